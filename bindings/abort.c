@@ -32,6 +32,7 @@ static void puts(const char *s)
 
 void _assert_fail(const char *file, const char *line, const char *e)
 {
+    console_flush();
     puts("Solo5: ABORT: ");
     puts(file);
     puts(":");
@@ -44,6 +45,7 @@ void _assert_fail(const char *file, const char *line, const char *e)
 
 void _abort(const char *file, const char *line, const char *s, void *regs_hint)
 {
+    console_flush();
     puts("Solo5: ABORT: ");
     puts(file);
     puts(":");
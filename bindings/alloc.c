@@ -0,0 +1,641 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * alloc.c: Optional memory allocator for Solo5 applications, see
+ * solo5_alloc.h. Built into solo5_alloc.o, not into the bindings.
+ *
+ * Memory is managed in pages, described by an array of struct page at the
+ * start of the managed range. Pages are grouped into spans: free spans, in
+ * the page heap's bins by size; slabs of objects of one size class; and
+ * large allocations (including arena chunks). The first page of a span
+ * describes it; the last, and for slabs every page, points back to the
+ * first, so that spans can be coalesced with their neighbours when freed and
+ * objects can be mapped to their slab.
+ */
+
+#include "solo5_alloc.h"
+
+#define PAGE_SIZE SOLO5_PAGE_SIZE
+#define HUGE_PAGES (SOLO5_ALLOC_HUGE_SIZE / PAGE_SIZE)
+
+#define NIL UINT32_MAX
+
+#define CLS_FREE 0xfe                   /* Free span in the page heap */
+#define CLS_LARGE 0xff                  /* Large allocation or arena chunk */
+
+struct page {
+    uint32_t first;                     /* First page of the span */
+    uint32_t npages;                    /* Pages in the span */
+    uint32_t next;                      /* Next span in list, or NIL */
+    uint32_t prev;                      /* Previous span in list, or NIL */
+    uint32_t free;                      /* Slabs: first free object, or NIL */
+    uint16_t nfree;                     /* Slabs: number of free objects */
+    uint8_t cls;                        /* Size class, or CLS_* */
+    uint8_t released;                   /* Free spans: released to the host */
+};
+
+static struct page *pages;
+static uintptr_t heap_base;
+static uint32_t heap_pages;
+
+/*
+ * Page heap. Free spans of n pages are kept in bins[n], except for those of
+ * NBINS - 1 pages or more, which are all kept in the last bin. No two free
+ * spans are adjacent.
+ */
+#define NBINS 129
+
+static uint32_t bins[NBINS];
+static int heap_lock;
+
+/*
+ * Size classes are multiples of 16 bytes up to 128 bytes, then 4 per power
+ * of 2 up to SOLO5_ALLOC_SMALL_MAX.
+ */
+#define NCLASSES 40
+
+/*
+ * Slabs of each size class with free objects.
+ */
+static struct central {
+    int lock;
+    uint32_t spans;
+    uint32_t nspans;
+} __attribute__((aligned(64))) central[NCLASSES];
+
+/*
+ * Per-CPU caches of free objects, linked through their first word.
+ */
+static struct cpu_cache {
+    struct {
+        void *head;
+        uint32_t count;
+    } c[NCLASSES];
+} __attribute__((aligned(64))) caches[SOLO5_ALLOC_CPUS_MAX];
+
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__)
+    __asm__ __volatile__("pause" ::: "memory");
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield" ::: "memory");
+#else
+    __asm__ __volatile__("" ::: "memory");
+#endif
+}
+
+static void spin_lock(int *lock)
+{
+    while (__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE))
+        while (__atomic_load_n(lock, __ATOMIC_RELAXED))
+            cpu_relax();
+}
+
+static void spin_unlock(int *lock)
+{
+    __atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+}
+
+static inline uintptr_t align_up(uintptr_t v, uintptr_t align)
+{
+    return (v + align - 1) & ~(align - 1);
+}
+
+static inline uint8_t *page_addr(uint32_t pg)
+{
+    return (uint8_t *)(heap_base + (uintptr_t)pg * PAGE_SIZE);
+}
+
+static inline uint32_t page_of(const void *p)
+{
+    return ((uintptr_t)p - heap_base) / PAGE_SIZE;
+}
+
+static unsigned size_class(size_t size)
+{
+    if (size <= 128)
+        return (size + 15) / 16 - 1;
+    unsigned b = 63 - __builtin_clzll(size - 1);
+    return 8 + (b - 7) * 4 + ((size - 1) >> (b - 2)) - 4;
+}
+
+static size_t class_size(unsigned cls)
+{
+    if (cls < 8)
+        return (cls + 1) * 16;
+    unsigned b = 7 + (cls - 8) / 4;
+    return (size_t)((cls - 8) % 4 + 5) << (b - 2);
+}
+
+/*
+ * Slabs hold at least 8 objects.
+ */
+static uint32_t slab_pages(unsigned cls)
+{
+    return align_up(class_size(cls) * 8, PAGE_SIZE) / PAGE_SIZE;
+}
+
+static uint32_t slab_objects(unsigned cls)
+{
+    return slab_pages(cls) * PAGE_SIZE / class_size(cls);
+}
+
+/*
+ * Number of objects moved between a CPU cache and the slabs at once. A CPU
+ * caches at most twice this.
+ */
+static uint32_t cache_batch(unsigned cls)
+{
+    size_t n = 16384 / class_size(cls);
+    return n < 2 ? 2 : n > 32 ? 32 : n;
+}
+
+static void list_push(uint32_t *head, uint32_t s)
+{
+    pages[s].prev = NIL;
+    pages[s].next = *head;
+    if (*head != NIL)
+        pages[*head].prev = s;
+    *head = s;
+}
+
+static void list_remove(uint32_t *head, uint32_t s)
+{
+    if (pages[s].prev != NIL)
+        pages[pages[s].prev].next = pages[s].next;
+    else
+        *head = pages[s].next;
+    if (pages[s].next != NIL)
+        pages[pages[s].next].prev = pages[s].prev;
+}
+
+static uint32_t *bin_of(uint32_t n)
+{
+    return &bins[n < NBINS - 1 ? n : NBINS - 1];
+}
+
+static void span_set(uint32_t s, uint32_t n, uint8_t cls)
+{
+    pages[s].first = s;
+    pages[s].npages = n;
+    pages[s].cls = cls;
+    pages[s + n - 1].first = s;
+}
+
+static void heap_insert(uint32_t s, uint32_t n, bool released)
+{
+    span_set(s, n, CLS_FREE);
+    pages[s].released = released;
+    list_push(bin_of(n), s);
+}
+
+/*
+ * Allocates (n) pages aligned to (align) pages, a power of 2, from the page
+ * heap, first fit. Returns the first page, or NIL. Called with heap_lock
+ * held.
+ */
+static uint32_t heap_alloc(uint32_t n, uint32_t align)
+{
+    uintptr_t align_bytes = (uintptr_t)align * PAGE_SIZE;
+
+    for (uint32_t *bin = bin_of(n); bin < &bins[NBINS]; bin++) {
+        for (uint32_t s = *bin; s != NIL; s = pages[s].next) {
+            uint32_t t = (align_up((uintptr_t)page_addr(s), align_bytes) -
+                    heap_base) / PAGE_SIZE;
+            uint32_t total = pages[s].npages;
+            if ((uint64_t)t + n > (uint64_t)s + total)
+                continue;
+
+            bool released = pages[s].released;
+            list_remove(bin, s);
+            if (t > s)
+                heap_insert(s, t - s, released);
+            if (t + n < s + total)
+                heap_insert(t + n, s + total - (t + n), released);
+            return t;
+        }
+    }
+    return NIL;
+}
+
+/*
+ * Returns the (n) pages at (s) to the page heap, coalescing them with free
+ * neighbouring spans. Called with heap_lock held.
+ */
+static void heap_free(uint32_t s, uint32_t n)
+{
+    if (s > 0) {
+        uint32_t p = pages[s - 1].first;
+        if (pages[p].cls == CLS_FREE) {
+            list_remove(bin_of(pages[p].npages), p);
+            n += pages[p].npages;
+            s = p;
+        }
+    }
+    uint32_t e = s + n;
+    if (e < heap_pages && pages[e].cls == CLS_FREE) {
+        list_remove(bin_of(pages[e].npages), e);
+        n += pages[e].npages;
+    }
+    heap_insert(s, n, false);
+}
+
+static void *large_alloc(size_t size, size_t align)
+{
+    if (size > (size_t)heap_pages * PAGE_SIZE)
+        return NULL;
+    uint32_t n = align_up(size, PAGE_SIZE) / PAGE_SIZE;
+    uint32_t align_pages = align / PAGE_SIZE;
+    uint32_t s = NIL;
+
+    spin_lock(&heap_lock);
+    /*
+     * Huge allocations get whole huge pages, if the page heap has any left.
+     */
+    if (size >= SOLO5_ALLOC_HUGE_SIZE) {
+        uint32_t nh = align_up(n, HUGE_PAGES);
+        s = heap_alloc(nh, align_pages > HUGE_PAGES ? align_pages : HUGE_PAGES);
+        if (s != NIL)
+            n = nh;
+    }
+    if (s == NIL)
+        s = heap_alloc(n, align_pages);
+    if (s != NIL)
+        span_set(s, n, CLS_LARGE);
+    spin_unlock(&heap_lock);
+    return s == NIL ? NULL : page_addr(s);
+}
+
+static void large_free(uint32_t s)
+{
+    spin_lock(&heap_lock);
+    heap_free(s, pages[s].npages);
+    spin_unlock(&heap_lock);
+}
+
+/*
+ * Allocates a slab of (cls) from the page heap, linking all of its objects
+ * into its free list. Returns its first page, or NIL.
+ */
+static uint32_t slab_new(unsigned cls)
+{
+    uint32_t n = slab_pages(cls);
+
+    spin_lock(&heap_lock);
+    uint32_t s = heap_alloc(n, 1);
+    spin_unlock(&heap_lock);
+    if (s == NIL)
+        return NIL;
+
+    for (uint32_t i = 0; i < n; i++)
+        pages[s + i].first = s;
+    pages[s].npages = n;
+    pages[s].cls = cls;
+
+    size_t size = class_size(cls);
+    uint32_t count = slab_objects(cls);
+    uint8_t *p = page_addr(s);
+    for (uint32_t i = 0; i < count; i++)
+        *(uint32_t *)(p + i * size) = (i + 1 < count) ? (i + 1) * size : NIL;
+    pages[s].free = 0;
+    pages[s].nfree = count;
+    return s;
+}
+
+/*
+ * Moves up to a batch of free objects of (cls) from the slabs to the cache
+ * of (cpu), which is empty. Returns false if there is no free memory.
+ */
+static bool cache_refill(unsigned cpu, unsigned cls)
+{
+    struct central *ce = &central[cls];
+    uint32_t batch = cache_batch(cls);
+    void *head = NULL;
+    uint32_t count = 0;
+
+    spin_lock(&ce->lock);
+    while (count < batch) {
+        uint32_t s = ce->spans;
+        if (s == NIL) {
+            s = slab_new(cls);
+            if (s == NIL)
+                break;
+            list_push(&ce->spans, s);
+            ce->nspans++;
+        }
+        uint8_t *p = page_addr(s);
+        while (count < batch && pages[s].free != NIL) {
+            void *obj = p + pages[s].free;
+            pages[s].free = *(uint32_t *)obj;
+            pages[s].nfree--;
+            *(void **)obj = head;
+            head = obj;
+            count++;
+        }
+        if (pages[s].free == NIL) {
+            list_remove(&ce->spans, s);
+            ce->nspans--;
+        }
+    }
+    spin_unlock(&ce->lock);
+
+    caches[cpu].c[cls].head = head;
+    caches[cpu].c[cls].count = count;
+    return count != 0;
+}
+
+/*
+ * Returns (n) objects from the cache of (cpu) to their slabs. Slabs which
+ * become entirely free are returned to the page heap, unless they are the
+ * only slab of (cls) with free objects.
+ */
+static void cache_flush(unsigned cpu, unsigned cls, uint32_t n)
+{
+    struct central *ce = &central[cls];
+    void *head = caches[cpu].c[cls].head;
+    uint32_t capacity = slab_objects(cls);
+
+    spin_lock(&ce->lock);
+    for (uint32_t i = 0; i < n; i++) {
+        void *obj = head;
+        head = *(void **)obj;
+
+        uint32_t s = pages[page_of(obj)].first;
+        bool was_full = pages[s].free == NIL;
+        *(uint32_t *)obj = pages[s].free;
+        pages[s].free = (uint8_t *)obj - page_addr(s);
+        pages[s].nfree++;
+        if (was_full) {
+            list_push(&ce->spans, s);
+            ce->nspans++;
+        }
+        if (pages[s].nfree == capacity && ce->nspans > 1) {
+            list_remove(&ce->spans, s);
+            ce->nspans--;
+            large_free(s);
+        }
+    }
+    spin_unlock(&ce->lock);
+
+    caches[cpu].c[cls].head = head;
+    caches[cpu].c[cls].count -= n;
+}
+
+static void *class_alloc(unsigned cpu, unsigned cls)
+{
+    if (caches[cpu].c[cls].count == 0 && !cache_refill(cpu, cls))
+        return NULL;
+    void *obj = caches[cpu].c[cls].head;
+    caches[cpu].c[cls].head = *(void **)obj;
+    caches[cpu].c[cls].count--;
+    return obj;
+}
+
+solo5_result_t solo5_alloc_init(uintptr_t start, size_t size)
+{
+    uintptr_t s = align_up(start, PAGE_SIZE);
+    uintptr_t e = (start + size) & ~(uintptr_t)(PAGE_SIZE - 1);
+
+    if (e <= s)
+        return SOLO5_R_EINVAL;
+    size_t total = (e - s) / PAGE_SIZE;
+    size_t meta = align_up(total * sizeof (struct page), PAGE_SIZE) /
+        PAGE_SIZE;
+    if (total < meta + 16)
+        return SOLO5_R_EINVAL;
+    if (total - meta >= NIL)
+        total = meta + NIL - 1;
+
+    pages = (struct page *)s;
+    heap_base = s + meta * PAGE_SIZE;
+    heap_pages = total - meta;
+    for (unsigned i = 0; i < NBINS; i++)
+        bins[i] = NIL;
+    for (unsigned i = 0; i < NCLASSES; i++)
+        central[i].spans = NIL;
+    heap_insert(0, heap_pages, false);
+    return SOLO5_R_OK;
+}
+
+void *solo5_alloc(unsigned cpu, size_t size)
+{
+    if (size == 0)
+        return NULL;
+    if (size <= SOLO5_ALLOC_SMALL_MAX)
+        return class_alloc(cpu, size_class(size));
+    return large_alloc(size, PAGE_SIZE);
+}
+
+void *solo5_alloc_aligned(unsigned cpu, size_t align, size_t size)
+{
+    if (size == 0 || align == 0 || (align & (align - 1)) != 0)
+        return NULL;
+    if (align <= 16)
+        return solo5_alloc(cpu, size);
+    if (align > PAGE_SIZE || size > SOLO5_ALLOC_SMALL_MAX)
+        return large_alloc(size, align > PAGE_SIZE ? align : PAGE_SIZE);
+
+    /*
+     * Slabs start on a page boundary, so objects of a class whose size is a
+     * multiple of (align) are aligned. Every fourth class is a power of 2.
+     */
+    size = align_up(size, align);
+    if (size > SOLO5_ALLOC_SMALL_MAX)
+        return large_alloc(size, PAGE_SIZE);
+    unsigned cls = size_class(size);
+    while (class_size(cls) % align != 0)
+        cls++;
+    return class_alloc(cpu, cls);
+}
+
+void solo5_free(unsigned cpu, void *ptr)
+{
+    if (ptr == NULL)
+        return;
+    uint32_t s = pages[page_of(ptr)].first;
+    unsigned cls = pages[s].cls;
+    if (cls == CLS_LARGE) {
+        large_free(s);
+        return;
+    }
+
+    *(void **)ptr = caches[cpu].c[cls].head;
+    caches[cpu].c[cls].head = ptr;
+    caches[cpu].c[cls].count++;
+    if (caches[cpu].c[cls].count > 2 * cache_batch(cls))
+        cache_flush(cpu, cls, cache_batch(cls));
+}
+
+size_t solo5_alloc_usable_size(const void *ptr)
+{
+    uint32_t s = pages[page_of(ptr)].first;
+
+    if (pages[s].cls == CLS_LARGE)
+        return (size_t)pages[s].npages * PAGE_SIZE;
+    return class_size(pages[s].cls);
+}
+
+void *solo5_realloc(unsigned cpu, void *ptr, size_t size)
+{
+    if (ptr == NULL)
+        return solo5_alloc(cpu, size);
+    if (size == 0) {
+        solo5_free(cpu, ptr);
+        return NULL;
+    }
+
+    /*
+     * Allocations are kept in place unless they shrink to less than half.
+     */
+    size_t usable = solo5_alloc_usable_size(ptr);
+    if (size <= usable && size > usable / 2)
+        return ptr;
+    void *p = solo5_alloc(cpu, size);
+    if (p == NULL)
+        return (size <= usable) ? ptr : NULL;
+    __builtin_memcpy(p, ptr, size < usable ? size : usable);
+    solo5_free(cpu, ptr);
+    return p;
+}
+
+void solo5_alloc_flush(unsigned cpu)
+{
+    for (unsigned cls = 0; cls < NCLASSES; cls++) {
+        if (caches[cpu].c[cls].count != 0)
+            cache_flush(cpu, cls, caches[cpu].c[cls].count);
+    }
+}
+
+size_t solo5_alloc_trim(void)
+{
+    size_t released = 0;
+
+    /*
+     * Return the slabs kept although entirely free to the page heap first.
+     */
+    for (unsigned cls = 0; cls < NCLASSES; cls++) {
+        struct central *ce = &central[cls];
+        uint32_t capacity = slab_objects(cls);
+
+        spin_lock(&ce->lock);
+        uint32_t s = ce->spans;
+        while (s != NIL) {
+            uint32_t next = pages[s].next;
+            if (pages[s].nfree == capacity) {
+                list_remove(&ce->spans, s);
+                ce->nspans--;
+                large_free(s);
+            }
+            s = next;
+        }
+        spin_unlock(&ce->lock);
+    }
+
+    spin_lock(&heap_lock);
+    for (unsigned i = 0; i < NBINS; i++) {
+        for (uint32_t s = bins[i]; s != NIL; s = pages[s].next) {
+            if (pages[s].released)
+                continue;
+            size_t len = (size_t)pages[s].npages * PAGE_SIZE;
+            solo5_result_t rc =
+                solo5_mem_release((uintptr_t)page_addr(s), len);
+            if (rc == SOLO5_R_EUNSPEC)
+                goto out;
+            if (rc == SOLO5_R_OK) {
+                pages[s].released = true;
+                released += len;
+            }
+        }
+    }
+out:
+    spin_unlock(&heap_lock);
+    return released;
+}
+
+/*
+ * Arenas. Each chunk starts with a struct chunk, linking it to the chunk
+ * obtained before it.
+ */
+#define ARENA_CHUNK_SIZE (64 * 1024)
+
+struct chunk {
+    struct chunk *prev;
+    uintptr_t pad;
+};
+
+void solo5_arena_init(struct solo5_arena *arena, size_t chunk_size)
+{
+    arena->cur = 0;
+    arena->end = 0;
+    arena->chunks = NULL;
+    arena->chunk_size = chunk_size ?
+        align_up(chunk_size, PAGE_SIZE) : ARENA_CHUNK_SIZE;
+}
+
+void *solo5_arena_alloc(struct solo5_arena *arena, size_t size, size_t align)
+{
+    if (size == 0 || align == 0 || (align & (align - 1)) != 0 ||
+            align > PAGE_SIZE || size > (size_t)heap_pages * PAGE_SIZE)
+        return NULL;
+
+    uintptr_t p = align_up(arena->cur, align);
+    if (arena->chunks == NULL || p > arena->end || size > arena->end - p) {
+        size_t need = align_up(sizeof (struct chunk) + size + align - 1,
+                PAGE_SIZE);
+        size_t len = need > arena->chunk_size ? need : arena->chunk_size;
+        struct chunk *c = large_alloc(len, PAGE_SIZE);
+        if (c == NULL)
+            return NULL;
+        c->prev = arena->chunks;
+        arena->chunks = c;
+        arena->cur = (uintptr_t)(c + 1);
+        arena->end = (uintptr_t)c + solo5_alloc_usable_size(c);
+        p = align_up(arena->cur, align);
+    }
+    arena->cur = p + size;
+    return (void *)p;
+}
+
+void solo5_arena_reset(struct solo5_arena *arena)
+{
+    struct chunk *c = arena->chunks;
+
+    if (c == NULL)
+        return;
+    while (c->prev != NULL) {
+        struct chunk *prev = c->prev->prev;
+        large_free(page_of(c->prev));
+        c->prev = prev;
+    }
+    arena->cur = (uintptr_t)(c + 1);
+}
+
+void solo5_arena_destroy(struct solo5_arena *arena)
+{
+    struct chunk *c = arena->chunks;
+
+    while (c != NULL) {
+        struct chunk *prev = c->prev;
+        large_free(page_of(c));
+        c = prev;
+    }
+    solo5_arena_init(arena, arena->chunk_size);
+}
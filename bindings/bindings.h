@@ -80,6 +80,7 @@ void _abort(const char *, const char *, const char *, void *)
 
 /* cpu_<architecture>.c: low-level CPU functions */
 void cpu_init(void);
+void cpu_init_secondary(void);
 void cpu_halt(void) __attribute__((noreturn));
 void cpu_intr_enable(void);
 void cpu_intr_disable(void);
@@ -91,10 +92,360 @@ extern int cpu_intr_depth;
 void intr_register_irq(unsigned irq, int (*handler)(void *), void *arg);
 void intr_irq_handler(uint64_t irq);
 
+/* console_buf.c: buffered console output */
+void console_write(const char *buf, size_t size);
+void console_flush(void);
+
 /* mem.c: low-level page alloc routines */
 void mem_init(void);
 void *mem_ialloc_pages(size_t num);
 void mem_lock_heap(uintptr_t *start, size_t *size);
+void mem_huge_heap(uintptr_t *start, size_t *size);
+void *mem_alloc_pages(size_t num);
+void mem_free_pages(void *p, size_t num);
+
+/*
+ * net_loan.c: FIFO of buffers loaned with solo5_net_write_loan(). Buffers are
+ * pushed when loaned, completed (in order) once the device is done with them,
+ * and then reclaimed by the application.
+ */
+struct net_wloans {
+    const uint8_t *buf[SOLO5_NET_WRITE_LOANS_MAX];
+    unsigned head;              /* Next slot to push */
+    unsigned done;              /* First slot not yet completed */
+    unsigned tail;              /* First slot not yet reclaimed */
+};
+
+static inline bool net_wloans_full(const struct net_wloans *wl)
+{
+    return wl->head - wl->tail == SOLO5_NET_WRITE_LOANS_MAX;
+}
+
+void net_wloans_push(struct net_wloans *wl, const uint8_t *buf);
+void net_wloans_complete(struct net_wloans *wl, unsigned n);
+solo5_result_t net_wloans_reclaim(struct net_wloans *wl,
+        const uint8_t **bufs, size_t count, size_t *reclaimed);
+
+/*
+ * block_cq.c: Completions of asynchronous block requests, waiting to be reaped
+ * by the application. Requests are counted as (inflight) from submission
+ * until completed by the device, in any order.
+ */
+struct block_cq {
+    struct solo5_block_completion c[SOLO5_BLOCK_QUEUE_MAX];
+    unsigned head;              /* Next slot to complete into */
+    unsigned tail;              /* First slot not yet reaped */
+    unsigned inflight;          /* Submitted, not yet completed */
+};
+
+static inline bool block_cq_full(const struct block_cq *cq)
+{
+    return cq->inflight + (cq->head - cq->tail) == SOLO5_BLOCK_QUEUE_MAX;
+}
+
+static inline bool block_cq_ready(const struct block_cq *cq)
+{
+    return cq->head != cq->tail;
+}
+
+void block_cq_submit(struct block_cq *cq);
+void block_cq_complete(struct block_cq *cq, uint64_t tag,
+        solo5_result_t result);
+solo5_result_t block_cq_reap(struct block_cq *cq,
+        struct solo5_block_completion *completions, size_t count,
+        size_t *reaped);
+
+/*
+ * Returns true if a range of (size) bytes at (offset) is valid for a block
+ * device of (capacity) and (block_size), see solo5_block_discard().
+ */
+static inline bool block_range_valid(solo5_off_t capacity,
+        solo5_off_t block_size, solo5_off_t offset, solo5_off_t size)
+{
+    return size != 0 && !((offset | size) & (block_size - 1)) &&
+        offset <= capacity && size <= capacity - offset;
+}
+
+/*
+ * Returns true if a request of (size) bytes at (offset) is valid for a block
+ * device of (capacity) and (block_size), see solo5_block_write().
+ */
+static inline bool block_request_valid(solo5_off_t capacity,
+        solo5_off_t block_size, solo5_off_t offset, size_t size)
+{
+    return size <= SOLO5_BLOCK_IO_MAX &&
+        block_range_valid(capacity, block_size, offset, size);
+}
+
+/*
+ * block_zero.c: Writes zeroes to a (valid) range of a block device with
+ * solo5_block_writev(), for devices that cannot do so natively.
+ */
+solo5_result_t block_write_zeroes_slow(solo5_handle_t handle,
+        solo5_off_t offset, solo5_off_t size);
+
+/*
+ * Returns the total size of the segments in (iov[]), or 0 if (count) or the
+ * size of any segment is invalid for a block device of (block_size), see
+ * solo5_block_writev().
+ */
+static inline size_t block_iov_size(const struct solo5_block_iov *iov,
+        size_t count, solo5_off_t block_size)
+{
+    size_t total = 0;
+
+    if (count == 0 || count > SOLO5_BLOCK_IOV_MAX)
+        return 0;
+    for (size_t i = 0; i < count; i++) {
+        if (iov[i].size == 0 || iov[i].size > SOLO5_BLOCK_IO_MAX ||
+                (iov[i].size & (block_size - 1)))
+            return 0;
+        total += iov[i].size;
+    }
+    return total;
+}
+
+/*
+ * stats.c: Per-device I/O statistics, see solo5_net_stats(). Bindings count
+ * requests at their public entry points with the helpers below, which return
+ * the (result) they are given, and register devices with stats_acquire() once
+ * acquired. Block requests may be issued concurrently, so are counted
+ * atomically.
+ */
+extern struct solo5_net_stats __solo5_net_stats[MFT_MAX_ENTRIES];
+extern struct solo5_block_stats __solo5_block_stats[MFT_MAX_ENTRIES];
+
+void stats_acquire(solo5_handle_t handle, enum mft_type type);
+/*
+ * Returns true if (handle) was registered with stats_acquire() as (type).
+ */
+bool stats_acquired(solo5_handle_t handle, enum mft_type type);
+
+static inline solo5_result_t net_stats_rx(solo5_handle_t handle,
+        solo5_result_t result, size_t size)
+{
+    if (handle >= MFT_MAX_ENTRIES)
+        return result;
+    struct solo5_net_stats *s = &__solo5_net_stats[handle];
+    if (result == SOLO5_R_OK) {
+        s->rx_packets++;
+        s->rx_bytes += size;
+    }
+    else if (result == SOLO5_R_AGAIN)
+        s->rx_again++;
+    else
+        s->rx_errors++;
+    return result;
+}
+
+static inline solo5_result_t net_stats_tx(solo5_handle_t handle,
+        solo5_result_t result, size_t size)
+{
+    if (handle >= MFT_MAX_ENTRIES)
+        return result;
+    struct solo5_net_stats *s = &__solo5_net_stats[handle];
+    if (result == SOLO5_R_OK) {
+        s->tx_packets++;
+        s->tx_bytes += size;
+    }
+    else if (result == SOLO5_R_AGAIN)
+        s->tx_again++;
+    else
+        s->tx_errors++;
+    return result;
+}
+
+/*
+ * Counts the (n) packets received into (frames[]) if (result) is SOLO5_R_OK,
+ * as for solo5_net_readv().
+ */
+static inline solo5_result_t net_stats_rxv(solo5_handle_t handle,
+        solo5_result_t result, const struct solo5_net_frame *frames,
+        size_t n)
+{
+    if (result != SOLO5_R_OK)
+        return net_stats_rx(handle, result, 0);
+    for (size_t i = 0; i < n; i++)
+        (void)net_stats_rx(handle, frames[i].result, frames[i].size);
+    return result;
+}
+
+/*
+ * Counts the (count) packets in (frames[]) by their individual results, as
+ * set by solo5_net_writev().
+ */
+static inline solo5_result_t net_stats_txv(solo5_handle_t handle,
+        solo5_result_t result, const struct solo5_net_frame *frames,
+        size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        (void)net_stats_tx(handle, frames[i].result, frames[i].size);
+    return result;
+}
+
+enum block_stats_op {
+    BLOCK_STATS_READ,
+    BLOCK_STATS_WRITE,
+    BLOCK_STATS_FLUSH,
+    BLOCK_STATS_DISCARD
+};
+
+static inline solo5_result_t block_stats_op(solo5_handle_t handle,
+        enum block_stats_op op, solo5_result_t result, size_t size)
+{
+    if (handle >= MFT_MAX_ENTRIES)
+        return result;
+    struct solo5_block_stats *s = &__solo5_block_stats[handle];
+    if (result == SOLO5_R_AGAIN)        /* Queue full, not issued */
+        return result;
+    if (result != SOLO5_R_OK) {
+        __atomic_add_fetch(&s->errors, 1, __ATOMIC_RELAXED);
+        return result;
+    }
+    switch (op) {
+    case BLOCK_STATS_READ:
+        __atomic_add_fetch(&s->read_ops, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&s->read_bytes, size, __ATOMIC_RELAXED);
+        break;
+    case BLOCK_STATS_WRITE:
+        __atomic_add_fetch(&s->write_ops, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&s->write_bytes, size, __ATOMIC_RELAXED);
+        break;
+    case BLOCK_STATS_FLUSH:
+        __atomic_add_fetch(&s->flush_ops, 1, __ATOMIC_RELAXED);
+        break;
+    case BLOCK_STATS_DISCARD:
+        __atomic_add_fetch(&s->discard_ops, 1, __ATOMIC_RELAXED);
+        break;
+    }
+    return result;
+}
+
+/*
+ * Counts the failed requests among the (n) completions reaped into
+ * (completions[]) if (result) is SOLO5_R_OK, as for solo5_block_reap().
+ */
+static inline solo5_result_t block_stats_reap(solo5_handle_t handle,
+        solo5_result_t result, const struct solo5_block_completion *completions,
+        size_t n)
+{
+    if (result != SOLO5_R_OK || handle >= MFT_MAX_ENTRIES)
+        return result;
+    for (size_t i = 0; i < n; i++) {
+        if (completions[i].result != SOLO5_R_OK)
+            __atomic_add_fetch(&__solo5_block_stats[handle].errors, 1,
+                    __ATOMIC_RELAXED);
+    }
+    return result;
+}
+
+/*
+ * calls.c: Per-call counters, see solo5_call_stats(). The public calls which
+ * are counted are defined in calls.c, which times and counts each around a
+ * call to the target's implementation. Targets define these calls as usual:
+ * the macros below rename their definitions, and any calls made to them from
+ * within the bindings, which are thus not counted, to impl_<call>.
+ */
+bool impl_solo5_yield(solo5_time_t deadline, solo5_handle_set_t *ready_set);
+bool impl_solo5_yield_events(solo5_time_t deadline,
+        struct solo5_event *events, size_t count, size_t *nready);
+void impl_solo5_console_write(const char *buf, size_t size);
+solo5_result_t impl_solo5_net_read(solo5_handle_t handle, uint8_t *buf,
+        size_t size, size_t *read_size);
+solo5_result_t impl_solo5_net_readv(solo5_handle_t handle,
+        struct solo5_net_frame *frames, size_t count, size_t *read_count);
+solo5_result_t impl_solo5_net_read_loan(solo5_handle_t handle,
+        const uint8_t **buf, size_t *size);
+solo5_result_t impl_solo5_net_read_release(solo5_handle_t handle);
+solo5_result_t impl_solo5_net_write(solo5_handle_t handle, const uint8_t *buf,
+        size_t size);
+solo5_result_t impl_solo5_net_writev(solo5_handle_t handle,
+        struct solo5_net_frame *frames, size_t count);
+solo5_result_t impl_solo5_net_write_loan(solo5_handle_t handle,
+        const uint8_t *buf, size_t size);
+solo5_result_t impl_solo5_net_write_reclaim(solo5_handle_t handle,
+        const uint8_t **bufs, size_t count, size_t *reclaimed);
+solo5_result_t impl_solo5_block_read(solo5_handle_t handle,
+        solo5_off_t offset, uint8_t *buf, size_t size);
+solo5_result_t impl_solo5_block_readv(solo5_handle_t handle,
+        solo5_off_t offset, const struct solo5_block_iov *iov, size_t count);
+solo5_result_t impl_solo5_block_write(solo5_handle_t handle,
+        solo5_off_t offset, const uint8_t *buf, size_t size);
+solo5_result_t impl_solo5_block_writev(solo5_handle_t handle,
+        solo5_off_t offset, const struct solo5_block_iov *iov, size_t count);
+solo5_result_t impl_solo5_block_flush(solo5_handle_t handle);
+solo5_result_t impl_solo5_block_discard(solo5_handle_t handle,
+        solo5_off_t offset, solo5_off_t size);
+solo5_result_t impl_solo5_block_write_zeroes(solo5_handle_t handle,
+        solo5_off_t offset, solo5_off_t size);
+solo5_result_t impl_solo5_block_prefetch(solo5_handle_t handle,
+        solo5_off_t offset, solo5_off_t size);
+solo5_result_t impl_solo5_block_zone_append(solo5_handle_t handle,
+        solo5_off_t zone, const uint8_t *buf, size_t size,
+        solo5_off_t *offset);
+solo5_result_t impl_solo5_block_submit_read(solo5_handle_t handle,
+        solo5_off_t offset, uint8_t *buf, size_t size, uint64_t tag);
+solo5_result_t impl_solo5_block_submit_write(solo5_handle_t handle,
+        solo5_off_t offset, const uint8_t *buf, size_t size, uint64_t tag);
+solo5_result_t impl_solo5_block_submit_read_fixed(solo5_handle_t handle,
+        solo5_off_t offset, unsigned index, size_t buf_offset, size_t size,
+        uint64_t tag);
+solo5_result_t impl_solo5_block_submit_write_fixed(solo5_handle_t handle,
+        solo5_off_t offset, unsigned index, size_t buf_offset, size_t size,
+        uint64_t tag);
+solo5_result_t impl_solo5_block_submit_flush(solo5_handle_t handle,
+        uint64_t tag);
+solo5_result_t impl_solo5_block_reap(solo5_handle_t handle,
+        struct solo5_block_completion *completions, size_t count,
+        size_t *reaped);
+solo5_result_t impl_solo5_shm_notify(solo5_handle_t handle);
+solo5_result_t impl_solo5_vsock_read(solo5_handle_t handle, uint8_t *buf,
+        size_t size, size_t *read_size);
+solo5_result_t impl_solo5_vsock_write(solo5_handle_t handle,
+        const uint8_t *buf, size_t size, size_t *written);
+solo5_result_t impl_solo5_mem_release(uintptr_t addr, size_t size);
+
+/*
+ * Defined by calls.c itself, and by targets which do not count calls.
+ */
+#ifndef BINDINGS_NO_CALL_COUNTERS
+#define solo5_yield impl_solo5_yield
+#define solo5_yield_events impl_solo5_yield_events
+#define solo5_console_write impl_solo5_console_write
+#define solo5_net_read impl_solo5_net_read
+#define solo5_net_readv impl_solo5_net_readv
+#define solo5_net_read_loan impl_solo5_net_read_loan
+#define solo5_net_read_release impl_solo5_net_read_release
+#define solo5_net_write impl_solo5_net_write
+#define solo5_net_writev impl_solo5_net_writev
+#define solo5_net_write_loan impl_solo5_net_write_loan
+#define solo5_net_write_reclaim impl_solo5_net_write_reclaim
+#define solo5_block_read impl_solo5_block_read
+#define solo5_block_readv impl_solo5_block_readv
+#define solo5_block_write impl_solo5_block_write
+#define solo5_block_writev impl_solo5_block_writev
+#define solo5_block_flush impl_solo5_block_flush
+#define solo5_block_discard impl_solo5_block_discard
+#define solo5_block_write_zeroes impl_solo5_block_write_zeroes
+#define solo5_block_prefetch impl_solo5_block_prefetch
+#define solo5_block_zone_append impl_solo5_block_zone_append
+#define solo5_block_submit_read impl_solo5_block_submit_read
+#define solo5_block_submit_write impl_solo5_block_submit_write
+#define solo5_block_submit_read_fixed impl_solo5_block_submit_read_fixed
+#define solo5_block_submit_write_fixed impl_solo5_block_submit_write_fixed
+#define solo5_block_submit_flush impl_solo5_block_submit_flush
+#define solo5_block_reap impl_solo5_block_reap
+#define solo5_shm_notify impl_solo5_shm_notify
+#define solo5_vsock_read impl_solo5_vsock_read
+#define solo5_vsock_write impl_solo5_vsock_write
+#define solo5_mem_release impl_solo5_mem_release
+#endif
+
+/*
+ * Writes the counters of all calls made to the console, if "--solo5:calls"
+ * was given.
+ */
+void calls_dump(void);
 
 /* lib.c: minimal bits of stdc we need */
 void *memset(void *dest, int c, size_t n);
@@ -117,6 +468,27 @@ uint64_t platform_mem_size(void);
 void platform_exit(int status, void *cookie) __attribute__((noreturn));
 int platform_puts(const char *buf, int n);
 int platform_set_tls_base(uint64_t base);
+/*
+ * Give the memory at (addr, size), page-aligned and within the heap, back to
+ * the host. Returns -1 if this is not supported.
+ */
+int platform_mem_release(uint64_t addr, size_t size);
+/*
+ * Returns true if the host has asked for memory to be released since the
+ * last call.
+ */
+bool platform_mem_reclaim_requested(void);
+/*
+ * Returns the set of network devices which the host reports can accept
+ * packets again since a write to them returned SOLO5_R_AGAIN, and clears it.
+ */
+solo5_handle_set_t platform_net_writable_set(void);
+
+/*
+ * Stores the time (cpu) has been ready to run but not running, as reported by
+ * the host, in (*steal). Returns false if this is not supported.
+ */
+bool platform_cpu_steal(unsigned cpu, solo5_time_t *steal);
 
 /* platform_intr.c: platform-specific interrupt handling */
 void platform_intr_init(void);
@@ -124,8 +496,31 @@ void platform_intr_clear_irq(unsigned irq);
 void platform_intr_mask_irq(unsigned irq);
 void platform_intr_ack_irq(unsigned irq);
 
+/*
+ * cpu_time.c: CPU time accounting, see solo5_cpu_time(). Platforms call
+ * cpu_time_start() and cpu_time_stop() on each CPU as it starts running and
+ * stops, and cpu_time_idle() with the time at which they started blocking
+ * once they are done.
+ */
+#define CPU_TIME_CPUS_MAX 64
+
+void cpu_time_start(unsigned cpu);
+void cpu_time_stop(unsigned cpu);
+void cpu_time_idle(solo5_time_t since);
+
+/*
+ * steal_kvm.c: Steal time reported by KVM to each CPU (x86_64 only). Each
+ * CPU registers its own record on start.
+ */
+void steal_init(void);
+void steal_init_secondary(unsigned cpu);
+void steal_restore(void);
+
 /* cmdline.c: command line parsing */
 char *cmdline_parse(const char *cmdline);
+extern bool cmdline_net_offload;        /* --solo5:net-offload, virtio only */
+extern bool cmdline_profile;            /* --solo5:profile, virtio only */
+extern bool cmdline_calls;              /* --solo5:calls */
 
 /* log.c: */
 typedef enum {
@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * block_buffers.c: Registered block buffers, for targets on which the host
+ * has no use for them. Requests for a registered buffer are checked against
+ * it and submitted as any other.
+ */
+
+#include "bindings.h"
+
+static struct {
+    uint8_t *buf;
+    size_t size;
+} block_buffers[MFT_MAX_ENTRIES][SOLO5_BLOCK_BUFFERS_MAX];
+static unsigned block_nbuffers[MFT_MAX_ENTRIES];
+
+solo5_result_t solo5_block_register_buffer(solo5_handle_t handle,
+        uint8_t *buf, size_t size, unsigned *index)
+{
+    if (!stats_acquired(handle, MFT_BLOCK_BASIC) || size == 0)
+        return SOLO5_R_EINVAL;
+    unsigned n = block_nbuffers[handle];
+    if (n == SOLO5_BLOCK_BUFFERS_MAX)
+        return SOLO5_R_AGAIN;
+
+    block_buffers[handle][n].buf = buf;
+    block_buffers[handle][n].size = size;
+    block_nbuffers[handle]++;
+    *index = n;
+    return SOLO5_R_OK;
+}
+
+/*
+ * Returns the address of the (size) bytes at (buf_offset) in registered
+ * buffer (index), or NULL if these are not within the buffer.
+ */
+static uint8_t *block_buffer(solo5_handle_t handle, unsigned index,
+        size_t buf_offset, size_t size)
+{
+    if (handle >= MFT_MAX_ENTRIES || index >= block_nbuffers[handle] ||
+            buf_offset > block_buffers[handle][index].size ||
+            size > block_buffers[handle][index].size - buf_offset)
+        return NULL;
+    return block_buffers[handle][index].buf + buf_offset;
+}
+
+solo5_result_t solo5_block_submit_read_fixed(solo5_handle_t handle,
+        solo5_off_t offset, unsigned index, size_t buf_offset, size_t size,
+        uint64_t tag)
+{
+    uint8_t *buf = block_buffer(handle, index, buf_offset, size);
+    if (buf == NULL)
+        return block_stats_op(handle, BLOCK_STATS_READ, SOLO5_R_EINVAL, size);
+    return solo5_block_submit_read(handle, offset, buf, size, tag);
+}
+
+solo5_result_t solo5_block_submit_write_fixed(solo5_handle_t handle,
+        solo5_off_t offset, unsigned index, size_t buf_offset, size_t size,
+        uint64_t tag)
+{
+    uint8_t *buf = block_buffer(handle, index, buf_offset, size);
+    if (buf == NULL)
+        return block_stats_op(handle, BLOCK_STATS_WRITE, SOLO5_R_EINVAL,
+                size);
+    return solo5_block_submit_write(handle, offset, buf, size, tag);
+}
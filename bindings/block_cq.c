@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * block_cq.c: Completion queue for asynchronous block I/O.
+ */
+
+#include "bindings.h"
+
+void block_cq_submit(struct block_cq *cq)
+{
+    assert(!block_cq_full(cq));
+    cq->inflight++;
+}
+
+void block_cq_complete(struct block_cq *cq, uint64_t tag,
+        solo5_result_t result)
+{
+    assert(cq->inflight > 0);
+    cq->inflight--;
+    cq->c[cq->head % SOLO5_BLOCK_QUEUE_MAX].tag = tag;
+    cq->c[cq->head % SOLO5_BLOCK_QUEUE_MAX].result = result;
+    cq->head++;
+}
+
+solo5_result_t block_cq_reap(struct block_cq *cq,
+        struct solo5_block_completion *completions, size_t count,
+        size_t *reaped)
+{
+    size_t n;
+
+    for (n = 0; n < count && cq->tail != cq->head; n++, cq->tail++)
+        completions[n] = cq->c[cq->tail % SOLO5_BLOCK_QUEUE_MAX];
+    if (n == 0)
+        return SOLO5_R_AGAIN;
+    *reaped = n;
+    return SOLO5_R_OK;
+}
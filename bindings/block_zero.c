@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * block_zero.c: Writing zeroes to block devices without native support.
+ */
+
+#include "bindings.h"
+
+/*
+ * Each request writes up to SOLO5_BLOCK_IO_MAX bytes, as segments all
+ * pointing to (zeroes). The segment size is a multiple of any block size we
+ * support, so that only the last request of a range may be shorter.
+ */
+#define ZERO_SEG_SIZE (64 * 1024)
+#define ZERO_SEG_MAX (SOLO5_BLOCK_IO_MAX / ZERO_SEG_SIZE)
+
+static uint8_t zeroes[ZERO_SEG_SIZE] __attribute__((aligned(4096)));
+
+solo5_result_t block_write_zeroes_slow(solo5_handle_t handle,
+        solo5_off_t offset, solo5_off_t size)
+{
+    struct solo5_block_iov iov[ZERO_SEG_MAX];
+
+    while (size > 0) {
+        size_t count = 0;
+        solo5_off_t len = 0;
+
+        for (; count < ZERO_SEG_MAX && len < size; count++) {
+            iov[count].buf = zeroes;
+            iov[count].size = (size - len < ZERO_SEG_SIZE) ?
+                size - len : ZERO_SEG_SIZE;
+            len += iov[count].size;
+        }
+        solo5_result_t rc = solo5_block_writev(handle, offset, iov, count);
+        if (rc != SOLO5_R_OK)
+            return rc;
+        offset += len;
+        size -= len;
+    }
+    return SOLO5_R_OK;
+}
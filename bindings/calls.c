@@ -0,0 +1,454 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * calls.c: Per-call counters, see solo5_call_stats().
+ */
+
+#define BINDINGS_NO_CALL_COUNTERS
+#include "bindings.h"
+
+#if defined(__x86_64__)
+#define READ_CPU_TICKS cpu_rdtsc
+#elif defined(__aarch64__)
+#define READ_CPU_TICKS cpu_cntvct
+#else
+#error Unsupported architecture
+#endif
+
+/*
+ * Indexed by handle, with calls which do not take a handle counted under
+ * CALLS_NO_HANDLE. Calls may be made concurrently, so are counted
+ * atomically.
+ */
+#define CALLS_NO_HANDLE MFT_MAX_ENTRIES
+
+static struct solo5_call_stats calls[MFT_MAX_ENTRIES + 1][SOLO5_CALL_MAX];
+
+static const char *const call_names[SOLO5_CALL_MAX] = {
+    [SOLO5_CALL_YIELD] = "yield",
+    [SOLO5_CALL_YIELD_EVENTS] = "yield_events",
+    [SOLO5_CALL_CONSOLE_WRITE] = "console_write",
+    [SOLO5_CALL_NET_READ] = "net_read",
+    [SOLO5_CALL_NET_READV] = "net_readv",
+    [SOLO5_CALL_NET_READ_LOAN] = "net_read_loan",
+    [SOLO5_CALL_NET_READ_RELEASE] = "net_read_release",
+    [SOLO5_CALL_NET_WRITE] = "net_write",
+    [SOLO5_CALL_NET_WRITEV] = "net_writev",
+    [SOLO5_CALL_NET_WRITE_LOAN] = "net_write_loan",
+    [SOLO5_CALL_NET_WRITE_RECLAIM] = "net_write_reclaim",
+    [SOLO5_CALL_BLOCK_READ] = "block_read",
+    [SOLO5_CALL_BLOCK_READV] = "block_readv",
+    [SOLO5_CALL_BLOCK_WRITE] = "block_write",
+    [SOLO5_CALL_BLOCK_WRITEV] = "block_writev",
+    [SOLO5_CALL_BLOCK_FLUSH] = "block_flush",
+    [SOLO5_CALL_BLOCK_DISCARD] = "block_discard",
+    [SOLO5_CALL_BLOCK_WRITE_ZEROES] = "block_write_zeroes",
+    [SOLO5_CALL_BLOCK_PREFETCH] = "block_prefetch",
+    [SOLO5_CALL_BLOCK_ZONE_APPEND] = "block_zone_append",
+    [SOLO5_CALL_BLOCK_SUBMIT_READ] = "block_submit_read",
+    [SOLO5_CALL_BLOCK_SUBMIT_WRITE] = "block_submit_write",
+    [SOLO5_CALL_BLOCK_SUBMIT_READ_FIXED] = "block_submit_read_fixed",
+    [SOLO5_CALL_BLOCK_SUBMIT_WRITE_FIXED] = "block_submit_write_fixed",
+    [SOLO5_CALL_BLOCK_SUBMIT_FLUSH] = "block_submit_flush",
+    [SOLO5_CALL_BLOCK_REAP] = "block_reap",
+    [SOLO5_CALL_SHM_NOTIFY] = "shm_notify",
+    [SOLO5_CALL_VSOCK_READ] = "vsock_read",
+    [SOLO5_CALL_VSOCK_WRITE] = "vsock_write",
+    [SOLO5_CALL_MEM_RELEASE] = "mem_release"
+};
+
+static void record(solo5_handle_t handle, enum solo5_call call,
+        uint64_t start, bool again, uint64_t bytes)
+{
+    uint64_t cycles = READ_CPU_TICKS() - start;
+
+    if (handle > CALLS_NO_HANDLE)
+        return;
+    struct solo5_call_stats *s = &calls[handle][call];
+    __atomic_add_fetch(&s->calls, 1, __ATOMIC_RELAXED);
+    if (bytes != 0)
+        __atomic_add_fetch(&s->bytes, bytes, __ATOMIC_RELAXED);
+    if (again)
+        __atomic_add_fetch(&s->again, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&s->cycles, cycles, __ATOMIC_RELAXED);
+}
+
+/*
+ * Counts a call on the device (handle), returning its (result). Calls on
+ * invalid handles, which the implementation has rejected, are not counted.
+ */
+static solo5_result_t record_dev(solo5_handle_t handle, enum solo5_call call,
+        uint64_t start, solo5_result_t result, uint64_t bytes)
+{
+    if (handle < MFT_MAX_ENTRIES)
+        record(handle, call, start, result == SOLO5_R_AGAIN,
+                result == SOLO5_R_OK ? bytes : 0);
+    return result;
+}
+
+static size_t frames_bytes(const struct solo5_net_frame *frames, size_t n)
+{
+    size_t bytes = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        if (frames[i].result == SOLO5_R_OK)
+            bytes += frames[i].size;
+    }
+    return bytes;
+}
+
+static size_t iov_bytes(const struct solo5_block_iov *iov, size_t count)
+{
+    size_t bytes = 0;
+
+    for (size_t i = 0; i < count; i++)
+        bytes += iov[i].size;
+    return bytes;
+}
+
+bool solo5_yield(solo5_time_t deadline, solo5_handle_set_t *ready_set)
+{
+    uint64_t start = READ_CPU_TICKS();
+    bool ready = impl_solo5_yield(deadline, ready_set);
+    record(CALLS_NO_HANDLE, SOLO5_CALL_YIELD, start, !ready, 0);
+    return ready;
+}
+
+bool solo5_yield_events(solo5_time_t deadline, struct solo5_event *events,
+        size_t count, size_t *nready)
+{
+    uint64_t start = READ_CPU_TICKS();
+    bool ready = impl_solo5_yield_events(deadline, events, count, nready);
+    record(CALLS_NO_HANDLE, SOLO5_CALL_YIELD_EVENTS, start, !ready, 0);
+    return ready;
+}
+
+void solo5_console_write(const char *buf, size_t size)
+{
+    uint64_t start = READ_CPU_TICKS();
+    impl_solo5_console_write(buf, size);
+    record(CALLS_NO_HANDLE, SOLO5_CALL_CONSOLE_WRITE, start, false, size);
+}
+
+solo5_result_t solo5_net_read(solo5_handle_t handle, uint8_t *buf,
+        size_t size, size_t *read_size)
+{
+    uint64_t start = READ_CPU_TICKS();
+    solo5_result_t rc = impl_solo5_net_read(handle, buf, size, read_size);
+    return record_dev(handle, SOLO5_CALL_NET_READ, start, rc,
+            rc == SOLO5_R_OK ? *read_size : 0);
+}
+
+solo5_result_t solo5_net_readv(solo5_handle_t handle,
+        struct solo5_net_frame *frames, size_t count, size_t *read_count)
+{
+    uint64_t start = READ_CPU_TICKS();
+    solo5_result_t rc = impl_solo5_net_readv(handle, frames, count,
+            read_count);
+    return record_dev(handle, SOLO5_CALL_NET_READV, start, rc,
+            rc == SOLO5_R_OK ? frames_bytes(frames, *read_count) : 0);
+}
+
+solo5_result_t solo5_net_read_loan(solo5_handle_t handle,
+        const uint8_t **buf, size_t *size)
+{
+    uint64_t start = READ_CPU_TICKS();
+    solo5_result_t rc = impl_solo5_net_read_loan(handle, buf, size);
+    return record_dev(handle, SOLO5_CALL_NET_READ_LOAN, start, rc,
+            rc == SOLO5_R_OK ? *size : 0);
+}
+
+solo5_result_t solo5_net_read_release(solo5_handle_t handle)
+{
+    uint64_t start = READ_CPU_TICKS();
+    solo5_result_t rc = impl_solo5_net_read_release(handle);
+    return record_dev(handle, SOLO5_CALL_NET_READ_RELEASE, start, rc, 0);
+}
+
+solo5_result_t solo5_net_write(solo5_handle_t handle, const uint8_t *buf,
+        size_t size)
+{
+    uint64_t start = READ_CPU_TICKS();
+    solo5_result_t rc = impl_solo5_net_write(handle, buf, size);
+    return record_dev(handle, SOLO5_CALL_NET_WRITE, start, rc, size);
+}
+
+solo5_result_t solo5_net_writev(solo5_handle_t handle,
+        struct solo5_net_frame *frames, size_t count)
+{
+    uint64_t start = READ_CPU_TICKS();
+    solo5_result_t rc = impl_solo5_net_writev(handle, frames, count);
+    /*
+     * Frames may have been sent even if the call as a whole failed.
+     */
+    if (handle < MFT_MAX_ENTRIES)
+        record(handle, SOLO5_CALL_NET_WRITEV, start, rc == SOLO5_R_AGAIN,
+                frames_bytes(frames, count));
+    return rc;
+}
+
+solo5_result_t solo5_net_write_loan(solo5_handle_t handle,
+        const uint8_t *buf, size_t size)
+{
+    uint64_t start = READ_CPU_TICKS();
+    solo5_result_t rc = impl_solo5_net_write_loan(handle, buf, size);
+    return record_dev(handle, SOLO5_CALL_NET_WRITE_LOAN, start, rc, size);
+}
+
+solo5_result_t solo5_net_write_reclaim(solo5_handle_t handle,
+        const uint8_t **bufs, size_t count, size_t *reclaimed)
+{
+    uint64_t start = READ_CPU_TICKS();
+    solo5_result_t rc = impl_solo5_net_write_reclaim(handle, bufs, count,
+            reclaimed);
+    return record_dev(handle, SOLO5_CALL_NET_WRITE_RECLAIM, start, rc, 0);
+}
+
+solo5_result_t solo5_block_read(solo5_handle_t handle, solo5_off_t offset,
+        uint8_t *buf, size_t size)
+{
+    uint64_t start = READ_CPU_TICKS();
+    solo5_result_t rc = impl_solo5_block_read(handle, offset, buf, size);
+    return record_dev(handle, SOLO5_CALL_BLOCK_READ, start, rc, size);
+}
+
+solo5_result_t solo5_block_readv(solo5_handle_t handle, solo5_off_t offset,
+        const struct solo5_block_iov *iov, size_t count)
+{
+    uint64_t start = READ_CPU_TICKS();
+    solo5_result_t rc = impl_solo5_block_readv(handle, offset, iov, count);
+    return record_dev(handle, SOLO5_CALL_BLOCK_READV, start, rc,
+            rc == SOLO5_R_OK ? iov_bytes(iov, count) : 0);
+}
+
+solo5_result_t solo5_block_write(solo5_handle_t handle, solo5_off_t offset,
+        const uint8_t *buf, size_t size)
+{
+    uint64_t start = READ_CPU_TICKS();
+    solo5_result_t rc = impl_solo5_block_write(handle, offset, buf, size);
+    return record_dev(handle, SOLO5_CALL_BLOCK_WRITE, start, rc, size);
+}
+
+solo5_result_t solo5_block_writev(solo5_handle_t handle, solo5_off_t offset,
+        const struct solo5_block_iov *iov, size_t count)
+{
+    uint64_t start = READ_CPU_TICKS();
+    solo5_result_t rc = impl_solo5_block_writev(handle, offset, iov, count);
+    return record_dev(handle, SOLO5_CALL_BLOCK_WRITEV, start, rc,
+            rc == SOLO5_R_OK ? iov_bytes(iov, count) : 0);
+}
+
+solo5_result_t solo5_block_flush(solo5_handle_t handle)
+{
+    uint64_t start = READ_CPU_TICKS();
+    solo5_result_t rc = impl_solo5_block_flush(handle);
+    return record_dev(handle, SOLO5_CALL_BLOCK_FLUSH, start, rc, 0);
+}
+
+solo5_result_t solo5_block_discard(solo5_handle_t handle, solo5_off_t offset,
+        solo5_off_t size)
+{
+    uint64_t start = READ_CPU_TICKS();
+    solo5_result_t rc = impl_solo5_block_discard(handle, offset, size);
+    return record_dev(handle, SOLO5_CALL_BLOCK_DISCARD, start, rc, 0);
+}
+
+solo5_result_t solo5_block_write_zeroes(solo5_handle_t handle,
+        solo5_off_t offset, solo5_off_t size)
+{
+    uint64_t start = READ_CPU_TICKS();
+    solo5_result_t rc = impl_solo5_block_write_zeroes(handle, offset, size);
+    return record_dev(handle, SOLO5_CALL_BLOCK_WRITE_ZEROES, start, rc, 0);
+}
+
+solo5_result_t solo5_block_prefetch(solo5_handle_t handle,
+        solo5_off_t offset, solo5_off_t size)
+{
+    uint64_t start = READ_CPU_TICKS();
+    solo5_result_t rc = impl_solo5_block_prefetch(handle, offset, size);
+    return record_dev(handle, SOLO5_CALL_BLOCK_PREFETCH, start, rc, 0);
+}
+
+solo5_result_t solo5_block_zone_append(solo5_handle_t handle,
+        solo5_off_t zone, const uint8_t *buf, size_t size,
+        solo5_off_t *offset)
+{
+    uint64_t start = READ_CPU_TICKS();
+    solo5_result_t rc = impl_solo5_block_zone_append(handle, zone, buf, size,
+            offset);
+    return record_dev(handle, SOLO5_CALL_BLOCK_ZONE_APPEND, start, rc, size);
+}
+
+solo5_result_t solo5_block_submit_read(solo5_handle_t handle,
+        solo5_off_t offset, uint8_t *buf, size_t size, uint64_t tag)
+{
+    uint64_t start = READ_CPU_TICKS();
+    solo5_result_t rc = impl_solo5_block_submit_read(handle, offset, buf,
+            size, tag);
+    return record_dev(handle, SOLO5_CALL_BLOCK_SUBMIT_READ, start, rc, size);
+}
+
+solo5_result_t solo5_block_submit_write(solo5_handle_t handle,
+        solo5_off_t offset, const uint8_t *buf, size_t size, uint64_t tag)
+{
+    uint64_t start = READ_CPU_TICKS();
+    solo5_result_t rc = impl_solo5_block_submit_write(handle, offset, buf,
+            size, tag);
+    return record_dev(handle, SOLO5_CALL_BLOCK_SUBMIT_WRITE, start, rc, size);
+}
+
+solo5_result_t solo5_block_submit_read_fixed(solo5_handle_t handle,
+        solo5_off_t offset, unsigned index, size_t buf_offset, size_t size,
+        uint64_t tag)
+{
+    uint64_t start = READ_CPU_TICKS();
+    solo5_result_t rc = impl_solo5_block_submit_read_fixed(handle, offset,
+            index, buf_offset, size, tag);
+    return record_dev(handle, SOLO5_CALL_BLOCK_SUBMIT_READ_FIXED, start, rc,
+            size);
+}
+
+solo5_result_t solo5_block_submit_write_fixed(solo5_handle_t handle,
+        solo5_off_t offset, unsigned index, size_t buf_offset, size_t size,
+        uint64_t tag)
+{
+    uint64_t start = READ_CPU_TICKS();
+    solo5_result_t rc = impl_solo5_block_submit_write_fixed(handle, offset,
+            index, buf_offset, size, tag);
+    return record_dev(handle, SOLO5_CALL_BLOCK_SUBMIT_WRITE_FIXED, start, rc,
+            size);
+}
+
+solo5_result_t solo5_block_submit_flush(solo5_handle_t handle, uint64_t tag)
+{
+    uint64_t start = READ_CPU_TICKS();
+    solo5_result_t rc = impl_solo5_block_submit_flush(handle, tag);
+    return record_dev(handle, SOLO5_CALL_BLOCK_SUBMIT_FLUSH, start, rc, 0);
+}
+
+solo5_result_t solo5_block_reap(solo5_handle_t handle,
+        struct solo5_block_completion *completions, size_t count,
+        size_t *reaped)
+{
+    uint64_t start = READ_CPU_TICKS();
+    solo5_result_t rc = impl_solo5_block_reap(handle, completions, count,
+            reaped);
+    return record_dev(handle, SOLO5_CALL_BLOCK_REAP, start, rc, 0);
+}
+
+solo5_result_t solo5_shm_notify(solo5_handle_t handle)
+{
+    uint64_t start = READ_CPU_TICKS();
+    solo5_result_t rc = impl_solo5_shm_notify(handle);
+    return record_dev(handle, SOLO5_CALL_SHM_NOTIFY, start, rc, 0);
+}
+
+solo5_result_t solo5_vsock_read(solo5_handle_t handle, uint8_t *buf,
+        size_t size, size_t *read_size)
+{
+    uint64_t start = READ_CPU_TICKS();
+    solo5_result_t rc = impl_solo5_vsock_read(handle, buf, size, read_size);
+    return record_dev(handle, SOLO5_CALL_VSOCK_READ, start, rc,
+            rc == SOLO5_R_OK ? *read_size : 0);
+}
+
+solo5_result_t solo5_vsock_write(solo5_handle_t handle, const uint8_t *buf,
+        size_t size, size_t *written)
+{
+    uint64_t start = READ_CPU_TICKS();
+    solo5_result_t rc = impl_solo5_vsock_write(handle, buf, size, written);
+    return record_dev(handle, SOLO5_CALL_VSOCK_WRITE, start, rc,
+            rc == SOLO5_R_OK ? *written : 0);
+}
+
+solo5_result_t solo5_mem_release(uintptr_t addr, size_t size)
+{
+    uint64_t start = READ_CPU_TICKS();
+    solo5_result_t rc = impl_solo5_mem_release(addr, size);
+    record(CALLS_NO_HANDLE, SOLO5_CALL_MEM_RELEASE, start,
+            rc == SOLO5_R_AGAIN, rc == SOLO5_R_OK ? size : 0);
+    return rc;
+}
+
+solo5_result_t solo5_call_stats(solo5_handle_t handle, enum solo5_call call,
+        struct solo5_call_stats *stats)
+{
+    if ((unsigned)call >= SOLO5_CALL_MAX || handle >= MFT_MAX_ENTRIES)
+        return SOLO5_R_EINVAL;
+    switch (call) {
+    case SOLO5_CALL_YIELD:
+    case SOLO5_CALL_YIELD_EVENTS:
+    case SOLO5_CALL_CONSOLE_WRITE:
+    case SOLO5_CALL_MEM_RELEASE:
+        handle = CALLS_NO_HANDLE;
+        break;
+    default:
+        break;
+    }
+    struct solo5_call_stats *s = &calls[handle][call];
+    stats->calls = __atomic_load_n(&s->calls, __ATOMIC_RELAXED);
+    stats->bytes = __atomic_load_n(&s->bytes, __ATOMIC_RELAXED);
+    stats->again = __atomic_load_n(&s->again, __ATOMIC_RELAXED);
+    stats->cycles = __atomic_load_n(&s->cycles, __ATOMIC_RELAXED);
+    return SOLO5_R_OK;
+}
+
+extern struct mft_note __solo5_manifest_note;
+
+/*
+ * Returns the manifest name of the device with handle (h), whatever its type.
+ */
+static const char *device_name(unsigned h)
+{
+    for (mft_type_t t = MFT_BLOCK_BASIC; t <= MFT_VSOCK_BASIC; t++) {
+        struct mft_entry *e = mft_get_by_index(&__solo5_manifest_note.m, h, t);
+        if (e != NULL)
+            return e->name;
+    }
+    return "?";
+}
+
+void calls_dump(void)
+{
+    char line[160];
+
+    if (!cmdline_calls)
+        return;
+    for (unsigned h = 0; h <= CALLS_NO_HANDLE; h++) {
+        const char *device = h == CALLS_NO_HANDLE ? "-" : device_name(h);
+
+        for (unsigned c = 0; c < SOLO5_CALL_MAX; c++) {
+            const struct solo5_call_stats *s = &calls[h][c];
+            if (s->calls == 0)
+                continue;
+            int len = snprintf(line, sizeof line,
+                    "solo5-calls: %s %s calls=%llu bytes=%llu again=%llu "
+                    "cycles=%llu\n", device, call_names[c],
+                    (unsigned long long)s->calls,
+                    (unsigned long long)s->bytes,
+                    (unsigned long long)s->again,
+                    (unsigned long long)s->cycles);
+            if (len > 0)
+                console_write(line, (size_t)len < sizeof line ?
+                        (size_t)len : sizeof line - 1);
+        }
+    }
+}
@@ -19,10 +19,17 @@
  */
 #include "bindings.h"
 
+bool cmdline_net_offload;
+bool cmdline_profile;
+bool cmdline_calls;
+
 char *cmdline_parse(const char *cmdline)
 {
     const char opt_quiet[] = "--solo5:quiet";
     const char opt_debug[] = "--solo5:debug";
+    const char opt_net_offload[] = "--solo5:net-offload";
+    const char opt_profile[] = "--solo5:profile";
+    const char opt_calls[] = "--solo5:calls";
 
     const char *p = cmdline;
     bool matched;
@@ -49,6 +56,31 @@ char *cmdline_parse(const char *cmdline)
                 matched = true;
             }
         }
+        else if (strncmp(p, opt_net_offload,
+                    (sizeof(opt_net_offload) - 1)) == 0) {
+            after = (char *) (p + (sizeof(opt_net_offload) - 1));
+            if (isspace(*after) || *after == '\0') {
+                cmdline_net_offload = true;
+                p += (sizeof(opt_net_offload) - 1);
+                matched = true;
+            }
+        }
+        else if (strncmp(p, opt_profile, (sizeof(opt_profile) - 1)) == 0) {
+            after = (char *) (p + (sizeof(opt_profile) - 1));
+            if (isspace(*after) || *after == '\0') {
+                cmdline_profile = true;
+                p += (sizeof(opt_profile) - 1);
+                matched = true;
+            }
+        }
+        else if (strncmp(p, opt_calls, (sizeof(opt_calls) - 1)) == 0) {
+            after = (char *) (p + (sizeof(opt_calls) - 1));
+            if (isspace(*after) || *after == '\0') {
+                cmdline_calls = true;
+                p += (sizeof(opt_calls) - 1);
+                matched = true;
+            }
+        }
         if (matched) {
             while (*p && isspace(*p))
                 p++;
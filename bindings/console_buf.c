@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "bindings.h"
+
+/*
+ * Console output from log() and solo5_console_write() is buffered here, so
+ * that chatty applications do not pay for a platform_puts() (on hvt, a write()
+ * by the tender, and a hypercall unless the console ring is used) per line.
+ * The buffer is flushed once it holds CONSOLE_FLUSH_LINES lines or would
+ * overflow, and by console_flush(), which is called before solo5_app_main(),
+ * on solo5_yield() and on exit or abort.
+ */
+#define CONSOLE_BUF_SIZE 4096
+#define CONSOLE_FLUSH_LINES 32
+
+static char console_buf[CONSOLE_BUF_SIZE];
+static size_t console_len;
+static unsigned console_lines;
+static bool console_lock;
+
+static void flush_locked(void)
+{
+    if (console_len != 0)
+        (void)platform_puts(console_buf, console_len);
+    console_len = 0;
+    console_lines = 0;
+}
+
+void console_write(const char *buf, size_t size)
+{
+    /*
+     * If the buffer is in use, we are either on another CPU or have
+     * interrupted its user, such as with a trap. Write directly rather than
+     * wait, which may reorder output but cannot deadlock.
+     */
+    if (__atomic_test_and_set(&console_lock, __ATOMIC_ACQUIRE)) {
+        (void)platform_puts(buf, size);
+        return;
+    }
+
+    if (size > sizeof console_buf - console_len) {
+        flush_locked();
+        if (size > sizeof console_buf) {
+            (void)platform_puts(buf, size);
+            __atomic_clear(&console_lock, __ATOMIC_RELEASE);
+            return;
+        }
+    }
+    memcpy(console_buf + console_len, buf, size);
+    console_len += size;
+    if (size != 0 && buf[size - 1] == '\n' &&
+            ++console_lines == CONSOLE_FLUSH_LINES)
+        flush_locked();
+
+    __atomic_clear(&console_lock, __ATOMIC_RELEASE);
+}
+
+void console_flush(void)
+{
+    if (__atomic_load_n(&console_len, __ATOMIC_RELAXED) == 0 ||
+            __atomic_test_and_set(&console_lock, __ATOMIC_ACQUIRE))
+        return;
+    flush_locked();
+    __atomic_clear(&console_lock, __ATOMIC_RELEASE);
+}
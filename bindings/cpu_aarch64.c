@@ -38,12 +38,41 @@ static const char *exception_modes[]= {
     "Error"
 };
 
+/*
+ * The tender enables FP/Advanced SIMD, and SVE if it gave us SVE, but make
+ * sure neither traps, as the compiler may use them anywhere. The SVE vector
+ * length is set to the largest the host allows, which ZCR_EL1 (written by
+ * its encoding, as the assembler may not know SVE) caps at 2048 bits.
+ */
+static void cpu_enable_simd(void)
+{
+    uint64_t cpacr, pfr0;
+
+    __asm__ __volatile__("mrs %0, id_aa64pfr0_el1" : "=r" (pfr0));
+    __asm__ __volatile__("mrs %0, cpacr_el1" : "=r" (cpacr));
+    cpacr |= CPACR_FPEN_NOTRAP;
+    if (ID_AA64PFR0_SVE(pfr0) != 0)
+        cpacr |= CPACR_ZEN_NOTRAP;
+    __asm__ __volatile__("msr cpacr_el1, %0; isb" : : "r" (cpacr) : "memory");
+    if (ID_AA64PFR0_SVE(pfr0) != 0)
+        __asm__ __volatile__("msr s3_0_c1_c2_0, %0; isb"
+                :
+                : "r" ((uint64_t)0xf)
+                : "memory");
+}
+
 void cpu_init(void)
 {
     __asm__ __volatile__("msr VBAR_EL1, %0"
             :
             : "r" ((uint64_t)&cpu_exception_vectors)
             : "memory");
+    cpu_enable_simd();
+}
+
+void cpu_init_secondary(void)
+{
+    cpu_init();
 }
 
 static void dump_registers(struct regs *regs)
@@ -46,6 +46,14 @@
 #define ESR_EC_DABT_LOW	_AC(0x24, UL)
 #define ESR_EC_DABT_CUR	_AC(0x25, UL)
 
+/*
+ * CPACR_EL1 fields enabling FP/Advanced SIMD and SVE instructions at EL1 and
+ * EL0 without trapping, and the ID_AA64PFR0_EL1 field reporting SVE.
+ */
+#define CPACR_FPEN_NOTRAP   (_AC(3, UL) << 20)
+#define CPACR_ZEN_NOTRAP    (_AC(3, UL) << 16)
+#define ID_AA64PFR0_SVE(r)  (((r) >> 32) & 0xf)
+
 #define ESR_EC_SHIFT    _AC(26, UL)
 #define ESR_EC_MASK     (_AC(0x3F, UL) << ESR_EC_SHIFT)
 #define ESR_EC(esr)     (((esr) & ESR_EC_MASK) >> ESR_EC_SHIFT)
@@ -65,7 +73,7 @@ static inline uint64_t cpu_cntvct(void)
 
 static inline uint64_t mul64_32(uint64_t a, uint32_t b, uint8_t s)
 {
-    return (a * b) >> s;
+    return (uint64_t)(((unsigned __int128)a * b) >> s);
 }
 #endif /* !ASM_FILE */
 
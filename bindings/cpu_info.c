@@ -0,0 +1,206 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * cpu_info.c: CPU features and cache geometry, as seen by the guest.
+ *
+ * On x86_64, features are read with CPUID, which the hvt tender sets up to
+ * report what it has enabled, and those using AVX or AVX-512 state are only
+ * reported if XCR0 shows it is enabled; XGETBV returns the XCR0 set up by the
+ * tender, by the bindings on virtio, and by the host kernel on spt. On
+ * aarch64, they are read from the ID registers, which Linux emulates for spt.
+ */
+
+#include "bindings.h"
+
+#if defined(__x86_64__)
+
+static void cpuid_count(uint32_t leaf, uint32_t subleaf, uint32_t *regs)
+{
+    __asm__(
+        "cpuid"
+        : "=a" (regs[0]), "=b" (regs[1]), "=c" (regs[2]), "=d" (regs[3])
+        : "0" (leaf), "2" (subleaf)
+    );
+}
+
+#define XCR0_AVX        0x6ULL
+#define XCR0_AVX512     0xe6ULL
+
+static uint64_t cpu_features(void)
+{
+    uint32_t r[4];
+    uint64_t f = 0, xcr0 = 0;
+
+    cpuid_count(0, 0, r);
+    uint32_t max_leaf = r[0];
+
+    cpuid_count(1, 0, r);
+    uint32_t ecx = r[2];
+    f |= (ecx & (1U << 0)) ? SOLO5_CPU_SSE3 : 0;
+    f |= (ecx & (1U << 1)) ? SOLO5_CPU_PCLMULQDQ : 0;
+    f |= (ecx & (1U << 9)) ? SOLO5_CPU_SSSE3 : 0;
+    f |= (ecx & (1U << 19)) ? SOLO5_CPU_SSE4_1 : 0;
+    f |= (ecx & (1U << 20)) ? SOLO5_CPU_SSE4_2 : 0;
+    f |= (ecx & (1U << 23)) ? SOLO5_CPU_POPCNT : 0;
+    f |= (ecx & (1U << 25)) ? SOLO5_CPU_AESNI : 0;
+    f |= (ecx & (1U << 30)) ? SOLO5_CPU_RDRAND : 0;
+    if (ecx & (1U << 27)) {
+        uint32_t lo, hi;
+        __asm__ __volatile__("xgetbv" : "=a" (lo), "=d" (hi) : "c" (0));
+        xcr0 = ((uint64_t)hi << 32) | lo;
+    }
+    bool avx = (xcr0 & XCR0_AVX) == XCR0_AVX;
+    bool avx512 = (xcr0 & XCR0_AVX512) == XCR0_AVX512;
+    if (avx) {
+        f |= (ecx & (1U << 28)) ? SOLO5_CPU_AVX : 0;
+        f |= (ecx & (1U << 12)) ? SOLO5_CPU_FMA : 0;
+    }
+
+    if (max_leaf < 7)
+        return f;
+    cpuid_count(7, 0, r);
+    uint32_t ebx = r[1];
+    ecx = r[2];
+    f |= (ebx & (1U << 3)) ? SOLO5_CPU_BMI1 : 0;
+    f |= (ebx & (1U << 8)) ? SOLO5_CPU_BMI2 : 0;
+    f |= (ebx & (1U << 18)) ? SOLO5_CPU_RDSEED : 0;
+    f |= (ebx & (1U << 29)) ? SOLO5_CPU_SHA : 0;
+    f |= (ecx & (1U << 8)) ? SOLO5_CPU_GFNI : 0;
+    if (avx) {
+        f |= (ebx & (1U << 5)) ? SOLO5_CPU_AVX2 : 0;
+        f |= (ecx & (1U << 9)) ? SOLO5_CPU_VAES : 0;
+        f |= (ecx & (1U << 10)) ? SOLO5_CPU_VPCLMULQDQ : 0;
+    }
+    if (avx512 && (ebx & (1U << 16))) {
+        f |= SOLO5_CPU_AVX512F;
+        f |= (ebx & (1U << 17)) ? SOLO5_CPU_AVX512DQ : 0;
+        f |= (ebx & (1U << 30)) ? SOLO5_CPU_AVX512BW : 0;
+        f |= (ebx & (1U << 31)) ? SOLO5_CPU_AVX512VL : 0;
+    }
+    return f;
+}
+
+/*
+ * Walks the deterministic cache parameters, in leaf 4 on Intel and leaf
+ * 0x8000001d on AMD, which share the same format. Returns false if neither
+ * is available.
+ */
+static bool cpu_caches_leaf(uint32_t leaf, struct solo5_cpu_info *info)
+{
+    uint32_t r[4];
+    bool found = false;
+
+    for (uint32_t i = 0; i < 16; i++) {
+        cpuid_count(leaf, i, r);
+        uint32_t type = r[0] & 0x1f;
+        if (type == 0)
+            break;
+        if (type == 2)                  /* Instruction cache */
+            continue;
+        uint32_t level = (r[0] >> 5) & 0x7;
+        uint32_t line = (r[1] & 0xfff) + 1;
+        uint64_t size = (uint64_t)((r[1] >> 22) + 1) *
+            (((r[1] >> 12) & 0x3ff) + 1) * line * ((uint64_t)r[2] + 1);
+        if (size > UINT32_MAX)
+            size = UINT32_MAX;
+        if (level == 1) {
+            info->l1d_cache_size = size;
+            info->cache_line_size = line;
+        }
+        else if (level == 2)
+            info->l2_cache_size = size;
+        else if (level == 3)
+            info->l3_cache_size = size;
+        found = true;
+    }
+    return found;
+}
+
+static void cpu_caches(struct solo5_cpu_info *info)
+{
+    uint32_t r[4];
+
+    cpuid_count(1, 0, r);
+    if (r[3] & (1U << 19))              /* CLFLUSH line size is valid */
+        info->cache_line_size = ((r[1] >> 8) & 0xff) * 8;
+
+    cpuid_count(0, 0, r);
+    if (r[0] >= 4 && cpu_caches_leaf(4, info))
+        return;
+    cpuid_count(0x80000000, 0, r);
+    if (r[0] >= 0x8000001d) {
+        cpuid_count(0x80000001, 0, r);
+        if (r[2] & (1U << 22))          /* TOPOEXT */
+            (void)cpu_caches_leaf(0x8000001d, info);
+    }
+}
+
+#elif defined(__aarch64__)
+
+#define ID_FIELD(reg, shift) (((reg) >> (shift)) & 0xf)
+
+static uint64_t cpu_features(void)
+{
+    uint64_t isar0, pfr0;
+    uint64_t f = 0;
+
+    __asm__ __volatile__("mrs %0, id_aa64isar0_el1" : "=r" (isar0));
+    __asm__ __volatile__("mrs %0, id_aa64pfr0_el1" : "=r" (pfr0));
+
+    f |= (ID_FIELD(pfr0, 20) != 0xf) ? SOLO5_CPU_ASIMD : 0;
+    f |= (ID_FIELD(pfr0, 32) >= 1) ? SOLO5_CPU_SVE : 0;
+    f |= (ID_FIELD(isar0, 4) >= 1) ? SOLO5_CPU_AES : 0;
+    f |= (ID_FIELD(isar0, 4) >= 2) ? SOLO5_CPU_PMULL : 0;
+    f |= (ID_FIELD(isar0, 8) >= 1) ? SOLO5_CPU_SHA1 : 0;
+    f |= (ID_FIELD(isar0, 12) >= 1) ? SOLO5_CPU_SHA2 : 0;
+    f |= (ID_FIELD(isar0, 12) >= 2) ? SOLO5_CPU_SHA512 : 0;
+    f |= (ID_FIELD(isar0, 16) >= 1) ? SOLO5_CPU_CRC32 : 0;
+    f |= (ID_FIELD(isar0, 20) >= 2) ? SOLO5_CPU_ATOMICS : 0;
+    f |= (ID_FIELD(isar0, 32) >= 1) ? SOLO5_CPU_SHA3 : 0;
+    return f;
+}
+
+/*
+ * Cache sizes are only described by registers accessible at EL1, which spt
+ * does not run at, so only the line size is reported.
+ */
+static void cpu_caches(struct solo5_cpu_info *info)
+{
+    uint64_t ctr;
+
+    __asm__ __volatile__("mrs %0, ctr_el0" : "=r" (ctr));
+    info->cache_line_size = 4U << ID_FIELD(ctr, 16);
+}
+
+#else
+#error Unsupported architecture
+#endif
+
+void solo5_cpu_info(struct solo5_cpu_info *info)
+{
+    struct solo5_cpu_info tmp = {
+        .cache_line_size = 64
+    };
+
+    tmp.features = cpu_features();
+    cpu_caches(&tmp);
+    *info = tmp;
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * cpu_time.c: CPU time accounting, see solo5_cpu_time().
+ *
+ * Elapsed time is counted from the start of each CPU until it stops, idle
+ * time around the blocking part of solo5_yield(), and steal time by the
+ * host, as reported by platform_cpu_steal(). Run time is what remains.
+ */
+
+#include "bindings.h"
+
+static struct {
+    bool started;
+    bool stopped;
+    solo5_time_t start;
+    solo5_time_t stop;
+} cpu_times[CPU_TIME_CPUS_MAX];
+
+static solo5_time_t idle_time;
+
+void cpu_time_start(unsigned cpu)
+{
+    if (cpu >= CPU_TIME_CPUS_MAX)
+        return;
+    cpu_times[cpu].start = solo5_clock_monotonic();
+    __atomic_store_n(&cpu_times[cpu].started, true, __ATOMIC_RELEASE);
+}
+
+void cpu_time_stop(unsigned cpu)
+{
+    if (cpu >= CPU_TIME_CPUS_MAX)
+        return;
+    cpu_times[cpu].stop = solo5_clock_monotonic();
+    __atomic_store_n(&cpu_times[cpu].stopped, true, __ATOMIC_RELEASE);
+}
+
+void cpu_time_idle(solo5_time_t since)
+{
+    solo5_time_t now = solo5_clock_monotonic();
+
+    if (now > since)
+        __atomic_fetch_add(&idle_time, now - since, __ATOMIC_RELAXED);
+}
+
+solo5_result_t solo5_cpu_time(struct solo5_cpu_time *time)
+{
+    solo5_time_t now = solo5_clock_monotonic();
+    solo5_time_t elapsed = 0, steal = 0;
+    bool have_steal = true;
+
+    for (unsigned cpu = 0; cpu < CPU_TIME_CPUS_MAX; cpu++) {
+        if (!__atomic_load_n(&cpu_times[cpu].started, __ATOMIC_ACQUIRE))
+            continue;
+        solo5_time_t end = now;
+        if (__atomic_load_n(&cpu_times[cpu].stopped, __ATOMIC_ACQUIRE))
+            end = cpu_times[cpu].stop;
+        if (end > cpu_times[cpu].start)
+            elapsed += end - cpu_times[cpu].start;
+
+        solo5_time_t cpu_steal;
+        if (have_steal && platform_cpu_steal(cpu, &cpu_steal))
+            steal += cpu_steal;
+        else
+            have_steal = false;
+    }
+
+    time->idle = __atomic_load_n(&idle_time, __ATOMIC_RELAXED);
+    time->steal = have_steal ? steal : 0;
+    /*
+     * The clocks are read at different times, so the sum of idle and steal
+     * time may slightly exceed the elapsed time.
+     */
+    if (elapsed > time->idle + time->steal)
+        time->run = elapsed - time->idle - time->steal;
+    else
+        time->run = 0;
+    return have_steal ? SOLO5_R_OK : SOLO5_R_EUNSPEC;
+}
@@ -22,6 +22,19 @@
 
 static uint64_t cpu_gdt64[GDT_NUM_ENTRIES] ALIGN_64_BIT;
 
+static void gdt_load(void)
+{
+    volatile struct gdtptr gdtptr;
+    gdtptr.limit = sizeof(cpu_gdt64) - 1;
+    gdtptr.base = (uint64_t)&cpu_gdt64;
+    __asm__ __volatile__("lgdt (%0)" :: "r" (&gdtptr));
+    /*
+     * TODO: Technically we should reload all segment registers here, in
+     * practice this doesn't matter since the bootstrap GDT matches ours, for
+     * now.
+     */
+}
+
 /*
  * The tender (hvt) or bootloader + bootstrap (virtio) starts us up with a
  * bootstrap GDT which is "invisible" to the guest, init and switch to our own
@@ -36,19 +49,18 @@ static void gdt_init(void)
     cpu_gdt64[GDT_DESC_CODE] = GDT_DESC_CODE_VAL;
     cpu_gdt64[GDT_DESC_DATA] = GDT_DESC_DATA_VAL;
 
-    volatile struct gdtptr gdtptr;
-    gdtptr.limit = sizeof(cpu_gdt64) - 1;
-    gdtptr.base = (uint64_t)&cpu_gdt64;
-    __asm__ __volatile__("lgdt (%0)" :: "r" (&gdtptr));
-    /*
-     * TODO: Technically we should reload all segment registers here, in
-     * practice this doesn't matter since the bootstrap GDT matches ours, for
-     * now.
-     */
+    gdt_load();
 }
 
 static struct idt_gate_desc cpu_idt[IDT_NUM_ENTRIES] ALIGN_64_BIT;
 
+/*
+ * Secondary CPUs share our GDT, but have no TSS and therefore no interrupt
+ * stacks of their own. They use a copy of the IDT where all handlers run on
+ * the current stack.
+ */
+static struct idt_gate_desc cpu_secondary_idt[IDT_NUM_ENTRIES] ALIGN_64_BIT;
+
 static void idt_fillgate(unsigned num, void *fun, unsigned ist)
 {
     struct idt_gate_desc *desc = &cpu_idt[num];
@@ -63,6 +75,17 @@ static void idt_fillgate(unsigned num, void *fun, unsigned ist)
     desc->type = 0b1110;
     desc->dpl = 0;
     desc->p = 1;
+
+    cpu_secondary_idt[num] = *desc;
+    cpu_secondary_idt[num].ist = 0;
+}
+
+static void idt_load(struct idt_gate_desc *idt)
+{
+    volatile struct idtptr idtptr;
+    idtptr.limit = sizeof(cpu_idt) - 1;
+    idtptr.base = (uint64_t)idt;
+    __asm__ __volatile__("lidt (%0)" :: "r" (&idtptr));
 }
 
 static void idt_init(void)
@@ -115,10 +138,17 @@ static void idt_init(void)
     FILL_IRQ_GATE(14, 1);
     FILL_IRQ_GATE(15, 1);
 
-    volatile struct idtptr idtptr;
-    idtptr.limit = sizeof(cpu_idt) - 1;
-    idtptr.base = (uint64_t) &cpu_idt;
-    __asm__ __volatile__("lidt (%0)" :: "r" (&idtptr));
+    idt_load(cpu_idt);
+}
+
+/*
+ * Install (fun) as the handler for interrupt vector (num), above those used
+ * for legacy IRQs. As for IRQs, it runs on IST1 (cpu_intr_stack).
+ */
+void cpu_intr_set_vector(unsigned num, void (*fun)(void))
+{
+    assert(num >= 48 && num < IDT_NUM_ENTRIES);
+    idt_fillgate(num, fun, 1);
 }
 
 static struct tss cpu_tss;
@@ -149,11 +179,68 @@ static void tss_init(void)
     __asm__ __volatile__("ltr %0" :: "r" ((unsigned short)(GDT_DESC_TSS_LO * 8)));
 }
 
+bool cpu_fsgsbase;
+
+/*
+ * Enable the FSGSBASE instructions if the CPU supports them. Only for use on
+ * targets where Solo5 sets up CR4 itself; on hvt, the tender does so.
+ */
+void cpu_enable_fsgsbase(void)
+{
+    uint32_t eax, ebx, ecx, edx;
+
+    x86_cpuid(0, &eax, &ebx, &ecx, &edx);
+    if (eax < 7)
+        return;
+    x86_cpuid(7, &eax, &ebx, &ecx, &edx);
+    if (ebx & 1)
+        cpu_write_cr4(cpu_read_cr4() | X86_CR4_FSGSBASE);
+}
+
+/*
+ * Extended state components enabled by cpu_enable_xsave(): x87, SSE, AVX and,
+ * only if all three are present, the AVX-512 components.
+ */
+#define XCR0_BASE       0x3ULL
+#define XCR0_AVX        0x4ULL
+#define XCR0_AVX512     0xe0ULL
+
+/*
+ * Enable XSAVE and, in XCR0, as much AVX and AVX-512 state as the CPU
+ * supports. As for cpu_enable_fsgsbase(), on hvt the tender does this.
+ */
+void cpu_enable_xsave(void)
+{
+    uint32_t eax, ebx, ecx, edx;
+
+    x86_cpuid(1, &eax, &ebx, &ecx, &edx);
+    if (!(ecx & (1U << 26)))
+        return;
+    cpu_write_cr4(cpu_read_cr4() | X86_CR4_OSXSAVE);
+
+    x86_cpuid(0xd, &eax, &ebx, &ecx, &edx);
+    uint64_t xcr0 = XCR0_BASE | (eax & (XCR0_AVX | XCR0_AVX512));
+    if (!(xcr0 & XCR0_AVX) || (xcr0 & XCR0_AVX512) != XCR0_AVX512)
+        xcr0 &= ~XCR0_AVX512;
+    __asm__ __volatile__("xsetbv" ::
+        "c" (0),
+        "a" ((uint32_t)xcr0),
+        "d" ((uint32_t)(xcr0 >> 32))
+    );
+}
+
 void cpu_init(void)
 {
     gdt_init();
     tss_init();
     idt_init();
+    cpu_fsgsbase = (cpu_read_cr4() & X86_CR4_FSGSBASE) != 0;
+}
+
+void cpu_init_secondary(void)
+{
+    gdt_load();
+    idt_load(cpu_secondary_idt);
 }
 
 static char *traps[32] = {
@@ -59,6 +59,10 @@
 #define X86_CR4_OSXMMEXCPT      _BITUL(X86_CR4_OSXMMEXCPT_BIT)
 #define X86_CR4_VMXE_BIT        13 /* VMX enabled */
 #define X86_CR4_VMXE            _BITUL(X86_CR4_VMXE_BIT)
+#define X86_CR4_FSGSBASE_BIT    16 /* Enable RDFSBASE/WRFSBASE etc. */
+#define X86_CR4_FSGSBASE        _BITUL(X86_CR4_FSGSBASE_BIT)
+#define X86_CR4_OSXSAVE_BIT     18 /* Enable XSAVE and XSETBV/XGETBV */
+#define X86_CR4_OSXSAVE         _BITUL(X86_CR4_OSXSAVE_BIT)
 
 /*
  * Intel CPU features in EFER
@@ -102,7 +106,11 @@ struct gdtptr {
     uint64_t base;
 } __attribute__((packed));
 
-#define IDT_NUM_ENTRIES 48
+/*
+ * Vectors 0-31 are used for traps, 32-47 for legacy IRQs, and the remainder
+ * may be set with cpu_intr_set_vector().
+ */
+#define IDT_NUM_ENTRIES 64
 
 struct idt_gate_desc {
     uint64_t offset_lo:16;
@@ -164,6 +172,31 @@ static inline uint64_t cpu_rdtsc(void)
     return ((uint64_t)h << 32) | l;
 }
 
+static inline uint64_t cpu_rdpmc(uint32_t counter)
+{
+    uint32_t lo, hi;
+
+    __asm__ __volatile__("rdpmc" : "=a" (lo), "=d" (hi) : "c" (counter));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void
+x86_cpuid(uint32_t level, uint32_t *eax_out, uint32_t *ebx_out,
+        uint32_t *ecx_out, uint32_t *edx_out)
+{
+    uint32_t eax_, ebx_, ecx_, edx_;
+
+    __asm__(
+        "cpuid"
+        : "=a" (eax_), "=b" (ebx_), "=c" (ecx_), "=d" (edx_)
+        : "0" (level), "2" (0)
+    );
+    *eax_out = eax_;
+    *ebx_out = ebx_;
+    *ecx_out = ecx_;
+    *edx_out = edx_;
+}
+
 static inline uint64_t mul64_32(uint64_t a, uint32_t b, uint8_t s)
 {
     uint64_t prod;
@@ -225,8 +258,48 @@ static inline uint64_t inq(uint16_t port_lo)
     return ((uint64_t)lo) | ((uint64_t)hi << 32);
 }
 
+static inline uint64_t cpu_rdmsr(uint32_t msr)
+{
+    uint32_t lo, hi;
+
+    __asm__ __volatile__("rdmsr" : "=a" (lo), "=d" (hi) : "c" (msr));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void cpu_wrmsr(uint32_t msr, uint64_t v)
+{
+    __asm__ __volatile__("wrmsr" ::
+        "c" (msr), "a" ((uint32_t)v), "d" ((uint32_t)(v >> 32)));
+}
+
+void cpu_intr_set_vector(unsigned num, void (*fun)(void));
+
+static inline uint64_t cpu_read_cr4(void)
+{
+    uint64_t cr4;
+
+    __asm__ __volatile__("mov %%cr4, %0" : "=r" (cr4));
+    return cr4;
+}
+
+static inline void cpu_write_cr4(uint64_t cr4)
+{
+    __asm__ __volatile__("mov %0, %%cr4" :: "r" (cr4));
+}
+
+/*
+ * True if CR4.FSGSBASE is set, as found by cpu_init().
+ */
+extern bool cpu_fsgsbase;
+void cpu_enable_fsgsbase(void);
+void cpu_enable_xsave(void);
+
 static inline void cpu_set_tls_base(uint64_t base)
 {
+    if (cpu_fsgsbase) {
+        __asm__ __volatile__("wrfsbase %0" :: "r" (base));
+        return;
+    }
      __asm__ __volatile("wrmsr" ::
          "c" (0xc0000100), /* IA32_FS_BASE */
          "a" ((uint32_t)(base)),
@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * events.c: Readiness as an array of events, see solo5_yield_events().
+ */
+
+#include "bindings.h"
+
+/*
+ * Writability which did not fit in the caller's array, as it is not reported
+ * again by the platform.
+ */
+static solo5_handle_set_t writable_pending;
+
+bool solo5_yield_events(solo5_time_t deadline, struct solo5_event *events,
+        size_t count, size_t *nready)
+{
+    solo5_handle_set_t ready_set = 0;
+    size_t n = 0;
+
+    bool rc = solo5_yield(deadline, &ready_set);
+    solo5_handle_set_t writable_set =
+        __atomic_exchange_n(&writable_pending, 0, __ATOMIC_RELAXED) |
+        platform_net_writable_set();
+    solo5_handle_set_t set = ready_set | writable_set;
+    /*
+     * Visit only the handles which are ready, lowest first.
+     */
+    while (set != 0 && n < count) {
+        solo5_handle_t h = __builtin_ctzll(set);
+        solo5_handle_set_t bit = 1ULL << h;
+        set &= set - 1;
+        events[n].handle = h;
+        events[n].events = 0;
+        if (ready_set & bit)
+            events[n].events = stats_acquired(h, MFT_BLOCK_BASIC) ?
+                SOLO5_EVENT_COMPLETION : SOLO5_EVENT_READABLE;
+        if (writable_set & bit)
+            events[n].events |= SOLO5_EVENT_WRITABLE;
+        n++;
+    }
+    if (writable_set & set)
+        __atomic_fetch_or(&writable_pending, writable_set & set,
+                __ATOMIC_RELAXED);
+    *nready = n;
+    return rc || n != 0;
+}
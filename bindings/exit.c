@@ -23,11 +23,15 @@
 void solo5_exit(int status)
 {
     log(INFO, "Solo5: solo5_exit(%d) called\n", status);
+    calls_dump();
+    console_flush();
     platform_exit(status, NULL);
 }
 
 void solo5_abort(void)
 {
     log(INFO, "Solo5: solo5_abort() called\n");
+    calls_dump();
+    console_flush();
     platform_exit(SOLO5_EXIT_ABORT, NULL);
 }
@@ -37,6 +37,7 @@
 
 /* Solo5 includes */
 extern "C" {
+#define BINDINGS_NO_CALL_COUNTERS
 #include "../bindings.h"
 extern struct mft_note __solo5_manifest_note;
 }
@@ -122,6 +123,16 @@ struct Solo5::Device
 	net_read(uint8_t *buf, size_t size, size_t &read_size) {
 		return SOLO5_R_EINVAL; }
 
+	virtual
+	solo5_result_t
+	net_read_loan(const uint8_t *&buf, size_t &size) {
+		return SOLO5_R_EINVAL; }
+
+	virtual
+	solo5_result_t
+	net_read_release() {
+		return SOLO5_R_EINVAL; }
+
 	virtual
 	solo5_result_t
 	block_info(solo5_block_info &info) {
@@ -136,6 +147,67 @@ struct Solo5::Device
 	solo5_result_t
 	block_read(solo5_off_t offset, uint8_t *buf, size_t size) {
 		return SOLO5_R_EINVAL; }
+
+	virtual
+	solo5_result_t
+	block_writev(solo5_off_t offset, const solo5_block_iov *iov, size_t count) {
+		return SOLO5_R_EINVAL; }
+
+	virtual
+	solo5_result_t
+	block_readv(solo5_off_t offset, const solo5_block_iov *iov, size_t count) {
+		return SOLO5_R_EINVAL; }
+
+	virtual
+	solo5_result_t
+	block_flush() {
+		return SOLO5_R_EINVAL; }
+
+	virtual
+	solo5_result_t
+	block_discard(solo5_off_t offset, solo5_off_t size) {
+		return SOLO5_R_EINVAL; }
+
+	virtual
+	solo5_result_t
+	block_write_zeroes(solo5_off_t offset, solo5_off_t size) {
+		return SOLO5_R_EINVAL; }
+
+	virtual
+	solo5_result_t
+	block_submit_read(solo5_off_t offset, uint8_t *buf, size_t size,
+	                  uint64_t tag) {
+		return SOLO5_R_EINVAL; }
+
+	virtual
+	solo5_result_t
+	block_submit_write(solo5_off_t offset, const uint8_t *buf, size_t size,
+	                   uint64_t tag) {
+		return SOLO5_R_EINVAL; }
+
+	virtual
+	solo5_result_t
+	block_submit_flush(uint64_t tag) {
+		return SOLO5_R_EINVAL; }
+
+	virtual
+	solo5_result_t
+	block_reap(solo5_block_completion *completions, size_t count,
+	           size_t &reaped) {
+		return SOLO5_R_EINVAL; }
+
+	virtual
+	bool
+	block_ready() {
+		return false; }
+
+	/**
+	 * Signal the server of packets submitted or acknowledged
+	 * since last called
+	 */
+	virtual
+	void
+	wakeup() { }
 };
 
 
@@ -154,6 +226,35 @@ struct Solo5::Net_device final : Device
 	solo5_handle_set_t &_ready_set;
 	solo5_handle_set_t  _handle;
 
+	/* packet loaned to the application, not yet acknowledged */
+	Nic::Packet_descriptor _loaned { };
+	bool                   _on_loan = false;
+
+	/*
+	 * Packets are submitted and acknowledged without signalling the
+	 * server, which is woken up once WAKEUP_BATCH packets have
+	 * accumulated in either direction, at the end of a batch
+	 * call, or when the application yields.
+	 */
+	enum { WAKEUP_BATCH = 32 };
+
+	unsigned _tx_unsignalled = 0;
+	unsigned _rx_unsignalled = 0;
+
+	void _tx_submit(Nic::Packet_descriptor pkt)
+	{
+		_nic.tx()->try_submit_packet(pkt);
+		if (++_tx_unsignalled == WAKEUP_BATCH)
+			wakeup();
+	}
+
+	void _rx_ack(Nic::Packet_descriptor pkt)
+	{
+		_nic.rx()->try_ack_packet(pkt);
+		if (++_rx_unsignalled == WAKEUP_BATCH)
+			wakeup();
+	}
+
 	void _handle_signal()
 	{
 		_ready_set |= 1<<_handle;
@@ -186,6 +287,7 @@ struct Solo5::Net_device final : Device
 
 		// MTU is unknown
 		info.mtu = 1500;
+		info.offloads = 0;
 
 		return SOLO5_R_OK;
 	}
@@ -200,11 +302,13 @@ struct Solo5::Net_device final : Device
 		 * has been processed by the server
 		 */
 		while (tx.ack_avail())
-			tx.release_packet(tx.get_acked_packet());
+			tx.release_packet(tx.try_get_acked_packet());
 
 		// do not block if packets congest at the server
-		if (!tx.ready_to_submit())
+		if (!tx.ready_to_submit()) {
+			wakeup();
 			return SOLO5_R_AGAIN;
+		}
 
 		// allocate a packet in the shared packet buffer
 		try {
@@ -212,112 +316,537 @@ struct Solo5::Net_device final : Device
 			// copy-in payload
 			Genode::memcpy(tx.packet_content(pkt), buf, size);
 
-			// signal the server
-			tx.submit_packet(pkt);
+			_tx_submit(pkt);
 			return SOLO5_R_OK;
 		}
 
 		catch (Nic::Session::Tx::Source::Packet_alloc_failed) {
 			// the packet buffer is full, try again later
+			wakeup();
 			return SOLO5_R_AGAIN;
 		}
 	}
 
+	/*
+	 * Get the next packet queued by the server. Packets which do
+	 * not lie within the packet buffer are acknowledged and skipped,
+	 * as their content is handed to the application as is.
+	 */
+	bool
+	_rx_next(Nic::Packet_descriptor &pkt)
+	{
+		auto &rx = *_nic.rx();
+
+		while (rx.packet_avail() && rx.ready_to_ack()) {
+			pkt = rx.try_get_packet();
+			if (rx.packet_valid(pkt) && pkt.size() > 0)
+				return true;
+			_rx_ack(pkt);
+		}
+		return false;
+	}
+
 	solo5_result_t
 	net_read(uint8_t *buf, size_t size, size_t &read_size) override
 	{
 		auto &rx = *_nic.rx();
+		Nic::Packet_descriptor pkt;
 
 		// check for queued packets from the server
-		if (!rx.packet_avail() || !rx.ready_to_ack())
+		if (!_rx_next(pkt))
 			return SOLO5_R_AGAIN;
 
 		// copy-out payload
-		auto pkt = rx.get_packet();
 		size_t n = min(size, pkt.size());
 		Genode::memcpy(buf, rx.packet_content(pkt), n);
 		read_size = n;
 
 		// inform the server that the packet is processed
-		rx.acknowledge_packet(pkt);
+		_rx_ack(pkt);
 
 		// TODO: flag if more packets are pending
 		return SOLO5_R_OK;
 	}
+
+	solo5_result_t
+	net_read_loan(const uint8_t *&buf, size_t &size) override
+	{
+		auto &rx = *_nic.rx();
+
+		if (_on_loan)
+			return SOLO5_R_EINVAL;
+
+		if (!_rx_next(_loaned))
+			return SOLO5_R_AGAIN;
+
+		/*
+		 * hand out the payload in the shared packet buffer, it is
+		 * acknowledged only once the application releases it
+		 */
+		buf = (const uint8_t *)rx.packet_content(_loaned);
+		size = _loaned.size();
+		_on_loan = true;
+		return SOLO5_R_OK;
+	}
+
+	solo5_result_t
+	net_read_release() override
+	{
+		if (!_on_loan)
+			return SOLO5_R_EINVAL;
+
+		_rx_ack(_loaned);
+		_on_loan = false;
+		return SOLO5_R_OK;
+	}
+
+	void
+	wakeup() override
+	{
+		if (_tx_unsignalled) {
+			_nic.tx()->wakeup();
+			_tx_unsignalled = 0;
+		}
+		if (_rx_unsignalled) {
+			_nic.rx()->wakeup();
+			_rx_unsignalled = 0;
+		}
+	}
 };
 
 
 struct Solo5::Block_device final : Device
 {
+	/*
+	 * Asynchronous requests are submitted to the server without
+	 * signalling it, which is woken up once WAKEUP_BATCH requests
+	 * have accumulated, or when the application reaps or yields.
+	 * Up to IO_QUEUE requests, synchronous or asynchronous, are in
+	 * flight at a time, each taking up to SOLO5_BLOCK_IO_MAX of the
+	 * packet buffer.
+	 */
+	enum { IO_QUEUE = 16, WAKEUP_BATCH = 8 };
+
 	Block::Connection<> _block;
 
 	Block::Session::Info const _info { _block.info() };
 
+	/**
+	 * Invokes the `_handle_ack` method when signals
+	 * for acknowledged requests are dispatched.
+	 */
+	Io_signal_handler<Block_device> _ack_handler;
+
+	struct Request
+	{
+		Block::Packet_descriptor pkt { };
+		uint8_t *read_buf = nullptr;
+		uint64_t tag = 0;
+		bool busy = false;
+		bool sync = false;      /* waited for by the submitter */
+		bool done = false;      /* sync only, acknowledged */
+	};
+
+	Request  _requests[IO_QUEUE] { };
+	unsigned _in_flight    = 0;
+	unsigned _unsignalled  = 0;
+
+	/* completed asynchronous requests, not yet reaped */
+	solo5_block_completion _completions[SOLO5_BLOCK_QUEUE_MAX] { };
+	unsigned _head = 0, _tail = 0;
+
+	void _handle_ack() { _collect(); }
+
 	Block_device(struct mft_entry &me,
 	             Genode::Env &env,
 	             Range_allocator &alloc)
-	: _block(env, &alloc, 128*1024, me.name)
-	{ }
+	: _block(env, &alloc, (IO_QUEUE + 1)*SOLO5_BLOCK_IO_MAX, me.name)
+	, _ack_handler(env.ep(), *this, &Block_device::_handle_ack)
+	{
+		_block.tx_channel()->sigh_ack_avail(_ack_handler);
+	}
+
+	void
+	_complete(uint64_t tag, solo5_result_t res)
+	{
+		_completions[_head % SOLO5_BLOCK_QUEUE_MAX] = { tag, res };
+		++_head;
+	}
+
+	/*
+	 * Complete the request acknowledged by the server with (pkt).
+	 * Synchronous requests are handed back to their submitter, which
+	 * releases them. Asynchronous ones are completed here, copying
+	 * out data read and releasing their packet.
+	 */
+	void
+	_ack(Block::Packet_descriptor pkt)
+	{
+		auto &source = *_block.tx();
+
+		for (Request &r : _requests) {
+			if (!r.busy || r.pkt.offset() != pkt.offset())
+				continue;
+
+			if (r.sync) {
+				r.pkt = pkt;
+				r.done = true;
+				return;
+			}
+			if (r.read_buf && pkt.succeeded())
+				Genode::memcpy(r.read_buf, source.packet_content(pkt),
+				               pkt.size());
+			_complete(r.tag, pkt.succeeded() ? SOLO5_R_OK : SOLO5_R_EUNSPEC);
+			r.pkt = pkt;
+			_release(r);
+			return;
+		}
+		source.release_packet(pkt);
+	}
+
+	/* Collect the acknowledgements available without blocking */
+	void
+	_collect()
+	{
+		auto &source = *_block.tx();
+
+		while (source.ack_avail())
+			_ack(source.try_get_acked_packet());
+	}
+
+	/* Wait for all asynchronous requests to be acknowledged */
+	void
+	_drain()
+	{
+		wakeup();
+		while (_in_flight)
+			_ack(_block.tx()->get_acked_packet());
+	}
+
+	/*
+	 * Allocate a request slot and a packet of (size) bytes for it.
+	 * Returns nullptr if none is available.
+	 */
+	Request *
+	_alloc(Block::Packet_descriptor::Opcode op, solo5_off_t offset,
+	       size_t size)
+	{
+		if (_in_flight == IO_QUEUE)
+			_collect();
+		if (_in_flight == IO_QUEUE || !_block.tx()->ready_to_submit())
+			return nullptr;
+
+		for (Request &r : _requests) {
+			if (r.busy)
+				continue;
+
+			try {
+				r.pkt = Block::Packet_descriptor(
+					_block.alloc_packet(size), op,
+					offset / _info.block_size, size / _info.block_size);
+			}
+			catch (Block::Session::Tx::Source::Packet_alloc_failed) {
+				return nullptr;
+			}
+			r.busy = true;
+			r.done = false;
+			++_in_flight;
+			return &r;
+		}
+		return nullptr;
+	}
+
+	void
+	_release(Request &r)
+	{
+		_block.tx()->release_packet(r.pkt);
+		r.busy = false;
+		--_in_flight;
+	}
+
+	/*
+	 * Perform a request synchronously, leaving any asynchronous
+	 * requests in flight, so that the two may overlap.
+	 */
+	solo5_result_t
+	_request_sync(Block::Packet_descriptor::Opcode op, solo5_off_t offset,
+	              const solo5_block_iov *iov, size_t count)
+	{
+		size_t const size = _request_size(offset, iov, count);
+		if (size == 0)
+			return SOLO5_R_EINVAL;
+
+		auto &source = *_block.tx();
+		Request *r;
+
+		// wait for a slot and space in the packet buffer
+		while ((r = _alloc(op, offset, size)) == nullptr) {
+			wakeup();
+			_ack(source.get_acked_packet());
+		}
+		r->sync = true;
+
+		// copy-in write
+		if (op == Block::Packet_descriptor::WRITE) {
+			char *content = source.packet_content(r->pkt);
+			for (size_t i = 0; i < count; content += iov[i++].size)
+				Genode::memcpy(content, iov[i].buf, iov[i].size);
+		}
+
+		// submit, block for response
+		source.try_submit_packet(r->pkt);
+		++_unsignalled;
+		wakeup();
+		while (!r->done)
+			_ack(source.get_acked_packet());
+
+		// copy-out read
+		bool const succeeded = r->pkt.succeeded();
+		if (op == Block::Packet_descriptor::READ && succeeded) {
+			char const *content = source.packet_content(r->pkt);
+			for (size_t i = 0; i < count; content += iov[i++].size)
+				Genode::memcpy(iov[i].buf, content, iov[i].size);
+		}
+
+		r->sync = false;
+		_release(*r);
+		return succeeded ? SOLO5_R_OK : SOLO5_R_EUNSPEC;
+	}
+
+	void
+	wakeup() override
+	{
+		if (_unsignalled) {
+			_block.tx()->wakeup();
+			_unsignalled = 0;
+		}
+	}
 
 	solo5_result_t
 	block_info(struct solo5_block_info &info) override
 	{
 		info.capacity   = _info.block_count * _info.block_size;
 		info.block_size = _info.block_size;
+		info.zone_size  = 0;
 		return SOLO5_R_OK;
 	}
 
+	/*
+	 * Returns the total size of a request for the segments in (iov),
+	 * or 0 if the request is invalid.
+	 */
+	size_t
+	_request_size(solo5_off_t offset, const solo5_block_iov *iov, size_t count)
+	{
+		solo5_off_t const capacity = _info.block_count * _info.block_size;
+		size_t size = 0;
+
+		if (count == 0 || count > SOLO5_BLOCK_IOV_MAX)
+			return 0;
+		for (size_t i = 0; i < count; ++i) {
+			if (iov[i].size == 0 || iov[i].size > SOLO5_BLOCK_IO_MAX ||
+			    iov[i].size % _info.block_size)
+				return 0;
+			size += iov[i].size;
+		}
+		if (size > SOLO5_BLOCK_IO_MAX || offset % _info.block_size ||
+		    offset > capacity || size > capacity - offset)
+			return 0;
+		return size;
+	}
+
+	solo5_result_t
+	block_writev(solo5_off_t offset, const solo5_block_iov *iov,
+	             size_t count) override
+	{
+		return _request_sync(Block::Packet_descriptor::WRITE, offset,
+		                     iov, count);
+	}
+
+	solo5_result_t
+	block_readv(solo5_off_t offset, const solo5_block_iov *iov,
+	            size_t count) override
+	{
+		return _request_sync(Block::Packet_descriptor::READ, offset,
+		                     iov, count);
+	}
+
 	solo5_result_t
 	block_write(solo5_off_t offset, const uint8_t *buf, size_t size) override
 	{
-		if ((offset|size) % _info.block_size)
-			return SOLO5_R_EINVAL;
+		solo5_block_iov const iov { const_cast<uint8_t *>(buf), size };
+		return block_writev(offset, &iov, 1);
+	}
 
-		auto &source = *_block.tx();
+	solo5_result_t
+	block_read(solo5_off_t offset, uint8_t *buf, size_t size) override
+	{
+		solo5_block_iov const iov { buf, size };
+		return block_readv(offset, &iov, 1);
+	}
 
-		// allocate a region in the packet buffer
-		Block::Packet_descriptor pkt(
-			_block.alloc_packet(size),
-			Block::Packet_descriptor::WRITE,
-			offset / _info.block_size, size / _info.block_size);
+	solo5_result_t
+	block_flush() override
+	{
+		_drain();
+		_block.sync();
+		return SOLO5_R_OK;
+	}
 
-		// copy-in write
-		Genode::memcpy(source.packet_content(pkt), buf, pkt.size());
+	/*
+	 * Returns true if a range of (size) bytes at (offset) is valid
+	 * for discarding or writing zeroes.
+	 */
+	bool
+	_range_valid(solo5_off_t offset, solo5_off_t size)
+	{
+		solo5_off_t const capacity = _info.block_count * _info.block_size;
 
-		// submit, block for response, release
-		source.submit_packet(pkt);
-		pkt = source.get_acked_packet();
-		source.release_packet(pkt);
+		return size != 0 &&
+		       !(offset % _info.block_size) && !(size % _info.block_size) &&
+		       offset <= capacity && size <= capacity - offset;
+	}
 
-		return pkt.succeeded() ? SOLO5_R_OK : SOLO5_R_EUNSPEC;
+	/*
+	 * The block session has no means of discarding, and discarding
+	 * is advisory.
+	 */
+	solo5_result_t
+	block_discard(solo5_off_t offset, solo5_off_t size) override
+	{
+		return _range_valid(offset, size) ? SOLO5_R_OK : SOLO5_R_EINVAL;
 	}
 
-	virtual
+	/*
+	 * Zeroes are written as data, in packets of SOLO5_BLOCK_IO_MAX,
+	 * keeping up to IO_QUEUE of them in flight and signalling the
+	 * server once per batch.
+	 */
 	solo5_result_t
-	block_read(solo5_off_t offset, uint8_t *buf, size_t size) override
+	block_write_zeroes(solo5_off_t offset, solo5_off_t size) override
 	{
-		if ((offset|size) % _info.block_size)
+		if (!_range_valid(offset, size))
 			return SOLO5_R_EINVAL;
 
 		auto &source = *_block.tx();
+		unsigned in_flight = 0;
+		bool succeeded = true;
+
+		_drain();
+		while (size > 0 || in_flight > 0) {
+			if (size > 0 && in_flight < IO_QUEUE &&
+			    source.ready_to_submit()) {
+				size_t const len = size < SOLO5_BLOCK_IO_MAX
+					? size : SOLO5_BLOCK_IO_MAX;
+				Block::Packet_descriptor pkt(
+					_block.alloc_packet(len),
+					Block::Packet_descriptor::WRITE,
+					offset / _info.block_size, len / _info.block_size);
+				Genode::memset(source.packet_content(pkt), 0, len);
+				source.try_submit_packet(pkt);
+				++in_flight;
+
+				offset += len;
+				size -= len;
+				continue;
+			}
 
-		// allocate a region in the packet buffer
-		Block::Packet_descriptor pkt(
-			_block.alloc_packet(size),
-			Block::Packet_descriptor::READ,
-			offset / _info.block_size, size / _info.block_size);
+			source.wakeup();
+			Block::Packet_descriptor pkt = source.get_acked_packet();
+			source.release_packet(pkt);
+			succeeded = succeeded && pkt.succeeded();
+			--in_flight;
+		}
+		return succeeded ? SOLO5_R_OK : SOLO5_R_EUNSPEC;
+	}
 
-		// submit, block for response
-		source.submit_packet(pkt);
-		pkt = source.get_acked_packet();
+	/*
+	 * Submit an asynchronous request for (size) bytes at (offset),
+	 * copying in (write_buf), or copying out to (read_buf) when it
+	 * is acknowledged.
+	 */
+	solo5_result_t
+	_submit(Block::Packet_descriptor::Opcode op, solo5_off_t offset,
+	        uint8_t *read_buf, const uint8_t *write_buf, size_t size,
+	        uint64_t tag)
+	{
+		solo5_block_iov const iov { read_buf ? read_buf
+		                                     : const_cast<uint8_t *>(write_buf),
+		                            size };
+		if (_request_size(offset, &iov, 1) == 0)
+			return SOLO5_R_EINVAL;
+		if (_head - _tail + _in_flight >= SOLO5_BLOCK_QUEUE_MAX)
+			return SOLO5_R_AGAIN;
 
-		// copy-out read
-		Genode::memcpy(buf, source.packet_content(pkt), pkt.size());
+		Request *r = _alloc(op, offset, size);
+		if (r == nullptr) {
+			wakeup();
+			return SOLO5_R_AGAIN;
+		}
 
-		// release packet region
-		source.release_packet(pkt);
+		auto &source = *_block.tx();
+		if (write_buf)
+			Genode::memcpy(source.packet_content(r->pkt), write_buf, size);
+		r->read_buf = read_buf;
+		r->tag = tag;
+
+		source.try_submit_packet(r->pkt);
+		if (++_unsignalled == WAKEUP_BATCH)
+			wakeup();
+		return SOLO5_R_OK;
+	}
+
+	solo5_result_t
+	block_submit_read(solo5_off_t offset, uint8_t *buf, size_t size,
+	                  uint64_t tag) override
+	{
+		return _submit(Block::Packet_descriptor::READ, offset, buf, nullptr,
+		               size, tag);
+	}
+
+	solo5_result_t
+	block_submit_write(solo5_off_t offset, const uint8_t *buf, size_t size,
+	                   uint64_t tag) override
+	{
+		return _submit(Block::Packet_descriptor::WRITE, offset, nullptr, buf,
+		               size, tag);
+	}
+
+	/*
+	 * Flushes are performed synchronously on submission, once all
+	 * requests in flight have been acknowledged.
+	 */
+	solo5_result_t
+	block_submit_flush(uint64_t tag) override
+	{
+		if (_head - _tail + _in_flight >= SOLO5_BLOCK_QUEUE_MAX)
+			return SOLO5_R_AGAIN;
 
-		return pkt.succeeded() ? SOLO5_R_OK : SOLO5_R_EUNSPEC;
+		_complete(tag, block_flush());
+		return SOLO5_R_OK;
+	}
+
+	solo5_result_t
+	block_reap(solo5_block_completion *completions, size_t count,
+	           size_t &reaped) override
+	{
+		wakeup();
+		_collect();
+
+		size_t n = 0;
+		for (; n < count && _tail != _head; ++n)
+			completions[n] = _completions[_tail++ % SOLO5_BLOCK_QUEUE_MAX];
+		if (n == 0)
+			return SOLO5_R_AGAIN;
+		reaped = n;
+		return SOLO5_R_OK;
+	}
+
+	bool
+	block_ready() override
+	{
+		_collect();
+		return _head != _tail;
 	}
 };
 
@@ -422,10 +951,37 @@ struct Solo5::Platform
 	 ** Solo5 bindings **
 	 ********************/
 
+	solo5_handle_set_t
+	_block_ready_set()
+	{
+		solo5_handle_set_t ready_set = 0;
+		for (unsigned i = 0; i < MFT_MAX_ENTRIES; ++i)
+			if (devices[i]->block_ready())
+				ready_set |= 1ULL<<i;
+		return ready_set;
+	}
+
 	bool
 	yield(solo5_time_t deadline_ns, solo5_handle_set_t *ready_set)
 	{
-		if (!nic_ready) {
+		solo5_handle_set_t nic, block;
+		bool ready = yield(deadline_ns, nic, block);
+		if (ready && ready_set != nullptr)
+			*ready_set = nic | block;
+		return ready;
+	}
+
+	bool
+	yield(solo5_time_t deadline_ns, solo5_handle_set_t &nic,
+	      solo5_handle_set_t &block)
+	{
+		// signal the servers of anything batched up so far
+		for (unsigned i = 0; i < MFT_MAX_ENTRIES; ++i)
+			devices[i]->wakeup();
+
+		solo5_handle_set_t block_ready = _block_ready_set();
+
+		if (!nic_ready && !block_ready) {
 			solo5_time_t deadline_us = deadline_ns / 1000;
 			solo5_time_t now_us = timer.curr_time()
 				.trunc_to_plain_us().value;
@@ -435,21 +991,24 @@ struct Solo5::Platform
 				Genode::Microseconds{deadline_us - now_us});
 
 			/*
-			 * Block for Nic and Timer signals until a packet is
-			 * pending or until the timeout expires.
-			 * The handlers defined in the Net_device class will be
-			 * invoked during "wait_and_dispatch_one_io_signal".
+			 * Block for Nic, Block and Timer signals until a packet
+			 * is pending, a block request completes or until the
+			 * timeout expires. The handlers defined in the device
+			 * classes will be invoked during
+			 * "wait_and_dispatch_one_io_signal".
 			 */
-			while (!nic_ready && yield_timeout.scheduled())
+			while (!nic_ready && !block_ready &&
+			       yield_timeout.scheduled()) {
 				env.ep().wait_and_dispatch_one_io_signal();
+				block_ready = _block_ready_set();
+			}
 
 			yield_timeout.discard();
 		}
 
-		if (nic_ready) {
-			if (ready_set != nullptr) {
-				*ready_set = nic_ready;
-			}
+		nic = nic_ready;
+		block = block_ready;
+		if (nic_ready || block_ready) {
 			nic_ready = 0;
 			return true;
 		}
@@ -543,6 +1102,28 @@ solo5_yield(solo5_time_t deadline,
 }
 
 
+bool
+solo5_yield_events(solo5_time_t deadline, struct solo5_event *events,
+                   size_t count, size_t *nready)
+{
+	solo5_handle_set_t nic, block;
+	bool ready = Platform::instance->yield(deadline, nic, block);
+	size_t n = 0;
+
+	for (unsigned i = 0; i < MFT_MAX_ENTRIES && n < count; ++i) {
+		uint32_t kind = 0;
+		if (nic & (1ULL<<i))
+			kind |= SOLO5_EVENT_READABLE;
+		if (block & (1ULL<<i))
+			kind |= SOLO5_EVENT_COMPLETION;
+		if (kind != 0)
+			events[n++] = { i, kind };
+	}
+	*nready = n;
+	return ready;
+}
+
+
 void
 solo5_console_write(const char *buf, size_t size)
 {
@@ -577,6 +1158,107 @@ solo5_net_read(solo5_handle_t handle, uint8_t *buf, size_t size, size_t *read_si
 }
 
 
+solo5_result_t
+solo5_net_read_loan(solo5_handle_t handle, const uint8_t **buf, size_t *size)
+{
+	return Platform::devices[handle]->net_read_loan(*buf, *size);
+}
+
+
+solo5_result_t
+solo5_net_read_release(solo5_handle_t handle)
+{
+	return Platform::devices[handle]->net_read_release();
+}
+
+
+/*
+ * Packets loaned with solo5_net_write_loan() are copied into the packet
+ * stream by net_write(), so they are complete as soon as they are sent.
+ */
+static struct
+{
+	const uint8_t *buf[SOLO5_NET_WRITE_LOANS_MAX];
+	unsigned head, tail;
+} _write_loans[MFT_MAX_ENTRIES];
+
+
+solo5_result_t
+solo5_net_write_loan(solo5_handle_t handle, const uint8_t *buf, size_t size)
+{
+	if (handle >= MFT_MAX_ENTRIES)
+		return SOLO5_R_EINVAL;
+
+	auto &wl = _write_loans[handle];
+	if (wl.head - wl.tail == SOLO5_NET_WRITE_LOANS_MAX)
+		return SOLO5_R_AGAIN;
+
+	solo5_result_t res = Platform::devices[handle]->net_write(buf, size);
+	if (res == SOLO5_R_OK)
+		wl.buf[wl.head++ % SOLO5_NET_WRITE_LOANS_MAX] = buf;
+	return res;
+}
+
+
+solo5_result_t
+solo5_net_write_reclaim(solo5_handle_t handle, const uint8_t **bufs,
+                        size_t count, size_t *reclaimed)
+{
+	if (handle >= MFT_MAX_ENTRIES)
+		return SOLO5_R_EINVAL;
+
+	auto &wl = _write_loans[handle];
+	size_t n = 0;
+	for (; n < count && wl.tail != wl.head; ++n)
+		bufs[n] = wl.buf[wl.tail++ % SOLO5_NET_WRITE_LOANS_MAX];
+	if (n == 0)
+		return SOLO5_R_AGAIN;
+	*reclaimed = n;
+	return SOLO5_R_OK;
+}
+
+
+solo5_result_t
+solo5_net_writev(solo5_handle_t handle, struct solo5_net_frame *frames, size_t count)
+{
+	if (count > SOLO5_NET_FRAMES_MAX)
+		return SOLO5_R_EINVAL;
+
+	solo5_result_t res = SOLO5_R_OK;
+	for (size_t i = 0; i < count; ++i) {
+		frames[i].result = Platform::devices[handle]->net_write(
+			frames[i].buf, frames[i].size);
+		if (frames[i].result != SOLO5_R_OK && res == SOLO5_R_OK)
+			res = frames[i].result;
+	}
+	// signal the server once for the whole batch
+	Platform::devices[handle]->wakeup();
+	return res;
+}
+
+
+solo5_result_t
+solo5_net_readv(solo5_handle_t handle, struct solo5_net_frame *frames,
+                size_t count, size_t *read_count)
+{
+	if (count > SOLO5_NET_FRAMES_MAX)
+		return SOLO5_R_EINVAL;
+
+	size_t n = 0;
+	for (; n < count; ++n) {
+		frames[n].result = Platform::devices[handle]->net_read(
+			frames[n].buf, frames[n].size, frames[n].size);
+		if (frames[n].result != SOLO5_R_OK)
+			break;
+	}
+	if (n == 0)
+		return SOLO5_R_AGAIN;
+
+	*read_count = n;
+	return SOLO5_R_OK;
+}
+
+
 solo5_result_t
 solo5_block_acquire(const char *name,
                     solo5_handle_t *handle,
@@ -602,6 +1284,218 @@ solo5_block_read(solo5_handle_t handle, solo5_off_t offset,
 }
 
 
+solo5_result_t
+solo5_block_writev(solo5_handle_t handle, solo5_off_t offset,
+                   const struct solo5_block_iov *iov, size_t count)
+{
+	return Platform::devices[handle]->block_writev(offset, iov, count);
+}
+
+
+solo5_result_t
+solo5_block_readv(solo5_handle_t handle, solo5_off_t offset,
+                  const struct solo5_block_iov *iov, size_t count)
+{
+	return Platform::devices[handle]->block_readv(offset, iov, count);
+}
+
+
+solo5_result_t
+solo5_block_flush(solo5_handle_t handle)
+{
+	return Platform::devices[handle]->block_flush();
+}
+
+
+solo5_result_t
+solo5_block_discard(solo5_handle_t handle, solo5_off_t offset,
+                    solo5_off_t size)
+{
+	return Platform::devices[handle]->block_discard(offset, size);
+}
+
+
+solo5_result_t
+solo5_block_write_zeroes(solo5_handle_t handle, solo5_off_t offset,
+                         solo5_off_t size)
+{
+	return Platform::devices[handle]->block_write_zeroes(offset, size);
+}
+
+
+solo5_result_t
+solo5_block_prefetch(solo5_handle_t, solo5_off_t, solo5_off_t)
+{
+	/* Block sessions provide no means of prefetching, the hint is ignored */
+	return SOLO5_R_OK;
+}
+
+
+solo5_result_t
+solo5_block_map(solo5_handle_t, const uint8_t **)
+{
+	/* Block sessions provide no means of mapping device contents */
+	return SOLO5_R_EINVAL;
+}
+
+
+solo5_result_t
+solo5_block_zone_report(solo5_handle_t, solo5_off_t,
+                        struct solo5_block_zone *, size_t, size_t *)
+{
+	/* Block sessions have no notion of zones, devices are never zoned */
+	return SOLO5_R_EINVAL;
+}
+
+
+solo5_result_t
+solo5_block_zone_append(solo5_handle_t, solo5_off_t, const uint8_t *,
+                        size_t, solo5_off_t *)
+{
+	return SOLO5_R_EINVAL;
+}
+
+
+solo5_result_t
+solo5_block_zone_manage(solo5_handle_t, unsigned, solo5_off_t)
+{
+	return SOLO5_R_EINVAL;
+}
+
+
+solo5_result_t
+solo5_block_submit_read(solo5_handle_t handle, solo5_off_t offset,
+                        uint8_t *buf, size_t size, uint64_t tag)
+{
+	if (handle >= MFT_MAX_ENTRIES)
+		return SOLO5_R_EINVAL;
+
+	return Platform::devices[handle]->block_submit_read(offset, buf, size,
+	                                                    tag);
+}
+
+
+solo5_result_t
+solo5_block_submit_write(solo5_handle_t handle, solo5_off_t offset,
+                         const uint8_t *buf, size_t size, uint64_t tag)
+{
+	if (handle >= MFT_MAX_ENTRIES)
+		return SOLO5_R_EINVAL;
+
+	return Platform::devices[handle]->block_submit_write(offset, buf, size,
+	                                                     tag);
+}
+
+
+solo5_result_t
+solo5_block_register_buffer(solo5_handle_t, uint8_t *, size_t, unsigned *)
+{
+	/* Registered buffers are not supported */
+	return SOLO5_R_EUNSPEC;
+}
+
+
+solo5_result_t
+solo5_block_submit_read_fixed(solo5_handle_t, solo5_off_t, unsigned, size_t,
+                              size_t, uint64_t)
+{
+	return SOLO5_R_EINVAL;
+}
+
+
+solo5_result_t
+solo5_block_submit_write_fixed(solo5_handle_t, solo5_off_t, unsigned, size_t,
+                               size_t, uint64_t)
+{
+	return SOLO5_R_EINVAL;
+}
+
+
+solo5_result_t
+solo5_block_submit_flush(solo5_handle_t handle, uint64_t tag)
+{
+	if (handle >= MFT_MAX_ENTRIES)
+		return SOLO5_R_EINVAL;
+
+	return Platform::devices[handle]->block_submit_flush(tag);
+}
+
+
+solo5_result_t
+solo5_block_reap(solo5_handle_t handle,
+                 struct solo5_block_completion *completions,
+                 size_t count, size_t *reaped)
+{
+	if (handle >= MFT_MAX_ENTRIES)
+		return SOLO5_R_EINVAL;
+
+	return Platform::devices[handle]->block_reap(completions, count,
+	                                             *reaped);
+}
+
+
+unsigned
+solo5_cpu_count(void)
+{
+	/* Additional CPUs would be provided as Genode threads, not supported yet */
+	return 1;
+}
+
+
+solo5_result_t
+solo5_cpu_start(unsigned, solo5_cpu_entry_t, void *, uintptr_t, uintptr_t)
+{
+	return SOLO5_R_EINVAL;
+}
+
+
+solo5_result_t
+solo5_net_stats(solo5_handle_t, struct solo5_net_stats *)
+{
+	/* Statistics are not kept */
+	return SOLO5_R_EUNSPEC;
+}
+
+
+solo5_result_t
+solo5_block_stats(solo5_handle_t, struct solo5_block_stats *)
+{
+	/* Statistics are not kept */
+	return SOLO5_R_EUNSPEC;
+}
+
+
+solo5_result_t
+solo5_call_stats(solo5_handle_t, enum solo5_call, struct solo5_call_stats *)
+{
+	/* Calls are not counted */
+	return SOLO5_R_EUNSPEC;
+}
+
+
+solo5_result_t
+solo5_snapshot(void)
+{
+	/* Snapshots are not supported */
+	return SOLO5_R_EUNSPEC;
+}
+
+
+solo5_result_t
+solo5_mem_release(uintptr_t, size_t)
+{
+	/* Memory reclaim is not supported */
+	return SOLO5_R_EUNSPEC;
+}
+
+
+bool
+solo5_mem_reclaim_requested(void)
+{
+	return false;
+}
+
+
 solo5_result_t
 solo5_set_tls_base(uintptr_t base)
 {
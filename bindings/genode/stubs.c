@@ -1,3 +1,4 @@
+#define BINDINGS_NO_CALL_COUNTERS
 #include "../bindings.h"
 
 void solo5_console_write(const char *buf, size_t size) { }
@@ -7,15 +8,64 @@ void solo5_abort(void) { for(;;); }
 solo5_time_t solo5_clock_monotonic(void) { return ~0; }
 solo5_time_t solo5_clock_wall(void) { return ~0; }
 bool solo5_yield(solo5_time_t deadline, solo5_handle_set_t *ready_set) { return false; }
+bool solo5_yield_events(solo5_time_t deadline, struct solo5_event *events, size_t count, size_t *nready) { return false; }
 
 solo5_result_t solo5_net_acquire(const char *name, solo5_handle_t *handle, struct solo5_net_info *info) { return SOLO5_R_EUNSPEC; }
 solo5_result_t solo5_net_write(solo5_handle_t handle, const uint8_t *buf, size_t size) { return SOLO5_R_EUNSPEC; }
 solo5_result_t solo5_net_read(solo5_handle_t handle, uint8_t *buf, size_t size, size_t *read_size) { return SOLO5_R_EUNSPEC; }
+solo5_result_t solo5_net_writev(solo5_handle_t handle, struct solo5_net_frame *frames, size_t count) { return SOLO5_R_EUNSPEC; }
+solo5_result_t solo5_net_readv(solo5_handle_t handle, struct solo5_net_frame *frames, size_t count, size_t *read_count) { return SOLO5_R_EUNSPEC; }
+solo5_result_t solo5_net_stats(solo5_handle_t handle, struct solo5_net_stats *stats) { return SOLO5_R_EUNSPEC; }
+uint32_t solo5_net_csum_partial(const void *buf, size_t size, uint32_t sum) { return 0; }
+uint16_t solo5_net_csum_fold(uint32_t sum) { return 0; }
+void solo5_net_csum_tx(struct solo5_net_hdr *hdr, uint8_t *pkt, size_t size, size_t csum_start, size_t csum_offset, uint32_t pseudo) { }
+bool solo5_net_csum_rx_valid(const struct solo5_net_hdr *hdr) { return false; }
+solo5_result_t solo5_net_read_loan(solo5_handle_t handle, const uint8_t **buf, size_t *size) { return SOLO5_R_EUNSPEC; }
+solo5_result_t solo5_net_read_release(solo5_handle_t handle) { return SOLO5_R_EUNSPEC; }
+solo5_result_t solo5_net_write_loan(solo5_handle_t handle, const uint8_t *buf, size_t size) { return SOLO5_R_EUNSPEC; }
+solo5_result_t solo5_net_write_reclaim(solo5_handle_t handle, const uint8_t **bufs, size_t count, size_t *reclaimed) { return SOLO5_R_EUNSPEC; }
 
 solo5_result_t solo5_block_acquire(const char *name, solo5_handle_t *handle, struct solo5_block_info *info) { return SOLO5_R_EUNSPEC; }
 
 solo5_result_t solo5_block_write(solo5_handle_t handle, solo5_off_t offset, const uint8_t *buf, size_t size) { return SOLO5_R_EUNSPEC; }
 solo5_result_t solo5_block_read(solo5_handle_t handle, solo5_off_t offset, uint8_t *buf, size_t size) { return SOLO5_R_EUNSPEC; }
+solo5_result_t solo5_block_writev(solo5_handle_t handle, solo5_off_t offset, const struct solo5_block_iov *iov, size_t count) { return SOLO5_R_EUNSPEC; }
+solo5_result_t solo5_block_readv(solo5_handle_t handle, solo5_off_t offset, const struct solo5_block_iov *iov, size_t count) { return SOLO5_R_EUNSPEC; }
+solo5_result_t solo5_block_submit_read(solo5_handle_t handle, solo5_off_t offset, uint8_t *buf, size_t size, uint64_t tag) { return SOLO5_R_EUNSPEC; }
+solo5_result_t solo5_block_submit_write(solo5_handle_t handle, solo5_off_t offset, const uint8_t *buf, size_t size, uint64_t tag) { return SOLO5_R_EUNSPEC; }
+solo5_result_t solo5_block_flush(solo5_handle_t handle) { return SOLO5_R_EUNSPEC; }
+solo5_result_t solo5_block_discard(solo5_handle_t handle, solo5_off_t offset, solo5_off_t size) { return SOLO5_R_EUNSPEC; }
+solo5_result_t solo5_block_write_zeroes(solo5_handle_t handle, solo5_off_t offset, solo5_off_t size) { return SOLO5_R_EUNSPEC; }
+solo5_result_t solo5_block_prefetch(solo5_handle_t handle, solo5_off_t offset, solo5_off_t size) { return SOLO5_R_EUNSPEC; }
+solo5_result_t solo5_block_map(solo5_handle_t handle, const uint8_t **data) { return SOLO5_R_EUNSPEC; }
+solo5_result_t solo5_block_zone_report(solo5_handle_t handle, solo5_off_t offset, struct solo5_block_zone *zones, size_t count, size_t *nzones) { return SOLO5_R_EUNSPEC; }
+solo5_result_t solo5_block_zone_append(solo5_handle_t handle, solo5_off_t zone, const uint8_t *buf, size_t size, solo5_off_t *offset) { return SOLO5_R_EUNSPEC; }
+solo5_result_t solo5_block_zone_manage(solo5_handle_t handle, unsigned op, solo5_off_t zone) { return SOLO5_R_EUNSPEC; }
+solo5_result_t solo5_block_submit_flush(solo5_handle_t handle, uint64_t tag) { return SOLO5_R_EUNSPEC; }
+solo5_result_t solo5_block_reap(solo5_handle_t handle, struct solo5_block_completion *completions, size_t count, size_t *reaped) { return SOLO5_R_EUNSPEC; }
+solo5_result_t solo5_block_register_buffer(solo5_handle_t handle, uint8_t *buf, size_t size, unsigned *index) { return SOLO5_R_EUNSPEC; }
+solo5_result_t solo5_block_submit_read_fixed(solo5_handle_t handle, solo5_off_t offset, unsigned index, size_t buf_offset, size_t size, uint64_t tag) { return SOLO5_R_EUNSPEC; }
+solo5_result_t solo5_block_submit_write_fixed(solo5_handle_t handle, solo5_off_t offset, unsigned index, size_t buf_offset, size_t size, uint64_t tag) { return SOLO5_R_EUNSPEC; }
+solo5_result_t solo5_block_stats(solo5_handle_t handle, struct solo5_block_stats *stats) { return SOLO5_R_EUNSPEC; }
+solo5_result_t solo5_call_stats(solo5_handle_t handle, enum solo5_call call, struct solo5_call_stats *stats) { return SOLO5_R_EUNSPEC; }
+
+solo5_result_t solo5_shm_acquire(const char *name, solo5_handle_t *handle, struct solo5_shm_info *info) { return SOLO5_R_EUNSPEC; }
+solo5_result_t solo5_shm_notify(solo5_handle_t handle) { return SOLO5_R_EUNSPEC; }
+solo5_result_t solo5_pci_acquire(const char *name, solo5_handle_t *handle, struct solo5_pci_info *info) { return SOLO5_R_EUNSPEC; }
+solo5_result_t solo5_vsock_acquire(const char *name, solo5_handle_t *handle, struct solo5_vsock_info *info) { return SOLO5_R_EUNSPEC; }
+solo5_result_t solo5_vsock_write(solo5_handle_t handle, const uint8_t *buf, size_t size, size_t *written) { return SOLO5_R_EINVAL; }
+solo5_result_t solo5_vsock_read(solo5_handle_t handle, uint8_t *buf, size_t size, size_t *read_size) { return SOLO5_R_EINVAL; }
+solo5_result_t solo5_vsock_close(solo5_handle_t handle) { return SOLO5_R_EINVAL; }
+
+unsigned solo5_cpu_count(void) { return 1; }
+solo5_result_t solo5_cpu_start(unsigned cpu, solo5_cpu_entry_t entry, void *arg, uintptr_t stack, uintptr_t tls_base) { return SOLO5_R_EUNSPEC; }
+solo5_result_t solo5_snapshot(void) { return SOLO5_R_EUNSPEC; }
+solo5_result_t solo5_mem_release(uintptr_t addr, size_t size) { return SOLO5_R_EUNSPEC; }
+bool solo5_mem_reclaim_requested(void) { return false; }
+void solo5_trace(uint32_t id, uint64_t arg0, uint64_t arg1) { }
+solo5_result_t solo5_pmu_read(struct solo5_pmu_counters *counters) { return SOLO5_R_EUNSPEC; }
+solo5_result_t solo5_cpu_time(struct solo5_cpu_time *time) { return SOLO5_R_EUNSPEC; }
+void solo5_cpu_info(struct solo5_cpu_info *info) { *info = (struct solo5_cpu_info){ .cache_line_size = 64 }; }
 
 solo5_result_t solo5_set_tls_base(uintptr_t base) { return SOLO5_R_EUNSPEC; }
 
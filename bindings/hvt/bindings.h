@@ -32,14 +32,44 @@
 #include "hvt_abi.h"
 
 void time_init(struct hvt_boot_info *bi);
-void console_init(void);
+void console_init(struct hvt_boot_info *bi);
+void console_restore(void);
 void net_init(struct hvt_boot_info *bi);
+bool net_rings_enabled(void);
+solo5_handle_set_t net_rings_ready_set(void);
+bool net_vhost_attached(solo5_handle_t handle);
+bool net_vhost_enabled(void);
+solo5_handle_set_t net_vhost_ready_set(void);
+solo5_result_t net_vhost_writev(solo5_handle_t handle,
+        struct solo5_net_frame *frames, size_t count);
+solo5_result_t net_vhost_readv(solo5_handle_t handle,
+        struct solo5_net_frame *frames, size_t count, size_t *read_count);
+solo5_result_t net_vhost_read_loan(solo5_handle_t handle, const uint8_t **buf,
+        size_t *size);
+void net_vhost_read_release(solo5_handle_t handle);
+void net_vhost_init(solo5_handle_t handle, uint16_t mtu);
 void block_init(struct hvt_boot_info *bi);
+void shm_init(struct hvt_boot_info *bi);
+void pci_init(struct hvt_boot_info *bi);
+solo5_handle_set_t block_async_handles(void);
+void block_flush(void);
+void block_restore(void);
+void smp_init(struct hvt_boot_info *bi);
+void yield_init(struct hvt_boot_info *bi);
+void yield_restore(void);
+void trace_init(struct hvt_boot_info *bi);
+void trace_restore(void);
+void pmu_init(void);
+void pmu_init_secondary(void);
+void pmu_restore(void);
 
 /* tscclock.c: TSC-based clock */
 uint64_t tscclock_monotonic(void);
 int tscclock_init(uint64_t tsc_freq);
 uint64_t tscclock_epochoffset(void);
+int tscclock_set_time_page(struct hvt_time_page *p);
+uint64_t tscclock_wall(void);
+void tscclock_restore(void);
 
 void process_bootinfo(void *arg);
 
@@ -21,26 +21,21 @@
 #include "bindings.h"
 
 static struct mft *mft;
+static const uint8_t *block_maps[MFT_MAX_ENTRIES];
 
 solo5_result_t solo5_block_write(solo5_handle_t handle, solo5_off_t offset,
         const uint8_t *buf, size_t size)
 {
     struct mft_entry *e = mft_get_by_index(mft, handle, MFT_BLOCK_BASIC);
     if (e == NULL)
-        return SOLO5_R_EINVAL;
-    if (offset & (e->u.block_basic.block_size - 1))
-        return SOLO5_R_EINVAL;
-    /*
-     * Checks for writes beyond capacity are enforced by the tender in the
-     * hypercall handler.
-     */
+        return block_stats_op(handle, BLOCK_STATS_WRITE, SOLO5_R_EINVAL, 0);
     /*
-     * TODO: This artificially enforces the current limit of allowing only
-     * single-block operations. Will be removed once all targets can handle
-     * reads/writes of >1 block.
+     * Checks for writes beyond capacity are additionally enforced by the
+     * tender in the hypercall handler.
      */
-    if (size != e->u.block_basic.block_size)
-        return SOLO5_R_EINVAL;
+    if (!block_request_valid(e->u.block_basic.capacity,
+                e->u.block_basic.block_size, offset, size))
+        return block_stats_op(handle, BLOCK_STATS_WRITE, SOLO5_R_EINVAL, 0);
 
     volatile struct hvt_hc_block_write wr;
     wr.handle = handle;
@@ -51,7 +46,7 @@ solo5_result_t solo5_block_write(solo5_handle_t handle, solo5_off_t offset,
 
     hvt_do_hypercall(HVT_HYPERCALL_BLOCK_WRITE, &wr);
 
-    return wr.ret;
+    return block_stats_op(handle, BLOCK_STATS_WRITE, wr.ret, size);
 }
 
 solo5_result_t solo5_block_read(solo5_handle_t handle, solo5_off_t offset,
@@ -59,20 +54,14 @@ solo5_result_t solo5_block_read(solo5_handle_t handle, solo5_off_t offset,
 {
     struct mft_entry *e = mft_get_by_index(mft, handle, MFT_BLOCK_BASIC);
     if (e == NULL)
-        return SOLO5_R_EINVAL;
-    if (offset & (e->u.block_basic.block_size - 1))
-        return SOLO5_R_EINVAL;
-    /*
-     * Checks for reads beyond capacity are enforced by the tender in the
-     * hypercall handler.
-     */
+        return block_stats_op(handle, BLOCK_STATS_READ, SOLO5_R_EINVAL, 0);
     /*
-     * TODO: This artificially enforces the current limit of allowing only
-     * single-block operations. Will be removed once all targets can handle
-     * reads/writes of >1 block.
+     * Checks for reads beyond capacity are additionally enforced by the
+     * tender in the hypercall handler.
      */
-    if (size != e->u.block_basic.block_size)
-        return SOLO5_R_EINVAL;
+    if (!block_request_valid(e->u.block_basic.capacity,
+                e->u.block_basic.block_size, offset, size))
+        return block_stats_op(handle, BLOCK_STATS_READ, SOLO5_R_EINVAL, 0);
 
     volatile struct hvt_hc_block_read rd;
     rd.handle = handle;
@@ -83,7 +72,450 @@ solo5_result_t solo5_block_read(solo5_handle_t handle, solo5_off_t offset,
 
     hvt_do_hypercall(HVT_HYPERCALL_BLOCK_READ, &rd);
 
-    return rd.ret;
+    return block_stats_op(handle, BLOCK_STATS_READ, rd.ret, size);
+}
+
+/*
+ * Validates a vectored request and translates its segments into (biov[]).
+ */
+static bool block_iov_init(solo5_handle_t handle, solo5_off_t offset,
+        const struct solo5_block_iov *iov, size_t count,
+        struct hvt_block_iov *biov)
+{
+    struct mft_entry *e = mft_get_by_index(mft, handle, MFT_BLOCK_BASIC);
+    if (e == NULL)
+        return false;
+    size_t size = block_iov_size(iov, count, e->u.block_basic.block_size);
+    if (size == 0 || !block_request_valid(e->u.block_basic.capacity,
+                e->u.block_basic.block_size, offset, size))
+        return false;
+
+    for (size_t i = 0; i < count; i++) {
+        biov[i].data = iov[i].buf;
+        biov[i].len = iov[i].size;
+    }
+    return true;
+}
+
+solo5_result_t solo5_block_writev(solo5_handle_t handle, solo5_off_t offset,
+        const struct solo5_block_iov *iov, size_t count)
+{
+    struct hvt_block_iov biov[SOLO5_BLOCK_IOV_MAX];
+
+    if (!block_iov_init(handle, offset, iov, count, biov))
+        return block_stats_op(handle, BLOCK_STATS_WRITE, SOLO5_R_EINVAL, 0);
+
+    volatile struct hvt_hc_block_writev wr;
+    wr.handle = handle;
+    wr.offset = offset;
+    wr.iov = biov;
+    wr.iovcnt = count;
+    wr.ret = 0;
+
+    hvt_do_hypercall(HVT_HYPERCALL_BLOCK_WRITEV, &wr);
+
+    return block_stats_op(handle, BLOCK_STATS_WRITE, wr.ret,
+            block_iov_size(iov, count, 1));
+}
+
+solo5_result_t solo5_block_readv(solo5_handle_t handle, solo5_off_t offset,
+        const struct solo5_block_iov *iov, size_t count)
+{
+    struct hvt_block_iov biov[SOLO5_BLOCK_IOV_MAX];
+
+    if (!block_iov_init(handle, offset, iov, count, biov))
+        return block_stats_op(handle, BLOCK_STATS_READ, SOLO5_R_EINVAL, 0);
+
+    volatile struct hvt_hc_block_readv rd;
+    rd.handle = handle;
+    rd.offset = offset;
+    rd.iov = biov;
+    rd.iovcnt = count;
+    rd.ret = 0;
+
+    hvt_do_hypercall(HVT_HYPERCALL_BLOCK_READV, &rd);
+
+    return block_stats_op(handle, BLOCK_STATS_READ, rd.ret,
+            block_iov_size(iov, count, 1));
+}
+
+solo5_result_t solo5_block_flush(solo5_handle_t handle)
+{
+    if (mft_get_by_index(mft, handle, MFT_BLOCK_BASIC) == NULL)
+        return block_stats_op(handle, BLOCK_STATS_FLUSH, SOLO5_R_EINVAL, 0);
+
+    volatile struct hvt_hc_block_flush fl;
+    fl.handle = handle;
+    fl.ret = 0;
+
+    hvt_do_hypercall(HVT_HYPERCALL_BLOCK_FLUSH, &fl);
+
+    return block_stats_op(handle, BLOCK_STATS_FLUSH, fl.ret, 0);
+}
+
+static bool block_range_check(solo5_handle_t handle, solo5_off_t offset,
+        solo5_off_t size)
+{
+    struct mft_entry *e = mft_get_by_index(mft, handle, MFT_BLOCK_BASIC);
+    return e != NULL && block_range_valid(e->u.block_basic.capacity,
+            e->u.block_basic.block_size, offset, size);
+}
+
+solo5_result_t solo5_block_discard(solo5_handle_t handle, solo5_off_t offset,
+        solo5_off_t size)
+{
+    if (!block_range_check(handle, offset, size))
+        return block_stats_op(handle, BLOCK_STATS_DISCARD, SOLO5_R_EINVAL, 0);
+
+    volatile struct hvt_hc_block_discard dc;
+    dc.handle = handle;
+    dc.offset = offset;
+    dc.len = size;
+    dc.ret = 0;
+
+    hvt_do_hypercall(HVT_HYPERCALL_BLOCK_DISCARD, &dc);
+
+    return block_stats_op(handle, BLOCK_STATS_DISCARD, dc.ret, 0);
+}
+
+solo5_result_t solo5_block_write_zeroes(solo5_handle_t handle,
+        solo5_off_t offset, solo5_off_t size)
+{
+    if (!block_range_check(handle, offset, size))
+        return block_stats_op(handle, BLOCK_STATS_DISCARD, SOLO5_R_EINVAL, 0);
+
+    volatile struct hvt_hc_block_write_zeroes wz;
+    wz.handle = handle;
+    wz.offset = offset;
+    wz.len = size;
+    wz.ret = 0;
+
+    hvt_do_hypercall(HVT_HYPERCALL_BLOCK_WRITE_ZEROES, &wz);
+
+    return block_stats_op(handle, BLOCK_STATS_DISCARD, wz.ret, 0);
+}
+
+solo5_result_t solo5_block_prefetch(solo5_handle_t handle, solo5_off_t offset,
+        solo5_off_t size)
+{
+    if (!block_range_check(handle, offset, size))
+        return SOLO5_R_EINVAL;
+
+    volatile struct hvt_hc_block_prefetch pf;
+    pf.handle = handle;
+    pf.offset = offset;
+    pf.len = size;
+    pf.ret = 0;
+
+    hvt_do_hypercall(HVT_HYPERCALL_BLOCK_PREFETCH, &pf);
+
+    return pf.ret;
+}
+
+/*
+ * Zones are reported by the tender in batches of up to HVT_BLOCK_ZONES_MAX.
+ */
+solo5_result_t solo5_block_zone_report(solo5_handle_t handle,
+        solo5_off_t offset, struct solo5_block_zone *zones, size_t count,
+        size_t *nzones)
+{
+    struct mft_entry *e = mft_get_by_index(mft, handle, MFT_BLOCK_BASIC);
+    if (e == NULL || e->u.block_basic.zone_blocks == 0 ||
+            offset >= e->u.block_basic.capacity)
+        return SOLO5_R_EINVAL;
+
+    struct hvt_block_zone z[HVT_BLOCK_ZONES_MAX];
+    size_t n = 0;
+    while (n < count && offset < e->u.block_basic.capacity) {
+        volatile struct hvt_hc_block_zone_report zr;
+        zr.handle = handle;
+        zr.offset = offset;
+        zr.zones = z;
+        zr.count = (count - n < HVT_BLOCK_ZONES_MAX) ?
+            count - n : HVT_BLOCK_ZONES_MAX;
+        zr.nzones = 0;
+        zr.ret = 0;
+
+        hvt_do_hypercall(HVT_HYPERCALL_BLOCK_ZONE_REPORT, &zr);
+
+        if (zr.ret != SOLO5_R_OK)
+            return zr.ret;
+        for (size_t i = 0; i < zr.nzones; i++) {
+            zones[n + i].start = z[i].start;
+            zones[n + i].size = z[i].size;
+            zones[n + i].capacity = z[i].capacity;
+            zones[n + i].write_pointer = z[i].write_pointer;
+            zones[n + i].type = z[i].type;
+            zones[n + i].cond = z[i].cond;
+        }
+        n += zr.nzones;
+        if (zr.nzones < zr.count)
+            break;
+        offset = z[zr.nzones - 1].start + z[zr.nzones - 1].size;
+    }
+    *nzones = n;
+    return SOLO5_R_OK;
+}
+
+solo5_result_t solo5_block_zone_append(solo5_handle_t handle,
+        solo5_off_t zone, const uint8_t *buf, size_t size,
+        solo5_off_t *offset)
+{
+    struct mft_entry *e = mft_get_by_index(mft, handle, MFT_BLOCK_BASIC);
+    if (e == NULL || e->u.block_basic.zone_blocks == 0 ||
+            !block_request_valid(e->u.block_basic.capacity,
+                e->u.block_basic.block_size, zone, size))
+        return block_stats_op(handle, BLOCK_STATS_WRITE, SOLO5_R_EINVAL, 0);
+
+    volatile struct hvt_hc_block_zone_append za;
+    za.handle = handle;
+    za.zone = zone;
+    za.data = buf;
+    za.len = size;
+    za.ret = 0;
+
+    hvt_do_hypercall(HVT_HYPERCALL_BLOCK_ZONE_APPEND, &za);
+
+    if (za.ret == SOLO5_R_OK)
+        *offset = za.offset;
+    return block_stats_op(handle, BLOCK_STATS_WRITE, za.ret, size);
+}
+
+solo5_result_t solo5_block_zone_manage(solo5_handle_t handle, unsigned op,
+        solo5_off_t zone)
+{
+    struct mft_entry *e = mft_get_by_index(mft, handle, MFT_BLOCK_BASIC);
+    if (e == NULL || e->u.block_basic.zone_blocks == 0)
+        return SOLO5_R_EINVAL;
+
+    volatile struct hvt_hc_block_zone_manage zm;
+    zm.handle = handle;
+    zm.zone = zone;
+    zm.op = op;
+    zm.ret = 0;
+
+    hvt_do_hypercall(HVT_HYPERCALL_BLOCK_ZONE_MANAGE, &zm);
+
+    return zm.ret;
+}
+
+solo5_result_t solo5_block_map(solo5_handle_t handle, const uint8_t **data)
+{
+    if (mft_get_by_index(mft, handle, MFT_BLOCK_BASIC) == NULL ||
+            block_maps[handle] == NULL)
+        return SOLO5_R_EINVAL;
+
+    *data = block_maps[handle];
+    return SOLO5_R_OK;
+}
+
+/*
+ * Asynchronous requests are performed by the tender. Submissions are batched
+ * in (block_batch) and passed to the tender by block_flush(), which is called
+ * when the batch is full, on solo5_block_reap() and on solo5_yield(). Requests
+ * are fully validated here, so the tender accepts every request in a batch.
+ * The number outstanding on each device is tracked to enforce the queue limit
+ * and to let solo5_yield() know where to look for completions.
+ */
+static unsigned block_outstanding[MFT_MAX_ENTRIES];
+static solo5_handle_set_t block_outstanding_set;
+static struct hvt_block_req block_batch[SOLO5_BLOCK_QUEUE_MAX];
+static size_t block_batch_len;
+
+solo5_handle_set_t block_async_handles(void)
+{
+    return block_outstanding_set;
+}
+
+void block_flush(void)
+{
+    if (block_batch_len == 0)
+        return;
+
+    volatile struct hvt_hc_block_submit sb;
+    sb.reqs = block_batch;
+    sb.count = block_batch_len;
+    sb.ret = 0;
+
+    hvt_do_hypercall(HVT_HYPERCALL_BLOCK_SUBMIT, &sb);
+
+    assert(sb.ret == SOLO5_R_OK && sb.count == block_batch_len);
+    block_batch_len = 0;
+}
+
+static solo5_result_t block_submit(solo5_handle_t handle, uint64_t op,
+        solo5_off_t offset, const uint8_t *buf, size_t size, uint64_t buffer,
+        uint64_t tag)
+{
+    struct mft_entry *e = mft_get_by_index(mft, handle, MFT_BLOCK_BASIC);
+    if (e == NULL)
+        return SOLO5_R_EINVAL;
+    if (op != HVT_BLOCK_OP_FLUSH &&
+            !block_request_valid(e->u.block_basic.capacity,
+                e->u.block_basic.block_size, offset, size))
+        return SOLO5_R_EINVAL;
+    if (block_outstanding[handle] == SOLO5_BLOCK_QUEUE_MAX)
+        return SOLO5_R_AGAIN;
+
+    if (block_batch_len == SOLO5_BLOCK_QUEUE_MAX)
+        block_flush();
+    struct hvt_block_req *r = &block_batch[block_batch_len++];
+    r->handle = handle;
+    r->op = op;
+    r->offset = offset;
+    r->data = (void *)buf;
+    r->len = size;
+    r->tag = tag;
+    r->buffer = buffer;
+
+    block_outstanding[handle]++;
+    block_outstanding_set |= 1ULL << handle;
+    return SOLO5_R_OK;
+}
+
+solo5_result_t solo5_block_submit_read(solo5_handle_t handle,
+        solo5_off_t offset, uint8_t *buf, size_t size, uint64_t tag)
+{
+    solo5_result_t rc =
+        block_submit(handle, HVT_BLOCK_OP_READ, offset, buf, size, 0, tag);
+    return block_stats_op(handle, BLOCK_STATS_READ, rc, size);
+}
+
+solo5_result_t solo5_block_submit_write(solo5_handle_t handle,
+        solo5_off_t offset, const uint8_t *buf, size_t size, uint64_t tag)
+{
+    solo5_result_t rc =
+        block_submit(handle, HVT_BLOCK_OP_WRITE, offset, buf, size, 0, tag);
+    return block_stats_op(handle, BLOCK_STATS_WRITE, rc, size);
+}
+
+solo5_result_t solo5_block_submit_flush(solo5_handle_t handle, uint64_t tag)
+{
+    solo5_result_t rc =
+        block_submit(handle, HVT_BLOCK_OP_FLUSH, 0, NULL, 0, 0, tag);
+    return block_stats_op(handle, BLOCK_STATS_FLUSH, rc, 0);
+}
+
+/*
+ * Registered buffers are listed in (block_buffers), which the tender reads
+ * when each is registered, see HVT_HYPERCALL_BLOCK_REGISTER. Requests for them
+ * pass the offset in the buffer in place of its address.
+ */
+static struct hvt_block_buffer
+    block_buffers[MFT_MAX_ENTRIES][HVT_BLOCK_BUFFERS_MAX];
+static unsigned block_nbuffers[MFT_MAX_ENTRIES];
+
+static int block_register(solo5_handle_t handle, unsigned index)
+{
+    volatile struct hvt_hc_block_register rg;
+
+    rg.buffers = &block_buffers[0][0];
+    rg.handle = handle;
+    rg.index = index;
+    rg.ret = 0;
+    hvt_do_hypercall(HVT_HYPERCALL_BLOCK_REGISTER, &rg);
+    return rg.ret;
+}
+
+solo5_result_t solo5_block_register_buffer(solo5_handle_t handle,
+        uint8_t *buf, size_t size, unsigned *index)
+{
+    if (mft_get_by_index(mft, handle, MFT_BLOCK_BASIC) == NULL || size == 0)
+        return SOLO5_R_EINVAL;
+    unsigned n = block_nbuffers[handle];
+    if (n == HVT_BLOCK_BUFFERS_MAX)
+        return SOLO5_R_AGAIN;
+
+    block_buffers[handle][n].data = buf;
+    block_buffers[handle][n].len = size;
+    solo5_result_t rc = block_register(handle, n);
+    if (rc != SOLO5_R_OK) {
+        block_buffers[handle][n].len = 0;
+        return rc;
+    }
+    block_nbuffers[handle]++;
+    *index = n;
+    return SOLO5_R_OK;
+}
+
+static solo5_result_t block_submit_fixed(solo5_handle_t handle, uint64_t op,
+        solo5_off_t offset, unsigned index, size_t buf_offset, size_t size,
+        uint64_t tag)
+{
+    if (mft_get_by_index(mft, handle, MFT_BLOCK_BASIC) == NULL ||
+            index >= block_nbuffers[handle] ||
+            buf_offset > block_buffers[handle][index].len ||
+            size > block_buffers[handle][index].len - buf_offset)
+        return SOLO5_R_EINVAL;
+    return block_submit(handle, op, offset, (const uint8_t *)buf_offset,
+            size, index, tag);
+}
+
+solo5_result_t solo5_block_submit_read_fixed(solo5_handle_t handle,
+        solo5_off_t offset, unsigned index, size_t buf_offset, size_t size,
+        uint64_t tag)
+{
+    solo5_result_t rc = block_submit_fixed(handle, HVT_BLOCK_OP_READ_FIXED,
+            offset, index, buf_offset, size, tag);
+    return block_stats_op(handle, BLOCK_STATS_READ, rc, size);
+}
+
+solo5_result_t solo5_block_submit_write_fixed(solo5_handle_t handle,
+        solo5_off_t offset, unsigned index, size_t buf_offset, size_t size,
+        uint64_t tag)
+{
+    solo5_result_t rc = block_submit_fixed(handle, HVT_BLOCK_OP_WRITE_FIXED,
+            offset, index, buf_offset, size, tag);
+    return block_stats_op(handle, BLOCK_STATS_WRITE, rc, size);
+}
+
+/*
+ * After restoring from a snapshot, the buffers must be registered with the
+ * new tender.
+ */
+void block_restore(void)
+{
+    for (unsigned i = 0; i != MFT_MAX_ENTRIES; i++) {
+        for (unsigned j = 0; j != block_nbuffers[i]; j++) {
+            if (block_register(i, j) != SOLO5_R_OK)
+                PANIC("Could not register block buffer", NULL);
+        }
+    }
+}
+
+solo5_result_t solo5_block_reap(solo5_handle_t handle,
+        struct solo5_block_completion *completions, size_t count,
+        size_t *reaped)
+{
+    struct hvt_block_completion c[SOLO5_BLOCK_QUEUE_MAX];
+
+    if (mft_get_by_index(mft, handle, MFT_BLOCK_BASIC) == NULL)
+        return SOLO5_R_EINVAL;
+    if (block_outstanding[handle] == 0)
+        return SOLO5_R_AGAIN;
+    block_flush();
+    if (count > SOLO5_BLOCK_QUEUE_MAX)
+        count = SOLO5_BLOCK_QUEUE_MAX;
+
+    volatile struct hvt_hc_block_reap rp;
+    rp.handle = handle;
+    rp.completions = c;
+    rp.count = count;
+    rp.ret = 0;
+
+    hvt_do_hypercall(HVT_HYPERCALL_BLOCK_REAP, &rp);
+
+    if (rp.ret != SOLO5_R_OK)
+        return rp.ret;
+    for (size_t i = 0; i < rp.count; i++) {
+        completions[i].tag = c[i].tag;
+        completions[i].result = c[i].ret;
+    }
+    block_outstanding[handle] -= rp.count;
+    if (block_outstanding[handle] == 0)
+        block_outstanding_set &= ~(1ULL << handle);
+    *reaped = rp.count;
+    return block_stats_reap(handle, SOLO5_R_OK, completions, rp.count);
 }
 
 solo5_result_t solo5_block_acquire(const char *name, solo5_handle_t *handle,
@@ -96,12 +528,46 @@ solo5_result_t solo5_block_acquire(const char *name, solo5_handle_t *handle,
     assert(e->attached);
 
     *handle = index;
+    stats_acquire(index, MFT_BLOCK_BASIC);
     info->capacity = e->u.block_basic.capacity;
     info->block_size = e->u.block_basic.block_size;
+    info->zone_size = (solo5_off_t)e->u.block_basic.zone_blocks *
+        e->u.block_basic.block_size;
     return SOLO5_R_OK;
 }
 
+/*
+ * Devices attached with MFT_BLOCK_MAPPED are mapped by the tender over guest
+ * memory set aside for them here, before the heap is passed to the
+ * application.
+ */
+static void block_map_init(unsigned i)
+{
+    const uintptr_t align = HVT_BLOCK_MAP_ALIGN;
+    uint64_t size = (mft->e[i].u.block_basic.capacity + align - 1) &
+        ~(align - 1);
+    uintptr_t p = (uintptr_t)mem_ialloc_pages((size + align - PAGE_SIZE) >>
+            PAGE_SHIFT);
+
+    volatile struct hvt_hc_block_map mp;
+    mp.handle = i;
+    mp.data = (void *)((p + align - 1) & ~(align - 1));
+    mp.ret = 0;
+
+    hvt_do_hypercall(HVT_HYPERCALL_BLOCK_MAP, &mp);
+
+    if (mp.ret != SOLO5_R_OK)
+        PANIC("Could not map block device", NULL);
+    block_maps[i] = mp.data;
+}
+
 void block_init(struct hvt_boot_info *bi)
 {
     mft = bi->mft;
+
+    for (unsigned i = 0; i != mft->entries; i++) {
+        if (mft->e[i].type == MFT_BLOCK_BASIC && mft->e[i].attached &&
+                (mft->e[i].u.block_basic.flags & MFT_BLOCK_MAPPED))
+            block_map_init(i);
+    }
 }
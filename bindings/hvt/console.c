@@ -20,7 +20,16 @@
 
 #include "bindings.h"
 
-int platform_puts(const char *buf, int n)
+/*
+ * Console output ring (HVT_FEATURE_CONSOLE_RING), drained by the tender on
+ * each exit. Only one CPU may append to it at once, others use
+ * HVT_HYPERCALL_PUTS.
+ */
+static struct hvt_console_ring console_ring __attribute__((aligned(64)));
+static bool console_ring_registered;
+static bool console_ring_lock;
+
+static int puts_hypercall(const char *buf, int n)
 {
     struct hvt_hc_puts str;
 
@@ -32,11 +41,65 @@ int platform_puts(const char *buf, int n)
     return str.len;
 }
 
+/*
+ * Appends (buf) to the ring, returning false if it does not have room.
+ */
+static bool ring_puts(const char *buf, size_t n)
+{
+    struct hvt_console_ring *r = &console_ring;
+
+    if (__atomic_test_and_set(&console_ring_lock, __ATOMIC_ACQUIRE))
+        return false;
+    uint64_t head = r->head;
+    uint64_t tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+    bool room = n <= HVT_CONSOLE_RING_SIZE - (head - tail);
+    if (room) {
+        size_t off = head & (HVT_CONSOLE_RING_SIZE - 1);
+        size_t len = HVT_CONSOLE_RING_SIZE - off;
+        if (len > n)
+            len = n;
+        memcpy(r->data + off, buf, len);
+        memcpy(r->data, buf + len, n - len);
+        __atomic_store_n(&r->head, head + n, __ATOMIC_RELEASE);
+    }
+    __atomic_clear(&console_ring_lock, __ATOMIC_RELEASE);
+    return room;
+}
+
+int platform_puts(const char *buf, int n)
+{
+    if (console_ring_registered && ring_puts(buf, n))
+        return n;
+    return puts_hypercall(buf, n);
+}
+
 void solo5_console_write(const char *buf, size_t size)
 {
-    (void)platform_puts(buf, size);
+    console_write(buf, size);
+}
+
+static void console_ring_register(void)
+{
+    volatile struct hvt_hc_console_ring cr;
+
+    cr.ring = &console_ring;
+    cr.ret = 0;
+    hvt_do_hypercall(HVT_HYPERCALL_CONSOLE_RING, &cr);
+    console_ring_registered = (cr.ret == SOLO5_R_OK);
 }
 
-void console_init(void)
+void console_init(struct hvt_boot_info *bi)
+{
+    if (bi->features & HVT_FEATURE_CONSOLE_RING)
+        console_ring_register();
+}
+
+/*
+ * After restoring from a snapshot, the ring must be registered with the new
+ * tender, which then writes out anything left in it.
+ */
+void console_restore(void)
 {
+    if (console_ring_registered)
+        console_ring_register();
 }
@@ -22,10 +22,147 @@
 
 static struct mft *mft;
 
+/*
+ * Shared-memory packet rings, if offered by the tender. See hvt_abi.h for a
+ * description of the protocol.
+ */
+static struct {
+    struct hvt_net_ring *rx;
+    struct hvt_net_ring *tx;
+} rings[MFT_MAX_ENTRIES];
+static solo5_handle_set_t ring_handles;
+
+static bool ring_empty(struct hvt_net_ring *r)
+{
+    return ring_cons_avail(&r->idx) == 0;
+}
+
+static struct hvt_net_ring *ring_get(solo5_handle_t handle, bool tx)
+{
+    if (handle >= MFT_MAX_ENTRIES || !(ring_handles & (1ULL << handle)))
+        return NULL;
+    return tx ? rings[handle].tx : rings[handle].rx;
+}
+
+/*
+ * Queues a packet on (r) as packet (*queued) of a batch, or returns
+ * SOLO5_R_AGAIN if the ring is full, so that the caller can retry once the
+ * tender has caught up. The caller must call ring_tx_kick() to publish the
+ * batch.
+ */
+static solo5_result_t ring_put(struct hvt_net_ring *r, const uint8_t *buf,
+        size_t size, uint32_t *queued)
+{
+    if (size > sizeof r->slot[0].data)
+        return SOLO5_R_EINVAL;
+    if (ring_prod_free(&r->idx, HVT_NET_RING_SLOTS) <= *queued)
+        return SOLO5_R_AGAIN;
+
+    struct hvt_net_ring_slot *slot = &r->slot[ring_slot(
+            ring_prod_pos(&r->idx) + *queued, HVT_NET_RING_SLOTS)];
+    memcpy(slot->data, buf, size);
+    slot->len = size;
+    (*queued)++;
+    return SOLO5_R_OK;
+}
+
+/*
+ * Publishes the (queued) packets of a batch, ringing the doorbell if the
+ * tender may have gone idle before seeing them.
+ */
+static void ring_tx_kick(solo5_handle_t handle, struct hvt_net_ring *r,
+        uint32_t queued)
+{
+    uint32_t pos = ring_prod_pos(&r->idx);
+
+    if (queued == 0)
+        return;
+    ring_prod_publish(&r->idx, queued);
+    ring_fence();
+    if (ring_prod_drained(&r->idx, pos)) {
+        volatile struct hvt_hc_net_notify nt;
+
+        nt.handle = handle;
+        hvt_do_hypercall(HVT_HYPERCALL_NET_NOTIFY, &nt);
+    }
+}
+
+/*
+ * Returns packet (i) of those available in (r), or NULL if there are no more.
+ */
+static struct hvt_net_ring_slot *ring_peek(struct hvt_net_ring *r, uint32_t i)
+{
+    if (ring_cons_avail(&r->idx) <= i)
+        return NULL;
+    return &r->slot[ring_slot(ring_cons_pos(&r->idx) + i,
+            HVT_NET_RING_SLOTS)];
+}
+
+static void ring_consume(struct hvt_net_ring *r, uint32_t n)
+{
+    ring_cons_release(&r->idx, n);
+}
+
+/*
+ * Copies out packet (i) of those available in (r), which the caller must
+ * then consume.
+ */
+static solo5_result_t ring_get_packet(struct hvt_net_ring *r, uint32_t i,
+        uint8_t *buf, size_t size, size_t *read_size, solo5_time_t *tstamp)
+{
+    struct hvt_net_ring_slot *slot = ring_peek(r, i);
+
+    if (slot == NULL)
+        return SOLO5_R_AGAIN;
+
+    size_t len = slot->len;
+    if (len > size)
+        len = size;
+    memcpy(buf, slot->data, len);
+    *read_size = len;
+    *tstamp = slot->tstamp;
+    return SOLO5_R_OK;
+}
+
+solo5_handle_set_t net_rings_ready_set(void)
+{
+    solo5_handle_set_t ready_set = 0;
+
+    /*
+     * Pairs with the fence in the tender after producing into (rx), ensuring
+     * that either we see the new (prod) or the tender sees our (cons) and
+     * wakes us up.
+     */
+    ring_fence();
+    for (unsigned i = 0; i != MFT_MAX_ENTRIES; i++) {
+        if ((ring_handles & (1ULL << i)) && !ring_empty(rings[i].rx))
+            ready_set |= 1ULL << i;
+    }
+    return ready_set | net_vhost_ready_set();
+}
+
+bool net_rings_enabled(void)
+{
+    return ring_handles != 0 || net_vhost_enabled();
+}
+
 solo5_result_t solo5_net_write(solo5_handle_t handle, const uint8_t *buf,
         size_t size)
 {
     volatile struct hvt_hc_net_write wr;
+    struct hvt_net_ring *r = ring_get(handle, true);
+
+    if (net_vhost_attached(handle)) {
+        struct solo5_net_frame frame = { .buf = (uint8_t *)buf, .size = size };
+        return net_stats_tx(handle, net_vhost_writev(handle, &frame, 1),
+                size);
+    }
+    if (r != NULL) {
+        uint32_t queued = 0;
+        solo5_result_t rc = ring_put(r, buf, size, &queued);
+        ring_tx_kick(handle, r, queued);
+        return net_stats_tx(handle, rc, size);
+    }
 
     wr.handle = handle;
     wr.data = buf;
@@ -34,13 +171,30 @@ solo5_result_t solo5_net_write(solo5_handle_t handle, const uint8_t *buf,
 
     hvt_do_hypercall(HVT_HYPERCALL_NET_WRITE, &wr);
 
-    return wr.ret;
+    return net_stats_tx(handle, wr.ret, size);
 }
 
 solo5_result_t solo5_net_read(solo5_handle_t handle, uint8_t *buf, size_t size,
         size_t *read_size)
 {
     volatile struct hvt_hc_net_read rd;
+    struct hvt_net_ring *r = ring_get(handle, false);
+
+    if (net_vhost_attached(handle)) {
+        struct solo5_net_frame frame = { .buf = buf, .size = size };
+        size_t n;
+        solo5_result_t rc = net_vhost_readv(handle, &frame, 1, &n);
+        *read_size = frame.size;
+        return net_stats_rx(handle, rc, frame.size);
+    }
+    if (r != NULL) {
+        solo5_time_t tstamp;
+        solo5_result_t rc = ring_get_packet(r, 0, buf, size, read_size,
+                &tstamp);
+        if (rc == SOLO5_R_OK)
+            ring_consume(r, 1);
+        return net_stats_rx(handle, rc, rc == SOLO5_R_OK ? *read_size : 0);
+    }
 
     rd.handle = handle;
     rd.data = buf;
@@ -50,7 +204,198 @@ solo5_result_t solo5_net_read(solo5_handle_t handle, uint8_t *buf, size_t size,
     hvt_do_hypercall(HVT_HYPERCALL_NET_READ, &rd);
 
     *read_size = rd.len;
-    return rd.ret;
+    return net_stats_rx(handle, rd.ret, rd.len);
+}
+
+solo5_result_t solo5_net_writev(solo5_handle_t handle,
+        struct solo5_net_frame *frames, size_t count)
+{
+    volatile struct hvt_hc_net_writev wr;
+    volatile struct hvt_net_iov iov[HVT_NET_IOV_MAX];
+
+    struct hvt_net_ring *r = ring_get(handle, true);
+
+    if (count > SOLO5_NET_FRAMES_MAX || count > HVT_NET_IOV_MAX)
+        return net_stats_tx(handle, SOLO5_R_EINVAL, 0);
+
+    if (net_vhost_attached(handle))
+        return net_stats_txv(handle, net_vhost_writev(handle, frames, count),
+                frames, count);
+    if (r != NULL) {
+        uint32_t queued = 0;
+        solo5_result_t rc = SOLO5_R_OK;
+        for (size_t i = 0; i < count; i++) {
+            frames[i].result = ring_put(r, frames[i].buf, frames[i].size,
+                    &queued);
+            if (frames[i].result != SOLO5_R_OK && rc == SOLO5_R_OK)
+                rc = frames[i].result;
+        }
+        ring_tx_kick(handle, r, queued);
+        return net_stats_txv(handle, rc, frames, count);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        iov[i].data = frames[i].buf;
+        iov[i].len = frames[i].size;
+        iov[i].ret = 0;
+    }
+    wr.handle = handle;
+    wr.iov = (struct hvt_net_iov *)iov;
+    wr.iovcnt = count;
+    wr.ret = 0;
+
+    hvt_do_hypercall(HVT_HYPERCALL_NET_WRITEV, &wr);
+
+    if (wr.ret == SOLO5_R_EINVAL)
+        return net_stats_tx(handle, wr.ret, 0);
+    for (size_t i = 0; i < count; i++)
+        frames[i].result = iov[i].ret;
+    return net_stats_txv(handle, wr.ret, frames, count);
+}
+
+solo5_result_t solo5_net_readv(solo5_handle_t handle,
+        struct solo5_net_frame *frames, size_t count, size_t *read_count)
+{
+    volatile struct hvt_hc_net_readv rd;
+    volatile struct hvt_net_iov iov[HVT_NET_IOV_MAX];
+
+    struct hvt_net_ring *r = ring_get(handle, false);
+
+    if (count > SOLO5_NET_FRAMES_MAX || count > HVT_NET_IOV_MAX)
+        return net_stats_rx(handle, SOLO5_R_EINVAL, 0);
+
+    if (net_vhost_attached(handle)) {
+        solo5_result_t rc = net_vhost_readv(handle, frames, count, read_count);
+        return net_stats_rxv(handle, rc, frames,
+                rc == SOLO5_R_OK ? *read_count : 0);
+    }
+    if (r != NULL) {
+        size_t n;
+        for (n = 0; n < count; n++) {
+            frames[n].result = ring_get_packet(r, n, frames[n].buf,
+                    frames[n].size, &frames[n].size, &frames[n].tstamp);
+            if (frames[n].result != SOLO5_R_OK)
+                break;
+        }
+        ring_consume(r, n);
+        if (n == 0)
+            return net_stats_rx(handle, SOLO5_R_AGAIN, 0);
+        *read_count = n;
+        return net_stats_rxv(handle, SOLO5_R_OK, frames, n);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        iov[i].data = frames[i].buf;
+        iov[i].len = frames[i].size;
+        iov[i].ret = 0;
+    }
+    rd.handle = handle;
+    rd.iov = (struct hvt_net_iov *)iov;
+    rd.iovcnt = count;
+    rd.ret = 0;
+
+    hvt_do_hypercall(HVT_HYPERCALL_NET_READV, &rd);
+
+    if (rd.ret != SOLO5_R_OK)
+        return net_stats_rx(handle, rd.ret, 0);
+    for (size_t i = 0; i < rd.iovcnt; i++) {
+        frames[i].size = iov[i].len;
+        frames[i].result = iov[i].ret;
+        frames[i].tstamp = iov[i].tstamp;
+    }
+    *read_count = rd.iovcnt;
+    return net_stats_rxv(handle, rd.ret, frames, rd.iovcnt);
+}
+
+/*
+ * Packets on loan to the application. Rings are loaned from in place;
+ * otherwise the packet is read into a per-device buffer allocated in
+ * net_init().
+ */
+static struct {
+    uint8_t *buf;
+    size_t size;
+    bool on_loan;
+} loans[MFT_MAX_ENTRIES];
+
+solo5_result_t solo5_net_read_loan(solo5_handle_t handle, const uint8_t **buf,
+        size_t *size)
+{
+    struct hvt_net_ring *r = ring_get(handle, false);
+    solo5_result_t rc;
+
+    if (handle >= MFT_MAX_ENTRIES || loans[handle].on_loan)
+        return SOLO5_R_EINVAL;
+
+    if (net_vhost_attached(handle)) {
+        rc = net_vhost_read_loan(handle, buf, size);
+        (void)net_stats_rx(handle, rc, rc == SOLO5_R_OK ? *size : 0);
+    }
+    else if (r != NULL) {
+        struct hvt_net_ring_slot *slot = ring_peek(r, 0);
+        if (slot == NULL)
+            return net_stats_rx(handle, SOLO5_R_AGAIN, 0);
+        *buf = slot->data;
+        *size = slot->len;
+        rc = net_stats_rx(handle, SOLO5_R_OK, *size);
+    }
+    else if (loans[handle].buf != NULL) {
+        rc = solo5_net_read(handle, loans[handle].buf, loans[handle].size,
+                size);
+        *buf = loans[handle].buf;
+    }
+    else
+        return SOLO5_R_EINVAL;
+
+    if (rc == SOLO5_R_OK)
+        loans[handle].on_loan = true;
+    return rc;
+}
+
+solo5_result_t solo5_net_read_release(solo5_handle_t handle)
+{
+    struct hvt_net_ring *r = ring_get(handle, false);
+
+    if (handle >= MFT_MAX_ENTRIES || !loans[handle].on_loan)
+        return SOLO5_R_EINVAL;
+
+    if (net_vhost_attached(handle))
+        net_vhost_read_release(handle);
+    else if (r != NULL)
+        ring_consume(r, 1);
+    loans[handle].on_loan = false;
+    return SOLO5_R_OK;
+}
+
+/*
+ * Packets loaned with solo5_net_write_loan() are copied out by the tender
+ * before it returns, so they are complete as soon as they are sent.
+ */
+static struct net_wloans wloans[MFT_MAX_ENTRIES];
+
+solo5_result_t solo5_net_write_loan(solo5_handle_t handle, const uint8_t *buf,
+        size_t size)
+{
+    if (handle >= MFT_MAX_ENTRIES)
+        return SOLO5_R_EINVAL;
+    if (net_wloans_full(&wloans[handle]))
+        return SOLO5_R_AGAIN;
+
+    solo5_result_t rc = solo5_net_write(handle, buf, size);
+    if (rc == SOLO5_R_OK) {
+        net_wloans_push(&wloans[handle], buf);
+        net_wloans_complete(&wloans[handle], 1);
+    }
+    return rc;
+}
+
+solo5_result_t solo5_net_write_reclaim(solo5_handle_t handle,
+        const uint8_t **bufs, size_t count, size_t *reclaimed)
+{
+    if (handle >= MFT_MAX_ENTRIES)
+        return SOLO5_R_EINVAL;
+
+    return net_wloans_reclaim(&wloans[handle], bufs, count, reclaimed);
 }
 
 solo5_result_t solo5_net_acquire(const char *name, solo5_handle_t *handle,
@@ -63,13 +408,74 @@ solo5_result_t solo5_net_acquire(const char *name, solo5_handle_t *handle,
     assert(e->attached);
 
     *handle = index;
+    stats_acquire(index, MFT_NET_BASIC);
     info->mtu = e->u.net_basic.mtu;
+    info->offloads = e->u.net_basic.offloads;
     memcpy(info->mac_address, e->u.net_basic.mac,
             sizeof info->mac_address);
     return SOLO5_R_OK;
 }
 
+static struct hvt_net_ring *ring_alloc(void)
+{
+    size_t pages = (sizeof (struct hvt_net_ring) + PAGE_SIZE - 1) >> PAGE_SHIFT;
+    struct hvt_net_ring *r = mem_ialloc_pages(pages);
+
+    memset(r, 0, pages << PAGE_SHIFT);
+    return r;
+}
+
+static void loan_init(unsigned i)
+{
+    struct mft_net_basic *nb = &mft->e[i].u.net_basic;
+    size_t size;
+
+    if (nb->offloads & (MFT_NET_OFFLOAD_TSO4 | MFT_NET_OFFLOAD_TSO6))
+        size = SOLO5_NET_HDR_LEN + SOLO5_NET_GSO_FRAME_MAX;
+    else
+        size = ((nb->offloads & MFT_NET_OFFLOAD_HDR) ? SOLO5_NET_HDR_LEN : 0) +
+            nb->mtu + SOLO5_NET_HLEN;
+    loans[i].buf = mem_ialloc_pages((size + PAGE_SIZE - 1) >> PAGE_SHIFT);
+    loans[i].size = size;
+}
+
 void net_init(struct hvt_boot_info *bi)
 {
     mft = bi->mft;
+
+    if (!(bi->features & (HVT_FEATURE_NET_VHOST | HVT_FEATURE_NET_RINGS))) {
+        for (unsigned i = 0; i != mft->entries; i++) {
+            if (mft->e[i].type == MFT_NET_BASIC && mft->e[i].attached)
+                loan_init(i);
+        }
+        return;
+    }
+
+    if (bi->features & HVT_FEATURE_NET_VHOST) {
+        for (unsigned i = 0; i != mft->entries; i++) {
+            if (mft->e[i].type == MFT_NET_BASIC && mft->e[i].attached)
+                net_vhost_init(i, mft->e[i].u.net_basic.mtu);
+        }
+        return;
+    }
+    if (!(bi->features & HVT_FEATURE_NET_RINGS))
+        return;
+
+    for (unsigned i = 0; i != mft->entries; i++) {
+        if (mft->e[i].type != MFT_NET_BASIC || !mft->e[i].attached)
+            continue;
+
+        volatile struct hvt_hc_net_rings rs;
+
+        rings[i].rx = ring_alloc();
+        rings[i].tx = ring_alloc();
+        rs.handle = i;
+        rs.rx = rings[i].rx;
+        rs.tx = rings[i].tx;
+        rs.ret = 0;
+        hvt_do_hypercall(HVT_HYPERCALL_NET_RINGS, &rs);
+        if (rs.ret != SOLO5_R_OK)
+            PANIC("Could not set up network packet rings", NULL);
+        ring_handles |= 1ULL << i;
+    }
 }
@@ -0,0 +1,278 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * virtio rings for network devices served by vhost-net in the host kernel
+ * (HVT_FEATURE_NET_VHOST). See hvt_abi.h for a description of the protocol.
+ *
+ * Each descriptor maps 1:1 to a fixed buffer, sized in multiples of
+ * VQ_BUF_SIZE to hold a frame of the device's MTU. The receive queue is kept
+ * fully stocked with buffers; transmit buffers are reclaimed lazily when
+ * queueing new packets. vhost-net completes transmit buffers in order, which
+ * lets us reclaim them by count alone.
+ */
+
+#include "bindings.h"
+#include "../virtio/virtio_ring.h"
+
+#define VQ_MASK         (HVT_NET_VRING_NUM - 1)
+#define VQ_BUF_SIZE     2048
+
+struct vq {
+    struct virtq_desc *desc;
+    struct virtq_avail *avail;
+    struct virtq_used *used;
+    uint8_t *bufs;
+    size_t buf_size;
+
+    uint16_t next_avail;
+    uint16_t last_used;
+};
+
+static struct vq vqs[MFT_MAX_ENTRIES][2];
+static solo5_handle_set_t vhost_handles;
+
+static void *vq_alloc(size_t size)
+{
+    size_t pages = (size + PAGE_SIZE - 1) >> PAGE_SHIFT;
+    void *p = mem_ialloc_pages(pages);
+
+    memset(p, 0, pages << PAGE_SHIFT);
+    return p;
+}
+
+static void vq_init(struct vq *q, size_t buf_size)
+{
+    q->desc = vq_alloc(sizeof (struct virtq_desc) * HVT_NET_VRING_NUM);
+    q->avail = vq_alloc(sizeof (struct virtq_avail) +
+            sizeof (le16) * (HVT_NET_VRING_NUM + 1));
+    q->used = vq_alloc(sizeof (struct virtq_used) +
+            sizeof (struct virtq_used_elem) * HVT_NET_VRING_NUM +
+            sizeof (le16));
+    q->buf_size = buf_size;
+    q->bufs = vq_alloc(buf_size * HVT_NET_VRING_NUM);
+    for (unsigned i = 0; i != HVT_NET_VRING_NUM; i++)
+        q->desc[i].addr = (uint64_t)(q->bufs + (i * buf_size));
+}
+
+static void vq_kick(solo5_handle_t handle, unsigned queue)
+{
+    struct vq *q = &vqs[handle][queue];
+
+    /*
+     * Ensure the host either sees our new (avail->idx), or we see that it
+     * wants to be notified.
+     */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&q->used->flags, __ATOMIC_RELAXED) &
+            VIRTQ_USED_F_NO_NOTIFY)
+        return;
+    hvt_do_hypercall(HVT_HYPERCALL_NET_KICK,
+            (void *)(uintptr_t)HVT_NET_VRING_QUEUE(handle, queue));
+}
+
+static void vq_publish(struct vq *q, uint16_t id)
+{
+    uint16_t idx = q->avail->idx;
+
+    q->avail->ring[idx & VQ_MASK] = id;
+    __atomic_store_n(&q->avail->idx, idx + 1, __ATOMIC_RELEASE);
+}
+
+static solo5_result_t vq_put(struct vq *q, const uint8_t *buf, size_t size)
+{
+    if (size > q->buf_size - HVT_NET_VRING_HDR_LEN)
+        return SOLO5_R_EINVAL;
+
+    q->last_used = __atomic_load_n(&q->used->idx, __ATOMIC_ACQUIRE);
+    if ((uint16_t)(q->next_avail - q->last_used) >= HVT_NET_VRING_NUM)
+        return SOLO5_R_OK; /* Queue full, drop packet */
+
+    uint16_t id = q->next_avail & VQ_MASK;
+    uint8_t *data = q->bufs + (id * q->buf_size);
+    memset(data, 0, HVT_NET_VRING_HDR_LEN);
+    memcpy(data + HVT_NET_VRING_HDR_LEN, buf, size);
+    q->desc[id].len = HVT_NET_VRING_HDR_LEN + size;
+    q->desc[id].flags = 0;
+    vq_publish(q, id);
+    q->next_avail++;
+    return SOLO5_R_OK;
+}
+
+static struct virtq_used_elem *vq_peek(struct vq *q)
+{
+    if (__atomic_load_n(&q->used->idx, __ATOMIC_ACQUIRE) == q->last_used)
+        return NULL;
+    return &q->used->ring[q->last_used & VQ_MASK];
+}
+
+static uint8_t *vq_elem_data(struct vq *q, struct virtq_used_elem *e,
+        size_t *len)
+{
+    *len = (e->len > HVT_NET_VRING_HDR_LEN) ?
+        e->len - HVT_NET_VRING_HDR_LEN : 0;
+    return q->bufs + ((e->id & VQ_MASK) * q->buf_size) +
+        HVT_NET_VRING_HDR_LEN;
+}
+
+/*
+ * Returns the buffer at (q->last_used) to the host. The caller must call
+ * vq_kick() once done.
+ */
+static void vq_recycle(struct vq *q)
+{
+    uint16_t id = q->used->ring[q->last_used & VQ_MASK].id & VQ_MASK;
+
+    q->last_used++;
+    vq_publish(q, id);
+}
+
+static solo5_result_t vq_get(struct vq *q, uint8_t *buf, size_t size,
+        size_t *read_size)
+{
+    struct virtq_used_elem *e = vq_peek(q);
+    size_t len;
+
+    if (e == NULL)
+        return SOLO5_R_AGAIN;
+
+    uint8_t *data = vq_elem_data(q, e, &len);
+    if (len > size)
+        len = size;
+    memcpy(buf, data, len);
+    *read_size = len;
+    vq_recycle(q);
+    return SOLO5_R_OK;
+}
+
+bool net_vhost_attached(solo5_handle_t handle)
+{
+    return handle < MFT_MAX_ENTRIES && (vhost_handles & (1ULL << handle));
+}
+
+bool net_vhost_enabled(void)
+{
+    return vhost_handles != 0;
+}
+
+solo5_handle_set_t net_vhost_ready_set(void)
+{
+    solo5_handle_set_t ready_set = 0;
+
+    for (unsigned i = 0; i != MFT_MAX_ENTRIES; i++) {
+        struct vq *q = &vqs[i][HVT_NET_VRING_RX];
+        if ((vhost_handles & (1ULL << i)) &&
+                __atomic_load_n(&q->used->idx, __ATOMIC_ACQUIRE) !=
+                q->last_used)
+            ready_set |= 1ULL << i;
+    }
+    return ready_set;
+}
+
+solo5_result_t net_vhost_writev(solo5_handle_t handle,
+        struct solo5_net_frame *frames, size_t count)
+{
+    struct vq *q = &vqs[handle][HVT_NET_VRING_TX];
+    uint16_t next_avail0 = q->next_avail;
+    solo5_result_t rc = SOLO5_R_OK;
+
+    for (size_t i = 0; i < count; i++) {
+        frames[i].result = vq_put(q, frames[i].buf, frames[i].size);
+        if (frames[i].result != SOLO5_R_OK && rc == SOLO5_R_OK)
+            rc = frames[i].result;
+    }
+    if (q->next_avail != next_avail0)
+        vq_kick(handle, HVT_NET_VRING_TX);
+    return rc;
+}
+
+solo5_result_t net_vhost_readv(solo5_handle_t handle,
+        struct solo5_net_frame *frames, size_t count, size_t *read_count)
+{
+    struct vq *q = &vqs[handle][HVT_NET_VRING_RX];
+    size_t n;
+
+    for (n = 0; n < count; n++) {
+        frames[n].result = vq_get(q, frames[n].buf, frames[n].size,
+                &frames[n].size);
+        if (frames[n].result != SOLO5_R_OK)
+            break;
+        /* The host kernel fills the ring without telling us when. */
+        frames[n].tstamp = 0;
+    }
+    if (n == 0)
+        return SOLO5_R_AGAIN;
+    /*
+     * Buffers consumed above have been handed back to the host; let it know.
+     */
+    vq_kick(handle, HVT_NET_VRING_RX);
+    *read_count = n;
+    return SOLO5_R_OK;
+}
+
+solo5_result_t net_vhost_read_loan(solo5_handle_t handle, const uint8_t **buf,
+        size_t *size)
+{
+    struct vq *q = &vqs[handle][HVT_NET_VRING_RX];
+    struct virtq_used_elem *e = vq_peek(q);
+
+    if (e == NULL)
+        return SOLO5_R_AGAIN;
+    *buf = vq_elem_data(q, e, size);
+    return SOLO5_R_OK;
+}
+
+void net_vhost_read_release(solo5_handle_t handle)
+{
+    vq_recycle(&vqs[handle][HVT_NET_VRING_RX]);
+    vq_kick(handle, HVT_NET_VRING_RX);
+}
+
+void net_vhost_init(solo5_handle_t handle, uint16_t mtu)
+{
+    volatile struct hvt_hc_net_vrings vr;
+    size_t buf_size = HVT_NET_VRING_HDR_LEN + mtu + SOLO5_NET_HLEN;
+
+    buf_size = (buf_size + VQ_BUF_SIZE - 1) & ~(size_t)(VQ_BUF_SIZE - 1);
+    for (unsigned q = 0; q != 2; q++) {
+        vq_init(&vqs[handle][q], buf_size);
+        vr.queue[q].desc = vqs[handle][q].desc;
+        vr.queue[q].avail = vqs[handle][q].avail;
+        vr.queue[q].used = vqs[handle][q].used;
+    }
+
+    /*
+     * Stock the receive queue with all buffers before handing it over.
+     */
+    struct vq *rxq = &vqs[handle][HVT_NET_VRING_RX];
+    for (unsigned i = 0; i != HVT_NET_VRING_NUM; i++) {
+        rxq->desc[i].len = rxq->buf_size;
+        rxq->desc[i].flags = VIRTQ_DESC_F_WRITE;
+        vq_publish(rxq, i);
+    }
+
+    vr.handle = handle;
+    vr.ret = 0;
+    hvt_do_hypercall(HVT_HYPERCALL_NET_VRINGS, &vr);
+    if (vr.ret != SOLO5_R_OK)
+        PANIC("Could not set up vhost-net virtio rings", NULL);
+    vhost_handles |= 1ULL << handle;
+    vq_kick(handle, HVT_NET_VRING_RX);
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * pci.c: Passed-through PCI devices.
+ */
+
+#include "bindings.h"
+
+static struct mft *mft;
+static volatile uint8_t *pci_bars[MFT_MAX_ENTRIES][MFT_PCI_BARS];
+
+solo5_result_t solo5_pci_acquire(const char *name, solo5_handle_t *handle,
+        struct solo5_pci_info *info)
+{
+    unsigned index;
+    struct mft_entry *e = mft_get_by_name(mft, name, MFT_PCI_BASIC, &index);
+    if (e == NULL)
+        return SOLO5_R_EINVAL;
+    assert(e->attached);
+
+    *handle = index;
+    info->vendor_id = e->u.pci_basic.vendor_id;
+    info->device_id = e->u.pci_basic.device_id;
+    info->irqs = e->u.pci_basic.irqs;
+    for (unsigned i = 0; i != SOLO5_PCI_BARS; i++) {
+        unsigned shift = e->u.pci_basic.bar_shift[i];
+        info->bar[i].addr = pci_bars[index][i];
+        info->bar[i].size = shift ? (size_t)1 << shift : 0;
+    }
+    return SOLO5_R_OK;
+}
+
+/*
+ * BARs are mapped by the tender over guest memory set aside for them here,
+ * before the heap is passed to the application.
+ */
+static void pci_map_init(unsigned i, unsigned bar)
+{
+    const uintptr_t align = HVT_PCI_ALIGN;
+    uint64_t size = ((1ULL << mft->e[i].u.pci_basic.bar_shift[bar]) +
+            align - 1) & ~(align - 1);
+    uintptr_t p = (uintptr_t)mem_ialloc_pages((size + align - PAGE_SIZE) >>
+            PAGE_SHIFT);
+
+    volatile struct hvt_hc_pci_map mp;
+    mp.handle = i;
+    mp.bar = bar;
+    mp.data = (void *)((p + align - 1) & ~(align - 1));
+    mp.ret = 0;
+
+    hvt_do_hypercall(HVT_HYPERCALL_PCI_MAP, &mp);
+
+    if (mp.ret != SOLO5_R_OK)
+        PANIC("Could not map PCI device", NULL);
+    pci_bars[i][bar] = mp.data;
+}
+
+void pci_init(struct hvt_boot_info *bi)
+{
+    mft = bi->mft;
+
+    for (unsigned i = 0; i != mft->entries; i++) {
+        if (mft->e[i].type != MFT_PCI_BASIC || !mft->e[i].attached)
+            continue;
+        for (unsigned bar = 0; bar != MFT_PCI_BARS; bar++)
+            if (mft->e[i].u.pci_basic.bar_shift[bar] != 0)
+                pci_map_init(i, bar);
+    }
+}
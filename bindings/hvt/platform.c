@@ -23,12 +23,19 @@
 static const char *cmdline;
 static uint64_t mem_size;
 
+#ifdef __aarch64__
+int hvt_hypercall_hvc;
+#endif
+
 void process_bootinfo(void *arg)
 {
     struct hvt_boot_info *bi = arg;
 
     cmdline = bi->cmdline;
     mem_size = bi->mem_size;
+#ifdef __aarch64__
+    hvt_hypercall_hvc = (bi->features & HVT_FEATURE_HVC) != 0;
+#endif
 }
 
 const char *platform_cmdline(void)
@@ -23,6 +23,9 @@
 void platform_init(void *arg)
 {
     process_bootinfo(arg);
+    smp_init(arg);
+    pmu_init();
+    steal_init();
 }
 
 void platform_exit(int status, void *cookie)
@@ -35,3 +38,36 @@ void platform_exit(int status, void *cookie)
     hvt_do_hypercall(HVT_HYPERCALL_HALT, &h);
     for(;;);
 }
+
+solo5_result_t solo5_snapshot(void)
+{
+    volatile struct hvt_hc_snapshot s;
+
+    s.ret = SOLO5_R_EUNSPEC;
+    hvt_do_hypercall(HVT_HYPERCALL_SNAPSHOT, &s);
+    if (s.ret != SOLO5_R_OK)
+        return s.ret;
+
+    /*
+     * We are now running in a restored instance, with a new tender.
+     */
+    tscclock_restore();
+    yield_restore();
+    trace_restore();
+    block_restore();
+    console_restore();
+    pmu_restore();
+    steal_restore();
+    return SOLO5_R_OK;
+}
+
+int platform_mem_release(uint64_t addr, size_t size)
+{
+    volatile struct hvt_hc_mem_release r;
+
+    r.data = (void *)addr;
+    r.len = size;
+    r.ret = SOLO5_R_EUNSPEC;
+    hvt_do_hypercall(HVT_HYPERCALL_MEM_RELEASE, &r);
+    return r.ret == SOLO5_R_OK ? 0 : -1;
+}
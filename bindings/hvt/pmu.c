@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * pmu.c: Performance counters.
+ *
+ * On x86_64, the tender gives the guest KVM's virtual PMU only with --pmu,
+ * advertising it in the architectural performance monitoring CPUID leaf
+ * (0xa). Each CPU programs its own counters: the fixed counters for
+ * instructions retired and core cycles, and the first general-purpose
+ * counter for the architectural LLC misses event, if available. Reading
+ * them with RDPMC does not exit to the host.
+ */
+
+#include "bindings.h"
+
+#if defined(__x86_64__)
+
+#define MSR_IA32_PMC0               0x0c1
+#define MSR_IA32_PERFEVTSEL0        0x186
+#define MSR_IA32_FIXED_CTR_CTRL     0x38d
+#define MSR_IA32_PERF_GLOBAL_CTRL   0x38f
+
+/*
+ * Count in ring 0 and ring 3 (all the unikernel does), and enable.
+ */
+#define PERFEVTSEL_USR              (1ULL << 16)
+#define PERFEVTSEL_OS               (1ULL << 17)
+#define PERFEVTSEL_EN               (1ULL << 22)
+#define PERFEVTSEL_LLC_MISSES       (0x2eULL | (0x41ULL << 8))
+#define FIXED_CTR_CTRL_0_1          0x33ULL
+
+#define RDPMC_FIXED                 (1U << 30)
+#define FIXED_INSTRUCTIONS          0
+#define FIXED_CYCLES                1
+
+static bool pmu_enabled;
+static bool pmu_llc;
+
+/*
+ * Checks that the VCPU has an architectural PMU of version 2 or later, for
+ * the fixed counters and the global control MSR.
+ */
+static bool pmu_probe(void)
+{
+    uint32_t eax, ebx, ecx, edx;
+
+    x86_cpuid(0, &eax, &ebx, &ecx, &edx);
+    if (eax < 0xa)
+        return false;
+    x86_cpuid(0xa, &eax, &ebx, &ecx, &edx);
+    if ((eax & 0xff) < 2 || (edx & 0x1f) < 2)
+        return false;
+    /*
+     * An event is available if its bit in EBX, of which EAX[31:24] are
+     * valid, is clear.
+     */
+    pmu_llc = ((eax >> 8) & 0xff) >= 1 && ((eax >> 24) & 0xff) > 4 &&
+        !(ebx & (1U << 4));
+    return true;
+}
+
+static void pmu_setup_cpu(void)
+{
+    uint64_t global = (1ULL << (32 + FIXED_INSTRUCTIONS)) |
+        (1ULL << (32 + FIXED_CYCLES));
+
+    cpu_wrmsr(MSR_IA32_PERF_GLOBAL_CTRL, 0);
+    cpu_wrmsr(MSR_IA32_FIXED_CTR_CTRL, FIXED_CTR_CTRL_0_1);
+    if (pmu_llc) {
+        cpu_wrmsr(MSR_IA32_PMC0, 0);
+        cpu_wrmsr(MSR_IA32_PERFEVTSEL0, PERFEVTSEL_LLC_MISSES |
+                PERFEVTSEL_USR | PERFEVTSEL_OS | PERFEVTSEL_EN);
+        global |= 1ULL;
+    }
+    cpu_wrmsr(MSR_IA32_PERF_GLOBAL_CTRL, global);
+}
+
+void pmu_init(void)
+{
+    pmu_enabled = pmu_probe();
+    if (pmu_enabled)
+        pmu_setup_cpu();
+}
+
+void pmu_init_secondary(void)
+{
+    if (pmu_enabled)
+        pmu_setup_cpu();
+}
+
+/*
+ * The tender restoring a snapshot may not have been given --pmu, so look
+ * again.
+ */
+void pmu_restore(void)
+{
+    pmu_init();
+}
+
+solo5_result_t solo5_pmu_read(struct solo5_pmu_counters *counters)
+{
+    if (!pmu_enabled)
+        return SOLO5_R_EUNSPEC;
+
+    counters->cycles = cpu_rdpmc(RDPMC_FIXED | FIXED_CYCLES);
+    counters->instructions = cpu_rdpmc(RDPMC_FIXED | FIXED_INSTRUCTIONS);
+    counters->cache_misses = pmu_llc ? cpu_rdpmc(0) : 0;
+    return SOLO5_R_OK;
+}
+
+#else /* !__x86_64__ */
+
+void pmu_init(void)
+{
+}
+
+void pmu_init_secondary(void)
+{
+}
+
+void pmu_restore(void)
+{
+}
+
+solo5_result_t solo5_pmu_read(struct solo5_pmu_counters *counters)
+{
+    (void)counters;
+    return SOLO5_R_EUNSPEC;
+}
+
+#endif
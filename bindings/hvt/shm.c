@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * shm.c: Shared-memory regions.
+ */
+
+#include "bindings.h"
+
+static struct mft *mft;
+static uint8_t *shm_maps[MFT_MAX_ENTRIES];
+
+solo5_result_t solo5_shm_acquire(const char *name, solo5_handle_t *handle,
+        struct solo5_shm_info *info)
+{
+    unsigned index;
+    struct mft_entry *e = mft_get_by_name(mft, name, MFT_SHM_BASIC, &index);
+    if (e == NULL)
+        return SOLO5_R_EINVAL;
+    assert(e->attached);
+
+    *handle = index;
+    info->addr = shm_maps[index];
+    info->size = (size_t)e->u.shm_basic.pages * MFT_SHM_PAGE_SIZE;
+    info->doorbell = (e->u.shm_basic.flags & MFT_SHM_DOORBELL) != 0;
+    return SOLO5_R_OK;
+}
+
+solo5_result_t solo5_shm_notify(solo5_handle_t handle)
+{
+    volatile struct hvt_hc_shm_notify np;
+    np.handle = handle;
+    np.ret = 0;
+
+    hvt_do_hypercall(HVT_HYPERCALL_SHM_NOTIFY, &np);
+
+    return np.ret;
+}
+
+/*
+ * Regions are mapped by the tender over guest memory set aside for them here,
+ * before the heap is passed to the application.
+ */
+static void shm_map_init(unsigned i)
+{
+    const uintptr_t align = HVT_SHM_ALIGN;
+    uint64_t size = ((uint64_t)mft->e[i].u.shm_basic.pages *
+            MFT_SHM_PAGE_SIZE + align - 1) & ~(align - 1);
+    uintptr_t p = (uintptr_t)mem_ialloc_pages((size + align - PAGE_SIZE) >>
+            PAGE_SHIFT);
+
+    volatile struct hvt_hc_shm_map mp;
+    mp.handle = i;
+    mp.data = (void *)((p + align - 1) & ~(align - 1));
+    mp.ret = 0;
+
+    hvt_do_hypercall(HVT_HYPERCALL_SHM_MAP, &mp);
+
+    if (mp.ret != SOLO5_R_OK)
+        PANIC("Could not map shared memory", NULL);
+    shm_maps[i] = mp.data;
+}
+
+void shm_init(struct hvt_boot_info *bi)
+{
+    mft = bi->mft;
+
+    for (unsigned i = 0; i != mft->entries; i++) {
+        if (mft->e[i].type == MFT_SHM_BASIC && mft->e[i].attached)
+            shm_map_init(i);
+    }
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "bindings.h"
+
+static unsigned cpu_count = 1;
+
+/*
+ * Entry points of secondary CPUs, set by solo5_cpu_start(). A CPU has been
+ * started if its (entry) is set.
+ */
+static struct {
+    solo5_cpu_entry_t entry;
+    void *arg;
+} cpu_entries[HVT_CPUS_MAX];
+
+void smp_init(struct hvt_boot_info *bi)
+{
+    if (bi->cpus > 1 && bi->cpus <= HVT_CPUS_MAX)
+        cpu_count = bi->cpus;
+}
+
+/*
+ * Secondary CPUs are started here by the tender, with (cpu) as the sole
+ * argument. The tender has already set up the stack and TLS base.
+ */
+static void cpu_secondary_start(uint64_t cpu)
+{
+    cpu_init_secondary();
+    pmu_init_secondary();
+    steal_init_secondary(cpu);
+    cpu_time_start(cpu);
+    cpu_entries[cpu].entry(cpu_entries[cpu].arg);
+    cpu_time_stop(cpu);
+    cpu_halt();
+}
+
+unsigned solo5_cpu_count(void)
+{
+    return cpu_count;
+}
+
+solo5_result_t solo5_cpu_start(unsigned cpu, solo5_cpu_entry_t entry,
+        void *arg, uintptr_t stack, uintptr_t tls_base)
+{
+    if (cpu == 0 || cpu >= cpu_count || entry == NULL || (stack & 15) != 0)
+        return SOLO5_R_EINVAL;
+
+    solo5_cpu_entry_t expected = NULL;
+    if (!__atomic_compare_exchange_n(&cpu_entries[cpu].entry, &expected,
+                entry, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+        return SOLO5_R_EINVAL;
+    cpu_entries[cpu].arg = arg;
+
+    volatile struct hvt_hc_cpu_start cs;
+    cs.cpu = cpu;
+    cs.entry = (void *)(uintptr_t)cpu_secondary_start;
+    cs.stack = (void *)stack;
+    cs.tls_base = tls_base;
+    cs.arg = cpu;
+    cs.ret = 0;
+
+    hvt_do_hypercall(HVT_HYPERCALL_CPU_START, &cs);
+
+    return cs.ret;
+}
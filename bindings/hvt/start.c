@@ -27,8 +27,11 @@ void _start(void *arg)
     crt_init_tls();
 
     static struct solo5_start_info si;
+    struct hvt_boot_info *bi = arg;
+    volatile struct hvt_hc_boot_report br;
 
-    console_init();
+    br.start_cycles = READ_CPU_TICKS();
+    console_init(bi);
     cpu_init();
     platform_init(arg);
     si.cmdline = cmdline_parse(platform_cmdline());
@@ -40,9 +43,22 @@ void _start(void *arg)
 
     mem_init();
     time_init(arg);
+    cpu_time_start(0);
     block_init(arg);
+    shm_init(arg);
+    pci_init(arg);
     net_init(arg);
+    yield_init(arg);
+    trace_init(arg);
 
     mem_lock_heap(&si.heap_start, &si.heap_size);
+    mem_huge_heap(&si.heap_huge_start, &si.heap_huge_size);
+    /*
+     * Reported by the tender with --trace-boot and --mem-report.
+     */
+    br.heap_start = si.heap_start;
+    br.app_main_cycles = READ_CPU_TICKS();
+    hvt_do_hypercall(HVT_HYPERCALL_BOOT_REPORT, &br);
+    console_flush();
     solo5_exit(solo5_app_main(&si));
 }
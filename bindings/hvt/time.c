@@ -23,6 +23,16 @@
 void time_init(struct hvt_boot_info *bi)
 {
     assert(tscclock_init(bi->cpu_cycle_freq) == 0);
+
+    /*
+     * If the tender offers a shared time page, use it for wall clock time so
+     * that we follow corrections made to the host clock.
+     */
+    if (bi->features & HVT_FEATURE_TIME_PAGE) {
+        struct hvt_time_page *p = mem_ialloc_pages(1);
+        if (tscclock_set_time_page(p) != 0)
+            log(WARN, "Solo5: Could not register time page\n");
+    }
 }
 
 uint64_t solo5_clock_monotonic(void)
@@ -33,5 +43,5 @@ uint64_t solo5_clock_monotonic(void)
 /* return wall time in nsecs */
 uint64_t solo5_clock_wall(void)
 {
-    return tscclock_monotonic() + tscclock_epochoffset();
+    return tscclock_wall();
 }
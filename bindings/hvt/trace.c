@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * trace.c: Event trace ring (HVT_FEATURE_TRACE), read by the tender.
+ */
+
+#include "bindings.h"
+
+static struct hvt_trace_ring *trace_ring;
+
+static int trace_ring_register(struct hvt_trace_ring *r)
+{
+    volatile struct hvt_hc_trace_ring tr;
+
+    tr.ring = r;
+    tr.nsecs = tscclock_monotonic();
+    tr.ret = 0;
+    hvt_do_hypercall(HVT_HYPERCALL_TRACE_RING, &tr);
+    return tr.ret == SOLO5_R_OK ? 0 : -1;
+}
+
+void trace_init(struct hvt_boot_info *bi)
+{
+    if (!(bi->features & HVT_FEATURE_TRACE))
+        return;
+
+    size_t pages = (sizeof (struct hvt_trace_ring) + PAGE_SIZE - 1) /
+        PAGE_SIZE;
+    struct hvt_trace_ring *r = mem_ialloc_pages(pages);
+    memset(r, 0, pages * PAGE_SIZE);
+    if (trace_ring_register(r) == 0)
+        trace_ring = r;
+}
+
+/*
+ * After restoring from a snapshot, the ring must be registered with the new
+ * tender. Events recorded before the snapshot are kept.
+ */
+void trace_restore(void)
+{
+    if (trace_ring != NULL && trace_ring_register(trace_ring) != 0)
+        trace_ring = NULL;
+}
+
+void solo5_trace(uint32_t id, uint64_t arg0, uint64_t arg1)
+{
+    struct hvt_trace_ring *r = trace_ring;
+
+    if (r == NULL)
+        return;
+
+    uint64_t n = __atomic_fetch_add(&r->head, 1, __ATOMIC_RELAXED);
+    struct hvt_trace_event *ev = &r->ev[n % HVT_TRACE_ENTRIES];
+
+    __atomic_store_n(&ev->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    ev->nsecs = tscclock_monotonic();
+    ev->id = id;
+    ev->arg[0] = arg0;
+    ev->arg[1] = arg1;
+    __atomic_store_n(&ev->seq, n + 1, __ATOMIC_RELEASE);
+}
@@ -23,7 +23,11 @@
 /* Wall clock offset at monotonic time base. */
 static uint64_t wc_epochoffset;
 
-/* Base time values at the last call to tscclock_monotonic(). */
+/*
+ * Base time values, taken by tscclock_init(). These and the scaling factors
+ * below are not written afterwards, so tscclock_monotonic() does not dirty
+ * any shared cache lines and may be called from several CPUs at once.
+ */
 static uint64_t time_base;
 static uint64_t tsc_base;
 
@@ -36,6 +40,9 @@ static uint8_t tsc_shift;
 /* Multiplier for converting TSC ticks to nsecs. (0.S) fixed point. */
 static uint32_t tsc_mult;
 
+/* Shared time page, if registered with tscclock_set_time_page(). */
+static struct hvt_time_page *time_page;
+
 #if defined(__x86_64__)
 #define READ_CPU_TICKS cpu_rdtsc
 #elif defined(__aarch64__)
@@ -49,17 +56,13 @@ static uint32_t tsc_mult;
  */
 uint64_t tscclock_monotonic(void)
 {
-    uint64_t tsc_now, tsc_delta;
-
     /*
-     * Update time_base (monotonic time) and tsc_base (TSC time).
+     * mul64_32() computes the full 96-bit product, so this does not overflow
+     * for any delta that can occur in practice.
      */
-    tsc_now = READ_CPU_TICKS();
-    tsc_delta = tsc_now - tsc_base;
-    time_base += mul64_32(tsc_delta, tsc_mult, tsc_shift);
-    tsc_base = tsc_now;
+    uint64_t tsc_delta = READ_CPU_TICKS() - tsc_base;
 
-    return time_base;
+    return time_base + mul64_32(tsc_delta, tsc_mult, tsc_shift);
 }
 
 /*
@@ -111,9 +114,9 @@ int tscclock_init(uint64_t tsc_freq)
      * Compute wall clock epoch offset by subtracting monotonic time_base from
      * wall time at boot.
      *
-     * TODO: This arrangement minimises the use of hypercalls, but is subject
-     * to clock skew over time and cannot get corrections from the host (via
-     * e.g. NTP). 
+     * This arrangement minimises the use of hypercalls, but is subject to
+     * clock skew over time and cannot get corrections from the host (via e.g.
+     * NTP). It is only used if the tender does not offer a shared time page.
      */
     struct hvt_hc_walltime t;
     hvt_do_hypercall(HVT_HYPERCALL_WALLTIME, &t);
@@ -129,3 +132,66 @@ uint64_t tscclock_epochoffset(void)
 {
 	return wc_epochoffset;
 }
+
+/*
+ * Register the shared time page at (p), returning 0 on success.
+ */
+int tscclock_set_time_page(struct hvt_time_page *p)
+{
+    volatile struct hvt_hc_time_page tp;
+
+    memset(p, 0, sizeof (*p));
+    tp.page = p;
+    tp.ret = 0;
+    tp.cycles = READ_CPU_TICKS();
+    hvt_do_hypercall(HVT_HYPERCALL_TIME_PAGE, &tp);
+    if (tp.ret != SOLO5_R_OK)
+        return -1;
+    time_page = p;
+    return 0;
+}
+
+/*
+ * After restoring from a snapshot, register the shared time page with the new
+ * tender, or if there is none, recompute the epoch offset.
+ */
+void tscclock_restore(void)
+{
+    if (time_page != NULL && tscclock_set_time_page(time_page) == 0)
+        return;
+    time_page = NULL;
+
+    struct hvt_hc_walltime t;
+    hvt_do_hypercall(HVT_HYPERCALL_WALLTIME, &t);
+    wc_epochoffset = t.nsecs - tscclock_monotonic();
+}
+
+/*
+ * Return wall time, extrapolated from the latest update of the shared time
+ * page if registered.
+ */
+uint64_t tscclock_wall(void)
+{
+    uint64_t seq, cycles, wall_nsecs, tsc_now;
+
+    if (time_page == NULL)
+        return tscclock_monotonic() + wc_epochoffset;
+
+    do {
+        seq = __atomic_load_n(&time_page->seq, __ATOMIC_ACQUIRE);
+        cycles = __atomic_load_n(&time_page->cycles, __ATOMIC_RELAXED);
+        wall_nsecs = __atomic_load_n(&time_page->wall_nsecs, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) ||
+            seq != __atomic_load_n(&time_page->seq, __ATOMIC_RELAXED));
+
+    /*
+     * (cycles) is the tender's estimate of our cycle counter, so do not assume
+     * that it can never be ahead of it.
+     */
+    tsc_now = READ_CPU_TICKS();
+    if (tsc_now >= cycles)
+        return wall_nsecs + mul64_32(tsc_now - cycles, tsc_mult, tsc_shift);
+    else
+        return wall_nsecs - mul64_32(cycles - tsc_now, tsc_mult, tsc_shift);
+}
@@ -20,18 +20,317 @@
 
 #include "bindings.h"
 
-bool solo5_yield(solo5_time_t deadline, solo5_handle_set_t *ready_set)
+/*
+ * Shared readiness page, if offered by the tender (HVT_FEATURE_POLL_PAGE).
+ * Readiness of devices published in it can be checked without exiting to the
+ * tender.
+ */
+static struct hvt_poll_page *poll_page;
+
+static int poll_page_register(struct hvt_poll_page *p)
+{
+    volatile struct hvt_hc_poll_page pg;
+
+    memset(p, 0, PAGE_SIZE);
+    pg.page = p;
+    pg.ret = 0;
+    hvt_do_hypercall(HVT_HYPERCALL_POLL_PAGE, &pg);
+    return pg.ret == SOLO5_R_OK ? 0 : -1;
+}
+
+#if defined(__x86_64__)
+/*
+ * In-kernel local APIC, if offered by the tender (HVT_FEATURE_IRQCHIP).
+ * Instead of blocking in HVT_HYPERCALL_POLL, the guest halts until the
+ * TSC-deadline timer expires or the tender raises HVT_IRQCHIP_VECTOR, so
+ * that waiting and waking up do not exit to the tender. Both interrupts only
+ * serve to wake the CPU; the tender's is noted in (irqchip_woken), so that
+ * the guest then polls, without blocking, to find out which devices are
+ * ready, which also has the tender watch them again.
+ */
+#define MSR_IA32_APIC_BASE      0x1b
+#define MSR_IA32_TSC_DEADLINE   0x6e0
+#define MSR_X2APIC_EOI          0x80b
+#define MSR_X2APIC_SVR          0x80f
+#define MSR_X2APIC_LVT_TIMER    0x832
+
+#define APIC_BASE_EXTD          (1ULL << 10)    /* x2APIC mode */
+#define APIC_BASE_EN            (1ULL << 11)
+#define APIC_SVR_ENABLE         (1U << 8)
+#define APIC_SVR_VECTOR         0xff
+#define LVT_TIMER_TSC_DEADLINE  (2U << 17)
+
+#define CPUID_1_ECX_X2APIC      (1U << 21)
+#define CPUID_1_ECX_TSC_DEADLINE (1U << 24)
+
+/*
+ * Both interrupts use the legacy IRQ vectors set up by cpu_init(), the
+ * tender's being IRQ 0.
+ */
+#define IRQCHIP_WAKE_IRQ        (HVT_IRQCHIP_VECTOR - 32)
+#define IRQCHIP_TIMER_IRQ       (IRQCHIP_WAKE_IRQ + 1)
+
+/*
+ * The timer is armed at most this far ahead, so that the deadline computed
+ * below cannot overflow.
+ */
+#define IRQCHIP_TIMER_MAX_NSECS NSEC_PER_SEC
+
+static bool irqchip_enabled;
+/*
+ * Initially set, as the tender may have raised its interrupt before the
+ * local APIC was enabled.
+ */
+static volatile bool irqchip_woken = true;
+/* Multiplier for converting nsecs to TSC ticks. (32.32) fixed point. */
+static uint64_t tsc_per_nsec;
+
+/* WARNING: called in interrupt context */
+static int irqchip_wake(void *arg)
+{
+    (void)arg;
+    irqchip_woken = true;
+    cpu_wrmsr(MSR_X2APIC_EOI, 0);
+    return 1;
+}
+
+/* WARNING: called in interrupt context */
+static int irqchip_timer(void *arg)
+{
+    (void)arg;
+    cpu_wrmsr(MSR_X2APIC_EOI, 0);
+    return 1;
+}
+
+static void irqchip_init(struct hvt_boot_info *bi)
+{
+    uint32_t eax, ebx, ecx, edx;
+
+    if (!(bi->features & HVT_FEATURE_IRQCHIP) || bi->cpu_cycle_freq == 0)
+        return;
+    x86_cpuid(1, &eax, &ebx, &ecx, &edx);
+    if (!(ecx & CPUID_1_ECX_X2APIC) || !(ecx & CPUID_1_ECX_TSC_DEADLINE))
+        return;
+
+    uint64_t base = cpu_rdmsr(MSR_IA32_APIC_BASE);
+    cpu_wrmsr(MSR_IA32_APIC_BASE, base | APIC_BASE_EN | APIC_BASE_EXTD);
+    cpu_wrmsr(MSR_X2APIC_SVR, APIC_SVR_ENABLE | APIC_SVR_VECTOR);
+    /*
+     * A 128-bit division would need libgcc, which the bindings do not link.
+     */
+    uint64_t freq = bi->cpu_cycle_freq;
+    tsc_per_nsec = ((freq / NSEC_PER_SEC) << 32) +
+        (((freq % NSEC_PER_SEC) << 32) / NSEC_PER_SEC);
+    intr_register_irq(IRQCHIP_WAKE_IRQ, irqchip_wake, NULL);
+    intr_register_irq(IRQCHIP_TIMER_IRQ, irqchip_timer, NULL);
+    cpu_wrmsr(MSR_X2APIC_LVT_TIMER, LVT_TIMER_TSC_DEADLINE |
+            (32 + IRQCHIP_TIMER_IRQ));
+    irqchip_enabled = true;
+}
+
+/*
+ * Halts until (deadline), or earlier if interrupted, accounting the time as
+ * idle. Interrupts are only enabled while halted, so the tender's interrupt
+ * cannot be missed between checking (irqchip_woken) and halting.
+ */
+static void irqchip_halt(solo5_time_t deadline, solo5_time_t now)
+{
+    uint64_t delta_ns = deadline - now;
+    if (delta_ns > IRQCHIP_TIMER_MAX_NSECS)
+        delta_ns = IRQCHIP_TIMER_MAX_NSECS;
+    uint64_t ticks = ((unsigned __int128)delta_ns * tsc_per_nsec) >> 32;
+    cpu_wrmsr(MSR_IA32_TSC_DEADLINE, cpu_rdtsc() + ticks + 1);
+    if (!irqchip_woken)
+        __asm__ __volatile__("sti; hlt; cli" ::: "memory");
+    cpu_time_idle(now);
+}
+#else
+static const bool irqchip_enabled = false;
+static bool irqchip_woken;
+
+static void irqchip_init(struct hvt_boot_info *bi)
+{
+    (void)bi;
+}
+
+static void irqchip_halt(solo5_time_t deadline, solo5_time_t now)
+{
+    (void)deadline;
+    (void)now;
+}
+#endif
+
+void yield_init(struct hvt_boot_info *bi)
+{
+    irqchip_init(bi);
+    if (!(bi->features & HVT_FEATURE_POLL_PAGE))
+        return;
+
+    struct hvt_poll_page *p = mem_ialloc_pages(1);
+    if (poll_page_register(p) == 0)
+        poll_page = p;
+}
+
+/*
+ * After restoring from a snapshot, the readiness page must be registered with
+ * the new tender.
+ */
+void yield_restore(void)
+{
+    if (poll_page != NULL && poll_page_register(poll_page) != 0)
+        poll_page = NULL;
+}
+
+/*
+ * Requests to release memory are counted in the readiness page; without it,
+ * the tender cannot make any.
+ */
+static uint64_t reclaim_seen;
+
+bool platform_mem_reclaim_requested(void)
+{
+    if (poll_page == NULL)
+        return false;
+
+    uint64_t seq = __atomic_load_n(&poll_page->reclaim_seq, __ATOMIC_RELAXED);
+    if (seq == reclaim_seen)
+        return false;
+    reclaim_seen = seq;
+    return true;
+}
+
+/*
+ * Network devices reported as writable again by the tender, until taken by
+ * platform_net_writable_set().
+ */
+static solo5_handle_set_t writable_set;
+
+solo5_handle_set_t platform_net_writable_set(void)
+{
+    return __atomic_exchange_n(&writable_set, 0, __ATOMIC_RELAXED);
+}
+
+static void do_poll(struct hvt_hc_poll *t)
+{
+    solo5_time_t idle_start = t->timeout_nsecs ? solo5_clock_monotonic() : 0;
+
+    t->writable_set = 0;
+    hvt_do_hypercall(HVT_HYPERCALL_POLL, t);
+    if (t->timeout_nsecs)
+        cpu_time_idle(idle_start);
+    if (t->writable_set != 0)
+        __atomic_fetch_or(&writable_set, t->writable_set, __ATOMIC_RELAXED);
+}
+
+/*
+ * Waits for devices to become ready until (deadline), as do_poll() with the
+ * corresponding timeout does, but by halting. Returns early, as do_poll()
+ * does, if only writability is reported.
+ */
+static void irqchip_wait(struct hvt_hc_poll *t, solo5_time_t deadline)
+{
+    for (;;) {
+        if (irqchip_woken) {
+            irqchip_woken = false;
+            t->timeout_nsecs = 0;
+            do_poll(t);
+            if (t->ret > 0 || t->writable_set != 0)
+                return;
+        }
+        solo5_time_t now = solo5_clock_monotonic();
+        if (deadline <= now)
+            break;
+        irqchip_halt(deadline, now);
+    }
+    t->ready_set = 0;
+    t->writable_set = 0;
+    t->ret = 0;
+}
+
+static solo5_handle_set_t poll_page_ready_set(void)
+{
+    return __atomic_load_n(&poll_page->ready_set, __ATOMIC_ACQUIRE);
+}
+
+static bool do_yield(solo5_time_t deadline, solo5_handle_set_t *ready_set)
 {
     struct hvt_hc_poll t;
     uint64_t now;
 
-    now = solo5_clock_monotonic();
-    if (deadline <= now)
-        t.timeout_nsecs = 0;
-    else
-        t.timeout_nsecs = deadline - now;
-    hvt_do_hypercall(HVT_HYPERCALL_POLL, &t);
+    if (!net_rings_enabled()) {
+        now = solo5_clock_monotonic();
+        /*
+         * Only exit to the tender if no devices are ready and we need to
+         * block.
+         */
+        if (poll_page != NULL) {
+            solo5_handle_set_t tmp_ready_set = poll_page_ready_set();
+            if (tmp_ready_set != 0 || deadline <= now) {
+                if (ready_set != NULL)
+                    *ready_set = tmp_ready_set;
+                return tmp_ready_set != 0;
+            }
+        }
+        if (irqchip_enabled && deadline > now)
+            irqchip_wait(&t, deadline);
+        else {
+            if (deadline <= now)
+                t.timeout_nsecs = 0;
+            else
+                t.timeout_nsecs = deadline - now;
+            do_poll(&t);
+        }
+        if (ready_set != NULL)
+            *ready_set = t.ready_set;
+        return t.ret;
+    }
+
+    /*
+     * With packet rings, readiness is determined by the rings themselves;
+     * the tender is only asked to block if all rings are empty. Wakeups
+     * may be spurious, in which case we go back to sleep. Readiness of other
+     * devices is as reported by the tender.
+     */
+    solo5_handle_set_t tmp_ready_set = net_rings_ready_set();
+    if (tmp_ready_set != 0 && block_async_handles() != 0) {
+        if (poll_page != NULL)
+            tmp_ready_set |= poll_page_ready_set() & block_async_handles();
+        else {
+            t.timeout_nsecs = 0;
+            do_poll(&t);
+            tmp_ready_set |= t.ready_set & block_async_handles();
+        }
+    }
+    while (tmp_ready_set == 0) {
+        now = solo5_clock_monotonic();
+        if (deadline <= now)
+            break;
+        if (irqchip_enabled)
+            irqchip_wait(&t, deadline);
+        else {
+            t.timeout_nsecs = deadline - now;
+            do_poll(&t);
+        }
+        tmp_ready_set = net_rings_ready_set() |
+            (t.ready_set & block_async_handles());
+        if (!t.ret)
+            break;
+    }
     if (ready_set != NULL)
-        *ready_set = t.ready_set;
-    return t.ret;
+        *ready_set = tmp_ready_set;
+    return tmp_ready_set != 0;
+}
+
+bool solo5_yield(solo5_time_t deadline, solo5_handle_set_t *ready_set)
+{
+    /*
+     * Pass any batched block requests and console output to the tender
+     * before waiting.
+     */
+    block_flush();
+    console_flush();
+    solo5_trace(SOLO5_TRACE_ID_YIELD_ENTER, deadline, 0);
+    bool rc = do_yield(deadline, ready_set);
+    solo5_trace(SOLO5_TRACE_ID_YIELD_EXIT, rc, ready_set ? *ready_set : 0);
+    return rc;
 }
@@ -46,11 +46,11 @@ int log(log_level_t level, const char *fmt, ...)
      */
     if (size >= sizeof buffer) {
         const char trunc[] = "(truncated)\n";
-        platform_puts(buffer, sizeof buffer - 1);
-        platform_puts(trunc, sizeof trunc - 1);
+        console_write(buffer, sizeof buffer - 1);
+        console_write(trunc, sizeof trunc - 1);
         return sizeof buffer - 1;
     } else {
-        platform_puts(buffer, size);
+        console_write(buffer, size);
         return size;
     }
 }
@@ -0,0 +1,413 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * loop.c: Optional event loop for Solo5 applications, see solo5_loop.h.
+ * Built into solo5_loop.o, not into the bindings.
+ *
+ * Started timers are kept in a pairing heap: each timer points to its first
+ * child and its next sibling, and back to its previous sibling, or to its
+ * parent if it is a first child. Expired timers are moved to a list before
+ * any of them runs, so that a timer restarted from a callback with a
+ * deadline which has already passed does not run again in the same
+ * iteration.
+ */
+
+#include "solo5_loop.h"
+
+#define HANDLES_MAX (sizeof (solo5_handle_set_t) * 8)
+
+#define TIMER_IDLE 0
+#define TIMER_HEAP 1                    /* In loop->timers */
+#define TIMER_EXPIRED 2                 /* In loop->expired */
+
+/*
+ * Pairing heap.
+ */
+static struct solo5_timer *meld(struct solo5_timer *a, struct solo5_timer *b)
+{
+    if (a == NULL)
+        return b;
+    if (b == NULL)
+        return a;
+    if (b->deadline < a->deadline) {
+        struct solo5_timer *t = a;
+        a = b;
+        b = t;
+    }
+    b->prev = a;
+    b->next = a->child;
+    if (a->child != NULL)
+        a->child->prev = b;
+    a->child = b;
+    return a;
+}
+
+/*
+ * Melds the siblings starting at (first) into a single heap, pairing them
+ * left to right and then melding the pairs right to left.
+ */
+static struct solo5_timer *merge_pairs(struct solo5_timer *first)
+{
+    struct solo5_timer *pairs = NULL;
+
+    while (first != NULL) {
+        struct solo5_timer *a = first;
+        struct solo5_timer *b = a->next;
+        first = (b != NULL) ? b->next : NULL;
+        a->next = a->prev = NULL;
+        if (b != NULL)
+            b->next = b->prev = NULL;
+        a = meld(a, b);
+        a->next = pairs;
+        pairs = a;
+    }
+
+    struct solo5_timer *root = NULL;
+    while (pairs != NULL) {
+        struct solo5_timer *next = pairs->next;
+        pairs->next = NULL;
+        root = meld(root, pairs);
+        pairs = next;
+    }
+    return root;
+}
+
+static void heap_insert(struct solo5_loop *loop, struct solo5_timer *timer)
+{
+    timer->child = timer->next = timer->prev = NULL;
+    loop->timers = meld(loop->timers, timer);
+    timer->state = TIMER_HEAP;
+}
+
+static void heap_remove(struct solo5_loop *loop, struct solo5_timer *timer)
+{
+    if (timer == loop->timers) {
+        loop->timers = merge_pairs(timer->child);
+    }
+    else {
+        if (timer->prev->child == timer)
+            timer->prev->child = timer->next;
+        else
+            timer->prev->next = timer->next;
+        if (timer->next != NULL)
+            timer->next->prev = timer->prev;
+        loop->timers = meld(loop->timers, merge_pairs(timer->child));
+    }
+    if (loop->timers != NULL)
+        loop->timers->prev = NULL;
+    timer->child = timer->next = timer->prev = NULL;
+    timer->state = TIMER_IDLE;
+}
+
+/*
+ * The list of expired timers, linked through next and prev.
+ */
+static void expired_remove(struct solo5_loop *loop, struct solo5_timer *timer)
+{
+    if (timer->prev != NULL)
+        timer->prev->next = timer->next;
+    else
+        loop->expired = timer->next;
+    if (timer->next != NULL)
+        timer->next->prev = timer->prev;
+    timer->next = timer->prev = NULL;
+    timer->state = TIMER_IDLE;
+}
+
+void solo5_timer_init(struct solo5_timer *timer, solo5_timer_fn_t fn,
+        void *arg)
+{
+    timer->deadline = 0;
+    timer->fn = fn;
+    timer->arg = arg;
+    timer->child = timer->next = timer->prev = NULL;
+    timer->state = TIMER_IDLE;
+}
+
+void solo5_timer_stop(struct solo5_loop *loop, struct solo5_timer *timer)
+{
+    if (timer->state == TIMER_HEAP)
+        heap_remove(loop, timer);
+    else if (timer->state == TIMER_EXPIRED)
+        expired_remove(loop, timer);
+}
+
+void solo5_timer_start(struct solo5_loop *loop, struct solo5_timer *timer,
+        solo5_time_t deadline)
+{
+    solo5_timer_stop(loop, timer);
+    timer->deadline = deadline;
+    heap_insert(loop, timer);
+}
+
+bool solo5_timer_active(const struct solo5_timer *timer)
+{
+    return timer->state != TIMER_IDLE;
+}
+
+static void run_timers(struct solo5_loop *loop)
+{
+    struct solo5_timer **tail = &loop->expired;
+    struct solo5_timer *prev = NULL;
+
+    /*
+     * Timers left over from an iteration cut short by solo5_loop_stop() run
+     * first.
+     */
+    while (*tail != NULL) {
+        prev = *tail;
+        tail = &prev->next;
+    }
+    while (loop->timers != NULL && loop->timers->deadline <= loop->now) {
+        struct solo5_timer *timer = loop->timers;
+        heap_remove(loop, timer);
+        timer->prev = prev;
+        *tail = timer;
+        tail = &timer->next;
+        prev = timer;
+        timer->state = TIMER_EXPIRED;
+    }
+
+    /*
+     * Callbacks may stop or restart any of the timers still in the list.
+     */
+    while (loop->expired != NULL && !loop->stopped) {
+        struct solo5_timer *timer = loop->expired;
+        expired_remove(loop, timer);
+        timer->fn(loop, timer, timer->arg);
+    }
+}
+
+/*
+ * Devices.
+ */
+void solo5_loop_init(struct solo5_loop *loop)
+{
+    loop->now = solo5_clock_monotonic();
+    loop->timers = NULL;
+    loop->expired = NULL;
+    loop->watched = 0;
+    for (size_t i = 0; i < HANDLES_MAX; i++) {
+        loop->watch[i].fn = NULL;
+        loop->watch[i].frames = NULL;
+        loop->watch[i].completions = NULL;
+    }
+    loop->stopped = false;
+}
+
+static solo5_result_t watch(struct solo5_loop *loop, solo5_handle_t handle,
+        solo5_loop_io_fn_t fn, void *arg)
+{
+    if (handle >= HANDLES_MAX || fn == NULL)
+        return SOLO5_R_EINVAL;
+    loop->watch[handle].fn = fn;
+    loop->watch[handle].arg = arg;
+    loop->watch[handle].frames = NULL;
+    loop->watch[handle].nframes = 0;
+    loop->watch[handle].frame_size = 0;
+    loop->watch[handle].completions = NULL;
+    loop->watch[handle].ncompletions = 0;
+    loop->watched |= 1ULL << handle;
+    return SOLO5_R_OK;
+}
+
+solo5_result_t solo5_loop_watch(struct solo5_loop *loop,
+        solo5_handle_t handle, solo5_loop_io_fn_t fn, void *arg)
+{
+    return watch(loop, handle, fn, arg);
+}
+
+solo5_result_t solo5_loop_watch_net(struct solo5_loop *loop,
+        solo5_handle_t handle, struct solo5_net_frame *frames, size_t count,
+        size_t frame_size, solo5_loop_io_fn_t fn, void *arg)
+{
+    if (frames == NULL || count == 0 || count > SOLO5_NET_FRAMES_MAX)
+        return SOLO5_R_EINVAL;
+    solo5_result_t rc = watch(loop, handle, fn, arg);
+    if (rc != SOLO5_R_OK)
+        return rc;
+    loop->watch[handle].frames = frames;
+    loop->watch[handle].nframes = count;
+    loop->watch[handle].frame_size = frame_size;
+    return SOLO5_R_OK;
+}
+
+solo5_result_t solo5_loop_watch_block(struct solo5_loop *loop,
+        solo5_handle_t handle, struct solo5_block_completion *completions,
+        size_t count, solo5_loop_io_fn_t fn, void *arg)
+{
+    if (completions == NULL || count == 0 || count > SOLO5_BLOCK_QUEUE_MAX)
+        return SOLO5_R_EINVAL;
+    solo5_result_t rc = watch(loop, handle, fn, arg);
+    if (rc != SOLO5_R_OK)
+        return rc;
+    loop->watch[handle].completions = completions;
+    loop->watch[handle].ncompletions = count;
+    return SOLO5_R_OK;
+}
+
+void solo5_loop_unwatch(struct solo5_loop *loop, solo5_handle_t handle)
+{
+    if (handle >= HANDLES_MAX)
+        return;
+    loop->watch[handle].fn = NULL;
+    loop->watched &= ~(1ULL << handle);
+}
+
+/*
+ * Returns true if (handle) is still watched with the same (w), as callbacks
+ * may unwatch or rewatch it.
+ */
+static bool still_watched(struct solo5_loop *loop, solo5_handle_t handle,
+        const struct solo5_loop_watch *w)
+{
+    const struct solo5_loop_watch *cur = &loop->watch[handle];
+
+    return !loop->stopped && cur->fn == w->fn && cur->frames == w->frames &&
+        cur->completions == w->completions;
+}
+
+static void drain_net(struct solo5_loop *loop, solo5_handle_t handle,
+        const struct solo5_loop_watch *w)
+{
+    struct solo5_loop_io io = {
+        .handle = handle,
+        .events = SOLO5_EVENT_READABLE,
+        .frames = w->frames
+    };
+
+    for (int batch = 0; batch < SOLO5_LOOP_BATCHES_MAX; batch++) {
+        for (size_t i = 0; i < w->nframes; i++)
+            w->frames[i].size = w->frame_size;
+        io.nframes = 0;
+        io.result = solo5_net_readv(handle, w->frames, w->nframes,
+                &io.nframes);
+        if (io.result == SOLO5_R_AGAIN)
+            return;
+        w->fn(loop, &io, w->arg);
+        if (io.result != SOLO5_R_OK || io.nframes < w->nframes ||
+                !still_watched(loop, handle, w))
+            return;
+    }
+}
+
+static void drain_block(struct solo5_loop *loop, solo5_handle_t handle,
+        const struct solo5_loop_watch *w)
+{
+    struct solo5_loop_io io = {
+        .handle = handle,
+        .events = SOLO5_EVENT_COMPLETION,
+        .completions = w->completions
+    };
+
+    for (int batch = 0; batch < SOLO5_LOOP_BATCHES_MAX; batch++) {
+        io.ncompletions = 0;
+        io.result = solo5_block_reap(handle, w->completions,
+                w->ncompletions, &io.ncompletions);
+        if (io.result == SOLO5_R_AGAIN)
+            return;
+        w->fn(loop, &io, w->arg);
+        if (io.result != SOLO5_R_OK || io.ncompletions < w->ncompletions ||
+                !still_watched(loop, handle, w))
+            return;
+    }
+}
+
+static void dispatch(struct solo5_loop *loop, const struct solo5_event *ev)
+{
+    if (ev->handle >= HANDLES_MAX || loop->watch[ev->handle].fn == NULL)
+        return;
+    /*
+     * Copied, so that the device is drained as it was watched when it became
+     * ready even if a callback changes its watch.
+     */
+    struct solo5_loop_watch w = loop->watch[ev->handle];
+
+    if (w.frames == NULL && w.completions == NULL) {
+        struct solo5_loop_io io = {
+            .handle = ev->handle,
+            .events = ev->events,
+            .result = SOLO5_R_OK
+        };
+        w.fn(loop, &io, w.arg);
+        return;
+    }
+
+    if (ev->events & SOLO5_EVENT_WRITABLE) {
+        struct solo5_loop_io io = {
+            .handle = ev->handle,
+            .events = SOLO5_EVENT_WRITABLE,
+            .result = SOLO5_R_OK
+        };
+        w.fn(loop, &io, w.arg);
+        if (!still_watched(loop, ev->handle, &w))
+            return;
+    }
+    if ((ev->events & SOLO5_EVENT_READABLE) && w.frames != NULL)
+        drain_net(loop, ev->handle, &w);
+    else if ((ev->events & SOLO5_EVENT_COMPLETION) && w.completions != NULL)
+        drain_block(loop, ev->handle, &w);
+}
+
+bool solo5_loop_run_once(struct solo5_loop *loop, bool wait)
+{
+    struct solo5_event events[HANDLES_MAX];
+    size_t nready = 0;
+
+    loop->stopped = false;
+    loop->now = solo5_clock_monotonic();
+    run_timers(loop);
+    if (loop->stopped)
+        return true;
+    if (loop->timers == NULL && loop->watched == 0)
+        return false;
+
+    /*
+     * Without timers, there is nothing to wake up for other than the
+     * devices, so yield until one is ready.
+     */
+    solo5_time_t deadline = 0;
+    if (wait)
+        deadline = (loop->timers != NULL) ? loop->timers->deadline :
+            UINT64_MAX;
+    solo5_yield_events(deadline, events, HANDLES_MAX, &nready);
+    loop->now = solo5_clock_monotonic();
+
+    for (size_t i = 0; i < nready && !loop->stopped; i++)
+        dispatch(loop, &events[i]);
+    return true;
+}
+
+void solo5_loop_run(struct solo5_loop *loop)
+{
+    while (solo5_loop_run_once(loop, true) && !loop->stopped)
+        ;
+}
+
+void solo5_loop_stop(struct solo5_loop *loop)
+{
+    loop->stopped = true;
+}
+
+solo5_time_t solo5_loop_now(const struct solo5_loop *loop)
+{
+    return loop->now;
+}
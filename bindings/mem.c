@@ -23,8 +23,33 @@
 static uint64_t heap_start;
 
 /*
- * Locks the memory layout (by disabling mem_ialloc_pages()). Must be called
- * before passing control to the application via solo5_app_main().
+ * Pages reserved for mem_alloc_pages() once the heap is locked, at most
+ * MEM_POOL_PAGES and no more than 1/MEM_POOL_FRACTION of the free heap.
+ * Pages of the pool are only backed by host memory once first used on
+ * platforms where guest memory is allocated lazily, and are given back to the
+ * host when freed where possible.
+ */
+#define MEM_POOL_PAGES 256
+#define MEM_POOL_FRACTION 16
+
+/*
+ * Heaps of at least MEM_HUGE_HEAP_MIN bytes start on a SOLO5_HUGE_PAGE_SIZE
+ * boundary, so that the application can use huge page mappings from the
+ * start of its heap. The pool grows to fill the gap left below the heap,
+ * which costs no host memory until used.
+ */
+#define MEM_HUGE_HEAP_MIN (32 * SOLO5_HUGE_PAGE_SIZE)
+#define MEM_POOL_PAGES_MAX (MEM_POOL_PAGES + SOLO5_HUGE_PAGE_SIZE / PAGE_SIZE)
+
+static uint64_t pool_start;
+static size_t pool_pages;
+static uint64_t pool_used[MEM_POOL_PAGES_MAX / 64]; /* Bitmap of used pages */
+static bool pool_lock;
+
+/*
+ * Locks the memory layout (by disabling mem_ialloc_pages()), reserving the
+ * pool for mem_alloc_pages(). Must be called before passing control to the
+ * application via solo5_app_main().
  *
  * Returns the first usable memory address for application heap in (*start)
  * and the size of the heap in (*size).
@@ -35,10 +60,39 @@ void mem_lock_heap(uintptr_t *start, size_t *size)
     assert(!mem_locked);
 
     mem_locked = 1;
+    pool_pages = ((platform_mem_size() - heap_start) >> PAGE_SHIFT) /
+        MEM_POOL_FRACTION;
+    if (pool_pages > MEM_POOL_PAGES)
+        pool_pages = MEM_POOL_PAGES;
+    pool_start = heap_start;
+    heap_start += pool_pages << PAGE_SHIFT;
+    if (platform_mem_size() - heap_start >= MEM_HUGE_HEAP_MIN) {
+        uint64_t aligned = (heap_start + SOLO5_HUGE_PAGE_SIZE - 1) &
+            ~(uint64_t)(SOLO5_HUGE_PAGE_SIZE - 1);
+        pool_pages += (aligned - heap_start) >> PAGE_SHIFT;
+        heap_start = aligned;
+    }
+
     *start = heap_start;
     *size = platform_mem_size() - heap_start;
 }
 
+/*
+ * Returns the largest SOLO5_HUGE_PAGE_SIZE-aligned part of the heap returned
+ * by mem_lock_heap() in (*start) and (*size), or a (*size) of 0 if there is
+ * none.
+ */
+void mem_huge_heap(uintptr_t *start, size_t *size)
+{
+    uint64_t s = (heap_start + SOLO5_HUGE_PAGE_SIZE - 1) &
+        ~(uint64_t)(SOLO5_HUGE_PAGE_SIZE - 1);
+    uint64_t e = platform_mem_size() & ~(uint64_t)(SOLO5_HUGE_PAGE_SIZE - 1);
+
+    assert(mem_locked);
+    *start = s;
+    *size = (e > s) ? e - s : 0;
+}
+
 void mem_init(void)
 {
     extern char _stext[], _etext[], _erodata[], _end[];
@@ -81,3 +135,90 @@ void *mem_ialloc_pages(size_t num)
 
     return (void *)prev;
 }
+
+static bool pool_page_used(size_t page)
+{
+    return pool_used[page / 64] & (1ULL << (page % 64));
+}
+
+static void pool_mark(size_t first, size_t num, bool used)
+{
+    for (size_t page = first; page < first + num; page++) {
+        if (used)
+            pool_used[page / 64] |= 1ULL << (page % 64);
+        else
+            pool_used[page / 64] &= ~(1ULL << (page % 64));
+    }
+}
+
+/*
+ * Allocate (num) contiguous pages from the pool, after the heap has been
+ * locked. Returns NULL if the pool has no such run of free pages. Must not be
+ * called from interrupt context.
+ */
+void *mem_alloc_pages(size_t num)
+{
+    void *p = NULL;
+
+    assert(mem_locked);
+    if (num == 0 || num > pool_pages)
+        return NULL;
+
+    while (__atomic_test_and_set(&pool_lock, __ATOMIC_ACQUIRE))
+        cc_barrier();
+    for (size_t first = 0; first + num <= pool_pages; first++) {
+        size_t n = 0;
+        while (n < num && !pool_page_used(first + n))
+            n++;
+        if (n == num) {
+            pool_mark(first, num, true);
+            p = (void *)(pool_start + (first << PAGE_SHIFT));
+            break;
+        }
+        first += n;
+    }
+    __atomic_clear(&pool_lock, __ATOMIC_RELEASE);
+
+    return p;
+}
+
+/*
+ * Free (num) pages at (p), as returned by mem_alloc_pages(), giving them back
+ * to the host where possible. Their contents are undefined when next
+ * allocated.
+ */
+void mem_free_pages(void *p, size_t num)
+{
+    uint64_t addr = (uint64_t)p;
+
+    assert(addr >= pool_start && (addr & ~PAGE_MASK) == 0);
+    size_t first = (addr - pool_start) >> PAGE_SHIFT;
+    assert(first + num <= pool_pages);
+
+    (void)platform_mem_release(addr, num << PAGE_SHIFT);
+    while (__atomic_test_and_set(&pool_lock, __ATOMIC_ACQUIRE))
+        cc_barrier();
+    pool_mark(first, num, false);
+    __atomic_clear(&pool_lock, __ATOMIC_RELEASE);
+}
+
+solo5_result_t solo5_mem_release(uintptr_t addr, size_t size)
+{
+    assert(mem_locked);
+
+    if ((addr & (SOLO5_PAGE_SIZE - 1)) || (size & (SOLO5_PAGE_SIZE - 1)))
+        return SOLO5_R_EINVAL;
+    if (addr < heap_start || addr > platform_mem_size() ||
+            size > platform_mem_size() - addr)
+        return SOLO5_R_EINVAL;
+    if (size == 0)
+        return SOLO5_R_OK;
+
+    return platform_mem_release(addr, size) == 0 ? SOLO5_R_OK :
+        SOLO5_R_EUNSPEC;
+}
+
+bool solo5_mem_reclaim_requested(void)
+{
+    return platform_mem_reclaim_requested();
+}
@@ -18,23 +18,488 @@
  * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
-#include "../bindings.h"
+/*
+ * muen-block.c: Block storage provided by another subject over Muen shared
+ * memory channels.
+ *
+ * Requests are written to the "blk_req" channel, and the storage subject
+ * answers each with a response in the "blk_resp" channel, in any order.
+ * Data is exchanged through the shared "blk_data" region, which is divided
+ * into slots of SOLO5_BLOCK_IO_MAX bytes, one per request in flight: written
+ * by us before a write request, and by the storage subject before it
+ * responds to a read request. A request and its response are identified by
+ * their slot.
+ *
+ * The capacity and block size of the device are obtained with a
+ * MUENBLK_OP_INFO request when the device is acquired.
+ */
+
+#include "../hvt/bindings.h"
+#include "sinfo.h"
+#include "reader.h"
+#include "writer.h"
+#include "muen-block.h"
+
+#define MUENBLK_PROTO 0x3d1a6c84f2b90e57ULL
+
+#define MUENBLK_OP_READ         0
+#define MUENBLK_OP_WRITE        1
+#define MUENBLK_OP_FLUSH        2
+#define MUENBLK_OP_DISCARD      3
+#define MUENBLK_OP_WRITE_ZEROES 4
+#define MUENBLK_OP_INFO         5
+
+#define MUENBLK_S_OK            0
+
+struct blk_req_msg {
+    uint64_t slot;
+    uint64_t offset;
+    uint64_t size;
+    uint32_t op;
+    uint32_t __reserved;
+} __attribute__((packed));
+
+struct blk_resp_msg {
+    uint64_t slot;
+    uint64_t capacity;          /* MUENBLK_OP_INFO only */
+    uint32_t block_size;        /* MUENBLK_OP_INFO only */
+    uint32_t status;
+} __attribute__((packed));
+
+static struct muchannel *blk_req;
+static struct muchannel *blk_resp;
+static struct muchannel_reader blk_rdr;
+static uint8_t *blk_data;
+
+/*
+ * Requests in flight, one per data slot. Data read by asynchronous requests
+ * is copied to (buf) on completion; synchronous requests copy it out
+ * themselves.
+ */
+struct blk_slot {
+    bool busy;
+    bool async;
+    bool done;
+    solo5_result_t result;
+    uint64_t tag;
+    uint8_t *buf;
+    size_t size;
+};
+
+static struct blk_slot blk_slots[SOLO5_BLOCK_QUEUE_MAX];
+static unsigned blk_nslots;
+static struct block_cq blk_cq;
+
+static bool blk_acquired;
+static solo5_handle_t blk_handle;
+static solo5_off_t blk_capacity;
+static solo5_off_t blk_block_size;
+static bool blk_use_discard;
+static bool blk_use_write_zeroes;
+extern struct mft_note __solo5_manifest_note;
+
+static uint8_t *slot_data(unsigned slot)
+{
+    return blk_data + (size_t)slot * SOLO5_BLOCK_IO_MAX;
+}
+
+/* Consume the responses received since last called. */
+static void blk_complete(void)
+{
+    struct blk_resp_msg msg;
+
+    while (muen_channel_read(blk_resp, &blk_rdr, &msg) == MUCHANNEL_SUCCESS) {
+        struct blk_slot *s;
+
+        if (msg.slot >= blk_nslots || !blk_slots[msg.slot].busy ||
+                blk_slots[msg.slot].done) {
+            log(WARN, "Solo5: Block: Unexpected response for slot %llu\n",
+                (unsigned long long)msg.slot);
+            continue;
+        }
+        s = &blk_slots[msg.slot];
+        s->result = (msg.status == MUENBLK_S_OK) ?
+            SOLO5_R_OK : SOLO5_R_EUNSPEC;
+        if (s->async) {
+            if (s->buf != NULL && s->result == SOLO5_R_OK)
+                memcpy(s->buf, slot_data(msg.slot), s->size);
+            s->busy = false;
+            block_cq_complete(&blk_cq, s->tag, s->result);
+        }
+        else {
+            /* Stash the device's answer to MUENBLK_OP_INFO in the slot. */
+            s->size = msg.capacity;
+            s->tag = msg.block_size;
+            s->done = true;
+        }
+    }
+}
+
+/* Returns a free slot, or -1 if all slots are busy. */
+static int blk_slot_get(void)
+{
+    for (unsigned i = 0; i < blk_nslots; i++)
+        if (!blk_slots[i].busy)
+            return i;
+    return -1;
+}
+
+/*
+ * Sends a request in (slot). The data to be written, if any, must already be
+ * in slot_data(slot).
+ */
+static void blk_send(unsigned slot, uint32_t op, solo5_off_t offset,
+        uint64_t size, bool async, uint64_t tag)
+{
+    struct blk_req_msg msg = {
+        .slot = slot, .offset = offset, .size = size, .op = op
+    };
+
+    blk_slots[slot].busy = true;
+    blk_slots[slot].async = async;
+    blk_slots[slot].done = false;
+    blk_slots[slot].tag = tag;
+    blk_slots[slot].buf = NULL;
+    if (async)
+        block_cq_submit(&blk_cq);
+    muen_channel_write(blk_req, &msg);
+}
+
+/* Waits for a free slot, processing responses meanwhile. */
+static unsigned blk_slot_wait(void)
+{
+    int slot;
+
+    while ((slot = blk_slot_get()) == -1) {
+        blk_complete();
+        __asm__ __volatile__("pause");
+    }
+    return slot;
+}
+
+/*
+ * Waits for the response to the synchronous request in (slot). Returns the
+ * result, leaving the slot busy for the caller to copy any data out of
+ * and release.
+ */
+static solo5_result_t blk_wait(unsigned slot)
+{
+    while (!blk_slots[slot].done) {
+        blk_complete();
+        if (!blk_slots[slot].done)
+            __asm__ __volatile__("pause");
+    }
+    return blk_slots[slot].result;
+}
+
+static solo5_result_t blk_op_sync(uint32_t op, solo5_off_t offset,
+        uint64_t size)
+{
+    unsigned slot = blk_slot_wait();
+
+    blk_send(slot, op, offset, size, false, 0);
+    solo5_result_t rc = blk_wait(slot);
+    blk_slots[slot].busy = false;
+    return rc;
+}
+
+solo5_handle_set_t muen_block_ready_set(void)
+{
+    if (!blk_acquired)
+        return 0;
 
-solo5_result_t solo5_block_write(solo5_off_t offset __attribute__((unused)),
-                         const uint8_t *buf __attribute__((unused)),
-                         size_t size __attribute__((unused)))
+    blk_complete();
+    return block_cq_ready(&blk_cq) ? 1ULL << blk_handle : 0;
+}
+
+void block_init(struct hvt_boot_info *bi __attribute__((unused)))
+{
+    const uint64_t epoch = muen_get_sched_start();
+    const struct muen_resource_type *const
+        chan_req = muen_get_resource("blk_req", MUEN_RES_MEMORY);
+    const struct muen_resource_type *const
+        chan_resp = muen_get_resource("blk_resp", MUEN_RES_MEMORY);
+    const struct muen_resource_type *const
+        data = muen_get_resource("blk_data", MUEN_RES_MEMORY);
+
+    if (!chan_req || !chan_resp || !data)
+        return;
+    if (!(chan_req->data.mem.flags & MEM_CHANNEL_FLAG) ||
+            !(chan_req->data.mem.flags & MEM_WRITABLE_FLAG) ||
+            !(chan_resp->data.mem.flags & MEM_CHANNEL_FLAG) ||
+            !(data->data.mem.flags & MEM_WRITABLE_FLAG)) {
+        log(WARN, "Solo5: Block: Invalid channel or data region\n");
+        return;
+    }
+
+    blk_nslots = data->data.mem.size / SOLO5_BLOCK_IO_MAX;
+    if (blk_nslots > SOLO5_BLOCK_QUEUE_MAX)
+        blk_nslots = SOLO5_BLOCK_QUEUE_MAX;
+    if (blk_nslots == 0) {
+        log(WARN, "Solo5: Block: Data region '%s' too small\n",
+            data->name.data);
+        return;
+    }
+    blk_data = (uint8_t *)data->data.mem.address;
+
+    blk_req = (struct muchannel *)(chan_req->data.mem.address);
+    muen_channel_init_writer(blk_req, MUENBLK_PROTO,
+            sizeof(struct blk_req_msg), chan_req->data.mem.size, epoch);
+    blk_resp = (struct muchannel *)(chan_resp->data.mem.address);
+    muen_channel_init_reader(&blk_rdr, MUENBLK_PROTO);
+
+    log(INFO, "Solo5: Block: Muen shared memory stream, protocol 0x%llx, "
+        "%u slots\n", MUENBLK_PROTO, blk_nslots);
+}
+
+/*
+ * A single block device is supported: the first call to
+ * solo5_block_acquire() for a valid block device in the application manifest
+ * succeeds, once the storage subject has told us its geometry, and all
+ * subsequent calls fail.
+ */
+solo5_result_t solo5_block_acquire(const char *name, solo5_handle_t *h,
+        struct solo5_block_info *info)
 {
-    return SOLO5_R_EUNSPEC;
+    if (blk_nslots == 0 || blk_acquired)
+        return SOLO5_R_EUNSPEC;
+
+    unsigned mft_index;
+    struct mft_entry *mft_e = mft_get_by_name(&__solo5_manifest_note.m, name,
+        MFT_BLOCK_BASIC, &mft_index);
+    if (mft_e == NULL)
+        return SOLO5_R_EINVAL;
+
+    unsigned slot = blk_slot_wait();
+    blk_send(slot, MUENBLK_OP_INFO, 0, 0, false, 0);
+    solo5_result_t rc = blk_wait(slot);
+    blk_capacity = blk_slots[slot].size;
+    blk_block_size = blk_slots[slot].tag;
+    blk_slots[slot].busy = false;
+    if (rc != SOLO5_R_OK || blk_block_size == 0 ||
+            (blk_block_size & (blk_block_size - 1)) ||
+            blk_block_size > SOLO5_BLOCK_IO_MAX)
+        return SOLO5_R_EUNSPEC;
+    /* Probe for optional operations with empty requests. */
+    blk_use_discard = blk_op_sync(MUENBLK_OP_DISCARD, 0, 0) == SOLO5_R_OK;
+    blk_use_write_zeroes =
+        blk_op_sync(MUENBLK_OP_WRITE_ZEROES, 0, 0) == SOLO5_R_OK;
+
+    blk_handle = (solo5_handle_t)mft_index;
+    blk_acquired = true;
+    info->block_size = blk_block_size;
+    info->capacity = blk_capacity;
+    info->zone_size = 0;
+    *h = (solo5_handle_t)mft_index;
+    stats_acquire(*h, MFT_BLOCK_BASIC);
+    log(INFO, "Solo5: Application acquired '%s' as block device\n", name);
+    return SOLO5_R_OK;
 }
 
-solo5_result_t solo5_block_read(solo5_off_t offset __attribute__((unused)),
-                        uint8_t *buf __attribute__((unused)),
-                        size_t size __attribute__((unused)))
+static bool blk_valid(solo5_handle_t h, solo5_off_t offset, size_t size)
 {
-    return SOLO5_R_EUNSPEC;
+    return blk_acquired && h == blk_handle &&
+        block_request_valid(blk_capacity, blk_block_size, offset, size);
 }
 
-void solo5_block_info(struct solo5_block_info *info __attribute__((unused)))
+solo5_result_t solo5_block_writev(solo5_handle_t h, solo5_off_t offset,
+        const struct solo5_block_iov *iov, size_t count)
 {
-    assert(0);
+    size_t size = block_iov_size(iov, count, blk_block_size);
+    if (size == 0 || !blk_valid(h, offset, size))
+        return block_stats_op(h, BLOCK_STATS_WRITE, SOLO5_R_EINVAL, 0);
+
+    unsigned slot = blk_slot_wait();
+    uint8_t *p = slot_data(slot);
+    for (size_t i = 0; i < count; p += iov[i].size, i++)
+        memcpy(p, iov[i].buf, iov[i].size);
+    blk_send(slot, MUENBLK_OP_WRITE, offset, size, false, 0);
+    solo5_result_t rc = blk_wait(slot);
+    blk_slots[slot].busy = false;
+    return block_stats_op(h, BLOCK_STATS_WRITE, rc, size);
+}
+
+solo5_result_t solo5_block_readv(solo5_handle_t h, solo5_off_t offset,
+        const struct solo5_block_iov *iov, size_t count)
+{
+    size_t size = block_iov_size(iov, count, blk_block_size);
+    if (size == 0 || !blk_valid(h, offset, size))
+        return block_stats_op(h, BLOCK_STATS_READ, SOLO5_R_EINVAL, 0);
+
+    unsigned slot = blk_slot_wait();
+    blk_send(slot, MUENBLK_OP_READ, offset, size, false, 0);
+    solo5_result_t rc = blk_wait(slot);
+    if (rc == SOLO5_R_OK) {
+        const uint8_t *p = slot_data(slot);
+        for (size_t i = 0; i < count; p += iov[i].size, i++)
+            memcpy(iov[i].buf, p, iov[i].size);
+    }
+    blk_slots[slot].busy = false;
+    return block_stats_op(h, BLOCK_STATS_READ, rc, size);
+}
+
+solo5_result_t solo5_block_write(solo5_handle_t h, solo5_off_t offset,
+        const uint8_t *buf, size_t size)
+{
+    struct solo5_block_iov iov = { .buf = (uint8_t *)buf, .size = size };
+    return solo5_block_writev(h, offset, &iov, 1);
+}
+
+solo5_result_t solo5_block_read(solo5_handle_t h, solo5_off_t offset,
+        uint8_t *buf, size_t size)
+{
+    struct solo5_block_iov iov = { .buf = buf, .size = size };
+    return solo5_block_readv(h, offset, &iov, 1);
+}
+
+solo5_result_t solo5_block_flush(solo5_handle_t h)
+{
+    if (!blk_acquired || h != blk_handle)
+        return block_stats_op(h, BLOCK_STATS_FLUSH, SOLO5_R_EINVAL, 0);
+
+    return block_stats_op(h, BLOCK_STATS_FLUSH,
+            blk_op_sync(MUENBLK_OP_FLUSH, 0, 0), 0);
+}
+
+solo5_result_t solo5_block_discard(solo5_handle_t h, solo5_off_t offset,
+        solo5_off_t size)
+{
+    if (!blk_acquired || h != blk_handle ||
+            !block_range_valid(blk_capacity, blk_block_size, offset, size))
+        return block_stats_op(h, BLOCK_STATS_DISCARD, SOLO5_R_EINVAL, 0);
+    if (!blk_use_discard)
+        return block_stats_op(h, BLOCK_STATS_DISCARD, SOLO5_R_OK, 0);
+
+    return block_stats_op(h, BLOCK_STATS_DISCARD,
+            blk_op_sync(MUENBLK_OP_DISCARD, offset, size), 0);
+}
+
+solo5_result_t solo5_block_write_zeroes(solo5_handle_t h, solo5_off_t offset,
+        solo5_off_t size)
+{
+    if (!blk_acquired || h != blk_handle ||
+            !block_range_valid(blk_capacity, blk_block_size, offset, size))
+        return block_stats_op(h, BLOCK_STATS_DISCARD, SOLO5_R_EINVAL, 0);
+    if (!blk_use_write_zeroes)
+        return block_write_zeroes_slow(h, offset, size);
+
+    return block_stats_op(h, BLOCK_STATS_DISCARD,
+            blk_op_sync(MUENBLK_OP_WRITE_ZEROES, offset, size), 0);
+}
+
+/*
+ * The block server protocol has no means of passing on the hint.
+ */
+solo5_result_t solo5_block_prefetch(solo5_handle_t h, solo5_off_t offset,
+        solo5_off_t size)
+{
+    if (!blk_acquired || h != blk_handle ||
+            !block_range_valid(blk_capacity, blk_block_size, offset, size))
+        return SOLO5_R_EINVAL;
+    return SOLO5_R_OK;
+}
+
+solo5_result_t solo5_block_map(solo5_handle_t h __attribute__((unused)),
+        const uint8_t **data __attribute__((unused)))
+{
+    return SOLO5_R_EINVAL;
+}
+
+/*
+ * The block server protocol has no notion of zones, so devices are never
+ * zoned.
+ */
+solo5_result_t solo5_block_zone_report(
+        solo5_handle_t h __attribute__((unused)),
+        solo5_off_t offset __attribute__((unused)),
+        struct solo5_block_zone *zones __attribute__((unused)),
+        size_t count __attribute__((unused)),
+        size_t *nzones __attribute__((unused)))
+{
+    return SOLO5_R_EINVAL;
+}
+
+solo5_result_t solo5_block_zone_append(solo5_handle_t h,
+        solo5_off_t zone __attribute__((unused)),
+        const uint8_t *buf __attribute__((unused)),
+        size_t size __attribute__((unused)),
+        solo5_off_t *offset __attribute__((unused)))
+{
+    return block_stats_op(h, BLOCK_STATS_WRITE, SOLO5_R_EINVAL, 0);
+}
+
+solo5_result_t solo5_block_zone_manage(
+        solo5_handle_t h __attribute__((unused)),
+        unsigned op __attribute__((unused)),
+        solo5_off_t zone __attribute__((unused)))
+{
+    return SOLO5_R_EINVAL;
+}
+
+/*
+ * Submits an asynchronous request. Responses are only consumed if there is
+ * no free slot for it.
+ */
+static solo5_result_t blk_submit(uint32_t op, solo5_off_t offset,
+        uint8_t *read_buf, const uint8_t *write_buf, size_t size,
+        uint64_t tag)
+{
+    int slot;
+
+    if (block_cq_full(&blk_cq))
+        return SOLO5_R_AGAIN;
+    if ((slot = blk_slot_get()) == -1) {
+        blk_complete();
+        if ((slot = blk_slot_get()) == -1)
+            return SOLO5_R_AGAIN;
+    }
+
+    if (write_buf != NULL)
+        memcpy(slot_data(slot), write_buf, size);
+    blk_send(slot, op, offset, size, true, tag);
+    blk_slots[slot].buf = read_buf;
+    blk_slots[slot].size = size;
+    return SOLO5_R_OK;
+}
+
+solo5_result_t solo5_block_submit_read(solo5_handle_t h, solo5_off_t offset,
+        uint8_t *buf, size_t size, uint64_t tag)
+{
+    if (!blk_valid(h, offset, size))
+        return block_stats_op(h, BLOCK_STATS_READ, SOLO5_R_EINVAL, 0);
+
+    return block_stats_op(h, BLOCK_STATS_READ,
+            blk_submit(MUENBLK_OP_READ, offset, buf, NULL, size, tag), size);
+}
+
+solo5_result_t solo5_block_submit_write(solo5_handle_t h, solo5_off_t offset,
+        const uint8_t *buf, size_t size, uint64_t tag)
+{
+    if (!blk_valid(h, offset, size))
+        return block_stats_op(h, BLOCK_STATS_WRITE, SOLO5_R_EINVAL, 0);
+
+    return block_stats_op(h, BLOCK_STATS_WRITE,
+            blk_submit(MUENBLK_OP_WRITE, offset, NULL, buf, size, tag), size);
+}
+
+solo5_result_t solo5_block_submit_flush(solo5_handle_t h, uint64_t tag)
+{
+    if (!blk_acquired || h != blk_handle)
+        return block_stats_op(h, BLOCK_STATS_FLUSH, SOLO5_R_EINVAL, 0);
+
+    return block_stats_op(h, BLOCK_STATS_FLUSH,
+            blk_submit(MUENBLK_OP_FLUSH, 0, NULL, NULL, 0, tag), 0);
+}
+
+solo5_result_t solo5_block_reap(solo5_handle_t h,
+        struct solo5_block_completion *completions, size_t count,
+        size_t *reaped)
+{
+    if (!blk_acquired || h != blk_handle)
+        return SOLO5_R_EINVAL;
+
+    blk_complete();
+    solo5_result_t rc = block_cq_reap(&blk_cq, completions, count, reaped);
+    return block_stats_reap(h, rc, completions,
+            rc == SOLO5_R_OK ? *reaped : 0);
 }
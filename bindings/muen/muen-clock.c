@@ -21,6 +21,7 @@
 #include "../bindings.h"
 #include "sinfo.h"
 #include "mutimeinfo.h"
+#include "muen-clock.h"
 
 static struct time_info_type *time_info;
 
@@ -31,26 +32,46 @@ static uint64_t wc_epochoffset;
 static uint64_t time_base;
 static uint64_t tsc_base;
 
-/* Multiplier for converting TSC ticks to nsecs. (0.32) fixed point. */
+/* Multiplier for converting TSC ticks to nsecs. (0.S) fixed point. */
 static uint32_t tsc_mult;
+static uint8_t tsc_shift;
+static uint64_t tsc_freq;
 
-/* TSC value of current minor frame start */
+/* True if the subject may read the TSC itself. */
+static bool tsc_direct;
+
+/*
+ * Without RDTSC, TSC value of current minor frame start, and the ticks by
+ * which the clock advances on each call within the same minor frame.
+ */
 static uint64_t current_start = 0;
 static uint64_t min_delta;
 
+#define CPUID_1_EDX_TSC (1U << 4)
+
 uint64_t tscclock_monotonic(void)
 {
-    const uint64_t next_start = muen_get_sched_start();
     uint64_t tsc_now, tsc_delta;
-    tsc_now = tsc_base;
 
-    if (next_start == current_start)
-        tsc_now += min_delta;
-    else
-        tsc_now = current_start = next_start;
+    if (tsc_direct) {
+        tsc_now = cpu_rdtsc();
+        /*
+         * The subject is pinned to one CPU, but never let the clock go
+         * backwards should the TSC do so.
+         */
+        if (tsc_now <= tsc_base)
+            return time_base;
+    } else {
+        const uint64_t next_start = muen_get_sched_start();
+
+        if (next_start == current_start)
+            tsc_now = tsc_base + min_delta;
+        else
+            tsc_now = current_start = next_start;
+    }
 
     tsc_delta = tsc_now - tsc_base;
-    time_base += mul64_32(tsc_delta, tsc_mult, 32);
+    time_base += mul64_32(tsc_delta, tsc_mult, tsc_shift);
     tsc_base = tsc_now;
 
     return time_base;
@@ -58,7 +79,6 @@ uint64_t tscclock_monotonic(void)
 
 int tscclock_init(uint64_t freq __attribute__((unused)))
 {
-    uint64_t tsc_freq;
     const struct muen_resource_type *const
         region = muen_get_resource("time_info", MUEN_RES_MEMORY);
 
@@ -81,17 +101,48 @@ int tscclock_init(uint64_t freq __attribute__((unused)))
 
     tsc_freq = time_info->tsc_tick_rate_hz;
     /*
-     * TODO: This calculation may overflow for low values of tsc_freq;
-     * dynamically calculate tsc_shift as in hvt version.
+     * As on hvt, tsc_shift is the largest (<=32) shift factor for which
+     * tsc_mult fits into uint32_t, so that TSC frequencies below 1 GHz do
+     * not overflow it.
      */
-    tsc_mult = (NSEC_PER_SEC << 32) / tsc_freq;
+    tsc_shift = 32;
+    tsc_mult = 0;
+    do {
+        uint64_t tmp = (NSEC_PER_SEC << tsc_shift) / tsc_freq;
+        if ((tmp & 0xFFFFFFFF00000000L) == 0L)
+            tsc_mult = (uint32_t)tmp;
+        else
+            tsc_shift--;
+    } while (tsc_shift > 0 && tsc_mult == 0L);
     min_delta = (tsc_freq + (NSEC_PER_SEC - 1)) / NSEC_PER_SEC;
     time_base = 0;
-    log(INFO, "Solo5: Clock source: Muen PV clock, TSC frequency %llu Hz\n",
-        (unsigned long long)tsc_freq);
+
+    /*
+     * Read the TSC directly if the subject's CPUID reports it; otherwise
+     * fall back to advancing the clock from the minor frame start.
+     */
+    uint32_t eax, ebx, ecx, edx;
+    x86_cpuid(1, &eax, &ebx, &ecx, &edx);
+    tsc_direct = (edx & CPUID_1_EDX_TSC) != 0;
+    log(INFO, "Solo5: Clock source: Muen PV clock%s, TSC frequency %llu Hz\n",
+        tsc_direct ? " (RDTSC)" : "", (unsigned long long)tsc_freq);
     return 0;
 }
 
+uint64_t muen_clock_tsc_at(uint64_t ns)
+{
+    if (ns <= time_base)
+        return tsc_base;
+    /*
+     * A 128-bit division would need libgcc, which the bindings do not link.
+     * The remainder is below NSEC_PER_SEC, so its product with tsc_freq fits
+     * in 64 bits.
+     */
+    uint64_t delta = ns - time_base;
+    return tsc_base + (delta / NSEC_PER_SEC) * tsc_freq +
+        (delta % NSEC_PER_SEC) * tsc_freq / NSEC_PER_SEC;
+}
+
 uint64_t tscclock_epochoffset(void)
 {
     return wc_epochoffset;
@@ -18,7 +18,7 @@
  * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
-#include "../bindings.h"
+#include "../hvt/bindings.h"
 #include "sinfo.h"
 #include "writer.h"
 
@@ -66,10 +66,10 @@ int platform_puts(const char *buf, int n)
 
 void solo5_console_write(const char *buf, size_t size)
 {
-    (void)platform_puts(buf, size);
+    console_write(buf, size);
 }
 
-void console_init(void)
+void console_init(struct hvt_boot_info *bi __attribute__((unused)))
 {
     const struct muen_resource_type *const
         channel = muen_get_resource("debuglog", MUEN_RES_MEMORY);
@@ -31,59 +31,247 @@ struct net_msg {
     uint16_t length;
 } __attribute__((packed));
 
-static struct muchannel *net_in;
-static struct muchannel *net_out;
-static struct muchannel_reader net_rdr;
+/*
+ * Each network device in the application manifest is backed by its own pair
+ * of channels, named after the device: "<name>|out" written by us and
+ * "<name>|in" read by us, and found when the device is acquired.
+ */
+#define MUEN_NET_DEVICES_MAX 4
+
+struct net_dev {
+    solo5_handle_t handle;
+    struct muchannel *in;
+    struct muchannel *out;
+    struct muchannel_reader rdr;
+    uint8_t mac[SOLO5_NET_ALEN];
+    /*
+     * Packets are copied out of the channel on receipt, as the writer may
+     * overwrite elements at any time.
+     */
+    uint8_t loan_buf[PACKET_SIZE];
+    bool loaned;
+    /*
+     * Packets loaned for transmit are copied into the channel, so they are
+     * complete as soon as they are sent.
+     */
+    struct net_wloans wloans;
+};
 
-static uint8_t mac_addr[6];
+static struct net_dev net_devs[MUEN_NET_DEVICES_MAX];
+static unsigned net_ndevs;
+/* Device acquired for each manifest entry, if any */
+static struct net_dev *net_acquired[MFT_MAX_ENTRIES];
+extern struct mft_note __solo5_manifest_note;
 
-solo5_result_t solo5_net_write(const uint8_t *buf, size_t size)
+static struct net_dev *net_get(solo5_handle_t h)
 {
-    struct net_msg pkt;
+    return (h < MFT_MAX_ENTRIES) ? net_acquired[h] : NULL;
+}
 
-    if (size > PACKET_SIZE)
-        return SOLO5_R_EINVAL;
+/*
+ * Packets are written in place, and only up to their length: the rest of the
+ * element is left as it was, as readers ignore it.
+ */
+static void net_msg_fill(struct net_msg *msg, const uint8_t *buf, size_t size)
+{
+    memcpy(msg->data, buf, size);
+    msg->length = size;
+}
+
+solo5_result_t solo5_net_write(solo5_handle_t h, const uint8_t *buf,
+        size_t size)
+{
+    struct net_dev *nd = net_get(h);
+
+    if (nd == NULL || size > PACKET_SIZE)
+        return net_stats_tx(h, SOLO5_R_EINVAL, 0);
+
+    muen_channel_write_begin(nd->out, 1);
+    net_msg_fill(muen_channel_write_element(nd->out, 0), buf, size);
+    muen_channel_write_end(nd->out, 1);
+
+    return net_stats_tx(h, SOLO5_R_OK, size);
+}
+
+/*
+ * Valid packets are published together, as many at a time as the channel
+ * holds, with a single update of the channel header.
+ */
+solo5_result_t solo5_net_writev(solo5_handle_t h,
+        struct solo5_net_frame *frames, size_t count)
+{
+    struct net_dev *nd = net_get(h);
+    solo5_result_t rc = SOLO5_R_OK;
+
+    if (nd == NULL || count > SOLO5_NET_FRAMES_MAX)
+        return net_stats_tx(h, SOLO5_R_EINVAL, 0);
+
+    for (size_t i = 0; i < count; i++) {
+        if (frames[i].size > PACKET_SIZE) {
+            frames[i].result = SOLO5_R_EINVAL;
+            if (rc == SOLO5_R_OK)
+                rc = SOLO5_R_EINVAL;
+        }
+        else
+            frames[i].result = SOLO5_R_OK;
+    }
+
+    for (size_t i = 0, j; i < count; i = j) {
+        uint64_t n = 0;
 
-    memset(&pkt, 0, sizeof(struct net_msg));
+        for (j = i; j < count && n < nd->out->hdr.elements; j++)
+            n += (frames[j].result == SOLO5_R_OK);
+        muen_channel_write_begin(nd->out, n);
+        for (n = 0; i < j; i++) {
+            if (frames[i].result == SOLO5_R_OK)
+                net_msg_fill(muen_channel_write_element(nd->out, n++),
+                        frames[i].buf, frames[i].size);
+        }
+        muen_channel_write_end(nd->out, n);
+    }
+
+    return net_stats_txv(h, rc, frames, count);
+}
+
+/*
+ * Copy the next packet in the input channel of (nd) to (buf), which must hold
+ * PACKET_SIZE bytes, straight from the channel and only up to its length.
+ * Returns false if there is none, or it was overwritten while being copied.
+ */
+static bool net_recv(struct net_dev *nd, uint8_t *buf, size_t *read_size)
+{
+    const struct net_msg *msg;
+    uint16_t length;
+
+    if (muen_channel_read_begin(nd->in, &nd->rdr, (const void **)&msg) !=
+            MUCHANNEL_SUCCESS)
+        return false;
+
+    length = msg->length;
     cc_barrier();
-    pkt.length = size;
-    memcpy(&pkt.data, buf, size);
-    muen_channel_write(net_out, &pkt);
+    if (length > PACKET_SIZE)
+        length = PACKET_SIZE;
+    memcpy(buf, msg->data, length);
 
-    return SOLO5_R_OK;
+    if (muen_channel_read_end(nd->in, &nd->rdr) != MUCHANNEL_SUCCESS)
+        return false;
+    *read_size = length;
+    return true;
 }
 
-solo5_result_t solo5_net_read(uint8_t *buf, size_t size, size_t *read_size)
+solo5_result_t solo5_net_read(solo5_handle_t h, uint8_t *buf, size_t size,
+        size_t *read_size)
 {
-    enum muchannel_reader_result result;
-    struct net_msg pkt;
+    struct net_dev *nd = net_get(h);
+
+    if (nd == NULL || size < PACKET_SIZE)
+        return net_stats_rx(h, SOLO5_R_EINVAL, 0);
 
-    if (size < PACKET_SIZE)
+    if (!net_recv(nd, buf, read_size))
+        return net_stats_rx(h, SOLO5_R_AGAIN, 0);
+    return net_stats_rx(h, SOLO5_R_OK, *read_size);
+}
+
+solo5_result_t solo5_net_readv(solo5_handle_t h,
+        struct solo5_net_frame *frames, size_t count, size_t *read_count)
+{
+    struct net_dev *nd = net_get(h);
+    size_t n;
+
+    if (nd == NULL || count > SOLO5_NET_FRAMES_MAX)
+        return net_stats_rx(h, SOLO5_R_EINVAL, 0);
+    for (size_t i = 0; i < count; i++) {
+        if (frames[i].size < PACKET_SIZE)
+            return net_stats_rx(h, SOLO5_R_EINVAL, 0);
+    }
+
+    for (n = 0; n < count; n++) {
+        if (!net_recv(nd, frames[n].buf, &frames[n].size))
+            break;
+        frames[n].tstamp = 0;
+        frames[n].result = SOLO5_R_OK;
+    }
+    if (n == 0)
+        return net_stats_rx(h, SOLO5_R_AGAIN, 0);
+
+    *read_count = n;
+    return net_stats_rxv(h, SOLO5_R_OK, frames, n);
+}
+
+solo5_result_t solo5_net_read_loan(solo5_handle_t h, const uint8_t **buf,
+        size_t *size)
+{
+    struct net_dev *nd = net_get(h);
+
+    if (nd == NULL || nd->loaned)
+        return net_stats_rx(h, SOLO5_R_EINVAL, 0);
+
+    if (!net_recv(nd, nd->loan_buf, size))
+        return net_stats_rx(h, SOLO5_R_AGAIN, 0);
+    *buf = nd->loan_buf;
+    nd->loaned = true;
+    return net_stats_rx(h, SOLO5_R_OK, *size);
+}
+
+solo5_result_t solo5_net_read_release(solo5_handle_t h)
+{
+    struct net_dev *nd = net_get(h);
+
+    if (nd == NULL || !nd->loaned)
         return SOLO5_R_EINVAL;
 
-    result = muen_channel_read(net_in, &net_rdr, &pkt);
-    if (result == MUCHANNEL_SUCCESS) {
-        memcpy(buf, &pkt.data, pkt.length);
-        *read_size = pkt.length;
-        return SOLO5_R_OK;
-    } else {
-        return SOLO5_R_AGAIN;
+    nd->loaned = false;
+    return SOLO5_R_OK;
+}
+
+solo5_result_t solo5_net_write_loan(solo5_handle_t h, const uint8_t *buf,
+        size_t size)
+{
+    struct net_dev *nd = net_get(h);
+
+    if (nd == NULL)
+        return net_stats_tx(h, SOLO5_R_EINVAL, 0);
+    if (net_wloans_full(&nd->wloans))
+        return net_stats_tx(h, SOLO5_R_AGAIN, 0);
+
+    /* Counted by solo5_net_write(). */
+    solo5_result_t rc = solo5_net_write(h, buf, size);
+    if (rc == SOLO5_R_OK) {
+        net_wloans_push(&nd->wloans, buf);
+        net_wloans_complete(&nd->wloans, 1);
     }
+    return rc;
 }
 
-bool muen_net_pending_data()
+solo5_result_t solo5_net_write_reclaim(solo5_handle_t h, const uint8_t **bufs,
+        size_t count, size_t *reclaimed)
 {
-    return muen_channel_has_pending_data(net_in, &net_rdr);
+    struct net_dev *nd = net_get(h);
+
+    if (nd == NULL)
+        return SOLO5_R_EINVAL;
+
+    return net_wloans_reclaim(&nd->wloans, bufs, count, reclaimed);
 }
 
-/* TODO: Support configured MAC address */
-void solo5_net_info(struct solo5_net_info *info)
+solo5_handle_set_t muen_net_ready_set(void)
 {
-    memcpy(info->mac_address, mac_addr, sizeof info->mac_address);
-    info->mtu = 1500;
+    solo5_handle_set_t ready_set = 0;
+
+    for (unsigned i = 0; i < net_ndevs; i++) {
+        struct net_dev *nd = &net_devs[i];
+
+        if (muen_channel_has_pending_data(nd->in, &nd->rdr))
+            ready_set |= 1ULL << nd->handle;
+    }
+    return ready_set;
 }
 
-void generate_mac_addr(uint8_t *addr)
+/*
+ * Derive a locally administered MAC address for the device with manifest
+ * index (index), distinct for each device of the subject.
+ */
+static void generate_mac_addr(uint8_t *addr, unsigned index)
 {
     const char *subject_name = muen_get_subject_name();
     uint64_t data;
@@ -91,6 +279,7 @@ void generate_mac_addr(uint8_t *addr)
 
     data  = (muen_get_sched_start() << 32) | muen_get_sched_end();
     data ^= tscclock_epochoffset();
+    data ^= (uint64_t)index << 40;
 
     for (i = 0; i < 6; i++)
     {
@@ -103,62 +292,94 @@ void generate_mac_addr(uint8_t *addr)
     addr[0] |= 0x02;
 }
 
-void net_init(void)
+/*
+ * Looks up the channel "<name>|<dir>", returning NULL if the subject has
+ * none, or it is not a channel, or not writable if (writable) is set.
+ */
+static const struct muen_resource_type *net_channel_get(const char *name,
+        const char *dir, bool writable)
 {
-    char mac_str[18];
-    const uint64_t epoch = muen_get_sched_start();
-    const struct muen_resource_type *const
-        chan_out = muen_get_resource("net_out", MUEN_RES_MEMORY);
-    const struct muen_resource_type *const
-        chan_in = muen_get_resource("net_in", MUEN_RES_MEMORY);
-
-    if (!chan_out) {
-        log(WARN, "Solo5: Net: No output channel\n");
-        return;
+    char res_name[MFT_NAME_SIZE + 4];
+    const struct muen_resource_type *res;
+
+    snprintf(res_name, sizeof res_name, "%s|%s", name, dir);
+    res = muen_get_resource(res_name, MUEN_RES_MEMORY);
+    if (!res) {
+        log(WARN, "Solo5: Net: No channel '%s'\n", res_name);
+        return NULL;
     }
-    if (!(chan_out->data.mem.flags & MEM_CHANNEL_FLAG)) {
-        log(WARN, "Solo5: Net: Memory '%s' is not a channel\n",
-            chan_out->name.data);
-        return;
+    if (!(res->data.mem.flags & MEM_CHANNEL_FLAG)) {
+        log(WARN, "Solo5: Net: Memory '%s' is not a channel\n", res_name);
+        return NULL;
     }
-    if (!(chan_out->data.mem.flags & MEM_WRITABLE_FLAG)) {
+    if (writable && !(res->data.mem.flags & MEM_WRITABLE_FLAG)) {
         log(WARN, "Solo5: Net: Output channel '%s' not writable\n",
-            chan_out->name.data);
-        return;
+            res_name);
+        return NULL;
+    }
+    if (!writable && (res->data.mem.flags & MEM_WRITABLE_FLAG)) {
+        log(DEBUG, "Solo5: Net: Input channel '%s' is writable\n", res_name);
     }
+    return res;
+}
+
+solo5_result_t solo5_net_acquire(const char *name, solo5_handle_t *h,
+        struct solo5_net_info *info)
+{
+    char mac_str[18];
+    const uint64_t epoch = muen_get_sched_start();
+    const struct muen_resource_type *chan_out, *chan_in;
+    struct net_dev *nd;
+
+    unsigned mft_index;
+    struct mft_entry *mft_e = mft_get_by_name(&__solo5_manifest_note.m, name,
+            MFT_NET_BASIC, &mft_index);
+    if (mft_e == NULL)
+        return SOLO5_R_EINVAL;
+    if (net_acquired[mft_index] != NULL || net_ndevs == MUEN_NET_DEVICES_MAX)
+        return SOLO5_R_EUNSPEC;
+
+    chan_out = net_channel_get(name, "out", true);
+    chan_in = net_channel_get(name, "in", false);
+    if (!chan_out || !chan_in)
+        return SOLO5_R_EUNSPEC;
 
-    net_out = (struct muchannel *)(chan_out->data.mem.address);
-    muen_channel_init_writer(net_out, MUENNET_PROTO, sizeof(struct net_msg),
+    nd = &net_devs[net_ndevs++];
+    nd->handle = (solo5_handle_t)mft_index;
+    nd->out = (struct muchannel *)(chan_out->data.mem.address);
+    muen_channel_init_writer(nd->out, MUENNET_PROTO, sizeof(struct net_msg),
                              chan_out->data.mem.size, epoch);
+    nd->in = (struct muchannel *)(chan_in->data.mem.address);
+    muen_channel_init_reader(&nd->rdr, MUENNET_PROTO);
+    net_acquired[mft_index] = nd;
+
     log(INFO, "Solo5: Net: Muen shared memory stream, protocol 0x%llx\n",
         MUENNET_PROTO);
     log(INFO, "Solo5: Net: Output channel @ 0x%llx, size 0x%llx, epoch 0x%llx\n",
         (unsigned long long)chan_out->data.mem.address,
         (unsigned long long)chan_out->data.mem.size, (unsigned long long)epoch);
-
-    if (!chan_in) {
-        log(WARN, "Solo5: Net: No input channel\n");
-        return;
-    }
-    if (!(chan_in->data.mem.flags & MEM_CHANNEL_FLAG)) {
-        log(WARN, "Solo5: Net: Memory '%s' is not a channel\n",
-            chan_in->name.data);
-        return;
-    }
-    if (chan_in->data.mem.flags & MEM_WRITABLE_FLAG) {
-        log(DEBUG, "Solo5: Net: Input channel '%s' is writable\n",
-            chan_in->name.data);
-    }
-
-    net_in = (struct muchannel *)(chan_in->data.mem.address);
-    muen_channel_init_reader(&net_rdr, MUENNET_PROTO);
     log(INFO, "Solo5: Net: Input  channel @ 0x%llx, size 0x%llx\n",
         (unsigned long long)chan_in->data.mem.address,
         (unsigned long long)chan_in->data.mem.size);
 
-    generate_mac_addr(mac_addr);
+    /* TODO: Support configured MAC address */
+    generate_mac_addr(nd->mac, mft_index);
     snprintf(mac_str, sizeof(mac_str), "%02x:%02x:%02x:%02x:%02x:%02x",
-             mac_addr[0], mac_addr[1], mac_addr[2],
-             mac_addr[3], mac_addr[4], mac_addr[5]);
+             nd->mac[0], nd->mac[1], nd->mac[2],
+             nd->mac[3], nd->mac[4], nd->mac[5]);
     log(INFO, "Solo5: Net: Using MAC address %s\n", mac_str);
+
+    memcpy(info->mac_address, nd->mac, sizeof info->mac_address);
+    /* Channel elements are sized by the system policy. */
+    info->mtu = PACKET_SIZE - SOLO5_NET_HLEN;
+    info->offloads = 0;
+    *h = (solo5_handle_t)mft_index;
+    stats_acquire(*h, MFT_NET_BASIC);
+    log(INFO, "Solo5: Application acquired '%s' as network device\n", name);
+    return SOLO5_R_OK;
+}
+
+/* Channels are set up when each device is acquired. */
+void net_init(struct hvt_boot_info *bi __attribute__((unused)))
+{
 }
@@ -22,8 +22,8 @@
 #define MUEN_NET_H
 
 /*
- * Returns True if there is pending network data.
+ * Returns the set of acquired network devices with pending input.
  */
-bool muen_net_pending_data();
+solo5_handle_set_t muen_net_ready_set(void);
 
 #endif
@@ -40,3 +40,44 @@ void platform_exit(int status __attribute__((unused)),
     __asm__ __volatile__("cli; hlt");
     for (;;);
 }
+
+int platform_mem_release(uint64_t addr __attribute__((unused)),
+        size_t size __attribute__((unused)))
+{
+    return -1;
+}
+
+bool platform_mem_reclaim_requested(void)
+{
+    return false;
+}
+
+solo5_handle_set_t platform_net_writable_set(void)
+{
+    return 0;
+}
+
+/*
+ * Shared-memory regions and PCI passthrough are not supported, see
+ * shm_none.c and pci_none.c.
+ */
+void shm_init(struct hvt_boot_info *bi __attribute__((unused)))
+{
+}
+
+void pci_init(struct hvt_boot_info *bi __attribute__((unused)))
+{
+}
+
+/*
+ * Tracing is not supported.
+ */
+void trace_init(struct hvt_boot_info *bi __attribute__((unused)))
+{
+}
+
+void solo5_trace(uint32_t id __attribute__((unused)),
+        uint64_t arg0 __attribute__((unused)),
+        uint64_t arg1 __attribute__((unused)))
+{
+}
@@ -19,22 +19,82 @@
  */
 
 #include "../bindings.h"
+#include "sinfo.h"
+#include "mutimedevent.h"
+#include "muen-clock.h"
 #include "muen-net.h"
+#include "muen-block.h"
 
-bool solo5_yield(uint64_t deadline)
+/*
+ * If the policy gives the subject a timed event page, an event for it to
+ * trigger ("timer") and an event whose action is to put the subject to sleep
+ * ("sleep"), solo5_yield() sleeps until the deadline, or until another
+ * subject sends it an event, such as the writer of the network input
+ * channel. Otherwise, it spins until either.
+ */
+static struct timed_event_interface *timed_event;
+static uint8_t sleep_event;
+static bool yield_initialised;
+
+static void yield_init(void)
+{
+    const struct muen_resource_type *const
+        region = muen_get_resource("timed_event", MUEN_RES_MEMORY);
+    const struct muen_resource_type *const
+        timer = muen_get_resource("timer", MUEN_RES_EVENT);
+    const struct muen_resource_type *const
+        sleep = muen_get_resource("sleep", MUEN_RES_EVENT);
+
+    yield_initialised = true;
+    if (!region || !timer || !sleep) {
+        log(INFO, "Solo5: Yield: No timed or sleep event, polling\n");
+        return;
+    }
+
+    timed_event = (struct timed_event_interface *)region->data.mem.address;
+    timed_event->event_nr = timer->data.number;
+    sleep_event = sleep->data.number;
+    log(INFO, "Solo5: Yield: Sleeping on events %u and %u\n",
+        (unsigned)timer->data.number, (unsigned)sleep_event);
+}
+
+static void yield_sleep(uint64_t deadline)
 {
-    bool rc = false;
+    if (timed_event == NULL) {
+        __asm__ __volatile__("pause");
+        return;
+    }
+
+    timed_event->tsc_trigger = muen_clock_tsc_at(deadline);
+    cc_barrier();
+    __asm__ __volatile__("vmcall" : : "a"((uint64_t)sleep_event) : "memory");
+}
+
+static solo5_handle_set_t ready_set_poll(void)
+{
+    return muen_net_ready_set() | muen_block_ready_set();
+}
+
+bool solo5_yield(solo5_time_t deadline, solo5_handle_set_t *ready_set)
+{
+    solo5_handle_set_t tmp_ready_set;
+
+    if (!yield_initialised)
+        yield_init();
+
+    console_flush();
     do {
-        if (muen_net_pending_data()) {
-            rc = true;
+        tmp_ready_set = ready_set_poll();
+        if (tmp_ready_set)
             break;
-        }
-        __asm__ __volatile__("pause");
+        solo5_time_t idle_start = solo5_clock_monotonic();
+        yield_sleep(deadline);
+        cpu_time_idle(idle_start);
     } while (solo5_clock_monotonic() < deadline);
+    if (!tmp_ready_set)
+        tmp_ready_set = ready_set_poll();
 
-    if (muen_net_pending_data()) {
-        rc = true;
-    }
-
-    return rc;
+    if (ready_set)
+        *ready_set = tmp_ready_set;
+    return tmp_ready_set != 0;
 }
@@ -62,54 +62,74 @@ void muen_channel_init_reader(struct muchannel_reader *reader, uint64_t protocol
     reader->rc = 0;
 }
 
-enum muchannel_reader_result muen_channel_read(
+enum muchannel_reader_result muen_channel_read_begin(
         const struct muchannel * const channel,
         struct muchannel_reader *reader,
-        void *element)
+        const void **element)
 {
-    uint64_t epoch, pos, wc, wsc;
-    enum muchannel_reader_result result;
+    uint64_t pos, wc;
 
-    if (muen_channel_is_active(channel)) {
+    if (!muen_channel_is_active(channel)) {
+        reader->epoch = MUCHANNEL_NULL_EPOCH;
+        return MUCHANNEL_INACTIVE;
+    }
 
-        if (reader->epoch == MUCHANNEL_NULL_EPOCH ||
-                has_epoch_changed(channel, reader))
-            return synchronize(channel, reader);
+    if (reader->epoch == MUCHANNEL_NULL_EPOCH ||
+            has_epoch_changed(channel, reader))
+        return synchronize(channel, reader);
 
-        serialized_copy(&channel->hdr.wc, &wc);
-        if (reader->rc == wc)
-            result = MUCHANNEL_NO_DATA;
-        else if (wc - reader->rc > reader->elements)
-        {
-            result = MUCHANNEL_OVERRUN_DETECTED;
-        }
-        else
-        {
-            pos = reader->rc % reader->elements * reader->size;
-            memcpy(element, channel->data + pos, reader->size);
-            cc_barrier();
-
-            serialized_copy(&channel->hdr.wsc, &wsc);
-            if (wsc - reader->rc > reader->elements) {
-                result = MUCHANNEL_OVERRUN_DETECTED;
-            } else {
-                result = MUCHANNEL_SUCCESS;
-                reader->rc++;
-            }
-            if (has_epoch_changed(channel, reader)) {
-                result = MUCHANNEL_EPOCH_CHANGED;
-                epoch = 0;
-                serialized_copy(&epoch, &reader->epoch);
-            }
-        }
+    serialized_copy(&channel->hdr.wc, &wc);
+    if (reader->rc == wc)
+        return MUCHANNEL_NO_DATA;
+    else if (wc - reader->rc > reader->elements)
+        return MUCHANNEL_OVERRUN_DETECTED;
+
+    pos = reader->rc % reader->elements * reader->size;
+    *element = channel->data + pos;
+    return MUCHANNEL_SUCCESS;
+}
+
+enum muchannel_reader_result muen_channel_read_end(
+        const struct muchannel * const channel,
+        struct muchannel_reader *reader)
+{
+    uint64_t epoch, wsc;
+    enum muchannel_reader_result result;
+
+    cc_barrier();
+
+    serialized_copy(&channel->hdr.wsc, &wsc);
+    if (wsc - reader->rc > reader->elements) {
+        result = MUCHANNEL_OVERRUN_DETECTED;
     } else {
-        reader->epoch = MUCHANNEL_NULL_EPOCH;
-        result = MUCHANNEL_INACTIVE;
+        result = MUCHANNEL_SUCCESS;
+        reader->rc++;
+    }
+    if (has_epoch_changed(channel, reader)) {
+        result = MUCHANNEL_EPOCH_CHANGED;
+        epoch = 0;
+        serialized_copy(&epoch, &reader->epoch);
     }
 
     return result;
 }
 
+enum muchannel_reader_result muen_channel_read(
+        const struct muchannel * const channel,
+        struct muchannel_reader *reader,
+        void *element)
+{
+    enum muchannel_reader_result result;
+    const void *p;
+
+    result = muen_channel_read_begin(channel, reader, &p);
+    if (result != MUCHANNEL_SUCCESS)
+        return result;
+
+    memcpy(element, p, reader->size);
+    return muen_channel_read_end(channel, reader);
+}
+
 void muen_channel_drain(const struct muchannel * const channel,
             struct muchannel_reader *reader)
 {
@@ -53,6 +53,26 @@ enum muchannel_reader_result muen_channel_read(
         struct muchannel_reader *reader,
         void *element);
 
+/*
+ * Read next element from given channel in place. On MUCHANNEL_SUCCESS,
+ * element points at the next element in the channel. As the writer may
+ * overwrite it at any time, copy what is needed out of it, then call
+ * muen_channel_read_end(), and only use the copy if that also returns
+ * MUCHANNEL_SUCCESS.
+ */
+enum muchannel_reader_result muen_channel_read_begin(
+        const struct muchannel * const channel,
+        struct muchannel_reader *reader,
+        const void **element);
+
+/*
+ * Finish reading the element returned by muen_channel_read_begin(),
+ * checking that it was not overwritten in the meantime.
+ */
+enum muchannel_reader_result muen_channel_read_end(
+        const struct muchannel * const channel,
+        struct muchannel_reader *reader);
+
 /*
  * Drain all current channel elements.
  */
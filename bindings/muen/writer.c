@@ -49,17 +49,33 @@ void muen_channel_deactivate(struct muchannel *channel)
     cc_barrier();
 }
 
-void muen_channel_write(struct muchannel *channel, const void * const element)
+void muen_channel_write_begin(struct muchannel *channel, const uint64_t count)
 {
-    uint64_t wc, pos, size;
+    uint64_t wsc;
+
+    assert(count <= channel->hdr.elements);
+    wsc = channel->hdr.wc + count;
+    serialized_copy(&wsc, &channel->hdr.wsc);
+}
 
-    size = channel->hdr.size;
-    wc = channel->hdr.wc;
-    pos = wc % channel->hdr.elements;
+void *muen_channel_write_element(struct muchannel *channel, const uint64_t i)
+{
+    uint64_t pos = (channel->hdr.wc + i) % channel->hdr.elements;
 
-    wc++;
+    return channel->data + pos * channel->hdr.size;
+}
 
-    serialized_copy(&wc, &channel->hdr.wsc);
-    memcpy(channel->data + pos * size, element, size);
+void muen_channel_write_end(struct muchannel *channel, const uint64_t count)
+{
+    uint64_t wc;
+
+    wc = channel->hdr.wc + count;
     serialized_copy(&wc, &channel->hdr.wc);
 }
+
+void muen_channel_write(struct muchannel *channel, const void * const element)
+{
+    muen_channel_write_begin(channel, 1);
+    memcpy(muen_channel_write_element(channel, 0), element, channel->hdr.size);
+    muen_channel_write_end(channel, 1);
+}
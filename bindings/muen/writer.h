@@ -35,6 +35,23 @@ void muen_channel_init_writer(struct muchannel *channel, const uint64_t protocol
  */
 void muen_channel_deactivate(struct muchannel *channel);
 
+/**
+ * Start writing count elements to given channel in place, at most the number
+ * of elements in the channel. Readers see them as being overwritten until
+ * muen_channel_write_end() publishes them, all at once.
+ */
+void muen_channel_write_begin(struct muchannel *channel, const uint64_t count);
+
+/**
+ * Return the i-th element being written.
+ */
+void *muen_channel_write_element(struct muchannel *channel, const uint64_t i);
+
+/**
+ * Publish the count elements being written.
+ */
+void muen_channel_write_end(struct muchannel *channel, const uint64_t count);
+
 /**
  * Write element to given channel.
  */
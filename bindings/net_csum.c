@@ -0,0 +1,171 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * net_csum.c: Internet checksum, see solo5_net_csum_partial().
+ *
+ * The ones' complement sum of 16-bit words does not depend on byte order, so
+ * words are summed in host byte order, 32 bits at a time into a 64-bit
+ * accumulator, which cannot overflow for any buffer which fits in memory
+ * many times over. Where the compiler can use vector instructions, 32 bytes
+ * are summed at a time into vectors of 32-bit lanes, each taking the sum of
+ * the two halves of a 32-bit word, and emptied into the scalar accumulator
+ * before they can overflow.
+ *
+ * Bindings are built without vector instructions on x86_64, so that they do
+ * not clobber the application's FPU state from trap handlers. These functions
+ * only run when called by the application, so may use SSE2, which every
+ * x86_64 CPU has. On aarch64, Advanced SIMD is always available. Unaligned
+ * loads use __builtin_memcpy(), which is inlined even though bindings are
+ * built with -ffreestanding.
+ */
+
+#include "bindings.h"
+
+#if defined(__x86_64__) || defined(__aarch64__)
+#define CSUM_VECTOR
+typedef uint32_t v4u32 __attribute__((vector_size(16)));
+#endif
+
+#if defined(__x86_64__)
+#define CSUM_TARGET __attribute__((target("sse2")))
+#else
+#define CSUM_TARGET
+#endif
+
+static inline uint32_t load32(const uint8_t *p)
+{
+    uint32_t v;
+
+    __builtin_memcpy(&v, p, sizeof v);
+    return v;
+}
+
+#ifdef CSUM_VECTOR
+/*
+ * Each 32-bit lane gains at most 2 * 0xffff per block, so 16-bit overflow
+ * into the top of a lane is impossible for this many blocks.
+ */
+#define CSUM_VECTOR_BLOCKS 16384
+
+CSUM_TARGET
+static uint64_t csum_vector(const uint8_t **bufp, size_t *sizep)
+{
+    const uint8_t *p = *bufp;
+    size_t size = *sizep;
+    const v4u32 mask = { 0xffff, 0xffff, 0xffff, 0xffff };
+    uint64_t sum = 0;
+
+    while (size >= 32) {
+        v4u32 acc0 = { 0 }, acc1 = { 0 };
+        size_t blocks = size / 32;
+        if (blocks > CSUM_VECTOR_BLOCKS)
+            blocks = CSUM_VECTOR_BLOCKS;
+        for (size_t i = 0; i < blocks; i++) {
+            v4u32 a, b;
+            __builtin_memcpy(&a, p, sizeof a);
+            __builtin_memcpy(&b, p + 16, sizeof b);
+            acc0 += (a & mask) + (a >> 16);
+            acc1 += (b & mask) + (b >> 16);
+            p += 32;
+        }
+        size -= blocks * 32;
+        acc0 += acc1;
+        sum += (uint64_t)acc0[0] + acc0[1] + acc0[2] + acc0[3];
+    }
+    *bufp = p;
+    *sizep = size;
+    return sum;
+}
+#endif
+
+uint32_t solo5_net_csum_partial(const void *buf, size_t size, uint32_t sum)
+{
+    const uint8_t *p = buf;
+    uint64_t acc = sum;
+
+#ifdef CSUM_VECTOR
+    acc += csum_vector(&p, &size);
+#endif
+    while (size >= 16) {
+        acc += (uint64_t)load32(p) + load32(p + 4) + load32(p + 8) +
+            load32(p + 12);
+        p += 16;
+        size -= 16;
+    }
+    while (size >= 4) {
+        acc += load32(p);
+        p += 4;
+        size -= 4;
+    }
+    if (size >= 2) {
+        uint16_t w;
+        __builtin_memcpy(&w, p, sizeof w);
+        acc += w;
+        p += 2;
+        size -= 2;
+    }
+    /*
+     * A trailing byte is the first byte of a word padded with zero.
+     */
+    if (size == 1) {
+        uint16_t w = 0;
+        __builtin_memcpy(&w, p, 1);
+        acc += w;
+    }
+
+    acc = (acc & 0xffffffff) + (acc >> 32);
+    acc = (acc & 0xffffffff) + (acc >> 32);
+    return (uint32_t)acc;
+}
+
+uint16_t solo5_net_csum_fold(uint32_t sum)
+{
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    return (uint16_t)~sum;
+}
+
+void solo5_net_csum_tx(struct solo5_net_hdr *hdr, uint8_t *pkt, size_t size,
+        size_t csum_start, size_t csum_offset, uint32_t pseudo)
+{
+    /*
+     * The host expects the field to hold the folded, uncomplemented
+     * pseudo-header sum, which is also where computing it here starts from.
+     */
+    uint16_t csum = (uint16_t)~solo5_net_csum_fold(pseudo);
+
+    __builtin_memcpy(pkt + csum_start + csum_offset, &csum, sizeof csum);
+    if (hdr != NULL) {
+        hdr->flags |= SOLO5_NET_HDR_F_NEEDS_CSUM;
+        hdr->csum_start = csum_start;
+        hdr->csum_offset = csum_offset;
+        return;
+    }
+    csum = solo5_net_csum_fold(solo5_net_csum_partial(pkt + csum_start,
+                size - csum_start, 0));
+    __builtin_memcpy(pkt + csum_start + csum_offset, &csum, sizeof csum);
+}
+
+bool solo5_net_csum_rx_valid(const struct solo5_net_hdr *hdr)
+{
+    return hdr != NULL && (hdr->flags &
+            (SOLO5_NET_HDR_F_DATA_VALID | SOLO5_NET_HDR_F_NEEDS_CSUM));
+}
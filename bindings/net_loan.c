@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * net_loan.c: Bookkeeping for buffers loaned with solo5_net_write_loan().
+ */
+
+#include "bindings.h"
+
+void net_wloans_push(struct net_wloans *wl, const uint8_t *buf)
+{
+    assert(!net_wloans_full(wl));
+    wl->buf[wl->head % SOLO5_NET_WRITE_LOANS_MAX] = buf;
+    wl->head++;
+}
+
+void net_wloans_complete(struct net_wloans *wl, unsigned n)
+{
+    assert(n <= wl->head - wl->done);
+    wl->done += n;
+}
+
+solo5_result_t net_wloans_reclaim(struct net_wloans *wl,
+        const uint8_t **bufs, size_t count, size_t *reclaimed)
+{
+    size_t n;
+
+    for (n = 0; n < count && wl->tail != wl->done; n++, wl->tail++)
+        bufs[n] = wl->buf[wl->tail % SOLO5_NET_WRITE_LOANS_MAX];
+    if (n == 0)
+        return SOLO5_R_AGAIN;
+    *reclaimed = n;
+    return SOLO5_R_OK;
+}
@@ -22,7 +22,7 @@
 
 void solo5_console_write(const char *buf, size_t size)
 {
-    (void)sys_write(SYS_STDOUT, buf, size);
+    console_write(buf, size);
 }
 
 /* solo5_exit is in exit.c */
@@ -31,6 +31,9 @@ void solo5_console_write(const char *buf, size_t size)
 
 solo5_time_t solo5_clock_monotonic(void)
 {
+    if (tscclock_enabled())
+        return tscclock_monotonic();
+
     struct sys_timespec ts;
 
     int rc = sys_clock_gettime(SYS_CLOCK_MONOTONIC, &ts);
@@ -47,4 +50,17 @@ solo5_time_t solo5_clock_wall(void)
     return (ts.tv_sec * NSEC_PER_SEC) + ts.tv_nsec;
 }
 
+/* solo5_cpu_count and solo5_cpu_start are in smp.c */
+
+/* solo5_snapshot is in zygote.c */
+
+/*
+ * Tracing is not supported.
+ */
+void solo5_trace(uint32_t id __attribute__((unused)),
+        uint64_t arg0 __attribute__((unused)),
+        uint64_t arg1 __attribute__((unused)))
+{
+}
+
 /* solo5_set_tls_base is in tls.c */
@@ -38,7 +38,72 @@ long sys_write(long fd, const void *buf, long size);
 long sys_pread64(long fd, void *buf, long size, long pos);
 long sys_pwrite64(long fd, const void *buf, long size, long pos);
 
+struct sys_iovec {
+    void *base;
+    size_t len;
+};
+
+long sys_preadv(long fd, const struct sys_iovec *iov, long iovcnt, long pos);
+long sys_pwritev(long fd, const struct sys_iovec *iov, long iovcnt, long pos);
+long sys_fdatasync(long fd);
+
+#define SYS_FALLOC_FL_KEEP_SIZE  0x01
+#define SYS_FALLOC_FL_PUNCH_HOLE 0x02
+#define SYS_FALLOC_FL_ZERO_RANGE 0x10
+
+long sys_fallocate(long fd, long mode, long offset, long len);
+
+#define SYS_POSIX_FADV_WILLNEED 3
+
+long sys_fadvise64(long fd, long offset, long len, long advice);
+
+/*
+ * Zoned block device ioctl()s and structures, see <linux/blkzoned.h>.
+ */
+#define SYS_BLKREPORTZONE 0xc0101282
+#define SYS_BLKRESETZONE 0x40101283
+#define SYS_BLKOPENZONE 0x40101286
+#define SYS_BLKCLOSEZONE 0x40101287
+#define SYS_BLKFINISHZONE 0x40101288
+#define SYS_BLK_ZONE_REP_CAPACITY (1 << 0)
+
+struct sys_blk_zone {
+    uint64_t start;
+    uint64_t len;
+    uint64_t wp;
+    uint8_t type;
+    uint8_t cond;
+    uint8_t non_seq;
+    uint8_t reset;
+    uint8_t resv[4];
+    uint64_t capacity;
+    uint8_t reserved[24];
+};
+
+struct sys_blk_zone_report {
+    uint64_t sector;
+    uint32_t nr_zones;
+    uint32_t flags;
+    struct sys_blk_zone zones[];
+};
+
+struct sys_blk_zone_range {
+    uint64_t sector;
+    uint64_t nr_sectors;
+};
+
+long sys_ioctl(long fd, long request, void *arg);
+
+#define SYS_MADV_DONTNEED 4
+
+long sys_madvise(void *addr, long len, long advice);
+
 void sys_exit_group(long status) __attribute__((noreturn));
+void sys_exit(long status) __attribute__((noreturn));
+
+#define SYS_FUTEX_WAKE_PRIVATE 129
+
+long sys_futex(void *uaddr, long op, long val);
 
 struct sys_timespec {
     uint64_t tv_sec;
@@ -57,6 +122,7 @@ long sys_clock_gettime(const long which, void *ts);
 
 #define SYS_EINTR -4
 #define SYS_EAGAIN -11
+#define SYS_EOPNOTSUPP -95
 
 /*
  * Ah, the wonders of Linux ABIs...
@@ -75,15 +141,126 @@ struct sys_epoll_event {
 long sys_epoll_pwait(long epfd, void *events, long maxevents, long timeout,
         void *sigmask, long sigsetsize);
 
+long sys_epoll_pwait2(long epfd, void *events, long maxevents,
+        const void *timeout, void *sigmask, long sigsetsize);
+
 #define SYS_TFD_TIMER_ABSTIME (1 << 0)
 
 long sys_timerfd_settime(long fd, long flags, const void *utmr, void *otmr);
 
+long sys_io_uring_enter(long fd, long to_submit, long min_complete,
+        long flags);
+
+/*
+ * io_uring submission and completion queue entries, as used with the rings
+ * set up by the tender (see spt_abi.h).
+ */
+struct uring_sqe {
+    uint8_t opcode;
+    uint8_t flags;
+    uint16_t ioprio;
+    int32_t fd;
+    uint64_t off;
+    uint64_t addr;
+    uint32_t len;
+    uint32_t rw_flags;
+    uint64_t user_data;
+    uint64_t pad[3];
+};
+
+struct uring_cqe {
+    uint64_t user_data;
+    int32_t res;
+    uint32_t flags;
+};
+
+#define URING_OP_FSYNC          3
+#define URING_OP_READ           22
+#define URING_OP_WRITE          23
+#define URING_SQE_FIXED_FILE    (1U << 0)
+#define URING_FSYNC_DATASYNC    (1U << 0)
+#define URING_ENTER_GETEVENTS   (1U << 0)
+
+#define SYS_MSG_DONTWAIT 0x40
+
+/*
+ * Only used with (buf) NULL and (len) 0, to start transmission on an
+ * AF_PACKET socket's transmit ring.
+ */
+long sys_sendto(long fd, const void *buf, long len, long flags);
+
 #define SYS_ARCH_SET_FS		0x1002
 
 long sys_arch_prctl(long code, long addr);
 
+/*
+ * Used by the fork server (--zygote) only, see spt_abi.h.
+ */
+long sys_accept4(long fd);
+
+struct sys_msghdr {
+    void *name;
+    uint32_t namelen;
+    struct sys_iovec *iov;
+    size_t iovlen;
+    void *control;
+    size_t controllen;
+    int flags;
+};
+
+struct sys_cmsghdr {
+    size_t len;
+    int level;
+    int type;
+};
+
+#define SYS_SOL_SOCKET 1
+#define SYS_SCM_RIGHTS 1
+#define SYS_MSG_CTRUNC 0x08
+
+long sys_recvmsg(long fd, void *msg, long flags);
+long sys_dup3(long oldfd, long newfd, long flags);
+long sys_close(long fd);
+
+#define SYS_SIGCHLD 17
+
+long sys_fork(void);
+long sys_epoll_create1(long flags);
+
+#define SYS_EPOLL_CTL_ADD 1
+#define SYS_EPOLLIN 0x001
+
+long sys_epoll_ctl(long epfd, long op, long fd, void *event);
+
+#define SYS_TFD_NONBLOCK 04000
+
+long sys_timerfd_create(long clockid, long flags);
+
+#define SYS_SECCOMP_SET_MODE_FILTER 1
+
+struct sys_sock_fprog {
+    unsigned short len;
+    const void *filter;
+};
+
+long sys_seccomp(long op, long flags, const void *args);
+
 void block_init(struct spt_boot_info *arg);
+solo5_handle_set_t block_ready_set(void);
+solo5_handle_set_t block_uring_handles(void);
+void block_flush(void);
 void net_init(struct spt_boot_info *arg);
+void shm_init(struct spt_boot_info *arg);
+
+/* zygote.c: Fork server (--zygote) */
+void zygote_init(struct spt_boot_info *bi);
+
+/* smp.c: Secondary CPUs (--cpus) */
+void smp_init(struct spt_boot_info *bi);
+
+/* tscclock.c: Cycle counter based monotonic clock */
+void tscclock_init(struct spt_boot_info *bi);
+bool tscclock_enabled(void);
+uint64_t tscclock_monotonic(void);
 
 #endif /* __SPT_BINDINGS_H__ */
@@ -21,10 +21,29 @@
 #include "bindings.h"
 
 static struct mft *mft;
+static struct spt_block_uring *urings;
+static solo5_handle_set_t uring_handles;
+static const uint8_t **block_maps;
+static uint8_t **block_rams;
 
 void block_init(struct spt_boot_info *bi)
 {
     mft = bi->mft;
+    block_maps = bi->block_map;
+    block_rams = bi->block_ram;
+    urings = bi->block_uring;
+    if (urings == NULL)
+        return;
+    for (unsigned i = 0; i != mft->entries; i++) {
+        if (urings[i].entries != 0)
+            uring_handles |= 1ULL << i;
+    }
+}
+
+static bool block_valid(struct mft_entry *e, solo5_off_t offset, size_t size)
+{
+    return block_request_valid(e->u.block_basic.capacity,
+            e->u.block_basic.block_size, offset, size);
 }
 
 solo5_result_t solo5_block_acquire(const char *name, solo5_handle_t *handle,
@@ -37,32 +56,185 @@ solo5_result_t solo5_block_acquire(const char *name, solo5_handle_t *handle,
     assert(e->attached);
 
     *handle = index;
+    stats_acquire(index, MFT_BLOCK_BASIC);
     info->capacity = e->u.block_basic.capacity;
     info->block_size = e->u.block_basic.block_size;
+    info->zone_size = (solo5_off_t)e->u.block_basic.zone_blocks *
+        e->u.block_basic.block_size;
+    return SOLO5_R_OK;
+}
+
+/*
+ * Devices attached with --block-direct are opened with O_DIRECT, which
+ * requires buffers to be aligned to the block size. Requests with segments
+ * that are not aligned are performed through (bounce) by block_bounce()
+ * instead. Synchronous requests may be made concurrently from secondary CPUs,
+ * so (bounce) is protected by (bounce_lock).
+ */
+static uint8_t bounce[SOLO5_BLOCK_IO_MAX] __attribute__((aligned(4096)));
+static bool bounce_lock;
+
+static bool block_aligned(struct mft_entry *e, const struct sys_iovec *siov,
+        size_t count)
+{
+    uintptr_t mask = e->u.block_basic.block_size - 1;
+
+    if (!(e->u.block_basic.flags & MFT_BLOCK_DIRECT))
+        return true;
+    for (size_t i = 0; i < count; i++) {
+        if (((uintptr_t)siov[i].base | siov[i].len) & mask)
+            return false;
+    }
+    return true;
+}
+
+static solo5_result_t block_bounce(struct mft_entry *e, bool write,
+        const struct sys_iovec *siov, size_t count, size_t size,
+        solo5_off_t offset)
+{
+    uint8_t *p = bounce;
+    long nbytes;
+
+    while (__atomic_test_and_set(&bounce_lock, __ATOMIC_ACQUIRE))
+        cc_barrier();
+    if (write) {
+        for (size_t i = 0; i < count; p += siov[i++].len)
+            memcpy(p, siov[i].base, siov[i].len);
+        nbytes = sys_pwrite64(e->hostfd, bounce, size, offset);
+    }
+    else {
+        nbytes = sys_pread64(e->hostfd, bounce, size, offset);
+        for (size_t i = 0; nbytes == (long)size && i < count;
+                p += siov[i++].len)
+            memcpy(siov[i].base, p, siov[i].len);
+    }
+    __atomic_clear(&bounce_lock, __ATOMIC_RELEASE);
+
+    return (nbytes == (long)size) ? SOLO5_R_OK : SOLO5_R_EUNSPEC;
+}
+
+/*
+ * RAM-backed devices (MFT_BLOCK_RAM) are mapped writable by the tender, which
+ * passes their addresses in (block_rams), and are read and written with
+ * memcpy() rather than system calls. Returns the mapping of (handle), or NULL
+ * if it is not RAM-backed.
+ */
+static uint8_t *block_ram(solo5_handle_t handle)
+{
+    return (block_rams != NULL) ? block_rams[handle] : NULL;
+}
+
+static solo5_result_t block_ram_rw(uint8_t *ram, bool write,
+        const struct sys_iovec *siov, size_t count, solo5_off_t offset)
+{
+    uint8_t *p = ram + offset;
+
+    for (size_t i = 0; i < count; p += siov[i++].len) {
+        if (write)
+            memcpy(p, siov[i].base, siov[i].len);
+        else
+            memcpy(siov[i].base, p, siov[i].len);
+    }
     return SOLO5_R_OK;
 }
 
+/*
+ * Sequential read-ahead. The host reads ahead of each open file on its own,
+ * but loses track of several sequential readers interleaved on one device.
+ * Reads are therefore matched against up to RA_STREAMS streams per device,
+ * and once a stream has seen RA_TRIGGER consecutive reads, the host is asked
+ * to read ahead of it with fadvise64(POSIX_FADV_WILLNEED), in windows doubling
+ * from RA_WINDOW_MIN to RA_WINDOW_MAX. The least recently used stream is
+ * replaced by reads matching none. Devices attached with --block-direct
+ * bypass the host page cache, so are not tracked. Synchronous reads may be
+ * made concurrently from secondary CPUs, so the streams are protected by
+ * (ra_lock).
+ */
+#define RA_STREAMS 4
+#define RA_TRIGGER 2
+#define RA_WINDOW_MIN (128 * 1024)
+#define RA_WINDOW_MAX (2 * 1024 * 1024)
+
+static struct ra_stream {
+    solo5_off_t next;           /* Offset expected of the next read */
+    solo5_off_t end;            /* End of the data read ahead */
+    solo5_off_t window;
+    unsigned hits;
+    uint64_t used;
+} ra_streams[MFT_MAX_ENTRIES][RA_STREAMS];
+static uint64_t ra_clock;
+static bool ra_lock;
+
+static void block_ra(solo5_handle_t handle, struct mft_entry *e,
+        solo5_off_t offset, size_t size)
+{
+    if (e->u.block_basic.flags & MFT_BLOCK_DIRECT)
+        return;
+
+    while (__atomic_test_and_set(&ra_lock, __ATOMIC_ACQUIRE))
+        cc_barrier();
+    struct ra_stream *s = &ra_streams[handle][0];
+    for (unsigned i = 0; i < RA_STREAMS; i++) {
+        struct ra_stream *x = &ra_streams[handle][i];
+        if (x->hits != 0 && x->next == offset) {
+            s = x;
+            break;
+        }
+        if (x->used < s->used)
+            s = x;
+    }
+    if (s->hits == 0 || s->next != offset) {
+        s->hits = 0;
+        s->end = 0;
+        s->window = RA_WINDOW_MIN;
+    }
+    s->hits++;
+    s->next = offset + size;
+    s->used = ++ra_clock;
+
+    solo5_off_t start = 0, len = 0;
+    if (s->hits >= RA_TRIGGER && s->end - s->next < s->window / 2) {
+        start = (s->end > s->next) ? s->end : s->next;
+        len = s->window;
+        if (start + len > e->u.block_basic.capacity)
+            len = e->u.block_basic.capacity - start;
+        s->end = start + len;
+        if (s->window < RA_WINDOW_MAX)
+            s->window *= 2;
+    }
+    __atomic_clear(&ra_lock, __ATOMIC_RELEASE);
+
+    if (len > 0)
+        sys_fadvise64(e->hostfd, start, len, SYS_POSIX_FADV_WILLNEED);
+}
+
 solo5_result_t solo5_block_read(solo5_handle_t handle, solo5_off_t offset,
 	uint8_t *buf, size_t size)
 {
     struct mft_entry *e = mft_get_by_index(mft, handle, MFT_BLOCK_BASIC);
     if (e == NULL)
-        return SOLO5_R_EINVAL;
+        return block_stats_op(handle, BLOCK_STATS_READ, SOLO5_R_EINVAL, 0);
 
     /*
      * Note that reads beyond capacity are additionally enforced by the
      * tender's seccomp policy.
      */
-    if(size != e->u.block_basic.block_size)
-        return SOLO5_R_EINVAL;
-    if(offset & (e->u.block_basic.block_size - 1))
-        return SOLO5_R_EINVAL;
-    if(offset > (e->u.block_basic.capacity - e->u.block_basic.block_size))
-        return SOLO5_R_EINVAL;
+    if (!block_valid(e, offset, size))
+        return block_stats_op(handle, BLOCK_STATS_READ, SOLO5_R_EINVAL, 0);
+    struct sys_iovec siov = { .base = buf, .len = size };
+    if (block_ram(handle) != NULL)
+        return block_stats_op(handle, BLOCK_STATS_READ,
+                block_ram_rw(block_ram(handle), false, &siov, 1, offset),
+                size);
+    block_ra(handle, e, offset, size);
+    if (!block_aligned(e, &siov, 1))
+        return block_stats_op(handle, BLOCK_STATS_READ,
+                block_bounce(e, false, &siov, 1, size, offset), size);
 
     long nbytes = sys_pread64(e->hostfd, (char *)buf, size, offset);
 
-    return (nbytes == (int)size) ? SOLO5_R_OK : SOLO5_R_EUNSPEC;
+    return block_stats_op(handle, BLOCK_STATS_READ,
+            (nbytes == (long)size) ? SOLO5_R_OK : SOLO5_R_EUNSPEC, size);
 }
 
 solo5_result_t solo5_block_write(solo5_handle_t handle, solo5_off_t offset,
@@ -70,20 +242,621 @@ solo5_result_t solo5_block_write(solo5_handle_t handle, solo5_off_t offset,
 {
     struct mft_entry *e = mft_get_by_index(mft, handle, MFT_BLOCK_BASIC);
     if (e == NULL)
-        return SOLO5_R_EINVAL;
+        return block_stats_op(handle, BLOCK_STATS_WRITE, SOLO5_R_EINVAL, 0);
     
     /*
      * Note that writes beyond capacity are additionally enforced by the
      * tender's seccomp policy.
      */
-    if(size != e->u.block_basic.block_size)
+    if (!block_valid(e, offset, size))
+        return block_stats_op(handle, BLOCK_STATS_WRITE, SOLO5_R_EINVAL, 0);
+    struct sys_iovec siov = { .base = (uint8_t *)buf, .len = size };
+    if (block_ram(handle) != NULL)
+        return block_stats_op(handle, BLOCK_STATS_WRITE,
+                block_ram_rw(block_ram(handle), true, &siov, 1, offset),
+                size);
+    if (!block_aligned(e, &siov, 1))
+        return block_stats_op(handle, BLOCK_STATS_WRITE,
+                block_bounce(e, true, &siov, 1, size, offset), size);
+   
+    long nbytes = sys_pwrite64(e->hostfd, (const char *)buf, size, offset);
+
+    return block_stats_op(handle, BLOCK_STATS_WRITE,
+            (nbytes == (long)size) ? SOLO5_R_OK : SOLO5_R_EUNSPEC, size);
+}
+
+/*
+ * Validates a vectored request and translates its segments into (siov[]).
+ * Returns the total size of the request, or 0 if it is invalid.
+ */
+static size_t block_iov_init(struct mft_entry *e, solo5_off_t offset,
+        const struct solo5_block_iov *iov, size_t count,
+        struct sys_iovec *siov)
+{
+    size_t size = block_iov_size(iov, count, e->u.block_basic.block_size);
+    if (size == 0 || !block_valid(e, offset, size))
+        return 0;
+
+    for (size_t i = 0; i < count; i++) {
+        siov[i].base = iov[i].buf;
+        siov[i].len = iov[i].size;
+    }
+    return size;
+}
+
+solo5_result_t solo5_block_writev(solo5_handle_t handle, solo5_off_t offset,
+        const struct solo5_block_iov *iov, size_t count)
+{
+    struct mft_entry *e = mft_get_by_index(mft, handle, MFT_BLOCK_BASIC);
+    struct sys_iovec siov[SOLO5_BLOCK_IOV_MAX];
+    size_t size;
+
+    if (e == NULL || (size = block_iov_init(e, offset, iov, count, siov)) == 0)
+        return block_stats_op(handle, BLOCK_STATS_WRITE, SOLO5_R_EINVAL, 0);
+    if (block_ram(handle) != NULL)
+        return block_stats_op(handle, BLOCK_STATS_WRITE,
+                block_ram_rw(block_ram(handle), true, siov, count, offset),
+                size);
+    if (!block_aligned(e, siov, count))
+        return block_stats_op(handle, BLOCK_STATS_WRITE,
+                block_bounce(e, true, siov, count, size, offset), size);
+
+    long nbytes = sys_pwritev(e->hostfd, siov, count, offset);
+
+    return block_stats_op(handle, BLOCK_STATS_WRITE,
+            (nbytes == (long)size) ? SOLO5_R_OK : SOLO5_R_EUNSPEC, size);
+}
+
+solo5_result_t solo5_block_readv(solo5_handle_t handle, solo5_off_t offset,
+        const struct solo5_block_iov *iov, size_t count)
+{
+    struct mft_entry *e = mft_get_by_index(mft, handle, MFT_BLOCK_BASIC);
+    struct sys_iovec siov[SOLO5_BLOCK_IOV_MAX];
+    size_t size;
+
+    if (e == NULL || (size = block_iov_init(e, offset, iov, count, siov)) == 0)
+        return block_stats_op(handle, BLOCK_STATS_READ, SOLO5_R_EINVAL, 0);
+    if (block_ram(handle) != NULL)
+        return block_stats_op(handle, BLOCK_STATS_READ,
+                block_ram_rw(block_ram(handle), false, siov, count, offset),
+                size);
+    block_ra(handle, e, offset, size);
+    if (!block_aligned(e, siov, count))
+        return block_stats_op(handle, BLOCK_STATS_READ,
+                block_bounce(e, false, siov, count, size, offset), size);
+
+    long nbytes = sys_preadv(e->hostfd, siov, count, offset);
+
+    return block_stats_op(handle, BLOCK_STATS_READ,
+            (nbytes == (long)size) ? SOLO5_R_OK : SOLO5_R_EUNSPEC, size);
+}
+
+solo5_result_t solo5_block_flush(solo5_handle_t handle)
+{
+    struct mft_entry *e = mft_get_by_index(mft, handle, MFT_BLOCK_BASIC);
+    if (e == NULL)
+        return block_stats_op(handle, BLOCK_STATS_FLUSH, SOLO5_R_EINVAL, 0);
+    if (block_ram(handle) != NULL)
+        return block_stats_op(handle, BLOCK_STATS_FLUSH, SOLO5_R_OK, 0);
+
+    long rc = sys_fdatasync(e->hostfd);
+
+    return block_stats_op(handle, BLOCK_STATS_FLUSH,
+            (rc == 0) ? SOLO5_R_OK : SOLO5_R_EUNSPEC, 0);
+}
+
+static bool block_range_check(struct mft_entry *e, solo5_off_t offset,
+        solo5_off_t size)
+{
+    return e != NULL && block_range_valid(e->u.block_basic.capacity,
+            e->u.block_basic.block_size, offset, size);
+}
+
+/*
+ * Discarding is advisory, so it succeeds without doing anything where the
+ * backing storage cannot punch holes.
+ */
+solo5_result_t solo5_block_discard(solo5_handle_t handle, solo5_off_t offset,
+        solo5_off_t size)
+{
+    struct mft_entry *e = mft_get_by_index(mft, handle, MFT_BLOCK_BASIC);
+    if (!block_range_check(e, offset, size))
+        return block_stats_op(handle, BLOCK_STATS_DISCARD, SOLO5_R_EINVAL, 0);
+
+    long rc = sys_fallocate(e->hostfd,
+            SYS_FALLOC_FL_PUNCH_HOLE | SYS_FALLOC_FL_KEEP_SIZE, offset, size);
+
+    return block_stats_op(handle, BLOCK_STATS_DISCARD,
+            (rc == 0 || rc == SYS_EOPNOTSUPP) ? SOLO5_R_OK : SOLO5_R_EUNSPEC,
+            0);
+}
+
+solo5_result_t solo5_block_write_zeroes(solo5_handle_t handle,
+        solo5_off_t offset, solo5_off_t size)
+{
+    struct mft_entry *e = mft_get_by_index(mft, handle, MFT_BLOCK_BASIC);
+    if (!block_range_check(e, offset, size))
+        return block_stats_op(handle, BLOCK_STATS_DISCARD, SOLO5_R_EINVAL, 0);
+    if (block_ram(handle) != NULL) {
+        memset(block_ram(handle) + offset, 0, size);
+        return block_stats_op(handle, BLOCK_STATS_DISCARD, SOLO5_R_OK, 0);
+    }
+
+    long rc = sys_fallocate(e->hostfd, SYS_FALLOC_FL_ZERO_RANGE, offset, size);
+    if (rc == SYS_EOPNOTSUPP)
+        return block_write_zeroes_slow(handle, offset, size);
+
+    return block_stats_op(handle, BLOCK_STATS_DISCARD,
+            (rc == 0) ? SOLO5_R_OK : SOLO5_R_EUNSPEC, 0);
+}
+
+solo5_result_t solo5_block_prefetch(solo5_handle_t handle, solo5_off_t offset,
+        solo5_off_t size)
+{
+    struct mft_entry *e = mft_get_by_index(mft, handle, MFT_BLOCK_BASIC);
+    if (!block_range_check(e, offset, size))
         return SOLO5_R_EINVAL;
-    if(offset & (e->u.block_basic.block_size - 1))
+
+    if (!(e->u.block_basic.flags & MFT_BLOCK_DIRECT))
+        sys_fadvise64(e->hostfd, offset, size, SYS_POSIX_FADV_WILLNEED);
+    return SOLO5_R_OK;
+}
+
+/*
+ * Zoned devices are reported and managed with ioctl()s on the device, which
+ * the seccomp policy allows for the zone ioctl()s only. Zones are reported
+ * into (zone_report), of ZONE_BATCH zones at a time. Linux offers no zone
+ * append to user space, so appends are emulated by writing at the write
+ * pointer reported for the zone. Appends and zone management operations may
+ * be made concurrently from secondary CPUs, so both (zone_report) and the
+ * write pointers are protected by (zone_lock).
+ */
+#define ZONE_BATCH 32
+#define SECTOR_SHIFT 9
+
+static struct {
+    struct sys_blk_zone_report hdr;
+    struct sys_blk_zone zones[ZONE_BATCH];
+} zone_report;
+static bool zone_lock;
+
+static void zone_lock_acquire(void)
+{
+    while (__atomic_test_and_set(&zone_lock, __ATOMIC_ACQUIRE))
+        cc_barrier();
+}
+
+static void zone_lock_release(void)
+{
+    __atomic_clear(&zone_lock, __ATOMIC_RELEASE);
+}
+
+/*
+ * Reports up to (count) zones, at most ZONE_BATCH, of (e) starting with the
+ * zone containing (offset) into (zone_report). Must be called with
+ * (zone_lock) held.
+ */
+static long zone_report_get(struct mft_entry *e, solo5_off_t offset,
+        size_t count)
+{
+    zone_report.hdr.sector = offset >> SECTOR_SHIFT;
+    zone_report.hdr.nr_zones = count;
+    zone_report.hdr.flags = 0;
+    long rc = sys_ioctl(e->hostfd, SYS_BLKREPORTZONE, &zone_report);
+    return (rc == 0) ? (long)zone_report.hdr.nr_zones : -1;
+}
+
+static void zone_from_blk(struct solo5_block_zone *z,
+        const struct sys_blk_zone *bz)
+{
+    z->start = bz->start << SECTOR_SHIFT;
+    z->size = bz->len << SECTOR_SHIFT;
+    z->capacity = (zone_report.hdr.flags & SYS_BLK_ZONE_REP_CAPACITY) ?
+        bz->capacity << SECTOR_SHIFT : z->size;
+    z->write_pointer = bz->wp << SECTOR_SHIFT;
+    z->type = bz->type;
+    z->cond = bz->cond;
+}
+
+/*
+ * Reports the sequential zone starting at byte (start) of (e) into (*z). Must
+ * be called with (zone_lock) held.
+ */
+static solo5_result_t zone_get(struct mft_entry *e, solo5_off_t start,
+        struct solo5_block_zone *z)
+{
+    solo5_off_t size = (solo5_off_t)e->u.block_basic.zone_blocks *
+        e->u.block_basic.block_size;
+
+    if (size == 0 || start >= e->u.block_basic.capacity || start % size != 0)
         return SOLO5_R_EINVAL;
-    if(offset > (e->u.block_basic.capacity - e->u.block_basic.block_size))
+    if (zone_report_get(e, start, 1) != 1)
+        return SOLO5_R_EUNSPEC;
+    zone_from_blk(z, &zone_report.zones[0]);
+    if (z->start != start || z->type == SOLO5_BLOCK_ZONE_TYPE_CONVENTIONAL)
         return SOLO5_R_EINVAL;
-   
-    long nbytes = sys_pwrite64(e->hostfd, (const char *)buf, size, offset);
+    return SOLO5_R_OK;
+}
+
+solo5_result_t solo5_block_zone_report(solo5_handle_t handle,
+        solo5_off_t offset, struct solo5_block_zone *zones, size_t count,
+        size_t *nzones)
+{
+    struct mft_entry *e = mft_get_by_index(mft, handle, MFT_BLOCK_BASIC);
+    if (e == NULL || e->u.block_basic.zone_blocks == 0 ||
+            offset >= e->u.block_basic.capacity)
+        return SOLO5_R_EINVAL;
+
+    size_t n = 0;
+    zone_lock_acquire();
+    while (n < count && offset < e->u.block_basic.capacity) {
+        size_t want = (count - n < ZONE_BATCH) ? count - n : ZONE_BATCH;
+        long got = zone_report_get(e, offset, want);
+        if (got == -1) {
+            zone_lock_release();
+            return SOLO5_R_EUNSPEC;
+        }
+        for (long i = 0; i < got; i++)
+            zone_from_blk(&zones[n + i], &zone_report.zones[i]);
+        n += got;
+        if ((size_t)got < want)
+            break;
+        offset = zones[n - 1].start + zones[n - 1].size;
+    }
+    zone_lock_release();
+    *nzones = n;
+    return SOLO5_R_OK;
+}
+
+solo5_result_t solo5_block_zone_append(solo5_handle_t handle,
+        solo5_off_t zone, const uint8_t *buf, size_t size,
+        solo5_off_t *offset)
+{
+    struct mft_entry *e = mft_get_by_index(mft, handle, MFT_BLOCK_BASIC);
+    if (e == NULL || e->u.block_basic.zone_blocks == 0 ||
+            !block_valid(e, zone, size))
+        return block_stats_op(handle, BLOCK_STATS_WRITE, SOLO5_R_EINVAL, 0);
+
+    struct solo5_block_zone z;
+    struct sys_iovec siov = { .base = (uint8_t *)buf, .len = size };
+    zone_lock_acquire();
+    solo5_result_t rc = zone_get(e, zone, &z);
+    if (rc == SOLO5_R_OK) {
+        if (z.cond == SOLO5_BLOCK_ZONE_COND_READONLY ||
+                z.cond == SOLO5_BLOCK_ZONE_COND_FULL ||
+                z.cond == SOLO5_BLOCK_ZONE_COND_OFFLINE ||
+                size > z.start + z.capacity - z.write_pointer)
+            rc = SOLO5_R_EINVAL;
+        else if (!block_aligned(e, &siov, 1))
+            rc = block_bounce(e, true, &siov, 1, size, z.write_pointer);
+        else if (sys_pwrite64(e->hostfd, buf, size, z.write_pointer) !=
+                (long)size)
+            rc = SOLO5_R_EUNSPEC;
+    }
+    zone_lock_release();
+    if (rc == SOLO5_R_OK)
+        *offset = z.write_pointer;
+    return block_stats_op(handle, BLOCK_STATS_WRITE, rc, size);
+}
+
+solo5_result_t solo5_block_zone_manage(solo5_handle_t handle, unsigned op,
+        solo5_off_t zone)
+{
+    static const long reqs[] = {
+        [SOLO5_BLOCK_ZONE_RESET] = SYS_BLKRESETZONE,
+        [SOLO5_BLOCK_ZONE_OPEN] = SYS_BLKOPENZONE,
+        [SOLO5_BLOCK_ZONE_CLOSE] = SYS_BLKCLOSEZONE,
+        [SOLO5_BLOCK_ZONE_FINISH] = SYS_BLKFINISHZONE
+    };
+    struct mft_entry *e = mft_get_by_index(mft, handle, MFT_BLOCK_BASIC);
+    if (e == NULL || op < SOLO5_BLOCK_ZONE_RESET ||
+            op > SOLO5_BLOCK_ZONE_FINISH)
+        return SOLO5_R_EINVAL;
+
+    struct solo5_block_zone z;
+    zone_lock_acquire();
+    solo5_result_t rc = zone_get(e, zone, &z);
+    if (rc == SOLO5_R_OK) {
+        struct sys_blk_zone_range range = {
+            .sector = z.start >> SECTOR_SHIFT,
+            .nr_sectors = z.size >> SECTOR_SHIFT
+        };
+        if (sys_ioctl(e->hostfd, reqs[op], &range) != 0)
+            rc = SOLO5_R_EUNSPEC;
+    }
+    zone_lock_release();
+    return rc;
+}
+
+/*
+ * MFT_BLOCK_MAPPED devices are mapped read-only by the tender, which passes
+ * their addresses in (block_maps).
+ */
+solo5_result_t solo5_block_map(solo5_handle_t handle, const uint8_t **data)
+{
+    if (mft_get_by_index(mft, handle, MFT_BLOCK_BASIC) == NULL ||
+            block_maps == NULL || block_maps[handle] == NULL)
+        return SOLO5_R_EINVAL;
+
+    *data = block_maps[handle];
+    return SOLO5_R_OK;
+}
+
+/*
+ * Asynchronous I/O.
+ *
+ * Where the tender has set up an io_uring instance for the device, requests
+ * are queued on its submission queue directly, and passed to the kernel in
+ * batches by block_flush(), which is called on solo5_block_reap() and on
+ * solo5_yield(). The ring is restricted by the tender to reads, writes and
+ * flushes of the device, but not to its capacity, so requests are validated
+ * here as for synchronous I/O. The submission queue cannot overflow, as it has
+ * at least SOLO5_BLOCK_QUEUE_MAX entries. Each request occupies a slot in
+ * (uring_reqs), whose index is passed to the kernel to identify it.
+ *
+ * A flush submitted while another flush is queued but not yet passed to the
+ * kernel is covered by the latter, so it is only recorded in the (joined)
+ * slots of that flush, and completed along with it. Such completions are
+ * queued in (block_cqs) until reaped.
+ *
+ * Requests needing a bounce buffer for direct I/O are performed on
+ * submission as below, see uring_submit_bounce().
+ *
+ * Otherwise, requests are performed synchronously on submission, as the
+ * tender's seccomp policy does not allow for any other means of asynchronous
+ * I/O. Their completions are queued until reaped.
+ */
+static unsigned uring_queued[MFT_MAX_ENTRIES];
+static unsigned uring_outstanding[MFT_MAX_ENTRIES];
+static struct uring_req {
+    uint64_t tag;
+    size_t len;
+    uint64_t joined;            /* Bitmap of flushes completing with this one */
+} uring_reqs[MFT_MAX_ENTRIES][SOLO5_BLOCK_QUEUE_MAX];
+static uint64_t uring_busy[MFT_MAX_ENTRIES]; /* Bitmap of used (uring_reqs) */
+static int uring_queued_flush[MFT_MAX_ENTRIES]; /* Slot of queued flush + 1 */
+static struct block_cq block_cqs[MFT_MAX_ENTRIES];
+
+static bool uring_cq_ready(struct spt_block_uring *u)
+{
+    return *u->cq_head != __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+}
+
+static void uring_flush(solo5_handle_t handle)
+{
+    struct spt_block_uring *u = &urings[handle];
+
+    while (uring_queued[handle] != 0) {
+        long rc = sys_io_uring_enter(u->ringfd, uring_queued[handle], 0, 0);
+        if (rc == SYS_EINTR)
+            continue;
+        assert(rc > 0);
+        uring_queued[handle] -= rc;
+    }
+    uring_queued_flush[handle] = 0;
+}
+
+static unsigned uring_alloc(solo5_handle_t handle, uint64_t tag, size_t len)
+{
+    unsigned slot = __builtin_ctzll(~uring_busy[handle]);
+
+    uring_busy[handle] |= 1ULL << slot;
+    uring_reqs[handle][slot].tag = tag;
+    uring_reqs[handle][slot].len = len;
+    uring_reqs[handle][slot].joined = 0;
+    uring_outstanding[handle]++;
+    return slot;
+}
 
-    return (nbytes == (int)size) ? SOLO5_R_OK : SOLO5_R_EUNSPEC;
+static solo5_result_t uring_submit(solo5_handle_t handle, uint8_t op,
+        solo5_off_t offset, const uint8_t *buf, size_t size, uint64_t tag)
+{
+    struct spt_block_uring *u = &urings[handle];
+
+    if (uring_outstanding[handle] == SOLO5_BLOCK_QUEUE_MAX)
+        return SOLO5_R_AGAIN;
+
+    if (op == URING_OP_FSYNC && uring_queued_flush[handle] != 0) {
+        unsigned lead = uring_queued_flush[handle] - 1;
+        unsigned slot = uring_alloc(handle, tag, 0);
+        uring_reqs[handle][lead].joined |= 1ULL << slot;
+        block_cq_submit(&block_cqs[handle]);
+        return SOLO5_R_OK;
+    }
+
+    unsigned slot = uring_alloc(handle, tag, size);
+    uint32_t tail = *u->sq_tail;
+    assert(tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) < u->entries);
+    uint32_t idx = tail & *u->sq_mask;
+    struct uring_sqe *sqe = (struct uring_sqe *)u->sqes + idx;
+    memset(sqe, 0, sizeof *sqe);
+    sqe->opcode = op;
+    sqe->flags = URING_SQE_FIXED_FILE;
+    sqe->fd = 0;
+    sqe->off = offset;
+    sqe->addr = (uintptr_t)buf;
+    sqe->len = size;
+    if (op == URING_OP_FSYNC) {
+        sqe->rw_flags = URING_FSYNC_DATASYNC;
+        uring_queued_flush[handle] = slot + 1;
+    }
+    sqe->user_data = slot;
+    u->sq_array[idx] = idx;
+    __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    uring_queued[handle]++;
+    return SOLO5_R_OK;
+}
+
+/*
+ * Requests needing a bounce buffer cannot be queued on the ring, so they are
+ * performed on submission, and their completions queued in (block_cqs).
+ */
+static solo5_result_t uring_submit_bounce(solo5_handle_t handle,
+        struct mft_entry *e, bool write, const struct sys_iovec *siov,
+        solo5_off_t offset, uint64_t tag)
+{
+    if (uring_outstanding[handle] == SOLO5_BLOCK_QUEUE_MAX)
+        return SOLO5_R_AGAIN;
+
+    solo5_result_t rc = block_bounce(e, write, siov, 1, siov->len, offset);
+    uring_outstanding[handle]++;
+    block_cq_submit(&block_cqs[handle]);
+    block_cq_complete(&block_cqs[handle], tag, rc);
+    return SOLO5_R_OK;
+}
+
+static solo5_result_t uring_reap(solo5_handle_t handle,
+        struct solo5_block_completion *completions, size_t count,
+        size_t *reaped)
+{
+    struct spt_block_uring *u = &urings[handle];
+    struct block_cq *cq = &block_cqs[handle];
+    uint32_t head = *u->cq_head;
+    size_t n = 0;
+
+    uring_flush(handle);
+    if (block_cq_ready(cq))
+        (void)block_cq_reap(cq, completions, count, &n);
+    for (; n < count && uring_cq_ready(u); n++, head++) {
+        struct uring_cqe *cqe = (struct uring_cqe *)u->cqes +
+            (head & *u->cq_mask);
+        struct uring_req *req = &uring_reqs[handle][cqe->user_data];
+        completions[n].tag = req->tag;
+        completions[n].result =
+            (cqe->res >= 0 && (size_t)cqe->res == req->len) ?
+            SOLO5_R_OK : SOLO5_R_EUNSPEC;
+        uring_busy[handle] &= ~(1ULL << cqe->user_data);
+        while (req->joined) {
+            unsigned slot = __builtin_ctzll(req->joined);
+            req->joined &= ~(1ULL << slot);
+            block_cq_complete(cq, uring_reqs[handle][slot].tag,
+                    completions[n].result);
+            uring_busy[handle] &= ~(1ULL << slot);
+        }
+        /*
+         * Release each entry as consumed, as uring_cq_ready() reads
+         * (*cq_head).
+         */
+        __atomic_store_n(u->cq_head, head + 1, __ATOMIC_RELEASE);
+    }
+    if (n == 0)
+        return SOLO5_R_AGAIN;
+    uring_outstanding[handle] -= n;
+    *reaped = n;
+    return SOLO5_R_OK;
+}
+
+void block_flush(void)
+{
+    for (unsigned i = 0; i != MFT_MAX_ENTRIES; i++) {
+        if (uring_handles & (1ULL << i))
+            uring_flush(i);
+    }
+}
+
+solo5_handle_set_t block_uring_handles(void)
+{
+    return uring_handles;
+}
+
+solo5_handle_set_t block_ready_set(void)
+{
+    solo5_handle_set_t ready_set = 0;
+
+    for (unsigned i = 0; i != MFT_MAX_ENTRIES; i++) {
+        if (block_cq_ready(&block_cqs[i]) ||
+                ((uring_handles & (1ULL << i)) && uring_cq_ready(&urings[i])))
+            ready_set |= 1ULL << i;
+    }
+    return ready_set;
+}
+
+solo5_result_t solo5_block_submit_read(solo5_handle_t handle,
+        solo5_off_t offset, uint8_t *buf, size_t size, uint64_t tag)
+{
+    struct mft_entry *e = mft_get_by_index(mft, handle, MFT_BLOCK_BASIC);
+    if (e == NULL)
+        return block_stats_op(handle, BLOCK_STATS_READ, SOLO5_R_EINVAL, 0);
+    if (uring_handles & (1ULL << handle)) {
+        if (!block_valid(e, offset, size))
+            return block_stats_op(handle, BLOCK_STATS_READ, SOLO5_R_EINVAL, 0);
+        block_ra(handle, e, offset, size);
+        struct sys_iovec siov = { .base = buf, .len = size };
+        solo5_result_t rc = block_aligned(e, &siov, 1) ?
+            uring_submit(handle, URING_OP_READ, offset, buf, size, tag) :
+            uring_submit_bounce(handle, e, false, &siov, offset, tag);
+        return block_stats_op(handle, BLOCK_STATS_READ, rc, size);
+    }
+    if (block_cq_full(&block_cqs[handle]))
+        return SOLO5_R_AGAIN;
+
+    solo5_result_t rc = solo5_block_read(handle, offset, buf, size);
+    if (rc == SOLO5_R_EINVAL)
+        return rc;
+    block_cq_submit(&block_cqs[handle]);
+    block_cq_complete(&block_cqs[handle], tag, rc);
+    return SOLO5_R_OK;
+}
+
+solo5_result_t solo5_block_submit_write(solo5_handle_t handle,
+        solo5_off_t offset, const uint8_t *buf, size_t size, uint64_t tag)
+{
+    struct mft_entry *e = mft_get_by_index(mft, handle, MFT_BLOCK_BASIC);
+    if (e == NULL)
+        return block_stats_op(handle, BLOCK_STATS_WRITE, SOLO5_R_EINVAL, 0);
+    if (uring_handles & (1ULL << handle)) {
+        if (!block_valid(e, offset, size))
+            return block_stats_op(handle, BLOCK_STATS_WRITE, SOLO5_R_EINVAL, 0);
+        struct sys_iovec siov = { .base = (uint8_t *)buf, .len = size };
+        solo5_result_t rc = block_aligned(e, &siov, 1) ?
+            uring_submit(handle, URING_OP_WRITE, offset, buf, size, tag) :
+            uring_submit_bounce(handle, e, true, &siov, offset, tag);
+        return block_stats_op(handle, BLOCK_STATS_WRITE, rc, size);
+    }
+    if (block_cq_full(&block_cqs[handle]))
+        return SOLO5_R_AGAIN;
+
+    solo5_result_t rc = solo5_block_write(handle, offset, buf, size);
+    if (rc == SOLO5_R_EINVAL)
+        return rc;
+    block_cq_submit(&block_cqs[handle]);
+    block_cq_complete(&block_cqs[handle], tag, rc);
+    return SOLO5_R_OK;
+}
+
+solo5_result_t solo5_block_submit_flush(solo5_handle_t handle, uint64_t tag)
+{
+    if (mft_get_by_index(mft, handle, MFT_BLOCK_BASIC) == NULL)
+        return block_stats_op(handle, BLOCK_STATS_FLUSH, SOLO5_R_EINVAL, 0);
+    if (uring_handles & (1ULL << handle)) {
+        solo5_result_t rc =
+            uring_submit(handle, URING_OP_FSYNC, 0, NULL, 0, tag);
+        return block_stats_op(handle, BLOCK_STATS_FLUSH, rc, 0);
+    }
+    if (block_cq_full(&block_cqs[handle]))
+        return SOLO5_R_AGAIN;
+
+    solo5_result_t rc = solo5_block_flush(handle);
+    block_cq_submit(&block_cqs[handle]);
+    block_cq_complete(&block_cqs[handle], tag, rc);
+    return SOLO5_R_OK;
+}
+
+solo5_result_t solo5_block_reap(solo5_handle_t handle,
+        struct solo5_block_completion *completions, size_t count,
+        size_t *reaped)
+{
+    if (mft_get_by_index(mft, handle, MFT_BLOCK_BASIC) == NULL)
+        return SOLO5_R_EINVAL;
+
+    /*
+     * Requests not using io_uring were counted when performed on submission.
+     */
+    if (uring_handles & (1ULL << handle)) {
+        solo5_result_t rc = uring_reap(handle, completions, count, reaped);
+        return block_stats_reap(handle, rc, completions,
+                rc == SOLO5_R_OK ? *reaped : 0);
+    }
+    return block_cq_reap(&block_cqs[handle], completions, count, reaped);
 }
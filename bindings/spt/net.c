@@ -24,18 +24,345 @@ static struct mft *mft;
 static int epollfd;
 static int npollfds;
 static int timerfd;
+static bool have_epoll_pwait2;
+
+/*
+ * Busy-polling (--poll-us=N). Before blocking in solo5_yield(), spin for up
+ * to (spin_nsecs) checking for ready devices without blocking. The budget
+ * adapts to recent hit rates: it is doubled, up to (spin_max_nsecs), each
+ * time spinning finds a ready device, and halved, down to SPIN_MIN_NSECS,
+ * each time it does not.
+ */
+#define SPIN_MIN_NSECS 1000ULL
+static solo5_time_t spin_max_nsecs;
+static solo5_time_t spin_nsecs;
+
+/*
+ * Buffers for packets on loan to the application, allocated in net_init().
+ */
+static struct {
+    uint8_t *buf;
+    size_t size;
+    bool on_loan;
+} loans[MFT_MAX_ENTRIES];
+
+/*
+ * Returns the size of the largest packet which may be read from network
+ * device (i).
+ */
+static size_t frame_size(unsigned i)
+{
+    struct mft_net_basic *nb = &mft->e[i].u.net_basic;
+
+    if (nb->offloads & (MFT_NET_OFFLOAD_TSO4 | MFT_NET_OFFLOAD_TSO6))
+        return SOLO5_NET_HDR_LEN + SOLO5_NET_GSO_FRAME_MAX;
+    else
+        return ((nb->offloads & MFT_NET_OFFLOAD_HDR) ? SOLO5_NET_HDR_LEN : 0) +
+            nb->mtu + SOLO5_NET_HLEN;
+}
+
+static void loan_init(unsigned i)
+{
+    size_t size = frame_size(i);
+
+    loans[i].buf = mem_ialloc_pages((size + PAGE_SIZE - 1) >> PAGE_SHIFT);
+    loans[i].size = size;
+}
+
+/*
+ * Where the tender runs an I/O thread (--io-thread), packets are exchanged
+ * with it on rings in guest memory (see spt_abi.h), and the host is only
+ * entered to wake the thread if it is sleeping. A packet queued on a full
+ * transmit ring is dropped, as for a full device.
+ */
+static struct spt_io_thread *io;
+static solo5_handle_set_t io_handles;
+
+static void io_ring_init(struct spt_io_ring *ring, unsigned i)
+{
+    size_t slot_size = (frame_size(i) + 63) & ~(size_t)63;
+    size_t size = slot_size * SPT_IO_RING_SLOTS;
+
+    ring->slot_size = slot_size;
+    ring->buf = mem_ialloc_pages((size + PAGE_SIZE - 1) >> PAGE_SHIFT);
+}
+
+static void io_kick(void)
+{
+    uint64_t one = 1;
+
+    sys_write(io->kickfd, (const char *)&one, sizeof one);
+}
+
+/*
+ * Wake the I/O thread if it is sleeping, and has not been woken already. The
+ * fence orders packets published before the call with the load of (idle),
+ * pairing with the fence in the thread after setting (idle).
+ */
+static void io_wake(void)
+{
+    ring_fence();
+    if (__atomic_load_n(&io->idle, __ATOMIC_SEQ_CST) &&
+            __atomic_exchange_n(&io->idle, 0, __ATOMIC_SEQ_CST))
+        io_kick();
+}
+
+static bool io_push(solo5_handle_t handle, const uint8_t *buf, size_t size)
+{
+    struct spt_io_ring *ring = &io->net[handle].tx;
+
+    if (size > ring->slot_size ||
+            ring_prod_free(&ring->idx, SPT_IO_RING_SLOTS) == 0)
+        return false;
+    uint32_t slot = ring_slot(ring_prod_pos(&ring->idx), SPT_IO_RING_SLOTS);
+    memcpy(ring->buf + (size_t)slot * ring->slot_size, buf, size);
+    ring->len[slot] = size;
+    ring_prod_publish(&ring->idx, 1);
+    return true;
+}
+
+static bool io_pop(solo5_handle_t handle, uint8_t *buf, size_t size,
+        size_t *read_size, solo5_time_t *tstamp)
+{
+    struct spt_io_ring *ring = &io->net[handle].rx;
+
+    if (ring_cons_avail(&ring->idx) == 0)
+        return false;
+    uint32_t slot = ring_slot(ring_cons_pos(&ring->idx), SPT_IO_RING_SLOTS);
+    size_t len = ring->len[slot];
+    /*
+     * As for read(), a packet larger than the buffer is truncated.
+     */
+    if (len > size)
+        len = size;
+    memcpy(buf, ring->buf + (size_t)slot * ring->slot_size, len);
+    *tstamp = ring->tstamp[slot];
+    ring_cons_release(&ring->idx, 1);
+    ring_fence();
+    if (__atomic_load_n(&ring->waiting, __ATOMIC_SEQ_CST) &&
+            __atomic_exchange_n(&ring->waiting, 0, __ATOMIC_SEQ_CST))
+        io_kick();
+    *read_size = len;
+    return true;
+}
+
+/*
+ * Where a device is attached to an AF_PACKET socket (--net:NAME=packet:IFACE),
+ * packets are received by walking the blocks of its TPACKET_V3 receive ring,
+ * each of which is returned to the kernel once all its packets have been
+ * read, and sent by queueing them in frames of its transmit ring, the kernel
+ * being asked to send all queued frames with a single sendto().
+ */
+struct packet_block_desc {
+    uint32_t version;
+    uint32_t offset_to_priv;
+    uint32_t block_status;
+    uint32_t num_pkts;
+    uint32_t offset_to_first_pkt;
+};
+
+struct packet_hdr {
+    uint32_t next_offset;
+    uint32_t sec, nsec;
+    uint32_t snaplen;
+    uint32_t len;
+    uint32_t status;
+    uint16_t mac, net;
+};
+
+#define PACKET_STATUS_KERNEL        0
+#define PACKET_STATUS_USER          (1U << 0)
+#define PACKET_STATUS_SEND_REQUEST  (1U << 0)
+#define PACKET_STATUS_SENDING       (1U << 1)
+#define PACKET_TX_DATA_OFFSET       48  /* TPACKET_ALIGN(tpacket3_hdr) */
+
+static struct spt_net_packet *packets;
+static struct {
+    uint32_t block;             /* Current receive block */
+    uint32_t left;              /* Packets left to read in (block) */
+    uint8_t *next;              /* Next packet to read in (block) */
+    uint32_t tx_frame;          /* Next transmit frame */
+} packet_state[MFT_MAX_ENTRIES];
+
+static bool has_packet(solo5_handle_t handle)
+{
+    return packets != NULL && packets[handle].rx != NULL;
+}
+
+static long packet_read(solo5_handle_t handle, uint8_t *buf, size_t size,
+        solo5_time_t *tstamp)
+{
+    struct spt_net_packet *p = &packets[handle];
+    struct packet_block_desc *b =
+        (void *)(p->rx + (size_t)packet_state[handle].block * p->block_size);
+
+    if (packet_state[handle].left == 0) {
+        if (!(__atomic_load_n(&b->block_status, __ATOMIC_ACQUIRE) &
+                    PACKET_STATUS_USER))
+            return SYS_EAGAIN;
+        packet_state[handle].left = b->num_pkts;
+        packet_state[handle].next = (uint8_t *)b + b->offset_to_first_pkt;
+    }
+
+    long len = SYS_EAGAIN;
+    if (packet_state[handle].left != 0) {
+        struct packet_hdr *h = (void *)packet_state[handle].next;
+        /*
+         * As for read(), a packet larger than the buffer is truncated.
+         */
+        len = (h->snaplen > size) ? (long)size : (long)h->snaplen;
+        memcpy(buf, packet_state[handle].next + h->mac, len);
+        *tstamp = (solo5_time_t)h->sec * NSEC_PER_SEC + h->nsec;
+        packet_state[handle].next += h->next_offset;
+        packet_state[handle].left--;
+    }
+    if (packet_state[handle].left == 0) {
+        __atomic_store_n(&b->block_status, PACKET_STATUS_KERNEL,
+                __ATOMIC_RELEASE);
+        packet_state[handle].block =
+            (packet_state[handle].block + 1) % p->rx_blocks;
+    }
+    return len;
+}
+
+/*
+ * Queue a packet on the transmit ring, to be sent by packet_flush(). If the
+ * ring is full, the packet is dropped, as for a full device.
+ */
+static long packet_queue(solo5_handle_t handle, const uint8_t *buf,
+        size_t size)
+{
+    struct spt_net_packet *p = &packets[handle];
+    uint32_t frame = packet_state[handle].tx_frame;
+    uint8_t *f = p->tx + (size_t)frame * p->frame_size;
+    struct packet_hdr *h = (void *)f;
+
+    if (size > p->frame_size - PACKET_TX_DATA_OFFSET)
+        return -1;
+    if (__atomic_load_n(&h->status, __ATOMIC_ACQUIRE) &
+            (PACKET_STATUS_SEND_REQUEST | PACKET_STATUS_SENDING))
+        return SYS_EAGAIN;
+    memcpy(f + PACKET_TX_DATA_OFFSET, buf, size);
+    h->next_offset = 0;
+    h->len = size;
+    __atomic_store_n(&h->status, PACKET_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+    packet_state[handle].tx_frame = (frame + 1) % p->tx_frames;
+    return size;
+}
+
+static void packet_flush(solo5_handle_t handle)
+{
+    long rc;
+
+    do {
+        rc = sys_sendto(packets[handle].fd, NULL, 0, SYS_MSG_DONTWAIT);
+    } while (rc == SYS_EINTR);
+}
+
+static solo5_handle_set_t io_ready_set(void)
+{
+    solo5_handle_set_t ready_set = 0;
+
+    for (unsigned i = 0; i != MFT_MAX_ENTRIES; i++) {
+        if ((io_handles & (1ULL << i)) &&
+                ring_cons_avail(&io->net[i].rx.idx) != 0)
+            ready_set |= 1ULL << i;
+    }
+    return ready_set;
+}
+
+/*
+ * Where the tender has set up an io_uring instance for the device
+ * (--net-uring), packets are read and written by queueing requests on its
+ * submission queue and passing each batch to the kernel with a single
+ * io_uring_enter(), which also waits for them to complete. The device is
+ * non-blocking, so this never waits for packets to arrive or be sent; as for
+ * read() and write(), a request which cannot be completed immediately fails
+ * with EAGAIN. The submission queue has SOLO5_NET_FRAMES_MAX entries, and is
+ * always empty between calls.
+ */
+static struct spt_block_uring *urings;
+
+static void uring_rw(solo5_handle_t handle, uint8_t op,
+        struct solo5_net_frame *frames, size_t count, long *res)
+{
+    struct spt_block_uring *u = &urings[handle];
+    uint32_t tail = *u->sq_tail;
+
+    assert(count <= u->entries);
+    for (size_t i = 0; i < count; i++) {
+        uint32_t idx = (tail + i) & *u->sq_mask;
+        struct uring_sqe *sqe = (struct uring_sqe *)u->sqes + idx;
+        memset(sqe, 0, sizeof *sqe);
+        sqe->opcode = op;
+        sqe->flags = URING_SQE_FIXED_FILE;
+        sqe->fd = 0;
+        sqe->off = (uint64_t)-1;
+        sqe->addr = (uintptr_t)frames[i].buf;
+        sqe->len = frames[i].size;
+        sqe->user_data = i;
+        u->sq_array[idx] = idx;
+    }
+    __atomic_store_n(u->sq_tail, tail + count, __ATOMIC_RELEASE);
+
+    size_t queued = count, reaped = 0;
+    while (reaped < count) {
+        long rc = sys_io_uring_enter(u->ringfd, queued, count - reaped,
+                URING_ENTER_GETEVENTS);
+        if (rc == SYS_EINTR)
+            continue;
+        assert(rc >= 0);
+        queued -= rc;
+
+        uint32_t head = *u->cq_head;
+        while (head != __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) {
+            struct uring_cqe *cqe = (struct uring_cqe *)u->cqes +
+                (head & *u->cq_mask);
+            res[cqe->user_data] = cqe->res;
+            head++;
+            reaped++;
+        }
+        __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+    }
+}
+
+static bool has_uring(solo5_handle_t handle)
+{
+    return urings != NULL && urings[handle].entries != 0;
+}
 
 void net_init(struct spt_boot_info *bi)
 {
     mft = bi->mft;
+    urings = bi->net_uring;
     epollfd = bi->epollfd;
     timerfd = bi->timerfd;
+    have_epoll_pwait2 = bi->epoll_pwait2 != 0;
+    spin_max_nsecs = spin_nsecs = bi->poll_nsecs;
+
+    io = bi->io_thread;
+    packets = bi->net_packet;
 
     npollfds = 0;
     for (unsigned i = 0; i != mft->entries; i++) {
-	if (mft->e[i].type == MFT_NET_BASIC)
+	if (mft->e[i].type == MFT_NET_BASIC) {
+	    npollfds++;
+	    if (mft->e[i].attached)
+	        loan_init(i);
+	    if (mft->e[i].attached && io != NULL) {
+	        io_ring_init(&io->net[i].rx, i);
+	        io_ring_init(&io->net[i].tx, i);
+	        io_handles |= 1ULL << i;
+	    }
+	}
+	else if (bi->block_uring != NULL && bi->block_uring[i].entries != 0)
 	    npollfds++;
     }
+    if (io != NULL) {
+        npollfds++;
+        __atomic_store_n(&io->ready, 1, __ATOMIC_RELEASE);
+        io_kick();
+    }
 }
 
 solo5_result_t solo5_net_acquire(const char *name, solo5_handle_t *handle,
@@ -48,7 +375,9 @@ solo5_result_t solo5_net_acquire(const char *name, solo5_handle_t *handle,
     assert(e->attached);
 
     *handle = index;
+    stats_acquire(index, MFT_NET_BASIC);
     info->mtu = e->u.net_basic.mtu;
+    info->offloads = e->u.net_basic.offloads;
     memcpy(info->mac_address, e->u.net_basic.mac,
             sizeof info->mac_address);
     return SOLO5_R_OK;
@@ -59,18 +388,35 @@ solo5_result_t solo5_net_read(solo5_handle_t handle, uint8_t *buf, size_t size,
 {
     struct mft_entry *e = mft_get_by_index(mft, handle, MFT_NET_BASIC);
     if (e == NULL)
-        return SOLO5_R_EINVAL;
+        return net_stats_rx(handle, SOLO5_R_EINVAL, 0);
     
-    long nbytes = sys_read(e->hostfd, (char *)buf, size);
+    if (io != NULL) {
+        solo5_time_t tstamp;
+        if (!io_pop(handle, buf, size, read_size, &tstamp))
+            return net_stats_rx(handle, SOLO5_R_AGAIN, 0);
+        return net_stats_rx(handle, SOLO5_R_OK, *read_size);
+    }
+
+    long nbytes;
+    if (has_packet(handle)) {
+        solo5_time_t tstamp;
+        nbytes = packet_read(handle, buf, size, &tstamp);
+    }
+    else if (has_uring(handle)) {
+        struct solo5_net_frame frame = { .buf = buf, .size = size };
+        uring_rw(handle, URING_OP_READ, &frame, 1, &nbytes);
+    }
+    else
+        nbytes = sys_read(e->hostfd, (char *)buf, size);
     if (nbytes < 0) {
         if (nbytes == SYS_EAGAIN)
-            return SOLO5_R_AGAIN;
+            return net_stats_rx(handle, SOLO5_R_AGAIN, 0);
         else
-            return SOLO5_R_EUNSPEC;
+            return net_stats_rx(handle, SOLO5_R_EUNSPEC, 0);
     }
 
     *read_size = (size_t)nbytes;
-    return SOLO5_R_OK;
+    return net_stats_rx(handle, SOLO5_R_OK, *read_size);
 }
 
 solo5_result_t solo5_net_write(solo5_handle_t handle, const uint8_t *buf,
@@ -78,11 +424,278 @@ solo5_result_t solo5_net_write(solo5_handle_t handle, const uint8_t *buf,
 {
     struct mft_entry *e = mft_get_by_index(mft, handle, MFT_NET_BASIC);
     if (e == NULL)
+        return net_stats_tx(handle, SOLO5_R_EINVAL, 0);
+
+    if (io != NULL) {
+        bool queued = io_push(handle, buf, size);
+        io_wake();
+        return net_stats_tx(handle, queued ? SOLO5_R_OK :
+                (size > io->net[handle].tx.slot_size) ? SOLO5_R_EUNSPEC :
+                SOLO5_R_AGAIN, size);
+    }
+
+    long nbytes;
+    if (has_packet(handle)) {
+        nbytes = packet_queue(handle, buf, size);
+        packet_flush(handle);
+    }
+    else if (has_uring(handle)) {
+        struct solo5_net_frame frame = { .buf = (uint8_t *)buf, .size = size };
+        uring_rw(handle, URING_OP_WRITE, &frame, 1, &nbytes);
+    }
+    else
+        nbytes = sys_write(e->hostfd, (const char *)buf, size);
+
+    return net_stats_tx(handle, (nbytes == (int)size) ? SOLO5_R_OK :
+            (nbytes == SYS_EAGAIN) ? SOLO5_R_AGAIN : SOLO5_R_EUNSPEC, size);
+}
+
+solo5_result_t solo5_net_read_loan(solo5_handle_t handle, const uint8_t **buf,
+        size_t *size)
+{
+    if (handle >= MFT_MAX_ENTRIES || loans[handle].buf == NULL ||
+            loans[handle].on_loan)
+        return SOLO5_R_EINVAL;
+
+    solo5_result_t rc = solo5_net_read(handle, loans[handle].buf,
+            loans[handle].size, size);
+    if (rc == SOLO5_R_OK) {
+        *buf = loans[handle].buf;
+        loans[handle].on_loan = true;
+    }
+    return rc;
+}
+
+solo5_result_t solo5_net_read_release(solo5_handle_t handle)
+{
+    if (handle >= MFT_MAX_ENTRIES || !loans[handle].on_loan)
+        return SOLO5_R_EINVAL;
+
+    loans[handle].on_loan = false;
+    return SOLO5_R_OK;
+}
+
+/*
+ * Packets loaned with solo5_net_write_loan() are written to the host
+ * before sys_write() returns, so they are complete as soon as they are sent.
+ */
+static struct net_wloans wloans[MFT_MAX_ENTRIES];
+
+solo5_result_t solo5_net_write_loan(solo5_handle_t handle, const uint8_t *buf,
+        size_t size)
+{
+    if (handle >= MFT_MAX_ENTRIES)
+        return SOLO5_R_EINVAL;
+    if (net_wloans_full(&wloans[handle]))
+        return SOLO5_R_AGAIN;
+
+    solo5_result_t rc = solo5_net_write(handle, buf, size);
+    if (rc == SOLO5_R_OK) {
+        net_wloans_push(&wloans[handle], buf);
+        net_wloans_complete(&wloans[handle], 1);
+    }
+    return rc;
+}
+
+solo5_result_t solo5_net_write_reclaim(solo5_handle_t handle,
+        const uint8_t **bufs, size_t count, size_t *reclaimed)
+{
+    if (handle >= MFT_MAX_ENTRIES)
         return SOLO5_R_EINVAL;
 
-    long nbytes = sys_write(e->hostfd, (const char *)buf, size);
+    return net_wloans_reclaim(&wloans[handle], bufs, count, reclaimed);
+}
+
+static solo5_result_t io_writev(solo5_handle_t handle,
+        struct solo5_net_frame *frames, size_t count)
+{
+    solo5_result_t rc = SOLO5_R_OK;
 
-    return (nbytes == (int)size) ? SOLO5_R_OK : SOLO5_R_EUNSPEC;
+    for (size_t i = 0; i < count; i++) {
+        if (io_push(handle, frames[i].buf, frames[i].size))
+            frames[i].result = SOLO5_R_OK;
+        else if (frames[i].size > io->net[handle].tx.slot_size)
+            frames[i].result = SOLO5_R_EUNSPEC;
+        else
+            frames[i].result = SOLO5_R_AGAIN;
+        if (frames[i].result != SOLO5_R_OK && rc == SOLO5_R_OK)
+            rc = frames[i].result;
+    }
+    io_wake();
+    return rc;
+}
+
+solo5_result_t solo5_net_writev(solo5_handle_t handle,
+        struct solo5_net_frame *frames, size_t count)
+{
+    struct mft_entry *e = mft_get_by_index(mft, handle, MFT_NET_BASIC);
+    if (e == NULL || count > SOLO5_NET_FRAMES_MAX)
+        return net_stats_tx(handle, SOLO5_R_EINVAL, 0);
+
+    if (io != NULL)
+        return net_stats_txv(handle, io_writev(handle, frames, count), frames,
+                count);
+
+    long res[SOLO5_NET_FRAMES_MAX];
+    if (has_uring(handle))
+        uring_rw(handle, URING_OP_WRITE, frames, count, res);
+
+    solo5_result_t rc = SOLO5_R_OK;
+    for (size_t i = 0; i < count; i++) {
+        long nbytes;
+        if (has_packet(handle))
+            nbytes = packet_queue(handle, frames[i].buf, frames[i].size);
+        else if (has_uring(handle))
+            nbytes = res[i];
+        else
+            nbytes = sys_write(e->hostfd, (const char *)frames[i].buf,
+                    frames[i].size);
+        if (nbytes == (long)frames[i].size)
+            frames[i].result = SOLO5_R_OK;
+        else if (nbytes == SYS_EAGAIN)
+            frames[i].result = SOLO5_R_AGAIN;
+        else
+            frames[i].result = SOLO5_R_EUNSPEC;
+        if (frames[i].result != SOLO5_R_OK && rc == SOLO5_R_OK)
+            rc = frames[i].result;
+    }
+    if (has_packet(handle))
+        packet_flush(handle);
+    return net_stats_txv(handle, rc, frames, count);
+}
+
+/*
+ * All reads are attempted, so a packet may arrive after an earlier read has
+ * failed with EAGAIN, in which case it is moved down to keep received packets
+ * contiguous in (frames[]).
+ */
+static solo5_result_t uring_readv(solo5_handle_t handle,
+        struct solo5_net_frame *frames, size_t count, size_t *read_count)
+{
+    long res[SOLO5_NET_FRAMES_MAX];
+    uring_rw(handle, URING_OP_READ, frames, count, res);
+    solo5_time_t now = solo5_clock_wall();
+
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (res[i] < 0)
+            continue;
+        if (i != n) {
+            if ((size_t)res[i] > frames[n].size)
+                continue;
+            memcpy(frames[n].buf, frames[i].buf, res[i]);
+        }
+        frames[n].size = (size_t)res[i];
+        frames[n].tstamp = now;
+        frames[n].result = SOLO5_R_OK;
+        n++;
+    }
+    if (n == 0)
+        return (count != 0 && res[0] != SYS_EAGAIN) ? SOLO5_R_EUNSPEC :
+            SOLO5_R_AGAIN;
+
+    *read_count = n;
+    return SOLO5_R_OK;
+}
+
+solo5_result_t solo5_net_readv(solo5_handle_t handle,
+        struct solo5_net_frame *frames, size_t count, size_t *read_count)
+{
+    struct mft_entry *e = mft_get_by_index(mft, handle, MFT_NET_BASIC);
+    if (e == NULL || count > SOLO5_NET_FRAMES_MAX)
+        return net_stats_rx(handle, SOLO5_R_EINVAL, 0);
+    if (has_uring(handle)) {
+        solo5_result_t rc = uring_readv(handle, frames, count, read_count);
+        return net_stats_rxv(handle, rc, frames,
+                rc == SOLO5_R_OK ? *read_count : 0);
+    }
+    if (io != NULL) {
+        size_t n;
+        for (n = 0; n < count; n++) {
+            if (!io_pop(handle, frames[n].buf, frames[n].size,
+                        &frames[n].size, &frames[n].tstamp))
+                break;
+            frames[n].result = SOLO5_R_OK;
+        }
+        if (n == 0)
+            return net_stats_rx(handle, SOLO5_R_AGAIN, 0);
+        *read_count = n;
+        return net_stats_rxv(handle, SOLO5_R_OK, frames, n);
+    }
+
+    size_t n;
+    for (n = 0; n < count; n++) {
+        long nbytes;
+        if (has_packet(handle))
+            nbytes = packet_read(handle, frames[n].buf, frames[n].size,
+                    &frames[n].tstamp);
+        else {
+            nbytes = sys_read(e->hostfd, (char *)frames[n].buf,
+                    frames[n].size);
+            frames[n].tstamp = solo5_clock_wall();
+        }
+        if (nbytes < 0) {
+            if (nbytes != SYS_EAGAIN && n == 0)
+                return net_stats_rx(handle, SOLO5_R_EUNSPEC, 0);
+            break;
+        }
+        frames[n].size = (size_t)nbytes;
+        frames[n].result = SOLO5_R_OK;
+    }
+    if (n == 0)
+        return net_stats_rx(handle, SOLO5_R_AGAIN, 0);
+
+    *read_count = n;
+    return net_stats_rxv(handle, SOLO5_R_OK, frames, n);
+}
+
+/*
+ * Spin until a device is ready, (deadline) passes or the spin budget is
+ * exhausted, returning the set of ready devices.
+ */
+static solo5_handle_set_t yield_spin(solo5_time_t deadline,
+        struct sys_epoll_event *revents, int nevents)
+{
+    solo5_time_t start = solo5_clock_monotonic(), now = start;
+    solo5_time_t end = start + spin_nsecs;
+    bool truncated = false;
+    solo5_handle_set_t tmp_ready_set;
+
+    if (deadline < end) {
+        end = deadline;
+        truncated = true;
+    }
+    for (;;) {
+        tmp_ready_set = 0;
+        int nrevents = sys_epoll_pwait(epollfd, revents, nevents, 0, NULL, 0);
+        /*
+         * The internal timerfd is not armed while spinning, and may still be
+         * readable from an earlier call, so disregard it.
+         */
+        for (int i = 0; i < nrevents; i++)
+            if (revents[i].data != SPT_INTERNAL_TIMERFD &&
+                    revents[i].data != SPT_IO_THREAD_WAKE)
+                tmp_ready_set |= 1ULL << revents[i].data;
+        tmp_ready_set = (tmp_ready_set & ~block_uring_handles()) |
+            block_ready_set();
+        if (io != NULL)
+            tmp_ready_set |= io_ready_set();
+        if (tmp_ready_set != 0 || now >= end)
+            break;
+        now = solo5_clock_monotonic();
+    }
+
+    if (tmp_ready_set != 0) {
+        spin_nsecs *= 2;
+        if (spin_nsecs > spin_max_nsecs)
+            spin_nsecs = spin_max_nsecs;
+    }
+    else if (!truncated) {
+        spin_nsecs /= 2;
+        if (spin_nsecs < SPIN_MIN_NSECS)
+            spin_nsecs = SPIN_MIN_NSECS;
+    }
+    return tmp_ready_set;
 }
 
 bool solo5_yield(solo5_time_t deadline, solo5_handle_set_t *ready_set)
@@ -90,12 +703,15 @@ bool solo5_yield(solo5_time_t deadline, solo5_handle_set_t *ready_set)
     int nrevents;
     /*
      * In order to support nanosecond timeouts, as defined by the Solo5 API, we
-     * use a timerfd internally in the epoll() set. Account for this in the
-     * number of requested events.
+     * use epoll_pwait2() if the tender allows it, or a timerfd internally in
+     * the epoll() set. Account for the latter in the number of requested
+     * events. The event buffer is sized for the largest possible set, rather
+     * than on each call.
      */
     int nevents = npollfds ? (npollfds + 1) : 1;
-    struct sys_epoll_event revents[nevents];
-    solo5_handle_set_t tmp_ready_set = 0;
+    struct sys_epoll_event revents[MFT_MAX_ENTRIES + 2];
+    solo5_handle_set_t tmp_ready_set;
+    bool expired = false;
     struct sys_itimerspec it = {
         .it_interval = { 0 },
         .it_value = {
@@ -103,29 +719,93 @@ bool solo5_yield(solo5_time_t deadline, solo5_handle_set_t *ready_set)
             .tv_nsec = deadline % 1000000000ULL
         }
     };
+    /*
+     * Block requests batched on io_uring rings are passed to the kernel before
+     * waiting for their completion, as is buffered console output.
+     */
+    block_flush();
+    console_flush();
+    if (spin_max_nsecs != 0) {
+        tmp_ready_set = yield_spin(deadline, revents, nevents);
+        if (tmp_ready_set != 0) {
+            if (ready_set != NULL)
+                *ready_set = tmp_ready_set;
+            return true;
+        }
+    }
     /*
      * On spt, given that Solo5 monotonic time is identical to CLOCK_MONOTONIC,
      * we can just pass the deadline into the timerfd as an abosulte timeout,
      * saving a clock_gettime() call in the process.
      */
-    assert(sys_timerfd_settime(timerfd, SYS_TFD_TIMER_ABSTIME, &it, NULL) != -1);
-    /*
-     * We can always safely restart this call on EINTR, since the internal
-     * timerfd is independent of its invocation.
-     */
-    do {
-        nrevents = sys_epoll_pwait(epollfd, revents, nevents, -1, NULL, 0);
-    } while (nrevents == SYS_EINTR);
-    if (nrevents > 0) {
-        int orig_nrevents = nrevents;
-        for (int i = 0; i < orig_nrevents; i++)
-            if (revents[i].data == SPT_INTERNAL_TIMERFD)
-                nrevents -= 1;          /* Disregard in total reported events */
+    if (!have_epoll_pwait2)
+        assert(sys_timerfd_settime(timerfd, SYS_TFD_TIMER_ABSTIME, &it, NULL)
+                != -1);
+    for (;;) {
+        /*
+         * Completed block requests and packets received by the I/O thread
+         * are ready immediately, in which case we only check for other events
+         * without waiting.
+         */
+        tmp_ready_set = block_ready_set();
+        if (io != NULL)
+            tmp_ready_set |= io_ready_set();
+        long timeout = tmp_ready_set ? 0 : -1;
+        solo5_time_t idle_start = timeout ? solo5_clock_monotonic() : 0;
+        if (have_epoll_pwait2) {
+            /*
+             * The timeout is relative, so it is recalculated from the
+             * deadline on each call, including after EINTR. A call which
+             * waited until the deadline and returned no events has expired.
+             */
+            solo5_time_t now = solo5_clock_monotonic();
+            struct sys_timespec ts = { 0 };
+            if (timeout != 0 && now < deadline) {
+                ts.tv_sec = (deadline - now) / 1000000000ULL;
+                ts.tv_nsec = (deadline - now) % 1000000000ULL;
+            }
             else
+                timeout = 0;
+            nrevents = sys_epoll_pwait2(epollfd, revents, nevents, &ts, NULL,
+                    0);
+            if (nrevents == SYS_EINTR)
+                continue;
+            if (nrevents == 0 && tmp_ready_set == 0)
+                expired = true;
+        }
+        else {
+            /*
+             * We can always safely restart this call on EINTR, since the
+             * internal timerfd is independent of its invocation.
+             */
+            do {
+                nrevents = sys_epoll_pwait(epollfd, revents, nevents, timeout,
+                        NULL, 0);
+            } while (nrevents == SYS_EINTR);
+        }
+        assert(nrevents >= 0);
+        if (idle_start != 0)
+            cpu_time_idle(idle_start);
+        for (int i = 0; i < nrevents; i++) {
+            if (revents[i].data == SPT_INTERNAL_TIMERFD)
+                expired = true;
+            else if (revents[i].data != SPT_IO_THREAD_WAKE)
                 tmp_ready_set |= 1ULL << revents[i].data;
+        }
+        /*
+         * Readiness of devices with io_uring rings is determined by their
+         * completion queues, and of devices served by the I/O thread by their
+         * receive rings; events on their eventfds only serve to wake us up,
+         * and may be stale, in which case we go back to sleep.
+         */
+        tmp_ready_set = (tmp_ready_set & ~block_uring_handles()) |
+            block_ready_set();
+        if (io != NULL)
+            tmp_ready_set |= io_ready_set();
+        if (tmp_ready_set != 0 || timeout == 0 || expired)
+            break;
     }
-    assert(nrevents >= 0);
     if (ready_set != NULL)
         *ready_set = tmp_ready_set;
-    return (nrevents > 0);
+    return (tmp_ready_set != 0);
 }
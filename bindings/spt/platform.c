@@ -22,6 +22,9 @@
 
 static const char *cmdline;
 static uint64_t mem_size;
+#if defined(__x86_64__)
+static bool fsgsbase;
+#endif
 
 void platform_init(void *arg)
 {
@@ -29,6 +32,12 @@ void platform_init(void *arg)
 
     cmdline = bi->cmdline;
     mem_size = bi->mem_size;
+#if defined(__x86_64__)
+    fsgsbase = bi->fsgsbase != 0;
+#endif
+    tscclock_init(bi);
+    smp_init(bi);
+    zygote_init(bi);
 }
 
 const char *platform_cmdline(void)
@@ -55,7 +64,14 @@ int platform_puts(const char *buf, int n)
 int platform_set_tls_base(uint64_t base)
 {
 #if defined(__x86_64__)
-    /* In x86 we need to ask the host kernel to change %fs for us. */
+    /*
+     * In x86 we need to ask the host kernel to change %fs for us, unless it
+     * allows us to do so directly.
+     */
+    if (fsgsbase) {
+        __asm__ __volatile__("wrfsbase %0" :: "r" (base));
+        return 0;
+    }
     return sys_arch_prctl(SYS_ARCH_SET_FS, base);
 #elif defined(__aarch64__)
     cpu_set_tls_base(base);
@@ -64,3 +80,28 @@ int platform_set_tls_base(uint64_t base)
 #error Unsupported architecture
 #endif
 }
+
+/*
+ * Guest memory is a private mapping, so discarding its pages frees them.
+ */
+int platform_mem_release(uint64_t addr, size_t size)
+{
+    return sys_madvise((void *)addr, size, SYS_MADV_DONTNEED) == 0 ? 0 : -1;
+}
+
+/*
+ * The tender does not run alongside the guest, so cannot ask for memory.
+ */
+bool platform_mem_reclaim_requested(void)
+{
+    return false;
+}
+
+/*
+ * Writability is not watched; the application retries writes which returned
+ * SOLO5_R_AGAIN.
+ */
+solo5_handle_set_t platform_net_writable_set(void)
+{
+    return 0;
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * shm.c: Shared-memory regions.
+ */
+
+#include "bindings.h"
+
+static struct mft *mft;
+
+solo5_result_t solo5_shm_acquire(const char *name, solo5_handle_t *handle,
+        struct solo5_shm_info *info)
+{
+    unsigned index;
+    struct mft_entry *e = mft_get_by_name(mft, name, MFT_SHM_BASIC, &index);
+    if (e == NULL)
+        return SOLO5_R_EINVAL;
+    assert(e->attached);
+
+    *handle = index;
+    info->addr = (uint8_t *)(uintptr_t)e->u.shm_basic.addr;
+    info->size = (size_t)e->u.shm_basic.pages * MFT_SHM_PAGE_SIZE;
+    info->doorbell = (e->u.shm_basic.flags & MFT_SHM_DOORBELL) != 0;
+    return SOLO5_R_OK;
+}
+
+/*
+ * The tender replaces (hostfd) of regions with a doorbell by the eventfd
+ * signalled to notify the service.
+ */
+solo5_result_t solo5_shm_notify(solo5_handle_t handle)
+{
+    struct mft_entry *e = mft_get_by_index(mft, handle, MFT_SHM_BASIC);
+    if (e == NULL || !(e->u.shm_basic.flags & MFT_SHM_DOORBELL))
+        return SOLO5_R_EINVAL;
+
+    uint64_t n = 1;
+    long nbytes = sys_write(e->hostfd, (const char *)&n, sizeof n);
+    return (nbytes == sizeof n) ? SOLO5_R_OK : SOLO5_R_EUNSPEC;
+}
+
+void shm_init(struct spt_boot_info *arg)
+{
+    mft = arg->mft;
+}
@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "bindings.h"
+
+static unsigned cpu_count = 1;
+static struct spt_cpu *cpus;
+static int schedstat_fd = -1;
+
+/*
+ * Entry points of secondary CPUs, set by solo5_cpu_start(). A CPU has been
+ * started if its (entry) is set.
+ */
+static struct {
+    solo5_cpu_entry_t entry;
+    void *arg;
+} cpu_entries[SPT_CPUS_MAX];
+
+void smp_init(struct spt_boot_info *bi)
+{
+    schedstat_fd = bi->schedstat_fd;
+    if (bi->cpus > 1 && bi->cpus <= SPT_CPUS_MAX && bi->cpu != NULL) {
+        cpu_count = bi->cpus;
+        cpus = bi->cpu;
+    }
+}
+
+/*
+ * Secondary CPUs are started here by the tender, with (cpu) as the sole
+ * argument. The tender has already set up the stack and TLS base. The thread
+ * exits once the CPU's entry point returns.
+ */
+static void cpu_secondary_start(void *arg)
+{
+    unsigned cpu = (uintptr_t)arg;
+
+    cpu_time_start(cpu);
+    cpu_entries[cpu].entry(cpu_entries[cpu].arg);
+    cpu_time_stop(cpu);
+    sys_exit(0);
+}
+
+unsigned solo5_cpu_count(void)
+{
+    return cpu_count;
+}
+
+solo5_result_t solo5_cpu_start(unsigned cpu, solo5_cpu_entry_t entry,
+        void *arg, uintptr_t stack, uintptr_t tls_base)
+{
+    if (cpu == 0 || cpu >= cpu_count || entry == NULL || (stack & 15) != 0)
+        return SOLO5_R_EINVAL;
+
+    solo5_cpu_entry_t expected = NULL;
+    if (!__atomic_compare_exchange_n(&cpu_entries[cpu].entry, &expected,
+                entry, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+        return SOLO5_R_EINVAL;
+    cpu_entries[cpu].arg = arg;
+
+    cpus[cpu].entry = cpu_secondary_start;
+    cpus[cpu].arg = (void *)(uintptr_t)cpu;
+    cpus[cpu].stack = stack;
+    cpus[cpu].tls_base = tls_base;
+    __atomic_store_n(&cpus[cpu].state, SPT_CPU_STARTED, __ATOMIC_RELEASE);
+    (void)sys_futex(&cpus[cpu].state, SYS_FUTEX_WAKE_PRIVATE, 1);
+
+    return SOLO5_R_OK;
+}
+
+/*
+ * Steal time is the time the thread running (cpu) has been runnable but
+ * waiting for a host CPU, the second field of its scheduler statistics. The
+ * statistics of a CPU whose thread has exited can no longer be read, so the
+ * last value read is kept.
+ */
+static solo5_time_t steal_last[SPT_CPUS_MAX];
+
+bool platform_cpu_steal(unsigned cpu, solo5_time_t *steal)
+{
+    if (cpu >= cpu_count)
+        return false;
+    int fd = cpu == 0 ? schedstat_fd : cpus[cpu].schedstat_fd;
+    if (fd < 0)
+        return false;
+
+    char buf[80];
+    long n = sys_pread64(fd, buf, sizeof buf - 1, 0);
+    if (n <= 0) {
+        *steal = __atomic_load_n(&steal_last[cpu], __ATOMIC_RELAXED);
+        return cpu != 0;
+    }
+    buf[n] = '\0';
+
+    const char *p = buf;
+    while (*p >= '0' && *p <= '9')
+        p++;
+    if (*p++ != ' ' || *p < '0' || *p > '9')
+        return false;
+    solo5_time_t value = 0;
+    while (*p >= '0' && *p <= '9')
+        value = value * 10 + (solo5_time_t)(*p++ - '0');
+    __atomic_store_n(&steal_last[cpu], value, __ATOMIC_RELAXED);
+    *steal = value;
+    return true;
+}
@@ -29,6 +29,7 @@ void _start(void *arg)
     static struct solo5_start_info si;
 
     platform_init(arg);
+    cpu_time_start(0);
     si.cmdline = cmdline_parse(platform_cmdline());
 
     log(INFO, "            |      ___|\n");
@@ -39,7 +40,19 @@ void _start(void *arg)
     mem_init();
     block_init(arg);
     net_init(arg);
+    shm_init(arg);
 
     mem_lock_heap(&si.heap_start, &si.heap_size);
+    mem_huge_heap(&si.heap_huge_start, &si.heap_huge_size);
+    /*
+     * With --trace-boot, the tender does not regain control once the guest
+     * is running, so report reaching solo5_app_main() here.
+     */
+    struct spt_boot_info *bi = arg;
+    if (bi->boot_trace_start)
+        log(INFO, "Solo5: boot: %8llu us solo5_app_main (guest)\n",
+                (unsigned long long)(solo5_clock_monotonic() -
+                    bi->boot_trace_start) / 1000);
+    console_flush();
     solo5_exit(solo5_app_main(&si));
 }
@@ -34,10 +34,31 @@
 #define SYS_write 64
 #define SYS_pread64 67
 #define SYS_pwrite64 68
+#define SYS_preadv 69
+#define SYS_pwritev 70
+#define SYS_fdatasync 83
+#define SYS_fallocate 47
+#define SYS_fadvise64 223
+#define SYS_ioctl 29
+#define SYS_madvise 233
 #define SYS_clock_gettime 113
 #define SYS_exit_group 94
+#define SYS_exit 93
+#define SYS_futex 98
 #define SYS_epoll_pwait 22
 #define SYS_timerfd_settime 86
+#define SYS_epoll_pwait2 441
+#define SYS_io_uring_enter 426
+#define SYS_sendto 206
+#define SYS_accept4 242
+#define SYS_recvmsg 212
+#define SYS_dup3 24
+#define SYS_close 57
+#define SYS_clone 220
+#define SYS_epoll_create1 20
+#define SYS_epoll_ctl 21
+#define SYS_timerfd_create 85
+#define SYS_seccomp 277
 
 long sys_read(long fd, void *buf, long size)
 {
@@ -109,6 +130,133 @@ long sys_pwrite64(long fd, const void *buf, long size, long pos)
     return x0;
 }
 
+/*
+ * The high word of (pos) is passed as 0, as on 64-bit architectures the low
+ * word holds the full offset.
+ */
+long sys_preadv(long fd, const struct sys_iovec *iov, long iovcnt, long pos)
+{
+    register long x8 __asm__("x8") = SYS_preadv;
+    register long x0 __asm__("x0") = fd;
+    register long x1 __asm__("x1") = (long)iov;
+    register long x2 __asm__("x2") = iovcnt;
+    register long x3 __asm__("x3") = pos;
+    register long x4 __asm__("x4") = 0;
+
+    __asm__ __volatile__ (
+            "svc 0"
+            : "=r" (x0)
+            : "r" (x8), "r" (x0), "r" (x1), "r" (x2), "r" (x3), "r" (x4)
+            : "memory", "cc"
+    );
+
+    return x0;
+}
+
+long sys_pwritev(long fd, const struct sys_iovec *iov, long iovcnt, long pos)
+{
+    register long x8 __asm__("x8") = SYS_pwritev;
+    register long x0 __asm__("x0") = fd;
+    register long x1 __asm__("x1") = (long)iov;
+    register long x2 __asm__("x2") = iovcnt;
+    register long x3 __asm__("x3") = pos;
+    register long x4 __asm__("x4") = 0;
+
+    __asm__ __volatile__ (
+            "svc 0"
+            : "=r" (x0)
+            : "r" (x8), "r" (x0), "r" (x1), "r" (x2), "r" (x3), "r" (x4)
+            : "memory", "cc"
+    );
+
+    return x0;
+}
+
+long sys_fdatasync(long fd)
+{
+    register long x8 __asm__("x8") = SYS_fdatasync;
+    register long x0 __asm__("x0") = fd;
+
+    __asm__ __volatile__ (
+            "svc 0"
+            : "=r" (x0)
+            : "r" (x8), "r" (x0)
+            : "memory", "cc"
+    );
+
+    return x0;
+}
+
+long sys_fallocate(long fd, long mode, long offset, long len)
+{
+    register long x8 __asm__("x8") = SYS_fallocate;
+    register long x0 __asm__("x0") = fd;
+    register long x1 __asm__("x1") = mode;
+    register long x2 __asm__("x2") = offset;
+    register long x3 __asm__("x3") = len;
+
+    __asm__ __volatile__ (
+            "svc 0"
+            : "=r" (x0)
+            : "r" (x8), "r" (x0), "r" (x1), "r" (x2), "r" (x3)
+            : "memory", "cc"
+    );
+
+    return x0;
+}
+
+long sys_fadvise64(long fd, long offset, long len, long advice)
+{
+    register long x8 __asm__("x8") = SYS_fadvise64;
+    register long x0 __asm__("x0") = fd;
+    register long x1 __asm__("x1") = offset;
+    register long x2 __asm__("x2") = len;
+    register long x3 __asm__("x3") = advice;
+
+    __asm__ __volatile__ (
+            "svc 0"
+            : "=r" (x0)
+            : "r" (x8), "r" (x0), "r" (x1), "r" (x2), "r" (x3)
+            : "memory", "cc"
+    );
+
+    return x0;
+}
+
+long sys_ioctl(long fd, long request, void *arg)
+{
+    register long x8 __asm__("x8") = SYS_ioctl;
+    register long x0 __asm__("x0") = fd;
+    register long x1 __asm__("x1") = request;
+    register long x2 __asm__("x2") = (long)arg;
+
+    __asm__ __volatile__ (
+            "svc 0"
+            : "=r" (x0)
+            : "r" (x8), "r" (x0), "r" (x1), "r" (x2)
+            : "memory", "cc"
+    );
+
+    return x0;
+}
+
+long sys_madvise(void *addr, long len, long advice)
+{
+    register long x8 __asm__("x8") = SYS_madvise;
+    register long x0 __asm__("x0") = (long)addr;
+    register long x1 __asm__("x1") = len;
+    register long x2 __asm__("x2") = advice;
+
+    __asm__ __volatile__ (
+            "svc 0"
+            : "=r" (x0)
+            : "r" (x8), "r" (x0), "r" (x1), "r" (x2)
+            : "memory", "cc"
+    );
+
+    return x0;
+}
+
 void sys_exit_group(long status)
 {
     register long x8 __asm__("x8") = SYS_exit_group;
@@ -124,6 +272,38 @@ void sys_exit_group(long status)
     for(;;);
 }
 
+void sys_exit(long status)
+{
+    register long x8 __asm__("x8") = SYS_exit;
+    register long x0 __asm__("x0") = status;
+
+    __asm__ __volatile__ (
+            "svc 0"
+            : "=r" (x0)
+            : "r" (x8), "r" (x0)
+            : "memory", "cc"
+    );
+
+    for(;;);
+}
+
+long sys_futex(void *uaddr, long op, long val)
+{
+    register long x8 __asm__("x8") = SYS_futex;
+    register long x0 __asm__("x0") = (long)uaddr;
+    register long x1 __asm__("x1") = op;
+    register long x2 __asm__("x2") = val;
+
+    __asm__ __volatile__ (
+            "svc 0"
+            : "=r" (x0)
+            : "r" (x8), "r" (x0), "r" (x1), "r" (x2)
+            : "memory", "cc"
+    );
+
+    return x0;
+}
+
 long sys_clock_gettime(const long which, void *ts)
 {
     register long x8 __asm__("x8") = SYS_clock_gettime;
@@ -162,6 +342,28 @@ long sys_epoll_pwait(long epfd, void *events, long maxevents, long timeout,
     return x0;
 }
 
+long sys_epoll_pwait2(long epfd, void *events, long maxevents,
+        const void *timeout, void *sigmask, long sigsetsize)
+{
+    register long x8 __asm__("x8") = SYS_epoll_pwait2;
+    register long x0 __asm__("x0") = epfd;
+    register long x1 __asm__("x1") = (long)events;
+    register long x2 __asm__("x2") = maxevents;
+    register long x3 __asm__("x3") = (long)timeout;
+    register long x4 __asm__("x4") = (long)sigmask;
+    register long x5 __asm__("x5") = sigsetsize;
+
+    __asm__ __volatile__ (
+            "svc 0"
+            : "=r" (x0)
+            : "r" (x8), "r" (x0), "r" (x1), "r" (x2), "r" (x3), "r" (x4),
+              "r" (x5)
+            : "memory", "cc"
+    );
+
+    return x0;
+}
+
 long sys_timerfd_settime(long fd, long flags, const void *utmr, void *otmr)
 {
     register long x8 __asm__("x8") = SYS_timerfd_settime;
@@ -179,3 +381,201 @@ long sys_timerfd_settime(long fd, long flags, const void *utmr, void *otmr)
 
     return x0;
 }
+
+long sys_io_uring_enter(long fd, long to_submit, long min_complete,
+        long flags)
+{
+    register long x8 __asm__("x8") = SYS_io_uring_enter;
+    register long x0 __asm__("x0") = fd;
+    register long x1 __asm__("x1") = to_submit;
+    register long x2 __asm__("x2") = min_complete;
+    register long x3 __asm__("x3") = flags;
+    register long x4 __asm__("x4") = 0;
+    register long x5 __asm__("x5") = 0;
+
+    __asm__ __volatile__ (
+            "svc 0"
+            : "=r" (x0)
+            : "r" (x8), "r" (x0), "r" (x1), "r" (x2), "r" (x3), "r" (x4),
+              "r" (x5)
+            : "memory", "cc"
+    );
+
+    return x0;
+}
+
+long sys_sendto(long fd, const void *buf, long len, long flags)
+{
+    register long x8 __asm__("x8") = SYS_sendto;
+    register long x0 __asm__("x0") = fd;
+    register long x1 __asm__("x1") = (long)buf;
+    register long x2 __asm__("x2") = len;
+    register long x3 __asm__("x3") = flags;
+    register long x4 __asm__("x4") = 0;
+    register long x5 __asm__("x5") = 0;
+
+    __asm__ __volatile__ (
+            "svc 0"
+            : "=r" (x0)
+            : "r" (x8), "r" (x0), "r" (x1), "r" (x2), "r" (x3), "r" (x4),
+              "r" (x5)
+            : "memory", "cc"
+    );
+
+    return x0;
+}
+
+long sys_accept4(long fd)
+{
+    register long x8 __asm__("x8") = SYS_accept4;
+    register long x0 __asm__("x0") = fd;
+    register long x1 __asm__("x1") = 0;
+    register long x2 __asm__("x2") = 0;
+    register long x3 __asm__("x3") = 0;
+
+    __asm__ __volatile__ (
+            "svc 0"
+            : "=r" (x0)
+            : "r" (x8), "r" (x0), "r" (x1), "r" (x2), "r" (x3)
+            : "memory", "cc"
+    );
+
+    return x0;
+}
+
+long sys_recvmsg(long fd, void *msg, long flags)
+{
+    register long x8 __asm__("x8") = SYS_recvmsg;
+    register long x0 __asm__("x0") = fd;
+    register long x1 __asm__("x1") = (long)msg;
+    register long x2 __asm__("x2") = flags;
+
+    __asm__ __volatile__ (
+            "svc 0"
+            : "=r" (x0)
+            : "r" (x8), "r" (x0), "r" (x1), "r" (x2)
+            : "memory", "cc"
+    );
+
+    return x0;
+}
+
+long sys_dup3(long oldfd, long newfd, long flags)
+{
+    register long x8 __asm__("x8") = SYS_dup3;
+    register long x0 __asm__("x0") = oldfd;
+    register long x1 __asm__("x1") = newfd;
+    register long x2 __asm__("x2") = flags;
+
+    __asm__ __volatile__ (
+            "svc 0"
+            : "=r" (x0)
+            : "r" (x8), "r" (x0), "r" (x1), "r" (x2)
+            : "memory", "cc"
+    );
+
+    return x0;
+}
+
+long sys_close(long fd)
+{
+    register long x8 __asm__("x8") = SYS_close;
+    register long x0 __asm__("x0") = fd;
+
+    __asm__ __volatile__ (
+            "svc 0"
+            : "=r" (x0)
+            : "r" (x8), "r" (x0)
+            : "memory", "cc"
+    );
+
+    return x0;
+}
+
+/*
+ * clone(SIGCHLD) with no new stack, as fork().
+ */
+long sys_fork(void)
+{
+    register long x8 __asm__("x8") = SYS_clone;
+    register long x0 __asm__("x0") = SYS_SIGCHLD;
+    register long x1 __asm__("x1") = 0;
+    register long x2 __asm__("x2") = 0;
+    register long x3 __asm__("x3") = 0;
+    register long x4 __asm__("x4") = 0;
+
+    __asm__ __volatile__ (
+            "svc 0"
+            : "=r" (x0)
+            : "r" (x8), "r" (x0), "r" (x1), "r" (x2), "r" (x3), "r" (x4)
+            : "memory", "cc"
+    );
+
+    return x0;
+}
+
+long sys_epoll_create1(long flags)
+{
+    register long x8 __asm__("x8") = SYS_epoll_create1;
+    register long x0 __asm__("x0") = flags;
+
+    __asm__ __volatile__ (
+            "svc 0"
+            : "=r" (x0)
+            : "r" (x8), "r" (x0)
+            : "memory", "cc"
+    );
+
+    return x0;
+}
+
+long sys_epoll_ctl(long epfd, long op, long fd, void *event)
+{
+    register long x8 __asm__("x8") = SYS_epoll_ctl;
+    register long x0 __asm__("x0") = epfd;
+    register long x1 __asm__("x1") = op;
+    register long x2 __asm__("x2") = fd;
+    register long x3 __asm__("x3") = (long)event;
+
+    __asm__ __volatile__ (
+            "svc 0"
+            : "=r" (x0)
+            : "r" (x8), "r" (x0), "r" (x1), "r" (x2), "r" (x3)
+            : "memory", "cc"
+    );
+
+    return x0;
+}
+
+long sys_timerfd_create(long clockid, long flags)
+{
+    register long x8 __asm__("x8") = SYS_timerfd_create;
+    register long x0 __asm__("x0") = clockid;
+    register long x1 __asm__("x1") = flags;
+
+    __asm__ __volatile__ (
+            "svc 0"
+            : "=r" (x0)
+            : "r" (x8), "r" (x0), "r" (x1)
+            : "memory", "cc"
+    );
+
+    return x0;
+}
+
+long sys_seccomp(long op, long flags, const void *args)
+{
+    register long x8 __asm__("x8") = SYS_seccomp;
+    register long x0 __asm__("x0") = op;
+    register long x1 __asm__("x1") = flags;
+    register long x2 __asm__("x2") = (long)args;
+
+    __asm__ __volatile__ (
+            "svc 0"
+            : "=r" (x0)
+            : "r" (x8), "r" (x0), "r" (x1), "r" (x2)
+            : "memory", "cc"
+    );
+
+    return x0;
+}
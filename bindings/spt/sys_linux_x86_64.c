@@ -34,11 +34,32 @@
 #define SYS_write 1
 #define SYS_pread64 17
 #define SYS_pwrite64 18
+#define SYS_preadv 295
+#define SYS_pwritev 296
+#define SYS_fdatasync 75
+#define SYS_fallocate 285
+#define SYS_fadvise64 221
+#define SYS_ioctl 16
+#define SYS_madvise 28
 #define SYS_arch_prctl 158
 #define SYS_clock_gettime 228
 #define SYS_exit_group 231
+#define SYS_exit 60
+#define SYS_futex 202
 #define SYS_epoll_pwait 281
 #define SYS_timerfd_settime 286
+#define SYS_epoll_pwait2 441
+#define SYS_io_uring_enter 426
+#define SYS_sendto 44
+#define SYS_accept4 288
+#define SYS_recvmsg 47
+#define SYS_dup3 292
+#define SYS_close 3
+#define SYS_clone 56
+#define SYS_epoll_create1 291
+#define SYS_epoll_ctl 233
+#define SYS_timerfd_create 283
+#define SYS_seccomp 317
 
 long sys_read(long fd, void *buf, long size)
 {
@@ -98,6 +119,118 @@ long sys_pwrite64(long fd, const void *buf, long size, long pos)
     return ret;
 }
 
+/*
+ * The high word of (pos) is passed as 0, as on 64-bit architectures the low
+ * word holds the full offset.
+ */
+long sys_preadv(long fd, const struct sys_iovec *iov, long iovcnt, long pos)
+{
+    long ret;
+    register long r10 asm("r10") = pos;
+    register long r8 asm("r8") = 0;
+
+    __asm__ __volatile__ (
+            "syscall"
+            : "=a" (ret)
+            : "a" (SYS_preadv), "D" (fd), "S" (iov), "d" (iovcnt), "r" (r10),
+              "r" (r8)
+            : "rcx", "r11", "memory"
+    );
+
+    return ret;
+}
+
+long sys_pwritev(long fd, const struct sys_iovec *iov, long iovcnt, long pos)
+{
+    long ret;
+    register long r10 asm("r10") = pos;
+    register long r8 asm("r8") = 0;
+
+    __asm__ __volatile__ (
+            "syscall"
+            : "=a" (ret)
+            : "a" (SYS_pwritev), "D" (fd), "S" (iov), "d" (iovcnt), "r" (r10),
+              "r" (r8)
+            : "rcx", "r11", "memory"
+    );
+
+    return ret;
+}
+
+long sys_fdatasync(long fd)
+{
+    long ret;
+
+    __asm__ __volatile__ (
+            "syscall"
+            : "=a" (ret)
+            : "a" (SYS_fdatasync), "D" (fd)
+            : "rcx", "r11", "memory"
+    );
+
+    return ret;
+}
+
+long sys_fallocate(long fd, long mode, long offset, long len)
+{
+    long ret;
+    register long r10 asm("r10") = len;
+
+    __asm__ __volatile__ (
+            "syscall"
+            : "=a" (ret)
+            : "a" (SYS_fallocate), "D" (fd), "S" (mode), "d" (offset),
+              "r" (r10)
+            : "rcx", "r11", "memory"
+    );
+
+    return ret;
+}
+
+long sys_fadvise64(long fd, long offset, long len, long advice)
+{
+    long ret;
+    register long r10 asm("r10") = advice;
+
+    __asm__ __volatile__ (
+            "syscall"
+            : "=a" (ret)
+            : "a" (SYS_fadvise64), "D" (fd), "S" (offset), "d" (len),
+              "r" (r10)
+            : "rcx", "r11", "memory"
+    );
+
+    return ret;
+}
+
+long sys_ioctl(long fd, long request, void *arg)
+{
+    long ret;
+
+    __asm__ __volatile__ (
+            "syscall"
+            : "=a" (ret)
+            : "a" (SYS_ioctl), "D" (fd), "S" (request), "d" (arg)
+            : "rcx", "r11", "memory"
+    );
+
+    return ret;
+}
+
+long sys_madvise(void *addr, long len, long advice)
+{
+    long ret;
+
+    __asm__ __volatile__ (
+            "syscall"
+            : "=a" (ret)
+            : "a" (SYS_madvise), "D" (addr), "S" (len), "d" (advice)
+            : "rcx", "r11", "memory"
+    );
+
+    return ret;
+}
+
 void sys_exit_group(long status)
 {
     __asm__ __volatile__ (
@@ -110,6 +243,32 @@ void sys_exit_group(long status)
     for(;;);
 }
 
+void sys_exit(long status)
+{
+    __asm__ __volatile__ (
+            "syscall"
+            :
+            : "a" (SYS_exit), "D" (status)
+            : "rcx", "r11", "memory"
+    );
+
+    for(;;);
+}
+
+long sys_futex(void *uaddr, long op, long val)
+{
+    long ret;
+
+    __asm__ __volatile__ (
+            "syscall"
+            : "=a" (ret)
+            : "a" (SYS_futex), "D" (uaddr), "S" (op), "d" (val)
+            : "rcx", "r11", "memory"
+    );
+
+    return ret;
+}
+
 long sys_clock_gettime(const long which, void *ts)
 {
     int ret;
@@ -143,6 +302,25 @@ long sys_epoll_pwait(long epfd, void *events, long maxevents, long timeout,
     return ret;
 }
 
+long sys_epoll_pwait2(long epfd, void *events, long maxevents,
+        const void *timeout, void *sigmask, long sigsetsize)
+{
+    long ret;
+    register long r10 asm("r10") = (long)timeout;
+    register long r8 asm("r8") = (long)sigmask;
+    register long r9 asm("r9") = sigsetsize;
+
+    __asm__ __volatile__ (
+            "syscall"
+            : "=a" (ret)
+            : "a" (SYS_epoll_pwait2), "D" (epfd), "S" (events), "d" (maxevents),
+              "r" (r10), "r" (r8), "r" (r9)
+            : "rcx", "r11", "memory"
+    );
+
+    return ret;
+}
+
 long sys_timerfd_settime(long fd, long flags, const void *utmr, void *otmr)
 {
     long ret;
@@ -159,6 +337,43 @@ long sys_timerfd_settime(long fd, long flags, const void *utmr, void *otmr)
     return ret;
 }
 
+long sys_io_uring_enter(long fd, long to_submit, long min_complete,
+        long flags)
+{
+    long ret;
+    register long r10 asm("r10") = flags;
+    register long r8 asm("r8") = 0;
+    register long r9 asm("r9") = 0;
+
+    __asm__ __volatile__ (
+            "syscall"
+            : "=a" (ret)
+            : "a" (SYS_io_uring_enter), "D" (fd), "S" (to_submit),
+              "d" (min_complete), "r" (r10), "r" (r8), "r" (r9)
+            : "rcx", "r11", "memory"
+    );
+
+    return ret;
+}
+
+long sys_sendto(long fd, const void *buf, long len, long flags)
+{
+    long ret;
+    register long r10 asm("r10") = flags;
+    register long r8 asm("r8") = 0;
+    register long r9 asm("r9") = 0;
+
+    __asm__ __volatile__ (
+            "syscall"
+            : "=a" (ret)
+            : "a" (SYS_sendto), "D" (fd), "S" (buf), "d" (len), "r" (r10),
+              "r" (r8), "r" (r9)
+            : "rcx", "r11", "memory"
+    );
+
+    return ret;
+}
+
 long sys_arch_prctl(long code, long addr)
 {
     long ret;
@@ -172,3 +387,137 @@ long sys_arch_prctl(long code, long addr)
 
     return ret;
 }
+
+long sys_accept4(long fd)
+{
+    long ret;
+    register long r10 asm("r10") = 0;
+
+    __asm__ __volatile__ (
+            "syscall"
+            : "=a" (ret)
+            : "a" (SYS_accept4), "D" (fd), "S" (0), "d" (0), "r" (r10)
+            : "rcx", "r11", "memory"
+    );
+
+    return ret;
+}
+
+long sys_recvmsg(long fd, void *msg, long flags)
+{
+    long ret;
+
+    __asm__ __volatile__ (
+            "syscall"
+            : "=a" (ret)
+            : "a" (SYS_recvmsg), "D" (fd), "S" (msg), "d" (flags)
+            : "rcx", "r11", "memory"
+    );
+
+    return ret;
+}
+
+long sys_dup3(long oldfd, long newfd, long flags)
+{
+    long ret;
+
+    __asm__ __volatile__ (
+            "syscall"
+            : "=a" (ret)
+            : "a" (SYS_dup3), "D" (oldfd), "S" (newfd), "d" (flags)
+            : "rcx", "r11", "memory"
+    );
+
+    return ret;
+}
+
+long sys_close(long fd)
+{
+    long ret;
+
+    __asm__ __volatile__ (
+            "syscall"
+            : "=a" (ret)
+            : "a" (SYS_close), "D" (fd)
+            : "rcx", "r11", "memory"
+    );
+
+    return ret;
+}
+
+/*
+ * clone(SIGCHLD) with no new stack, as fork().
+ */
+long sys_fork(void)
+{
+    long ret;
+    register long r10 asm("r10") = 0;
+    register long r8 asm("r8") = 0;
+
+    __asm__ __volatile__ (
+            "syscall"
+            : "=a" (ret)
+            : "a" (SYS_clone), "D" (SYS_SIGCHLD), "S" (0), "d" (0),
+              "r" (r10), "r" (r8)
+            : "rcx", "r11", "memory"
+    );
+
+    return ret;
+}
+
+long sys_epoll_create1(long flags)
+{
+    long ret;
+
+    __asm__ __volatile__ (
+            "syscall"
+            : "=a" (ret)
+            : "a" (SYS_epoll_create1), "D" (flags)
+            : "rcx", "r11", "memory"
+    );
+
+    return ret;
+}
+
+long sys_epoll_ctl(long epfd, long op, long fd, void *event)
+{
+    long ret;
+    register long r10 asm("r10") = (long)event;
+
+    __asm__ __volatile__ (
+            "syscall"
+            : "=a" (ret)
+            : "a" (SYS_epoll_ctl), "D" (epfd), "S" (op), "d" (fd), "r" (r10)
+            : "rcx", "r11", "memory"
+    );
+
+    return ret;
+}
+
+long sys_timerfd_create(long clockid, long flags)
+{
+    long ret;
+
+    __asm__ __volatile__ (
+            "syscall"
+            : "=a" (ret)
+            : "a" (SYS_timerfd_create), "D" (clockid), "S" (flags)
+            : "rcx", "r11", "memory"
+    );
+
+    return ret;
+}
+
+long sys_seccomp(long op, long flags, const void *args)
+{
+    long ret;
+
+    __asm__ __volatile__ (
+            "syscall"
+            : "=a" (ret)
+            : "a" (SYS_seccomp), "D" (op), "S" (flags), "d" (args)
+            : "rcx", "r11", "memory"
+    );
+
+    return ret;
+}
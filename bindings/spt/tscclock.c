@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * tscclock.c: Cycle counter based monotonic clock.
+ *
+ * If the tender has calibrated the host's cycle counter against
+ * CLOCK_MONOTONIC (see spt_boot_info), monotonic time is computed from the
+ * cycle counter, read directly, rather than with a clock_gettime() system
+ * call. Otherwise, tscclock_enabled() returns false.
+ */
+
+#include "bindings.h"
+
+static bool enabled;
+
+/* Base time values at the last call to tscclock_monotonic(). */
+static uint64_t time_base;
+static uint64_t tsc_base;
+
+/*
+ * Shift factor and (0.S) fixed point multiplier for converting TSC ticks to
+ * nsecs, as for the hvt TSC clock.
+ */
+static uint8_t tsc_shift;
+static uint32_t tsc_mult;
+
+#if defined(__x86_64__)
+#define READ_CPU_TICKS cpu_rdtsc
+#elif defined(__aarch64__)
+#define READ_CPU_TICKS cpu_cntvct
+#else
+#error Unsupported architecture
+#endif
+
+uint64_t tscclock_monotonic(void)
+{
+#if defined(__x86_64__)
+    /*
+     * On x86_64, mul64_32() does not overflow for any delta that can occur in
+     * practice, so time is computed directly from the values supplied by the
+     * tender.
+     */
+    return time_base + mul64_32(READ_CPU_TICKS() - tsc_base, tsc_mult,
+            tsc_shift);
+#else
+    uint64_t tsc_now = READ_CPU_TICKS();
+
+    time_base += mul64_32(tsc_now - tsc_base, tsc_mult, tsc_shift);
+    tsc_base = tsc_now;
+    return time_base;
+#endif
+}
+
+bool tscclock_enabled(void)
+{
+    return enabled;
+}
+
+void tscclock_init(struct spt_boot_info *bi)
+{
+    if (bi->tsc_freq == 0)
+        return;
+
+    tsc_shift = 32;
+    uint64_t tmp;
+    do {
+        tmp = (NSEC_PER_SEC << tsc_shift) / bi->tsc_freq;
+        if ((tmp & 0xFFFFFFFF00000000L) == 0L)
+            tsc_mult = (uint32_t)tmp;
+        else
+            tsc_shift--;
+    } while (tsc_shift > 0 && tsc_mult == 0L);
+    if (tsc_mult == 0L)
+        return;
+
+    tsc_base = bi->tsc_base;
+    time_base = bi->time_base;
+    enabled = true;
+}
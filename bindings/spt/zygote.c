@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * zygote.c: Fork server (--zygote), see spt_abi.h.
+ */
+
+#include "bindings.h"
+
+static const struct spt_zygote *zygote;
+static struct mft *mft;
+static int epollfd;
+static int timerfd;
+
+void zygote_init(struct spt_boot_info *bi)
+{
+    zygote = bi->zygote;
+    mft = bi->mft;
+    epollfd = bi->epollfd;
+    timerfd = bi->timerfd;
+}
+
+static void check(long rc, const char *what)
+{
+    if (rc < 0) {
+        log(ERROR, "Solo5: zygote: %s failed (%ld)\n", what, -rc);
+        sys_exit_group(SOLO5_EXIT_ABORT);
+    }
+}
+
+/*
+ * Moves (fd) onto (newfd).
+ */
+static void move_fd(long fd, long newfd, const char *what)
+{
+    check(sys_dup3(fd, newfd, 0), what);
+    (void)sys_close(fd);
+}
+
+/*
+ * Attaches the instance to the devices passed in (fds), and to an epoll()
+ * set and timerfd of its own, then applies the instance's seccomp policy.
+ */
+static void instance_start(const int *fds)
+{
+    unsigned n = 0;
+    for (unsigned i = 0; i != mft->entries; i++) {
+        if (mft->e[i].attached)
+            move_fd(fds[n++], mft->e[i].hostfd, "dup3(device)");
+    }
+    (void)sys_close(zygote->connfd);
+    (void)sys_close(zygote->listenfd);
+
+    move_fd(sys_epoll_create1(0), epollfd, "epoll_create1()");
+    move_fd(sys_timerfd_create(SYS_CLOCK_MONOTONIC, SYS_TFD_NONBLOCK),
+            timerfd, "timerfd_create()");
+    struct sys_epoll_event ev = {
+        .events = SYS_EPOLLIN,
+        .data = SPT_INTERNAL_TIMERFD
+    };
+    check(sys_epoll_ctl(epollfd, SYS_EPOLL_CTL_ADD, timerfd, &ev),
+            "epoll_ctl(timerfd)");
+    for (unsigned i = 0; i != mft->entries; i++) {
+        if (mft->e[i].type != MFT_NET_BASIC || !mft->e[i].attached)
+            continue;
+        ev.data = i;
+        check(sys_epoll_ctl(epollfd, SYS_EPOLL_CTL_ADD, mft->e[i].hostfd,
+                    &ev), "epoll_ctl(device)");
+    }
+
+    struct sys_sock_fprog prog = {
+        .len = zygote->filter_len,
+        .filter = zygote->filter
+    };
+    check(sys_seccomp(SYS_SECCOMP_SET_MODE_FILTER, 0, &prog), "seccomp()");
+}
+
+/*
+ * Receives the devices of an instance on (connfd) into (fds), returning
+ * their number, or -1 if the message is malformed.
+ */
+static int receive_fds(int *fds)
+{
+    char data;
+    struct sys_iovec iov = { .base = &data, .len = 1 };
+    union {
+        struct sys_cmsghdr hdr;
+        uint8_t buf[sizeof (struct sys_cmsghdr) +
+            MFT_MAX_ENTRIES * sizeof (int)];
+    } control;
+    struct sys_msghdr mh = {
+        .iov = &iov,
+        .iovlen = 1,
+        .control = &control,
+        .controllen = sizeof control
+    };
+
+    long nbytes;
+    do {
+        nbytes = sys_recvmsg(zygote->connfd, &mh, 0);
+    } while (nbytes == SYS_EINTR);
+    if (nbytes <= 0 || mh.controllen < sizeof (struct sys_cmsghdr) ||
+            control.hdr.level != SYS_SOL_SOCKET ||
+            control.hdr.type != SYS_SCM_RIGHTS)
+        return -1;
+    int nfds = (control.hdr.len - sizeof (struct sys_cmsghdr)) / sizeof (int);
+    memcpy(fds, &control.buf[sizeof (struct sys_cmsghdr)],
+            nfds * sizeof (int));
+    if (mh.flags & SYS_MSG_CTRUNC) {
+        for (int i = 0; i < nfds; i++)
+            (void)sys_close(fds[i]);
+        return -1;
+    }
+    return nfds;
+}
+
+/*
+ * In the zygote, serves launchers and never returns. Returns in each
+ * instance.
+ */
+solo5_result_t solo5_snapshot(void)
+{
+    if (zygote == NULL)
+        return SOLO5_R_EUNSPEC;
+
+    unsigned ndevices = 0;
+    for (unsigned i = 0; i != mft->entries; i++)
+        ndevices += mft->e[i].attached;
+    /*
+     * Buffered console output would otherwise be written by every instance.
+     */
+    console_flush();
+    log(INFO, "Solo5: zygote: Ready\n");
+
+    for (;;) {
+        long fd = sys_accept4(zygote->listenfd);
+        if (fd == SYS_EINTR)
+            continue;
+        check(fd, "accept4()");
+        move_fd(fd, zygote->connfd, "dup3(connection)");
+
+        int fds[MFT_MAX_ENTRIES];
+        int nfds = receive_fds(fds);
+        int32_t pid = -1;
+        if (nfds == (int)ndevices) {
+            pid = sys_fork();
+            if (pid == 0) {
+                instance_start(fds);
+                return SOLO5_R_OK;
+            }
+            if (pid < 0)
+                pid = -1;
+        }
+        for (int i = 0; i < nfds; i++)
+            (void)sys_close(fds[i]);
+        (void)sys_write(zygote->connfd, &pid, sizeof pid);
+    }
+}
@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * stats.c: Per-device I/O statistics.
+ */
+
+#include "bindings.h"
+
+/*
+ * Indexed by handle. The tenders find these by name in the unikernel's symbol
+ * table to export them with --metrics, so they must not be renamed.
+ */
+struct solo5_net_stats __solo5_net_stats[MFT_MAX_ENTRIES];
+struct solo5_block_stats __solo5_block_stats[MFT_MAX_ENTRIES];
+
+static solo5_handle_set_t net_handles, block_handles;
+
+void stats_acquire(solo5_handle_t handle, enum mft_type type)
+{
+    assert(handle < MFT_MAX_ENTRIES);
+    if (type == MFT_NET_BASIC)
+        net_handles |= 1ULL << handle;
+    else if (type == MFT_BLOCK_BASIC)
+        block_handles |= 1ULL << handle;
+}
+
+bool stats_acquired(solo5_handle_t handle, enum mft_type type)
+{
+    if (handle >= MFT_MAX_ENTRIES)
+        return false;
+    if (type == MFT_NET_BASIC)
+        return net_handles & (1ULL << handle);
+    else if (type == MFT_BLOCK_BASIC)
+        return block_handles & (1ULL << handle);
+    else
+        return false;
+}
+
+solo5_result_t solo5_net_stats(solo5_handle_t handle,
+        struct solo5_net_stats *stats)
+{
+    if (!stats_acquired(handle, MFT_NET_BASIC))
+        return SOLO5_R_EINVAL;
+    *stats = __solo5_net_stats[handle];
+    return SOLO5_R_OK;
+}
+
+solo5_result_t solo5_block_stats(solo5_handle_t handle,
+        struct solo5_block_stats *stats)
+{
+    if (!stats_acquired(handle, MFT_BLOCK_BASIC))
+        return SOLO5_R_EINVAL;
+    struct solo5_block_stats *s = &__solo5_block_stats[handle];
+    stats->read_ops = __atomic_load_n(&s->read_ops, __ATOMIC_RELAXED);
+    stats->read_bytes = __atomic_load_n(&s->read_bytes, __ATOMIC_RELAXED);
+    stats->write_ops = __atomic_load_n(&s->write_ops, __ATOMIC_RELAXED);
+    stats->write_bytes = __atomic_load_n(&s->write_bytes, __ATOMIC_RELAXED);
+    stats->flush_ops = __atomic_load_n(&s->flush_ops, __ATOMIC_RELAXED);
+    stats->discard_ops = __atomic_load_n(&s->discard_ops, __ATOMIC_RELAXED);
+    stats->errors = __atomic_load_n(&s->errors, __ATOMIC_RELAXED);
+    return SOLO5_R_OK;
+}
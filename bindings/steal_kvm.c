@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * steal_kvm.c: Steal time, as reported by KVM.
+ *
+ * If the host advertises KVM_FEATURE_STEAL_TIME in the KVM CPUID leaves, each
+ * CPU gives KVM the address of a record with MSR_KVM_STEAL_TIME, in which KVM
+ * accumulates the time the VCPU thread has been runnable but waiting for a
+ * host CPU, each time it enters the guest. Reading the record does not exit
+ * to the host.
+ */
+
+#include "bindings.h"
+
+#if defined(__x86_64__)
+
+#define KVM_CPUID_SIGNATURE         0x40000000
+#define KVM_CPUID_FEATURES          0x40000001
+#define KVM_FEATURE_STEAL_TIME      (1U << 5)
+#define MSR_KVM_STEAL_TIME          0x4b564d03
+#define KVM_MSR_ENABLED             1ULL
+
+/*
+ * Layout defined by KVM; (version) is odd while KVM is updating the record.
+ */
+struct kvm_steal_time {
+    uint64_t steal;
+    uint32_t version;
+    uint32_t flags;
+    uint8_t preempted;
+    uint8_t pad0[3];
+    uint32_t pad1[11];
+};
+
+static struct kvm_steal_time steal_time[CPU_TIME_CPUS_MAX]
+    __attribute__((aligned(64)));
+static bool steal_registered[CPU_TIME_CPUS_MAX];
+static bool steal_enabled;
+
+static bool steal_probe(void)
+{
+    uint32_t eax, ebx, ecx, edx;
+
+    x86_cpuid(KVM_CPUID_SIGNATURE, &eax, &ebx, &ecx, &edx);
+    /* "KVMKVMKVM\0\0\0" */
+    if (eax < KVM_CPUID_FEATURES || ebx != 0x4b4d564b ||
+            ecx != 0x564b4d56 || edx != 0x4d)
+        return false;
+    x86_cpuid(KVM_CPUID_FEATURES, &eax, &ebx, &ecx, &edx);
+    return (eax & KVM_FEATURE_STEAL_TIME) != 0;
+}
+
+static void steal_setup_cpu(unsigned cpu)
+{
+    if (cpu >= CPU_TIME_CPUS_MAX)
+        return;
+    cpu_wrmsr(MSR_KVM_STEAL_TIME,
+            (uint64_t)(uintptr_t)&steal_time[cpu] | KVM_MSR_ENABLED);
+    __atomic_store_n(&steal_registered[cpu], true, __ATOMIC_RELEASE);
+}
+
+void steal_init(void)
+{
+    steal_enabled = steal_probe();
+    if (steal_enabled)
+        steal_setup_cpu(0);
+}
+
+void steal_init_secondary(unsigned cpu)
+{
+    if (steal_enabled)
+        steal_setup_cpu(cpu);
+}
+
+/*
+ * The host restoring a snapshot knows nothing of the record, and may not
+ * support it at all. KVM adds to the (steal) already in the record, so the
+ * total carries over.
+ */
+void steal_restore(void)
+{
+    steal_registered[0] = false;
+    steal_init();
+}
+
+bool platform_cpu_steal(unsigned cpu, solo5_time_t *steal)
+{
+    if (cpu >= CPU_TIME_CPUS_MAX ||
+            !__atomic_load_n(&steal_registered[cpu], __ATOMIC_ACQUIRE))
+        return false;
+
+    volatile struct kvm_steal_time *st = &steal_time[cpu];
+    uint32_t version;
+    uint64_t value;
+    do {
+        version = st->version;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        value = st->steal;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((version & 1) || version != st->version);
+    *steal = value;
+    return true;
+}
+
+#else /* !__x86_64__ */
+
+void steal_init(void)
+{
+}
+
+void steal_init_secondary(unsigned cpu)
+{
+    (void)cpu;
+}
+
+void steal_restore(void)
+{
+}
+
+bool platform_cpu_steal(unsigned cpu, solo5_time_t *steal)
+{
+    (void)cpu;
+    (void)steal;
+    return false;
+}
+
+#endif
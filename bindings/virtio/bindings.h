@@ -30,10 +30,17 @@
 
 #include "../bindings.h"
 #include "multiboot.h"
+#include "pvh.h"
+
+/* platform.c: start of device memory, following guest memory */
+uint64_t platform_mmio_start(void);
 
 /* serial.c: console output for debugging */
 void serial_init(void);
-void serial_putc(char a);
+void serial_puts(const char *buf, size_t n);
+
+/* virtio_console.c: console output, if a virtio console is present */
+bool virtio_console_write(const char *buf, size_t size);
 
 void time_init(void);
 
@@ -41,32 +48,64 @@ void time_init(void);
 int pvclock_init(void);
 uint64_t pvclock_monotonic(void);
 uint64_t pvclock_epochoffset(void);
+uint64_t pvclock_tsc_freq(void);
 
 /* tscclock.c: TSC/PIT-based clock and sleep */
 int tscclock_init(void);
 uint64_t tscclock_monotonic(void);
 uint64_t tscclock_epochoffset(void);
+uint64_t tscclock_freq(void);
 void cpu_block(uint64_t until);
+void pit_periodic(unsigned hz);
+
+/* lapic.c: local APIC TSC-deadline timer and MSI-X interrupts */
+int lapic_init(void);
+int lapic_timer_init(uint64_t tsc_freq);
+bool lapic_timer_arm(uint64_t delta_ns);
+int lapic_msi_alloc(int (*handler)(void *), void *arg, uint64_t *addr,
+        uint32_t *data);
+void lapic_msi_handler(uint64_t n);
+
+/* profile.c: sampling profiler (--solo5:profile) */
+void profile_init(void);
+void profile_sample(const uint64_t *iret_frame, uint64_t rbp);
+void profile_dump(void);
 
-/* pci.c: only enumerate for now */
+/*
+ * pci.c: only enumerate for now. virtio-mmio devices are described with the
+ * same structure, with (mmio) set and (dev) their index on the command line.
+ */
 struct pci_config_info {
     uint8_t bus;
     uint8_t dev;
     uint16_t vendor_id;
+    uint16_t device_id;
     uint16_t subsys_id;
-    uint16_t base;
+    uint16_t base;              /* I/O port BAR0, or 0 if none */
     uint8_t irq;
+    uint64_t mmio;              /* virtio-mmio registers, or 0 if PCI */
 };
 
 void pci_enumerate(void);
+bool virtio_config_device(struct pci_config_info *pci, uint16_t type);
+uint32_t pci_config_read32(const struct pci_config_info *pci, uint8_t off);
+void pci_config_write16(const struct pci_config_info *pci, uint8_t off,
+        uint16_t val);
+
+/* virtio_mmio.c: virtio-mmio devices given on the command line */
+void virtio_mmio_cmdline(char *cmdline);
+int virtio_mmio_enumerate(void);
 
-/* virtio.c: mostly net for now */
+/* virtio_net.c, virtio_blk.c */
+#define VIRTIO_NET_DEVICES_MAX 4
+#define VIRTIO_BLK_DEVICES_MAX 4
 void virtio_config_network(struct pci_config_info *);
 void virtio_config_block(struct pci_config_info *);
+void virtio_config_console(struct pci_config_info *);
+void virtio_config_balloon(struct pci_config_info *);
+void virtio_config_vsock(struct pci_config_info *);
 
-uint8_t *virtio_net_pkt_get(size_t *size);  /* get a pointer to recv'd data */
-void virtio_net_pkt_put(void);      /* we're done with recv'd data */
-int virtio_net_xmit_packet(const void *data, size_t len);
-int virtio_net_pkt_poll(void);      /* test if packet(s) are available */
+solo5_handle_set_t virtio_blk_ready_set(void); /* completed async I/O */
+solo5_handle_set_t virtio_vsock_ready_set(void); /* vsock streams */
 
 #endif /* __VIRTIO_BINDINGS_H__ */
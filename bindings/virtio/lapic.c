@@ -0,0 +1,177 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * lapic.c: Local APIC TSC-deadline timer and MSI-X interrupts.
+ *
+ * If the CPU supports x2APIC mode and TSC-deadline mode for the local APIC
+ * timer, cpu_block() arms the timer with a single MSR write, instead of
+ * programming the PIT with several port I/O writes. The PIT remains
+ * programmed as it was, and legacy IRQs are still delivered through the PIC,
+ * which the BIOS connects to LINT0.
+ *
+ * In x2APIC mode, devices may also interrupt the CPU directly with MSI-X
+ * messages, each on a vector of its own, which needs neither sharing nor the
+ * PIC.
+ */
+
+#include "bindings.h"
+
+#define MSR_IA32_APIC_BASE      0x1b
+#define MSR_IA32_TSC_DEADLINE   0x6e0
+#define MSR_X2APIC_ID           0x802
+#define MSR_X2APIC_EOI          0x80b
+#define MSR_X2APIC_SVR          0x80f
+#define MSR_X2APIC_LVT_TIMER    0x832
+
+#define APIC_BASE_EXTD          (1ULL << 10)    /* x2APIC mode */
+#define APIC_BASE_EN            (1ULL << 11)
+#define APIC_SVR_ENABLE         (1U << 8)
+#define APIC_SVR_VECTOR         0xff
+#define LVT_TIMER_TSC_DEADLINE  (2U << 17)
+
+#define CPUID_1_ECX_X2APIC      (1U << 21)
+#define CPUID_1_ECX_TSC_DEADLINE (1U << 24)
+
+/*
+ * Interrupt vector used for the timer, just above those used for legacy
+ * IRQs.
+ */
+#define LAPIC_TIMER_VECTOR      48
+
+/* Interrupt vectors used for MSI-X, up to the end of the IDT. */
+#define LAPIC_MSI_VECTOR        49
+#define LAPIC_MSI_VECTORS       (IDT_NUM_ENTRIES - LAPIC_MSI_VECTOR)
+
+/* MSI address of the local APIC with ID (id) */
+#define LAPIC_MSI_ADDR(id)      (0xfee00000ULL | ((uint64_t)(id) << 12))
+
+/*
+ * The timer is armed at most this far ahead, so that the deadline computed
+ * below cannot overflow; cpu_block() is called in a loop until the deadline.
+ */
+#define LAPIC_TIMER_MAX_NSECS   NSEC_PER_SEC
+
+extern void lapic_timer_intr(void);
+extern void (*const lapic_msi_intrs[])(void);
+
+static bool lapic_enabled;
+static bool lapic_timer_enabled;
+
+struct lapic_msi {
+    int (*handler)(void *);
+    void *arg;
+};
+
+static struct lapic_msi lapic_msis[LAPIC_MSI_VECTORS];
+static unsigned lapic_nmsis;
+
+/* Multiplier for converting nsecs to TSC ticks. (32.32) fixed point. */
+static uint64_t tsc_per_nsec;
+
+/*
+ * Switch the local APIC to x2APIC mode, returning 0 if the CPU supports it.
+ * Must be called before the timer or MSI-X vectors are set up.
+ */
+int lapic_init(void)
+{
+    uint32_t eax, ebx, ecx, edx;
+
+    x86_cpuid(1, &eax, &ebx, &ecx, &edx);
+    if (!(ecx & CPUID_1_ECX_X2APIC))
+        return -1;
+
+    uint64_t base = cpu_rdmsr(MSR_IA32_APIC_BASE);
+    cpu_wrmsr(MSR_IA32_APIC_BASE, base | APIC_BASE_EN | APIC_BASE_EXTD);
+    cpu_wrmsr(MSR_X2APIC_SVR, APIC_SVR_ENABLE | APIC_SVR_VECTOR);
+    lapic_enabled = true;
+    return 0;
+}
+
+/*
+ * Enable the timer, given the TSC frequency (tsc_freq), returning 0 if it can
+ * be used.
+ */
+int lapic_timer_init(uint64_t tsc_freq)
+{
+    uint32_t eax, ebx, ecx, edx;
+
+    if (!lapic_enabled || tsc_freq == 0)
+        return -1;
+    x86_cpuid(1, &eax, &ebx, &ecx, &edx);
+    if (!(ecx & CPUID_1_ECX_TSC_DEADLINE))
+        return -1;
+
+    tsc_per_nsec = (tsc_freq << 32) / NSEC_PER_SEC;
+    cpu_intr_set_vector(LAPIC_TIMER_VECTOR, lapic_timer_intr);
+    cpu_wrmsr(MSR_X2APIC_LVT_TIMER, LVT_TIMER_TSC_DEADLINE |
+            LAPIC_TIMER_VECTOR);
+    lapic_timer_enabled = true;
+    return 0;
+}
+
+/*
+ * Arm the timer to interrupt the CPU after (delta_ns), or after
+ * LAPIC_TIMER_MAX_NSECS if less. Returns false if the timer is not enabled.
+ */
+bool lapic_timer_arm(uint64_t delta_ns)
+{
+    if (!lapic_timer_enabled)
+        return false;
+
+    if (delta_ns > LAPIC_TIMER_MAX_NSECS)
+        delta_ns = LAPIC_TIMER_MAX_NSECS;
+    uint64_t ticks = ((unsigned __int128)delta_ns * tsc_per_nsec) >> 32;
+    cpu_wrmsr(MSR_IA32_TSC_DEADLINE, cpu_rdtsc() + ticks + 1);
+    return true;
+}
+
+/*
+ * Allocate an interrupt vector for (handler), which is called with (arg) in
+ * interrupt context, and may be NULL if the interrupt only needs to wake the
+ * CPU from cpu_block(). Returns the MSI address and data a device should use
+ * to raise it in (*addr) and (*data), or -1 if the local APIC is not enabled
+ * or there are no vectors left.
+ */
+int lapic_msi_alloc(int (*handler)(void *), void *arg, uint64_t *addr,
+        uint32_t *data)
+{
+    if (!lapic_enabled || lapic_nmsis == LAPIC_MSI_VECTORS)
+        return -1;
+
+    unsigned n = lapic_nmsis++;
+    lapic_msis[n].handler = handler;
+    lapic_msis[n].arg = arg;
+    cpu_intr_set_vector(LAPIC_MSI_VECTOR + n, lapic_msi_intrs[n]);
+
+    *addr = LAPIC_MSI_ADDR(cpu_rdmsr(MSR_X2APIC_ID));
+    *data = LAPIC_MSI_VECTOR + n;
+    return 0;
+}
+
+/* WARNING: called in interrupt context */
+void lapic_msi_handler(uint64_t n)
+{
+    struct lapic_msi *m = &lapic_msis[n];
+
+    if (m->handler != NULL)
+        m->handler(m->arg);
+    cpu_wrmsr(MSR_X2APIC_EOI, 0);
+}
@@ -39,8 +39,8 @@
 #define PCI_CONF_IRQ_SHFT 0x0
 #define PCI_CONF_IRQ_MASK 0xff
 
-#define PCI_CONF_IOBAR      0x10
-#define PCI_CONF_IOBAR_SHFT 0x0
+#define PCI_CONF_BAR0       0x10
+#define PCI_CONF_BAR_IO     0x1
 #define PCI_CONF_IOBAR_MASK ~0x3
 
 
@@ -53,39 +53,121 @@
 } while (0)
 
 
+static uint32_t pci_config_addr(const struct pci_config_info *pci,
+        uint8_t off)
+{
+    return PCI_ENABLE_BIT | ((uint32_t)pci->bus << PCI_BUS_SHIFT) |
+        ((uint32_t)pci->dev << PCI_DEVICE_SHIFT) | (off & ~0x3);
+}
+
+uint32_t pci_config_read32(const struct pci_config_info *pci, uint8_t off)
+{
+    outl(PCI_CONFIG_ADDR, pci_config_addr(pci, off));
+    return inl(PCI_CONFIG_DATA);
+}
+
+void pci_config_write16(const struct pci_config_info *pci, uint8_t off,
+        uint16_t val)
+{
+    outl(PCI_CONFIG_ADDR, pci_config_addr(pci, off));
+    outw(PCI_CONFIG_DATA + (off & 0x2), val);
+}
+
 static uint32_t net_devices_found;
 static uint32_t blk_devices_found;
+static uint32_t console_devices_found;
+static uint32_t balloon_devices_found;
+static uint32_t vsock_devices_found;
 
 #define PCI_CONF_SUBSYS_NET 1
 #define PCI_CONF_SUBSYS_BLK 2
+#define PCI_CONF_SUBSYS_CONSOLE 3
+#define PCI_CONF_SUBSYS_BALLOON 5
+#define PCI_CONF_SUBSYS_VSOCK 19
+
+/*
+ * Transitional devices (0x1000 to 0x103f) give the virtio device type in their
+ * subsystem ID, modern-only devices as an offset from 0x1040 in their device
+ * ID.
+ */
+#define PCI_DEVICE_ID_VIRTIO_MODERN 0x1040
+
+/*
+ * Configures virtio device (pci) of type (type), if it is supported and we
+ * have room for it. Returns false otherwise.
+ *
+ * We support up to VIRTIO_NET_DEVICES_MAX net devices and
+ * VIRTIO_BLK_DEVICES_MAX blk devices, one console device, one balloon
+ * device and one vsock device.
+ */
+bool virtio_config_device(struct pci_config_info *pci, uint16_t type)
+{
+    switch (type) {
+    case PCI_CONF_SUBSYS_NET:
+        if (net_devices_found++ >= VIRTIO_NET_DEVICES_MAX)
+            return false;
+        virtio_config_network(pci);
+        return true;
+    case PCI_CONF_SUBSYS_BLK:
+        if (blk_devices_found++ >= VIRTIO_BLK_DEVICES_MAX)
+            return false;
+        virtio_config_block(pci);
+        return true;
+    case PCI_CONF_SUBSYS_CONSOLE:
+        if (console_devices_found++)
+            return false;
+        virtio_config_console(pci);
+        return true;
+    case PCI_CONF_SUBSYS_BALLOON:
+        if (balloon_devices_found++)
+            return false;
+        virtio_config_balloon(pci);
+        return true;
+    case PCI_CONF_SUBSYS_VSOCK:
+        if (vsock_devices_found++)
+            return false;
+        virtio_config_vsock(pci);
+        return true;
+    default:
+        return false;
+    }
+}
 
 static void virtio_config(struct pci_config_info *pci)
 {
-    /* we only support one net device and one blk device */
-    switch (pci->subsys_id) {
+    uint16_t type = pci->subsys_id;
+    const char *name;
+
+    if (pci->device_id >= PCI_DEVICE_ID_VIRTIO_MODERN)
+        type = pci->device_id - PCI_DEVICE_ID_VIRTIO_MODERN;
+
+    switch (type) {
     case PCI_CONF_SUBSYS_NET:
-        log(INFO, "Solo5: PCI:%02x:%02x: virtio-net device, base=0x%x, irq=%u\n",
-            pci->bus, pci->dev, pci->base, pci->irq);
-        if (!net_devices_found++)
-            virtio_config_network(pci);
-        else
-            log(WARN, "Solo5: PCI:%02x:%02x: not configured\n", pci->bus,
-                pci->dev);
+        name = "virtio-net";
         break;
     case PCI_CONF_SUBSYS_BLK:
-        log(INFO, "Solo5: PCI:%02x:%02x: virtio-block device, base=0x%x, irq=%u\n",
-            pci->bus, pci->dev, pci->base, pci->irq);
-        if (!blk_devices_found++)
-            virtio_config_block(pci);
-        else
-            log(WARN, "Solo5: PCI:%02x:%02x: not configured\n", pci->bus,
-                pci->dev);
+        name = "virtio-block";
+        break;
+    case PCI_CONF_SUBSYS_CONSOLE:
+        name = "virtio-console";
+        break;
+    case PCI_CONF_SUBSYS_BALLOON:
+        name = "virtio-balloon";
+        break;
+    case PCI_CONF_SUBSYS_VSOCK:
+        name = "virtio-vsock";
         break;
     default:
         log(WARN, "Solo5: PCI:%02x:%02x: unknown virtio device (0x%x)\n",
-            pci->bus, pci->dev, pci->subsys_id);
+            pci->bus, pci->dev, type);
         return;
     }
+
+    log(INFO, "Solo5: PCI:%02x:%02x: %s device, base=0x%x, irq=%u\n",
+        pci->bus, pci->dev, name, pci->base, pci->irq);
+    if (!virtio_config_device(pci, type))
+        log(WARN, "Solo5: PCI:%02x:%02x: not configured\n", pci->bus,
+            pci->dev);
 }
 
 #define VENDOR_QUMRANET_VIRTIO 0x1af4
@@ -110,11 +192,19 @@ void pci_enumerate(void)
             pci.bus = bus;
             pci.dev = dev;
             pci.vendor_id = config_data & 0xffff;
+            pci.device_id = config_data >> 16;
+            pci.mmio = 0;
 
             if (pci.vendor_id == VENDOR_QUMRANET_VIRTIO) {
+                uint32_t bar0;
+
                 PCI_CONF_READ(uint16_t, &pci.subsys_id, config_addr, SUBSYS_ID);
-                PCI_CONF_READ(uint16_t, &pci.base, config_addr, IOBAR);
                 PCI_CONF_READ(uint8_t, &pci.irq, config_addr, IRQ);
+                bar0 = pci_config_read32(&pci, PCI_CONF_BAR0);
+                if (bar0 & PCI_CONF_BAR_IO)
+                    pci.base = bar0 & PCI_CONF_IOBAR_MASK;
+                else
+                    pci.base = 0;
 
                 virtio_config(&pci);
             }
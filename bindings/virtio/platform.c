@@ -19,50 +19,59 @@
  */
 
 #include "bindings.h"
+#include "virtio_pci.h"
 
 static char cmdline[8192];
 
 #define PLATFORM_MEM_START 0x100000
-#define PLATFORM_MAX_MEM_SIZE 0x40000000
+#define PLATFORM_MAX_MEM_SIZE MMIO_END
+
+/* Page table entry bits */
+#define PT_P            (1ULL << 0)
+#define PT_RW           (1ULL << 1)
+#define PT_PS           (1ULL << 7)     /* 2MB (PDE) or 1GB (PDPTE) page */
+#define PT_PAGE_2M      (1ULL << 21)
+#define PT_PAGE_1G      (1ULL << 30)
 
 static uint64_t mem_size;
+static uint64_t mmio_start = PT_PAGE_1G;
 
-void platform_init(void *arg)
+static void cmdline_copy(const char *src)
 {
-    /*
-     * The multiboot structures may be anywhere in memory, so take a copy of
-     * the command line before we initialise memory allocation.
-     */
-    struct multiboot_info *mi = (struct multiboot_info *)arg;
+    size_t cmdline_len = strlen(src);
 
+    if (cmdline_len >= sizeof(cmdline)) {
+        cmdline_len = sizeof(cmdline) - 1;
+        log(WARN, "Solo5: warning: command line too long, truncated\n");
+    }
+    memcpy(cmdline, src, cmdline_len);
+    cmdline[cmdline_len] = 0;
+}
+
+/*
+ * Returns the end of the chunk of memory at PLATFORM_MEM_START, from the
+ * multiboot memory map.
+ */
+static uint64_t multiboot_init(struct multiboot_info *mi)
+{
     if (mi->flags & MULTIBOOT_INFO_CMDLINE) {
         char *mi_cmdline = (char *)(uint64_t)mi->cmdline;
-        size_t cmdline_len = strlen(mi_cmdline);
 
         /*
          * Skip the first token in the cmdline as it is an opaque "name" for
          * the kernel coming from the bootloader.
          */
-        for (; *mi_cmdline; mi_cmdline++, cmdline_len--) {
+        for (; *mi_cmdline; mi_cmdline++) {
             if (*mi_cmdline == ' ') {
                 mi_cmdline++;
-                cmdline_len--;
                 break;
             }
         }
-
-        if (cmdline_len >= sizeof(cmdline)) {
-            cmdline_len = sizeof(cmdline) - 1;
-            log(WARN, "Solo5: warning: command line too long, truncated\n");
-        }
-        memcpy(cmdline, mi_cmdline, cmdline_len);
+        cmdline_copy(mi_cmdline);
     } else {
         cmdline[0] = 0;
     }
 
-    /*
-     * Look for the first chunk of memory at PLATFORM_MEM_START.
-     */
     multiboot_memory_map_t *m;
     uint32_t offset;
 
@@ -75,14 +84,112 @@ void platform_init(void *arg)
         }
     }
     assert(offset < mi->mmap_length);
+    return m->addr + m->len;
+}
+
+/*
+ * As multiboot_init(), for the PVH boot protocol. The command line has no
+ * kernel name in front of it.
+ */
+static uint64_t pvh_init(struct hvm_start_info *si)
+{
+    if (si->cmdline_paddr != 0)
+        cmdline_copy((const char *)si->cmdline_paddr);
+    else
+        cmdline[0] = 0;
+
+    if (si->version < 1) {
+        log(ERROR, "Solo5: PVH boot without a memory map is not supported\n");
+        solo5_abort();
+    }
+
+    struct hvm_memmap_table_entry *m =
+        (struct hvm_memmap_table_entry *)si->memmap_paddr;
+    uint32_t i;
+
+    for (i = 0; i < si->memmap_entries; i++) {
+        if (m[i].addr == PLATFORM_MEM_START &&
+                m[i].type == XEN_HVM_MEMMAP_TYPE_RAM)
+            break;
+    }
+    assert(i < si->memmap_entries);
+    return m[i].addr + m[i].size;
+}
+
+/* pagetable.S */
+extern uint64_t cpu_pdpt[];
+extern uint64_t cpu_pd_mmio[];
+
+/*
+ * Returns true if the CPU supports 1GB pages (CPUID.80000001H:EDX.Page1GB).
+ */
+static bool cpu_has_1g_pages(void)
+{
+    uint32_t eax, ebx, ecx, edx;
+
+    x86_cpuid(0x80000000, &eax, &ebx, &ecx, &edx);
+    if (eax < 0x80000001)
+        return false;
+    x86_cpuid(0x80000001, &eax, &ebx, &ecx, &edx);
+    return (edx & (1U << 26)) != 0;
+}
+
+/*
+ * The page tables in pagetable.S map the first 1GB as memory and the rest of
+ * the first 4GB uncached, for device memory. Now that we know where memory
+ * ends, remap that beyond the first 1GB as memory, with 1GB pages if the CPU
+ * supports them, and 2MB pages up to the 2MB boundary below its end. Device
+ * memory then starts at that boundary.
+ */
+static void pagetable_init(void)
+{
+    if (mem_size <= PT_PAGE_1G)
+        return;
+
+    mem_size &= ~(PT_PAGE_2M - 1);
+    mmio_start = mem_size;
+    for (uint64_t addr = PT_PAGE_1G; addr < mem_size; addr += PT_PAGE_2M)
+        cpu_pd_mmio[(addr - PT_PAGE_1G) / PT_PAGE_2M] =
+            addr | PT_P | PT_RW | PT_PS;
+    if (cpu_has_1g_pages()) {
+        for (uint64_t addr = PT_PAGE_1G; addr + PT_PAGE_1G <= mem_size;
+                addr += PT_PAGE_1G)
+            cpu_pdpt[addr / PT_PAGE_1G] = addr | PT_P | PT_RW | PT_PS;
+    }
+
+    /* Flush the TLB. */
+    uint64_t cr3;
+    __asm__ __volatile__("mov %%cr3, %0" : "=r"(cr3));
+    __asm__ __volatile__("mov %0, %%cr3" :: "r"(cr3) : "memory");
+}
+
+void platform_init(void *arg)
+{
+    /*
+     * The boot information may be anywhere in memory, so take a copy of the
+     * command line before we initialise memory allocation. PVH start info
+     * begins with a magic value which no multiboot flags can have.
+     */
+    if (*(uint32_t *)arg == XEN_HVM_START_MAGIC_VALUE)
+        mem_size = pvh_init(arg);
+    else
+        mem_size = multiboot_init(arg);
 
     /*
      * Cap our memory size to PLATFORM_MAX_MEM_SIZE which boot.S defines page
-     * tables for.
+     * tables for. In practice the chunk of memory we use ends well below
+     * that, where the monitor places device memory; memory beyond 4GB is a
+     * separate chunk, and is not used.
      */
-    mem_size = m->addr + m->len;
     if (mem_size > PLATFORM_MAX_MEM_SIZE)
         mem_size = PLATFORM_MAX_MEM_SIZE;
+    pagetable_init();
+
+    /*
+     * Devices described on the command line by the monitor are not meant
+     * for the application.
+     */
+    virtio_mmio_cmdline(cmdline);
 
     platform_intr_init();
 }
@@ -97,9 +204,16 @@ uint64_t platform_mem_size(void)
     return mem_size;
 }
 
+uint64_t platform_mmio_start(void)
+{
+    return mmio_start;
+}
+
 void platform_exit(int status __attribute__((unused)),
     void *cookie __attribute__((unused)))
 {
+    profile_dump();
+
     /*
      * Poke the QEMU "isa-debug-exit" device to "shutdown". Should be harmless
      * if it is not present. This is used to enable automated tests on virtio.
@@ -117,17 +231,45 @@ void platform_exit(int status __attribute__((unused)),
 
 int platform_puts(const char *buf, int n)
 {
-    int i;
-
-    for (i = 0; i < n; i++)
-        serial_putc(buf[i]);
+    if (!virtio_console_write(buf, n))
+        serial_puts(buf, n);
 
     return n;
 }
 
 void solo5_console_write(const char *buf, size_t size)
 {
-    (void)platform_puts(buf, size);
+    console_write(buf, size);
+}
+
+unsigned solo5_cpu_count(void)
+{
+    return 1;
+}
+
+solo5_result_t solo5_cpu_start(unsigned cpu __attribute__((unused)),
+        solo5_cpu_entry_t entry __attribute__((unused)),
+        void *arg __attribute__((unused)),
+        uintptr_t stack __attribute__((unused)),
+        uintptr_t tls_base __attribute__((unused)))
+{
+    return SOLO5_R_EINVAL;
+}
+
+solo5_result_t solo5_snapshot(void)
+{
+    return SOLO5_R_EUNSPEC;
+}
+
+void solo5_trace(uint32_t id __attribute__((unused)),
+        uint64_t arg0 __attribute__((unused)),
+        uint64_t arg1 __attribute__((unused)))
+{
+}
+
+solo5_handle_set_t platform_net_writable_set(void)
+{
+    return 0;
 }
 
 int platform_set_tls_base(uint64_t base)
@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * profile.c: Sampling profiler, enabled with --solo5:profile.
+ *
+ * The PIT, unused once cpu_block() uses the local APIC timer, interrupts the
+ * CPU PROFILE_HZ times a second. Each interrupt records the interrupted %rip
+ * and the return addresses found by following the chain of frame pointers
+ * from %rbp, in a ring of the most recent PROFILE_SAMPLES samples. When the
+ * unikernel exits, the samples are written to the console as folded stacks
+ * of addresses, one line per sample prefixed with "solo5-profile: ".
+ *
+ * Callers are only found for code built with -fno-omit-frame-pointer.
+ */
+
+#include "bindings.h"
+
+#define PROFILE_HZ          99
+#define PROFILE_DEPTH       16
+#define PROFILE_SAMPLES     4096
+#define PROFILE_IRQ         0
+#define PROFILE_VECTOR      32          /* PIC IRQ 0, see platform_intr.c */
+
+struct profile_sample {
+    uint64_t pc[PROFILE_DEPTH];         /* Innermost first, 0-terminated */
+};
+
+extern void profile_intr(void);
+
+static struct profile_sample *samples;
+static uint64_t nsamples;
+
+void profile_init(void)
+{
+    size_t npages = (PROFILE_SAMPLES * sizeof (struct profile_sample) +
+            PAGE_SIZE - 1) / PAGE_SIZE;
+
+    samples = mem_ialloc_pages(npages);
+    cpu_intr_set_vector(PROFILE_VECTOR, profile_intr);
+    pit_periodic(PROFILE_HZ);
+    platform_intr_clear_irq(PROFILE_IRQ);
+    log(INFO, "Solo5: Profiling at %d Hz\n", PROFILE_HZ);
+}
+
+/* WARNING: called in interrupt context */
+void profile_sample(const uint64_t *iret_frame, uint64_t rbp)
+{
+    struct profile_sample *s = &samples[nsamples % PROFILE_SAMPLES];
+    uint64_t mem_size = platform_mem_size();
+    unsigned n = 0;
+
+    s->pc[n++] = iret_frame[0];
+    /*
+     * Each frame holds the caller's %rbp, followed by the return address.
+     * Stop at anything which does not look like the next frame up the
+     * stack, as the interrupted code may not use frame pointers.
+     */
+    while (n < PROFILE_DEPTH - 1 && rbp >= PAGE_SIZE && (rbp & 7) == 0 &&
+            rbp <= mem_size - 16) {
+        const uint64_t *frame = (const uint64_t *)rbp;
+
+        if (frame[1] == 0)
+            break;
+        s->pc[n++] = frame[1];
+        if (frame[0] <= rbp)
+            break;
+        rbp = frame[0];
+    }
+    s->pc[n] = 0;
+    nsamples++;
+
+    platform_intr_ack_irq(PROFILE_IRQ);
+}
+
+void profile_dump(void)
+{
+    char line[PROFILE_DEPTH * 19 + 32];
+    uint64_t first;
+
+    if (samples == NULL)
+        return;
+    platform_intr_mask_irq(PROFILE_IRQ);
+
+    first = nsamples > PROFILE_SAMPLES ? nsamples - PROFILE_SAMPLES : 0;
+    log(INFO, "Solo5: Profile: %llu samples, writing the last %llu\n",
+            (unsigned long long)nsamples,
+            (unsigned long long)(nsamples - first));
+    for (uint64_t i = first; i < nsamples; i++) {
+        struct profile_sample *s = &samples[i % PROFILE_SAMPLES];
+        size_t len = 0;
+        int n;
+
+        for (n = 0; n < PROFILE_DEPTH && s->pc[n] != 0; n++)
+            ;
+        len += snprintf(line, sizeof line, "solo5-profile: ");
+        /* Folded stacks are outermost first. */
+        while (n-- > 0)
+            len += snprintf(line + len, sizeof line - len, "0x%llx%s",
+                    (unsigned long long)s->pc[n], n > 0 ? ";" : " 1\n");
+        console_write(line, len);
+    }
+}
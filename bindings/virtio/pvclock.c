@@ -77,23 +77,6 @@ struct pvclock_wall_clock {
 static volatile struct pvclock_vcpu_time_info pvclock_ti;
 static volatile struct pvclock_wall_clock pvclock_wc;
 
-static inline void
-x86_cpuid(uint32_t level, uint32_t *eax_out, uint32_t *ebx_out,
-        uint32_t *ecx_out, uint32_t *edx_out)
-{
-    uint32_t eax_, ebx_, ecx_, edx_;
-
-    __asm__(
-        "cpuid"
-        : "=a" (eax_), "=b" (ebx_), "=c" (ecx_), "=d" (edx_)
-        : "0" (level)
-    );
-    *eax_out = eax_;
-    *ebx_out = ebx_;
-    *ecx_out = ecx_;
-    *edx_out = edx_;
-}
-
 uint64_t pvclock_monotonic(void) {
     uint32_t version;
     uint64_t delta, time_now;
@@ -178,3 +161,20 @@ int pvclock_init(void) {
 uint64_t pvclock_epochoffset(void) {
 	return wc_epochoffset;
 }
+
+/*
+ * Return TSC frequency, Hz, as implied by the scaling factors supplied by the
+ * hypervisor, or 0 if they are not known.
+ */
+uint64_t pvclock_tsc_freq(void) {
+    uint32_t mul = pvclock_ti.tsc_to_system_mul;
+    int8_t shift = pvclock_ti.tsc_shift;
+
+    if (mul == 0)
+        return 0;
+    /*
+     * nsecs = ((tsc << tsc_shift) * tsc_to_system_mul) >> 32
+     */
+    uint64_t freq = (NSEC_PER_SEC << 32) / mul;
+    return shift < 0 ? freq << -shift : freq >> shift;
+}
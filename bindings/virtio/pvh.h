@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * pvh.h: Definitions for the x86 PVH direct boot protocol, as used by Xen and
+ * by monitors which load the kernel themselves (Firecracker, Cloud
+ * Hypervisor, QEMU with -kernel). The monitor finds the 32-bit entry point in
+ * a XEN_ELFNOTE_PHYS32_ENTRY note, and enters it in protected mode with
+ * paging disabled and %ebx pointing to struct hvm_start_info.
+ */
+
+#ifndef PVH_H
+#define PVH_H
+
+#define XEN_ELFNOTE_PHYS32_ENTRY        18
+#define XEN_HVM_START_MAGIC_VALUE       0x336ec578
+
+#ifndef ASM_FILE
+
+struct hvm_start_info {
+    uint32_t magic;                     /* XEN_HVM_START_MAGIC_VALUE */
+    uint32_t version;
+    uint32_t flags;
+    uint32_t nr_modules;
+    uint64_t modlist_paddr;
+    uint64_t cmdline_paddr;             /* C string, or 0 */
+    uint64_t rsdp_paddr;
+    /* Version 1 and later */
+    uint64_t memmap_paddr;
+    uint32_t memmap_entries;
+    uint32_t reserved;
+};
+
+#define XEN_HVM_MEMMAP_TYPE_RAM         1
+
+struct hvm_memmap_table_entry {
+    uint64_t addr;
+    uint64_t size;
+    uint32_t type;
+    uint32_t reserved;
+};
+
+#endif /* !ASM_FILE */
+
+#endif /* PVH_H */
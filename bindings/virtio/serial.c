@@ -24,6 +24,7 @@
 
 #define COM1_DATA   (COM1 + 0)
 #define COM1_INTR   (COM1 + 1)
+#define COM1_FIFO   (COM1 + 2)
 #define COM1_CTRL   (COM1 + 3)
 #define COM1_STATUS (COM1 + 5)
 
@@ -33,6 +34,13 @@
 
 #define DLAB 0x80
 #define PROT 0x03 /* 8N1 (8 bits, no parity, one stop bit) */
+#define FIFO 0x07 /* Enable and clear FIFOs */
+
+/*
+ * With FIFOs enabled, the transmitter is empty once it has sent everything in
+ * its FIFO, which can then take this many bytes at once.
+ */
+#define TX_FIFO_SIZE 16
 
 void serial_init(void)
 {
@@ -41,6 +49,7 @@ void serial_init(void)
 	outb(COM1_DIV_LO, 0x01);    /* Set divisor to 1 (lo byte) 115200 baud */
 	outb(COM1_DIV_HI, 0x00);    /*                  (hi byte) */
 	outb(COM1_CTRL, PROT);      /* Set 8N1, clear DLAB */
+	outb(COM1_FIFO, FIFO);      /* Enable FIFOs */
 }
 
 
@@ -49,17 +58,26 @@ static int serial_tx_empty(void)
 	return inb(COM1_STATUS) & 0x20;
 }
 
-static void serial_write(char a)
+/*
+ * Write (n) bytes from (buf), polling the transmitter only once per
+ * TX_FIFO_SIZE bytes rather than before each byte.
+ */
+void serial_puts(const char *buf, size_t n)
 {
-    while (!serial_tx_empty())
-        ;
-
-    outb(COM1_DATA, a);
-}
+    size_t i = 0;
 
-void serial_putc(char a)
-{
-    if (a == '\n')
-        serial_write('\r');
-    serial_write(a);
+    while (i < n) {
+        while (!serial_tx_empty())
+            ;
+        for (int room = TX_FIFO_SIZE; room > 0 && i < n; room--) {
+            if (buf[i] == '\n') {
+                /* Send '\r' now and '\n' in the next slot, if any. */
+                if (room < 2)
+                    break;
+                outb(COM1_DATA, '\r');
+                room--;
+            }
+            outb(COM1_DATA, buf[i++]);
+        }
+    }
 }
@@ -38,6 +38,8 @@ void _start(void *arg)
     while (gdb == 0)
         ;
 
+    cpu_enable_fsgsbase();
+    cpu_enable_xsave();
     cpu_init();
     platform_init(arg);
 
@@ -61,8 +63,16 @@ static void _start2(void *arg __attribute__((unused)))
     log(INFO, "____/\\___/ _|\\___/____/\n");
 
     mem_init();
+    lapic_init();
     time_init();
-    pci_enumerate();
+    steal_init();
+    cpu_time_start(0);
+    /*
+     * PCI enumeration takes thousands of port I/O exits, which is a large
+     * part of the boot time of a minimal monitor with only virtio-mmio.
+     */
+    if (virtio_mmio_enumerate() == 0)
+        pci_enumerate();
     cpu_intr_enable();
 
     struct mft *mft = &__solo5_manifest_note.m;
@@ -73,5 +83,7 @@ static void _start2(void *arg __attribute__((unused)))
     }
 
     mem_lock_heap(&si.heap_start, &si.heap_size);
+    mem_huge_heap(&si.heap_huge_start, &si.heap_huge_size);
+    console_flush();
     solo5_exit(solo5_app_main(&si));
 }
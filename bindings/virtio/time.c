@@ -23,7 +23,8 @@
 /*
  * The virtio target uses the KVM paravirtualized clock for timekeeping if
  * available, otherwise the TSC is used. CPU blocking-when-idle is performed
- * using the PIT via cpu_block() in tscclock.c.
+ * via cpu_block() in tscclock.c, using the local APIC TSC-deadline timer if
+ * available, otherwise the PIT.
  */
 static int use_pvclock;
 
@@ -59,4 +60,18 @@ void time_init(void)
 
     if (!use_pvclock)
         assert(tscclock_init() == 0);
+
+    uint64_t tsc_freq = use_pvclock ? pvclock_tsc_freq() : tscclock_freq();
+    if (lapic_timer_init(tsc_freq) == 0) {
+        log(INFO, "Solo5: Using local APIC TSC-deadline timer\n");
+        /*
+         * The PIT is now free for the profiler.
+         */
+        if (cmdline_profile)
+            profile_init();
+    }
+    else if (cmdline_profile) {
+        log(WARN, "Solo5: Profiling needs the local APIC TSC-deadline "
+                "timer, disabled\n");
+    }
 }
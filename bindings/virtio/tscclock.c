@@ -77,10 +77,16 @@ static uint64_t rtc_epochoffset;
  * TSC clock specific.
  */
 
-/* Base time values at the last call to tscclock_monotonic(). */
+/*
+ * Base time values, taken by tscclock_init() and not written afterwards, so
+ * that reading the clock does not dirty any shared cache lines.
+ */
 static uint64_t time_base;
 static uint64_t tsc_base;
 
+/* TSC frequency, Hz. */
+static uint64_t tsc_freq;
+
 /* Multiplier for converting TSC ticks to nsecs. (0.32) fixed point. */
 static uint32_t tsc_mult;
 
@@ -172,24 +178,52 @@ static uint64_t rtc_gettimeofday(void) {
  * Beturn monotonic time using TSC clock.
  */
 uint64_t tscclock_monotonic(void) {
-    uint64_t tsc_now, tsc_delta;
+    uint64_t tsc_delta = cpu_rdtsc() - tsc_base;
 
-    /*
-     * Update time_base (monotonic time) and tsc_base (TSC time).
-     */
-    tsc_now = cpu_rdtsc();
-    tsc_delta = tsc_now - tsc_base;
-    time_base += mul64_32(tsc_delta, tsc_mult, 32);
-    tsc_base = tsc_now;
+    return time_base + mul64_32(tsc_delta, tsc_mult, 32);
+}
 
-    return time_base;
+/*
+ * Return the TSC frequency as reported by CPUID, or 0 if it is not reported.
+ * Hypervisors which implement the generic timing leaf (0x40000010) report
+ * it there, otherwise Intel CPUs may report it in leaf 0x15 (as the ratio of
+ * the TSC to the core crystal clock) or, approximately, leaf 0x16 (as the
+ * base frequency of the processor).
+ */
+static uint64_t tsc_freq_cpuid(void) {
+    uint32_t eax, ebx, ecx, edx;
+
+    x86_cpuid(1, &eax, &ebx, &ecx, &edx);
+    if (ecx & (1U << 31)) {
+        x86_cpuid(0x40000000, &eax, &ebx, &ecx, &edx);
+        if (eax >= 0x40000010) {
+            x86_cpuid(0x40000010, &eax, &ebx, &ecx, &edx);
+            if (eax != 0)
+                return (uint64_t)eax * 1000;
+        }
+    }
+
+    x86_cpuid(0, &eax, &ebx, &ecx, &edx);
+    uint32_t max_leaf = eax;
+    if (max_leaf >= 0x15) {
+        x86_cpuid(0x15, &eax, &ebx, &ecx, &edx);
+        if (eax != 0 && ebx != 0 && ecx != 0)
+            return (uint64_t)ecx * ebx / eax;
+    }
+    if (max_leaf >= 0x16) {
+        x86_cpuid(0x16, &eax, &ebx, &ecx, &edx);
+        if ((eax & 0xffff) != 0)
+            return (uint64_t)(eax & 0xffff) * 1000000;
+    }
+    return 0;
 }
 
 /*
- * Calibrate TSC and initialise TSC clock.
+ * Initialise TSC clock, calibrating the TSC if its frequency is not reported
+ * by CPUID.
  */
 int tscclock_init(void) {
-    uint64_t tsc_freq, rtc_boot;
+    uint64_t rtc_boot;
 
     /* Initialise i8254 timer channel 0 to mode 2 at 100 Hz */
     outb(TIMER_MODE, TIMER_SEL0 | TIMER_RATEGEN | TIMER_16BIT);
@@ -203,14 +237,22 @@ int tscclock_init(void) {
     rtc_boot = rtc_gettimeofday();
 
     /*
-     * Calculate TSC frequency by calibrating against an 0.1s delay
-     * using the i8254 timer.
+     * Use the TSC frequency reported by CPUID if possible. Otherwise,
+     * calculate it by calibrating against an 0.1s delay using the i8254
+     * timer, which takes most of the time spent booting.
      */
     tsc_base = cpu_rdtsc();
-    i8254_delay(100000);
-    tsc_freq = (cpu_rdtsc() - tsc_base) * 10;
-    log(INFO, "Solo5: Clock source: TSC, frequency estimate is %llu Hz\n",
-        (unsigned long long)tsc_freq);
+    tsc_freq = tsc_freq_cpuid();
+    if (tsc_freq != 0) {
+        log(INFO, "Solo5: Clock source: TSC, frequency %llu Hz (CPUID)\n",
+            (unsigned long long)tsc_freq);
+    }
+    else {
+        i8254_delay(100000);
+        tsc_freq = (cpu_rdtsc() - tsc_base) * 10;
+        log(INFO, "Solo5: Clock source: TSC, frequency estimate is %llu Hz\n",
+            (unsigned long long)tsc_freq);
+    }
 
     /*
      * Calculate TSC scaling multiplier.
@@ -249,12 +291,63 @@ uint64_t tscclock_epochoffset(void) {
 	return rtc_epochoffset;
 }
 
+/*
+ * Return TSC frequency, Hz.
+ */
+uint64_t tscclock_freq(void) {
+    return tsc_freq;
+}
+
 /*
  * Minimum delta to sleep using PIT. Programming seems to have an overhead of
  * 3-4us, but play it safe here.
  */
 #define PIT_MIN_DELTA	16
 
+/*
+ * Program the PIT to interrupt the CPU after (delta_ns), or as long as it
+ * can wait if less. Returns -1 if the delay is less than the minimum safe
+ * amount of ticks.
+ */
+static int pit_arm(uint64_t delta_ns) {
+    uint64_t delta_ticks;
+    unsigned int ticks;
+
+    delta_ticks = mul64_32(delta_ns, pit_mult, 32);
+    if (delta_ticks < PIT_MIN_DELTA)
+        return -1;
+
+    /*
+     * Maximum timer delay is 65535 ticks.
+     */
+    if (delta_ticks > 65535)
+        ticks = 65535;
+    else
+        ticks = delta_ticks;
+
+    /*
+     * Note that according to the Intel 82C54 datasheet, p12 the
+     * interrupt is actually delivered in N + 1 ticks.
+     */
+    outb(TIMER_CNTR, (ticks - 1) & 0xff);
+    outb(TIMER_CNTR, (ticks - 1) >> 8);
+    return 0;
+}
+
+/*
+ * Program the PIT to interrupt the CPU (hz) times a second, until the next
+ * call to pit_arm(). Only for use if cpu_block() uses the local APIC timer.
+ */
+void pit_periodic(unsigned hz) {
+    unsigned int ticks = TIMER_HZ / hz;
+
+    if (ticks > 65535)
+        ticks = 65535;
+    outb(TIMER_MODE, TIMER_SEL0 | TIMER_RATEGEN | TIMER_16BIT);
+    outb(TIMER_CNTR, ticks & 0xff);
+    outb(TIMER_CNTR, ticks >> 8);
+}
+
 /*
  * Returns early if any interrupts are serviced, or if the requested delay is
  * too short. Must be called with interrupts disabled, will enable interrupts
@@ -262,8 +355,6 @@ uint64_t tscclock_epochoffset(void) {
  */
 void cpu_block(uint64_t until) {
     uint64_t now, delta_ns;
-    uint64_t delta_ticks;
-    unsigned int ticks;
     int d;
 
     assert(cpu_intr_depth > 0);
@@ -277,13 +368,12 @@ void cpu_block(uint64_t until) {
         return;
 
     /*
-     * Compute delta in PIT ticks. Return if it is less than minimum safe
-     * amount of ticks.  Essentially this will cause us to spin until
-     * the timeout.
+     * Arm the local APIC timer if available, otherwise the PIT. If the delay
+     * is too short for the PIT, this will cause us to spin until the
+     * timeout.
      */
     delta_ns = until - now;
-    delta_ticks = mul64_32(delta_ns, pit_mult, 32);
-    if (delta_ticks < PIT_MIN_DELTA) {
+    if (!lapic_timer_arm(delta_ns) && pit_arm(delta_ns) == -1) {
         /*
          * Since we are "spinning", quickly enable interrupts in
          * the hopes that we might get new work and can do something
@@ -296,22 +386,6 @@ void cpu_block(uint64_t until) {
         return;
     }
 
-    /*
-     * Program the timer to interrupt the CPU after the delay has expired.
-     * Maximum timer delay is 65535 ticks.
-     */
-    if (delta_ticks > 65535)
-        ticks = 65535;
-    else
-        ticks = delta_ticks;
-
-    /*
-     * Note that according to the Intel 82C54 datasheet, p12 the
-     * interrupt is actually delivered in N + 1 ticks.
-     */
-    outb(TIMER_CNTR, (ticks - 1) & 0xff);
-    outb(TIMER_CNTR, (ticks - 1) >> 8);
-
     /*
      * Wait for any interrupt. If we got an interrupt then
      * just return into the scheduler which will check if there is
@@ -0,0 +1,195 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * virtio_balloon.c: Giving memory released by the application back to the
+ * host through a virtio-balloon device.
+ *
+ * solo5_mem_release() hands the pages to the device, which discards them,
+ * and waits for it to be done, after which they may be used again at once.
+ * If the device offers free page reporting, the pages are reported as free.
+ * Otherwise they are put in the balloon and taken straight back out again,
+ * so that the balloon itself stays empty. Either way, the memory released is
+ * only held back until the application touches it again.
+ *
+ * An increase in the number of pages the host asks for in the balloon is
+ * passed on to the application as a request to release memory, see
+ * solo5_mem_reclaim_requested().
+ */
+
+#include "bindings.h"
+#include "virtio_ring.h"
+#include "virtio_pci.h"
+
+#define VIRTIO_BALLOON_F_MUST_TELL_HOST (1ULL << 0)
+#define VIRTIO_BALLOON_F_STATS_VQ       (1ULL << 1)
+#define VIRTIO_BALLOON_F_FREE_PAGE_HINT (1ULL << 3)
+#define VIRTIO_BALLOON_F_PAGE_REPORTING (1ULL << 5)
+
+/* Device configuration */
+#define VIRTIO_BALLOON_NUM_PAGES        0       /* 32-bit r/o */
+
+#define VIRTQ_BALLOON_INFLATE   0
+#define VIRTQ_BALLOON_DEFLATE   1
+
+/* Pages are given to the balloon as 32-bit numbers of 4k pages */
+#define VIRTIO_BALLOON_PFN_SHIFT 12
+#define VIRTIO_BALLOON_PFNS_MAX 256
+
+/* Largest range reported as free in one descriptor */
+#define VIRTIO_BALLOON_REPORT_MAX (1UL << 30)
+
+static struct virtio_dev balloon_dev;
+static struct virtq inflateq, deflateq, reportq;
+static bool balloon_configured;
+static bool balloon_reporting;
+static uint32_t balloon_target;
+/*
+ * Only one buffer is ever in flight, so all of them point at the same array
+ * of page numbers.
+ */
+static uint32_t balloon_pfns[VIRTIO_BALLOON_PFNS_MAX];
+
+static void balloon_setup_queue(struct virtq *vq, int selector)
+{
+    virtq_init_rings(&balloon_dev, vq, selector);
+    virtq_init_bufs(vq, 0);
+    /* We wait for the device to use our buffers, and need no interrupts. */
+    virtq_intr_disable(vq);
+}
+
+void virtio_config_balloon(struct pci_config_info *pci)
+{
+    uint64_t host_features, features;
+
+    virtio_dev_init(&balloon_dev, pci);
+    host_features = virtio_dev_features(&balloon_dev);
+    features = host_features &
+        (VIRTIO_BALLOON_F_MUST_TELL_HOST | VIRTIO_BALLOON_F_PAGE_REPORTING);
+    if (virtio_dev_set_features(&balloon_dev, host_features, features) != 0) {
+        log(WARN, "Solo5: PCI:%02x:%02x: feature negotiation failed\n",
+            pci->bus, pci->dev);
+        return;
+    }
+
+    if (features & VIRTIO_BALLOON_F_PAGE_REPORTING) {
+        /*
+         * The reporting queue follows those for the optional features the
+         * device offers, whether or not we use them.
+         */
+        int selector = 2;
+        if (host_features & VIRTIO_BALLOON_F_STATS_VQ)
+            selector++;
+        if (host_features & VIRTIO_BALLOON_F_FREE_PAGE_HINT)
+            selector++;
+        balloon_setup_queue(&reportq, selector);
+        balloon_reporting = true;
+    }
+    else {
+        balloon_setup_queue(&inflateq, VIRTQ_BALLOON_INFLATE);
+        balloon_setup_queue(&deflateq, VIRTQ_BALLOON_DEFLATE);
+    }
+
+    balloon_target = virtio_dev_config32(&balloon_dev,
+            VIRTIO_BALLOON_NUM_PAGES);
+    virtio_dev_driver_ok(&balloon_dev);
+    balloon_configured = true;
+    log(INFO, "Solo5: PCI:%02x:%02x: configured, %s\n", pci->bus, pci->dev,
+        balloon_reporting ? "free page reporting" : "no free page reporting");
+}
+
+/*
+ * Makes the buffer at the next available descriptor of (vq) available to the
+ * device, and waits for the device to use it.
+ */
+static void balloon_submit(struct virtq *vq, struct io_buffer *b)
+{
+    uint16_t head = vq->next_avail & (vq->num - 1);
+
+    assert(b == &vq->bufs[head]);
+    assert(virtq_add_descriptor_chain(vq, head, 1) == 0);
+    virtq_kick(vq);
+    while (!virtq_used_get(vq, 0, NULL, NULL))
+        ;
+    virtq_used_pop(vq);
+}
+
+static struct io_buffer *balloon_buf(struct virtq *vq)
+{
+    return &vq->bufs[vq->next_avail & (vq->num - 1)];
+}
+
+int platform_mem_release(uint64_t addr, size_t size)
+{
+    if (!balloon_configured)
+        return -1;
+
+    while (size > 0) {
+        if (balloon_reporting) {
+            struct io_buffer *b = balloon_buf(&reportq);
+            size_t len = size < VIRTIO_BALLOON_REPORT_MAX ? size :
+                VIRTIO_BALLOON_REPORT_MAX;
+
+            b->ext_data = (const uint8_t *)addr;
+            b->len = len;
+            b->extra_flags = VIRTQ_DESC_F_WRITE;
+            balloon_submit(&reportq, b);
+            addr += len;
+            size -= len;
+        }
+        else {
+            struct io_buffer *in = balloon_buf(&inflateq);
+            struct io_buffer *out = balloon_buf(&deflateq);
+            size_t n;
+
+            for (n = 0; n < VIRTIO_BALLOON_PFNS_MAX && size > 0; n++) {
+                balloon_pfns[n] = addr >> VIRTIO_BALLOON_PFN_SHIFT;
+                addr += 1UL << VIRTIO_BALLOON_PFN_SHIFT;
+                size -= 1UL << VIRTIO_BALLOON_PFN_SHIFT;
+            }
+            in->ext_data = (const uint8_t *)balloon_pfns;
+            in->len = n * sizeof (uint32_t);
+            in->extra_flags = 0;
+            out->ext_data = in->ext_data;
+            out->len = in->len;
+            out->extra_flags = 0;
+            /*
+             * The device has discarded the pages once it has used the
+             * inflate buffer, and with VIRTIO_BALLOON_F_MUST_TELL_HOST, they
+             * may be used again once it has used the deflate buffer.
+             */
+            balloon_submit(&inflateq, in);
+            balloon_submit(&deflateq, out);
+        }
+    }
+    return 0;
+}
+
+bool platform_mem_reclaim_requested(void)
+{
+    if (!balloon_configured)
+        return false;
+
+    uint32_t target = virtio_dev_config32(&balloon_dev,
+            VIRTIO_BALLOON_NUM_PAGES);
+    bool requested = target > balloon_target;
+    balloon_target = target;
+    return requested;
+}
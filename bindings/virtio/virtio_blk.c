@@ -30,13 +30,22 @@
 #define VIRTIO_BLK_T_FLUSH        4
 #define VIRTIO_BLK_T_FLUSH_OUT    5
 #define VIRTIO_BLK_T_GET_ID       8
+#define VIRTIO_BLK_T_DISCARD      11
+#define VIRTIO_BLK_T_WRITE_ZEROES 13
 #define VIRTIO_BLK_T_BARRIER      0x80000000
 
 #define VIRTIO_BLK_S_OK     0
 #define VIRTIO_BLK_S_IOERR  1
 #define VIRTIO_BLK_S_UNSUPP 2
 
-static uint64_t virtio_blk_sectors;
+#define VIRTIO_BLK_F_FLUSH (1 << 9) /* Flush command supported */
+#define VIRTIO_BLK_F_DISCARD (1 << 13) /* Discard command supported */
+#define VIRTIO_BLK_F_WRITE_ZEROES (1 << 14) /* Write zeroes supported */
+
+/* Offsets of limits in device configuration space */
+#define VIRTIO_BLK_CFG_MAX_DISCARD_SECTORS      36
+#define VIRTIO_BLK_CFG_MAX_WRITE_ZEROES_SECTORS 48
+#define VIRTIO_F_INDIRECT_DESC_BIT (1 << VIRTIO_F_INDIRECT_DESC)
 
 #define VIRTIO_BLK_SECTOR_SIZE    512
 
@@ -46,223 +55,755 @@ struct virtio_blk_hdr {
     uint64_t sector;
 };
 
-static struct virtq blkq;
-#define VIRTQ_BLK  0
+/* Data of VIRTIO_BLK_T_DISCARD and VIRTIO_BLK_T_WRITE_ZEROES requests */
+struct virtio_blk_range {
+    uint64_t sector;
+    uint32_t num_sectors;
+    uint32_t flags;
+};
 
-static uint16_t virtio_blk_pci_base; /* base in PCI config space */
+#define VIRTQ_BLK  0
 
-static bool blk_configured;
-static bool blk_acquired;
-static solo5_handle_t blk_handle;
 extern struct mft_note __solo5_manifest_note;
 
-/* Returns the index to the head of the buffers chain. */
-static uint16_t virtio_blk_op(uint32_t type,
-                              uint64_t sector,
-                              void *data, size_t len)
-{
-    uint16_t mask = blkq.num - 1;
+/*
+ * Requests in flight. A request is a chain of a header, one data descriptor
+ * per segment and a status descriptor. Data descriptors point directly at the
+ * caller's buffers. Slots are completed by the device in any order.
+ *
+ * If the device supports indirect descriptors, each slot owns the ring
+ * descriptor at (slot), which points to the slot's chain in (ind[]).
+ * Otherwise, each slot owns a fixed range of 3 ring descriptors starting at
+ * (3 * slot), and requests with more than one segment occupy several
+ * consecutive slots, all of which are owned by the first slot.
+ *
+ * Completions of asynchronous requests are queued in (cq) until reaped.
+ * Synchronous requests wait for their own completion, see virtio_blk_op_sync().
+ */
+struct blk_req {
+    bool busy;
+    bool async;
+    bool done;
+    solo5_result_t result;
+    uint64_t tag;
+    uint16_t ndesc;             /* Descriptors in chain */
+    uint16_t nslots;            /* Slots occupied by chain */
+};
+
+/*
+ * The header and status of the request in a slot. These are kept apart from
+ * the indirect descriptor tables, so that the ones in use share cache lines.
+ */
+struct blk_req_hdr {
     struct virtio_blk_hdr hdr;
-    struct io_buffer *head_buf, *data_buf, *status_buf;
-    uint16_t head = blkq.next_avail & mask;
+    uint8_t status;
+};
+
+struct blk_indirect {
+    struct virtq_desc desc[SOLO5_BLOCK_IOV_MAX + 2];
+};
+
+/*
+ * A virtio block device. Devices are configured in PCI enumeration order,
+ * and handed out in that order to the block devices acquired from the
+ * application manifest.
+ */
+struct blk_dev {
+    struct blk_indirect ind[SOLO5_BLOCK_QUEUE_MAX];
+    struct blk_req_hdr hdrs[SOLO5_BLOCK_QUEUE_MAX];
+    struct virtio_dev vd;
+    struct virtq blkq;
+    uint64_t sectors;
+
+    struct blk_req reqs[SOLO5_BLOCK_QUEUE_MAX];
+    unsigned nslots;
+    struct block_cq cq;
+
+    bool use_indirect;
+    bool use_flush;
+    /* Maximum sectors per request, or 0 if not supported by the device */
+    uint32_t max_discard;
+    uint32_t max_write_zeroes;
+
+    /*
+     * Set if requests have been added to the available ring since the device
+     * was last notified, see virtio_blk_kick().
+     */
+    bool kick_pending;
+
+    bool acquired;
+    solo5_handle_t handle;
+};
+
+static struct blk_dev blk_devs[VIRTIO_BLK_DEVICES_MAX]
+    __attribute__((aligned(16)));
+static unsigned blk_ndevs;
+/* Device acquired for each manifest entry, if any */
+static struct blk_dev *blk_acquired[MFT_MAX_ENTRIES];
+
+static struct blk_dev *blk_get(solo5_handle_t h)
+{
+    return (h < MFT_MAX_ENTRIES) ? blk_acquired[h] : NULL;
+}
+
+#define BLK_SLOTS(bd, count) \
+    ((bd)->use_indirect ? 1 : ((count) + 2 + 2) / 3)
+#define BLK_HEAD(bd, slot)   ((bd)->use_indirect ? (slot) : (slot) * 3)
+
+/* WARNING: called in interrupt context */
+static int handle_virtio_blk_interrupt(void *arg)
+{
+    struct blk_dev *bd = arg;
+    uint8_t isr_status;
+
+    isr_status = virtio_dev_isr(&bd->vd);
+    if (isr_status & VIRTIO_PCI_ISR_HAS_INTR) {
+        /* Only used to kick the application out of solo5_yield(). */
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Notifies the device of requests added since last called, unless it has told
+ * us it does not need to be notified. Asynchronous requests are added to the
+ * available ring on submission but only notified here, so that a batch of
+ * them costs a single notification.
+ */
+static void virtio_blk_kick(struct blk_dev *bd)
+{
+    if (!bd->kick_pending)
+        return;
+    bd->kick_pending = false;
+    virtq_kick(&bd->blkq);
+}
+
+/* Consume the descriptor chains used by the device since last called. */
+static void virtio_blk_complete(struct blk_dev *bd)
+{
+    struct virtq *blkq = &bd->blkq;
+    uint16_t head;
+    uint8_t status;
 
-    assert(len <= VIRTIO_BLK_SECTOR_SIZE);
+    virtio_blk_kick(bd);
+    for (; virtq_used_get(blkq, 0, &head, NULL); virtq_used_pop(blkq)) {
+        unsigned slot = bd->use_indirect ? head : head / 3U;
+        struct blk_req *req = &bd->reqs[slot];
+
+        assert(head == BLK_HEAD(bd, slot) && req->busy && !req->done);
+        status = bd->hdrs[slot].status;
+        if (!bd->use_indirect) {
+            for (unsigned i = 1; i < req->ndesc - 1U; i++)
+                blkq->bufs[head + i].ext_data = NULL;
+            for (unsigned i = 1; i < req->nslots; i++)
+                bd->reqs[slot + i].busy = false;
+        }
+
+        req->result = (status == VIRTIO_BLK_S_OK) ?
+            SOLO5_R_OK : SOLO5_R_EUNSPEC;
+        if (req->async) {
+            req->busy = false;
+            block_cq_complete(&bd->cq, req->tag, req->result);
+        }
+        else
+            req->done = true;
+    }
+    if (bd->cq.inflight == 0)
+        virtq_intr_disable(blkq);
+}
 
-    head_buf = &blkq.bufs[head];
-    data_buf = &blkq.bufs[(head + 1) & mask];
-    status_buf = &blkq.bufs[(head + 2) & mask];
+/*
+ * Sets entry (n) of an indirect descriptor table, in the format of the ring.
+ * Entries of a packed table are used in sequence, not chained.
+ */
+static void virtio_blk_ind_desc(struct blk_dev *bd, struct blk_indirect *ind,
+        unsigned n, uint64_t addr, uint32_t len, uint16_t flags, bool last)
+{
+    if (bd->blkq.packed) {
+        struct virtq_packed_desc *desc = (struct virtq_packed_desc *)
+            &ind->desc[n];
+        desc->addr = addr;
+        desc->len = len;
+        desc->id = 0;
+        desc->flags = flags;
+    }
+    else {
+        ind->desc[n].addr = addr;
+        ind->desc[n].len = len;
+        ind->desc[n].flags = last ? flags : (flags | VIRTQ_DESC_F_NEXT);
+        ind->desc[n].next = last ? 0 : n + 1;
+    }
+}
 
-    hdr.type = type;
-    hdr.ioprio = 0;
-    hdr.sector = sector;
+/*
+ * Builds the chain for a request in the indirect descriptor table of (slot),
+ * and points the ring descriptor owned by (slot) at it.
+ */
+static void virtio_blk_chain_indirect(struct blk_dev *bd, unsigned slot,
+        uint32_t type, uint64_t sector, const struct solo5_block_iov *iov,
+        size_t count)
+{
+    struct blk_indirect *ind = &bd->ind[slot];
+    struct blk_req_hdr *rh = &bd->hdrs[slot];
+    uint16_t data_flags = (type == VIRTIO_BLK_T_IN) ? VIRTQ_DESC_F_WRITE : 0;
+    unsigned n = 0;
+
+    rh->hdr.type = type;
+    rh->hdr.ioprio = 0;
+    rh->hdr.sector = sector;
+    rh->status = VIRTIO_BLK_S_IOERR;
+
+    virtio_blk_ind_desc(bd, ind, n++, (uint64_t)&rh->hdr,
+            sizeof(struct virtio_blk_hdr), 0, false);
+    for (size_t i = 0; i < count; i++, n++)
+        virtio_blk_ind_desc(bd, ind, n, (uint64_t)iov[i].buf, iov[i].size,
+                data_flags, false);
+    virtio_blk_ind_desc(bd, ind, n, (uint64_t)&rh->status, sizeof(uint8_t),
+            VIRTQ_DESC_F_WRITE, true);
+
+    struct io_buffer *buf = &bd->blkq.bufs[slot];
+    buf->ext_data = (const uint8_t *)ind->desc;
+    buf->len = (n + 1) * sizeof(struct virtq_desc);
+    buf->extra_flags = VIRTQ_DESC_F_INDIRECT;
+}
+
+/*
+ * Builds the chain for a request in the ring descriptors owned by (slot),
+ * spanning as many slots as needed.
+ */
+static void virtio_blk_chain_direct(struct blk_dev *bd, unsigned slot,
+        uint32_t type, uint64_t sector, const struct solo5_block_iov *iov,
+        size_t count)
+{
+    struct blk_req_hdr *rh = &bd->hdrs[slot];
+    uint16_t head = BLK_HEAD(bd, slot);
+    struct io_buffer *head_buf, *status_buf;
+
+    head_buf = &bd->blkq.bufs[head];
+    status_buf = &bd->blkq.bufs[head + count + 1];
+
+    rh->hdr.type = type;
+    rh->hdr.ioprio = 0;
+    rh->hdr.sector = sector;
+    rh->status = VIRTIO_BLK_S_IOERR;
 
     /* The header buf */
-    memcpy(head_buf->data, &hdr, sizeof(struct virtio_blk_hdr));
+    head_buf->ext_data = (const uint8_t *)&rh->hdr;
     head_buf->len = sizeof(struct virtio_blk_hdr);
     head_buf->extra_flags = 0;
 
-    /* The data buf */
-    if (type == VIRTIO_BLK_T_OUT) /* write */ {
-        memcpy(data_buf->data, data, len);
-        data_buf->extra_flags = 0;
-    } else
-        data_buf->extra_flags = VIRTQ_DESC_F_WRITE;
-    data_buf->len = len;
+    /* The data bufs */
+    for (size_t i = 0; i < count; i++) {
+        struct io_buffer *data_buf = &bd->blkq.bufs[head + 1 + i];
+        data_buf->ext_data = iov[i].buf;
+        if (type == VIRTIO_BLK_T_IN) /* read */
+            data_buf->extra_flags = VIRTQ_DESC_F_WRITE;
+        else
+            data_buf->extra_flags = 0;
+        data_buf->len = iov[i].size;
+    }
 
     /* The status buf */
+    status_buf->ext_data = &rh->status;
     status_buf->len = sizeof(uint8_t);
     status_buf->extra_flags = VIRTQ_DESC_F_WRITE;
+}
 
-    assert(virtq_add_descriptor_chain(&blkq, head, 3) == 0);
+/*
+ * Submits a request for the (count) segments in (iov[]), returning its slot,
+ * or -1 if not enough consecutive slots are free. Synchronous requests are
+ * notified to the device immediately, asynchronous ones by the next call to
+ * virtio_blk_kick().
+ */
+static int virtio_blk_op(struct blk_dev *bd, uint32_t type, uint64_t sector,
+        const struct solo5_block_iov *iov, size_t count, bool async,
+        uint64_t tag)
+{
+    unsigned slot, nslots = BLK_SLOTS(bd, count), run = 0;
+
+    for (slot = 0; slot < bd->nslots && run < nslots; slot++)
+        run = bd->reqs[slot].busy ? 0 : run + 1;
+    if (run < nslots)
+        return -1;
+    slot -= nslots;
+
+    uint16_t head = BLK_HEAD(bd, slot);
+    uint16_t ndesc = count + 2;
+    if (bd->use_indirect)
+        virtio_blk_chain_indirect(bd, slot, type, sector, iov, count);
+    else
+        virtio_blk_chain_direct(bd, slot, type, sector, iov, count);
+
+    for (unsigned i = 1; i < nslots; i++)
+        bd->reqs[slot + i].busy = true;
+    bd->reqs[slot].busy = true;
+    bd->reqs[slot].async = async;
+    bd->reqs[slot].done = false;
+    bd->reqs[slot].tag = tag;
+    bd->reqs[slot].ndesc = ndesc;
+    bd->reqs[slot].nslots = nslots;
+    if (async) {
+        block_cq_submit(&bd->cq);
+        virtq_intr_enable(&bd->blkq);
+    }
 
-    outw(virtio_blk_pci_base + VIRTIO_PCI_QUEUE_NOTIFY, VIRTQ_BLK);
+    assert(virtq_add_descriptor_chain(&bd->blkq, head,
+                bd->use_indirect ? 1 : ndesc) == 0);
 
-    return head;
+    bd->kick_pending = true;
+    if (!async)
+        virtio_blk_kick(bd);
+    return slot;
 }
 
 /*
- * Returns the status (0 is OK, -1 is not)
- *
- * This function assumes that no other pending IO is submitted at the same
- * time.  That is true as long as we use only synchronous IO calls, and if
- * there is just a sync call at a time (which is true for solo5).
+ * Submits a request and waits for it to complete. Returns the status (0 is
+ * OK, -1 is not). Asynchronous requests completing in the meantime are
+ * queued as usual.
  */
-static int virtio_blk_op_sync(uint32_t type,
-                              uint64_t sector,
-                              void *data, size_t len)
+static int virtio_blk_op_sync(struct blk_dev *bd, uint32_t type,
+        uint64_t sector, const struct solo5_block_iov *iov, size_t count)
 {
-    uint16_t mask = blkq.num - 1;
-    uint16_t head;
-    struct io_buffer *data_buf, *status_buf;
-    uint8_t status;
+    int slot;
 
-    head = virtio_blk_op(type, sector, data, len);
-    data_buf = &blkq.bufs[(head + 1) & mask];
-    status_buf = &blkq.bufs[(head + 2) & mask];
+    if (BLK_SLOTS(bd, count) > bd->nslots)
+        return -1;
+    while ((slot = virtio_blk_op(bd, type, sector, iov, count, false, 0))
+            == -1)
+        virtio_blk_complete(bd);
 
-    /* Loop until the device used all of our descriptors. */
-    while (blkq.used->idx != blkq.avail->idx)
-        ;
+    /* Loop until the device used our descriptors. */
+    while (!bd->reqs[slot].done)
+        virtio_blk_complete(bd);
 
-    /* Consume all the recently used descriptors. */
-    for (; blkq.used->idx != blkq.last_used; blkq.last_used++) {
-        struct virtq_used_elem *e;
+    bd->reqs[slot].busy = false;
+    return (bd->reqs[slot].result == SOLO5_R_OK) ? 0 : -1;
+}
 
-        /* Assert that the used descriptor matches the descriptor of the
-         * IO we started at the start of this function. */
-        e = &(blkq.used->ring[blkq.last_used & mask]);
-        assert(head == e->id);
+/*
+ * Submits an asynchronous request. Completions are only consumed if there is
+ * no free slot for it, so as not to notify the device of each request in a
+ * batch separately.
+ */
+static solo5_result_t virtio_blk_submit(struct blk_dev *bd, uint32_t type,
+        uint64_t sector, const struct solo5_block_iov *iov, size_t count,
+        uint64_t tag)
+{
+    if (block_cq_full(&bd->cq))
+        return SOLO5_R_AGAIN;
+    if (virtio_blk_op(bd, type, sector, iov, count, true, tag) != -1)
+        return SOLO5_R_OK;
+    virtio_blk_complete(bd);
+    if (virtio_blk_op(bd, type, sector, iov, count, true, tag) != -1)
+        return SOLO5_R_OK;
+    return SOLO5_R_AGAIN;
+}
 
-        blkq.num_avail += 3; /* 3 descriptors per chain */
+/*
+ * Performs a VIRTIO_BLK_T_DISCARD or VIRTIO_BLK_T_WRITE_ZEROES request for
+ * (size) bytes at (offset), split into requests of at most (max_sectors).
+ */
+static int virtio_blk_range_op(struct blk_dev *bd, uint32_t type,
+        uint32_t max_sectors, solo5_off_t offset, solo5_off_t size)
+{
+    struct virtio_blk_range range;
+    struct solo5_block_iov iov = {
+        .buf = (uint8_t *)&range, .size = sizeof range
+    };
+    uint64_t sector = offset / VIRTIO_BLK_SECTOR_SIZE;
+    uint64_t sectors = size / VIRTIO_BLK_SECTOR_SIZE;
+
+    while (sectors > 0) {
+        range.sector = sector;
+        range.num_sectors = (sectors < max_sectors) ? sectors : max_sectors;
+        range.flags = 0;
+        if (virtio_blk_op_sync(bd, type, 0, &iov, 1) != 0)
+            return -1;
+        sector += range.num_sectors;
+        sectors -= range.num_sectors;
     }
+    return 0;
+}
 
-    status = (*(uint8_t *)status_buf);
-    if (status != VIRTIO_BLK_S_OK)
-        return -1;
+static bool virtio_blk_valid(struct blk_dev *bd, solo5_off_t offset,
+        size_t size)
+{
+    return block_request_valid(bd->sectors * VIRTIO_BLK_SECTOR_SIZE,
+            VIRTIO_BLK_SECTOR_SIZE, offset, size);
+}
 
-    if (type == VIRTIO_BLK_T_IN) /* read */
-        memcpy(data, data_buf->data, len);
+static bool virtio_blk_range_valid(struct blk_dev *bd, solo5_off_t offset,
+        solo5_off_t size)
+{
+    return block_range_valid(bd->sectors * VIRTIO_BLK_SECTOR_SIZE,
+            VIRTIO_BLK_SECTOR_SIZE, offset, size);
+}
 
-    return 0;
+solo5_handle_set_t virtio_blk_ready_set(void)
+{
+    solo5_handle_set_t ready_set = 0;
+
+    for (unsigned i = 0; i < blk_ndevs; i++) {
+        struct blk_dev *bd = &blk_devs[i];
+
+        if (!bd->acquired)
+            continue;
+        virtio_blk_complete(bd);
+        if (block_cq_ready(&bd->cq))
+            ready_set |= 1ULL << bd->handle;
+    }
+    return ready_set;
 }
 
 void virtio_config_block(struct pci_config_info *pci)
 {
-    uint8_t ready_for_init = VIRTIO_PCI_STATUS_ACK | VIRTIO_PCI_STATUS_DRIVER;
-    uint32_t host_features, guest_features;
-    size_t pgs;
+    struct blk_dev *bd;
+    uint64_t host_features, guest_features;
 
-    outb(pci->base + VIRTIO_PCI_STATUS, ready_for_init);
+    assert(blk_ndevs < VIRTIO_BLK_DEVICES_MAX);
+    bd = &blk_devs[blk_ndevs];
 
-    host_features = inl(pci->base + VIRTIO_PCI_HOST_FEATURES);
+    virtio_dev_init(&bd->vd, pci);
+    host_features = virtio_dev_features(&bd->vd);
 
-    /* don't negotiate anything for now */
+    /*
+     * With indirect descriptors, every request uses a single descriptor in
+     * the ring, regardless of how many segments it has. If the device does
+     * not offer VIRTIO_BLK_F_FLUSH, it does not cache writes, and flushes
+     * complete immediately. Without VIRTIO_BLK_F_DISCARD, discards do
+     * nothing; without VIRTIO_BLK_F_WRITE_ZEROES, zeroes are written as data.
+     *
+     * VIRTIO_BLK_F_MQ is not negotiated: with a single CPU, additional
+     * request queues would only add notifications.
+     */
     guest_features = 0;
-    outl(pci->base + VIRTIO_PCI_GUEST_FEATURES, guest_features);
+    if (host_features & VIRTIO_BLK_F_FLUSH) {
+        guest_features |= VIRTIO_BLK_F_FLUSH;
+        bd->use_flush = true;
+    }
+    if (host_features & VIRTIO_F_INDIRECT_DESC_BIT) {
+        guest_features |= VIRTIO_F_INDIRECT_DESC_BIT;
+        bd->use_indirect = true;
+    }
+    if (host_features & VIRTIO_BLK_F_DISCARD) {
+        guest_features |= VIRTIO_BLK_F_DISCARD;
+        bd->max_discard = virtio_dev_config32(&bd->vd,
+                VIRTIO_BLK_CFG_MAX_DISCARD_SECTORS);
+    }
+    if (host_features & VIRTIO_BLK_F_WRITE_ZEROES) {
+        guest_features |= VIRTIO_BLK_F_WRITE_ZEROES;
+        bd->max_write_zeroes = virtio_dev_config32(&bd->vd,
+                VIRTIO_BLK_CFG_MAX_WRITE_ZEROES_SECTORS);
+    }
+    if (virtio_dev_set_features(&bd->vd, host_features,
+                guest_features) != 0) {
+        log(WARN, "Solo5: PCI:%02x:%02x: feature negotiation failed\n",
+            pci->bus, pci->dev);
+        memset(bd, 0, sizeof *bd);
+        return;
+    }
 
-    virtio_blk_sectors = inq(pci->base + VIRTIO_PCI_CONFIG_OFF);
+    bd->sectors = virtio_dev_config64(&bd->vd, 0);
     log(INFO, "Solo5: PCI:%02x:%02x: configured, capacity=%llu sectors, "
-        "features=0x%x\n",
-        pci->bus, pci->dev, (unsigned long long)virtio_blk_sectors,
-        host_features);
+        "features=0x%llx%s%s\n",
+        pci->bus, pci->dev, (unsigned long long)bd->sectors,
+        (unsigned long long)host_features,
+        bd->vd.modern ? ", modern" : "", bd->vd.packed ? ", packed" : "");
 
-    virtq_init_rings(pci->base, &blkq, 0);
+    virtq_init_rings(&bd->vd, &bd->blkq, VIRTQ_BLK);
+    bd->nslots = bd->use_indirect ? bd->blkq.num : bd->blkq.num / 3;
+    if (bd->nslots > SOLO5_BLOCK_QUEUE_MAX)
+        bd->nslots = SOLO5_BLOCK_QUEUE_MAX;
 
-    pgs = (((blkq.num * sizeof (struct io_buffer)) - 1) >> PAGE_SHIFT) + 1;
-    blkq.bufs = mem_ialloc_pages(pgs);
-    assert(blkq.bufs);
-    memset(blkq.bufs, 0, pgs << PAGE_SHIFT);
+    /* Headers and status are in hdrs[], and data in the application's. */
+    virtq_init_bufs(&bd->blkq, 0);
 
-    virtio_blk_pci_base = pci->base;
-    blk_configured = 1;
+    blk_ndevs++;
+    if (!virtio_dev_queue_intr(&bd->vd, VIRTQ_BLK, NULL, NULL))
+        intr_register_irq(pci->irq, handle_virtio_blk_interrupt, bd);
 
     /*
      * We don't need to get interrupts every time the device uses our
-     * descriptors.
+     * descriptors, only while asynchronous requests are in flight.
      */
 
-    blkq.avail->flags |= VIRTQ_AVAIL_F_NO_INTERRUPT;
+    virtq_intr_disable(&bd->blkq);
 
-    outb(pci->base + VIRTIO_PCI_STATUS, VIRTIO_PCI_STATUS_DRIVER_OK);
+    virtio_dev_driver_ok(&bd->vd);
 }
 
 /*
- * FIXME: This is a single-device implementation of the new manifest-based
- * APIs. On virtio, this call has the following semantics:
- *
- * 1. The first call to solo5_block_acquire() asking for a handle to a valid
- *    block device (one specified in the application manifest) will succeed,
- *    and return a handle for the sole virtio block device.
- * 2. All subsequent calls will return an error.
- *
- * Note that the presence of a virtio block device is registered during boot
- * in (blk_configured), and the initial acquisition by solo5_block_acquire() is
- * registered in (blk_acquired).
+ * Block devices are handed out in PCI enumeration order: each call to
+ * solo5_block_acquire() for a valid block device in the application manifest
+ * is given the next virtio block device not yet acquired, and fails once
+ * there are none left.
  */
 solo5_result_t solo5_block_acquire(const char *name, solo5_handle_t *h,
         struct solo5_block_info *info)
 {
-    if (!blk_configured || blk_acquired)
-        return SOLO5_R_EUNSPEC;
+    struct blk_dev *bd = NULL;
 
     unsigned mft_index;
     struct mft_entry *mft_e = mft_get_by_name(&__solo5_manifest_note.m, name,
         MFT_BLOCK_BASIC, &mft_index);
     if (mft_e == NULL)
         return SOLO5_R_EINVAL;
-    blk_handle = (solo5_handle_t)mft_index;
-    blk_acquired = true;
+    if (blk_acquired[mft_index] != NULL)
+        return SOLO5_R_EUNSPEC;
+    for (unsigned i = 0; i < blk_ndevs; i++) {
+        if (!blk_devs[i].acquired) {
+            bd = &blk_devs[i];
+            break;
+        }
+    }
+    if (bd == NULL)
+        return SOLO5_R_EUNSPEC;
+
+    bd->handle = (solo5_handle_t)mft_index;
+    bd->acquired = true;
+    blk_acquired[mft_index] = bd;
 
     info->block_size = VIRTIO_BLK_SECTOR_SIZE;
-    info->capacity = virtio_blk_sectors * VIRTIO_BLK_SECTOR_SIZE;
+    info->capacity = bd->sectors * VIRTIO_BLK_SECTOR_SIZE;
+    info->zone_size = 0;
     *h = (solo5_handle_t)mft_index;
-    log(INFO, "Solo5: Application acquired '%s' as block device\n", name);
+    stats_acquire(*h, MFT_BLOCK_BASIC);
+    log(INFO, "Solo5: Application acquired '%s' as block device %u\n",
+        name, (unsigned)(bd - blk_devs));
     return SOLO5_R_OK;
 }
 
 solo5_result_t solo5_block_write(solo5_handle_t h, solo5_off_t offset,
         const uint8_t *buf, size_t size)
 {
-    if (!blk_acquired || h != blk_handle)
-        return SOLO5_R_EINVAL;
-
-    /*
-     * XXX: This does not check for writes ending past the end of the device,
-     * virtio_blk_op_sync() will return -1 (translated to SOLO5_R_EUNSPEC)
-     * below.
-     */
-    uint64_t sector = offset / VIRTIO_BLK_SECTOR_SIZE;
-    if ((offset % VIRTIO_BLK_SECTOR_SIZE != 0) ||
-        (sector >= virtio_blk_sectors) ||
-        (size != VIRTIO_BLK_SECTOR_SIZE))
-        return SOLO5_R_EINVAL;
-
-    /*
-     * XXX: removing the const qualifier from buf here is fine with the current
-     * implementation which does a memcpy() on VIRTIO_BLK_T_OUT, however the
-     * internal interfaces should be refactored to reflect this.
-     */
-    int rv = virtio_blk_op_sync(VIRTIO_BLK_T_OUT, sector, (uint8_t *)buf, size);
-    return (rv == 0) ? SOLO5_R_OK : SOLO5_R_EUNSPEC;
+    struct blk_dev *bd = blk_get(h);
+
+    if (bd == NULL)
+        return block_stats_op(h, BLOCK_STATS_WRITE, SOLO5_R_EINVAL, 0);
+    if (!virtio_blk_valid(bd, offset, size))
+        return block_stats_op(h, BLOCK_STATS_WRITE, SOLO5_R_EINVAL, 0);
+
+    struct solo5_block_iov iov = { .buf = (uint8_t *)buf, .size = size };
+    int rv = virtio_blk_op_sync(bd, VIRTIO_BLK_T_OUT,
+            offset / VIRTIO_BLK_SECTOR_SIZE, &iov, 1);
+    return block_stats_op(h, BLOCK_STATS_WRITE,
+            (rv == 0) ? SOLO5_R_OK : SOLO5_R_EUNSPEC, size);
 }
 
 solo5_result_t solo5_block_read(solo5_handle_t h, solo5_off_t offset,
         uint8_t *buf, size_t size)
 {
-    if (!blk_acquired || h != blk_handle)
+    struct blk_dev *bd = blk_get(h);
+
+    if (bd == NULL)
+        return block_stats_op(h, BLOCK_STATS_READ, SOLO5_R_EINVAL, 0);
+    if (!virtio_blk_valid(bd, offset, size))
+        return block_stats_op(h, BLOCK_STATS_READ, SOLO5_R_EINVAL, 0);
+
+    struct solo5_block_iov iov = { .buf = buf, .size = size };
+    int rv = virtio_blk_op_sync(bd, VIRTIO_BLK_T_IN,
+            offset / VIRTIO_BLK_SECTOR_SIZE, &iov, 1);
+    return block_stats_op(h, BLOCK_STATS_READ,
+            (rv == 0) ? SOLO5_R_OK : SOLO5_R_EUNSPEC, size);
+}
+
+solo5_result_t solo5_block_writev(solo5_handle_t h, solo5_off_t offset,
+        const struct solo5_block_iov *iov, size_t count)
+{
+    struct blk_dev *bd = blk_get(h);
+
+    if (bd == NULL)
+        return block_stats_op(h, BLOCK_STATS_WRITE, SOLO5_R_EINVAL, 0);
+    size_t size = block_iov_size(iov, count, VIRTIO_BLK_SECTOR_SIZE);
+    if (size == 0 || !virtio_blk_valid(bd, offset, size))
+        return block_stats_op(h, BLOCK_STATS_WRITE, SOLO5_R_EINVAL, 0);
+
+    int rv = virtio_blk_op_sync(bd, VIRTIO_BLK_T_OUT,
+            offset / VIRTIO_BLK_SECTOR_SIZE, iov, count);
+    return block_stats_op(h, BLOCK_STATS_WRITE,
+            (rv == 0) ? SOLO5_R_OK : SOLO5_R_EUNSPEC, size);
+}
+
+solo5_result_t solo5_block_readv(solo5_handle_t h, solo5_off_t offset,
+        const struct solo5_block_iov *iov, size_t count)
+{
+    struct blk_dev *bd = blk_get(h);
+
+    if (bd == NULL)
+        return block_stats_op(h, BLOCK_STATS_READ, SOLO5_R_EINVAL, 0);
+    size_t size = block_iov_size(iov, count, VIRTIO_BLK_SECTOR_SIZE);
+    if (size == 0 || !virtio_blk_valid(bd, offset, size))
+        return block_stats_op(h, BLOCK_STATS_READ, SOLO5_R_EINVAL, 0);
+
+    int rv = virtio_blk_op_sync(bd, VIRTIO_BLK_T_IN,
+            offset / VIRTIO_BLK_SECTOR_SIZE, iov, count);
+    return block_stats_op(h, BLOCK_STATS_READ,
+            (rv == 0) ? SOLO5_R_OK : SOLO5_R_EUNSPEC, size);
+}
+
+solo5_result_t solo5_block_flush(solo5_handle_t h)
+{
+    struct blk_dev *bd = blk_get(h);
+
+    if (bd == NULL)
+        return block_stats_op(h, BLOCK_STATS_FLUSH, SOLO5_R_EINVAL, 0);
+    if (!bd->use_flush)
+        return block_stats_op(h, BLOCK_STATS_FLUSH, SOLO5_R_OK, 0);
+
+    int rv = virtio_blk_op_sync(bd, VIRTIO_BLK_T_FLUSH, 0, NULL, 0);
+    return block_stats_op(h, BLOCK_STATS_FLUSH,
+            (rv == 0) ? SOLO5_R_OK : SOLO5_R_EUNSPEC, 0);
+}
+
+solo5_result_t solo5_block_discard(solo5_handle_t h, solo5_off_t offset,
+        solo5_off_t size)
+{
+    struct blk_dev *bd = blk_get(h);
+
+    if (bd == NULL)
+        return block_stats_op(h, BLOCK_STATS_DISCARD, SOLO5_R_EINVAL, 0);
+    if (!virtio_blk_range_valid(bd, offset, size))
+        return block_stats_op(h, BLOCK_STATS_DISCARD, SOLO5_R_EINVAL, 0);
+    if (bd->max_discard == 0)
+        return block_stats_op(h, BLOCK_STATS_DISCARD, SOLO5_R_OK, 0);
+
+    int rv = virtio_blk_range_op(bd, VIRTIO_BLK_T_DISCARD, bd->max_discard,
+            offset, size);
+    return block_stats_op(h, BLOCK_STATS_DISCARD,
+            (rv == 0) ? SOLO5_R_OK : SOLO5_R_EUNSPEC, 0);
+}
+
+solo5_result_t solo5_block_write_zeroes(solo5_handle_t h, solo5_off_t offset,
+        solo5_off_t size)
+{
+    struct blk_dev *bd = blk_get(h);
+
+    if (bd == NULL)
+        return block_stats_op(h, BLOCK_STATS_DISCARD, SOLO5_R_EINVAL, 0);
+    if (!virtio_blk_range_valid(bd, offset, size))
+        return block_stats_op(h, BLOCK_STATS_DISCARD, SOLO5_R_EINVAL, 0);
+    /* The slow path is counted by the writes it issues. */
+    if (bd->max_write_zeroes == 0)
+        return block_write_zeroes_slow(h, offset, size);
+
+    int rv = virtio_blk_range_op(bd, VIRTIO_BLK_T_WRITE_ZEROES,
+            bd->max_write_zeroes, offset, size);
+    return block_stats_op(h, BLOCK_STATS_DISCARD,
+            (rv == 0) ? SOLO5_R_OK : SOLO5_R_EUNSPEC, 0);
+}
+
+/*
+ * virtio-blk has no means of passing on the hint.
+ */
+solo5_result_t solo5_block_prefetch(solo5_handle_t h, solo5_off_t offset,
+        solo5_off_t size)
+{
+    struct blk_dev *bd = blk_get(h);
+
+    if (bd == NULL || !virtio_blk_range_valid(bd, offset, size))
         return SOLO5_R_EINVAL;
+    return SOLO5_R_OK;
+}
 
-    /*
-     * XXX: This does not check for reads ending past the end of the device,
-     * virtio_blk_op_sync() will return -1 (translated to SOLO5_R_EUNSPEC)
-     * below.
-     */
-    uint64_t sector = offset / VIRTIO_BLK_SECTOR_SIZE;
-    if ((offset % VIRTIO_BLK_SECTOR_SIZE != 0) ||
-        (sector >= virtio_blk_sectors) ||
-        (size != VIRTIO_BLK_SECTOR_SIZE))
+solo5_result_t solo5_block_map(solo5_handle_t h __attribute__((unused)),
+        const uint8_t **data __attribute__((unused)))
+{
+    return SOLO5_R_EINVAL;
+}
+
+/*
+ * Zoned devices (VIRTIO_BLK_F_ZONED) are not supported, so devices are never
+ * zoned.
+ */
+solo5_result_t solo5_block_zone_report(
+        solo5_handle_t h __attribute__((unused)),
+        solo5_off_t offset __attribute__((unused)),
+        struct solo5_block_zone *zones __attribute__((unused)),
+        size_t count __attribute__((unused)),
+        size_t *nzones __attribute__((unused)))
+{
+    return SOLO5_R_EINVAL;
+}
+
+solo5_result_t solo5_block_zone_append(solo5_handle_t h,
+        solo5_off_t zone __attribute__((unused)),
+        const uint8_t *buf __attribute__((unused)),
+        size_t size __attribute__((unused)),
+        solo5_off_t *offset __attribute__((unused)))
+{
+    return block_stats_op(h, BLOCK_STATS_WRITE, SOLO5_R_EINVAL, 0);
+}
+
+solo5_result_t solo5_block_zone_manage(
+        solo5_handle_t h __attribute__((unused)),
+        unsigned op __attribute__((unused)),
+        solo5_off_t zone __attribute__((unused)))
+{
+    return SOLO5_R_EINVAL;
+}
+
+solo5_result_t solo5_block_submit_read(solo5_handle_t h, solo5_off_t offset,
+        uint8_t *buf, size_t size, uint64_t tag)
+{
+    struct blk_dev *bd = blk_get(h);
+
+    if (bd == NULL)
+        return block_stats_op(h, BLOCK_STATS_READ, SOLO5_R_EINVAL, 0);
+    if (!virtio_blk_valid(bd, offset, size))
+        return block_stats_op(h, BLOCK_STATS_READ, SOLO5_R_EINVAL, 0);
+
+    struct solo5_block_iov iov = { .buf = buf, .size = size };
+    solo5_result_t rc = virtio_blk_submit(bd, VIRTIO_BLK_T_IN,
+            offset / VIRTIO_BLK_SECTOR_SIZE, &iov, 1, tag);
+    return block_stats_op(h, BLOCK_STATS_READ, rc, size);
+}
+
+solo5_result_t solo5_block_submit_write(solo5_handle_t h, solo5_off_t offset,
+        const uint8_t *buf, size_t size, uint64_t tag)
+{
+    struct blk_dev *bd = blk_get(h);
+
+    if (bd == NULL)
+        return block_stats_op(h, BLOCK_STATS_WRITE, SOLO5_R_EINVAL, 0);
+    if (!virtio_blk_valid(bd, offset, size))
+        return block_stats_op(h, BLOCK_STATS_WRITE, SOLO5_R_EINVAL, 0);
+
+    struct solo5_block_iov iov = { .buf = (uint8_t *)buf, .size = size };
+    solo5_result_t rc = virtio_blk_submit(bd, VIRTIO_BLK_T_OUT,
+            offset / VIRTIO_BLK_SECTOR_SIZE, &iov, 1, tag);
+    return block_stats_op(h, BLOCK_STATS_WRITE, rc, size);
+}
+
+solo5_result_t solo5_block_submit_flush(solo5_handle_t h, uint64_t tag)
+{
+    struct blk_dev *bd = blk_get(h);
+
+    if (bd == NULL)
+        return block_stats_op(h, BLOCK_STATS_FLUSH, SOLO5_R_EINVAL, 0);
+    if (bd->use_flush) {
+        solo5_result_t rc = virtio_blk_submit(bd, VIRTIO_BLK_T_FLUSH, 0, NULL,
+                0, tag);
+        return block_stats_op(h, BLOCK_STATS_FLUSH, rc, 0);
+    }
+    if (block_cq_full(&bd->cq))
+        return block_stats_op(h, BLOCK_STATS_FLUSH, SOLO5_R_AGAIN, 0);
+
+    block_cq_submit(&bd->cq);
+    block_cq_complete(&bd->cq, tag, SOLO5_R_OK);
+    return block_stats_op(h, BLOCK_STATS_FLUSH, SOLO5_R_OK, 0);
+}
+
+solo5_result_t solo5_block_reap(solo5_handle_t h,
+        struct solo5_block_completion *completions, size_t count,
+        size_t *reaped)
+{
+    struct blk_dev *bd = blk_get(h);
+
+    if (bd == NULL)
         return SOLO5_R_EINVAL;
 
-    int rv = virtio_blk_op_sync(VIRTIO_BLK_T_IN, sector, buf, size);
-    return (rv == 0) ? SOLO5_R_OK : SOLO5_R_EUNSPEC;
+    virtio_blk_complete(bd);
+    solo5_result_t rc = block_cq_reap(&bd->cq, completions, count, reaped);
+    return block_stats_reap(h, rc, completions,
+            rc == SOLO5_R_OK ? *reaped : 0);
 }
@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * virtio_console.c: Console output through a virtio console device.
+ *
+ * Console output otherwise goes to the serial port, costing an I/O port exit
+ * per byte. Here, each write costs a single notification of the device, for
+ * as many bytes as fit in the transmit queue.
+ *
+ * Only port 0 is used, as VIRTIO_CONSOLE_F_MULTIPORT is not negotiated, and
+ * input is ignored.
+ */
+
+#include "bindings.h"
+#include "virtio_ring.h"
+#include "virtio_pci.h"
+
+#define VIRTQ_CONSOLE_RECV  0
+#define VIRTQ_CONSOLE_XMIT  1
+
+/* Bytes of output per descriptor, after translating "\n" to "\r\n" */
+#define CONSOLE_BUFFER_LEN  512
+
+static struct virtio_dev console_dev;
+static struct virtq xmitq;
+static bool console_configured;
+/* Set while a write is in progress, see virtio_console_write() */
+static bool console_busy;
+
+void virtio_config_console(struct pci_config_info *pci)
+{
+    uint64_t host_features;
+
+    virtio_dev_init(&console_dev, pci);
+    host_features = virtio_dev_features(&console_dev);
+    if (virtio_dev_set_features(&console_dev, host_features, 0) != 0) {
+        log(WARN, "Solo5: PCI:%02x:%02x: feature negotiation failed\n",
+            pci->bus, pci->dev);
+        return;
+    }
+
+    virtq_init_rings(&console_dev, &xmitq, VIRTQ_CONSOLE_XMIT);
+    virtq_init_bufs(&xmitq, CONSOLE_BUFFER_LEN);
+
+    /* We wait for the device to use our buffers, and need no interrupts. */
+    virtq_intr_disable(&xmitq);
+
+    virtio_dev_driver_ok(&console_dev);
+    console_configured = true;
+    log(INFO, "Solo5: PCI:%02x:%02x: configured, console output follows\n",
+        pci->bus, pci->dev);
+}
+
+/*
+ * Writes (size) bytes from (buf) to the console, translating "\n" to "\r\n"
+ * as the serial console does. Returns false if there is no virtio console, or
+ * it is in use by a write we have interrupted, in which case the caller
+ * should write to the serial console instead.
+ *
+ * We wait for the device to use the buffers before returning, so that output
+ * is not reordered with respect to the serial console, or lost on exit. The
+ * device consumes them when notified, so this costs no further exits.
+ */
+bool virtio_console_write(const char *buf, size_t size)
+{
+    uint16_t mask = xmitq.num - 1;
+    size_t off = 0;
+
+    if (!console_configured || console_busy)
+        return false;
+    console_busy = true;
+
+    while (off < size) {
+        while (xmitq.num_avail > 0 && off < size) {
+            uint16_t head = xmitq.next_avail & mask;
+            struct io_buffer *b = &xmitq.bufs[head];
+            uint32_t len = 0;
+
+            while (off < size && len < CONSOLE_BUFFER_LEN - 1) {
+                if (buf[off] == '\n')
+                    b->data[len++] = '\r';
+                b->data[len++] = buf[off++];
+            }
+            b->len = len;
+            b->extra_flags = 0;
+            assert(virtq_add_descriptor_chain(&xmitq, head, 1) == 0);
+        }
+        virtq_kick(&xmitq);
+
+        while (xmitq.num_avail < xmitq.num) {
+            if (virtq_used_get(&xmitq, 0, NULL, NULL))
+                virtq_used_pop(&xmitq);
+        }
+    }
+
+    console_busy = false;
+    return true;
+}
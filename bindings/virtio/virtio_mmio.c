@@ -0,0 +1,194 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * virtio_mmio.c: Discovery of virtio-mmio devices.
+ *
+ * virtio-mmio devices cannot be enumerated; monitors describe them on the
+ * kernel command line as for Linux, with one
+ * "virtio_mmio.device=<size>@<base>:<irq>[:<id>]" parameter per device.
+ */
+
+#include "bindings.h"
+#include "virtio_pci.h"
+
+#define VIRTIO_MMIO_DEVICES_MAX 16
+
+static struct {
+    uint64_t base;
+    uint64_t size;
+    uint8_t irq;
+} devices[VIRTIO_MMIO_DEVICES_MAX];
+static int ndevices;
+
+static const char opt_device[] = "virtio_mmio.device=";
+
+/*
+ * Parses a number in C notation from (*p), stopping at (end). Returns false
+ * if there are no digits.
+ */
+static bool parse_num(const char **p, const char *end, uint64_t *num)
+{
+    const char *s = *p;
+    unsigned base = 10;
+    uint64_t n = 0;
+
+    if (end - s > 2 && s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) {
+        base = 16;
+        s += 2;
+    }
+    const char *digits = s;
+    for (; s < end; s++) {
+        unsigned d;
+
+        if (*s >= '0' && *s <= '9')
+            d = *s - '0';
+        else if (base == 16 && *s >= 'a' && *s <= 'f')
+            d = *s - 'a' + 10;
+        else if (base == 16 && *s >= 'A' && *s <= 'F')
+            d = *s - 'A' + 10;
+        else
+            break;
+        n = n * base + d;
+    }
+    if (s == digits)
+        return false;
+    *p = s;
+    *num = n;
+    return true;
+}
+
+/*
+ * Parses the device description between (p) and (end).
+ */
+static bool parse_device(const char *p, const char *end)
+{
+    uint64_t size, base, irq;
+
+    if (!parse_num(&p, end, &size))
+        return false;
+    if (p < end && (*p == 'K' || *p == 'k')) {
+        size <<= 10;
+        p++;
+    }
+    else if (p < end && (*p == 'M' || *p == 'm')) {
+        size <<= 20;
+        p++;
+    }
+    if (p == end || *p++ != '@' || !parse_num(&p, end, &base))
+        return false;
+    if (p == end || *p++ != ':' || !parse_num(&p, end, &irq))
+        return false;
+    /* The platform device ID, if any, is of no use to us. */
+    if (p != end && *p != ':')
+        return false;
+
+    if (base < platform_mmio_start() || size < VIRTIO_MMIO_CONFIG ||
+            base + size > MMIO_END) {
+        log(WARN, "Solo5: virtio-mmio@0x%llx: not mapped, ignored\n",
+            (unsigned long long)base);
+        return true;
+    }
+    if (irq >= 16) {
+        log(WARN, "Solo5: virtio-mmio@0x%llx: irq %llu not supported\n",
+            (unsigned long long)base, (unsigned long long)irq);
+        return true;
+    }
+    if (ndevices == VIRTIO_MMIO_DEVICES_MAX) {
+        log(WARN, "Solo5: virtio-mmio@0x%llx: too many devices, ignored\n",
+            (unsigned long long)base);
+        return true;
+    }
+    devices[ndevices].base = base;
+    devices[ndevices].size = size;
+    devices[ndevices].irq = irq;
+    ndevices++;
+    return true;
+}
+
+/*
+ * Records the devices described in (cmdline), and removes their descriptions
+ * from it, so that they are not passed to the application.
+ */
+void virtio_mmio_cmdline(char *cmdline)
+{
+    char *in = cmdline, *out = cmdline;
+
+    while (*in) {
+        char *end = in;
+
+        while (*end && !isspace(*end))
+            end++;
+        if (strncmp(in, opt_device, sizeof(opt_device) - 1) == 0) {
+            if (!parse_device(in + sizeof(opt_device) - 1, end))
+                log(WARN, "Solo5: malformed virtio_mmio.device, ignored\n");
+            while (*end && isspace(*end))
+                end++;
+            in = end;
+            continue;
+        }
+        while (in < end)
+            *out++ = *in++;
+        while (*in && isspace(*in))
+            *out++ = *in++;
+    }
+    *out = 0;
+}
+
+/*
+ * Configures the devices found by virtio_mmio_cmdline(). Returns the number
+ * of devices described on the command line, in which case there is no need
+ * to look for PCI devices.
+ */
+int virtio_mmio_enumerate(void)
+{
+    for (int i = 0; i < ndevices; i++) {
+        volatile uint8_t *m = (volatile uint8_t *)devices[i].base;
+        uint32_t magic = *(volatile uint32_t *)(m + VIRTIO_MMIO_MAGIC);
+        uint32_t version = *(volatile uint32_t *)(m + VIRTIO_MMIO_VERSION);
+        uint32_t type = *(volatile uint32_t *)(m + VIRTIO_MMIO_DEVICE_ID);
+        struct pci_config_info pci = {
+            .bus = 0xff,
+            .dev = i,
+            .irq = devices[i].irq,
+            .mmio = devices[i].base
+        };
+
+        /*
+         * Only the virtio 1.0 ("version 2") interface is supported. Device
+         * type 0 is a placeholder for a device which is not present.
+         */
+        if (magic != VIRTIO_MMIO_MAGIC_VALUE || version != 2) {
+            log(WARN, "Solo5: virtio-mmio@0x%llx: unsupported device\n",
+                (unsigned long long)devices[i].base);
+            continue;
+        }
+        if (type == 0)
+            continue;
+
+        log(INFO, "Solo5: virtio-mmio@0x%llx: device type %u, irq=%u\n",
+            (unsigned long long)devices[i].base, (unsigned)type,
+            (unsigned)devices[i].irq);
+        if (!virtio_config_device(&pci, type))
+            log(WARN, "Solo5: virtio-mmio@0x%llx: not configured\n",
+                (unsigned long long)devices[i].base);
+    }
+    return ndevices;
+}
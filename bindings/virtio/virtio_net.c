@@ -23,18 +23,47 @@
 #include "virtio_pci.h"
 
 /* The feature bitmap for virtio net */
-#define VIRTIO_NET_F_CSUM       0 /* Host handles pkts w/ partial csum */
-#define VIRTIO_NET_F_GUEST_CSUM        1 /* Guest handles pkts w/ partial csum */
+#define VIRTIO_NET_F_CSUM (1 << 0) /* Host handles pkts w/ partial csum */
+#define VIRTIO_NET_F_GUEST_CSUM (1 << 1) /* Guest handles pkts w/ partial csum */
+#define VIRTIO_NET_F_MTU (1 << 3) /* Host has given MTU. */
 #define VIRTIO_NET_F_MAC (1 << 5) /* Host has given MAC address. */
+#define VIRTIO_NET_F_MRG_RXBUF (1 << 15) /* Guest can merge rx buffers. */
+#define VIRTIO_NET_F_CTRL_VQ (1 << 17) /* Control channel available */
+#define VIRTIO_NET_F_MQ (1 << 22) /* Device supports multiple queue pairs */
+#define VIRTIO_NET_F_RSS (1ULL << 60) /* Device supports RSS steering */
+
+/* Offsets in the device configuration, if the matching feature is offered. */
+#define VIRTIO_NET_CONFIG_MAX_PAIRS 8           /* VIRTIO_NET_F_MQ */
+#define VIRTIO_NET_CONFIG_MTU 10                /* VIRTIO_NET_F_MTU */
+#define VIRTIO_NET_CONFIG_RSS_KEY_SIZE 17       /* VIRTIO_NET_F_RSS */
+#define VIRTIO_NET_CONFIG_RSS_TABLE_LEN 18
+#define VIRTIO_NET_CONFIG_RSS_HASH_TYPES 20
 
 #define PKT_BUFFER_LEN 1526
 
-static struct virtq recvq;
-static struct virtq xmitq;
-
+/*
+ * Queue pair (q) uses virtqueues (2q + VIRTQ_RECV) and (2q + VIRTQ_XMIT); the
+ * control virtqueue follows the device's maximum number of queue pairs.
+ */
 #define VIRTQ_RECV 0
 #define VIRTQ_XMIT 1
 
+/*
+ * Commands on the control virtqueue are a header, the command's data and an
+ * ack written by the device, each in a descriptor of its own.
+ */
+#define VIRTIO_NET_CTRL_MQ 4
+#define VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET 0
+#define VIRTIO_NET_CTRL_MQ_RSS_CONFIG 1
+#define VIRTIO_NET_OK 0
+#define CTRL_DATA_MAX 512
+#define CTRL_SPIN_MAX (1UL << 26)
+
+/* RSS hash types used, if supported by the device. */
+#define VIRTIO_NET_RSS_HASH_TYPES 0x3f  /* IPv4, TCPv4, UDPv4, and for IPv6 */
+#define RSS_TABLE_MAX 128
+#define RSS_KEY_LEN 40
+
 /* This header comes first in the scatter-gather list.
  * If VIRTIO_F_ANY_LAYOUT is not negotiated, it must
  * be the first element of the scatter-gather list.  If you don't
@@ -56,97 +85,415 @@ struct __attribute__((__packed__)) virtio_net_hdr {
     uint16_t csum_offset;        /* Offset after that to place checksum */
 };
 
-static uint16_t virtio_net_pci_base; /* base in PCI config space */
+/*
+ * With VIRTIO_NET_F_MRG_RXBUF, the header is followed by the number of receive
+ * buffers the frame is spread across. Legacy devices then use this longer
+ * header in both directions; modern devices always do.
+ */
+struct __attribute__((__packed__)) virtio_net_hdr_mrg_rxbuf {
+    struct virtio_net_hdr hdr;
+    uint16_t num_buffers;
+};
+
+/*
+ * A queue pair of a virtio network device, handed out to a network device
+ * acquired from the application manifest. Devices are configured in PCI
+ * enumeration order. Devices offering VIRTIO_NET_F_MQ may be given several
+ * queue pairs, if the manifest has more network devices than can otherwise be
+ * served (see net_pairs_wanted()); each pair then behaves as a device of its
+ * own, sharing the device's MAC address.
+ */
+struct net_dev {
+    struct virtio_dev *vd;
+    uint16_t pair;
+    struct virtq recvq;
+    struct virtq xmitq;
+
+    uint8_t mac[6];
+    uint16_t mtu;
+    bool mrg_rxbuf;
+    size_t hdr_len;
+    uint8_t *recv_bounce;
+    /*
+     * SOLO5_NET_OFFLOAD_* enabled for the device. With SOLO5_NET_OFFLOAD_HDR,
+     * the solo5_net_hdr prefixing each frame is passed to or from the device
+     * as the virtio_net_hdr, which has the same layout.
+     */
+    uint32_t offloads;
+    size_t app_hdr_len;
+
+    bool acquired;
+    solo5_handle_t handle;
 
-static uint8_t virtio_net_mac[6];
-static char virtio_net_mac_str[18];
+    /* See recv_intr_enable() */
+    bool recv_intr_on;
 
-static bool net_configured;
-static bool net_acquired;
-static solo5_handle_t net_handle;
+    /*
+     * Buffers loaned by the application for zero-copy transmit. The device
+     * completes transmit chains in order, so these can be completed in order
+     * as their chains are consumed.
+     */
+    struct net_wloans xmit_wloans;
+
+    /*
+     * The receive buffer on loan, if any, is always the one at
+     * recvq.last_used, unless the packet spanned several buffers and was
+     * copied to recv_bounce.
+     */
+    bool recv_loaned;
+    bool recv_loaned_bounce;
+};
+
+#define NET_PAIRS_MAX 8
+static struct virtio_dev net_vdevs[VIRTIO_NET_DEVICES_MAX];
+static unsigned net_nvdevs;
+static struct net_dev net_devs[VIRTIO_NET_DEVICES_MAX * NET_PAIRS_MAX];
+static unsigned net_ndevs;
+/* Device acquired for each manifest entry, if any */
+static struct net_dev *net_acquired[MFT_MAX_ENTRIES];
 extern struct mft_note __solo5_manifest_note;
 
-static int handle_virtio_net_interrupt(void *);
+static struct net_dev *net_get(solo5_handle_t h)
+{
+    return (h < MFT_MAX_ENTRIES) ? net_acquired[h] : NULL;
+}
+
 
 /* WARNING: called in interrupt context */
-int handle_virtio_net_interrupt(void *arg __attribute__((unused)))
+static int handle_virtio_net_interrupt(void *arg)
 {
+    struct net_dev *nd = arg;
     uint8_t isr_status;
 
-    if (net_configured) {
-        isr_status = inb(virtio_net_pci_base + VIRTIO_PCI_ISR);
-        if (isr_status & VIRTIO_PCI_ISR_HAS_INTR) {
-            /* This interrupt is just to kick the application out of any
-             * solo5_poll() that may be running. */
-            return 1;
-        }
+    isr_status = virtio_dev_isr(nd->vd);
+    if (isr_status & VIRTIO_PCI_ISR_HAS_INTR) {
+        /* This interrupt is just to kick the application out of any
+         * solo5_poll() that may be running. */
+        return 1;
     }
     return 0;
 }
 
-static void recv_setup(void)
+/*
+ * Largest frame exchanged with the application, including any solo5_net_hdr.
+ */
+static size_t net_frame_max(struct net_dev *nd)
 {
-    uint16_t mask = recvq.num - 1;
+    return nd->app_hdr_len + SOLO5_NET_HLEN + nd->mtu;
+}
+
+/*
+ * Check a frame to be transmitted. Segmentation offloads are not negotiated,
+ * so only checksum offload may be requested.
+ */
+static bool net_frame_valid(struct net_dev *nd, const uint8_t *buf,
+        size_t size)
+{
+    if (size < nd->app_hdr_len || size > net_frame_max(nd))
+        return false;
+    if (nd->app_hdr_len) {
+        const struct solo5_net_hdr *hdr = (const struct solo5_net_hdr *)buf;
+        if (hdr->gso_type != SOLO5_NET_HDR_GSO_NONE ||
+                (hdr->flags & ~SOLO5_NET_HDR_F_NEEDS_CSUM))
+            return false;
+    }
+    return true;
+}
+
+static void recv_setup(struct net_dev *nd)
+{
+    struct virtq *recvq = &nd->recvq;
+    uint16_t mask = recvq->num - 1;
     do {
         struct io_buffer *buf; /* header and data in a single descriptor */
-        buf = &recvq.bufs[recvq.next_avail & mask];
+        buf = &recvq->bufs[recvq->next_avail & mask];
         memset(buf->data, 0, PKT_BUFFER_LEN);
         buf->len = PKT_BUFFER_LEN;
         buf->extra_flags = VIRTQ_DESC_F_WRITE;
-        assert(virtq_add_descriptor_chain(&recvq,
-                                          recvq.next_avail & mask, 1) == 0);
-    } while ((recvq.next_avail & mask) != 0);
+        assert(virtq_add_descriptor_chain(recvq,
+                                          recvq->next_avail & mask, 1) == 0);
+    } while ((recvq->next_avail & mask) != 0);
 
-    outw(virtio_net_pci_base + VIRTIO_PCI_QUEUE_NOTIFY, VIRTQ_RECV);
+    virtq_kick(recvq);
 }
 
-/* performance note: we perform a copy into the xmit buffer */
-int virtio_net_xmit_packet(const void *data, size_t len)
+/* Consume used descriptors from all the previous tx'es. */
+static void xmit_reap(struct net_dev *nd)
 {
-    uint16_t mask = xmitq.num - 1;
+    struct virtq *xmitq = &nd->xmitq;
+    uint16_t mask = xmitq->num - 1;
+    uint16_t head;
+
+    while (virtq_used_get(xmitq, 0, &head, NULL)) {
+        /* A header descriptor followed by a data descriptor. */
+        struct io_buffer *buf = &xmitq->bufs[(head + 1) & mask];
+        if (buf->ext_data != NULL) {
+            buf->ext_data = NULL;
+            net_wloans_complete(&nd->xmit_wloans, 1);
+        }
+        virtq_used_pop(xmitq);
+    }
+}
+
+/*
+ * Every transmit chain is a header descriptor followed by a single data
+ * descriptor, so even descriptors only ever hold headers, and odd ones frames
+ * copied from the application. The headers are kept in an array of their
+ * own, and frame buffers are sized for the MTU.
+ */
+static void xmit_init_bufs(struct net_dev *nd)
+{
+    struct virtq *xmitq = &nd->xmitq;
+    size_t frame_len = SOLO5_NET_HLEN + nd->mtu;
+    unsigned nchains = xmitq->num / 2;
+    uint8_t *hdrs, *frames;
+    size_t pgs;
+
+    assert(nchains > 0);
+    virtq_init_bufs(xmitq, 0);
+    pgs = (((nchains * nd->hdr_len) - 1) >> PAGE_SHIFT) + 1;
+    hdrs = mem_ialloc_pages(pgs);
+    assert(hdrs);
+    pgs = (((nchains * frame_len) - 1) >> PAGE_SHIFT) + 1;
+    frames = mem_ialloc_pages(pgs);
+    assert(frames);
+    for (unsigned i = 0; i < nchains; i++) {
+        xmitq->bufs[2 * i].data = hdrs + i * nd->hdr_len;
+        xmitq->bufs[2 * i + 1].data = frames + i * frame_len;
+    }
+}
+
+/*
+ * If (nocopy), the data descriptor points directly at (data), which must
+ * remain untouched until reaped. Otherwise (data) is copied. Any
+ * solo5_net_hdr at the start of (data) is copied to the header descriptor.
+ */
+static int xmit_packet(struct net_dev *nd, const void *data, size_t len,
+        bool nocopy)
+{
+    struct virtq *xmitq = &nd->xmitq;
+    uint16_t mask = xmitq->num - 1;
     uint16_t head;
     struct io_buffer *head_buf, *data_buf;
+    const void *app_hdr;
     int r;
 
-    /* Consume used descriptors from all the previous tx'es. */
-    for (; xmitq.last_used != xmitq.used->idx; xmitq.last_used++)
-        xmitq.num_avail += 2; /* 2 descriptors per chain */
+    xmit_reap(nd);
+
+    assert(len >= nd->app_hdr_len);
+    app_hdr = data;
+    data = (const uint8_t *)data + nd->app_hdr_len;
+    len -= nd->app_hdr_len;
+    assert(len <= (size_t)SOLO5_NET_HLEN + nd->mtu);
+    /* Don't touch buffers which may still be in flight. */
+    if (xmitq->num_avail < 2)
+        return -1;
 
     /* next_avail is incremented by virtq_add_descriptor_chain below. */
-    head = xmitq.next_avail & mask;
-    head_buf = &xmitq.bufs[head];
-    data_buf = &xmitq.bufs[(head + 1) & mask];
+    head = xmitq->next_avail & mask;
+    assert((head & 1) == 0);
+    head_buf = &xmitq->bufs[head];
+    data_buf = &xmitq->bufs[head + 1];
 
     /* The header buf */
-    memset(head_buf->data, 0, sizeof(struct virtio_net_hdr));
-    head_buf->len = sizeof(struct virtio_net_hdr);
+    memset(head_buf->data, 0, nd->hdr_len);
+    if (nd->app_hdr_len)
+        memcpy(head_buf->data, app_hdr, nd->app_hdr_len);
+    head_buf->len = nd->hdr_len;
     head_buf->extra_flags = 0;
 
     /* The data buf */
-    assert(len <= PKT_BUFFER_LEN);
-    memcpy(data_buf->data, data, len);
+    if (nocopy)
+        data_buf->ext_data = data;
+    else {
+        memcpy(data_buf->data, data, len);
+        data_buf->ext_data = NULL;
+    }
     data_buf->len = len;
     data_buf->extra_flags = 0;
 
-    r = virtq_add_descriptor_chain(&xmitq, head, 2);
+    r = virtq_add_descriptor_chain(xmitq, head, 2);
+    if (r != 0)
+        data_buf->ext_data = NULL;
 
-    outw(virtio_net_pci_base + VIRTIO_PCI_QUEUE_NOTIFY, VIRTQ_XMIT);
+    virtq_kick(xmitq);
 
     return r;
 }
 
-void virtio_config_network(struct pci_config_info *pci)
+/*
+ * Devices are given queue pairs for the network devices in the manifest which
+ * remain once each device before them has one, as queue pairs are handed out
+ * to the application first by pair, then by device (see solo5_net_acquire()).
+ * Device (dev) thus needs at most one pair per (dev + 1) entries, and a single
+ * pair if there are no more network devices in the manifest than devices.
+ */
+static unsigned net_pairs_wanted(unsigned dev)
+{
+    struct mft *mft = &__solo5_manifest_note.m;
+    unsigned entries = 0;
+
+    for (unsigned i = 0; i < mft->entries; i++)
+        if (mft_get_by_index(mft, i, MFT_NET_BASIC) != NULL)
+            entries++;
+    return (entries > dev + 1) ? entries / (dev + 1) : 1;
+}
+
+/*
+ * Runs (class, cmd) with (len) bytes of (data) on the control virtqueue
+ * (ctrlq), waiting for the device to complete it. Returns true if the device
+ * acknowledged it.
+ */
+static bool ctrl_command(struct virtq *ctrlq, uint8_t *page, uint8_t class,
+        uint8_t cmd, const void *data, size_t len)
+{
+    uint16_t mask = ctrlq->num - 1;
+    uint16_t head = ctrlq->next_avail & mask;
+    struct io_buffer *hdr = &ctrlq->bufs[head];
+    struct io_buffer *body = &ctrlq->bufs[(head + 1) & mask];
+    struct io_buffer *ack = &ctrlq->bufs[(head + 2) & mask];
+
+    assert(len <= CTRL_DATA_MAX);
+    hdr->data = page;
+    hdr->data[0] = class;
+    hdr->data[1] = cmd;
+    hdr->len = 2;
+    hdr->extra_flags = 0;
+    body->data = page + 64;
+    memcpy(body->data, data, len);
+    body->len = len;
+    body->extra_flags = 0;
+    ack->data = page + 32;
+    ack->data[0] = ~VIRTIO_NET_OK;
+    ack->len = 1;
+    ack->extra_flags = VIRTQ_DESC_F_WRITE;
+    if (virtq_add_descriptor_chain(ctrlq, head, 3) != 0)
+        return false;
+    virtq_kick(ctrlq);
+
+    for (unsigned long i = 0; !virtq_used_get(ctrlq, 0, NULL, NULL); i++) {
+        if (i == CTRL_SPIN_MAX)
+            return false;
+        __asm__ __volatile__("pause");
+    }
+    virtq_used_pop(ctrlq);
+    return ack->data[0] == VIRTIO_NET_OK;
+}
+
+/*
+ * Tells the device to use (pairs) queue pairs. With RSS, incoming flows are
+ * spread evenly across their receive queues by a Toeplitz hash of their
+ * addresses and ports; otherwise, the device steers them as it sees fit,
+ * normally to the pair last used to transmit on the flow.
+ */
+static bool net_set_pairs(struct virtio_dev *vd, struct virtq *ctrlq,
+        uint16_t pairs, bool rss)
+{
+    static const uint8_t rss_key[RSS_KEY_LEN] = {
+        0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2,
+        0x41, 0x67, 0x25, 0x3d, 0x43, 0xa3, 0x8f, 0xb0,
+        0xd0, 0xca, 0x2b, 0xcb, 0xae, 0x7b, 0x30, 0xb4,
+        0x77, 0xcb, 0x2d, 0xa3, 0x80, 0x30, 0xf2, 0x0c,
+        0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa
+    };
+    uint8_t data[CTRL_DATA_MAX];
+    size_t len;
+
+    if (ctrlq->num < 3)
+        return false;
+    uint8_t *page = mem_ialloc_pages(1);
+    assert(page);
+
+    if (!rss) {
+        memcpy(data, &pairs, sizeof pairs);
+        return ctrl_command(ctrlq, page, VIRTIO_NET_CTRL_MQ,
+                VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET, data, sizeof pairs);
+    }
+
+    /*
+     * struct virtio_net_rss_config: hash types, indirection table mask,
+     * unclassified queue, indirection table, number of transmit queues, key
+     * length and key, all little-endian.
+     */
+    uint32_t hash_types = virtio_dev_config32(vd,
+            VIRTIO_NET_CONFIG_RSS_HASH_TYPES) & VIRTIO_NET_RSS_HASH_TYPES;
+    uint16_t table_max = virtio_dev_config16(vd,
+            VIRTIO_NET_CONFIG_RSS_TABLE_LEN);
+    uint8_t key_len = virtio_dev_config8(vd, VIRTIO_NET_CONFIG_RSS_KEY_SIZE);
+    uint16_t table_len = 1, zero = 0;
+
+    if (table_max > RSS_TABLE_MAX)
+        table_max = RSS_TABLE_MAX;
+    while (table_len * 2 <= table_max)
+        table_len *= 2;
+    if (key_len > RSS_KEY_LEN)
+        key_len = RSS_KEY_LEN;
+    uint16_t table_mask = table_len - 1;
+
+    len = 0;
+    memcpy(data + len, &hash_types, 4);
+    len += 4;
+    memcpy(data + len, &table_mask, 2);
+    len += 2;
+    memcpy(data + len, &zero, 2);
+    len += 2;
+    for (uint16_t i = 0; i < table_len; i++) {
+        uint16_t queue = 2 * (i % pairs) + VIRTQ_RECV;
+        memcpy(data + len, &queue, 2);
+        len += 2;
+    }
+    memcpy(data + len, &pairs, 2);
+    len += 2;
+    data[len++] = key_len;
+    memcpy(data + len, rss_key, key_len);
+    len += key_len;
+    return ctrl_command(ctrlq, page, VIRTIO_NET_CTRL_MQ,
+            VIRTIO_NET_CTRL_MQ_RSS_CONFIG, data, len);
+}
+
+/*
+ * Sets up the virtqueues of queue pair (nd->pair).
+ */
+static void net_pair_init(struct net_dev *nd)
 {
-    uint32_t host_features, guest_features;
     size_t pgs;
 
+    virtq_init_rings(nd->vd, &nd->recvq, 2 * nd->pair + VIRTQ_RECV);
+    virtq_init_rings(nd->vd, &nd->xmitq, 2 * nd->pair + VIRTQ_XMIT);
+
+    virtq_init_bufs(&nd->recvq, PKT_BUFFER_LEN);
+    xmit_init_bufs(nd);
+
     /*
-     * 2. Set the ACKNOWLEDGE status bit: the guest OS has notice the device.
-     * 3. Set the DRIVER status bit: the guest OS knows how to drive the device.
+     * Frames spread across several receive buffers can't be loaned in place,
+     * so are copied here instead.
      */
+    if (nd->mrg_rxbuf) {
+        pgs = ((net_frame_max(nd) - 1) >> PAGE_SHIFT) + 1;
+        nd->recv_bounce = mem_ialloc_pages(pgs);
+        assert(nd->recv_bounce);
+    }
+}
 
-    outb(pci->base + VIRTIO_PCI_STATUS, VIRTIO_PCI_STATUS_ACK);
-    outb(pci->base + VIRTIO_PCI_STATUS, VIRTIO_PCI_STATUS_DRIVER);
+void virtio_config_network(struct pci_config_info *pci)
+{
+    struct virtio_dev *vd;
+    struct net_dev *nd;
+    struct virtq ctrlq;
+    uint64_t host_features, guest_features;
+    char mac_str[18];
+    unsigned pairs = 1;
+    uint16_t max_pairs = 1;
+
+    assert(net_nvdevs < VIRTIO_NET_DEVICES_MAX);
+    vd = &net_vdevs[net_nvdevs];
+    nd = &net_devs[net_ndevs];
+    nd->vd = vd;
+    nd->mtu = 1500;
+    nd->hdr_len = sizeof(struct virtio_net_hdr);
+    nd->recv_intr_on = true;
+
+    virtio_dev_init(vd, pci);
 
     /*
      * 4. Read device feature bits, and write the subset of feature bits
@@ -155,51 +502,123 @@ void virtio_config_network(struct pci_config_info *pci)
      * fields to check that it can support the device before accepting it.
      */
 
-    host_features = inl(pci->base + VIRTIO_PCI_HOST_FEATURES);
+    host_features = virtio_dev_features(vd);
     assert(host_features & VIRTIO_NET_F_MAC);
 
-    /* only negotiate that the mac was set for now */
     guest_features = VIRTIO_NET_F_MAC;
-    outl(pci->base + VIRTIO_PCI_GUEST_FEATURES, guest_features);
+    if (vd->modern)
+        nd->hdr_len = sizeof(struct virtio_net_hdr_mrg_rxbuf);
+    /*
+     * Merging receive buffers lets us receive frames larger than a single
+     * buffer. Without it, we can only accept the device's MTU if its frames
+     * fit in one.
+     */
+    if (host_features & VIRTIO_NET_F_MRG_RXBUF) {
+        guest_features |= VIRTIO_NET_F_MRG_RXBUF;
+        nd->mrg_rxbuf = true;
+        nd->hdr_len = sizeof(struct virtio_net_hdr_mrg_rxbuf);
+    }
+    if (host_features & VIRTIO_NET_F_MTU) {
+        uint16_t mtu = virtio_dev_config16(vd, VIRTIO_NET_CONFIG_MTU);
+        if (mtu >= MFT_NET_MTU_MIN && mtu <= MFT_NET_MTU_MAX &&
+                (nd->mrg_rxbuf ||
+                 nd->hdr_len + SOLO5_NET_HLEN + mtu <= (size_t)PKT_BUFFER_LEN)) {
+            guest_features |= VIRTIO_NET_F_MTU;
+            nd->mtu = mtu;
+        }
+    }
+    /*
+     * Checksum offload. Frames then carry a solo5_net_hdr, through which the
+     * application can leave checksums to the device on transmit, and learn
+     * of partial or already validated checksums on receive. As applications
+     * not expecting the header would misparse every frame, this is only done
+     * if asked for with --solo5:net-offload.
+     */
+    if (cmdline_net_offload && (host_features & VIRTIO_NET_F_CSUM)) {
+        guest_features |= VIRTIO_NET_F_CSUM;
+        nd->offloads = SOLO5_NET_OFFLOAD_HDR;
+        nd->app_hdr_len = SOLO5_NET_HDR_LEN;
+        if (host_features & VIRTIO_NET_F_GUEST_CSUM) {
+            guest_features |= VIRTIO_NET_F_GUEST_CSUM;
+            nd->offloads |= SOLO5_NET_OFFLOAD_CSUM;
+        }
+    }
+    /*
+     * Multiple queue pairs, only if the manifest has use for them. RSS is
+     * only used if the device can hash on some of the flow types we want.
+     */
+    pairs = net_pairs_wanted(net_nvdevs);
+    if (pairs > NET_PAIRS_MAX)
+        pairs = NET_PAIRS_MAX;
+    if (pairs > 1 && (host_features & VIRTIO_NET_F_CTRL_VQ) &&
+            (host_features & VIRTIO_NET_F_MQ))
+        max_pairs = virtio_dev_config16(vd, VIRTIO_NET_CONFIG_MAX_PAIRS);
+    if (max_pairs > 1) {
+        guest_features |= VIRTIO_NET_F_CTRL_VQ | VIRTIO_NET_F_MQ;
+        if ((host_features & VIRTIO_NET_F_RSS) && (virtio_dev_config32(vd,
+                        VIRTIO_NET_CONFIG_RSS_HASH_TYPES) &
+                    VIRTIO_NET_RSS_HASH_TYPES))
+            guest_features |= VIRTIO_NET_F_RSS;
+    }
+    if (pairs > max_pairs)
+        pairs = max_pairs;
+    if (virtio_dev_set_features(vd, host_features,
+                guest_features) != 0) {
+        log(WARN, "Solo5: PCI:%02x:%02x: feature negotiation failed\n",
+            pci->bus, pci->dev);
+        memset(nd, 0, sizeof *nd);
+        memset(vd, 0, sizeof *vd);
+        return;
+    }
 
     for (int i = 0; i < 6; i++) {
-        virtio_net_mac[i] = inb(pci->base + VIRTIO_PCI_CONFIG_OFF + i);
+        nd->mac[i] = virtio_dev_config8(vd, i);
     }
-    snprintf(virtio_net_mac_str,
-             sizeof(virtio_net_mac_str),
+    snprintf(mac_str,
+             sizeof(mac_str),
              "%02x:%02x:%02x:%02x:%02x:%02x",
-             virtio_net_mac[0],
-             virtio_net_mac[1],
-             virtio_net_mac[2],
-             virtio_net_mac[3],
-             virtio_net_mac[4],
-             virtio_net_mac[5]);
-    log(INFO, "Solo5: PCI:%02x:%02x: configured, mac=%s, features=0x%x\n",
-        pci->bus, pci->dev, virtio_net_mac_str, host_features);
+             nd->mac[0],
+             nd->mac[1],
+             nd->mac[2],
+             nd->mac[3],
+             nd->mac[4],
+             nd->mac[5]);
+    log(INFO, "Solo5: PCI:%02x:%02x: configured, mac=%s, mtu=%u, "
+        "features=0x%llx, offloads=0x%x%s%s\n", pci->bus, pci->dev,
+        mac_str, nd->mtu, (unsigned long long)host_features, nd->offloads,
+        vd->modern ? ", modern" : "", vd->packed ? ", packed" : "");
 
     /*
      * 7. Perform device-specific setup, including discovery of virtqueues for
      * the device, optional per-bus setup, reading and possibly writing the
      * device's virtio configuration space, and population of virtqueues.
+     *
+     * All pairs share the settings of the first.
      */
+    for (unsigned q = 1; q < pairs; q++) {
+        net_devs[net_ndevs + q] = *nd;
+        net_devs[net_ndevs + q].pair = q;
+    }
+    net_pair_init(nd);
 
-    virtq_init_rings(pci->base, &recvq, VIRTQ_RECV);
-    virtq_init_rings(pci->base, &xmitq, VIRTQ_XMIT);
-
-    pgs = (((recvq.num * sizeof (struct io_buffer)) - 1) >> PAGE_SHIFT) + 1;
-    recvq.bufs = mem_ialloc_pages(pgs);
-    assert(recvq.bufs);
-    memset(recvq.bufs, 0, pgs << PAGE_SHIFT);
-
-    pgs = (((recvq.num * sizeof (struct io_buffer)) - 1) >> PAGE_SHIFT) + 1;
-    xmitq.bufs = mem_ialloc_pages(pgs);
-    assert(xmitq.bufs);
-    memset(xmitq.bufs, 0, pgs << PAGE_SHIFT);
-
-    virtio_net_pci_base = pci->base;
-    net_configured = 1;
-    intr_register_irq(pci->irq, handle_virtio_net_interrupt, NULL);
-    recv_setup();
+    /*
+     * Only the receive queues interrupt us. With MSI-X, their vectors are not
+     * shared, so there is no ISR to read and nothing to do but wake up. If
+     * the first pair cannot have a vector, all pairs share the legacy IRQ;
+     * otherwise, only as many pairs as have vectors are used, as MSI-X
+     * disables the legacy IRQ.
+     */
+    bool msix = virtio_dev_queue_intr(vd, VIRTQ_RECV, NULL, NULL);
+    if (!msix)
+        intr_register_irq(pci->irq, handle_virtio_net_interrupt, nd);
+    for (unsigned q = 1; q < pairs; q++) {
+        if (msix && !virtio_dev_queue_intr(vd, 2 * q + VIRTQ_RECV, NULL,
+                    NULL)) {
+            pairs = q;
+            break;
+        }
+        net_pair_init(&net_devs[net_ndevs + q]);
+    }
 
     /*
      * We don't need to get interrupts every time the device uses our
@@ -207,181 +626,458 @@ void virtio_config_network(struct pci_config_info *pci)
      * following packets (as suggested in "5.1.6.2.1 Packet Transmission
      * Interrupt").
      */
+    for (unsigned q = 0; q < pairs; q++) {
+        recv_setup(&net_devs[net_ndevs + q]);
+        virtq_intr_disable(&net_devs[net_ndevs + q].xmitq);
+    }
+    if (pairs > 1) {
+        virtq_init_rings(vd, &ctrlq, 2 * max_pairs);
+        virtq_init_bufs(&ctrlq, 0);
+        virtq_intr_disable(&ctrlq);
+    }
 
-    xmitq.avail->flags |= VIRTQ_AVAIL_F_NO_INTERRUPT;
+    virtio_dev_driver_ok(vd);
 
     /*
-     * 8. Set the DRIVER_OK status bit. At this point the device is "live".
+     * The device only uses the first pair until told otherwise.
      */
+    if (pairs > 1) {
+        bool rss = (guest_features & VIRTIO_NET_F_RSS) != 0;
+        if (net_set_pairs(vd, &ctrlq, pairs, rss)) {
+            log(INFO, "Solo5: PCI:%02x:%02x: %u queue pairs%s\n", pci->bus,
+                pci->dev, pairs, rss ? ", RSS" : "");
+        }
+        else {
+            log(WARN, "Solo5: PCI:%02x:%02x: could not enable %u queue "
+                "pairs, using one\n", pci->bus, pci->dev, pairs);
+            pairs = 1;
+        }
+    }
+    net_nvdevs++;
+    net_ndevs += pairs;
+}
 
-    outb(pci->base + VIRTIO_PCI_STATUS, VIRTIO_PCI_STATUS_DRIVER_OK);
+/* Returns true if there is a pending used descriptor for us to read. */
+static bool net_pkt_poll(struct net_dev *nd)
+{
+    return virtq_used_get(&nd->recvq, 0, NULL, NULL);
 }
 
-/* Returns 1 if there is a pending used descriptor for us to read. */
-int virtio_net_pkt_poll(void)
+/*
+ * Receive interrupts are only needed to wake up the application from
+ * solo5_yield() when the receive ring is empty. Once a packet is found
+ * pending, they are left off while the application polls the used ring, and
+ * turned back on only when the ring has been drained or the application is
+ * about to block, so that under load packets are received without interrupts
+ * or reads of the ISR register.
+ */
+static void recv_intr_disable(struct net_dev *nd)
 {
-    if (!net_configured)
-        return 0;
+    if (nd->recv_intr_on) {
+        virtq_intr_disable(&nd->recvq);
+        nd->recv_intr_on = false;
+    }
+}
 
-    /* The device increments used->idx whenever it uses a packet (i.e. it put
-     * a packet on our receive queue) and if it's ahead of last_used it means
-     * that we have a pending packet. */
-    if (recvq.last_used == recvq.used->idx)
-        return 0;
-    else
-        return 1;
+/*
+ * Turn receive interrupts back on. Returns false, leaving them off, if a
+ * packet arrived before the device could see that it should interrupt us.
+ */
+static bool recv_intr_enable(struct net_dev *nd)
+{
+    if (nd->recv_intr_on)
+        return true;
+
+    virtq_intr_enable(&nd->recvq);
+    nd->recv_intr_on = true;
+    __asm__ __volatile__("mfence" ::: "memory");
+    if (net_pkt_poll(nd)) {
+        recv_intr_disable(nd);
+        return false;
+    }
+    return true;
 }
 
-/* Get the data from the next_avail (top-most) receive buffer/descriptpr in
- * the available ring. */
-uint8_t *virtio_net_recv_pkt_get(size_t *size)
+/* Get the receive buffer (i) places past last_used, if the device has put a
+ * packet in it, and the length of the data received in (*len). */
+static struct io_buffer *recv_used(struct net_dev *nd, uint16_t i,
+        size_t *len)
 {
-    uint16_t mask = recvq.num - 1;
-    struct virtq_used_elem *e;
     struct io_buffer *buf;
-    uint16_t desc_idx;
+    uint16_t id;
+    uint32_t used_len;
 
-    /* The device increments used->idx whenever it uses a packet (i.e. it put
-     * a packet on our receive queue) and if it's ahead of last_used it means
-     * that we have a pending packet. */
-    if (recvq.last_used == recvq.used->idx)
+    if (!virtq_used_get(&nd->recvq, i, &id, &used_len))
         return NULL;
 
-    e = &(recvq.used->ring[recvq.last_used & mask]);
-    desc_idx = e->id;
+    buf = &nd->recvq.bufs[id];
+    buf->len = used_len;
+    *len = used_len;
+    return buf;
+}
+
+/* Get the data from the next_avail (top-most) receive buffer/descriptpr in
+ * the available ring, and the number of buffers the packet spans in
+ * (*nbufs). The data in the first buffer is returned in (*size). */
+static uint8_t *recv_pkt_get(struct net_dev *nd, size_t *size,
+        uint16_t *nbufs)
+{
+    struct io_buffer *buf;
+    size_t len;
+
+    buf = recv_used(nd, 0, &len);
+    if (buf == NULL)
+        return NULL;
 
-    buf = (struct io_buffer *) recvq.desc[desc_idx].addr;
-    buf->len = e->len;
+    *nbufs = 1;
+    if (nd->mrg_rxbuf) {
+        struct virtio_net_hdr_mrg_rxbuf *hdr =
+            (struct virtio_net_hdr_mrg_rxbuf *)buf->data;
+        size_t unused;
+
+        if (hdr->num_buffers > 1) {
+            /* The device may still be filling later buffers. */
+            if (recv_used(nd, hdr->num_buffers - 1, &unused) == NULL)
+                return NULL;
+            *nbufs = hdr->num_buffers;
+        }
+    }
 
-    /* Remove the virtio_net_hdr */
-    *size = buf->len - sizeof(struct virtio_net_hdr);
-    return buf->data + sizeof(struct virtio_net_hdr);
+    /*
+     * Remove the virtio_net_hdr. If the application wants it, keep the part
+     * matching solo5_net_hdr directly in front of the frame instead.
+     */
+    if (len < nd->hdr_len)
+        len = nd->hdr_len;
+    if (nd->app_hdr_len != 0 && nd->app_hdr_len != nd->hdr_len)
+        memmove(buf->data + nd->hdr_len - nd->app_hdr_len, buf->data,
+                nd->app_hdr_len);
+    *size = len - nd->hdr_len + nd->app_hdr_len;
+    return buf->data + nd->hdr_len - nd->app_hdr_len;
 }
 
 /* Return the next_avail (top-most) receive buffer/descriptor to the available
- * ring. */
-void virtio_net_recv_pkt_put(void)
+ * ring. The caller notifies the device. */
+static void recv_pkt_put(struct net_dev *nd)
 {
-    uint16_t mask = recvq.num - 1;
-    recvq.bufs[recvq.next_avail & mask].len = PKT_BUFFER_LEN;
-    recvq.bufs[recvq.next_avail & mask].extra_flags = VIRTQ_DESC_F_WRITE;
+    struct virtq *recvq = &nd->recvq;
+    uint16_t mask = recvq->num - 1;
+    recvq->bufs[recvq->next_avail & mask].len = PKT_BUFFER_LEN;
+    recvq->bufs[recvq->next_avail & mask].extra_flags = VIRTQ_DESC_F_WRITE;
 
     /* This sets the returned descriptor to be ready for incoming packets, and
      * advances the next_avail index. */
-    assert(virtq_add_descriptor_chain(&recvq, recvq.next_avail & mask, 1) == 0);
-    outw(virtio_net_pci_base + VIRTIO_PCI_QUEUE_NOTIFY, VIRTQ_RECV);
+    assert(virtq_add_descriptor_chain(recvq, recvq->next_avail & mask, 1) == 0);
 }
 
 /*
- * FIXME: This is a single-device implementation of the new manifest-based
- * APIs. On virtio, this call has the following semantics:
- *
- * 1. The first call to solo5_net_acquire() asking for a handle to a valid
- *    network device (one specified in the application manifest) will succeed,
- *    and return a handle for the sole virtio network device.
- * 2. All subsequent calls will return an error.
- *
- * Note that the presence of a virtio network device is registered during boot
- * in (net_configured), and the initial acquisition by solo5_net_acquire() is
- * registered in (net_acquired).
+ * Network devices are handed out in PCI enumeration order: each call to
+ * solo5_net_acquire() for a valid network device in the application manifest
+ * is given the next virtio network device not yet acquired, and fails once
+ * there are none left. Devices with several queue pairs give out their first
+ * pair in that order, then their second pairs once all devices have been
+ * acquired, and so on, so that applications acquiring no more network devices
+ * than there are virtio devices get a device each.
  */
 solo5_result_t solo5_net_acquire(const char *name, solo5_handle_t *h,
         struct solo5_net_info *info)
 {
-    if (!net_configured || net_acquired)
-        return SOLO5_R_EUNSPEC;
+    struct net_dev *nd = NULL;
 
     unsigned mft_index;
     struct mft_entry *mft_e = mft_get_by_name(&__solo5_manifest_note.m, name,
             MFT_NET_BASIC, &mft_index);
     if (mft_e == NULL)
         return SOLO5_R_EINVAL;
-    net_handle = (solo5_handle_t)mft_index;
-    net_acquired = true;
+    if (net_acquired[mft_index] != NULL)
+        return SOLO5_R_EUNSPEC;
+    for (unsigned q = 0; q < NET_PAIRS_MAX && nd == NULL; q++) {
+        for (unsigned i = 0; i < net_ndevs; i++) {
+            if (net_devs[i].pair == q && !net_devs[i].acquired) {
+                nd = &net_devs[i];
+                break;
+            }
+        }
+    }
+    if (nd == NULL)
+        return SOLO5_R_EUNSPEC;
+
+    nd->handle = (solo5_handle_t)mft_index;
+    nd->acquired = true;
+    net_acquired[mft_index] = nd;
 
-    memcpy(info->mac_address, virtio_net_mac, sizeof info->mac_address);
-    info->mtu = 1500;
+    memcpy(info->mac_address, nd->mac, sizeof info->mac_address);
+    info->mtu = nd->mtu;
+    info->offloads = nd->offloads;
     *h = (solo5_handle_t)mft_index;
-    log(INFO, "Solo5: Application acquired '%s' as network device\n", name);
+    stats_acquire(*h, MFT_NET_BASIC);
+    log(INFO, "Solo5: Application acquired '%s' as network device %u, "
+        "queue pair %u\n", name, (unsigned)(nd->vd - net_vdevs),
+        (unsigned)nd->pair);
     return SOLO5_R_OK;
 }
 
+static solo5_handle_set_t ready_set_poll(void)
+{
+    solo5_handle_set_t ready_set = virtio_blk_ready_set() |
+        virtio_vsock_ready_set();
+
+    for (unsigned i = 0; i < net_ndevs; i++) {
+        struct net_dev *nd = &net_devs[i];
+
+        if (nd->acquired && net_pkt_poll(nd)) {
+            recv_intr_disable(nd);
+            ready_set |= 1ULL << nd->handle;
+        }
+    }
+    return ready_set;
+}
+
+/*
+ * Turn receive interrupts back on for all acquired devices before blocking.
+ * Returns false if a packet arrived in the meantime on any of them.
+ */
+static bool recv_intr_enable_all(void)
+{
+    for (unsigned i = 0; i < net_ndevs; i++) {
+        if (net_devs[i].acquired && !recv_intr_enable(&net_devs[i]))
+            return false;
+    }
+    return true;
+}
+
 bool solo5_yield(solo5_time_t deadline, solo5_handle_set_t *ready_set)
 {
-    bool rc = false;
+    solo5_handle_set_t tmp_ready_set;
 
+    console_flush();
     /*
      * cpu_block() as currently implemented will only poll for the maximum time
-     * the PIT can be run in "one shot" mode. Loop until either I/O is possible
-     * or the desired time has been reached.
+     * the PIT can be run in "one shot" mode, or up to a second with the local
+     * APIC timer. Loop until either I/O is possible or the desired time has
+     * been reached.
      */
     cpu_intr_disable();
     do {
-        if (net_acquired && virtio_net_pkt_poll()) {
-            rc = true;
+        tmp_ready_set = ready_set_poll();
+        if (tmp_ready_set)
             break;
-        }
 
+        if (!recv_intr_enable_all())
+            continue;
+        solo5_time_t idle_start = solo5_clock_monotonic();
         cpu_block(deadline);
+        cpu_time_idle(idle_start);
     } while (solo5_clock_monotonic() < deadline);
-    if (!rc)
-        rc = net_acquired && virtio_net_pkt_poll();
+    if (!tmp_ready_set)
+        tmp_ready_set = ready_set_poll();
     cpu_intr_enable();
 
-    solo5_handle_set_t tmp_ready_set;
-    if (rc)
-        tmp_ready_set = 1UL << net_handle;
-    else
-        tmp_ready_set = 0;
     if (ready_set)
         *ready_set = tmp_ready_set;
-    return rc;
+    return tmp_ready_set != 0;
 }
 
-solo5_result_t solo5_net_write(solo5_handle_t h, const uint8_t *buf,
+static solo5_result_t net_write(solo5_handle_t h, const uint8_t *buf,
         size_t size)
 {
-    if (!net_acquired || h != net_handle)
+    struct net_dev *nd = net_get(h);
+
+    if (nd == NULL || !net_frame_valid(nd, buf, size))
         return SOLO5_R_EINVAL;
 
-    int rv = virtio_net_xmit_packet(buf, size);
+    /* performance note: we perform a copy into the xmit buffer */
+    int rv = xmit_packet(nd, buf, size, false);
     return (rv == 0) ? SOLO5_R_OK : SOLO5_R_EUNSPEC;
 }
 
-solo5_result_t solo5_net_read(solo5_handle_t h, uint8_t *buf, size_t size,
+solo5_result_t solo5_net_write(solo5_handle_t h, const uint8_t *buf,
+        size_t size)
+{
+    return net_stats_tx(h, net_write(h, buf, size), size);
+}
+
+/*
+ * Consume the (nbufs) used descriptors at last_used, returning them to the
+ * device.
+ */
+static void recv_consume(struct net_dev *nd, uint16_t nbufs)
+{
+    for (uint16_t i = 0; i < nbufs; i++) {
+        virtq_used_pop(&nd->recvq);
+        recv_pkt_put(nd);
+    }
+    virtq_kick(&nd->recvq);
+}
+
+/*
+ * Copy the packet starting with (len) bytes at (pkt) and spanning (nbufs)
+ * receive buffers to (buf), truncating it to (size) bytes, and consume the
+ * buffers. Returns the number of bytes copied.
+ */
+static size_t recv_copy(struct net_dev *nd, uint8_t *buf, size_t size,
+        const uint8_t *pkt, size_t len, uint16_t nbufs)
+{
+    size_t off = 0;
+
+    for (uint16_t i = 0; ; ) {
+        if (len > size - off)
+            len = size - off;
+        memcpy(buf + off, pkt, len);
+        off += len;
+        if (++i == nbufs)
+            break;
+        pkt = recv_used(nd, i, &len)->data;
+    }
+    recv_consume(nd, nbufs);
+    return off;
+}
+
+static solo5_result_t net_read(solo5_handle_t h, uint8_t *buf, size_t size,
         size_t *read_size)
 {
+    struct net_dev *nd = net_get(h);
     uint8_t *pkt;
     size_t len = size;
+    uint16_t nbufs;
 
-    if (!net_acquired || h != net_handle)
+    if (nd == NULL)
         return SOLO5_R_EINVAL;
 
-    /* We only need interrupts to wake up the application when it's sleeping
-     * and waiting for incoming packets. The app is definitely not doing that
-     * now (as we are here), so disable them. */
-    recvq.avail->flags |= VIRTQ_AVAIL_F_NO_INTERRUPT;
-
-    pkt = virtio_net_recv_pkt_get(&len);
+    pkt = recv_pkt_get(nd, &len, &nbufs);
     if (!pkt) {
-        recvq.avail->flags &= ~VIRTQ_AVAIL_F_NO_INTERRUPT;
+        /* The ring has been drained. */
+        recv_intr_enable(nd);
         return SOLO5_R_AGAIN;
     }
-
-    assert(len <= size);
-    assert(len <= PKT_BUFFER_LEN);
-    *read_size = len;
+    recv_intr_disable(nd);
 
     /* also, it's clearly not zero copy */
-    memcpy(buf, pkt, len);
+    *read_size = recv_copy(nd, buf, size, pkt, len, nbufs);
+
+    return SOLO5_R_OK;
+}
+
+solo5_result_t solo5_net_read(solo5_handle_t h, uint8_t *buf, size_t size,
+        size_t *read_size)
+{
+    solo5_result_t rc = net_read(h, buf, size, read_size);
+    return net_stats_rx(h, rc, rc == SOLO5_R_OK ? *read_size : 0);
+}
+
+solo5_result_t solo5_net_write_loan(solo5_handle_t h, const uint8_t *buf,
+        size_t size)
+{
+    struct net_dev *nd = net_get(h);
+
+    if (nd == NULL || !net_frame_valid(nd, buf, size))
+        return net_stats_tx(h, SOLO5_R_EINVAL, 0);
+    if (net_wloans_full(&nd->xmit_wloans))
+        return net_stats_tx(h, SOLO5_R_AGAIN, 0);
+
+    if (xmit_packet(nd, buf, size, true) != 0)
+        return net_stats_tx(h, SOLO5_R_EUNSPEC, 0);
+    net_wloans_push(&nd->xmit_wloans, buf);
+    return net_stats_tx(h, SOLO5_R_OK, size);
+}
+
+solo5_result_t solo5_net_write_reclaim(solo5_handle_t h, const uint8_t **bufs,
+        size_t count, size_t *reclaimed)
+{
+    struct net_dev *nd = net_get(h);
+
+    if (nd == NULL)
+        return SOLO5_R_EINVAL;
+
+    xmit_reap(nd);
+    return net_wloans_reclaim(&nd->xmit_wloans, bufs, count, reclaimed);
+}
 
-    /* Consume the recently used descriptor. */
-    recvq.last_used++;
-    recvq.num_avail++;
+solo5_result_t solo5_net_read_loan(solo5_handle_t h, const uint8_t **buf,
+        size_t *size)
+{
+    struct net_dev *nd = net_get(h);
+    uint8_t *pkt;
+    size_t len;
+    uint16_t nbufs;
 
-    virtio_net_recv_pkt_put();
+    if (nd == NULL || nd->recv_loaned)
+        return net_stats_rx(h, SOLO5_R_EINVAL, 0);
 
-    recvq.avail->flags &= ~VIRTQ_AVAIL_F_NO_INTERRUPT;
+    pkt = recv_pkt_get(nd, &len, &nbufs);
+    if (!pkt) {
+        recv_intr_enable(nd);
+        return net_stats_rx(h, SOLO5_R_AGAIN, 0);
+    }
+    recv_intr_disable(nd);
 
+    if (nbufs > 1) {
+        *buf = nd->recv_bounce;
+        *size = recv_copy(nd, nd->recv_bounce, net_frame_max(nd), pkt, len,
+                nbufs);
+        nd->recv_loaned_bounce = true;
+    }
+    else {
+        *buf = pkt;
+        *size = len;
+    }
+    nd->recv_loaned = true;
+    return net_stats_rx(h, SOLO5_R_OK, *size);
+}
+
+solo5_result_t solo5_net_read_release(solo5_handle_t h)
+{
+    struct net_dev *nd = net_get(h);
+
+    if (nd == NULL || !nd->recv_loaned)
+        return SOLO5_R_EINVAL;
+
+    /* Consume the loaned descriptor and hand it back to the device. */
+    if (!nd->recv_loaned_bounce)
+        recv_consume(nd, 1);
+    nd->recv_loaned = false;
+    nd->recv_loaned_bounce = false;
     return SOLO5_R_OK;
 }
+
+/*
+ * The batched interfaces are implemented in terms of the single packet
+ * interfaces; there is no per-call exit to amortise on virtio.
+ */
+solo5_result_t solo5_net_writev(solo5_handle_t h,
+        struct solo5_net_frame *frames, size_t count)
+{
+    solo5_result_t rc = SOLO5_R_OK;
+
+    if (net_get(h) == NULL || count > SOLO5_NET_FRAMES_MAX)
+        return net_stats_tx(h, SOLO5_R_EINVAL, 0);
+
+    for (size_t i = 0; i < count; i++) {
+        frames[i].result = net_write(h, frames[i].buf, frames[i].size);
+        if (frames[i].result != SOLO5_R_OK && rc == SOLO5_R_OK)
+            rc = frames[i].result;
+    }
+    return net_stats_txv(h, rc, frames, count);
+}
+
+solo5_result_t solo5_net_readv(solo5_handle_t h,
+        struct solo5_net_frame *frames, size_t count, size_t *read_count)
+{
+    size_t n;
+
+    if (net_get(h) == NULL || count > SOLO5_NET_FRAMES_MAX)
+        return net_stats_rx(h, SOLO5_R_EINVAL, 0);
+
+    for (n = 0; n < count; n++) {
+        frames[n].result = net_read(h, frames[n].buf, frames[n].size,
+                &frames[n].size);
+        if (frames[n].result != SOLO5_R_OK)
+            break;
+        frames[n].tstamp = 0;
+    }
+    if (n == 0)
+        return net_stats_rx(h, SOLO5_R_AGAIN, 0);
+
+    *read_count = n;
+    return net_stats_rxv(h, SOLO5_R_OK, frames, n);
+}
@@ -0,0 +1,496 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * virtio_pci.c: Legacy and virtio 1.0 ("modern") PCI transports, and the
+ * virtio-mmio transport.
+ */
+
+#include "bindings.h"
+#include "virtio_pci.h"
+#include "virtio_ring.h"
+
+#define PCI_CONF_COMMAND        0x04
+#define PCI_COMMAND_MEMORY      0x2
+#define PCI_COMMAND_MASTER      0x4
+#define PCI_STATUS_CAP_LIST     (0x10 << 16)
+#define PCI_CONF_CAP_PTR        0x34
+#define PCI_CONF_BAR0           0x10
+#define PCI_CAP_ID_VNDR         0x09
+#define PCI_CAP_ID_MSIX         0x11
+
+/* Offsets in the MSI-X capability, and MSI-X table entries */
+#define PCI_MSIX_CTRL           2    /* 16-bit */
+#define PCI_MSIX_CTRL_SIZE      0x7ff
+#define PCI_MSIX_CTRL_MASKALL   (1 << 14)
+#define PCI_MSIX_CTRL_ENABLE    (1 << 15)
+#define PCI_MSIX_TABLE          4    /* 32-bit, BAR in low 3 bits */
+#define PCI_MSIX_ENTRY_SIZE     16
+#define PCI_MSIX_ENTRY_ADDRLO   0
+#define PCI_MSIX_ENTRY_ADDRHI   4
+#define PCI_MSIX_ENTRY_DATA     8
+#define PCI_MSIX_ENTRY_CTRL     12
+
+static inline uint8_t mmio_read8(volatile uint8_t *base, unsigned off)
+{
+    return *(volatile uint8_t *)(base + off);
+}
+
+static inline uint16_t mmio_read16(volatile uint8_t *base, unsigned off)
+{
+    return *(volatile uint16_t *)(base + off);
+}
+
+static inline uint32_t mmio_read32(volatile uint8_t *base, unsigned off)
+{
+    return *(volatile uint32_t *)(base + off);
+}
+
+static inline void mmio_write8(volatile uint8_t *base, unsigned off,
+        uint8_t val)
+{
+    *(volatile uint8_t *)(base + off) = val;
+}
+
+static inline void mmio_write16(volatile uint8_t *base, unsigned off,
+        uint16_t val)
+{
+    *(volatile uint16_t *)(base + off) = val;
+}
+
+static inline void mmio_write32(volatile uint8_t *base, unsigned off,
+        uint32_t val)
+{
+    *(volatile uint32_t *)(base + off) = val;
+}
+
+/*
+ * Returns the address of the (length) bytes at (offset) in memory BAR (bar),
+ * or NULL if the BAR is not usable.
+ */
+static volatile uint8_t *bar_map(const struct pci_config_info *pci,
+        uint8_t bar, uint32_t offset, uint32_t length)
+{
+    uint32_t lo;
+    uint64_t addr;
+
+    if (bar > 5)
+        return NULL;
+    lo = pci_config_read32(pci, PCI_CONF_BAR0 + bar * 4);
+    if (lo & 0x1)
+        return NULL;
+    addr = lo & ~0xfULL;
+    if (((lo >> 1) & 0x3) == 0x2 && bar < 5)
+        addr |= (uint64_t)pci_config_read32(pci, PCI_CONF_BAR0 +
+                (bar + 1) * 4) << 32;
+
+    addr += offset;
+    if (addr < platform_mmio_start() || addr + length > MMIO_END)
+        return NULL;
+    return (volatile uint8_t *)addr;
+}
+
+/*
+ * Walks the capability list of (pci) for the virtio 1.0 register blocks.
+ * Returns false if any is missing or cannot be mapped.
+ */
+static bool modern_probe(struct virtio_dev *vd,
+        const struct pci_config_info *pci)
+{
+    uint8_t ptr;
+
+    if (!(pci_config_read32(pci, PCI_CONF_COMMAND) & PCI_STATUS_CAP_LIST))
+        return false;
+
+    ptr = pci_config_read32(pci, PCI_CONF_CAP_PTR) & 0xfc;
+    for (int n = 0; ptr != 0 && n < 48; n++) {
+        uint32_t hdr = pci_config_read32(pci, ptr);
+        uint8_t next = (hdr >> 8) & 0xfc;
+
+        if ((hdr & 0xff) == PCI_CAP_ID_MSIX)
+            vd->msix_cap = ptr;
+        if ((hdr & 0xff) == PCI_CAP_ID_VNDR) {
+            uint8_t cfg_type = hdr >> (VIRTIO_PCI_CAP_CFG_TYPE * 8);
+            uint8_t bar = pci_config_read32(pci, ptr + VIRTIO_PCI_CAP_BAR);
+            uint32_t offset = pci_config_read32(pci,
+                    ptr + VIRTIO_PCI_CAP_OFFSET);
+            uint32_t length = pci_config_read32(pci,
+                    ptr + VIRTIO_PCI_CAP_LENGTH);
+            volatile uint8_t *p = bar_map(pci, bar, offset, length);
+
+            switch (cfg_type) {
+            case VIRTIO_PCI_CAP_COMMON_CFG:
+                if (vd->common == NULL)
+                    vd->common = p;
+                break;
+            case VIRTIO_PCI_CAP_NOTIFY_CFG:
+                if (vd->notify == NULL) {
+                    vd->notify = p;
+                    vd->notify_mult = pci_config_read32(pci,
+                            ptr + VIRTIO_PCI_CAP_NOTIFY_MULT);
+                }
+                break;
+            case VIRTIO_PCI_CAP_ISR_CFG:
+                if (vd->isr == NULL)
+                    vd->isr = p;
+                break;
+            case VIRTIO_PCI_CAP_DEVICE_CFG:
+                if (vd->device == NULL)
+                    vd->device = p;
+                break;
+            default:
+                break;
+            }
+        }
+        ptr = next;
+    }
+
+    return vd->common && vd->notify && vd->isr && vd->device;
+}
+
+/*
+ * Maps the MSI-X table of (pci), if it has one within reach. It is left
+ * disabled until an entry is used.
+ */
+static void msix_probe(struct virtio_dev *vd,
+        const struct pci_config_info *pci)
+{
+    uint16_t ctrl;
+    uint32_t table;
+
+    if (vd->msix_cap == 0)
+        return;
+    ctrl = pci_config_read32(pci, vd->msix_cap) >> 16;
+    table = pci_config_read32(pci, vd->msix_cap + PCI_MSIX_TABLE);
+    vd->msix_size = (ctrl & PCI_MSIX_CTRL_SIZE) + 1;
+    vd->msix_table = bar_map(pci, table & 0x7, table & ~0x7U,
+            vd->msix_size * PCI_MSIX_ENTRY_SIZE);
+}
+
+static uint8_t get_status(struct virtio_dev *vd)
+{
+    if (vd->mmio)
+        return mmio_read32(vd->mmio, VIRTIO_MMIO_STATUS);
+    else if (vd->modern)
+        return mmio_read8(vd->common, VIRTIO_PCI_COMMON_STATUS);
+    else
+        return inb(vd->io_base + VIRTIO_PCI_STATUS);
+}
+
+static void set_status(struct virtio_dev *vd, uint8_t status)
+{
+    if (vd->mmio)
+        mmio_write32(vd->mmio, VIRTIO_MMIO_STATUS, status);
+    else if (vd->modern)
+        mmio_write8(vd->common, VIRTIO_PCI_COMMON_STATUS, status);
+    else
+        outb(vd->io_base + VIRTIO_PCI_STATUS, status);
+}
+
+void virtio_dev_init(struct virtio_dev *vd, const struct pci_config_info *pci)
+{
+    memset(vd, 0, sizeof *vd);
+    vd->io_base = pci->base;
+    vd->pci = *pci;
+
+    if (pci->mmio != 0) {
+        vd->mmio = (volatile uint8_t *)pci->mmio;
+        vd->modern = true;
+    }
+    else if (modern_probe(vd, pci)) {
+        vd->modern = true;
+        msix_probe(vd, pci);
+    }
+    else if (pci->base == 0) {
+        log(ERROR, "Solo5: PCI:%02x:%02x: no usable virtio interface\n",
+            pci->bus, pci->dev);
+        solo5_abort();
+    }
+
+    /*
+     * 1. Reset the device. Firmware only enables I/O port decoding for the
+     * devices it knows about, so make sure the memory BARs decode too.
+     */
+    if (vd->modern) {
+        if (vd->mmio == NULL) {
+            uint16_t command = pci_config_read32(pci, PCI_CONF_COMMAND);
+            pci_config_write16(pci, PCI_CONF_COMMAND,
+                    command | PCI_COMMAND_MEMORY | PCI_COMMAND_MASTER);
+        }
+        set_status(vd, 0);
+        while (get_status(vd) != 0)
+            ;
+    }
+
+    /*
+     * 2. Set the ACKNOWLEDGE status bit: the guest OS has notice the device.
+     * 3. Set the DRIVER status bit: the guest OS knows how to drive the device.
+     */
+    set_status(vd, VIRTIO_PCI_STATUS_ACK);
+    set_status(vd, VIRTIO_PCI_STATUS_ACK | VIRTIO_PCI_STATUS_DRIVER);
+}
+
+uint64_t virtio_dev_features(struct virtio_dev *vd)
+{
+    uint64_t features;
+
+    if (!vd->modern)
+        return inl(vd->io_base + VIRTIO_PCI_HOST_FEATURES);
+    if (vd->mmio) {
+        mmio_write32(vd->mmio, VIRTIO_MMIO_DEVICE_FEATURES_SEL, 0);
+        features = mmio_read32(vd->mmio, VIRTIO_MMIO_DEVICE_FEATURES);
+        mmio_write32(vd->mmio, VIRTIO_MMIO_DEVICE_FEATURES_SEL, 1);
+        features |= (uint64_t)mmio_read32(vd->mmio,
+                VIRTIO_MMIO_DEVICE_FEATURES) << 32;
+        return features;
+    }
+
+    mmio_write32(vd->common, VIRTIO_PCI_COMMON_DFSELECT, 0);
+    features = mmio_read32(vd->common, VIRTIO_PCI_COMMON_DF);
+    mmio_write32(vd->common, VIRTIO_PCI_COMMON_DFSELECT, 1);
+    features |= (uint64_t)mmio_read32(vd->common, VIRTIO_PCI_COMMON_DF) << 32;
+    return features;
+}
+
+int virtio_dev_set_features(struct virtio_dev *vd, uint64_t host_features,
+        uint64_t features)
+{
+    /*
+     * With VIRTIO_F_EVENT_IDX, the driver and device tell each other how far
+     * into the ring they want to be notified of, rather than just whether,
+     * so that a busy device is not notified of each buffer separately.
+     */
+    if (host_features & (1ULL << VIRTIO_F_EVENT_IDX)) {
+        features |= 1ULL << VIRTIO_F_EVENT_IDX;
+        vd->event_idx = true;
+    }
+
+    if (!vd->modern) {
+        outl(vd->io_base + VIRTIO_PCI_GUEST_FEATURES, (uint32_t)features);
+        return 0;
+    }
+
+    /*
+     * A modern device requires VIRTIO_F_VERSION_1. Packed virtqueues are used
+     * whenever the device offers them, which is up to its configuration on
+     * the host.
+     */
+    if (!(host_features & VIRTIO_F_VERSION_1))
+        return -1;
+    features |= VIRTIO_F_VERSION_1;
+    if (host_features & VIRTIO_F_RING_PACKED) {
+        features |= VIRTIO_F_RING_PACKED;
+        vd->packed = true;
+    }
+
+    if (vd->mmio) {
+        mmio_write32(vd->mmio, VIRTIO_MMIO_DRIVER_FEATURES_SEL, 0);
+        mmio_write32(vd->mmio, VIRTIO_MMIO_DRIVER_FEATURES,
+                (uint32_t)features);
+        mmio_write32(vd->mmio, VIRTIO_MMIO_DRIVER_FEATURES_SEL, 1);
+        mmio_write32(vd->mmio, VIRTIO_MMIO_DRIVER_FEATURES,
+                (uint32_t)(features >> 32));
+    }
+    else {
+        mmio_write32(vd->common, VIRTIO_PCI_COMMON_GFSELECT, 0);
+        mmio_write32(vd->common, VIRTIO_PCI_COMMON_GF, (uint32_t)features);
+        mmio_write32(vd->common, VIRTIO_PCI_COMMON_GFSELECT, 1);
+        mmio_write32(vd->common, VIRTIO_PCI_COMMON_GF,
+                (uint32_t)(features >> 32));
+    }
+
+    set_status(vd, get_status(vd) | VIRTIO_PCI_STATUS_FEATURES_OK);
+    if (!(get_status(vd) & VIRTIO_PCI_STATUS_FEATURES_OK))
+        return -1;
+    return 0;
+}
+
+void virtio_dev_driver_ok(struct virtio_dev *vd)
+{
+    /*
+     * 8. Set the DRIVER_OK status bit. At this point the device is "live".
+     */
+    set_status(vd, get_status(vd) | VIRTIO_PCI_STATUS_DRIVER_OK);
+}
+
+/*
+ * MSI-X is only used with the modern interface: with the legacy one, enabling
+ * it moves the device-specific configuration. virtio-mmio devices have no
+ * MSI-X table.
+ */
+bool virtio_dev_queue_intr(struct virtio_dev *vd, uint16_t selector,
+        int (*handler)(void *), void *arg)
+{
+    volatile uint8_t *c = vd->common;
+    volatile uint8_t *entry;
+    uint16_t n = vd->msix_used;
+    uint64_t addr;
+    uint32_t data;
+
+    if (!vd->modern || vd->msix_table == NULL || n == vd->msix_size)
+        return false;
+
+    /* The device reads back NO_VECTOR if it cannot use the entry. */
+    mmio_write16(c, VIRTIO_PCI_COMMON_Q_SELECT, selector);
+    mmio_write16(c, VIRTIO_PCI_COMMON_Q_MSIX, n);
+    if (mmio_read16(c, VIRTIO_PCI_COMMON_Q_MSIX) != n)
+        return false;
+    if (lapic_msi_alloc(handler, arg, &addr, &data) != 0) {
+        mmio_write16(c, VIRTIO_PCI_COMMON_Q_MSIX, VIRTIO_MSI_NO_VECTOR);
+        return false;
+    }
+
+    entry = vd->msix_table + n * PCI_MSIX_ENTRY_SIZE;
+    mmio_write32(entry, PCI_MSIX_ENTRY_ADDRLO, (uint32_t)addr);
+    mmio_write32(entry, PCI_MSIX_ENTRY_ADDRHI, (uint32_t)(addr >> 32));
+    mmio_write32(entry, PCI_MSIX_ENTRY_DATA, data);
+    mmio_write32(entry, PCI_MSIX_ENTRY_CTRL, 0);
+
+    if (vd->msix_used++ == 0) {
+        /* We do not handle configuration changes. */
+        mmio_write16(c, VIRTIO_PCI_COMMON_MSIX_CONFIG, VIRTIO_MSI_NO_VECTOR);
+        uint16_t ctrl = pci_config_read32(&vd->pci, vd->msix_cap) >> 16;
+        pci_config_write16(&vd->pci, vd->msix_cap + PCI_MSIX_CTRL,
+                (ctrl | PCI_MSIX_CTRL_ENABLE) & ~PCI_MSIX_CTRL_MASKALL);
+    }
+    log(INFO, "Solo5: PCI:%02x:%02x: queue %u: MSI-X vector %u\n",
+        vd->pci.bus, vd->pci.dev, selector, (unsigned)data);
+    return true;
+}
+
+/* WARNING: called in interrupt context */
+uint8_t virtio_dev_isr(struct virtio_dev *vd)
+{
+    if (vd->mmio) {
+        uint32_t status = mmio_read32(vd->mmio, VIRTIO_MMIO_INTERRUPT_STATUS);
+        mmio_write32(vd->mmio, VIRTIO_MMIO_INTERRUPT_ACK, status);
+        return status;
+    }
+    else if (vd->modern)
+        return mmio_read8(vd->isr, 0);
+    else
+        return inb(vd->io_base + VIRTIO_PCI_ISR);
+}
+
+uint8_t virtio_dev_config8(struct virtio_dev *vd, unsigned off)
+{
+    if (vd->mmio)
+        return mmio_read8(vd->mmio, VIRTIO_MMIO_CONFIG + off);
+    else if (vd->modern)
+        return mmio_read8(vd->device, off);
+    else
+        return inb(vd->io_base + VIRTIO_PCI_CONFIG_OFF + off);
+}
+
+uint16_t virtio_dev_config16(struct virtio_dev *vd, unsigned off)
+{
+    if (vd->mmio)
+        return mmio_read16(vd->mmio, VIRTIO_MMIO_CONFIG + off);
+    else if (vd->modern)
+        return mmio_read16(vd->device, off);
+    else
+        return inw(vd->io_base + VIRTIO_PCI_CONFIG_OFF + off);
+}
+
+uint32_t virtio_dev_config32(struct virtio_dev *vd, unsigned off)
+{
+    if (vd->mmio)
+        return mmio_read32(vd->mmio, VIRTIO_MMIO_CONFIG + off);
+    else if (vd->modern)
+        return mmio_read32(vd->device, off);
+    else
+        return inl(vd->io_base + VIRTIO_PCI_CONFIG_OFF + off);
+}
+
+uint64_t virtio_dev_config64(struct virtio_dev *vd, unsigned off)
+{
+    if (vd->mmio)
+        return mmio_read32(vd->mmio, VIRTIO_MMIO_CONFIG + off) |
+            ((uint64_t)mmio_read32(vd->mmio, VIRTIO_MMIO_CONFIG + off + 4)
+             << 32);
+    else if (vd->modern)
+        return mmio_read32(vd->device, off) |
+            ((uint64_t)mmio_read32(vd->device, off + 4) << 32);
+    else
+        return inq(vd->io_base + VIRTIO_PCI_CONFIG_OFF + off);
+}
+
+/*
+ * Sets up queue (selector) of (vd) with (num) entries in the rings at (desc),
+ * (driver) and (device), returning where to notify the device of it in
+ * (*notify_addr), or for a virtio-mmio device, (*notify_mmio).
+ */
+void virtio_dev_queue_setup(struct virtio_dev *vd, uint16_t selector,
+        uint16_t num, uint64_t desc, uint64_t driver, uint64_t device,
+        volatile uint16_t **notify_addr, volatile uint32_t **notify_mmio)
+{
+    volatile uint8_t *c = vd->common;
+
+    if (vd->mmio) {
+        volatile uint8_t *m = vd->mmio;
+
+        mmio_write32(m, VIRTIO_MMIO_QUEUE_SEL, selector);
+        mmio_write32(m, VIRTIO_MMIO_QUEUE_NUM, num);
+        mmio_write32(m, VIRTIO_MMIO_QUEUE_DESC_LOW, (uint32_t)desc);
+        mmio_write32(m, VIRTIO_MMIO_QUEUE_DESC_HIGH, (uint32_t)(desc >> 32));
+        mmio_write32(m, VIRTIO_MMIO_QUEUE_DRIVER_LOW, (uint32_t)driver);
+        mmio_write32(m, VIRTIO_MMIO_QUEUE_DRIVER_HIGH,
+                (uint32_t)(driver >> 32));
+        mmio_write32(m, VIRTIO_MMIO_QUEUE_DEVICE_LOW, (uint32_t)device);
+        mmio_write32(m, VIRTIO_MMIO_QUEUE_DEVICE_HIGH,
+                (uint32_t)(device >> 32));
+        mmio_write32(m, VIRTIO_MMIO_QUEUE_READY, 1);
+        *notify_addr = NULL;
+        *notify_mmio = (volatile uint32_t *)(m + VIRTIO_MMIO_QUEUE_NOTIFY);
+        return;
+    }
+
+    mmio_write16(c, VIRTIO_PCI_COMMON_Q_SELECT, selector);
+    mmio_write16(c, VIRTIO_PCI_COMMON_Q_SIZE, num);
+    mmio_write32(c, VIRTIO_PCI_COMMON_Q_DESCLO, (uint32_t)desc);
+    mmio_write32(c, VIRTIO_PCI_COMMON_Q_DESCHI, (uint32_t)(desc >> 32));
+    mmio_write32(c, VIRTIO_PCI_COMMON_Q_AVAILLO, (uint32_t)driver);
+    mmio_write32(c, VIRTIO_PCI_COMMON_Q_AVAILHI, (uint32_t)(driver >> 32));
+    mmio_write32(c, VIRTIO_PCI_COMMON_Q_USEDLO, (uint32_t)device);
+    mmio_write32(c, VIRTIO_PCI_COMMON_Q_USEDHI, (uint32_t)(device >> 32));
+    *notify_addr = (volatile uint16_t *)(vd->notify +
+            mmio_read16(c, VIRTIO_PCI_COMMON_Q_NOFF) * vd->notify_mult);
+    *notify_mmio = NULL;
+    mmio_write16(c, VIRTIO_PCI_COMMON_Q_ENABLE, 1);
+}
+
+/*
+ * Returns the largest queue size the device supports for queue (selector).
+ */
+uint16_t virtio_dev_queue_size(struct virtio_dev *vd, uint16_t selector)
+{
+    if (vd->mmio) {
+        mmio_write32(vd->mmio, VIRTIO_MMIO_QUEUE_SEL, selector);
+        return mmio_read32(vd->mmio, VIRTIO_MMIO_QUEUE_NUM_MAX);
+    }
+    else if (vd->modern) {
+        mmio_write16(vd->common, VIRTIO_PCI_COMMON_Q_SELECT, selector);
+        return mmio_read16(vd->common, VIRTIO_PCI_COMMON_Q_SIZE);
+    }
+    else {
+        outw(vd->io_base + VIRTIO_PCI_QUEUE_SEL, selector);
+        return inw(vd->io_base + VIRTIO_PCI_QUEUE_SIZE);
+    }
+}
@@ -21,6 +21,13 @@
 #ifndef VIRTIO_PCI_H
 #define VIRTIO_PCI_H
 
+/*
+ * Memory BARs and virtio-mmio registers are only accessible if they lie
+ * within the uncached mapping set up in pagetable.S, from
+ * platform_mmio_start() to MMIO_END.
+ */
+#define MMIO_END                0x100000000ULL
+
 /* virtio config space layout */
 #define VIRTIO_PCI_HOST_FEATURES        0    /* 32-bit r/o */
 #define VIRTIO_PCI_GUEST_FEATURES       4    /* 32-bit r/w */
@@ -55,4 +62,143 @@
 /* xxx assuming msi is not configured */
 #define VIRTIO_PCI_CONFIG_OFF           20
 
+/* Device status bits added by virtio 1.0 */
+#define VIRTIO_PCI_STATUS_FEATURES_OK   0x8  /* feature negotiation complete */
+
+/* Transport feature bits, beyond the 32 available to legacy devices */
+#define VIRTIO_F_VERSION_1              (1ULL << 32)
+#define VIRTIO_F_RING_PACKED            (1ULL << 34)
+
+/*
+ * Virtio 1.0 ("modern") devices describe the location of their register
+ * blocks in memory BARs with vendor-specific PCI capabilities.
+ */
+#define VIRTIO_PCI_CAP_COMMON_CFG       1
+#define VIRTIO_PCI_CAP_NOTIFY_CFG       2
+#define VIRTIO_PCI_CAP_ISR_CFG          3
+#define VIRTIO_PCI_CAP_DEVICE_CFG       4
+
+/* Offsets in struct virtio_pci_cap, and virtio_pci_notify_cap */
+#define VIRTIO_PCI_CAP_CFG_TYPE         3    /* 8-bit */
+#define VIRTIO_PCI_CAP_BAR              4    /* 8-bit */
+#define VIRTIO_PCI_CAP_OFFSET           8    /* 32-bit */
+#define VIRTIO_PCI_CAP_LENGTH           12   /* 32-bit */
+#define VIRTIO_PCI_CAP_NOTIFY_MULT      16   /* 32-bit */
+
+/* Offsets in the common configuration structure */
+#define VIRTIO_PCI_COMMON_DFSELECT      0    /* 32-bit r/w */
+#define VIRTIO_PCI_COMMON_DF            4    /* 32-bit r/o */
+#define VIRTIO_PCI_COMMON_GFSELECT      8    /* 32-bit r/w */
+#define VIRTIO_PCI_COMMON_GF            12   /* 32-bit r/w */
+#define VIRTIO_PCI_COMMON_MSIX_CONFIG   16   /* 16-bit r/w */
+#define VIRTIO_PCI_COMMON_STATUS        20   /* 8-bit r/w */
+#define VIRTIO_PCI_COMMON_Q_SELECT      22   /* 16-bit r/w */
+#define VIRTIO_PCI_COMMON_Q_SIZE        24   /* 16-bit r/w */
+#define VIRTIO_PCI_COMMON_Q_MSIX        26   /* 16-bit r/w */
+#define VIRTIO_PCI_COMMON_Q_ENABLE      28   /* 16-bit r/w */
+#define VIRTIO_PCI_COMMON_Q_NOFF        30   /* 16-bit r/o */
+#define VIRTIO_PCI_COMMON_Q_DESCLO      32   /* 32-bit r/w */
+#define VIRTIO_PCI_COMMON_Q_DESCHI      36   /* 32-bit r/w */
+#define VIRTIO_PCI_COMMON_Q_AVAILLO     40   /* 32-bit r/w */
+#define VIRTIO_PCI_COMMON_Q_AVAILHI     44   /* 32-bit r/w */
+#define VIRTIO_PCI_COMMON_Q_USEDLO      48   /* 32-bit r/w */
+#define VIRTIO_PCI_COMMON_Q_USEDHI      52   /* 32-bit r/w */
+
+#define VIRTIO_MSI_NO_VECTOR            0xffff
+
+/*
+ * virtio-mmio (version 2) register layout. All registers but the
+ * device-specific configuration must be accessed 32 bits at a time.
+ */
+#define VIRTIO_MMIO_MAGIC               0x000
+#define VIRTIO_MMIO_MAGIC_VALUE         0x74726976      /* "virt" */
+#define VIRTIO_MMIO_VERSION             0x004
+#define VIRTIO_MMIO_DEVICE_ID           0x008
+#define VIRTIO_MMIO_DEVICE_FEATURES     0x010
+#define VIRTIO_MMIO_DEVICE_FEATURES_SEL 0x014
+#define VIRTIO_MMIO_DRIVER_FEATURES     0x020
+#define VIRTIO_MMIO_DRIVER_FEATURES_SEL 0x024
+#define VIRTIO_MMIO_QUEUE_SEL           0x030
+#define VIRTIO_MMIO_QUEUE_NUM_MAX       0x034
+#define VIRTIO_MMIO_QUEUE_NUM           0x038
+#define VIRTIO_MMIO_QUEUE_READY         0x044
+#define VIRTIO_MMIO_QUEUE_NOTIFY        0x050
+#define VIRTIO_MMIO_INTERRUPT_STATUS    0x060
+#define VIRTIO_MMIO_INTERRUPT_ACK       0x064
+#define VIRTIO_MMIO_STATUS              0x070
+#define VIRTIO_MMIO_QUEUE_DESC_LOW      0x080
+#define VIRTIO_MMIO_QUEUE_DESC_HIGH     0x084
+#define VIRTIO_MMIO_QUEUE_DRIVER_LOW    0x090
+#define VIRTIO_MMIO_QUEUE_DRIVER_HIGH   0x094
+#define VIRTIO_MMIO_QUEUE_DEVICE_LOW    0x0a0
+#define VIRTIO_MMIO_QUEUE_DEVICE_HIGH   0x0a4
+#define VIRTIO_MMIO_CONFIG              0x100
+
+/*
+ * A virtio PCI device, driven either through the legacy I/O port interface at
+ * (io_base), or, if (modern), through the virtio 1.0 register blocks mapped
+ * from its memory BARs. A virtio-mmio device is (modern), with its registers
+ * at (mmio).
+ */
+struct virtio_dev {
+    bool modern;
+    volatile uint8_t *mmio;
+    bool packed;                /* VIRTIO_F_RING_PACKED negotiated */
+    bool event_idx;             /* VIRTIO_F_EVENT_IDX negotiated */
+    uint16_t io_base;
+    volatile uint8_t *common;
+    volatile uint8_t *isr;
+    volatile uint8_t *device;
+    volatile uint8_t *notify;
+    uint32_t notify_mult;
+
+    /*
+     * MSI-X table of a modern device, if it has one we can map, and the
+     * number of entries in it and in use. MSI-X is enabled once the first
+     * entry is, see virtio_dev_queue_intr().
+     */
+    struct pci_config_info pci;
+    uint8_t msix_cap;
+    volatile uint8_t *msix_table;
+    uint16_t msix_size;
+    uint16_t msix_used;
+};
+
+/*
+ * Resets the device and tells it that we know how to drive it. The modern
+ * interface is used if the device provides it at an address we can map.
+ */
+void virtio_dev_init(struct virtio_dev *vd, const struct pci_config_info *pci);
+uint64_t virtio_dev_features(struct virtio_dev *vd);
+/*
+ * Accepts the device-specific (features), together with the transport
+ * features we support. Returns -1 if the device does not accept them.
+ */
+int virtio_dev_set_features(struct virtio_dev *vd, uint64_t host_features,
+        uint64_t features);
+void virtio_dev_driver_ok(struct virtio_dev *vd);
+/*
+ * Gives queue (selector) of (vd) an MSI-X vector of its own, calling
+ * (handler) with (arg) when it interrupts, see lapic_msi_alloc(). Returns
+ * false if MSI-X cannot be used, in which case the caller should use the
+ * device's legacy IRQ instead. Must be called before virtio_dev_driver_ok(),
+ * and for all queues of a device needing interrupts, if any: once a queue
+ * has a vector, the legacy IRQ is no longer raised.
+ */
+bool virtio_dev_queue_intr(struct virtio_dev *vd, uint16_t selector,
+        int (*handler)(void *), void *arg);
+uint8_t virtio_dev_isr(struct virtio_dev *vd);
+
+/* Reads from the device-specific configuration at (off) */
+uint8_t virtio_dev_config8(struct virtio_dev *vd, unsigned off);
+uint16_t virtio_dev_config16(struct virtio_dev *vd, unsigned off);
+uint32_t virtio_dev_config32(struct virtio_dev *vd, unsigned off);
+uint64_t virtio_dev_config64(struct virtio_dev *vd, unsigned off);
+
+/* Queue setup, for virtio_ring.c */
+uint16_t virtio_dev_queue_size(struct virtio_dev *vd, uint16_t selector);
+void virtio_dev_queue_setup(struct virtio_dev *vd, uint16_t selector,
+        uint16_t num, uint64_t desc, uint64_t driver, uint64_t device,
+        volatile uint16_t **notify_addr, volatile uint32_t **notify_mmio);
+
 #endif
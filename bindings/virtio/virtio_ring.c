@@ -29,9 +29,49 @@
 #define VIRTQ_MAX_QUEUE_SIZE 8192
 
 
+/* The wrap counter for descriptor (pos) of a packed virtqueue. */
+static inline bool virtq_wrap(struct virtq *vq, uint16_t pos)
+{
+    return ((pos / vq->num) & 1) == 0;
+}
+
+static void virtq_add_packed(struct virtq *vq, uint16_t head, uint16_t num)
+{
+    uint16_t mask = vq->num - 1;
+    uint16_t pos = vq->next_avail;
+    uint16_t head_flags = 0;
+
+    for (uint16_t k = 0; k < num; k++, pos++) {
+        struct io_buffer *buf = &vq->bufs[(head + k) & mask];
+        struct virtq_packed_desc *desc = &vq->pdesc[pos & mask];
+        uint16_t flags = buf->extra_flags;
+
+        if (k + 1 < num)
+            flags |= VIRTQ_DESC_F_NEXT;
+        flags |= virtq_wrap(vq, pos) ? VIRTQ_DESC_F_AVAIL : VIRTQ_DESC_F_USED;
+
+        desc->addr = buf->ext_data ?
+            (uint64_t) buf->ext_data : (uint64_t) buf->data;
+        desc->len = buf->len;
+        desc->id = head;
+        if (k == 0)
+            head_flags = flags;
+        else
+            desc->flags = flags;
+    }
+
+    /*
+     * The device may look at the chain as soon as the head is available, so
+     * make it so last.
+     */
+    cc_barrier();
+    vq->pdesc[vq->next_avail & mask].flags = head_flags;
+}
+
 /*
  * Create a descriptor chain starting at index head, using vq->bufs also
- * starting at index head.
+ * starting at index head. For a packed virtqueue the descriptors are instead
+ * the next (num) in the ring, with head as their buffer ID.
  * Make sure the vq-bufs are cleaned before using them again.
  */
 int virtq_add_descriptor_chain(struct virtq *vq,
@@ -52,17 +92,22 @@ int virtq_add_descriptor_chain(struct virtq *vq,
     assert(used_descs > 0);
 
     for (i = head; used_descs > 0; used_descs--) {
-        desc = &(vq->desc[i]);
+        assert(vq->bufs[i].ext_data != NULL || vq->bufs[i].data != NULL);
+        i = (i + 1) & mask;
+    }
+    vq->bufs[head].chain_len = num;
 
-        assert(vq->bufs[i].len <= MAX_BUFFER_LEN);
+    if (vq->packed) {
+        virtq_add_packed(vq, head, num);
+        vq->num_avail -= num;
+        vq->next_avail += num;
+        return 0;
+    }
 
-        /*
-         * The first field of a "struct io_buffer" is the "data" field, so in
-         * the interrupt handler we can just cast this pointer back into a
-         * 'struct io_buffer'.
-         */
-        assert(vq->bufs[i].data == (uint8_t *) &vq->bufs[i]);
-        desc->addr = (uint64_t) vq->bufs[i].data;
+    for (i = head, used_descs = num; used_descs > 0; used_descs--) {
+        desc = &(vq->desc[i]);
+        desc->addr = vq->bufs[i].ext_data ?
+            (uint64_t) vq->bufs[i].ext_data : (uint64_t) vq->bufs[i].data;
         desc->len = vq->bufs[i].len;
         desc->flags = VIRTQ_DESC_F_NEXT | vq->bufs[i].extra_flags;
 
@@ -84,27 +129,231 @@ int virtq_add_descriptor_chain(struct virtq *vq,
     return 0;
 }
 
-void virtq_init_rings(uint16_t pci_base, struct virtq *vq, int selector)
+bool virtq_used_get(struct virtq *vq, uint16_t i, uint16_t *id,
+                    uint32_t *len)
+{
+    uint16_t mask = vq->num - 1;
+
+    if (!vq->packed) {
+        struct virtq_used_elem *e;
+
+        if ((uint16_t)(vq->used->idx - vq->last_used) <= i)
+            return false;
+        cc_barrier();
+        e = &vq->used->ring[(vq->last_used + i) & mask];
+        if (id)
+            *id = e->id & mask;
+        if (len)
+            *len = e->len;
+        return true;
+    }
+
+    for (uint16_t pos = vq->last_used; ; ) {
+        struct virtq_packed_desc *desc = &vq->pdesc[pos & mask];
+        uint16_t flags = desc->flags;
+        bool wrap = virtq_wrap(vq, pos);
+
+        if (!!(flags & VIRTQ_DESC_F_AVAIL) != wrap ||
+                !!(flags & VIRTQ_DESC_F_USED) != wrap)
+            return false;
+        cc_barrier();
+        if (i-- == 0) {
+            if (id)
+                *id = desc->id & mask;
+            if (len)
+                *len = desc->len;
+            return true;
+        }
+        pos += vq->bufs[desc->id & mask].chain_len;
+    }
+}
+
+void virtq_used_pop(struct virtq *vq)
+{
+    uint16_t mask = vq->num - 1;
+    uint16_t id, n;
+
+    if (vq->packed) {
+        id = vq->pdesc[vq->last_used & mask].id & mask;
+        n = vq->bufs[id].chain_len;
+        vq->last_used += n;
+    }
+    else {
+        id = vq->used->ring[vq->last_used & mask].id & mask;
+        n = vq->bufs[id].chain_len;
+        vq->last_used++;
+    }
+    vq->num_avail += n;
+}
+
+/*
+ * With VIRTIO_F_EVENT_IDX, a split virtqueue's device ignores avail->flags,
+ * and interrupts us when the used index passes used_event instead. Leaving
+ * used_event just behind last_used postpones the next interrupt until the
+ * index wraps around, which is as close to never as it gets.
+ */
+void virtq_intr_disable(struct virtq *vq)
+{
+    if (vq->packed)
+        vq->driver_event->flags = VIRTQ_EVENT_F_DISABLE;
+    else if (vq->event_idx)
+        *virtq_used_event(vq) = vq->last_used - 1;
+    else
+        vq->avail->flags |= VIRTQ_AVAIL_F_NO_INTERRUPT;
+}
+
+void virtq_intr_enable(struct virtq *vq)
+{
+    if (vq->packed)
+        vq->driver_event->flags = VIRTQ_EVENT_F_ENABLE;
+    else if (vq->event_idx)
+        *virtq_used_event(vq) = vq->last_used;
+    else
+        vq->avail->flags &= ~VIRTQ_AVAIL_F_NO_INTERRUPT;
+}
+
+/*
+ * Returns the position in the ring of the descriptor the device of a packed
+ * virtqueue wants to be notified of, given as an offset and a wrap counter,
+ * relative to next_avail.
+ */
+static uint16_t virtq_packed_event_pos(struct virtq *vq, uint16_t off_wrap)
+{
+    uint16_t lap = vq->next_avail & ~(vq->num - 1);
+    uint16_t pos = lap + (off_wrap & 0x7fff);
+
+    if (!!(off_wrap & 0x8000) != virtq_wrap(vq, vq->next_avail))
+        pos -= vq->num;
+    return pos;
+}
+
+void virtq_kick(struct virtq *vq)
+{
+    uint16_t old = vq->kicked;
+    uint16_t new = vq->packed ? vq->next_avail : vq->avail->idx;
+
+    if (old == new)
+        return;
+    vq->kicked = new;
+
+    /*
+     * The device must see the new buffers before we look at whether it wants
+     * to be notified, or it could go idle without either of us noticing.
+     */
+    __asm__ __volatile__("mfence" ::: "memory");
+    if (vq->packed) {
+        uint16_t flags = vq->device_event->flags;
+
+        if (flags == VIRTQ_EVENT_F_DISABLE)
+            return;
+        if (flags == VIRTQ_EVENT_F_DESC && !virtq_need_event(
+                    virtq_packed_event_pos(vq, vq->device_event->off_wrap),
+                    new, old))
+            return;
+    }
+    else if (vq->event_idx) {
+        if (!virtq_need_event(*virtq_avail_event(vq), new, old))
+            return;
+    }
+    else if (vq->used->flags & VIRTQ_USED_F_NO_NOTIFY)
+        return;
+
+    if (vq->notify_addr)
+        *vq->notify_addr = vq->queue;
+    else if (vq->notify_mmio)
+        *vq->notify_mmio = vq->queue;
+    else
+        outw(vq->notify_port, vq->queue);
+}
+
+/*
+ * Picks the queue size for a modern device: the largest power of two no
+ * larger than what the device supports.
+ */
+static uint16_t virtq_modern_size(uint16_t max)
+{
+    uint16_t num = 1;
+
+    if (max > VIRTQ_MAX_QUEUE_SIZE)
+        max = VIRTQ_MAX_QUEUE_SIZE;
+    while (num * 2 <= max)
+        num *= 2;
+    return num;
+}
+
+void virtq_init_rings(struct virtio_dev *vd, struct virtq *vq, int selector)
 {
     uint8_t *data;
-    size_t pgs;
-    
-    outw(pci_base + VIRTIO_PCI_QUEUE_SEL, selector);
-    vq->last_used = vq->next_avail = 0;
-    vq->num = vq->num_avail = inw(pci_base + VIRTIO_PCI_QUEUE_SIZE);
+    size_t size, pgs;
+    uint16_t num;
+
+    vq->last_used = vq->next_avail = vq->kicked = 0;
+    vq->event_idx = vd->event_idx;
+    vq->queue = selector;
+    num = virtio_dev_queue_size(vd, selector);
+    if (vd->modern)
+        num = virtq_modern_size(num);
+    vq->num = vq->num_avail = num;
+
+    assert(vq->num <= VIRTQ_MAX_QUEUE_SIZE);
 
-    pgs = ((VIRTQ_SIZE(vq->num) - 1) >> PAGE_SHIFT) + 1;
+    vq->packed = vd->packed;
+    if (vq->packed)
+        size = vq->num * sizeof(struct virtq_packed_desc) +
+            2 * sizeof(struct virtq_packed_event);
+    else
+        size = VIRTQ_SIZE(vq->num);
+    pgs = ((size - 1) >> PAGE_SHIFT) + 1;
     data = mem_ialloc_pages(pgs);
     assert(data);
     memset(data, 0, pgs << PAGE_SHIFT);
 
-    assert(vq->num <= VIRTQ_MAX_QUEUE_SIZE);
+    if (vq->packed) {
+        vq->pdesc = (struct virtq_packed_desc *)data;
+        vq->driver_event = (struct virtq_packed_event *)
+            (data + vq->num * sizeof(struct virtq_packed_desc));
+        vq->device_event = vq->driver_event + 1;
+    }
+    else {
+        vq->desc = (struct virtq_desc *)(data + VIRTQ_OFF_DESC(vq->num));
+        vq->avail = (struct virtq_avail *)(data + VIRTQ_OFF_AVAIL(vq->num));
+        vq->used = (struct virtq_used *)(data + VIRTQ_OFF_USED(vq->num));
+    }
 
-    vq->desc = (struct virtq_desc *)(data + VIRTQ_OFF_DESC(vq->num));
-    vq->avail = (struct virtq_avail *)(data + VIRTQ_OFF_AVAIL(vq->num));
-    vq->used = (struct virtq_used *)(data + VIRTQ_OFF_USED(vq->num));
+    if (vd->modern) {
+        if (vq->packed)
+            virtio_dev_queue_setup(vd, selector, num, (uint64_t)vq->pdesc,
+                    (uint64_t)vq->driver_event, (uint64_t)vq->device_event,
+                    &vq->notify_addr, &vq->notify_mmio);
+        else
+            virtio_dev_queue_setup(vd, selector, num, (uint64_t)vq->desc,
+                    (uint64_t)vq->avail, (uint64_t)vq->used,
+                    &vq->notify_addr, &vq->notify_mmio);
+        return;
+    }
 
-    outw(pci_base + VIRTIO_PCI_QUEUE_SEL, selector);
-    outl(pci_base + VIRTIO_PCI_QUEUE_PFN, (uint64_t) data
+    vq->notify_port = vd->io_base + VIRTIO_PCI_QUEUE_NOTIFY;
+    outw(vd->io_base + VIRTIO_PCI_QUEUE_SEL, selector);
+    outl(vd->io_base + VIRTIO_PCI_QUEUE_PFN, (uint64_t) data
          >> VIRTIO_PCI_QUEUE_ADDR_SHIFT);
 }
+
+void virtq_init_bufs(struct virtq *vq, size_t buf_len)
+{
+    uint8_t *data;
+    size_t pgs;
+
+    pgs = (((vq->num * sizeof (struct io_buffer)) - 1) >> PAGE_SHIFT) + 1;
+    vq->bufs = mem_ialloc_pages(pgs);
+    assert(vq->bufs);
+    memset(vq->bufs, 0, pgs << PAGE_SHIFT);
+    if (buf_len == 0)
+        return;
+
+    pgs = (((vq->num * buf_len) - 1) >> PAGE_SHIFT) + 1;
+    data = mem_ialloc_pages(pgs);
+    assert(data);
+    memset(data, 0, pgs << PAGE_SHIFT);
+    for (unsigned i = 0; i < vq->num; i++)
+        vq->bufs[i].data = data + i * buf_len;
+}
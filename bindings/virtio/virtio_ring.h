@@ -72,7 +72,8 @@ typedef uint64_t le64;
 #define VIRTQ_OFF_USED_RING(q) (VIRTQ_OFF_USED(q) + sizeof(struct virtq_used))
 
 #define VIRTQ_SIZE(q) (VIRTQ_OFF_USED_RING(q) \
-                                   + (sizeof(struct virtq_used_elem) * (q)))
+                                   + (sizeof(struct virtq_used_elem) * (q)) \
+                                   + sizeof(le16))
 
 /* Virtqueue descriptors: 16 bytes.
  * These can chain together via "next". */
@@ -109,15 +110,43 @@ struct virtq_used {
         /* Only if VIRTIO_F_EVENT_IDX: le16 avail_event; */
 };
 
-/* This is the max buffer length per descriptor. */
-#define MAX_BUFFER_LEN 1526
+/*
+ * Packed virtqueues (VIRTIO_F_RING_PACKED) use a single descriptor ring, in
+ * which the device overwrites available descriptors with used ones. Whether a
+ * descriptor is available or used is given by its AVAIL and USED flags
+ * relative to a wrap counter, which starts at 1 and flips each time the ring
+ * wraps around.
+ */
+#define VIRTQ_DESC_F_AVAIL      (1 << 7)
+#define VIRTQ_DESC_F_USED       (1 << 15)
+
+struct virtq_packed_desc {
+        le64 addr;
+        le32 len;
+        le16 id;
+        volatile le16 flags;
+};
+
+/* Event suppression, in the driver and device areas of a packed virtqueue. */
+#define VIRTQ_EVENT_F_ENABLE    0
+#define VIRTQ_EVENT_F_DISABLE   1
+/* Only if VIRTIO_F_EVENT_IDX: notify when the descriptor at off_wrap is used */
+#define VIRTQ_EVENT_F_DESC      2
+
+struct virtq_packed_event {
+        le16 off_wrap;
+        volatile le16 flags;
+};
 
 /*
  * Each one of these io_buffer's map to a descriptor. An array of io_buffer's
- * of size virtq.num (same as virtq.desc) is allocated during init.
+ * of size virtq.num (same as virtq.desc) is allocated by virtq_init_bufs().
+ * They hold no data themselves, so that the array stays compact; what data
+ * space each needs depends on its role, and is allocated separately.
  */
 struct io_buffer {
-    uint8_t data[MAX_BUFFER_LEN];
+    /* The buffer's own data, if it has any. */
+    uint8_t *data;
 
     /* Data length in Bytes. It is written by the driver on a tx/write, or
      * by the device on a rx/read on interrupt handling (do not remove the
@@ -126,22 +155,55 @@ struct io_buffer {
 
     /* Extra flags to be added to the corresponding descriptor. */
     uint16_t extra_flags;
+
+    /* Number of descriptors in the chain, if this is the head of one. */
+    uint16_t chain_len;
+
+    /* If not NULL, the descriptor points here instead of at (data), e.g. for
+     * zero-copy transmit of a buffer owned by the application. */
+    const uint8_t *ext_data;
 };
 
 struct virtq {
         unsigned int num;
 
+        /* Split virtqueue */
         struct virtq_desc *desc;
         struct virtq_avail *avail;
         struct virtq_used *used;
+
+        /* Packed virtqueue, if (packed) */
+        bool packed;
+        struct virtq_packed_desc *pdesc;
+        struct virtq_packed_event *driver_event;
+        struct virtq_packed_event *device_event;
+
         struct io_buffer *bufs;
 
         /* Keep track of available (free) descriptors */
         uint16_t num_avail;
 
-        /* Indexes in the descriptors array */
+        /*
+         * Indexes in the descriptors array. For a split virtqueue, last_used
+         * counts used chains; for a packed one, descriptors. Both wrap
+         * naturally at 65536.
+         */
         uint16_t last_used;
         uint16_t next_avail;
+
+        /*
+         * If (event_idx), the device is only notified of new buffers once
+         * the available index passes the event index it has published.
+         * kicked is the available index as of the last virtq_kick().
+         */
+        bool event_idx;
+        uint16_t kicked;
+
+        /* Where to notify the device of new buffers */
+        uint16_t queue;
+        uint16_t notify_port;
+        volatile le16 *notify_addr;
+        volatile uint32_t *notify_mmio;
 };
 
 static inline int virtq_need_event(uint16_t event_idx, uint16_t new_idx, uint16_t old_idx)
@@ -172,6 +234,38 @@ int virtq_add_descriptor_chain(struct virtq *vq,
                                uint16_t head,
                                uint16_t num);
 
-void virtq_init_rings(uint16_t pci_base, struct virtq *vq, int selector);
+/*
+ * Returns true if the device has used at least (i + 1) chains not yet
+ * consumed, setting (*id) to the head of the (i)th and (*len) to the number
+ * of bytes written to it. Either may be NULL.
+ */
+bool virtq_used_get(struct virtq *vq, uint16_t i, uint16_t *id,
+                    uint32_t *len);
+
+/*
+ * Consumes the first used chain, returning its descriptors to the free pool.
+ */
+void virtq_used_pop(struct virtq *vq);
+
+/* Asks the device not to interrupt us when it uses buffers, or to again. */
+void virtq_intr_disable(struct virtq *vq);
+void virtq_intr_enable(struct virtq *vq);
+
+/*
+ * Notifies the device of the buffers added since last called, unless it has
+ * asked us not to. Callers adding several buffers at once should add all of
+ * them first and kick once.
+ */
+void virtq_kick(struct virtq *vq);
+
+struct virtio_dev;
+void virtq_init_rings(struct virtio_dev *vd, struct virtq *vq, int selector);
+
+/*
+ * Allocates the buffers of (vq), giving each (buf_len) bytes of data, in a
+ * single contiguous array. Queues whose descriptors only ever point at
+ * ext_data, or whose driver lays out their data itself, pass 0.
+ */
+void virtq_init_bufs(struct virtq *vq, size_t buf_len);
 
 #endif /* VIRTQUEUE_H */
@@ -0,0 +1,613 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * virtio_vsock.c: Streams to services on the host through a virtio-vsock
+ * device.
+ *
+ * Each MFT_VSOCK_BASIC entry in the manifest is a stream, connected when it
+ * is acquired to the port given in the manifest on the host (CID 2). All
+ * streams share the device's receive and transmit queues. Data received is
+ * copied from the receive queue into the stream's own receive buffer, whose
+ * size is the credit we give the host, so that a stream whose data is not
+ * being read never holds up the others. Data written is copied into transmit
+ * buffers, as far as the host has given us credit for it; as the host always
+ * has room for data it has given credit for, the transmit queue is drained
+ * promptly, and we wait for it if it is full rather than take interrupts.
+ *
+ * Connections from the host are not accepted.
+ */
+
+#include "bindings.h"
+#include "virtio_ring.h"
+#include "virtio_pci.h"
+
+/* Device configuration */
+#define VIRTIO_VSOCK_CONFIG_GUEST_CID   0       /* 64-bit r/o */
+
+#define VIRTQ_VSOCK_RX          0
+#define VIRTQ_VSOCK_TX          1
+#define VIRTQ_VSOCK_EVENT       2
+
+#define VIRTIO_VSOCK_TYPE_STREAM        1
+
+#define VIRTIO_VSOCK_OP_REQUEST         1
+#define VIRTIO_VSOCK_OP_RESPONSE        2
+#define VIRTIO_VSOCK_OP_RST             3
+#define VIRTIO_VSOCK_OP_SHUTDOWN        4
+#define VIRTIO_VSOCK_OP_RW              5
+#define VIRTIO_VSOCK_OP_CREDIT_UPDATE   6
+#define VIRTIO_VSOCK_OP_CREDIT_REQUEST  7
+
+/* VIRTIO_VSOCK_OP_SHUTDOWN flags */
+#define VIRTIO_VSOCK_SHUTDOWN_RCV       (1U << 0)
+#define VIRTIO_VSOCK_SHUTDOWN_SEND      (1U << 1)
+#define VIRTIO_VSOCK_SHUTDOWN_BOTH \
+    (VIRTIO_VSOCK_SHUTDOWN_RCV | VIRTIO_VSOCK_SHUTDOWN_SEND)
+
+#define VIRTIO_VSOCK_EVENT_TRANSPORT_RESET 0
+
+#define VSOCK_HOST_CID          2
+
+struct __attribute__((__packed__)) virtio_vsock_hdr {
+    uint64_t src_cid;
+    uint64_t dst_cid;
+    uint32_t src_port;
+    uint32_t dst_port;
+    uint32_t len;
+    uint16_t type;
+    uint16_t op;
+    uint32_t flags;
+    uint32_t buf_alloc;
+    uint32_t fwd_cnt;
+};
+
+struct virtio_vsock_event {
+    uint32_t id;
+};
+
+/* Largest payload of a packet, in either direction */
+#define VSOCK_PAYLOAD_MAX       4096
+#define VSOCK_PKT_LEN \
+    (sizeof (struct virtio_vsock_hdr) + VSOCK_PAYLOAD_MAX)
+
+/* Receive buffer of each stream, a power of 2, and our credit to the host */
+#define VSOCK_RBUF_SIZE         (64 * 1024)
+
+/* How long the host has to accept a connection */
+#define VSOCK_CONNECT_TIMEOUT   (2ULL * 1000000000ULL)
+
+/* Local ports are handed out in turn from here, never reused */
+#define VSOCK_PORT_BASE         49152
+
+enum vsock_state {
+    VSOCK_CLOSED,
+    VSOCK_CONNECTING,
+    VSOCK_CONNECTED
+};
+
+/*
+ * A stream, indexed by its handle. Byte counters wrap naturally at 2^32, and
+ * index (rbuf) modulo its size.
+ */
+struct vsock_stream {
+    enum vsock_state state;
+    uint32_t port;              /* Our port */
+    uint32_t peer_port;         /* Port of the service on the host */
+    uint32_t peer_shutdown;     /* VIRTIO_VSOCK_SHUTDOWN_* by the host */
+    bool write_blocked;         /* A write has returned SOLO5_R_AGAIN */
+    bool credit_requested;      /* Since the host last gave us credit */
+    uint8_t *rbuf;
+    uint32_t rx_cnt;            /* Bytes received */
+    uint32_t fwd_cnt;           /* Bytes read by the application */
+    uint32_t fwd_cnt_sent;      /* (fwd_cnt) as last told to the host */
+    uint32_t tx_cnt;            /* Bytes sent */
+    uint32_t peer_buf_alloc;    /* Host's receive buffer */
+    uint32_t peer_fwd_cnt;      /* Bytes read by the service */
+};
+
+static struct virtio_dev vsock_dev;
+static struct virtq rxq, txq, eventq;
+static bool vsock_configured;
+static uint64_t vsock_cid;
+static uint32_t vsock_next_port = VSOCK_PORT_BASE;
+static struct vsock_stream vsock_streams[MFT_MAX_ENTRIES];
+extern struct mft_note __solo5_manifest_note;
+
+/* WARNING: called in interrupt context */
+static int handle_virtio_vsock_interrupt(void *arg)
+{
+    uint8_t isr_status;
+
+    (void)arg;
+    isr_status = virtio_dev_isr(&vsock_dev);
+    if (isr_status & VIRTIO_PCI_ISR_HAS_INTR) {
+        /* Only used to kick the application out of solo5_yield(). */
+        return 1;
+    }
+    return 0;
+}
+
+static struct vsock_stream *vsock_get(solo5_handle_t h)
+{
+    if (h >= MFT_MAX_ENTRIES || vsock_streams[h].state != VSOCK_CONNECTED)
+        return NULL;
+    return &vsock_streams[h];
+}
+
+/*
+ * Returns how many bytes the host has room for on (s).
+ */
+static uint32_t vsock_credit(const struct vsock_stream *s)
+{
+    uint32_t in_flight = s->tx_cnt - s->peer_fwd_cnt;
+
+    return (in_flight < s->peer_buf_alloc) ?
+        s->peer_buf_alloc - in_flight : 0;
+}
+
+/*
+ * Queues a packet with header (hdr) and (len) bytes of (data) for
+ * transmission, waiting for the device to free a transmit buffer if there are
+ * none. The caller kicks the device.
+ */
+static void vsock_xmit(const struct virtio_vsock_hdr *hdr, const uint8_t *data,
+        size_t len)
+{
+    uint16_t mask = txq.num - 1;
+
+    assert(len <= VSOCK_PAYLOAD_MAX);
+    for (;;) {
+        while (virtq_used_get(&txq, 0, NULL, NULL))
+            virtq_used_pop(&txq);
+        if (txq.num_avail > 0)
+            break;
+        __asm__ __volatile__("pause");
+    }
+
+    struct io_buffer *buf = &txq.bufs[txq.next_avail & mask];
+    memcpy(buf->data, hdr, sizeof *hdr);
+    if (len > 0)
+        memcpy(buf->data + sizeof *hdr, data, len);
+    buf->len = sizeof *hdr + len;
+    buf->extra_flags = 0;
+    assert(virtq_add_descriptor_chain(&txq, txq.next_avail & mask, 1) == 0);
+}
+
+/*
+ * Queues a packet of operation (op) on (s). Every packet tells the host how
+ * much it may send us.
+ */
+static void vsock_xmit_stream(struct vsock_stream *s, uint16_t op,
+        uint32_t flags, const uint8_t *data, size_t len)
+{
+    struct virtio_vsock_hdr hdr = {
+        .src_cid = vsock_cid,
+        .dst_cid = VSOCK_HOST_CID,
+        .src_port = s->port,
+        .dst_port = s->peer_port,
+        .len = len,
+        .type = VIRTIO_VSOCK_TYPE_STREAM,
+        .op = op,
+        .flags = flags,
+        .buf_alloc = VSOCK_RBUF_SIZE,
+        .fwd_cnt = s->fwd_cnt
+    };
+
+    vsock_xmit(&hdr, data, len);
+    s->fwd_cnt_sent = s->fwd_cnt;
+}
+
+/*
+ * Resets the connection of packet (in), which is not ours.
+ */
+static void vsock_xmit_rst(const struct virtio_vsock_hdr *in)
+{
+    struct virtio_vsock_hdr hdr = {
+        .src_cid = vsock_cid,
+        .dst_cid = in->src_cid,
+        .src_port = in->dst_port,
+        .dst_port = in->src_port,
+        .type = VIRTIO_VSOCK_TYPE_STREAM,
+        .op = VIRTIO_VSOCK_OP_RST
+    };
+
+    vsock_xmit(&hdr, NULL, 0);
+}
+
+static struct vsock_stream *vsock_lookup(const struct virtio_vsock_hdr *hdr)
+{
+    if (hdr->src_cid != VSOCK_HOST_CID || hdr->dst_cid != vsock_cid ||
+            hdr->type != VIRTIO_VSOCK_TYPE_STREAM)
+        return NULL;
+    for (unsigned i = 0; i < MFT_MAX_ENTRIES; i++) {
+        struct vsock_stream *s = &vsock_streams[i];
+        if (s->state != VSOCK_CLOSED && s->port == hdr->dst_port &&
+                s->peer_port == hdr->src_port)
+            return s;
+    }
+    return NULL;
+}
+
+/*
+ * Handles the packet with header (hdr) and (len) bytes of (data) received.
+ * Returns true if the device needs to be kicked for a packet sent in reply.
+ */
+static bool vsock_recv(const struct virtio_vsock_hdr *hdr, const uint8_t *data,
+        size_t len)
+{
+    struct vsock_stream *s = vsock_lookup(hdr);
+
+    if (s == NULL) {
+        if (hdr->op == VIRTIO_VSOCK_OP_RST)
+            return false;
+        vsock_xmit_rst(hdr);
+        return true;
+    }
+
+    if (s->state == VSOCK_CONNECTING) {
+        if (hdr->op == VIRTIO_VSOCK_OP_RESPONSE) {
+            s->state = VSOCK_CONNECTED;
+            s->peer_buf_alloc = hdr->buf_alloc;
+            s->peer_fwd_cnt = hdr->fwd_cnt;
+            return false;
+        }
+        s->state = VSOCK_CLOSED;
+        if (hdr->op == VIRTIO_VSOCK_OP_RST)
+            return false;
+        vsock_xmit_rst(hdr);
+        return true;
+    }
+
+    if (hdr->buf_alloc != s->peer_buf_alloc ||
+            hdr->fwd_cnt != s->peer_fwd_cnt)
+        s->credit_requested = false;
+    s->peer_buf_alloc = hdr->buf_alloc;
+    s->peer_fwd_cnt = hdr->fwd_cnt;
+
+    switch (hdr->op) {
+    case VIRTIO_VSOCK_OP_RW: {
+        /*
+         * The host may not send more than we have given it credit for; if it
+         * does anyway, the excess is dropped.
+         */
+        uint32_t room = VSOCK_RBUF_SIZE - (s->rx_cnt - s->fwd_cnt);
+        if (len > room)
+            len = room;
+        uint32_t off = s->rx_cnt & (VSOCK_RBUF_SIZE - 1);
+        size_t first = VSOCK_RBUF_SIZE - off;
+        if (first > len)
+            first = len;
+        memcpy(s->rbuf + off, data, first);
+        memcpy(s->rbuf, data + first, len - first);
+        s->rx_cnt += len;
+        return false;
+    }
+    case VIRTIO_VSOCK_OP_CREDIT_REQUEST:
+        vsock_xmit_stream(s, VIRTIO_VSOCK_OP_CREDIT_UPDATE, 0, NULL, 0);
+        return true;
+    case VIRTIO_VSOCK_OP_SHUTDOWN:
+        s->peer_shutdown |= hdr->flags & VIRTIO_VSOCK_SHUTDOWN_BOTH;
+        return false;
+    case VIRTIO_VSOCK_OP_RST:
+        s->peer_shutdown = VIRTIO_VSOCK_SHUTDOWN_BOTH;
+        return false;
+    default:
+        return false;
+    }
+}
+
+/*
+ * Handles all packets the device has received, returning their buffers to
+ * it, and any events it has raised.
+ */
+static void vsock_poll(void)
+{
+    bool kick_rx = false, kick_tx = false;
+    uint16_t id;
+    uint32_t len;
+
+    while (virtq_used_get(&rxq, 0, &id, &len)) {
+        struct io_buffer *buf = &rxq.bufs[id];
+        const struct virtio_vsock_hdr *hdr =
+            (const struct virtio_vsock_hdr *)buf->data;
+
+        if (len >= sizeof *hdr && hdr->len <= len - sizeof *hdr)
+            kick_tx |= vsock_recv(hdr, buf->data + sizeof *hdr, hdr->len);
+        virtq_used_pop(&rxq);
+        buf->len = VSOCK_PKT_LEN;
+        buf->extra_flags = VIRTQ_DESC_F_WRITE;
+        assert(virtq_add_descriptor_chain(&rxq, id, 1) == 0);
+        kick_rx = true;
+    }
+
+    /*
+     * The only event is a transport reset, after which all connections are
+     * gone and our CID may have changed.
+     */
+    while (virtq_used_get(&eventq, 0, &id, NULL)) {
+        struct io_buffer *buf = &eventq.bufs[id];
+        const struct virtio_vsock_event *ev =
+            (const struct virtio_vsock_event *)buf->data;
+
+        if (ev->id == VIRTIO_VSOCK_EVENT_TRANSPORT_RESET) {
+            vsock_cid = virtio_dev_config64(&vsock_dev,
+                    VIRTIO_VSOCK_CONFIG_GUEST_CID);
+            for (unsigned i = 0; i < MFT_MAX_ENTRIES; i++) {
+                if (vsock_streams[i].state == VSOCK_CONNECTING)
+                    vsock_streams[i].state = VSOCK_CLOSED;
+                vsock_streams[i].peer_shutdown = VIRTIO_VSOCK_SHUTDOWN_BOTH;
+            }
+        }
+        virtq_used_pop(&eventq);
+        buf->len = sizeof *ev;
+        buf->extra_flags = VIRTQ_DESC_F_WRITE;
+        assert(virtq_add_descriptor_chain(&eventq, id, 1) == 0);
+        virtq_kick(&eventq);
+    }
+
+    if (kick_rx)
+        virtq_kick(&rxq);
+    if (kick_tx)
+        virtq_kick(&txq);
+}
+
+static void vsock_setup_queue(struct virtq *vq, int selector, size_t len)
+{
+    uint16_t mask;
+
+    virtq_init_rings(&vsock_dev, vq, selector);
+    virtq_init_bufs(vq, len);
+    if (selector == VIRTQ_VSOCK_TX)
+        return;
+
+    mask = vq->num - 1;
+    do {
+        struct io_buffer *buf = &vq->bufs[vq->next_avail & mask];
+        buf->len = len;
+        buf->extra_flags = VIRTQ_DESC_F_WRITE;
+        assert(virtq_add_descriptor_chain(vq, vq->next_avail & mask, 1) == 0);
+    } while ((vq->next_avail & mask) != 0);
+}
+
+void virtio_config_vsock(struct pci_config_info *pci)
+{
+    struct mft *mft = &__solo5_manifest_note.m;
+    uint64_t host_features;
+
+    virtio_dev_init(&vsock_dev, pci);
+    host_features = virtio_dev_features(&vsock_dev);
+    if (virtio_dev_set_features(&vsock_dev, host_features, 0) != 0) {
+        log(WARN, "Solo5: PCI:%02x:%02x: feature negotiation failed\n",
+            pci->bus, pci->dev);
+        return;
+    }
+
+    vsock_setup_queue(&rxq, VIRTQ_VSOCK_RX, VSOCK_PKT_LEN);
+    vsock_setup_queue(&txq, VIRTQ_VSOCK_TX, VSOCK_PKT_LEN);
+    vsock_setup_queue(&eventq, VIRTQ_VSOCK_EVENT,
+            sizeof (struct virtio_vsock_event));
+    /*
+     * Only received packets interrupt us. We wait for transmit buffers to be
+     * freed when we need them, and look for events when polling.
+     */
+    virtq_intr_disable(&txq);
+    virtq_intr_disable(&eventq);
+    if (!virtio_dev_queue_intr(&vsock_dev, VIRTQ_VSOCK_RX, NULL, NULL))
+        intr_register_irq(pci->irq, handle_virtio_vsock_interrupt, NULL);
+
+    /*
+     * Receive buffers can only be allocated now, before the application
+     * starts, so every stream declared in the manifest gets one.
+     */
+    for (unsigned i = 0; i < mft->entries; i++) {
+        if (mft_get_by_index(mft, i, MFT_VSOCK_BASIC) == NULL)
+            continue;
+        vsock_streams[i].rbuf = mem_ialloc_pages(VSOCK_RBUF_SIZE / PAGE_SIZE);
+        assert(vsock_streams[i].rbuf);
+    }
+
+    vsock_cid = virtio_dev_config64(&vsock_dev, VIRTIO_VSOCK_CONFIG_GUEST_CID);
+    virtio_dev_driver_ok(&vsock_dev);
+    virtq_kick(&rxq);
+    virtq_kick(&eventq);
+    vsock_configured = true;
+    log(INFO, "Solo5: PCI:%02x:%02x: configured, CID %llu\n", pci->bus,
+        pci->dev, (unsigned long long)vsock_cid);
+}
+
+solo5_handle_set_t virtio_vsock_ready_set(void)
+{
+    solo5_handle_set_t ready_set = 0;
+
+    if (!vsock_configured)
+        return 0;
+    vsock_poll();
+    for (unsigned i = 0; i < MFT_MAX_ENTRIES; i++) {
+        struct vsock_stream *s = &vsock_streams[i];
+
+        if (s->state != VSOCK_CONNECTED)
+            continue;
+        if (s->rx_cnt != s->fwd_cnt ||
+                (s->peer_shutdown & VIRTIO_VSOCK_SHUTDOWN_SEND))
+            ready_set |= 1ULL << i;
+        if (s->write_blocked && (vsock_credit(s) > 0 ||
+                    (s->peer_shutdown & VIRTIO_VSOCK_SHUTDOWN_RCV))) {
+            s->write_blocked = false;
+            ready_set |= 1ULL << i;
+        }
+    }
+    return ready_set;
+}
+
+solo5_result_t solo5_vsock_acquire(const char *name, solo5_handle_t *h,
+        struct solo5_vsock_info *info)
+{
+    unsigned mft_index;
+    struct mft_entry *mft_e = mft_get_by_name(&__solo5_manifest_note.m, name,
+            MFT_VSOCK_BASIC, &mft_index);
+    if (mft_e == NULL)
+        return SOLO5_R_EINVAL;
+    if (!vsock_configured)
+        return SOLO5_R_EUNSPEC;
+
+    struct vsock_stream *s = &vsock_streams[mft_index];
+    if (s->state != VSOCK_CLOSED)
+        return SOLO5_R_EUNSPEC;
+    uint8_t *rbuf = s->rbuf;
+    memset(s, 0, sizeof *s);
+    s->rbuf = rbuf;
+    s->port = vsock_next_port++;
+    s->peer_port = mft_e->attrs.vsock.port;
+    s->state = VSOCK_CONNECTING;
+
+    vsock_xmit_stream(s, VIRTIO_VSOCK_OP_REQUEST, 0, NULL, 0);
+    virtq_kick(&txq);
+    solo5_time_t deadline = solo5_clock_monotonic() + VSOCK_CONNECT_TIMEOUT;
+    while (s->state == VSOCK_CONNECTING &&
+            solo5_clock_monotonic() < deadline) {
+        vsock_poll();
+        __asm__ __volatile__("pause");
+    }
+    if (s->state != VSOCK_CONNECTED) {
+        if (s->state == VSOCK_CONNECTING) {
+            vsock_xmit_stream(s, VIRTIO_VSOCK_OP_RST, 0, NULL, 0);
+            virtq_kick(&txq);
+            s->state = VSOCK_CLOSED;
+        }
+        log(WARN, "Solo5: Could not connect '%s' to port %u on the host\n",
+            name, (unsigned)s->peer_port);
+        return SOLO5_R_EUNSPEC;
+    }
+
+    info->cid = vsock_cid;
+    info->port = s->peer_port;
+    *h = (solo5_handle_t)mft_index;
+    log(INFO, "Solo5: Application acquired '%s' as vsock stream to port %u\n",
+        name, (unsigned)s->peer_port);
+    return SOLO5_R_OK;
+}
+
+solo5_result_t solo5_vsock_write(solo5_handle_t h, const uint8_t *buf,
+        size_t size, size_t *written)
+{
+    struct vsock_stream *s = vsock_get(h);
+    size_t done = 0;
+
+    if (s == NULL)
+        return SOLO5_R_EINVAL;
+    *written = 0;
+    if (s->peer_shutdown & VIRTIO_VSOCK_SHUTDOWN_RCV)
+        return SOLO5_R_EUNSPEC;
+
+    uint32_t credit = vsock_credit(s);
+    if (credit == 0) {
+        /* Credit may have arrived since we last looked. */
+        vsock_poll();
+        credit = vsock_credit(s);
+    }
+    while (done < size && credit > 0) {
+        size_t len = size - done;
+        if (len > credit)
+            len = credit;
+        if (len > VSOCK_PAYLOAD_MAX)
+            len = VSOCK_PAYLOAD_MAX;
+        vsock_xmit_stream(s, VIRTIO_VSOCK_OP_RW, 0, buf + done, len);
+        s->tx_cnt += len;
+        credit -= len;
+        done += len;
+    }
+
+    if (done == 0) {
+        /*
+         * The host normally tells us when the service has made room, but we
+         * ask, once, in case it does not.
+         */
+        if (!s->credit_requested) {
+            vsock_xmit_stream(s, VIRTIO_VSOCK_OP_CREDIT_REQUEST, 0, NULL, 0);
+            virtq_kick(&txq);
+            s->credit_requested = true;
+        }
+        s->write_blocked = true;
+        return SOLO5_R_AGAIN;
+    }
+    virtq_kick(&txq);
+    *written = done;
+    return SOLO5_R_OK;
+}
+
+solo5_result_t solo5_vsock_read(solo5_handle_t h, uint8_t *buf, size_t size,
+        size_t *read_size)
+{
+    struct vsock_stream *s = vsock_get(h);
+
+    if (s == NULL)
+        return SOLO5_R_EINVAL;
+    *read_size = 0;
+    if (s->rx_cnt == s->fwd_cnt)
+        vsock_poll();
+
+    uint32_t avail = s->rx_cnt - s->fwd_cnt;
+    if (avail == 0)
+        return (s->peer_shutdown & VIRTIO_VSOCK_SHUTDOWN_SEND) ?
+            SOLO5_R_OK : SOLO5_R_AGAIN;
+    if (size > avail)
+        size = avail;
+    uint32_t off = s->fwd_cnt & (VSOCK_RBUF_SIZE - 1);
+    size_t first = VSOCK_RBUF_SIZE - off;
+    if (first > size)
+        first = size;
+    memcpy(buf, s->rbuf + off, first);
+    memcpy(buf + first, s->rbuf, size - first);
+    s->fwd_cnt += size;
+    *read_size = size;
+
+    /*
+     * Tell the host about the room made once it amounts to half of the
+     * buffer, rather than on every read.
+     */
+    if (!(s->peer_shutdown & VIRTIO_VSOCK_SHUTDOWN_SEND) &&
+            s->fwd_cnt - s->fwd_cnt_sent >= VSOCK_RBUF_SIZE / 2) {
+        vsock_xmit_stream(s, VIRTIO_VSOCK_OP_CREDIT_UPDATE, 0, NULL, 0);
+        virtq_kick(&txq);
+    }
+    return SOLO5_R_OK;
+}
+
+/*
+ * A stream is forgotten as soon as it is closed: should the host still send
+ * us anything on it, including its own reset, it is answered as for any
+ * unknown connection.
+ */
+solo5_result_t solo5_vsock_close(solo5_handle_t h)
+{
+    struct vsock_stream *s = vsock_get(h);
+
+    if (s == NULL)
+        return SOLO5_R_EINVAL;
+    if (s->peer_shutdown == VIRTIO_VSOCK_SHUTDOWN_BOTH)
+        vsock_xmit_stream(s, VIRTIO_VSOCK_OP_RST, 0, NULL, 0);
+    else
+        vsock_xmit_stream(s, VIRTIO_VSOCK_OP_SHUTDOWN,
+                VIRTIO_VSOCK_SHUTDOWN_BOTH, NULL, 0);
+    virtq_kick(&txq);
+    s->state = VSOCK_CLOSED;
+    return SOLO5_R_OK;
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * vsock_none.c: Host streams on targets without support for them.
+ */
+
+#include "bindings.h"
+
+solo5_result_t solo5_vsock_acquire(const char *name, solo5_handle_t *handle,
+        struct solo5_vsock_info *info)
+{
+    (void)name;
+    (void)handle;
+    (void)info;
+    return SOLO5_R_EUNSPEC;
+}
+
+solo5_result_t solo5_vsock_write(solo5_handle_t handle, const uint8_t *buf,
+        size_t size, size_t *written)
+{
+    (void)handle;
+    (void)buf;
+    (void)size;
+    (void)written;
+    return SOLO5_R_EINVAL;
+}
+
+solo5_result_t solo5_vsock_read(solo5_handle_t handle, uint8_t *buf,
+        size_t size, size_t *read_size)
+{
+    (void)handle;
+    (void)buf;
+    (void)size;
+    (void)read_size;
+    return SOLO5_R_EINVAL;
+}
+
+solo5_result_t solo5_vsock_close(solo5_handle_t handle)
+{
+    (void)handle;
+    return SOLO5_R_EINVAL;
+}
@@ -70,6 +70,13 @@ int main(int argc, char *argv[])
 EOM
 }
 
+cc_check_header()
+{
+    ${CC} -x c -c -o /dev/null - <<EOM >/dev/null 2>&1
+#include <$1>
+EOM
+}
+
 ld_is_lld()
 {
     ${LD} --version 2>&1 | grep -q '^LLD'
@@ -118,6 +125,8 @@ CONFIG_GENODE=
 MAKECONF_CFLAGS=
 MAKECONF_LDFLAGS=
 CONFIG_SPT_NO_PIE=
+CONFIG_SDT=
+CONFIG_ZSTD=
 
 case "${CONFIG_HOST}" in
     Linux)
@@ -165,6 +174,13 @@ case "${CONFIG_HOST}" in
         [ "${CONFIG_ARCH}" = "x86_64" ] && CONFIG_VIRTIO=1
         [ "${CONFIG_ARCH}" = "x86_64" ] && CONFIG_MUEN=1
         [ "${CONFIG_ARCH}" = "x86_64" ] && CONFIG_GENODE=1
+
+        # Tracepoints in the tenders are compiled in as USDT probes if the
+        # host has <sys/sdt.h>, e.g. from systemtap-sdt-dev.
+        cc_check_header sys/sdt.h && CONFIG_SDT=1
+        # The tenders can load zstd-compressed unikernels if the host has
+        # libzstd, e.g. from libzstd-dev.
+        cc_check_header zstd.h && gcc_check_lib -lzstd && CONFIG_ZSTD=1
         ;;
     FreeBSD)
         # On FreeBSD/clang we use -nostdlibinc which gives us access to the
@@ -279,6 +295,8 @@ CONFIG_GUEST_PAGE_SIZE=${CONFIG_GUEST_PAGE_SIZE}
 MAKECONF_CC=${CC}
 MAKECONF_LD=${LD}
 CONFIG_SPT_NO_PIE=${CONFIG_SPT_NO_PIE}
+CONFIG_SDT=${CONFIG_SDT}
+CONFIG_ZSTD=${CONFIG_ZSTD}
 EOM
 
 echo "${prog_NAME}: Configured for ${CC_MACHINE}."
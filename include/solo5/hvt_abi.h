@@ -22,7 +22,7 @@
  * hvt_abi.h: hvt guest hypercall ABI definitions.
  *
  * This header file must be kept self-contained with no external dependencies
- * other than C99 headers.
+ * other than C99 headers and ring_abi.h.
  *
  * This header file is dual-use; tender code will define HVT_HOST when
  * including it.
@@ -34,6 +34,8 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "ring_abi.h"
+
 #ifdef __x86_64__
 /*
  * PIO base address used to dispatch hypercalls.
@@ -87,6 +89,15 @@ static inline void hvt_do_hypercall(int n, volatile void *arg)
 #define HVT_HYPERCALL_ADDRESS(x)   (HVT_HYPERCALL_MMIO_BASE + ((x) << 3))
 #define HVT_HYPERCALL_NR(x)        (((x) - HVT_HYPERCALL_MMIO_BASE) >> 3)
 
+/*
+ * If the tender offers HVT_FEATURE_HVC, hypercalls may instead be made with
+ * "hvc #0", passing the SMCCC function ID HVT_HYPERCALL_HVC_ID(x) in x0 and
+ * the argument in x1. The IDs are SMC64 fast calls in the OEM service range,
+ * which KVM forwards to the tender through its SMCCC filter.
+ */
+#define HVT_HYPERCALL_HVC_BASE     (0xc3000000UL)
+#define HVT_HYPERCALL_HVC_ID(x)    (HVT_HYPERCALL_HVC_BASE + (x))
+
 #    ifdef HVT_HOST
 /*
  * Non-dereferencable tender-side type representing a guest physical address.
@@ -101,11 +112,31 @@ typedef uint64_t hvt_gpa_t;
  * On aarch64 the compiler-only memory barrier ("memory" clobber) is
  * sufficient across the hypercall boundary.
  */
+/*
+ * Set by the bindings if the tender offers HVT_FEATURE_HVC. If KVM does not
+ * forward an HVC to the tender, as after restoring a snapshot with a tender
+ * which cannot, it returns SMCCC NOT_SUPPORTED (-1) in x0; the guest then
+ * clears this and falls back to MMIO.
+ */
+extern int hvt_hypercall_hvc;
+
 static inline void hvt_do_hypercall(int n, volatile void *arg)
 {
 #    ifdef assert
     assert(((uint64_t)arg <= UINT32_MAX));
 #    endif
+    if (hvt_hypercall_hvc) {
+        register uint64_t x0 __asm__("x0") = HVT_HYPERCALL_HVC_ID(n);
+        register uint64_t x1 __asm__("x1") = (uint64_t)arg;
+
+        __asm__ __volatile__("hvc #0"
+                : "+r" (x0), "+r" (x1)
+                :
+                : "x2", "x3", "memory");
+        if ((uint32_t)x0 != UINT32_MAX)
+            return;
+        hvt_hypercall_hvc = 0;
+    }
 	__asm__ __volatile__("str %w0, [%1]"
 	        :
 	        : "rZ" ((uint32_t)((uint64_t)arg)),
@@ -142,8 +173,24 @@ struct hvt_boot_info {
     uint64_t cpu_cycle_freq;            /* CPU cycle counter frequency, Hz */
     HVT_GUEST_PTR(char *) cmdline;      /* Address of command line (C string) */
     HVT_GUEST_PTR(void *) mft;          /* Address of application manifest */
+    uint64_t features;                  /* Optional features (HVT_FEATURE_*) */
+    uint64_t cpus;                      /* Number of VCPUs */
 };
 
+/*
+ * Optional features which may be offered to the guest by the tender in
+ * (struct hvt_boot_info).features.
+ */
+#define HVT_FEATURE_NET_RINGS   (1ULL << 0) /* Shared-memory packet rings */
+#define HVT_FEATURE_NET_VHOST   (1ULL << 1) /* virtio rings served by vhost */
+#define HVT_FEATURE_POLL_PAGE   (1ULL << 2) /* Shared readiness page */
+#define HVT_FEATURE_TIME_PAGE   (1ULL << 3) /* Shared wall clock page */
+#define HVT_FEATURE_TRACE       (1ULL << 4) /* Binary event trace ring */
+#define HVT_FEATURE_MULTI       (1ULL << 5) /* HVT_HYPERCALL_MULTI */
+#define HVT_FEATURE_CONSOLE_RING (1ULL << 6) /* Console output ring */
+#define HVT_FEATURE_HVC         (1ULL << 7) /* aarch64: HVC hypercalls */
+#define HVT_FEATURE_IRQCHIP     (1ULL << 8) /* x86_64: In-kernel local APIC */
+
 /*
  * Maximum size of guest command line, including the string terminator.
  */
@@ -163,6 +210,37 @@ enum hvt_hypercall {
     HVT_HYPERCALL_NET_WRITE,
     HVT_HYPERCALL_NET_READ,
     HVT_HYPERCALL_HALT,
+    HVT_HYPERCALL_NET_WRITEV,
+    HVT_HYPERCALL_NET_READV,
+    HVT_HYPERCALL_NET_RINGS,
+    HVT_HYPERCALL_NET_NOTIFY,
+    HVT_HYPERCALL_NET_VRINGS,
+    HVT_HYPERCALL_NET_KICK,
+    HVT_HYPERCALL_BLOCK_SUBMIT,
+    HVT_HYPERCALL_BLOCK_REAP,
+    HVT_HYPERCALL_BLOCK_WRITEV,
+    HVT_HYPERCALL_BLOCK_READV,
+    HVT_HYPERCALL_BLOCK_FLUSH,
+    HVT_HYPERCALL_BLOCK_DISCARD,
+    HVT_HYPERCALL_BLOCK_WRITE_ZEROES,
+    HVT_HYPERCALL_BLOCK_MAP,
+    HVT_HYPERCALL_CPU_START,
+    HVT_HYPERCALL_POLL_PAGE,
+    HVT_HYPERCALL_TIME_PAGE,
+    HVT_HYPERCALL_SNAPSHOT,
+    HVT_HYPERCALL_MEM_RELEASE,
+    HVT_HYPERCALL_TRACE_RING,
+    HVT_HYPERCALL_MULTI,
+    HVT_HYPERCALL_SHM_MAP,
+    HVT_HYPERCALL_SHM_NOTIFY,
+    HVT_HYPERCALL_PCI_MAP,
+    HVT_HYPERCALL_CONSOLE_RING,
+    HVT_HYPERCALL_BLOCK_PREFETCH,
+    HVT_HYPERCALL_BLOCK_ZONE_REPORT,
+    HVT_HYPERCALL_BLOCK_ZONE_APPEND,
+    HVT_HYPERCALL_BLOCK_ZONE_MANAGE,
+    HVT_HYPERCALL_BLOCK_REGISTER,
+    HVT_HYPERCALL_BOOT_REPORT,
     HVT_HYPERCALL_MAX
 };
 
@@ -209,6 +287,301 @@ struct hvt_hc_block_read {
     int ret;
 };
 
+/*
+ * A single segment in a HVT_HYPERCALL_BLOCK_WRITEV or HVT_HYPERCALL_BLOCK_READV
+ * request. Segments are transferred to or from consecutive ranges of the
+ * device, starting at (offset).
+ */
+#define HVT_BLOCK_IOV_MAX 16
+
+struct hvt_block_iov {
+    /* IN */
+    HVT_GUEST_PTR(void *) data;
+    size_t len;
+};
+
+/* HVT_HYPERCALL_BLOCK_WRITEV */
+struct hvt_hc_block_writev {
+    /* IN */
+    uint64_t handle;
+    uint64_t offset;
+    HVT_GUEST_PTR(struct hvt_block_iov *) iov;
+    size_t iovcnt;
+
+    /* OUT */
+    int ret;
+};
+
+/* HVT_HYPERCALL_BLOCK_READV */
+struct hvt_hc_block_readv {
+    /* IN */
+    uint64_t handle;
+    uint64_t offset;
+    HVT_GUEST_PTR(struct hvt_block_iov *) iov;
+    size_t iovcnt;
+
+    /* OUT */
+    int ret;
+};
+
+/* HVT_HYPERCALL_BLOCK_FLUSH */
+struct hvt_hc_block_flush {
+    /* IN */
+    uint64_t handle;
+
+    /* OUT */
+    int ret;
+};
+
+/* HVT_HYPERCALL_BLOCK_DISCARD */
+struct hvt_hc_block_discard {
+    /* IN */
+    uint64_t handle;
+    uint64_t offset;
+    uint64_t len;
+
+    /* OUT */
+    int ret;
+};
+
+/* HVT_HYPERCALL_BLOCK_WRITE_ZEROES */
+struct hvt_hc_block_write_zeroes {
+    /* IN */
+    uint64_t handle;
+    uint64_t offset;
+    uint64_t len;
+
+    /* OUT */
+    int ret;
+};
+
+/* HVT_HYPERCALL_BLOCK_PREFETCH */
+struct hvt_hc_block_prefetch {
+    /* IN */
+    uint64_t handle;
+    uint64_t offset;
+    uint64_t len;
+
+    /* OUT */
+    int ret;
+};
+
+/*
+ * A zone of a zoned block device, as for struct solo5_block_zone.
+ */
+struct hvt_block_zone {
+    uint64_t start;
+    uint64_t size;
+    uint64_t capacity;
+    uint64_t write_pointer;
+    uint8_t type;
+    uint8_t cond;
+};
+
+/*
+ * HVT_HYPERCALL_BLOCK_ZONE_REPORT: Report up to (count) zones of (handle) into
+ * (zones), starting with the zone containing (offset).
+ */
+#define HVT_BLOCK_ZONES_MAX     32
+
+struct hvt_hc_block_zone_report {
+    /* IN */
+    uint64_t handle;
+    uint64_t offset;
+    HVT_GUEST_PTR(struct hvt_block_zone *) zones;
+    size_t count;
+
+    /* OUT */
+    size_t nzones;
+    int ret;
+};
+
+/* HVT_HYPERCALL_BLOCK_ZONE_APPEND */
+struct hvt_hc_block_zone_append {
+    /* IN */
+    uint64_t handle;
+    uint64_t zone;
+    HVT_GUEST_PTR(const void *) data;
+    size_t len;
+
+    /* OUT */
+    uint64_t offset;
+    int ret;
+};
+
+/* HVT_HYPERCALL_BLOCK_ZONE_MANAGE */
+struct hvt_hc_block_zone_manage {
+    /* IN */
+    uint64_t handle;
+    uint64_t zone;
+    uint32_t op;                /* SOLO5_BLOCK_ZONE_* */
+
+    /* OUT */
+    int ret;
+};
+
+/*
+ * HVT_HYPERCALL_BLOCK_MAP: Replace the guest memory at (data) with a read-only
+ * mapping of the block device (handle), which must be attached with
+ * MFT_BLOCK_MAPPED. (data) must be aligned to HVT_BLOCK_MAP_ALIGN, and the
+ * mapping covers the capacity of the device rounded up to it.
+ */
+#define HVT_BLOCK_MAP_ALIGN     0x10000
+
+struct hvt_hc_block_map {
+    /* IN */
+    uint64_t handle;
+    HVT_GUEST_PTR(void *) data;
+
+    /* OUT */
+    int ret;
+};
+
+/*
+ * HVT_HYPERCALL_SHM_MAP: Map the shared-memory region (handle) over the guest
+ * memory at (data), which must be aligned to HVT_SHM_ALIGN. The guest sets
+ * aside the size of the region rounded up to HVT_SHM_ALIGN, of which the
+ * region replaces what was there; the region must be mapped once only.
+ */
+#define HVT_SHM_ALIGN           0x200000
+
+struct hvt_hc_shm_map {
+    /* IN */
+    uint64_t handle;
+    HVT_GUEST_PTR(void *) data;
+
+    /* OUT */
+    int ret;
+};
+
+/*
+ * HVT_HYPERCALL_SHM_NOTIFY: Notify the host service sharing region (handle),
+ * which must have MFT_SHM_DOORBELL set.
+ */
+struct hvt_hc_shm_notify {
+    /* IN */
+    uint64_t handle;
+
+    /* OUT */
+    int ret;
+};
+
+/*
+ * HVT_HYPERCALL_PCI_MAP: Map memory BAR (bar) of the PCI device (handle) over
+ * the guest memory at (data), which must be aligned to HVT_PCI_ALIGN, as for
+ * HVT_HYPERCALL_SHM_MAP. Each BAR must be mapped once only.
+ */
+#define HVT_PCI_ALIGN           0x200000
+
+struct hvt_hc_pci_map {
+    /* IN */
+    uint64_t handle;
+    uint64_t bar;
+    HVT_GUEST_PTR(void *) data;
+
+    /* OUT */
+    int ret;
+};
+
+/*
+ * Asynchronous block I/O.
+ *
+ * HVT_HYPERCALL_BLOCK_SUBMIT queues a batch of (count) requests, which the
+ * tender performs in the background. Requests are queued in order; if a
+ * request is invalid, or would exceed SOLO5_BLOCK_QUEUE_MAX outstanding
+ * requests on its device, it and all following requests are not queued and
+ * (ret) is set accordingly. On return, (count) is the number of requests
+ * queued. The guest must not access (data) until the completion of a request
+ * has been returned by HVT_HYPERCALL_BLOCK_REAP. The tender makes the device
+ * ready for HVT_HYPERCALL_POLL while completions are waiting to be reaped.
+ */
+#define HVT_BLOCK_OP_READ       0
+#define HVT_BLOCK_OP_WRITE      1
+#define HVT_BLOCK_OP_FLUSH      2       /* (offset, data, len) are ignored */
+
+/*
+ * As HVT_BLOCK_OP_READ and HVT_BLOCK_OP_WRITE, but (data) is an offset in the
+ * registered buffer (buffer), see HVT_HYPERCALL_BLOCK_REGISTER.
+ */
+#define HVT_BLOCK_OP_READ_FIXED  3
+#define HVT_BLOCK_OP_WRITE_FIXED 4
+
+struct hvt_block_req {
+    /* IN */
+    uint64_t handle;
+    uint64_t op;                        /* HVT_BLOCK_OP_* */
+    uint64_t offset;
+    HVT_GUEST_PTR(void *) data;
+    size_t len;
+    uint64_t tag;
+    uint64_t buffer;                    /* HVT_BLOCK_OP_*_FIXED */
+};
+
+/* HVT_HYPERCALL_BLOCK_SUBMIT */
+struct hvt_hc_block_submit {
+    /* IN */
+    HVT_GUEST_PTR(struct hvt_block_req *) reqs;
+
+    /* IN/OUT */
+    size_t count;
+
+    /* OUT */
+    int ret;
+};
+
+struct hvt_block_completion {
+    /* OUT */
+    uint64_t tag;
+    int ret;
+};
+
+/*
+ * Registered block buffers.
+ *
+ * The guest keeps a table of the buffers it has registered with each block
+ * device, at an address which does not change. Buffer (index) of device
+ * (handle) is entry (handle * HVT_BLOCK_BUFFERS_MAX + index), for handles up
+ * to MFT_MAX_ENTRIES; entries with a (len) of 0 are not registered.
+ *
+ * HVT_HYPERCALL_BLOCK_REGISTER registers the buffer in entry (index) of
+ * device (handle) of the table at (buffers) with the tender, after the guest
+ * has filled it in. The tender checks the buffer once, and requests with
+ * HVT_BLOCK_OP_*_FIXED then refer to it by index. As the table is part of
+ * guest memory, a tender to which the guest is migrated registers the buffers
+ * in it again itself; after restoring a snapshot, the guest registers them
+ * again.
+ */
+#define HVT_BLOCK_BUFFERS_MAX 16
+
+struct hvt_block_buffer {
+    HVT_GUEST_PTR(void *) data;
+    size_t len;
+};
+
+/* HVT_HYPERCALL_BLOCK_REGISTER */
+struct hvt_hc_block_register {
+    /* IN */
+    HVT_GUEST_PTR(struct hvt_block_buffer *) buffers;
+    uint64_t handle;
+    uint64_t index;
+
+    /* OUT */
+    int ret;
+};
+
+/* HVT_HYPERCALL_BLOCK_REAP */
+struct hvt_hc_block_reap {
+    /* IN */
+    uint64_t handle;
+    HVT_GUEST_PTR(struct hvt_block_completion *) completions;
+
+    /* IN/OUT */
+    size_t count;
+
+    /* OUT */
+    int ret;
+};
+
 /* HVT_HYPERCALL_NET_WRITE */
 struct hvt_hc_net_write {
     /* IN */
@@ -233,20 +606,372 @@ struct hvt_hc_net_read {
     int ret;
 };
 
-/* HVT_HYPERCALL_POLL */
+/*
+ * A single packet in a HVT_HYPERCALL_NET_WRITEV or HVT_HYPERCALL_NET_READV
+ * request.
+ */
+#define HVT_NET_IOV_MAX 64
+
+struct hvt_net_iov {
+    /* IN */
+    HVT_GUEST_PTR(void *) data;
+
+    /* IN/OUT */
+    size_t len;
+
+    /* OUT */
+    int ret;
+    uint64_t tstamp;            /* READV: host receive time (wall clock) */
+};
+
+/* HVT_HYPERCALL_NET_WRITEV */
+struct hvt_hc_net_writev {
+    /* IN */
+    uint64_t handle;
+    HVT_GUEST_PTR(struct hvt_net_iov *) iov;
+    size_t iovcnt;
+
+    /* OUT */
+    int ret;
+};
+
+/* HVT_HYPERCALL_NET_READV */
+struct hvt_hc_net_readv {
+    /* IN */
+    uint64_t handle;
+    HVT_GUEST_PTR(struct hvt_net_iov *) iov;
+
+    /* IN/OUT */
+    size_t iovcnt;
+
+    /* OUT */
+    int ret;
+};
+
+/*
+ * Shared-memory packet rings (HVT_FEATURE_NET_RINGS).
+ *
+ * Each ring is a single-producer, single-consumer queue of fixed-size packet
+ * slots in guest memory, indexed as described in ring_abi.h.
+ *
+ * A network device using rings has one ring in each direction: the tender
+ * produces into (rx) and the guest produces into (tx). The guest must issue
+ * HVT_HYPERCALL_NET_NOTIFY after producing into an empty (tx) ring. The
+ * tender makes the device ready for HVT_HYPERCALL_POLL after producing into
+ * an empty (rx) ring.
+ */
+#define HVT_NET_RING_SLOTS      256     /* Must be a power of 2 */
+#define HVT_NET_RING_SLOT_SIZE  2048
+
+struct hvt_net_ring_slot {
+    uint32_t len;
+    uint32_t pad;
+    uint64_t tstamp;            /* rx: host receive time (wall clock) */
+    uint8_t data[HVT_NET_RING_SLOT_SIZE - 16];
+};
+
+struct hvt_net_ring {
+    struct ring_index idx;
+    struct hvt_net_ring_slot slot[HVT_NET_RING_SLOTS];
+};
+
+/* HVT_HYPERCALL_NET_RINGS: Switch a network device to use packet rings. */
+struct hvt_hc_net_rings {
+    /* IN */
+    uint64_t handle;
+    HVT_GUEST_PTR(struct hvt_net_ring *) rx;
+    HVT_GUEST_PTR(struct hvt_net_ring *) tx;
+
+    /* OUT */
+    int ret;
+};
+
+/* HVT_HYPERCALL_NET_NOTIFY */
+struct hvt_hc_net_notify {
+    /* IN */
+    uint64_t handle;
+};
+
+/*
+ * virtio rings (HVT_FEATURE_NET_VHOST).
+ *
+ * A network device may instead be switched to use a pair of standard virtio
+ * split virtqueues (receive and transmit) in guest memory, which are served
+ * directly by the host kernel. Each buffer is prefixed by a struct
+ * virtio_net_hdr (HVT_NET_VRING_HDR_LEN bytes) with no offloads requested.
+ *
+ * The guest notifies the host of new buffers with HVT_HYPERCALL_NET_KICK,
+ * passing the queue number HVT_NET_VRING_QUEUE(handle, queue) in place of
+ * the usual hypercall argument pointer. Kicks are normally handled by the
+ * host kernel without exiting to the tender. The host signals used receive
+ * buffers by making the device ready for HVT_HYPERCALL_POLL.
+ */
+#define HVT_NET_VRING_NUM       256     /* Descriptors per queue */
+#define HVT_NET_VRING_HDR_LEN   10
+#define HVT_NET_VRING_RX        0
+#define HVT_NET_VRING_TX        1
+#define HVT_NET_VRING_QUEUE(handle, queue) (((handle) << 1) | (queue))
+
+struct hvt_net_vring {
+    HVT_GUEST_PTR(void *) desc;
+    HVT_GUEST_PTR(void *) avail;
+    HVT_GUEST_PTR(void *) used;
+};
+
+/* HVT_HYPERCALL_NET_VRINGS: Switch a network device to use virtio rings. */
+struct hvt_hc_net_vrings {
+    /* IN */
+    uint64_t handle;
+    struct hvt_net_vring queue[2];
+
+    /* OUT */
+    int ret;
+};
+
+/*
+ * HVT_HYPERCALL_POLL: (ret) is the number of devices ready, in (ready_set).
+ * Network devices on which a write returned SOLO5_R_AGAIN since the last poll
+ * are also reported in (writable_set), without being counted in (ret), once
+ * the host can accept packets for them again.
+ */
 struct hvt_hc_poll {
     /* IN */
     uint64_t timeout_nsecs;             /* Relative to time of call */
 
     /* OUT */
     uint64_t ready_set;
+    uint64_t writable_set;
+    int ret;
+};
+
+/*
+ * Shared readiness page (HVT_FEATURE_POLL_PAGE).
+ *
+ * Once registered by the guest, the tender publishes the readiness of devices
+ * in (ready_set) from an I/O thread, so that the guest can find out whether
+ * any devices are ready without HVT_HYPERCALL_POLL. A device's bit is set
+ * when it becomes ready, and cleared by the tender when the guest consumes
+ * its readiness by reading from it or reaping its completions, after which it
+ * is set again if the device is still ready. (seq) is incremented each time
+ * bits are set.
+ *
+ * Only devices for which HVT_HYPERCALL_POLL would report readiness until it is
+ * consumed are published; network devices using rings are not.
+ *
+ * (reclaim_seq) is incremented each time the host asks the guest to release
+ * unused memory with HVT_HYPERCALL_MEM_RELEASE.
+ */
+struct hvt_poll_page {
+    uint64_t ready_set;
+    uint64_t seq;
+    uint64_t reclaim_seq;
+};
+
+/* HVT_HYPERCALL_POLL_PAGE: Register the shared readiness page. */
+struct hvt_hc_poll_page {
+    /* IN */
+    HVT_GUEST_PTR(struct hvt_poll_page *) page;
+
+    /* OUT */
+    int ret;
+};
+
+/*
+ * In-kernel local APIC (HVT_FEATURE_IRQCHIP), x86_64 only.
+ *
+ * The boot VCPU has a local APIC emulated by the host kernel, supporting
+ * x2APIC mode and the TSC-deadline timer, with which the guest may wait by
+ * halting instead of blocking in HVT_HYPERCALL_POLL. The tender raises
+ * HVT_IRQCHIP_VECTOR on the boot VCPU, as a fixed, edge-triggered interrupt,
+ * when any device watched by HVT_HYPERCALL_POLL may have become ready, then
+ * not again until the guest next calls HVT_HYPERCALL_POLL, with which it
+ * finds out which devices are ready. As for any interrupt, the guest must
+ * signal end of interrupt to its local APIC.
+ */
+#define HVT_IRQCHIP_VECTOR 32
+
+/*
+ * Shared time page (HVT_FEATURE_TIME_PAGE).
+ *
+ * Once registered by the guest, the tender periodically updates it with the
+ * host's wall clock time (wall_nsecs) at a given value of the guest's CPU
+ * cycle counter (cycles), so that the guest can compute wall clock time
+ * which follows corrections made to the host clock without any hypercalls.
+ * The guest extrapolates from the latest update using the cycle counter
+ * frequency given in (struct hvt_boot_info).
+ *
+ * (seq) is odd while an update is in progress. Readers must retry if (seq) is
+ * odd, or has changed by the time they have read the other fields.
+ */
+struct hvt_time_page {
+    uint64_t seq;
+    uint64_t cycles;
+    uint64_t wall_nsecs;
+};
+
+/*
+ * HVT_HYPERCALL_TIME_PAGE: Register the shared time page. (cycles) is the
+ * guest's CPU cycle counter read immediately before the hypercall, which the
+ * tender uses to relate it to its own.
+ */
+struct hvt_hc_time_page {
+    /* IN */
+    HVT_GUEST_PTR(struct hvt_time_page *) page;
+    uint64_t cycles;
+
+    /* OUT */
+    int ret;
+};
+
+/*
+ * HVT_HYPERCALL_SNAPSHOT: The guest has finished initialising. If the tender
+ * was asked to take a snapshot, it saves the state of the guest as it will be
+ * on return from this hypercall, with (ret) set to SOLO5_R_OK, and exits.
+ * Otherwise, (ret) is set to SOLO5_R_EUNSPEC and the guest continues.
+ *
+ * After returning from a snapshot, the guest must register any shared pages
+ * (HVT_HYPERCALL_POLL_PAGE, HVT_HYPERCALL_TIME_PAGE, HVT_HYPERCALL_TRACE_RING,
+ * HVT_HYPERCALL_CONSOLE_RING) with the tender again.
+ */
+struct hvt_hc_snapshot {
+    /* OUT */
+    int ret;
+};
+
+/*
+ * HVT_HYPERCALL_BOOT_REPORT: The guest is about to call solo5_app_main().
+ * (start_cycles) and (app_main_cycles) are the CPU cycle counter on entry to
+ * the guest and just before this call, which the tender reports with
+ * --trace-boot, and (heap_start) is the start of the application heap, which
+ * it reports with --mem-report. The boot information page is read-only to the
+ * guest, so these are passed here rather than stored there.
+ */
+struct hvt_hc_boot_report {
+    /* IN */
+    uint64_t start_cycles;
+    uint64_t app_main_cycles;
+    uint64_t heap_start;
+};
+
+/*
+ * HVT_HYPERCALL_MEM_RELEASE: The guest no longer uses the (len) bytes of
+ * memory at (data). The tender gives the host pages entirely within this range
+ * back to the host, after which their contents are undefined until written by
+ * the guest. (ret) is set to SOLO5_R_EUNSPEC if the host cannot reclaim them.
+ */
+struct hvt_hc_mem_release {
+    /* IN */
+    HVT_GUEST_PTR(void *) data;
+    size_t len;
+
+    /* OUT */
+    int ret;
+};
+
+/*
+ * Event trace ring (HVT_FEATURE_TRACE).
+ *
+ * The guest records events in the ring without exiting to the tender, which
+ * reads it when dumping the trace. (head) counts the events recorded so far;
+ * event number (n) is stored in ev[n % HVT_TRACE_ENTRIES], overwriting older
+ * events. (seq) is 0 while an event is being written, and is then set to
+ * n + 1 after the other fields, so that readers can tell complete events from
+ * torn or overwritten ones.
+ */
+#define HVT_TRACE_ENTRIES 4096
+
+struct hvt_trace_event {
+    uint64_t seq;
+    uint64_t nsecs;                     /* solo5_clock_monotonic() */
+    uint64_t id;
+    uint64_t arg[2];
+};
+
+struct hvt_trace_ring {
+    uint64_t head;
+    uint64_t pad[7];
+    struct hvt_trace_event ev[HVT_TRACE_ENTRIES];
+};
+
+/*
+ * HVT_HYPERCALL_TRACE_RING: Register the event trace ring, which must be
+ * 64-byte aligned. (nsecs) is the guest's monotonic time just before the
+ * call, which the tender uses to place events on its own clock.
+ */
+struct hvt_hc_trace_ring {
+    /* IN */
+    HVT_GUEST_PTR(struct hvt_trace_ring *) ring;
+    uint64_t nsecs;
+
+    /* OUT */
+    int ret;
+};
+
+/*
+ * Console output ring (HVT_FEATURE_CONSOLE_RING).
+ *
+ * Once registered by the guest, console output is appended to (data) rather
+ * than written with HVT_HYPERCALL_PUTS. The guest advances (head) once it has
+ * written the data, and the tender writes out the data up to (head) and
+ * advances (tail) on each exit of the guest, before handling any hypercall.
+ * Console output thus costs no exit of its own, and appears no later than the
+ * guest's next exit. If the ring does not have room, the guest uses
+ * HVT_HYPERCALL_PUTS instead, which is handled after the ring is drained.
+ */
+#define HVT_CONSOLE_RING_SIZE   16384   /* Bytes, a power of 2 */
+
+struct hvt_console_ring {
+    uint64_t head;                      /* Written by the guest */
+    uint64_t pad0[7];
+    uint64_t tail;                      /* Written by the tender */
+    uint64_t pad1[7];
+    char data[HVT_CONSOLE_RING_SIZE];
+};
+
+/*
+ * HVT_HYPERCALL_CONSOLE_RING: Register the console output ring, which must be
+ * 64-byte aligned.
+ */
+struct hvt_hc_console_ring {
+    /* IN */
+    HVT_GUEST_PTR(struct hvt_console_ring *) ring;
+
+    /* OUT */
+    int ret;
+};
+
+/*
+ * HVT_HYPERCALL_MULTI (HVT_FEATURE_MULTI): Perform (count) hypercalls in order
+ * within a single exit. Each call (nr) takes its arguments at (arg) and
+ * reports its results there exactly as if it had been made on its own.
+ * HVT_HYPERCALL_HALT, HVT_HYPERCALL_SNAPSHOT and HVT_HYPERCALL_MULTI cannot be
+ * batched. If a call cannot be made, it and all following calls are not
+ * performed and (ret) is set to SOLO5_R_EINVAL. On return, (count) is the
+ * number of calls performed.
+ */
+#define HVT_MULTI_MAX 64
+
+struct hvt_multi_call {
+    /* IN */
+    uint64_t nr;
+    HVT_GUEST_PTR(void *) arg;
+};
+
+struct hvt_hc_multi {
+    /* IN */
+    HVT_GUEST_PTR(struct hvt_multi_call *) calls;
+
+    /* IN/OUT */
+    size_t count;
+
+    /* OUT */
     int ret;
 };
 
 /*
  * HVT_HYPERCALL_HALT: Terminate guest execution.
  *
- * (exit_status) will be returned to the host.
+ * (exit_status) will be returned to the host. Any VCPU may terminate the guest.
  *
  * Additionally, the guest may supply a (cookie) providing a hint to the
  * tender about where e.g. a trap frame may be found in guest memory. The
@@ -263,4 +988,25 @@ struct hvt_hc_halt {
     int exit_status;
 };
 
+/*
+ * HVT_HYPERCALL_CPU_START: Start VCPU (cpu), which must not have been started
+ * before, at (entry) with its stack pointer set to (stack) and its TLS base to
+ * (tls_base). (arg) is passed as the sole argument to (entry), and (stack)
+ * must be 16-byte aligned. The VCPU starts with the same CPU state as the boot
+ * VCPU, and stops if it halts. VCPU 0 is the boot VCPU.
+ */
+#define HVT_CPUS_MAX 64
+
+struct hvt_hc_cpu_start {
+    /* IN */
+    uint64_t cpu;
+    HVT_GUEST_PTR(void *) entry;
+    HVT_GUEST_PTR(void *) stack;
+    uint64_t tls_base;
+    uint64_t arg;
+
+    /* OUT */
+    int ret;
+};
+
 #endif /* HVT_GUEST_H */
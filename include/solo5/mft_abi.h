@@ -34,16 +34,20 @@
 #define MFT_ABI_H
 
 /*
- * MFT_VERSION is the manifest ABI version.
+ * MFT_VERSION is the manifest ABI version. Version 2 added the performance
+ * attributes declared for each device (mft_entry.attrs).
  */
-#define MFT_VERSION 1
+#define MFT_VERSION 2
 
 /*
  * Supported device types.
  */
 typedef enum mft_type {
     MFT_BLOCK_BASIC,
-    MFT_NET_BASIC
+    MFT_NET_BASIC,
+    MFT_SHM_BASIC,
+    MFT_PCI_BASIC,
+    MFT_VSOCK_BASIC
 } mft_type_t;
 
 /*
@@ -52,14 +56,119 @@ typedef enum mft_type {
 struct mft_block_basic {
     uint64_t capacity;
     uint16_t block_size;
+    uint16_t flags;             /* MFT_BLOCK_* */
+    uint32_t zone_blocks;       /* Zone size in blocks, 0 if not zoned */
 };
 
+/*
+ * MFT_BLOCK_BASIC flags, set by the tender.
+ */
+#define MFT_BLOCK_DIRECT        (1U << 0)   /* Opened for direct I/O */
+#define MFT_BLOCK_MAPPED        (1U << 1)   /* Read-only, mapped into memory */
+#define MFT_BLOCK_RAM           (1U << 2)   /* Backed by tender memory */
+
 /*
  * MFT_NET_BASIC (basic network device) properties.
  */
 struct mft_net_basic {
     uint8_t mac[6];
     uint16_t mtu;
+    uint32_t offloads;          /* MFT_NET_OFFLOAD_* */
+};
+
+/*
+ * Range of MTUs which may be configured for a MFT_NET_BASIC device. The
+ * maximum allows for an Ethernet header in a 64kB frame.
+ */
+#define MFT_NET_MTU_MIN         68
+#define MFT_NET_MTU_MAX         65521
+
+/*
+ * MFT_NET_BASIC offload flags, set by the tender. These correspond to the
+ * SOLO5_NET_OFFLOAD_* flags in solo5.h.
+ */
+#define MFT_NET_OFFLOAD_HDR     (1U << 0)   /* Frames carry a solo5_net_hdr */
+#define MFT_NET_OFFLOAD_CSUM    (1U << 1)   /* Partial checksums */
+#define MFT_NET_OFFLOAD_TSO4    (1U << 2)   /* TCP segmentation, IPv4 */
+#define MFT_NET_OFFLOAD_TSO6    (1U << 3)   /* TCP segmentation, IPv6 */
+
+/*
+ * MFT_SHM_BASIC (shared-memory region) properties. (addr) is only set if the
+ * tender maps the region into guest memory itself; otherwise the guest
+ * chooses where to map it.
+ */
+struct mft_shm_basic {
+    uint64_t addr;
+    uint32_t pages;             /* Size, in MFT_SHM_PAGE_SIZE pages */
+    uint16_t flags;             /* MFT_SHM_* */
+};
+
+#define MFT_SHM_PAGE_SIZE       4096
+
+/*
+ * MFT_SHM_BASIC flags, set by the tender.
+ */
+#define MFT_SHM_DOORBELL        (1U << 0)   /* Notifications in both ways */
+
+/*
+ * MFT_PCI_BASIC (passed-through PCI device) properties, set by the tender.
+ * (bar_shift[i]) is the log2 of the size of memory BAR i, or 0 if it cannot
+ * be mapped by the guest.
+ */
+#define MFT_PCI_BARS            6
+
+struct mft_pci_basic {
+    uint16_t vendor_id;
+    uint16_t device_id;
+    uint16_t irqs;              /* MSI-X vectors, signalling the handle */
+    uint8_t bar_shift[MFT_PCI_BARS];
+};
+
+/*
+ * MFT_BLOCK_BASIC performance attributes, declared in the manifest. Zero
+ * values state no requirement or preference.
+ */
+struct mft_block_attrs {
+    uint16_t block_size;        /* Block size required */
+    uint16_t queue_depth;       /* Asynchronous requests kept in flight */
+    uint16_t flags;             /* MFT_BLOCK_ATTR_* */
+};
+
+#define MFT_BLOCK_ATTR_DIRECT   (1U << 0)   /* Direct I/O preferred */
+
+/*
+ * MFT_NET_BASIC performance attributes, declared in the manifest. Zero values
+ * state no requirement.
+ */
+struct mft_net_attrs {
+    uint16_t mtu;               /* MTU required */
+    uint16_t queues;            /* Queues required */
+    uint32_t offloads;          /* MFT_NET_OFFLOAD_* required */
+};
+
+/*
+ * MFT_SHM_BASIC attributes, declared in the manifest. A zero (size) states no
+ * requirement.
+ */
+struct mft_shm_attrs {
+    uint64_t size;              /* Size required, bytes */
+};
+
+/*
+ * MFT_PCI_BASIC attributes, declared in the manifest. Zero values match any
+ * device.
+ */
+struct mft_pci_attrs {
+    uint16_t vendor_id;         /* Vendor ID required */
+    uint16_t device_id;         /* Device ID required */
+};
+
+/*
+ * MFT_VSOCK_BASIC (stream to a host service over vsock) attributes, declared
+ * in the manifest.
+ */
+struct mft_vsock_attrs {
+    uint32_t port;              /* Port of the service on the host */
 };
 
 #define MFT_NAME_SIZE 68        /* Bytes, including string terminator */
@@ -74,7 +183,16 @@ struct mft_entry {
     union {
         struct mft_block_basic block_basic;
         struct mft_net_basic net_basic;
+        struct mft_shm_basic shm_basic;
+        struct mft_pci_basic pci_basic;
     } u;
+    union {
+        struct mft_block_attrs block;
+        struct mft_net_attrs net;
+        struct mft_shm_attrs shm;
+        struct mft_pci_attrs pci;
+        struct mft_vsock_attrs vsock;
+    } attrs;
     int hostfd;                 /* Backing host descriptor */
     bool attached;              /* Device attached? */
 };
@@ -0,0 +1,179 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * ring_abi.h: Lock-free ring indices shared between a guest and its host.
+ *
+ * This header file must be kept self-contained with no external dependencies
+ * other than C99 headers and the GCC/Clang __atomic builtins, as it is used
+ * both by the bindings and by the tenders.
+ *
+ * A ring is a power-of-2 sized array of slots, defined by its user, and a
+ * struct ring_index. (prod) counts the slots published by the producer and
+ * (cons) the slots released by the consumer; both are free-running, and
+ * (prod - cons) is the number of slots in use. The two counters are on
+ * separate cache lines, so that the producer and consumer each only write to
+ * their own. Slot number (n) is at index ring_slot(n, size).
+ *
+ * A producer writes slots from ring_prod_pos() onwards, at most
+ * ring_prod_free() of them, then makes them visible with ring_prod_publish().
+ * A consumer reads slots from ring_cons_pos() onwards, at most
+ * ring_cons_avail() of them, then returns them with ring_cons_release().
+ * Publishing or releasing a batch of slots at once costs a single store to
+ * a shared cache line.
+ *
+ * Several producers (but still a single consumer) may share a ring by
+ * reserving slots with ring_mp_reserve() and publishing them with
+ * ring_mp_publish(), in place of the functions above. Reservations are
+ * published in order, so a producer may wait for others to publish theirs.
+ *
+ * Counters are published with release stores and read with acquire loads,
+ * so that slot contents written before publishing (or read before releasing)
+ * are ordered with respect to the other side. On x86_64 these are plain loads
+ * and stores, and on aarch64 LDAR and STLR. A side which sleeps when the ring
+ * is empty (or full) must, after announcing that it is about to sleep,
+ * issue ring_fence() before checking the ring one last time, and the other
+ * side must issue ring_fence() after publishing (or releasing) before
+ * checking whether to wake it.
+ */
+
+#ifndef RING_ABI_H
+#define RING_ABI_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define RING_CACHE_LINE 64
+
+struct ring_index {
+    uint32_t prod;              /* Written only by the producer(s) */
+    uint32_t resv;              /* Slots reserved by ring_mp_reserve() */
+    uint8_t pad0[RING_CACHE_LINE - 8];
+    uint32_t cons;              /* Written only by the consumer */
+    uint8_t pad1[RING_CACHE_LINE - 4];
+};
+
+static inline uint32_t ring_slot(uint32_t n, uint32_t size)
+{
+    return n & (size - 1);
+}
+
+static inline void ring_fence(void)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+/*
+ * Hint to the CPU that the caller is spinning on a ring.
+ */
+static inline void ring_cpu_relax(void)
+{
+#if defined(__x86_64__)
+    __asm__ __volatile__("pause" ::: "memory");
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield" ::: "memory");
+#else
+    __asm__ __volatile__("" ::: "memory");
+#endif
+}
+
+/*
+ * Producer side.
+ */
+static inline uint32_t ring_prod_pos(const struct ring_index *ri)
+{
+    return ri->prod;
+}
+
+static inline uint32_t ring_prod_free(const struct ring_index *ri,
+        uint32_t size)
+{
+    uint32_t used = ri->prod - __atomic_load_n(&ri->cons, __ATOMIC_ACQUIRE);
+
+    /* A corrupt (cons) is treated as a full ring. */
+    return used >= size ? 0 : size - used;
+}
+
+static inline void ring_prod_publish(struct ring_index *ri, uint32_t n)
+{
+    __atomic_store_n(&ri->prod, ri->prod + n, __ATOMIC_RELEASE);
+}
+
+/*
+ * Returns true if the consumer has released every slot published before
+ * (pos), i.e. it found the ring empty and may be waiting for a wakeup.
+ * Must be preceded by ring_fence().
+ */
+static inline bool ring_prod_drained(const struct ring_index *ri, uint32_t pos)
+{
+    return __atomic_load_n(&ri->cons, __ATOMIC_ACQUIRE) == pos;
+}
+
+/*
+ * Consumer side.
+ */
+static inline uint32_t ring_cons_pos(const struct ring_index *ri)
+{
+    return ri->cons;
+}
+
+static inline uint32_t ring_cons_avail(const struct ring_index *ri)
+{
+    return __atomic_load_n(&ri->prod, __ATOMIC_ACQUIRE) - ri->cons;
+}
+
+static inline void ring_cons_release(struct ring_index *ri, uint32_t n)
+{
+    __atomic_store_n(&ri->cons, ri->cons + n, __ATOMIC_RELEASE);
+}
+
+/*
+ * Multiple producers. Reserves (n) slots of a ring of (size) slots, storing
+ * the number of the first in (*pos). Returns false if there is not enough
+ * room.
+ */
+static inline bool ring_mp_reserve(struct ring_index *ri, uint32_t size,
+        uint32_t n, uint32_t *pos)
+{
+    uint32_t resv = __atomic_load_n(&ri->resv, __ATOMIC_RELAXED);
+
+    do {
+        uint32_t cons = __atomic_load_n(&ri->cons, __ATOMIC_ACQUIRE);
+        if (resv - cons > size || n > size - (resv - cons))
+            return false;
+    } while (!__atomic_compare_exchange_n(&ri->resv, &resv, resv + n, true,
+                __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    *pos = resv;
+    return true;
+}
+
+/*
+ * Publishes the (n) slots reserved at (pos), once all earlier reservations
+ * have been published.
+ */
+static inline void ring_mp_publish(struct ring_index *ri, uint32_t pos,
+        uint32_t n)
+{
+    while (__atomic_load_n(&ri->prod, __ATOMIC_RELAXED) != pos)
+        ring_cpu_relax();
+    __atomic_store_n(&ri->prod, pos + n, __ATOMIC_RELEASE);
+}
+
+#endif /* RING_ABI_H */
@@ -91,16 +91,27 @@ typedef enum {
  * heap or stack(s) as it sees fit.  At entry, the application is provided with
  * an initial stack growing down from (info->heap_start + info->heap_size).
  *
+ * (info->heap_huge_start, info->heap_huge_size) is the largest part of the
+ * heap aligned to and a multiple of SOLO5_HUGE_PAGE_SIZE, which the Solo5
+ * implementation maps with huge pages where it can, or has a size of 0 if
+ * there is none. Large heaps start on a SOLO5_HUGE_PAGE_SIZE boundary, in
+ * which case both regions start at the same address. Allocators may place
+ * large or frequently accessed data there to reduce TLB misses.
+ *
  * The application MUST NOT make any further assumptions about memory layout,
  * including where executable code or static data are located in memory.
  *
  * Returning from this function is equivalent to calling solo5_exit(<return
  * value>).
  */
+#define SOLO5_HUGE_PAGE_SIZE (2UL << 20)
+
 struct solo5_start_info {
     const char *cmdline;
     uintptr_t heap_start;
     size_t heap_size;
+    uintptr_t heap_huge_start;
+    size_t heap_huge_size;
 };
 
 int solo5_app_main(const struct solo5_start_info *info);
@@ -162,11 +173,45 @@ typedef uint64_t solo5_handle_set_t;
  *   b) at least one network device is ready for input.
  *
  * Returns true if at least one network device is ready, otherwise false.
+ * May return false before (deadline) if a network device becomes writable,
+ * see SOLO5_EVENT_WRITABLE.
  * If (ready_set) is not NULL, it will be filled in with the set of
  * solo5_handle_t's ready for input.
  */
 bool solo5_yield(solo5_time_t deadline, solo5_handle_set_t *ready_set);
 
+/*
+ * Kinds of readiness reported by solo5_yield_events().
+ */
+#define SOLO5_EVENT_READABLE    (1U << 0)   /* Network device has input */
+#define SOLO5_EVENT_COMPLETION  (1U << 1)   /* Block device has completions */
+#define SOLO5_EVENT_WRITABLE    (1U << 2)   /* Network device can send again */
+
+struct solo5_event {
+    solo5_handle_t handle;
+    uint32_t events;                        /* SOLO5_EVENT_* */
+};
+
+/*
+ * As solo5_yield(), but reports the devices which are ready as an array
+ * rather than a set: fills in up to (count) entries of (events[]), one per
+ * ready device, with the kind of readiness of each, and the number filled in
+ * (*nready). Returns true if at least one device is ready.
+ *
+ * Readiness persists until it is consumed, so devices which did not fit in
+ * (events[]) are reported by the next call. The cost of a call depends on
+ * the number of devices ready, not on the number of devices, and the array
+ * does not limit the number of handles which can be reported, unlike
+ * solo5_handle_set_t; new applications should prefer this call.
+ *
+ * SOLO5_EVENT_WRITABLE is reported once for a network device on which a write
+ * returned SOLO5_R_AGAIN as the host could not accept the packet, when it
+ * can again. Not all targets report it; on those, writes must be retried
+ * after a suitable delay.
+ */
+bool solo5_yield_events(solo5_time_t deadline, struct solo5_event *events,
+        size_t count, size_t *nready);
+
 /*
  * Console I/O.
  */
@@ -196,8 +241,56 @@ void solo5_console_write(const char *buf, size_t size);
 struct solo5_net_info {
     uint8_t mac_address[SOLO5_NET_ALEN];
     size_t mtu;                 /* Not including Ethernet header */
+    uint32_t offloads;          /* SOLO5_NET_OFFLOAD_* */
+};
+
+/*
+ * Network device offloads.
+ *
+ * If SOLO5_NET_OFFLOAD_HDR is set in (solo5_net_info.offloads), every packet
+ * sent or received on the device is prefixed by a (struct solo5_net_hdr),
+ * which has the same layout as a virtio-net header. On transmit, the
+ * application may then ask for the host to complete a partial checksum
+ * (SOLO5_NET_HDR_F_NEEDS_CSUM) and to segment a TCP "super-frame" of up to
+ * SOLO5_NET_GSO_FRAME_MAX bytes (gso_type != SOLO5_NET_HDR_GSO_NONE).
+ *
+ * On receive, the host may deliver such packets only if the corresponding
+ * SOLO5_NET_OFFLOAD_CSUM or SOLO5_NET_OFFLOAD_TSO* flag is set. With
+ * SOLO5_NET_OFFLOAD_CSUM, the host may also set SOLO5_NET_HDR_F_DATA_VALID to
+ * indicate that it has already verified the packet's checksums. Receive
+ * buffers for devices with SOLO5_NET_OFFLOAD_TSO* must be at least
+ * (SOLO5_NET_HDR_LEN + SOLO5_NET_GSO_FRAME_MAX) bytes.
+ */
+#define SOLO5_NET_OFFLOAD_HDR   (1U << 0)
+#define SOLO5_NET_OFFLOAD_CSUM  (1U << 1)
+#define SOLO5_NET_OFFLOAD_TSO4  (1U << 2)
+#define SOLO5_NET_OFFLOAD_TSO6  (1U << 3)
+
+struct solo5_net_hdr {
+    uint8_t flags;              /* SOLO5_NET_HDR_F_* */
+    uint8_t gso_type;           /* SOLO5_NET_HDR_GSO_* */
+    uint16_t hdr_len;           /* Ethernet + IP + TCP header length */
+    uint16_t gso_size;          /* Segment size, not including headers */
+    uint16_t csum_start;        /* Offset to start checksumming from */
+    uint16_t csum_offset;       /* Offset after csum_start to store it */
 };
 
+#define SOLO5_NET_HDR_LEN       10
+
+#define SOLO5_NET_HDR_F_NEEDS_CSUM      1
+#define SOLO5_NET_HDR_F_DATA_VALID      2
+
+#define SOLO5_NET_HDR_GSO_NONE          0
+#define SOLO5_NET_HDR_GSO_TCPV4         1
+#define SOLO5_NET_HDR_GSO_TCPV6         4
+#define SOLO5_NET_HDR_GSO_ECN           0x80
+
+/*
+ * Maximum packet size, including the Ethernet header but not the
+ * solo5_net_hdr, when segmentation offloads are in use.
+ */
+#define SOLO5_NET_GSO_FRAME_MAX (65535 + SOLO5_NET_HLEN)
+
 /*
  * Acquires a handle to the network device declared as (name) in the
  * application manifest. The returned handle is stored in (*handle), and
@@ -209,12 +302,19 @@ solo5_result_t solo5_net_acquire(const char *name, solo5_handle_t *handle,
 
 /*
  * Sends a single network packet to the network device identified by (handle),
- * from the buffer (*buf), without blocking.  If the packet cannot be sent due
- * to a transient error (e.g.  no resources available) it will be silently
- * dropped.
+ * from the buffer (*buf), without blocking.  On targets which do not report
+ * SOLO5_R_AGAIN for it, a packet which cannot be sent due to a transient
+ * error (e.g.  no resources available) will be silently dropped.
+ *
+ * Returns SOLO5_R_AGAIN if the packet was not sent as the host cannot
+ * accept it now, e.g. as its queue for the device is full or to enforce a
+ * rate limit; the application may retry later, see SOLO5_EVENT_WRITABLE.
+ * Returns SOLO5_R_EUNSPEC if the host failed to send the packet.
  *
  * The maximum allowed value for (size) is (solo5_net_info.mtu +
- * SOLO5_NET_HLEN). The packet must include the ethernet frame header.
+ * SOLO5_NET_HLEN). The packet must include the ethernet frame header, and
+ * with SOLO5_NET_OFFLOAD_HDR is preceded by a (struct solo5_net_hdr); see
+ * above.
  */
 solo5_result_t solo5_net_write(solo5_handle_t handle, const uint8_t *buf,
         size_t size);
@@ -232,15 +332,194 @@ solo5_result_t solo5_net_write(solo5_handle_t handle, const uint8_t *buf,
 solo5_result_t solo5_net_read(solo5_handle_t handle, uint8_t *buf,
         size_t size, size_t *read_size);
 
+/*
+ * Receives a single network packet from the network device identified by
+ * (handle) without blocking and without copying, by loaning the buffer
+ * holding the packet to the application. A pointer to the packet, including
+ * the ethernet frame header, is stored in (*buf) and its size in (*size).
+ *
+ * The buffer remains valid, and owned by the application, until it is
+ * returned with solo5_net_read_release(). At most one packet per device may
+ * be on loan at any time; the application MUST release it before calling any
+ * other receive interface on (handle).
+ *
+ * If no packets are available returns SOLO5_R_AGAIN. If a packet is already
+ * on loan returns SOLO5_R_EINVAL.
+ */
+solo5_result_t solo5_net_read_loan(solo5_handle_t handle, const uint8_t **buf,
+        size_t *size);
+
+/*
+ * Returns the packet on loan from the network device identified by (handle)
+ * following a successful solo5_net_read_loan(). Returns SOLO5_R_EINVAL if no
+ * packet is on loan.
+ */
+solo5_result_t solo5_net_read_release(solo5_handle_t handle);
+
+/*
+ * Maximum number of packets per network device which may be loaned to Solo5
+ * with solo5_net_write_loan() and not yet reclaimed.
+ */
+#define SOLO5_NET_WRITE_LOANS_MAX 64
+
+/*
+ * Sends a single network packet to the network device identified by
+ * (handle), from the buffer (*buf), without blocking and if possible without
+ * copying. Requirements for (buf, size) are as for solo5_net_write().
+ *
+ * Ownership of the buffer passes to Solo5: the application MUST NOT modify
+ * it until it has been returned by solo5_net_write_reclaim().
+ *
+ * If SOLO5_NET_WRITE_LOANS_MAX packets are already on loan, returns
+ * SOLO5_R_AGAIN and the application should reclaim some before retrying.
+ */
+solo5_result_t solo5_net_write_loan(solo5_handle_t handle, const uint8_t *buf,
+        size_t size);
+
+/*
+ * Reclaims up to (count) buffers previously loaned with solo5_net_write_loan()
+ * to the network device identified by (handle) whose transmission has
+ * completed, without blocking. Buffers are stored in (bufs[]) in the order
+ * they were loaned, and their number in (*reclaimed).
+ *
+ * If no buffers can be reclaimed returns SOLO5_R_AGAIN.
+ */
+solo5_result_t solo5_net_write_reclaim(solo5_handle_t handle,
+        const uint8_t **bufs, size_t count, size_t *reclaimed);
+
+/*
+ * Describes a single network packet for the batched I/O interfaces below.
+ */
+struct solo5_net_frame {
+    uint8_t *buf;               /* Packet buffer */
+    size_t size;                /* IN: buffer/packet size, OUT: size read */
+    solo5_result_t result;      /* OUT: result of I/O for this packet */
+    solo5_time_t tstamp;        /* OUT: host receive time, see readv */
+};
+
+/*
+ * Maximum number of packets which may be passed in a single call to
+ * solo5_net_readv() or solo5_net_writev().
+ */
+#define SOLO5_NET_FRAMES_MAX    64
+
+/*
+ * Sends up to (count) network packets described by (frames[]) to the network
+ * device identified by (handle), without blocking. Each packet is subject to
+ * the same requirements and semantics as for solo5_net_write(); the result of
+ * sending each packet is stored in (frames[i].result).
+ *
+ * (count) must not exceed SOLO5_NET_FRAMES_MAX, otherwise SOLO5_R_EINVAL is
+ * returned.
+ *
+ * Returns SOLO5_R_OK if all packets were sent, otherwise returns the first
+ * error encountered.
+ */
+solo5_result_t solo5_net_writev(solo5_handle_t handle,
+        struct solo5_net_frame *frames, size_t count);
+
+/*
+ * Receives up to (count) network packets from the network device identified
+ * by (handle) into the buffers described by (frames[]), without blocking.
+ * Each (frames[i].size) must be at least (solo5_net_info.mtu +
+ * SOLO5_NET_HLEN).
+ *
+ * (count) must not exceed SOLO5_NET_FRAMES_MAX, otherwise SOLO5_R_EINVAL is
+ * returned.
+ *
+ * If no packets are available returns SOLO5_R_AGAIN, otherwise returns
+ * SOLO5_R_OK and the number of packets received in (*read_count). For each
+ * received packet, (frames[i].size) is set to the size of the packet
+ * including the ethernet frame header, and (frames[i].result) to SOLO5_R_OK.
+ *
+ * (frames[i].tstamp) is set to the wall clock time, as for solo5_clock_wall(),
+ * at which the host received the packet: the host kernel's own receive
+ * timestamp where the host device provides one, otherwise the time at which
+ * Solo5 took the packet from the host device. Comparing it with
+ * solo5_clock_wall() gives the time the packet spent queued before being
+ * read. It is 0 if the target cannot tell, e.g. on virtio.
+ */
+solo5_result_t solo5_net_readv(solo5_handle_t handle,
+        struct solo5_net_frame *frames, size_t count, size_t *read_count);
+
+/*
+ * Per-device network statistics, counted by Solo5 since the device was
+ * acquired. Packets are counted once handed to or returned by Solo5, whichever
+ * interface is used to send or receive them; packets dropped by the host
+ * before reaching Solo5 are not counted.
+ */
+struct solo5_net_stats {
+    uint64_t rx_packets;        /* Packets received */
+    uint64_t rx_bytes;          /* Bytes received, including headers */
+    uint64_t rx_again;          /* Reads returning SOLO5_R_AGAIN */
+    uint64_t rx_errors;         /* Reads failing otherwise */
+    uint64_t tx_packets;        /* Packets sent */
+    uint64_t tx_bytes;          /* Bytes sent, including headers */
+    uint64_t tx_again;          /* Packets refused with SOLO5_R_AGAIN */
+    uint64_t tx_errors;         /* Packets failing otherwise */
+};
+
+/*
+ * Stores the statistics of the network device identified by (handle) in
+ * (*stats). Counters are maintained by the binding at little cost, and this
+ * does not exit to the host, so it may be called as often as needed.
+ *
+ * Returns SOLO5_R_EINVAL if (handle) is not an acquired network device, and
+ * SOLO5_R_EUNSPEC if the Solo5 implementation does not keep statistics.
+ */
+solo5_result_t solo5_net_stats(solo5_handle_t handle,
+        struct solo5_net_stats *stats);
+
+/*
+ * Internet checksum (RFC 1071).
+ *
+ * solo5_net_csum_partial() adds the ones' complement sum of the (size) bytes
+ * at (buf) to (sum), a partial sum returned by a previous call or 0, and
+ * returns the new partial sum. A checksum may be computed over several
+ * buffers, e.g. a pseudo-header and a payload, of which all but the last must
+ * have an even size. solo5_net_csum_fold() folds a partial sum into the
+ * checksum to be stored in a packet header, which is already in network byte
+ * order. A received header including its checksum sums to 0xffff, i.e. folds
+ * to 0, if the checksum is correct.
+ *
+ * These do not depend on any device, and use the widest arithmetic the CPU
+ * provides, including vector instructions where the Solo5 implementation can.
+ */
+uint32_t solo5_net_csum_partial(const void *buf, size_t size, uint32_t sum);
+uint16_t solo5_net_csum_fold(uint32_t sum);
+
+/*
+ * Completes the transport checksum of a packet to be sent, at (pkt), of
+ * (size) bytes starting with the Ethernet header. The checksum covers the
+ * bytes from offset (csum_start) to the end of the packet, plus the partial
+ * sum of the pseudo-header (pseudo), and is stored at offset (csum_start +
+ * csum_offset).
+ *
+ * If (hdr) is not NULL, the packet is to be sent with it on a device with
+ * SOLO5_NET_OFFLOAD_HDR, and the host computes the checksum: (hdr) is set to
+ * ask for it, and only the folded pseudo-header sum is stored. Otherwise, the
+ * checksum is computed here.
+ */
+void solo5_net_csum_tx(struct solo5_net_hdr *hdr, uint8_t *pkt, size_t size,
+        size_t csum_start, size_t csum_offset, uint32_t pseudo);
+
+/*
+ * Returns true if the transport checksums of a packet received with (hdr)
+ * need not be verified, as the host has verified them or the packet was sent
+ * by a local peer which left them to be computed on transmit. Returns false
+ * if (hdr) is NULL.
+ */
+bool solo5_net_csum_rx_valid(const struct solo5_net_hdr *hdr);
+
 /*
  * Block I/O.
  *
  * The minimum unit of I/O which can be performed on a block device is defined
- * by solo5_block_info.block_size. In practice we currently also limit the
- * *maximum* unit of I/O to the block size.
+ * by solo5_block_info.block_size. A single request may span multiple blocks,
+ * up to SOLO5_BLOCK_IO_MAX bytes.
  *
- * These interfaces, depending on atomicity guarantees, may be extended to
- * support I/O operations of >1 block per call.
+ * Completed writes are not guaranteed to be durable, as they may be cached by
+ * the host. Use solo5_block_flush() to make them so.
  */
 
 /*
@@ -251,6 +530,7 @@ typedef uint64_t solo5_off_t;
 struct solo5_block_info {
     solo5_off_t capacity;       /* Capacity of block device, bytes */
     solo5_off_t block_size;     /* Minimum I/O unit (block size), bytes */
+    solo5_off_t zone_size;      /* Zone size, bytes, or 0 if not zoned */
 };
 
 /*
@@ -262,16 +542,19 @@ struct solo5_block_info {
 solo5_result_t solo5_block_acquire(const char *name, solo5_handle_t *handle,
         struct solo5_block_info *info);
 
+/*
+ * Maximum size of a single block I/O request, in bytes.
+ */
+#define SOLO5_BLOCK_IO_MAX      (256 * 1024)
+
 /*
  * Writes data of (size) bytes from the buffer (*buf) to the block device
  * identified by (handle), starting at byte (offset). Data is either written in
  * it's entirety or not at all ("short writes" are not possible).
  *
- * Both (size) and (offset) must be a multiple of the block size, otherwise
- * SOLO5_R_EINVAL is returned.
- *
- * NOTE: Current implementations further limit the *maximum* I/O size to a
- * single block.
+ * Both (size) and (offset) must be a multiple of the block size, (size) must be
+ * non-zero and at most SOLO5_BLOCK_IO_MAX, and the request must not extend
+ * beyond the capacity of the device, otherwise SOLO5_R_EINVAL is returned.
  */
 solo5_result_t solo5_block_write(solo5_handle_t handle, solo5_off_t offset,
         const uint8_t *buf, size_t size);
@@ -281,15 +564,455 @@ solo5_result_t solo5_block_write(solo5_handle_t handle, solo5_off_t offset,
  * identified by (handle), starting at byte (offset). Always reads the full
  * amount of (size) bytes ("short reads" are not possible).
  *
- * Both (size) and (offset) must be a multiple of the block size, otherwise
- * SOLO5_R_EINVAL is returned.
- *
- * NOTE: Current implementations further limit the *maximum* I/O size to a
- * single block.
+ * The constraints on (size) and (offset) are those of solo5_block_write().
  */
 solo5_result_t solo5_block_read(solo5_handle_t handle, solo5_off_t offset,
         uint8_t *buf, size_t size);
 
+/*
+ * Vectored block I/O.
+ *
+ * solo5_block_writev() and solo5_block_readv() transfer the (count) segments
+ * in (iov[]) to or from consecutive ranges of the block device identified by
+ * (handle), starting at byte (offset), as a single request. The size of each
+ * segment must be a non-zero multiple of the block size, and (count) must be
+ * non-zero and at most SOLO5_BLOCK_IOV_MAX. The constraints on (offset) and
+ * the total size of all segments are those of solo5_block_write().
+ */
+#define SOLO5_BLOCK_IOV_MAX     16
+
+struct solo5_block_iov {
+    uint8_t *buf;               /* Segment buffer */
+    size_t size;                /* Segment size, bytes */
+};
+
+solo5_result_t solo5_block_writev(solo5_handle_t handle, solo5_off_t offset,
+        const struct solo5_block_iov *iov, size_t count);
+
+solo5_result_t solo5_block_readv(solo5_handle_t handle, solo5_off_t offset,
+        const struct solo5_block_iov *iov, size_t count);
+
+/*
+ * Flushes the block device identified by (handle). On success, all writes
+ * completed before the call are durable.
+ */
+solo5_result_t solo5_block_flush(solo5_handle_t handle);
+
+/*
+ * Discards (size) bytes starting at byte (offset) on the block device
+ * identified by (handle), allowing the host to release the storage backing
+ * them. The contents of discarded blocks are unspecified until they are next
+ * written. Discarding is advisory, and may do nothing.
+ *
+ * Both (size) and (offset) must be a multiple of the block size, (size) must
+ * be non-zero, and the request must not extend beyond the capacity of the
+ * device, otherwise SOLO5_R_EINVAL is returned. Unlike for reads and writes,
+ * (size) is not limited to SOLO5_BLOCK_IO_MAX.
+ */
+solo5_result_t solo5_block_discard(solo5_handle_t handle, solo5_off_t offset,
+        solo5_off_t size);
+
+/*
+ * Writes zeroes to (size) bytes starting at byte (offset) on the block device
+ * identified by (handle). Where supported by the host, no data is
+ * transferred. The constraints on (size) and (offset) are those of
+ * solo5_block_discard().
+ */
+solo5_result_t solo5_block_write_zeroes(solo5_handle_t handle,
+        solo5_off_t offset, solo5_off_t size);
+
+/*
+ * Advises the host that (size) bytes starting at byte (offset) on the block
+ * device identified by (handle) will be read soon, so that it may start
+ * reading them into its cache in the background. Returns without waiting for
+ * the data. Prefetching is advisory, and may do nothing. The constraints on
+ * (size) and (offset) are those of solo5_block_discard().
+ *
+ * Sequential reads are also detected by the host on some targets, and read
+ * ahead without being requested.
+ */
+solo5_result_t solo5_block_prefetch(solo5_handle_t handle, solo5_off_t offset,
+        solo5_off_t size);
+
+/*
+ * Returns a pointer to the contents of the block device identified by
+ * (handle) in (*data), if the device is read-only and mapped into memory by
+ * the host. Its (capacity) bytes may then be read directly from (*data), with
+ * data loaded from the host on demand, as well as with solo5_block_read().
+ * Writing to (*data) terminates the unikernel. Returns SOLO5_R_EINVAL if the
+ * device is not mapped.
+ *
+ * On hvt, a RAM-backed device may also be mapped, but not read-only: writes
+ * made with solo5_block_write() and related functions are visible through
+ * (*data) once they complete.
+ */
+solo5_result_t solo5_block_map(solo5_handle_t handle, const uint8_t **data);
+
+/*
+ * Zoned block devices.
+ *
+ * A zoned block device, such as a host-managed SMR disk or an NVMe ZNS SSD, is
+ * divided into zones of solo5_block_info.zone_size bytes, which is 0 for
+ * devices that are not zoned. The zone functions below return SOLO5_R_EINVAL
+ * for such devices.
+ *
+ * Conventional zones are read and written as any other block device.
+ * Sequential write required zones must be written at their write pointer,
+ * which each write then advances: writes elsewhere, and reads beyond the
+ * write pointer, fail. A zone which is full must be reset before it can be
+ * written again, which discards its contents. As requests may complete in any
+ * order, only one write to such a zone may be outstanding at a time.
+ * Instead, solo5_block_zone_append() writes to a zone at its write pointer,
+ * wherever that is, and returns where the data was written, so that several
+ * appends to a zone may be made concurrently.
+ *
+ * Zone types and conditions are those of the ZBC and ZNS specifications.
+ */
+#define SOLO5_BLOCK_ZONE_TYPE_CONVENTIONAL  0x1
+#define SOLO5_BLOCK_ZONE_TYPE_SEQ_REQUIRED  0x2
+#define SOLO5_BLOCK_ZONE_TYPE_SEQ_PREFERRED 0x3
+
+#define SOLO5_BLOCK_ZONE_COND_NOT_WP        0x0 /* Conventional zone */
+#define SOLO5_BLOCK_ZONE_COND_EMPTY         0x1
+#define SOLO5_BLOCK_ZONE_COND_IMP_OPEN      0x2 /* Opened by writing */
+#define SOLO5_BLOCK_ZONE_COND_EXP_OPEN      0x3 /* Opened explicitly */
+#define SOLO5_BLOCK_ZONE_COND_CLOSED        0x4
+#define SOLO5_BLOCK_ZONE_COND_READONLY      0xd
+#define SOLO5_BLOCK_ZONE_COND_FULL          0xe
+#define SOLO5_BLOCK_ZONE_COND_OFFLINE       0xf
+
+struct solo5_block_zone {
+    solo5_off_t start;          /* Offset of zone, bytes */
+    solo5_off_t size;           /* Size of zone, bytes */
+    solo5_off_t capacity;       /* Writable bytes from (start), <= (size) */
+    solo5_off_t write_pointer;  /* Offset of next write, bytes */
+    uint8_t type;               /* SOLO5_BLOCK_ZONE_TYPE_* */
+    uint8_t cond;               /* SOLO5_BLOCK_ZONE_COND_* */
+};
+
+/*
+ * Reports up to (count) zones of the zoned block device identified by
+ * (handle) into (zones[]), starting with the zone containing byte (offset),
+ * which must be less than the capacity of the device. Returns the number of
+ * zones reported in (*nzones), which is less than (count) only when the last
+ * zone of the device has been reported.
+ */
+solo5_result_t solo5_block_zone_report(solo5_handle_t handle,
+        solo5_off_t offset, struct solo5_block_zone *zones, size_t count,
+        size_t *nzones);
+
+/*
+ * Writes (size) bytes from the buffer (*buf) at the write pointer of the
+ * sequential zone starting at byte (zone) of the zoned block device
+ * identified by (handle), and returns the offset at which they were written
+ * in (*offset). The constraints on (size) are those of solo5_block_write(),
+ * and the data must fit within the capacity of the zone. Returns
+ * SOLO5_R_EINVAL if (zone) is not the start of a sequential zone, or the zone
+ * cannot be written or has too little space left.
+ */
+solo5_result_t solo5_block_zone_append(solo5_handle_t handle,
+        solo5_off_t zone, const uint8_t *buf, size_t size,
+        solo5_off_t *offset);
+
+/*
+ * Zone management operations, see solo5_block_zone_manage().
+ */
+#define SOLO5_BLOCK_ZONE_RESET  1   /* Discard contents, rewind write pointer */
+#define SOLO5_BLOCK_ZONE_OPEN   2   /* Open explicitly */
+#define SOLO5_BLOCK_ZONE_CLOSE  3   /* Close, releasing device resources */
+#define SOLO5_BLOCK_ZONE_FINISH 4   /* Make full, preventing further writes */
+
+/*
+ * Performs the zone management operation (op), one of SOLO5_BLOCK_ZONE_*, on
+ * the sequential zone starting at byte (zone) of the zoned block device
+ * identified by (handle). Returns SOLO5_R_EINVAL if (zone) is not the start
+ * of a sequential zone, and SOLO5_R_EUNSPEC if the device fails the
+ * operation, for example as too many zones are open.
+ */
+solo5_result_t solo5_block_zone_manage(solo5_handle_t handle, unsigned op,
+        solo5_off_t zone);
+
+/*
+ * Asynchronous block I/O.
+ *
+ * Requests submitted with solo5_block_submit_read(),
+ * solo5_block_submit_write() or solo5_block_submit_flush() are queued without
+ * waiting for the I/O to be performed. Until the request has completed, its buffer (*buf) belongs to
+ * Solo5 and must not be accessed by the application. Each request carries an
+ * application-defined (tag), which is returned with its completion. Requests
+ * may complete in any order, and no ordering is guaranteed between requests
+ * accessing the same blocks.
+ *
+ * The constraints on (offset) and (size) are those of solo5_block_read() and
+ * solo5_block_write(), and are checked on submission. At most
+ * SOLO5_BLOCK_QUEUE_MAX requests may be outstanding (submitted but not yet
+ * reaped) on a device at any time; further submissions return SOLO5_R_AGAIN.
+ *
+ * Submitted requests may be batched, and are not guaranteed to be started
+ * until the next call to solo5_yield() or solo5_block_reap(). While completed
+ * requests are waiting to be reaped, (handle) is included in the ready set
+ * returned by solo5_yield().
+ */
+#define SOLO5_BLOCK_QUEUE_MAX   64
+
+struct solo5_block_completion {
+    uint64_t tag;               /* As given on submission */
+    solo5_result_t result;      /* Result of the read or write */
+};
+
+/*
+ * Submits a request to read (size) bytes into the buffer (*buf) from the block
+ * device identified by (handle), starting at byte (offset).
+ */
+solo5_result_t solo5_block_submit_read(solo5_handle_t handle,
+        solo5_off_t offset, uint8_t *buf, size_t size, uint64_t tag);
+
+/*
+ * Submits a request to write (size) bytes from the buffer (*buf) to the block
+ * device identified by (handle), starting at byte (offset).
+ */
+solo5_result_t solo5_block_submit_write(solo5_handle_t handle,
+        solo5_off_t offset, const uint8_t *buf, size_t size, uint64_t tag);
+
+/*
+ * Submits a request to flush the block device identified by (handle). Once
+ * completed, all writes completed before submission are durable; for
+ * asynchronous writes, this means their completion has been reaped.
+ * Flushes submitted close together may be served by a single flush of the
+ * underlying storage.
+ */
+solo5_result_t solo5_block_submit_flush(solo5_handle_t handle, uint64_t tag);
+
+/*
+ * Reaps up to (count) completed requests on the block device identified by
+ * (handle) into (completions[]), without blocking. If no requests have
+ * completed, returns SOLO5_R_AGAIN. Otherwise, returns SOLO5_R_OK and the
+ * number of completions stored in (*reaped).
+ */
+solo5_result_t solo5_block_reap(solo5_handle_t handle,
+        struct solo5_block_completion *completions, size_t count,
+        size_t *reaped);
+
+/*
+ * Registered buffers.
+ *
+ * An application which performs asynchronous I/O from long-lived buffers may
+ * register each of them once with a block device, and then submit requests
+ * referring to a buffer by its index and an offset in it. Solo5 checks the
+ * buffer, and on some targets has the host prepare it for I/O, when it is
+ * registered rather than on every request. Up to SOLO5_BLOCK_BUFFERS_MAX
+ * buffers may be registered with each device. Buffers remain registered
+ * until the application exits, and must not be released with
+ * solo5_mem_release() meanwhile; they may also be passed to any other
+ * function.
+ */
+#define SOLO5_BLOCK_BUFFERS_MAX 16
+
+/*
+ * Registers the (size) bytes at (*buf) with the block device identified by
+ * (handle), returning the index of the buffer in (*index). Returns
+ * SOLO5_R_EINVAL if (size) is 0, and SOLO5_R_AGAIN if
+ * SOLO5_BLOCK_BUFFERS_MAX buffers are already registered with the device.
+ */
+solo5_result_t solo5_block_register_buffer(solo5_handle_t handle,
+        uint8_t *buf, size_t size, unsigned *index);
+
+/*
+ * As solo5_block_submit_read() and solo5_block_submit_write(), for the (size)
+ * bytes at (buf_offset) in the registered buffer (index). Returns
+ * SOLO5_R_EINVAL if these are not within the buffer.
+ */
+solo5_result_t solo5_block_submit_read_fixed(solo5_handle_t handle,
+        solo5_off_t offset, unsigned index, size_t buf_offset, size_t size,
+        uint64_t tag);
+solo5_result_t solo5_block_submit_write_fixed(solo5_handle_t handle,
+        solo5_off_t offset, unsigned index, size_t buf_offset, size_t size,
+        uint64_t tag);
+
+/*
+ * Per-device block statistics, counted by Solo5 since the device was
+ * acquired. Synchronous and asynchronous requests are counted alike, by type
+ * once accepted, and in (errors) if they fail, either immediately or, for
+ * asynchronous requests, on completion. Writes of zeroes which the
+ * implementation emulates are counted as the writes it issues.
+ */
+struct solo5_block_stats {
+    uint64_t read_ops;          /* Read requests */
+    uint64_t read_bytes;        /* Bytes read */
+    uint64_t write_ops;         /* Write requests */
+    uint64_t write_bytes;       /* Bytes written */
+    uint64_t flush_ops;         /* Flush requests */
+    uint64_t discard_ops;       /* Discard and write zeroes requests */
+    uint64_t errors;            /* Requests failing */
+};
+
+/*
+ * Stores the statistics of the block device identified by (handle) in
+ * (*stats), as for solo5_net_stats().
+ */
+solo5_result_t solo5_block_stats(solo5_handle_t handle,
+        struct solo5_block_stats *stats);
+
+/*
+ * Shared memory.
+ *
+ * A shared-memory region is memory shared with a service on the host, such as
+ * a cache or a telemetry collector, which the unikernel and the service
+ * access directly, without exiting to the host. How the memory is used is up
+ * to the unikernel and the service. If the region has a doorbell, each side
+ * can notify the other: solo5_shm_notify() notifies the service, and the
+ * region's handle becomes ready for solo5_yield() when the service notifies
+ * the unikernel. A handle which is ready stays so until solo5_yield() returns
+ * it.
+ */
+struct solo5_shm_info {
+    uint8_t *addr;              /* Start of the region, page-aligned */
+    size_t size;                /* Size of the region, bytes */
+    bool doorbell;              /* Region has a doorbell */
+};
+
+/*
+ * Acquires a handle to the shared-memory region declared as (name) in the
+ * application manifest, storing it in (*handle), and the region's properties
+ * in (*info).
+ */
+solo5_result_t solo5_shm_acquire(const char *name, solo5_handle_t *handle,
+        struct solo5_shm_info *info);
+
+/*
+ * Notifies the service sharing the region identified by (handle). Returns
+ * SOLO5_R_EINVAL if the region has no doorbell.
+ */
+solo5_result_t solo5_shm_notify(solo5_handle_t handle);
+
+/*
+ * Passed-through PCI devices.
+ *
+ * A PCI device of the host, e.g. an SR-IOV virtual function or an NVMe
+ * controller, may be passed through to the unikernel, which drives it itself.
+ * The unikernel accesses the device's memory BARs directly, and the device
+ * accesses the unikernel's memory by DMA at the unikernel's own addresses.
+ * Interrupts are not delivered as such: instead, the device's handle becomes
+ * ready for solo5_yield() when the device signals any of its MSI-X vectors.
+ * A handle which is ready stays so until solo5_yield() returns it.
+ */
+#define SOLO5_PCI_BARS 6
+
+struct solo5_pci_info {
+    uint16_t vendor_id;
+    uint16_t device_id;
+    unsigned irqs;              /* MSI-X vectors signalling the handle */
+    struct {
+        volatile uint8_t *addr; /* Mapping of the BAR, or NULL */
+        size_t size;            /* Size of the BAR, bytes */
+    } bar[SOLO5_PCI_BARS];
+};
+
+/*
+ * Acquires a handle to the PCI device declared as (name) in the application
+ * manifest, storing it in (*handle), and the device's properties in (*info).
+ */
+solo5_result_t solo5_pci_acquire(const char *name, solo5_handle_t *handle,
+        struct solo5_pci_info *info);
+
+/*
+ * Host streams (vsock).
+ *
+ * A vsock stream is a reliable, ordered byte stream to a service listening on
+ * the host, such as an agent serving metrics, configuration or secrets, which
+ * needs neither a network stack in the unikernel nor IP configuration on the
+ * host. Each stream is declared in the application manifest with the port of
+ * the service, and connected by solo5_vsock_acquire().
+ *
+ * Reads and writes never block: they return SOLO5_R_AGAIN if there is no data
+ * to read, or if the service cannot take any more data for now. The stream's
+ * handle becomes ready for solo5_yield() when there is data to read, when the
+ * service has closed its end, and once after a write has returned
+ * SOLO5_R_AGAIN when more data may be written. solo5_yield_events() reports
+ * all of these as SOLO5_EVENT_READABLE.
+ */
+struct solo5_vsock_info {
+    uint64_t cid;               /* Context ID of the unikernel */
+    uint32_t port;              /* Port of the service on the host */
+};
+
+/*
+ * Connects the stream declared as (name) in the application manifest to its
+ * service on the host, storing its handle in (*handle) and its properties in
+ * (*info). A stream which has been closed may be acquired again, with the
+ * same handle, to reconnect.
+ *
+ * Returns SOLO5_R_EUNSPEC if the service refused the connection or did not
+ * respond.
+ */
+solo5_result_t solo5_vsock_acquire(const char *name, solo5_handle_t *handle,
+        struct solo5_vsock_info *info);
+
+/*
+ * Writes up to (size) bytes from (buf) to the stream identified by (handle),
+ * storing the number of bytes written in (*written).
+ *
+ * Returns SOLO5_R_AGAIN if no data could be written, and SOLO5_R_EUNSPEC if
+ * the stream has been closed by either end or reset.
+ */
+solo5_result_t solo5_vsock_write(solo5_handle_t handle, const uint8_t *buf,
+        size_t size, size_t *written);
+
+/*
+ * Reads up to (size) bytes from the stream identified by (handle) into (buf),
+ * storing the number of bytes read in (*read_size). Once the service has
+ * closed its end and all data has been read, returns SOLO5_R_OK with
+ * (*read_size) set to 0.
+ *
+ * Returns SOLO5_R_AGAIN if there is no data to read.
+ */
+solo5_result_t solo5_vsock_read(solo5_handle_t handle, uint8_t *buf,
+        size_t size, size_t *read_size);
+
+/*
+ * Closes the stream identified by (handle). Data not yet read is discarded.
+ */
+solo5_result_t solo5_vsock_close(solo5_handle_t handle);
+
+/*
+ * Multiple CPUs.
+ *
+ * The unikernel starts running on CPU 0. Solo5 implementations may provide
+ * additional CPUs if configured to do so, which the unikernel can start with
+ * solo5_cpu_start(). Each CPU may only be started once, and stops when its
+ * entry point returns.
+ *
+ * Solo5 does not serialise calls made from different CPUs. Only
+ * solo5_cpu_start(), solo5_console_write(), solo5_clock_monotonic(),
+ * solo5_clock_wall(), solo5_exit(), solo5_abort(), solo5_trace(),
+ * solo5_pmu_read() and the synchronous block I/O calls (solo5_block_read(),
+ * solo5_block_write(), their vectored variants, solo5_block_flush(),
+ * solo5_block_discard() and solo5_block_write_zeroes()) may be called
+ * concurrently; all other calls must be serialised by the unikernel.
+ */
+
+/*
+ * Type of the entry point of a CPU started with solo5_cpu_start().
+ */
+typedef void (*solo5_cpu_entry_t)(void *arg);
+
+/*
+ * Returns the number of CPUs available to the unikernel, including CPU 0.
+ */
+unsigned solo5_cpu_count(void);
+
+/*
+ * Starts CPU (cpu), which must not have been started before, running
+ * (entry)(arg) on the stack whose top is (stack), with the TLS base set to
+ * (tls_base). (stack) must be aligned to 16 bytes. Traps on the CPU are handled
+ * on its stack.
+ *
+ * Returns SOLO5_R_EINVAL if (cpu) is 0, not less than solo5_cpu_count() or has
+ * already been started, or if (stack) is not suitably aligned.
+ */
+solo5_result_t solo5_cpu_start(unsigned cpu, solo5_cpu_entry_t entry,
+        void *arg, uintptr_t stack, uintptr_t tls_base);
+
 /*
  * Set the TLS base register. This sets the %fs segment register on
  * x86_64 or the TPIDR_EL0 register on aarch64.
@@ -299,4 +1022,288 @@ solo5_result_t solo5_block_read(solo5_handle_t handle, solo5_off_t offset,
  */
 solo5_result_t solo5_set_tls_base(uintptr_t base);
 
+/*
+ * Snapshots.
+ *
+ * Signals that the unikernel has finished initialising. If the Solo5
+ * implementation was asked to take a snapshot of the unikernel at this point,
+ * it saves the state of the unikernel and exits. Instances later restored from
+ * the snapshot start running by returning from this call, skipping the
+ * unikernel's initialisation.
+ *
+ * Returns SOLO5_R_OK when returning in an instance restored from a snapshot.
+ * Otherwise, returns SOLO5_R_EUNSPEC and the unikernel continues as normal.
+ *
+ * The unikernel must not have any asynchronous block requests outstanding
+ * when calling this. Devices are attached anew to restored instances, so any
+ * other device state such as network connections is not preserved.
+ */
+solo5_result_t solo5_snapshot(void);
+
+/*
+ * Memory reclaim.
+ */
+
+/*
+ * Granularity of memory released with solo5_mem_release().
+ */
+#define SOLO5_PAGE_SIZE 4096
+
+/*
+ * Tells the host that the application no longer uses the (size) bytes of
+ * memory at (addr), so that the host may reclaim it. The memory must lie
+ * within the heap given to the application in (struct solo5_start_info), and
+ * (addr) and (size) must be multiples of SOLO5_PAGE_SIZE.
+ *
+ * The memory may be used again at any time, but its contents are undefined
+ * until the application writes to it.
+ *
+ * Returns SOLO5_R_EINVAL if the range is not suitably aligned or not within
+ * the heap, and SOLO5_R_EUNSPEC if the Solo5 implementation cannot reclaim
+ * memory, in which case calling this again is pointless.
+ */
+solo5_result_t solo5_mem_release(uintptr_t addr, size_t size);
+
+/*
+ * Returns true if the host has asked the application to release unused
+ * memory since the previous call, in which case the application should
+ * release as much of its heap as it can with solo5_mem_release(). Requests
+ * are not queued, and the application is not woken up for them, so it should
+ * check for them periodically, for example whenever solo5_yield() returns.
+ *
+ * Solo5 implementations which cannot make requests always return false.
+ */
+bool solo5_mem_reclaim_requested(void);
+
+/*
+ * TRACING
+ */
+
+/*
+ * Event identifiers from SOLO5_TRACE_ID_SOLO5 upwards are reserved for events
+ * recorded by Solo5 itself; all others are free for use by the application.
+ */
+#define SOLO5_TRACE_ID_SOLO5        0xffff0000U
+#define SOLO5_TRACE_ID_YIELD_ENTER  (SOLO5_TRACE_ID_SOLO5 + 0)
+#define SOLO5_TRACE_ID_YIELD_EXIT   (SOLO5_TRACE_ID_SOLO5 + 1)
+
+/*
+ * Records event (id) with arguments (arg0) and (arg1), timestamped with
+ * solo5_clock_monotonic(), in a fixed-size ring in guest memory which the
+ * host may dump, for example when the unikernel exits. Older events are
+ * overwritten once the ring is full. Recording an event does not exit to the
+ * host, and costs tens of nanoseconds.
+ *
+ * If the host has not enabled tracing, or the Solo5 implementation does not
+ * support it, this does nothing.
+ */
+void solo5_trace(uint32_t id, uint64_t arg0, uint64_t arg1);
+
+/*
+ * PERFORMANCE COUNTERS
+ */
+
+/*
+ * Hardware performance counters of a CPU. The counters are free-running from
+ * an unspecified value and wrap around at an implementation-defined width of
+ * at least 40 bits, so only the difference between two readings on the same
+ * CPU is meaningful.
+ */
+struct solo5_pmu_counters {
+    uint64_t cycles;            /* Core clock cycles */
+    uint64_t instructions;      /* Instructions retired */
+    uint64_t cache_misses;      /* Last level cache misses, or always 0 */
+};
+
+/*
+ * Stores the counters of the calling CPU in (*counters), which count while
+ * the unikernel runs on it. Reading them does not exit to the host.
+ *
+ * Returns SOLO5_R_EUNSPEC if the host has not given the unikernel a PMU, or
+ * the Solo5 implementation does not support it.
+ */
+solo5_result_t solo5_pmu_read(struct solo5_pmu_counters *counters);
+
+/*
+ * CPU TIME
+ */
+
+/*
+ * Time spent by the unikernel's CPUs since each was started, summed over all
+ * started CPUs, in nanoseconds:
+ *
+ *   - (idle): waiting in solo5_yield() for a device or the deadline.
+ *   - (steal): ready to run, but not running as the host was running
+ *     something else. This is the share of the CPU taken by other tenants of
+ *     an overcommitted host, and is measured by the host.
+ *   - (run): the remainder, spent running the unikernel (or the Solo5
+ *     implementation on its behalf, including exits to the host).
+ *
+ * All three are cumulative, so the fraction of time stolen over an interval
+ * is the ratio of the differences of (steal) and of the sum of all three
+ * between two readings.
+ */
+struct solo5_cpu_time {
+    solo5_time_t run;
+    solo5_time_t idle;
+    solo5_time_t steal;
+};
+
+/*
+ * Stores the time spent by the unikernel's CPUs in (*time). May be called
+ * from any CPU.
+ *
+ * Returns SOLO5_R_EUNSPEC, with (time->steal) set to 0 and (time->run) and
+ * (time->idle) set as above, if the host does not report steal time to the
+ * unikernel, or the Solo5 implementation does not support it.
+ */
+solo5_result_t solo5_cpu_time(struct solo5_cpu_time *time);
+
+/*
+ * CALL COUNTERS
+ */
+
+/*
+ * Public calls counted by the Solo5 implementation. Calls made by Solo5
+ * itself, e.g. synchronous block I/O implemented over the asynchronous
+ * interfaces, are not counted.
+ */
+enum solo5_call {
+    SOLO5_CALL_YIELD,
+    SOLO5_CALL_YIELD_EVENTS,
+    SOLO5_CALL_CONSOLE_WRITE,
+    SOLO5_CALL_NET_READ,
+    SOLO5_CALL_NET_READV,
+    SOLO5_CALL_NET_READ_LOAN,
+    SOLO5_CALL_NET_READ_RELEASE,
+    SOLO5_CALL_NET_WRITE,
+    SOLO5_CALL_NET_WRITEV,
+    SOLO5_CALL_NET_WRITE_LOAN,
+    SOLO5_CALL_NET_WRITE_RECLAIM,
+    SOLO5_CALL_BLOCK_READ,
+    SOLO5_CALL_BLOCK_READV,
+    SOLO5_CALL_BLOCK_WRITE,
+    SOLO5_CALL_BLOCK_WRITEV,
+    SOLO5_CALL_BLOCK_FLUSH,
+    SOLO5_CALL_BLOCK_DISCARD,
+    SOLO5_CALL_BLOCK_WRITE_ZEROES,
+    SOLO5_CALL_BLOCK_PREFETCH,
+    SOLO5_CALL_BLOCK_ZONE_APPEND,
+    SOLO5_CALL_BLOCK_SUBMIT_READ,
+    SOLO5_CALL_BLOCK_SUBMIT_WRITE,
+    SOLO5_CALL_BLOCK_SUBMIT_READ_FIXED,
+    SOLO5_CALL_BLOCK_SUBMIT_WRITE_FIXED,
+    SOLO5_CALL_BLOCK_SUBMIT_FLUSH,
+    SOLO5_CALL_BLOCK_REAP,
+    SOLO5_CALL_SHM_NOTIFY,
+    SOLO5_CALL_VSOCK_READ,
+    SOLO5_CALL_VSOCK_WRITE,
+    SOLO5_CALL_MEM_RELEASE,
+    SOLO5_CALL_MAX
+};
+
+/*
+ * Counters of a public call, since the unikernel started:
+ *
+ *   - (bytes): bytes read, written, released or reaped as completions,
+ *     depending on the call.
+ *   - (again): calls returning SOLO5_R_AGAIN, or, for solo5_yield() and
+ *     solo5_yield_events(), returning with no device ready. A high proportion
+ *     of these means the application polls more than it needs to.
+ *   - (cycles): time spent in the call, in ticks of the CPU timestamp
+ *     counter (the TSC on x86_64, the virtual counter on aarch64).
+ *
+ * Comparing (bytes) to (calls) shows how well the application batches its
+ * I/O.
+ */
+struct solo5_call_stats {
+    uint64_t calls;
+    uint64_t bytes;
+    uint64_t again;
+    uint64_t cycles;
+};
+
+/*
+ * Stores the counters of (call) on the device identified by (handle) in
+ * (*stats). Calls which do not take a handle (solo5_yield(),
+ * solo5_yield_events(), solo5_console_write() and solo5_mem_release()) are
+ * counted once for the unikernel, and (handle) is then ignored. As with
+ * solo5_net_stats(), this does not exit to the host. If "--solo5:calls" is
+ * given on the command line, the counters of all calls made are also written
+ * to the console when the unikernel exits.
+ *
+ * Returns SOLO5_R_EINVAL if (call) is not valid or (handle) is not a valid
+ * handle, and SOLO5_R_EUNSPEC if the Solo5 implementation does not keep
+ * call counters.
+ */
+solo5_result_t solo5_call_stats(solo5_handle_t handle, enum solo5_call call,
+        struct solo5_call_stats *stats);
+
+/*
+ * CPU FEATURES
+ */
+
+/*
+ * Instruction set extensions which the CPU implements and the Solo5
+ * implementation and host have enabled, such that the application may use
+ * them. Each is only ever reported on the architecture it is listed under.
+ */
+/* x86_64 */
+#define SOLO5_CPU_SSE3          (1ULL << 0)
+#define SOLO5_CPU_SSSE3         (1ULL << 1)
+#define SOLO5_CPU_SSE4_1        (1ULL << 2)
+#define SOLO5_CPU_SSE4_2        (1ULL << 3)
+#define SOLO5_CPU_POPCNT        (1ULL << 4)
+#define SOLO5_CPU_AESNI         (1ULL << 5)
+#define SOLO5_CPU_PCLMULQDQ     (1ULL << 6)
+#define SOLO5_CPU_RDRAND        (1ULL << 7)
+#define SOLO5_CPU_RDSEED        (1ULL << 8)
+#define SOLO5_CPU_BMI1          (1ULL << 9)
+#define SOLO5_CPU_BMI2          (1ULL << 10)
+#define SOLO5_CPU_SHA           (1ULL << 11)
+#define SOLO5_CPU_AVX           (1ULL << 12)
+#define SOLO5_CPU_AVX2          (1ULL << 13)
+#define SOLO5_CPU_FMA           (1ULL << 14)
+#define SOLO5_CPU_VAES          (1ULL << 15)
+#define SOLO5_CPU_VPCLMULQDQ    (1ULL << 16)
+#define SOLO5_CPU_GFNI          (1ULL << 17)
+#define SOLO5_CPU_AVX512F       (1ULL << 18)
+#define SOLO5_CPU_AVX512DQ      (1ULL << 19)
+#define SOLO5_CPU_AVX512BW      (1ULL << 20)
+#define SOLO5_CPU_AVX512VL      (1ULL << 21)
+/* aarch64 */
+#define SOLO5_CPU_ASIMD         (1ULL << 32)
+#define SOLO5_CPU_AES           (1ULL << 33)
+#define SOLO5_CPU_PMULL         (1ULL << 34)
+#define SOLO5_CPU_SHA1          (1ULL << 35)
+#define SOLO5_CPU_SHA2          (1ULL << 36)
+#define SOLO5_CPU_SHA512        (1ULL << 37)
+#define SOLO5_CPU_SHA3          (1ULL << 38)
+#define SOLO5_CPU_CRC32         (1ULL << 39)
+#define SOLO5_CPU_ATOMICS       (1ULL << 40)
+#define SOLO5_CPU_SVE           (1ULL << 41)
+
+/*
+ * CPU features and cache geometry. Cache sizes are those of the caches
+ * closest to CPU 0 at each level, which may be shared with other CPUs, and
+ * are 0 if unknown or if there is no such cache.
+ */
+struct solo5_cpu_info {
+    uint64_t features;          /* SOLO5_CPU_* */
+    uint32_t cache_line_size;   /* Data cache line size in bytes */
+    uint32_t l1d_cache_size;    /* Level 1 data cache size in bytes */
+    uint32_t l2_cache_size;     /* Level 2 cache size in bytes */
+    uint32_t l3_cache_size;     /* Level 3 cache size in bytes */
+};
+
+/*
+ * Stores the CPU features and cache geometry in (*info). The results do not
+ * change while the unikernel runs, so applications may call this once at
+ * startup to select the code paths to use.
+ *
+ * If the Solo5 implementation does not support this, all of (*info) is 0,
+ * apart from (info->cache_line_size), which is 64.
+ */
+void solo5_cpu_info(struct solo5_cpu_info *info);
+
 #endif
@@ -0,0 +1,171 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef SOLO5_ALLOC_H_INCLUDED
+#define SOLO5_ALLOC_H_INCLUDED
+
+#include "solo5.h"
+
+/*
+ * Optional memory allocator for Solo5 applications.
+ *
+ * This allocator is not part of the Solo5 API proper: it is built from
+ * bindings/alloc.c into solo5_alloc.o, which applications wishing to use it
+ * link in addition to the bindings. It only uses the Solo5 API, and expects
+ * the application to provide memcpy().
+ *
+ * The allocator manages a range of memory given to it by the application,
+ * normally the heap passed to solo5_app_main() less the initial stack, in
+ * pages of SOLO5_PAGE_SIZE. Memory is allocated:
+ *
+ *   - Up to SOLO5_ALLOC_SMALL_MAX bytes, from slabs of objects of the same
+ *     size class, with at most 25% internal fragmentation.
+ *   - Above that, as whole pages. Allocations of at least
+ *     SOLO5_ALLOC_HUGE_SIZE bytes are aligned to and rounded up to a multiple
+ *     of SOLO5_ALLOC_HUGE_SIZE, so that the host may back them with huge
+ *     pages.
+ *   - From arenas (struct solo5_arena), by bumping a pointer, for objects
+ *     which are all freed at once, such as those used to handle a request.
+ *
+ * Each CPU has a cache of free objects of each size class, which serves most
+ * allocations and frees without synchronisation; objects may be freed on a
+ * CPU other than the one which allocated them. Caches are refilled from, and
+ * flushed to, per-class lists of slabs protected by spinlocks. The functions
+ * taking a (cpu) argument must be called on that CPU, which is not checked:
+ * Solo5 does not tell an application which CPU it is running on, so it must
+ * keep track of this itself, for example in its thread-local storage.
+ * Applications using a single CPU pass 0. The other functions may be called
+ * concurrently from any CPU, except for solo5_alloc_init().
+ */
+
+/*
+ * Largest allocation served from slabs.
+ */
+#define SOLO5_ALLOC_SMALL_MAX 32768
+
+/*
+ * Alignment and granularity of allocations of at least this size.
+ */
+#define SOLO5_ALLOC_HUGE_SIZE SOLO5_HUGE_PAGE_SIZE
+
+/*
+ * Maximum number of CPUs supported by the allocator.
+ */
+#define SOLO5_ALLOC_CPUS_MAX 64
+
+/*
+ * Initialises the allocator to manage the (size) bytes at (start), of which
+ * it uses about 0.6% for its own bookkeeping. Must be called once, on CPU 0,
+ * before any other function declared in this file.
+ *
+ * Returns SOLO5_R_EINVAL if the range is too small to be useful.
+ */
+solo5_result_t solo5_alloc_init(uintptr_t start, size_t size);
+
+/*
+ * Allocates (size) bytes, aligned to at least 16 bytes. Returns NULL if
+ * (size) is 0 or if there is not enough free memory.
+ */
+void *solo5_alloc(unsigned cpu, size_t size);
+
+/*
+ * Allocates (size) bytes aligned to (align), which must be a power of 2.
+ * Returns NULL if (size) is 0, (align) is not a power of 2 or there is not
+ * enough free memory.
+ */
+void *solo5_alloc_aligned(unsigned cpu, size_t align, size_t size);
+
+/*
+ * Frees (ptr), which must have been returned by solo5_alloc(),
+ * solo5_alloc_aligned() or solo5_realloc(). Does nothing if (ptr) is NULL.
+ */
+void solo5_free(unsigned cpu, void *ptr);
+
+/*
+ * Resizes the allocation at (ptr) to (size) bytes, moving it if necessary, in
+ * which case its contents are copied and the old allocation is freed.
+ * Behaves as solo5_alloc() if (ptr) is NULL, and as solo5_free() if (size) is
+ * 0. Returns NULL, leaving (ptr) allocated, if there is not enough free
+ * memory.
+ */
+void *solo5_realloc(unsigned cpu, void *ptr, size_t size);
+
+/*
+ * Returns the number of bytes usable at (ptr), at least the size requested
+ * when it was allocated.
+ */
+size_t solo5_alloc_usable_size(const void *ptr);
+
+/*
+ * Returns the free objects cached by (cpu) to the shared slabs, for example
+ * before the CPU stops or before calling solo5_alloc_trim().
+ */
+void solo5_alloc_flush(unsigned cpu);
+
+/*
+ * Releases free pages to the host with solo5_mem_release(), for example when
+ * solo5_mem_reclaim_requested() returns true. Returns the number of bytes
+ * released.
+ */
+size_t solo5_alloc_trim(void);
+
+/*
+ * Arenas.
+ *
+ * An arena hands out memory from chunks of pages obtained from the
+ * allocator, by bumping a pointer. Individual allocations cannot be freed;
+ * instead, solo5_arena_reset() frees everything allocated from the arena at
+ * once. An arena must only be used by one CPU at a time.
+ *
+ * The contents of struct solo5_arena are private to the allocator.
+ */
+struct solo5_arena {
+    uintptr_t cur;
+    uintptr_t end;
+    void *chunks;
+    size_t chunk_size;
+};
+
+/*
+ * Initialises (arena) to allocate chunks of at least (chunk_size) bytes, or a
+ * default size if 0. No memory is allocated until the first call to
+ * solo5_arena_alloc().
+ */
+void solo5_arena_init(struct solo5_arena *arena, size_t chunk_size);
+
+/*
+ * Allocates (size) bytes aligned to (align), which must be a power of 2 no
+ * larger than SOLO5_PAGE_SIZE, from (arena). Returns NULL if (size) is 0,
+ * (align) is invalid or there is not enough free memory.
+ */
+void *solo5_arena_alloc(struct solo5_arena *arena, size_t size, size_t align);
+
+/*
+ * Frees everything allocated from (arena), keeping its most recently
+ * obtained chunk for further allocations.
+ */
+void solo5_arena_reset(struct solo5_arena *arena);
+
+/*
+ * Frees everything allocated from (arena), and all of its chunks.
+ */
+void solo5_arena_destroy(struct solo5_arena *arena);
+
+#endif /* SOLO5_ALLOC_H_INCLUDED */
@@ -0,0 +1,221 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef SOLO5_LOOP_H_INCLUDED
+#define SOLO5_LOOP_H_INCLUDED
+
+#include "solo5.h"
+
+/*
+ * Optional event loop for Solo5 applications.
+ *
+ * This library is not part of the Solo5 API proper: it is built from
+ * bindings/loop.c into solo5_loop.o, which applications wishing to use it
+ * link in addition to the bindings. It only uses the Solo5 API.
+ *
+ * A loop (struct solo5_loop) runs timers, and callbacks for the devices it
+ * watches when they are ready. Each iteration of the loop yields to the host
+ * with solo5_yield_events() until the earliest timer expires, then drains
+ * each ready device: network devices are read and block devices reaped in
+ * batches with solo5_net_readv() and solo5_block_reap(), up to
+ * SOLO5_LOOP_BATCHES_MAX batches per device per iteration so that one busy
+ * device cannot starve the others or the timers.
+ *
+ * Readiness persists until it is consumed, so every device which can become
+ * ready must be watched, and drained by its callback if watched with
+ * solo5_loop_watch(); otherwise the loop never blocks.
+ *
+ * A loop and its timers must only be used by one CPU, and callbacks run on
+ * the CPU running the loop. Callbacks may start and stop timers, watch and
+ * unwatch devices and stop the loop.
+ *
+ * The contents of struct solo5_loop and struct solo5_timer are private to
+ * the library.
+ */
+
+struct solo5_loop;
+struct solo5_timer;
+
+/*
+ * Maximum number of batches read from or reaped on a device per iteration.
+ */
+#define SOLO5_LOOP_BATCHES_MAX 8
+
+/*
+ * Timers.
+ *
+ * A timer calls (fn) once, when monotonic time reaches its deadline. Timers
+ * are kept in a pairing heap, so that starting a timer takes constant time
+ * and stopping or running one logarithmic time. Timers with the same deadline
+ * run in an unspecified order. To repeat, a timer restarts itself from its
+ * callback; a timer restarted with a deadline which has already passed runs
+ * in the next iteration of the loop.
+ */
+typedef void (*solo5_timer_fn_t)(struct solo5_loop *loop,
+        struct solo5_timer *timer, void *arg);
+
+struct solo5_timer {
+    solo5_time_t deadline;
+    solo5_timer_fn_t fn;
+    void *arg;
+    struct solo5_timer *child;
+    struct solo5_timer *next;
+    struct solo5_timer *prev;
+    int state;
+};
+
+/*
+ * Initialises (timer) to call (fn) with (arg). The timer is not started.
+ */
+void solo5_timer_init(struct solo5_timer *timer, solo5_timer_fn_t fn,
+        void *arg);
+
+/*
+ * Starts (timer) on (loop) to run at monotonic time (deadline), restarting it
+ * if it is already started.
+ */
+void solo5_timer_start(struct solo5_loop *loop, struct solo5_timer *timer,
+        solo5_time_t deadline);
+
+/*
+ * Stops (timer), if it is started.
+ */
+void solo5_timer_stop(struct solo5_loop *loop, struct solo5_timer *timer);
+
+/*
+ * Returns true if (timer) is started and has not run yet.
+ */
+bool solo5_timer_active(const struct solo5_timer *timer);
+
+/*
+ * Devices.
+ *
+ * A callback receives the readiness of a device in (io). For devices
+ * watched with solo5_loop_watch_net() or solo5_loop_watch_block(), it is
+ * called with SOLO5_EVENT_WRITABLE on its own, and with SOLO5_EVENT_READABLE
+ * or SOLO5_EVENT_COMPLETION once per batch of packets read or completions
+ * reaped. If reading or reaping fails, (io->result) is set accordingly and
+ * the batch is empty. For devices watched with solo5_loop_watch(), it is
+ * called once with all of the events of the device, and (io->result) is
+ * SOLO5_R_OK.
+ */
+struct solo5_loop_io {
+    solo5_handle_t handle;
+    uint32_t events;                        /* SOLO5_EVENT_* */
+    solo5_result_t result;
+    struct solo5_net_frame *frames;         /* Packets read */
+    size_t nframes;
+    struct solo5_block_completion *completions; /* Completions reaped */
+    size_t ncompletions;
+};
+
+typedef void (*solo5_loop_io_fn_t)(struct solo5_loop *loop,
+        const struct solo5_loop_io *io, void *arg);
+
+struct solo5_loop_watch {
+    solo5_loop_io_fn_t fn;
+    void *arg;
+    struct solo5_net_frame *frames;
+    size_t nframes;
+    size_t frame_size;
+    struct solo5_block_completion *completions;
+    size_t ncompletions;
+};
+
+struct solo5_loop {
+    solo5_time_t now;
+    struct solo5_timer *timers;
+    struct solo5_timer *expired;
+    solo5_handle_set_t watched;
+    struct solo5_loop_watch watch[64];
+    bool stopped;
+};
+
+/*
+ * Initialises (loop), with no timers and no devices watched.
+ */
+void solo5_loop_init(struct solo5_loop *loop);
+
+/*
+ * Watches the device (handle) on (loop), calling (fn) with (arg) when it is
+ * ready. The callback consumes the readiness of the device itself, replacing
+ * any previous watch of (handle).
+ *
+ * Returns SOLO5_R_EINVAL if (handle) is not a valid handle.
+ */
+solo5_result_t solo5_loop_watch(struct solo5_loop *loop,
+        solo5_handle_t handle, solo5_loop_io_fn_t fn, void *arg);
+
+/*
+ * Watches the network device (handle) on (loop), as solo5_loop_watch(), but
+ * reads its packets into (frames[]), whose (count) buffers of (frame_size)
+ * bytes each are provided by the application, before calling (fn). The
+ * packets are only valid until (fn) returns.
+ *
+ * Returns SOLO5_R_EINVAL if (handle) is not a valid handle or (count) is 0
+ * or exceeds SOLO5_NET_FRAMES_MAX.
+ */
+solo5_result_t solo5_loop_watch_net(struct solo5_loop *loop,
+        solo5_handle_t handle, struct solo5_net_frame *frames, size_t count,
+        size_t frame_size, solo5_loop_io_fn_t fn, void *arg);
+
+/*
+ * Watches the block device (handle) on (loop), as solo5_loop_watch(), but
+ * reaps up to (count) completions into (completions[]) before calling (fn).
+ *
+ * Returns SOLO5_R_EINVAL if (handle) is not a valid handle or (count) is 0
+ * or exceeds SOLO5_BLOCK_QUEUE_MAX.
+ */
+solo5_result_t solo5_loop_watch_block(struct solo5_loop *loop,
+        solo5_handle_t handle, struct solo5_block_completion *completions,
+        size_t count, solo5_loop_io_fn_t fn, void *arg);
+
+/*
+ * Stops watching the device (handle) on (loop).
+ */
+void solo5_loop_unwatch(struct solo5_loop *loop, solo5_handle_t handle);
+
+/*
+ * Runs one iteration of (loop): runs the expired timers, then, if (wait) is
+ * true, yields until a watched device is ready or the earliest timer expires,
+ * and calls the callbacks of the ready devices. Returns false, without
+ * yielding, if there are no timers started and no devices watched.
+ */
+bool solo5_loop_run_once(struct solo5_loop *loop, bool wait);
+
+/*
+ * Runs (loop) until solo5_loop_stop() is called, or until there are no timers
+ * started and no devices watched.
+ */
+void solo5_loop_run(struct solo5_loop *loop);
+
+/*
+ * Makes solo5_loop_run() return after the current callback.
+ */
+void solo5_loop_stop(struct solo5_loop *loop);
+
+/*
+ * Returns the monotonic time at which (loop) last yielded or ran its timers,
+ * which is cheaper than solo5_clock_monotonic() and suitable for computing
+ * timer deadlines.
+ */
+solo5_time_t solo5_loop_now(const struct solo5_loop *loop);
+
+#endif /* SOLO5_LOOP_H_INCLUDED */
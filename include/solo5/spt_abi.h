@@ -22,7 +22,7 @@
  * spt_abi.h: spt guest/tender interface definitions.
  *
  * This header file must be kept self-contained with no external dependencies
- * other than C99 headers.
+ * other than C99 headers and ring_abi.h.
  */
 
 #ifndef SPT_ABI_H
@@ -31,6 +31,126 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "ring_abi.h"
+
+/*
+ * io_uring instance set up by the tender for a block or network device. The
+ * ring is restricted to IORING_OP_READ and IORING_OP_WRITE on fixed file 0
+ * (the device), and only io_uring_enter() with no flags (for block devices)
+ * or with IORING_ENTER_GETEVENTS (for network devices) is allowed by the
+ * seccomp policy. Pointers are to the rings as mapped by the tender.
+ * (entries) is 0 if the device has no ring.
+ */
+struct spt_block_uring {
+    int ringfd;
+    uint32_t entries;
+    uint32_t *sq_head, *sq_tail, *sq_mask, *sq_array;
+    void *sqes;
+    uint32_t *cq_head, *cq_tail, *cq_mask;
+    void *cqes;
+};
+
+/*
+ * AF_PACKET socket set up by the tender for a network device attached with
+ * --net:NAME=packet:IFACE. Its TPACKET_V3 receive ring of (rx_blocks) blocks
+ * of (block_size) bytes, and transmit ring of (tx_frames) frames of
+ * (frame_size) bytes, are mapped by the tender and walked by the guest
+ * directly. The seccomp policy only allows sendto() on (fd) with no data, to
+ * start transmission of frames queued on the transmit ring. (rx) is NULL if
+ * the device is not attached in this way.
+ */
+struct spt_net_packet {
+    int fd;
+    uint32_t block_size, rx_blocks;
+    uint32_t frame_size, tx_frames;
+    uint8_t *rx, *tx;
+};
+
+/*
+ * Single-producer, single-consumer ring of packets, shared between the guest
+ * and the tender's I/O thread (--io-thread), indexed as described in
+ * ring_abi.h. Slot (i) holds a packet of (len[i]) bytes at
+ * (buf + i * slot_size). (buf) and (slot_size) are set by the guest before it
+ * sets (spt_io_thread.ready), and not changed thereafter.
+ */
+#define SPT_IO_RING_SLOTS 64    /* Must be a power of 2 */
+
+struct spt_io_ring {
+    struct ring_index idx;
+    uint32_t waiting;           /* Producer is waiting for a free slot */
+    uint32_t slot_size;
+    uint32_t len[SPT_IO_RING_SLOTS];
+    uint64_t tstamp[SPT_IO_RING_SLOTS]; /* rx: host receive time (wall clock) */
+    uint8_t *buf;
+};
+
+/*
+ * State shared with the I/O thread, which performs network I/O on behalf of
+ * the guest. (net) is indexed by manifest entry, only entries for network
+ * devices are used.
+ *
+ * The thread sleeps once it finds no work to do, having set (idle), and the
+ * guest wakes it by writing to (kickfd). It signals the guest by writing to
+ * an eventfd in the epoll() set, identified by SPT_IO_THREAD_WAKE.
+ */
+struct spt_io_thread {
+    int kickfd;
+    uint32_t ready;             /* Set by the guest once (net) is set up */
+    uint32_t idle;              /* Set by the thread before it sleeps */
+    struct {
+        struct spt_io_ring rx;  /* Produced by the thread */
+        struct spt_io_ring tx;  /* Produced by the guest */
+    } net[];
+};
+
+/*
+ * Secondary CPU (--cpus). The tender runs a thread for each secondary CPU,
+ * subject to the guest's seccomp policy, which waits with
+ * futex(FUTEX_WAIT_PRIVATE) on (state). The guest starts the CPU by setting
+ * (entry), (arg), (stack) and (tls_base), then setting (state) to
+ * SPT_CPU_STARTED and waking the thread with futex(FUTEX_WAKE_PRIVATE). The
+ * thread then sets its TLS base to (tls_base) and calls (entry)(arg) with its
+ * stack pointer set to (stack), which is 16-byte aligned. The seccomp policy
+ * only allows these futex() calls on (state), and exit() to stop the thread.
+ *
+ * (schedstat_fd) is a descriptor of the thread's scheduler statistics
+ * (/proc/thread-self/schedstat), which the guest may read with pread64(), or
+ * -1. The second field is the time the thread has been runnable but waiting
+ * for a host CPU.
+ */
+#define SPT_CPUS_MAX 64
+
+#define SPT_CPU_PARKED 0
+#define SPT_CPU_STARTED 1
+
+struct spt_cpu {
+    uint32_t state;
+    void (*entry)(void *arg);
+    void *arg;
+    uint64_t stack;
+    uint64_t tls_base;
+    int schedstat_fd;
+};
+
+/*
+ * Fork server (--zygote). When the guest calls solo5_snapshot(), it accepts
+ * connections from launchers on (listenfd), moving each to (connfd) with
+ * dup3(). A launcher sends a single message with SCM_RIGHTS, passing a
+ * descriptor for each device in manifest order, and the guest forks an
+ * instance with clone(SIGCHLD). The instance moves the descriptors onto the
+ * (hostfd) of the devices, replaces (epollfd) and (timerfd) with its own,
+ * registered as set up by the tender, and applies the seccomp policy
+ * (filter) of (filter_len) instructions, which denies all of the system
+ * calls used to do so, before returning from solo5_snapshot(). The zygote
+ * replies with the process ID of the instance as an int32_t, or -1.
+ */
+struct spt_zygote {
+    int listenfd;
+    int connfd;
+    uint32_t filter_len;
+    const void *filter;                 /* struct sock_filter[] */
+};
+
 /*
  * A pointer to this structure is passed by the tender as the sole argument to
  * the guest entrypoint.
@@ -42,6 +162,38 @@ struct spt_boot_info {
     void *mft;                          /* Address of application manifest */
     int epollfd;                        /* epoll() set for yield() */
     int timerfd;                        /* internal timerfd for yield() */
+    struct spt_block_uring *block_uring;
+                                        /* Indexed by manifest entry, or NULL */
+    struct spt_block_uring *net_uring;  /* Rings for network devices if
+                                           --net-uring, indexed by manifest
+                                           entry, or NULL */
+    struct spt_io_thread *io_thread;    /* If --io-thread, else NULL */
+    struct spt_net_packet *net_packet;  /* Indexed by manifest entry, or NULL */
+    const uint8_t **block_map;          /* Contents of MFT_BLOCK_MAPPED devices,
+                                           indexed by manifest entry, or NULL */
+    uint64_t poll_nsecs;                /* Busy-poll budget for yield(),
+                                           0 if disabled */
+    uint64_t boot_trace_start;          /* Tender start time (CLOCK_MONOTONIC
+                                           nsecs) if --trace-boot, else 0 */
+    uint64_t tsc_freq;                  /* Cycle counter frequency (Hz) if
+                                           invariant, else 0 */
+    uint64_t tsc_base;                  /* Cycle counter at (time_base) */
+    uint64_t time_base;                 /* CLOCK_MONOTONIC nsecs at
+                                           (tsc_base) */
+    uint64_t cpus;                      /* Number of CPUs, including CPU 0 */
+    struct spt_cpu *cpu;                /* Indexed by CPU, or NULL if (cpus)
+                                           is 1 */
+    uint64_t fsgsbase;                  /* Non-zero if the host kernel allows
+                                           WRFSBASE (x86_64 only) */
+    uint64_t epoll_pwait2;              /* Non-zero if yield() may use
+                                           epoll_pwait2() on (epollfd) rather
+                                           than (timerfd) */
+    uint8_t **block_ram;                /* Writable contents of RAM-backed
+                                           devices, indexed by manifest
+                                           entry, or NULL */
+    int schedstat_fd;                   /* Scheduler statistics of CPU 0, see
+                                           struct spt_cpu, or -1 */
+    struct spt_zygote *zygote;          /* If --zygote, else NULL */
 };
 
 /*
@@ -49,6 +201,11 @@ struct spt_boot_info {
  */
 #define SPT_INTERNAL_TIMERFD (~1U)
 
+/*
+ * Identifier (data.u64) for the I/O thread's eventfd in epoll() set.
+ */
+#define SPT_IO_THREAD_WAKE (~2U)
+
 /*
  * The lowest memory address at which we can mmap() memory on the host. See
  * spt_main.c for an explanation.
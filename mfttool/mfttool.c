@@ -75,13 +75,157 @@ static const char out_header[] = \
     "  .e = {\n";
 
 static const char out_entry[] = \
-    "    { .name = \"%s\", .type = MFT_%s },\n";
+    "    { .name = \"%s\", .type = MFT_%s";
+
+static const char out_block_attrs[] = \
+    ",\n      .attrs.block = { .block_size = %lld, .queue_depth = %lld, "
+    ".flags = %s }";
+
+static const char out_net_attrs[] = \
+    ",\n      .attrs.net = { .mtu = %lld, .queues = %lld, .offloads = %s }";
+
+static const char out_shm_attrs[] = \
+    ",\n      .attrs.shm = { .size = %lld }";
+
+static const char out_pci_attrs[] = \
+    ",\n      .attrs.pci = { .vendor_id = %lld, .device_id = %lld }";
+
+static const char out_vsock_attrs[] = \
+    ",\n      .attrs.vsock = { .port = %lld }";
+
+static const char out_entry_end[] = \
+    " },\n";
 
 static const char out_footer[] = \
     "  }\n"
     "}\n"
     "MFT_NOTE_END\n";
 
+/*
+ * Return the integer value of the device attribute (v), checking that it is
+ * within (min) and (max).
+ */
+static long long jattr_int(jvalue *v, long long min, long long max)
+{
+    jexpect(jint, v, ".devices[...]");
+    if (v->u.i < min || v->u.i > max)
+        errx(1, ".devices[...]: .%s must be between %lld and %lld", v->n,
+                min, max);
+    return v->u.i;
+}
+
+static const struct {
+    const char *name;
+    const char *flag;
+} net_offloads[] = {
+    { "hdr",  "MFT_NET_OFFLOAD_HDR" },
+    { "csum", "MFT_NET_OFFLOAD_CSUM" },
+    { "tso4", "MFT_NET_OFFLOAD_TSO4" },
+    { "tso6", "MFT_NET_OFFLOAD_TSO6" },
+};
+
+/*
+ * Generate the attributes of device (dev), named (name), of type (type). Only
+ * keys applying to (type) are accepted, and only in a manifest of version 2
+ * or later.
+ */
+static void gen_attrs(FILE *ofp, jvalue *dev, const char *name,
+        const char *type, long long version)
+{
+    bool block = strcmp(type, "BLOCK_BASIC") == 0;
+    bool net = strcmp(type, "NET_BASIC") == 0;
+    bool shm = strcmp(type, "SHM_BASIC") == 0;
+    bool pci = strcmp(type, "PCI_BASIC") == 0;
+    bool vsock = strcmp(type, "VSOCK_BASIC") == 0;
+    long long block_size = 0, queue_depth = 0, mtu = 0, queues = 0, size = 0;
+    long long vendor_id = 0, device_id = 0, port = 0;
+    char flags[64] = "0", offloads[128] = "0";
+    bool any = false;
+
+    if (!block && !net && !shm && !pci && !vsock)
+        errx(1, ".devices[...]: unknown .type: %s", type);
+    for (jvalue **j = dev->u.v; *j; ++j) {
+        const char *k = (*j)->n;
+        if (strcmp(k, "name") == 0 || strcmp(k, "type") == 0)
+            continue;
+        if (version < 2)
+            errx(1, ".devices[...]: device attributes require .version 2 "
+                    "or later: %s", k);
+        any = true;
+        if (block && strcmp(k, "block_size") == 0) {
+            block_size = jattr_int(*j, 512, 32768);
+            if (block_size & (block_size - 1))
+                errx(1, ".devices[...]: .block_size must be a power of 2");
+        }
+        else if (block && strcmp(k, "queue_depth") == 0)
+            queue_depth = jattr_int(*j, 1, 65535);
+        else if (block && strcmp(k, "direct") == 0) {
+            if ((*j)->d != jtrue && (*j)->d != jfalse)
+                jexpect(jtrue, *j, ".devices[...]");
+            if ((*j)->d == jtrue)
+                strcpy(flags, "MFT_BLOCK_ATTR_DIRECT");
+        }
+        else if (net && strcmp(k, "mtu") == 0)
+            mtu = jattr_int(*j, MFT_NET_MTU_MIN, MFT_NET_MTU_MAX);
+        else if (net && strcmp(k, "queues") == 0)
+            queues = jattr_int(*j, 1, 65535);
+        else if (net && strcmp(k, "offloads") == 0) {
+            jexpect(jarray, *j, ".devices[...]");
+            for (jvalue **o = (*j)->u.v; *o; ++o) {
+                jexpect(jstring, *o, ".devices[...].offloads[]");
+                size_t f;
+                for (f = 0; f < sizeof net_offloads / sizeof net_offloads[0];
+                        f++)
+                    if (strcmp((*o)->u.s, net_offloads[f].name) == 0)
+                        break;
+                if (f == sizeof net_offloads / sizeof net_offloads[0])
+                    errx(1, ".devices[...].offloads[]: unknown offload: %s",
+                            (*o)->u.s);
+                if (strcmp(offloads, "0") == 0)
+                    strcpy(offloads, "MFT_NET_OFFLOAD_HDR");
+                if (strstr(offloads, net_offloads[f].flag) == NULL) {
+                    strcat(offloads, " | ");
+                    strcat(offloads, net_offloads[f].flag);
+                }
+            }
+        }
+        else if (shm && strcmp(k, "size") == 0) {
+            size = jattr_int(*j, MFT_SHM_PAGE_SIZE, 1LL << 40);
+            if (size % MFT_SHM_PAGE_SIZE)
+                errx(1, ".devices[...]: .size must be a multiple of %d",
+                        MFT_SHM_PAGE_SIZE);
+        }
+        else if (pci && strcmp(k, "vendor_id") == 0)
+            vendor_id = jattr_int(*j, 1, 0xfffe);
+        else if (pci && strcmp(k, "device_id") == 0)
+            device_id = jattr_int(*j, 1, 0xfffe);
+        else if (vsock && strcmp(k, "port") == 0)
+            port = jattr_int(*j, 1, 0xfffffffe);
+        else
+            errx(1, ".devices[...]: unknown key for %s device '%s': %s", type,
+                    name, k);
+    }
+
+    /*
+     * A vsock stream is useless without the port of the service to connect
+     * to, so it is the one attribute which must be given.
+     */
+    if (vsock && port == 0)
+        errx(1, ".devices[...]: %s device '%s' requires .port", type, name);
+    if (!any)
+        return;
+    if (block)
+        fprintf(ofp, out_block_attrs, block_size, queue_depth, flags);
+    else if (net)
+        fprintf(ofp, out_net_attrs, mtu, queues, offloads);
+    else if (shm)
+        fprintf(ofp, out_shm_attrs, size);
+    else if (pci)
+        fprintf(ofp, out_pci_attrs, vendor_id, device_id);
+    else
+        fprintf(ofp, out_vsock_attrs, port);
+}
+
 static void usage(const char *prog)
 {
     fprintf(stderr, "usage: %s COMMAND ...\n\n", prog);
@@ -135,9 +279,13 @@ static int mfttool_generate(const char *source, const char *output)
     if (jdevices == NULL)
         errx(1, "missing .devices[]");
 
-    if (jversion->u.i != MFT_VERSION)
-        errx(1, ".version: invalid version %lld, expected %d", jversion->u.i,
-                MFT_VERSION);
+    /*
+     * Manifests of version 1 declare no device attributes, and are otherwise
+     * the same as version 2.
+     */
+    if (jversion->u.i < 1 || jversion->u.i > MFT_VERSION)
+        errx(1, ".version: invalid version %lld, expected 1 to %d",
+                jversion->u.i, MFT_VERSION);
     if (entries > MFT_MAX_ENTRIES)
         errx(1, ".devices[]: too many entries, maximum %d", MFT_MAX_ENTRIES);
 
@@ -154,8 +302,6 @@ static int mfttool_generate(const char *source, const char *output)
                 jexpect(jstring, *j, ".devices[...]");
                 r_type = (*j)->u.s;
             }
-            else
-                errx(1, ".devices[...]: unknown key: %s", (*j)->n);
         }
         if (r_name == NULL)
             errx(1, ".devices[...]: missing .name");
@@ -169,6 +315,8 @@ static int mfttool_generate(const char *source, const char *output)
         if (r_type == NULL)
             errx(1, ".devices[...]: missing .type");
         fprintf(ofp, out_entry, r_name, r_type);
+        gen_attrs(ofp, *i, r_name, r_type, jversion->u.i);
+        fprintf(ofp, out_entry_end);
     }
     fprintf(ofp, out_footer);
 
@@ -190,8 +338,41 @@ static int mfttool_dump(const char *binary)
 
     printf("%s: Manifest contains %d entries.\n", binary, mft->entries);
     for (unsigned i = 0; i != mft->entries; i++) {
-        printf("%s[%u]: Name: '%s', Type: %s\n", binary, i, mft->e[i].name,
+        printf("%s[%u]: Name: '%s', Type: %s", binary, i, mft->e[i].name,
                 mft_type_to_string(mft->e[i].type));
+        if (mft->e[i].type == MFT_BLOCK_BASIC) {
+            struct mft_block_attrs *a = &mft->e[i].attrs.block;
+            if (a->block_size)
+                printf(", Block size: %u", a->block_size);
+            if (a->queue_depth)
+                printf(", Queue depth: %u", a->queue_depth);
+            if (a->flags & MFT_BLOCK_ATTR_DIRECT)
+                printf(", Direct I/O preferred");
+        }
+        else if (mft->e[i].type == MFT_SHM_BASIC) {
+            struct mft_shm_attrs *a = &mft->e[i].attrs.shm;
+            if (a->size)
+                printf(", Size: %llu", (unsigned long long)a->size);
+        }
+        else if (mft->e[i].type == MFT_PCI_BASIC) {
+            struct mft_pci_attrs *a = &mft->e[i].attrs.pci;
+            if (a->vendor_id)
+                printf(", Vendor ID: 0x%04x", a->vendor_id);
+            if (a->device_id)
+                printf(", Device ID: 0x%04x", a->device_id);
+        }
+        else if (mft->e[i].type == MFT_VSOCK_BASIC)
+            printf(", Port: %u", mft->e[i].attrs.vsock.port);
+        else {
+            struct mft_net_attrs *a = &mft->e[i].attrs.net;
+            if (a->mtu)
+                printf(", MTU: %u", a->mtu);
+            if (a->queues)
+                printf(", Queues: %u", a->queues);
+            if (a->offloads)
+                printf(", Offloads: 0x%x", a->offloads);
+        }
+        printf("\n");
     }
 
     free(mft);
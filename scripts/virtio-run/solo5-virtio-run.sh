@@ -25,14 +25,27 @@ Usage: solo5-virtio-run [ OPTIONS ] UNIKERNEL [ -- ] [ ARGUMENTS ... ]
 Launch the Solo5 UNIKERNEL (virtio target). Unikernel output is sent to stdout.
 
 Options:
-    -d DISK: Attach virtio-blk device with DISK image file.
+    -C: Send console output to a virtio console rather than the serial port,
+        once it has been configured (QEMU only).
+
+    -d DISK: Attach virtio-blk device with DISK image file. May be given up
+        to 4 times.
 
     -m MEM: Start guest with MEM megabytes of memory (default is 128).
 
-    -n NETIF: Attach virtio-net device with NETIF tap interface.
+    -n NETIF: Attach virtio-net device with NETIF tap interface. May be
+        given up to 4 times.
+
+    -P: Offer packed virtqueues on virtio devices (QEMU only).
+
+    -Q QUEUES: Offer QUEUES queue pairs on each virtio-net device, whose tap
+        interface must have been created with multi_queue (QEMU only).
 
     -q: Quiet mode. Don't print hypervisor incantations.
 
+    -V CID: Attach a virtio-vsock device, giving the guest context ID CID
+        (KVM only).
+
     -H HV: Use hypervisor HV (default is "best available").
 EOM
     exit 1
@@ -59,19 +72,29 @@ is_quiet ()
 }
 
 # Parse command line arguments.
-ARGS=$(getopt d:m:n:qH: $*)
+ARGS=$(getopt Cd:m:n:PQ:qV:H: $*)
 [ $? -ne 0 ] && usage
 set -- $ARGS
 MEM=128
 HV=best
-NETIF=
-BLKIMG=
+NETIFS=
+BLKIMGS=
+PACKED=
+NETMQ=
+NETQUEUES=
+VCONSOLE=
+VSOCKCID=
 QUIET=
 while true; do
     case "$1" in
+    -C)
+        VCONSOLE=1
+        shift
+        ;;
     -d)
         BLKIMG=$(readlink -f $2)
         [ -f ${BLKIMG} ] || die "not found: ${BLKIMG}"
+        BLKIMGS="${BLKIMGS} ${BLKIMG}"
         shift; shift
         ;;
     -m)
@@ -80,6 +103,7 @@ while true; do
         ;;
     -n)
         NETIF="$2"
+        NETIFS="${NETIFS} ${NETIF}"
         # Check dependencies
         type ip >/dev/null 2>&1 ||
             type ifconfig >/dev/null 2>&1 ||
@@ -89,10 +113,25 @@ while true; do
             die "no such network interface: ${NETIF}"
         shift; shift
         ;;
+    -P)
+        PACKED=",packed=on"
+        shift
+        ;;
+    -Q)
+        [ "$2" -gt 1 ] 2>/dev/null || die "invalid number of queues: $2"
+        NETMQ=",mq=on,vectors=$(($2 * 2 + 2))"
+        NETQUEUES=",queues=$2"
+        shift; shift
+        ;;
     -q)
         QUIET=1
         shift
         ;;
+    -V)
+        [ "$2" -gt 2 ] 2>/dev/null || die "invalid context ID: $2"
+        VSOCKCID="$2"
+        shift; shift
+        ;;
     -H)
         HV="$2"
         shift; shift
@@ -152,16 +191,34 @@ kvm|qemu)
     # QEMU monitor on stdio which requires ^Ax to exit. This makes things look
     # more like a normal process (quit with ^C), consistent with bhyve and
     # solo5-hvt.
-    hv_addargs -display none -serial stdio
+    hv_addargs -display none
+    if [ -n "${VCONSOLE}" ]; then
+        # Both consoles need stdio, so they share it through a multiplexer.
+        hv_addargs -chardev stdio,mux=on,id=con0 -serial chardev:con0
+        hv_addargs -device virtio-serial${PACKED}
+        hv_addargs -device virtconsole,chardev=con0
+    else
+        hv_addargs -serial stdio
+    fi
 
     # Network
-    if [ -n "${NETIF}" ]; then
-        hv_addargs -device virtio-net,netdev=n0
-        hv_addargs -netdev tap,id=n0,ifname=${NETIF},script=no,downscript=no
-    fi
+    N=0
+    for NETIF in ${NETIFS}; do
+        hv_addargs -device virtio-net,netdev=n${N}${PACKED}${NETMQ}
+        hv_addargs -netdev tap,id=n${N},ifname=${NETIF},script=no,downscript=no${NETQUEUES}
+        N=$((N + 1))
+    done
     # Disk
-    if [ -n "${BLKIMG}" ]; then
-        hv_addargs -drive file=${BLKIMG},if=virtio,format=raw
+    N=0
+    for BLKIMG in ${BLKIMGS}; do
+        hv_addargs -drive file=${BLKIMG},if=none,id=d${N},format=raw
+        hv_addargs -device virtio-blk,drive=d${N}${PACKED}
+        N=$((N + 1))
+    done
+    # vsock, served by the host kernel (vhost-vsock)
+    if [ -n "${VSOCKCID}" ]; then
+        [ "${HV}" = "kvm" ] || die "-V requires KVM"
+        hv_addargs -device vhost-vsock-pci,guest-cid=${VSOCKCID}
     fi
 
     # Used by automated tests on QEMU (see kernel/virtio/platform.c).
@@ -199,13 +256,17 @@ bhyve)
     hv_addargs -l com1,${TTYB}
     
     # Network
-    if [ -n "${NETIF}" ]; then
-        hv_addargs -s 2:0,virtio-net,${NETIF}
-    fi
+    N=0
+    for NETIF in ${NETIFS}; do
+        hv_addargs -s 2:${N},virtio-net,${NETIF}
+        N=$((N + 1))
+    done
     # Disk
-    if [ -n "${BLKIMG}" ]; then
-        hv_addargs -s 3:0,virtio-blk,${BLKIMG}
-    fi
+    N=0
+    for BLKIMG in ${BLKIMGS}; do
+        hv_addargs -s 3:${N},virtio-blk,${BLKIMG}
+        N=$((N + 1))
+    done
 
     hv_addargs ${VMNAME}
 
@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * affinity.c: Host CPU affinity and NUMA placement options common to all
+ * tenders.
+ */
+
+#define _GNU_SOURCE
+#include <err.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__linux__)
+#include <sched.h>
+#include <unistd.h>
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
+#endif
+
+#include "affinity.h"
+
+#if defined(__linux__)
+
+#define NODES_MAX 1024
+#define MASK_BITS (8 * sizeof (unsigned long))
+
+static bool have_cpus;
+static cpu_set_t cpus;
+static int numa_node = -1;
+static unsigned long node_mask[NODES_MAX / MASK_BITS];
+
+/*
+ * Parse a Linux CPU list ("0-3,8,10-11") in (list) into (*set). Returns -1
+ * if it is malformed or names a CPU beyond CPU_SETSIZE.
+ */
+static int parse_cpu_list(const char *list, cpu_set_t *set)
+{
+    const char *p = list;
+
+    CPU_ZERO(set);
+    do {
+        char *end;
+        unsigned long first, last;
+
+        errno = 0;
+        first = strtoul(p, &end, 10);
+        if (errno != 0 || end == p)
+            return -1;
+        last = first;
+        p = end;
+        if (*p == '-') {
+            p++;
+            last = strtoul(p, &end, 10);
+            if (errno != 0 || end == p || last < first)
+                return -1;
+            p = end;
+        }
+        if (last >= CPU_SETSIZE)
+            return -1;
+        for (unsigned long cpu = first; cpu <= last; cpu++)
+            CPU_SET(cpu, set);
+    } while (*p++ == ',');
+
+    /*
+     * The list ends at the terminator, or at the newline of a sysfs file.
+     */
+    return (p[-1] == '\0' || p[-1] == '\n') ? 0 : -1;
+}
+
+int affinity_handle_cmdarg(const char *cmdarg)
+{
+    if (strncmp("--cpu=", cmdarg, 6) == 0) {
+        if (parse_cpu_list(cmdarg + 6, &cpus) == -1 || CPU_COUNT(&cpus) == 0)
+            errx(1, "Malformed argument to --cpu");
+        have_cpus = true;
+        return 0;
+    }
+    if (strncmp("--numa-node=", cmdarg, 12) == 0) {
+        unsigned node;
+        char c;
+        if (sscanf(cmdarg, "--numa-node=%u%c", &node, &c) != 1 ||
+                node >= NODES_MAX)
+            errx(1, "Malformed argument to --numa-node");
+        numa_node = node;
+        memset(node_mask, 0, sizeof node_mask);
+        node_mask[node / MASK_BITS] = 1UL << (node % MASK_BITS);
+        return 0;
+    }
+    return -1;
+}
+
+void affinity_apply(void)
+{
+    if (numa_node != -1) {
+        char path[64];
+        char list[4096];
+
+        snprintf(path, sizeof path, "/sys/devices/system/node/node%d/cpulist",
+                numa_node);
+        FILE *f = fopen(path, "r");
+        if (f == NULL)
+            errx(1, "NUMA node %d does not exist on this host", numa_node);
+        /*
+         * Without --cpu, run on the CPUs of the node.
+         */
+        if (fgets(list, sizeof list, f) == NULL ||
+                (!have_cpus && parse_cpu_list(list, &cpus) == -1))
+            errx(1, "Could not read the CPUs of NUMA node %d", numa_node);
+        fclose(f);
+        if (CPU_COUNT(&cpus) == 0)
+            errx(1, "NUMA node %d has no CPUs, use --cpu", numa_node);
+        have_cpus = true;
+
+        /*
+         * Memory allocated by the tender itself, and by the host kernel on
+         * its behalf, is only preferred to be on the node. Guest memory is
+         * bound to it by affinity_bind_mem().
+         */
+        if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, node_mask,
+                    NODES_MAX + 1) == -1)
+            err(1, "set_mempolicy(MPOL_PREFERRED, node=%d) failed",
+                    numa_node);
+    }
+    if (have_cpus && sched_setaffinity(0, sizeof cpus, &cpus) == -1)
+        err(1, "Could not set CPU affinity");
+}
+
+void affinity_bind_mem(void *mem, size_t size)
+{
+    if (numa_node == -1)
+        return;
+
+    if (syscall(SYS_mbind, mem, size, MPOL_BIND, node_mask, NODES_MAX + 1,
+                MPOL_MF_MOVE) == -1)
+        err(1, "Could not bind guest memory to NUMA node %d", numa_node);
+}
+
+#else /* !__linux__ */
+
+int affinity_handle_cmdarg(const char *cmdarg)
+{
+    if (strncmp("--cpu=", cmdarg, 6) == 0 ||
+            strncmp("--numa-node=", cmdarg, 12) == 0)
+        errx(1, "--cpu and --numa-node are not supported on this host");
+    return -1;
+}
+
+void affinity_apply(void)
+{
+}
+
+void affinity_bind_mem(void *mem __attribute__((unused)),
+        size_t size __attribute__((unused)))
+{
+}
+
+#endif /* __linux__ */
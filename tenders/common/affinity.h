@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * affinity.h: Host CPU affinity and NUMA placement options common to all
+ * tenders (--cpu=LIST, --numa-node=N).
+ */
+
+#ifndef COMMON_AFFINITY_H
+#define COMMON_AFFINITY_H
+
+#include <stddef.h>
+
+/*
+ * Parse a CPU affinity or NUMA placement option (cmdarg). Returns 0 if
+ * (cmdarg) was such an option, -1 otherwise. Exits if it is malformed, or not
+ * supported on this host.
+ */
+int affinity_handle_cmdarg(const char *cmdarg);
+
+/*
+ * Apply the options to the calling thread: restrict it to the CPUs given with
+ * --cpu, or those of the node given with --numa-node, and prefer allocating
+ * its memory on that node. Must be called by the tender before it allocates
+ * guest memory or creates any threads, which inherit the placement.
+ */
+void affinity_apply(void);
+
+/*
+ * Bind the guest memory mapping at (mem, size) to the node given with
+ * --numa-node, if any. Must be called before the mapping is populated.
+ */
+void affinity_bind_mem(void *mem, size_t size);
+
+#endif /* COMMON_AFFINITY_H */
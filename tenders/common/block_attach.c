@@ -25,27 +25,203 @@
 #define _GNU_SOURCE
 #define _FILE_OFFSET_BITS 64
 #include <err.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <fcntl.h>
 #include <unistd.h>
 
+#if defined(__linux__)
+#include <linux/fs.h>
+#include <sys/syscall.h>
+#endif
+
+#include "block_attach.h"
+
+static bool block_size_valid(unsigned bs)
+{
+    return bs >= BLOCK_SIZE_MIN && bs <= BLOCK_SIZE_MAX && (bs & (bs - 1)) == 0;
+}
+
+bool block_parse_opts(char *path, unsigned *bs)
+{
+    *bs = BLOCK_SIZE_DEFAULT;
+
+    char *opt = strrchr(path, ',');
+    if (opt == NULL || strncmp(opt, ",bs=", 4) != 0)
+        return true;
+    *opt = '\0';
+    opt += 4;
+    if (strcmp(opt, "auto") == 0) {
+        *bs = BLOCK_SIZE_DETECT;
+        return true;
+    }
+    char *end;
+    unsigned long v = strtoul(opt, &end, 10);
+    if (*opt == '\0' || *end != '\0' || !block_size_valid(v))
+        return false;
+    *bs = v;
+    return true;
+}
+
+/*
+ * Returns the block size of the storage behind (fd). For block devices, this
+ * is their logical block size. For regular files, the alignment required by
+ * the file system for direct I/O is not generally known, so use its preferred
+ * I/O size, which is a multiple of it, within the range supported.
+ */
+static uint16_t block_size_detect(const char *path, int fd)
+{
+    struct stat st;
+    unsigned bs = 4096;
+
+    if (fstat(fd, &st) == -1)
+        err(1, "%s: fstat() failed", path);
+#if defined(__linux__)
+    int ssz;
+    if (S_ISBLK(st.st_mode)) {
+        if (ioctl(fd, BLKSSZGET, &ssz) == -1)
+            err(1, "%s: Could not determine block size", path);
+        bs = ssz;
+    }
+    else
+#endif
+    if (block_size_valid(st.st_blksize))
+        bs = st.st_blksize;
+    if (!block_size_valid(bs))
+        errx(1, "%s: Unsupported block size: %u", path, bs);
+    return bs;
+}
+
 /*
- * Attach to the block device specified by (path), returning its capacity in
- * bytes in (*capacity).
+ * Syntax @<number> indicates a pre-existing open fd. Its access mode cannot
+ * be changed, so it must allow writing unless (oflags) is O_RDONLY; direct
+ * I/O can be enabled afterwards, as with open().
  */
-int block_attach(const char *path, off_t *capacity_)
+static int block_open_fd(const char *path, int oflags)
 {
-    int fd = open(path, O_RDWR);
+    char *endp;
+    errno = 0;
+    long int maybe_fd = strtol(&path[1], &endp, 10);
+    if (*endp != 0 || endp == &path[1])
+        errno = EINVAL;
+    else if (maybe_fd < 0 || maybe_fd > INT_MAX)
+        errno = ERANGE;
+    if (errno)
+        return -1;
+
+    int fd = (int)maybe_fd;
+    int fl = fcntl(fd, F_GETFL);
+    if (fl == -1)
+        return -1;
+    if ((oflags & O_ACCMODE) != O_RDONLY && (fl & O_ACCMODE) == O_RDONLY) {
+        errno = EBADF;
+        return -1;
+    }
+#if defined(O_DIRECT)
+    if ((oflags & O_DIRECT) && !(fl & O_DIRECT) &&
+            fcntl(fd, F_SETFL, fl | O_DIRECT) == -1)
+        return -1;
+#endif
+    return fd;
+}
+
+int block_attach(const char *path, unsigned flags, unsigned bs_req,
+        off_t *capacity_, uint16_t *block_size)
+{
+    bool direct = flags & BLOCK_ATTACH_DIRECT;
+    int oflags = (flags & BLOCK_ATTACH_RDONLY) ? O_RDONLY : O_RDWR;
+
+    if (direct) {
+#if defined(O_DIRECT)
+        oflags |= O_DIRECT;
+#else
+        errx(1, "%s: Direct I/O is not supported on this host", path);
+#endif
+    }
+    int fd = path[0] == '@' ? block_open_fd(path, oflags) : open(path, oflags);
     if (fd == -1)
-        err(1, "Could not open block device: %s", path);
+        err(1, "Could not open block device%s: %s",
+                direct ? " for direct I/O" : "", path);
+    uint16_t bs;
+    if (bs_req == BLOCK_SIZE_DETECT ||
+            (direct && bs_req == BLOCK_SIZE_DEFAULT))
+        bs = block_size_detect(path, fd);
+    else if (bs_req == BLOCK_SIZE_DEFAULT)
+        bs = BLOCK_SIZE_MIN;
+    else {
+        bs = bs_req;
+        /*
+         * With direct I/O, requests must remain aligned to what the device
+         * requires.
+         */
+        if (direct && bs % block_size_detect(path, fd) != 0)
+            errx(1, "%s: Block size %u is not supported for direct I/O",
+                    path, (unsigned)bs);
+    }
     off_t capacity = lseek(fd, 0, SEEK_END);
     if (capacity == -1)
         err(1, "%s: Could not determine capacity", path);
-    if (capacity < 512)
-        errx(1, "%s: Backing storage must be at least 1 block (512 bytes) "
-                "in size", path);
+    /*
+     * A partial block at the end of the device cannot be accessed.
+     */
+    capacity -= capacity % bs;
+    if (capacity < bs)
+        errx(1, "%s: Backing storage must be at least 1 block (%u bytes) "
+                "in size", path, (unsigned)bs);
 
     *capacity_ = capacity;
+    *block_size = bs;
     return fd;
 }
+
+bool block_parse_ioprio(const char *spec, int *ioprio)
+{
+    static const struct {
+        const char *name;
+        int class;
+    } classes[] = {
+        { "rt", BLOCK_IOPRIO_CLASS_RT },
+        { "be", BLOCK_IOPRIO_CLASS_BE },
+        { "idle", BLOCK_IOPRIO_CLASS_IDLE }
+    };
+
+    for (size_t i = 0; i != sizeof classes / sizeof classes[0]; i++) {
+        size_t len = strlen(classes[i].name);
+        if (strncmp(spec, classes[i].name, len) != 0)
+            continue;
+        if (spec[len] == '\0') {
+            *ioprio = BLOCK_IOPRIO(classes[i].class,
+                    classes[i].class == BLOCK_IOPRIO_CLASS_IDLE ? 0 : 4);
+            return true;
+        }
+        /*
+         * The idle class has no levels.
+         */
+        if (spec[len] != ':' || classes[i].class == BLOCK_IOPRIO_CLASS_IDLE ||
+                spec[len + 1] < '0' || spec[len + 1] > '7' ||
+                spec[len + 2] != '\0')
+            return false;
+        *ioprio = BLOCK_IOPRIO(classes[i].class, spec[len + 1] - '0');
+        return true;
+    }
+    return false;
+}
+
+int block_set_ioprio(int ioprio)
+{
+#if defined(__linux__) && defined(SYS_ioprio_set)
+    /*
+     * IOPRIO_WHO_PROCESS, which for (who) of 0 is the calling thread.
+     */
+    return syscall(SYS_ioprio_set, 1, 0, ioprio);
+#else
+    (void)ioprio;
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
@@ -27,12 +27,76 @@
 
 #define _GNU_SOURCE
 #define _FILE_OFFSET_BITS 64
+#include <stdbool.h>
+#include <stdint.h>
 #include <sys/types.h>
 
+/*
+ * Block sizes supported, and special values for the block size requested
+ * from block_attach().
+ */
+#define BLOCK_SIZE_MIN 512
+#define BLOCK_SIZE_MAX 4096
+#define BLOCK_SIZE_DEFAULT 0
+#define BLOCK_SIZE_DETECT 1
+
+/*
+ * Parse and strip any options following (path) on the command line. The only
+ * option is ",bs=SIZE", where SIZE is a power of 2 between BLOCK_SIZE_MIN and
+ * BLOCK_SIZE_MAX, or "auto". Returns the block size requested in (*bs) and
+ * false if the options are invalid.
+ */
+bool block_parse_opts(char *path, unsigned *bs);
+
 /*
  * Attach to the block device specified by (path). Returns the file descriptor
- * and device capacity in * bytes in (*capacity).
+ * and device capacity in * bytes in (*capacity), and its block size in
+ * (*block_size).
+ *
+ * The block size is (bs), or if BLOCK_SIZE_DETECT, the logical block size of
+ * the device or the preferred I/O size of the file system it is on. Any
+ * partial block at the end of the device is not included in its capacity.
+ *
+ * If (flags) includes BLOCK_ATTACH_DIRECT, the device is opened for direct I/O
+ * (O_DIRECT), bypassing the host page cache. The block size must then be a
+ * multiple of what the device requires for direct I/O, and defaults to it.
+ * Otherwise, the block size defaults to 512 bytes. If (flags) includes
+ * BLOCK_ATTACH_RDONLY, the device is opened read-only.
+ *
+ * A (path) of the form "@NN" indicates a pre-existing open fd NN, such as one
+ * passed by a launcher, which is used as if it had been opened from a path.
+ * It must be open for writing unless BLOCK_ATTACH_RDONLY is given.
+ */
+#define BLOCK_ATTACH_DIRECT (1U << 0)
+#define BLOCK_ATTACH_RDONLY (1U << 1)
+
+int block_attach(const char *path, unsigned flags, unsigned bs,
+        off_t *capacity_, uint16_t *block_size);
+
+/*
+ * Host I/O priorities (--block-prio), encoded as for ioprio_set(2). A
+ * priority of BLOCK_IOPRIO_NONE is that of the tender, which by default is
+ * equivalent to BLOCK_IOPRIO_DEFAULT.
+ */
+#define BLOCK_IOPRIO_CLASS_RT 1
+#define BLOCK_IOPRIO_CLASS_BE 2
+#define BLOCK_IOPRIO_CLASS_IDLE 3
+#define BLOCK_IOPRIO(class, level) (((class) << 13) | (level))
+#define BLOCK_IOPRIO_NONE 0
+#define BLOCK_IOPRIO_DEFAULT BLOCK_IOPRIO(BLOCK_IOPRIO_CLASS_BE, 4)
+
+/*
+ * Parse CLASS[:LEVEL] (spec), where CLASS is "rt", "be" or "idle" and LEVEL is
+ * from 0 (highest) to 7, defaulting to 4, into (*ioprio). Returns false if
+ * (spec) is invalid.
+ */
+bool block_parse_ioprio(const char *spec, int *ioprio);
+
+/*
+ * Set the I/O priority of the calling thread, and of threads it creates
+ * later, to (ioprio). Returns 0 on success, or -1 and an appropriate errno on
+ * failure (ENOTSUP if not supported on this host).
  */
-int block_attach(const char *path, off_t *capacity_);
+int block_set_ioprio(int ioprio);
 
 #endif /* COMMON_BLOCK_ATTACH_H */
@@ -0,0 +1,242 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * block_cow.c: Common functions for copy-on-write overlays of block devices.
+ */
+
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "block_attach.h"
+#include "block_cow.h"
+
+#define CLUSTER_SIZE_MAX (64 * 1024)
+
+static bool cow_present(struct block_cow *cow, uint64_t c)
+{
+    return __atomic_load_n(&cow->map[c / 64], __ATOMIC_ACQUIRE) &
+        (1ULL << (c % 64));
+}
+
+static void cow_set(struct block_cow *cow, uint64_t c)
+{
+    __atomic_fetch_or(&cow->map[c / 64], 1ULL << (c % 64), __ATOMIC_RELEASE);
+}
+
+bool block_cow_path(char *path, char **overlay)
+{
+    struct stat st;
+
+    if (stat(path, &st) == 0)
+        return false;
+    char *p = strrchr(path, '+');
+    if (p == NULL || p == path || p[1] == '\0')
+        return false;
+    *p = '\0';
+    *overlay = p + 1;
+    return true;
+}
+
+/*
+ * Add the data allocated in the OVERLAY to the map of (cow). Returns 0 on
+ * success, -1 on error.
+ */
+static int cow_map_load(struct block_cow *cow)
+{
+#if defined(SEEK_DATA)
+    off_t pos = 0, end;
+
+    while ((pos = lseek(cow->fd, pos, SEEK_DATA)) != -1) {
+        if ((end = lseek(cow->fd, pos, SEEK_HOLE)) == -1)
+            break;
+        for (uint64_t c = pos / cow->cluster_size;
+                (off_t)(c * cow->cluster_size) < end; c++)
+            cow_set(cow, c);
+        pos = end;
+    }
+    return errno == ENXIO ? 0 : -1;
+#else
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+int block_cow_reload(struct block_cow *cow)
+{
+    /*
+     * Clusters are never removed from the OVERLAY, so the map only grows.
+     */
+    return cow_map_load(cow);
+}
+
+int block_cow_attach(struct block_cow *cow, const char *path,
+        const char *overlay, unsigned bs, off_t *capacity_,
+        uint16_t *block_size)
+{
+    off_t capacity;
+    struct stat st;
+
+    cow->basefd = block_attach(path, BLOCK_ATTACH_RDONLY, bs, &capacity,
+            block_size);
+    cow->fd = open(overlay, O_RDWR | O_CREAT, 0666);
+    if (cow->fd == -1)
+        err(1, "Could not open overlay: %s", overlay);
+    if (fstat(cow->fd, &st) == -1)
+        err(1, "%s: fstat() failed", overlay);
+    if (!S_ISREG(st.st_mode))
+        errx(1, "%s: Overlay must be a regular file", overlay);
+    if (st.st_size == 0) {
+        if (ftruncate(cow->fd, capacity) == -1)
+            err(1, "%s: Could not set size of overlay", overlay);
+    }
+    else if (st.st_size != capacity)
+        errx(1, "%s: Overlay size does not match %s", overlay, path);
+
+    unsigned cs = *block_size;
+    if (st.st_blksize > cs)
+        cs = st.st_blksize;
+    if (cs > CLUSTER_SIZE_MAX || (cs & (cs - 1)))
+        errx(1, "%s: Unsupported file system block size: %u", overlay, cs);
+    cow->capacity = capacity;
+    cow->cluster_size = cs;
+    uint64_t clusters = (capacity + cs - 1) / cs;
+    cow->map = calloc((clusters + 63) / 64, sizeof (uint64_t));
+    cow->cluster = malloc(cs);
+    if (cow->map == NULL || cow->cluster == NULL)
+        errx(1, "%s: Could not allocate overlay map", overlay);
+    if (pthread_mutex_init(&cow->lock, NULL) != 0)
+        errx(1, "%s: pthread_mutex_init() failed", overlay);
+    if (st.st_blocks != 0 && cow_map_load(cow) == -1)
+        err(1, "%s: Could not determine data in overlay", overlay);
+
+    *capacity_ = capacity;
+    return cow->fd;
+}
+
+/*
+ * Read or write (len) bytes, starting (skip) bytes into (iov[]), at (pos) on
+ * (fd).
+ */
+static ssize_t cow_io(int fd, bool write, const struct iovec *iov, int iovcnt,
+        size_t skip, size_t len, off_t pos)
+{
+    struct iovec sub[iovcnt];
+    int n = 0;
+
+    for (int i = 0; i < iovcnt && len > 0; i++) {
+        if (skip >= iov[i].iov_len) {
+            skip -= iov[i].iov_len;
+            continue;
+        }
+        size_t l = iov[i].iov_len - skip;
+        if (l > len)
+            l = len;
+        sub[n].iov_base = (uint8_t *)iov[i].iov_base + skip;
+        sub[n].iov_len = l;
+        n++;
+        skip = 0;
+        len -= l;
+    }
+    return write ? pwritev(fd, sub, n, pos) : preadv(fd, sub, n, pos);
+}
+
+static size_t iov_len(const struct iovec *iov, int iovcnt)
+{
+    size_t len = 0;
+
+    for (int i = 0; i < iovcnt; i++)
+        len += iov[i].iov_len;
+    return len;
+}
+
+/*
+ * Reads are split into runs of clusters that are all in either the OVERLAY or
+ * BASE.
+ */
+ssize_t block_cow_preadv(struct block_cow *cow, const struct iovec *iov,
+        int iovcnt, off_t pos)
+{
+    off_t cs = cow->cluster_size;
+    size_t len = iov_len(iov, iovcnt);
+    off_t end = pos + len;
+
+    for (off_t p = pos; p < end; ) {
+        bool present = cow_present(cow, p / cs);
+        off_t run = (p / cs + 1) * cs;
+        while (run < end && cow_present(cow, run / cs) == present)
+            run += cs;
+        if (run > end)
+            run = end;
+        ssize_t n = run - p;
+        if (cow_io(present ? cow->fd : cow->basefd, false, iov, iovcnt,
+                    p - pos, n, p) != n)
+            return -1;
+        p = run;
+    }
+    return len;
+}
+
+static bool cow_copy_up(struct block_cow *cow, uint64_t c)
+{
+    off_t start = c * cow->cluster_size;
+    ssize_t len = cow->capacity - start;
+
+    if (len > (ssize_t)cow->cluster_size)
+        len = cow->cluster_size;
+    if (pread(cow->basefd, cow->cluster, len, start) != len ||
+            pwrite(cow->fd, cow->cluster, len, start) != len)
+        return false;
+    cow_set(cow, c);
+    return true;
+}
+
+ssize_t block_cow_pwritev(struct block_cow *cow, const struct iovec *iov,
+        int iovcnt, off_t pos)
+{
+    off_t cs = cow->cluster_size;
+    size_t len = iov_len(iov, iovcnt);
+    off_t end = pos + len;
+    uint64_t first = pos / cs, last = (end - 1) / cs;
+    ssize_t ret = -1;
+
+    pthread_mutex_lock(&cow->lock);
+    if (pos % cs != 0 && !cow_present(cow, first) &&
+            !cow_copy_up(cow, first))
+        goto out;
+    if (end % cs != 0 && end != cow->capacity && !cow_present(cow, last) &&
+            !cow_copy_up(cow, last))
+        goto out;
+    ret = cow_io(cow->fd, true, iov, iovcnt, 0, len, pos);
+    if (ret == (ssize_t)len) {
+        for (uint64_t c = first; c <= last; c++)
+            cow_set(cow, c);
+    }
+out:
+    pthread_mutex_unlock(&cow->lock);
+    return ret;
+}
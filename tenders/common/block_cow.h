@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * block_cow.h: Common functions for copy-on-write overlays of block devices.
+ */
+
+#ifndef COMMON_BLOCK_COW_H
+#define COMMON_BLOCK_COW_H
+
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/*
+ * A copy-on-write overlay, BASE+OVERLAY, backs a block device with a BASE
+ * image, which is opened read-only and may be shared by any number of
+ * tenders, and a sparse OVERLAY file holding only the data written to the
+ * device. The OVERLAY has the same layout as BASE, and is created empty if it
+ * does not exist.
+ *
+ * Data is tracked in clusters of (cluster_size) bytes, which is at least the
+ * block size and the allocation unit of the file system the OVERLAY is on.
+ * Each cluster is either entirely in the OVERLAY or entirely in BASE, as
+ * recorded in (map). Writes covering only part of a cluster not yet in the
+ * OVERLAY first copy it up from BASE. The map is not stored, but rebuilt from
+ * the data allocated in the OVERLAY (SEEK_DATA) when attaching, so the file
+ * system the OVERLAY is on must support holes.
+ */
+struct block_cow {
+    int basefd;
+    int fd;                     /* OVERLAY */
+    off_t capacity;
+    unsigned cluster_size;
+    uint64_t *map;              /* Bitmap of clusters in the OVERLAY */
+    uint8_t *cluster;           /* Copy-up buffer, protected by (lock) */
+    pthread_mutex_t lock;       /* Serialises writes */
+};
+
+/*
+ * Returns true if (path) does not exist, but names a copy-on-write overlay,
+ * BASE+OVERLAY. If so, (path) is truncated to BASE, and (*overlay) points to
+ * OVERLAY.
+ */
+bool block_cow_path(char *path, char **overlay);
+
+/*
+ * Attach (cow) to the copy-on-write overlay of BASE (path) with OVERLAY
+ * (overlay). (bs), (*capacity) and (*block_size) are as for block_attach(), and
+ * refer to BASE. Returns the file descriptor of the OVERLAY.
+ */
+int block_cow_attach(struct block_cow *cow, const char *path,
+        const char *overlay, unsigned bs, off_t *capacity,
+        uint16_t *block_size);
+
+/*
+ * Rebuild the map of (cow) from the OVERLAY, after another tender which has
+ * it attached may have written to it. Returns 0 on success, -1 on error.
+ */
+int block_cow_reload(struct block_cow *cow);
+
+/*
+ * As for preadv() and pwritev() on the device. Returns -1 if any part of the
+ * request could not be performed. Requests must be within the capacity of the
+ * device. Concurrent calls are safe.
+ */
+ssize_t block_cow_preadv(struct block_cow *cow, const struct iovec *iov,
+        int iovcnt, off_t pos);
+ssize_t block_cow_pwritev(struct block_cow *cow, const struct iovec *iov,
+        int iovcnt, off_t pos);
+
+#endif /* COMMON_BLOCK_COW_H */
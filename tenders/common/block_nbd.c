@@ -0,0 +1,1167 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * block_nbd.c: Common functions for attaching to remote block devices using
+ * the NBD protocol.
+ *
+ * Each connection has a thread receiving replies, so that requests from any
+ * number of threads can be pipelined on it: a request is sent by the thread
+ * performing it, which then waits for the receiving thread to complete it.
+ * Requests are identified to the server by their index in (reqs).
+ */
+
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <endian.h>
+#else
+#include <sys/endian.h>
+#endif
+
+#include "block_attach.h"
+#include "block_nbd.h"
+
+/*
+ * Protocol constants, see
+ * https://github.com/NetworkBlockDevice/nbd/blob/master/doc/proto.md.
+ */
+#define NBD_PORT                10809
+#define NBD_MAGIC               0x4e42444d41474943ULL  /* "NBDMAGIC" */
+#define NBD_OPTS_MAGIC          0x49484156454f5054ULL  /* "IHAVEOPT" */
+#define NBD_REP_MAGIC           0x0003e889045565a9ULL
+#define NBD_REQUEST_MAGIC       0x25609513
+#define NBD_REPLY_MAGIC         0x67446698
+
+#define NBD_FLAG_FIXED_NEWSTYLE (1U << 0)
+#define NBD_FLAG_NO_ZEROES      (1U << 1)
+
+#define NBD_OPT_EXPORT_NAME     1
+#define NBD_OPT_GO              7
+#define NBD_REP_ACK             1
+#define NBD_REP_INFO            3
+#define NBD_REP_ERR_UNSUP       0x80000001U
+#define NBD_INFO_EXPORT         0
+#define NBD_INFO_BLOCK_SIZE     3
+
+#define NBD_TFLAG_READ_ONLY     (1U << 1)
+#define NBD_TFLAG_SEND_FLUSH    (1U << 2)
+#define NBD_TFLAG_SEND_TRIM     (1U << 5)
+#define NBD_TFLAG_SEND_WRITE_ZEROES (1U << 6)
+#define NBD_TFLAG_CAN_MULTI_CONN (1U << 8)
+
+#define NBD_CMD_READ            0
+#define NBD_CMD_WRITE           1
+#define NBD_CMD_FLUSH           3
+#define NBD_CMD_TRIM            4
+#define NBD_CMD_WRITE_ZEROES    6
+
+struct nbd_request {
+    uint32_t magic;
+    uint16_t flags;
+    uint16_t type;
+    uint64_t cookie;
+    uint64_t offset;
+    uint32_t length;
+} __attribute__((packed));
+
+struct nbd_reply {
+    uint32_t magic;
+    uint32_t error;
+    uint64_t cookie;
+} __attribute__((packed));
+
+/*
+ * Requests in flight per device, and the largest request sent.
+ */
+#define NBD_REQS_MAX    128
+#define NBD_RA_MIN      (128 * 1024)
+#define NBD_RA_MAX      (2 * 1024 * 1024)
+#define NBD_CLUSTER_SIZE (64 * 1024)
+
+struct nbd_conn {
+    struct block_nbd *nbd;
+    int fd;
+    pthread_mutex_t send_lock;
+    pthread_t thread;
+    bool failed;
+};
+
+struct nbd_req {
+    struct nbd_conn *conn;
+    const struct iovec *iov;    /* Reads: where the data goes */
+    int iovcnt;
+    struct iovec ra_iov;
+    struct nbd_ra *ra;          /* Read-ahead: the segment being read */
+    int error;                  /* errno, 0 on success */
+    bool busy;
+    bool done;
+};
+
+/*
+ * Read-ahead. Sequential reads grow a window, up to NBD_RA_MAX, and are
+ * served from two segments which are read ahead of them in turn. Writes
+ * discard any data read ahead, as well as reads ahead in flight.
+ */
+#define RA_EMPTY    0
+#define RA_PENDING  1
+#define RA_READY    2
+
+struct nbd_ra {
+    off_t start;
+    size_t len;
+    int state;
+    uint64_t gen;               /* (wgen) when read ahead */
+    uint8_t *buf;
+};
+
+struct block_nbd {
+    struct nbd_conn conns[BLOCK_NBD_CONNS_MAX];
+    unsigned nconns;
+    unsigned next_conn;
+    uint16_t tflags;
+    off_t capacity;
+
+    pthread_mutex_t lock;       /* Protects all of the below */
+    pthread_cond_t cond;        /* Signalled when a request completes */
+    struct nbd_req reqs[NBD_REQS_MAX];
+    unsigned nfree;
+
+    uint64_t wgen;              /* Incremented as writes start and end */
+    unsigned writes;            /* Writes in flight */
+    off_t ra_next;              /* Expected position of the next read */
+    off_t ra_end;               /* End of the data read ahead */
+    size_t ra_window;
+    struct nbd_ra ra[2];
+
+    int cachefd;                /* Local cache, or -1 */
+    uint64_t *cache_map;        /* Bitmap of clusters in the cache */
+};
+
+bool block_nbd_is_spec(const char *path)
+{
+    return strncmp(path, "nbd://", 6) == 0 ||
+        strncmp(path, "nbd+unix://", 11) == 0;
+}
+
+/*
+ * Socket I/O.
+ */
+static int send_full(int fd, const struct iovec *iov, int iovcnt)
+{
+    struct iovec v[64];
+
+    while (iovcnt > 0) {
+        int n = (iovcnt < 64) ? iovcnt : 64;
+        memcpy(v, iov, n * sizeof v[0]);
+        struct iovec *p = v;
+        int left = n;
+        while (left > 0) {
+            struct msghdr mh = { .msg_iov = p, .msg_iovlen = left };
+            ssize_t nbytes = sendmsg(fd, &mh, MSG_NOSIGNAL);
+            if (nbytes == -1) {
+                if (errno == EINTR)
+                    continue;
+                return -1;
+            }
+            while (left > 0 && (size_t)nbytes >= p->iov_len) {
+                nbytes -= p->iov_len;
+                p++;
+                left--;
+            }
+            if (left > 0) {
+                p->iov_base = (uint8_t *)p->iov_base + nbytes;
+                p->iov_len -= nbytes;
+            }
+        }
+        iov += n;
+        iovcnt -= n;
+    }
+    return 0;
+}
+
+static int recv_full(int fd, void *buf, size_t len)
+{
+    uint8_t *p = buf;
+
+    while (len > 0) {
+        ssize_t nbytes = recv(fd, p, len, MSG_WAITALL);
+        if (nbytes == 0)
+            errno = ECONNRESET;
+        if (nbytes <= 0) {
+            if (nbytes == -1 && errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += nbytes;
+        len -= nbytes;
+    }
+    return 0;
+}
+
+static int send_buf(int fd, const void *buf, size_t len)
+{
+    struct iovec iov = { .iov_base = (void *)buf, .iov_len = len };
+
+    return send_full(fd, &iov, 1);
+}
+
+/*
+ * Local cache.
+ */
+static bool cache_present(struct block_nbd *nbd, uint64_t c)
+{
+    return nbd->cache_map[c / 64] & (1ULL << (c % 64));
+}
+
+/*
+ * Returns true if all of [pos, pos + len) is in the cache. Must be called
+ * with (lock) held.
+ */
+static bool cache_covers(struct block_nbd *nbd, off_t pos, size_t len)
+{
+    if (nbd->cachefd == -1)
+        return false;
+    for (uint64_t c = pos / NBD_CLUSTER_SIZE;
+            (off_t)(c * NBD_CLUSTER_SIZE) < pos + (off_t)len; c++) {
+        if (!cache_present(nbd, c))
+            return false;
+    }
+    return true;
+}
+
+/*
+ * Stores the clusters entirely within (len) bytes read at (pos) into the
+ * cache, unless a write has started since they were read, at (gen). The last
+ * cluster of the device may be short. Must be called with (lock) held.
+ */
+static void cache_fill(struct block_nbd *nbd, const uint8_t *buf, off_t pos,
+        size_t len, uint64_t gen)
+{
+    if (nbd->cachefd == -1 || nbd->wgen != gen || nbd->writes != 0)
+        return;
+    uint64_t c = (pos + NBD_CLUSTER_SIZE - 1) / NBD_CLUSTER_SIZE;
+    for (;; c++) {
+        off_t start = c * NBD_CLUSTER_SIZE;
+        off_t end = start + NBD_CLUSTER_SIZE;
+        if (end > nbd->capacity)
+            end = nbd->capacity;
+        if (start >= end || end > pos + (off_t)len)
+            break;
+        if (cache_present(nbd, c))
+            continue;
+        if (pwrite(nbd->cachefd, buf + (start - pos), end - start, start) !=
+                end - start)
+            break;
+        nbd->cache_map[c / 64] |= 1ULL << (c % 64);
+    }
+}
+
+/*
+ * Removes [pos, pos + len) from the cache before it is written. Must be
+ * called with (lock) held.
+ */
+static void cache_invalidate(struct block_nbd *nbd, off_t pos, off_t len)
+{
+    if (nbd->cachefd == -1)
+        return;
+    uint64_t first = pos / NBD_CLUSTER_SIZE;
+    uint64_t last = (pos + len - 1) / NBD_CLUSTER_SIZE;
+    bool present = false;
+    for (uint64_t c = first; c <= last; c++) {
+        present |= cache_present(nbd, c);
+        nbd->cache_map[c / 64] &= ~(1ULL << (c % 64));
+    }
+    if (!present)
+        return;
+    /*
+     * Clusters are trusted if allocated in the cache when it is attached
+     * again, so must not be left there. If they cannot be punched out,
+     * start again with an empty cache.
+     */
+#if defined(__linux__)
+    off_t start = first * NBD_CLUSTER_SIZE;
+    if (fallocate(nbd->cachefd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                start, (last + 1) * NBD_CLUSTER_SIZE - start) == 0)
+        return;
+#endif
+    if (ftruncate(nbd->cachefd, 0) == -1 ||
+            ftruncate(nbd->cachefd, nbd->capacity) == -1) {
+        /*
+         * Concurrent reads may still be using the descriptor, so it is left
+         * open.
+         */
+        warn("NBD: Could not reset cache, disabling it");
+        nbd->cachefd = -1;
+        return;
+    }
+    memset(nbd->cache_map, 0, ((nbd->capacity / NBD_CLUSTER_SIZE) / 64 + 1) *
+            sizeof (uint64_t));
+}
+
+static void cache_attach(struct block_nbd *nbd, const char *path)
+{
+    struct stat st;
+    size_t nclusters = nbd->capacity / NBD_CLUSTER_SIZE + 1;
+
+    nbd->cachefd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+    if (nbd->cachefd == -1)
+        err(1, "Could not open NBD cache: %s", path);
+    if (fstat(nbd->cachefd, &st) == -1)
+        err(1, "%s: fstat() failed", path);
+    if (!S_ISREG(st.st_mode))
+        errx(1, "%s: NBD cache must be a regular file", path);
+    /*
+     * A cache of a different size cannot be of this export.
+     */
+    if (st.st_size != nbd->capacity && (ftruncate(nbd->cachefd, 0) == -1 ||
+                ftruncate(nbd->cachefd, nbd->capacity) == -1))
+        err(1, "%s: Could not resize NBD cache", path);
+    nbd->cache_map = calloc(nclusters / 64 + 1, sizeof (uint64_t));
+    if (nbd->cache_map == NULL)
+        err(1, "malloc");
+
+#if defined(SEEK_DATA)
+    off_t pos = 0, end;
+    while ((pos = lseek(nbd->cachefd, pos, SEEK_DATA)) != -1) {
+        if ((end = lseek(nbd->cachefd, pos, SEEK_HOLE)) == -1)
+            break;
+        for (uint64_t c = pos / NBD_CLUSTER_SIZE;
+                (off_t)(c * NBD_CLUSTER_SIZE) < end; c++)
+            nbd->cache_map[c / 64] |= 1ULL << (c % 64);
+        pos = end;
+    }
+    if (errno != ENXIO)
+        err(1, "%s: Could not load NBD cache", path);
+#else
+    errx(1, "%s: NBD caches are not supported on this host", path);
+#endif
+}
+
+/*
+ * Requests.
+ */
+static struct nbd_req *req_alloc(struct block_nbd *nbd, bool wait)
+{
+    for (;;) {
+        for (unsigned i = 0; nbd->nfree != 0 && i < NBD_REQS_MAX; i++) {
+            struct nbd_req *r = &nbd->reqs[i];
+            if (!r->busy) {
+                memset(r, 0, sizeof *r);
+                r->busy = true;
+                nbd->nfree--;
+                return r;
+            }
+        }
+        if (!wait)
+            return NULL;
+        pthread_cond_wait(&nbd->cond, &nbd->lock);
+    }
+}
+
+static void req_free(struct block_nbd *nbd, struct nbd_req *r)
+{
+    r->busy = false;
+    nbd->nfree++;
+    pthread_cond_broadcast(&nbd->cond);
+}
+
+static void ra_complete(struct block_nbd *nbd, struct nbd_req *r);
+
+static struct nbd_conn *conn_pick(struct block_nbd *nbd)
+{
+    for (unsigned i = 0; i < nbd->nconns; i++) {
+        struct nbd_conn *c = &nbd->conns[nbd->next_conn++ % nbd->nconns];
+        if (!c->failed)
+            return c;
+    }
+    return NULL;
+}
+
+/*
+ * Sends request (r), followed by (iov) for writes. Must be called with
+ * (lock) held, which is released while sending. On failure, the request is
+ * completed with an error by the receiving thread of its connection.
+ */
+static void req_send(struct block_nbd *nbd, struct nbd_req *r, uint16_t type,
+        off_t pos, size_t len, const struct iovec *iov, int iovcnt)
+{
+    struct nbd_conn *c = conn_pick(nbd);
+
+    if (c == NULL) {
+        r->error = EIO;
+        r->done = true;
+        if (r->ra != NULL)
+            ra_complete(nbd, r);
+        return;
+    }
+    r->conn = c;
+    pthread_mutex_unlock(&nbd->lock);
+
+    struct nbd_request rq = {
+        .magic = htobe32(NBD_REQUEST_MAGIC),
+        .type = htobe16(type),
+        .cookie = htobe64(r - nbd->reqs),
+        .offset = htobe64(pos),
+        .length = htobe32(len)
+    };
+    pthread_mutex_lock(&c->send_lock);
+    int rc = send_buf(c->fd, &rq, sizeof rq);
+    if (rc == 0 && iov != NULL)
+        rc = send_full(c->fd, iov, iovcnt);
+    pthread_mutex_unlock(&c->send_lock);
+    /*
+     * Part of a request may have been sent, so the connection cannot be used
+     * any more. Shutting it down makes its receiving thread fail all requests
+     * in flight on it.
+     */
+    if (rc == -1) {
+        c->failed = true;
+        shutdown(c->fd, SHUT_RDWR);
+    }
+
+    pthread_mutex_lock(&nbd->lock);
+}
+
+/*
+ * Performs a request, returning 0 on success or -1 with errno set. Must be
+ * called with (lock) held.
+ */
+static int req_run(struct block_nbd *nbd, uint16_t type, off_t pos,
+        size_t len, const struct iovec *iov, int iovcnt)
+{
+    struct nbd_req *r = req_alloc(nbd, true);
+
+    if (type == NBD_CMD_READ) {
+        r->iov = iov;
+        r->iovcnt = iovcnt;
+    }
+    req_send(nbd, r, type, pos, len, (type == NBD_CMD_WRITE) ? iov : NULL,
+            iovcnt);
+    while (!r->done)
+        pthread_cond_wait(&nbd->cond, &nbd->lock);
+    int error = r->error;
+    req_free(nbd, r);
+    if (error != 0) {
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
+
+static void ra_complete(struct block_nbd *nbd, struct nbd_req *r)
+{
+    struct nbd_ra *ra = r->ra;
+
+    if (r->error == 0 && ra->gen == nbd->wgen && nbd->writes == 0) {
+        ra->state = RA_READY;
+        cache_fill(nbd, ra->buf, ra->start, ra->len, ra->gen);
+    }
+    else
+        ra->state = RA_EMPTY;
+    req_free(nbd, r);
+}
+
+/*
+ * Fails all requests in flight on (c). Must be called with (lock) held.
+ */
+static void conn_fail(struct block_nbd *nbd, struct nbd_conn *c)
+{
+    c->failed = true;
+    for (unsigned i = 0; i < NBD_REQS_MAX; i++) {
+        struct nbd_req *r = &nbd->reqs[i];
+        if (!r->busy || r->done || r->conn != c)
+            continue;
+        r->error = EIO;
+        r->done = true;
+        if (r->ra != NULL)
+            ra_complete(nbd, r);
+    }
+    pthread_cond_broadcast(&nbd->cond);
+}
+
+static int recv_iov(int fd, const struct iovec *iov, int iovcnt)
+{
+    for (int i = 0; i < iovcnt; i++) {
+        if (recv_full(fd, iov[i].iov_base, iov[i].iov_len) == -1)
+            return -1;
+    }
+    return 0;
+}
+
+static void *conn_thread(void *arg)
+{
+    struct nbd_conn *c = arg;
+    struct block_nbd *nbd = c->nbd;
+    struct nbd_reply rp;
+
+    for (;;) {
+        if (recv_full(c->fd, &rp, sizeof rp) == -1)
+            break;
+        uint64_t cookie = be64toh(rp.cookie);
+        if (be32toh(rp.magic) != NBD_REPLY_MAGIC || cookie >= NBD_REQS_MAX)
+            break;
+        pthread_mutex_lock(&nbd->lock);
+        struct nbd_req *r = &nbd->reqs[cookie];
+        bool valid = r->busy && !r->done && r->conn == c;
+        pthread_mutex_unlock(&nbd->lock);
+        if (!valid)
+            break;
+        /*
+         * The request is ours until completed, so its data can be received
+         * without holding the lock.
+         */
+        int error = be32toh(rp.error);
+        if (error == 0 && r->iov != NULL &&
+                recv_iov(c->fd, r->iov, r->iovcnt) == -1)
+            break;
+        pthread_mutex_lock(&nbd->lock);
+        r->error = (error == 0) ? 0 : (error == EROFS || error == ENOSPC) ?
+            error : EIO;
+        r->done = true;
+        if (r->ra != NULL)
+            ra_complete(nbd, r);
+        pthread_cond_broadcast(&nbd->cond);
+        pthread_mutex_unlock(&nbd->lock);
+    }
+
+    warnx("NBD: Connection lost");
+    pthread_mutex_lock(&nbd->lock);
+    conn_fail(nbd, c);
+    pthread_mutex_unlock(&nbd->lock);
+    return NULL;
+}
+
+/*
+ * Handshake.
+ */
+struct nbd_spec {
+    char *host;                 /* NULL for nbd+unix:// */
+    char *port;
+    char *socket;
+    char *name;
+};
+
+static void parse_spec(char *spec, struct nbd_spec *s)
+{
+    memset(s, 0, sizeof *s);
+    if (strncmp(spec, "nbd+unix://", 11) == 0) {
+        char *p = spec + 11;
+        char *q = strstr(p, "?socket=");
+        if (*p != '/' || q == NULL || q[8] == '\0')
+            errx(1, "%s: Expected nbd+unix:///[EXPORT]?socket=PATH", spec);
+        *q = '\0';
+        s->name = p + 1;
+        s->socket = q + 8;
+        return;
+    }
+
+    char *p = spec + 6;
+    char *slash = strchr(p, '/');
+    if (slash != NULL) {
+        *slash = '\0';
+        s->name = slash + 1;
+    }
+    else
+        s->name = "";
+    if (*p == '[') {
+        char *end = strchr(p, ']');
+        if (end == NULL || (end[1] != '\0' && end[1] != ':'))
+            errx(1, "nbd://%s: Malformed address", p);
+        *end = '\0';
+        s->host = p + 1;
+        if (end[1] == ':')
+            s->port = end + 2;
+    }
+    else {
+        char *colon = strchr(p, ':');
+        if (colon != NULL) {
+            *colon = '\0';
+            s->port = colon + 1;
+        }
+        s->host = p;
+    }
+    if (*s->host == '\0')
+        errx(1, "nbd://: Missing host");
+    if (s->port == NULL || *s->port == '\0')
+        s->port = "10809";
+}
+
+static int nbd_connect(const struct nbd_spec *s)
+{
+    int fd;
+
+    if (s->socket != NULL) {
+        struct sockaddr_un sa = { .sun_family = AF_UNIX };
+        if (strlen(s->socket) >= sizeof sa.sun_path)
+            errx(1, "%s: NBD socket path too long", s->socket);
+        strcpy(sa.sun_path, s->socket);
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd == -1)
+            err(1, "socket");
+        if (connect(fd, (struct sockaddr *)&sa, sizeof sa) == -1)
+            err(1, "%s: Could not connect to NBD server", s->socket);
+        return fd;
+    }
+
+    struct addrinfo hints = {
+        .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM
+    };
+    struct addrinfo *res, *ai;
+    int rc = getaddrinfo(s->host, s->port, &hints, &res);
+    if (rc != 0)
+        errx(1, "%s:%s: %s", s->host, s->port, gai_strerror(rc));
+    fd = -1;
+    for (ai = res; ai != NULL; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC,
+                ai->ai_protocol);
+        if (fd == -1)
+            continue;
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+            break;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd == -1)
+        err(1, "%s:%s: Could not connect to NBD server", s->host, s->port);
+    /*
+     * Requests are small and latency-sensitive.
+     */
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+    return fd;
+}
+
+struct nbd_export {
+    uint64_t size;
+    uint16_t tflags;
+    uint32_t min_block;
+    uint32_t pref_block;
+};
+
+static void recv_or_die(int fd, void *buf, size_t len)
+{
+    if (recv_full(fd, buf, len) == -1)
+        err(1, "NBD: Handshake failed");
+}
+
+static void send_or_die(int fd, const void *buf, size_t len)
+{
+    if (send_buf(fd, buf, len) == -1)
+        err(1, "NBD: Handshake failed");
+}
+
+static void send_opt(int fd, uint32_t opt, uint32_t len)
+{
+    struct {
+        uint64_t magic;
+        uint32_t opt;
+        uint32_t len;
+    } __attribute__((packed)) h = {
+        .magic = htobe64(NBD_OPTS_MAGIC),
+        .opt = htobe32(opt),
+        .len = htobe32(len)
+    };
+
+    send_or_die(fd, &h, sizeof h);
+}
+
+/*
+ * Selects the export with NBD_OPT_GO, which also returns its preferred block
+ * size. Returns false if the server does not support NBD_OPT_GO.
+ */
+static bool handshake_go(int fd, const char *name, struct nbd_export *ex)
+{
+    uint32_t namelen = strlen(name);
+    uint32_t be_namelen = htobe32(namelen);
+    uint16_t info[2] = { htobe16(1), htobe16(NBD_INFO_BLOCK_SIZE) };
+
+    send_opt(fd, NBD_OPT_GO, 4 + namelen + sizeof info);
+    send_or_die(fd, &be_namelen, 4);
+    send_or_die(fd, name, namelen);
+    send_or_die(fd, info, sizeof info);
+
+    bool have_export = false;
+    for (;;) {
+        struct {
+            uint64_t magic;
+            uint32_t opt;
+            uint32_t type;
+            uint32_t len;
+        } __attribute__((packed)) rep;
+        recv_or_die(fd, &rep, sizeof rep);
+        uint32_t type = be32toh(rep.type);
+        uint32_t len = be32toh(rep.len);
+        if (be64toh(rep.magic) != NBD_REP_MAGIC || len > 4096)
+            errx(1, "NBD: Malformed reply from server");
+        uint8_t data[4096 + 1];
+        recv_or_die(fd, data, len);
+
+        if (type == NBD_REP_ACK) {
+            if (!have_export)
+                errx(1, "NBD: Server did not describe export");
+            return true;
+        }
+        if (type == NBD_REP_ERR_UNSUP)
+            return false;
+        if (type & 0x80000000U) {
+            data[len] = '\0';
+            errx(1, "NBD: Export '%s' not available (error 0x%x%s%s)", name,
+                    type, len ? ": " : "", (char *)data);
+        }
+        if (type != NBD_REP_INFO || len < 2)
+            continue;
+        uint16_t info_type = be16toh(*(uint16_t *)data);
+        if (info_type == NBD_INFO_EXPORT && len >= 12) {
+            uint64_t size;
+            uint16_t tflags;
+            memcpy(&size, data + 2, 8);
+            memcpy(&tflags, data + 10, 2);
+            ex->size = be64toh(size);
+            ex->tflags = be16toh(tflags);
+            have_export = true;
+        }
+        else if (info_type == NBD_INFO_BLOCK_SIZE && len >= 14) {
+            uint32_t v[2];
+            memcpy(v, data + 2, 8);
+            ex->min_block = be32toh(v[0]);
+            ex->pref_block = be32toh(v[1]);
+        }
+    }
+}
+
+static int handshake(const struct nbd_spec *s, struct nbd_export *ex)
+{
+    int fd = nbd_connect(s);
+    struct {
+        uint64_t magic;
+        uint64_t opts_magic;
+        uint16_t flags;
+    } __attribute__((packed)) greeting;
+
+    recv_or_die(fd, &greeting, sizeof greeting);
+    if (be64toh(greeting.magic) != NBD_MAGIC ||
+            be64toh(greeting.opts_magic) != NBD_OPTS_MAGIC)
+        errx(1, "NBD: Server does not support the newstyle protocol");
+    uint32_t flags = be16toh(greeting.flags) &
+        (NBD_FLAG_FIXED_NEWSTYLE | NBD_FLAG_NO_ZEROES);
+    uint32_t be_flags = htobe32(flags);
+    send_or_die(fd, &be_flags, 4);
+
+    memset(ex, 0, sizeof *ex);
+    if ((flags & NBD_FLAG_FIXED_NEWSTYLE) && handshake_go(fd, s->name, ex))
+        return fd;
+
+    size_t namelen = strlen(s->name);
+    send_opt(fd, NBD_OPT_EXPORT_NAME, namelen);
+    send_or_die(fd, s->name, namelen);
+    struct {
+        uint64_t size;
+        uint16_t tflags;
+    } __attribute__((packed)) rep;
+    uint8_t zeroes[124];
+    /*
+     * The server closes the connection if the export does not exist.
+     */
+    if (recv_full(fd, &rep, sizeof rep) == -1)
+        errx(1, "NBD: Export '%s' not available", s->name);
+    if (!(flags & NBD_FLAG_NO_ZEROES))
+        recv_or_die(fd, zeroes, sizeof zeroes);
+    ex->size = be64toh(rep.size);
+    ex->tflags = be16toh(rep.tflags);
+    return fd;
+}
+
+static char *parse_opts(char *spec, unsigned *nconns)
+{
+    char *cache = NULL;
+    char *opt = strchr(spec, ',');
+
+    *nconns = 1;
+    while (opt != NULL) {
+        *opt++ = '\0';
+        char *next = strchr(opt, ',');
+        if (next != NULL)
+            *next = '\0';
+        if (strncmp(opt, "conns=", 6) == 0) {
+            char *end;
+            unsigned long v = strtoul(opt + 6, &end, 10);
+            if (opt[6] == '\0' || *end != '\0' || v < 1 ||
+                    v > BLOCK_NBD_CONNS_MAX)
+                errx(1, "%s: conns must be between 1 and %d", spec,
+                        BLOCK_NBD_CONNS_MAX);
+            *nconns = v;
+        }
+        else if (strncmp(opt, "cache=", 6) == 0 && opt[6] != '\0')
+            cache = opt + 6;
+        else
+            errx(1, "%s: Unknown option: %s", spec, opt);
+        if (next != NULL)
+            *next = ',';
+        opt = next;
+    }
+    return cache;
+}
+
+struct block_nbd *block_nbd_attach(char *spec, unsigned bs, off_t *capacity,
+        uint16_t *block_size)
+{
+    struct block_nbd *nbd = calloc(1, sizeof *nbd);
+    if (nbd == NULL)
+        err(1, "malloc");
+
+    unsigned nconns;
+    char *cache = parse_opts(spec, &nconns);
+    char *name = strdup(spec);
+    if (name == NULL)
+        err(1, "malloc");
+    struct nbd_spec s;
+    parse_spec(spec, &s);
+
+    struct nbd_export ex;
+    nbd->conns[0].fd = handshake(&s, &ex);
+    nbd->tflags = ex.tflags;
+    if (nconns > 1 && !(ex.tflags & NBD_TFLAG_CAN_MULTI_CONN)) {
+        warnx("%s: Server does not allow multiple connections, using 1",
+                name);
+        nconns = 1;
+    }
+    for (unsigned i = 1; i < nconns; i++) {
+        struct nbd_export ex2;
+        nbd->conns[i].fd = handshake(&s, &ex2);
+        if (ex2.size != ex.size)
+            errx(1, "%s: Export changed while connecting", name);
+    }
+    nbd->nconns = nconns;
+
+    if (bs == BLOCK_SIZE_DETECT) {
+        bs = ex.pref_block;
+        if (bs < BLOCK_SIZE_MIN || bs > BLOCK_SIZE_MAX || (bs & (bs - 1)))
+            bs = BLOCK_SIZE_MIN;
+    }
+    else if (bs == BLOCK_SIZE_DEFAULT)
+        bs = BLOCK_SIZE_MIN;
+    if (ex.min_block > bs)
+        errx(1, "%s: Block size %u is smaller than the server's minimum of "
+                "%u", name, bs, (unsigned)ex.min_block);
+    /*
+     * A partial block at the end of the device cannot be accessed.
+     */
+    nbd->capacity = ex.size - ex.size % bs;
+    if (nbd->capacity < (off_t)bs)
+        errx(1, "%s: Export must be at least 1 block (%u bytes) in size",
+                name, bs);
+
+    pthread_mutex_init(&nbd->lock, NULL);
+    pthread_cond_init(&nbd->cond, NULL);
+    nbd->nfree = NBD_REQS_MAX;
+    nbd->ra_window = NBD_RA_MIN;
+    nbd->ra_next = -1;
+    for (unsigned i = 0; i < 2; i++) {
+        nbd->ra[i].buf = malloc(NBD_RA_MAX);
+        if (nbd->ra[i].buf == NULL)
+            err(1, "malloc");
+    }
+    nbd->cachefd = -1;
+    if (cache != NULL)
+        cache_attach(nbd, cache);
+
+    for (unsigned i = 0; i < nconns; i++) {
+        struct nbd_conn *c = &nbd->conns[i];
+        c->nbd = nbd;
+        pthread_mutex_init(&c->send_lock, NULL);
+        if (pthread_create(&c->thread, NULL, conn_thread, c) != 0)
+            errx(1, "%s: Could not create thread", name);
+    }
+    free(name);
+
+    *capacity = nbd->capacity;
+    *block_size = bs;
+    return nbd;
+}
+
+int block_nbd_fd(struct block_nbd *nbd)
+{
+    return nbd->conns[0].fd;
+}
+
+/*
+ * I/O.
+ */
+static size_t iov_len(const struct iovec *iov, int iovcnt)
+{
+    size_t len = 0;
+
+    for (int i = 0; i < iovcnt; i++)
+        len += iov[i].iov_len;
+    return len;
+}
+
+static void iov_from_buf(const struct iovec *iov, int iovcnt,
+        const uint8_t *buf)
+{
+    for (int i = 0; i < iovcnt; i++) {
+        memcpy(iov[i].iov_base, buf, iov[i].iov_len);
+        buf += iov[i].iov_len;
+    }
+}
+
+/*
+ * Starts reading ahead up to (window) bytes after the data already read
+ * ahead, into a segment not in use. Must be called with (lock) held.
+ */
+static void ra_start(struct block_nbd *nbd, off_t pos)
+{
+    if (nbd->ra_end < pos)
+        nbd->ra_end = pos;
+    if (nbd->ra_end >= nbd->capacity ||
+            nbd->ra_end - pos >= (off_t)nbd->ra_window)
+        return;
+
+    struct nbd_ra *ra = NULL;
+    for (unsigned i = 0; i < 2; i++) {
+        struct nbd_ra *x = &nbd->ra[i];
+        /*
+         * Segments already read, or left over from an earlier sequence of
+         * reads, can be reused.
+         */
+        if (x->state == RA_EMPTY || (x->state == RA_READY &&
+                    (x->start + (off_t)x->len <= pos ||
+                     x->start >= nbd->ra_end))) {
+            ra = x;
+            break;
+        }
+    }
+    if (ra == NULL)
+        return;
+
+    size_t len = nbd->ra_window;
+    if (nbd->ra_end + (off_t)len > nbd->capacity)
+        len = nbd->capacity - nbd->ra_end;
+    off_t start = nbd->ra_end;
+    nbd->ra_end += len;
+    if (cache_covers(nbd, start, len))
+        return;
+    struct nbd_req *r = req_alloc(nbd, false);
+    if (r == NULL)
+        return;
+    ra->state = RA_PENDING;
+    ra->start = start;
+    ra->len = len;
+    ra->gen = nbd->wgen;
+    r->ra = ra;
+    r->ra_iov.iov_base = ra->buf;
+    r->ra_iov.iov_len = len;
+    r->iov = &r->ra_iov;
+    r->iovcnt = 1;
+    req_send(nbd, r, NBD_CMD_READ, start, len, NULL, 0);
+}
+
+/*
+ * Serves a read from the data read ahead, waiting for it to arrive if it is
+ * being read. Returns false if not read ahead. Must be called with (lock)
+ * held.
+ */
+static bool ra_read(struct block_nbd *nbd, const struct iovec *iov,
+        int iovcnt, off_t pos, size_t len)
+{
+    for (;;) {
+        bool pending = false;
+        for (unsigned i = 0; i < 2; i++) {
+            struct nbd_ra *ra = &nbd->ra[i];
+            if (ra->state == RA_EMPTY || pos < ra->start ||
+                    pos + (off_t)len > ra->start + (off_t)ra->len)
+                continue;
+            if (ra->state == RA_READY) {
+                iov_from_buf(iov, iovcnt, ra->buf + (pos - ra->start));
+                return true;
+            }
+            pending = true;
+        }
+        if (!pending)
+            return false;
+        pthread_cond_wait(&nbd->cond, &nbd->lock);
+    }
+}
+
+ssize_t block_nbd_preadv(struct block_nbd *nbd, const struct iovec *iov,
+        int iovcnt, off_t pos)
+{
+    size_t len = iov_len(iov, iovcnt);
+    int rc = 0;
+
+    pthread_mutex_lock(&nbd->lock);
+    /*
+     * Sequential reads grow the window, others reset it and stop reading
+     * ahead.
+     */
+    bool sequential = (pos == nbd->ra_next);
+    nbd->ra_next = pos + len;
+    if (sequential) {
+        if (nbd->ra_window < NBD_RA_MAX)
+            nbd->ra_window *= 2;
+    }
+    else {
+        nbd->ra_window = NBD_RA_MIN;
+        nbd->ra_end = 0;
+    }
+
+    if (cache_covers(nbd, pos, len)) {
+        int cachefd = nbd->cachefd;
+        if (sequential)
+            ra_start(nbd, pos + len);
+        pthread_mutex_unlock(&nbd->lock);
+        ssize_t nbytes = preadv(cachefd, iov, iovcnt, pos);
+        return (nbytes == (ssize_t)len) ? nbytes : -1;
+    }
+    if (!ra_read(nbd, iov, iovcnt, pos, len)) {
+        if (nbd->cachefd == -1)
+            rc = req_run(nbd, NBD_CMD_READ, pos, len, iov, iovcnt);
+        else {
+            /*
+             * Read whole clusters, so that they can be cached.
+             */
+            off_t start = pos - pos % NBD_CLUSTER_SIZE;
+            off_t end = pos + len + NBD_CLUSTER_SIZE - 1;
+            end -= end % NBD_CLUSTER_SIZE;
+            if (end > nbd->capacity)
+                end = nbd->capacity;
+            uint8_t *buf = malloc(end - start);
+            if (buf == NULL) {
+                pthread_mutex_unlock(&nbd->lock);
+                return -1;
+            }
+            struct iovec biov = { .iov_base = buf, .iov_len = end - start };
+            uint64_t gen = nbd->wgen;
+            bool clean = (nbd->writes == 0);
+            rc = req_run(nbd, NBD_CMD_READ, start, end - start, &biov, 1);
+            if (rc == 0) {
+                iov_from_buf(iov, iovcnt, buf + (pos - start));
+                if (clean)
+                    cache_fill(nbd, buf, start, end - start, gen);
+            }
+            free(buf);
+        }
+    }
+    if (sequential && rc == 0)
+        ra_start(nbd, pos + len);
+    pthread_mutex_unlock(&nbd->lock);
+    return (rc == 0) ? (ssize_t)len : -1;
+}
+
+/*
+ * Discards the data read ahead and cached for [pos, pos + len) before it is
+ * modified, and marks a modification as started. Must be called with (lock)
+ * held.
+ */
+static void write_start(struct block_nbd *nbd, off_t pos, off_t len)
+{
+    nbd->wgen++;
+    nbd->writes++;
+    cache_invalidate(nbd, pos, len);
+    for (unsigned i = 0; i < 2; i++) {
+        struct nbd_ra *ra = &nbd->ra[i];
+        if (ra->state == RA_READY && pos < ra->start + (off_t)ra->len &&
+                pos + len > ra->start)
+            ra->state = RA_EMPTY;
+    }
+}
+
+static void write_end(struct block_nbd *nbd)
+{
+    nbd->wgen++;
+    nbd->writes--;
+}
+
+ssize_t block_nbd_pwritev(struct block_nbd *nbd, const struct iovec *iov,
+        int iovcnt, off_t pos)
+{
+    size_t len = iov_len(iov, iovcnt);
+
+    pthread_mutex_lock(&nbd->lock);
+    write_start(nbd, pos, len);
+    int rc = req_run(nbd, NBD_CMD_WRITE, pos, len, iov, iovcnt);
+    write_end(nbd);
+    pthread_mutex_unlock(&nbd->lock);
+    return (rc == 0) ? (ssize_t)len : -1;
+}
+
+int block_nbd_flush(struct block_nbd *nbd)
+{
+    if (!(nbd->tflags & NBD_TFLAG_SEND_FLUSH))
+        return 0;
+    pthread_mutex_lock(&nbd->lock);
+    int rc = req_run(nbd, NBD_CMD_FLUSH, 0, 0, NULL, 0);
+    pthread_mutex_unlock(&nbd->lock);
+    return rc;
+}
+
+/*
+ * Performs (type) on [pos, pos + len), in requests of at most 1GB.
+ */
+static int range_run(struct block_nbd *nbd, uint16_t type, off_t pos,
+        off_t len)
+{
+    int rc = 0;
+
+    pthread_mutex_lock(&nbd->lock);
+    write_start(nbd, pos, len);
+    while (rc == 0 && len > 0) {
+        off_t n = (len < (1 << 30)) ? len : (1 << 30);
+        rc = req_run(nbd, type, pos, n, NULL, 0);
+        pos += n;
+        len -= n;
+    }
+    write_end(nbd);
+    pthread_mutex_unlock(&nbd->lock);
+    return rc;
+}
+
+int block_nbd_trim(struct block_nbd *nbd, off_t pos, off_t len)
+{
+    if (!(nbd->tflags & NBD_TFLAG_SEND_TRIM))
+        return 0;
+    return range_run(nbd, NBD_CMD_TRIM, pos, len);
+}
+
+int block_nbd_write_zeroes(struct block_nbd *nbd, off_t pos, off_t len)
+{
+    if (!(nbd->tflags & NBD_TFLAG_SEND_WRITE_ZEROES)) {
+        errno = ENOTSUP;
+        return -1;
+    }
+    return range_run(nbd, NBD_CMD_WRITE_ZEROES, pos, len);
+}
@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * block_nbd.h: Common functions for attaching to remote block devices using
+ * the NBD protocol.
+ */
+
+#ifndef COMMON_BLOCK_NBD_H
+#define COMMON_BLOCK_NBD_H
+
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+struct block_nbd;
+
+/*
+ * Maximum number of connections to an NBD server per device.
+ */
+#define BLOCK_NBD_CONNS_MAX 8
+
+/*
+ * Returns true if (path) names an NBD export, either
+ * "nbd://HOST[:PORT][/EXPORT]" or "nbd+unix:///[EXPORT]?socket=PATH",
+ * optionally followed by options, and should be attached using
+ * block_nbd_attach().
+ */
+bool block_nbd_is_spec(const char *path);
+
+/*
+ * Attach to the NBD export (spec), with the options following it:
+ *
+ *   ,conns=N    Use N connections, if the server allows it. Requests are
+ *               spread over connections, and several requests may be in
+ *               flight on each.
+ *   ,cache=FILE Keep the data read from the export in the sparse local FILE,
+ *               which has the same layout as the export, and serve later
+ *               reads of the same data from it. FILE is created if it does
+ *               not exist, and kept across runs, so it must only be used with
+ *               exports which are only modified through it.
+ *
+ * (bs), (*capacity) and (*block_size) are as for block_attach(); with
+ * BLOCK_SIZE_DETECT, the block size is that preferred by the server. Exits
+ * with an error message on failure.
+ *
+ * Sequential reads are detected, and read ahead in windows growing up to
+ * 2MB.
+ */
+struct block_nbd *block_nbd_attach(char *spec, unsigned bs, off_t *capacity,
+        uint16_t *block_size);
+
+/*
+ * Returns a descriptor of (nbd), the socket of its first connection.
+ */
+int block_nbd_fd(struct block_nbd *nbd);
+
+/*
+ * As for preadv() and pwritev() on the device. Returns -1 if any part of the
+ * request could not be performed. Requests must be within the capacity of the
+ * device. Concurrent calls are safe.
+ */
+ssize_t block_nbd_preadv(struct block_nbd *nbd, const struct iovec *iov,
+        int iovcnt, off_t pos);
+ssize_t block_nbd_pwritev(struct block_nbd *nbd, const struct iovec *iov,
+        int iovcnt, off_t pos);
+
+/*
+ * Makes the writes completed on (nbd) durable on the server. Returns 0 on
+ * success, -1 on error.
+ */
+int block_nbd_flush(struct block_nbd *nbd);
+
+/*
+ * Discards (len) bytes at (pos) on (nbd), if supported by the server.
+ * Returns 0 on success, including if not supported, -1 on error.
+ */
+int block_nbd_trim(struct block_nbd *nbd, off_t pos, off_t len);
+
+/*
+ * Writes (len) zero bytes at (pos) on (nbd) without transferring them.
+ * Returns 0 on success, or -1 on error, with errno set to ENOTSUP if not
+ * supported by the server.
+ */
+int block_nbd_write_zeroes(struct block_nbd *nbd, off_t pos, off_t len);
+
+#endif /* COMMON_BLOCK_NBD_H */
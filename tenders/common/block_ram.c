@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * block_ram.c: RAM-backed scratch block devices.
+ */
+
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+#include <err.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "block_attach.h"
+#include "block_ram.h"
+
+#define HUGEPAGE_SIZE (2UL * 1024 * 1024)
+
+bool block_ram_is_spec(const char *path)
+{
+    return strncmp(path, "ram:", 4) == 0;
+}
+
+/*
+ * Parse SIZE[:huge] from (spec). Returns false if it is invalid.
+ */
+static bool parse_spec(const char *spec, uint64_t *size, bool *huge)
+{
+    char *end;
+
+    if (*spec < '0' || *spec > '9')
+        return false;
+    errno = 0;
+    unsigned long long v = strtoull(spec, &end, 10);
+    if (errno != 0)
+        return false;
+    unsigned shift = 0;
+    switch (*end) {
+    case 'K':
+        shift = 10;
+        end++;
+        break;
+    case 'M':
+        shift = 20;
+        end++;
+        break;
+    case 'G':
+        shift = 30;
+        end++;
+        break;
+    }
+    if (v > (UINT64_MAX >> 1) >> shift)
+        return false;
+    *size = v << shift;
+    *huge = false;
+    if (strcmp(end, ":huge") == 0)
+        *huge = true;
+    else if (*end != '\0')
+        return false;
+    return true;
+}
+
+#if defined(__linux__)
+
+/*
+ * Create a memfd of (len) bytes with (mfd_flags) and map it, returning the
+ * mapping and the descriptor in (*fd), or MAP_FAILED.
+ */
+static uint8_t *ram_create(const char *path, size_t len, unsigned mfd_flags,
+        int *fd)
+{
+    *fd = memfd_create("solo5-block-ram", MFD_CLOEXEC | mfd_flags);
+    if (*fd == -1)
+        return MAP_FAILED;
+    if (ftruncate(*fd, len) == -1)
+        err(1, "%s: Could not set size", path);
+    /*
+     * Huge pages are reserved for shared mappings when mapped, so this fails
+     * rather than the first access to a page which cannot be had.
+     */
+    uint8_t *p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0);
+    if (p == MAP_FAILED)
+        close(*fd);
+    return p;
+}
+
+int block_ram_attach(const char *path, unsigned bs, off_t *capacity,
+        uint16_t *block_size, uint8_t **mem, bool *huge)
+{
+    uint64_t size;
+
+    if (!parse_spec(path + 4, &size, huge))
+        errx(1, "Invalid RAM block device: '%s'", path);
+    if (bs == BLOCK_SIZE_DEFAULT)
+        bs = BLOCK_SIZE_MIN;
+    else if (bs == BLOCK_SIZE_DETECT)
+        bs = BLOCK_SIZE_MAX;
+    size -= size % bs;
+    if (size < bs)
+        errx(1, "%s: Size must be at least 1 block (%u bytes)", path, bs);
+    if (size > SIZE_MAX / 2)
+        errx(1, "%s: Size too large", path);
+
+    int fd = -1;
+    uint8_t *p = MAP_FAILED;
+    if (*huge) {
+        size_t len = (size + HUGEPAGE_SIZE - 1) & ~(HUGEPAGE_SIZE - 1);
+        p = ram_create(path, len, MFD_HUGETLB, &fd);
+        if (p == MAP_FAILED) {
+            *huge = false;
+            p = ram_create(path, size, 0, &fd);
+            if (p != MAP_FAILED &&
+                    madvise(p, size, MADV_HUGEPAGE) == -1)
+                warn("%s: Could not request transparent huge pages", path);
+        }
+    }
+    else
+        p = ram_create(path, size, 0, &fd);
+    if (p == MAP_FAILED)
+        err(1, "%s: Could not allocate %llu bytes", path,
+                (unsigned long long)size);
+
+    *capacity = size;
+    *block_size = bs;
+    *mem = p;
+    return fd;
+}
+
+#else /* !__linux__ */
+
+int block_ram_attach(const char *path, unsigned bs, off_t *capacity,
+        uint16_t *block_size, uint8_t **mem, bool *huge)
+{
+    uint64_t size;
+
+    (void)bs;
+    (void)capacity;
+    (void)block_size;
+    (void)mem;
+    if (!parse_spec(path + 4, &size, huge))
+        errx(1, "Invalid RAM block device: '%s'", path);
+    errx(1, "%s: RAM block devices are not supported on this host", path);
+}
+
+#endif /* __linux__ */
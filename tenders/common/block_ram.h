@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * block_ram.h: RAM-backed scratch block devices.
+ */
+
+#ifndef COMMON_BLOCK_RAM_H
+#define COMMON_BLOCK_RAM_H
+
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Returns true if (path) given to --block is of the form "ram:...".
+ */
+bool block_ram_is_spec(const char *path);
+
+/*
+ * Create the RAM-backed block device specified by "ram:SIZE[:huge]" (path),
+ * where SIZE is a number of bytes with an optional K, M or G (binary) suffix.
+ * The device is an anonymous file (memfd), initially zeroed, which lives
+ * only as long as the tender. Returns its file descriptor, the device
+ * capacity in bytes in (*capacity) and its block size in (*block_size), which
+ * is (bs) or, if BLOCK_SIZE_DEFAULT or BLOCK_SIZE_DETECT, 512 or 4096 bytes
+ * respectively. Any partial block at the end of SIZE is not included in the
+ * capacity.
+ *
+ * The file is also mapped shared and writable into the tender, at (*mem), so
+ * that requests can be served with memcpy() rather than through the file
+ * system. With ":huge", the file is backed by huge pages reserved on the host
+ * (MAP_HUGETLB), if enough are available, or else transparent huge pages are
+ * requested for it, and (*huge) is set if the former succeeded. Such files
+ * cannot be read or written through their descriptor.
+ *
+ * Exits on failure, or if not supported on this host (only Linux supports
+ * RAM-backed devices).
+ */
+int block_ram_attach(const char *path, unsigned bs, off_t *capacity,
+        uint16_t *block_size, uint8_t **mem, bool *huge);
+
+#endif /* COMMON_BLOCK_RAM_H */
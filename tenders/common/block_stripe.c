@@ -0,0 +1,437 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * block_stripe.c: Common functions for block devices striped across several
+ * backing files or devices.
+ *
+ * A request is split into pieces, one for each part of an iovec segment
+ * within a stripe unit. With io_uring, each piece is queued on the ring of
+ * its member and all rings are submitted before waiting for any completion,
+ * so that members perform their parts of the request in parallel. A thread
+ * performing a request uses a lane, a set of rings with one for each member,
+ * of its own, so that up to STRIPE_LANES requests are in flight at once.
+ * Without io_uring, the parts on each member are performed in turn, each with
+ * a single preadv() or pwritev(), since the units of a request on one member
+ * are contiguous there.
+ */
+
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "block_attach.h"
+#include "block_stripe.h"
+#include "block_uring.h"
+
+#define STRIPE_LANES 4
+#define STRIPE_RING_ENTRIES 64
+#define STRIPE_UNIT_MAX (64UL << 20)
+
+struct stripe_lane {
+    struct block_uring rings[BLOCK_STRIPE_MEMBERS_MAX];
+    unsigned inflight[BLOCK_STRIPE_MEMBERS_MAX];
+    bool busy;
+};
+
+struct block_stripe {
+    unsigned n;
+    int fds[BLOCK_STRIPE_MEMBERS_MAX];
+    uint64_t unit;
+    bool use_uring;
+    struct stripe_lane lanes[STRIPE_LANES];
+    pthread_mutex_t lock;       /* Protects (lanes[].busy) */
+    pthread_cond_t cond;
+};
+
+bool block_stripe_is_spec(const char *path)
+{
+    return strncmp(path, "stripe:", 7) == 0;
+}
+
+/*
+ * Returns the member holding (pos), the offset of (pos) on it in (*mpos), and
+ * the number of bytes from (pos) to the end of its unit in (*avail).
+ */
+static unsigned stripe_map(const struct block_stripe *st, off_t pos,
+        off_t *mpos, size_t *avail)
+{
+    uint64_t u = pos / st->unit;
+
+    *mpos = (u / st->n) * st->unit + pos % st->unit;
+    *avail = st->unit - pos % st->unit;
+    return u % st->n;
+}
+
+/*
+ * Returns false if none of the (len) bytes at (pos) are on member (m), and
+ * otherwise the range they cover there in (*mpos, *mlen). Units of the device
+ * on one member follow each other there, so this range is contiguous.
+ */
+static bool stripe_member_range(const struct block_stripe *st, unsigned m,
+        off_t pos, off_t len, off_t *mpos, off_t *mlen)
+{
+    uint64_t n = st->n, unit = st->unit;
+    uint64_t first = pos / unit, last = (pos + len - 1) / unit;
+    uint64_t u0 = first + (m + n - first % n) % n;
+    if (len == 0 || u0 > last)
+        return false;
+    uint64_t u1 = last - (last % n + n - m) % n;
+    uint64_t start = (u0 / n) * unit + ((u0 == first) ? pos % unit : 0);
+    uint64_t end = (u1 / n) * unit +
+        ((u1 == last) ? (pos + len - 1) % unit + 1 : unit);
+    *mpos = start;
+    *mlen = end - start;
+    return true;
+}
+
+static uint64_t parse_unit(const char *s, char **end)
+{
+    uint64_t v = strtoull(s, end, 10);
+
+    if (**end == 'k' || **end == 'K') {
+        v <<= 10;
+        (*end)++;
+    }
+    else if (**end == 'm' || **end == 'M') {
+        v <<= 20;
+        (*end)++;
+    }
+    return v;
+}
+
+struct block_stripe *block_stripe_attach(char *spec, unsigned flags,
+        unsigned bs, off_t *capacity, uint16_t *block_size)
+{
+    struct block_stripe *st = calloc(1, sizeof *st);
+    if (st == NULL)
+        err(1, "malloc");
+
+    char *end;
+    st->unit = parse_unit(spec + 7, &end);
+    if (end == spec + 7 || *end != ':' || st->unit == 0 ||
+            (st->unit & (st->unit - 1)) != 0 || st->unit > STRIPE_UNIT_MAX)
+        errx(1, "%s: Stripe unit must be a power of 2 up to 64m", spec);
+
+    off_t member_cap = -1;
+    char *saveptr;
+    for (char *path = strtok_r(end + 1, ",", &saveptr); path != NULL;
+            path = strtok_r(NULL, ",", &saveptr)) {
+        if (st->n == BLOCK_STRIPE_MEMBERS_MAX)
+            errx(1, "%s: Too many stripe members, at most %d", path,
+                    BLOCK_STRIPE_MEMBERS_MAX);
+        off_t cap;
+        st->fds[st->n] = block_attach(path, flags, bs, &cap, block_size);
+        if (st->n == 0)
+            bs = *block_size;
+        if (member_cap == -1 || cap < member_cap)
+            member_cap = cap;
+        st->n++;
+    }
+    if (st->n < 2)
+        errx(1, "Striped devices need at least two members");
+    if (st->unit % *block_size != 0)
+        errx(1, "Stripe unit must be a multiple of the block size (%u)",
+                (unsigned)*block_size);
+    *capacity = (member_cap / st->unit) * st->unit * st->n;
+    if (*capacity == 0)
+        errx(1, "Stripe members are smaller than a stripe unit");
+
+    pthread_mutex_init(&st->lock, NULL);
+    pthread_cond_init(&st->cond, NULL);
+    st->use_uring = true;
+    for (unsigned l = 0; l < STRIPE_LANES && st->use_uring; l++) {
+        for (unsigned m = 0; m < st->n; m++) {
+            if (block_uring_init(&st->lanes[l].rings[m], st->fds[m],
+                        STRIPE_RING_ENTRIES) == -1) {
+                if (errno != ENOTSUP)
+                    warn("Could not set up io_uring for striped device, "
+                            "not using it");
+                st->use_uring = false;
+                break;
+            }
+        }
+    }
+    return st;
+}
+
+int block_stripe_fd(struct block_stripe *st, unsigned i)
+{
+    return (i < st->n) ? st->fds[i] : -1;
+}
+
+static struct stripe_lane *lane_get(struct block_stripe *st)
+{
+    pthread_mutex_lock(&st->lock);
+    for (;;) {
+        for (unsigned l = 0; l < STRIPE_LANES; l++) {
+            if (!st->lanes[l].busy) {
+                st->lanes[l].busy = true;
+                pthread_mutex_unlock(&st->lock);
+                return &st->lanes[l];
+            }
+        }
+        pthread_cond_wait(&st->cond, &st->lock);
+    }
+}
+
+static void lane_put(struct block_stripe *st, struct stripe_lane *lane)
+{
+    pthread_mutex_lock(&st->lock);
+    lane->busy = false;
+    pthread_cond_signal(&st->cond);
+    pthread_mutex_unlock(&st->lock);
+}
+
+/*
+ * Waits for at least one of the requests in flight on (lane) to complete, and
+ * reaps all completed requests. The tag of a request is the result expected.
+ */
+static void lane_wait(struct block_stripe *st, struct stripe_lane *lane,
+        bool *failed)
+{
+    struct pollfd pfd[BLOCK_STRIPE_MEMBERS_MAX];
+
+    for (;;) {
+        bool reaped = false, inflight = false;
+        unsigned npfd = 0;
+        for (unsigned m = 0; m < st->n; m++) {
+            uint64_t tag;
+            int res;
+            while (block_uring_reap(&lane->rings[m], &tag, &res) == 1) {
+                if (res < 0 || (uint64_t)res != tag)
+                    *failed = true;
+                lane->inflight[m]--;
+                reaped = true;
+            }
+            if (lane->inflight[m] != 0) {
+                pfd[npfd].fd = lane->rings[m].eventfd;
+                pfd[npfd++].events = POLLIN;
+                inflight = true;
+            }
+        }
+        if (reaped || !inflight)
+            return;
+        if (poll(pfd, npfd, -1) == -1 && errno != EINTR)
+            err(1, "poll() failed");
+        for (unsigned i = 0; i < npfd; i++) {
+            uint64_t val;
+            if (pfd[i].revents & POLLIN)
+                (void)read(pfd[i].fd, &val, sizeof val);
+        }
+    }
+}
+
+/*
+ * Submits the requests queued on all rings of (lane). Requests left queued
+ * would later be performed on buffers which may no longer exist, so failing
+ * to submit them is fatal.
+ */
+static void lane_submit(struct block_stripe *st, struct stripe_lane *lane,
+        bool *failed)
+{
+    for (unsigned m = 0; m < st->n; m++) {
+        while (block_uring_submit(&lane->rings[m]) == -1) {
+            if (errno != EAGAIN && errno != EBUSY)
+                err(1, "Could not submit striped device I/O");
+            lane_wait(st, lane, failed);
+        }
+    }
+}
+
+static ssize_t stripe_rw_uring(struct block_stripe *st, bool write,
+        const struct iovec *iov, int iovcnt, off_t pos)
+{
+    struct stripe_lane *lane = lane_get(st);
+    bool failed = false;
+    size_t total = 0;
+
+    for (int i = 0; i < iovcnt; i++) {
+        for (size_t off = 0; off < iov[i].iov_len; ) {
+            off_t mpos;
+            size_t len;
+            unsigned m = stripe_map(st, pos, &mpos, &len);
+            if (len > iov[i].iov_len - off)
+                len = iov[i].iov_len - off;
+            /*
+             * Requests in flight on a ring are bounded by its size, so that
+             * its completion queue cannot overflow.
+             */
+            while (lane->inflight[m] == lane->rings[m].entries ||
+                    block_uring_queue(&lane->rings[m], write,
+                        (uint8_t *)iov[i].iov_base + off, len, mpos,
+                        len) == -1) {
+                lane_submit(st, lane, &failed);
+                lane_wait(st, lane, &failed);
+            }
+            lane->inflight[m]++;
+            off += len;
+            pos += len;
+            total += len;
+        }
+    }
+    lane_submit(st, lane, &failed);
+    for (unsigned m = 0; m < st->n; m++) {
+        while (lane->inflight[m] != 0)
+            lane_wait(st, lane, &failed);
+    }
+    lane_put(st, lane);
+
+    if (failed) {
+        errno = EIO;
+        return -1;
+    }
+    return total;
+}
+
+/*
+ * Performs the parts of a request on member (m) with as few preadv() or
+ * pwritev() calls as IOV_MAX allows.
+ */
+static int stripe_rw_member(struct block_stripe *st, unsigned m, bool write,
+        const struct iovec *iov, int iovcnt, off_t pos)
+{
+    struct iovec miov[64];
+    int miovcnt = 0;
+    off_t start = -1;
+    size_t mlen = 0;
+
+    for (int i = 0; i < iovcnt; i++) {
+        for (size_t off = 0; off < iov[i].iov_len; ) {
+            off_t mpos;
+            size_t len;
+            unsigned pm = stripe_map(st, pos, &mpos, &len);
+            if (len > iov[i].iov_len - off)
+                len = iov[i].iov_len - off;
+            if (pm == m) {
+                if (miovcnt == (int)(sizeof miov / sizeof miov[0])) {
+                    ssize_t ret = write ?
+                        pwritev(st->fds[m], miov, miovcnt, start) :
+                        preadv(st->fds[m], miov, miovcnt, start);
+                    if (ret != (ssize_t)mlen)
+                        return -1;
+                    miovcnt = 0;
+                    start = -1;
+                    mlen = 0;
+                }
+                if (start == -1)
+                    start = mpos;
+                miov[miovcnt].iov_base = (uint8_t *)iov[i].iov_base + off;
+                miov[miovcnt++].iov_len = len;
+                mlen += len;
+            }
+            off += len;
+            pos += len;
+        }
+    }
+    if (miovcnt == 0)
+        return 0;
+    ssize_t ret = write ? pwritev(st->fds[m], miov, miovcnt, start) :
+        preadv(st->fds[m], miov, miovcnt, start);
+    return (ret == (ssize_t)mlen) ? 0 : -1;
+}
+
+static ssize_t stripe_rw(struct block_stripe *st, bool write,
+        const struct iovec *iov, int iovcnt, off_t pos)
+{
+    if (st->use_uring)
+        return stripe_rw_uring(st, write, iov, iovcnt, pos);
+
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; i++)
+        total += iov[i].iov_len;
+    for (unsigned m = 0; m < st->n; m++) {
+        if (stripe_rw_member(st, m, write, iov, iovcnt, pos) == -1)
+            return -1;
+    }
+    return total;
+}
+
+ssize_t block_stripe_preadv(struct block_stripe *st, const struct iovec *iov,
+        int iovcnt, off_t pos)
+{
+    return stripe_rw(st, false, iov, iovcnt, pos);
+}
+
+ssize_t block_stripe_pwritev(struct block_stripe *st, const struct iovec *iov,
+        int iovcnt, off_t pos)
+{
+    return stripe_rw(st, true, iov, iovcnt, pos);
+}
+
+int block_stripe_flush(struct block_stripe *st)
+{
+    if (!st->use_uring) {
+        int rc = 0;
+        for (unsigned m = 0; m < st->n; m++) {
+            if (fdatasync(st->fds[m]) == -1)
+                rc = -1;
+        }
+        return rc;
+    }
+
+    struct stripe_lane *lane = lane_get(st);
+    bool failed = false;
+    for (unsigned m = 0; m < st->n; m++) {
+        while (block_uring_queue_fsync(&lane->rings[m], 0) == -1) {
+            lane_submit(st, lane, &failed);
+            lane_wait(st, lane, &failed);
+        }
+        lane->inflight[m]++;
+    }
+    lane_submit(st, lane, &failed);
+    for (unsigned m = 0; m < st->n; m++) {
+        while (lane->inflight[m] != 0)
+            lane_wait(st, lane, &failed);
+    }
+    lane_put(st, lane);
+    return failed ? -1 : 0;
+}
+
+int block_stripe_fallocate(struct block_stripe *st, int mode, off_t pos,
+        off_t len)
+{
+#if defined(__linux__)
+    for (unsigned m = 0; m < st->n; m++) {
+        off_t mpos, mlen;
+        if (stripe_member_range(st, m, pos, len, &mpos, &mlen) &&
+                fallocate(st->fds[m], mode, mpos, mlen) == -1)
+            return -1;
+    }
+    return 0;
+#else
+    (void)st;
+    (void)mode;
+    (void)pos;
+    (void)len;
+    (void)stripe_member_range;
+    errno = EOPNOTSUPP;
+    return -1;
+#endif
+}
@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * block_stripe.h: Common functions for block devices striped across several
+ * backing files or devices.
+ */
+
+#ifndef COMMON_BLOCK_STRIPE_H
+#define COMMON_BLOCK_STRIPE_H
+
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+struct block_stripe;
+
+/*
+ * Maximum number of members of a striped device.
+ */
+#define BLOCK_STRIPE_MEMBERS_MAX 16
+
+/*
+ * Returns true if (path) names a striped device,
+ * "stripe:UNIT:PATH,PATH[,...]", and should be attached using
+ * block_stripe_attach().
+ */
+bool block_stripe_is_spec(const char *path);
+
+/*
+ * Attach to the striped device (spec). Consecutive stripe units of UNIT
+ * bytes, a power of 2 given with an optional "k" or "m" suffix, are placed
+ * on each member PATH in turn, so that a request spanning several units is
+ * spread over several members. The capacity of the device is that of the
+ * smallest member, rounded down to a whole number of units, times the number
+ * of members.
+ *
+ * Each member is attached with block_attach() and (flags), and (bs),
+ * (*capacity) and (*block_size) are as for block_attach(); with
+ * BLOCK_SIZE_DETECT, the block size is that of the first member, which all
+ * others must support. UNIT must be a multiple of the block size. Exits with
+ * an error message on failure.
+ */
+struct block_stripe *block_stripe_attach(char *spec, unsigned flags,
+        unsigned bs, off_t *capacity, uint16_t *block_size);
+
+/*
+ * Returns the descriptor of member (i) of (st), or -1 if it has fewer
+ * members.
+ */
+int block_stripe_fd(struct block_stripe *st, unsigned i);
+
+/*
+ * As for preadv() and pwritev() on the device. The parts of a request on
+ * different members are performed in parallel, using io_uring if supported by
+ * the host. Returns -1 if any part of the request could not be performed.
+ * Requests must be within the capacity of the device. Concurrent calls are
+ * safe.
+ */
+ssize_t block_stripe_preadv(struct block_stripe *st, const struct iovec *iov,
+        int iovcnt, off_t pos);
+ssize_t block_stripe_pwritev(struct block_stripe *st, const struct iovec *iov,
+        int iovcnt, off_t pos);
+
+/*
+ * Makes the writes completed on (st) durable on all members. Returns 0 on
+ * success, -1 on error.
+ */
+int block_stripe_flush(struct block_stripe *st);
+
+/*
+ * As for fallocate() with (mode) on the (len) bytes at (pos) of the device,
+ * for each member. Returns 0 on success, or -1 on error, with errno set to
+ * EOPNOTSUPP if a member does not support (mode).
+ */
+int block_stripe_fallocate(struct block_stripe *st, int mode, off_t pos,
+        off_t len);
+
+#endif /* COMMON_BLOCK_STRIPE_H */
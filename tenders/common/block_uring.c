@@ -0,0 +1,461 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * block_uring.c: Common functions for performing block I/O using io_uring.
+ */
+
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#endif
+
+#include "block_uring.h"
+
+#if defined(__linux__)
+
+static int uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uring_enter(int ringfd, unsigned to_submit)
+{
+    return syscall(__NR_io_uring_enter, ringfd, to_submit, 0, 0, NULL, 0);
+}
+
+static int uring_register(int ringfd, unsigned opcode, const void *arg,
+        unsigned nr_args)
+{
+    return syscall(__NR_io_uring_register, ringfd, opcode, arg, nr_args);
+}
+
+/*
+ * Reserve a sparse table of (nbuffers) registered buffer slots, which
+ * requires Linux 5.19. Returns 0 on success, or -1 if not supported.
+ */
+static int uring_reserve_buffers(int ringfd, unsigned nbuffers)
+{
+#if defined(IORING_RSRC_REGISTER_SPARSE)
+    struct io_uring_rsrc_register rr;
+
+    memset(&rr, 0, sizeof rr);
+    rr.nr = nbuffers;
+    rr.flags = IORING_RSRC_REGISTER_SPARSE;
+    return uring_register(ringfd, IORING_REGISTER_BUFFERS2, &rr, sizeof rr);
+#else
+    (void)ringfd;
+    (void)nbuffers;
+    return -1;
+#endif
+}
+
+/*
+ * The ring is created disabled, so that the restrictions below can be applied
+ * before any requests are accepted. Once enabled, the ring can only be used
+ * to read and write (and, if (fsync), fsync) the registered device, and no
+ * further registrations are possible, except of buffers into the (*nbuffers)
+ * slots reserved here, if any; (*nbuffers) is set to 0 if they could not be.
+ * (efd) is -1 if completions are not to be signalled.
+ */
+static int uring_restrict(int ringfd, int fd, int efd, int fsync,
+        unsigned *nbuffers)
+{
+    struct io_uring_restriction res[8];
+    unsigned nres = 0;
+
+    if (uring_register(ringfd, IORING_REGISTER_FILES, &fd, 1) == -1)
+        return -1;
+    if (efd != -1 &&
+            uring_register(ringfd, IORING_REGISTER_EVENTFD, &efd, 1) == -1)
+        return -1;
+    if (*nbuffers != 0 && uring_reserve_buffers(ringfd, *nbuffers) == -1)
+        *nbuffers = 0;
+
+    memset(res, 0, sizeof res);
+    res[nres].opcode = IORING_RESTRICTION_SQE_OP;
+    res[nres++].sqe_op = IORING_OP_READ;
+    res[nres].opcode = IORING_RESTRICTION_SQE_OP;
+    res[nres++].sqe_op = IORING_OP_WRITE;
+    if (fsync) {
+        res[nres].opcode = IORING_RESTRICTION_SQE_OP;
+        res[nres++].sqe_op = IORING_OP_FSYNC;
+    }
+#if defined(IORING_RSRC_REGISTER_SPARSE)
+    if (*nbuffers != 0) {
+        res[nres].opcode = IORING_RESTRICTION_SQE_OP;
+        res[nres++].sqe_op = IORING_OP_READ_FIXED;
+        res[nres].opcode = IORING_RESTRICTION_SQE_OP;
+        res[nres++].sqe_op = IORING_OP_WRITE_FIXED;
+        res[nres].opcode = IORING_RESTRICTION_REGISTER_OP;
+        res[nres++].register_op = IORING_REGISTER_BUFFERS_UPDATE;
+    }
+#endif
+    res[nres].opcode = IORING_RESTRICTION_SQE_FLAGS_ALLOWED;
+    res[nres++].sqe_flags = IOSQE_FIXED_FILE;
+    res[nres].opcode = IORING_RESTRICTION_SQE_FLAGS_REQUIRED;
+    res[nres++].sqe_flags = IOSQE_FIXED_FILE;
+    if (uring_register(ringfd, IORING_REGISTER_RESTRICTIONS, res, nres) == -1)
+        return -1;
+
+    return uring_register(ringfd, IORING_REGISTER_ENABLE_RINGS, NULL, 0);
+}
+
+static int uring_init(struct block_uring *u, int fd, unsigned entries,
+        int net, unsigned nbuffers)
+{
+    struct io_uring_params p;
+    uint8_t *ring = MAP_FAILED;
+    void *sqes = MAP_FAILED;
+    size_t ring_size = 0, sqes_size = 0;
+    int ringfd, efd = -1, saved_errno;
+
+    memset(&p, 0, sizeof p);
+    p.flags = IORING_SETUP_R_DISABLED;
+    ringfd = uring_setup(entries, &p);
+    if (ringfd == -1) {
+        if (errno == ENOSYS || errno == EPERM)
+            errno = ENOTSUP;
+        return -1;
+    }
+    /*
+     * Only kernels which map both rings with a single mmap() are supported;
+     * all kernels which support IORING_SETUP_R_DISABLED do so.
+     */
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+        errno = ENOTSUP;
+        goto fail;
+    }
+
+    ring_size = p.sq_off.array + p.sq_entries * sizeof (unsigned);
+    if (p.cq_off.cqes + p.cq_entries * sizeof (struct io_uring_cqe) >
+            ring_size)
+        ring_size = p.cq_off.cqes + p.cq_entries * sizeof (struct io_uring_cqe);
+    ring = mmap(NULL, ring_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_SQ_RING);
+    if (ring == MAP_FAILED)
+        goto fail;
+    sqes_size = p.sq_entries * sizeof (struct io_uring_sqe);
+    sqes = mmap(NULL, sqes_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+        goto fail;
+
+    /*
+     * Network devices signal readiness on the device itself, so their
+     * completions need not be signalled.
+     */
+    if (!net) {
+        efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (efd == -1)
+            goto fail;
+    }
+    if (uring_restrict(ringfd, fd, efd, !net, &nbuffers) == -1)
+        goto fail;
+
+    u->ringfd = ringfd;
+    u->eventfd = efd;
+    u->entries = p.sq_entries;
+    u->sq_head = (unsigned *)(ring + p.sq_off.head);
+    u->sq_tail = (unsigned *)(ring + p.sq_off.tail);
+    u->sq_mask = (unsigned *)(ring + p.sq_off.ring_mask);
+    u->sq_array = (unsigned *)(ring + p.sq_off.array);
+    u->sqes = sqes;
+    u->cq_head = (unsigned *)(ring + p.cq_off.head);
+    u->cq_tail = (unsigned *)(ring + p.cq_off.tail);
+    u->cq_mask = (unsigned *)(ring + p.cq_off.ring_mask);
+    u->cqes = ring + p.cq_off.cqes;
+    u->sq_queued = 0;
+    u->nbuffers = nbuffers;
+    return 0;
+
+fail:
+    saved_errno = errno;
+    if (efd != -1)
+        close(efd);
+    if (sqes != MAP_FAILED)
+        munmap(sqes, sqes_size);
+    if (ring != MAP_FAILED)
+        munmap(ring, ring_size);
+    close(ringfd);
+    errno = saved_errno;
+    return -1;
+}
+
+int block_uring_init(struct block_uring *u, int fd, unsigned entries)
+{
+    return uring_init(u, fd, entries, 0, 0);
+}
+
+int block_uring_init_fixed(struct block_uring *u, int fd, unsigned entries,
+        unsigned nbuffers)
+{
+    return uring_init(u, fd, entries, 0, nbuffers);
+}
+
+int net_uring_init(struct block_uring *u, int fd, unsigned entries)
+{
+    return uring_init(u, fd, entries, 1, 0);
+}
+
+int block_uring_register_buffer(struct block_uring *u, unsigned index,
+        void *data, size_t len)
+{
+    if (index >= u->nbuffers) {
+        errno = ENOTSUP;
+        return -1;
+    }
+
+#if defined(IORING_RSRC_REGISTER_SPARSE)
+    struct iovec iov = { .iov_base = data, .iov_len = len };
+    struct io_uring_rsrc_update2 up;
+    memset(&up, 0, sizeof up);
+    up.offset = index;
+    up.data = (uintptr_t)&iov;
+    up.nr = 1;
+    int rc = uring_register(u->ringfd, IORING_REGISTER_BUFFERS_UPDATE, &up,
+            sizeof up);
+    return (rc == 1) ? 0 : -1;
+#else
+    (void)data;
+    (void)len;
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+int block_uring_queue(struct block_uring *u, int write, void *data,
+        size_t len, off_t offset, uint64_t tag)
+{
+    unsigned tail = *u->sq_tail;
+
+    if (tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) == u->entries)
+        return -1;
+
+    unsigned idx = tail & *u->sq_mask;
+    struct io_uring_sqe *sqe = (struct io_uring_sqe *)u->sqes + idx;
+    memset(sqe, 0, sizeof *sqe);
+    sqe->opcode = write ? IORING_OP_WRITE : IORING_OP_READ;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->ioprio = u->ioprio;
+    sqe->fd = 0;
+    sqe->off = offset;
+    sqe->addr = (uintptr_t)data;
+    sqe->len = len;
+    sqe->user_data = tag;
+    u->sq_array[idx] = idx;
+    __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    u->sq_queued++;
+    return 0;
+}
+
+int block_uring_queue_fixed(struct block_uring *u, int write, void *data,
+        size_t len, off_t offset, unsigned index, uint64_t tag)
+{
+    unsigned tail = *u->sq_tail;
+
+    if (tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) == u->entries)
+        return -1;
+
+    unsigned idx = tail & *u->sq_mask;
+    struct io_uring_sqe *sqe = (struct io_uring_sqe *)u->sqes + idx;
+    memset(sqe, 0, sizeof *sqe);
+    sqe->opcode = write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->ioprio = u->ioprio;
+    sqe->fd = 0;
+    sqe->off = offset;
+    sqe->addr = (uintptr_t)data;
+    sqe->len = len;
+    sqe->buf_index = index;
+    sqe->user_data = tag;
+    u->sq_array[idx] = idx;
+    __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    u->sq_queued++;
+    return 0;
+}
+
+int block_uring_queue_fsync(struct block_uring *u, uint64_t tag)
+{
+    unsigned tail = *u->sq_tail;
+
+    if (tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) == u->entries)
+        return -1;
+
+    unsigned idx = tail & *u->sq_mask;
+    struct io_uring_sqe *sqe = (struct io_uring_sqe *)u->sqes + idx;
+    memset(sqe, 0, sizeof *sqe);
+    sqe->opcode = IORING_OP_FSYNC;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->fd = 0;
+    sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+    sqe->user_data = tag;
+    u->sq_array[idx] = idx;
+    __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    u->sq_queued++;
+    return 0;
+}
+
+int block_uring_submit(struct block_uring *u)
+{
+    while (u->sq_queued != 0) {
+        int rc = uring_enter(u->ringfd, u->sq_queued);
+        if (rc == -1 && errno == EINTR)
+            continue;
+        if (rc == -1)
+            return -1;
+        if (rc == 0) {
+            errno = EAGAIN;
+            return -1;
+        }
+        u->sq_queued -= rc;
+    }
+    return 0;
+}
+
+int block_uring_ready(struct block_uring *u)
+{
+    return *u->cq_head != __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+}
+
+int block_uring_reap(struct block_uring *u, uint64_t *tag, int *res)
+{
+    unsigned head = *u->cq_head;
+
+    if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE))
+        return 0;
+
+    struct io_uring_cqe *cqe = (struct io_uring_cqe *)u->cqes +
+        (head & *u->cq_mask);
+    *tag = cqe->user_data;
+    *res = cqe->res;
+    __atomic_store_n(u->cq_head, head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+#else /* !__linux__ */
+
+int block_uring_init(struct block_uring *u, int fd, unsigned entries)
+{
+    (void)u;
+    (void)fd;
+    (void)entries;
+    errno = ENOTSUP;
+    return -1;
+}
+
+int block_uring_init_fixed(struct block_uring *u, int fd, unsigned entries,
+        unsigned nbuffers)
+{
+    (void)u;
+    (void)fd;
+    (void)entries;
+    (void)nbuffers;
+    errno = ENOTSUP;
+    return -1;
+}
+
+int net_uring_init(struct block_uring *u, int fd, unsigned entries)
+{
+    (void)u;
+    (void)fd;
+    (void)entries;
+    errno = ENOTSUP;
+    return -1;
+}
+
+int block_uring_register_buffer(struct block_uring *u, unsigned index,
+        void *data, size_t len)
+{
+    (void)u;
+    (void)index;
+    (void)data;
+    (void)len;
+    errno = ENOTSUP;
+    return -1;
+}
+
+int block_uring_queue(struct block_uring *u, int write, void *data,
+        size_t len, off_t offset, uint64_t tag)
+{
+    (void)u;
+    (void)write;
+    (void)data;
+    (void)len;
+    (void)offset;
+    (void)tag;
+    return -1;
+}
+
+int block_uring_queue_fixed(struct block_uring *u, int write, void *data,
+        size_t len, off_t offset, unsigned index, uint64_t tag)
+{
+    (void)u;
+    (void)write;
+    (void)data;
+    (void)len;
+    (void)offset;
+    (void)index;
+    (void)tag;
+    return -1;
+}
+
+int block_uring_queue_fsync(struct block_uring *u, uint64_t tag)
+{
+    (void)u;
+    (void)tag;
+    return -1;
+}
+
+int block_uring_submit(struct block_uring *u)
+{
+    (void)u;
+    errno = ENOTSUP;
+    return -1;
+}
+
+int block_uring_ready(struct block_uring *u)
+{
+    (void)u;
+    return 0;
+}
+
+int block_uring_reap(struct block_uring *u, uint64_t *tag, int *res)
+{
+    (void)u;
+    (void)tag;
+    (void)res;
+    return 0;
+}
+
+#endif /* __linux__ */
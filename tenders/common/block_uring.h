@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * block_uring.h: Common functions for performing block I/O using io_uring.
+ */
+
+#ifndef COMMON_BLOCK_URING_H
+#define COMMON_BLOCK_URING_H
+
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * An io_uring instance restricted to IORING_OP_READ, IORING_OP_WRITE and
+ * IORING_OP_FSYNC on a single block device, registered as fixed file 0.
+ * Completions are signalled on (eventfd). The ring layout is exposed so that
+ * it can be shared with spt guests, which queue requests and reap completions
+ * directly.
+ */
+struct block_uring {
+    int ringfd;
+    int eventfd;
+    unsigned entries;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    void *sqes;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    void *cqes;
+    unsigned sq_queued;         /* Queued, not yet submitted to the kernel */
+    uint16_t ioprio;            /* Host I/O priority of requests queued by
+                                   block_uring_queue() */
+    unsigned nbuffers;          /* Slots for registered buffers */
+};
+
+/*
+ * Set up (u) with (entries) submission queue entries for block I/O on (fd).
+ * Returns 0 on success, or -1 and an appropriate errno on failure (ENOTSUP if
+ * io_uring is not supported on this host).
+ */
+int block_uring_init(struct block_uring *u, int fd, unsigned entries);
+
+/*
+ * As block_uring_init(), but also reserve (nbuffers) slots for buffers
+ * registered with block_uring_register_buffer(), and allow
+ * block_uring_queue_fixed(), if the host supports it (Linux 5.19 or later).
+ * (nbuffers) in (u) is set to the number of slots reserved, 0 if none.
+ */
+int block_uring_init_fixed(struct block_uring *u, int fd, unsigned entries,
+        unsigned nbuffers);
+
+/*
+ * Register the (len) bytes at (data) in slot (index), replacing any buffer
+ * registered there before, or empty the slot if (data) is NULL. The kernel
+ * pins the pages of a registered buffer, charging them to RLIMIT_MEMLOCK.
+ * Returns 0 on success, or -1 and an appropriate errno on failure (ENOTSUP if
+ * (index) is not a slot reserved by block_uring_init_fixed()).
+ */
+int block_uring_register_buffer(struct block_uring *u, unsigned index,
+        void *data, size_t len);
+
+/*
+ * As block_uring_init(), but for packet I/O on the tap device (fd): the ring
+ * is restricted to IORING_OP_READ and IORING_OP_WRITE, and completions are
+ * not signalled, (eventfd) being -1.
+ */
+int net_uring_init(struct block_uring *u, int fd, unsigned entries);
+
+/*
+ * Queue a request to read or write (len) bytes at (data) from/to (offset) on
+ * the device, to be started by the next call to block_uring_submit(). Returns
+ * -1 if the submission queue is full.
+ */
+int block_uring_queue(struct block_uring *u, int write, void *data,
+        size_t len, off_t offset, uint64_t tag);
+
+/*
+ * As block_uring_queue(), for (data) within the buffer registered in slot
+ * (index).
+ */
+int block_uring_queue_fixed(struct block_uring *u, int write, void *data,
+        size_t len, off_t offset, unsigned index, uint64_t tag);
+
+/*
+ * Queue a request to make the data written to the device durable, as for
+ * fdatasync(), to be started by the next call to block_uring_submit().
+ * Returns -1 if the submission queue is full.
+ */
+int block_uring_queue_fsync(struct block_uring *u, uint64_t tag);
+
+/*
+ * Submit all queued requests to the kernel with a single system call. Returns
+ * 0 on success, or -1 and an appropriate errno on failure.
+ */
+int block_uring_submit(struct block_uring *u);
+
+/*
+ * Returns non-zero if completions are pending on (u).
+ */
+int block_uring_ready(struct block_uring *u);
+
+/*
+ * Reap a single completion from (u), without blocking. Returns 1 and the
+ * request's (*tag) and result (as for pread()/pwrite(), or -errno) in (*res),
+ * or 0 if no completions are pending.
+ */
+int block_uring_reap(struct block_uring *u, uint64_t *tag, int *res);
+
+#endif /* COMMON_BLOCK_URING_H */
@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * block_zone.c: Common functions for zoned block devices.
+ *
+ * Zones are reported and managed with the BLK*ZONE ioctl()s, which count in
+ * 512-byte sectors regardless of the logical block size of the device.
+ */
+
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+
+#if defined(__linux__)
+#include <linux/blkzoned.h>
+#endif
+
+/*
+ * The zone management ioctl()s other than BLKRESETZONE appeared in Linux 5.5.
+ */
+#if defined(BLKOPENZONE)
+#define HAVE_BLKZONED
+#endif
+
+#include "block_zone.h"
+
+#define SECTOR_SHIFT 9
+
+uint64_t block_zone_size(int fd)
+{
+#if defined(HAVE_BLKZONED)
+    struct stat st;
+    __u32 sectors;
+
+    if (fstat(fd, &st) == -1 || !S_ISBLK(st.st_mode) ||
+            ioctl(fd, BLKGETZONESZ, &sectors) == -1)
+        return 0;
+    return (uint64_t)sectors << SECTOR_SHIFT;
+#else
+    (void)fd;
+    return 0;
+#endif
+}
+
+int block_zone_report(int fd, uint64_t offset, struct block_zone *zones,
+        unsigned count)
+{
+#if defined(HAVE_BLKZONED)
+    struct blk_zone_report *rep = calloc(1, sizeof *rep +
+            count * sizeof (struct blk_zone));
+    if (rep == NULL)
+        return -1;
+    rep->sector = offset >> SECTOR_SHIFT;
+    rep->nr_zones = count;
+    if (ioctl(fd, BLKREPORTZONE, rep) == -1) {
+        int saved_errno = errno;
+        free(rep);
+        errno = saved_errno;
+        return -1;
+    }
+
+    for (unsigned i = 0; i < rep->nr_zones; i++) {
+        struct blk_zone *z = &rep->zones[i];
+        zones[i].start = z->start << SECTOR_SHIFT;
+        zones[i].size = z->len << SECTOR_SHIFT;
+#if defined(BLK_ZONE_REP_CAPACITY)
+        if (rep->flags & BLK_ZONE_REP_CAPACITY)
+            zones[i].capacity = z->capacity << SECTOR_SHIFT;
+        else
+#endif
+            zones[i].capacity = zones[i].size;
+        zones[i].write_pointer = z->wp << SECTOR_SHIFT;
+        zones[i].type = z->type;
+        zones[i].cond = z->cond;
+    }
+    int n = rep->nr_zones;
+    free(rep);
+    return n;
+#else
+    (void)fd;
+    (void)offset;
+    (void)zones;
+    (void)count;
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+int block_zone_manage(int fd, unsigned op, uint64_t start, uint64_t size)
+{
+#if defined(HAVE_BLKZONED)
+    struct blk_zone_range range = {
+        .sector = start >> SECTOR_SHIFT,
+        .nr_sectors = size >> SECTOR_SHIFT
+    };
+    unsigned long req;
+
+    switch (op) {
+    case BLOCK_ZONE_RESET:
+        req = BLKRESETZONE;
+        break;
+    case BLOCK_ZONE_OPEN:
+        req = BLKOPENZONE;
+        break;
+    case BLOCK_ZONE_CLOSE:
+        req = BLKCLOSEZONE;
+        break;
+    case BLOCK_ZONE_FINISH:
+        req = BLKFINISHZONE;
+        break;
+    default:
+        errno = EINVAL;
+        return -1;
+    }
+    return ioctl(fd, req, &range);
+#else
+    (void)fd;
+    (void)op;
+    (void)start;
+    (void)size;
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
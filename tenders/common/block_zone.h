@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * block_zone.h: Common functions for zoned block devices.
+ */
+
+#ifndef COMMON_BLOCK_ZONE_H
+#define COMMON_BLOCK_ZONE_H
+
+#include <stdint.h>
+
+/*
+ * A zone, in bytes, with the type and condition reported by the host, which
+ * are those of the ZBC and ZNS specifications (SOLO5_BLOCK_ZONE_TYPE_* and
+ * SOLO5_BLOCK_ZONE_COND_*).
+ */
+struct block_zone {
+    uint64_t start;
+    uint64_t size;
+    uint64_t capacity;
+    uint64_t write_pointer;
+    uint8_t type;
+    uint8_t cond;
+};
+
+#define BLOCK_ZONE_TYPE_CONVENTIONAL 0x1
+#define BLOCK_ZONE_COND_READONLY 0xd
+#define BLOCK_ZONE_COND_FULL 0xe
+#define BLOCK_ZONE_COND_OFFLINE 0xf
+
+/*
+ * Zone management operations, as SOLO5_BLOCK_ZONE_*.
+ */
+#define BLOCK_ZONE_RESET 1
+#define BLOCK_ZONE_OPEN 2
+#define BLOCK_ZONE_CLOSE 3
+#define BLOCK_ZONE_FINISH 4
+
+/*
+ * Returns the zone size in bytes of the host block device open as (fd), or 0
+ * if it is not a zoned block device or zoned devices are not supported on this
+ * host (only Linux supports them).
+ */
+uint64_t block_zone_size(int fd);
+
+/*
+ * Reports up to (count) zones of the zoned device (fd) into (zones[]),
+ * starting with the zone containing byte (offset). Returns the number of zones
+ * reported, 0 if (offset) is beyond the last zone, or -1 and an appropriate
+ * errno on failure.
+ */
+int block_zone_report(int fd, uint64_t offset, struct block_zone *zones,
+        unsigned count);
+
+/*
+ * Performs the zone management operation (op), one of BLOCK_ZONE_*, on the
+ * zone of (size) bytes starting at byte (start) of the zoned device (fd).
+ * Returns 0 on success, or -1 and an appropriate errno on failure.
+ */
+int block_zone_manage(int fd, unsigned op, uint64_t start, uint64_t size);
+
+#endif /* COMMON_BLOCK_ZONE_H */
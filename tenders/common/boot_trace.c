@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * boot_trace.c: Timing of tender startup phases (--trace-boot).
+ */
+
+#define _GNU_SOURCE
+#include <err.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "boot_trace.h"
+#include "sdt.h"
+
+#define BOOT_TRACE_MAX 32
+#define BOOT_TRACE_NAME_SIZE 48
+
+struct phase {
+    uint64_t nsecs;
+    char name[BOOT_TRACE_NAME_SIZE];
+};
+
+static struct phase phases[BOOT_TRACE_MAX];
+static unsigned nphases;
+static uint64_t start_nsecs;
+static bool enabled;
+
+uint64_t boot_trace_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void boot_trace_init(void)
+{
+    start_nsecs = boot_trace_now();
+}
+
+int boot_trace_handle_cmdarg(const char *cmdarg)
+{
+    if (strcmp("--trace-boot", cmdarg) != 0)
+        return -1;
+    enabled = true;
+    return 0;
+}
+
+bool boot_trace_enabled(void)
+{
+    return enabled;
+}
+
+uint64_t boot_trace_start(void)
+{
+    return start_nsecs;
+}
+
+void boot_trace_at(uint64_t nsecs, const char *phase)
+{
+    TENDER_PROBE2(boot__phase, phase, nsecs - start_nsecs);
+    if (nphases == BOOT_TRACE_MAX)
+        return;
+    phases[nphases].nsecs = nsecs;
+    snprintf(phases[nphases].name, BOOT_TRACE_NAME_SIZE, "%s", phase);
+    nphases++;
+}
+
+void boot_trace(const char *fmt, ...)
+{
+    uint64_t now = boot_trace_now();
+    char phase[BOOT_TRACE_NAME_SIZE];
+    va_list ap;
+
+    va_start(ap, fmt);
+    vsnprintf(phase, sizeof phase, fmt, ap);
+    va_end(ap);
+    boot_trace_at(now, phase);
+}
+
+void boot_trace_report(void)
+{
+    if (!enabled)
+        return;
+
+    /*
+     * Phases timed by other means may have been recorded out of order.
+     */
+    for (unsigned i = 1; i < nphases; i++) {
+        struct phase p = phases[i];
+        unsigned j = i;
+        for (; j > 0 && phases[j - 1].nsecs > p.nsecs; j--)
+            phases[j] = phases[j - 1];
+        phases[j] = p;
+    }
+
+    uint64_t prev = start_nsecs;
+    for (unsigned i = 0; i < nphases; i++) {
+        warnx("boot: %8llu us (+%llu) %s",
+                (unsigned long long)(phases[i].nsecs - start_nsecs) / 1000,
+                (unsigned long long)(phases[i].nsecs - prev) / 1000,
+                phases[i].name);
+        prev = phases[i].nsecs;
+    }
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * boot_trace.h: Timing of tender startup phases (--trace-boot).
+ */
+
+#ifndef COMMON_BOOT_TRACE_H
+#define COMMON_BOOT_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Record the start of the tender. Must be called first thing in main().
+ *
+ * Timestamps are recorded whether or not --trace-boot is given, as each costs
+ * only a clock_gettime(), and some phases complete before the command line
+ * has been parsed.
+ */
+void boot_trace_init(void);
+
+/*
+ * Parse --trace-boot (cmdarg). Returns 0 if (cmdarg) was --trace-boot, -1
+ * otherwise.
+ */
+int boot_trace_handle_cmdarg(const char *cmdarg);
+
+/*
+ * Returns true if --trace-boot was given.
+ */
+bool boot_trace_enabled(void);
+
+/*
+ * Record that the startup phase named by (fmt) has completed now.
+ */
+void boot_trace(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+/*
+ * Record that the startup phase (phase) completed at (nsecs) on the host
+ * monotonic clock, for phases timed by other means.
+ */
+void boot_trace_at(uint64_t nsecs, const char *phase);
+
+/*
+ * Returns the host monotonic clock, in nanoseconds.
+ */
+uint64_t boot_trace_now(void);
+
+/*
+ * Returns the time at which the tender started, as for boot_trace_now().
+ */
+uint64_t boot_trace_start(void);
+
+/*
+ * Report all phases recorded so far in order of completion, if --trace-boot
+ * was given.
+ */
+void boot_trace_report(void);
+
+#endif /* COMMON_BOOT_TRACE_H */
@@ -0,0 +1,298 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * cgroup.c: Placement of the tender in a cgroup v2, common to all tenders.
+ */
+
+#define _GNU_SOURCE
+#include <err.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#endif
+
+#include "cgroup.h"
+
+#if defined(__linux__)
+
+#define CGROUP_ROOT "/sys/fs/cgroup"
+
+/*
+ * Memory used by the tender itself and by the host kernel on its behalf
+ * (page tables, socket and block I/O buffers, page cache) on top of guest
+ * memory. Above memory.high the tender is throttled and its memory reclaimed,
+ * above memory.max it is killed.
+ */
+#define MEM_HIGH_EXTRA (32ULL << 20)
+#define MEM_MAX_EXTRA (64ULL << 20)
+
+#define CPU_PERIOD_USECS 100000
+
+static char cg_path[PATH_MAX];
+static unsigned cpu_quota_pct;
+
+/*
+ * I/O limits of each host disk, the sum of those of the attached block
+ * devices it backs. If any of these has no limit of a kind, neither does the
+ * disk.
+ */
+#define IO_DEVS_MAX 16
+
+static struct {
+    dev_t dev;
+    uint64_t bytes_per_sec;
+    uint64_t ops_per_sec;
+    bool bytes_unlimited;
+    bool ops_unlimited;
+    bool written;               /* io.max has been set for the disk */
+} io_devs[IO_DEVS_MAX];
+static unsigned io_ndevs;
+
+/*
+ * Write (value) to the control file (file) of the cgroup at (dir). Returns 0
+ * on success, or -1 with errno set.
+ */
+static int cg_write(const char *dir, const char *file, const char *value)
+{
+    char path[PATH_MAX];
+
+    if (snprintf(path, sizeof path, "%s/%s", dir, file) >= (int)sizeof path) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd == -1)
+        return -1;
+    ssize_t len = strlen(value);
+    ssize_t nbytes = write(fd, value, len);
+    int saved_errno = errno;
+    close(fd);
+    if (nbytes != len) {
+        errno = (nbytes == -1) ? saved_errno : EIO;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Create the directories of (path) which do not exist yet, enabling the
+ * controllers we use for the children of each, as cgroup v2 requires.
+ */
+static void cg_create(char *path)
+{
+    size_t root_len = strlen(CGROUP_ROOT);
+
+    for (char *p = path + root_len + 1; ; p++) {
+        if (*p != '/' && *p != '\0')
+            continue;
+        char c = *p;
+        *p = '\0';
+        char *parent = strrchr(path, '/');
+        *parent = '\0';
+        /*
+         * Controllers may already be enabled, or not be available at all,
+         * which is reported below when setting limits.
+         */
+        (void)cg_write(path, "cgroup.subtree_control", "+memory +cpu +io");
+        *parent = '/';
+        if (mkdir(path, 0755) == -1 && errno != EEXIST)
+            err(1, "Could not create cgroup %s", path);
+        *p = c;
+        if (c == '\0')
+            break;
+    }
+}
+
+int cgroup_handle_cmdarg(const char *cmdarg)
+{
+    if (strncmp("--cgroup=", cmdarg, 9) == 0) {
+        const char *path = cmdarg + 9;
+        while (*path == '/')
+            path++;
+        if (*path == '\0' || strstr(path, "..") != NULL ||
+                path[strlen(path) - 1] == '/')
+            errx(1, "Malformed argument to --cgroup");
+        if (snprintf(cg_path, sizeof cg_path, "%s/%s", CGROUP_ROOT, path) >=
+                (int)sizeof cg_path)
+            errx(1, "Malformed argument to --cgroup");
+        return 0;
+    }
+    if (strncmp("--cpu-quota=", cmdarg, 12) == 0) {
+        unsigned pct;
+        char c;
+        if (sscanf(cmdarg, "--cpu-quota=%u%c", &pct, &c) != 1 || pct == 0 ||
+                pct > 100000)
+            errx(1, "Malformed argument to --cpu-quota");
+        cpu_quota_pct = pct;
+        return 0;
+    }
+    return -1;
+}
+
+void cgroup_apply(size_t mem_size)
+{
+    char value[64];
+
+    if (cg_path[0] == '\0') {
+        if (cpu_quota_pct != 0)
+            errx(1, "--cpu-quota requires --cgroup");
+        return;
+    }
+
+    cg_create(cg_path);
+    snprintf(value, sizeof value, "%" PRIu64,
+            (uint64_t)(mem_size + MEM_HIGH_EXTRA));
+    if (cg_write(cg_path, "memory.high", value) == -1)
+        err(1, "Could not set memory.high of cgroup %s", cg_path);
+    snprintf(value, sizeof value, "%" PRIu64,
+            (uint64_t)(mem_size + MEM_MAX_EXTRA));
+    if (cg_write(cg_path, "memory.max", value) == -1)
+        err(1, "Could not set memory.max of cgroup %s", cg_path);
+    if (cpu_quota_pct != 0) {
+        snprintf(value, sizeof value, "%llu %u",
+                (unsigned long long)cpu_quota_pct * CPU_PERIOD_USECS / 100,
+                CPU_PERIOD_USECS);
+        if (cg_write(cg_path, "cpu.max", value) == -1)
+            err(1, "Could not set cpu.max of cgroup %s", cg_path);
+    }
+    if (cg_write(cg_path, "cgroup.procs", "0") == -1)
+        err(1, "Could not move into cgroup %s", cg_path);
+}
+
+/*
+ * Return the whole disk (*dev) is a partition of, if it is one, as io.max
+ * only applies to disks.
+ */
+static void whole_disk(dev_t *dev)
+{
+    char path[64], buf[32];
+    unsigned maj, min;
+
+    snprintf(path, sizeof path, "/sys/dev/block/%u:%u/partition",
+            major(*dev), minor(*dev));
+    if (access(path, F_OK) == -1)
+        return;
+    snprintf(path, sizeof path, "/sys/dev/block/%u:%u/../dev",
+            major(*dev), minor(*dev));
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+        return;
+    if (fgets(buf, sizeof buf, f) != NULL &&
+            sscanf(buf, "%u:%u", &maj, &min) == 2)
+        *dev = makedev(maj, min);
+    fclose(f);
+}
+
+static void io_rate(char *buf, size_t size, const char *key, uint64_t rate,
+        bool unlimited)
+{
+    if (unlimited)
+        snprintf(buf, size, "%s=max", key);
+    else
+        snprintf(buf, size, "%s=%" PRIu64, key, rate);
+}
+
+void cgroup_limit_block(int fd, const struct rate_limit *rl)
+{
+    struct stat st;
+
+    if (cg_path[0] == '\0')
+        return;
+    if (fstat(fd, &st) == -1)
+        err(1, "fstat() failed");
+    dev_t dev = S_ISBLK(st.st_mode) ? st.st_rdev : st.st_dev;
+    whole_disk(&dev);
+    if (major(dev) == 0) {
+        if (rate_limit_enabled(rl))
+            warnx("cgroup: Block device on a filesystem with no backing "
+                    "disk, not limiting its I/O");
+        return;
+    }
+
+    unsigned i;
+    for (i = 0; i < io_ndevs; i++) {
+        if (io_devs[i].dev == dev)
+            break;
+    }
+    if (i == io_ndevs) {
+        if (io_ndevs == IO_DEVS_MAX)
+            errx(1, "cgroup: Too many host devices to limit");
+        io_devs[i].dev = dev;
+        io_ndevs++;
+    }
+    io_devs[i].bytes_per_sec += rl->bytes_per_sec;
+    io_devs[i].bytes_unlimited |= (rl->bytes_per_sec == 0);
+    io_devs[i].ops_per_sec += rl->ops_per_sec;
+    io_devs[i].ops_unlimited |= (rl->ops_per_sec == 0);
+    /*
+     * The io controller is only required if something is limited.
+     */
+    if (io_devs[i].bytes_unlimited && io_devs[i].ops_unlimited &&
+            !io_devs[i].written)
+        return;
+
+    char rbps[32], wbps[32], riops[32], wiops[32], value[160];
+    io_rate(rbps, sizeof rbps, "rbps", io_devs[i].bytes_per_sec,
+            io_devs[i].bytes_unlimited);
+    io_rate(wbps, sizeof wbps, "wbps", io_devs[i].bytes_per_sec,
+            io_devs[i].bytes_unlimited);
+    io_rate(riops, sizeof riops, "riops", io_devs[i].ops_per_sec,
+            io_devs[i].ops_unlimited);
+    io_rate(wiops, sizeof wiops, "wiops", io_devs[i].ops_per_sec,
+            io_devs[i].ops_unlimited);
+    snprintf(value, sizeof value, "%u:%u %s %s %s %s", major(dev), minor(dev),
+            rbps, wbps, riops, wiops);
+    if (cg_write(cg_path, "io.max", value) == -1)
+        err(1, "Could not set io.max of cgroup %s", cg_path);
+    io_devs[i].written = true;
+}
+
+#else /* !__linux__ */
+
+int cgroup_handle_cmdarg(const char *cmdarg)
+{
+    if (strncmp("--cgroup=", cmdarg, 9) == 0 ||
+            strncmp("--cpu-quota=", cmdarg, 12) == 0)
+        errx(1, "--cgroup and --cpu-quota are not supported on this host");
+    return -1;
+}
+
+void cgroup_apply(size_t mem_size __attribute__((unused)))
+{
+}
+
+void cgroup_limit_block(int fd __attribute__((unused)),
+        const struct rate_limit *rl __attribute__((unused)))
+{
+}
+
+#endif /* __linux__ */
@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * cgroup.h: Placement of the tender in a cgroup v2, with resource limits
+ * derived from its configuration (--cgroup=PATH, --cpu-quota=PCT).
+ */
+
+#ifndef COMMON_CGROUP_H
+#define COMMON_CGROUP_H
+
+#include <stddef.h>
+
+#include "rate_limit.h"
+
+/*
+ * Parse a cgroup option (cmdarg). Returns 0 if (cmdarg) was such an option,
+ * -1 otherwise. Exits if it is malformed, or not supported on this host.
+ */
+int cgroup_handle_cmdarg(const char *cmdarg);
+
+/*
+ * Create the cgroup given with --cgroup, if any, limit its memory according
+ * to the guest memory size (mem_size) and its CPU time according to
+ * --cpu-quota, and move the tender into it. Must be called by the tender
+ * before it allocates guest memory or creates any threads, so that both are
+ * accounted to the cgroup.
+ */
+void cgroup_apply(size_t mem_size);
+
+/*
+ * Add the rate limit (rl) of a block device attached as (fd), which may
+ * limit nothing, to the I/O limits of the cgroup, if any, for the host disk
+ * backing (fd). Must be called for every attached block device.
+ */
+void cgroup_limit_block(int fd, const struct rate_limit *rl);
+
+#endif /* COMMON_CGROUP_H */
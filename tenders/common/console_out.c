@@ -0,0 +1,251 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * console_out.c: Asynchronous console output of the guest.
+ *
+ * Console output used to be written to standard output on the VCPU thread
+ * making the hypercall, so a slow consumer such as a full pipe or a logging
+ * daemon under pressure stalled the guest. It is now copied to a ring buffer,
+ * from which a dedicated thread writes it out. Only the writer thread
+ * consumes the ring, and does so without holding (lock), which it holds only
+ * to publish the new tail, so producers only wait for it when the ring is
+ * full and the overflow policy is to block.
+ */
+
+#define _GNU_SOURCE
+#include <err.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "console_out.h"
+#include "metrics.h"
+
+#define CONSOLE_OUT_DEFAULT_KB 256
+
+static size_t buf_size = CONSOLE_OUT_DEFAULT_KB * 1024;
+static bool drop;
+
+static char *ring;
+static uint64_t head, tail;
+static uint64_t dropped;
+static bool flushed;
+/*
+ * (lock) protects all of the above. (write_lock) is held while writing to
+ * standard output, so that output is written by one thread at a time.
+ */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t write_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t not_empty = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t not_full = PTHREAD_COND_INITIALIZER;
+
+int console_out_handle_cmdarg(const char *cmdarg)
+{
+    if (strncmp("--console-buffer=", cmdarg, 17) == 0) {
+        char *end;
+        unsigned long kb = strtoul(cmdarg + 17, &end, 10);
+        if (cmdarg[17] == '\0' || *end != '\0' || kb > (1UL << 20))
+            errx(1, "Malformed argument to --console-buffer");
+        buf_size = kb * 1024;
+        return 0;
+    }
+    else if (strncmp("--console-overflow=", cmdarg, 19) == 0) {
+        if (strcmp(cmdarg + 19, "drop") == 0)
+            drop = true;
+        else if (strcmp(cmdarg + 19, "block") == 0)
+            drop = false;
+        else
+            errx(1, "Malformed argument to --console-overflow");
+        return 0;
+    }
+    return -1;
+}
+
+static void write_all(const char *data, size_t len)
+{
+    while (len > 0) {
+        ssize_t rc = write(1, data, len);
+        if (rc == -1 && errno == EINTR)
+            continue;
+        /*
+         * There is nothing more useful to do with output which cannot be
+         * written.
+         */
+        if (rc <= 0)
+            return;
+        data += rc;
+        len -= rc;
+    }
+}
+
+/*
+ * Writes out the (len) bytes at (t) in the ring. Called with (write_lock)
+ * held.
+ */
+static void write_ring(uint64_t t, size_t len)
+{
+    size_t off = t % buf_size;
+    size_t first = buf_size - off;
+
+    if (first > len)
+        first = len;
+    write_all(ring + off, first);
+    write_all(ring, len - first);
+}
+
+static void *writer_thread(void *arg __attribute__((unused)))
+{
+    pthread_mutex_lock(&lock);
+    for (;;) {
+        while (head == tail)
+            pthread_cond_wait(&not_empty, &lock);
+        uint64_t t = tail, h = head;
+        pthread_mutex_unlock(&lock);
+
+        pthread_mutex_lock(&write_lock);
+        write_ring(t, h - t);
+        pthread_mutex_unlock(&write_lock);
+
+        pthread_mutex_lock(&lock);
+        tail = h;
+        pthread_cond_broadcast(&not_full);
+    }
+    return NULL;
+}
+
+/*
+ * Writes out what is left in the ring when the tender exits, on the exiting
+ * thread, as the writer thread is about to go away. Later output is written
+ * synchronously.
+ */
+static void console_out_flush(void)
+{
+    pthread_mutex_lock(&write_lock);
+    pthread_mutex_lock(&lock);
+    if (head != tail)
+        write_ring(tail, head - tail);
+    tail = head;
+    flushed = true;
+    pthread_cond_broadcast(&not_full);
+    uint64_t n = dropped;
+    pthread_mutex_unlock(&lock);
+    pthread_mutex_unlock(&write_lock);
+    if (n > 0)
+        warnx("%llu bytes of console output dropped",
+                (unsigned long long)n);
+}
+
+static void console_out_metrics(struct metrics_buf *b,
+        void *arg __attribute__((unused)))
+{
+    pthread_mutex_lock(&lock);
+    uint64_t n = dropped;
+    pthread_mutex_unlock(&lock);
+    metrics_header(b, "solo5_console_dropped_bytes_total", "counter",
+            "Console output dropped as the console buffer was full.");
+    metrics_printf(b, "solo5_console_dropped_bytes_total %llu\n",
+            (unsigned long long)n);
+}
+
+void console_out_init(void)
+{
+    if (buf_size == 0)
+        return;
+    char *r = malloc(buf_size);
+    if (r == NULL)
+        err(1, "malloc");
+    if (atexit(console_out_flush) != 0)
+        errx(1, "atexit() failed");
+
+    /*
+     * Signals must not be handled on the writer thread, as a handler exiting
+     * there would wait for the thread to finish writing in
+     * console_out_flush().
+     */
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    pthread_t tid;
+    int rc = pthread_create(&tid, NULL, writer_thread, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (rc != 0)
+        errx(1, "Could not create console thread");
+    pthread_detach(tid);
+
+    pthread_mutex_lock(&lock);
+    ring = r;
+    pthread_mutex_unlock(&lock);
+    if (metrics_enabled() && drop &&
+            metrics_register(console_out_metrics, NULL) == -1)
+        errx(1, "Could not register console metrics");
+}
+
+void console_out_write(const void *buf, size_t len)
+{
+    pthread_mutex_lock(&lock);
+    if (ring == NULL || flushed) {
+        pthread_mutex_unlock(&lock);
+        pthread_mutex_lock(&write_lock);
+        write_all(buf, len);
+        pthread_mutex_unlock(&write_lock);
+        return;
+    }
+    /*
+     * Output which could never fit is written in pieces, each waiting for
+     * the ring to drain completely.
+     */
+    const char *p = buf;
+    while (len > 0) {
+        size_t n = len < buf_size ? len : buf_size;
+        while (buf_size - (head - tail) < n && !flushed) {
+            if (drop) {
+                dropped += len;
+                pthread_mutex_unlock(&lock);
+                return;
+            }
+            pthread_cond_wait(&not_full, &lock);
+        }
+        if (flushed) {
+            pthread_mutex_unlock(&lock);
+            pthread_mutex_lock(&write_lock);
+            write_all(p, len);
+            pthread_mutex_unlock(&write_lock);
+            return;
+        }
+        size_t off = head % buf_size;
+        size_t first = buf_size - off;
+        if (first > n)
+            first = n;
+        memcpy(ring + off, p, first);
+        memcpy(ring, p + first, n - first);
+        if (head == tail)
+            pthread_cond_signal(&not_empty);
+        head += n;
+        p += n;
+        len -= n;
+    }
+    pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * console_out.h: Asynchronous console output of the guest.
+ */
+
+#ifndef COMMON_CONSOLE_OUT_H
+#define COMMON_CONSOLE_OUT_H
+
+#include <stddef.h>
+
+/*
+ * Parse --console-buffer=KB and --console-overflow=POLICY (cmdarg). Returns 0
+ * if (cmdarg) was one of these, -1 otherwise.
+ */
+int console_out_handle_cmdarg(const char *cmdarg);
+
+/*
+ * Allocate the console buffer and start the thread writing it to standard
+ * output, exiting on failure. Output still buffered when the tender exits
+ * through exit() is written out first. Until this is called, or if
+ * --console-buffer=0 was given, console_out_write() writes synchronously.
+ */
+void console_out_init(void);
+
+/*
+ * Queue (len) bytes of console output at (buf) for writing to standard
+ * output. If the buffer does not have room for them, then with
+ * --console-overflow=block (the default), wait until it does; with
+ * --console-overflow=drop, discard them and count them as dropped, so that
+ * the caller is never held up by a slow consumer of the output. May be called
+ * concurrently; output is written in the order in which calls are made.
+ */
+void console_out_write(const void *buf, size_t len);
+
+#endif /* COMMON_CONSOLE_OUT_H */
@@ -31,6 +31,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -40,7 +41,12 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#ifdef SOLO5_ZSTD
+#include <zstd.h>
+#endif
+
 #include "cc.h"
+#include "elf.h"
 #include "mft_abi.h"
 
 static ssize_t pread_in_full(int fd, void *buf, size_t count, off_t offset)
@@ -73,6 +79,168 @@ static ssize_t pread_in_full(int fd, void *buf, size_t count, off_t offset)
     return total;
 }
 
+/*
+ * An ELF binary being read. It may be compressed as a whole with zstd
+ * ("zstd kernel.hvt"), in which case it is decompressed as it is read. Reads
+ * should then be made at increasing offsets, as reading backwards restarts
+ * decompression from the beginning of the file.
+ */
+struct elf_file {
+    const char *file;
+    int fd;
+    uint64_t size;                      /* Uncompressed size, if known */
+    bool compressed;
+#ifdef SOLO5_ZSTD
+    ZSTD_DCtx *zds;
+    ZSTD_inBuffer in;
+    uint8_t *inbuf;
+    size_t inbuf_size;
+    off_t in_offset;                    /* File offset of next input */
+    bool in_eof;
+    uint64_t pos;                       /* Uncompressed offset of next read */
+#endif
+};
+
+static const uint8_t zstd_magic[4] = { 0x28, 0xb5, 0x2f, 0xfd };
+
+static int elf_open(const char *file, struct elf_file *ef)
+{
+    struct stat st;
+    uint8_t magic[sizeof zstd_magic];
+    ssize_t nbytes;
+
+    memset(ef, 0, sizeof *ef);
+    ef->file = file;
+    ef->fd = open(file, O_RDONLY);
+    if (ef->fd == -1)
+        return -1;
+    if (fstat(ef->fd, &st) == -1)
+        return -1;
+    ef->size = st.st_size;
+
+    nbytes = pread_in_full(ef->fd, magic, sizeof magic, 0);
+    if (nbytes < 0)
+        return -1;
+    if (nbytes != sizeof magic || memcmp(magic, zstd_magic, sizeof magic))
+        return 0;
+
+#ifdef SOLO5_ZSTD
+    /*
+     * The file may hold several frames, so the size of the first is not
+     * necessarily that of the binary; rely on short reads instead.
+     */
+    ef->compressed = true;
+    ef->size = UINT64_MAX;
+    ef->zds = ZSTD_createDCtx();
+    ef->inbuf_size = ZSTD_DStreamInSize();
+    ef->inbuf = malloc(ef->inbuf_size);
+    if (ef->zds == NULL || ef->inbuf == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    return 0;
+#else
+    warnx("%s: Compressed with zstd, but built without zstd support", file);
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+static void elf_close(struct elf_file *ef)
+{
+#ifdef SOLO5_ZSTD
+    ZSTD_freeDCtx(ef->zds);
+    free(ef->inbuf);
+#endif
+    if (ef->fd != -1)
+        close(ef->fd);
+}
+
+#ifdef SOLO5_ZSTD
+static ssize_t zstd_pread(struct elf_file *ef, void *buf, size_t count,
+        uint64_t offset)
+{
+    uint8_t skip[4096];
+    uint8_t *p = buf;
+    ssize_t total = 0;
+
+    if (offset < ef->pos) {
+        ZSTD_DCtx_reset(ef->zds, ZSTD_reset_session_only);
+        ef->in.src = ef->inbuf;
+        ef->in.size = ef->in.pos = 0;
+        ef->in_offset = 0;
+        ef->in_eof = false;
+        ef->pos = 0;
+    }
+
+    while (count > 0) {
+        ZSTD_outBuffer out = { .pos = 0 };
+        size_t rc;
+
+        /*
+         * Decompress straight into (buf), discarding anything before
+         * (offset).
+         */
+        if (ef->pos < offset) {
+            out.dst = skip;
+            out.size = offset - ef->pos < sizeof skip ?
+                offset - ef->pos : sizeof skip;
+        }
+        else {
+            out.dst = p;
+            out.size = count;
+        }
+
+        if (ef->in.pos == ef->in.size && !ef->in_eof) {
+            ssize_t nr = pread_in_full(ef->fd, ef->inbuf, ef->inbuf_size,
+                    ef->in_offset);
+            if (nr < 0)
+                return -1;
+            ef->in.src = ef->inbuf;
+            ef->in.size = nr;
+            ef->in.pos = 0;
+            ef->in_offset += nr;
+            ef->in_eof = (nr == 0);
+        }
+
+        rc = ZSTD_decompressStream(ef->zds, &out, &ef->in);
+        if (ZSTD_isError(rc)) {
+            warnx("%s: %s", ef->file, ZSTD_getErrorName(rc));
+            errno = EINVAL;
+            return -1;
+        }
+        if (out.pos == 0 && ef->in_eof)
+            break;
+
+        ef->pos += out.pos;
+        if (out.dst == p) {
+            p += out.pos;
+            count -= out.pos;
+            total += out.pos;
+        }
+    }
+
+    return total;
+}
+#endif
+
+/*
+ * As pread_in_full(), on (ef).
+ */
+static ssize_t elf_pread(struct elf_file *ef, void *buf, size_t count,
+        uint64_t offset)
+{
+#ifdef SOLO5_ZSTD
+    if (ef->compressed)
+        return zstd_pread(ef, buf, count, offset);
+#endif
+    if (offset > INT64_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+    return pread_in_full(ef->fd, buf, count, offset);
+}
+
 static bool ehdr_is_valid(const Elf64_Ehdr *hdr)
 {
     /*
@@ -95,10 +263,35 @@ static bool ehdr_is_valid(const Elf64_Ehdr *hdr)
         );
 }
 
-void elf_load(const char *file, uint8_t *mem, size_t mem_size,
+/*
+ * Map (filesz) bytes of the segment at (offset) in (fd) copy-on-write at
+ * (daddr), replacing the guest memory there. This is only possible if the
+ * segment is at the same offset into a page in memory as in the file, and
+ * does not share its first page with the previous segment (ending at
+ * (prev_end)). As with the dynamic linker, bytes following the segment in
+ * its last page are taken from the file. Returns -1 if the segment must be
+ * read instead.
+ */
+static int map_segment(int fd, uint8_t *daddr, size_t filesz, off_t offset,
+        uint8_t *prev_end)
+{
+    uintptr_t pagesize = sysconf(_SC_PAGESIZE);
+    uintptr_t skew = (uintptr_t)daddr & (pagesize - 1);
+
+    if (filesz == 0 || (offset & (pagesize - 1)) != skew ||
+            daddr - skew < prev_end)
+        return -1;
+    size_t len = (filesz + skew + pagesize - 1) & ~(pagesize - 1);
+    if (mmap(daddr - skew, len, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_FIXED, fd, offset - skew) != daddr - skew)
+        return -1;
+    return 0;
+}
+
+void elf_load(const char *file, uint8_t *mem, size_t mem_size, bool map,
        uint64_t *p_entry, uint64_t *p_end)
 {
-    int fd_kernel = -1;
+    struct elf_file ef;
     ssize_t nbytes;
     size_t ph_size;
     Elf64_Off ph_off;
@@ -107,17 +300,17 @@ void elf_load(const char *file, uint8_t *mem, size_t mem_size,
     Elf64_Half ph_i;
     Elf64_Phdr *phdr = NULL;
     Elf64_Ehdr hdr;
+    uint8_t *prev_end = mem;
 
     /* elf entry point (on physical memory) */
     *p_entry = 0;
     /* highest byte of the program (on physical memory) */
     *p_end = 0;
 
-    fd_kernel = open(file, O_RDONLY);
-    if (fd_kernel == -1)
+    if (elf_open(file, &ef) == -1)
         goto out_error;
 
-    nbytes = pread_in_full(fd_kernel, &hdr, sizeof(Elf64_Ehdr), 0);
+    nbytes = elf_pread(&ef, &hdr, sizeof(Elf64_Ehdr), 0);
     if (nbytes < 0)
         goto out_error;
     if (nbytes != sizeof(Elf64_Ehdr))
@@ -132,7 +325,7 @@ void elf_load(const char *file, uint8_t *mem, size_t mem_size,
     phdr = malloc(ph_size);
     if (!phdr)
         goto out_error;
-    nbytes = pread_in_full(fd_kernel, phdr, ph_size, ph_off);
+    nbytes = elf_pread(&ef, phdr, ph_size, ph_off);
     if (nbytes < 0)
         goto out_error;
     if (nbytes != ph_size)
@@ -179,12 +372,19 @@ void elf_load(const char *file, uint8_t *mem, size_t mem_size,
             *p_end = _end;
 
         daddr = mem + paddr;
-        nbytes = pread_in_full(fd_kernel, daddr, filesz, offset);
-        if (nbytes < 0)
-            goto out_error;
-        if (nbytes != filesz)
+        if (add_overflow(offset, filesz, result) ||
+                result > ef.size)
             goto out_invalid;
+        if (!map || ef.compressed ||
+                map_segment(ef.fd, daddr, filesz, offset, prev_end) == -1) {
+            nbytes = elf_pread(&ef, daddr, filesz, offset);
+            if (nbytes < 0)
+                goto out_error;
+            if (nbytes != filesz)
+                goto out_invalid;
+        }
         memset(daddr + filesz, 0, memsz - filesz);
+        prev_end = mem + _end;
 
         prot = PROT_NONE;
         if (phdr[ph_i].p_flags & PF_R)
@@ -203,28 +403,26 @@ void elf_load(const char *file, uint8_t *mem, size_t mem_size,
     }
 
     free (phdr);
-    close (fd_kernel);
+    elf_close(&ef);
     *p_entry = hdr.e_entry;
     return;
 
 out_error:
     warn("%s", file);
     free (phdr);
-    if (fd_kernel != -1)
-        close (fd_kernel);
+    elf_close(&ef);
     exit(1);
 
 out_invalid:
     warnx("%s: Exec format error", file);
     free (phdr);
-    if (fd_kernel != -1)
-        close (fd_kernel);
+    elf_close(&ef);
     exit(1);
 }
 
 void elf_load_mft(const char *file, struct mft **mft, size_t *mft_size)
 {
-    int fd_kernel = -1;
+    struct elf_file ef;
     ssize_t nbytes;
     size_t ph_size;
     Elf64_Off ph_off;
@@ -236,11 +434,18 @@ void elf_load_mft(const char *file, struct mft **mft, size_t *mft_size)
     struct mft *note = NULL;
     size_t note_offset, note_size = 0;
 
-    fd_kernel = open(file, O_RDONLY);
-    if (fd_kernel == -1)
+    if (elf_open(file, &ef) == -1)
         goto out_error;
+#if defined(POSIX_FADV_WILLNEED)
+    /*
+     * The whole file is loaded later by elf_load(); have the host kernel start
+     * reading it in now, while the tender is setting up. This is only advice,
+     * so errors are ignored.
+     */
+    (void)posix_fadvise(ef.fd, 0, 0, POSIX_FADV_WILLNEED);
+#endif
 
-    nbytes = pread_in_full(fd_kernel, &hdr, sizeof(Elf64_Ehdr), 0);
+    nbytes = elf_pread(&ef, &hdr, sizeof(Elf64_Ehdr), 0);
     if (nbytes < 0)
         goto out_error;
     if (nbytes != sizeof(Elf64_Ehdr))
@@ -255,7 +460,7 @@ void elf_load_mft(const char *file, struct mft **mft, size_t *mft_size)
     phdr = malloc(ph_size);
     if (!phdr)
         goto out_error;
-    nbytes = pread_in_full(fd_kernel, phdr, ph_size, ph_off);
+    nbytes = elf_pread(&ef, phdr, ph_size, ph_off);
     if (nbytes < 0)
         goto out_error;
     if (nbytes != ph_size)
@@ -272,7 +477,7 @@ void elf_load_mft(const char *file, struct mft **mft, size_t *mft_size)
         struct mft_note_header nhdr;
         if (phdr[ph_i].p_filesz < sizeof nhdr)
             continue; /* Too small to be a (valid) Solo5 NOTE, skip */
-        nbytes = pread_in_full(fd_kernel, &nhdr, sizeof nhdr,
+        nbytes = elf_pread(&ef, &nhdr, sizeof nhdr,
                 phdr[ph_i].p_offset);
         if (nbytes < 0)
             goto out_error;
@@ -309,7 +514,7 @@ void elf_load_mft(const char *file, struct mft **mft, size_t *mft_size)
     note = malloc(note_size);
     if (note == NULL)
         goto out_error;
-    nbytes = pread_in_full(fd_kernel, note, note_size, note_offset);
+    nbytes = elf_pread(&ef, note, note_size, note_offset);
     if (nbytes < 0)
         goto out_error;
     if (nbytes != note_size)
@@ -318,22 +523,166 @@ void elf_load_mft(const char *file, struct mft **mft, size_t *mft_size)
     *mft = note;
     *mft_size = note_size;
     free(phdr);
-    close(fd_kernel);
+    elf_close(&ef);
     return;
 
 out_error:
     warn("%s", file);
     free (phdr);
     free (note);
-    if (fd_kernel != -1)
-        close (fd_kernel);
+    elf_close(&ef);
     exit(1);
 
 out_invalid:
     warnx("%s: Exec format error", file);
     free (phdr);
     free (note);
-    if (fd_kernel != -1)
-        close (fd_kernel);
+    elf_close(&ef);
     exit(1);
 }
+
+static int load_symbols(const char *file, uint64_t base, unsigned type,
+        elf_symbol_fn fn, void *arg)
+{
+    struct elf_file ef;
+    ssize_t nbytes;
+    Elf64_Ehdr hdr;
+    Elf64_Phdr *phdr = NULL;
+    Elf64_Shdr *shdr = NULL;
+    Elf64_Sym *sym = NULL;
+    char *strtab = NULL;
+    size_t ph_size, sh_size, sym_size, str_size;
+    Elf64_Half i;
+    int nsyms = 0;
+
+    if (elf_open(file, &ef) == -1)
+        goto out_error;
+
+    nbytes = elf_pread(&ef, &hdr, sizeof(Elf64_Ehdr), 0);
+    if (nbytes < 0)
+        goto out_error;
+    if (nbytes != sizeof(Elf64_Ehdr))
+        goto out_invalid;
+    if (!ehdr_is_valid(&hdr))
+        goto out_invalid;
+    if (hdr.e_phentsize != sizeof(Elf64_Phdr) ||
+            hdr.e_shentsize != sizeof(Elf64_Shdr))
+        goto out_invalid;
+
+    ph_size = sizeof(Elf64_Phdr) * hdr.e_phnum;
+    phdr = malloc(ph_size);
+    if (!phdr)
+        goto out_error;
+    nbytes = elf_pread(&ef, phdr, ph_size, hdr.e_phoff);
+    if (nbytes < 0)
+        goto out_error;
+    if (nbytes != ph_size)
+        goto out_invalid;
+
+    sh_size = sizeof(Elf64_Shdr) * hdr.e_shnum;
+    shdr = malloc(sh_size);
+    if (!shdr)
+        goto out_error;
+    nbytes = elf_pread(&ef, shdr, sh_size, hdr.e_shoff);
+    if (nbytes < 0)
+        goto out_error;
+    if (nbytes != sh_size)
+        goto out_invalid;
+
+    /*
+     * Find the symbol table and the string table holding its names. The
+     * table is only present if the unikernel has not been stripped.
+     */
+    for (i = 0; i < hdr.e_shnum; i++) {
+        if (shdr[i].sh_type == SHT_SYMTAB)
+            break;
+    }
+    if (i == hdr.e_shnum) {
+        warnx("%s: No symbol table found, binary stripped?", file);
+        goto out;
+    }
+    if (shdr[i].sh_link >= hdr.e_shnum ||
+            shdr[shdr[i].sh_link].sh_type != SHT_STRTAB)
+        goto out_invalid;
+
+    sym_size = shdr[i].sh_size - shdr[i].sh_size % sizeof(Elf64_Sym);
+    sym = malloc(sym_size);
+    if (!sym)
+        goto out_error;
+    nbytes = elf_pread(&ef, sym, sym_size, shdr[i].sh_offset);
+    if (nbytes < 0)
+        goto out_error;
+    if (nbytes != sym_size)
+        goto out_invalid;
+
+    str_size = shdr[shdr[i].sh_link].sh_size;
+    if (str_size == 0)
+        goto out_invalid;
+    strtab = malloc(str_size);
+    if (!strtab)
+        goto out_error;
+    nbytes = elf_pread(&ef, strtab, str_size,
+            shdr[shdr[i].sh_link].sh_offset);
+    if (nbytes < 0)
+        goto out_error;
+    if (nbytes != str_size)
+        goto out_invalid;
+    strtab[str_size - 1] = '\0';
+
+    /*
+     * elf_load() places segments at their physical address, so relocate each
+     * symbol from its virtual address by the segment containing it.
+     */
+    for (size_t s = 0; s < sym_size / sizeof(Elf64_Sym); s++) {
+        if (ELF64_ST_TYPE(sym[s].st_info) != type ||
+                sym[s].st_shndx == SHN_UNDEF || sym[s].st_size == 0 ||
+                sym[s].st_name >= str_size)
+            continue;
+
+        uint64_t vaddr = sym[s].st_value;
+        for (Elf64_Half ph_i = 0; ph_i < hdr.e_phnum; ph_i++) {
+            if (phdr[ph_i].p_type != PT_LOAD ||
+                    vaddr < phdr[ph_i].p_vaddr ||
+                    vaddr - phdr[ph_i].p_vaddr >= phdr[ph_i].p_memsz)
+                continue;
+            fn(base + phdr[ph_i].p_paddr + (vaddr - phdr[ph_i].p_vaddr),
+                    sym[s].st_size, &strtab[sym[s].st_name], arg);
+            nsyms++;
+            break;
+        }
+    }
+
+    free(strtab);
+    free(sym);
+    free(shdr);
+    free(phdr);
+    elf_close(&ef);
+    return nsyms;
+
+out_error:
+    warn("%s", file);
+    goto out;
+
+out_invalid:
+    warnx("%s: Exec format error", file);
+
+out:
+    free(strtab);
+    free(sym);
+    free(shdr);
+    free(phdr);
+    elf_close(&ef);
+    return -1;
+}
+
+int elf_load_symbols(const char *file, uint64_t base, elf_symbol_fn fn,
+        void *arg)
+{
+    return load_symbols(file, base, STT_FUNC, fn, arg);
+}
+
+int elf_load_objects(const char *file, uint64_t base, elf_symbol_fn fn,
+        void *arg)
+{
+    return load_symbols(file, base, STT_OBJECT, fn, arg);
+}
@@ -30,8 +30,17 @@
 /*
  * Load an ELF binary from (file) into (mem_size) bytes of (mem), returning
  * the entry point (p_entry), last byte used by the binary (p_end).
+ *
+ * If (map) is true, segments are mapped copy-on-write from (file) where
+ * possible rather than read into (mem), so that they are loaded on demand
+ * and shared with other processes mapping the same file. This requires that
+ * (mem) is ordinary process memory.
+ *
+ * If the tender was built with libzstd, (file) may also be a zstd-compressed
+ * binary, which is decompressed straight into (mem) as it is read; (map) is
+ * then ignored. This also applies to the other functions below.
  */
-void elf_load(const char *file, uint8_t *mem, size_t mem_size,
+void elf_load(const char *file, uint8_t *mem, size_t mem_size, bool map,
         uint64_t *p_entry, uint64_t *p_end);
 
 /*
@@ -41,4 +50,22 @@ void elf_load(const char *file, uint8_t *mem, size_t mem_size,
  */
 void elf_load_mft(const char *file, struct mft **mft, size_t *mft_size);
 
+/*
+ * Call (fn) for each function symbol defined in the symbol table of the ELF
+ * binary (file), passing its address, size and name, and (arg). Addresses are
+ * those at which elf_load() places the function in memory, offset by (base).
+ * Returns the number of symbols found, or -1 if (file) has no symbol table or
+ * cannot be read, with a warning printed.
+ */
+typedef void (*elf_symbol_fn)(uint64_t addr, uint64_t size, const char *name,
+        void *arg);
+int elf_load_symbols(const char *file, uint64_t base, elf_symbol_fn fn,
+        void *arg);
+
+/*
+ * As elf_load_symbols(), for data object symbols.
+ */
+int elf_load_objects(const char *file, uint64_t base, elf_symbol_fn fn,
+        void *arg);
+
 #endif /* COMMON_ELF_H */
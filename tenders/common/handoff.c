@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * handoff.c: Devices passed by a launcher over a UNIX socket (--fds-from).
+ *
+ * Creating and configuring TAP interfaces and opening block devices may
+ * require privileges the tender does not have, and takes time on every
+ * launch. A launcher can instead keep a pool of them ready, and pass them to
+ * each new tender, which then attaches them as pre-existing fds ("@NN").
+ */
+
+#define _GNU_SOURCE
+#include <err.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#endif
+
+#include "handoff.h"
+
+static const char *socket_path;
+
+int handoff_handle_cmdarg(const char *cmdarg)
+{
+    if (strncmp("--fds-from=", cmdarg, 11) != 0)
+        return -1;
+#if defined(__linux__)
+    if (cmdarg[11] == '\0')
+        errx(1, "Malformed argument to --fds-from");
+    socket_path = &cmdarg[11];
+    return 0;
+#else
+    errx(1, "--fds-from is only supported on Linux");
+#endif
+}
+
+#if defined(__linux__)
+
+/*
+ * Returns (opt) with "@(fd)" given as its value.
+ */
+static char *handoff_option(const char *opt, int fd)
+{
+    char *arg;
+    const char *eq = strchr(opt, '=');
+    int rc;
+
+    if (eq == NULL)
+        rc = asprintf(&arg, "%s=@%d", opt, fd);
+    else
+        rc = asprintf(&arg, "%.*s@%d%s", (int)(eq + 1 - opt), opt, fd,
+                eq + 1);
+    if (rc == -1)
+        err(1, "asprintf");
+    return arg;
+}
+
+int handoff_receive(char ***args)
+{
+    struct sockaddr_un sa = { .sun_family = AF_UNIX };
+
+    *args = NULL;
+    if (socket_path == NULL)
+        return 0;
+    if (strlen(socket_path) >= sizeof sa.sun_path)
+        errx(1, "%s: Socket path too long", socket_path);
+    strcpy(sa.sun_path, socket_path);
+
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock == -1)
+        err(1, "socket");
+    if (connect(sock, (const struct sockaddr *)&sa, sizeof sa) == -1)
+        err(1, "%s: Could not connect to launcher", socket_path);
+
+    static char data[HANDOFF_FDS_MAX * 128];
+    struct iovec iov = { .iov_base = data, .iov_len = sizeof data };
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(HANDOFF_FDS_MAX * sizeof (int))];
+    } control;
+    struct msghdr mh = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof control.buf
+    };
+    ssize_t nbytes;
+    do {
+        nbytes = recvmsg(sock, &mh, MSG_CMSG_CLOEXEC);
+    } while (nbytes == -1 && errno == EINTR);
+    if (nbytes == -1)
+        err(1, "%s: Could not receive devices from launcher", socket_path);
+    close(sock);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&mh);
+    if (mh.msg_flags & (MSG_TRUNC | MSG_CTRUNC) || cmsg == NULL ||
+            cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+        errx(1, "%s: Malformed message from launcher", socket_path);
+    int nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof (int);
+    int fds[HANDOFF_FDS_MAX];
+    memcpy(fds, CMSG_DATA(cmsg), nfds * sizeof (int));
+
+    char **opts = malloc(nfds * sizeof (char *));
+    if (opts == NULL)
+        err(1, "malloc");
+    size_t off = 0;
+    for (int i = 0; i < nfds; i++) {
+        const char *opt = &data[off];
+        size_t len = strnlen(opt, nbytes - off);
+        if (off + len == (size_t)nbytes || strncmp(opt, "--", 2) != 0)
+            errx(1, "%s: Malformed message from launcher", socket_path);
+        opts[i] = handoff_option(opt, fds[i]);
+        off += len + 1;
+    }
+    if (off != (size_t)nbytes)
+        errx(1, "%s: Malformed message from launcher", socket_path);
+
+    *args = opts;
+    return nfds;
+}
+
+#else /* !__linux__ */
+
+int handoff_receive(char ***args)
+{
+    *args = NULL;
+    return 0;
+}
+
+#endif
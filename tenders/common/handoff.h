@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * handoff.h: Devices passed by a launcher over a UNIX socket (--fds-from).
+ */
+
+#ifndef COMMON_HANDOFF_H
+#define COMMON_HANDOFF_H
+
+/*
+ * Parse --fds-from=SOCKET (cmdarg). Returns 0 if (cmdarg) was --fds-from, -1
+ * otherwise.
+ */
+int handoff_handle_cmdarg(const char *cmdarg);
+
+/*
+ * If --fds-from was given, connect to its SOCKET, a SOCK_SEQPACKET UNIX
+ * socket on which a launcher listens, and receive a single message from it,
+ * exiting on failure. The message carries up to HANDOFF_FDS_MAX fds with
+ * SCM_RIGHTS, and as its data one NUL-terminated device option for each fd,
+ * in the same order, such as "--net:service" or "--block-direct:storage".
+ * The fd is given as the value of its option, "=@NN", inserted after the
+ * first '=' if the option already has one, so that "--block:storage=,bs=4096"
+ * becomes "--block:storage=@NN,bs=4096".
+ *
+ * Returns the resulting options in (*args), to be handled as if they had
+ * been given on the command line, and their number. The options are never
+ * freed.
+ */
+#define HANDOFF_FDS_MAX 64
+
+int handoff_receive(char ***args);
+
+#endif /* COMMON_HANDOFF_H */
@@ -0,0 +1,421 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * mem.c: Guest memory allocation options common to all tenders.
+ */
+
+#define _GNU_SOURCE
+#include <err.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#include "mem.h"
+
+/*
+ * The default huge page size on all supported architectures with 4K pages,
+ * and the size of the largest ones, which guests may map with a single
+ * page table entry.
+ */
+#define HUGEPAGE_SIZE (1UL << 21)
+#define HUGEPAGE_SIZE_1G (1UL << 30)
+
+int mem_handle_cmdarg(const char *cmdarg, unsigned *mem_flags)
+{
+    if (strcmp("--mem-hugepages", cmdarg) == 0)
+        *mem_flags |= MEM_HUGEPAGES;
+    else if (strcmp("--mem-prefault", cmdarg) == 0)
+        *mem_flags |= MEM_PREFAULT;
+    else if (strcmp("--mem-lazy", cmdarg) == 0)
+        *mem_flags |= MEM_LAZY;
+    else if (strcmp("--mem-mergeable", cmdarg) == 0)
+        *mem_flags |= MEM_MERGEABLE;
+    else if (strcmp("--mem-shared", cmdarg) == 0)
+        *mem_flags |= MEM_SHARED;
+    else if (strcmp("--mem-report", cmdarg) == 0)
+        *mem_flags |= MEM_REPORT;
+    else if (strcmp("--mem-lock", cmdarg) == 0)
+        *mem_flags |= MEM_LOCK;
+    else
+        return -1;
+
+    if ((*mem_flags & MEM_PREFAULT) && (*mem_flags & MEM_LAZY))
+        errx(1, "--mem-prefault and --mem-lazy cannot be used together");
+    /*
+     * Locked memory is populated and reserved up front.
+     */
+    if ((*mem_flags & MEM_LOCK) && (*mem_flags & MEM_LAZY))
+        errx(1, "--mem-lock and --mem-lazy cannot be used together");
+    /*
+     * Huge pages are not merged.
+     */
+    if ((*mem_flags & MEM_HUGEPAGES) && (*mem_flags & MEM_MERGEABLE))
+        errx(1, "--mem-hugepages and --mem-mergeable cannot be used together");
+    /*
+     * Shared guest memory is a single file mapping, which is neither private
+     * nor replaced by huge page mappings.
+     */
+    if ((*mem_flags & MEM_SHARED) &&
+            (*mem_flags & (MEM_HUGEPAGES | MEM_MERGEABLE)))
+        errx(1, "--mem-shared cannot be used with --mem-hugepages or "
+                "--mem-mergeable");
+    return 0;
+}
+
+int mem_shared_fd(size_t size)
+{
+#if defined(__linux__)
+    int fd = memfd_create("solo5-guest-mem", MFD_CLOEXEC);
+    if (fd == -1)
+        return -1;
+    if (ftruncate(fd, size) == -1) {
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return -1;
+    }
+    return fd;
+#else
+    (void)size;
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+int mem_mmap_flags(unsigned mem_flags)
+{
+    int flags = 0;
+
+#if defined(MAP_NORESERVE)
+    if (mem_flags & MEM_LAZY)
+        flags |= MAP_NORESERVE;
+#endif
+    return flags;
+}
+
+void *mem_map(size_t size, int prot, int flags, int fd)
+{
+    size_t align = size >= HUGEPAGE_SIZE_1G ? HUGEPAGE_SIZE_1G : HUGEPAGE_SIZE;
+
+    /*
+     * Reserve enough address space to find an aligned start in, then map
+     * guest memory over it and release what is left either side.
+     */
+    uint8_t *r = mmap(NULL, size + align, PROT_NONE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (r == MAP_FAILED)
+        return MAP_FAILED;
+    uint8_t *p = (uint8_t *)(((uintptr_t)r + align - 1) & ~(align - 1));
+    if (mmap(p, size, prot, flags | MAP_FIXED, fd, 0) != p) {
+        int saved_errno = errno;
+        munmap(r, size + align);
+        errno = saved_errno;
+        return MAP_FAILED;
+    }
+    if (p > r)
+        munmap(r, p - r);
+    if (r + align > p)
+        munmap(p + size, r + align - p);
+    return p;
+}
+
+int mem_hugepages(void *mem, size_t size, int prot, int flags)
+{
+    uintptr_t start = ((uintptr_t)mem + HUGEPAGE_SIZE - 1) &
+        ~(HUGEPAGE_SIZE - 1);
+    uintptr_t end = ((uintptr_t)mem + size) & ~(HUGEPAGE_SIZE - 1);
+    if (end <= start)
+        return 0;
+    void *p = (void *)start;
+    size_t len = end - start;
+
+#if defined(MAP_HUGETLB) && defined(MAP_HUGE_1GB)
+    /*
+     * Where the host has 1GB huge pages reserved, back each whole GB with
+     * one, matching guests which map it with a single entry, and the rest
+     * as below.
+     */
+    uintptr_t start_1g = (start + HUGEPAGE_SIZE_1G - 1) &
+        ~(HUGEPAGE_SIZE_1G - 1);
+    uintptr_t end_1g = end & ~(HUGEPAGE_SIZE_1G - 1);
+    if (end_1g > start_1g) {
+        void *p_1g = (void *)start_1g;
+        size_t len_1g = end_1g - start_1g;
+        if (mmap(p_1g, len_1g, prot,
+                    flags | MAP_FIXED | MAP_HUGETLB | MAP_HUGE_1GB, -1, 0) ==
+                p_1g) {
+            if (start_1g > start && mem_hugepages(p, start_1g - start, prot,
+                        flags) == -1)
+                return -1;
+            if (end > end_1g && mem_hugepages(
+                        (void *)end_1g, end - end_1g, prot, flags) == -1)
+                return -1;
+            return 0;
+        }
+        if (mmap(p_1g, len_1g, prot, flags | MAP_FIXED, -1, 0) != p_1g)
+            err(1, "Could not restore guest memory mapping");
+    }
+#endif
+#if defined(MAP_HUGETLB)
+    /*
+     * Huge pages are reserved when MAP_HUGETLB memory is mapped, so this fails
+     * up front if not enough are available. In that case, the original
+     * mapping is restored.
+     */
+    if (mmap(p, len, prot, flags | MAP_FIXED | MAP_HUGETLB, -1, 0) == p)
+        return 0;
+    if (mmap(p, len, prot, flags | MAP_FIXED, -1, 0) != p)
+        err(1, "Could not restore guest memory mapping");
+#endif
+#if defined(MADV_HUGEPAGE)
+    if (madvise(p, len, MADV_HUGEPAGE) == 0)
+        return 0;
+#endif
+    return -1;
+}
+
+/*
+ * Mappings smaller than this are populated by a single thread.
+ */
+#define PREFAULT_CHUNK_SIZE (1UL << 28)
+#define PREFAULT_THREADS_MAX 8
+
+struct prefault_range {
+    uint8_t *start;
+    size_t len;
+};
+
+static void *prefault_range(void *arg)
+{
+    struct prefault_range *r = arg;
+    long pagesize = sysconf(_SC_PAGESIZE);
+
+    /*
+     * Guest memory has not been loaded yet, so writing to it is harmless, and
+     * unlike reading it does not leave the zero page mapped in its place.
+     */
+    for (size_t off = 0; off < r->len; off += pagesize)
+        ((volatile uint8_t *)r->start)[off] = 0;
+    return NULL;
+}
+
+void mem_prefault(void *mem, size_t size)
+{
+#if defined(MADV_POPULATE_WRITE)
+    if (madvise(mem, size, MADV_POPULATE_WRITE) == 0)
+        return;
+#endif
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t nthreads = size / PREFAULT_CHUNK_SIZE;
+    if (nthreads > PREFAULT_THREADS_MAX)
+        nthreads = PREFAULT_THREADS_MAX;
+    if (ncpus > 0 && nthreads > (size_t)ncpus)
+        nthreads = ncpus;
+    if (nthreads < 1)
+        nthreads = 1;
+
+    pthread_t threads[PREFAULT_THREADS_MAX];
+    bool started[PREFAULT_THREADS_MAX] = { false };
+    struct prefault_range ranges[PREFAULT_THREADS_MAX];
+    size_t len = size / nthreads;
+    for (size_t i = 0; i < nthreads; i++) {
+        ranges[i].start = (uint8_t *)mem + i * len;
+        ranges[i].len = (i == nthreads - 1) ? size - i * len : len;
+    }
+    /*
+     * The first range is populated by the calling thread; if a thread cannot
+     * be created, its range is too.
+     */
+    for (size_t i = 1; i < nthreads; i++) {
+        if (pthread_create(&threads[i], NULL, prefault_range, &ranges[i]) == 0)
+            started[i] = true;
+        else
+            prefault_range(&ranges[i]);
+    }
+    prefault_range(&ranges[0]);
+    for (size_t i = 1; i < nthreads; i++) {
+        if (started[i])
+            pthread_join(threads[i], NULL);
+    }
+}
+
+int mem_lock(void *mem, size_t size)
+{
+    struct rlimit rl;
+
+    if (getrlimit(RLIMIT_MEMLOCK, &rl) == 0 && rl.rlim_cur != rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        (void)setrlimit(RLIMIT_MEMLOCK, &rl);
+    }
+    return mlock(mem, size);
+}
+
+int mem_mergeable(void *mem, size_t size)
+{
+#if defined(MADV_MERGEABLE)
+    static bool checked;
+
+    if (madvise(mem, size, MADV_MERGEABLE) == -1)
+        return -1;
+    if (checked)
+        return 0;
+    checked = true;
+
+    int run = 0;
+    FILE *f = fopen("/sys/kernel/mm/ksm/run", "r");
+    if (f != NULL) {
+        if (fscanf(f, "%d", &run) != 1)
+            run = 0;
+        fclose(f);
+    }
+    if (run != 1)
+        warnx("Page merging is not enabled on the host, guest memory will "
+                "not be merged until it is (/sys/kernel/mm/ksm/run)");
+    return 0;
+#else
+    (void)mem;
+    (void)size;
+    return -1;
+#endif
+}
+
+void mem_mergeable_report(void)
+{
+    unsigned long pages;
+    FILE *f = fopen("/proc/self/ksm_merging_pages", "r");
+    if (f == NULL) {
+        warnx("Merged page statistics are not available on this host");
+        return;
+    }
+    if (fscanf(f, "%lu", &pages) == 1)
+        warnx("%lu pages (%lu MB) of guest memory merged", pages,
+                pages * sysconf(_SC_PAGESIZE) >> 20);
+    fclose(f);
+}
+
+#if defined(__linux__)
+/*
+ * Returns the value in kB of the field (key) in the /proc file (file), or -1
+ * if not present.
+ */
+static long proc_kb(const char *file, const char *key)
+{
+    char line[128];
+    size_t len = strlen(key);
+    long kb = -1;
+
+    FILE *f = fopen(file, "r");
+    if (f == NULL)
+        return -1;
+    while (fgets(line, sizeof line, f) != NULL) {
+        if (strncmp(line, key, len) == 0 && line[len] == ':') {
+            kb = strtol(line + len + 1, NULL, 10);
+            break;
+        }
+    }
+    fclose(f);
+    return kb;
+}
+#endif
+
+void mem_report(const void *mem, size_t size, uint64_t heap_start)
+{
+#if defined(__OpenBSD__)
+    (void)mem;
+    (void)size;
+    (void)heap_start;
+    warnx("Guest memory usage is not available on this host");
+#else
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t pages = size / page_size;
+    unsigned char *vec = malloc(pages);
+    if (vec == NULL)
+        err(1, "malloc");
+
+    /*
+     * Pages which were touched but have since been released by the guest, or
+     * swapped out, are not counted.
+     */
+    if (mincore((void *)mem, pages * page_size, (void *)vec) == -1) {
+        warn("Could not determine guest memory usage: mincore() failed");
+        free(vec);
+        return;
+    }
+    size_t resident = 0, run = 0, gap = 0, gap_start = 0;
+    size_t first = (heap_start < size) ? heap_start / page_size : pages;
+    for (size_t i = 0; i < pages; i++) {
+        if (vec[i] & 1) {
+            resident++;
+            run = 0;
+        }
+        else if (i >= first && ++run > gap) {
+            gap = run;
+            gap_start = i + 1 - run;
+        }
+    }
+    free(vec);
+
+    warnx("%zu MB of %zu MB guest memory touched (%zu%%)",
+            resident * page_size >> 20, size >> 20,
+            pages ? resident * 100 / pages : 0);
+    if (heap_start != 0 && gap != 0)
+        warnx("Guest heap high-water mark 0x%zx, %zu MB untouched between "
+                "heap and stack", gap_start * page_size,
+                gap * page_size >> 20);
+
+#if defined(__linux__)
+    long rss = proc_kb("/proc/self/status", "VmRSS");
+    long hwm = proc_kb("/proc/self/status", "VmHWM");
+    long thp = proc_kb("/proc/self/smaps_rollup", "AnonHugePages");
+    long hugetlb = proc_kb("/proc/self/status", "HugetlbPages");
+    if (rss != -1 && hwm != -1)
+        warnx("Tender RSS %ld MB, peak %ld MB", rss >> 10, hwm >> 10);
+    if (thp > 0 || hugetlb > 0)
+        warnx("%ld MB in transparent huge pages, %ld MB in hugetlbfs pages",
+                (thp > 0 ? thp : 0) >> 10, (hugetlb > 0 ? hugetlb : 0) >> 10);
+#else
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) == 0)
+        warnx("Tender peak RSS %ld MB", (long)ru.ru_maxrss >> 10);
+#endif
+#endif /* !__OpenBSD__ */
+}
+
+int mem_release(void *mem, size_t size)
+{
+#if defined(MADV_REMOVE)
+    /*
+     * Pages of shared mappings stay in memory unless removed from the
+     * backing object. This fails for private mappings, such as guest memory
+     * restored from a snapshot, which are handled below.
+     */
+    if (madvise(mem, size, MADV_REMOVE) == 0)
+        return 0;
+#endif
+    return madvise(mem, size, MADV_DONTNEED);
+}
@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * mem.h: Guest memory allocation options common to all tenders.
+ */
+
+#ifndef COMMON_MEM_H
+#define COMMON_MEM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Guest memory options (--mem-hugepages, --mem-prefault, --mem-lazy,
+ * --mem-mergeable, --mem-shared, --mem-report, --mem-lock), passed as
+ * (mem_flags) to hvt_init() and spt_init().
+ */
+#define MEM_HUGEPAGES   (1U << 0)
+#define MEM_PREFAULT    (1U << 1)
+#define MEM_LAZY        (1U << 2)
+#define MEM_MERGEABLE   (1U << 3)
+#define MEM_SHARED      (1U << 4)
+#define MEM_REPORT      (1U << 5)
+#define MEM_LOCK        (1U << 6)
+
+/*
+ * Parse a guest memory option (cmdarg) into (*mem_flags). Returns 0 if
+ * (cmdarg) was a guest memory option, -1 otherwise. Exits if --mem-prefault
+ * and --mem-lazy, or --mem-hugepages and --mem-mergeable, are both given, if
+ * --mem-shared is given with --mem-hugepages or --mem-mergeable, or if
+ * --mem-lock is given with --mem-lazy.
+ */
+int mem_handle_cmdarg(const char *cmdarg, unsigned *mem_flags);
+
+/*
+ * Returns the flags to add to mmap() flags when allocating guest memory with
+ * (mem_flags).
+ */
+int mem_mmap_flags(unsigned mem_flags);
+
+/*
+ * Create an anonymous file of (size) bytes to back guest memory with
+ * --mem-shared, so that it can be mapped by other processes, such as
+ * vhost-user backends, given its descriptor. Returns the descriptor, or -1
+ * and an appropriate errno (ENOTSUP if not supported on this host).
+ */
+int mem_shared_fd(size_t size);
+
+/*
+ * Map (size) bytes of guest memory as mmap() would with (prot), (flags) and
+ * (fd), at a host address aligned to 1GB if (size) is at least 1GB, or to the
+ * huge page size otherwise, so that huge pages backing guest memory line up
+ * with the largest blocks the guest maps it with. Returns MAP_FAILED and an
+ * appropriate errno on failure.
+ */
+void *mem_map(size_t size, int prot, int flags, int fd);
+
+/*
+ * Back the part of the guest memory mapping at (mem, size) which is aligned to
+ * the huge page size with huge pages. (mem) must be an anonymous mapping
+ * created with (prot) and (flags).
+ *
+ * The aligned part is replaced with an explicit (MAP_HUGETLB) mapping if the
+ * host has enough huge pages reserved, using 1GB pages for any whole GBs if
+ * enough of those are reserved. Otherwise, it is left in place and
+ * transparent huge pages are requested for it with madvise(MADV_HUGEPAGE).
+ * Returns -1 if neither is supported by the host.
+ */
+int mem_hugepages(void *mem, size_t size, int prot, int flags);
+
+/*
+ * Populate all pages of the guest memory mapping at (mem, size) up front, so
+ * that the guest does not take any first-touch page faults. Large mappings
+ * are populated by several threads in parallel.
+ */
+void mem_prefault(void *mem, size_t size);
+
+/*
+ * Lock the populated guest memory mapping at (mem, size) into memory, so that
+ * the host does not swap it out, raising the tender's RLIMIT_MEMLOCK as far
+ * as it is allowed to first. Returns -1 and an appropriate errno on failure.
+ */
+int mem_lock(void *mem, size_t size);
+
+/*
+ * Allow the host to merge pages of the private guest memory mapping at (mem,
+ * size) with identical pages elsewhere (KSM). Returns -1 if not supported by
+ * the host. Warns, once, if merging is supported but not enabled.
+ */
+int mem_mergeable(void *mem, size_t size);
+
+/*
+ * Report how much memory of the tender process has been merged, to be called
+ * at exit by tenders using --mem-mergeable.
+ */
+void mem_mergeable_report(void);
+
+/*
+ * Report how much of the guest memory mapping at (mem, size) has been
+ * touched, i.e. is resident, and the memory use of the tender process, to be
+ * called at exit by tenders using --mem-report. If (heap_start) is not 0, the
+ * largest untouched range above it is reported as the headroom between the
+ * guest's heap and its stack.
+ */
+void mem_report(const void *mem, size_t size, uint64_t heap_start);
+
+/*
+ * Give the pages of the guest memory mapping at (mem, size), which must be
+ * aligned to the host page size, back to the host. Their contents are
+ * undefined when next accessed. Returns -1 if the host cannot reclaim them.
+ */
+int mem_release(void *mem, size_t size);
+
+#endif /* COMMON_MEM_H */
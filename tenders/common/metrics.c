@@ -0,0 +1,449 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * metrics.c: Live counters in Prometheus text format (--metrics).
+ *
+ * Each connection to the socket is answered with the current value of all
+ * counters and closed. If the client sends an HTTP request first, the
+ * response is preceded by an HTTP header, so that the socket can be scraped
+ * through a proxy as well as read with socat(1).
+ */
+
+#define _GNU_SOURCE
+#include <err.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#endif
+
+#include "boot_trace.h"
+#include "elf.h"
+#include "metrics.h"
+#include "solo5.h"
+
+static const char *socket_path;
+
+int metrics_handle_cmdarg(const char *cmdarg)
+{
+    if (strncmp("--metrics=", cmdarg, 10) != 0)
+        return -1;
+#if defined(__linux__)
+    if (cmdarg[10] == '\0')
+        errx(1, "Malformed argument to --metrics");
+    socket_path = &cmdarg[10];
+    return 0;
+#else
+    errx(1, "--metrics is only supported on Linux");
+#endif
+}
+
+bool metrics_enabled(void)
+{
+    return socket_path != NULL;
+}
+
+void metrics_printf(struct metrics_buf *b, const char *fmt, ...)
+{
+    va_list ap;
+
+    if (b->len >= b->size)
+        return;
+    va_start(ap, fmt);
+    int n = vsnprintf(b->data + b->len, b->size - b->len, fmt, ap);
+    va_end(ap);
+    /*
+     * A response which does not fit is cut short before the first output
+     * which does not.
+     */
+    if (n < 0 || (size_t)n >= b->size - b->len) {
+        b->data[b->len] = '\0';
+        b->size = b->len;
+    }
+    else
+        b->len += n;
+}
+
+void metrics_header(struct metrics_buf *b, const char *name,
+        const char *type, const char *help)
+{
+    metrics_printf(b, "# HELP %s %s\n# TYPE %s %s\n", name, help, name,
+            type);
+}
+
+static struct {
+    metrics_fn fn;
+    void *arg;
+} sources[METRICS_SOURCES_MAX];
+static unsigned nsources;
+
+int metrics_register(metrics_fn fn, void *arg)
+{
+    if (nsources == METRICS_SOURCES_MAX)
+        return -1;
+    sources[nsources].fn = fn;
+    sources[nsources].arg = arg;
+    nsources++;
+    return 0;
+}
+
+#if defined(__linux__)
+
+static int listenfd = -1;
+static struct mft *metrics_mft;
+static uint8_t *guest_mem;
+static size_t guest_mem_size;
+
+/*
+ * The per-device counters kept by the bindings (see bindings/stats.c), if
+ * found in the unikernel's symbol table, or NULL.
+ */
+static struct solo5_net_stats *guest_net_stats;
+static struct solo5_block_stats *guest_block_stats;
+
+static void find_stats(uint64_t addr, uint64_t size, const char *name,
+        void *arg)
+{
+    (void)arg;
+
+    if (addr > guest_mem_size || size > guest_mem_size - addr)
+        return;
+    if (strcmp(name, "__solo5_net_stats") == 0 &&
+            size == MFT_MAX_ENTRIES * sizeof (struct solo5_net_stats) &&
+            addr % sizeof (uint64_t) == 0)
+        guest_net_stats = (struct solo5_net_stats *)(guest_mem + addr);
+    else if (strcmp(name, "__solo5_block_stats") == 0 &&
+            size == MFT_MAX_ENTRIES * sizeof (struct solo5_block_stats) &&
+            addr % sizeof (uint64_t) == 0)
+        guest_block_stats = (struct solo5_block_stats *)(guest_mem + addr);
+}
+
+static void cleanup(void)
+{
+    (void)unlink(socket_path);
+}
+
+void metrics_init(const char *elffile, struct mft *mft, uint8_t *mem,
+        size_t mem_size)
+{
+    struct sockaddr_un sa = { .sun_family = AF_UNIX };
+    struct stat st;
+
+    if (socket_path == NULL)
+        return;
+    if (strlen(socket_path) >= sizeof sa.sun_path)
+        errx(1, "--metrics: %s: Path too long", socket_path);
+    strcpy(sa.sun_path, socket_path);
+
+    /*
+     * A socket left behind by a previous tender is replaced.
+     */
+    if (stat(socket_path, &st) == 0 && S_ISSOCK(st.st_mode))
+        (void)unlink(socket_path);
+    listenfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listenfd == -1)
+        err(1, "--metrics: socket() failed");
+    if (bind(listenfd, (struct sockaddr *)&sa, sizeof sa) == -1)
+        err(1, "--metrics: Could not bind to %s", socket_path);
+    if (listen(listenfd, 8) == -1)
+        err(1, "--metrics: listen() failed");
+    atexit(cleanup);
+
+    metrics_mft = mft;
+    guest_mem = mem;
+    guest_mem_size = mem_size;
+    if (elf_load_objects(elffile, 0, find_stats, NULL) == -1 ||
+            guest_net_stats == NULL || guest_block_stats == NULL)
+        warnx("--metrics: Device counters not found in %s, not reporting "
+                "them", elffile);
+}
+
+/*
+ * Returns the number of bytes of guest memory resident in host memory.
+ */
+static uint64_t guest_resident(void)
+{
+    static unsigned char vec[4096];
+    long page_size = sysconf(_SC_PAGESIZE);
+    size_t chunk = sizeof vec * page_size;
+    uint64_t pages = 0;
+
+    for (size_t off = 0; off < guest_mem_size; off += chunk) {
+        size_t len = guest_mem_size - off < chunk ?
+            guest_mem_size - off : chunk;
+        if (mincore(guest_mem + off, len, vec) == -1)
+            return 0;
+        for (size_t i = 0; i < (len + page_size - 1) / page_size; i++)
+            pages += vec[i] & 1;
+    }
+    return pages * page_size;
+}
+
+/*
+ * Print (name) escaped as a label value.
+ */
+static void print_label(struct metrics_buf *b, const char *name)
+{
+    for (; *name; name++) {
+        if (*name == '\\' || *name == '"')
+            metrics_printf(b, "\\%c", *name);
+        else if (*name == '\n')
+            metrics_printf(b, "\\n");
+        else
+            metrics_printf(b, "%c", *name);
+    }
+}
+
+static void device_counter(struct metrics_buf *b, const char *metric,
+        unsigned i, const char *label, const char *value, uint64_t *counter)
+{
+    metrics_printf(b, "%s{device=\"", metric);
+    print_label(b, metrics_mft->e[i].name);
+    if (label != NULL)
+        metrics_printf(b, "\",%s=\"%s", label, value);
+    metrics_printf(b, "\"} %llu\n",
+            (unsigned long long)__atomic_load_n(counter, __ATOMIC_RELAXED));
+}
+
+static void device_metrics(struct metrics_buf *b)
+{
+    struct mft *mft = metrics_mft;
+
+    if (guest_net_stats != NULL) {
+        metrics_header(b, "solo5_net_packets_total", "counter",
+                "Packets moved by the unikernel.");
+        for (unsigned i = 0; i != mft->entries; i++) {
+            if (mft->e[i].type != MFT_NET_BASIC)
+                continue;
+            struct solo5_net_stats *s = &guest_net_stats[i];
+            device_counter(b, "solo5_net_packets_total", i, "direction", "rx",
+                    &s->rx_packets);
+            device_counter(b, "solo5_net_packets_total", i, "direction", "tx",
+                    &s->tx_packets);
+        }
+        metrics_header(b, "solo5_net_bytes_total", "counter",
+                "Bytes moved by the unikernel.");
+        for (unsigned i = 0; i != mft->entries; i++) {
+            if (mft->e[i].type != MFT_NET_BASIC)
+                continue;
+            struct solo5_net_stats *s = &guest_net_stats[i];
+            device_counter(b, "solo5_net_bytes_total", i, "direction", "rx",
+                    &s->rx_bytes);
+            device_counter(b, "solo5_net_bytes_total", i, "direction", "tx",
+                    &s->tx_bytes);
+        }
+        metrics_header(b, "solo5_net_again_total", "counter",
+                "Network calls which would have blocked.");
+        for (unsigned i = 0; i != mft->entries; i++) {
+            if (mft->e[i].type != MFT_NET_BASIC)
+                continue;
+            struct solo5_net_stats *s = &guest_net_stats[i];
+            device_counter(b, "solo5_net_again_total", i, "direction", "rx",
+                    &s->rx_again);
+            device_counter(b, "solo5_net_again_total", i, "direction", "tx",
+                    &s->tx_again);
+        }
+        metrics_header(b, "solo5_net_errors_total", "counter",
+                "Network calls which failed.");
+        for (unsigned i = 0; i != mft->entries; i++) {
+            if (mft->e[i].type != MFT_NET_BASIC)
+                continue;
+            struct solo5_net_stats *s = &guest_net_stats[i];
+            device_counter(b, "solo5_net_errors_total", i, "direction", "rx",
+                    &s->rx_errors);
+            device_counter(b, "solo5_net_errors_total", i, "direction", "tx",
+                    &s->tx_errors);
+        }
+    }
+
+    if (guest_block_stats != NULL) {
+        metrics_header(b, "solo5_block_ops_total", "counter",
+                "Block requests completed by the unikernel.");
+        for (unsigned i = 0; i != mft->entries; i++) {
+            if (mft->e[i].type != MFT_BLOCK_BASIC)
+                continue;
+            struct solo5_block_stats *s = &guest_block_stats[i];
+            device_counter(b, "solo5_block_ops_total", i, "op", "read",
+                    &s->read_ops);
+            device_counter(b, "solo5_block_ops_total", i, "op", "write",
+                    &s->write_ops);
+            device_counter(b, "solo5_block_ops_total", i, "op", "flush",
+                    &s->flush_ops);
+            device_counter(b, "solo5_block_ops_total", i, "op", "discard",
+                    &s->discard_ops);
+        }
+        metrics_header(b, "solo5_block_bytes_total", "counter",
+                "Bytes moved by block requests.");
+        for (unsigned i = 0; i != mft->entries; i++) {
+            if (mft->e[i].type != MFT_BLOCK_BASIC)
+                continue;
+            struct solo5_block_stats *s = &guest_block_stats[i];
+            device_counter(b, "solo5_block_bytes_total", i, "op", "read",
+                    &s->read_bytes);
+            device_counter(b, "solo5_block_bytes_total", i, "op", "write",
+                    &s->write_bytes);
+        }
+        metrics_header(b, "solo5_block_errors_total", "counter",
+                "Block requests which failed.");
+        for (unsigned i = 0; i != mft->entries; i++) {
+            if (mft->e[i].type != MFT_BLOCK_BASIC)
+                continue;
+            device_counter(b, "solo5_block_errors_total", i, NULL, NULL,
+                    &guest_block_stats[i].errors);
+        }
+    }
+}
+
+static void process_metrics(struct metrics_buf *b)
+{
+    struct rusage ru;
+    uint64_t now = boot_trace_now();
+
+    metrics_header(b, "solo5_uptime_seconds", "gauge",
+            "Time since the tender started.");
+    metrics_printf(b, "solo5_uptime_seconds %.3f\n",
+            (now - boot_trace_start()) / 1e9);
+
+    if (getrusage(RUSAGE_SELF, &ru) == 0) {
+        metrics_header(b, "solo5_cpu_seconds_total", "counter",
+                "CPU time used by the tender, including the unikernel.");
+        metrics_printf(b, "solo5_cpu_seconds_total{mode=\"user\"} %ld.%06ld\n",
+                (long)ru.ru_utime.tv_sec, (long)ru.ru_utime.tv_usec);
+        metrics_printf(b,
+                "solo5_cpu_seconds_total{mode=\"system\"} %ld.%06ld\n",
+                (long)ru.ru_stime.tv_sec, (long)ru.ru_stime.tv_usec);
+    }
+
+    metrics_header(b, "solo5_guest_memory_bytes", "gauge",
+            "Guest memory size.");
+    metrics_printf(b, "solo5_guest_memory_bytes %zu\n", guest_mem_size);
+    metrics_header(b, "solo5_guest_resident_bytes", "gauge",
+            "Guest memory resident in host memory.");
+    metrics_printf(b, "solo5_guest_resident_bytes %llu\n",
+            (unsigned long long)guest_resident());
+}
+
+/*
+ * Answer the connection (fd). Data is moved with recv() and send(), which
+ * fail on anything but a socket.
+ */
+static void serve(int fd)
+{
+    static char request[1024];
+    static char response[65536];
+    struct metrics_buf b = {
+        .data = response, .len = 0, .size = sizeof response
+    };
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    bool http = false;
+
+    /*
+     * Give the client a moment to send a request, to tell HTTP clients from
+     * others.
+     */
+    if (poll(&pfd, 1, 100) == 1) {
+        ssize_t n = recv(fd, request, sizeof request, MSG_DONTWAIT);
+        http = n >= 4 && memcmp(request, "GET ", 4) == 0;
+    }
+
+    process_metrics(&b);
+    device_metrics(&b);
+    for (unsigned i = 0; i != nsources; i++)
+        sources[i].fn(&b, sources[i].arg);
+
+    if (http) {
+        char header[128];
+        int n = snprintf(header, sizeof header, "HTTP/1.0 200 OK\r\n"
+                "Content-Type: text/plain; version=0.0.4\r\n"
+                "Content-Length: %zu\r\n\r\n", b.len);
+        if (send(fd, header, n, MSG_NOSIGNAL) != n)
+            return;
+    }
+    for (size_t off = 0; off < b.len; ) {
+        ssize_t n = send(fd, b.data + off, b.len - off, MSG_NOSIGNAL);
+        if (n <= 0)
+            break;
+        off += n;
+    }
+}
+
+static void *metrics_thread(void *arg)
+{
+    void (*thread_init)(int) = (void (*)(int))arg;
+
+    if (thread_init != NULL)
+        thread_init(listenfd);
+    for (;;) {
+        int fd = accept4(listenfd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            err(1, "--metrics: accept() failed");
+        }
+        serve(fd);
+        close(fd);
+    }
+    return NULL;
+}
+
+void metrics_start(void (*thread_init)(int listenfd))
+{
+    pthread_t tid;
+
+    if (listenfd == -1)
+        return;
+    if (pthread_create(&tid, NULL, metrics_thread, (void *)thread_init) != 0)
+        errx(1, "pthread_create() failed");
+}
+
+#else /* !__linux__ */
+
+void metrics_init(const char *elffile, struct mft *mft, uint8_t *mem,
+        size_t mem_size)
+{
+    (void)elffile;
+    (void)mft;
+    (void)mem;
+    (void)mem_size;
+}
+
+void metrics_start(void (*thread_init)(int listenfd))
+{
+    (void)thread_init;
+}
+
+#endif /* __linux__ */
@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * metrics.h: Live counters in Prometheus text format (--metrics).
+ */
+
+#ifndef COMMON_METRICS_H
+#define COMMON_METRICS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mft.h"
+
+/*
+ * Parse --metrics=PATH (cmdarg). Returns 0 if (cmdarg) was --metrics, -1
+ * otherwise.
+ */
+int metrics_handle_cmdarg(const char *cmdarg);
+
+/*
+ * Returns true if --metrics was given.
+ */
+bool metrics_enabled(void);
+
+/*
+ * A buffer into which a response is formatted, without allocating memory.
+ */
+struct metrics_buf {
+    char *data;
+    size_t len;
+    size_t size;
+};
+
+void metrics_printf(struct metrics_buf *b, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+/*
+ * Print the HELP and TYPE lines introducing the metric (name) to (b).
+ */
+void metrics_header(struct metrics_buf *b, const char *name,
+        const char *type, const char *help);
+
+/*
+ * Register (fn) to add metrics to each response, passing (arg). Up to
+ * METRICS_SOURCES_MAX may be registered, before metrics_start().
+ */
+#define METRICS_SOURCES_MAX 4
+
+typedef void (*metrics_fn)(struct metrics_buf *b, void *arg);
+int metrics_register(metrics_fn fn, void *arg);
+
+/*
+ * Create the socket given with --metrics, if any, exiting on failure. The
+ * socket is removed when the tender exits through exit(). The
+ * unikernel (elffile) has been loaded into (mem_size) bytes of (mem) by
+ * elf_load(); the per-device I/O counters kept by its bindings are found in
+ * its symbol table, and reported for the devices in (mft).
+ */
+void metrics_init(const char *elffile, struct mft *mft, uint8_t *mem,
+        size_t mem_size);
+
+/*
+ * Start serving the socket from a new thread, which calls (thread_init), if
+ * not NULL, before accepting any connection. The thread makes no system
+ * calls other than accept4() on (listenfd), poll(), recvfrom(), sendto() and
+ * close() on connections, getrusage(), mincore(), clock_gettime(), and
+ * write() to stderr when exiting on error.
+ */
+void metrics_start(void (*thread_init)(int listenfd));
+
+#endif /* COMMON_METRICS_H */
@@ -24,11 +24,46 @@
 
 #ifndef __SOLO5_BINDINGS__
 #include <assert.h>
+#include <err.h>
 #include <string.h>
+
+#include "solo5.h"
 #endif
 
 #include "mft.h"
 
+#define MFT_NET_OFFLOAD_ALL (MFT_NET_OFFLOAD_HDR | MFT_NET_OFFLOAD_CSUM | \
+        MFT_NET_OFFLOAD_TSO4 | MFT_NET_OFFLOAD_TSO6)
+
+/*
+ * Check the attributes declared for manifest entry (e), which are untrusted.
+ */
+static bool attrs_valid(const struct mft_entry *e)
+{
+    switch (e->type) {
+    case MFT_BLOCK_BASIC: {
+        const struct mft_block_attrs *a = &e->attrs.block;
+        return (a->block_size == 0 || (a->block_size >= 512 &&
+                    (a->block_size & (a->block_size - 1)) == 0)) &&
+            (a->flags & ~MFT_BLOCK_ATTR_DIRECT) == 0;
+    }
+    case MFT_NET_BASIC: {
+        const struct mft_net_attrs *a = &e->attrs.net;
+        return (a->mtu == 0 || (a->mtu >= MFT_NET_MTU_MIN &&
+                    a->mtu <= MFT_NET_MTU_MAX)) &&
+            (a->offloads & ~MFT_NET_OFFLOAD_ALL) == 0;
+    }
+    case MFT_SHM_BASIC:
+        return (e->attrs.shm.size % MFT_SHM_PAGE_SIZE) == 0;
+    case MFT_PCI_BASIC:
+        return true;
+    case MFT_VSOCK_BASIC:
+        return e->attrs.vsock.port != 0;
+    default:
+        return false;
+    }
+}
+
 int mft_validate(struct mft *mft, size_t mft_size)
 {
     /*
@@ -55,6 +90,8 @@ int mft_validate(struct mft *mft, size_t mft_size)
          * in the array itself.
          */
         mft->e[i].name[MFT_NAME_MAX] = 0;
+        if (!attrs_valid(&mft->e[i]))
+            return -1;
         /*
          * Sanitize private fields (to be used by the tender/bindings):
          *
@@ -103,7 +140,84 @@ const char *mft_type_to_string(mft_type_t type)
             return "BLOCK_BASIC";
         case MFT_NET_BASIC:
             return "NET_BASIC";
+        case MFT_SHM_BASIC:
+            return "SHM_BASIC";
+        case MFT_PCI_BASIC:
+            return "PCI_BASIC";
+        case MFT_VSOCK_BASIC:
+            return "VSOCK_BASIC";
         default:
             assert(false);
     }
 }
+
+#ifndef __SOLO5_BINDINGS__
+int mft_check_attrs(const struct mft_entry *e)
+{
+    switch (e->type) {
+    case MFT_BLOCK_BASIC: {
+        const struct mft_block_attrs *a = &e->attrs.block;
+        if (a->block_size != 0 &&
+                e->u.block_basic.block_size != a->block_size) {
+            warnx("Block device '%s' has a block size of %u bytes, manifest "
+                    "requires %u", e->name, e->u.block_basic.block_size,
+                    a->block_size);
+            return -1;
+        }
+        if (a->queue_depth > SOLO5_BLOCK_QUEUE_MAX) {
+            warnx("Block device '%s': manifest requests a queue depth of %u, "
+                    "at most %u is supported", e->name, a->queue_depth,
+                    SOLO5_BLOCK_QUEUE_MAX);
+            return -1;
+        }
+        return 0;
+    }
+    case MFT_NET_BASIC: {
+        const struct mft_net_attrs *a = &e->attrs.net;
+        if (a->mtu != 0 && e->u.net_basic.mtu != a->mtu) {
+            warnx("Network '%s' has an MTU of %u, manifest requires %u",
+                    e->name, e->u.net_basic.mtu, a->mtu);
+            return -1;
+        }
+        if (a->queues > 1) {
+            warnx("Network '%s': manifest requests %u queues, only 1 is "
+                    "supported", e->name, a->queues);
+            return -1;
+        }
+        if ((e->u.net_basic.offloads & a->offloads) != a->offloads) {
+            warnx("Network '%s' does not provide the offloads required by "
+                    "the manifest (0x%x, have 0x%x)", e->name, a->offloads,
+                    e->u.net_basic.offloads);
+            return -1;
+        }
+        return 0;
+    }
+    case MFT_SHM_BASIC: {
+        uint64_t size = (uint64_t)e->u.shm_basic.pages * MFT_SHM_PAGE_SIZE;
+        if (size < e->attrs.shm.size) {
+            warnx("Shared-memory region '%s' has a size of %llu bytes, "
+                    "manifest requires %llu", e->name,
+                    (unsigned long long)size,
+                    (unsigned long long)e->attrs.shm.size);
+            return -1;
+        }
+        return 0;
+    }
+    case MFT_PCI_BASIC: {
+        const struct mft_pci_attrs *a = &e->attrs.pci;
+        if ((a->vendor_id && a->vendor_id != e->u.pci_basic.vendor_id) ||
+                (a->device_id && a->device_id != e->u.pci_basic.device_id)) {
+            warnx("PCI device '%s' is %04x:%04x, manifest requires %04x:%04x",
+                    e->name, e->u.pci_basic.vendor_id,
+                    e->u.pci_basic.device_id, a->vendor_id, a->device_id);
+            return -1;
+        }
+        return 0;
+    }
+    case MFT_VSOCK_BASIC:
+        return 0;
+    default:
+        assert(false);
+    }
+}
+#endif
@@ -56,4 +56,15 @@ struct mft_entry *mft_get_by_index(struct mft *mft, unsigned index,
  */
 const char *mft_type_to_string(mft_type_t type);
 
+#ifndef __SOLO5_BINDINGS__
+/*
+ * Check that the attached device (e) has the properties required by the
+ * attributes declared for it in the manifest. Preferences, and defaults for
+ * properties not given on the command line, are applied by the tender when
+ * attaching the device. Returns 0 on success, or -1 with a warning naming the
+ * device and the attribute which cannot be honoured.
+ */
+int mft_check_attrs(const struct mft_entry *e);
+#endif
+
 #endif /* MFT_H */
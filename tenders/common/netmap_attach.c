@@ -0,0 +1,253 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * netmap_attach.c: Common functions for attaching to netmap ports.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__FreeBSD__)
+
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <net/if.h>
+#include <net/netmap.h>
+#include <net/netmap_user.h>
+
+#endif
+
+#include "netmap_attach.h"
+
+int netmap_is_spec(const char *spec)
+{
+    return strncmp(spec, "netmap:", 7) == 0 || strncmp(spec, "vale", 4) == 0;
+}
+
+#if defined(__FreeBSD__)
+
+struct netmap_port {
+    int fd;
+    void *mem;
+    size_t memsize;
+    struct netmap_if *nifp;
+    unsigned rx_ring;           /* Next receive ring to look at */
+    unsigned tx_ring;           /* Transmit ring being filled */
+    int tx_pending;             /* Packets queued since the last TXSYNC */
+};
+
+struct netmap_port *netmap_attach(const char *spec)
+{
+    struct nmreq_header hdr;
+    struct nmreq_register reg;
+
+    memset(&hdr, 0, sizeof hdr);
+    memset(&reg, 0, sizeof reg);
+    hdr.nr_version = NETMAP_API;
+    hdr.nr_reqtype = NETMAP_REQ_REGISTER;
+    hdr.nr_body = (uintptr_t)&reg;
+    reg.nr_mode = NR_REG_ALL_NIC;
+    /*
+     * The kernel is given host interfaces by name alone, but VALE ports
+     * including the switch name.
+     */
+    const char *name = (strncmp(spec, "netmap:", 7) == 0) ? spec + 7 : spec;
+    if (strlen(name) == 0 || strlen(name) >= sizeof hdr.nr_name) {
+        errno = EINVAL;
+        return NULL;
+    }
+    strcpy(hdr.nr_name, name);
+
+    struct netmap_port *np = calloc(1, sizeof *np);
+    if (np == NULL)
+        return NULL;
+    np->fd = open("/dev/netmap", O_RDWR | O_CLOEXEC);
+    if (np->fd == -1)
+        goto err_free;
+    if (ioctl(np->fd, NIOCCTRL, &hdr) == -1)
+        goto err_close;
+    np->memsize = reg.nr_memsize;
+    np->mem = mmap(NULL, np->memsize, PROT_READ | PROT_WRITE, MAP_SHARED,
+            np->fd, 0);
+    if (np->mem == MAP_FAILED)
+        goto err_close;
+    np->nifp = NETMAP_IF(np->mem, reg.nr_offset);
+    return np;
+
+err_close:
+    {
+        int saved_errno = errno;
+        close(np->fd);
+        errno = saved_errno;
+    }
+err_free:
+    free(np);
+    return NULL;
+}
+
+int netmap_fd(struct netmap_port *np)
+{
+    return np->fd;
+}
+
+/*
+ * Returns the next non-empty receive ring, starting from the one last
+ * received from, or NULL if all are empty.
+ */
+static struct netmap_ring *rx_ring_ready(struct netmap_port *np)
+{
+    unsigned n = np->nifp->ni_rx_rings;
+
+    for (unsigned i = 0; i < n; i++) {
+        unsigned r = (np->rx_ring + i) % n;
+        struct netmap_ring *ring = NETMAP_RXRING(np->nifp, r);
+        if (!nm_ring_empty(ring)) {
+            np->rx_ring = r;
+            return ring;
+        }
+    }
+    return NULL;
+}
+
+ssize_t netmap_read(struct netmap_port *np, void *buf, size_t size)
+{
+    struct netmap_ring *ring = rx_ring_ready(np);
+
+    if (ring == NULL) {
+        /*
+         * Release the slots consumed so far, and fetch new packets.
+         */
+        if (ioctl(np->fd, NIOCRXSYNC, NULL) == -1)
+            return -1;
+        ring = rx_ring_ready(np);
+        if (ring == NULL) {
+            errno = EAGAIN;
+            return -1;
+        }
+    }
+
+    struct netmap_slot *slot = &ring->slot[ring->cur];
+    size_t len = (slot->len < size) ? slot->len : size;
+    memcpy(buf, NETMAP_BUF(ring, slot->buf_idx), len);
+    ring->head = ring->cur = nm_ring_next(ring, ring->cur);
+    return len;
+}
+
+void netmap_flush(struct netmap_port *np)
+{
+    if (np->tx_pending == 0)
+        return;
+    (void)ioctl(np->fd, NIOCTXSYNC, NULL);
+    np->tx_pending = 0;
+}
+
+/*
+ * Returns a transmit ring with a free slot, starting from the one being
+ * filled, or NULL if all are full.
+ */
+static struct netmap_ring *tx_ring_ready(struct netmap_port *np)
+{
+    unsigned n = np->nifp->ni_tx_rings;
+
+    for (unsigned i = 0; i < n; i++) {
+        unsigned r = (np->tx_ring + i) % n;
+        struct netmap_ring *ring = NETMAP_TXRING(np->nifp, r);
+        if (nm_ring_space(ring) > 0) {
+            np->tx_ring = r;
+            return ring;
+        }
+    }
+    return NULL;
+}
+
+ssize_t netmap_write(struct netmap_port *np, const void *buf, size_t size)
+{
+    struct netmap_ring *ring = tx_ring_ready(np);
+
+    if (ring == NULL) {
+        /*
+         * Push out what has been queued, and reclaim completed slots.
+         */
+        np->tx_pending = 1;
+        netmap_flush(np);
+        ring = tx_ring_ready(np);
+        if (ring == NULL)
+            return size;        /* Dropped */
+    }
+    if (size > ring->nr_buf_size) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    struct netmap_slot *slot = &ring->slot[ring->cur];
+    memcpy(NETMAP_BUF(ring, slot->buf_idx), buf, size);
+    slot->len = size;
+    ring->head = ring->cur = nm_ring_next(ring, ring->cur);
+    np->tx_pending++;
+    return size;
+}
+
+#else /* !__FreeBSD__ */
+
+struct netmap_port *netmap_attach(const char *spec)
+{
+    (void)spec;
+    errno = ENOTSUP;
+    return NULL;
+}
+
+int netmap_fd(struct netmap_port *np)
+{
+    (void)np;
+    return -1;
+}
+
+ssize_t netmap_read(struct netmap_port *np, void *buf, size_t size)
+{
+    (void)np;
+    (void)buf;
+    (void)size;
+    errno = ENOTSUP;
+    return -1;
+}
+
+ssize_t netmap_write(struct netmap_port *np, const void *buf, size_t size)
+{
+    (void)np;
+    (void)buf;
+    (void)size;
+    errno = ENOTSUP;
+    return -1;
+}
+
+void netmap_flush(struct netmap_port *np)
+{
+    (void)np;
+}
+
+#endif /* __FreeBSD__ */
@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * netmap_attach.h: Common functions for attaching to netmap ports.
+ */
+
+#ifndef COMMON_NETMAP_ATTACH_H
+#define COMMON_NETMAP_ATTACH_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+struct netmap_port;
+
+/*
+ * MTU of networks attached using netmap. Packets must fit in a single netmap
+ * buffer, which is 2kB by default.
+ */
+#define NETMAP_ATTACH_MTU 1500
+
+/*
+ * Returns true if (spec) is of the form "netmap:IFACE", naming a host
+ * interface, or "valeX:PORT", naming a port of VALE switch X, and should be
+ * attached using netmap_attach().
+ */
+int netmap_is_spec(const char *spec);
+
+/*
+ * Attach to the netmap port described by (spec), binding all its hardware
+ * rings.
+ *
+ * Returns NULL and an appropriate errno on failure (ENOTSUP if netmap is not
+ * supported on this host).
+ */
+struct netmap_port *netmap_attach(const char *spec);
+
+/*
+ * Returns the descriptor of (np), which becomes readable when packets are
+ * pending and can be used with poll() or equivalent.
+ */
+int netmap_fd(struct netmap_port *np);
+
+/*
+ * Receives a single packet from (np) into (buf), without blocking. Semantics
+ * are as for read() on a TAP device: returns the packet length, which is
+ * truncated to (size) if necessary, or -1 and EAGAIN if no packets are
+ * pending. The receive rings are only synchronised with the kernel once they
+ * have been drained.
+ */
+ssize_t netmap_read(struct netmap_port *np, void *buf, size_t size);
+
+/*
+ * Queues a single packet of (size) bytes from (buf) for sending on (np),
+ * without blocking. Packets are only handed to the kernel by netmap_flush(),
+ * or once the transmit rings are full. As for TAP devices, if no transmit
+ * slots are available the packet is silently dropped. Returns (size), or -1
+ * and an appropriate errno on failure.
+ */
+ssize_t netmap_write(struct netmap_port *np, const void *buf, size_t size);
+
+/*
+ * Hands the packets queued by netmap_write() to the kernel for sending.
+ */
+void netmap_flush(struct netmap_port *np);
+
+#endif /* COMMON_NETMAP_ATTACH_H */
@@ -0,0 +1,184 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * packet_attach.c: Common functions for attaching to AF_PACKET sockets.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+
+#endif
+
+#include "packet_attach.h"
+
+int packet_is_spec(const char *spec)
+{
+    return strncmp(spec, "packet:", 7) == 0;
+}
+
+#if defined(__linux__)
+
+/*
+ * Receive blocks are retired to the guest once full, or after
+ * PACKET_RETIRE_MSECS, which bounds the latency added by batching.
+ */
+#define PACKET_BLOCK_SIZE       (1U << 16)
+#define PACKET_RX_BLOCKS        64
+#define PACKET_TX_BLOCKS        4
+#define PACKET_RETIRE_MSECS     1
+
+int packet_attach(const char *spec, struct packet_ring *ring)
+{
+    const char *ifname = spec + 7;
+    struct ifreq ifr;
+    int fd, saved_errno;
+
+    unsigned ifindex = if_nametoindex(ifname);
+    if (ifindex == 0)
+        return -1;
+
+    fd = socket(AF_PACKET, SOCK_RAW | SOCK_NONBLOCK, htons(ETH_P_ALL));
+    if (fd == -1) {
+        if (errno == EAFNOSUPPORT)
+            errno = ENOTSUP;
+        return -1;
+    }
+
+    memset(&ifr, 0, sizeof ifr);
+    snprintf(ifr.ifr_name, sizeof ifr.ifr_name, "%s", ifname);
+    if (ioctl(fd, SIOCGIFMTU, (void *)&ifr) == -1)
+        goto fail;
+    ring->mtu = ifr.ifr_mtu;
+
+    int version = TPACKET_V3;
+    if (setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version,
+                sizeof version) == -1)
+        goto fail;
+#if defined(PACKET_IGNORE_OUTGOING)
+    int one = 1;
+    if (setsockopt(fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &one,
+                sizeof one) == -1)
+        goto fail;
+#else
+    errno = ENOTSUP;
+    goto fail;
+#endif
+
+    /*
+     * Transmit frames hold a TPACKET_V3 header followed by the packet, and
+     * must divide the block size.
+     */
+    uint32_t frame_size = 2048;
+    while (frame_size < TPACKET_ALIGN(sizeof (struct tpacket3_hdr)) +
+            (uint32_t)ring->mtu + ETH_HLEN)
+        frame_size *= 2;
+    uint32_t block_size = PACKET_BLOCK_SIZE;
+    if (block_size < frame_size)
+        block_size = frame_size;
+
+    struct tpacket_req3 req;
+    memset(&req, 0, sizeof req);
+    req.tp_block_size = block_size;
+    req.tp_block_nr = PACKET_RX_BLOCKS;
+    req.tp_frame_size = frame_size;
+    req.tp_frame_nr = (block_size / frame_size) * PACKET_RX_BLOCKS;
+    req.tp_retire_blk_tov = PACKET_RETIRE_MSECS;
+    if (setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof req) == -1)
+        goto fail;
+    memset(&req, 0, sizeof req);
+    req.tp_block_size = block_size;
+    req.tp_block_nr = PACKET_TX_BLOCKS;
+    req.tp_frame_size = frame_size;
+    req.tp_frame_nr = (block_size / frame_size) * PACKET_TX_BLOCKS;
+    if (setsockopt(fd, SOL_PACKET, PACKET_TX_RING, &req, sizeof req) == -1)
+        goto fail;
+
+    /*
+     * Both rings are mapped with a single mmap(), receive ring first.
+     */
+    size_t rx_size = (size_t)block_size * PACKET_RX_BLOCKS;
+    size_t tx_size = (size_t)block_size * PACKET_TX_BLOCKS;
+    uint8_t *p = mmap(NULL, rx_size + tx_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, fd, 0);
+    if (p == MAP_FAILED)
+        goto fail;
+
+    struct packet_mreq mreq;
+    memset(&mreq, 0, sizeof mreq);
+    mreq.mr_ifindex = ifindex;
+    mreq.mr_type = PACKET_MR_PROMISC;
+    if (setsockopt(fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq,
+                sizeof mreq) == -1)
+        goto fail_unmap;
+
+    struct sockaddr_ll sll;
+    memset(&sll, 0, sizeof sll);
+    sll.sll_family = AF_PACKET;
+    sll.sll_protocol = htons(ETH_P_ALL);
+    sll.sll_ifindex = ifindex;
+    if (bind(fd, (struct sockaddr *)&sll, sizeof sll) == -1)
+        goto fail_unmap;
+
+    ring->rx = p;
+    ring->tx = p + rx_size;
+    ring->block_size = block_size;
+    ring->rx_blocks = PACKET_RX_BLOCKS;
+    ring->frame_size = frame_size;
+    ring->tx_frames = req.tp_frame_nr;
+    return fd;
+
+fail_unmap:
+    saved_errno = errno;
+    munmap(p, rx_size + tx_size);
+    errno = saved_errno;
+fail:
+    saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+    return -1;
+}
+
+#else /* !__linux__ */
+
+int packet_attach(const char *spec, struct packet_ring *ring)
+{
+    (void)spec;
+    (void)ring;
+    errno = ENOTSUP;
+    return -1;
+}
+
+#endif /* __linux__ */
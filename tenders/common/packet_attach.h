@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * packet_attach.h: Common functions for attaching to AF_PACKET sockets.
+ */
+
+#ifndef COMMON_PACKET_ATTACH_H
+#define COMMON_PACKET_ATTACH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * TPACKET_V3 receive and transmit rings of an AF_PACKET socket, as mapped by
+ * packet_attach(). The receive ring consists of (rx_blocks) blocks of
+ * (block_size) bytes, each holding a variable number of packets, and the
+ * transmit ring of (tx_frames) frames of (frame_size) bytes, each holding a
+ * single packet.
+ */
+struct packet_ring {
+    uint8_t *rx, *tx;
+    uint32_t block_size, rx_blocks;
+    uint32_t frame_size, tx_frames;
+    int mtu;                    /* MTU of the host interface */
+};
+
+/*
+ * Returns true if (spec) is of the form "packet:IFACE" and should be attached
+ * using packet_attach().
+ */
+int packet_is_spec(const char *spec);
+
+/*
+ * Attach an AF_PACKET socket to the network interface described by (spec),
+ * receiving all traffic on the interface other than that sent on the socket
+ * itself, and map its receive and transmit rings into (ring).
+ *
+ * Returns the non-blocking socket descriptor, which becomes readable when a
+ * block of the receive ring is ready, or -1 and an appropriate errno on
+ * failure (ENOTSUP if AF_PACKET is not supported on this host).
+ */
+int packet_attach(const char *spec, struct packet_ring *ring);
+
+#endif /* COMMON_PACKET_ATTACH_H */
@@ -0,0 +1,363 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * pcap.c: Capture of network packets to pcapng files.
+ *
+ * Packets are copied, truncated to the snap length of their device, into
+ * fixed-size slots of a ring shared by all devices, from which a dedicated
+ * thread writes them out as pcapng Enhanced Packet Blocks every
+ * PCAP_WRITE_INTERVAL_MS. Producers serialise on a spinlock, so capturing a
+ * packet takes no system calls on the thread doing packet I/O, only a read of
+ * the (vDSO) clock and a copy. Only the writer thread, or the thread exiting,
+ * consumes the ring, which they do while holding (consume_lock). Packets
+ * arriving while the ring is full are dropped and counted.
+ */
+
+#define _GNU_SOURCE
+#include <err.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include "mft_abi.h"
+#include "pcap.h"
+
+#define PCAP_RING_BYTES (4 * 1024 * 1024)
+#define PCAP_RING_SLOTS_MIN 64
+#define PCAP_WRITE_INTERVAL_MS 10
+
+/*
+ * pcapng block types and options, see draft-ietf-opsawg-pcapng.
+ */
+#define PCAPNG_SHB 0x0a0d0d0a
+#define PCAPNG_IDB 0x00000001
+#define PCAPNG_EPB 0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1a2b3c4d
+#define PCAPNG_LINKTYPE_ETHERNET 1
+#define PCAPNG_OPT_ENDOFOPT 0
+#define PCAPNG_IF_NAME 2
+#define PCAPNG_IF_TSRESOL 9
+#define PCAPNG_EPB_FLAGS 2
+#define PCAPNG_EPB_INBOUND 1
+#define PCAPNG_EPB_OUTBOUND 2
+
+struct slot {
+    uint64_t tstamp;            /* Nanoseconds since the epoch */
+    uint32_t len;               /* Length of the packet */
+    uint32_t caplen;            /* Bytes captured, following */
+    uint16_t handle;
+    uint8_t out;
+    uint8_t data[];
+};
+
+static struct {
+    FILE *f;
+    unsigned snaplen;
+    uint64_t dropped;
+} devs[MFT_MAX_ENTRIES];
+static uint64_t captured;       /* Bitmap of devices captured */
+static unsigned snaplen_max;
+
+static volatile sig_atomic_t paused;
+
+static uint8_t *ring;
+static size_t slot_size, nslots;
+static uint64_t head, tail;
+static bool produce_lock;
+static pthread_mutex_t consume_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void pcap_write(FILE *f, const void *data, size_t len)
+{
+    static const uint8_t zeroes[4];
+
+    (void)fwrite(data, 1, len, f);
+    if (len % 4)
+        (void)fwrite(zeroes, 1, 4 - len % 4, f);
+}
+
+static int pcap_header(FILE *f, const char *name, unsigned snaplen)
+{
+    struct {
+        uint32_t type, len, magic;
+        uint16_t major, minor;
+        int64_t section_len;
+        uint32_t len2;
+    } __attribute__((packed)) shb = {
+        .type = PCAPNG_SHB, .len = sizeof shb,
+        .magic = PCAPNG_BYTE_ORDER_MAGIC, .major = 1, .minor = 0,
+        .section_len = -1, .len2 = sizeof shb
+    };
+    size_t name_len = strlen(name);
+    struct {
+        uint32_t type, len;
+        uint16_t linktype, reserved;
+        uint32_t snaplen;
+    } idb = {
+        .type = PCAPNG_IDB,
+        /*
+         * Header, if_name and if_tsresol (each padded), end of options and
+         * trailing length.
+         */
+        .len = sizeof idb + 4 + ((name_len + 3) & ~3) + 8 + 4 + 4,
+        .linktype = PCAPNG_LINKTYPE_ETHERNET,
+        .snaplen = snaplen
+    };
+    uint16_t opt_name[2] = { PCAPNG_IF_NAME, name_len };
+    /*
+     * Timestamps are in nanoseconds.
+     */
+    uint8_t opt_tsresol[8] = { PCAPNG_IF_TSRESOL, 0, 1, 0, 9 };
+    uint32_t end = PCAPNG_OPT_ENDOFOPT;
+
+    (void)fwrite(&shb, sizeof shb, 1, f);
+    (void)fwrite(&idb, sizeof idb, 1, f);
+    (void)fwrite(opt_name, sizeof opt_name, 1, f);
+    pcap_write(f, name, name_len);
+    (void)fwrite(opt_tsresol, sizeof opt_tsresol, 1, f);
+    (void)fwrite(&end, sizeof end, 1, f);
+    (void)fwrite(&idb.len, sizeof idb.len, 1, f);
+    return fflush(f);
+}
+
+int pcap_open(unsigned handle, const char *name, const char *spec)
+{
+    char *path = strdup(spec);
+    if (path == NULL)
+        err(1, "strdup");
+    unsigned snaplen = PCAP_SNAPLEN_DEFAULT;
+    bool start_paused = false;
+
+    char *opt = strchr(path, ',');
+    if (opt != NULL)
+        *opt++ = '\0';
+    while (opt != NULL) {
+        char *next = strchr(opt, ',');
+        if (next != NULL)
+            *next++ = '\0';
+        char *end;
+        if (strncmp(opt, "snaplen=", 8) == 0) {
+            unsigned long n = strtoul(opt + 8, &end, 10);
+            if (opt[8] == '\0' || *end != '\0' || n == 0 ||
+                    n > PCAP_SNAPLEN_MAX) {
+                warnx("Invalid snap length: '%s'", opt + 8);
+                free(path);
+                return -1;
+            }
+            snaplen = n;
+        }
+        else if (strcmp(opt, "paused") == 0)
+            start_paused = true;
+        else {
+            warnx("Invalid capture option: '%s'", opt);
+            free(path);
+            return -1;
+        }
+        opt = next;
+    }
+
+    if (path[0] == '\0' || devs[handle].f != NULL) {
+        free(path);
+        return -1;
+    }
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        warn("Could not create capture file %s", path);
+        free(path);
+        return -1;
+    }
+    free(path);
+    if (pcap_header(f, name, snaplen) == EOF) {
+        warn("Could not write capture file header");
+        fclose(f);
+        return -1;
+    }
+
+    devs[handle].f = f;
+    devs[handle].snaplen = snaplen;
+    captured |= 1ULL << handle;
+    if (snaplen > snaplen_max)
+        snaplen_max = snaplen;
+    if (start_paused)
+        paused = 1;
+    return 0;
+}
+
+static void write_slot(const struct slot *s)
+{
+    FILE *f = devs[s->handle].f;
+    struct {
+        uint32_t type, len, ifid, ts_high, ts_low, caplen, len_orig;
+    } epb = {
+        .type = PCAPNG_EPB,
+        /*
+         * Header, data (padded), epb_flags, end of options and trailing
+         * length.
+         */
+        .len = sizeof epb + ((s->caplen + 3) & ~3) + 8 + 4 + 4,
+        .ifid = 0,
+        .ts_high = s->tstamp >> 32,
+        .ts_low = (uint32_t)s->tstamp,
+        .caplen = s->caplen,
+        .len_orig = s->len
+    };
+    uint32_t opts[4] = {
+        PCAPNG_EPB_FLAGS | (4 << 16),
+        s->out ? PCAPNG_EPB_OUTBOUND : PCAPNG_EPB_INBOUND,
+        PCAPNG_OPT_ENDOFOPT,
+        epb.len
+    };
+
+    (void)fwrite(&epb, sizeof epb, 1, f);
+    pcap_write(f, s->data, s->caplen);
+    (void)fwrite(opts, sizeof opts, 1, f);
+}
+
+/*
+ * Writes out the slots published in the ring, returning true if there were
+ * any. Called with (consume_lock) held.
+ */
+static bool drain(void)
+{
+    uint64_t h = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+    uint64_t t = tail;
+
+    if (t == h)
+        return false;
+    for (; t != h; t++)
+        write_slot((struct slot *)(ring + (t % nslots) * slot_size));
+    __atomic_store_n(&tail, h, __ATOMIC_RELEASE);
+    for (unsigned i = 0; i != MFT_MAX_ENTRIES; i++) {
+        if (devs[i].f != NULL)
+            (void)fflush(devs[i].f);
+    }
+    return true;
+}
+
+static void *writer_thread(void *arg __attribute__((unused)))
+{
+    const struct timespec interval = {
+        .tv_nsec = PCAP_WRITE_INTERVAL_MS * 1000000L
+    };
+    sig_atomic_t was_paused = paused;
+
+    for (;;) {
+        nanosleep(&interval, NULL);
+        if (paused != was_paused) {
+            was_paused = paused;
+            warnx("Packet capture %s", was_paused ? "paused" : "resumed");
+        }
+        pthread_mutex_lock(&consume_lock);
+        (void)drain();
+        pthread_mutex_unlock(&consume_lock);
+    }
+    return NULL;
+}
+
+static void pcap_flush(void)
+{
+    pthread_mutex_lock(&consume_lock);
+    (void)drain();
+    for (unsigned i = 0; i != MFT_MAX_ENTRIES; i++) {
+        uint64_t n = __atomic_load_n(&devs[i].dropped, __ATOMIC_RELAXED);
+        if (devs[i].f != NULL && n > 0)
+            warnx("%llu packets not captured on network device %u as the "
+                    "capture ring was full", (unsigned long long)n, i);
+    }
+    pthread_mutex_unlock(&consume_lock);
+}
+
+static void sighup_handler(int signo __attribute__((unused)))
+{
+    paused = !paused;
+}
+
+void pcap_init(void)
+{
+    if (captured == 0)
+        return;
+
+    slot_size = (sizeof (struct slot) + snaplen_max + 7) & ~7UL;
+    nslots = PCAP_RING_BYTES / slot_size;
+    if (nslots < PCAP_RING_SLOTS_MIN)
+        nslots = PCAP_RING_SLOTS_MIN;
+    void *p = mmap(NULL, nslots * slot_size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        err(1, "Could not allocate capture ring");
+    ring = p;
+    if (atexit(pcap_flush) != 0)
+        errx(1, "atexit() failed");
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof sa);
+    sa.sa_handler = sighup_handler;
+    sa.sa_flags = SA_RESTART;
+    sigfillset(&sa.sa_mask);
+    if (sigaction(SIGHUP, &sa, NULL) == -1)
+        err(1, "Could not install SIGHUP handler");
+
+    /*
+     * As for the console writer, signals must not be handled on the writer
+     * thread, which pcap_flush() may wait for.
+     */
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    pthread_t tid;
+    int rc = pthread_create(&tid, NULL, writer_thread, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (rc != 0)
+        errx(1, "Could not create packet capture thread");
+    pthread_detach(tid);
+}
+
+void pcap_packet(unsigned handle, bool out, const void *buf, size_t len)
+{
+    if (!(captured & (1ULL << handle)) || paused || ring == NULL)
+        return;
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    size_t caplen = len < devs[handle].snaplen ? len : devs[handle].snaplen;
+
+    while (__atomic_test_and_set(&produce_lock, __ATOMIC_ACQUIRE))
+        ;
+    if (head - __atomic_load_n(&tail, __ATOMIC_ACQUIRE) == nslots) {
+        __atomic_clear(&produce_lock, __ATOMIC_RELEASE);
+        __atomic_add_fetch(&devs[handle].dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    struct slot *s = (struct slot *)(ring + (head % nslots) * slot_size);
+    s->tstamp = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    s->len = len;
+    s->caplen = caplen;
+    s->handle = handle;
+    s->out = out;
+    memcpy(s->data, buf, caplen);
+    __atomic_store_n(&head, head + 1, __ATOMIC_RELEASE);
+    __atomic_clear(&produce_lock, __ATOMIC_RELEASE);
+}
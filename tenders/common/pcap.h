@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * pcap.h: Capture of network packets to pcapng files.
+ */
+
+#ifndef COMMON_PCAP_H
+#define COMMON_PCAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Default and maximum number of bytes captured of each packet.
+ */
+#define PCAP_SNAPLEN_DEFAULT 128
+#define PCAP_SNAPLEN_MAX 65535
+
+/*
+ * Parse FILE[,snaplen=BYTES][,paused] (spec) and create FILE to capture the
+ * packets of network device (handle), named (name) in the file. With
+ * ",paused", capture starts paused. Returns 0 on success, or -1 after
+ * warning if (spec) is invalid or FILE cannot be created.
+ */
+int pcap_open(unsigned handle, const char *name, const char *spec);
+
+/*
+ * Allocate the capture ring, start the thread writing it out and install a
+ * SIGHUP handler pausing and resuming capture, if any device is captured.
+ * Packets still in the ring when the tender exits through exit() are written
+ * out first. Exits on failure.
+ */
+void pcap_init(void);
+
+/*
+ * Capture the packet of (len) bytes at (buf), received (out false) or sent
+ * (out true) on network device (handle), if it is being captured. Copies at
+ * most the snap length of the device into the ring, without making any system
+ * calls, or drops the packet and counts it if the ring is full. May be called
+ * concurrently.
+ */
+void pcap_packet(unsigned handle, bool out, const void *buf, size_t len);
+
+#endif /* COMMON_PCAP_H */
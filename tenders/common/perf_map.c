@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * perf_map.c: Guest symbol maps for host profilers (--perf-map).
+ */
+
+#define _GNU_SOURCE
+#include <err.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "elf.h"
+#include "perf_map.h"
+
+static bool enabled;
+static const char *map_file;
+
+int perf_map_handle_cmdarg(const char *cmdarg)
+{
+    if (strcmp("--perf-map", cmdarg) == 0) {
+        enabled = true;
+        map_file = NULL;
+        return 0;
+    }
+    if (strncmp("--perf-map=", cmdarg, 11) == 0) {
+        if (cmdarg[11] == '\0')
+            errx(1, "Malformed argument to --perf-map");
+        enabled = true;
+        map_file = &cmdarg[11];
+        return 0;
+    }
+    return -1;
+}
+
+static void write_process(uint64_t addr, uint64_t size, const char *name,
+        void *arg)
+{
+    fprintf(arg, "%llx %llx %s\n", (unsigned long long)addr,
+            (unsigned long long)size, name);
+}
+
+static void write_kallsyms(uint64_t addr, uint64_t size __attribute__((unused)),
+        const char *name, void *arg)
+{
+    fprintf(arg, "%016llx t %s\n", (unsigned long long)addr, name);
+}
+
+void perf_map_write(const char *elffile, uint64_t base,
+        enum perf_map_format format)
+{
+    char path[PATH_MAX];
+    const char *file = map_file;
+
+    if (!enabled)
+        return;
+
+    if (file == NULL) {
+        snprintf(path, sizeof path, "/tmp/perf-%d.%s", (int)getpid(),
+                format == PERF_MAP_PROCESS ? "map" : "kallsyms");
+        file = path;
+    }
+
+    FILE *out = fopen(file, "w");
+    if (out == NULL) {
+        warn("%s", file);
+        return;
+    }
+    int nsyms = elf_load_symbols(elffile, base,
+            format == PERF_MAP_PROCESS ? write_process : write_kallsyms, out);
+    if (fclose(out) != 0) {
+        warn("%s", file);
+        return;
+    }
+    if (nsyms == -1)
+        warnx("%s: Not writing guest symbols", file);
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * perf_map.h: Guest symbol maps for host profilers (--perf-map).
+ */
+
+#ifndef COMMON_PERF_MAP_H
+#define COMMON_PERF_MAP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+enum perf_map_format {
+    /*
+     * "START SIZE name" lines in hex, as read by perf from
+     * /tmp/perf-<pid>.map for code running in the process <pid>.
+     */
+    PERF_MAP_PROCESS,
+    /*
+     * /proc/kallsyms format, as read by perf kvm --guestkallsyms.
+     */
+    PERF_MAP_KALLSYMS
+};
+
+/*
+ * Parse --perf-map[=FILE] (cmdarg). Returns 0 if (cmdarg) was --perf-map, -1
+ * otherwise.
+ */
+int perf_map_handle_cmdarg(const char *cmdarg);
+
+/*
+ * Write the function symbols of the unikernel (elffile), loaded by elf_load()
+ * at (base), in (format), if --perf-map was given. The map is written to FILE
+ * if given, otherwise to /tmp/perf-<pid>.map for PERF_MAP_PROCESS or
+ * /tmp/perf-<pid>.kallsyms for PERF_MAP_KALLSYMS. Failure to write the map is
+ * not fatal.
+ */
+void perf_map_write(const char *elffile, uint64_t base,
+        enum perf_map_format format);
+
+#endif /* COMMON_PERF_MAP_H */
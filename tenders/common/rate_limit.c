@@ -0,0 +1,159 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * rate_limit.c: Per-device rate limiting of I/O (--net-rate, --block-rate).
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "rate_limit.h"
+
+#define NSECS_PER_SEC 1000000000ULL
+
+/*
+ * The cost of a packet is rounded down to whole nanoseconds, so rates are
+ * bounded to keep the error small.
+ */
+#define RATE_MAX (10 * NSECS_PER_SEC)
+#define BURST_MS_DEFAULT 10
+#define BURST_MS_MAX 10000
+
+/*
+ * Parse a decimal number, with an optional K, M or G suffix, from (*s),
+ * advancing it. Returns -1 if there is none, or it is out of range.
+ */
+static int parse_rate(const char **s, uint64_t *rate)
+{
+    char *end;
+
+    if (**s < '0' || **s > '9')
+        return -1;
+    errno = 0;
+    unsigned long long v = strtoull(*s, &end, 10);
+    if (errno != 0)
+        return -1;
+    switch (*end) {
+    case 'K':
+        v *= 1000ULL;
+        end++;
+        break;
+    case 'M':
+        v *= 1000000ULL;
+        end++;
+        break;
+    case 'G':
+        v *= 1000000000ULL;
+        end++;
+        break;
+    }
+    if (v > RATE_MAX)
+        return -1;
+    *rate = v;
+    *s = end;
+    return 0;
+}
+
+int rate_limit_parse_rates(const char *spec, struct rate_limit *rl)
+{
+    struct rate_limit new = { 0 };
+    uint64_t burst_ms = BURST_MS_DEFAULT;
+
+    if (parse_rate(&spec, &new.bytes_per_sec) == -1)
+        return -1;
+    if (*spec == ':') {
+        spec++;
+        if (parse_rate(&spec, &new.ops_per_sec) == -1)
+            return -1;
+        if (*spec == ':') {
+            char *end;
+            spec++;
+            if (*spec < '0' || *spec > '9')
+                return -1;
+            burst_ms = strtoull(spec, &end, 10);
+            if (burst_ms == 0 || burst_ms > BURST_MS_MAX)
+                return -1;
+            spec = end;
+        }
+    }
+    if (*spec != '\0')
+        return -1;
+    new.burst_nsecs = burst_ms * 1000000ULL;
+    *rl = new;
+    return 0;
+}
+
+int rate_limit_parse(const char *spec, struct rate_limit *rx,
+        struct rate_limit *tx)
+{
+    if (strncmp(spec, "rx:", 3) == 0)
+        return rate_limit_parse_rates(spec + 3, rx);
+    else if (strncmp(spec, "tx:", 3) == 0)
+        return rate_limit_parse_rates(spec + 3, tx);
+    else
+        return -1;
+}
+
+uint64_t rate_limit_clock(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NSECS_PER_SEC + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t bucket_wait(uint64_t rate, uint64_t tat, uint64_t burst,
+        uint64_t now)
+{
+    if (rate == 0 || tat < now + burst)
+        return 0;
+    return tat - (now + burst) + 1;
+}
+
+uint64_t rate_limit_wait(const struct rate_limit *rl, uint64_t now)
+{
+    uint64_t b = bucket_wait(rl->bytes_per_sec, rl->bytes_tat,
+            rl->burst_nsecs, now);
+    uint64_t p = bucket_wait(rl->ops_per_sec, rl->ops_tat,
+            rl->burst_nsecs, now);
+
+    return (b > p) ? b : p;
+}
+
+static void bucket_charge(uint64_t rate, uint64_t *tat, uint64_t now,
+        uint64_t units)
+{
+    if (rate == 0)
+        return;
+    if (*tat < now)
+        *tat = now;
+    *tat += units * NSECS_PER_SEC / rate;
+}
+
+void rate_limit_charge(struct rate_limit *rl, uint64_t now, uint64_t bytes)
+{
+    bucket_charge(rl->bytes_per_sec, &rl->bytes_tat, now, bytes);
+    bucket_charge(rl->ops_per_sec, &rl->ops_tat, now, 1);
+}
@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * rate_limit.h: Per-device rate limiting of I/O (--net-rate, --block-rate).
+ */
+
+#ifndef COMMON_RATE_LIMIT_H
+#define COMMON_RATE_LIMIT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * A token bucket limiting a stream of operations (packets, or block requests)
+ * to (bytes_per_sec) and (ops_per_sec), either of which may be 0 for no
+ * limit, with bursts of up to (burst_nsecs) worth of either.
+ *
+ * Rather than a count of tokens, each bucket keeps the time at which it will
+ * be full again (*_tat). An operation may proceed while that time lies less
+ * than (burst_nsecs) in the future, and advances it by the time the operation
+ * takes at the configured rate. The operation may be charged after the fact,
+ * e.g. when receiving a packet of unknown size, so the bucket may briefly go
+ * into debt by up to one operation.
+ */
+struct rate_limit {
+    uint64_t bytes_per_sec;
+    uint64_t ops_per_sec;
+    uint64_t burst_nsecs;
+    uint64_t bytes_tat;
+    uint64_t ops_tat;
+};
+
+/*
+ * Parse BYTES[:OPS[:BURST_MS]] (spec) into (*rl). BYTES and OPS may have a K,
+ * M or G (decimal) suffix. Returns 0 on success or -1 if (spec) is invalid.
+ */
+int rate_limit_parse_rates(const char *spec, struct rate_limit *rl);
+
+/*
+ * Parse the DIR:BYTES[:PACKETS[:BURST_MS]] argument of --net-rate (spec),
+ * setting (*rx) or (*tx) according to DIR. Returns 0 on success or -1 if
+ * (spec) is invalid.
+ */
+int rate_limit_parse(const char *spec, struct rate_limit *rx,
+        struct rate_limit *tx);
+
+/*
+ * Returns true if (rl) limits anything.
+ */
+static inline bool rate_limit_enabled(const struct rate_limit *rl)
+{
+    return rl->bytes_per_sec != 0 || rl->ops_per_sec != 0;
+}
+
+/*
+ * Returns the current time, in nanoseconds, of the clock used by (now)
+ * arguments below.
+ */
+uint64_t rate_limit_clock(void);
+
+/*
+ * Returns 0 if an operation may proceed through (rl) at time (now), or
+ * otherwise the number of nanoseconds until one may.
+ */
+uint64_t rate_limit_wait(const struct rate_limit *rl, uint64_t now);
+
+/*
+ * Charge an operation of (bytes) performed at time (now) to (rl).
+ */
+void rate_limit_charge(struct rate_limit *rl, uint64_t now, uint64_t bytes);
+
+#endif /* COMMON_RATE_LIMIT_H */
@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * resctrl.c: Placement of the tender in a resctrl group, common to all
+ * tenders.
+ */
+
+#define _GNU_SOURCE
+#include <err.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "resctrl.h"
+
+#if defined(__linux__)
+
+#define RESCTRL_ROOT "/sys/fs/resctrl"
+
+static char rc_path[PATH_MAX];
+
+int resctrl_handle_cmdarg(const char *cmdarg)
+{
+    if (strncmp("--cache-class=", cmdarg, 14) != 0)
+        return -1;
+    const char *name = cmdarg + 14;
+    /*
+     * Groups are directories directly under the root; monitoring groups
+     * (mon_groups) and the info directory are not resource groups.
+     */
+    if (*name == '\0' || strchr(name, '/') != NULL ||
+            strcmp(name, ".") == 0 || strcmp(name, "..") == 0 ||
+            strcmp(name, "info") == 0 || strcmp(name, "mon_groups") == 0 ||
+            strcmp(name, "mon_data") == 0)
+        errx(1, "Malformed argument to --cache-class");
+    if (snprintf(rc_path, sizeof rc_path, "%s/%s/tasks", RESCTRL_ROOT,
+                name) >= (int)sizeof rc_path)
+        errx(1, "Malformed argument to --cache-class");
+    return 0;
+}
+
+void resctrl_apply(void)
+{
+    if (rc_path[0] == '\0')
+        return;
+
+    if (access(RESCTRL_ROOT "/info", F_OK) == -1)
+        errx(1, "--cache-class requires resctrl to be mounted at "
+                RESCTRL_ROOT);
+    /*
+     * Groups are set up by the host administrator, with the cache and
+     * memory bandwidth allocations (schemata) of each class; the tender only
+     * joins one. Writing 0 moves the calling thread.
+     */
+    int fd = open(rc_path, O_WRONLY | O_CLOEXEC);
+    if (fd == -1)
+        err(1, "Could not open resctrl group %s", rc_path);
+    ssize_t nbytes = write(fd, "0", 1);
+    int saved_errno = errno;
+    close(fd);
+    if (nbytes != 1) {
+        errno = (nbytes == -1) ? saved_errno : EIO;
+        err(1, "Could not move into resctrl group %s", rc_path);
+    }
+}
+
+#else /* !__linux__ */
+
+int resctrl_handle_cmdarg(const char *cmdarg)
+{
+    if (strncmp("--cache-class=", cmdarg, 14) == 0)
+        errx(1, "--cache-class is not supported on this host");
+    return -1;
+}
+
+void resctrl_apply(void)
+{
+}
+
+#endif /* __linux__ */
@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * resctrl.h: Placement of the tender in a resctrl group, to give it a share
+ * of the host's last-level cache and memory bandwidth (--cache-class=NAME).
+ */
+
+#ifndef COMMON_RESCTRL_H
+#define COMMON_RESCTRL_H
+
+/*
+ * Parse a resctrl option (cmdarg). Returns 0 if (cmdarg) was such an option,
+ * -1 otherwise. Exits if it is malformed, or not supported on this host.
+ */
+int resctrl_handle_cmdarg(const char *cmdarg);
+
+/*
+ * Move the tender into the resctrl group given with --cache-class, if any.
+ * Must be called by the tender before it creates any threads, which inherit
+ * the group.
+ */
+void resctrl_apply(void);
+
+#endif /* COMMON_RESCTRL_H */
@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * rt.c: Real-time scheduling of VCPU threads, common to all tenders.
+ */
+
+#define _GNU_SOURCE
+#include <err.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__linux__)
+#include <sched.h>
+#include <sys/resource.h>
+#endif
+
+#include "rt.h"
+
+#if defined(__linux__)
+
+#define RT_BUDGET_MS_DEFAULT 1000
+
+static int rt_policy = -1;
+static int rt_priority;
+static unsigned long rt_budget_ms = RT_BUDGET_MS_DEFAULT;
+
+int rt_handle_cmdarg(const char *cmdarg)
+{
+    if (strncmp("--rt-priority=", cmdarg, 14) != 0)
+        return -1;
+
+    int prio, n = 0;
+    if (sscanf(cmdarg + 14, "%d%n", &prio, &n) != 1 || n == 0 ||
+            prio < sched_get_priority_min(SCHED_FIFO) ||
+            prio > sched_get_priority_max(SCHED_FIFO))
+        errx(1, "Malformed argument to --rt-priority");
+    rt_policy = SCHED_FIFO;
+    rt_priority = prio;
+    const char *opt = cmdarg + 14 + n;
+    while (*opt == ',') {
+        opt++;
+        n = 0;
+        if (strncmp(opt, "rr", 2) == 0 && (opt[2] == ',' || opt[2] == '\0')) {
+            rt_policy = SCHED_RR;
+            opt += 2;
+        }
+        else if (sscanf(opt, "budget=%lu%n", &rt_budget_ms, &n) == 1 &&
+                n != 0 && rt_budget_ms != 0 && rt_budget_ms <= 60000)
+            opt += n;
+        else
+            break;
+    }
+    if (*opt != '\0')
+        errx(1, "Malformed argument to --rt-priority");
+    return 0;
+}
+
+bool rt_enabled(void)
+{
+    return rt_policy != -1;
+}
+
+void rt_apply(void)
+{
+    if (rt_policy == -1)
+        return;
+
+    /*
+     * The host sends SIGXCPU, which terminates the tender, once a real-time
+     * thread has run for the soft limit without blocking, and SIGKILL at the
+     * hard limit. The limit is per process, so this is idempotent.
+     */
+    struct rlimit rl;
+    rlim_t budget = (rlim_t)rt_budget_ms * 1000;
+    if (getrlimit(RLIMIT_RTTIME, &rl) == -1)
+        err(1, "getrlimit(RLIMIT_RTTIME) failed");
+    if (rl.rlim_max == RLIM_INFINITY || rl.rlim_max > 2 * budget)
+        rl.rlim_max = 2 * budget;
+    rl.rlim_cur = (budget < rl.rlim_max) ? budget : rl.rlim_max;
+    if (setrlimit(RLIMIT_RTTIME, &rl) == -1)
+        err(1, "setrlimit(RLIMIT_RTTIME) failed");
+
+    struct sched_param sp = { .sched_priority = rt_priority };
+    if (sched_setscheduler(0, rt_policy | SCHED_RESET_ON_FORK, &sp) == -1)
+        err(1, "Could not set real-time priority %d (requires CAP_SYS_NICE "
+                "or RLIMIT_RTPRIO)", rt_priority);
+}
+
+#else /* !__linux__ */
+
+int rt_handle_cmdarg(const char *cmdarg)
+{
+    if (strncmp("--rt-priority=", cmdarg, 14) == 0)
+        errx(1, "--rt-priority is not supported on this host");
+    return -1;
+}
+
+bool rt_enabled(void)
+{
+    return false;
+}
+
+void rt_apply(void)
+{
+}
+
+#endif /* __linux__ */
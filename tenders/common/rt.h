@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * rt.h: Real-time scheduling of VCPU threads common to all tenders
+ * (--rt-priority=N).
+ */
+
+#ifndef COMMON_RT_H
+#define COMMON_RT_H
+
+#include <stdbool.h>
+
+/*
+ * Parse a real-time scheduling option (cmdarg). Returns 0 if (cmdarg) was
+ * such an option, -1 otherwise. Exits if it is malformed, or not supported on
+ * this host.
+ */
+int rt_handle_cmdarg(const char *cmdarg);
+
+/*
+ * Returns true if --rt-priority was given.
+ */
+bool rt_enabled(void);
+
+/*
+ * Run the calling thread, which must be about to run a VCPU, with the
+ * real-time policy and priority given with --rt-priority, if any. Threads it
+ * creates revert to normal scheduling. Exits if the host does not allow it.
+ *
+ * As a watchdog, a VCPU thread which runs for longer than the budget given
+ * with --rt-priority without blocking gets the tender killed by the host
+ * (RLIMIT_RTTIME), so that a spinning guest cannot monopolise a host CPU.
+ */
+void rt_apply(void);
+
+#endif /* COMMON_RT_H */
@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * sdt.h: Statically defined tracepoints in the tenders.
+ *
+ * If the host provides <sys/sdt.h> (systemtap-sdt-dev on Linux), configure.sh
+ * sets CONFIG_SDT and each TENDER_PROBE*() is compiled in as a USDT probe
+ * named "solo5:NAME", which can be enabled with e.g. bpftrace or perf while
+ * the tender is running. A probe which is not enabled costs a single nop,
+ * beyond keeping its arguments available where the tracer can find them.
+ * Otherwise, probes compile to nothing and their arguments are not
+ * evaluated.
+ *
+ * Double underscores in NAME are shown as dashes by most tracers.
+ */
+
+#ifndef COMMON_SDT_H
+#define COMMON_SDT_H
+
+#if defined(SOLO5_SDT)
+
+#include <sys/sdt.h>
+
+#define TENDER_PROBE1(name, a) \
+    DTRACE_PROBE1(solo5, name, a)
+#define TENDER_PROBE2(name, a, b) \
+    DTRACE_PROBE2(solo5, name, a, b)
+#define TENDER_PROBE3(name, a, b, c) \
+    DTRACE_PROBE3(solo5, name, a, b, c)
+#define TENDER_PROBE4(name, a, b, c, d) \
+    DTRACE_PROBE4(solo5, name, a, b, c, d)
+
+#else
+
+#define TENDER_PROBE1(name, a) do { } while (0)
+#define TENDER_PROBE2(name, a, b) do { } while (0)
+#define TENDER_PROBE3(name, a, b, c) do { } while (0)
+#define TENDER_PROBE4(name, a, b, c, d) do { } while (0)
+
+#endif
+
+#endif /* COMMON_SDT_H */
@@ -0,0 +1,416 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * shm_attach.c: Common functions for attaching to shared-memory links between
+ * tenders.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#endif
+
+#include "shm_attach.h"
+
+int shm_is_spec(const char *spec)
+{
+    return strncmp(spec, "shm:", 4) == 0;
+}
+
+#if defined(__linux__)
+
+#define SHM_SLOTS       256
+#define SHM_SLOT_SIZE   2048
+
+/*
+ * A single-producer, single-consumer ring of packets. (head) is only written
+ * by the producer, and (tail) only by the consumer; both run freely and are
+ * reduced modulo SHM_SLOTS to index (slot).
+ */
+struct shm_ring {
+    uint32_t head __attribute__((aligned(64)));
+    uint32_t tail __attribute__((aligned(64)));
+    struct {
+        uint32_t len;
+        uint8_t data[SHM_SLOT_SIZE - sizeof (uint32_t)];
+    } slot[SHM_SLOTS] __attribute__((aligned(64)));
+};
+
+/*
+ * The end listening on the socket transmits on ring 0 and signals efd[0];
+ * the other end transmits on ring 1 and signals efd[1].
+ */
+struct shm_link {
+    struct shm_ring *tx;
+    struct shm_ring *rx;
+    int txefd;                  /* Signalled when tx becomes non-empty */
+    int rxefd;                  /* Signalled when rx becomes non-empty */
+    bool tx_wakeup;             /* Signal txefd on the next shm_flush() */
+};
+
+/*
+ * Receives the memfd and eventfds from the listening end on (sock) into
+ * (fds). Returns 0 on success, -1 on error.
+ */
+static int shm_recv_fds(int sock, int fds[3])
+{
+    char byte;
+    struct iovec iov = { .iov_base = &byte, .iov_len = 1 };
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(3 * sizeof (int))];
+    } control;
+    struct msghdr mh = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof control.buf
+    };
+
+    ssize_t nbytes;
+    do {
+        nbytes = recvmsg(sock, &mh, MSG_CMSG_CLOEXEC);
+    } while (nbytes == -1 && errno == EINTR);
+    if (nbytes == -1)
+        return -1;
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&mh);
+    if (nbytes != 1 || cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET ||
+            cmsg->cmsg_type != SCM_RIGHTS ||
+            cmsg->cmsg_len != CMSG_LEN(3 * sizeof (int))) {
+        errno = EPROTO;
+        return -1;
+    }
+    memcpy(fds, CMSG_DATA(cmsg), 3 * sizeof (int));
+    return 0;
+}
+
+/*
+ * Sends the memfd and eventfds in (fds) to the connecting end on (sock).
+ * Returns 0 on success, -1 on error.
+ */
+static int shm_send_fds(int sock, const int fds[3])
+{
+    char byte = 0;
+    struct iovec iov = { .iov_base = &byte, .iov_len = 1 };
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(3 * sizeof (int))];
+    } control;
+    struct msghdr mh = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof control.buf
+    };
+
+    memset(&control, 0, sizeof control);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&mh);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(3 * sizeof (int));
+    memcpy(CMSG_DATA(cmsg), fds, 3 * sizeof (int));
+
+    ssize_t nbytes;
+    do {
+        nbytes = sendmsg(sock, &mh, MSG_NOSIGNAL);
+    } while (nbytes == -1 && errno == EINTR);
+    return (nbytes == 1) ? 0 : -1;
+}
+
+/*
+ * Creates the memfd holding both rings and the eventfds, storing them in
+ * (fds). Returns 0 on success, -1 on error.
+ */
+static int shm_create_fds(int fds[3])
+{
+    fds[0] = memfd_create("solo5-shm-link", MFD_CLOEXEC);
+    if (fds[0] == -1)
+        return -1;
+    if (ftruncate(fds[0], 2 * sizeof (struct shm_ring)) == -1)
+        goto fail;
+    fds[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fds[1] == -1)
+        goto fail;
+    fds[2] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fds[2] == -1) {
+        close(fds[1]);
+        goto fail;
+    }
+    return 0;
+
+fail:
+    close(fds[0]);
+    return -1;
+}
+
+/*
+ * Rendezvous with the other end at (sa), storing the memfd and eventfds in
+ * (fds) and which end we are in (*side). Returns 0 on success, -1 on error.
+ */
+static int shm_rendezvous(const struct sockaddr_un *sa, int fds[3],
+        int *side)
+{
+    int sock = -1, rc = -1, saved_errno;
+
+    /*
+     * If both ends start at the same time, the one losing the race to bind()
+     * tries connecting again.
+     */
+    bool refused = false;
+    for (int tries = 0; tries < 3; tries++) {
+        sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (sock == -1)
+            return -1;
+        if (connect(sock, (const struct sockaddr *)sa, sizeof *sa) == 0) {
+            *side = 1;
+            rc = shm_recv_fds(sock, fds);
+            goto out;
+        }
+        if (errno != ECONNREFUSED && errno != ENOENT)
+            goto out;
+        /*
+         * Nobody is listening. The socket may belong to an end which has
+         * bound it but not yet called listen(), so give it a moment before
+         * removing it as left behind by an end which exited before its peer
+         * attached.
+         */
+        if (errno == ECONNREFUSED) {
+            if (!refused) {
+                refused = true;
+                close(sock);
+                sock = -1;
+                usleep(100000);
+                continue;
+            }
+            (void)unlink(sa->sun_path);
+        }
+        if (bind(sock, (const struct sockaddr *)sa, sizeof *sa) == 0)
+            break;
+        if (errno != EADDRINUSE)
+            goto out;
+        close(sock);
+        sock = -1;
+    }
+    if (sock == -1) {
+        errno = EADDRINUSE;
+        return -1;
+    }
+
+    if (listen(sock, 1) == -1)
+        goto out;
+    int peer;
+    do {
+        peer = accept4(sock, NULL, NULL, SOCK_CLOEXEC);
+    } while (peer == -1 && errno == EINTR);
+    (void)unlink(sa->sun_path);
+    if (peer == -1)
+        goto out;
+    *side = 0;
+    if (shm_create_fds(fds) == 0) {
+        rc = shm_send_fds(peer, fds);
+        if (rc == -1) {
+            saved_errno = errno;
+            for (int i = 0; i < 3; i++)
+                close(fds[i]);
+            errno = saved_errno;
+        }
+    }
+    saved_errno = errno;
+    close(peer);
+    errno = saved_errno;
+
+out:
+    saved_errno = errno;
+    if (sock != -1)
+        close(sock);
+    errno = saved_errno;
+    return rc;
+}
+
+struct shm_link *shm_attach(const char *spec)
+{
+    struct sockaddr_un sa = { .sun_family = AF_UNIX };
+    const char *path = spec + 4;
+
+    if (!shm_is_spec(spec) || path[0] == '\0') {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (strlen(path) >= sizeof sa.sun_path) {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+    strcpy(sa.sun_path, path);
+
+    struct shm_link *sl = calloc(1, sizeof *sl);
+    if (sl == NULL)
+        return NULL;
+    int fds[3], side;
+    if (shm_rendezvous(&sa, fds, &side) == -1) {
+        free(sl);
+        return NULL;
+    }
+
+    struct shm_ring *rings = mmap(NULL, 2 * sizeof (struct shm_ring),
+            PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+    int saved_errno = errno;
+    close(fds[0]);
+    if (rings == MAP_FAILED) {
+        close(fds[1]);
+        close(fds[2]);
+        free(sl);
+        errno = saved_errno;
+        return NULL;
+    }
+    sl->tx = &rings[side];
+    sl->rx = &rings[1 - side];
+    sl->txefd = fds[1 + side];
+    sl->rxefd = fds[2 - side];
+    return sl;
+}
+
+int shm_fd(struct shm_link *sl)
+{
+    return sl->rxefd;
+}
+
+ssize_t shm_read(struct shm_link *sl, void *buf, size_t size)
+{
+    struct shm_ring *r = sl->rx;
+    uint32_t tail = r->tail;
+
+    if (__atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == tail) {
+        /*
+         * Re-arm the wakeup before checking again: the producer signals when
+         * it finds the ring empty after queueing, so a packet queued after
+         * the check below is guaranteed to signal rxefd again.
+         */
+        uint64_t val;
+        (void)read(sl->rxefd, &val, sizeof val);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == tail) {
+            errno = EAGAIN;
+            return -1;
+        }
+    }
+
+    /*
+     * The peer is not trusted, so bound the length it gives us.
+     */
+    unsigned i = tail % SHM_SLOTS;
+    size_t len = r->slot[i].len;
+    if (len > sizeof r->slot[i].data)
+        len = sizeof r->slot[i].data;
+    if (len > size)
+        len = size;
+    memcpy(buf, r->slot[i].data, len);
+    __atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+    return len;
+}
+
+ssize_t shm_write(struct shm_link *sl, const void *buf, size_t size)
+{
+    struct shm_ring *r = sl->tx;
+    uint32_t head = r->head;
+
+    if (size > sizeof r->slot[0].data) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    if (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) >= SHM_SLOTS)
+        return size;            /* Dropped */
+
+    unsigned i = head % SHM_SLOTS;
+    memcpy(r->slot[i].data, buf, size);
+    r->slot[i].len = size;
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+    /*
+     * If the consumer had drained the ring, it may be waiting for rxefd.
+     */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) == head)
+        sl->tx_wakeup = true;
+    return size;
+}
+
+void shm_flush(struct shm_link *sl)
+{
+    uint64_t one = 1;
+
+    if (!sl->tx_wakeup)
+        return;
+    (void)write(sl->txefd, &one, sizeof one);
+    sl->tx_wakeup = false;
+}
+
+#else /* !__linux__ */
+
+struct shm_link *shm_attach(const char *spec)
+{
+    (void)spec;
+    errno = ENOTSUP;
+    return NULL;
+}
+
+int shm_fd(struct shm_link *sl)
+{
+    (void)sl;
+    return -1;
+}
+
+ssize_t shm_read(struct shm_link *sl, void *buf, size_t size)
+{
+    (void)sl;
+    (void)buf;
+    (void)size;
+    errno = ENOTSUP;
+    return -1;
+}
+
+ssize_t shm_write(struct shm_link *sl, const void *buf, size_t size)
+{
+    (void)sl;
+    (void)buf;
+    (void)size;
+    errno = ENOTSUP;
+    return -1;
+}
+
+void shm_flush(struct shm_link *sl)
+{
+    (void)sl;
+}
+
+#endif /* __linux__ */
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * shm_attach.h: Common functions for attaching to shared-memory links between
+ * tenders.
+ */
+
+#ifndef COMMON_SHM_ATTACH_H
+#define COMMON_SHM_ATTACH_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+struct shm_link;
+
+/*
+ * MTU of networks attached using shared-memory links. Packets are copied
+ * into fixed-size ring slots of 2kB.
+ */
+#define SHM_ATTACH_MTU 1500
+
+/*
+ * Returns true if (spec) is of the form "shm:PATH" and should be attached
+ * using shm_attach().
+ */
+int shm_is_spec(const char *spec);
+
+/*
+ * Attach to the shared-memory link rendezvousing at the UNIX socket PATH
+ * given in (spec). The first tender to attach listens on PATH, blocking until
+ * a second tender attaches to the same PATH, and then passes it a memfd
+ * holding one packet ring per direction and an eventfd per direction used to
+ * signal that a ring is no longer empty. PATH is removed once both ends are
+ * attached.
+ *
+ * Returns NULL and an appropriate errno on failure (ENOTSUP if not supported
+ * on this host).
+ */
+struct shm_link *shm_attach(const char *spec);
+
+/*
+ * Returns the descriptor of (sl), which becomes readable when packets are
+ * pending and can be used with poll() or equivalent.
+ */
+int shm_fd(struct shm_link *sl);
+
+/*
+ * Receives a single packet from (sl) into (buf), without blocking. Semantics
+ * are as for read() on a TAP device: returns the packet length, which is
+ * truncated to (size) if necessary, or -1 and EAGAIN if no packets are
+ * pending.
+ */
+ssize_t shm_read(struct shm_link *sl, void *buf, size_t size);
+
+/*
+ * Queues a single packet of (size) bytes from (buf) for sending on (sl),
+ * without blocking. The peer is only woken up by shm_flush(). As for TAP
+ * devices, if the ring is full the packet is silently dropped. Returns
+ * (size), or -1 and an appropriate errno on failure.
+ */
+ssize_t shm_write(struct shm_link *sl, const void *buf, size_t size);
+
+/*
+ * Wakes up the peer of (sl) if shm_write() has queued packets into an empty
+ * ring since the last call.
+ */
+void shm_flush(struct shm_link *sl);
+
+#endif /* COMMON_SHM_ATTACH_H */
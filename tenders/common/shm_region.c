@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * shm_region.c: Common functions for attaching to shared-memory regions.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "mft_abi.h"
+#include "shm_region.h"
+
+#if defined(__linux__)
+
+/*
+ * Receives the descriptors passed by the service on (sock) into (fds),
+ * returning how many there are, or -1 on error.
+ */
+static int recv_fds(int sock, int fds[3])
+{
+    char byte;
+    struct iovec iov = { .iov_base = &byte, .iov_len = 1 };
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(3 * sizeof (int))];
+    } control;
+    struct msghdr mh = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof control.buf
+    };
+
+    ssize_t nbytes;
+    do {
+        nbytes = recvmsg(sock, &mh, MSG_CMSG_CLOEXEC);
+    } while (nbytes == -1 && errno == EINTR);
+    if (nbytes == -1)
+        return -1;
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&mh);
+    if (nbytes != 1 || cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET ||
+            cmsg->cmsg_type != SCM_RIGHTS || (mh.msg_flags & MSG_CTRUNC)) {
+        errno = EPROTO;
+        return -1;
+    }
+    int n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof (int);
+    memcpy(fds, CMSG_DATA(cmsg), n * sizeof (int));
+    if (n != 1 && n != 3) {
+        for (int i = 0; i < n; i++)
+            close(fds[i]);
+        errno = EPROTO;
+        return -1;
+    }
+    return n;
+}
+
+static int connect_service(const char *path, struct shm_region *r)
+{
+    struct sockaddr_un sa = { .sun_family = AF_UNIX };
+
+    if (strlen(path) >= sizeof sa.sun_path) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(sa.sun_path, path);
+
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock == -1)
+        return -1;
+    int fds[3], n = -1;
+    if (connect(sock, (const struct sockaddr *)&sa, sizeof sa) == 0)
+        n = recv_fds(sock, fds);
+    int saved_errno = errno;
+    close(sock);
+    errno = saved_errno;
+    if (n == -1)
+        return -1;
+
+    r->memfd = fds[0];
+    r->notifyfd = (n == 3) ? fds[1] : -1;
+    r->kickfd = (n == 3) ? fds[2] : -1;
+    return 0;
+}
+
+int shm_region_attach(const char *path, struct shm_region *r)
+{
+    struct stat st;
+
+    if (stat(path, &st) == -1)
+        return -1;
+    if (S_ISSOCK(st.st_mode)) {
+        if (connect_service(path, r) == -1)
+            return -1;
+    }
+    else {
+        r->memfd = open(path, O_RDWR | O_CLOEXEC);
+        if (r->memfd == -1)
+            return -1;
+        r->notifyfd = r->kickfd = -1;
+    }
+
+    if (fstat(r->memfd, &st) == -1)
+        goto fail;
+    r->size = st.st_size & ~(uint64_t)(MFT_SHM_PAGE_SIZE - 1);
+    if (r->size == 0) {
+        errno = EINVAL;
+        goto fail;
+    }
+    return 0;
+
+fail:;
+    int saved_errno = errno;
+    close(r->memfd);
+    if (r->notifyfd != -1) {
+        close(r->notifyfd);
+        close(r->kickfd);
+    }
+    errno = saved_errno;
+    return -1;
+}
+
+#else /* !__linux__ */
+
+int shm_region_attach(const char *path, struct shm_region *r)
+{
+    (void)path;
+    (void)r;
+    errno = ENOTSUP;
+    return -1;
+}
+
+#endif
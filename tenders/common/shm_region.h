@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * shm_region.h: Common functions for attaching to shared-memory regions.
+ */
+
+#ifndef COMMON_SHM_REGION_H
+#define COMMON_SHM_REGION_H
+
+#include <stdint.h>
+
+struct shm_region {
+    int memfd;                  /* Memory of the region */
+    int notifyfd;               /* Signalled by the service, or -1 */
+    int kickfd;                 /* Signalled for the guest, or -1 */
+    uint64_t size;              /* Bytes, a multiple of MFT_SHM_PAGE_SIZE */
+};
+
+/*
+ * Attach to the shared-memory region at (path), storing it in (r).
+ *
+ * If (path) is a UNIX socket, the host service listening on it passes the
+ * tender a descriptor for the region's memory in a single message, optionally
+ * followed by two eventfds forming the region's doorbell: the service signals
+ * the first to notify the guest, and the tender signals the second when the
+ * guest notifies the service. Otherwise, (path) is a file, e.g. on tmpfs or
+ * hugetlbfs, shared without a doorbell. The size of the region is that of
+ * the memory, rounded down to a whole number of pages.
+ *
+ * Returns 0 on success, or -1 and an appropriate errno on failure (ENOTSUP
+ * if not supported on this host).
+ */
+int shm_region_attach(const char *path, struct shm_region *r);
+
+#endif /* COMMON_SHM_REGION_H */
@@ -0,0 +1,613 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * switch_attach.c: Common functions for attaching to an L2 switch shared
+ * between tenders.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#endif
+
+#include "switch_attach.h"
+#include "tap_attach.h"
+#include "xdp_attach.h"
+
+int switch_is_spec(const char *spec)
+{
+    return strncmp(spec, "switch:", 7) == 0;
+}
+
+#if defined(__linux__)
+
+#define SW_MAGIC        0x315753354f4c4f53ULL   /* "SOLO5SW1" */
+#define SW_NAME_MAX     64
+#define SW_SLOTS        256
+#define SW_SLOT_SIZE    2048
+
+/*
+ * A bounded multi-producer, single-consumer ring of packets. Producers claim
+ * a slot by advancing (head), and publish it by setting its (seq) to one more
+ * than its position; the consumer frees it by setting (seq) to its position
+ * in the next lap. All positions run freely and are reduced modulo SW_SLOTS.
+ */
+struct sw_ring {
+    uint32_t head __attribute__((aligned(64)));
+    uint32_t tail __attribute__((aligned(64)));
+    struct {
+        uint32_t seq;
+        uint32_t len;
+        uint8_t data[SW_SLOT_SIZE - 2 * sizeof (uint32_t)];
+    } slot[SW_SLOTS] __attribute__((aligned(64)));
+};
+
+struct sw_port {
+    int32_t owner __attribute__((aligned(64))); /* pid, 0 if free */
+    uint32_t waiting;           /* Owner waits for its doorbell */
+    uint32_t uplink;            /* Owner has an uplink */
+    uint64_t mac;               /* Learned MAC address, see mac_key() */
+    struct sw_ring rx;
+};
+
+struct sw_shared {
+    uint64_t magic;
+    struct sw_port port[SWITCH_ATTACH_PORTS];
+};
+
+struct switch_port {
+    struct sw_shared *sw;
+    struct sw_port *self;
+    unsigned index;
+    char name[SW_NAME_MAX];
+    int bellfd;                 /* Doorbell of our port */
+    int txfd;                   /* Socket to ring the doorbells of others */
+    int epfd;                   /* Doorbell and uplink */
+    int uplinkfd;               /* TAP uplink, or -1 */
+    struct xdp_sock *uplink_xdp; /* AF_XDP uplink, or NULL */
+    uint64_t wakeup;            /* Ports to ring on the next switch_flush() */
+};
+
+/*
+ * MAC addresses are kept as integers, with an extra bit set to tell an
+ * address apart from none.
+ */
+static uint64_t mac_key(const uint8_t *mac)
+{
+    uint64_t key = 1ULL << 48;
+
+    for (int i = 0; i < 6; i++)
+        key |= (uint64_t)mac[i] << (8 * i);
+    return key;
+}
+
+static void ring_reset(struct sw_ring *r)
+{
+    r->head = 0;
+    r->tail = 0;
+    for (uint32_t i = 0; i < SW_SLOTS; i++)
+        __atomic_store_n(&r->slot[i].seq, i, __ATOMIC_RELEASE);
+}
+
+/*
+ * Queues a packet on (r). Returns false if the ring is full.
+ */
+static bool ring_push(struct sw_ring *r, const void *buf, size_t size)
+{
+    uint32_t pos = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+
+    for (;;) {
+        unsigned i = pos % SW_SLOTS;
+        uint32_t seq = __atomic_load_n(&r->slot[i].seq, __ATOMIC_ACQUIRE);
+        int32_t diff = (int32_t)(seq - pos);
+        if (diff < 0)
+            return false;
+        if (diff > 0) {
+            pos = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+            continue;
+        }
+        if (__atomic_compare_exchange_n(&r->head, &pos, pos + 1, false,
+                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            memcpy(r->slot[i].data, buf, size);
+            r->slot[i].len = size;
+            __atomic_store_n(&r->slot[i].seq, pos + 1, __ATOMIC_RELEASE);
+            return true;
+        }
+    }
+}
+
+/*
+ * Receives a packet from (r) into (buf). Returns -1 if the ring is empty.
+ */
+static ssize_t ring_pop(struct sw_ring *r, void *buf, size_t size)
+{
+    uint32_t pos = r->tail;
+    unsigned i = pos % SW_SLOTS;
+
+    if (__atomic_load_n(&r->slot[i].seq, __ATOMIC_ACQUIRE) != pos + 1)
+        return -1;
+    /*
+     * Other tenders are not trusted, so bound the length they give us.
+     */
+    size_t len = r->slot[i].len;
+    if (len > sizeof r->slot[i].data)
+        len = sizeof r->slot[i].data;
+    if (len > size)
+        len = size;
+    memcpy(buf, r->slot[i].data, len);
+    __atomic_store_n(&r->slot[i].seq, pos + SW_SLOTS, __ATOMIC_RELEASE);
+    r->tail = pos + 1;
+    return len;
+}
+
+static bool ring_empty(struct sw_ring *r)
+{
+    uint32_t pos = r->tail;
+
+    return __atomic_load_n(&r->slot[pos % SW_SLOTS].seq, __ATOMIC_ACQUIRE) !=
+        pos + 1;
+}
+
+static bool port_active(const struct sw_port *p)
+{
+    return __atomic_load_n(&p->owner, __ATOMIC_ACQUIRE) > 0;
+}
+
+/*
+ * Queues a packet for port (i), noting it for switch_flush() if its owner is
+ * waiting.
+ */
+static void port_deliver(struct switch_port *sp, unsigned i, const void *buf,
+        size_t size)
+{
+    struct sw_port *p = &sp->sw->port[i];
+
+    if (!ring_push(&p->rx, buf, size))
+        return;                 /* Dropped */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&p->waiting, __ATOMIC_RELAXED) &&
+            __atomic_exchange_n(&p->waiting, 0, __ATOMIC_ACQ_REL))
+        sp->wakeup |= 1ULL << i;
+}
+
+/*
+ * Returns the port other than ours whose MAC address is (key), or -1.
+ */
+static int port_lookup(struct switch_port *sp, uint64_t key)
+{
+    for (unsigned i = 0; i < SWITCH_ATTACH_PORTS; i++) {
+        struct sw_port *p = &sp->sw->port[i];
+        if (i != sp->index &&
+                __atomic_load_n(&p->mac, __ATOMIC_RELAXED) == key &&
+                port_active(p))
+            return i;
+    }
+    return -1;
+}
+
+/*
+ * Learns the source MAC address of a packet sent by our port. An address
+ * moving to our port from another, e.g. that of a unikernel restarted on a
+ * different port, is forgotten there.
+ */
+static void port_learn(struct switch_port *sp, const uint8_t *src)
+{
+    if (src[0] & 1)
+        return;
+    uint64_t key = mac_key(src);
+    if (__atomic_load_n(&sp->self->mac, __ATOMIC_RELAXED) == key)
+        return;
+    for (unsigned i = 0; i < SWITCH_ATTACH_PORTS; i++) {
+        uint64_t old = key;
+        if (i != sp->index)
+            (void)__atomic_compare_exchange_n(&sp->sw->port[i].mac, &old, 0,
+                    false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&sp->self->mac, key, __ATOMIC_RELAXED);
+}
+
+static void uplink_write(struct switch_port *sp, const void *buf, size_t size)
+{
+    if (sp->uplink_xdp != NULL)
+        (void)xdp_write(sp->uplink_xdp, buf, size);
+    else if (sp->uplinkfd != -1)
+        (void)write(sp->uplinkfd, buf, size);
+}
+
+static ssize_t uplink_read(struct switch_port *sp, void *buf, size_t size)
+{
+    if (sp->uplink_xdp != NULL)
+        return xdp_read(sp->uplink_xdp, buf, size);
+    else if (sp->uplinkfd != -1)
+        return read(sp->uplinkfd, buf, size);
+    errno = EAGAIN;
+    return -1;
+}
+
+/*
+ * Switches a packet received on our uplink. Returns true if it was forwarded
+ * to another port only, false if it is for our unikernel.
+ */
+static bool uplink_ingress(struct switch_port *sp, const uint8_t *buf,
+        size_t len)
+{
+    if (len < 12)
+        return false;
+    if (buf[0] & 1) {
+        for (unsigned i = 0; i < SWITCH_ATTACH_PORTS; i++) {
+            struct sw_port *p = &sp->sw->port[i];
+            if (i != sp->index && port_active(p) &&
+                    !__atomic_load_n(&p->uplink, __ATOMIC_RELAXED))
+                port_deliver(sp, i, buf, len);
+        }
+        return false;
+    }
+    int i = port_lookup(sp, mac_key(buf));
+    if (i == -1)
+        return false;
+    port_deliver(sp, i, buf, len);
+    return true;
+}
+
+/*
+ * Claims a free port of (sw), or one whose owner has exited, for the calling
+ * process. Must be called with the switch locked.
+ */
+static int port_claim(struct sw_shared *sw, bool uplink)
+{
+    pid_t self = getpid();
+
+    for (unsigned i = 0; i < SWITCH_ATTACH_PORTS; i++) {
+        struct sw_port *p = &sw->port[i];
+        int32_t owner = __atomic_load_n(&p->owner, __ATOMIC_ACQUIRE);
+        if (owner > 0 && (kill(owner, 0) == 0 || errno != ESRCH))
+            continue;
+        /*
+         * The port is inactive while it is reset, so other tenders stop
+         * sending to it.
+         */
+        __atomic_store_n(&p->owner, 0, __ATOMIC_RELEASE);
+        __atomic_store_n(&p->mac, 0, __ATOMIC_RELAXED);
+        p->waiting = 0;
+        p->uplink = uplink;
+        ring_reset(&p->rx);
+        __atomic_store_n(&p->owner, self, __ATOMIC_RELEASE);
+        return i;
+    }
+    errno = EBUSY;
+    return -1;
+}
+
+/*
+ * Maps the switch (name), creating it if necessary, and claims a port of it.
+ * Returns the switch and stores the port in (*index), or returns NULL on
+ * error.
+ */
+static struct sw_shared *switch_open(const char *name, bool uplink,
+        unsigned *index)
+{
+    char path[32 + SW_NAME_MAX];
+    struct sw_shared *sw = NULL;
+    int saved_errno;
+
+    snprintf(path, sizeof path, "/dev/shm/solo5-switch-%s", name);
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd == -1)
+        return NULL;
+    if (flock(fd, LOCK_EX) == -1)
+        goto out;
+    struct stat st;
+    if (fstat(fd, &st) == -1)
+        goto out;
+    if (st.st_size == 0 && ftruncate(fd, sizeof *sw) == -1)
+        goto out;
+    else if (st.st_size != 0 && st.st_size != sizeof *sw) {
+        errno = EPROTO;
+        goto out;
+    }
+    sw = mmap(NULL, sizeof *sw, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (sw == MAP_FAILED) {
+        sw = NULL;
+        goto out;
+    }
+    if (sw->magic != SW_MAGIC) {
+        for (unsigned i = 0; i < SWITCH_ATTACH_PORTS; i++)
+            ring_reset(&sw->port[i].rx);
+        sw->magic = SW_MAGIC;
+    }
+    int i = port_claim(sw, uplink);
+    if (i == -1) {
+        saved_errno = errno;
+        munmap(sw, sizeof *sw);
+        sw = NULL;
+        errno = saved_errno;
+    }
+    else
+        *index = i;
+
+out:
+    saved_errno = errno;
+    /*
+     * The mapping keeps the file open, and with it the lock.
+     */
+    (void)flock(fd, LOCK_UN);
+    close(fd);
+    errno = saved_errno;
+    return sw;
+}
+
+static void doorbell_addr(struct sockaddr_un *sa, socklen_t *len,
+        const char *name, unsigned index)
+{
+    memset(sa, 0, sizeof *sa);
+    sa->sun_family = AF_UNIX;
+    /*
+     * Abstract socket names are not NUL-terminated.
+     */
+    int n = snprintf(sa->sun_path + 1, sizeof sa->sun_path - 1,
+            "solo5-switch-%s-%u", name, index);
+    *len = offsetof(struct sockaddr_un, sun_path) + 1 + n;
+}
+
+struct switch_port *switch_attach(const char *spec)
+{
+    const char *name = spec + 7;
+    const char *uplink = NULL;
+    size_t name_len;
+    int saved_errno;
+
+    if (!switch_is_spec(spec)) {
+        errno = EINVAL;
+        return NULL;
+    }
+    const char *comma = strchr(name, ',');
+    if (comma != NULL) {
+        if (strncmp(comma, ",uplink=", 8) != 0 || comma[8] == '\0') {
+            errno = EINVAL;
+            return NULL;
+        }
+        uplink = comma + 8;
+        name_len = comma - name;
+    }
+    else
+        name_len = strlen(name);
+    if (name_len == 0 || name_len >= SW_NAME_MAX ||
+            memchr(name, '/', name_len) != NULL) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    struct switch_port *sp = calloc(1, sizeof *sp);
+    if (sp == NULL)
+        return NULL;
+    memcpy(sp->name, name, name_len);
+    sp->bellfd = sp->txfd = sp->epfd = sp->uplinkfd = -1;
+
+    if (uplink != NULL) {
+        if (xdp_is_spec(uplink)) {
+            sp->uplink_xdp = xdp_attach(uplink);
+            if (sp->uplink_xdp == NULL)
+                goto fail;
+        }
+        else {
+            sp->uplinkfd = tap_attach(uplink);
+            if (sp->uplinkfd == -1)
+                goto fail;
+        }
+    }
+
+    sp->sw = switch_open(sp->name, uplink != NULL, &sp->index);
+    if (sp->sw == NULL)
+        goto fail;
+    sp->self = &sp->sw->port[sp->index];
+
+    struct sockaddr_un sa;
+    socklen_t sa_len;
+    doorbell_addr(&sa, &sa_len, sp->name, sp->index);
+    sp->bellfd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+            0);
+    if (sp->bellfd == -1 ||
+            bind(sp->bellfd, (struct sockaddr *)&sa, sa_len) == -1)
+        goto fail_port;
+    sp->txfd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sp->txfd == -1)
+        goto fail_port;
+
+    sp->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (sp->epfd == -1)
+        goto fail_port;
+    struct epoll_event ev = { .events = EPOLLIN };
+    if (epoll_ctl(sp->epfd, EPOLL_CTL_ADD, sp->bellfd, &ev) == -1)
+        goto fail_port;
+    int upfd = (sp->uplink_xdp != NULL) ? xdp_fd(sp->uplink_xdp) :
+        sp->uplinkfd;
+    if (upfd != -1 && epoll_ctl(sp->epfd, EPOLL_CTL_ADD, upfd, &ev) == -1)
+        goto fail_port;
+    return sp;
+
+fail_port:
+    saved_errno = errno;
+    __atomic_store_n(&sp->self->owner, 0, __ATOMIC_RELEASE);
+    munmap(sp->sw, sizeof *sp->sw);
+    errno = saved_errno;
+fail:
+    saved_errno = errno;
+    if (sp->bellfd != -1)
+        close(sp->bellfd);
+    if (sp->txfd != -1)
+        close(sp->txfd);
+    if (sp->epfd != -1)
+        close(sp->epfd);
+    if (sp->uplinkfd != -1)
+        close(sp->uplinkfd);
+    free(sp);
+    errno = saved_errno;
+    return NULL;
+}
+
+int switch_fd(struct switch_port *sp)
+{
+    return sp->epfd;
+}
+
+ssize_t switch_read(struct switch_port *sp, void *buf, size_t size)
+{
+    ssize_t len;
+
+    for (;;) {
+        len = ring_pop(&sp->self->rx, buf, size);
+        if (len >= 0)
+            break;
+        len = uplink_read(sp, buf, size);
+        if (len >= 0) {
+            if (uplink_ingress(sp, buf, len))
+                continue;
+            break;
+        }
+        if (errno != EAGAIN)
+            break;
+        /*
+         * Drain the doorbell and announce that we are waiting before
+         * checking the ring again: a producer rings it if it finds us
+         * waiting after queueing, so a packet queued after the check below
+         * is guaranteed to ring it again.
+         */
+        char byte;
+        while (recv(sp->bellfd, &byte, sizeof byte, 0) != -1)
+            ;
+        __atomic_store_n(&sp->self->waiting, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (ring_empty(&sp->self->rx)) {
+            errno = EAGAIN;
+            break;
+        }
+    }
+    /*
+     * Packets from the uplink may have been forwarded to other ports.
+     */
+    int saved_errno = errno;
+    switch_flush(sp);
+    errno = saved_errno;
+    return len;
+}
+
+ssize_t switch_write(struct switch_port *sp, const void *buf, size_t size)
+{
+    const uint8_t *frame = buf;
+
+    if (size > sizeof sp->self->rx.slot[0].data) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    if (size < 12)
+        return size;            /* Dropped */
+
+    port_learn(sp, frame + 6);
+    if (frame[0] & 1) {
+        for (unsigned i = 0; i < SWITCH_ATTACH_PORTS; i++) {
+            if (i != sp->index && port_active(&sp->sw->port[i]))
+                port_deliver(sp, i, buf, size);
+        }
+        uplink_write(sp, buf, size);
+        return size;
+    }
+    int i = port_lookup(sp, mac_key(frame));
+    if (i != -1)
+        port_deliver(sp, i, buf, size);
+    else
+        uplink_write(sp, buf, size);
+    return size;
+}
+
+void switch_flush(struct switch_port *sp)
+{
+    while (sp->wakeup != 0) {
+        unsigned i = __builtin_ctzll(sp->wakeup);
+        sp->wakeup &= sp->wakeup - 1;
+        struct sockaddr_un sa;
+        socklen_t sa_len;
+        char byte = 0;
+        doorbell_addr(&sa, &sa_len, sp->name, i);
+        /*
+         * If the doorbell's queue is full, it has been rung already.
+         */
+        (void)sendto(sp->txfd, &byte, sizeof byte, MSG_DONTWAIT,
+                (struct sockaddr *)&sa, sa_len);
+    }
+}
+
+#else /* !__linux__ */
+
+struct switch_port *switch_attach(const char *spec)
+{
+    (void)spec;
+    errno = ENOTSUP;
+    return NULL;
+}
+
+int switch_fd(struct switch_port *sp)
+{
+    (void)sp;
+    return -1;
+}
+
+ssize_t switch_read(struct switch_port *sp, void *buf, size_t size)
+{
+    (void)sp;
+    (void)buf;
+    (void)size;
+    errno = ENOTSUP;
+    return -1;
+}
+
+ssize_t switch_write(struct switch_port *sp, const void *buf, size_t size)
+{
+    (void)sp;
+    (void)buf;
+    (void)size;
+    errno = ENOTSUP;
+    return -1;
+}
+
+void switch_flush(struct switch_port *sp)
+{
+    (void)sp;
+}
+
+#endif /* __linux__ */
@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * switch_attach.h: Common functions for attaching to an L2 switch shared
+ * between tenders.
+ */
+
+#ifndef COMMON_SWITCH_ATTACH_H
+#define COMMON_SWITCH_ATTACH_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+struct switch_port;
+
+/*
+ * MTU of networks attached to a switch. Packets are copied into fixed-size
+ * ring slots of 2kB.
+ */
+#define SWITCH_ATTACH_MTU 1500
+
+/*
+ * Maximum number of ports of a switch.
+ */
+#define SWITCH_ATTACH_PORTS 32
+
+/*
+ * Returns true if (spec) is of the form "switch:NAME[,uplink=IFACE]" and
+ * should be attached using switch_attach().
+ */
+int switch_is_spec(const char *spec);
+
+/*
+ * Attach to a free port of the switch NAME given in (spec), creating the
+ * switch if no tender is attached to it yet. The switch is a shared-memory
+ * region holding a packet ring per port, which any tender attached to the
+ * switch may queue packets into; a tender is woken up through a datagram
+ * socket of its port when its ring becomes non-empty. Ports of tenders which
+ * have exited are reused.
+ *
+ * Packets are forwarded between ports by destination MAC address, learned
+ * from the source addresses of the packets each port sends. Packets for
+ * addresses not on the switch leave through the uplink of the sending port,
+ * IFACE, which is a TAP interface or an AF_XDP socket given as for
+ * xdp_attach(), and are dropped if it has none. Packets received on an
+ * uplink for another port are forwarded to it, broadcasts to the ports with
+ * no uplink of their own.
+ *
+ * Returns NULL and an appropriate errno on failure (ENOTSUP if not supported
+ * on this host, EBUSY if the switch has no free ports).
+ */
+struct switch_port *switch_attach(const char *spec);
+
+/*
+ * Returns the descriptor of (sp), which becomes readable when packets are
+ * pending, on the switch or on the uplink, and can be used with poll() or
+ * equivalent.
+ */
+int switch_fd(struct switch_port *sp);
+
+/*
+ * Receives a single packet from (sp) into (buf), without blocking. Semantics
+ * are as for read() on a TAP device: returns the packet length, which is
+ * truncated to (size) if necessary, or -1 and EAGAIN if no packets are
+ * pending.
+ */
+ssize_t switch_read(struct switch_port *sp, void *buf, size_t size);
+
+/*
+ * Forwards a single packet of (size) bytes from (buf) from (sp), without
+ * blocking. Ports receiving the packet are only woken up by switch_flush().
+ * As for TAP devices, if a destination ring is full the packet is silently
+ * dropped. Returns (size), or -1 and an appropriate errno on failure.
+ */
+ssize_t switch_write(struct switch_port *sp, const void *buf, size_t size);
+
+/*
+ * Wakes up the ports which switch_write() has queued packets for since the
+ * last call, if they are waiting.
+ */
+void switch_flush(struct switch_port *sp);
+
+#endif /* COMMON_SWITCH_ATTACH_H */
@@ -41,6 +41,7 @@
  * Linux TAP device specific.
  */
 #include <sys/socket.h>
+#include <linux/filter.h>
 #include <linux/if.h>
 #include <linux/if_tun.h>
 
@@ -59,7 +60,9 @@
 
 #endif
 
-int tap_attach(const char *ifname)
+#include "mft_abi.h"
+
+static int tap_open(const char *ifname, int vnet_hdr)
 {
     int fd;
 
@@ -82,6 +85,23 @@ int tap_attach(const char *ifname)
         if (fcntl(fd, F_SETFL, O_NONBLOCK) == -1)
             return -1;
 
+#if defined(__linux__)
+        /*
+         * We cannot change the flags of an already attached tap device, so
+         * the caller must have set up IFF_VNET_HDR for us.
+         */
+        struct ifreq ifr;
+
+        if (vnet_hdr) {
+            if (ioctl(fd, TUNGETIFF, (void *)&ifr) == -1)
+                return -1;
+            if (!(ifr.ifr_flags & IFF_VNET_HDR)) {
+                errno = EINVAL;
+                return -1;
+            }
+        }
+#endif
+
         return fd;
     }
     else if (strlen(ifname) >= IFNAMSIZ) {
@@ -137,13 +157,26 @@ int tap_attach(const char *ifname)
      * TODO: IFF_NO_PI may silently truncate packets on read().
      */
     ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+    if (vnet_hdr)
+        ifr.ifr_flags |= IFF_VNET_HDR;
     strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
 
     /*
      * Attach to the tap device; we have already verified that it exists, but
      * see below.
+     *
+     * The kernel refuses to attach unless IFF_MULTI_QUEUE matches the mode
+     * the device was created with, so if that fails try again as a
+     * multi-queue device. In that case, each successful attach adds a queue
+     * with its own descriptor, so the same device may be attached to several
+     * networks.
      */
-    if (ioctl(fd, TUNSETIFF, (void *)&ifr) == -1) {
+    int rc = ioctl(fd, TUNSETIFF, (void *)&ifr);
+    if (rc == -1 && errno == EINVAL) {
+        ifr.ifr_flags |= IFF_MULTI_QUEUE;
+        rc = ioctl(fd, TUNSETIFF, (void *)&ifr);
+    }
+    if (rc == -1) {
         err = errno;
         close(fd);
         errno = err;
@@ -162,6 +195,11 @@ int tap_attach(const char *ifname)
 
 #elif defined(__FreeBSD__)
 
+    if (vnet_hdr) {
+        errno = ENOTSUP;
+        return -1;
+    }
+
     char devname[strlen(ifname) + 6];
 
     snprintf(devname, sizeof devname, "/dev/%s", ifname);
@@ -175,6 +213,10 @@ int tap_attach(const char *ifname)
         errno = ENETDOWN;
         return -1;
     }
+    if (vnet_hdr) {
+        errno = ENOTSUP;
+        return -1;
+    }
 
     char devname[strlen(ifname) + 6];
 
@@ -187,6 +229,129 @@ int tap_attach(const char *ifname)
     return fd;
 }
 
+int tap_attach(const char *ifname)
+{
+    return tap_open(ifname, 0);
+}
+
+int tap_attach_offload(const char *ifname, uint32_t *offloads)
+{
+    int fd = tap_open(ifname, 1);
+
+    if (fd == -1)
+        return -1;
+
+    *offloads = MFT_NET_OFFLOAD_HDR;
+#if defined(__linux__)
+    /*
+     * Ask for the largest set of offloads the host kernel will give us,
+     * falling back to checksum offload only, or none at all.
+     */
+    if (ioctl(fd, TUNSETOFFLOAD, TUN_F_CSUM | TUN_F_TSO4 | TUN_F_TSO6) == 0)
+        *offloads |= MFT_NET_OFFLOAD_CSUM | MFT_NET_OFFLOAD_TSO4 |
+            MFT_NET_OFFLOAD_TSO6;
+    else if (ioctl(fd, TUNSETOFFLOAD, TUN_F_CSUM) == 0)
+        *offloads |= MFT_NET_OFFLOAD_CSUM;
+#endif
+    return fd;
+}
+
+int tap_attach_mtu(int fd)
+{
+#if defined(__linux__)
+    struct ifreq ifr;
+    int sfd, rc, err;
+
+    if (ioctl(fd, TUNGETIFF, (void *)&ifr) == -1)
+        return -1;
+    sfd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sfd == -1)
+        return -1;
+    rc = ioctl(sfd, SIOCGIFMTU, (void *)&ifr);
+    err = errno;
+    close(sfd);
+    if (rc == -1) {
+        errno = err;
+        return -1;
+    }
+    return ifr.ifr_mtu;
+#else
+    (void)fd;
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+int tap_attach_filter_mac(int fd, const uint8_t *mac)
+{
+#if defined(__linux__)
+    struct {
+        struct tun_filter f;
+        uint8_t addr[3][ETH_ALEN];
+    } flt = {
+        .f.flags = 0,
+        .f.count = 3,
+        .addr = {
+            { mac[0], mac[1], mac[2], mac[3], mac[4], mac[5] },
+            { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff },
+            /* IPv6 neighbour discovery */
+            { 0x33, 0x33, 0xff, mac[3], mac[4], mac[5] }
+        }
+    };
+
+    return ioctl(fd, TUNSETTXFILTER, (void *)&flt);
+#else
+    (void)fd;
+    (void)mac;
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+int tap_attach_filter_bpf(int fd, const char *path)
+{
+#if defined(__linux__)
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+        return -1;
+
+    struct sock_filter *insns = NULL;
+    unsigned n;
+    int rc = -1, saved_errno;
+    if (fscanf(fp, "%u", &n) != 1 || n == 0 || n > BPF_MAXINSNS) {
+        errno = EINVAL;
+        goto out;
+    }
+    insns = calloc(n, sizeof *insns);
+    if (insns == NULL)
+        goto out;
+    for (unsigned i = 0; i < n; i++) {
+        unsigned code, jt, jf, k;
+        if (fscanf(fp, "%u %u %u %u", &code, &jt, &jf, &k) != 4 ||
+                code > UINT16_MAX || jt > UINT8_MAX || jf > UINT8_MAX) {
+            errno = EINVAL;
+            goto out;
+        }
+        insns[i] = (struct sock_filter){ code, jt, jf, k };
+    }
+
+    struct sock_fprog prog = { .len = n, .filter = insns };
+    rc = ioctl(fd, TUNATTACHFILTER, (void *)&prog);
+
+out:
+    saved_errno = errno;
+    free(insns);
+    fclose(fp);
+    errno = saved_errno;
+    return rc;
+#else
+    (void)fd;
+    (void)path;
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
 void tap_attach_genmac(uint8_t *mac)
 {
     int rfd = open("/dev/urandom", O_RDONLY);
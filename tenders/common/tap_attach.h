@@ -29,11 +29,49 @@
  * Attach to an existing TAP interface named (ifname). If ifname is "@<num>",
  * assume that a pre-existing TAP interface is open as file descriptor <num>.
  *
+ * On Linux, a TAP interface created in multi-queue mode may be attached more
+ * than once; each call attaches a new queue of the interface.
+ *
  * Returns -1 and an appropriate errno on failure (ENOENT if the interface does
  * not exist), and the tap device file descriptor on success.
  */
 int tap_attach(const char *ifname);
 
+/*
+ * As tap_attach(), but enables IFF_VNET_HDR and as many of the checksum and
+ * TCP segmentation offloads as the host supports on the TAP interface. If
+ * ifname is "@<num>", the descriptor must already have IFF_VNET_HDR set.
+ *
+ * On success, stores the MFT_NET_OFFLOAD_* flags enabled in (*offloads).
+ * Returns -1 with errno set to ENOTSUP if not supported on this host.
+ */
+int tap_attach_offload(const char *ifname, uint32_t *offloads);
+
+/*
+ * Returns the MTU of the TAP interface attached as (fd). Returns -1 and an
+ * appropriate errno on failure (ENOTSUP if not supported on this host).
+ */
+int tap_attach_mtu(int fd);
+
+/*
+ * Make the TAP interface attached as (fd) drop received frames not addressed
+ * to (mac), which must be an uint8_t[6], to broadcast, or to the IPv6
+ * solicited-node multicast address derived from (mac), so that they never
+ * reach the tender. Returns -1 and an appropriate errno on failure (ENOTSUP
+ * if not supported on this host).
+ */
+int tap_attach_filter_mac(int fd, const uint8_t *mac);
+
+/*
+ * Attach the classic BPF program in the file at (path) to the TAP interface
+ * attached as (fd), dropping received frames it rejects. The file is in the
+ * format printed by "tcpdump -ddd": the number of instructions, followed by
+ * one "code jt jf k" line per instruction, in decimal. Returns -1 and an
+ * appropriate errno on failure (EINVAL if the file is malformed, ENOTSUP if
+ * not supported on this host).
+ */
+int tap_attach_filter_bpf(int fd, const char *path);
+
 /*
  * Generate a random, locally-administered and unicast MAC address, and store it
  * in (*mac), which must be an uint8_t[6].
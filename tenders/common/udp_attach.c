@@ -0,0 +1,537 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * udp_attach.c: Common functions for attaching to an overlay network carrying
+ * Ethernet frames over UDP.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
+#endif
+
+#include "udp_attach.h"
+
+int udp_is_spec(const char *spec)
+{
+    return strncmp(spec, "udp:", 4) == 0;
+}
+
+#if defined(__linux__)
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT     103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO         104
+#endif
+
+#define UDP_RX_BATCH    16
+#define UDP_RX_SIZE     65536           /* Largest datagram, or GRO batch */
+#define UDP_TX_BATCH    32
+#define UDP_TX_SIZE     (256 * 1024)
+#define UDP_GSO_SEGS    64              /* UDP_MAX_SEGMENTS of older hosts */
+#define UDP_GSO_SIZE    60000           /* Bound on a GSO batch */
+#define UDP_FRAME_MAX   (UDP_ATTACH_MTU_MAX + 18)   /* With a VLAN tag */
+
+#define VXLAN_HLEN      8
+#define VXLAN_FLAG_VNI  0x08
+
+/*
+ * A datagram queued for sending, or with GSO a batch of datagrams of (seg)
+ * bytes, the last of which may be shorter, after which the batch is
+ * (closed).
+ */
+struct udp_tx {
+    size_t off;                 /* In (txbuf) */
+    size_t len;
+    size_t seg;
+    unsigned nsegs;
+    bool closed;
+};
+
+union udp_cmsg {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE(sizeof (int))];
+};
+
+struct udp_link {
+    int fd;
+    int backlogfd;              /* Signalled while (rx) holds frames */
+    int epfd;
+    bool backlog;
+    struct sockaddr_storage remote;
+    socklen_t remote_len;
+    size_t hlen;                /* Of (vxlan), 0 if frames are not wrapped */
+    uint8_t vxlan[VXLAN_HLEN];
+    bool gso;
+
+    uint8_t *rxbuf;             /* UDP_RX_BATCH of UDP_RX_SIZE */
+    struct mmsghdr rxmsg[UDP_RX_BATCH];
+    struct iovec rxiov[UDP_RX_BATCH];
+    struct sockaddr_storage rxaddr[UDP_RX_BATCH];
+    union udp_cmsg rxctl[UDP_RX_BATCH];
+    unsigned rxn;               /* Datagrams (or GRO batches) received */
+    unsigned rxi;               /* Next to return a frame from */
+    size_t rxoff;               /* Offset of that frame in it */
+
+    uint8_t *txbuf;             /* UDP_TX_SIZE */
+    size_t txlen;
+    struct udp_tx tx[UDP_TX_BATCH];
+    unsigned txn;
+};
+
+/*
+ * Parses ADDR:PORT or [ADDR]:PORT, of (n) characters at (s), into (ss).
+ */
+static int parse_addr(const char *s, size_t n, struct sockaddr_storage *ss,
+        socklen_t *ss_len)
+{
+    char host[INET6_ADDRSTRLEN];
+    char port[6];
+
+    const char *colon = memrchr(s, ':', n);
+    if (colon == NULL)
+        return -1;
+    size_t hlen = colon - s;
+    size_t plen = n - hlen - 1;
+    if (hlen >= 2 && s[0] == '[' && s[hlen - 1] == ']') {
+        s++;
+        hlen -= 2;
+    }
+    if (hlen == 0 || hlen >= sizeof host || plen == 0 || plen >= sizeof port)
+        return -1;
+    memcpy(host, s, hlen);
+    host[hlen] = '\0';
+    memcpy(port, colon + 1, plen);
+    port[plen] = '\0';
+    char *end;
+    unsigned long p = strtoul(port, &end, 10);
+    if (*end != '\0' || p > 65535)
+        return -1;
+
+    memset(ss, 0, sizeof *ss);
+    struct sockaddr_in *sin = (struct sockaddr_in *)ss;
+    struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)ss;
+    if (inet_pton(AF_INET, host, &sin->sin_addr) == 1) {
+        sin->sin_family = AF_INET;
+        sin->sin_port = htons(p);
+        *ss_len = sizeof *sin;
+    }
+    else if (inet_pton(AF_INET6, host, &sin6->sin6_addr) == 1) {
+        sin6->sin6_family = AF_INET6;
+        sin6->sin6_port = htons(p);
+        *ss_len = sizeof *sin6;
+    }
+    else
+        return -1;
+    return 0;
+}
+
+/*
+ * Returns true if (ss) is the host of (ul->remote). The port is not compared,
+ * as VXLAN endpoints send from a port chosen per flow.
+ */
+static bool from_remote(const struct udp_link *ul,
+        const struct sockaddr_storage *ss)
+{
+    if (ss->ss_family != ul->remote.ss_family)
+        return false;
+    if (ss->ss_family == AF_INET)
+        return ((const struct sockaddr_in *)ss)->sin_addr.s_addr ==
+            ((const struct sockaddr_in *)&ul->remote)->sin_addr.s_addr;
+    return memcmp(&((const struct sockaddr_in6 *)ss)->sin6_addr,
+            &((const struct sockaddr_in6 *)&ul->remote)->sin6_addr,
+            sizeof (struct in6_addr)) == 0;
+}
+
+struct udp_link *udp_attach(const char *spec)
+{
+    struct sockaddr_storage local;
+    socklen_t local_len;
+    unsigned long vni = 0;
+
+    if (!udp_is_spec(spec)) {
+        errno = EINVAL;
+        return NULL;
+    }
+    const char *lspec = spec + 4;
+    const char *rspec = strchr(lspec, '=');
+    if (rspec == NULL) {
+        errno = EINVAL;
+        return NULL;
+    }
+    rspec++;
+    const char *opt = strchr(rspec, ',');
+    if (opt != NULL) {
+        char *end;
+        if (strncmp(opt, ",vni=", 5) != 0 || opt[5] == '\0') {
+            errno = EINVAL;
+            return NULL;
+        }
+        vni = strtoul(opt + 5, &end, 10);
+        if (*end != '\0' || vni > 0xffffff) {
+            errno = EINVAL;
+            return NULL;
+        }
+    }
+
+    struct udp_link *ul = calloc(1, sizeof *ul);
+    if (ul == NULL)
+        return NULL;
+    ul->fd = ul->backlogfd = ul->epfd = -1;
+    if (parse_addr(lspec, rspec - 1 - lspec, &local, &local_len) == -1 ||
+            parse_addr(rspec, opt ? (size_t)(opt - rspec) : strlen(rspec),
+                &ul->remote, &ul->remote_len) == -1 ||
+            local.ss_family != ul->remote.ss_family ||
+            ((struct sockaddr_in *)&ul->remote)->sin_port == 0) {
+        free(ul);
+        errno = EINVAL;
+        return NULL;
+    }
+    if (opt != NULL) {
+        ul->hlen = VXLAN_HLEN;
+        ul->vxlan[0] = VXLAN_FLAG_VNI;
+        ul->vxlan[4] = vni >> 16;
+        ul->vxlan[5] = vni >> 8;
+        ul->vxlan[6] = vni;
+    }
+
+    ul->rxbuf = malloc(UDP_RX_BATCH * UDP_RX_SIZE);
+    ul->txbuf = malloc(UDP_TX_SIZE);
+    if (ul->rxbuf == NULL || ul->txbuf == NULL)
+        goto fail;
+    for (unsigned i = 0; i < UDP_RX_BATCH; i++) {
+        ul->rxiov[i].iov_base = ul->rxbuf + i * UDP_RX_SIZE;
+        ul->rxiov[i].iov_len = UDP_RX_SIZE;
+    }
+
+    ul->fd = socket(local.ss_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+            0);
+    if (ul->fd == -1 ||
+            bind(ul->fd, (struct sockaddr *)&local, local_len) == -1)
+        goto fail;
+    /*
+     * Hosts which do not support GRO deliver datagrams one by one, and those
+     * which do not support GSO reject UDP_SEGMENT.
+     */
+    int one = 1, zero = 0;
+    (void)setsockopt(ul->fd, SOL_UDP, UDP_GRO, &one, sizeof one);
+    ul->gso = setsockopt(ul->fd, SOL_UDP, UDP_SEGMENT, &zero,
+            sizeof zero) == 0;
+
+    ul->backlogfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (ul->backlogfd == -1)
+        goto fail;
+    ul->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (ul->epfd == -1)
+        goto fail;
+    struct epoll_event ev = { .events = EPOLLIN };
+    if (epoll_ctl(ul->epfd, EPOLL_CTL_ADD, ul->fd, &ev) == -1 ||
+            epoll_ctl(ul->epfd, EPOLL_CTL_ADD, ul->backlogfd, &ev) == -1)
+        goto fail;
+    return ul;
+
+fail:
+    {
+        int saved_errno = errno;
+        if (ul->fd != -1)
+            close(ul->fd);
+        if (ul->backlogfd != -1)
+            close(ul->backlogfd);
+        if (ul->epfd != -1)
+            close(ul->epfd);
+        free(ul->rxbuf);
+        free(ul->txbuf);
+        free(ul);
+        errno = saved_errno;
+    }
+    return NULL;
+}
+
+int udp_fd(struct udp_link *ul)
+{
+    return ul->epfd;
+}
+
+/*
+ * Keeps (backlogfd) readable while (pending), so that frames received with a
+ * batch but not yet read are reported as such by udp_fd().
+ */
+static void backlog_set(struct udp_link *ul, bool pending)
+{
+    uint64_t val = 1;
+
+    if (pending == ul->backlog)
+        return;
+    if (pending)
+        (void)write(ul->backlogfd, &val, sizeof val);
+    else
+        (void)read(ul->backlogfd, &val, sizeof val);
+    ul->backlog = pending;
+}
+
+static int rx_batch(struct udp_link *ul)
+{
+    for (unsigned i = 0; i < UDP_RX_BATCH; i++) {
+        struct msghdr *mh = &ul->rxmsg[i].msg_hdr;
+        mh->msg_name = &ul->rxaddr[i];
+        mh->msg_namelen = sizeof ul->rxaddr[i];
+        mh->msg_iov = &ul->rxiov[i];
+        mh->msg_iovlen = 1;
+        mh->msg_control = ul->rxctl[i].buf;
+        mh->msg_controllen = sizeof ul->rxctl[i].buf;
+        mh->msg_flags = 0;
+    }
+    int n;
+    do {
+        n = recvmmsg(ul->fd, ul->rxmsg, UDP_RX_BATCH, MSG_DONTWAIT, NULL);
+    } while (n == -1 && errno == EINTR);
+    if (n == -1)
+        return -1;
+    ul->rxn = n;
+    ul->rxi = 0;
+    ul->rxoff = 0;
+    return 0;
+}
+
+/*
+ * Returns the size of the datagrams coalesced by GRO into (mh), or (len) if
+ * it holds a single datagram.
+ */
+static size_t rx_segment_size(struct msghdr *mh, size_t len)
+{
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(mh); cmsg != NULL;
+            cmsg = CMSG_NXTHDR(mh, cmsg)) {
+        if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+            int seg;
+            memcpy(&seg, CMSG_DATA(cmsg), sizeof seg);
+            if (seg > 0)
+                return seg;
+        }
+    }
+    return len;
+}
+
+ssize_t udp_read(struct udp_link *ul, void *buf, size_t size)
+{
+    for (;;) {
+        if (ul->rxi == ul->rxn) {
+            backlog_set(ul, false);
+            if (rx_batch(ul) == -1)
+                return -1;
+            continue;
+        }
+
+        struct mmsghdr *m = &ul->rxmsg[ul->rxi];
+        uint8_t *p = ul->rxbuf + ul->rxi * UDP_RX_SIZE + ul->rxoff;
+        size_t len = rx_segment_size(&m->msg_hdr, m->msg_len);
+        if (len > m->msg_len - ul->rxoff)
+            len = m->msg_len - ul->rxoff;
+        bool valid = from_remote(ul, &ul->rxaddr[ul->rxi]) &&
+            !(m->msg_hdr.msg_flags & MSG_TRUNC);
+        ul->rxoff += len;
+        if (ul->rxoff >= m->msg_len) {
+            ul->rxi++;
+            ul->rxoff = 0;
+        }
+
+        /*
+         * Datagrams from other hosts, or not carrying a frame of our VNI,
+         * are dropped.
+         */
+        if (!valid || len == 0)
+            continue;
+        if (ul->hlen != 0) {
+            if (len < ul->hlen || !(p[0] & VXLAN_FLAG_VNI) ||
+                    memcmp(&p[4], &ul->vxlan[4], 3) != 0)
+                continue;
+            p += ul->hlen;
+            len -= ul->hlen;
+        }
+        backlog_set(ul, ul->rxi < ul->rxn);
+        if (len > size)
+            len = size;
+        memcpy(buf, p, len);
+        return len;
+    }
+}
+
+ssize_t udp_write(struct udp_link *ul, const void *buf, size_t size)
+{
+    size_t len = ul->hlen + size;
+
+    if (size > UDP_FRAME_MAX) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    if (ul->txlen + len > UDP_TX_SIZE)
+        udp_flush(ul);
+
+    /*
+     * With GSO, a frame no larger than those of the last batch queued is
+     * added to it, as a datagram of its own.
+     */
+    struct udp_tx *t = (ul->txn > 0) ? &ul->tx[ul->txn - 1] : NULL;
+    bool append = ul->gso && t != NULL && !t->closed && len <= t->seg &&
+        t->nsegs < UDP_GSO_SEGS && t->len + len <= UDP_GSO_SIZE;
+    if (!append && ul->txn == UDP_TX_BATCH)
+        udp_flush(ul);
+
+    uint8_t *p = ul->txbuf + ul->txlen;
+    memcpy(p, ul->vxlan, ul->hlen);
+    memcpy(p + ul->hlen, buf, size);
+    if (append) {
+        t->len += len;
+        t->nsegs++;
+        t->closed = len < t->seg;
+    }
+    else {
+        t = &ul->tx[ul->txn++];
+        t->off = ul->txlen;
+        t->len = t->seg = len;
+        t->nsegs = 1;
+        t->closed = false;
+    }
+    ul->txlen += len;
+    return size;
+}
+
+/*
+ * Sends the datagrams of (t) one by one, for hosts which turn out not to
+ * support GSO on the route taken.
+ */
+static void tx_segments(struct udp_link *ul, const struct udp_tx *t)
+{
+    for (size_t off = 0; off < t->len; off += t->seg) {
+        size_t len = (t->len - off < t->seg) ? t->len - off : t->seg;
+        (void)sendto(ul->fd, ul->txbuf + t->off + off, len, MSG_DONTWAIT,
+                (struct sockaddr *)&ul->remote, ul->remote_len);
+    }
+}
+
+void udp_flush(struct udp_link *ul)
+{
+    struct mmsghdr msgs[UDP_TX_BATCH];
+    struct iovec iov[UDP_TX_BATCH];
+    union udp_cmsg ctl[UDP_TX_BATCH];
+
+    for (unsigned i = 0; i < ul->txn; i++) {
+        const struct udp_tx *t = &ul->tx[i];
+        struct msghdr *mh = &msgs[i].msg_hdr;
+        iov[i].iov_base = ul->txbuf + t->off;
+        iov[i].iov_len = t->len;
+        memset(mh, 0, sizeof *mh);
+        mh->msg_name = &ul->remote;
+        mh->msg_namelen = ul->remote_len;
+        mh->msg_iov = &iov[i];
+        mh->msg_iovlen = 1;
+        if (t->nsegs > 1) {
+            uint16_t seg = t->seg;
+            mh->msg_control = ctl[i].buf;
+            mh->msg_controllen = CMSG_SPACE(sizeof seg);
+            struct cmsghdr *cmsg = CMSG_FIRSTHDR(mh);
+            cmsg->cmsg_level = SOL_UDP;
+            cmsg->cmsg_type = UDP_SEGMENT;
+            cmsg->cmsg_len = CMSG_LEN(sizeof seg);
+            memcpy(CMSG_DATA(cmsg), &seg, sizeof seg);
+        }
+    }
+
+    unsigned sent = 0;
+    while (sent < ul->txn) {
+        int n = sendmmsg(ul->fd, &msgs[sent], ul->txn - sent, MSG_DONTWAIT);
+        if (n >= 0) {
+            sent += n;
+            continue;
+        }
+        if (errno == EINTR)
+            continue;
+        if (errno == EIO && ul->tx[sent].nsegs > 1) {
+            ul->gso = false;
+            tx_segments(ul, &ul->tx[sent]);
+            sent++;
+            continue;
+        }
+        /*
+         * As for TAP devices, frames the host cannot accept are dropped.
+         */
+        break;
+    }
+    ul->txn = 0;
+    ul->txlen = 0;
+}
+
+#else /* !__linux__ */
+
+struct udp_link *udp_attach(const char *spec)
+{
+    (void)spec;
+    errno = ENOTSUP;
+    return NULL;
+}
+
+int udp_fd(struct udp_link *ul)
+{
+    (void)ul;
+    return -1;
+}
+
+ssize_t udp_read(struct udp_link *ul, void *buf, size_t size)
+{
+    (void)ul;
+    (void)buf;
+    (void)size;
+    errno = ENOTSUP;
+    return -1;
+}
+
+ssize_t udp_write(struct udp_link *ul, const void *buf, size_t size)
+{
+    (void)ul;
+    (void)buf;
+    (void)size;
+    errno = ENOTSUP;
+    return -1;
+}
+
+void udp_flush(struct udp_link *ul)
+{
+    (void)ul;
+}
+
+#endif /* __linux__ */
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * udp_attach.h: Common functions for attaching to an overlay network carrying
+ * Ethernet frames over UDP.
+ */
+
+#ifndef COMMON_UDP_ATTACH_H
+#define COMMON_UDP_ATTACH_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+struct udp_link;
+
+/*
+ * Default and largest MTU of networks attached over UDP. The underlay must
+ * carry datagrams of the MTU plus the Ethernet header, any VXLAN header and
+ * the UDP and IP headers, or fragment them.
+ */
+#define UDP_ATTACH_MTU 1500
+#define UDP_ATTACH_MTU_MAX 9000
+
+/*
+ * Returns true if (spec) is of the form "udp:LOCAL=REMOTE[,vni=VNI]" and
+ * should be attached using udp_attach().
+ */
+int udp_is_spec(const char *spec);
+
+/*
+ * Attach to the overlay network given in (spec): a UDP socket bound to
+ * LOCAL, sending to and only receiving from the host REMOTE. Addresses are
+ * given as ADDR:PORT, or [ADDR]:PORT for IPv6, and must be numeric. Frames
+ * are carried one per datagram, with a VXLAN header for VNI if given.
+ * Datagrams are received and sent in batches, with UDP GRO and GSO if
+ * supported by the host.
+ *
+ * Returns NULL and an appropriate errno on failure (ENOTSUP if not supported
+ * on this host, EINVAL if (spec) is malformed).
+ */
+struct udp_link *udp_attach(const char *spec);
+
+/*
+ * Returns the descriptor of (ul), which becomes readable when frames are
+ * pending, on the socket or received with an earlier batch, and can be used
+ * with poll() or equivalent.
+ */
+int udp_fd(struct udp_link *ul);
+
+/*
+ * Receives a single frame from (ul) into (buf), without blocking. Semantics
+ * are as for read() on a TAP device: returns the frame length, which is
+ * truncated to (size) if necessary, or -1 and EAGAIN if no frames are
+ * pending.
+ */
+ssize_t udp_read(struct udp_link *ul, void *buf, size_t size);
+
+/*
+ * Queues a single frame of (size) bytes from (buf) for sending on (ul),
+ * without blocking. Frames are only sent by udp_flush(), or once the queue
+ * is full. As for TAP devices, frames the host cannot accept are silently
+ * dropped. Returns (size), or -1 and an appropriate errno on failure.
+ */
+ssize_t udp_write(struct udp_link *ul, const void *buf, size_t size);
+
+/*
+ * Sends the frames queued by udp_write() since the last call.
+ */
+void udp_flush(struct udp_link *ul);
+
+#endif /* COMMON_UDP_ATTACH_H */
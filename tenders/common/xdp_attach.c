@@ -0,0 +1,436 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * xdp_attach.c: Common functions for attaching to AF_XDP sockets.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+
+#include <net/if.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/bpf.h>
+#include <linux/if_xdp.h>
+
+#endif
+
+#include "xdp_attach.h"
+
+int xdp_is_spec(const char *spec)
+{
+    return strncmp(spec, "xdp:", 4) == 0;
+}
+
+#if defined(__linux__)
+
+/*
+ * UMEM is split evenly between receive frames, which are owned by the fill
+ * and RX rings, and transmit frames, which are owned by the TX and completion
+ * rings or our free list. Each ring can therefore never overflow.
+ */
+#define XDP_NUM_FRAMES  4096
+#define XDP_FRAME_SIZE  2048
+#define XDP_RING_SIZE   (XDP_NUM_FRAMES / 2)
+
+struct xdp_ring {
+    uint32_t *producer;
+    uint32_t *consumer;
+    uint32_t *flags;
+    void *desc;
+};
+
+struct xdp_sock {
+    int fd;
+    uint8_t *umem;
+    struct xdp_ring rx, tx, fill, comp;
+    uint64_t tx_free[XDP_RING_SIZE];
+    unsigned tx_nfree;
+};
+
+/*
+ * XDP programs are attached per interface, so sockets attached to several
+ * queues of the same interface share a program and XSKMAP.
+ */
+#define XDP_MAX_QUEUES  64
+
+static struct {
+    unsigned ifindex;
+    int map_fd;
+} xdp_progs[XDP_MAX_QUEUES];
+static unsigned xdp_nprogs;
+
+static int sys_bpf(int cmd, union bpf_attr *attr)
+{
+    return syscall(__NR_bpf, cmd, attr, sizeof *attr);
+}
+
+/*
+ * Load and attach to (ifindex) a program equivalent to:
+ *
+ *     return bpf_redirect_map(&xsks_map, ctx->rx_queue_index, XDP_PASS);
+ *
+ * Returns the descriptor of (xsks_map), or -1 on failure. The program remains
+ * attached for the lifetime of the tender.
+ */
+static int xdp_prog_attach(unsigned ifindex)
+{
+    union bpf_attr attr;
+    int map_fd, prog_fd, link_fd;
+
+    memset(&attr, 0, sizeof attr);
+    attr.map_type = BPF_MAP_TYPE_XSKMAP;
+    attr.key_size = sizeof (uint32_t);
+    attr.value_size = sizeof (int);
+    attr.max_entries = XDP_MAX_QUEUES;
+    map_fd = sys_bpf(BPF_MAP_CREATE, &attr);
+    if (map_fd == -1)
+        return -1;
+
+    struct bpf_insn insns[] = {
+        { .code = BPF_LDX | BPF_MEM | BPF_W, .dst_reg = BPF_REG_2,
+          .src_reg = BPF_REG_1,
+          .off = offsetof(struct xdp_md, rx_queue_index) },
+        { .code = BPF_LD | BPF_DW | BPF_IMM, .dst_reg = BPF_REG_1,
+          .src_reg = BPF_PSEUDO_MAP_FD, .imm = map_fd },
+        { 0 },
+        { .code = BPF_ALU64 | BPF_MOV | BPF_K, .dst_reg = BPF_REG_3,
+          .imm = XDP_PASS },
+        { .code = BPF_JMP | BPF_CALL, .imm = BPF_FUNC_redirect_map },
+        { .code = BPF_JMP | BPF_EXIT }
+    };
+    static const char license[] = "ISC";
+
+    memset(&attr, 0, sizeof attr);
+    attr.prog_type = BPF_PROG_TYPE_XDP;
+    attr.insn_cnt = sizeof insns / sizeof insns[0];
+    attr.insns = (uint64_t)(uintptr_t)insns;
+    attr.license = (uint64_t)(uintptr_t)license;
+    prog_fd = sys_bpf(BPF_PROG_LOAD, &attr);
+    if (prog_fd == -1)
+        goto err_map;
+
+    memset(&attr, 0, sizeof attr);
+    attr.link_create.prog_fd = prog_fd;
+    attr.link_create.target_ifindex = ifindex;
+    attr.link_create.attach_type = BPF_XDP;
+    link_fd = sys_bpf(BPF_LINK_CREATE, &attr);
+    close(prog_fd);
+    if (link_fd == -1)
+        goto err_map;
+
+    return map_fd;
+
+err_map:
+    close(map_fd);
+    return -1;
+}
+
+static int xdp_map_add(unsigned ifindex, unsigned queue, int fd)
+{
+    int map_fd = -1;
+
+    if (queue >= XDP_MAX_QUEUES) {
+        errno = ERANGE;
+        return -1;
+    }
+    for (unsigned i = 0; i != xdp_nprogs; i++) {
+        if (xdp_progs[i].ifindex == ifindex)
+            map_fd = xdp_progs[i].map_fd;
+    }
+    if (map_fd == -1) {
+        if (xdp_nprogs == XDP_MAX_QUEUES) {
+            errno = ENOSPC;
+            return -1;
+        }
+        map_fd = xdp_prog_attach(ifindex);
+        if (map_fd == -1)
+            return -1;
+        xdp_progs[xdp_nprogs].ifindex = ifindex;
+        xdp_progs[xdp_nprogs].map_fd = map_fd;
+        xdp_nprogs++;
+    }
+
+    union bpf_attr attr;
+    uint32_t key = queue;
+
+    memset(&attr, 0, sizeof attr);
+    attr.map_fd = map_fd;
+    attr.key = (uint64_t)(uintptr_t)&key;
+    attr.value = (uint64_t)(uintptr_t)&fd;
+    attr.flags = BPF_ANY;
+    return sys_bpf(BPF_MAP_UPDATE_ELEM, &attr);
+}
+
+static int ring_map(int fd, struct xdp_ring *r,
+        const struct xdp_ring_offset *off, size_t desc_size, off_t pgoff)
+{
+    uint8_t *p = mmap(NULL, off->desc + (XDP_RING_SIZE * desc_size),
+            PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, pgoff);
+    if (p == MAP_FAILED)
+        return -1;
+
+    r->producer = (uint32_t *)(p + off->producer);
+    r->consumer = (uint32_t *)(p + off->consumer);
+    r->flags = (uint32_t *)(p + off->flags);
+    r->desc = p + off->desc;
+    return 0;
+}
+
+static int parse_spec(const char *spec, char *ifname, unsigned *queue)
+{
+    const char *p = spec + 4, *sep = strchr(p, ':');
+    size_t len = sep ? (size_t)(sep - p) : strlen(p);
+
+    if (len == 0 || len >= IFNAMSIZ)
+        return -1;
+    memcpy(ifname, p, len);
+    ifname[len] = '\0';
+
+    *queue = 0;
+    if (sep == NULL)
+        return 0;
+    p = sep + 1;
+    if (strncmp(p, "queue", 5) == 0)
+        p += 5;
+
+    char *endp;
+    unsigned long q = strtoul(p, &endp, 10);
+    if (*p == '\0' || *endp != '\0' || q >= XDP_MAX_QUEUES)
+        return -1;
+    *queue = (unsigned)q;
+    return 0;
+}
+
+struct xdp_sock *xdp_attach(const char *spec)
+{
+    char ifname[IFNAMSIZ];
+    unsigned queue, ifindex;
+    int err;
+
+    if (parse_spec(spec, ifname, &queue) == -1) {
+        errno = EINVAL;
+        return NULL;
+    }
+    ifindex = if_nametoindex(ifname);
+    if (ifindex == 0)
+        return NULL;
+
+    struct xdp_sock *xs = calloc(1, sizeof *xs);
+    if (xs == NULL)
+        return NULL;
+    xs->fd = socket(AF_XDP, SOCK_RAW | SOCK_CLOEXEC, 0);
+    if (xs->fd == -1)
+        goto err_free;
+
+    xs->umem = mmap(NULL, XDP_NUM_FRAMES * XDP_FRAME_SIZE,
+            PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (xs->umem == MAP_FAILED)
+        goto err_close;
+
+    struct xdp_umem_reg mr = {
+        .addr = (uint64_t)(uintptr_t)xs->umem,
+        .len = XDP_NUM_FRAMES * XDP_FRAME_SIZE,
+        .chunk_size = XDP_FRAME_SIZE,
+        .headroom = 0
+    };
+    if (setsockopt(xs->fd, SOL_XDP, XDP_UMEM_REG, &mr, sizeof mr) == -1)
+        goto err_close;
+
+    int ring_size = XDP_RING_SIZE;
+    if (setsockopt(xs->fd, SOL_XDP, XDP_UMEM_FILL_RING, &ring_size,
+                sizeof ring_size) == -1 ||
+        setsockopt(xs->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &ring_size,
+                sizeof ring_size) == -1 ||
+        setsockopt(xs->fd, SOL_XDP, XDP_RX_RING, &ring_size,
+                sizeof ring_size) == -1 ||
+        setsockopt(xs->fd, SOL_XDP, XDP_TX_RING, &ring_size,
+                sizeof ring_size) == -1)
+        goto err_close;
+
+    struct xdp_mmap_offsets off;
+    socklen_t optlen = sizeof off;
+    if (getsockopt(xs->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) == -1)
+        goto err_close;
+    if (ring_map(xs->fd, &xs->rx, &off.rx, sizeof (struct xdp_desc),
+                XDP_PGOFF_RX_RING) == -1 ||
+        ring_map(xs->fd, &xs->tx, &off.tx, sizeof (struct xdp_desc),
+                XDP_PGOFF_TX_RING) == -1 ||
+        ring_map(xs->fd, &xs->fill, &off.fr, sizeof (uint64_t),
+                XDP_UMEM_PGOFF_FILL_RING) == -1 ||
+        ring_map(xs->fd, &xs->comp, &off.cr, sizeof (uint64_t),
+                XDP_UMEM_PGOFF_COMPLETION_RING) == -1)
+        goto err_close;
+
+    uint64_t *fill = xs->fill.desc;
+    for (unsigned i = 0; i != XDP_RING_SIZE; i++)
+        fill[i] = (uint64_t)i * XDP_FRAME_SIZE;
+    __atomic_store_n(xs->fill.producer, XDP_RING_SIZE, __ATOMIC_RELEASE);
+    for (unsigned i = 0; i != XDP_RING_SIZE; i++)
+        xs->tx_free[i] = (uint64_t)(XDP_RING_SIZE + i) * XDP_FRAME_SIZE;
+    xs->tx_nfree = XDP_RING_SIZE;
+
+    struct sockaddr_xdp sxdp = {
+        .sxdp_family = AF_XDP,
+        .sxdp_ifindex = ifindex,
+        .sxdp_queue_id = queue,
+        .sxdp_flags = XDP_USE_NEED_WAKEUP
+    };
+    if (bind(xs->fd, (struct sockaddr *)&sxdp, sizeof sxdp) == -1)
+        goto err_close;
+    if (xdp_map_add(ifindex, queue, xs->fd) == -1)
+        goto err_close;
+
+    return xs;
+
+    /*
+     * Ring and UMEM mappings are not unmapped on failure; the tender will
+     * exit shortly anyway.
+     */
+err_close:
+    err = errno;
+    close(xs->fd);
+    errno = err;
+err_free:
+    err = errno;
+    free(xs);
+    errno = err;
+    return NULL;
+}
+
+int xdp_fd(struct xdp_sock *xs)
+{
+    return xs->fd;
+}
+
+ssize_t xdp_read(struct xdp_sock *xs, void *buf, size_t size)
+{
+    uint32_t cons = *xs->rx.consumer;
+
+    if (__atomic_load_n(xs->rx.producer, __ATOMIC_ACQUIRE) == cons) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    struct xdp_desc *d =
+        &((struct xdp_desc *)xs->rx.desc)[cons & (XDP_RING_SIZE - 1)];
+    uint64_t addr = d->addr;
+    size_t len = (d->len < size) ? d->len : size;
+
+    memcpy(buf, xs->umem + addr, len);
+    __atomic_store_n(xs->rx.consumer, cons + 1, __ATOMIC_RELEASE);
+
+    /*
+     * Hand the frame straight back to the kernel.
+     */
+    uint32_t prod = *xs->fill.producer;
+    ((uint64_t *)xs->fill.desc)[prod & (XDP_RING_SIZE - 1)] =
+        addr & ~(uint64_t)(XDP_FRAME_SIZE - 1);
+    __atomic_store_n(xs->fill.producer, prod + 1, __ATOMIC_RELEASE);
+    if (__atomic_load_n(xs->fill.flags, __ATOMIC_RELAXED) &
+            XDP_RING_NEED_WAKEUP)
+        (void)recvfrom(xs->fd, NULL, 0, MSG_DONTWAIT, NULL, NULL);
+
+    return len;
+}
+
+ssize_t xdp_write(struct xdp_sock *xs, const void *buf, size_t size)
+{
+    if (size > XDP_FRAME_SIZE) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    /*
+     * Reclaim completed transmit frames.
+     */
+    uint32_t cons = *xs->comp.consumer;
+    uint32_t prod = __atomic_load_n(xs->comp.producer, __ATOMIC_ACQUIRE);
+    for (; cons != prod; cons++)
+        xs->tx_free[xs->tx_nfree++] =
+            ((uint64_t *)xs->comp.desc)[cons & (XDP_RING_SIZE - 1)];
+    __atomic_store_n(xs->comp.consumer, cons, __ATOMIC_RELEASE);
+
+    if (xs->tx_nfree > 0) {
+        uint64_t addr = xs->tx_free[--xs->tx_nfree];
+
+        memcpy(xs->umem + addr, buf, size);
+        prod = *xs->tx.producer;
+        struct xdp_desc *d =
+            &((struct xdp_desc *)xs->tx.desc)[prod & (XDP_RING_SIZE - 1)];
+        d->addr = addr;
+        d->len = size;
+        d->options = 0;
+        __atomic_store_n(xs->tx.producer, prod + 1, __ATOMIC_RELEASE);
+    }
+    /*
+     * Otherwise, the packet is dropped, but we still kick the kernel so that
+     * the transmit ring gets drained.
+     */
+    if (__atomic_load_n(xs->tx.flags, __ATOMIC_RELAXED) & XDP_RING_NEED_WAKEUP)
+        (void)sendto(xs->fd, NULL, 0, MSG_DONTWAIT, NULL, 0);
+
+    return size;
+}
+
+#else /* !__linux__ */
+
+struct xdp_sock *xdp_attach(const char *spec)
+{
+    (void)spec;
+    errno = ENOTSUP;
+    return NULL;
+}
+
+int xdp_fd(struct xdp_sock *xs)
+{
+    (void)xs;
+    return -1;
+}
+
+ssize_t xdp_read(struct xdp_sock *xs, void *buf, size_t size)
+{
+    (void)xs;
+    (void)buf;
+    (void)size;
+    errno = ENOTSUP;
+    return -1;
+}
+
+ssize_t xdp_write(struct xdp_sock *xs, const void *buf, size_t size)
+{
+    (void)xs;
+    (void)buf;
+    (void)size;
+    errno = ENOTSUP;
+    return -1;
+}
+
+#endif /* __linux__ */
@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * xdp_attach.h: Common functions for attaching to AF_XDP sockets.
+ */
+
+#ifndef COMMON_XDP_ATTACH_H
+#define COMMON_XDP_ATTACH_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+struct xdp_sock;
+
+/*
+ * MTU of networks attached using AF_XDP. Packets must fit in a single 2kB
+ * UMEM frame, including the headroom reserved by the kernel.
+ */
+#define XDP_ATTACH_MTU 1500
+
+/*
+ * Returns true if (spec) is of the form "xdp:IFACE[:QUEUE]" and should be
+ * attached using xdp_attach().
+ */
+int xdp_is_spec(const char *spec);
+
+/*
+ * Attach an AF_XDP socket to the network interface and queue described by
+ * (spec), loading a minimal XDP program redirecting all traffic received on
+ * that queue to the socket. QUEUE may be given as either "N" or "queueN",
+ * and defaults to 0.
+ *
+ * Returns NULL and an appropriate errno on failure (ENOTSUP if AF_XDP is not
+ * supported on this host).
+ */
+struct xdp_sock *xdp_attach(const char *spec);
+
+/*
+ * Returns the descriptor of (xs), which becomes readable when packets are
+ * pending and can be used with poll() or equivalent.
+ */
+int xdp_fd(struct xdp_sock *xs);
+
+/*
+ * Receives a single packet from (xs) into (buf), without blocking. Semantics
+ * are as for read() on a TAP device: returns the packet length, which is
+ * truncated to (size) if necessary, or -1 and EAGAIN if no packets are
+ * pending.
+ */
+ssize_t xdp_read(struct xdp_sock *xs, void *buf, size_t size);
+
+/*
+ * Sends a single packet of (size) bytes from (buf) on (xs), without blocking.
+ * As for TAP devices, if no transmit buffers are available the packet is
+ * silently dropped. Returns (size), or -1 and an appropriate errno on failure.
+ */
+ssize_t xdp_write(struct xdp_sock *xs, const void *buf, size_t size);
+
+#endif /* COMMON_XDP_ATTACH_H */
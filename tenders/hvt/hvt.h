@@ -31,9 +31,20 @@
 #include <inttypes.h>
 #include <err.h>
 
+#include "../common/affinity.h"
+#include "../common/boot_trace.h"
+#include "../common/cgroup.h"
 #include "../common/cc.h"
+#include "../common/console_out.h"
 #include "../common/elf.h"
+#include "../common/handoff.h"
+#include "../common/mem.h"
+#include "../common/metrics.h"
 #include "../common/mft.h"
+#include "../common/perf_map.h"
+#include "../common/resctrl.h"
+#include "../common/rt.h"
+#include "../common/sdt.h"
 #define HVT_HOST
 #include "hvt_abi.h"
 #include "hvt_gdb.h"
@@ -57,9 +68,29 @@ struct hvt {
     size_t mem_size;
     uint64_t cpu_cycle_freq;
     hvt_gpa_t cpu_boot_info_base;
+    uint64_t features;                  /* HVT_FEATURE_* for the guest */
+    unsigned cpus;                      /* Number of VCPUs */
+    struct hvt_core *core;              /* Defined in hvt_core.c */
+    uint64_t *dirty;                    /* See hvt_dirty_track_enable() */
+    int mem_fd;                         /* Backing guest memory, or -1 */
+    const char *file;                   /* Unikernel binary, if loaded */
+    bool mem_pinned;                    /* Guest memory pinned for DMA */
+    bool pmu;                           /* Give the guest a PMU (--pmu) */
+    unsigned sve;                       /* Max. SVE vector length in bits
+                                           (--sve), 0 if not enabled */
+    bool reuse;                         /* Guest is run again (--reuse) */
+    bool irqchip;                       /* In-kernel irqchip (--irqchip) */
+    hvt_gpa_t block_buffers;            /* Guest's table of registered block
+                                           buffers, or 0 */
     struct hvt_b *b;
 };
 
+/*
+ * Called by hvt_checked_gpa_p() while tracking pages accessed by the tender,
+ * see hvt_dirty_track_enable().
+ */
+void hvt_dirty_track_mark(struct hvt *hvt, hvt_gpa_t gpa, size_t sz);
+
 /*
  * Check that (gpa) and (gpa + sz) are within guest memory. Returns a host-side
  * pointer to (gpa) if successful, aborts if not.
@@ -78,15 +109,36 @@ inline void *hvt_checked_gpa_p(struct hvt *hvt, hvt_gpa_t gpa, size_t sz,
                 file, line, gpa, sz);
     }
     else {
+        if (__atomic_load_n(&hvt->dirty, __ATOMIC_RELAXED) != NULL)
+            hvt_dirty_track_mark(hvt, gpa, sz);
         return (void *)(hvt->mem + gpa);
     }
 }
 
 /*
- * Initialise hypervisor, with (mem_size) bytes of guest memory.
- * (hvt->mem) and (hvt->mem_size) are valid after this function has been called.
+ * Options for hvt_init().
+ */
+/* The VCPU has a host CPU to itself (--dedicated-core) */
+#define HVT_INIT_DEDICATED_CORE (1U << 0)
+/* Create an in-kernel irqchip for the guest to halt with (--irqchip) */
+#define HVT_INIT_IRQCHIP        (1U << 1)
+
+/*
+ * Initialise hypervisor, with (mem_size) bytes of guest memory and (cpus)
+ * VCPUs. (hvt->mem), (hvt->mem_size) and (hvt->cpus) are valid after this
+ * function has been called. Backends which do not support more than one VCPU
+ * abort if (cpus) is greater than 1. (mem_flags) are the MEM_* guest memory
+ * options from mem.h, and (init_flags) the HVT_INIT_* options above; backends
+ * abort if given an option they do not support. May be called on any thread.
+ */
+struct hvt *hvt_init(size_t mem_size, unsigned cpus, unsigned mem_flags,
+        unsigned init_flags);
+
+/*
+ * Initialise the per-VM state of the core, with which modules register their
+ * hypercalls and hooks. Must be called after hvt_init().
  */
-struct hvt *hvt_init(size_t mem_size);
+void hvt_core_init(struct hvt *hvt);
 
 /*
  * Computes the memory size to use for this tender, based on the user-provided
@@ -95,7 +147,9 @@ struct hvt *hvt_init(size_t mem_size);
 void hvt_mem_size(size_t *mem_size);
 
 /*
- * Initialise VCPU state with (gpa_ep) as the entry point.
+ * Initialise VCPU state with (gpa_ep) as the entry point. Must be called on
+ * the thread which will run the boot VCPU. Secondary VCPUs, if any, are
+ * started by the guest with HVT_HYPERCALL_CPU_START.
  */
 void hvt_vcpu_init(struct hvt *hvt, hvt_gpa_t gpa_ep);
 
@@ -118,11 +172,149 @@ void hvt_drop_privileges();
 #endif
 
 /*
- * Run the VCPU. Returns on normal guest exit. Returns the exit status passed
- * from the unikernel on the final exit.
+ * Run the boot VCPU. Returns on normal guest exit. Returns the exit status
+ * passed from the unikernel on the final exit. Secondary VCPUs run on threads
+ * of their own, and exit the tender if the guest halts on them.
  */
 int hvt_vcpu_loop(struct hvt *hvt);
 
+/*
+ * Save the state of the boot VCPU to (fd) at its current offset, or restore it
+ * from (fd) at its current offset after hvt_vcpu_init(). Saving is only done
+ * on the boot VCPU's thread, by a hypercall handler or a function passed to
+ * hvt_core_interrupt(). Returns 0 on success, or -1 on error or if not
+ * supported by the backend.
+ */
+int hvt_vcpu_save(struct hvt *hvt, int fd);
+int hvt_vcpu_restore(struct hvt *hvt, int fd);
+
+/*
+ * Make the boot VCPU stop running the guest as soon as possible, and return
+ * from it with EINTR, after which hvt_vcpu_loop() calls
+ * hvt_core_interrupted(). May be called from any thread. Returns 0 on
+ * success, or -1 if not supported by the backend.
+ */
+int hvt_vcpu_interrupt(struct hvt *hvt);
+
+/*
+ * Read the program counter and frame pointer of the boot VCPU into (pc) and
+ * (fp), on its own thread while it is not running the guest, such as from a
+ * function passed to hvt_core_interrupt(). Returns 0 on success, or -1 if not
+ * supported by the backend.
+ */
+int hvt_vcpu_get_frame(struct hvt *hvt, uint64_t *pc, uint64_t *fp);
+
+/*
+ * Snapshots (hvt_snapshot.c). hvt_snapshot_init() must always be called after
+ * module setup, with (file) set to the file to save a snapshot to when the
+ * guest signals that it has initialised, or NULL. hvt_snapshot_restore()
+ * restores guest memory and VCPU state from the snapshot (file) instead of
+ * loading the unikernel and initialising its boot information, reading ahead
+ * the working set recorded in (prefetch_file) if not NULL, or recording it
+ * there on exit.
+ */
+void hvt_snapshot_init(struct hvt *hvt, const char *file, struct mft *mft,
+        size_t mft_size);
+void hvt_snapshot_restore(struct hvt *hvt, const char *file,
+        const char *prefetch_file, struct mft *mft, size_t mft_size);
+
+/*
+ * Returns true if the unikernel described by (mft) is the same as that
+ * described by (saved), with the same devices attached, with the same
+ * properties as far as the guest is concerned.
+ */
+bool hvt_snapshot_mft_matches(struct mft *mft, struct mft *saved);
+
+/*
+ * Live migration (hvt_migrate.c). hvt_migrate_init() must be called after
+ * module setup, with (addr) set to the address to migrate the guest to when
+ * the tender receives SIGUSR1, or NULL. hvt_migrate_incoming() waits for a
+ * guest to be migrated to (addr), and restores its memory and VCPU state
+ * instead of loading the unikernel and initialising its boot information.
+ */
+void hvt_migrate_init(struct hvt *hvt, const char *addr, struct mft *mft,
+        size_t mft_size);
+void hvt_migrate_incoming(struct hvt *hvt, const char *addr, struct mft *mft,
+        size_t mft_size);
+
+/*
+ * Running the guest again once it halts (hvt_reuse.c, --reuse=N).
+ * hvt_reuse_init() must be called once guest memory and boot information have
+ * been initialised, just before the guest is first run, and keeps a copy of
+ * the memory written so far. hvt_reuse_reset() returns guest memory, the core
+ * and modules, and the boot VCPU to that state, after the guest has halted.
+ */
+void hvt_reuse_init(struct hvt *hvt, hvt_gpa_t gpa_kend);
+void hvt_reuse_reset(struct hvt *hvt, hvt_gpa_t gpa_ep);
+
+/*
+ * Recording and replaying the input of the guest (hvt_replay.c, --record and
+ * --replay). hvt_replay_init() must be called after module setup, and before
+ * boot information is initialised. Does nothing if both (record_file) and
+ * (replay_file) are NULL.
+ */
+void hvt_replay_init(struct hvt *hvt, const char *record_file,
+        const char *replay_file, struct mft *mft);
+
+/*
+ * Have guest calls to hypercall (nr) signal the eventfd (fd) in the host
+ * kernel, without exiting to the tender. If (datamatch) is set, only calls
+ * passing (data) are matched. Returns 0 on success, -1 if the backend cannot
+ * do so, in which case calls to (nr) exit to the tender as usual.
+ */
+int hvt_ioeventfd(struct hvt *hvt, int nr, int fd, bool datamatch,
+        uint32_t data);
+
+/*
+ * Have signalling the eventfd (fd) raise HVT_IRQCHIP_VECTOR on the boot VCPU
+ * in the host kernel. Only called if (hvt->irqchip) is set. Returns 0 on
+ * success, -1 if the backend cannot do so.
+ */
+int hvt_irqfd(struct hvt *hvt, int fd);
+
+/*
+ * Start logging writes made by the guest to guest memory. Writes made by the
+ * tender itself, such as by hypercall handlers, are not logged, see
+ * hvt_dirty_track_enable(). Returns 0 on success, -1 if the backend cannot
+ * do so.
+ */
+int hvt_dirty_log_enable(struct hvt *hvt);
+
+/*
+ * Fetch the pages of guest memory written by the guest since logging was
+ * enabled or the log was last fetched into (bitmap), with one bit per host
+ * page (HVT_DIRTY_LOG_WORDS() words), and clear the log. Returns 0 on
+ * success, -1 on error.
+ */
+#define HVT_DIRTY_LOG_WORDS(npages) (((npages) + 63) / 64)
+int hvt_dirty_log_get(struct hvt *hvt, uint64_t *bitmap);
+
+/*
+ * Returns the index of the first bit set in (bitmap) of (nbits) bits at or
+ * after (bit), or (nbits) if there is none. If (set) is false, returns the
+ * first bit clear instead, for finding the end of a run of set bits.
+ */
+size_t hvt_dirty_log_next(const uint64_t *bitmap, size_t nbits, size_t bit,
+        bool set);
+
+/*
+ * Start tracking the pages of guest memory accessed by the tender through
+ * HVT_CHECKED_GPA_P(), which is how hypercall handlers read and write guest
+ * memory on behalf of the guest. hvt_dirty_track_get() sets the bits of the
+ * pages accessed since tracking was started in (bitmap), without clearing
+ * them, as the tender may still be writing to them. Pages written through
+ * pointers kept across hypercalls, such as those to shared pages, are not
+ * tracked.
+ */
+void hvt_dirty_track_enable(struct hvt *hvt);
+void hvt_dirty_track_get(struct hvt *hvt, uint64_t *bitmap);
+
+/*
+ * Forget the pages accessed by the tender so far. Only safe once nothing is
+ * accessing guest memory on behalf of the guest, see hvt_core_reset().
+ */
+void hvt_dirty_track_clear(struct hvt *hvt);
+
 /*
  * Register the file descriptor (fd) for use with HVT_HYPERCALL_POLL.
  * (waitset_data) must be set to the solo5_handle_t associated with (fd).
@@ -130,34 +322,231 @@ int hvt_vcpu_loop(struct hvt *hvt);
 int hvt_core_register_pollfd(int fd, uintptr_t waitset_data);
 
 /*
- * Register (fn) as the handler for hypercall (nr).
+ * As hvt_core_register_pollfd(), but (fd) is edge-triggered: it will only be
+ * reported as ready by HVT_HYPERCALL_POLL once for each time new data
+ * becomes available on it.
+ */
+int hvt_core_register_pollfd_edge(int fd, uintptr_t waitset_data);
+
+/*
+ * Must be called by modules after consuming the readiness of a pollfd
+ * registered with hvt_core_register_pollfd() for (waitset_data), i.e. reading
+ * from it until it would block, or as far as the guest asked to. If the guest
+ * uses the shared readiness page, the pollfd is not watched again until then.
+ */
+void hvt_core_pollfd_consumed(uintptr_t waitset_data);
+
+#if defined(__linux__)
+/*
+ * Stop reporting the pollfd registered with hvt_core_register_pollfd() for
+ * (waitset_data) as ready, through HVT_HYPERCALL_POLL or the shared readiness
+ * page, until hvt_core_pollfd_resume() is called. Used by modules to delay
+ * the guest's view of readiness, e.g. when rate limiting; the module must
+ * arrange for the guest to be woken once it may proceed.
+ */
+void hvt_core_pollfd_pause(uintptr_t waitset_data);
+void hvt_core_pollfd_resume(uintptr_t waitset_data);
+
+/*
+ * Watch the pollfd registered with hvt_core_register_pollfd() for
+ * (waitset_data) for writability, until HVT_HYPERCALL_POLL next reports it
+ * as writable to the guest. Used by modules after a write by the guest would
+ * have blocked.
+ */
+void hvt_core_pollfd_want_write(uintptr_t waitset_data);
+#endif
+
+/*
+ * Register (fn) as the handler for hypercall (nr). If the guest has more than
+ * one VCPU, (fn) is called with the core lock held, so that handlers need not
+ * be reentrant.
  */
 typedef void (*hvt_hypercall_fn_t)(struct hvt *hvt, hvt_gpa_t gpa);
-int hvt_core_register_hypercall(int nr, hvt_hypercall_fn_t fn);
+int hvt_core_register_hypercall(struct hvt *hvt, int nr,
+        hvt_hypercall_fn_t fn);
+
+/*
+ * As hvt_core_register_hypercall(), but (fn) is safe to call concurrently from
+ * several VCPUs, and is called without the core lock held.
+ */
+int hvt_core_register_hypercall_mt(struct hvt *hvt, int nr,
+        hvt_hypercall_fn_t fn);
+
+/*
+ * Replace the handler registered for hypercall (nr) with (fn), returning the
+ * previous handler for (fn) to call, or NULL if there was none, in which case
+ * nothing is replaced. Used to observe or stand in for other modules.
+ */
+hvt_hypercall_fn_t hvt_core_interpose_hypercall(struct hvt *hvt, int nr,
+        hvt_hypercall_fn_t fn);
+
+/*
+ * Register hypercall (nr) as a doorbell, which only signals (fd), ignoring
+ * its argument. (fd) must be an eventfd, or the write end of a pipe, and
+ * readers must drain it in 8-byte units. Where possible, the backend signals
+ * (fd) directly, otherwise hvt_core_hypercall() does.
+ */
+int hvt_core_register_doorbell(struct hvt *hvt, int nr, int fd);
 
 /*
  * Register (fn) as a hook for HVT_HYPERCALL_HALT.
  */
 typedef void (*hvt_halt_fn_t)(struct hvt *hvt, int status, void *cookie);
-int hvt_core_register_halt_hook(hvt_halt_fn_t fn);
+int hvt_core_register_halt_hook(struct hvt *hvt, hvt_halt_fn_t fn);
 
 /*
- * Dispatch array of [HVT_HYPERCALL_MAX] hypercalls. NULL = no handler.
+ * Handle HVT_HYPERCALL_HALT, running the halt hooks. Returns the exit status
+ * passed by the guest.
  */
-extern hvt_hypercall_fn_t hvt_core_hypercalls[];
 int hvt_core_hypercall_halt(struct hvt *hvt, hvt_gpa_t gpa);
 
+/*
+ * Dispatch hypercall (nr) other than HVT_HYPERCALL_HALT to its handler, taking
+ * the core lock if required, or signal its doorbell. Aborts if there is no
+ * handler for (nr).
+ */
+void hvt_core_hypercall(struct hvt *hvt, int nr, hvt_gpa_t gpa);
+
+/*
+ * Returns the name of hypercall (nr), e.g. "BLOCK_WRITE", or NULL if (nr) is
+ * not a known hypercall.
+ */
+const char *hvt_core_hypercall_name(int nr);
+
+/*
+ * Returns the report made by the guest with HVT_HYPERCALL_BOOT_REPORT on
+ * reaching solo5_app_main(), or NULL if it has not made one.
+ */
+const struct hvt_hc_boot_report *hvt_core_boot_report(struct hvt *hvt);
+
+/*
+ * Register (fn) to be called after each hypercall dispatched by
+ * hvt_core_hypercall(), with the time taken to handle it in (nsecs). Hooks are
+ * called in the order registered. (fn) may be called concurrently from
+ * several VCPUs.
+ */
+typedef void (*hvt_hypercall_hook_fn_t)(struct hvt *hvt, int nr,
+        hvt_gpa_t gpa, uint64_t nsecs);
+int hvt_core_register_hypercall_hook(struct hvt *hvt,
+        hvt_hypercall_hook_fn_t fn);
+
+/*
+ * Register (fn) to be called by hvt_core_exit(). Only one hook may be
+ * registered. (fn) may be called concurrently from several VCPUs.
+ */
+typedef void (*hvt_exit_hook_fn_t)(struct hvt *hvt, unsigned reason);
+int hvt_core_register_exit_hook(struct hvt *hvt, hvt_exit_hook_fn_t fn);
+
+/*
+ * Called by backends for each VCPU exit which is not a hypercall, and which
+ * does not terminate the tender, with a backend-specific exit (reason).
+ */
+void hvt_core_exit(struct hvt *hvt, unsigned reason);
+
+/*
+ * Have the boot VCPU call (fn) on its own thread once it has stopped running
+ * the guest, between hypercalls, so that the guest and VCPU state are
+ * consistent. The guest carries on running when (fn) returns. May be called
+ * from any thread, and returns once (fn) has been called or is about to be;
+ * concurrent callers are serialised.
+ * A pending HVT_HYPERCALL_POLL returns early, with no events. Returns 0 on
+ * success, or -1 if not supported by the backend.
+ */
+typedef void (*hvt_interrupt_fn_t)(struct hvt *hvt);
+int hvt_core_interrupt(struct hvt *hvt, hvt_interrupt_fn_t fn);
+
+/*
+ * As hvt_core_interrupt(), but if the boot VCPU is blocked in
+ * HVT_HYPERCALL_POLL, (fn) is called from there, after which the hypercall
+ * carries on waiting until its deadline. (fn) must then not depend on the
+ * guest being between hypercalls, and may only read the VCPU state.
+ */
+int hvt_core_interrupt_poll(struct hvt *hvt, hvt_interrupt_fn_t fn);
+
+/*
+ * Called by backends on the boot VCPU's thread after it returned from
+ * running the guest with EINTR, to call the function passed to
+ * hvt_core_interrupt(), if any.
+ */
+void hvt_core_interrupted(struct hvt *hvt);
+
+/*
+ * Register (fn) to be called by hvt_core_busy(). (fn) must return true while
+ * the module has requests in flight on behalf of the guest, such as
+ * asynchronous I/O which has been submitted but not yet reaped.
+ */
+typedef bool (*hvt_busy_fn_t)(struct hvt *hvt);
+int hvt_core_register_busy_hook(struct hvt *hvt, hvt_busy_fn_t fn);
+
+/*
+ * Returns true if any module has requests in flight on behalf of the guest,
+ * in which case its state cannot be transferred elsewhere.
+ */
+bool hvt_core_busy(struct hvt *hvt);
+
+/*
+ * State of the core on behalf of the guest which must be carried over when
+ * the guest is migrated: the guest physical addresses of the shared pages it
+ * has registered, or 0 if none, and the value of its cycle counter.
+ */
+struct hvt_core_state {
+    hvt_gpa_t time_page;
+    hvt_gpa_t poll_page;
+    uint64_t cycles;
+    hvt_gpa_t block_buffers;
+};
+
+/*
+ * Save the core state to (s), on the boot VCPU's thread just after saving
+ * its state. Restore it from (s) just after restoring the VCPU state, which
+ * starts updating the shared pages again and runs the restore hooks.
+ */
+void hvt_core_save(struct hvt *hvt, struct hvt_core_state *s);
+void hvt_core_restore(struct hvt *hvt, const struct hvt_core_state *s);
+
+/*
+ * Register (fn) to be called by hvt_core_restore(), once the guest has been
+ * migrated to this tender, to refresh any state which the module derived
+ * from its devices when attaching them, and which the tender the guest was
+ * migrated from may have changed since.
+ */
+typedef void (*hvt_restore_fn_t)(struct hvt *hvt);
+int hvt_core_register_restore_hook(struct hvt *hvt, hvt_restore_fn_t fn);
+
+/*
+ * Stop using any guest memory the guest has registered with the core, such
+ * as shared pages, and run the reset hooks, so that the guest can be run
+ * again from the start (--reuse). Called on the boot VCPU's thread once the
+ * guest has halted. Register (fn) as a reset hook, to wait for any requests
+ * the module has in flight on behalf of the guest, and drop any state it
+ * keeps for it.
+ */
+void hvt_core_reset(struct hvt *hvt);
+typedef void (*hvt_reset_fn_t)(struct hvt *hvt);
+int hvt_core_register_reset_hook(struct hvt *hvt, hvt_reset_fn_t fn);
+
+/*
+ * Register (fn) to be called when the guest yields with a non-zero timeout,
+ * on entry to HVT_HYPERCALL_POLL, to complete work the module has deferred
+ * before the VCPU may block. (fn) may be called concurrently from several
+ * VCPUs. Never called with an in-kernel irqchip, where the guest halts
+ * instead.
+ */
+typedef void (*hvt_idle_fn_t)(struct hvt *hvt);
+int hvt_core_register_idle_hook(struct hvt *hvt, hvt_idle_fn_t fn);
+
 /*
  * Register a custom vmexit handler (fn). (fn) must return 0 if the vmexit was
  * handled, -1 if not.
  */
 typedef int (*hvt_vmexit_fn_t)(struct hvt *hvt);
-int hvt_core_register_vmexit(hvt_vmexit_fn_t fn);
+int hvt_core_register_vmexit(struct hvt *hvt, hvt_vmexit_fn_t fn);
 
 /*
- * Dispatch array of module-registered vmexit handlers. NULL terminated.
+ * Offer the current vmexit to the module-registered vmexit handlers. Returns
+ * 0 if one of them handled it, -1 if not.
  */
-extern hvt_vmexit_fn_t hvt_core_vmexits[];
+int hvt_core_vmexit(struct hvt *hvt);
 
 /*
  * Operations provided by a module. (setup) is required, all other functions
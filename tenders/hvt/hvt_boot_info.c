@@ -65,6 +65,8 @@ void hvt_boot_info_init(struct hvt *hvt, hvt_gpa_t gpa_kend, int cmdline_argc,
     bi->mem_size = hvt->mem_size;
     bi->kernel_end = gpa_kend;
     bi->cpu_cycle_freq = hvt->cpu_cycle_freq;
+    bi->features = hvt->features;
+    bi->cpus = hvt->cpus;
     /*
      * Followed by mft_size bytes for manifest.
      *
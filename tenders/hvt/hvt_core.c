@@ -29,7 +29,9 @@
 #include <assert.h>
 #include <err.h>
 #include <errno.h>
+#include <pthread.h>
 #include <signal.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -40,6 +42,7 @@
 #if defined(__linux__)
 
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/timerfd.h>
 
 #elif defined(__FreeBSD__) || defined(__OpenBSD__)
@@ -55,31 +58,317 @@
 #endif
 
 #include "hvt.h"
+#include "solo5.h"
 
-hvt_hypercall_fn_t hvt_core_hypercalls[HVT_HYPERCALL_MAX] = { 0 };
+static uint64_t monotonic_nsecs(void)
+{
+    struct timespec ts;
+
+    int rc = clock_gettime(CLOCK_MONOTONIC, &ts);
+    assert(rc == 0);
+    return (ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+static uint64_t realtime_nsecs(void)
+{
+    struct timespec ts;
+
+    int rc = clock_gettime(CLOCK_REALTIME, &ts);
+    assert(rc == 0);
+    return (ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+#define HVT_HALT_HOOKS_MAX 16
+#define NUM_MODULES 8
+
+/*
+ * Hypercall dispatch and hooks registered with the core for a VM.
+ */
+struct hvt_core {
+    hvt_hypercall_fn_t hypercalls[HVT_HYPERCALL_MAX];
+    /*
+     * With more than one VCPU, hypercall handlers which are not marked in
+     * (hypercalls_mt) are serialised by (lock).
+     */
+    bool hypercalls_mt[HVT_HYPERCALL_MAX];
+    pthread_mutex_t lock;
+    /*
+     * Hypercalls registered as doorbells, and the file descriptors they
+     * signal.
+     */
+    bool doorbells[HVT_HYPERCALL_MAX];
+    int doorbell_fds[HVT_HYPERCALL_MAX];
+    bool hypercall_seen;
+    hvt_hypercall_hook_fn_t hypercall_hooks[NUM_MODULES];
+    int nr_hypercall_hooks;
+    hvt_exit_hook_fn_t exit_hook;
+    hvt_halt_fn_t halt_hooks[HVT_HALT_HOOKS_MAX];
+    int nr_halt_hooks;
+    hvt_vmexit_fn_t vmexits[NUM_MODULES];
+    int nvmexits;
+    hvt_busy_fn_t busy_hooks[NUM_MODULES];
+    int nr_busy_hooks;
+    hvt_restore_fn_t restore_hooks[NUM_MODULES];
+    int nr_restore_hooks;
+    hvt_reset_fn_t reset_hooks[NUM_MODULES];
+    int nr_reset_hooks;
+    hvt_idle_fn_t idle_hooks[NUM_MODULES];
+    int nr_idle_hooks;
+    /*
+     * Function passed to hvt_core_interrupt(), until the boot VCPU calls it,
+     * and whether it may be called from HVT_HYPERCALL_POLL.
+     */
+    hvt_interrupt_fn_t interrupt_fn;
+    bool interrupt_in_poll;
+    /*
+     * Pages accessed by the tender are tracked in (hvt->dirty), with one bit
+     * per (1 << dirty_page_shift) bytes.
+     */
+    unsigned dirty_page_shift;
+    /*
+     * Last HVT_HYPERCALL_BOOT_REPORT made by the guest, if (boot_reported).
+     */
+    struct hvt_hc_boot_report boot_report;
+    bool boot_reported;
+};
+
+void hvt_core_init(struct hvt *hvt)
+{
+    struct hvt_core *core = calloc(1, sizeof (struct hvt_core));
+    if (core == NULL)
+        err(1, "calloc");
+    pthread_mutex_init(&core->lock, NULL);
+    hvt->core = core;
+}
+
+static int register_hypercall(struct hvt *hvt, int nr, hvt_hypercall_fn_t fn,
+        bool mt)
+{
+    struct hvt_core *core = hvt->core;
+
+    if (nr >= HVT_HYPERCALL_MAX)
+        return -1;
+    if (core->hypercalls[nr] != NULL || core->doorbells[nr])
+        return -1;
+
+    core->hypercalls[nr] = fn;
+    core->hypercalls_mt[nr] = mt;
+    return 0;
+}
 
-int hvt_core_register_hypercall(int nr, hvt_hypercall_fn_t fn)
+int hvt_core_register_hypercall(struct hvt *hvt, int nr, hvt_hypercall_fn_t fn)
 {
+    return register_hypercall(hvt, nr, fn, false);
+}
+
+int hvt_core_register_hypercall_mt(struct hvt *hvt, int nr,
+        hvt_hypercall_fn_t fn)
+{
+    return register_hypercall(hvt, nr, fn, true);
+}
+
+hvt_hypercall_fn_t hvt_core_interpose_hypercall(struct hvt *hvt, int nr,
+        hvt_hypercall_fn_t fn)
+{
+    struct hvt_core *core = hvt->core;
+
+    if (nr >= HVT_HYPERCALL_MAX || core->hypercalls[nr] == NULL)
+        return NULL;
+
+    hvt_hypercall_fn_t prev = core->hypercalls[nr];
+    core->hypercalls[nr] = fn;
+    return prev;
+}
+
+int hvt_core_register_doorbell(struct hvt *hvt, int nr, int fd)
+{
+    struct hvt_core *core = hvt->core;
+
     if (nr >= HVT_HYPERCALL_MAX)
         return -1;
-    if (hvt_core_hypercalls[nr] != NULL)
+    if (core->hypercalls[nr] != NULL || core->doorbells[nr])
+        return -1;
+
+    core->doorbells[nr] = true;
+    core->doorbell_fds[nr] = fd;
+    /*
+     * If the backend cannot signal (fd) itself, calls to (nr) exit to the
+     * tender and are handled by hvt_core_hypercall().
+     */
+    (void)hvt_ioeventfd(hvt, nr, fd, false, 0);
+    return 0;
+}
+
+int hvt_core_register_hypercall_hook(struct hvt *hvt,
+        hvt_hypercall_hook_fn_t fn)
+{
+    struct hvt_core *core = hvt->core;
+
+    if (core->nr_hypercall_hooks == NUM_MODULES)
+        return -1;
+
+    core->hypercall_hooks[core->nr_hypercall_hooks] = fn;
+    core->nr_hypercall_hooks++;
+    return 0;
+}
+
+int hvt_core_register_exit_hook(struct hvt *hvt, hvt_exit_hook_fn_t fn)
+{
+    if (hvt->core->exit_hook != NULL)
         return -1;
 
-    hvt_core_hypercalls[nr] = fn;
+    hvt->core->exit_hook = fn;
     return 0;
 }
 
-#define HVT_HALT_HOOKS_MAX 8
-hvt_halt_fn_t hvt_core_halt_hooks[HVT_HALT_HOOKS_MAX] = {0};
-static int nr_halt_hooks;
+static void console_drain(struct hvt *hvt);
+
+void hvt_core_exit(struct hvt *hvt, unsigned reason)
+{
+    console_drain(hvt);
+    if (hvt->core->exit_hook != NULL)
+        hvt->core->exit_hook(hvt, reason);
+}
+
+static void dispatch_hypercall(struct hvt *hvt, int nr, hvt_gpa_t gpa)
+{
+    struct hvt_core *core = hvt->core;
+
+    if (core->doorbells[nr]) {
+        uint64_t one = 1;
+        (void)write(core->doorbell_fds[nr], &one, sizeof one);
+        return;
+    }
+
+    hvt_hypercall_fn_t fn = core->hypercalls[nr];
+    if (fn == NULL)
+        errx(1, "Invalid guest hypercall: num=%d", nr);
+
+    if (hvt->cpus == 1 || core->hypercalls_mt[nr]) {
+        fn(hvt, gpa);
+        return;
+    }
+    pthread_mutex_lock(&core->lock);
+    fn(hvt, gpa);
+    pthread_mutex_unlock(&core->lock);
+}
+
+static const char *hypercall_names[HVT_HYPERCALL_MAX] = {
+    [HVT_HYPERCALL_WALLTIME] = "WALLTIME",
+    [HVT_HYPERCALL_PUTS] = "PUTS",
+    [HVT_HYPERCALL_POLL] = "POLL",
+    [HVT_HYPERCALL_BLOCK_WRITE] = "BLOCK_WRITE",
+    [HVT_HYPERCALL_BLOCK_READ] = "BLOCK_READ",
+    [HVT_HYPERCALL_NET_WRITE] = "NET_WRITE",
+    [HVT_HYPERCALL_NET_READ] = "NET_READ",
+    [HVT_HYPERCALL_HALT] = "HALT",
+    [HVT_HYPERCALL_NET_WRITEV] = "NET_WRITEV",
+    [HVT_HYPERCALL_NET_READV] = "NET_READV",
+    [HVT_HYPERCALL_NET_RINGS] = "NET_RINGS",
+    [HVT_HYPERCALL_NET_NOTIFY] = "NET_NOTIFY",
+    [HVT_HYPERCALL_NET_VRINGS] = "NET_VRINGS",
+    [HVT_HYPERCALL_NET_KICK] = "NET_KICK",
+    [HVT_HYPERCALL_BLOCK_SUBMIT] = "BLOCK_SUBMIT",
+    [HVT_HYPERCALL_BLOCK_REAP] = "BLOCK_REAP",
+    [HVT_HYPERCALL_BLOCK_WRITEV] = "BLOCK_WRITEV",
+    [HVT_HYPERCALL_BLOCK_READV] = "BLOCK_READV",
+    [HVT_HYPERCALL_BLOCK_FLUSH] = "BLOCK_FLUSH",
+    [HVT_HYPERCALL_BLOCK_DISCARD] = "BLOCK_DISCARD",
+    [HVT_HYPERCALL_BLOCK_WRITE_ZEROES] = "BLOCK_WRITE_ZEROES",
+    [HVT_HYPERCALL_BLOCK_MAP] = "BLOCK_MAP",
+    [HVT_HYPERCALL_CPU_START] = "CPU_START",
+    [HVT_HYPERCALL_POLL_PAGE] = "POLL_PAGE",
+    [HVT_HYPERCALL_TIME_PAGE] = "TIME_PAGE",
+    [HVT_HYPERCALL_SNAPSHOT] = "SNAPSHOT",
+    [HVT_HYPERCALL_MEM_RELEASE] = "MEM_RELEASE",
+    [HVT_HYPERCALL_TRACE_RING] = "TRACE_RING",
+    [HVT_HYPERCALL_MULTI] = "MULTI",
+    [HVT_HYPERCALL_SHM_MAP] = "SHM_MAP",
+    [HVT_HYPERCALL_SHM_NOTIFY] = "SHM_NOTIFY",
+    [HVT_HYPERCALL_PCI_MAP] = "PCI_MAP",
+    [HVT_HYPERCALL_CONSOLE_RING] = "CONSOLE_RING",
+    [HVT_HYPERCALL_BLOCK_PREFETCH] = "BLOCK_PREFETCH",
+    [HVT_HYPERCALL_BLOCK_ZONE_REPORT] = "BLOCK_ZONE_REPORT",
+    [HVT_HYPERCALL_BLOCK_ZONE_APPEND] = "BLOCK_ZONE_APPEND",
+    [HVT_HYPERCALL_BLOCK_ZONE_MANAGE] = "BLOCK_ZONE_MANAGE",
+    [HVT_HYPERCALL_BLOCK_REGISTER] = "BLOCK_REGISTER",
+    [HVT_HYPERCALL_BOOT_REPORT] = "BOOT_REPORT",
+};
+
+const char *hvt_core_hypercall_name(int nr)
+{
+    if (nr < 0 || nr >= HVT_HYPERCALL_MAX)
+        return NULL;
+    return hypercall_names[nr];
+}
+
+void hvt_core_hypercall(struct hvt *hvt, int nr, hvt_gpa_t gpa)
+{
+    struct hvt_core *core = hvt->core;
+
+    if (!core->hypercall_seen) {
+        core->hypercall_seen = true;
+        boot_trace("first hypercall");
+    }
+    TENDER_PROBE2(hypercall__entry, nr, gpa);
+    console_drain(hvt);
+    if (core->nr_hypercall_hooks == 0) {
+        dispatch_hypercall(hvt, nr, gpa);
+        TENDER_PROBE1(hypercall__return, nr);
+        return;
+    }
+
+    uint64_t start = monotonic_nsecs();
+    dispatch_hypercall(hvt, nr, gpa);
+    uint64_t nsecs = monotonic_nsecs() - start;
+    for (int i = 0; i < core->nr_hypercall_hooks; i++)
+        core->hypercall_hooks[i](hvt, nr, gpa, nsecs);
+    TENDER_PROBE1(hypercall__return, nr);
+}
+
+static void hypercall_multi(struct hvt *hvt, hvt_gpa_t gpa)
+{
+    struct hvt_core *core = hvt->core;
+    struct hvt_hc_multi *m =
+        HVT_CHECKED_GPA_P(hvt, gpa, sizeof (struct hvt_hc_multi));
+    size_t count = m->count;
+
+    if (count > HVT_MULTI_MAX) {
+        m->count = 0;
+        m->ret = SOLO5_R_EINVAL;
+        return;
+    }
+    struct hvt_multi_call *calls = HVT_CHECKED_GPA_P(hvt, m->calls,
+            count * sizeof (struct hvt_multi_call));
+
+    /*
+     * Each call is made through hvt_core_hypercall(), so that it is seen by
+     * the hypercall hook and tracepoints as if it had been made on its own.
+     */
+    size_t i;
+    for (i = 0; i < count; i++) {
+        uint64_t nr = calls[i].nr;
+        hvt_gpa_t arg = calls[i].arg;
+
+        if (nr >= HVT_HYPERCALL_MAX || nr == HVT_HYPERCALL_SNAPSHOT ||
+                nr == HVT_HYPERCALL_MULTI ||
+                (core->hypercalls[nr] == NULL && !core->doorbells[nr]))
+            break;
+        hvt_core_hypercall(hvt, nr, arg);
+    }
+    m->count = i;
+    m->ret = (i == count) ? SOLO5_R_OK : SOLO5_R_EINVAL;
+}
 
-int hvt_core_register_halt_hook(hvt_halt_fn_t fn)
+int hvt_core_register_halt_hook(struct hvt *hvt, hvt_halt_fn_t fn)
 {
-    if (nr_halt_hooks == HVT_HALT_HOOKS_MAX)
+    struct hvt_core *core = hvt->core;
+
+    if (core->nr_halt_hooks == HVT_HALT_HOOKS_MAX)
         return -1;
 
-    hvt_core_halt_hooks[nr_halt_hooks] = fn;
-    nr_halt_hooks++;
+    core->halt_hooks[core->nr_halt_hooks] = fn;
+    core->nr_halt_hooks++;
     return 0;
 }
 
@@ -90,6 +379,14 @@ int hvt_core_hypercall_halt(struct hvt *hvt, hvt_gpa_t gpa)
     struct hvt_hc_halt *t =
             HVT_CHECKED_GPA_P(hvt, gpa, sizeof (struct hvt_hc_halt));
 
+    /*
+     * If several VCPUs halt at once, only the first runs the halt hooks. The
+     * core lock is not released, as the tender is about to exit.
+     */
+    if (hvt->cpus > 1)
+        pthread_mutex_lock(&hvt->core->lock);
+    console_drain(hvt);
+
     /*
      * If the guest set a non-NULL cookie (non-zero before conversion), verify
      * that the memory space pointed to by it is accessible and pass it down to
@@ -100,8 +397,8 @@ int hvt_core_hypercall_halt(struct hvt *hvt, hvt_gpa_t gpa)
     else
         cookie = NULL;
 
-    for (idx = 0; idx < nr_halt_hooks; idx++) {
-        hvt_halt_fn_t fn = hvt_core_halt_hooks[idx];
+    for (idx = 0; idx < hvt->core->nr_halt_hooks; idx++) {
+        hvt_halt_fn_t fn = hvt->core->halt_hooks[idx];
         assert(fn != NULL);
         fn(hvt, t->exit_status, cookie);
     }
@@ -109,37 +406,398 @@ int hvt_core_hypercall_halt(struct hvt *hvt, hvt_gpa_t gpa)
     return t->exit_status;
 }
 
-#define NUM_MODULES 8
-hvt_vmexit_fn_t hvt_core_vmexits[NUM_MODULES + 1] = { 0 };
-static int nvmexits = 0;
+int hvt_core_register_vmexit(struct hvt *hvt, hvt_vmexit_fn_t fn)
+{
+    struct hvt_core *core = hvt->core;
+
+    if (core->nvmexits == NUM_MODULES)
+        return -1;
+
+    core->vmexits[core->nvmexits] = fn;
+    core->nvmexits++;
+    return 0;
+}
 
-int hvt_core_register_vmexit(hvt_vmexit_fn_t fn)
+int hvt_core_vmexit(struct hvt *hvt)
 {
-    if (nvmexits == NUM_MODULES)
+    struct hvt_core *core = hvt->core;
+
+    for (int i = 0; i < core->nvmexits; i++) {
+        if (core->vmexits[i](hvt) == 0)
+            return 0;
+    }
+    return -1;
+}
+
+/*
+ * Set on the thread running the boot VCPU, which is the one setting up the
+ * modules.
+ */
+static __thread bool on_boot_vcpu;
+
+static int interrupt(struct hvt *hvt, hvt_interrupt_fn_t fn, bool in_poll)
+{
+    static pthread_mutex_t interrupt_lock = PTHREAD_MUTEX_INITIALIZER;
+    struct hvt_core *core = hvt->core;
+    struct timespec ts = { .tv_sec = 0, .tv_nsec = 1000000 };
+    int rc = 0;
+
+    pthread_mutex_lock(&interrupt_lock);
+    assert(core->interrupt_fn == NULL);
+    core->interrupt_in_poll = in_poll;
+    __atomic_store_n(&core->interrupt_fn, fn, __ATOMIC_RELEASE);
+    /*
+     * The boot VCPU may miss being interrupted if it is between checking for
+     * a pending interrupt and blocking in HVT_HYPERCALL_POLL, so keep trying
+     * until it has taken (fn).
+     */
+    do {
+        if (hvt_vcpu_interrupt(hvt) == -1) {
+            __atomic_store_n(&core->interrupt_fn, NULL, __ATOMIC_RELEASE);
+            rc = -1;
+            break;
+        }
+        nanosleep(&ts, NULL);
+    } while (__atomic_load_n(&core->interrupt_fn, __ATOMIC_ACQUIRE) != NULL);
+    pthread_mutex_unlock(&interrupt_lock);
+    return rc;
+}
+
+int hvt_core_interrupt(struct hvt *hvt, hvt_interrupt_fn_t fn)
+{
+    return interrupt(hvt, fn, false);
+}
+
+int hvt_core_interrupt_poll(struct hvt *hvt, hvt_interrupt_fn_t fn)
+{
+    return interrupt(hvt, fn, true);
+}
+
+/*
+ * Called by HVT_HYPERCALL_POLL when interrupted while blocking. Returns true
+ * if it must return to the guest for the boot VCPU to be interrupted, or
+ * false if it can carry on waiting, having called a function passed to
+ * hvt_core_interrupt_poll() itself.
+ */
+static bool interrupt_pending(struct hvt *hvt)
+{
+    struct hvt_core *core = hvt->core;
+
+    if (__atomic_load_n(&core->interrupt_fn, __ATOMIC_ACQUIRE) == NULL)
+        return false;
+    if (!on_boot_vcpu || !core->interrupt_in_poll)
+        return true;
+    hvt_core_interrupted(hvt);
+    return false;
+}
+
+void hvt_core_interrupted(struct hvt *hvt)
+{
+    hvt_interrupt_fn_t fn =
+        __atomic_exchange_n(&hvt->core->interrupt_fn, NULL, __ATOMIC_ACQ_REL);
+
+    if (fn != NULL)
+        fn(hvt);
+}
+
+int hvt_core_register_busy_hook(struct hvt *hvt, hvt_busy_fn_t fn)
+{
+    struct hvt_core *core = hvt->core;
+
+    if (core->nr_busy_hooks == NUM_MODULES)
+        return -1;
+
+    core->busy_hooks[core->nr_busy_hooks] = fn;
+    core->nr_busy_hooks++;
+    return 0;
+}
+
+bool hvt_core_busy(struct hvt *hvt)
+{
+    struct hvt_core *core = hvt->core;
+
+    for (int i = 0; i < core->nr_busy_hooks; i++) {
+        if (core->busy_hooks[i](hvt))
+            return true;
+    }
+    return false;
+}
+
+int hvt_core_register_restore_hook(struct hvt *hvt, hvt_restore_fn_t fn)
+{
+    struct hvt_core *core = hvt->core;
+
+    if (core->nr_restore_hooks == NUM_MODULES)
+        return -1;
+
+    core->restore_hooks[core->nr_restore_hooks] = fn;
+    core->nr_restore_hooks++;
+    return 0;
+}
+
+int hvt_core_register_reset_hook(struct hvt *hvt, hvt_reset_fn_t fn)
+{
+    struct hvt_core *core = hvt->core;
+
+    if (core->nr_reset_hooks == NUM_MODULES)
+        return -1;
+
+    core->reset_hooks[core->nr_reset_hooks] = fn;
+    core->nr_reset_hooks++;
+    return 0;
+}
+
+int hvt_core_register_idle_hook(struct hvt *hvt, hvt_idle_fn_t fn)
+{
+    struct hvt_core *core = hvt->core;
+
+    if (core->nr_idle_hooks == NUM_MODULES)
         return -1;
 
-    hvt_core_vmexits[nvmexits] = fn;
-    nvmexits++;
+    core->idle_hooks[core->nr_idle_hooks] = fn;
+    core->nr_idle_hooks++;
     return 0;
 }
 
+void hvt_dirty_track_enable(struct hvt *hvt)
+{
+    if (hvt->dirty != NULL)
+        return;
+
+    long page_size = sysconf(_SC_PAGESIZE);
+    assert(page_size > 0 && (page_size & (page_size - 1)) == 0);
+    hvt->core->dirty_page_shift = __builtin_ctzl(page_size);
+    uint64_t *dirty = calloc(HVT_DIRTY_LOG_WORDS(hvt->mem_size / page_size),
+            sizeof (uint64_t));
+    if (dirty == NULL)
+        err(1, "calloc");
+    __atomic_store_n(&hvt->dirty, dirty, __ATOMIC_RELEASE);
+}
+
+void hvt_dirty_track_mark(struct hvt *hvt, hvt_gpa_t gpa, size_t sz)
+{
+    unsigned shift = hvt->core->dirty_page_shift;
+    uint64_t first = gpa >> shift;
+    uint64_t last = (gpa + (sz ? sz - 1 : 0)) >> shift;
+
+    for (uint64_t pg = first; pg <= last; pg++) {
+        uint64_t bit = 1ULL << (pg % 64);
+        /*
+         * Most accesses are to pages which are already marked, avoid the
+         * atomic operation for those.
+         */
+        if (!(__atomic_load_n(&hvt->dirty[pg / 64], __ATOMIC_RELAXED) & bit))
+            __atomic_fetch_or(&hvt->dirty[pg / 64], bit, __ATOMIC_RELAXED);
+    }
+}
+
+void hvt_dirty_track_get(struct hvt *hvt, uint64_t *bitmap)
+{
+    size_t nwords =
+        HVT_DIRTY_LOG_WORDS(hvt->mem_size >> hvt->core->dirty_page_shift);
+
+    for (size_t i = 0; i < nwords; i++)
+        bitmap[i] |= __atomic_load_n(&hvt->dirty[i], __ATOMIC_RELAXED);
+}
+
+void hvt_dirty_track_clear(struct hvt *hvt)
+{
+    size_t nwords =
+        HVT_DIRTY_LOG_WORDS(hvt->mem_size >> hvt->core->dirty_page_shift);
+
+    memset(hvt->dirty, 0, nwords * sizeof (uint64_t));
+}
+
+size_t hvt_dirty_log_next(const uint64_t *bitmap, size_t nbits, size_t bit,
+        bool set)
+{
+    while (bit < nbits) {
+        uint64_t word = bitmap[bit / 64];
+        if (!set)
+            word = ~word;
+        word &= ~0ULL << (bit % 64);
+        if (word != 0) {
+            bit = (bit & ~63UL) + __builtin_ctzll(word);
+            return bit < nbits ? bit : nbits;
+        }
+        bit = (bit & ~63UL) + 64;
+    }
+    return nbits;
+}
+
 static void hypercall_walltime(struct hvt *hvt, hvt_gpa_t gpa)
 {
     struct hvt_hc_walltime *t =
         HVT_CHECKED_GPA_P(hvt, gpa, sizeof (struct hvt_hc_walltime));
-    struct timespec ts;
 
-    int rc = clock_gettime(CLOCK_REALTIME, &ts);
-    assert(rc == 0);
-    t->nsecs = (ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+    t->nsecs = realtime_nsecs();
+}
+
+/*
+ * Shared time page (HVT_FEATURE_TIME_PAGE), updated by (time_thread) every
+ * TIME_PAGE_INTERVAL_NSECS. The guest's cycle counter runs at the same rate
+ * as ours, at a fixed offset (time_page_offset) which is estimated when the
+ * page is registered.
+ */
+#define TIME_PAGE_INTERVAL_NSECS 100000000ULL
+static struct hvt_time_page *time_page;
+static uint64_t time_page_offset;
+static pthread_t time_thread;
+
+static uint64_t host_cycles(void)
+{
+#if defined(__x86_64__)
+    return __builtin_ia32_rdtsc();
+#elif defined(__aarch64__)
+    uint64_t v;
+    __asm__ __volatile__("isb; mrs %0, cntvct_el0" : "=r" (v) :: "memory");
+    return v;
+#else
+#error Unsupported architecture
+#endif
+}
+
+static void time_page_update(void)
+{
+    /*
+     * Take the cycle count half way between two readings, to minimise the
+     * error introduced by clock_gettime() itself.
+     */
+    uint64_t before = host_cycles();
+    uint64_t wall_nsecs = realtime_nsecs();
+    uint64_t after = host_cycles();
+    uint64_t cycles = before + (after - before) / 2 + time_page_offset;
+    uint64_t seq = time_page->seq;
+
+    __atomic_store_n(&time_page->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&time_page->cycles, cycles, __ATOMIC_RELAXED);
+    __atomic_store_n(&time_page->wall_nsecs, wall_nsecs, __ATOMIC_RELAXED);
+    __atomic_store_n(&time_page->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+static void *time_thread_fn(void *arg)
+{
+    struct timespec ts = {
+        .tv_sec = TIME_PAGE_INTERVAL_NSECS / 1000000000ULL,
+        .tv_nsec = TIME_PAGE_INTERVAL_NSECS % 1000000000ULL
+    };
+
+    (void)arg;
+    for (;;) {
+        nanosleep(&ts, NULL);
+        time_page_update();
+    }
+    return NULL;
+}
+
+/*
+ * Start updating the time page at (gpa), given that the guest's cycle counter
+ * reads (cycles) now.
+ */
+static void time_page_start(struct hvt *hvt, hvt_gpa_t gpa, uint64_t cycles)
+{
+    time_page_offset = cycles - host_cycles();
+    time_page = HVT_CHECKED_GPA_P(hvt, gpa, sizeof (struct hvt_time_page));
+    time_page_update();
+
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    if (pthread_create(&time_thread, NULL, time_thread_fn, NULL) != 0)
+        errx(1, "Could not create time page thread");
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+static void hypercall_time_page(struct hvt *hvt, hvt_gpa_t gpa)
+{
+    struct hvt_hc_time_page *tp =
+        HVT_CHECKED_GPA_P(hvt, gpa, sizeof (struct hvt_hc_time_page));
+
+    if (time_page != NULL || (tp->page & 7) != 0) {
+        tp->ret = SOLO5_R_EINVAL;
+        return;
+    }
+    /*
+     * The guest read (tp->cycles) just before exiting, so this
+     * underestimates the offset by the cost of a hypercall, a constant error
+     * of the order of a microsecond.
+     */
+    time_page_start(hvt, tp->page, tp->cycles);
+    tp->ret = SOLO5_R_OK;
+}
+
+/*
+ * Console output ring (HVT_FEATURE_CONSOLE_RING), drained by console_drain()
+ * on each exit of the guest. (console_lock) keeps output from the ring and
+ * from HVT_HYPERCALL_PUTS in order across VCPUs.
+ */
+static struct hvt_console_ring *console_ring;
+static hvt_gpa_t console_ring_gpa;
+static pthread_mutex_t console_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void console_drain_locked(struct hvt *hvt)
+{
+    uint64_t head = __atomic_load_n(&console_ring->head, __ATOMIC_ACQUIRE);
+    uint64_t tail = console_ring->tail;
+
+    if (head == tail)
+        return;
+    /*
+     * A guest which has overrun the ring has corrupted its own output.
+     */
+    if (head - tail > HVT_CONSOLE_RING_SIZE)
+        tail = head - HVT_CONSOLE_RING_SIZE;
+    while (tail != head) {
+        size_t off = tail & (HVT_CONSOLE_RING_SIZE - 1);
+        size_t len = HVT_CONSOLE_RING_SIZE - off;
+        if (len > head - tail)
+            len = head - tail;
+        console_out_write(console_ring->data + off, len);
+        tail += len;
+    }
+    /*
+     * Written through a checked pointer, so that the update is seen by dirty
+     * page tracking.
+     */
+    struct hvt_console_ring *r = HVT_CHECKED_GPA_P(hvt, console_ring_gpa,
+            offsetof(struct hvt_console_ring, data));
+    __atomic_store_n(&r->tail, head, __ATOMIC_RELEASE);
+}
+
+static void console_drain(struct hvt *hvt)
+{
+    if (console_ring == NULL ||
+            __atomic_load_n(&console_ring->head, __ATOMIC_RELAXED) ==
+            console_ring->tail)
+        return;
+    pthread_mutex_lock(&console_lock);
+    console_drain_locked(hvt);
+    pthread_mutex_unlock(&console_lock);
+}
+
+static void hypercall_console_ring(struct hvt *hvt, hvt_gpa_t gpa)
+{
+    struct hvt_hc_console_ring *cr =
+        HVT_CHECKED_GPA_P(hvt, gpa, sizeof (struct hvt_hc_console_ring));
+
+    if (console_ring != NULL || (cr->ring & 63) != 0) {
+        cr->ret = SOLO5_R_EINVAL;
+        return;
+    }
+    console_ring_gpa = cr->ring;
+    console_ring = HVT_CHECKED_GPA_P(hvt, cr->ring,
+            sizeof (struct hvt_console_ring));
+    cr->ret = SOLO5_R_OK;
 }
 
 static void hypercall_puts(struct hvt *hvt, hvt_gpa_t gpa)
 {
     struct hvt_hc_puts *p =
         HVT_CHECKED_GPA_P(hvt, gpa, sizeof (struct hvt_hc_puts));
-    int rc = write(1, HVT_CHECKED_GPA_P(hvt, p->data, p->len), p->len);
-    assert(rc >= 0);
+    pthread_mutex_lock(&console_lock);
+    console_out_write(HVT_CHECKED_GPA_P(hvt, p->data, p->len), p->len);
+    pthread_mutex_unlock(&console_lock);
 }
 
 static int waitsetfd = -1;
@@ -147,6 +805,34 @@ static int npollfds;
 #if defined(__linux__)
 static int timerfd = -1;
 #define INTERNAL_TIMERFD (~1U)
+/*
+ * Where the host supports epoll_pwait2(), whose timeout has nanosecond
+ * resolution, it is used rather than the internal timerfd, saving a
+ * timerfd_settime() on each blocking poll. The timerfd is then not created.
+ */
+#if !defined(SYS_epoll_pwait2)
+#define SYS_epoll_pwait2 441
+#endif
+static bool have_epoll_pwait2;
+
+static int waitset_pwait2(struct epoll_event *events, int maxevents,
+        uint64_t timeout_nsecs)
+{
+    struct timespec ts = {
+        .tv_sec = timeout_nsecs / 1000000000ULL,
+        .tv_nsec = timeout_nsecs % 1000000000ULL
+    };
+
+    return syscall(SYS_epoll_pwait2, waitsetfd, events, maxevents, &ts, NULL,
+            0);
+}
+#elif defined(NOTE_NSECONDS)
+/*
+ * On kqueue hosts supporting nanosecond timers, timeouts are implemented by a
+ * one-shot EVFILT_TIMER with this ident, as for the Linux timerfd, rather
+ * than by the timeout of kevent(), which is rounded up to the next tick.
+ */
+#define INTERNAL_TIMER_IDENT 0
 #endif
 
 static void setup_waitset(void)
@@ -156,11 +842,15 @@ static void setup_waitset(void)
     if (waitsetfd == -1)
         err(1, "Could not create wait set");
 
+    struct epoll_event ev;
+    if (waitset_pwait2(&ev, 1, 0) != -1 || errno != ENOSYS) {
+        have_epoll_pwait2 = true;
+        return;
+    }
     timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
     if (timerfd == -1)
         err(1, "Could not create wait set timerfd");
 
-    struct epoll_event ev;
     ev.events = EPOLLIN;
     ev.data.u64 = INTERNAL_TIMERFD;
     if (epoll_ctl(waitsetfd, EPOLL_CTL_ADD, timerfd, &ev) == -1)
@@ -172,14 +862,60 @@ static void setup_waitset(void)
 #endif
 }
 
-int hvt_core_register_pollfd(int fd, uintptr_t waitset_data)
+#if defined(__linux__)
+/*
+ * Shared readiness page (HVT_FEATURE_POLL_PAGE). Level-triggered pollfds are
+ * also watched by (page_thread) in a wait set of their own, with
+ * EPOLLONESHOT, which publishes their readiness in (poll_page). A published
+ * pollfd is not watched again until the module serving it calls
+ * hvt_core_pollfd_consumed(). Pollfds paused with hvt_core_pollfd_pause()
+ * are in (paused_handles), and watched by neither wait set.
+ */
+static uint64_t page_handles;
+static uint64_t paused_handles;
+/*
+ * Pollfds which are also watched for writability in the main wait set, having
+ * been asked for with hvt_core_pollfd_want_write(). Changes to the events
+ * watched are serialised by (watch_lock), as VCPUs may poll concurrently.
+ */
+static uint64_t write_handles;
+static pthread_mutex_t watch_lock = PTHREAD_MUTEX_INITIALIZER;
+static void write_done(uintptr_t waitset_data);
+static int page_fds[64];
+static int page_waitsetfd = -1;
+static struct hvt_poll_page *poll_page;
+static pthread_t page_thread;
+#endif
+
+#if defined(__linux__)
+/*
+ * In-kernel irqchip (HVT_FEATURE_IRQCHIP). The guest waits by halting rather
+ * than in HVT_HYPERCALL_POLL, so (wake_thread) watches the main wait set in
+ * a wait set of its own, with EPOLLONESHOT, and raises HVT_IRQCHIP_VECTOR
+ * through (wake_irqfd) once any pollfd in it is ready. hypercall_poll()
+ * re-arms the watch, which raises the interrupt again straight away if any
+ * pollfd is still ready.
+ */
+static int wake_waitsetfd = -1;
+static int wake_irqfd = -1;
+static pthread_t wake_thread;
+#endif
+
+static void register_pollfd(int fd, uintptr_t waitset_data, bool edge)
 {
     if (waitsetfd == -1)
         setup_waitset();
+#if defined(__linux__)
+    if (!edge) {
+        assert(waitset_data < 64);
+        page_handles |= 1ULL << waitset_data;
+        page_fds[waitset_data] = fd;
+    }
+#endif
 
 #if defined(__linux__)
     struct epoll_event ev;
-    ev.events = EPOLLIN;
+    ev.events = EPOLLIN | (edge ? EPOLLET : 0);
     /*
      * waitset_data is a solo5_handle_t, and will be returned by epoll() as
      * part of any received event.
@@ -193,112 +929,728 @@ int hvt_core_register_pollfd(int fd, uintptr_t waitset_data)
      * waitset_data is a solo5_handle_t, and will be returned by kevent() as
      * part of any received event.
      */
-    EV_SET(&ev, fd, EVFILT_READ, EV_ADD, 0, 0, (void *)waitset_data);
+    EV_SET(&ev, fd, EVFILT_READ, EV_ADD | (edge ? EV_CLEAR : 0), 0, 0,
+            (void *)waitset_data);
     if (kevent(waitsetfd, &ev, 1, NULL, 0, NULL) == -1)
         err(1, "kevent(EV_ADD) failed");
 #endif
     npollfds++;
+}
+
+/*
+ * Busy-polling (--poll-us=N). Before blocking in HVT_HYPERCALL_POLL, spin for
+ * up to (poll_spin_nsecs) checking the wait set without blocking. The spin
+ * budget adapts to recent hit rates: it is doubled, up to the maximum given
+ * by the user, each time spinning finds events, and halved, down to
+ * POLL_SPIN_MIN_NSECS, each time it does not. The budget is per-VCPU.
+ */
+#define POLL_US_MAX 100000
+#define POLL_SPIN_MIN_NSECS 1000ULL
+static uint64_t poll_spin_max_nsecs;
+static __thread uint64_t poll_spin_nsecs;
+
+#if defined(__linux__)
+typedef struct epoll_event poll_event_t;
+#else
+typedef struct kevent poll_event_t;
+#endif
+
+/*
+ * Returns a buffer for (nevents) events, kept across calls by each VCPU
+ * thread and grown as pollfds are registered.
+ */
+static poll_event_t *poll_events(int nevents)
+{
+    static __thread poll_event_t *revents;
+    static __thread int size;
+
+    if (nevents > size) {
+        poll_event_t *p = realloc(revents, nevents * sizeof (poll_event_t));
+        if (p == NULL)
+            err(1, "realloc");
+        revents = p;
+        size = nevents;
+    }
+    return revents;
+}
+
+/*
+ * Spin on the wait set for at most (timeout_nsecs), storing events in
+ * (revents). Returns the number of events stored, or 0 if no device became
+ * ready, and the time spent in (*spent_nsecs).
+ */
+static int poll_spin(poll_event_t *revents, int nevents,
+        uint64_t timeout_nsecs, uint64_t *spent_nsecs)
+{
+    if (poll_spin_nsecs == 0)
+        poll_spin_nsecs = poll_spin_max_nsecs;
+    uint64_t budget = poll_spin_nsecs;
+    bool truncated = false;
+    if (budget > timeout_nsecs) {
+        budget = timeout_nsecs;
+        truncated = true;
+    }
+
+    uint64_t start = monotonic_nsecs(), now = start;
+    int nrevents;
+    for (;;) {
+#if defined(__linux__)
+        nrevents = epoll_wait(waitsetfd, revents, nevents, 0);
+        /*
+         * The internal timerfd may still be readable from an earlier call,
+         * and is not armed while spinning, so disregard it.
+         */
+        bool ready = false;
+        for (int i = 0; i < nrevents; i++)
+            if (revents[i].data.u64 != INTERNAL_TIMERFD)
+                ready = true;
+        if (!ready)
+            nrevents = 0;
+#else /* kqueue */
+        struct timespec ts = { 0 };
+        nrevents = kevent(waitsetfd, NULL, 0, revents, nevents, &ts);
+        if (nrevents < 0)
+            nrevents = 0;
+        /*
+         * The internal timer may have fired since an earlier call, and is
+         * not armed while spinning, so disregard it.
+         */
+        bool ready = false;
+        for (int i = 0; i < nrevents; i++)
+            if (revents[i].filter != EVFILT_TIMER)
+                ready = true;
+        if (!ready)
+            nrevents = 0;
+#endif
+        if (nrevents > 0 || now - start >= budget)
+            break;
+        now = monotonic_nsecs();
+    }
+
+    if (nrevents > 0) {
+        poll_spin_nsecs *= 2;
+        if (poll_spin_nsecs > poll_spin_max_nsecs)
+            poll_spin_nsecs = poll_spin_max_nsecs;
+    }
+    else if (!truncated) {
+        poll_spin_nsecs /= 2;
+        if (poll_spin_nsecs < POLL_SPIN_MIN_NSECS)
+            poll_spin_nsecs = POLL_SPIN_MIN_NSECS;
+    }
+    *spent_nsecs = now - start;
+    return nrevents;
+}
+
+int hvt_core_register_pollfd(int fd, uintptr_t waitset_data)
+{
+    register_pollfd(fd, waitset_data, false);
+    return 0;
+}
+
+int hvt_core_register_pollfd_edge(int fd, uintptr_t waitset_data)
+{
+    register_pollfd(fd, waitset_data, true);
     return 0;
 }
 
+#if defined(__linux__)
+static void *wake_thread_fn(void *arg)
+{
+    struct epoll_event ev;
+    uint64_t one = 1;
+
+    (void)arg;
+    for (;;) {
+        int nrevents = epoll_wait(wake_waitsetfd, &ev, 1, -1);
+        if (nrevents == -1) {
+            if (errno == EINTR)
+                continue;
+            err(1, "epoll_wait() failed");
+        }
+        if (nrevents == 1 && write(wake_irqfd, &one, sizeof one) == -1 &&
+                errno != EAGAIN)
+            err(1, "Could not signal irqfd");
+    }
+    return NULL;
+}
+
+static void wake_arm(int op)
+{
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    ev.data.u64 = 0;
+    if (epoll_ctl(wake_waitsetfd, op, waitsetfd, &ev) == -1)
+        err(1, "epoll_ctl() failed");
+}
+
+static void wake_start(struct hvt *hvt)
+{
+    wake_irqfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (wake_irqfd == -1)
+        err(1, "Could not create irqfd");
+    if (hvt_irqfd(hvt, wake_irqfd) == -1)
+        errx(1, "--irqchip: Could not route interrupts to the guest");
+    wake_waitsetfd = epoll_create1(EPOLL_CLOEXEC);
+    if (wake_waitsetfd == -1)
+        err(1, "Could not create wait set");
+    wake_arm(EPOLL_CTL_ADD);
+
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    if (pthread_create(&wake_thread, NULL, wake_thread_fn, NULL) != 0)
+        errx(1, "Could not create irqchip wakeup thread");
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+#endif
+
 static void hypercall_poll(struct hvt *hvt, hvt_gpa_t gpa)
 {
     struct hvt_hc_poll *t =
         HVT_CHECKED_GPA_P(hvt, gpa, sizeof (struct hvt_hc_poll));
 
+    if (t->timeout_nsecs != 0) {
+        for (int i = 0; i < hvt->core->nr_idle_hooks; i++)
+            hvt->core->idle_hooks[i](hvt);
+    }
+
 #if defined(__linux__)
     /*
      * On Linux, in order to support nanosecond timeouts, as defined by the
-     * Solo5 API, we use a timerfd internally in the waitset. Account for this
-     * in the number of requested events.
+     * Solo5 API, we use epoll_pwait2() or a timerfd internally in the waitset.
+     * Account for the latter in the number of requested events.
      */
     int nevents = npollfds ? (npollfds + 1) : 1;
     int nrevents;
-    uint64_t ready_set = 0;
-
-    struct epoll_event revents[nevents];
-    struct itimerspec it = {
-        .it_interval = { 0 },
-        .it_value = {
-            .tv_sec = t->timeout_nsecs / 1000000000ULL,
-            .tv_nsec = t->timeout_nsecs % 1000000000ULL
+    uint64_t ready_set = 0, writable_set = 0;
+
+    struct epoll_event *revents = poll_events(nevents);
+    uint64_t timeout_nsecs = t->timeout_nsecs;
+
+    nrevents = 0;
+    if (poll_spin_max_nsecs != 0) {
+        uint64_t spent_nsecs;
+        nrevents = poll_spin(revents, nevents, timeout_nsecs, &spent_nsecs);
+        timeout_nsecs -= (spent_nsecs < timeout_nsecs) ? spent_nsecs :
+            timeout_nsecs;
+    }
+    if (nrevents == 0 && timeout_nsecs == 0) {
+        nrevents = epoll_wait(waitsetfd, revents, nevents, 0);
+        if (nrevents == -1 && errno == EINTR)
+            nrevents = 0;
+    }
+    else if (nrevents == 0 && have_epoll_pwait2) {
+        /*
+         * The timeout is relative, so it is recalculated from the deadline
+         * when the call is restarted on EINTR, unless the boot VCPU is being
+         * interrupted, in which case return with no events.
+         */
+        TENDER_PROBE1(poll__block, timeout_nsecs);
+        uint64_t deadline = monotonic_nsecs() + timeout_nsecs;
+        for (;;) {
+            nrevents = waitset_pwait2(revents, nevents, timeout_nsecs);
+            if (nrevents != -1 || errno != EINTR || interrupt_pending(hvt))
+                break;
+            uint64_t now = monotonic_nsecs();
+            timeout_nsecs = (now < deadline) ? deadline - now : 0;
         }
-    };
-    if (timerfd_settime(timerfd, 0, &it, NULL) == -1)
-        err(1, "timerfd_settime() failed");
-    /*
-     * We can always safely restart this call on EINTR, since the internal
-     * timerfd is independent of its invocation.
-     */
-    do {
-        nrevents = epoll_pwait(waitsetfd, revents, nevents, -1, NULL);
-    } while (nrevents == -1 && errno == EINTR);
+        if (nrevents == -1 && errno == EINTR)
+            nrevents = 0;
+    }
+    else if (nrevents == 0) {
+        struct itimerspec it = {
+            .it_interval = { 0 },
+            .it_value = {
+                .tv_sec = timeout_nsecs / 1000000000ULL,
+                .tv_nsec = timeout_nsecs % 1000000000ULL
+            }
+        };
+        if (timerfd_settime(timerfd, 0, &it, NULL) == -1)
+            err(1, "timerfd_settime() failed");
+        /*
+         * We can always safely restart this call on EINTR, since the
+         * internal timerfd is independent of its invocation, unless the boot
+         * VCPU is being interrupted, in which case return with no events.
+         */
+        TENDER_PROBE1(poll__block, timeout_nsecs);
+        do {
+            nrevents = epoll_pwait(waitsetfd, revents, nevents, -1, NULL);
+        } while (nrevents == -1 && errno == EINTR && !interrupt_pending(hvt));
+        if (nrevents == -1 && errno == EINTR)
+            nrevents = 0;
+    }
     if (nrevents > 0) {
         int orig_nrevents = nrevents;
-        for (int i = 0; i < orig_nrevents; i++)
-            if (revents[i].data.u64 == INTERNAL_TIMERFD)
+        for (int i = 0; i < orig_nrevents; i++) {
+            uint64_t h = revents[i].data.u64;
+            if (h == INTERNAL_TIMERFD) {
                 nrevents -= 1;          /* Disregard in total reported events */
+                continue;
+            }
+            if (revents[i].events & EPOLLOUT) {
+                writable_set |= 1ULL << h;
+                write_done(h);
+            }
+            if (revents[i].events & ~EPOLLOUT)
+                ready_set |= (1ULL << h);
             else
-                ready_set |= (1ULL << revents[i].data.u64);
+                nrevents -= 1;          /* Only writable, not ready */
+        }
     }
     assert(nrevents >= 0);
+    if (wake_waitsetfd != -1)
+        wake_arm(EPOLL_CTL_MOD);
 #else /* kqueue */
     /*
      * At least one event must be requested in kevent(), otherwise the call
-     * will just return or error.
+     * will just return or error. Account for the internal timer, if used.
      */
-    int nevents = npollfds ? npollfds : 1;
+    int nevents = npollfds + 1;
     int nrevents;
-    uint64_t ready_set = 0;
-    struct kevent revents[nevents];
-    struct timespec ts;
-
-    ts.tv_sec = t->timeout_nsecs / 1000000000ULL;
-    ts.tv_nsec = t->timeout_nsecs % 1000000000ULL;
+    uint64_t ready_set = 0, writable_set = 0;
+    struct kevent *revents = poll_events(nevents);
+    uint64_t timeout_nsecs = t->timeout_nsecs;
 
-    nrevents = kevent(waitsetfd, NULL, 0, revents, nevents, &ts);
-    /*
-     * Unlike the epoll() implementation, we can't easily restart the kqueue()
-     * call on EINTR, due to not having a straightforward way to recalculate
-     * the timeout.  While we could use EVFILT_TIMER similarly to the Linux
-     * timerfd, this has system-wide limits on the number of active timers.
-     *
-     * However: We don't handle any signals, other than by terminating the
-     * tender.  Therefore, we should never see EINTR in practice here. If this
-     * turns out not to be the case, prominently warn the user about it and
-     * pretend we woke up early with no events, which is better than just
-     * asserting/aborting.
-     */
-    if (nrevents == -1 && errno == EINTR) {
-        warnx("hypercall_poll(): kqueue() returned EINTR");
-        warnx("hypercall_poll(): This should not happen, please report a bug");
-        nrevents = 0;
+    nrevents = 0;
+    if (poll_spin_max_nsecs != 0) {
+        uint64_t spent_nsecs;
+        nrevents = poll_spin(revents, nevents, timeout_nsecs, &spent_nsecs);
+        timeout_nsecs -= (spent_nsecs < timeout_nsecs) ? spent_nsecs :
+            timeout_nsecs;
+    }
+    if (nrevents == 0 && timeout_nsecs == 0) {
+        struct timespec ts = { 0 };
+        nrevents = kevent(waitsetfd, NULL, 0, revents, nevents, &ts);
+        if (nrevents == -1 && errno == EINTR)
+            nrevents = 0;
+    }
+    else if (nrevents == 0) {
+        TENDER_PROBE1(poll__block, timeout_nsecs);
+#if defined(NOTE_NSECONDS)
+        /*
+         * Arming the timer replaces any earlier one. As with the Linux
+         * timerfd, the call can be restarted on EINTR without recalculating
+         * the timeout, unless the boot VCPU is being interrupted, in which
+         * case return with no events.
+         */
+        struct kevent ev;
+        EV_SET(&ev, INTERNAL_TIMER_IDENT, EVFILT_TIMER, EV_ADD | EV_ONESHOT,
+                NOTE_NSECONDS, timeout_nsecs, NULL);
+        nrevents = kevent(waitsetfd, &ev, 1, revents, nevents, NULL);
+        while (nrevents == -1 && errno == EINTR && !interrupt_pending(hvt))
+            nrevents = kevent(waitsetfd, NULL, 0, revents, nevents, NULL);
+#else
+        /*
+         * Without nanosecond timers, the timeout of kevent() is used, and
+         * recalculated from the deadline when the call is restarted on EINTR.
+         */
+        uint64_t deadline = monotonic_nsecs() + timeout_nsecs;
+        for (;;) {
+            struct timespec ts = {
+                .tv_sec = timeout_nsecs / 1000000000ULL,
+                .tv_nsec = timeout_nsecs % 1000000000ULL
+            };
+            nrevents = kevent(waitsetfd, NULL, 0, revents, nevents, &ts);
+            if (nrevents != -1 || errno != EINTR || interrupt_pending(hvt))
+                break;
+            uint64_t now = monotonic_nsecs();
+            timeout_nsecs = (now < deadline) ? deadline - now : 0;
+        }
+#endif
+        if (nrevents == -1 && errno == EINTR)
+            nrevents = 0;
     }
     assert(nrevents >= 0);
     if (nrevents > 0) {
-        for (int i = 0; i < nrevents; i++)
-            ready_set |= (1ULL << (uintptr_t)revents[i].udata);
+        int orig_nrevents = nrevents;
+        for (int i = 0; i < orig_nrevents; i++)
+            if (revents[i].filter == EVFILT_TIMER)
+                nrevents -= 1;          /* Disregard in total reported events */
+            else
+                ready_set |= (1ULL << (uintptr_t)revents[i].udata);
     }
 #endif
     t->ready_set = ready_set;
+    t->writable_set = writable_set;
     t->ret = nrevents;
+    TENDER_PROBE2(poll__wake, ready_set, writable_set);
+}
+
+#if defined(__linux__)
+static void *page_thread_fn(void *arg)
+{
+    struct epoll_event revents[64];
+
+    (void)arg;
+    for (;;) {
+        int nrevents = epoll_wait(page_waitsetfd, revents, 64, -1);
+        if (nrevents == -1) {
+            if (errno == EINTR)
+                continue;
+            err(1, "epoll_wait() failed");
+        }
+        uint64_t ready_set = 0;
+        for (int i = 0; i < nrevents; i++)
+            ready_set |= 1ULL << revents[i].data.u64;
+        __atomic_fetch_or(&poll_page->ready_set, ready_set, __ATOMIC_RELEASE);
+        __atomic_fetch_add(&poll_page->seq, 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+static void page_arm(uint64_t handle, int op)
+{
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    ev.data.u64 = handle;
+    if (epoll_ctl(page_waitsetfd, op, page_fds[handle], &ev) == -1)
+        err(1, "epoll_ctl() failed");
+}
+
+static void page_disarm(uint64_t handle)
+{
+    struct epoll_event ev;
+    ev.events = 0;
+    ev.data.u64 = handle;
+    if (epoll_ctl(page_waitsetfd, EPOLL_CTL_MOD, page_fds[handle], &ev) == -1)
+        err(1, "epoll_ctl() failed");
+}
+
+static void poll_page_start(struct hvt *hvt, hvt_gpa_t gpa)
+{
+    /*
+     * Published atomically for reclaim_handler().
+     */
+    __atomic_store_n(&poll_page, HVT_CHECKED_GPA_P(hvt, gpa,
+                sizeof (struct hvt_poll_page)), __ATOMIC_RELEASE);
+
+    page_waitsetfd = epoll_create1(EPOLL_CLOEXEC);
+    if (page_waitsetfd == -1)
+        err(1, "Could not create wait set");
+    for (uint64_t i = 0; i != 64; i++) {
+        if (page_handles & (1ULL << i)) {
+            page_arm(i, EPOLL_CTL_ADD);
+            if (paused_handles & (1ULL << i))
+                page_disarm(i);
+        }
+    }
+
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    if (pthread_create(&page_thread, NULL, page_thread_fn, NULL) != 0)
+        errx(1, "Could not create readiness page thread");
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+static void hypercall_poll_page(struct hvt *hvt, hvt_gpa_t gpa)
+{
+    struct hvt_hc_poll_page *pg =
+        HVT_CHECKED_GPA_P(hvt, gpa, sizeof (struct hvt_hc_poll_page));
+
+    if (poll_page != NULL || (pg->page & 7) != 0) {
+        pg->ret = SOLO5_R_EINVAL;
+        return;
+    }
+    poll_page_start(hvt, pg->page);
+    pg->ret = SOLO5_R_OK;
+}
+
+/*
+ * SIGUSR2 asks the guest to release unused memory, by counting a request in
+ * the readiness page. Requests made before the guest has registered it are
+ * dropped, as the guest has not started running the application yet.
+ */
+static void reclaim_handler(int signo)
+{
+    struct hvt_poll_page *p = __atomic_load_n(&poll_page, __ATOMIC_ACQUIRE);
+
+    (void)signo;
+    if (p != NULL)
+        __atomic_fetch_add(&p->reclaim_seq, 1, __ATOMIC_RELAXED);
+}
+#endif
+
+static void hypercall_boot_report(struct hvt *hvt, hvt_gpa_t gpa)
+{
+    struct hvt_hc_boot_report *br =
+        HVT_CHECKED_GPA_P(hvt, gpa, sizeof (struct hvt_hc_boot_report));
+
+    hvt->core->boot_report = *br;
+    hvt->core->boot_reported = true;
+}
+
+const struct hvt_hc_boot_report *hvt_core_boot_report(struct hvt *hvt)
+{
+    return hvt->core->boot_reported ? &hvt->core->boot_report : NULL;
+}
+
+static void hypercall_mem_release(struct hvt *hvt, hvt_gpa_t gpa)
+{
+    struct hvt_hc_mem_release *r =
+        HVT_CHECKED_GPA_P(hvt, gpa, sizeof (struct hvt_hc_mem_release));
+    uint8_t *data = HVT_CHECKED_GPA_P(hvt, r->data, r->len);
+
+    /*
+     * Pinned memory cannot be given back to the host, see
+     * hvt_module_pci.c.
+     */
+    if (hvt->mem_pinned) {
+        r->ret = SOLO5_R_EUNSPEC;
+        return;
+    }
+    /*
+     * Only whole host pages can be released, and the rest of the range is
+     * left alone.
+     */
+    uint64_t page_size = sysconf(_SC_PAGESIZE);
+    hvt_gpa_t start = (r->data + page_size - 1) & ~(page_size - 1);
+    hvt_gpa_t end = (r->data + r->len) & ~(page_size - 1);
+    r->ret = SOLO5_R_OK;
+    if (end > start &&
+            mem_release(data + (start - r->data), end - start) == -1)
+        r->ret = SOLO5_R_EUNSPEC;
+}
+
+void hvt_core_pollfd_consumed(uintptr_t waitset_data)
+{
+#if defined(__linux__)
+    if (poll_page == NULL || !(page_handles & (1ULL << waitset_data)))
+        return;
+    /*
+     * Only pollfds which have been published are disarmed. Clearing the bit
+     * before re-arming ensures that if the pollfd is still ready, its bit
+     * will be set again.
+     */
+    uint64_t bit = 1ULL << waitset_data;
+    if ((__atomic_fetch_and(&poll_page->ready_set, ~bit, __ATOMIC_ACQ_REL) &
+            bit) && !(paused_handles & bit))
+        page_arm(waitset_data, EPOLL_CTL_MOD);
+#else
+    (void)waitset_data;
+#endif
+}
+
+#if defined(__linux__)
+/*
+ * Updates the events the main wait set watches the pollfd for (waitset_data)
+ * for. Must be called with (watch_lock) held.
+ */
+static void waitset_watch(uintptr_t waitset_data)
+{
+    uint64_t bit = 1ULL << waitset_data;
+    struct epoll_event ev;
+    ev.events = ((paused_handles & bit) ? 0 : EPOLLIN) |
+        ((write_handles & bit) ? EPOLLOUT : 0);
+    ev.data.u64 = waitset_data;
+    if (epoll_ctl(waitsetfd, EPOLL_CTL_MOD, page_fds[waitset_data], &ev)
+            == -1)
+        err(1, "epoll_ctl() failed");
+}
+
+void hvt_core_pollfd_want_write(uintptr_t waitset_data)
+{
+    uint64_t bit = 1ULL << waitset_data;
+    if (!(page_handles & bit))
+        return;
+    pthread_mutex_lock(&watch_lock);
+    if (!(write_handles & bit)) {
+        write_handles |= bit;
+        waitset_watch(waitset_data);
+    }
+    pthread_mutex_unlock(&watch_lock);
+}
+
+/*
+ * Called by hypercall_poll() once the pollfd for (waitset_data) has been
+ * reported as writable, to stop watching it for writability.
+ */
+static void write_done(uintptr_t waitset_data)
+{
+    uint64_t bit = 1ULL << waitset_data;
+    pthread_mutex_lock(&watch_lock);
+    if (write_handles & bit) {
+        write_handles &= ~bit;
+        waitset_watch(waitset_data);
+    }
+    pthread_mutex_unlock(&watch_lock);
+}
+
+void hvt_core_pollfd_pause(uintptr_t waitset_data)
+{
+    assert(page_handles & (1ULL << waitset_data));
+    uint64_t bit = 1ULL << waitset_data;
+    if (paused_handles & bit)
+        return;
+    pthread_mutex_lock(&watch_lock);
+    paused_handles |= bit;
+    waitset_watch(waitset_data);
+    pthread_mutex_unlock(&watch_lock);
+    if (poll_page == NULL)
+        return;
+    /*
+     * Disarm before clearing the bit, so that (page_thread) cannot publish
+     * the pollfd again in between.
+     */
+    page_disarm(waitset_data);
+    __atomic_fetch_and(&poll_page->ready_set, ~bit, __ATOMIC_ACQ_REL);
+}
+
+void hvt_core_pollfd_resume(uintptr_t waitset_data)
+{
+    uint64_t bit = 1ULL << waitset_data;
+    if (!(paused_handles & bit))
+        return;
+    pthread_mutex_lock(&watch_lock);
+    paused_handles &= ~bit;
+    waitset_watch(waitset_data);
+    pthread_mutex_unlock(&watch_lock);
+    if (poll_page != NULL)
+        page_arm(waitset_data, EPOLL_CTL_MOD);
+}
+#endif
+
+void hvt_core_save(struct hvt *hvt, struct hvt_core_state *s)
+{
+    s->time_page = time_page ? (uint8_t *)time_page - hvt->mem : 0;
+    s->cycles = host_cycles() + time_page_offset;
+    s->block_buffers = hvt->block_buffers;
+#if defined(__linux__)
+    s->poll_page = poll_page ? (uint8_t *)poll_page - hvt->mem : 0;
+#else
+    s->poll_page = 0;
+#endif
+}
+
+void hvt_core_restore(struct hvt *hvt, const struct hvt_core_state *s)
+{
+    if (s->time_page != 0) {
+        struct hvt_time_page *tp = HVT_CHECKED_GPA_P(hvt, s->time_page,
+                sizeof (struct hvt_time_page));
+        /*
+         * The page may have been saved while being updated.
+         */
+        tp->seq = (tp->seq + 1) & ~1ULL;
+        time_page_start(hvt, s->time_page, s->cycles);
+    }
+#if defined(__linux__)
+    /*
+     * Readiness published in the page may be stale, which the guest treats
+     * as spurious. Devices which are ready are published again once armed.
+     */
+    if (s->poll_page != 0)
+        poll_page_start(hvt, s->poll_page);
+#else
+    if (s->poll_page != 0)
+        errx(1, "Guest uses a readiness page, not supported on this host");
+#endif
+
+    hvt->block_buffers = s->block_buffers;
+    for (int i = 0; i < hvt->core->nr_restore_hooks; i++)
+        hvt->core->restore_hooks[i](hvt);
+}
+
+void hvt_core_reset(struct hvt *hvt)
+{
+    /*
+     * Both threads only act on cancellation while waiting, never part way
+     * through updating a page.
+     */
+    if (time_page != NULL) {
+        pthread_cancel(time_thread);
+        pthread_join(time_thread, NULL);
+        time_page = NULL;
+    }
+#if defined(__linux__)
+    if (poll_page != NULL) {
+        pthread_cancel(page_thread);
+        pthread_join(page_thread, NULL);
+        close(page_waitsetfd);
+        page_waitsetfd = -1;
+        __atomic_store_n(&poll_page, NULL, __ATOMIC_RELEASE);
+    }
+#endif
+    pthread_mutex_lock(&console_lock);
+    console_ring = NULL;
+    console_ring_gpa = 0;
+    pthread_mutex_unlock(&console_lock);
+
+    for (int i = 0; i < hvt->core->nr_reset_hooks; i++)
+        hvt->core->reset_hooks[i](hvt);
 }
 
 static int setup(struct hvt *hvt, struct mft *mft)
 {
+    on_boot_vcpu = true;
     if (waitsetfd == -1)
         setup_waitset();
 
-    assert(hvt_core_register_hypercall(HVT_HYPERCALL_WALLTIME,
+    /*
+     * HVT_HYPERCALL_POLL shares (timerfd) between VCPUs. A guest polling on
+     * several VCPUs at once will see incorrect timeouts, but nothing worse.
+     */
+    assert(hvt_core_register_hypercall_mt(hvt, HVT_HYPERCALL_WALLTIME,
                 hypercall_walltime) == 0);
-    assert(hvt_core_register_hypercall(HVT_HYPERCALL_PUTS,
+    assert(hvt_core_register_hypercall_mt(hvt, HVT_HYPERCALL_PUTS,
                 hypercall_puts) == 0);
-    assert(hvt_core_register_hypercall(HVT_HYPERCALL_POLL,
+    assert(hvt_core_register_hypercall(hvt, HVT_HYPERCALL_CONSOLE_RING,
+                hypercall_console_ring) == 0);
+    hvt->features |= HVT_FEATURE_CONSOLE_RING;
+    assert(hvt_core_register_hypercall_mt(hvt, HVT_HYPERCALL_POLL,
                 hypercall_poll) == 0);
+    assert(hvt_core_register_hypercall(hvt, HVT_HYPERCALL_TIME_PAGE,
+                hypercall_time_page) == 0);
+    hvt->features |= HVT_FEATURE_TIME_PAGE;
+#if defined(__linux__)
+    assert(hvt_core_register_hypercall(hvt, HVT_HYPERCALL_POLL_PAGE,
+                hypercall_poll_page) == 0);
+    hvt->features |= HVT_FEATURE_POLL_PAGE;
+
+    if (hvt->irqchip) {
+        wake_start(hvt);
+        hvt->features |= HVT_FEATURE_IRQCHIP;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof (struct sigaction));
+    sa.sa_handler = reclaim_handler;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGUSR2, &sa, NULL) == -1)
+        err(1, "Could not install signal handler");
+#endif
+    assert(hvt_core_register_hypercall(hvt, HVT_HYPERCALL_BOOT_REPORT,
+                hypercall_boot_report) == 0);
+    assert(hvt_core_register_hypercall_mt(hvt, HVT_HYPERCALL_MEM_RELEASE,
+                hypercall_mem_release) == 0);
+    assert(hvt_core_register_hypercall_mt(hvt, HVT_HYPERCALL_MULTI,
+                hypercall_multi) == 0);
+    hvt->features |= HVT_FEATURE_MULTI;
 
     return 0;
 }
 
+static int handle_cmdarg(char *cmdarg, struct mft *mft)
+{
+    if (strncmp("--poll-us=", cmdarg, 10) != 0)
+        return -1;
+
+    unsigned us;
+    int rc = sscanf(cmdarg, "--poll-us=%u", &us);
+    if (rc != 1 || us < 1 || us > POLL_US_MAX)
+        errx(1, "Malformed argument to --poll-us");
+    poll_spin_max_nsecs = us * 1000ULL;
+    return 0;
+}
+
+static char *usage(void)
+{
+    return "--poll-us=N (busy-poll devices for up to N microseconds before "
+        "blocking in solo5_yield())";
+}
+
 DECLARE_MODULE(core,
-    .setup = setup
+    .setup = setup,
+    .handle_cmdarg = handle_cmdarg,
+    .usage = usage
 )
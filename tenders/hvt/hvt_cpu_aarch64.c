@@ -32,8 +32,11 @@
 #include "hvt_cpu_aarch64.h"
 
 /*
- * We will do VA = PA mapping in page table. For simplicity, currently
- * we use minimal 2MB block size and 1 PUD table in page table.
+ * We will do VA = PA mapping in page table, with 1 PUD table. The first GB
+ * is mapped by PMD0, using the PTE table for the first 2MB and 2MB blocks
+ * for the rest. Each further whole GB is mapped with a single 1GB block in
+ * the PUD table, which the 4KB granule allows at level 1; a trailing partial
+ * GB uses 2MB blocks from the next PMD table.
  */
 void aarch64_setup_memory_mapping(uint8_t *mem, uint64_t mem_size)
 {
@@ -84,22 +87,32 @@ void aarch64_setup_memory_mapping(uint8_t *mem, uint64_t mem_size)
     }
     assert(paddr == AARCH64_GUEST_BLOCK_SIZE);
 
-    /* Link pte table to pmd[0] */
+    /* Link pte table to pmd[0], and pmd table PMD0 to pud[0] */
     *pmd++ = AARCH64_PTE_PGT_BASE | PGT_DESC_TYPE_TABLE;
+    *pud++ = AARCH64_PMD_PGT_BASE | PGT_DESC_TYPE_TABLE;
 
-    /* Mapping left memory by 2MB block in pmd table */
-    for (; paddr < mem_size; paddr += PMD_SIZE, pmd++)
+    /* Mapping the rest of the first GB by 2MB block in PMD0 */
+    for (; paddr < mem_size && paddr < PUD_SIZE; paddr += PMD_SIZE, pmd++)
         *pmd = paddr | PROT_SECT_NORMAL_EXEC;
 
-    /* Link pmd tables (PMD0, PMD1, PMD2, PMD3) to pud[0] ~ pud[3] */
-    pmd_paddr = AARCH64_PMD_PGT_BASE;
-    for (paddr = 0; paddr < mem_size;
-         paddr += PUD_SIZE, pud++, pmd_paddr += PAGE_SIZE)
-        *pud = pmd_paddr | PGT_DESC_TYPE_TABLE;
+    /*
+     * Mapping each further whole GB by 1GB block in pud table, and any
+     * trailing partial GB by 2MB block in the next pmd table.
+     */
+    pmd_paddr = AARCH64_PMD_PGT_BASE + PAGE_SIZE;
+    for (; paddr + PUD_SIZE <= mem_size; paddr += PUD_SIZE, pud++)
+        *pud = paddr | PROT_SECT_NORMAL_EXEC;
+    if (paddr < mem_size) {
+        *pud++ = pmd_paddr | PGT_DESC_TYPE_TABLE;
+        pmd = (uint64_t *)(mem + pmd_paddr);
+        for (; paddr < mem_size; paddr += PMD_SIZE, pmd++)
+            *pmd = paddr | PROT_SECT_NORMAL_EXEC;
+    }
+    paddr = (paddr + PUD_SIZE - 1) & PUD_MASK;
 
     /* RAM address should not exceed MMIO_BASE */
     assert(paddr <= AARCH64_MMIO_BASE);
-    
+
     /* Mapping MMIO */
     pud += ((AARCH64_MMIO_BASE - paddr) >> PUD_SHIFT);
     for (paddr = AARCH64_MMIO_BASE;
@@ -57,10 +57,8 @@
  *   ...       unused ram
  * 0x010000    hvt_boot_info starts
  * 0x007000    PTE
- * 0x006000    PMD3
- * 0x005000    PMD2
- * 0x004000    PMD1
- * 0x003000    PMD0, 4 pages to cover max 4GB RAM
+ * 0x004000    PMD1 ~ PMD3, only PMD1 used, for a trailing partial GB
+ * 0x003000    PMD0, for the first GB; further GBs use 1GB blocks
  * 0x002000    PUD
  * 0x001000    PGD, memory start for page table
  * 0x000000    unused ram
@@ -25,12 +25,42 @@
 
 #include <err.h>
 #include <assert.h>
+#include <cpuid.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <string.h>
 
 #include "hvt_cpu_x86_64.h"
 
+/*
+ * Returns true if the CPU supports 1GB pages (CPUID.80000001H:EDX.Page1GB).
+ * Guest page tables are walked by the hardware, so this is all that matters
+ * for the guest being able to use them.
+ */
+static bool x86_has_1g_pages(void)
+{
+    unsigned eax, ebx, ecx, edx;
+
+    if (__get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx) == 0)
+        return false;
+    return (edx & (1U << 26)) != 0;
+}
+
+/*
+ * Returns the maximum guest memory size we can map. A single PDPTE table
+ * covers 512GB; if 1GB pages are not available each GB of guest memory
+ * requires a PDE table, of which we have one at X86_PDE_BASE and
+ * X86_PDE_EXTRA_MAX more below X86_PT0_MAP_START.
+ */
+static uint64_t x86_max_mem_size(void)
+{
+    if (x86_has_1g_pages())
+        return X86_GUEST_HUGE_PAGE_SIZE * 512;
+    else
+        return X86_GUEST_HUGE_PAGE_SIZE * (1 + X86_PDE_EXTRA_MAX);
+}
+
 void hvt_x86_mem_size(size_t *mem_size) {
     size_t mem;
     mem = (*mem_size / X86_GUEST_PAGE_SIZE) * X86_GUEST_PAGE_SIZE;
@@ -39,9 +69,9 @@ void hvt_x86_mem_size(size_t *mem_size) {
         mem = X86_GUEST_PAGE_SIZE;
     if (mem != *mem_size)
         warnx("adjusting memory to %zu bytes", mem);
-    if (mem > X86_GUEST_PAGE_SIZE * 512)
-        errx(1, "guest memory size %zu bytes exceeds the max size %u bytes",
-            mem, X86_GUEST_PAGE_SIZE * 512);
+    if (mem > x86_max_mem_size())
+        errx(1, "guest memory size %zu bytes exceeds the max size %llu bytes",
+            mem, (unsigned long long)x86_max_mem_size());
     *mem_size = mem;
 }
 
@@ -51,16 +81,20 @@ void hvt_x86_setup_pagetables(uint8_t *mem, size_t mem_size)
     uint64_t *pdpte = (uint64_t *)(mem + X86_PDPTE_BASE);
     uint64_t *pde = (uint64_t *)(mem + X86_PDE_BASE);
     uint64_t *pt0e = (uint64_t *)(mem + X86_PT0E_BASE);
+    uint64_t pde_extra = X86_PDE_EXTRA_BASE;
+    bool huge_pages = x86_has_1g_pages();
     uint64_t paddr;
 
     /*
-     * For simplicity we currently use 2MB pages and only a single
-     * PML4/PDPTE/PDE.  Sanity check that the guest size is a multiple of the
-     * page size and will fit in a single PDE (512 entries). Additionally,
-     * check that the guest size is at least 2MB.
+     * We use a single PML4/PDPTE. The first GB of address space is mapped
+     * with 2MB pages by the PDE at X86_PDE_BASE, and the remainder with 1GB
+     * pages if the CPU supports them, otherwise with 2MB pages using
+     * further PDEs. Any remaining partial GB always uses 2MB pages. Sanity
+     * check that the guest size is a multiple of 2MB, at least 2MB, and
+     * will fit.
      */
     assert((mem_size & (X86_GUEST_PAGE_SIZE - 1)) == 0);
-    assert(mem_size <= (X86_GUEST_PAGE_SIZE * 512));
+    assert(mem_size <= x86_max_mem_size());
     assert(mem_size >= X86_GUEST_PAGE_SIZE);
 
     memset(pml4, 0, X86_PML4_SIZE);
@@ -70,6 +104,7 @@ void hvt_x86_setup_pagetables(uint8_t *mem, size_t mem_size)
 
     *pml4 = X86_PDPTE_BASE | (X86_PDPT_P | X86_PDPT_RW);
     *pdpte = X86_PDE_BASE | (X86_PDPT_P | X86_PDPT_RW);
+    pdpte++;
 
     /*
      * PDE[0] is special: use 4kB pages and PT0 for the first 2MB of address
@@ -97,8 +132,27 @@ void hvt_x86_setup_pagetables(uint8_t *mem, size_t mem_size)
             *pt0e = paddr | (X86_PDPT_P | X86_PDPT_RW);
     }
     assert(paddr == X86_GUEST_PAGE_SIZE);
-    for (; paddr < mem_size; paddr += X86_GUEST_PAGE_SIZE, pde++)
+    for (; paddr < mem_size; paddr += X86_GUEST_PAGE_SIZE, pde++) {
+        if ((paddr & (X86_GUEST_HUGE_PAGE_SIZE - 1)) == 0) {
+            /*
+             * Start of a new GB: map it with a 1GB page if we can, otherwise
+             * point its PDPTE at the next free PDE.
+             */
+            if (huge_pages && paddr + X86_GUEST_HUGE_PAGE_SIZE <= mem_size) {
+                *pdpte = paddr | (X86_PDPT_P | X86_PDPT_RW | X86_PDPT_PS);
+                pdpte++;
+                paddr += X86_GUEST_HUGE_PAGE_SIZE - X86_GUEST_PAGE_SIZE;
+                continue;
+            }
+            assert(pde_extra < X86_PT0_MAP_START);
+            pde = (uint64_t *)(mem + pde_extra);
+            memset(pde, 0, X86_PDE_SIZE);
+            *pdpte = pde_extra | (X86_PDPT_P | X86_PDPT_RW);
+            pdpte++;
+            pde_extra += X86_PDE_SIZE;
+        }
         *pde = paddr | (X86_PDPT_P | X86_PDPT_RW | X86_PDPT_PS);
+    }
 }
 
 static struct x86_gdt_desc sreg_to_desc(const struct x86_sreg *sreg)
@@ -71,6 +71,10 @@
 #define X86_CR4_OSXMMEXCPT      _BITUL(X86_CR4_OSXMMEXCPT_BIT)
 #define X86_CR4_VMXE_BIT        13 /* VMX enabled */
 #define X86_CR4_VMXE            _BITUL(X86_CR4_VMXE_BIT)
+#define X86_CR4_FSGSBASE_BIT    16 /* Enable RDFSBASE/WRFSBASE etc. */
+#define X86_CR4_FSGSBASE        _BITUL(X86_CR4_FSGSBASE_BIT)
+#define X86_CR4_OSXSAVE_BIT     18 /* Enable XSAVE and XSETBV/XGETBV */
+#define X86_CR4_OSXSAVE         _BITUL(X86_CR4_OSXSAVE_BIT)
 
 /*
  * Intel SDM section 23.8 "Restrictions on VMX Operation" seems to imply that
@@ -81,6 +85,13 @@
 #define X86_CR4_INIT            (X86_CR4_PAE | X86_CR4_OSFXSR | \
                                 X86_CR4_OSXMMEXCPT)
 
+/*
+ * Backends which can tell that the host supports it also set
+ * X86_CR4_FSGSBASE, so that the guest can change its TLS base with WRFSBASE
+ * rather than by writing an MSR, which exits to the host, and
+ * X86_CR4_OSXSAVE together with an XCR0 enabling AVX/AVX-512 state.
+ */
+
 /*
  * Intel CPU features in EFER
  */
@@ -200,11 +211,14 @@ static const struct x86_sreg hvt_x86_sreg_unusable = {
 #define X86_PDE_SIZE            0x1000
 #define X86_PT0E_BASE           0x5000
 #define X86_PTE_SIZE            0x1000
+#define X86_PDE_EXTRA_BASE      0x6000
+#define X86_PDE_EXTRA_MAX       10
 #define X86_BOOT_INFO_BASE      0x10000
 #define X86_PT0_MAP_START       X86_BOOT_INFO_BASE
 #define X86_GUEST_MIN_BASE      0x100000
 
 #define X86_GUEST_PAGE_SIZE     0x200000
+#define X86_GUEST_HUGE_PAGE_SIZE 0x40000000ULL
 
 #define X86_CR3_INIT            X86_PML4_BASE
 
@@ -27,7 +27,9 @@
 #include <err.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <pwd.h>
+#include <signal.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -69,14 +71,32 @@ static void cleanup_vmfd(void)
         close(cleanup_hvt->b->vmfd);
 }
 
-struct hvt *hvt_init(size_t mem_size)
+struct hvt *hvt_init(size_t mem_size, unsigned cpus, unsigned mem_flags,
+        unsigned init_flags)
 {
     int ret;
 
+    if (cpus != 1)
+        errx(1, "Only one VCPU is supported on this host");
+    if (init_flags & HVT_INIT_DEDICATED_CORE)
+        errx(1, "--dedicated-core is not supported on this host");
+    if (init_flags & HVT_INIT_IRQCHIP)
+        errx(1, "--irqchip is not supported on this host");
+    if (mem_flags & MEM_HUGEPAGES)
+        errx(1, "--mem-hugepages is not supported on this host");
+    if (mem_flags & MEM_LAZY)
+        errx(1, "--mem-lazy is not supported on this host");
+    if (mem_flags & MEM_MERGEABLE)
+        errx(1, "--mem-mergeable is not supported on this host");
+    if (mem_flags & MEM_SHARED)
+        errx(1, "--mem-shared is not supported on this host");
+
     struct hvt *hvt = malloc(sizeof (struct hvt));
     if (hvt == NULL)
         err(1, "malloc");
     memset(hvt, 0, sizeof (struct hvt));
+    hvt->cpus = 1;
+    hvt->mem_fd = -1;
     struct hvt_b *hvb = malloc(sizeof (struct hvt_b));
     if (hvb == NULL)
         err(1, "malloc");
@@ -128,10 +148,62 @@ struct hvt *hvt_init(size_t mem_size)
             hvb->vmfd, 0);
     if (hvt->mem == MAP_FAILED)
         err(1, "mmap");
+    if (mem_flags & (MEM_PREFAULT | MEM_LOCK))
+        mem_prefault(hvt->mem, mem_size);
+    if ((mem_flags & MEM_LOCK) && mem_lock(hvt->mem, mem_size) == -1)
+        err(1, "Could not lock guest memory (RLIMIT_MEMLOCK may be too low)");
     hvt->mem_size = mem_size;
     return hvt;
 }
 
+int hvt_ioeventfd(struct hvt *hvt, int nr, int fd, bool datamatch,
+        uint32_t data)
+{
+    return -1;
+}
+
+/*
+ * The VCPU is interrupted with SIGRTMIN, whose handler does nothing. VM_RUN
+ * returns to the tender with VM_EXITCODE_BOGUS or EINTR if the signal arrives
+ * while the guest is running. Otherwise it is missed, and hvt_core_interrupt()
+ * tries again.
+ */
+static pthread_once_t interrupt_once = PTHREAD_ONCE_INIT;
+
+static void interrupt_handler(int signo)
+{
+    (void)signo;
+}
+
+static void interrupt_init(void)
+{
+    struct sigaction sa;
+    memset(&sa, 0, sizeof (struct sigaction));
+    sa.sa_handler = interrupt_handler;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGRTMIN, &sa, NULL) == -1)
+        err(1, "Could not install signal handler");
+}
+
+int hvt_vcpu_interrupt(struct hvt *hvt)
+{
+    pthread_once(&interrupt_once, interrupt_init);
+    if (pthread_kill(hvt->b->boot_thread, SIGRTMIN) != 0)
+        return -1;
+    return 0;
+}
+
+int hvt_dirty_log_enable(struct hvt *hvt)
+{
+    return -1;
+}
+
+int hvt_dirty_log_get(struct hvt *hvt, uint64_t *bitmap)
+{
+    return -1;
+}
+
 #if HVT_DROP_PRIVILEGES
 void hvt_drop_privileges()
 {
@@ -25,6 +25,8 @@
 #ifndef HVT_HV_FREEBSD_H
 #define HVT_HV_FREEBSD_H
 
+#include <pthread.h>
+
 #define VMM_USER      "nobody"
 #define VMM_CHROOT    "/var/empty"
 
@@ -32,6 +34,7 @@ struct hvt_b {
     char *vmname;
     int vmfd;
     struct vm_run vmrun;
+    pthread_t boot_thread;              /* Thread running the VCPU */
 };
 
 #endif /* HVT_HV_FREEBSD_H */
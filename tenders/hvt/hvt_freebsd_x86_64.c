@@ -97,6 +97,8 @@ void hvt_vcpu_init(struct hvt *hvt, hvt_gpa_t gpa_ep)
 {
     struct hvt_b *hvb = hvt->b;
 
+    hvb->boot_thread = pthread_self();
+
     hvt_x86_setup_gdt(hvt->mem);
     hvt_x86_setup_pagetables(hvt->mem, hvt->mem_size);
 
@@ -166,17 +168,18 @@ int hvt_vcpu_loop(struct hvt *hvt)
 
     while (1) {
         ret = ioctl(hvt->b->vmfd, VM_RUN, &hvb->vmrun);
-        if (ret == -1 && errno == EINTR)
+        if (ret == -1 && errno == EINTR) {
+            hvt_core_interrupted(hvt);
             continue;
+        }
         if (ret == -1) {
             err(1, "VM_RUN");
         }
 
-        int handled = 0;
-        for (hvt_vmexit_fn_t *fn = hvt_core_vmexits; *fn && !handled; fn++)
-            handled = ((*fn)(hvt) == 0);
-        if (handled)
+        if (hvt_core_vmexit(hvt) == 0) {
+            hvt_core_exit(hvt, hvb->vmrun.vm_exit.exitcode);
             continue;
+        }
 
         struct vm_exit *vme = &hvb->vmrun.vm_exit;
 
@@ -198,12 +201,8 @@ int hvt_vcpu_loop(struct hvt *hvt)
                 return hvt_core_hypercall_halt(hvt, gpa);
             }
 
-            hvt_hypercall_fn_t fn = hvt_core_hypercalls[nr];
-            if (fn == NULL)
-                errx(1, "Invalid guest hypercall: num=%d", nr);
-
             hvt_gpa_t gpa = vme->u.inout.eax;
-            fn(hvt, gpa);
+            hvt_core_hypercall(hvt, nr, gpa);
             break;
         }
 
@@ -213,6 +212,12 @@ int hvt_vcpu_loop(struct hvt *hvt)
              * bhyve does.
              */
              assert(vme->inst_length == 0);
+             hvt_core_exit(hvt, vme->exitcode);
+             /*
+              * This is also how VM_RUN returns when hvt_vcpu_interrupt()
+              * signals the VCPU thread.
+              */
+             hvt_core_interrupted(hvt);
              break;
         }
 
@@ -228,3 +233,29 @@ int hvt_vcpu_loop(struct hvt *hvt)
         } /* switch(vme->exitcode) */
     }
 }
+
+int hvt_vcpu_get_frame(struct hvt *hvt, uint64_t *pc, uint64_t *fp)
+{
+    struct vm_register vmreg = {
+        .cpuid = 0, .regnum = VM_REG_GUEST_RIP
+    };
+
+    if (ioctl(hvt->b->vmfd, VM_GET_REGISTER, &vmreg) == -1)
+        return -1;
+    *pc = vmreg.regval;
+    vmreg.regnum = VM_REG_GUEST_RBP;
+    if (ioctl(hvt->b->vmfd, VM_GET_REGISTER, &vmreg) == -1)
+        return -1;
+    *fp = vmreg.regval;
+    return 0;
+}
+
+int hvt_vcpu_save(struct hvt *hvt, int fd)
+{
+    return -1;
+}
+
+int hvt_vcpu_restore(struct hvt *hvt, int fd)
+{
+    return -1;
+}
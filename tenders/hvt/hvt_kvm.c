@@ -26,6 +26,8 @@
 #include <assert.h>
 #include <err.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <string.h>
@@ -36,10 +38,29 @@
 #include "hvt.h"
 #include "hvt_kvm.h"
 
-struct hvt *hvt_init(size_t mem_size)
+#if defined(__x86_64__)
+/*
+ * Start of the I/O APIC, followed by the local APIC, with --irqchip.
+ */
+#define IRQCHIP_MEM_MAX         0xfec00000ULL
+/*
+ * GSI through which the eventfd passed to hvt_irqfd() raises its MSI, and
+ * the MSI address of the local APIC with ID 0, in physical destination mode.
+ */
+#define IRQCHIP_GSI             0
+#define IRQCHIP_MSI_ADDR        0xfee00000U
+#endif
+
+struct hvt *hvt_init(size_t mem_size, unsigned cpus, unsigned mem_flags,
+        unsigned init_flags)
 {
     int ret;
 
+#if !defined(__x86_64__)
+    if (cpus != 1)
+        errx(1, "Only one VCPU is supported on this architecture");
+#endif
+
     struct hvt *hvt = malloc(sizeof (struct hvt));
     if (hvt == NULL)
         err(1, "malloc");
@@ -61,25 +82,108 @@ struct hvt *hvt_init(size_t mem_size)
     if (hvb->vmfd == -1)
         err(1, "KVM: ioctl (CREATE_VM) failed");
 
-    hvb->vcpufd = ioctl(hvb->vmfd, KVM_CREATE_VCPU, 0);
-    if (hvb->vcpufd == -1)
-        err(1, "KVM: ioctl (CREATE_VCPU) failed");
+    /*
+     * With a host CPU to itself, the VCPU gains nothing by exiting to let the
+     * host run something else when the guest halts or spins, so it no longer
+     * does. This must be done before any VCPU is created.
+     */
+    if (init_flags & HVT_INIT_DEDICATED_CORE) {
+#if defined(__x86_64__)
+        int want = KVM_X86_DISABLE_EXITS_HLT | KVM_X86_DISABLE_EXITS_PAUSE;
+        ret = ioctl(hvb->kvmfd, KVM_CHECK_EXTENSION,
+                KVM_CAP_X86_DISABLE_EXITS);
+        if (ret <= 0 || (ret & want) != want)
+            errx(1, "--dedicated-core: host cannot disable HLT and PAUSE "
+                    "exits");
+        want |= ret & KVM_X86_DISABLE_EXITS_MWAIT;
+        struct kvm_enable_cap cap = {
+            .cap = KVM_CAP_X86_DISABLE_EXITS,
+            .args[0] = want
+        };
+        if (ioctl(hvb->vmfd, KVM_ENABLE_CAP, &cap) == -1)
+            err(1, "KVM: ioctl (ENABLE_CAP) failed");
+#else
+        errx(1, "--dedicated-core is not supported on this architecture");
+#endif
+    }
+
+    /*
+     * The in-kernel irqchip must be created before any VCPU, and its local
+     * APIC and I/O APIC are at the top of the 32-bit address space, which
+     * guest memory must therefore stay below.
+     */
+    if (init_flags & HVT_INIT_IRQCHIP) {
+#if defined(__x86_64__)
+        if (mem_size > IRQCHIP_MEM_MAX)
+            errx(1, "--irqchip: guest memory cannot exceed %llu bytes",
+                    (unsigned long long)IRQCHIP_MEM_MAX);
+        if (ioctl(hvb->kvmfd, KVM_CHECK_EXTENSION, KVM_CAP_IRQFD) <= 0 ||
+                ioctl(hvb->kvmfd, KVM_CHECK_EXTENSION,
+                    KVM_CAP_IRQ_ROUTING) <= 0 ||
+                ioctl(hvb->kvmfd, KVM_CHECK_EXTENSION,
+                    KVM_CAP_TSC_DEADLINE_TIMER) <= 0)
+            errx(1, "--irqchip: host does not support irqfd, MSI routing or "
+                    "the TSC-deadline timer");
+        if (ioctl(hvb->vmfd, KVM_CREATE_IRQCHIP, 0) == -1)
+            err(1, "KVM: ioctl (CREATE_IRQCHIP) failed");
+        hvt->irqchip = true;
+#else
+        errx(1, "--irqchip is not supported on this architecture");
+#endif
+    }
+
     size_t runsize = ioctl(hvb->kvmfd, KVM_GET_VCPU_MMAP_SIZE, NULL);
     if (runsize == (size_t)-1)
         err(1, "KVM: ioctl (GET_VCPU_MMAP_SIZE) failed");
     if (runsize < sizeof(*hvb->vcpurun))
         errx(1, "KVM: invalid VCPU_MMAP_SIZE: %zd", runsize);
-    hvb->vcpurun =
-        mmap(NULL, runsize, PROT_READ | PROT_WRITE, MAP_SHARED, hvb->vcpufd,
-             0);
-    if (hvb->vcpurun == MAP_FAILED)
-        err(1, "KVM: VCPU mmap failed");
-
-    hvt->mem = mmap(NULL, mem_size, PROT_READ | PROT_WRITE,
-               MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    hvb->vcpufds = calloc(cpus, sizeof (int));
+    hvb->vcpuruns = calloc(cpus, sizeof (struct kvm_run *));
+    if (hvb->vcpufds == NULL || hvb->vcpuruns == NULL)
+        err(1, "calloc");
+    for (unsigned i = 0; i < cpus; i++) {
+        hvb->vcpufds[i] = ioctl(hvb->vmfd, KVM_CREATE_VCPU, i);
+        if (hvb->vcpufds[i] == -1)
+            err(1, "KVM: ioctl (CREATE_VCPU) failed");
+        hvb->vcpuruns[i] =
+            mmap(NULL, runsize, PROT_READ | PROT_WRITE, MAP_SHARED,
+                 hvb->vcpufds[i], 0);
+        if (hvb->vcpuruns[i] == MAP_FAILED)
+            err(1, "KVM: VCPU mmap failed");
+    }
+    hvb->vcpufd = hvb->vcpufds[0];
+    hvb->vcpurun = hvb->vcpuruns[0];
+
+    /*
+     * Only private mappings can have their pages merged. With --mem-shared,
+     * guest memory is a mapping of a file which can be passed to other
+     * processes.
+     */
+    int flags = ((mem_flags & MEM_MERGEABLE) ? MAP_PRIVATE : MAP_SHARED) |
+        mem_mmap_flags(mem_flags);
+    hvt->mem_fd = -1;
+    if (mem_flags & MEM_SHARED) {
+        hvt->mem_fd = mem_shared_fd(mem_size);
+        if (hvt->mem_fd == -1)
+            err(1, "Error allocating shared guest memory");
+    }
+    else
+        flags |= MAP_ANONYMOUS;
+    hvt->mem = mem_map(mem_size, PROT_READ | PROT_WRITE, flags, hvt->mem_fd);
     if (hvt->mem == MAP_FAILED)
         err(1, "Error allocating guest memory");
+    if ((mem_flags & MEM_HUGEPAGES) && mem_hugepages(hvt->mem, mem_size,
+                PROT_READ | PROT_WRITE, flags) == -1)
+        warnx("Huge pages are not supported by the host, not using them");
+    if ((mem_flags & MEM_MERGEABLE) && mem_mergeable(hvt->mem, mem_size) == -1)
+        warnx("Page merging is not supported by the host, not using it");
+    affinity_bind_mem(hvt->mem, mem_size);
+    if (mem_flags & (MEM_PREFAULT | MEM_LOCK))
+        mem_prefault(hvt->mem, mem_size);
+    if ((mem_flags & MEM_LOCK) && mem_lock(hvt->mem, mem_size) == -1)
+        err(1, "Could not lock guest memory (RLIMIT_MEMLOCK may be too low)");
     hvt->mem_size = mem_size;
+    hvt->cpus = cpus;
 
     struct kvm_userspace_memory_region region = {
         .slot = 0,
@@ -95,6 +199,136 @@ struct hvt *hvt_init(size_t mem_size)
     return hvt;
 }
 
+int hvt_ioeventfd(struct hvt *hvt, int nr, int fd, bool datamatch,
+        uint32_t data)
+{
+    struct kvm_ioeventfd ioev = {
+        .datamatch = data,
+        .len = 4,
+        .fd = fd,
+        .flags = datamatch ? KVM_IOEVENTFD_FLAG_DATAMATCH : 0,
+    };
+#if defined(__x86_64__)
+    ioev.addr = HVT_HYPERCALL_PIO_BASE + nr;
+    ioev.flags |= KVM_IOEVENTFD_FLAG_PIO;
+#elif defined(__aarch64__)
+    ioev.addr = HVT_HYPERCALL_ADDRESS(nr);
+#endif
+    if (ioctl(hvt->b->vmfd, KVM_IOEVENTFD, &ioev) == -1) {
+        warn("KVM: ioctl (IOEVENTFD) failed");
+        return -1;
+    }
+    return 0;
+}
+
+int hvt_irqfd(struct hvt *hvt, int fd)
+{
+#if defined(__x86_64__)
+    /*
+     * Replaces the default routing of GSIs to the PIC and I/O APIC, which
+     * the guest does not use, with a single MSI to the local APIC of the boot
+     * VCPU, whose ID is 0.
+     */
+    struct {
+        struct kvm_irq_routing info;
+        struct kvm_irq_routing_entry entries[1];
+    } routing = {
+        .info.nr = 1,
+        .entries[0] = {
+            .gsi = IRQCHIP_GSI,
+            .type = KVM_IRQ_ROUTING_MSI,
+            .u.msi = {
+                .address_lo = IRQCHIP_MSI_ADDR,
+                .data = HVT_IRQCHIP_VECTOR
+            }
+        }
+    };
+    if (ioctl(hvt->b->vmfd, KVM_SET_GSI_ROUTING, &routing) == -1) {
+        warn("KVM: ioctl (SET_GSI_ROUTING) failed");
+        return -1;
+    }
+    struct kvm_irqfd irqfd = {
+        .fd = fd,
+        .gsi = IRQCHIP_GSI
+    };
+    if (ioctl(hvt->b->vmfd, KVM_IRQFD, &irqfd) == -1) {
+        warn("KVM: ioctl (IRQFD) failed");
+        return -1;
+    }
+    return 0;
+#else
+    (void)hvt;
+    (void)fd;
+    return -1;
+#endif
+}
+
+/*
+ * The boot VCPU is interrupted with SIGRTMIN, whose handler does nothing, so
+ * that KVM_RUN or a system call blocking in the tender returns with EINTR.
+ * With immediate_exit set, KVM_RUN also does so if the signal arrived before
+ * it was entered.
+ */
+static pthread_once_t interrupt_once = PTHREAD_ONCE_INIT;
+
+static void interrupt_handler(int signo)
+{
+    (void)signo;
+}
+
+static void interrupt_init(void)
+{
+    struct sigaction sa;
+    memset(&sa, 0, sizeof (struct sigaction));
+    sa.sa_handler = interrupt_handler;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGRTMIN, &sa, NULL) == -1)
+        err(1, "Could not install signal handler");
+}
+
+int hvt_vcpu_interrupt(struct hvt *hvt)
+{
+    struct hvt_b *hvb = hvt->b;
+
+    if (ioctl(hvb->kvmfd, KVM_CHECK_EXTENSION, KVM_CAP_IMMEDIATE_EXIT) <= 0)
+        return -1;
+    pthread_once(&interrupt_once, interrupt_init);
+    __atomic_store_n(&hvb->vcpurun->immediate_exit, 1, __ATOMIC_RELEASE);
+    if (pthread_kill(hvb->boot_thread, SIGRTMIN) != 0)
+        return -1;
+    return 0;
+}
+
+int hvt_dirty_log_enable(struct hvt *hvt)
+{
+    struct kvm_userspace_memory_region region = {
+        .slot = 0,
+        .flags = KVM_MEM_LOG_DIRTY_PAGES,
+        .guest_phys_addr = 0,
+        .memory_size = hvt->mem_size,
+        .userspace_addr = (uint64_t)hvt->mem,
+    };
+    if (ioctl(hvt->b->vmfd, KVM_SET_USER_MEMORY_REGION, &region) == -1) {
+        warn("KVM: ioctl (SET_USER_MEMORY_REGION) failed");
+        return -1;
+    }
+    return 0;
+}
+
+int hvt_dirty_log_get(struct hvt *hvt, uint64_t *bitmap)
+{
+    struct kvm_dirty_log log = {
+        .slot = 0,
+        .dirty_bitmap = bitmap
+    };
+    if (ioctl(hvt->b->vmfd, KVM_GET_DIRTY_LOG, &log) == -1) {
+        warn("KVM: ioctl (GET_DIRTY_LOG) failed");
+        return -1;
+    }
+    return 0;
+}
+
 #if HVT_DROP_PRIVILEGES
 void hvt_drop_privileges()
 {
@@ -25,11 +25,16 @@
 #ifndef HVT_HV_KVM_H
 #define HVT_HV_KVM_H
 
+#include <pthread.h>
+
 struct hvt_b {
     int kvmfd;
     int vmfd;
-    int vcpufd;
-    struct kvm_run *vcpurun;
+    int vcpufd;                         /* Boot VCPU, vcpufds[0] */
+    struct kvm_run *vcpurun;            /* Boot VCPU, vcpuruns[0] */
+    int *vcpufds;                       /* All VCPUs, [hvt->cpus] */
+    struct kvm_run **vcpuruns;
+    pthread_t boot_thread;              /* Thread running the boot VCPU */
 };
 
 #endif /* HVT_HV_KVM_H */
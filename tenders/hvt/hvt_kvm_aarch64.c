@@ -28,6 +28,7 @@
 #include <err.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <stdbool.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <string.h>
@@ -73,11 +74,28 @@
 /* Generic Purpose register x0 */
 #define REG_X0              ARM64_CORE_REG(regs.regs[0])
 
+/* Generic Purpose register x1 */
+#define REG_X1              ARM64_CORE_REG(regs.regs[1])
+
+/* Frame pointer, x29 */
+#define REG_FP              ARM64_CORE_REG(regs.regs[29])
+
 /* Architectural Feature Access Control Register EL1 */
 #define CPACR_EL1           ARM64_SYS_REG(3, 0, 1, 0, 2)
 #define _FPEN_NOTRAP        0x3
 #define _FPEN_SHIFT         20
 #define _FPEN_MASK          GENMASK32(21, 20)
+#define _ZEN_NOTRAP         0x3
+#define _ZEN_SHIFT          16
+#define _ZEN_MASK           GENMASK32(17, 16)
+
+/*
+ * SVE Control Register EL1. The vector length used at EL1 is the largest
+ * supported one up to (LEN + 1) * 128 bits; KVM limits it further to the
+ * vector lengths enabled for the VCPU.
+ */
+#define ZCR_EL1             ARM64_SYS_REG(3, 0, 1, 2, 0)
+#define _ZCR_LEN_MAX        0xf
 
 /* Memory Attribute Indirection Register EL1 */
 #define MAIR_EL1            ARM64_SYS_REG(3, 0, 10, 2, 0)
@@ -172,35 +190,127 @@ static int aarch64_get_one_register(int vcpufd, uint64_t id, uint64_t *pdata)
     return ioctl(vcpufd, KVM_GET_ONE_REG, &one_reg);
 }
 
-static void aarch64_enable_guest_float(int vcpufd)
+static void aarch64_enable_guest_float(int vcpufd, bool sve)
 {
     int ret;
     uint64_t data;
 
-    /* Enable the floating-point and Advanced SIMD registers for Guest */
+    /*
+     * Enable the floating-point and Advanced SIMD registers for Guest, and
+     * the SVE registers if SVE was enabled for the VCPU, without trapping.
+     */
     ret = aarch64_get_one_register(vcpufd, CPACR_EL1, &data);
     if (ret == -1)
          err(1, "KVM: Get Architectural Feature Access Control Register failed");
 
     data &= ~(_FPEN_MASK);
     data |= (_FPEN_NOTRAP << _FPEN_SHIFT);
+    if (sve) {
+        data &= ~(_ZEN_MASK);
+        data |= (_ZEN_NOTRAP << _ZEN_SHIFT);
+    }
     ret = aarch64_set_one_register(vcpufd, CPACR_EL1, data);
     if (ret == -1)
          err(1, "KVM: Enable the floating-point and Advanced SIMD for Guest failed");
+
+    /* Use the largest vector length enabled for the VCPU */
+    if (sve && aarch64_set_one_register(vcpufd, ZCR_EL1, _ZCR_LEN_MAX) == -1)
+        err(1, "KVM: Set SVE vector length for Guest failed");
 }
 
-static void aarch64_setup_preferred_target(int vmfd, int vcpufd)
+#if defined(KVM_CAP_ARM_SVE)
+/*
+ * Limit the vector lengths the VCPU supports to those of up to (bits), and
+ * finalize its SVE configuration, which must be done before its registers
+ * are accessed.
+ */
+static void aarch64_setup_sve(int vcpufd, unsigned bits)
 {
+    uint64_t vls[KVM_ARM64_SVE_VLS_WORDS];
+    struct kvm_one_reg one_reg = {
+        .id   = KVM_REG_ARM64_SVE_VLS,
+        .addr = (uint64_t)vls,
+    };
+
+    if (ioctl(vcpufd, KVM_GET_ONE_REG, &one_reg) == -1)
+        err(1, "KVM: Get SVE vector lengths failed");
+    bool any = false;
+    for (unsigned vq = KVM_ARM64_SVE_VQ_MIN; vq <= KVM_ARM64_SVE_VQ_MAX;
+            vq++) {
+        unsigned i = vq - KVM_ARM64_SVE_VQ_MIN;
+        if (vq * 128 > bits)
+            vls[i / 64] &= ~(1ULL << (i % 64));
+        else if (vls[i / 64] & (1ULL << (i % 64)))
+            any = true;
+    }
+    if (!any)
+        errx(1, "--sve: host does not support a vector length of %u bits or "
+                "less", bits);
+    if (ioctl(vcpufd, KVM_SET_ONE_REG, &one_reg) == -1)
+        err(1, "KVM: Set SVE vector lengths failed");
+
+    int feature = KVM_ARM_VCPU_SVE;
+    if (ioctl(vcpufd, KVM_ARM_VCPU_FINALIZE, &feature) == -1)
+        err(1, "KVM: ioctl (KVM_ARM_VCPU_FINALIZE) failed");
+}
+#endif
+
+static void aarch64_setup_preferred_target(struct hvt *hvt)
+{
+    struct hvt_b *hvb = hvt->b;
     int ret;
     struct kvm_vcpu_init init;
 
-    ret = ioctl(vmfd, KVM_ARM_PREFERRED_TARGET, &init);
+    ret = ioctl(hvb->vmfd, KVM_ARM_PREFERRED_TARGET, &init);
     if (ret == -1)
         err(1, "KVM: ioctl (KVM_ARM_PREFERRED_TARGET) failed");
 
-    ret = ioctl(vcpufd, KVM_ARM_VCPU_INIT, &init);
+    if (hvt->sve) {
+#if defined(KVM_CAP_ARM_SVE)
+        if (ioctl(hvb->kvmfd, KVM_CHECK_EXTENSION, KVM_CAP_ARM_SVE) <= 0)
+            errx(1, "--sve: host does not support SVE for guests");
+        init.features[0] |= 1U << KVM_ARM_VCPU_SVE;
+#else
+        errx(1, "--sve: not supported by this build of the tender");
+#endif
+    }
+
+    ret = ioctl(hvb->vcpufd, KVM_ARM_VCPU_INIT, &init);
     if (ret == -1)
         err(1, "KVM: ioctl (KVM_ARM_VCPU_INIT) failed");
+
+#if defined(KVM_CAP_ARM_SVE)
+    if (hvt->sve)
+        aarch64_setup_sve(hvb->vcpufd, hvt->sve);
+#endif
+}
+
+/*
+ * Ask KVM to forward HVCs with our hypercall function IDs to us as
+ * KVM_EXIT_HYPERCALL. This saves decoding a data abort as an MMIO exit on
+ * every hypercall. The filter must be installed before any VCPU has run, and
+ * is only available on Linux 6.4 or later; if it is not, the guest is not
+ * offered HVT_FEATURE_HVC and uses MMIO.
+ */
+static void aarch64_setup_hvc(struct hvt *hvt)
+{
+#ifdef KVM_ARM_VM_SMCCC_FILTER
+    struct kvm_smccc_filter filter = {
+        .base = HVT_HYPERCALL_HVC_BASE,
+        .nr_functions = HVT_HYPERCALL_MAX,
+        .action = KVM_SMCCC_FILTER_FWD_TO_USER
+    };
+    struct kvm_device_attr attr = {
+        .group = KVM_ARM_VM_SMCCC_CTRL,
+        .attr = KVM_ARM_VM_SMCCC_FILTER,
+        .addr = (uint64_t)&filter
+    };
+
+    if (ioctl(hvt->b->vmfd, KVM_SET_DEVICE_ATTR, &attr) == 0)
+        hvt->features |= HVT_FEATURE_HVC;
+#else
+    (void)hvt;
+#endif
 }
 
 static uint64_t aarch64_get_counter_frequency(void)
@@ -298,6 +408,8 @@ void hvt_vcpu_init(struct hvt *hvt, hvt_gpa_t gpa_ep)
 {
     struct hvt_b *hvb = hvt->b;
 
+    hvb->boot_thread = pthread_self();
+
     /*
      * Setup aarch64 phys to virt mapping. Currently we only map 4GB for
      * RAM space and 1GB for MMIO space. Although the guest can use up
@@ -306,9 +418,11 @@ void hvt_vcpu_init(struct hvt *hvt, hvt_gpa_t gpa_ep)
     aarch64_setup_memory_mapping(hvt->mem, hvt->mem_size);
 
     /* Select preferred target for guest */
-    aarch64_setup_preferred_target(hvb->vmfd, hvb->vcpufd);
+    aarch64_setup_preferred_target(hvt);
+    /* Forward HVC hypercalls to us, if supported */
+    aarch64_setup_hvc(hvt);
     /* Enable float for guest */
-    aarch64_enable_guest_float(hvb->vcpufd);
+    aarch64_enable_guest_float(hvb->vcpufd, hvt->sve != 0);
     /* Enable MMU for guest*/
     aarch64_enable_guest_mmu(hvb->vcpufd);
 
@@ -321,6 +435,14 @@ static inline uint32_t mmio_read32(void *data)
     return *(uint32_t *)data;
 }
 
+int hvt_vcpu_get_frame(struct hvt *hvt, uint64_t *pc, uint64_t *fp)
+{
+    if (aarch64_get_one_register(hvt->b->vcpufd, REG_PC, pc) == -1 ||
+            aarch64_get_one_register(hvt->b->vcpufd, REG_FP, fp) == -1)
+        return -1;
+    return 0;
+}
+
 int hvt_vcpu_loop(struct hvt *hvt)
 {
     struct hvt_b *hvb = hvt->b;
@@ -328,8 +450,12 @@ int hvt_vcpu_loop(struct hvt *hvt)
 
     while (1) {
         ret = ioctl(hvb->vcpufd, KVM_RUN, NULL);
-        if (ret == -1 && errno == EINTR)
+        if (ret == -1 && errno == EINTR) {
+            hvt_core_exit(hvt, KVM_EXIT_INTR);
+            hvb->vcpurun->immediate_exit = 0;
+            hvt_core_interrupted(hvt);
             continue;
+        }
         if (ret == -1) {
             if (errno == EFAULT) {
                 uint64_t pc;
@@ -342,11 +468,10 @@ int hvt_vcpu_loop(struct hvt *hvt)
                 err(1, "KVM: ioctl (RUN) failed");
         }
 
-        int handled = 0;
-        for (hvt_vmexit_fn_t *fn = hvt_core_vmexits; *fn && !handled; fn++)
-            handled = ((*fn)(hvt) == 0);
-        if (handled)
+        if (hvt_core_vmexit(hvt) == 0) {
+            hvt_core_exit(hvt, hvb->vcpurun->exit_reason);
             continue;
+        }
 
         struct kvm_run *run = hvb->vcpurun;
 
@@ -367,15 +492,40 @@ int hvt_vcpu_loop(struct hvt *hvt)
                 return hvt_core_hypercall_halt(hvt, gpa);
             }
 
-            hvt_hypercall_fn_t fn = hvt_core_hypercalls[nr];
-            if (fn == NULL)
-                errx(1, "Invalid guest hypercall: num=%d", nr);
-
             hvt_gpa_t gpa = mmio_read32(run->mmio.data);
-            fn(hvt, gpa);
+            hvt_core_hypercall(hvt, nr, gpa);
             break;
         }
 
+#ifdef KVM_ARM_VM_SMCCC_FILTER
+        case KVM_EXIT_HYPERCALL: {
+            /*
+             * KVM has already advanced the PC past the HVC, and leaves x0
+             * (the function ID) as is, which the guest takes as success.
+             */
+            if (run->hypercall.flags & KVM_HYPERCALL_EXIT_SMC)
+                errx(1, "Invalid guest SMC: function=0x%llx",
+                        run->hypercall.nr);
+            if (run->hypercall.nr < HVT_HYPERCALL_HVC_BASE ||
+                run->hypercall.nr >= HVT_HYPERCALL_HVC_ID(HVT_HYPERCALL_MAX))
+                errx(1, "Invalid guest HVC: function=0x%llx",
+                        run->hypercall.nr);
+
+            int nr = run->hypercall.nr - HVT_HYPERCALL_HVC_BASE;
+            uint64_t x1;
+            if (aarch64_get_one_register(hvb->vcpufd, REG_X1, &x1) == -1)
+                err(1, "KVM: Get hypercall argument from x1 failed");
+            hvt_gpa_t gpa = (uint32_t)x1;
+
+            /* Guest has halted the CPU. */
+            if (nr == HVT_HYPERCALL_HALT)
+                return hvt_core_hypercall_halt(hvt, gpa);
+
+            hvt_core_hypercall(hvt, nr, gpa);
+            break;
+        }
+#endif
+
         case KVM_EXIT_FAIL_ENTRY:
             errx(1, "KVM: entry failure: hw_entry_failure_reason=0x%llx",
                  run->fail_entry.hardware_entry_failure_reason);
@@ -399,3 +549,13 @@ int hvt_vcpu_loop(struct hvt *hvt)
 void hvt_mem_size(size_t *mem_size) {
     aarch64_mem_size(mem_size);
 }
+
+int hvt_vcpu_save(struct hvt *hvt, int fd)
+{
+    return -1;
+}
+
+int hvt_vcpu_restore(struct hvt *hvt, int fd)
+{
+    return -1;
+}
@@ -28,24 +28,80 @@
 #include <err.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include <linux/kvm.h>
 
 #include "hvt.h"
 #include "hvt_kvm.h"
 #include "hvt_cpu_x86_64.h"
+#include "solo5.h"
 
 void hvt_mem_size(size_t *mem_size) {
     hvt_x86_mem_size(mem_size);
 }
 
-static void setup_cpuid(struct hvt_b *hvb)
+/*
+ * Extended state components the guest may enable in XCR0: x87, SSE, AVX and
+ * the three AVX-512 components (opmask, ZMM_Hi256, Hi16_ZMM). Anything else,
+ * notably AMX tile state, does not fit in struct kvm_xsave and is not exposed.
+ */
+#define XCR0_X87        (1ULL << 0)
+#define XCR0_SSE        (1ULL << 1)
+#define XCR0_AVX        (1ULL << 2)
+#define XCR0_AVX512     ((1ULL << 5) | (1ULL << 6) | (1ULL << 7))
+#define XCR0_ALLOWED    (XCR0_X87 | XCR0_SSE | XCR0_AVX | XCR0_AVX512)
+
+/*
+ * CPUID feature bits which depend on AVX or AVX-512 state being enabled.
+ */
+#define CPUID_1_ECX_AVX         ((1U << 12) | (1U << 28) | (1U << 29))
+#define CPUID_1_ECX_XSAVE       (1U << 26)
+#define CPUID_7_EBX_AVX         (1U << 5)
+#define CPUID_7_EBX_AVX512      ((1U << 16) | (1U << 17) | (1U << 21) | \
+                                 (1U << 26) | (1U << 27) | (1U << 28) | \
+                                 (1U << 30) | (1U << 31))
+#define CPUID_7_ECX_AVX512      ((1U << 1) | (1U << 6) | (1U << 11) | \
+                                 (1U << 12) | (1U << 14))
+#define CPUID_7_EDX_AVX512      ((1U << 2) | (1U << 3) | (1U << 8) | \
+                                 (1U << 23))
+#define CPUID_7_EDX_AMX         ((1U << 22) | (1U << 24) | (1U << 25))
+
+#define CPUID_1_ECX_TSC_DEADLINE (1U << 24)
+
+struct guest_features {
+    bool fsgsbase;
+    uint64_t xcr0;
+};
+
+/*
+ * Give the VCPU all CPUID features supported by KVM, restricted so that the
+ * extended state features advertised match the XCR0 value returned in
+ * (*gf), which the caller loads into the VCPU.
+ *
+ * KVM gives the VCPU a virtual PMU as described by the architectural
+ * performance monitoring leaf (0xa). Unless asked to with --pmu, hide it, so
+ * that KVM does not emulate the PMU MSRs or switch PMU state around VM
+ * entries.
+ *
+ * KVM emulates the TSC-deadline timer of the in-kernel local APIC, which
+ * older hosts do not include in the supported features, so it is added with
+ * --irqchip.
+ */
+static void setup_cpuid(struct hvt *hvt, int vcpufd,
+        struct guest_features *gf)
 {
+    struct hvt_b *hvb = hvt->b;
     struct kvm_cpuid2 *kvm_cpuid;
     int max_entries = 100;
+    bool xsave = false;
+    bool pmu = false;
+    uint64_t xcr0 = XCR0_X87 | XCR0_SSE;
 
     kvm_cpuid = calloc(1, sizeof(*kvm_cpuid) +
                           max_entries * sizeof(*kvm_cpuid->entries));
@@ -54,9 +110,82 @@ static void setup_cpuid(struct hvt_b *hvb)
 
     if (ioctl(hvb->kvmfd, KVM_GET_SUPPORTED_CPUID, kvm_cpuid) < 0)
         err(1, "KVM: ioctl (GET_SUPPORTED_CPUID) failed");
+    gf->fsgsbase = false;
+    for (unsigned i = 0; i < kvm_cpuid->nent; i++) {
+        struct kvm_cpuid_entry2 *e = &kvm_cpuid->entries[i];
+        if (e->function == 1)
+            xsave = e->ecx & CPUID_1_ECX_XSAVE;
+        else if (e->function == 7 && e->index == 0 && (e->ebx & 1))
+            gf->fsgsbase = true;
+    }
+    for (unsigned i = 0; xsave && i < kvm_cpuid->nent; i++) {
+        struct kvm_cpuid_entry2 *e = &kvm_cpuid->entries[i];
+        if (e->function == 0xd && e->index == 0) {
+            xcr0 = (((uint64_t)e->edx << 32) | e->eax) & XCR0_ALLOWED;
+            if (!(xcr0 & XCR0_AVX) ||
+                    (xcr0 & XCR0_AVX512) != XCR0_AVX512)
+                xcr0 &= ~XCR0_AVX512;
+            xcr0 |= XCR0_X87 | XCR0_SSE;
+        }
+    }
 
-    if (ioctl(hvb->vcpufd, KVM_SET_CPUID2, kvm_cpuid) < 0)
+    /*
+     * Hide whatever the guest cannot use with the state components we
+     * enable, and describe only those components in leaf 0xd.
+     */
+    for (unsigned i = 0; i < kvm_cpuid->nent; i++) {
+        struct kvm_cpuid_entry2 *e = &kvm_cpuid->entries[i];
+        if (e->function == 1 && !(xcr0 & XCR0_AVX))
+            e->ecx &= ~CPUID_1_ECX_AVX;
+        if (e->function == 1 && hvt->irqchip)
+            e->ecx |= CPUID_1_ECX_TSC_DEADLINE;
+        if (e->function == 7 && e->index == 0) {
+            if (!(xcr0 & XCR0_AVX))
+                e->ebx &= ~CPUID_7_EBX_AVX;
+            if (!(xcr0 & XCR0_AVX512)) {
+                e->ebx &= ~CPUID_7_EBX_AVX512;
+                e->ecx &= ~CPUID_7_ECX_AVX512;
+                e->edx &= ~CPUID_7_EDX_AVX512;
+            }
+            e->edx &= ~CPUID_7_EDX_AMX;
+        }
+        if (e->function == 0xd && e->index == 0) {
+            e->eax = (uint32_t)xcr0;
+            e->edx = (uint32_t)(xcr0 >> 32);
+        }
+        if (e->function == 0xa) {
+            if (hvt->pmu && (e->eax & 0xff) < 2)
+                errx(1, "--pmu: host does not support an architectural PMU "
+                        "of version 2 or later");
+            if (!hvt->pmu)
+                e->eax = e->ebx = e->ecx = e->edx = 0;
+            pmu = true;
+        }
+    }
+    if (hvt->pmu && !pmu)
+        errx(1, "--pmu: host does not support an architectural PMU");
+    gf->xcr0 = xsave ? xcr0 : 0;
+
+    if (ioctl(vcpufd, KVM_SET_CPUID2, kvm_cpuid) < 0)
         err(1, "KVM: ioctl (SET_CPUID2) failed");
+    free(kvm_cpuid);
+}
+
+/*
+ * Load (xcr0) into XCR0 of the VCPU. A zero (xcr0) means XSAVE is not
+ * available and XCR0 is left alone.
+ */
+static void setup_xcr0(int vcpufd, uint64_t xcr0)
+{
+    if (xcr0 == 0)
+        return;
+
+    struct kvm_xcrs xcrs = {
+        .nr_xcrs = 1,
+        .xcrs = { { .xcr = 0, .value = xcr0 } }
+    };
+    if (ioctl(vcpufd, KVM_SET_XCRS, &xcrs) == -1)
+        err(1, "KVM: ioctl (SET_XCRS) failed");
 }
 
 static struct kvm_segment sreg_to_kvm(const struct x86_sreg *sreg)
@@ -76,15 +205,26 @@ static struct kvm_segment sreg_to_kvm(const struct x86_sreg *sreg)
     return kvm;
 }
 
+/*
+ * Initial special registers and XCR0, shared by all VCPUs.
+ */
+static struct kvm_sregs vcpu_sregs;
+static uint64_t vcpu_xcr0;
+
+static void hypercall_cpu_start(struct hvt *hvt, hvt_gpa_t gpa);
+
 void hvt_vcpu_init(struct hvt *hvt, hvt_gpa_t gpa_ep)
 {
     struct hvt_b *hvb = hvt->b;
     int ret;
 
+    hvb->boot_thread = pthread_self();
+
     hvt_x86_setup_gdt(hvt->mem);
     hvt_x86_setup_pagetables(hvt->mem, hvt->mem_size);
 
-    setup_cpuid(hvb);
+    struct guest_features gf;
+    setup_cpuid(hvt, hvb->vcpufd, &gf);
 
     struct kvm_sregs sregs = {
         .cr0 = X86_CR0_INIT,
@@ -103,10 +243,32 @@ void hvt_vcpu_init(struct hvt *hvt, hvt_gpa_t gpa_ep)
         .tr = sreg_to_kvm(&hvt_x86_sreg_tr),
         .ldt = sreg_to_kvm(&hvt_x86_sreg_unusable)
     };
+    if (gf.fsgsbase)
+        sregs.cr4 |= X86_CR4_FSGSBASE;
+    if (gf.xcr0)
+        sregs.cr4 |= X86_CR4_OSXSAVE;
 
     ret = ioctl(hvb->vcpufd, KVM_SET_SREGS, &sregs);
     if (ret == -1)
         err(1, "KVM: ioctl (SET_SREGS) failed");
+    vcpu_sregs = sregs;
+    vcpu_xcr0 = gf.xcr0;
+    setup_xcr0(hvb->vcpufd, vcpu_xcr0);
+
+    /*
+     * A VCPU run again with --reuse is no longer in its reset state, so put
+     * the FPU back in it explicitly: all components in their initial
+     * configuration, with the default x87 control word and MXCSR.
+     */
+    struct kvm_xsave *xsave = calloc(1, sizeof (struct kvm_xsave));
+    if (xsave == NULL)
+        err(1, "calloc");
+    xsave->region[0] = 0x037f;
+    xsave->region[6] = 0x1f80;
+    ret = ioctl(hvb->vcpufd, KVM_SET_XSAVE, xsave);
+    if (ret == -1)
+        err(1, "KVM: ioctl (SET_XSAVE) failed");
+    free(xsave);
 
     ret = ioctl(hvb->kvmfd, KVM_CHECK_EXTENSION, KVM_CAP_GET_TSC_KHZ);
     if (ret == -1)
@@ -144,21 +306,38 @@ void hvt_vcpu_init(struct hvt *hvt, hvt_gpa_t gpa_ep)
         err(1, "KVM: ioctl (SET_REGS) failed");
 
     hvt->cpu_boot_info_base = X86_BOOT_INFO_BASE;
+
+    if (hvt->cpus > 1)
+        assert(hvt_core_register_hypercall(hvt, HVT_HYPERCALL_CPU_START,
+                    hypercall_cpu_start) == 0);
 }
 
-int hvt_vcpu_loop(struct hvt *hvt)
+/*
+ * Runs VCPU (cpu). Returns true if the guest halted with HVT_HYPERCALL_HALT,
+ * setting (*status) to its exit status. Secondary VCPUs may also stop by
+ * halting the CPU, in which case false is returned.
+ */
+static bool vcpu_loop(struct hvt *hvt, unsigned cpu, int *status)
 {
     struct hvt_b *hvb = hvt->b;
+    int vcpufd = hvb->vcpufds[cpu];
+    struct kvm_run *run = hvb->vcpuruns[cpu];
     int ret;
 
     while (1) {
-        ret = ioctl(hvb->vcpufd, KVM_RUN, NULL);
-        if (ret == -1 && errno == EINTR)
+        ret = ioctl(vcpufd, KVM_RUN, NULL);
+        if (ret == -1 && errno == EINTR) {
+            hvt_core_exit(hvt, KVM_EXIT_INTR);
+            if (cpu == 0) {
+                run->immediate_exit = 0;
+                hvt_core_interrupted(hvt);
+            }
             continue;
+        }
         if (ret == -1) {
             if (errno == EFAULT) {
                 struct kvm_regs regs;
-                ret = ioctl(hvb->vcpufd, KVM_GET_REGS, &regs);
+                ret = ioctl(vcpufd, KVM_GET_REGS, &regs);
                 if (ret == -1)
                     err(1, "KVM: ioctl (GET_REGS) failed after guest fault");
                 errx(1, "KVM: host/guest translation fault: rip=0x%llx",
@@ -168,13 +347,13 @@ int hvt_vcpu_loop(struct hvt *hvt)
                 err(1, "KVM: ioctl (RUN) failed");
         }
 
-        int handled = 0;
-        for (hvt_vmexit_fn_t *fn = hvt_core_vmexits; *fn && !handled; fn++)
-            handled = ((*fn)(hvt) == 0);
-        if (handled)
+        /*
+         * Module vmexit handlers only know about the boot VCPU.
+         */
+        if (cpu == 0 && hvt_core_vmexit(hvt) == 0) {
+            hvt_core_exit(hvt, run->exit_reason);
             continue;
-
-        struct kvm_run *run = hvb->vcpurun;
+        }
 
         switch (run->exit_reason) {
         case KVM_EXIT_IO: {
@@ -186,24 +365,25 @@ int hvt_vcpu_loop(struct hvt *hvt)
                 errx(1, "Invalid guest port access: port=0x%x", run->io.port);
 
             int nr = run->io.port - HVT_HYPERCALL_PIO_BASE;
+            hvt_gpa_t gpa =
+                *(uint32_t *)((uint8_t *)run + run->io.data_offset);
 
             /* Guest has halted the CPU. */
             if (nr == HVT_HYPERCALL_HALT) {
-                hvt_gpa_t gpa =
-                    *(uint32_t *)((uint8_t *)run + run->io.data_offset);
-                return hvt_core_hypercall_halt(hvt, gpa);
+                *status = hvt_core_hypercall_halt(hvt, gpa);
+                return true;
             }
 
-            hvt_hypercall_fn_t fn = hvt_core_hypercalls[nr];
-            if (fn == NULL)
-                errx(1, "Invalid guest hypercall: num=%d", nr);
-
-            hvt_gpa_t gpa =
-                *(uint32_t *)((uint8_t *)run + run->io.data_offset);
-            fn(hvt, gpa);
+            hvt_core_hypercall(hvt, nr, gpa);
             break;
         }
 
+        case KVM_EXIT_HLT:
+            if (cpu == 0)
+                goto unhandled;
+            hvt_core_exit(hvt, run->exit_reason);
+            return false;
+
         case KVM_EXIT_FAIL_ENTRY:
             errx(1, "KVM: entry failure: hw_entry_failure_reason=0x%llx",
                  run->fail_entry.hardware_entry_failure_reason);
@@ -212,9 +392,10 @@ int hvt_vcpu_loop(struct hvt *hvt)
             errx(1, "KVM: internal error exit: suberror=0x%x",
                  run->internal.suberror);
 
-        default: {
+        default:
+        unhandled: {
             struct kvm_regs regs;
-            ret = ioctl(hvb->vcpufd, KVM_GET_REGS, &regs);
+            ret = ioctl(vcpufd, KVM_GET_REGS, &regs);
             if (ret == -1)
                 err(1, "KVM: ioctl (GET_REGS) failed after unhandled exit");
             errx(1, "KVM: unhandled exit: exit_reason=0x%x, rip=0x%llx",
@@ -223,3 +404,202 @@ int hvt_vcpu_loop(struct hvt *hvt)
         } /* switch(run->exit_reason) */
     }
 }
+
+int hvt_vcpu_get_frame(struct hvt *hvt, uint64_t *pc, uint64_t *fp)
+{
+    struct kvm_regs regs;
+
+    if (ioctl(hvt->b->vcpufd, KVM_GET_REGS, &regs) == -1)
+        return -1;
+    *pc = regs.rip;
+    *fp = regs.rbp;
+    return 0;
+}
+
+int hvt_vcpu_loop(struct hvt *hvt)
+{
+    int status = 0;
+
+    (void)vcpu_loop(hvt, 0, &status);
+    return status;
+}
+
+#define MSR_IA32_TSC 0x10
+
+/*
+ * Boot VCPU state saved in snapshots. The TSC is saved so that the guest's
+ * monotonic clock carries on from where it was when restored.
+ */
+struct vcpu_state {
+    struct kvm_regs regs;
+    struct kvm_sregs sregs;
+    struct kvm_xcrs xcrs;
+    struct kvm_xsave xsave;
+    uint64_t tsc;
+};
+
+struct vcpu_msrs {
+    struct kvm_msrs info;
+    struct kvm_msr_entry entries[1];
+};
+
+int hvt_vcpu_save(struct hvt *hvt, int fd)
+{
+    struct hvt_b *hvb = hvt->b;
+    struct vcpu_msrs msrs = {
+        .info.nmsrs = 1,
+        .entries[0].index = MSR_IA32_TSC
+    };
+    int ret = -1;
+
+    /*
+     * The I/O instruction making the hypercall is only completed, and guest
+     * state made consistent, on the next KVM_RUN. With immediate_exit set,
+     * KVM does so and returns without running the guest.
+     */
+    if (ioctl(hvb->kvmfd, KVM_CHECK_EXTENSION, KVM_CAP_IMMEDIATE_EXIT) <= 0)
+        return -1;
+    hvb->vcpurun->immediate_exit = 1;
+    if (ioctl(hvb->vcpufd, KVM_RUN, NULL) != -1 || errno != EINTR) {
+        hvb->vcpurun->immediate_exit = 0;
+        return -1;
+    }
+    hvb->vcpurun->immediate_exit = 0;
+
+    struct vcpu_state *s = calloc(1, sizeof (struct vcpu_state));
+    if (s == NULL)
+        return -1;
+    if (ioctl(hvb->vcpufd, KVM_GET_REGS, &s->regs) == -1 ||
+            ioctl(hvb->vcpufd, KVM_GET_SREGS, &s->sregs) == -1 ||
+            ioctl(hvb->vcpufd, KVM_GET_XCRS, &s->xcrs) == -1 ||
+            ioctl(hvb->vcpufd, KVM_GET_XSAVE, &s->xsave) == -1 ||
+            ioctl(hvb->vcpufd, KVM_GET_MSRS, &msrs) != 1)
+        goto out;
+    s->tsc = msrs.entries[0].data;
+    for (size_t put = 0; put < sizeof (struct vcpu_state); ) {
+        ssize_t nbytes = write(fd, (uint8_t *)s + put,
+                sizeof (struct vcpu_state) - put);
+        if (nbytes == -1 && errno == EINTR)
+            continue;
+        if (nbytes <= 0)
+            goto out;
+        put += nbytes;
+    }
+    ret = 0;
+
+out:
+    free(s);
+    return ret;
+}
+
+int hvt_vcpu_restore(struct hvt *hvt, int fd)
+{
+    struct hvt_b *hvb = hvt->b;
+    int ret = -1;
+
+    struct vcpu_state *s = calloc(1, sizeof (struct vcpu_state));
+    if (s == NULL)
+        return -1;
+    /*
+     * (fd) may be a socket, on which the state arrives in several parts.
+     */
+    for (size_t got = 0; got < sizeof (struct vcpu_state); ) {
+        ssize_t nbytes = read(fd, (uint8_t *)s + got,
+                sizeof (struct vcpu_state) - got);
+        if (nbytes == -1 && errno == EINTR)
+            continue;
+        if (nbytes <= 0)
+            goto out;
+        got += nbytes;
+    }
+
+    struct vcpu_msrs msrs = {
+        .info.nmsrs = 1,
+        .entries[0] = { .index = MSR_IA32_TSC, .data = s->tsc }
+    };
+    if (ioctl(hvb->vcpufd, KVM_SET_SREGS, &s->sregs) == -1 ||
+            ioctl(hvb->vcpufd, KVM_SET_XCRS, &s->xcrs) == -1 ||
+            ioctl(hvb->vcpufd, KVM_SET_XSAVE, &s->xsave) == -1 ||
+            ioctl(hvb->vcpufd, KVM_SET_REGS, &s->regs) == -1 ||
+            ioctl(hvb->vcpufd, KVM_SET_MSRS, &msrs) != 1)
+        goto out;
+    ret = 0;
+
+out:
+    free(s);
+    return ret;
+}
+
+static struct hvt *vcpu_hvt;
+static bool *vcpu_started;
+
+static void *vcpu_thread(void *arg)
+{
+    int status;
+
+    rt_apply();
+    if (vcpu_loop(vcpu_hvt, (uintptr_t)arg, &status))
+        exit(status);
+    return NULL;
+}
+
+/*
+ * Called with the core lock held, so (vcpu_started) needs no further
+ * protection.
+ */
+static void hypercall_cpu_start(struct hvt *hvt, hvt_gpa_t gpa)
+{
+    struct hvt_b *hvb = hvt->b;
+    struct hvt_hc_cpu_start *cs =
+        HVT_CHECKED_GPA_P(hvt, gpa, sizeof (struct hvt_hc_cpu_start));
+
+    if (vcpu_started == NULL) {
+        vcpu_started = calloc(hvt->cpus, sizeof (bool));
+        if (vcpu_started == NULL)
+            err(1, "calloc");
+        vcpu_hvt = hvt;
+    }
+    if (cs->cpu == 0 || cs->cpu >= hvt->cpus || vcpu_started[cs->cpu] ||
+            (cs->stack & 15) != 0) {
+        cs->ret = SOLO5_R_EINVAL;
+        return;
+    }
+    (void)HVT_CHECKED_GPA_P(hvt, cs->entry, 1);
+    (void)HVT_CHECKED_GPA_P(hvt, cs->stack - 16, 16);
+
+    int vcpufd = hvb->vcpufds[cs->cpu];
+    struct guest_features gf;
+    setup_cpuid(hvt, vcpufd, &gf);
+    struct kvm_sregs sregs = vcpu_sregs;
+    sregs.fs.base = cs->tls_base;
+    if (ioctl(vcpufd, KVM_SET_SREGS, &sregs) == -1)
+        err(1, "KVM: ioctl (SET_SREGS) failed");
+    setup_xcr0(vcpufd, vcpu_xcr0);
+    /*
+     * As for the boot VCPU, (stack) is entered as if by a call.
+     */
+    struct kvm_regs regs = {
+        .rip = cs->entry,
+        .rflags = X86_RFLAGS_INIT,
+        .rsp = cs->stack - 8,
+        .rdi = cs->arg,
+    };
+    if (ioctl(vcpufd, KVM_SET_REGS, &regs) == -1)
+        err(1, "KVM: ioctl (SET_REGS) failed");
+
+    /*
+     * Signals are left to the main thread.
+     */
+    sigset_t all, old;
+    pthread_t thread;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    if (pthread_create(&thread, NULL, vcpu_thread,
+                (void *)(uintptr_t)cs->cpu) != 0)
+        errx(1, "Could not create VCPU thread");
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    pthread_detach(thread);
+
+    vcpu_started[cs->cpu] = true;
+    cs->ret = SOLO5_R_OK;
+}
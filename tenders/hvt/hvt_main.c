@@ -25,7 +25,9 @@
 #define _GNU_SOURCE
 #include <assert.h>
 #include <err.h>
+#include <errno.h>
 #include <libgen.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -50,6 +52,7 @@ static void setup_modules(struct hvt *hvt, struct mft *mft)
             }
             exit(1);
         }
+        boot_trace("setup (%s)", m->name);
     }
 
     bool fail = false;
@@ -77,6 +80,70 @@ static int handle_cmdarg(char *cmdarg, struct mft *mft)
     return -1;
 }
 
+/*
+ * Set if the guest reports when it reaches solo5_app_main() for --trace-boot,
+ * to the time at which the boot VCPU was first run.
+ */
+static uint64_t vcpu_start_nsecs;
+
+static void boot_trace_halt(struct hvt *hvt, int status __attribute__((unused)),
+        void *cookie __attribute__((unused)))
+{
+    const struct hvt_hc_boot_report *br = hvt_core_boot_report(hvt);
+
+    /*
+     * The guest reports its cycle counter on entry and on reaching
+     * solo5_app_main(), which is taken relative to when the VCPU was started.
+     */
+    if (vcpu_start_nsecs && br != NULL &&
+            br->app_main_cycles > br->start_cycles) {
+        uint64_t cycles = br->app_main_cycles - br->start_cycles;
+        uint64_t freq = hvt->cpu_cycle_freq;
+        uint64_t nsecs = (cycles / freq) * 1000000000ULL +
+            (cycles % freq) * 1000000000ULL / freq;
+        boot_trace_at(vcpu_start_nsecs + nsecs, "solo5_app_main (guest)");
+    }
+    boot_trace_report();
+}
+
+static void mergeable_halt(struct hvt *hvt __attribute__((unused)),
+        int status __attribute__((unused)),
+        void *cookie __attribute__((unused)))
+{
+    mem_mergeable_report();
+}
+
+static void mem_report_halt(struct hvt *hvt, int status __attribute__((unused)),
+        void *cookie __attribute__((unused)))
+{
+    const struct hvt_hc_boot_report *br = hvt_core_boot_report(hvt);
+
+    mem_report(hvt->mem, hvt->mem_size, br ? br->heap_start : 0);
+}
+
+/*
+ * Startup is pipelined: the VM is created by hvt_init() on a separate thread
+ * while the main thread attaches the devices given in module options, and
+ * the host kernel reads the unikernel ahead from elf_load_mft() onwards.
+ */
+struct vm_init {
+    size_t mem_size;
+    unsigned cpus;
+    unsigned mem_flags;
+    unsigned init_flags;
+    struct hvt *hvt;                    /* OUT */
+    uint64_t done_nsecs;                /* OUT: for --trace-boot */
+};
+
+static void *vm_init_thread(void *arg)
+{
+    struct vm_init *vi = arg;
+
+    vi->hvt = hvt_init(vi->mem_size, vi->cpus, vi->mem_flags, vi->init_flags);
+    vi->done_nsecs = boot_trace_now();
+    return NULL;
+}
+
 static void sig_handler(int signo)
 {
     errx(1, "Exiting on signal %d", signo);
@@ -93,6 +160,46 @@ static void handle_mem(char *cmdarg, size_t *mem_size)
     *mem_size = mem;
 }
 
+static void handle_cpus(char *cmdarg, unsigned *cpus)
+{
+    unsigned n;
+    int rc = sscanf(cmdarg, "--cpus=%u", &n);
+    if (rc != 1 || n < 1 || n > HVT_CPUS_MAX) {
+        errx(1, "Malformed argument to --cpus");
+    }
+    *cpus = n;
+}
+
+#if defined(__linux__) && defined(__x86_64__)
+static void handle_reuse(char *cmdarg, unsigned *runs)
+{
+    unsigned n;
+    int rc = sscanf(cmdarg, "--reuse=%u", &n);
+    if (rc != 1) {
+        errx(1, "Malformed argument to --reuse");
+    }
+    *runs = n;
+}
+#endif
+
+#if defined(__linux__) && defined(__aarch64__)
+static void handle_sve(char *cmdarg, unsigned *sve)
+{
+    char *end;
+    unsigned long bits;
+
+    if (cmdarg[5] == '\0') {
+        *sve = 2048;
+        return;
+    }
+    bits = strtoul(cmdarg + 6, &end, 10);
+    if (cmdarg[5] != '=' || cmdarg[6] == '\0' || *end != '\0' ||
+            bits < 128 || bits > 2048 || bits % 128 != 0)
+        errx(1, "Malformed argument to --sve");
+    *sve = bits;
+}
+#endif
+
 static void usage(const char *prog)
 {
     fprintf(stderr, "usage: %s [ CORE OPTIONS ] [ MODULE OPTIONS ] [ -- ] "
@@ -101,6 +208,77 @@ static void usage(const char *prog)
     fprintf(stderr, "ARGS are optional arguments passed to the unikernel.\n");
     fprintf(stderr, "Core options:\n");
     fprintf(stderr, "  [ --mem=512 ] (guest memory in MB)\n");
+    fprintf(stderr, "  [ --cpus=1 ] (number of VCPUs, up to %d)\n",
+            HVT_CPUS_MAX);
+    fprintf(stderr, "  [ --mem-hugepages ] (back guest memory with huge "
+            "pages)\n");
+    fprintf(stderr, "  [ --mem-prefault | --mem-lazy ] (populate guest memory "
+            "up front, or do not reserve it)\n");
+    fprintf(stderr, "  [ --mem-mergeable ] (allow the host to merge identical "
+            "pages of guest memory)\n");
+    fprintf(stderr, "  [ --mem-lock ] (populate guest memory up front and "
+            "lock it into host memory)\n");
+    fprintf(stderr, "  [ --mem-report ] (report how much guest memory was "
+            "used at exit)\n");
+#if defined(__linux__)
+    fprintf(stderr, "  [ --mem-shared ] (allocate guest memory from a file "
+            "which can be shared, for vhost-user)\n");
+#endif
+    fprintf(stderr, "  [ --cpu=LIST ] (run only on the host CPUs in LIST, "
+            "e.g. 0-3,8)\n");
+    fprintf(stderr, "  [ --numa-node=N ] (place guest memory and, without "
+            "--cpu, threads on host NUMA node N)\n");
+#if defined(__linux__)
+    fprintf(stderr, "  [ --cgroup=PATH ] (run in cgroup v2 PATH, with memory "
+            "limits derived from --mem)\n");
+    fprintf(stderr, "  [ --cpu-quota=PCT ] (limit the cgroup to PCT%% of one "
+            "host CPU)\n");
+    fprintf(stderr, "  [ --cache-class=NAME ] (run in resctrl group NAME, for "
+            "its share of cache and memory bandwidth)\n");
+    fprintf(stderr, "  [ --rt-priority=N[,rr][,budget=MS] ] (run VCPUs with "
+            "SCHED_FIFO, or SCHED_RR, priority N, killing the tender if one "
+            "runs for MS, default 1000, without blocking)\n");
+#endif
+#if defined(__linux__) && defined(__x86_64__)
+    fprintf(stderr, "  [ --pmu ] (give the guest a virtual PMU for "
+            "solo5_pmu_read())\n");
+    fprintf(stderr, "  [ --reuse=N ] (run the guest N times, 0 for no limit, "
+            "resetting it in place each time it exits)\n");
+    fprintf(stderr, "  [ --dedicated-core ] (the VCPU has a host CPU to "
+            "itself, do not exit when the guest halts or spins)\n");
+    fprintf(stderr, "  [ --irqchip ] (give the guest an in-kernel local "
+            "APIC, and have it halt instead of blocking in the tender)\n");
+#endif
+#if defined(__linux__) && defined(__aarch64__)
+    fprintf(stderr, "  [ --sve[=BITS] ] (enable SVE for the guest, with "
+            "vectors of up to BITS bits)\n");
+#endif
+    fprintf(stderr, "  [ --trace-boot ] (report the time taken by each "
+            "startup phase)\n");
+    fprintf(stderr, "  [ --perf-map[=FILE] ] (write guest symbols for perf kvm "
+            "--guestkallsyms to FILE, default /tmp/perf-PID.kallsyms)\n");
+    fprintf(stderr, "  [ --metrics=PATH ] (serve counters in Prometheus text "
+            "format on the UNIX socket PATH)\n");
+    fprintf(stderr, "  [ --fds-from=PATH ] (attach devices passed by a "
+            "launcher on the UNIX socket PATH)\n");
+    fprintf(stderr, "  [ --console-buffer=KB ] (buffer up to KB kB of console "
+            "output, default 256, 0 to write it synchronously)\n");
+    fprintf(stderr, "  [ --console-overflow=block|drop ] (wait or drop output "
+            "when the console buffer is full, default block)\n");
+    fprintf(stderr, "  [ --snapshot=FILE ] (save a snapshot of the guest to "
+            "FILE once initialised, and exit)\n");
+    fprintf(stderr, "  [ --restore=FILE ] (restore the guest from the snapshot "
+            "in FILE)\n");
+    fprintf(stderr, "  [ --restore-prefetch=FILE ] (read ahead the working set "
+            "recorded in FILE when restoring, or record it there)\n");
+    fprintf(stderr, "  [ --migrate-to=ADDR ] (migrate the guest to the tender "
+            "receiving it on ADDR, unix:PATH or tcp:HOST:PORT, on SIGUSR1)\n");
+    fprintf(stderr, "  [ --incoming=ADDR ] (receive a migrated guest on ADDR "
+            "instead of loading the unikernel)\n");
+    fprintf(stderr, "  [ --record=FILE ] (record the input of the guest "
+            "to FILE)\n");
+    fprintf(stderr, "  [ --replay=FILE[,speed=fast|recorded] ] (feed the "
+            "input recorded in FILE to the guest)\n");
     fprintf(stderr, "    --help (display this help)\n");
     fprintf(stderr, "Compiled-in modules: ");
     for (struct hvt_module *m = &__start_modules; m < &__stop_modules; m++) {
@@ -124,11 +302,25 @@ static void usage(const char *prog)
 int main(int argc, char **argv)
 {
     size_t mem_size = 0x20000000;
+    unsigned cpus = 1;
+    unsigned mem_flags = 0;
+    const char *snapshot_file = NULL;
+    const char *restore_file = NULL;
+    const char *prefetch_file = NULL;
+    const char *migrate_addr = NULL;
+    const char *incoming_addr = NULL;
+    const char *record_file = NULL;
+    const char *replay_file = NULL;
+    bool pmu = false;
+    unsigned sve = 0;
+    unsigned init_flags = 0;
+    unsigned runs = 1;
     hvt_gpa_t gpa_ep, gpa_kend;
     const char *prog;
     const char *elffile;
     int matched;
 
+    boot_trace_init();
     prog = basename(*argv);
     argc--;
     argv++;
@@ -168,15 +360,21 @@ int main(int argc, char **argv)
     struct mft *mft;
     size_t mft_size;
     elf_load_mft(elffile, &mft, &mft_size);
+    boot_trace("elf_load_mft");
     if (mft_validate(mft, mft_size) == -1) {
         free(mft);
         errx(1, "%s: Solo5 manifest is invalid", elffile);
     }
+    boot_trace("mft_validate");
 
     /*
-     * Scan command line arguments in a 2nd pass, and pass options through to
-     * modules to handle.
+     * Scan command line arguments in a 2nd pass. Options not handled by the
+     * core are passed through to modules once the VM is being created.
      */
+    char **module_args = malloc(argc * sizeof (char *));
+    if (module_args == NULL)
+        err(1, "malloc");
+    int n_module_args = 0;
     while (*argv && *argv[0] == '-') {
         if (strcmp("--", *argv) == 0) {
             /* Consume and stop option processing */
@@ -192,21 +390,210 @@ int main(int argc, char **argv)
             argc--;
             argv++;
         }
-        if (handle_cmdarg(*argv, mft) == 0) {
-            /* Handled by module, consume and go on to next arg */
+        if (strncmp("--cpus=", *argv, 7) == 0) {
+            handle_cpus(*argv, &cpus);
+            matched = 1;
+            argc--;
+            argv++;
+        }
+        if (strncmp("--snapshot=", *argv, 11) == 0) {
+            snapshot_file = *argv + 11;
+            matched = 1;
+            argc--;
+            argv++;
+        }
+        if (strncmp("--restore=", *argv, 10) == 0) {
+            restore_file = *argv + 10;
+            matched = 1;
+            argc--;
+            argv++;
+        }
+        if (strncmp("--restore-prefetch=", *argv, 19) == 0) {
+            prefetch_file = *argv + 19;
+            matched = 1;
+            argc--;
+            argv++;
+        }
+        if (strncmp("--migrate-to=", *argv, 13) == 0) {
+            migrate_addr = *argv + 13;
+            matched = 1;
+            argc--;
+            argv++;
+        }
+        if (strncmp("--record=", *argv, 9) == 0) {
+            record_file = *argv + 9;
+            matched = 1;
+            argc--;
+            argv++;
+        }
+        if (strncmp("--replay=", *argv, 9) == 0) {
+            replay_file = *argv + 9;
+            matched = 1;
+            argc--;
+            argv++;
+        }
+        if (strncmp("--incoming=", *argv, 11) == 0) {
+            incoming_addr = *argv + 11;
+            matched = 1;
+            argc--;
+            argv++;
+        }
+        if (mem_handle_cmdarg(*argv, &mem_flags) == 0) {
+            matched = 1;
+            argc--;
+            argv++;
+        }
+        if (affinity_handle_cmdarg(*argv) == 0) {
+            matched = 1;
+            argc--;
+            argv++;
+        }
+        if (cgroup_handle_cmdarg(*argv) == 0) {
+            matched = 1;
+            argc--;
+            argv++;
+        }
+        if (resctrl_handle_cmdarg(*argv) == 0) {
+            matched = 1;
+            argc--;
+            argv++;
+        }
+        if (rt_handle_cmdarg(*argv) == 0) {
+            matched = 1;
+            argc--;
+            argv++;
+        }
+        if (boot_trace_handle_cmdarg(*argv) == 0) {
+            matched = 1;
+            argc--;
+            argv++;
+        }
+#if defined(__linux__) && defined(__x86_64__)
+        if (strcmp("--pmu", *argv) == 0) {
+            pmu = true;
+            matched = 1;
+            argc--;
+            argv++;
+        }
+        if (strcmp("--dedicated-core", *argv) == 0) {
+            init_flags |= HVT_INIT_DEDICATED_CORE;
+            matched = 1;
+            argc--;
+            argv++;
+        }
+        if (strcmp("--irqchip", *argv) == 0) {
+            init_flags |= HVT_INIT_IRQCHIP;
+            matched = 1;
+            argc--;
+            argv++;
+        }
+        if (strncmp("--reuse=", *argv, 8) == 0) {
+            handle_reuse(*argv, &runs);
+            matched = 1;
+            argc--;
+            argv++;
+        }
+#endif
+#if defined(__linux__) && defined(__aarch64__)
+        if (strcmp("--sve", *argv) == 0 || strncmp("--sve=", *argv, 6) == 0) {
+            handle_sve(*argv, &sve);
+            matched = 1;
+            argc--;
+            argv++;
+        }
+#endif
+        if (perf_map_handle_cmdarg(*argv) == 0) {
+            matched = 1;
+            argc--;
+            argv++;
+        }
+        if (metrics_handle_cmdarg(*argv) == 0) {
+            matched = 1;
+            argc--;
+            argv++;
+        }
+        if (handoff_handle_cmdarg(*argv) == 0) {
+            matched = 1;
+            argc--;
+            argv++;
+        }
+        if (console_out_handle_cmdarg(*argv) == 0) {
             matched = 1;
             argc--;
             argv++;
         }
         if (!matched) {
-            warnx("Invalid option: `%s'", *argv);
-            usage(prog);
+            module_args[n_module_args++] = *argv;
+            argc--;
+            argv++;
         }
     }
     assert(elffile == *argv);
     argc--;
     argv++;
 
+    if (restore_file != NULL && incoming_addr != NULL)
+        errx(1, "--restore and --incoming cannot be used together");
+    if (prefetch_file != NULL && restore_file == NULL)
+        errx(1, "--restore-prefetch requires --restore");
+    /*
+     * Both use dirty page logging.
+     */
+    if (snapshot_file != NULL && migrate_addr != NULL)
+        errx(1, "--snapshot and --migrate-to cannot be used together");
+    bool restoring = restore_file != NULL || incoming_addr != NULL;
+    bool reuse = runs != 1;
+    /*
+     * A reused guest is reset using dirty page logging, from the memory it
+     * was loaded with, and only the boot VCPU is initialised again.
+     */
+    if (reuse && (snapshot_file != NULL || migrate_addr != NULL || restoring))
+        errx(1, "--reuse cannot be used with --snapshot, --restore, "
+                "--migrate-to or --incoming");
+    if (reuse && cpus > 1)
+        errx(1, "--reuse cannot be used with more than one VCPU");
+    /*
+     * A recording starts from the first instruction of the guest.
+     */
+    if (record_file != NULL && replay_file != NULL)
+        errx(1, "--record and --replay cannot be used together");
+    if ((record_file != NULL || replay_file != NULL) &&
+            (snapshot_file != NULL || migrate_addr != NULL || restoring ||
+             reuse))
+        errx(1, "--record and --replay cannot be used with --snapshot, "
+                "--restore, --migrate-to, --incoming or --reuse");
+    /*
+     * Secondary VCPUs leave the guest by halting, which no longer exits.
+     */
+    if ((init_flags & HVT_INIT_DEDICATED_CORE) && cpus > 1)
+        errx(1, "--dedicated-core cannot be used with more than one VCPU");
+    /*
+     * The state of the in-kernel irqchip is neither saved nor reset, and
+     * only the boot VCPU is interrupted when devices become ready.
+     */
+    if ((init_flags & HVT_INIT_IRQCHIP) &&
+            (snapshot_file != NULL || migrate_addr != NULL || restoring ||
+             reuse || record_file != NULL || replay_file != NULL))
+        errx(1, "--irqchip cannot be used with --snapshot, --restore, "
+                "--migrate-to, --incoming, --reuse, --record or --replay");
+    if ((init_flags & HVT_INIT_IRQCHIP) && cpus > 1)
+        errx(1, "--irqchip cannot be used with more than one VCPU");
+    if (restoring && argc > 0)
+        warnx("Restoring the guest, ignoring unikernel arguments");
+    /*
+     * When restoring, guest memory is mapped from the snapshot instead, so
+     * the memory allocated by hvt_init() is only a placeholder and must not
+     * be populated.
+     */
+    if (restoring && (mem_flags & MEM_SHARED))
+        errx(1, "--mem-shared cannot be used with --restore or --incoming");
+    if (restore_file != NULL) {
+        if (mem_flags & (MEM_HUGEPAGES | MEM_PREFAULT | MEM_LOCK))
+            errx(1, "--mem-hugepages, --mem-prefault and --mem-lock cannot be "
+                    "used with --restore");
+        mem_flags |= MEM_LAZY;
+    }
+
     struct sigaction sa;
     memset (&sa, 0, sizeof (struct sigaction));
     sa.sa_handler = sig_handler;
@@ -215,17 +602,150 @@ int main(int argc, char **argv)
         err(1, "Could not install signal handler");
     if (sigaction(SIGTERM, &sa, NULL) == -1)
         err(1, "Could not install signal handler");
+    console_out_init();
 
+    /*
+     * The VM thread inherits the cgroup, resctrl group, CPU affinity and NUMA
+     * memory policy of the tender.
+     */
     hvt_mem_size(&mem_size);
-    struct hvt *hvt = hvt_init(mem_size);
+    cgroup_apply(mem_size);
+    resctrl_apply();
+    affinity_apply();
+    struct vm_init vi = {
+        .mem_size = mem_size, .cpus = cpus, .mem_flags = mem_flags,
+        .init_flags = init_flags
+    };
+    pthread_t vm_thread;
+    if ((errno = pthread_create(&vm_thread, NULL, vm_init_thread, &vi)) != 0)
+        err(1, "Could not create thread");
 
-    elf_load(elffile, hvt->mem, hvt->mem_size, &gpa_ep, &gpa_kend);
+    for (int i = 0; i < n_module_args; i++) {
+        if (handle_cmdarg(module_args[i], mft) != 0) {
+            warnx("Invalid option: `%s'", module_args[i]);
+            usage(prog);
+        }
+    }
+    free(module_args);
+    char **handoff_args;
+    int n_handoff_args = handoff_receive(&handoff_args);
+    for (int i = 0; i < n_handoff_args; i++) {
+        if (handle_cmdarg(handoff_args[i], mft) != 0)
+            errx(1, "Invalid option from launcher: `%s'", handoff_args[i]);
+    }
+    boot_trace("module options");
+
+    /*
+     * Devices attached with --block-map, --shm and --pci are mapped over
+     * parts of guest memory, which is not possible with huge pages, nor
+     * reset when reusing the guest. Shared memory and PCI devices are not
+     * part of a snapshot.
+     */
+    for (unsigned i = 0; i != mft->entries; i++) {
+        if (mft->e[i].type != MFT_BLOCK_BASIC || !mft->e[i].attached ||
+                !(mft->e[i].u.block_basic.flags & MFT_BLOCK_MAPPED))
+            continue;
+        if (mem_flags & MEM_HUGEPAGES)
+            errx(1, "--mem-hugepages cannot be used with --block-map");
+        if (reuse)
+            errx(1, "--reuse cannot be used with --block-map");
+    }
+    for (unsigned i = 0; i != mft->entries; i++) {
+        if (mft->e[i].type != MFT_SHM_BASIC || !mft->e[i].attached)
+            continue;
+        if (mem_flags & MEM_HUGEPAGES)
+            errx(1, "--mem-hugepages cannot be used with --shm");
+        if (snapshot_file != NULL || migrate_addr != NULL || restoring ||
+                reuse)
+            errx(1, "--shm cannot be used with --snapshot, --restore, "
+                    "--migrate-to, --incoming or --reuse");
+    }
+    bool pci = false;
+    for (unsigned i = 0; i != mft->entries; i++) {
+        if (mft->e[i].type != MFT_PCI_BASIC || !mft->e[i].attached)
+            continue;
+        pci = true;
+        if (mem_flags & MEM_HUGEPAGES)
+            errx(1, "--mem-hugepages cannot be used with --pci");
+        if (snapshot_file != NULL || migrate_addr != NULL || restoring ||
+                reuse)
+            errx(1, "--pci cannot be used with --snapshot, --restore, "
+                    "--migrate-to, --incoming or --reuse");
+    }
+
+    if ((errno = pthread_join(vm_thread, NULL)) != 0)
+        err(1, "Could not join thread");
+    boot_trace_at(vi.done_nsecs, "hvt_init");
+    struct hvt *hvt = vi.hvt;
+    hvt->pmu = pmu;
+    hvt->sve = sve;
+    hvt->reuse = reuse;
+    hvt_core_init(hvt);
+
+    /*
+     * When restoring from a snapshot or receiving a migrated guest, guest
+     * memory and VCPU state are replaced wholesale once the VCPU and modules
+     * have been set up.
+     */
+    if (!restoring) {
+        /*
+         * On Linux, guest memory is ordinary process memory, so the unikernel
+         * can be mapped from its file, sharing its pages in the host page
+         * cache with other tenders running it until written to. This is not
+         * done if guest memory is to be populated up front, shared or pinned
+         * for DMA, nor if it is to be saved, which only finds the pages of
+         * guest memory resident in the tender.
+         */
+#if defined(__linux__)
+        bool map = !(mem_flags &
+                (MEM_HUGEPAGES | MEM_PREFAULT | MEM_SHARED | MEM_LOCK)) &&
+            !pci && snapshot_file == NULL && migrate_addr == NULL;
+#else
+        bool map = false;
+        (void)pci;
+#endif
+        elf_load(elffile, hvt->mem, hvt->mem_size, map, &gpa_ep, &gpa_kend);
+    }
+    else
+        gpa_ep = gpa_kend = 0;
+    boot_trace("elf_load");
+    /*
+     * The guest runs with guest virtual addresses identity mapped to guest
+     * physical addresses, so its symbols need no relocation. A restored or
+     * migrated guest is running the same unikernel.
+     */
+    perf_map_write(elffile, 0, PERF_MAP_KALLSYMS);
+    hvt->file = elffile;
 
     hvt_vcpu_init(hvt, gpa_ep);
+    boot_trace("hvt_vcpu_init");
 
     setup_modules(hvt, mft);
+    hvt_replay_init(hvt, record_file, replay_file, mft);
 
-    hvt_boot_info_init(hvt, gpa_kend, argc, argv, mft, mft_size);
+    hvt_snapshot_init(hvt, snapshot_file, mft, mft_size);
+    if (restore_file != NULL) {
+        hvt_snapshot_restore(hvt, restore_file, prefetch_file, mft,
+                mft_size);
+        /*
+         * Guest memory has been replaced by a mapping of the snapshot.
+         */
+        if (mem_flags & MEM_MERGEABLE)
+            (void)mem_mergeable(hvt->mem, hvt->mem_size);
+        boot_trace("hvt_snapshot_restore");
+    }
+    else if (incoming_addr != NULL) {
+        hvt_migrate_incoming(hvt, incoming_addr, mft, mft_size);
+        boot_trace("hvt_migrate_incoming");
+    }
+    else {
+        hvt_boot_info_init(hvt, gpa_kend, argc, argv, mft, mft_size);
+        boot_trace("hvt_boot_info_init");
+    }
+    hvt_migrate_init(hvt, migrate_addr, mft, mft_size);
+    if (reuse)
+        hvt_reuse_init(hvt, gpa_kend);
+    metrics_init(elffile, mft, hvt->mem, hvt->mem_size);
 
 #if HVT_DROP_PRIVILEGES
     hvt_drop_privileges();
@@ -235,5 +755,32 @@ int main(int argc, char **argv)
     warnx("WARNING: This is not recommended for production use.");
 #endif
 
-    return hvt_vcpu_loop(hvt);
+    if ((mem_flags & MEM_MERGEABLE) &&
+            hvt_core_register_halt_hook(hvt, mergeable_halt) == -1)
+        errx(1, "Could not register --mem-mergeable halt hook");
+    if ((mem_flags & MEM_REPORT) &&
+            hvt_core_register_halt_hook(hvt, mem_report_halt) == -1)
+        errx(1, "Could not register --mem-report halt hook");
+    if (boot_trace_enabled()) {
+        if (hvt_core_register_halt_hook(hvt, boot_trace_halt) == -1)
+            errx(1, "Could not register --trace-boot halt hook");
+        /*
+         * A restored guest does not pass through solo5_app_main() again.
+         */
+        if (!restoring)
+            vcpu_start_nsecs = boot_trace_now();
+    }
+    metrics_start(NULL);
+    boot_trace("VCPU start");
+    rt_apply();
+    /*
+     * A reused guest is run again until it has run (runs) times, or exits
+     * with a non-zero status.
+     */
+    for (unsigned run = 1; ; run++) {
+        int status = hvt_vcpu_loop(hvt);
+        if (status != 0 || run == runs)
+            return status;
+        hvt_reuse_reset(hvt, gpa_ep);
+    }
 }
@@ -0,0 +1,684 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * hvt_migrate.c: Live migration of the guest to another tender
+ * (--migrate-to=ADDR), and receiving a migrated guest (--incoming=ADDR).
+ *
+ * Migration starts when the tender receives SIGUSR1. Guest memory is copied
+ * while the guest carries on running: first the pages the guest has touched,
+ * then, in rounds, those written since the previous round, as found by
+ * logging the pages written by the guest and tracking those accessed by the
+ * tender. Once the pages left could be sent within MIGRATE_DOWNTIME_NSECS at
+ * the rate measured so far, or after MIGRATE_ROUNDS_MAX rounds, the boot VCPU
+ * is interrupted, and the pages left, the VCPU state and the core state are
+ * sent while the guest is stopped. The tender exits once the receiving tender
+ * has acknowledged them. If migration fails before then, the guest carries
+ * on running here.
+ *
+ * Devices are not transferred: as when restoring a snapshot, the receiving
+ * tender is started with the same devices attached, network devices by tap
+ * interface name and block devices by path.
+ *
+ * The stream starts with a (struct migrate_header) and the manifest, to which
+ * the receiving tender replies with a status byte. Then follow (struct
+ * migrate_msg) messages, each followed by its payload, up to MIGRATE_END, to
+ * which the receiving tender replies with a status byte once it has restored
+ * the guest.
+ */
+
+#define _GNU_SOURCE
+#include <assert.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "hvt.h"
+
+#define MIGRATE_MAGIC "SOLO5MIG"
+#define MIGRATE_VERSION 1
+
+/*
+ * Target time for which the guest is stopped, and limits on the number of
+ * rounds of copying pages while it runs, and of attempts at stopping it while
+ * it has requests in flight.
+ */
+#define MIGRATE_DOWNTIME_NSECS 30000000ULL
+#define MIGRATE_ROUNDS_MAX 30
+#define MIGRATE_STOP_TRIES 50
+
+struct migrate_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t cpus;
+    uint64_t mem_size;
+    uint64_t cpu_cycle_freq;
+    uint64_t page_size;
+    uint64_t mft_size;
+};
+
+enum {
+    MIGRATE_PAGES = 1,                  /* (len) bytes of memory at (gpa) */
+    MIGRATE_VCPU,                       /* Boot VCPU state */
+    MIGRATE_CORE,                       /* struct hvt_core_state */
+    MIGRATE_END
+};
+
+struct migrate_msg {
+    uint32_t type;
+    uint32_t pad;
+    uint64_t gpa;
+    uint64_t len;
+};
+
+static size_t page_size;
+static size_t npages;
+
+static uint64_t monotonic_nsecs(void)
+{
+    struct timespec ts;
+
+    int rc = clock_gettime(CLOCK_MONOTONIC, &ts);
+    assert(rc == 0);
+    return (ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+static int send_all(int fd, const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+
+    while (len > 0) {
+        ssize_t nbytes = send(fd, p, len, MSG_NOSIGNAL);
+        if (nbytes == -1 && errno == EINTR)
+            continue;
+        if (nbytes <= 0)
+            return -1;
+        p += nbytes;
+        len -= nbytes;
+    }
+    return 0;
+}
+
+static int recv_all(int fd, void *buf, size_t len)
+{
+    uint8_t *p = buf;
+
+    while (len > 0) {
+        ssize_t nbytes = recv(fd, p, len, 0);
+        if (nbytes == -1 && errno == EINTR)
+            continue;
+        if (nbytes <= 0)
+            return -1;
+        p += nbytes;
+        len -= nbytes;
+    }
+    return 0;
+}
+
+static int send_status(int fd, bool ok)
+{
+    uint8_t status = ok ? 0 : 1;
+
+    return send_all(fd, &status, 1);
+}
+
+static int recv_status(int fd)
+{
+    uint8_t status;
+
+    if (recv_all(fd, &status, 1) == -1 || status != 0)
+        return -1;
+    return 0;
+}
+
+/*
+ * Returns a socket connected to (addr), which is unix:PATH or
+ * tcp:HOST:PORT, or if (listening), one accepted on (addr), where HOST may be
+ * empty. Returns -1 on error.
+ */
+static int open_socket(const char *addr, bool listening)
+{
+    int fd = -1;
+
+    if (strncmp(addr, "unix:", 5) == 0) {
+        struct sockaddr_un sun = { .sun_family = AF_UNIX };
+        if (strlen(addr + 5) >= sizeof sun.sun_path) {
+            warnx("migrate: Path too long: %s", addr + 5);
+            return -1;
+        }
+        strcpy(sun.sun_path, addr + 5);
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd == -1) {
+            warn("migrate: socket() failed");
+            return -1;
+        }
+        if (!listening) {
+            if (connect(fd, (struct sockaddr *)&sun, sizeof sun) == 0)
+                return fd;
+            warn("migrate: Could not connect to %s", addr);
+            close(fd);
+            return -1;
+        }
+        (void)unlink(sun.sun_path);
+        if (bind(fd, (struct sockaddr *)&sun, sizeof sun) == -1 ||
+                listen(fd, 1) == -1) {
+            warn("migrate: Could not listen on %s", addr);
+            close(fd);
+            return -1;
+        }
+        int cfd = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
+        if (cfd == -1)
+            warn("migrate: accept() failed");
+        close(fd);
+        (void)unlink(sun.sun_path);
+        return cfd;
+    }
+
+    if (strncmp(addr, "tcp:", 4) != 0 || strrchr(addr, ':') == addr + 3) {
+        warnx("migrate: Malformed address: %s", addr);
+        return -1;
+    }
+    char *host = strdup(addr + 4);
+    if (host == NULL)
+        err(1, "strdup");
+    char *port = strrchr(host, ':');
+    *port++ = '\0';
+    struct addrinfo hints = {
+        .ai_family = AF_UNSPEC,
+        .ai_socktype = SOCK_STREAM,
+        .ai_flags = listening ? AI_PASSIVE : 0
+    };
+    struct addrinfo *res;
+    int rc = getaddrinfo(*host ? host : NULL, port, &hints, &res);
+    free(host);
+    if (rc != 0) {
+        warnx("migrate: %s: %s", addr, gai_strerror(rc));
+        return -1;
+    }
+    for (struct addrinfo *ai = res; ai != NULL; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC,
+                ai->ai_protocol);
+        if (fd == -1)
+            continue;
+        if (!listening) {
+            if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+                break;
+        }
+        else {
+            int one = 1;
+            (void)setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+            if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 &&
+                    listen(fd, 1) == 0) {
+                int cfd = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
+                close(fd);
+                fd = cfd;
+                break;
+            }
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd == -1) {
+        warn("migrate: Could not %s %s", listening ? "listen on" :
+                "connect to", addr);
+        return -1;
+    }
+    int one = 1;
+    (void)setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+    return fd;
+}
+
+/*
+ * The guest state which cannot be migrated is the same as that which cannot
+ * be saved in a snapshot.
+ */
+static void check_supported(struct hvt *hvt, struct mft *mft)
+{
+#if !(defined(__linux__) && defined(__x86_64__))
+    errx(1, "migrate: Not supported on this host");
+#endif
+    if (hvt->cpus > 1)
+        errx(1, "migrate: Not supported with more than one VCPU");
+    if (hvt->features & (HVT_FEATURE_NET_RINGS | HVT_FEATURE_NET_VHOST))
+        errx(1, "migrate: Not supported with --net-rings or --net-vhost");
+    /*
+     * The guest only registers its trace ring at boot, or when restored
+     * from a snapshot.
+     */
+    if (hvt->features & HVT_FEATURE_TRACE)
+        errx(1, "migrate: Not supported with --trace");
+    for (unsigned i = 0; i != mft->entries; i++) {
+        if (mft->e[i].type == MFT_BLOCK_BASIC && mft->e[i].attached &&
+                (mft->e[i].u.block_basic.flags & MFT_BLOCK_MAPPED))
+            errx(1, "migrate: Not supported with --block-map");
+        /*
+         * The contents of RAM-backed devices are not saved.
+         */
+        if (mft->e[i].type == MFT_BLOCK_BASIC && mft->e[i].attached &&
+                (mft->e[i].u.block_basic.flags & MFT_BLOCK_RAM))
+            errx(1, "migrate: Not supported with RAM block devices");
+    }
+
+    long sz = sysconf(_SC_PAGESIZE);
+    assert(sz > 0 && hvt->mem_size % sz == 0);
+    page_size = sz;
+    npages = hvt->mem_size / page_size;
+}
+
+/*
+ * State of an outgoing migration. (migrate_fd) and (bitmap) are used by
+ * migrate_thread(), and by stop() on the boot VCPU while migrate_thread()
+ * waits for it.
+ */
+static const char *migrate_addr;
+static struct mft *migrate_mft;
+static size_t migrate_mft_size;
+static int trigger_pipe[2];
+static int stop_pipe[2];
+static int migrate_fd = -1;
+static uint64_t *bitmap;
+static unsigned rounds;
+static uint64_t bytes_sent;
+
+enum {
+    STOP_FAILED,
+    STOP_BUSY
+};
+
+static size_t count_pages(void)
+{
+    size_t n = 0;
+
+    for (size_t i = 0; i < HVT_DIRTY_LOG_WORDS(npages); i++)
+        n += __builtin_popcountll(bitmap[i]);
+    return n;
+}
+
+/*
+ * Send the pages set in (bitmap). Returns the number of bytes sent, or -1 on
+ * error.
+ */
+static ssize_t send_pages(struct hvt *hvt, int fd)
+{
+    size_t sent = 0;
+    size_t start = hvt_dirty_log_next(bitmap, npages, 0, true);
+
+    while (start < npages) {
+        size_t end = hvt_dirty_log_next(bitmap, npages, start, false);
+        struct migrate_msg msg = {
+            .type = MIGRATE_PAGES,
+            .gpa = start * page_size,
+            .len = (end - start) * page_size
+        };
+        if (send_all(fd, &msg, sizeof msg) == -1 ||
+                send_all(fd, hvt->mem + msg.gpa, msg.len) == -1)
+            return -1;
+        sent += msg.len;
+        start = hvt_dirty_log_next(bitmap, npages, end, true);
+    }
+    bytes_sent += sent;
+    return sent;
+}
+
+/*
+ * Fetch the pages written since the last call into (bitmap).
+ */
+static int get_dirty(struct hvt *hvt)
+{
+    memset(bitmap, 0, HVT_DIRTY_LOG_WORDS(npages) * sizeof (uint64_t));
+    if (hvt_dirty_log_get(hvt, bitmap) == -1)
+        return -1;
+    hvt_dirty_track_get(hvt, bitmap);
+    return 0;
+}
+
+/*
+ * Set the pages which have been touched by the guest in (bitmap), as for
+ * dumpcore and snapshots. Pages not sent read as zero in the receiving
+ * tender.
+ */
+static int get_touched(struct hvt *hvt)
+{
+    unsigned char *mvec = malloc(npages);
+    if (mvec == NULL)
+        return -1;
+    if (mincore(hvt->mem, hvt->mem_size, (void *)mvec) == -1) {
+        free(mvec);
+        return -1;
+    }
+    memset(bitmap, 0, HVT_DIRTY_LOG_WORDS(npages) * sizeof (uint64_t));
+    for (size_t pg = 0; pg < npages; pg++) {
+        if (mvec[pg] & 1)
+            bitmap[pg / 64] |= 1ULL << (pg % 64);
+    }
+    free(mvec);
+    return 0;
+}
+
+static void mark_page(hvt_gpa_t gpa)
+{
+    if (gpa != 0)
+        bitmap[(gpa / page_size) / 64] |= 1ULL << ((gpa / page_size) % 64);
+}
+
+/*
+ * Called on the boot VCPU once the guest is stopped. Sends the rest of the
+ * guest state and exits if the receiving tender acknowledges it, otherwise
+ * returns to let the guest carry on running, passing the reason back to
+ * migrate_thread().
+ */
+static void stop(struct hvt *hvt)
+{
+    uint8_t result = STOP_BUSY;
+    uint64_t start = monotonic_nsecs();
+    struct hvt_core_state cs;
+    struct migrate_msg msg = { 0 };
+
+    if (hvt_core_busy(hvt))
+        goto out;
+    result = STOP_FAILED;
+    if (get_dirty(hvt) == -1)
+        goto out;
+    /*
+     * Shared pages are written by the tender without being tracked.
+     */
+    hvt_core_save(hvt, &cs);
+    mark_page(cs.time_page);
+    mark_page(cs.poll_page);
+    if (send_pages(hvt, migrate_fd) == -1)
+        goto out;
+
+    msg.type = MIGRATE_VCPU;
+    if (send_all(migrate_fd, &msg, sizeof msg) == -1 ||
+            hvt_vcpu_save(hvt, migrate_fd) == -1)
+        goto out;
+    hvt_core_save(hvt, &cs);
+    msg.type = MIGRATE_CORE;
+    msg.len = sizeof cs;
+    if (send_all(migrate_fd, &msg, sizeof msg) == -1 ||
+            send_all(migrate_fd, &cs, sizeof cs) == -1)
+        goto out;
+    msg.type = MIGRATE_END;
+    msg.len = 0;
+    if (send_all(migrate_fd, &msg, sizeof msg) == -1 ||
+            recv_status(migrate_fd) == -1)
+        goto out;
+
+    warnx("migrate: Migrated guest to %s in %u rounds, %llu MB sent, "
+            "stopped for %llu ms", migrate_addr, rounds,
+            (unsigned long long)bytes_sent >> 20,
+            (unsigned long long)(monotonic_nsecs() - start) / 1000000ULL);
+    exit(0);
+
+out:
+    if (write(stop_pipe[1], &result, 1) != 1)
+        err(1, "migrate: write() failed");
+}
+
+/*
+ * Returns only if migration failed.
+ */
+static int migrate(struct hvt *hvt)
+{
+    struct migrate_header hdr = {
+        .magic = MIGRATE_MAGIC,
+        .version = MIGRATE_VERSION,
+        .cpus = hvt->cpus,
+        .mem_size = hvt->mem_size,
+        .cpu_cycle_freq = hvt->cpu_cycle_freq,
+        .page_size = page_size,
+        .mft_size = migrate_mft_size
+    };
+    uint64_t rate = 0;                  /* Bytes per second */
+    unsigned tries = 0;
+
+    migrate_fd = open_socket(migrate_addr, false);
+    if (migrate_fd == -1)
+        return -1;
+    if (send_all(migrate_fd, &hdr, sizeof hdr) == -1 ||
+            send_all(migrate_fd, migrate_mft, migrate_mft_size) == -1 ||
+            recv_status(migrate_fd) == -1) {
+        warnx("migrate: %s did not accept the guest", migrate_addr);
+        goto out;
+    }
+
+    /*
+     * Pages written from here on are found by get_dirty().
+     */
+    if (hvt_dirty_log_enable(hvt) == -1)
+        goto out;
+    hvt_dirty_track_enable(hvt);
+    if (get_dirty(hvt) == -1 || get_touched(hvt) == -1)
+        goto out;
+    rounds = 0;
+    bytes_sent = 0;
+
+    for (;;) {
+        uint64_t start = monotonic_nsecs();
+        ssize_t sent = send_pages(hvt, migrate_fd);
+        if (sent == -1)
+            goto out;
+        uint64_t elapsed = monotonic_nsecs() - start;
+        if (sent > 0 && elapsed > 0)
+            rate = sent * 1000000000ULL / elapsed;
+        rounds++;
+
+        if (get_dirty(hvt) == -1)
+            goto out;
+        uint64_t left = count_pages() * page_size;
+        if (rounds < MIGRATE_ROUNDS_MAX && left > 0 &&
+                (rate == 0 || left * 1000000000ULL / rate >
+                 MIGRATE_DOWNTIME_NSECS))
+            continue;
+
+        if (hvt_core_interrupt(hvt, stop) == -1) {
+            warnx("migrate: Cannot interrupt the guest on this host");
+            goto out;
+        }
+        uint8_t result;
+        if (read(stop_pipe[0], &result, 1) != 1)
+            err(1, "migrate: read() failed");
+        /*
+         * The pages written since the last round are still in (bitmap) if
+         * the guest had requests in flight.
+         */
+        if (result == STOP_BUSY && ++tries < MIGRATE_STOP_TRIES)
+            continue;
+        if (result == STOP_BUSY)
+            warnx("migrate: Guest keeps requests in flight");
+        goto out;
+    }
+
+out:
+    close(migrate_fd);
+    migrate_fd = -1;
+    return -1;
+}
+
+static void *migrate_thread(void *arg)
+{
+    struct hvt *hvt = arg;
+    uint8_t c;
+
+    for (;;) {
+        ssize_t nbytes = read(trigger_pipe[0], &c, 1);
+        if (nbytes == -1 && errno == EINTR)
+            continue;
+        if (nbytes != 1)
+            err(1, "migrate: read() failed");
+        if (migrate(hvt) == -1)
+            warnx("migrate: Migration to %s failed, guest carries on "
+                    "running", migrate_addr);
+    }
+    return NULL;
+}
+
+static void trigger_handler(int signo)
+{
+    uint8_t c = 0;
+    int saved_errno = errno;
+
+    (void)signo;
+    (void)write(trigger_pipe[1], &c, 1);
+    errno = saved_errno;
+}
+
+void hvt_migrate_init(struct hvt *hvt, const char *addr, struct mft *mft,
+        size_t mft_size)
+{
+    if (addr == NULL)
+        return;
+
+    check_supported(hvt, mft);
+    if (strncmp(addr, "unix:", 5) != 0 && strncmp(addr, "tcp:", 4) != 0)
+        errx(1, "Malformed argument to --migrate-to");
+    migrate_addr = addr;
+    migrate_mft = mft;
+    migrate_mft_size = mft_size;
+    bitmap = calloc(HVT_DIRTY_LOG_WORDS(npages), sizeof (uint64_t));
+    if (bitmap == NULL)
+        err(1, "calloc");
+    if (pipe2(trigger_pipe, O_CLOEXEC) == -1 ||
+            pipe2(stop_pipe, O_CLOEXEC) == -1)
+        err(1, "pipe2() failed");
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof (struct sigaction));
+    sa.sa_handler = trigger_handler;
+    sa.sa_flags = SA_RESTART;
+    sigfillset(&sa.sa_mask);
+    if (sigaction(SIGUSR1, &sa, NULL) == -1)
+        err(1, "Could not install signal handler");
+    /*
+     * The receiving tender may go away at any point, which must not kill
+     * this one.
+     */
+    sa.sa_handler = SIG_IGN;
+    if (sigaction(SIGPIPE, &sa, NULL) == -1)
+        err(1, "Could not install signal handler");
+
+    pthread_t thread;
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    if (pthread_create(&thread, NULL, migrate_thread, hvt) != 0)
+        errx(1, "Could not create migration thread");
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+void hvt_migrate_incoming(struct hvt *hvt, const char *addr, struct mft *mft,
+        size_t mft_size)
+{
+    struct migrate_header hdr;
+    struct migrate_msg msg;
+    struct hvt_core_state cs = { 0 };
+    bool have_vcpu = false;
+
+    check_supported(hvt, mft);
+    int fd = open_socket(addr, true);
+    if (fd == -1)
+        errx(1, "migrate: Could not receive guest on %s", addr);
+    if (recv_all(fd, &hdr, sizeof hdr) == -1 ||
+            memcmp(hdr.magic, MIGRATE_MAGIC, sizeof hdr.magic) != 0 ||
+            hdr.version != MIGRATE_VERSION)
+        errx(1, "migrate: Invalid migration stream");
+
+    const char *mismatch = NULL;
+    if (hdr.mem_size != hvt->mem_size)
+        mismatch = "--mem";
+    else if (hdr.cpus != hvt->cpus)
+        mismatch = "--cpus";
+    else if (hdr.cpu_cycle_freq != hvt->cpu_cycle_freq)
+        mismatch = "CPU cycle counter frequency";
+    else if (hdr.page_size != page_size)
+        mismatch = "page size";
+    else if (hdr.mft_size != mft_size)
+        mismatch = "unikernel";
+    else {
+        struct mft *saved = malloc(mft_size);
+        if (saved == NULL)
+            err(1, "malloc");
+        if (recv_all(fd, saved, mft_size) == -1)
+            errx(1, "migrate: Invalid migration stream");
+        if (!hvt_snapshot_mft_matches(mft, saved))
+            mismatch = "unikernel or devices";
+        free(saved);
+    }
+    if (mismatch != NULL) {
+        (void)send_status(fd, false);
+        errx(1, "migrate: Guest is being migrated with a different %s",
+                mismatch);
+    }
+    if (send_status(fd, true) == -1)
+        errx(1, "migrate: Connection lost");
+
+    for (;;) {
+        if (recv_all(fd, &msg, sizeof msg) == -1)
+            errx(1, "migrate: Connection lost");
+        switch (msg.type) {
+        case MIGRATE_PAGES:
+            if (msg.gpa % page_size != 0 || msg.len % page_size != 0 ||
+                    msg.gpa > hvt->mem_size ||
+                    msg.len > hvt->mem_size - msg.gpa)
+                errx(1, "migrate: Invalid migration stream");
+            if (recv_all(fd, hvt->mem + msg.gpa, msg.len) == -1)
+                errx(1, "migrate: Connection lost");
+            break;
+        case MIGRATE_VCPU:
+            if (hvt_vcpu_restore(hvt, fd) == -1)
+                errx(1, "migrate: Could not restore VCPU state");
+            have_vcpu = true;
+            break;
+        case MIGRATE_CORE:
+            if (msg.len != sizeof cs)
+                errx(1, "migrate: Invalid migration stream");
+            if (recv_all(fd, &cs, sizeof cs) == -1)
+                errx(1, "migrate: Connection lost");
+            break;
+        case MIGRATE_END:
+            if (!have_vcpu)
+                errx(1, "migrate: Invalid migration stream");
+            hvt_core_restore(hvt, &cs);
+            if (send_status(fd, true) == -1)
+                errx(1, "migrate: Connection lost");
+            close(fd);
+            warnx("migrate: Received guest on %s", addr);
+            return;
+        default:
+            errx(1, "migrate: Invalid migration stream");
+        }
+    }
+}
@@ -26,18 +26,452 @@
 #define _FILE_OFFSET_BITS 64
 #include <assert.h>
 #include <err.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "../common/block_attach.h"
+#include "../common/block_cow.h"
+#include "../common/block_nbd.h"
+#include "../common/block_ram.h"
+#include "../common/block_stripe.h"
+#include "../common/block_uring.h"
+#include "../common/block_zone.h"
+#include "../common/rate_limit.h"
 #include "hvt.h"
 #include "solo5.h"
 
 static bool module_in_use;
+static bool direct_in_use;
 static struct mft *host_mft;
 
+/*
+ * Devices attached to a copy-on-write overlay (BASE+OVERLAY) have their reads
+ * and writes performed by block_cow_preadv() and block_cow_pwritev(), and never
+ * use io_uring. Their (hostfd) is the OVERLAY.
+ */
+static struct block_cow *block_cows[MFT_MAX_ENTRIES];
+
+/*
+ * Devices attached to an NBD export have all of their requests performed by
+ * the block_nbd_*() functions, and never use io_uring. Their (hostfd) is a
+ * socket connected to the server, which must not be used for I/O.
+ */
+static struct block_nbd *block_nbds[MFT_MAX_ENTRIES];
+
+/*
+ * RAM-backed devices (ram:SIZE) have their reads and writes performed with
+ * memcpy() to and from the tender's mapping of their contents, and never use
+ * io_uring. Their (hostfd) is the memfd, used for flushes and discards, and
+ * for mapping them into the guest with --block-map.
+ */
+static uint8_t *block_rams[MFT_MAX_ENTRIES];
+
+/*
+ * Striped devices (stripe:UNIT:PATH,...) have their reads, writes, flushes
+ * and discards performed by the block_stripe_*() functions, and never use the
+ * device's io_uring. Their (hostfd) is the first member, which must not be
+ * used for I/O.
+ */
+static struct block_stripe *block_stripes[MFT_MAX_ENTRIES];
+
+/*
+ * Devices attached with --block-direct are opened with O_DIRECT, which
+ * requires buffers to be aligned to the block size. Requests with segments
+ * that are not aligned are performed through an aligned bounce buffer of
+ * SOLO5_BLOCK_IO_MAX bytes instead. Each VCPU thread has its own
+ * (vcpu_bounce), allocated on first use, and each I/O thread has its own.
+ */
+static __thread void *vcpu_bounce;
+
+static void *bounce_alloc(void)
+{
+    void *p;
+
+    if (posix_memalign(&p, 4096, SOLO5_BLOCK_IO_MAX) != 0)
+        errx(1, "Could not allocate block I/O bounce buffer");
+    return p;
+}
+
+static void *vcpu_bounce_get(void)
+{
+    if (direct_in_use && vcpu_bounce == NULL)
+        vcpu_bounce = bounce_alloc();
+    return vcpu_bounce;
+}
+
+/*
+ * Quality of service (--block-rate, --block-prio).
+ *
+ * Requests on a device with a rate limit are held back until the limit allows
+ * them: synchronous requests by sleeping in the VCPU thread, and asynchronous
+ * requests by leaving them queued for the I/O threads, which never use
+ * io_uring for such devices, see aio_next_req(). All buckets are protected by
+ * (qos_lock).
+ *
+ * The host I/O priority of a device is applied to each thread before it
+ * performs a request on the device, and to requests submitted to io_uring.
+ * (thread_ioprio) is the priority last applied to the calling thread.
+ */
+static struct {
+    struct rate_limit rate;
+    int ioprio;
+} block_qos[MFT_MAX_ENTRIES];
+static pthread_mutex_t qos_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread int thread_ioprio = BLOCK_IOPRIO_NONE;
+
+static void qos_ioprio(uint64_t handle)
+{
+    if (block_qos[handle].ioprio != thread_ioprio &&
+            block_set_ioprio(block_qos[handle].ioprio) == 0)
+        thread_ioprio = block_qos[handle].ioprio;
+}
+
+/*
+ * Called before performing a synchronous request of (bytes) on device
+ * (handle), to wait for and charge its rate limit and apply its priority.
+ */
+static void qos_begin(uint64_t handle, size_t bytes)
+{
+    struct rate_limit *rl = &block_qos[handle].rate;
+
+    while (rate_limit_enabled(rl)) {
+        pthread_mutex_lock(&qos_lock);
+        uint64_t now = rate_limit_clock();
+        uint64_t wait = rate_limit_wait(rl, now);
+        if (wait == 0)
+            rate_limit_charge(rl, now, bytes);
+        pthread_mutex_unlock(&qos_lock);
+        if (wait == 0)
+            break;
+        struct timespec ts = {
+            .tv_sec = wait / 1000000000ULL,
+            .tv_nsec = wait % 1000000000ULL
+        };
+        nanosleep(&ts, NULL);
+    }
+    qos_ioprio(handle);
+}
+
+static bool block_iov_aligned(struct mft_entry *e, const struct iovec *iov,
+        size_t iovcnt)
+{
+    uintptr_t mask = e->u.block_basic.block_size - 1;
+
+    if (!(e->u.block_basic.flags & MFT_BLOCK_DIRECT))
+        return true;
+    for (size_t i = 0; i < iovcnt; i++) {
+        if (((uintptr_t)iov[i].iov_base | iov[i].iov_len) & mask)
+            return false;
+    }
+    return true;
+}
+
+static void block_probe(uint64_t handle, bool write, off_t pos, size_t len)
+{
+    if (write)
+        TENDER_PROBE3(block__write, handle, pos, len);
+    else
+        TENDER_PROBE3(block__read, handle, pos, len);
+}
+
+/*
+ * Sequential read-ahead. The host reads ahead of each open file on its own,
+ * but loses track of several sequential readers interleaved on one device, as
+ * when VCPUs or queued requests scan different parts of it. Reads are
+ * therefore matched against up to RA_STREAMS streams per device, and once a
+ * stream has seen RA_TRIGGER consecutive reads, the host is asked to read
+ * ahead of it with posix_fadvise(POSIX_FADV_WILLNEED), in windows doubling
+ * from RA_WINDOW_MIN to RA_WINDOW_MAX. The least recently used stream is
+ * replaced by reads matching none.
+ *
+ * Devices attached with --block-direct bypass the host page cache, and NBD
+ * exports read ahead on their own, so neither is tracked. On overlays, BASE
+ * is read ahead.
+ */
+#define RA_STREAMS 4
+#define RA_TRIGGER 2
+#define RA_WINDOW_MIN (128 * 1024)
+#define RA_WINDOW_MAX (2 * 1024 * 1024)
+
+struct ra_stream {
+    off_t next;                 /* Offset expected of the next read */
+    off_t end;                  /* End of the data read ahead */
+    off_t window;
+    unsigned hits;
+    uint64_t used;
+};
+
+static struct ra_dev {
+    pthread_mutex_t lock;
+    int fd;                     /* -1 if not tracked */
+    uint64_t clock;
+    struct ra_stream streams[RA_STREAMS];
+} ra_devs[MFT_MAX_ENTRIES];
+
+static void ra_observe(uint64_t handle, off_t pos, size_t len)
+{
+    struct ra_dev *d = &ra_devs[handle];
+    if (d->fd == -1)
+        return;
+
+    pthread_mutex_lock(&d->lock);
+    struct ra_stream *s = &d->streams[0];
+    for (unsigned i = 0; i < RA_STREAMS; i++) {
+        struct ra_stream *x = &d->streams[i];
+        if (x->hits != 0 && x->next == pos) {
+            s = x;
+            break;
+        }
+        if (x->used < s->used)
+            s = x;
+    }
+    if (s->hits == 0 || s->next != pos) {
+        s->hits = 0;
+        s->end = 0;
+        s->window = RA_WINDOW_MIN;
+    }
+    s->hits++;
+    s->next = pos + len;
+    s->used = ++d->clock;
+
+    off_t start = 0, n = 0;
+    if (s->hits >= RA_TRIGGER && s->end - s->next < s->window / 2) {
+        off_t capacity = host_mft->e[handle].u.block_basic.capacity;
+        start = (s->end > s->next) ? s->end : s->next;
+        n = (start + s->window > capacity) ? capacity - start : s->window;
+        s->end = start + n;
+        if (s->window < RA_WINDOW_MAX)
+            s->window *= 2;
+    }
+    pthread_mutex_unlock(&d->lock);
+
+    if (n > 0)
+        (void)posix_fadvise(d->fd, start, n, POSIX_FADV_WILLNEED);
+}
+
+static void ra_init(struct mft *mft)
+{
+    for (unsigned i = 0; i != MFT_MAX_ENTRIES; i++) {
+        struct ra_dev *d = &ra_devs[i];
+        pthread_mutex_init(&d->lock, NULL);
+        d->fd = -1;
+        if (i >= mft->entries || mft->e[i].type != MFT_BLOCK_BASIC ||
+                !mft->e[i].attached ||
+                (mft->e[i].u.block_basic.flags & MFT_BLOCK_DIRECT) ||
+                block_nbds[i] != NULL || block_rams[i] != NULL ||
+                block_stripes[i] != NULL)
+            continue;
+        d->fd = (block_cows[i] != NULL) ? block_cows[i]->basefd :
+            mft->e[i].hostfd;
+    }
+}
+
+/*
+ * Reads or writes the (iovcnt) segments in (iov[]), of (len) bytes in total,
+ * at (pos) on (e), using (bounce) if required.
+ */
+static ssize_t block_rw(struct mft_entry *e, bool write,
+        const struct iovec *iov, size_t iovcnt, size_t len, off_t pos,
+        void *bounce)
+{
+    struct block_cow *cow = block_cows[e - host_mft->e];
+    struct block_nbd *nbd = block_nbds[e - host_mft->e];
+    uint8_t *ram = block_rams[e - host_mft->e];
+    struct block_stripe *st = block_stripes[e - host_mft->e];
+    uint8_t *p = bounce;
+    ssize_t ret;
+
+    block_probe(e - host_mft->e, write, pos, len);
+    if (ram != NULL) {
+        p = ram + pos;
+        for (size_t i = 0; i < iovcnt; p += iov[i++].iov_len) {
+            if (write)
+                memcpy(p, iov[i].iov_base, iov[i].iov_len);
+            else
+                memcpy(iov[i].iov_base, p, iov[i].iov_len);
+        }
+        return len;
+    }
+    if (!write)
+        ra_observe(e - host_mft->e, pos, len);
+    if (nbd != NULL) {
+        if (write)
+            return block_nbd_pwritev(nbd, iov, iovcnt, pos);
+        else
+            return block_nbd_preadv(nbd, iov, iovcnt, pos);
+    }
+    if (cow != NULL) {
+        if (write)
+            return block_cow_pwritev(cow, iov, iovcnt, pos);
+        else
+            return block_cow_preadv(cow, iov, iovcnt, pos);
+    }
+    if (len > SOLO5_BLOCK_IO_MAX || block_iov_aligned(e, iov, iovcnt)) {
+        if (st != NULL && write)
+            return block_stripe_pwritev(st, iov, iovcnt, pos);
+        else if (st != NULL)
+            return block_stripe_preadv(st, iov, iovcnt, pos);
+        else if (write)
+            return pwritev(e->hostfd, iov, iovcnt, pos);
+        else
+            return preadv(e->hostfd, iov, iovcnt, pos);
+    }
+
+    struct iovec biov = { .iov_base = bounce, .iov_len = len };
+    if (write) {
+        for (size_t i = 0; i < iovcnt; p += iov[i++].iov_len)
+            memcpy(p, iov[i].iov_base, iov[i].iov_len);
+        if (st != NULL)
+            return block_stripe_pwritev(st, &biov, 1, pos);
+        return pwrite(e->hostfd, bounce, len, pos);
+    }
+    ret = (st != NULL) ? block_stripe_preadv(st, &biov, 1, pos) :
+        pread(e->hostfd, bounce, len, pos);
+    if (ret == (ssize_t)len) {
+        for (size_t i = 0; i < iovcnt; p += iov[i++].iov_len)
+            memcpy(iov[i].iov_base, p, iov[i].iov_len);
+    }
+    return ret;
+}
+
+/*
+ * Write coalescing (--block-coalesce:NAME). A synchronous write which
+ * directly follows the previous one on a device is copied into the device's
+ * (struct wc), and the run of writes is performed as one once the buffer is
+ * full, or when it is written out by wc_flush(): on a write elsewhere, before
+ * any other request overlapping the buffered range, before flushes, and when
+ * the guest yields, halts or is about to be migrated. An error writing out
+ * the buffer is reported by the next flush of the device.
+ */
+#define WC_SIZE (1024 * 1024)
+
+struct wc {
+    pthread_mutex_t lock;
+    uint8_t *buf;
+    size_t len;
+    off_t pos;
+    bool failed;
+};
+
+static struct wc *wcs[MFT_MAX_ENTRIES];
+static bool wc_requested[MFT_MAX_ENTRIES];
+static bool wc_in_use;
+
+/*
+ * Must be called with (w->lock) held.
+ */
+static void wc_writeout(struct mft_entry *e, struct wc *w)
+{
+    if (w->len == 0)
+        return;
+    struct iovec iov = { .iov_base = w->buf, .iov_len = w->len };
+    if (block_rw(e, true, &iov, 1, w->len, w->pos, NULL) != (ssize_t)w->len)
+        w->failed = true;
+    w->len = 0;
+}
+
+/*
+ * Writes out the buffer of device (handle), if any, if it overlaps the (len)
+ * bytes at (pos), or regardless if (len) is 0.
+ */
+static void wc_flush(uint64_t handle, off_t pos, size_t len)
+{
+    struct wc *w = wcs[handle];
+
+    if (w == NULL)
+        return;
+    pthread_mutex_lock(&w->lock);
+    if (len == 0 || (pos < w->pos + (off_t)w->len &&
+                w->pos < pos + (off_t)len))
+        wc_writeout(&host_mft->e[handle], w);
+    pthread_mutex_unlock(&w->lock);
+}
+
+/*
+ * Returns true, once, if writing out the buffer of device (handle) has failed
+ * since the last call.
+ */
+static bool wc_failed(uint64_t handle)
+{
+    struct wc *w = wcs[handle];
+    bool failed;
+
+    if (w == NULL)
+        return false;
+    pthread_mutex_lock(&w->lock);
+    failed = w->failed;
+    w->failed = false;
+    pthread_mutex_unlock(&w->lock);
+    return failed;
+}
+
+/*
+ * Performs a synchronous write of the (iovcnt) segments in (iov[]), of (len)
+ * bytes in total, at (pos) on device (handle), through its buffer.
+ */
+static solo5_result_t wc_write(uint64_t handle, const struct iovec *iov,
+        size_t iovcnt, size_t len, off_t pos)
+{
+    struct mft_entry *e = &host_mft->e[handle];
+    struct wc *w = wcs[handle];
+    solo5_result_t rc = SOLO5_R_OK;
+
+    pthread_mutex_lock(&w->lock);
+    if (w->len != 0 && (pos != w->pos + (off_t)w->len ||
+                w->len + len > WC_SIZE))
+        wc_writeout(e, w);
+    if (len > WC_SIZE) {
+        if (block_rw(e, true, iov, iovcnt, len, pos, vcpu_bounce_get()) !=
+                (ssize_t)len)
+            rc = SOLO5_R_EUNSPEC;
+    }
+    else {
+        if (w->len == 0)
+            w->pos = pos;
+        for (size_t i = 0; i < iovcnt; i++) {
+            memcpy(w->buf + w->len, iov[i].iov_base, iov[i].iov_len);
+            w->len += iov[i].iov_len;
+        }
+        if (w->len == WC_SIZE)
+            wc_writeout(e, w);
+    }
+    pthread_mutex_unlock(&w->lock);
+    return rc;
+}
+
+static void wc_flush_all(void)
+{
+    for (unsigned i = 0; i != MFT_MAX_ENTRIES; i++)
+        wc_flush(i, 0, 0);
+}
+
+static void wc_idle(struct hvt *hvt)
+{
+    (void)hvt;
+    wc_flush_all();
+}
+
+static void wc_halt(struct hvt *hvt, int status, void *cookie)
+{
+    (void)hvt;
+    (void)status;
+    (void)cookie;
+    wc_flush_all();
+    for (unsigned i = 0; i != MFT_MAX_ENTRIES; i++) {
+        if (wc_failed(i))
+            warnx("%s: Buffered writes failed", host_mft->e[i].name);
+    }
+}
+
 static void hypercall_block_write(struct hvt *hvt, hvt_gpa_t gpa)
 {
     struct hvt_hc_block_write *wr =
@@ -64,10 +498,17 @@ static void hypercall_block_write(struct hvt *hvt, hvt_gpa_t gpa)
         return;
     }
 
-    ret = pwrite(e->hostfd, HVT_CHECKED_GPA_P(hvt, wr->data, wr->len), wr->len,
-            pos);
-    assert(ret == wr->len);
-    wr->ret = SOLO5_R_OK;
+    struct iovec iov = {
+        .iov_base = HVT_CHECKED_GPA_P(hvt, wr->data, wr->len),
+        .iov_len = wr->len
+    };
+    qos_begin(wr->handle, wr->len);
+    if (wcs[wr->handle] != NULL) {
+        wr->ret = wc_write(wr->handle, &iov, 1, wr->len, pos);
+        return;
+    }
+    ret = block_rw(e, true, &iov, 1, wr->len, pos, vcpu_bounce_get());
+    wr->ret = (ret == (ssize_t)wr->len) ? SOLO5_R_OK : SOLO5_R_EUNSPEC;
 }
 
 static void hypercall_block_read(struct hvt *hvt, hvt_gpa_t gpa)
@@ -96,37 +537,1163 @@ static void hypercall_block_read(struct hvt *hvt, hvt_gpa_t gpa)
         return;
     }
 
-    ret = pread(e->hostfd, HVT_CHECKED_GPA_P(hvt, rd->data, rd->len), rd->len,
-            pos);
-    assert(ret == rd->len);
-    rd->ret = SOLO5_R_OK;
+    struct iovec iov = {
+        .iov_base = HVT_CHECKED_GPA_P(hvt, rd->data, rd->len),
+        .iov_len = rd->len
+    };
+    qos_begin(rd->handle, rd->len);
+    wc_flush(rd->handle, pos, rd->len);
+    ret = block_rw(e, false, &iov, 1, rd->len, pos, vcpu_bounce_get());
+    rd->ret = (ret == (ssize_t)rd->len) ? SOLO5_R_OK : SOLO5_R_EUNSPEC;
 }
 
-static int handle_cmdarg(char *cmdarg, struct mft *mft)
+/*
+ * Validates the (iovcnt) segments at (gpa) of a vectored request starting at
+ * (offset) on (e), and maps them into (iov[]). Returns the total length of
+ * the request, or -1 if it is invalid.
+ */
+static ssize_t block_iov_map(struct hvt *hvt, struct mft_entry *e,
+        uint64_t offset, hvt_gpa_t gpa, size_t iovcnt, struct iovec *iov)
+{
+    if (iovcnt == 0 || iovcnt > HVT_BLOCK_IOV_MAX)
+        return -1;
+
+    struct hvt_block_iov *biov = HVT_CHECKED_GPA_P(hvt, gpa,
+            iovcnt * sizeof (struct hvt_block_iov));
+    off_t pos, end;
+    size_t len = 0;
+
+    for (size_t i = 0; i < iovcnt; i++) {
+        if (biov[i].len > SSIZE_MAX - len)
+            return -1;
+        iov[i].iov_base = HVT_CHECKED_GPA_P(hvt, biov[i].data, biov[i].len);
+        iov[i].iov_len = biov[i].len;
+        len += biov[i].len;
+    }
+    if (offset >= e->u.block_basic.capacity)
+        return -1;
+    pos = offset;
+    if (add_overflow(pos, len, end)
+            || (end > e->u.block_basic.capacity))
+        return -1;
+    return len;
+}
+
+static void hypercall_block_writev(struct hvt *hvt, hvt_gpa_t gpa)
+{
+    struct hvt_hc_block_writev *wr =
+        HVT_CHECKED_GPA_P(hvt, gpa, sizeof (struct hvt_hc_block_writev));
+    struct mft_entry *e = mft_get_by_index(host_mft, wr->handle,
+            MFT_BLOCK_BASIC);
+    struct iovec iov[HVT_BLOCK_IOV_MAX];
+    ssize_t len, ret;
+
+    if (e == NULL ||
+            (len = block_iov_map(hvt, e, wr->offset, wr->iov, wr->iovcnt,
+                                 iov)) == -1) {
+        wr->ret = SOLO5_R_EINVAL;
+        return;
+    }
+
+    qos_begin(wr->handle, len);
+    if (wcs[wr->handle] != NULL) {
+        wr->ret = wc_write(wr->handle, iov, wr->iovcnt, len, wr->offset);
+        return;
+    }
+    ret = block_rw(e, true, iov, wr->iovcnt, len, wr->offset, vcpu_bounce_get());
+    wr->ret = (ret == len) ? SOLO5_R_OK : SOLO5_R_EUNSPEC;
+}
+
+static void hypercall_block_readv(struct hvt *hvt, hvt_gpa_t gpa)
+{
+    struct hvt_hc_block_readv *rd =
+        HVT_CHECKED_GPA_P(hvt, gpa, sizeof (struct hvt_hc_block_readv));
+    struct mft_entry *e = mft_get_by_index(host_mft, rd->handle,
+            MFT_BLOCK_BASIC);
+    struct iovec iov[HVT_BLOCK_IOV_MAX];
+    ssize_t len, ret;
+
+    if (e == NULL ||
+            (len = block_iov_map(hvt, e, rd->offset, rd->iov, rd->iovcnt,
+                                 iov)) == -1) {
+        rd->ret = SOLO5_R_EINVAL;
+        return;
+    }
+
+    qos_begin(rd->handle, len);
+    wc_flush(rd->handle, rd->offset, len);
+    ret = block_rw(e, false, iov, rd->iovcnt, len, rd->offset, vcpu_bounce_get());
+    rd->ret = (ret == len) ? SOLO5_R_OK : SOLO5_R_EUNSPEC;
+}
+
+/*
+ * Validates a range of (len) bytes starting at (offset) on (e), for
+ * HVT_HYPERCALL_BLOCK_DISCARD, HVT_HYPERCALL_BLOCK_WRITE_ZEROES and
+ * HVT_HYPERCALL_BLOCK_PREFETCH.
+ */
+static bool block_range_valid(struct mft_entry *e, uint64_t offset,
+        uint64_t len)
+{
+    return len != 0 && offset < e->u.block_basic.capacity &&
+        len <= e->u.block_basic.capacity - offset;
+}
+
+/*
+ * Discarding is advisory, so it succeeds without doing anything where the
+ * host or backing storage cannot punch holes, and on overlays, where holes
+ * would expose the data in BASE.
+ */
+static void hypercall_block_discard(struct hvt *hvt, hvt_gpa_t gpa)
+{
+    struct hvt_hc_block_discard *dc =
+        HVT_CHECKED_GPA_P(hvt, gpa, sizeof (struct hvt_hc_block_discard));
+    struct mft_entry *e = mft_get_by_index(host_mft, dc->handle,
+            MFT_BLOCK_BASIC);
+    if (e == NULL || !block_range_valid(e, dc->offset, dc->len)) {
+        dc->ret = SOLO5_R_EINVAL;
+        return;
+    }
+
+    dc->ret = SOLO5_R_OK;
+    if (block_cows[dc->handle] != NULL)
+        return;
+    qos_begin(dc->handle, 0);
+    wc_flush(dc->handle, dc->offset, dc->len);
+    if (block_nbds[dc->handle] != NULL) {
+        if (block_nbd_trim(block_nbds[dc->handle], dc->offset, dc->len) == -1)
+            dc->ret = SOLO5_R_EUNSPEC;
+        return;
+    }
+#if defined(__linux__)
+    int rc = (block_stripes[dc->handle] != NULL) ?
+        block_stripe_fallocate(block_stripes[dc->handle],
+                FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, dc->offset,
+                dc->len) :
+        fallocate(e->hostfd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                dc->offset, dc->len);
+    if (rc == -1 && errno != EOPNOTSUPP)
+        dc->ret = SOLO5_R_EUNSPEC;
+#endif
+}
+
+/*
+ * Prefetching is advisory, so it does nothing on devices which are not read
+ * ahead, see ra_observe().
+ */
+static void hypercall_block_prefetch(struct hvt *hvt, hvt_gpa_t gpa)
+{
+    struct hvt_hc_block_prefetch *pf =
+        HVT_CHECKED_GPA_P(hvt, gpa, sizeof (struct hvt_hc_block_prefetch));
+    struct mft_entry *e = mft_get_by_index(host_mft, pf->handle,
+            MFT_BLOCK_BASIC);
+    if (e == NULL || !block_range_valid(e, pf->offset, pf->len)) {
+        pf->ret = SOLO5_R_EINVAL;
+        return;
+    }
+
+    pf->ret = SOLO5_R_OK;
+    if (ra_devs[pf->handle].fd != -1)
+        (void)posix_fadvise(ra_devs[pf->handle].fd, pf->offset, pf->len,
+                POSIX_FADV_WILLNEED);
+}
+
+/*
+ * Zeroes are written with FALLOC_FL_ZERO_RANGE, or NBD_CMD_WRITE_ZEROES on NBD
+ * exports, where supported, otherwise, and always on overlays, from a buffer
+ * of zeroes.
+ */
+static void hypercall_block_write_zeroes(struct hvt *hvt, hvt_gpa_t gpa)
+{
+    static const char zeroes[64 * 1024] __attribute__((aligned(4096)));
+    struct hvt_hc_block_write_zeroes *wz =
+        HVT_CHECKED_GPA_P(hvt, gpa, sizeof (struct hvt_hc_block_write_zeroes));
+    struct mft_entry *e = mft_get_by_index(host_mft, wz->handle,
+            MFT_BLOCK_BASIC);
+    if (e == NULL || !block_range_valid(e, wz->offset, wz->len)) {
+        wz->ret = SOLO5_R_EINVAL;
+        return;
+    }
+
+    off_t pos = wz->offset, end = pos + wz->len;
+    wz->ret = SOLO5_R_OK;
+    qos_begin(wz->handle, wz->len);
+    wc_flush(wz->handle, wz->offset, wz->len);
+    if (block_nbds[wz->handle] != NULL) {
+        if (block_nbd_write_zeroes(block_nbds[wz->handle], pos, wz->len) == 0)
+            return;
+        if (errno != ENOTSUP) {
+            wz->ret = SOLO5_R_EUNSPEC;
+            return;
+        }
+    }
+#if defined(__linux__)
+    else if (block_cows[wz->handle] == NULL) {
+        int rc = (block_stripes[wz->handle] != NULL) ?
+            block_stripe_fallocate(block_stripes[wz->handle],
+                    FALLOC_FL_ZERO_RANGE, pos, wz->len) :
+            fallocate(e->hostfd, FALLOC_FL_ZERO_RANGE, pos, wz->len);
+        if (rc == 0)
+            return;
+        if (errno != EOPNOTSUPP) {
+            wz->ret = SOLO5_R_EUNSPEC;
+            return;
+        }
+    }
+#endif
+    while (pos < end) {
+        size_t len = (end - pos < (off_t)sizeof zeroes) ?
+            (size_t)(end - pos) : sizeof zeroes;
+        struct iovec iov = { .iov_base = (void *)zeroes, .iov_len = len };
+        if (block_rw(e, true, &iov, 1, len, pos, vcpu_bounce_get()) !=
+                (ssize_t)len) {
+            wz->ret = SOLO5_R_EUNSPEC;
+            return;
+        }
+        pos += len;
+    }
+}
+
+/*
+ * Zoned devices (those with a non-zero zone_blocks) must be attached with
+ * --block-direct, as writes to a sequential zone must reach the device in
+ * order, which writeback from the host page cache does not guarantee. Linux
+ * offers no zone append to user space, so appends are emulated by writing at
+ * the write pointer reported for the zone, with appends and zone management
+ * operations on a device serialised by its (zone_locks[]). Writes performed
+ * otherwise to a zone being appended to therefore make appends fail.
+ */
+static pthread_mutex_t zone_locks[MFT_MAX_ENTRIES];
+
+/*
+ * Reports the sequential zone starting at byte (start) of (e) into (*z).
+ */
+static solo5_result_t zone_get(struct mft_entry *e, uint64_t start,
+        struct block_zone *z)
+{
+    uint64_t size = (uint64_t)e->u.block_basic.zone_blocks *
+        e->u.block_basic.block_size;
+
+    if (size == 0 || start >= e->u.block_basic.capacity || start % size != 0)
+        return SOLO5_R_EINVAL;
+    if (block_zone_report(e->hostfd, start, z, 1) != 1)
+        return SOLO5_R_EUNSPEC;
+    if (z->start != start || z->type == BLOCK_ZONE_TYPE_CONVENTIONAL)
+        return SOLO5_R_EINVAL;
+    return SOLO5_R_OK;
+}
+
+static void hypercall_block_zone_report(struct hvt *hvt, hvt_gpa_t gpa)
+{
+    struct hvt_hc_block_zone_report *zr =
+        HVT_CHECKED_GPA_P(hvt, gpa, sizeof (struct hvt_hc_block_zone_report));
+    struct mft_entry *e = mft_get_by_index(host_mft, zr->handle,
+            MFT_BLOCK_BASIC);
+    if (e == NULL || e->u.block_basic.zone_blocks == 0 ||
+            zr->offset >= e->u.block_basic.capacity || zr->count == 0 ||
+            zr->count > HVT_BLOCK_ZONES_MAX) {
+        zr->ret = SOLO5_R_EINVAL;
+        return;
+    }
+
+    struct hvt_block_zone *gz = HVT_CHECKED_GPA_P(hvt, zr->zones,
+            zr->count * sizeof (struct hvt_block_zone));
+    struct block_zone z[HVT_BLOCK_ZONES_MAX];
+    int n = block_zone_report(e->hostfd, zr->offset, z, zr->count);
+    if (n == -1) {
+        zr->ret = SOLO5_R_EUNSPEC;
+        return;
+    }
+    for (int i = 0; i < n; i++) {
+        gz[i].start = z[i].start;
+        gz[i].size = z[i].size;
+        gz[i].capacity = z[i].capacity;
+        gz[i].write_pointer = z[i].write_pointer;
+        gz[i].type = z[i].type;
+        gz[i].cond = z[i].cond;
+    }
+    zr->nzones = n;
+    zr->ret = SOLO5_R_OK;
+}
+
+static void hypercall_block_zone_append(struct hvt *hvt, hvt_gpa_t gpa)
+{
+    struct hvt_hc_block_zone_append *za =
+        HVT_CHECKED_GPA_P(hvt, gpa, sizeof (struct hvt_hc_block_zone_append));
+    struct mft_entry *e = mft_get_by_index(host_mft, za->handle,
+            MFT_BLOCK_BASIC);
+    if (e == NULL || za->len == 0 || za->len > SOLO5_BLOCK_IO_MAX ||
+            za->len % e->u.block_basic.block_size != 0) {
+        za->ret = SOLO5_R_EINVAL;
+        return;
+    }
+
+    struct iovec iov = {
+        .iov_base = HVT_CHECKED_GPA_P(hvt, za->data, za->len),
+        .iov_len = za->len
+    };
+    struct block_zone z;
+    qos_begin(za->handle, za->len);
+    pthread_mutex_lock(&zone_locks[za->handle]);
+    za->ret = zone_get(e, za->zone, &z);
+    if (za->ret == SOLO5_R_OK) {
+        if (z.cond == BLOCK_ZONE_COND_READONLY ||
+                z.cond == BLOCK_ZONE_COND_FULL ||
+                z.cond == BLOCK_ZONE_COND_OFFLINE ||
+                za->len > z.start + z.capacity - z.write_pointer)
+            za->ret = SOLO5_R_EINVAL;
+        else if (block_rw(e, true, &iov, 1, za->len, z.write_pointer,
+                    vcpu_bounce_get()) != (ssize_t)za->len)
+            za->ret = SOLO5_R_EUNSPEC;
+        else
+            za->offset = z.write_pointer;
+    }
+    pthread_mutex_unlock(&zone_locks[za->handle]);
+}
+
+static void hypercall_block_zone_manage(struct hvt *hvt, hvt_gpa_t gpa)
+{
+    struct hvt_hc_block_zone_manage *zm =
+        HVT_CHECKED_GPA_P(hvt, gpa, sizeof (struct hvt_hc_block_zone_manage));
+    struct mft_entry *e = mft_get_by_index(host_mft, zm->handle,
+            MFT_BLOCK_BASIC);
+    if (e == NULL || zm->op < BLOCK_ZONE_RESET || zm->op > BLOCK_ZONE_FINISH) {
+        zm->ret = SOLO5_R_EINVAL;
+        return;
+    }
+
+    struct block_zone z;
+    pthread_mutex_lock(&zone_locks[zm->handle]);
+    zm->ret = zone_get(e, zm->zone, &z);
+    if (zm->ret == SOLO5_R_OK &&
+            block_zone_manage(e->hostfd, zm->op, z.start, z.size) == -1)
+        zm->ret = SOLO5_R_EUNSPEC;
+    pthread_mutex_unlock(&zone_locks[zm->handle]);
+}
+
+/*
+ * Devices attached with --block-map are mapped over guest memory set aside
+ * for them by the guest, and read by it directly. Replacing part of guest
+ * memory in this way is only possible with KVM, where guest memory is an
+ * ordinary mapping in the tender. The mapping is read-only, so a guest write
+ * to it fails KVM_RUN, terminating the guest.
+ */
+static bool block_mapped[MFT_MAX_ENTRIES];
+
+static void hypercall_block_map(struct hvt *hvt, hvt_gpa_t gpa)
+{
+    struct hvt_hc_block_map *mp =
+        HVT_CHECKED_GPA_P(hvt, gpa, sizeof (struct hvt_hc_block_map));
+    struct mft_entry *e = mft_get_by_index(host_mft, mp->handle,
+            MFT_BLOCK_BASIC);
+    if (e == NULL || !(e->u.block_basic.flags & MFT_BLOCK_MAPPED) ||
+            block_mapped[mp->handle] ||
+            (mp->data & (HVT_BLOCK_MAP_ALIGN - 1)) != 0) {
+        mp->ret = SOLO5_R_EINVAL;
+        return;
+    }
+
+    size_t len = (e->u.block_basic.capacity + HVT_BLOCK_MAP_ALIGN - 1) &
+        ~(size_t)(HVT_BLOCK_MAP_ALIGN - 1);
+    void *data = HVT_CHECKED_GPA_P(hvt, mp->data, len);
+#if defined(__linux__)
+    if (mmap(data, len, PROT_READ, MAP_SHARED | MAP_FIXED, e->hostfd, 0) ==
+            MAP_FAILED)
+        err(1, "Could not map block device into guest memory");
+    block_mapped[mp->handle] = true;
+    mp->ret = SOLO5_R_OK;
+#else
+    (void)data;
+    mp->ret = SOLO5_R_EUNSPEC;
+#endif
+}
+
+/*
+ * Asynchronous block I/O.
+ *
+ * Where the host supports it, each device has an io_uring instance restricted
+ * to the device (see block_uring.h). The requests in a batch are submitted
+ * with a single io_uring_enter() per device, and completions are signalled on
+ * the ring's eventfd, which is in the poll wait set. Each request occupies a
+ * slot in (uring_reqs), whose index is passed to the kernel to identify it.
+ *
+ * Otherwise, submitted requests are queued per device and performed by a pool
+ * of I/O threads, which queue the results as completions for the guest to
+ * reap. A device's (readyfd) pipe is in the poll wait set, and holds data
+ * exactly while its completion queue is non-empty. All queues are protected
+ * by (aio_lock).
+ *
+ * Flushes are always performed by the I/O threads, so that concurrent
+ * flushes can be folded into a single fdatasync(), see aio_flush(), as are
+ * requests needing a bounce buffer for direct I/O, and all requests on
+ * devices with a rate limit. On devices using io_uring, their completions are
+ * queued as above, but signalled on the ring's eventfd.
+ */
+#define AIO_THREADS 4
+
+struct aio_req {
+    struct mft_entry *e;
+    uint64_t op;
+    void *data;
+    size_t len;
+    off_t offset;
+    uint64_t tag;
+    uint64_t ticket;            /* HVT_BLOCK_OP_FLUSH, see aio_flush() */
+};
+
+struct aio_dev {
+    struct aio_req sq[SOLO5_BLOCK_QUEUE_MAX];
+    unsigned sq_head, sq_tail;
+    struct hvt_block_completion cq[SOLO5_BLOCK_QUEUE_MAX];
+    unsigned cq_head, cq_tail;
+    unsigned outstanding;       /* Submitted, not yet reaped */
+    int readyfd[2];
+    bool use_uring;
+    struct block_uring uring;
+    struct aio_uring_req {
+        uint64_t tag;
+        size_t len;
+    } uring_reqs[SOLO5_BLOCK_QUEUE_MAX];
+    uint64_t uring_busy;        /* Bitmap of used (uring_reqs) */
+    uint64_t sync_started;      /* Generation of last fdatasync() started */
+    uint64_t sync_done;         /* Generation of last fdatasync() completed */
+    uint64_t sync_failed;       /* Generation of last fdatasync() failed */
+    bool syncing;
+    struct aio_buffer {
+        uint8_t *data;          /* NULL if not registered */
+        hvt_gpa_t gpa;
+        size_t len;
+        bool fixed;             /* Registered with (uring) */
+    } buffers[HVT_BLOCK_BUFFERS_MAX];
+};
+
+static struct aio_dev aio_devs[MFT_MAX_ENTRIES];
+static pthread_mutex_t aio_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t aio_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t aio_sync_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t aio_threads[AIO_THREADS];
+
+/*
+ * Group commit. A flush takes a (ticket) of (sync_started + 1) when queued,
+ * and is complete once the fdatasync() of that generation, which necessarily
+ * starts after the flush was queued, is done. Flushes queued while a
+ * fdatasync() is running thus all share the next one. Must be called with
+ * (aio_lock) held, which is released while waiting.
+ */
+static int aio_flush(struct aio_dev *d, int hostfd, uint64_t ticket)
+{
+    while (d->sync_done < ticket) {
+        if (d->syncing) {
+            pthread_cond_wait(&aio_sync_cond, &aio_lock);
+            continue;
+        }
+        uint64_t gen = ++d->sync_started;
+        d->syncing = true;
+        pthread_mutex_unlock(&aio_lock);
+        struct block_nbd *nbd = block_nbds[d - aio_devs];
+        struct block_stripe *st = block_stripes[d - aio_devs];
+        int rc = (nbd != NULL) ? block_nbd_flush(nbd) :
+            (st != NULL) ? block_stripe_flush(st) : fdatasync(hostfd);
+        pthread_mutex_lock(&aio_lock);
+        if (rc == -1)
+            d->sync_failed = gen;
+        d->sync_done = gen;
+        d->syncing = false;
+        pthread_cond_broadcast(&aio_sync_cond);
+    }
+    return (d->sync_failed >= ticket) ? SOLO5_R_EUNSPEC : SOLO5_R_OK;
+}
+
+static void aio_signal(struct aio_dev *d)
+{
+    if (d->use_uring) {
+        uint64_t val = 1;
+        (void)write(d->uring.eventfd, &val, sizeof val);
+    }
+    else
+        (void)write(d->readyfd[1], "", 1);
+}
+
+static int qos_rank(unsigned i)
+{
+    return (block_qos[i].ioprio == BLOCK_IOPRIO_NONE) ?
+        BLOCK_IOPRIO_DEFAULT : block_qos[i].ioprio;
+}
+
+/*
+ * Dequeues the next request into (*req), from the device with the highest
+ * priority which has requests queued and whose rate limit allows one, and
+ * charges it. Returns NULL if there is none, setting (*wait) to the
+ * nanoseconds until a device held back by its rate limit may proceed, or to
+ * 0 if there is no such device.
+ */
+static struct aio_dev *aio_next_req(struct aio_req *req, uint64_t *wait)
+{
+    unsigned next = MFT_MAX_ENTRIES;
+    uint64_t now = 0;
+
+    *wait = 0;
+    pthread_mutex_lock(&qos_lock);
+    for (unsigned i = 0; i != MFT_MAX_ENTRIES; i++) {
+        struct aio_dev *d = &aio_devs[i];
+        if (d->sq_tail == d->sq_head)
+            continue;
+        if (rate_limit_enabled(&block_qos[i].rate)) {
+            if (now == 0)
+                now = rate_limit_clock();
+            uint64_t w = rate_limit_wait(&block_qos[i].rate, now);
+            if (w != 0) {
+                if (*wait == 0 || w < *wait)
+                    *wait = w;
+                continue;
+            }
+        }
+        if (next == MFT_MAX_ENTRIES || qos_rank(i) < qos_rank(next))
+            next = i;
+    }
+    if (next == MFT_MAX_ENTRIES) {
+        pthread_mutex_unlock(&qos_lock);
+        return NULL;
+    }
+
+    struct aio_dev *d = &aio_devs[next];
+    *req = d->sq[d->sq_tail % SOLO5_BLOCK_QUEUE_MAX];
+    d->sq_tail++;
+    if (now != 0)
+        rate_limit_charge(&block_qos[next].rate, now, req->len);
+    pthread_mutex_unlock(&qos_lock);
+    return d;
+}
+
+static void *aio_thread(void *arg)
+{
+    (void)arg;
+    struct aio_req req;
+    struct aio_dev *d;
+    uint64_t wait;
+    void *bounce = direct_in_use ? bounce_alloc() : NULL;
+
+    pthread_mutex_lock(&aio_lock);
+    for (;;) {
+        while ((d = aio_next_req(&req, &wait)) == NULL) {
+            if (wait == 0) {
+                pthread_cond_wait(&aio_cond, &aio_lock);
+                continue;
+            }
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            wait += ts.tv_nsec;
+            ts.tv_sec += wait / 1000000000ULL;
+            ts.tv_nsec = wait % 1000000000ULL;
+            pthread_cond_timedwait(&aio_cond, &aio_lock, &ts);
+        }
+
+        qos_ioprio(d - aio_devs);
+        int rc;
+        if (req.op == HVT_BLOCK_OP_FLUSH) {
+            rc = aio_flush(d, req.e->hostfd, req.ticket);
+            if (wc_failed(d - aio_devs))
+                rc = SOLO5_R_EUNSPEC;
+        }
+        else {
+            pthread_mutex_unlock(&aio_lock);
+            struct iovec iov = { .iov_base = req.data, .iov_len = req.len };
+            ssize_t ret = block_rw(req.e, req.op == HVT_BLOCK_OP_WRITE, &iov,
+                    1, req.len, req.offset, bounce);
+            rc = (ret == (ssize_t)req.len) ? SOLO5_R_OK : SOLO5_R_EUNSPEC;
+            pthread_mutex_lock(&aio_lock);
+        }
+
+        struct hvt_block_completion *c =
+            &d->cq[d->cq_head % SOLO5_BLOCK_QUEUE_MAX];
+        c->tag = req.tag;
+        c->ret = rc;
+        if (d->cq_head++ == d->cq_tail)
+            aio_signal(d);
+    }
+
+    return NULL;
+}
+
+static int aio_queue_thread(struct aio_dev *d, struct aio_req *req)
+{
+    pthread_mutex_lock(&aio_lock);
+    if (d->outstanding == SOLO5_BLOCK_QUEUE_MAX) {
+        pthread_mutex_unlock(&aio_lock);
+        return SOLO5_R_AGAIN;
+    }
+    if (req->op == HVT_BLOCK_OP_FLUSH)
+        req->ticket = d->sync_started + 1;
+    d->sq[d->sq_head % SOLO5_BLOCK_QUEUE_MAX] = *req;
+    d->sq_head++;
+    d->outstanding++;
+    pthread_cond_signal(&aio_cond);
+    pthread_mutex_unlock(&aio_lock);
+    return SOLO5_R_OK;
+}
+
+/*
+ * Registered buffers, see HVT_HYPERCALL_BLOCK_REGISTER. Each is checked once,
+ * when registered, and on devices using io_uring is also registered with the
+ * ring, so that the kernel need not pin its pages for every request. If that
+ * fails, for example for lack of RLIMIT_MEMLOCK, requests for the buffer are
+ * queued as any other.
+ */
+static int buffer_register(struct hvt *hvt, unsigned handle, unsigned index)
+{
+    struct mft_entry *e = mft_get_by_index(host_mft, handle,
+            MFT_BLOCK_BASIC);
+
+    if (e == NULL || index >= HVT_BLOCK_BUFFERS_MAX || hvt->block_buffers == 0)
+        return SOLO5_R_EINVAL;
+    struct hvt_block_buffer *t = HVT_CHECKED_GPA_P(hvt, hvt->block_buffers +
+            (handle * HVT_BLOCK_BUFFERS_MAX + index) *
+            sizeof (struct hvt_block_buffer), sizeof (struct hvt_block_buffer));
+    hvt_gpa_t gpa = t->data;
+    size_t len = t->len;
+    if (len == 0 || len > SSIZE_MAX)
+        return SOLO5_R_EINVAL;
+
+    struct aio_dev *d = &aio_devs[handle];
+    struct aio_buffer *b = &d->buffers[index];
+    b->data = HVT_CHECKED_GPA_P(hvt, gpa, len);
+    b->gpa = gpa;
+    b->len = len;
+    b->fixed = d->use_uring && block_uring_register_buffer(&d->uring, index,
+            b->data, len) == 0;
+    return SOLO5_R_OK;
+}
+
+static void hypercall_block_register(struct hvt *hvt, hvt_gpa_t gpa)
+{
+    struct hvt_hc_block_register *rg =
+        HVT_CHECKED_GPA_P(hvt, gpa, sizeof (struct hvt_hc_block_register));
+
+    hvt->block_buffers = rg->buffers;
+    rg->ret = buffer_register(hvt, rg->handle, rg->index);
+}
+
+/*
+ * The registered buffers are listed in guest memory, at the address passed
+ * on with the core state, so can be registered again with this tender once
+ * the guest has been migrated to it.
+ */
+static void buffers_restore(struct hvt *hvt)
+{
+    if (hvt->block_buffers == 0)
+        return;
+    for (unsigned i = 0; i != host_mft->entries; i++) {
+        if (host_mft->e[i].type != MFT_BLOCK_BASIC || !host_mft->e[i].attached)
+            continue;
+        struct hvt_block_buffer *t = HVT_CHECKED_GPA_P(hvt,
+                hvt->block_buffers + i * HVT_BLOCK_BUFFERS_MAX *
+                sizeof (struct hvt_block_buffer),
+                HVT_BLOCK_BUFFERS_MAX * sizeof (struct hvt_block_buffer));
+        for (unsigned j = 0; j != HVT_BLOCK_BUFFERS_MAX; j++) {
+            if (t[j].len != 0 && buffer_register(hvt, i, j) != SOLO5_R_OK)
+                errx(1, "%s: Could not register buffer %u",
+                        host_mft->e[i].name, j);
+        }
+    }
+}
+
+static int aio_queue(struct hvt *hvt, struct hvt_block_req *r)
+{
+    struct mft_entry *e = mft_get_by_index(host_mft, r->handle,
+            MFT_BLOCK_BASIC);
+    off_t pos, end;
+
+    if (e == NULL)
+        return SOLO5_R_EINVAL;
+    struct aio_dev *d = &aio_devs[r->handle];
+    struct aio_req req = {
+        .e = e,
+        .op = r->op,
+        .tag = r->tag
+    };
+    if (r->op == HVT_BLOCK_OP_FLUSH) {
+        wc_flush(r->handle, 0, 0);
+        return aio_queue_thread(d, &req);
+    }
+
+    struct aio_buffer *b = NULL;
+    if (r->op == HVT_BLOCK_OP_READ_FIXED || r->op == HVT_BLOCK_OP_WRITE_FIXED) {
+        if (r->buffer >= HVT_BLOCK_BUFFERS_MAX)
+            return SOLO5_R_EINVAL;
+        b = &d->buffers[r->buffer];
+        req.op = (r->op == HVT_BLOCK_OP_WRITE_FIXED) ?
+            HVT_BLOCK_OP_WRITE : HVT_BLOCK_OP_READ;
+    }
+    else if (r->op != HVT_BLOCK_OP_READ && r->op != HVT_BLOCK_OP_WRITE)
+        return SOLO5_R_EINVAL;
+    if (r->len > SSIZE_MAX || r->offset >= e->u.block_basic.capacity)
+        return SOLO5_R_EINVAL;
+    pos = r->offset;
+    if (add_overflow(pos, r->len, end)
+            || (end > e->u.block_basic.capacity))
+        return SOLO5_R_EINVAL;
+
+    void *data;
+    if (b != NULL) {
+        uint64_t buf_end;
+        if (b->data == NULL || add_overflow(r->data, r->len, buf_end) ||
+                buf_end > b->len)
+            return SOLO5_R_EINVAL;
+        data = b->data + r->data;
+        if (__atomic_load_n(&hvt->dirty, __ATOMIC_RELAXED) != NULL)
+            hvt_dirty_track_mark(hvt, b->gpa + r->data, r->len);
+    }
+    else
+        data = HVT_CHECKED_GPA_P(hvt, r->data, r->len);
+    struct iovec iov = { .iov_base = data, .iov_len = r->len };
+    bool write = (req.op == HVT_BLOCK_OP_WRITE);
+    wc_flush(r->handle, pos, r->len);
+
+    /*
+     * Requests needing a bounce buffer for direct I/O, or held back by a rate
+     * limit, are left to the I/O threads.
+     */
+    if (d->use_uring && block_iov_aligned(e, &iov, 1) &&
+            !rate_limit_enabled(&block_qos[r->handle].rate)) {
+        if (d->outstanding == SOLO5_BLOCK_QUEUE_MAX)
+            return SOLO5_R_AGAIN;
+        unsigned slot = __builtin_ctzll(~d->uring_busy);
+        d->uring_busy |= 1ULL << slot;
+        d->uring_reqs[slot].tag = r->tag;
+        d->uring_reqs[slot].len = r->len;
+        block_probe(r->handle, write, pos, r->len);
+        if (!write)
+            ra_observe(r->handle, pos, r->len);
+        int rc = (b != NULL && b->fixed) ?
+            block_uring_queue_fixed(&d->uring, write, data, r->len, pos,
+                    r->buffer, slot) :
+            block_uring_queue(&d->uring, write, data, r->len, pos, slot);
+        assert(rc == 0);
+        d->outstanding++;
+        return SOLO5_R_OK;
+    }
+
+    req.data = data;
+    req.len = r->len;
+    req.offset = pos;
+    return aio_queue_thread(d, &req);
+}
+
+static void hypercall_block_submit(struct hvt *hvt, hvt_gpa_t gpa)
+{
+    struct hvt_hc_block_submit *sb =
+        HVT_CHECKED_GPA_P(hvt, gpa, sizeof (struct hvt_hc_block_submit));
+    if (sb->count > MFT_MAX_ENTRIES * SOLO5_BLOCK_QUEUE_MAX) {
+        sb->count = 0;
+        sb->ret = SOLO5_R_EINVAL;
+        return;
+    }
+
+    struct hvt_block_req *reqs = HVT_CHECKED_GPA_P(hvt, sb->reqs,
+            sb->count * sizeof (struct hvt_block_req));
+    uint64_t queued_set = 0;
+    int rc = SOLO5_R_OK;
+    size_t n;
+
+    for (n = 0; n < sb->count; n++) {
+        rc = aio_queue(hvt, &reqs[n]);
+        if (rc != SOLO5_R_OK)
+            break;
+        queued_set |= 1ULL << reqs[n].handle;
+    }
+    for (unsigned i = 0; i != MFT_MAX_ENTRIES; i++) {
+        if ((queued_set & (1ULL << i)) && aio_devs[i].use_uring &&
+                block_uring_submit(&aio_devs[i].uring) == -1)
+            err(1, "io_uring_enter() failed");
+    }
+
+    sb->count = n;
+    sb->ret = rc;
+}
+
+static size_t aio_reap_uring(struct aio_dev *d,
+        struct hvt_block_completion *c, size_t count)
+{
+    uint64_t val, slot;
+    size_t n;
+    int res;
+
+    /*
+     * Clear the eventfd before harvesting, so that any completion racing with
+     * us signals it again. If completions are left over, re-signal it
+     * ourselves to keep the device ready. Completions of flushes performed by
+     * the I/O threads are harvested first.
+     */
+    (void)read(d->uring.eventfd, &val, sizeof val);
+    pthread_mutex_lock(&aio_lock);
+    for (n = 0; n < count && d->cq_tail != d->cq_head; n++, d->cq_tail++)
+        c[n] = d->cq[d->cq_tail % SOLO5_BLOCK_QUEUE_MAX];
+    pthread_mutex_unlock(&aio_lock);
+    for (; n < count; n++) {
+        if (!block_uring_reap(&d->uring, &slot, &res))
+            break;
+        assert(slot < SOLO5_BLOCK_QUEUE_MAX);
+        c[n].tag = d->uring_reqs[slot].tag;
+        c[n].ret = (res >= 0 && (size_t)res == d->uring_reqs[slot].len) ?
+            SOLO5_R_OK : SOLO5_R_EUNSPEC;
+        d->uring_busy &= ~(1ULL << slot);
+    }
+    pthread_mutex_lock(&aio_lock);
+    bool pending = (d->cq_tail != d->cq_head);
+    pthread_mutex_unlock(&aio_lock);
+    if (pending || block_uring_ready(&d->uring))
+        aio_signal(d);
+    return n;
+}
+
+static void hypercall_block_reap(struct hvt *hvt, hvt_gpa_t gpa)
+{
+    struct hvt_hc_block_reap *rp =
+        HVT_CHECKED_GPA_P(hvt, gpa, sizeof (struct hvt_hc_block_reap));
+    struct mft_entry *e = mft_get_by_index(host_mft, rp->handle,
+            MFT_BLOCK_BASIC);
+    if (e == NULL || rp->count > SOLO5_BLOCK_QUEUE_MAX) {
+        rp->ret = SOLO5_R_EINVAL;
+        return;
+    }
+
+    struct hvt_block_completion *c = HVT_CHECKED_GPA_P(hvt, rp->completions,
+            rp->count * sizeof (struct hvt_block_completion));
+    struct aio_dev *d = &aio_devs[rp->handle];
+    size_t n;
+
+    if (d->use_uring) {
+        n = aio_reap_uring(d, c, rp->count);
+        d->outstanding -= n;
+    }
+    else {
+        pthread_mutex_lock(&aio_lock);
+        for (n = 0; n < rp->count && d->cq_tail != d->cq_head;
+                n++, d->cq_tail++)
+            c[n] = d->cq[d->cq_tail % SOLO5_BLOCK_QUEUE_MAX];
+        d->outstanding -= n;
+        if (n != 0 && d->cq_tail == d->cq_head) {
+            char buf[1];
+            (void)read(d->readyfd[0], buf, sizeof buf);
+        }
+        pthread_mutex_unlock(&aio_lock);
+    }
+    hvt_core_pollfd_consumed(rp->handle);
+
+    rp->count = n;
+    rp->ret = (n == 0) ? SOLO5_R_AGAIN : SOLO5_R_OK;
+}
+
+static void hypercall_block_flush(struct hvt *hvt, hvt_gpa_t gpa)
+{
+    struct hvt_hc_block_flush *fl =
+        HVT_CHECKED_GPA_P(hvt, gpa, sizeof (struct hvt_hc_block_flush));
+    struct mft_entry *e = mft_get_by_index(host_mft, fl->handle,
+            MFT_BLOCK_BASIC);
+    if (e == NULL) {
+        fl->ret = SOLO5_R_EINVAL;
+        return;
+    }
+
+    struct aio_dev *d = &aio_devs[fl->handle];
+    qos_begin(fl->handle, 0);
+    wc_flush(fl->handle, 0, 0);
+    pthread_mutex_lock(&aio_lock);
+    fl->ret = aio_flush(d, e->hostfd, d->sync_started + 1);
+    pthread_mutex_unlock(&aio_lock);
+    if (wc_failed(fl->handle))
+        fl->ret = SOLO5_R_EUNSPEC;
+}
+
+/*
+ * Requests submitted but not yet reaped cannot be carried over if the guest
+ * is migrated. Buffered writes are written out first.
+ */
+static bool aio_busy(struct hvt *hvt)
+{
+    bool busy = false;
+
+    wc_flush_all();
+    pthread_mutex_lock(&aio_lock);
+    for (unsigned i = 0; i != host_mft->entries; i++)
+        busy |= aio_devs[i].outstanding != 0;
+    pthread_mutex_unlock(&aio_lock);
+    return busy;
+}
+
+/*
+ * Requests the guest did not reap before halting are waited for, and their
+ * completions discarded, so that devices are idle when it is run again.
+ */
+static void aio_reset(struct hvt *hvt)
+{
+    struct hvt_block_completion c[SOLO5_BLOCK_QUEUE_MAX];
+    struct timespec ts = { .tv_sec = 0, .tv_nsec = 1000000 };
+
+    hvt->block_buffers = 0;
+    wc_flush_all();
+    for (unsigned i = 0; i != host_mft->entries; i++) {
+        struct aio_dev *d = &aio_devs[i];
+        while (d->outstanding != 0) {
+            size_t n;
+            if (d->use_uring)
+                n = aio_reap_uring(d, c, SOLO5_BLOCK_QUEUE_MAX);
+            else {
+                pthread_mutex_lock(&aio_lock);
+                n = d->cq_head - d->cq_tail;
+                d->cq_tail = d->cq_head;
+                if (n != 0) {
+                    char buf[1];
+                    (void)read(d->readyfd[0], buf, sizeof buf);
+                }
+                pthread_mutex_unlock(&aio_lock);
+            }
+            d->outstanding -= n;
+            if (n == 0)
+                nanosleep(&ts, NULL);
+        }
+        if (d->use_uring) {
+            uint64_t val;
+            (void)read(d->uring.eventfd, &val, sizeof val);
+        }
+        for (unsigned j = 0; j != HVT_BLOCK_BUFFERS_MAX; j++) {
+            if (d->buffers[j].fixed)
+                (void)block_uring_register_buffer(&d->uring, j, NULL, 0);
+        }
+        memset(d->buffers, 0, sizeof d->buffers);
+    }
+}
+
+/*
+ * The tender the guest was migrated from may have written to overlays since
+ * they were attached.
+ */
+static void cow_restore(struct hvt *hvt)
+{
+    for (unsigned i = 0; i != host_mft->entries; i++) {
+        if (block_cows[i] != NULL && block_cow_reload(block_cows[i]) == -1)
+            err(1, "%s: Could not reload overlay", host_mft->e[i].name);
+    }
+}
+
+static void setup_aio(struct mft *mft)
+{
+    for (unsigned i = 0; i != mft->entries; i++) {
+        if (mft->e[i].type != MFT_BLOCK_BASIC || !mft->e[i].attached)
+            continue;
+
+        struct aio_dev *d = &aio_devs[i];
+        if (block_cows[i] == NULL && block_nbds[i] == NULL &&
+                block_rams[i] == NULL && block_stripes[i] == NULL &&
+                block_uring_init_fixed(&d->uring, mft->e[i].hostfd,
+                    SOLO5_BLOCK_QUEUE_MAX, HVT_BLOCK_BUFFERS_MAX) == 0) {
+            d->use_uring = true;
+            d->uring.ioprio = block_qos[i].ioprio;
+            hvt_core_register_pollfd(d->uring.eventfd, i);
+            continue;
+        }
+
+        int *fd = d->readyfd;
+        if (pipe(fd) == -1)
+            err(1, "pipe() failed");
+        for (int j = 0; j < 2; j++) {
+            int flags = fcntl(fd[j], F_GETFL);
+            if (flags == -1 || fcntl(fd[j], F_SETFL, flags | O_NONBLOCK) == -1)
+                err(1, "fcntl(O_NONBLOCK) failed");
+        }
+        hvt_core_register_pollfd(fd[0], i);
+    }
+
+    for (unsigned i = 0; i != AIO_THREADS; i++) {
+        if (pthread_create(&aio_threads[i], NULL, aio_thread, NULL) != 0)
+            errx(1, "Could not create block I/O thread");
+    }
+}
+
+static int handle_qos_cmdarg(char *cmdarg, struct mft *mft)
 {
-    if (strncmp("--block:", cmdarg, 8) != 0)
+    char name[MFT_NAME_SIZE];
+    int n = -1;
+
+    /*
+     * Both options are 13 characters long, up to NAME.
+     */
+    int rc = sscanf(cmdarg + 13, "%" XSTR(MFT_NAME_MAX) "[A-Za-z0-9]=%n",
+            name, &n);
+    if (rc != 1 || n == -1)
+        return -1;
+    const char *spec = cmdarg + 13 + n;
+    unsigned index;
+    struct mft_entry *e = mft_get_by_name(mft, name, MFT_BLOCK_BASIC, &index);
+    if (e == NULL) {
+        warnx("Resource not declared in manifest: '%s'", name);
+        return -1;
+    }
+    if (strncmp("--block-rate:", cmdarg, 13) == 0)
+        return rate_limit_parse_rates(spec, &block_qos[index].rate);
+    else
+        return block_parse_ioprio(spec, &block_qos[index].ioprio) ? 0 : -1;
+}
+
+static int handle_coalesce_cmdarg(char *cmdarg, struct mft *mft)
+{
+    char name[MFT_NAME_SIZE];
+    int n = -1;
+
+    int rc = sscanf(cmdarg, "--block-coalesce:%" XSTR(MFT_NAME_MAX)
+            "[A-Za-z0-9]%n", name, &n);
+    if (rc != 1 || n == -1 || cmdarg[n] != '\0')
+        return -1;
+    unsigned index;
+    struct mft_entry *e = mft_get_by_name(mft, name, MFT_BLOCK_BASIC, &index);
+    if (e == NULL) {
+        warnx("Resource not declared in manifest: '%s'", name);
         return -1;
+    }
+    wc_requested[index] = true;
+    return 0;
+}
 
+static int handle_cmdarg(char *cmdarg, struct mft *mft)
+{
     char name[MFT_NAME_SIZE];
     char path[PATH_MAX + 1];
-    int rc = sscanf(cmdarg,
-            "--block:%" XSTR(MFT_NAME_MAX) "[A-Za-z0-9]="
-            "%" XSTR(PATH_MAX) "s", name, path);
+    bool direct = false, map = false;
+    int rc;
+
+    if (strncmp("--block-rate:", cmdarg, 13) == 0 ||
+            strncmp("--block-prio:", cmdarg, 13) == 0)
+        return handle_qos_cmdarg(cmdarg, mft);
+    else if (strncmp("--block-coalesce:", cmdarg, 17) == 0)
+        return handle_coalesce_cmdarg(cmdarg, mft);
+    else if (strncmp("--block:", cmdarg, 8) == 0) {
+        rc = sscanf(cmdarg,
+                "--block:%" XSTR(MFT_NAME_MAX) "[A-Za-z0-9]="
+                "%" XSTR(PATH_MAX) "s", name, path);
+    }
+    else if (strncmp("--block-direct:", cmdarg, 15) == 0) {
+        direct = true;
+        rc = sscanf(cmdarg,
+                "--block-direct:%" XSTR(MFT_NAME_MAX) "[A-Za-z0-9]="
+                "%" XSTR(PATH_MAX) "s", name, path);
+    }
+    else if (strncmp("--block-map:", cmdarg, 12) == 0) {
+        map = true;
+        rc = sscanf(cmdarg,
+                "--block-map:%" XSTR(MFT_NAME_MAX) "[A-Za-z0-9]="
+                "%" XSTR(PATH_MAX) "s", name, path);
+    }
+    else
+        return -1;
     if (rc != 2)
         return -1;
-    struct mft_entry *e = mft_get_by_name(mft, name, MFT_BLOCK_BASIC, NULL);
+    unsigned bs;
+    if (!block_parse_opts(path, &bs)) {
+        warnx("Invalid block device options: '%s'", cmdarg);
+        return -1;
+    }
+    unsigned index;
+    struct mft_entry *e = mft_get_by_name(mft, name, MFT_BLOCK_BASIC, &index);
     if (e == NULL) {
         warnx("Resource not declared in manifest: '%s'", name);
         return -1;
     }
 
+    /*
+     * The block size required by the manifest is the default, and direct I/O
+     * is used if preferred by the manifest and possible.
+     */
+    if (bs == BLOCK_SIZE_DEFAULT)
+        bs = e->attrs.block.block_size;
+    char *overlay;
+    bool nbd = block_nbd_is_spec(path);
+    bool ram = !nbd && block_ram_is_spec(path);
+    bool stripe = !nbd && !ram && block_stripe_is_spec(path);
+    bool cow = !nbd && !ram && !stripe && block_cow_path(path, &overlay);
+    if (!nbd && !ram && !cow && !map &&
+            (e->attrs.block.flags & MFT_BLOCK_ATTR_DIRECT))
+        direct = true;
+
     off_t capacity;
-    int fd = block_attach(path, &capacity);
+    uint16_t block_size;
+    int fd;
+    if (nbd) {
+        if (direct || map) {
+            warnx("NBD exports can only be attached with --block: '%s'",
+                    cmdarg);
+            return -1;
+        }
+        block_nbds[index] = block_nbd_attach(path, bs, &capacity,
+                &block_size);
+        fd = block_nbd_fd(block_nbds[index]);
+    }
+    else if (stripe) {
+        if (map) {
+            warnx("Striped devices cannot be attached with --block-map: '%s'",
+                    cmdarg);
+            return -1;
+        }
+        block_stripes[index] = block_stripe_attach(path,
+                direct ? BLOCK_ATTACH_DIRECT : 0, bs, &capacity, &block_size);
+        fd = block_stripe_fd(block_stripes[index], 0);
+    }
+    else if (cow) {
+        if (direct || map) {
+            warnx("Overlays can only be attached with --block: '%s'", cmdarg);
+            return -1;
+        }
+        struct block_cow *cow = malloc(sizeof *cow);
+        if (cow == NULL)
+            err(1, "malloc");
+        fd = block_cow_attach(cow, path, overlay, bs, &capacity, &block_size);
+        block_cows[index] = cow;
+    }
+    else if (ram) {
+        if (direct) {
+            warnx("RAM block devices cannot be attached with --block-direct: "
+                    "'%s'", cmdarg);
+            return -1;
+        }
+        bool huge;
+        fd = block_ram_attach(path, bs, &capacity, &block_size,
+                &block_rams[index], &huge);
+        /*
+         * Huge pages cannot be mapped at the alignment guaranteed by
+         * HVT_HYPERCALL_BLOCK_MAP.
+         */
+        if (map && huge) {
+            warnx("RAM block devices backed by huge pages cannot be attached "
+                    "with --block-map: '%s'", cmdarg);
+            return -1;
+        }
+    }
+    else if (map) {
+#if !defined(__linux__)
+        warnx("Mapped block devices are not supported on this host: '%s'",
+                cmdarg);
+        return -1;
+#endif
+        fd = block_attach(path, BLOCK_ATTACH_RDONLY, bs, &capacity,
+                &block_size);
+    }
+    else
+        fd = block_attach(path, direct ? BLOCK_ATTACH_DIRECT : 0, bs,
+                &capacity, &block_size);
+    uint64_t zone_size = (nbd || cow || ram || stripe) ? 0 :
+        block_zone_size(fd);
+    if (zone_size != 0 && !direct) {
+        warnx("Zoned block devices can only be attached with --block-direct:"
+                " '%s'", cmdarg);
+        return -1;
+    }
+    e->u.block_basic.zone_blocks = zone_size / block_size;
     e->u.block_basic.capacity = capacity;
-    e->u.block_basic.block_size = 512;
+    e->u.block_basic.block_size = block_size;
+    e->u.block_basic.flags = (direct ? MFT_BLOCK_DIRECT : 0) |
+        (map ? MFT_BLOCK_MAPPED : 0) | (ram ? MFT_BLOCK_RAM : 0);
     e->hostfd = fd;
     e->attached = true;
     module_in_use = true;
+    direct_in_use |= direct;
 
     return 0;
 }
@@ -136,18 +1703,126 @@ static int setup(struct hvt *hvt, struct mft *mft)
     if (!module_in_use)
         return 0;
 
+    for (unsigned i = 0; i != mft->entries; i++) {
+        if (mft->e[i].type == MFT_BLOCK_BASIC && mft->e[i].attached &&
+                mft_check_attrs(&mft->e[i]) == -1)
+            return -1;
+        /*
+         * Check that the priority may be used, e.g. that the tender has
+         * CAP_SYS_ADMIN for the real-time class, while it still can fail.
+         */
+        if (block_qos[i].ioprio != BLOCK_IOPRIO_NONE) {
+            if (block_set_ioprio(block_qos[i].ioprio) == -1)
+                err(1, "Could not set I/O priority of block device '%s'",
+                        mft->e[i].name);
+            (void)block_set_ioprio(BLOCK_IOPRIO_NONE);
+        }
+        if (mft->e[i].type == MFT_BLOCK_BASIC && mft->e[i].attached &&
+                block_stripes[i] != NULL) {
+            for (unsigned m = 0; block_stripe_fd(block_stripes[i], m) != -1;
+                    m++)
+                cgroup_limit_block(block_stripe_fd(block_stripes[i], m),
+                        &block_qos[i].rate);
+        }
+        else if (mft->e[i].type == MFT_BLOCK_BASIC && mft->e[i].attached &&
+                block_nbds[i] == NULL)
+            cgroup_limit_block(mft->e[i].hostfd, &block_qos[i].rate);
+        if (wc_requested[i]) {
+            if (!mft->e[i].attached ||
+                    (mft->e[i].u.block_basic.flags & MFT_BLOCK_MAPPED))
+                errx(1, "--block-coalesce:%s requires a device attached "
+                        "with --block or --block-direct", mft->e[i].name);
+            if (mft->e[i].u.block_basic.zone_blocks != 0)
+                errx(1, "--block-coalesce:%s cannot be used with a zoned "
+                        "device", mft->e[i].name);
+            struct wc *w = calloc(1, sizeof *w);
+            if (w == NULL ||
+                    posix_memalign((void **)&w->buf, 4096, WC_SIZE) != 0)
+                err(1, "malloc");
+            pthread_mutex_init(&w->lock, NULL);
+            wcs[i] = w;
+            wc_in_use = true;
+        }
+    }
+
     host_mft = mft;
-    assert(hvt_core_register_hypercall(HVT_HYPERCALL_BLOCK_WRITE,
+    /*
+     * Synchronous I/O and flushes may be performed concurrently by several
+     * VCPUs.
+     */
+    assert(hvt_core_register_hypercall_mt(hvt, HVT_HYPERCALL_BLOCK_WRITE,
                 hypercall_block_write) == 0);
-    assert(hvt_core_register_hypercall(HVT_HYPERCALL_BLOCK_READ,
+    assert(hvt_core_register_hypercall_mt(hvt, HVT_HYPERCALL_BLOCK_READ,
                 hypercall_block_read) == 0);
+    assert(hvt_core_register_hypercall_mt(hvt, HVT_HYPERCALL_BLOCK_WRITEV,
+                hypercall_block_writev) == 0);
+    assert(hvt_core_register_hypercall_mt(hvt, HVT_HYPERCALL_BLOCK_READV,
+                hypercall_block_readv) == 0);
+    assert(hvt_core_register_hypercall_mt(hvt, HVT_HYPERCALL_BLOCK_FLUSH,
+                hypercall_block_flush) == 0);
+    assert(hvt_core_register_hypercall_mt(hvt, HVT_HYPERCALL_BLOCK_DISCARD,
+                hypercall_block_discard) == 0);
+    assert(hvt_core_register_hypercall_mt(hvt,
+                HVT_HYPERCALL_BLOCK_WRITE_ZEROES,
+                hypercall_block_write_zeroes) == 0);
+    assert(hvt_core_register_hypercall(hvt, HVT_HYPERCALL_BLOCK_SUBMIT,
+                hypercall_block_submit) == 0);
+    assert(hvt_core_register_hypercall(hvt, HVT_HYPERCALL_BLOCK_REAP,
+                hypercall_block_reap) == 0);
+    assert(hvt_core_register_hypercall(hvt, HVT_HYPERCALL_BLOCK_REGISTER,
+                hypercall_block_register) == 0);
+    assert(hvt_core_register_hypercall(hvt, HVT_HYPERCALL_BLOCK_MAP,
+                hypercall_block_map) == 0);
+    assert(hvt_core_register_hypercall_mt(hvt, HVT_HYPERCALL_BLOCK_PREFETCH,
+                hypercall_block_prefetch) == 0);
+    for (unsigned i = 0; i != MFT_MAX_ENTRIES; i++)
+        pthread_mutex_init(&zone_locks[i], NULL);
+    assert(hvt_core_register_hypercall_mt(hvt,
+                HVT_HYPERCALL_BLOCK_ZONE_REPORT,
+                hypercall_block_zone_report) == 0);
+    assert(hvt_core_register_hypercall_mt(hvt,
+                HVT_HYPERCALL_BLOCK_ZONE_APPEND,
+                hypercall_block_zone_append) == 0);
+    assert(hvt_core_register_hypercall_mt(hvt,
+                HVT_HYPERCALL_BLOCK_ZONE_MANAGE,
+                hypercall_block_zone_manage) == 0);
+    ra_init(mft);
+    setup_aio(mft);
+    assert(hvt_core_register_busy_hook(hvt, aio_busy) == 0);
+    assert(hvt_core_register_restore_hook(hvt, cow_restore) == 0);
+    assert(hvt_core_register_restore_hook(hvt, buffers_restore) == 0);
+    assert(hvt_core_register_reset_hook(hvt, aio_reset) == 0);
+    /*
+     * Buffered writes are flushed when the guest blocks in the tender, which
+     * a guest halting in the in-kernel irqchip never does.
+     */
+    if (wc_in_use && hvt->irqchip)
+        errx(1, "--block-coalesce cannot be used with --irqchip");
+    if (wc_in_use) {
+        assert(hvt_core_register_idle_hook(hvt, wc_idle) == 0);
+        assert(hvt_core_register_halt_hook(hvt, wc_halt) == 0);
+    }
 
     return 0;
 }
 
 static char *usage(void)
 {
-    return "--block:NAME=PATH (attach block device/file at PATH as block storage NAME)";
+    return "--block:NAME=PATH[,bs=SIZE] (attach block device/file at PATH as block storage NAME)\n"
+        "  | --block:NAME=BASE+OVERLAY[,bs=SIZE] (as above, writing changes to BASE to OVERLAY)\n"
+        "  | --block:NAME=nbd://HOST[:PORT][/EXPORT][,conns=N][,cache=FILE][,bs=SIZE]\n"
+        "    | --block:NAME=nbd+unix:///[EXPORT]?socket=PATH[,...] (attach NBD export EXPORT)\n"
+        "  | --block:NAME=stripe:UNIT:PATH,PATH[,...][,bs=SIZE] (stripe over PATHs in units of UNIT)\n"
+        "  | --block-direct:NAME=PATH[,bs=SIZE] (as above, bypassing the host page cache)\n"
+        "  | --block-map:NAME=PATH[,bs=SIZE] (as above, read-only and mapped into guest memory; Linux only)\n"
+        "  | --block:NAME=ram:SIZE[:huge][,bs=SIZE] (attach scratch storage of SIZE bytes held in\n"
+        "    memory, backed by huge pages with :huge; Linux only)\n"
+        "  [ --block-rate:NAME=BYTES[:IOPS[:BURST_MS]] ] (limit block storage NAME to BYTES\n"
+        "    and IOPS per second, 0 for no limit, with bursts of BURST_MS, default 10)\n"
+        "  [ --block-prio:NAME=rt|be|idle[:LEVEL] ] (set the host I/O priority class and\n"
+        "    LEVEL, 0 (highest) to 7, of block storage NAME; Linux only)\n"
+        "  [ --block-coalesce:NAME ] (buffer sequential writes to block storage NAME\n"
+        "    and perform them together, until flushed or the guest yields)";
 }
 
 DECLARE_MODULE(block,
@@ -19,7 +19,8 @@
  */
 
 /*
- * hvt_module_dumpcore.c: Dumps the unikernel memory as a core file
+ * hvt_module_dumpcore.c: Dumps the unikernel memory as a core file, when the
+ * guest aborts, or while it carries on running on SIGQUIT.
  */
 
 #define _GNU_SOURCE
@@ -39,6 +40,9 @@
 #include <assert.h>
 #include <stdio.h>
 #include <sys/uio.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
 
 #include "hvt.h"
 
@@ -72,28 +76,105 @@ typedef unsigned char *host_mvec_t;
 
 #endif
 
+/*
+ * Live core dumps: pages written by the guest while a live core dump is being
+ * written are written again, in up to LIVE_ROUNDS_MAX rounds, until fewer than
+ * LIVE_STOP_PAGES are left, which are written with the VCPU state while the
+ * guest is stopped. Stopping is retried up to LIVE_STOP_TRIES times while the
+ * guest has requests in flight.
+ */
+#define LIVE_ROUNDS_MAX 10
+#define LIVE_STOP_PAGES 256
+#define LIVE_STOP_TRIES 50
+
+enum {
+    STOP_DONE,
+    STOP_FAILED,
+    STOP_BUSY
+};
+
 static char *dumpcoredir;
 static int dir;
+static size_t page_size;
+static size_t npages;
+static uint64_t *bitmap;
+static int trigger_pipe[2];
+static int stop_pipe[2];
+static int live_fd = -1;
+static off_t live_mem_offset;
+static uint64_t live_stop_nsecs;
+static bool live_force;
+
+static uint64_t monotonic_nsecs(void)
+{
+    struct timespec ts;
 
-void hvt_dumpcore_hook(struct hvt *hvt, int status, void *cookie)
+    int rc = clock_gettime(CLOCK_MONOTONIC, &ts);
+    assert(rc == 0);
+    return (ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+/*
+ * Returns true if the (len) bytes at (p) are all zero. (len) must be a
+ * multiple of 8.
+ */
+static bool page_is_zero(const uint8_t *p, size_t len)
 {
-    if (status != 255) /* SOLO5_EXIT_ABORT */
-        return;
+    const uint64_t *w = (const uint64_t *)p;
 
-    char *filename;
-    assert(asprintf(&filename, "core.solo5-hvt.%d", getpid()) != -1);
+    for (size_t i = 0; i < len / sizeof *w; i++)
+        if (w[i] != 0)
+            return false;
+    return true;
+}
+
+/*
+ * Write (len) bytes from (buf) to (fd) at (off), retrying on short writes.
+ */
+static int write_extent(int fd, const uint8_t *buf, size_t len, off_t off)
+{
+    while (len > 0) {
+        ssize_t nbytes = pwrite(fd, buf, len, off);
+        if (nbytes == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (nbytes == 0) {
+            errno = EIO;
+            return -1;
+        }
+        buf += nbytes;
+        off += nbytes;
+        len -= nbytes;
+    }
+    return 0;
+}
+
+/*
+ * Create the core file (filename) in (dir). Returns the file descriptor, or
+ * -1 on error.
+ */
+static int open_core(const char *filename)
+{
     /*
      * Note that O_APPEND must not be set as this modifies the behaviour of
      * pwrite() on Linux.
      */
-    int fd = openat(dir, filename, O_WRONLY | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
-    close(dir);
-    if (fd < 0) {
+    int fd = openat(dir, filename, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+            S_IRUSR | S_IWUSR);
+    if (fd < 0)
         warn("dumpcore: open(%s)", filename);
-        goto failure;
-    }
-    warnx("dumpcore: dumping guest core to: %s/%s", dumpcoredir, filename);
+    return fd;
+}
 
+/*
+ * Write the ELF headers of a core file to (fd), leaving its offset at the
+ * NT_PRSTATUS content, to be written by hvt_dumpcore_write_prstatus(). Guest
+ * memory starts at (*mem_offset).
+ */
+static int write_headers(int fd, struct hvt *hvt, off_t *mem_offset)
+{
     /*
      * Core file structure:
      * (1) ELF header with e_type=ET_CORE
@@ -141,6 +222,7 @@ void hvt_dumpcore_hook(struct hvt *hvt, int status, void *cookie)
         .p_flags = 0,
         .p_offset = offset
     };
+    *mem_offset = offset;
 
     /*
      * (4) NT_PRSTATUS descriptor
@@ -162,70 +244,327 @@ void hvt_dumpcore_hook(struct hvt *hvt, int status, void *cookie)
                     + nhdr.n_namesz;
     if (writev(fd, iov, 5) != iovlen) {
         warn("dumpcore: Error writing ELF headers");
-        goto failure;
+        return -1;
     }
+    return 0;
+}
 
+/*
+ * Write the guest memory dump to (fd) at (start).
+ *
+ * We use mincore() to get the host kernel's view of which pages have actually
+ * been touched by the guest, and additionally skip touched pages which are
+ * all zero. Skipped pages are left as holes in the file, which read back as
+ * zeroes. This speeds up the process of writing out the core file
+ * significantly by reducing memory pressure on the host and writing out a
+ * sparse file.
+ *
+ * Note that mincore() is definitely not portable, but the "mvec[pg] & 1"
+ * construct should be portable across at least Linux and FreeBSD.
+ */
+static int write_memory(int fd, struct hvt *hvt, off_t start,
+        size_t *ndumped, size_t *nzero)
+{
+    host_mvec_t mvec = malloc(npages);
+    assert (mvec);
+    if (mincore(hvt->mem, hvt->mem_size, mvec) == -1) {
+        warn("dumpcore: mincore() failed");
+        free(mvec);
+        return -1;
+    }
+    *ndumped = *nzero = 0;
+    size_t pg = 0;
+    while (pg < npages) {
+        if (!(mvec[pg] & 1)) {
+            pg++;
+            continue;
+        }
+        if (page_is_zero(hvt->mem + pg * page_size, page_size)) {
+            (*nzero)++;
+            pg++;
+            continue;
+        }
+        /*
+         * Coalesce a run of touched, non-zero pages into a single write.
+         */
+        size_t first = pg;
+        while (pg < npages && (mvec[pg] & 1) &&
+                !page_is_zero(hvt->mem + pg * page_size, page_size))
+            pg++;
+        if (write_extent(fd, hvt->mem + first * page_size,
+                    (pg - first) * page_size, start + first * page_size)
+                == -1) {
+            warn("dumpcore: Error dumping guest memory pages %zu-%zu",
+                    first, pg - 1);
+            free(mvec);
+            return -1;
+        }
+        *ndumped += pg - first;
+    }
+    free(mvec);
     /*
-     * (5) NT_PRSTATUS content
+     * Extend the file to cover all of PT_LOAD, in case trailing pages were
+     * skipped.
      */
+    if (ftruncate(fd, start + hvt->mem_size) == -1) {
+        warn("dumpcore: ftruncate() failed");
+        return -1;
+    }
+    return 0;
+}
+
+void hvt_dumpcore_hook(struct hvt *hvt, int status, void *cookie)
+{
+    if (status != 255) /* SOLO5_EXIT_ABORT */
+        return;
+
+    char *filename;
+    assert(asprintf(&filename, "core.solo5-hvt.%d", getpid()) != -1);
+    int fd = open_core(filename);
+    close(dir);
+    if (fd < 0)
+        goto failure;
+    warnx("dumpcore: dumping guest core to: %s/%s", dumpcoredir, filename);
+
+    off_t mem_offset;
+    if (write_headers(fd, hvt, &mem_offset) == -1)
+        goto failure;
     if (hvt_dumpcore_write_prstatus(fd, hvt, cookie) < 0) {
         warnx("dumpcore: Could not retrieve guest state");
         goto failure;
     }
+    size_t ndumped, nzero;
+    if (write_memory(fd, hvt, mem_offset, &ndumped, &nzero) == -1)
+        goto failure;
+    warnx("dumpcore: dumped %zu pages of total %zu pages (%zu zero pages "
+            "skipped)", ndumped, npages, nzero);
+    close(fd);
+    return;
+
+failure:
+    warnx("dumpcore: error(s) dumping core, file may be incomplete");
+    if (fd >= 0)
+        close(fd);
+}
+
+static size_t count_pages(void)
+{
+    size_t n = 0;
+
+    for (size_t i = 0; i < HVT_DIRTY_LOG_WORDS(npages); i++)
+        n += __builtin_popcountll(bitmap[i]);
+    return n;
+}
+
+/*
+ * Fetch the pages written since the last call into (bitmap).
+ */
+static int get_dirty(struct hvt *hvt)
+{
+    memset(bitmap, 0, HVT_DIRTY_LOG_WORDS(npages) * sizeof (uint64_t));
+    if (hvt_dirty_log_get(hvt, bitmap) == -1)
+        return -1;
+    hvt_dirty_track_get(hvt, bitmap);
+    return 0;
+}
+
+static void mark_page(hvt_gpa_t gpa)
+{
+    if (gpa != 0)
+        bitmap[(gpa / page_size) / 64] |= 1ULL << ((gpa / page_size) % 64);
+}
+
+/*
+ * Write the pages set in (bitmap) to (fd) at (start). Pages which have become
+ * all zero are written too, as they may have been written before.
+ */
+static int write_dirty(int fd, struct hvt *hvt, off_t start)
+{
+    size_t first = hvt_dirty_log_next(bitmap, npages, 0, true);
+
+    while (first < npages) {
+        size_t end = hvt_dirty_log_next(bitmap, npages, first, false);
+        if (write_extent(fd, hvt->mem + first * page_size,
+                    (end - first) * page_size, start + first * page_size)
+                == -1) {
+            warn("dumpcore: Error dumping guest memory pages %zu-%zu",
+                    first, end - 1);
+            return -1;
+        }
+        first = hvt_dirty_log_next(bitmap, npages, end, true);
+    }
+    return 0;
+}
 
+/*
+ * Called on the boot VCPU once the guest is stopped. Writes the pages left and
+ * the VCPU state to the live core file, and passes the result back to
+ * live_dump().
+ */
+static void live_stop(struct hvt *hvt)
+{
+    uint8_t result = STOP_BUSY;
+    uint64_t start = monotonic_nsecs();
+    struct hvt_core_state cs;
+
+    if (hvt_core_busy(hvt) && !live_force)
+        goto out;
+    result = STOP_FAILED;
+    if (get_dirty(hvt) == -1)
+        goto out;
     /*
-     * (6) guest memory dump
-     *
-     * We use mincore() to get the host kernel's view of which pages have
-     * actually been touched by the guest. This speeds up the process of writing
-     * out the core file significantly by reducing memory pressure on the host
-     * and writing out a sparse file.
-     *
-     * Note that mincore() is definitely not portable, but the "mvec[pg] & 1"
-     * construct should be portable across at least Linux and FreeBSD.
+     * Shared pages are written by the tender without being tracked.
      */
-    long page_size = sysconf(_SC_PAGESIZE);
-    if (page_size == -1) {
-        warn("dumpcore: Could not determine _SC_PAGESIZE");
-        goto failure;
+    hvt_core_save(hvt, &cs);
+    mark_page(cs.time_page);
+    mark_page(cs.poll_page);
+    if (lseek(live_fd, live_mem_offset - hvt_dumpcore_prstatus_size(),
+                SEEK_SET) == -1 ||
+            hvt_dumpcore_write_prstatus(live_fd, hvt, NULL) < 0)
+        goto out;
+    if (write_dirty(live_fd, hvt, live_mem_offset) == -1)
+        goto out;
+    result = STOP_DONE;
+
+out:
+    live_stop_nsecs = monotonic_nsecs() - start;
+    if (write(stop_pipe[1], &result, 1) != 1)
+        err(1, "dumpcore: write() failed");
+}
+
+/*
+ * Write a core file of the running guest, stopping it only for as long as it
+ * takes to write the pages it wrote during the last round.
+ */
+static int live_dump(struct hvt *hvt, unsigned seq)
+{
+    static bool logging;
+    char *filename;
+    size_t ndumped, nzero;
+    unsigned rounds = 0, tries = 0;
+    int rc = -1;
+
+    assert(asprintf(&filename, "core.solo5-hvt.%d.%u", getpid(), seq) != -1);
+    live_fd = open_core(filename);
+    if (live_fd == -1) {
+        free(filename);
+        return -1;
     }
-    assert (hvt->mem_size % page_size == 0);
-    size_t npages = hvt->mem_size / page_size;
-    size_t ndumped = 0;
-    host_mvec_t mvec = malloc(npages);
-    assert (mvec);
-    if (mincore(hvt->mem, hvt->mem_size, mvec) == -1) {
-        warn("dumpcore: mincore() failed");
-        goto failure;
+    if (write_headers(live_fd, hvt, &live_mem_offset) == -1)
+        goto out;
+
+    /*
+     * Pages written from here on are found by get_dirty(), and written again.
+     */
+    if (!logging) {
+        if (hvt_dirty_log_enable(hvt) == -1) {
+            warnx("dumpcore: Live core dumps are not supported on this host");
+            goto out;
+        }
+        hvt_dirty_track_enable(hvt);
+        logging = true;
     }
-    off_t start = lseek(fd, 0, SEEK_CUR);
-    for (size_t pg = 0; pg < npages; pg++) {
-        if (mvec[pg] & 1) {
-            off_t pgoff = (pg * page_size);
-            ssize_t nbytes =
-                pwrite(fd, hvt->mem + pgoff, page_size, start + pgoff);
-            if (nbytes == -1) {
-                warn("dumpcore: Error dumping guest memory page %zd", pg);
-                free(mvec);
-                goto failure;
-            }
-            else if (nbytes != page_size) {
-                warnx("dumpcore: Short write dumping guest memory page"
-                        "%zd: %zd bytes", pg, nbytes);
-                free(mvec);
-                goto failure;
-            }
-            ndumped++;
+    if (get_dirty(hvt) == -1 || write_memory(live_fd, hvt, live_mem_offset,
+                &ndumped, &nzero) == -1)
+        goto out;
+
+    live_force = false;
+    for (;;) {
+        if (get_dirty(hvt) == -1)
+            goto out;
+        rounds++;
+        if (rounds < LIVE_ROUNDS_MAX && count_pages() >= LIVE_STOP_PAGES) {
+            if (write_dirty(live_fd, hvt, live_mem_offset) == -1)
+                goto out;
+            continue;
+        }
+
+        if (hvt_core_interrupt(hvt, live_stop) == -1) {
+            warnx("dumpcore: Cannot interrupt the guest on this host");
+            goto out;
         }
+        uint8_t result;
+        if (read(stop_pipe[0], &result, 1) != 1)
+            err(1, "dumpcore: read() failed");
+        if (result == STOP_DONE)
+            break;
+        if (result == STOP_FAILED)
+            goto out;
+        /*
+         * The guest has requests in flight. The pages written since the last
+         * round are still in (bitmap), and written on the next attempt. If it
+         * keeps them in flight, their buffers may be inconsistent in the core
+         * file.
+         */
+        if (write_dirty(live_fd, hvt, live_mem_offset) == -1)
+            goto out;
+        if (++tries == LIVE_STOP_TRIES)
+            live_force = true;
     }
-    free(mvec);
-    warnx("dumpcore: dumped %zd pages of total %zd pages", ndumped, npages);
-    close(fd);
-    return;
+    warnx("dumpcore: dumped live guest core to: %s/%s in %u rounds, "
+            "stopped for %llu us", dumpcoredir, filename, rounds,
+            (unsigned long long)live_stop_nsecs / 1000ULL);
+    rc = 0;
+
+out:
+    if (rc == -1)
+        warnx("dumpcore: error(s) dumping live core, file may be incomplete");
+    close(live_fd);
+    live_fd = -1;
+    free(filename);
+    return rc;
+}
 
-failure:
-    warnx("dumpcore: error(s) dumping core, file may be incomplete");
-    close(fd);
+static void *live_thread(void *arg)
+{
+    struct hvt *hvt = arg;
+    unsigned seq = 0;
+    uint8_t c;
+
+    for (;;) {
+        ssize_t nbytes = read(trigger_pipe[0], &c, 1);
+        if (nbytes == -1 && errno == EINTR)
+            continue;
+        if (nbytes != 1)
+            err(1, "dumpcore: read() failed");
+        (void)live_dump(hvt, seq++);
+    }
+    return NULL;
+}
+
+static void trigger_handler(int signo)
+{
+    uint8_t c = 0;
+    int saved_errno = errno;
+
+    (void)signo;
+    (void)write(trigger_pipe[1], &c, 1);
+    errno = saved_errno;
+}
+
+static void live_init(struct hvt *hvt)
+{
+    bitmap = calloc(HVT_DIRTY_LOG_WORDS(npages), sizeof (uint64_t));
+    if (bitmap == NULL)
+        err(1, "calloc");
+    if (pipe(trigger_pipe) == -1 || pipe(stop_pipe) == -1)
+        err(1, "pipe() failed");
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof (struct sigaction));
+    sa.sa_handler = trigger_handler;
+    sa.sa_flags = SA_RESTART;
+    sigfillset(&sa.sa_mask);
+    if (sigaction(SIGQUIT, &sa, NULL) == -1)
+        err(1, "Could not install signal handler");
+
+    pthread_t thread;
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    if (pthread_create(&thread, NULL, live_thread, hvt) != 0)
+        errx(1, "Could not create dumpcore thread");
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
 }
 
 static int handle_cmdarg(char *cmdarg, struct mft *mft)
@@ -239,7 +578,8 @@ static int handle_cmdarg(char *cmdarg, struct mft *mft)
 
 static char *usage(void)
 {
-    return "--dumpcore=DIR (enable guest core dump on abort/trap)";
+    return "--dumpcore=DIR (enable guest core dump on abort/trap, "
+        "and live on SIGQUIT)";
 }
 
 static int setup(struct hvt *hvt, struct mft *mft)
@@ -247,6 +587,9 @@ static int setup(struct hvt *hvt, struct mft *mft)
     if (dumpcoredir == NULL)
         return 0; /* Not present */
 
+    if (hvt->cpus > 1)
+        errx(1, "dumpcore: not supported with more than one VCPU");
+
     dir = open(dumpcoredir, O_RDONLY | O_DIRECTORY);
     if (dir == -1)
         errx(1, "dumpcore: cannot open dir");
@@ -254,12 +597,20 @@ static int setup(struct hvt *hvt, struct mft *mft)
     if (access(dumpcoredir, W_OK) == -1)
         errx(1, "dumpcore: dir not writable");
 
-    if (hvt_core_register_halt_hook(hvt_dumpcore_hook) == -1)
+    if (hvt_core_register_halt_hook(hvt, hvt_dumpcore_hook) == -1)
         return -1;
 
     if (hvt_dumpcore_supported() == -1)
         errx(1, "dumpcore: not implemented for this backend/architecture");
 
+    long sz = sysconf(_SC_PAGESIZE);
+    if (sz == -1)
+        err(1, "dumpcore: Could not determine _SC_PAGESIZE");
+    page_size = sz;
+    assert (hvt->mem_size % page_size == 0);
+    npages = hvt->mem_size / page_size;
+    live_init(hvt);
+
     return 0;
 }
 
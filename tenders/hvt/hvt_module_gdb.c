@@ -45,6 +45,7 @@
 #include <assert.h>
 #include <stdbool.h>
 #include <ctype.h>
+#include <errno.h>
 
 #include "hvt.h"
 #include "hvt_gdb.h"
@@ -76,9 +77,21 @@ static int socket_fd = 0;
 static int portno = 1234; /* Default port number */
 static const char hexchars[] = "0123456789abcdef";
 
-#define BUFMAX                         4096
+/*
+ * Maximum size of a packet's data, advertised to the debugger as PacketSize.
+ * Memory is read and written in chunks of up to this size.
+ */
+#define BUFMAX                         0x10000
 static char in_buffer[BUFMAX];
+static size_t in_len;                   /* Bytes of data in (in_buffer) */
+static char out_buffer[BUFMAX];
 static unsigned char registers[BUFMAX];
+/* Packets are sent with escaping, which at most doubles their size. */
+static char tx_buffer[2 * BUFMAX + 4];
+static unsigned char rx_buffer[4096];
+static size_t rx_pos, rx_len;
+/* Set once the debugger has asked for QStartNoAckMode. */
+static bool no_ack;
 
 /* The actual error code is ignored by GDB, so any number will do. */
 #define GDB_ERROR_MSG                  "E01"
@@ -196,45 +209,63 @@ static int wait_for_connect()
     return 0;
 }
 
-static int send_char(char ch)
+static int send_all(const char *buf, size_t len)
 {
-    /* TCP is already buffering, so no need to buffer here as well. */
-    return send(socket_fd, &ch, 1, 0);
+    while (len > 0) {
+        ssize_t ret = send(socket_fd, buf, len, 0);
+        if (ret == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += ret;
+        len -= ret;
+    }
+    return 0;
 }
 
-static char recv_char(void)
+static int send_char(char ch)
 {
-    unsigned char ch;
-    int ret;
+    return send_all(&ch, 1);
+}
 
-    ret = recv(socket_fd, &ch, 1, 0);
-    if (ret < 0) {
-        return -1;
-    } else if (ret == 0) {
-        /* The peer has performed an orderly shutdown (from "man recv"). */
-        close(socket_fd);
-        socket_fd = -1;
-        return -1;
-    } else {
-        assert(ret == 1);
+/*
+ * Returns the next byte received from the debugger, or -1 on error. Packets
+ * carrying binary data may contain any byte, so input is buffered to avoid a
+ * recv() per byte.
+ */
+static int recv_char(void)
+{
+    if (rx_pos == rx_len) {
+        ssize_t ret;
+        do {
+            ret = recv(socket_fd, rx_buffer, sizeof rx_buffer, 0);
+        } while (ret == -1 && errno == EINTR);
+        if (ret < 0) {
+            return -1;
+        } else if (ret == 0) {
+            /* The peer has performed an orderly shutdown (from "man recv"). */
+            close(socket_fd);
+            socket_fd = -1;
+            return -1;
+        }
+        rx_pos = 0;
+        rx_len = ret;
     }
-
-    /* All GDB remote packets are encoded in ASCII. */
-    assert(isascii(ch));
-
-    return (char)ch;
+    return rx_buffer[rx_pos++];
 }
 
 /*
  * Scan for the sequence $<data>#<checksum>
- * Returns a null terminated string.
+ * Returns a null terminated string, with its length in (in_len) as binary
+ * data may contain null bytes.
  */
 static char *recv_packet(void)
 {
     char *buffer = &in_buffer[0];
     unsigned char checksum;
     unsigned char xmitcsum;
-    char ch;
+    int ch;
     int count;
 
     while (1) {
@@ -265,6 +296,7 @@ retry:
         }
         /* Let's make this a C string. */
         buffer[count] = '\0';
+        in_len = count;
 
         if (ch == '#') {
             ch = recv_char();
@@ -280,19 +312,20 @@ retry:
                 warnx("Failed checksum from GDB. "
                       "My count = 0x%x, sent=0x%x. buf=%s",
                       checksum, xmitcsum, buffer);
-                if (send_char('-') == -1)
+                if (!no_ack && send_char('-') == -1)
                     /* Unsuccessful reply to a failed checksum */
                     err(1, "GDB: Could not send an ACK to the debugger.");
             } else {
-                if (send_char('+') == -1)
+                if (!no_ack && send_char('+') == -1)
                     /* Unsuccessful reply to a successful transfer */
                     err(1, "GDB: Could not send an ACK to the debugger.");
 
                 /* if a sequence char is present, reply the sequence ID */
-                if (buffer[2] == ':') {
+                if (count >= 3 && buffer[2] == ':' && buffer[0] != 'X') {
                     send_char(buffer[0]);
                     send_char(buffer[1]);
 
+                    in_len -= 3;
                     return &buffer[3];
                 }
 
@@ -303,49 +336,57 @@ retry:
 }
 
 /*
- * Send packet of the form $<packet info>#<checksum> without waiting for an ACK
- * from the debugger. Only send_response
+ * Send packet of the form $<packet info>#<checksum>, with (len) bytes of
+ * data, without waiting for an ACK from the debugger. If (binary) is set,
+ * bytes which have a meaning in the protocol are escaped, as for binary data.
  */
-static void send_packet_no_ack(char *buffer)
+static void send_data_no_ack(const char *buffer, size_t len, bool binary)
 {
-    unsigned char checksum;
-    int count;
-    char ch;
+    unsigned char checksum = 0;
+    size_t count = 0;
 
     /*
-     * We ignore all send_char errors as we either: (1) care about sending our
+     * We ignore all send errors as we either: (1) care about sending our
      * packet and we will keep sending it until we get a good ACK from the
      * debugger, or (2) not care and just send it as a best-effort notification
      * when dying (see handle_hvt_exit).
      */
-
-    send_char('$');
-    checksum = 0;
-    count = 0;
-
-    ch = buffer[count];
-    while (ch) {
-        send_char(ch);
+    tx_buffer[count++] = '$';
+    for (size_t i = 0; i < len; i++) {
+        char ch = buffer[i];
+        if (binary &&
+                (ch == '#' || ch == '$' || ch == '}' || ch == '*')) {
+            tx_buffer[count++] = '}';
+            checksum += '}';
+            ch ^= 0x20;
+        }
+        tx_buffer[count++] = ch;
         checksum += ch;
-        count += 1;
-        ch = buffer[count];
     }
+    tx_buffer[count++] = '#';
+    tx_buffer[count++] = hexchars[checksum >> 4];
+    tx_buffer[count++] = hexchars[checksum % 16];
+    (void)send_all(tx_buffer, count);
+}
 
-    send_char('#');
-    send_char(hexchars[checksum >> 4]);
-    send_char(hexchars[checksum % 16]);
+static void send_packet_no_ack(char *buffer)
+{
+    send_data_no_ack(buffer, strlen(buffer), false);
 }
 
 /*
  * Send a packet and wait for a successful ACK of '+' from the debugger.
- * An ACK of '-' means that we have to resend.
+ * An ACK of '-' means that we have to resend. No ACKs are sent in no-ack
+ * mode.
  */
-static void send_packet(char *buffer)
+static void send_data(const char *buffer, size_t len, bool binary)
 {
-    char ch;
+    int ch;
 
     for (;;) {
-        send_packet_no_ack(buffer);
+        send_data_no_ack(buffer, len, binary);
+        if (no_ack)
+            break;
         ch = recv_char();
         if (ch == -1)
             return;
@@ -354,6 +395,66 @@ static void send_packet(char *buffer)
     }
 }
 
+static void send_packet(char *buffer)
+{
+    send_data(buffer, strlen(buffer), false);
+}
+
+/*
+ * Decodes the (len) bytes of escaped binary data at (buf) into (count) bytes
+ * at (mem). Returns 0 on success, or -1 if the data does not decode to
+ * exactly (count) bytes.
+ */
+static int bin2mem(const char *buf, size_t len, unsigned char *mem,
+        size_t count)
+{
+    size_t n = 0;
+
+    for (size_t i = 0; i < len; i++) {
+        unsigned char ch = buf[i];
+        if (ch == '}') {
+            if (++i == len)
+                return -1;
+            ch = buf[i] ^ 0x20;
+        }
+        if (n == count)
+            return -1;
+        mem[n++] = ch;
+    }
+    return (n == count) ? 0 : -1;
+}
+
+/*
+ * Sends the (offset) and (len) part of (data), of (size) bytes, as a reply to
+ * qXfer:...:read.
+ */
+static void send_xfer(const char *data, size_t size, size_t offset,
+        size_t len)
+{
+    if (offset > size)
+        offset = size;
+    if (len > size - offset)
+        len = size - offset;
+    if (len > BUFMAX - 1)
+        len = BUFMAX - 1;
+    out_buffer[0] = (offset + len < size) ? 'm' : 'l';
+    memcpy(out_buffer + 1, data + offset, len);
+    send_data(out_buffer, len + 1, true);
+}
+
+/*
+ * Checks that the (len) bytes at (addr) are within guest memory, and that
+ * their (expansion) times larger encoding fits in a packet.
+ */
+static bool mem_range_ok(struct hvt *hvt, hvt_gpa_t addr, size_t len,
+        size_t expansion)
+{
+    hvt_gpa_t result;
+
+    return addr <= hvt->mem_size && !add_overflow(addr, len, result) &&
+        result <= hvt->mem_size && len < (BUFMAX - 1) / expansion;
+}
+
 #define send_error_msg()   do { send_packet(GDB_ERROR_MSG); } while (0)
 
 #define send_not_supported_msg()   do { send_packet(""); } while (0)
@@ -383,7 +484,7 @@ static void send_response(char code, int sigval, bool wait_for_ack)
 static void gdb_handle_exception(struct hvt *hvt, int sigval)
 {
     char *packet;
-    char obuf[BUFMAX];
+    char *obuf = out_buffer;
 
     /* Notify the debugger of our last signal */
     send_response('S', sigval, true);
@@ -449,9 +550,7 @@ static void gdb_handle_exception(struct hvt *hvt, int sigval)
                 break;
             }
 
-            if ((addr > hvt->mem_size) ||
-                add_overflow(addr, len, result) ||
-                (result > hvt->mem_size)) {
+            if (!mem_range_ok(hvt, addr, len, 2)) {
                 /* Don't panic about this, just return error so the debugger
                  * tries again. */
                 send_error_msg();
@@ -462,17 +561,83 @@ static void gdb_handle_exception(struct hvt *hvt, int sigval)
             break; /* Wait for another command. */
         }
 
+        case 'x': {
+            /* Read memory content, as binary data */
+            if (sscanf(packet, "x%"PRIx64",%zx", &addr, &len) != 2 ||
+                !mem_range_ok(hvt, addr, len, 1)) {
+                send_error_msg();
+                break;
+            }
+            obuf[0] = 'b';
+            memcpy(obuf + 1, hvt->mem + addr, len);
+            send_data(obuf, len + 1, true);
+            break; /* Wait for another command. */
+        }
+
+        case 'X': {
+            /* Write memory content, as binary data */
+            char *data = memchr(packet, ':', in_len);
+            if (data == NULL ||
+                sscanf(packet, "X%"PRIx64",%zx:", &addr, &len) != 2 ||
+                !mem_range_ok(hvt, addr, len, 1)) {
+                send_error_msg();
+                break;
+            }
+            data++;
+            if (bin2mem(data, in_len - (data - packet), hvt->mem + addr,
+                        len) == -1)
+                send_error_msg();
+            else
+                send_okay_msg();
+            break; /* Wait for another command. */
+        }
+
+        case 'q': {
+            size_t offset;
+            if (strncmp(packet, "qSupported", 10) == 0) {
+                snprintf(obuf, BUFMAX, "PacketSize=%x;QStartNoAckMode+;"
+                        "qXfer:memory-map:read+", BUFMAX - 1);
+                send_packet(obuf);
+            }
+            else if (sscanf(packet, "qXfer:memory-map:read::%zx,%zx",
+                        &offset, &len) == 2) {
+                char map[256];
+                int size = snprintf(map, sizeof map,
+                        "<?xml version=\"1.0\"?>"
+                        "<!DOCTYPE memory-map PUBLIC "
+                        "\"+//IDN gnu.org//DTD GDB Memory Map V1.0//EN\" "
+                        "\"http://sourceware.org/gdb/gdb-memory-map.dtd\">"
+                        "<memory-map><memory type=\"ram\" start=\"0x0\" "
+                        "length=\"%#zx\"/></memory-map>", hvt->mem_size);
+                assert(size > 0 && size < (int)sizeof map);
+                send_xfer(map, size, offset, len);
+            }
+            else
+                send_not_supported_msg();
+            break; /* Wait for another command. */
+        }
+
+        case 'Q': {
+            if (strcmp(packet, "QStartNoAckMode") == 0) {
+                /* This reply is still acknowledged. */
+                send_okay_msg();
+                no_ack = true;
+            }
+            else
+                send_not_supported_msg();
+            break; /* Wait for another command. */
+        }
+
         case 'M': {
             /* Write memory content */
-            assert(strlen(packet) <= sizeof(obuf));
+            assert(strlen(packet) <= BUFMAX);
             if (sscanf(packet, "M%"PRIx64",%zx:%s", &addr, &len, obuf) != 3) {
                 send_error_msg();
                 break;
             }
 
-            if ((addr > hvt->mem_size) ||
-                add_overflow(addr, len, result) ||
-                (result > hvt->mem_size)) {
+            if (!mem_range_ok(hvt, addr, len, 2) ||
+                strlen(obuf) < 2 * len) {
                 /* Don't panic about this, just return error so the debugger
                  * tries again. */
                 send_error_msg();
@@ -625,7 +790,10 @@ static int setup(struct hvt *hvt, struct mft *mft)
     if (!use_gdb)
         return 0;
 
-    if (hvt_core_register_vmexit(handle_exit) == -1)
+    if (hvt->cpus > 1)
+        errx(1, "GDB is not supported with more than one VCPU");
+
+    if (hvt_core_register_vmexit(hvt, handle_exit) == -1)
         return -1;
 
     if (hvt_gdb_supported() == -1)
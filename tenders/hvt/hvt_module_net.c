@@ -22,22 +22,253 @@
  * hvt_module_net.c: Network device module.
  */
 
+#define _GNU_SOURCE
 #include <assert.h>
 #include <err.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
+#include <poll.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <linux/vhost.h>
+#endif
+
 #include "../common/tap_attach.h"
+#include "../common/netmap_attach.h"
+#include "../common/pcap.h"
+#include "../common/rate_limit.h"
+#include "../common/shm_attach.h"
+#include "../common/switch_attach.h"
+#include "../common/udp_attach.h"
+#include "../common/xdp_attach.h"
 #include "hvt.h"
 #include "solo5.h"
 
 static bool module_in_use;
+static bool use_rings;
+static bool use_vhost;
 static struct mft *host_mft;
 
+/*
+ * Network devices attached to an AF_XDP socket rather than a TAP device.
+ */
+static struct xdp_sock *xdp_socks[MFT_MAX_ENTRIES];
+
+/*
+ * Network devices attached to a netmap port rather than a TAP device.
+ */
+static struct netmap_port *netmap_ports[MFT_MAX_ENTRIES];
+
+/*
+ * Network devices attached to a shared-memory link to another tender rather
+ * than a TAP device.
+ */
+static struct shm_link *shm_links[MFT_MAX_ENTRIES];
+
+/*
+ * Network devices attached to a port of a switch shared between tenders
+ * rather than a TAP device.
+ */
+static struct switch_port *switch_ports[MFT_MAX_ENTRIES];
+
+/*
+ * Network devices attached to a UDP tunnel rather than a TAP device.
+ */
+static struct udp_link *udp_links[MFT_MAX_ENTRIES];
+
+/*
+ * Network devices attached to a vhost-user socket, which can only be used
+ * through virtio rings. Packets read or written through hypercalls before the
+ * guest has set up the rings are dropped.
+ */
+static bool vhost_user[MFT_MAX_ENTRIES];
+
+/*
+ * Host-side filters requested for tap networks with --net-filter, applied by
+ * setup() once the MAC address is known.
+ */
+static struct {
+    bool mac;
+    const char *bpf;
+} net_filters[MFT_MAX_ENTRIES];
+
+/*
+ * Networks captured with --net-pcap.
+ */
+static bool pcap_captured[MFT_MAX_ENTRIES];
+
+/*
+ * Rate limits set with --net-rate. While a device may not receive, its
+ * pollfd is paused, and (timerfd), registered for the same handle, wakes the
+ * guest once it may.
+ */
+static struct {
+    struct rate_limit rx, tx;
+    int timerfd;
+    bool paused;
+} net_rates[MFT_MAX_ENTRIES];
+
+/*
+ * Returns true if network (handle) may not receive now, having paused its
+ * readiness until it may.
+ */
+static bool rx_limited(uint64_t handle)
+{
+#if defined(__linux__)
+    if (!rate_limit_enabled(&net_rates[handle].rx))
+        return false;
+    uint64_t wait = rate_limit_wait(&net_rates[handle].rx,
+            rate_limit_clock());
+    if (wait == 0) {
+        if (net_rates[handle].paused) {
+            uint64_t n;
+            (void)read(net_rates[handle].timerfd, &n, sizeof n);
+            hvt_core_pollfd_resume(handle);
+            net_rates[handle].paused = false;
+        }
+        return false;
+    }
+    struct itimerspec it = {
+        .it_interval = { 0 },
+        .it_value = {
+            .tv_sec = wait / 1000000000ULL,
+            .tv_nsec = wait % 1000000000ULL
+        }
+    };
+    if (timerfd_settime(net_rates[handle].timerfd, 0, &it, NULL) == -1)
+        err(1, "timerfd_settime() failed");
+    if (!net_rates[handle].paused) {
+        hvt_core_pollfd_pause(handle);
+        net_rates[handle].paused = true;
+    }
+    return true;
+#else
+    (void)handle;
+    return false;
+#endif
+}
+
+/*
+ * Returns true if network (handle) may not transmit now. There is no
+ * readiness for transmitting, so the guest is left to retry.
+ */
+static bool tx_limited(uint64_t handle)
+{
+    return rate_limit_enabled(&net_rates[handle].tx) &&
+        rate_limit_wait(&net_rates[handle].tx, rate_limit_clock()) != 0;
+}
+
+/*
+ * Called when the host cannot accept a packet from the guest for network
+ * (handle), so that the guest is told once it can.
+ */
+static void tx_blocked(uint64_t handle)
+{
+#if defined(__linux__)
+    hvt_core_pollfd_want_write(handle);
+#else
+    (void)handle;
+#endif
+}
+
+/*
+ * Receive timestamp of a packet taken from a device now, see
+ * solo5_net_readv(). None of our devices give the host kernel's own.
+ */
+static uint64_t rx_tstamp(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+static void rate_charge(struct rate_limit *rl, size_t bytes)
+{
+    if (rate_limit_enabled(rl))
+        rate_limit_charge(rl, rate_limit_clock(), bytes);
+}
+
+static ssize_t dev_read(uint64_t handle, struct mft_entry *e, void *buf,
+        size_t len)
+{
+    ssize_t ret;
+
+    if (xdp_socks[handle] != NULL)
+        ret = xdp_read(xdp_socks[handle], buf, len);
+    else if (netmap_ports[handle] != NULL)
+        ret = netmap_read(netmap_ports[handle], buf, len);
+    else if (shm_links[handle] != NULL)
+        ret = shm_read(shm_links[handle], buf, len);
+    else if (switch_ports[handle] != NULL)
+        ret = switch_read(switch_ports[handle], buf, len);
+    else if (udp_links[handle] != NULL)
+        ret = udp_read(udp_links[handle], buf, len);
+    else if (vhost_user[handle]) {
+        errno = EAGAIN;
+        ret = -1;
+    }
+    else
+        ret = read(e->hostfd, buf, len);
+    if (ret > 0)
+        pcap_packet(handle, false, buf, ret);
+    TENDER_PROBE3(net__read, handle, len, ret);
+    return ret;
+}
+
+static ssize_t dev_write(uint64_t handle, struct mft_entry *e,
+        const void *buf, size_t len)
+{
+    ssize_t ret;
+
+    if (xdp_socks[handle] != NULL)
+        ret = xdp_write(xdp_socks[handle], buf, len);
+    else if (netmap_ports[handle] != NULL)
+        ret = netmap_write(netmap_ports[handle], buf, len);
+    else if (shm_links[handle] != NULL)
+        ret = shm_write(shm_links[handle], buf, len);
+    else if (switch_ports[handle] != NULL)
+        ret = switch_write(switch_ports[handle], buf, len);
+    else if (udp_links[handle] != NULL)
+        ret = udp_write(udp_links[handle], buf, len);
+    else if (vhost_user[handle])
+        ret = len;
+    else
+        ret = write(e->hostfd, buf, len);
+    if (ret > 0)
+        pcap_packet(handle, true, buf, len);
+    TENDER_PROBE3(net__write, handle, len, ret);
+    return ret;
+}
+
+/*
+ * Called after a batch of dev_write() calls, to send packets which the
+ * backend has only queued.
+ */
+static void dev_flush(uint64_t handle)
+{
+    if (netmap_ports[handle] != NULL)
+        netmap_flush(netmap_ports[handle]);
+    else if (shm_links[handle] != NULL)
+        shm_flush(shm_links[handle]);
+    else if (switch_ports[handle] != NULL)
+        switch_flush(switch_ports[handle]);
+    else if (udp_links[handle] != NULL)
+        udp_flush(udp_links[handle]);
+}
+
 static void hypercall_net_write(struct hvt *hvt, hvt_gpa_t gpa)
 {
     struct hvt_hc_net_write *wr =
@@ -50,9 +281,23 @@ static void hypercall_net_write(struct hvt *hvt, hvt_gpa_t gpa)
 
     int ret;
 
-    ret = write(e->hostfd, HVT_CHECKED_GPA_P(hvt, wr->data, wr->len), wr->len);
-    assert(wr->len == ret);
-    wr->ret = SOLO5_R_OK;
+    if (tx_limited(wr->handle)) {
+        wr->ret = SOLO5_R_AGAIN;
+        return;
+    }
+    ret = dev_write(wr->handle, e, HVT_CHECKED_GPA_P(hvt, wr->data, wr->len),
+            wr->len);
+    dev_flush(wr->handle);
+    if (ret == -1 && errno == EAGAIN) {
+        tx_blocked(wr->handle);
+        wr->ret = SOLO5_R_AGAIN;
+    }
+    else if ((size_t)ret != wr->len)
+        wr->ret = SOLO5_R_EUNSPEC;
+    else {
+        rate_charge(&net_rates[wr->handle].tx, wr->len);
+        wr->ret = SOLO5_R_OK;
+    }
 }
 
 static void hypercall_net_read(struct hvt *hvt, hvt_gpa_t gpa)
@@ -67,55 +312,866 @@ static void hypercall_net_read(struct hvt *hvt, hvt_gpa_t gpa)
 
     int ret;
 
-    ret = read(e->hostfd, HVT_CHECKED_GPA_P(hvt, rd->data, rd->len), rd->len);
+    if (rx_limited(rd->handle)) {
+        rd->ret = SOLO5_R_AGAIN;
+        return;
+    }
+    ret = dev_read(rd->handle, e, HVT_CHECKED_GPA_P(hvt, rd->data, rd->len),
+            rd->len);
+    hvt_core_pollfd_consumed(rd->handle);
     if ((ret == 0) ||
         (ret == -1 && errno == EAGAIN)) {
         rd->ret = SOLO5_R_AGAIN;
         return;
     }
     assert(ret > 0);
+    rate_charge(&net_rates[rd->handle].rx, ret);
     rd->len = ret;
     rd->ret = SOLO5_R_OK;
 }
 
+static void hypercall_net_writev(struct hvt *hvt, hvt_gpa_t gpa)
+{
+    struct hvt_hc_net_writev *wr =
+        HVT_CHECKED_GPA_P(hvt, gpa, sizeof (struct hvt_hc_net_writev));
+    struct mft_entry *e = mft_get_by_index(host_mft, wr->handle, MFT_NET_BASIC);
+    if (e == NULL || wr->iovcnt > HVT_NET_IOV_MAX) {
+        wr->ret = SOLO5_R_EINVAL;
+        return;
+    }
+
+    struct hvt_net_iov *iov = HVT_CHECKED_GPA_P(hvt, wr->iov,
+            wr->iovcnt * sizeof (struct hvt_net_iov));
+    int ret;
+
+    wr->ret = SOLO5_R_OK;
+    for (size_t i = 0; i < wr->iovcnt; i++) {
+        if (tx_limited(wr->handle)) {
+            iov[i].ret = SOLO5_R_AGAIN;
+            if (wr->ret == SOLO5_R_OK)
+                wr->ret = SOLO5_R_AGAIN;
+            continue;
+        }
+        ret = dev_write(wr->handle, e,
+                HVT_CHECKED_GPA_P(hvt, iov[i].data, iov[i].len), iov[i].len);
+        if (ret == -1 && errno == EAGAIN) {
+            tx_blocked(wr->handle);
+            iov[i].ret = SOLO5_R_AGAIN;
+        }
+        else if ((size_t)ret != iov[i].len)
+            iov[i].ret = SOLO5_R_EUNSPEC;
+        else {
+            iov[i].ret = SOLO5_R_OK;
+            rate_charge(&net_rates[wr->handle].tx, ret);
+        }
+        if (iov[i].ret != SOLO5_R_OK && wr->ret == SOLO5_R_OK)
+            wr->ret = iov[i].ret;
+    }
+    dev_flush(wr->handle);
+}
+
+static void hypercall_net_readv(struct hvt *hvt, hvt_gpa_t gpa)
+{
+    struct hvt_hc_net_readv *rd =
+        HVT_CHECKED_GPA_P(hvt, gpa, sizeof (struct hvt_hc_net_readv));
+    struct mft_entry *e = mft_get_by_index(host_mft, rd->handle, MFT_NET_BASIC);
+    if (e == NULL || rd->iovcnt > HVT_NET_IOV_MAX) {
+        rd->ret = SOLO5_R_EINVAL;
+        return;
+    }
+
+    struct hvt_net_iov *iov = HVT_CHECKED_GPA_P(hvt, rd->iov,
+            rd->iovcnt * sizeof (struct hvt_net_iov));
+    size_t n;
+    int ret;
+
+    /*
+     * Drain the tap device until it would block, we run out of buffers, or
+     * the device's rate limit is reached.
+     */
+    for (n = 0; n < rd->iovcnt; n++) {
+        if (rx_limited(rd->handle))
+            break;
+        ret = dev_read(rd->handle, e,
+                HVT_CHECKED_GPA_P(hvt, iov[n].data, iov[n].len), iov[n].len);
+        if ((ret == 0) ||
+            (ret == -1 && errno == EAGAIN))
+            break;
+        assert(ret > 0);
+        iov[n].len = ret;
+        iov[n].ret = SOLO5_R_OK;
+        iov[n].tstamp = rx_tstamp();
+        rate_charge(&net_rates[rd->handle].rx, ret);
+    }
+    hvt_core_pollfd_consumed(rd->handle);
+    rd->iovcnt = n;
+    rd->ret = (n > 0) ? SOLO5_R_OK : SOLO5_R_AGAIN;
+}
+
+/*
+ * Shared-memory packet rings.
+ *
+ * Once the guest has switched a network device to use rings, all packet I/O
+ * for the device is done by a dedicated I/O thread which moves packets
+ * between the tap device and the rings, while the guest continues to run.
+ * The vCPU thread is only involved in ring setup and, where the backend cannot
+ * deliver them to the I/O thread directly, for HVT_HYPERCALL_NET_NOTIFY
+ * doorbells.
+ */
+struct ring_dev {
+    int hostfd;                 /* tap device */
+    int readyfd[2];             /* rx readiness pipe, [0] is in the waitset */
+    struct hvt_net_ring *rx;
+    struct hvt_net_ring *tx;
+    bool active;
+};
+
+static struct ring_dev ring_devs[MFT_MAX_ENTRIES];
+/*
+ * (doorbellfd) is signalled on HVT_HYPERCALL_NET_NOTIFY. On Linux, it is an
+ * eventfd at both ends, elsewhere it is a pipe.
+ */
+static int doorbellfd[2] = { -1, -1 };
+static bool io_thread_running;
+static pthread_t io_thread;
+
+static void pipe_signal(int fd[2])
+{
+    char buf[64];
+    uint64_t one = 1;
+
+    /*
+     * Drain the pipe before signalling, so that it can never fill up and
+     * every signal is seen as a new edge by the reader. Writes are of 8 bytes,
+     * so that this works with an eventfd too.
+     */
+    while (read(fd[0], buf, sizeof buf) > 0)
+        ;
+    (void)write(fd[1], &one, sizeof one);
+}
+
+static void ring_serve_tx(struct ring_dev *d)
+{
+    struct hvt_net_ring *r = d->tx;
+
+    for (;;) {
+        uint32_t avail = ring_cons_avail(&r->idx);
+        if (avail == 0) {
+            /*
+             * Pairs with the fence in the guest after publishing (prod),
+             * ensuring that either we see the new (prod) or the guest sees
+             * our (cons) and rings the doorbell.
+             */
+            ring_fence();
+            if (ring_cons_avail(&r->idx) == 0)
+                break;
+            continue;
+        }
+        /* A corrupt (prod) must not keep us here. */
+        if (avail > HVT_NET_RING_SLOTS)
+            avail = HVT_NET_RING_SLOTS;
+        uint32_t pos = ring_cons_pos(&r->idx);
+        for (uint32_t i = 0; i < avail; i++) {
+            struct hvt_net_ring_slot *slot =
+                &r->slot[ring_slot(pos + i, HVT_NET_RING_SLOTS)];
+            uint32_t len = slot->len;
+            if (len <= sizeof slot->data &&
+                    write(d->hostfd, slot->data, len) > 0)
+                pcap_packet(d - ring_devs, true, slot->data, len);
+        }
+        ring_cons_release(&r->idx, avail);
+    }
+}
+
+static void ring_serve_rx(struct ring_dev *d)
+{
+    static uint8_t discard[HVT_NET_RING_SLOT_SIZE];
+    struct hvt_net_ring *r = d->rx;
+    uint32_t pos0 = ring_prod_pos(&r->idx);
+    ssize_t ret;
+
+    for (;;) {
+        if (ring_prod_free(&r->idx, HVT_NET_RING_SLOTS) == 0) {
+            /*
+             * Ring is full, drop the packet.
+             */
+            ret = read(d->hostfd, discard, sizeof discard);
+            if (ret <= 0)
+                break;
+            continue;
+        }
+        struct hvt_net_ring_slot *slot =
+            &r->slot[ring_slot(ring_prod_pos(&r->idx), HVT_NET_RING_SLOTS)];
+        ret = read(d->hostfd, slot->data, sizeof slot->data);
+        if (ret <= 0)
+            break;
+        pcap_packet(d - ring_devs, false, slot->data, ret);
+        slot->len = ret;
+        slot->tstamp = rx_tstamp();
+        ring_prod_publish(&r->idx, 1);
+    }
+    if (ring_prod_pos(&r->idx) == pos0)
+        return;
+    /*
+     * If the guest had consumed all packets in the ring before we started,
+     * it may be blocked in HVT_HYPERCALL_POLL and must be woken up.
+     */
+    ring_fence();
+    if (ring_prod_drained(&r->idx, pos0))
+        pipe_signal(d->readyfd);
+}
+
+static void *ring_io_thread(void *arg)
+{
+    (void)arg;
+    struct pollfd fds[MFT_MAX_ENTRIES + 1];
+    unsigned handles[MFT_MAX_ENTRIES];
+
+    for (;;) {
+        nfds_t nfds = 1;
+        fds[0].fd = doorbellfd[0];
+        fds[0].events = POLLIN;
+        for (unsigned i = 0; i != MFT_MAX_ENTRIES; i++) {
+            if (!__atomic_load_n(&ring_devs[i].active, __ATOMIC_ACQUIRE))
+                continue;
+            handles[nfds - 1] = i;
+            fds[nfds].fd = ring_devs[i].hostfd;
+            fds[nfds].events = POLLIN;
+            nfds++;
+        }
+
+        int rc = poll(fds, nfds, -1);
+        if (rc == -1 && errno == EINTR)
+            continue;
+        if (rc == -1)
+            err(1, "poll() failed in network I/O thread");
+        if (fds[0].revents & POLLIN) {
+            char buf[64];
+            while (read(doorbellfd[0], buf, sizeof buf) > 0)
+                ;
+        }
+        /*
+         * Doorbells do not identify a ring, so always serve all TX rings.
+         */
+        for (nfds_t i = 1; i < nfds; i++) {
+            struct ring_dev *d = &ring_devs[handles[i - 1]];
+            ring_serve_tx(d);
+            if (fds[i].revents & POLLIN)
+                ring_serve_rx(d);
+        }
+    }
+
+    return NULL;
+}
+
+static void hypercall_net_rings(struct hvt *hvt, hvt_gpa_t gpa)
+{
+    struct hvt_hc_net_rings *rs =
+        HVT_CHECKED_GPA_P(hvt, gpa, sizeof (struct hvt_hc_net_rings));
+    struct mft_entry *e = mft_get_by_index(host_mft, rs->handle, MFT_NET_BASIC);
+    if (e == NULL || !e->attached || ring_devs[rs->handle].active) {
+        rs->ret = SOLO5_R_EINVAL;
+        return;
+    }
+
+    struct ring_dev *d = &ring_devs[rs->handle];
+    d->rx = HVT_CHECKED_GPA_P(hvt, rs->rx, sizeof (struct hvt_net_ring));
+    d->tx = HVT_CHECKED_GPA_P(hvt, rs->tx, sizeof (struct hvt_net_ring));
+    __atomic_store_n(&d->active, true, __ATOMIC_RELEASE);
+
+    if (!io_thread_running) {
+        if (pthread_create(&io_thread, NULL, ring_io_thread, NULL) != 0)
+            errx(1, "Could not create network I/O thread");
+        io_thread_running = true;
+    }
+    else {
+        /* Have the I/O thread pick up the new device. */
+        pipe_signal(doorbellfd);
+    }
+    rs->ret = SOLO5_R_OK;
+}
+
+static void setup_pipe(int fd[2])
+{
+    if (pipe(fd) == -1)
+        err(1, "pipe() failed");
+    for (int i = 0; i < 2; i++) {
+        int flags = fcntl(fd[i], F_GETFL);
+        if (flags == -1 || fcntl(fd[i], F_SETFL, flags | O_NONBLOCK) == -1)
+            err(1, "fcntl(O_NONBLOCK) failed");
+    }
+}
+
+#if defined(__linux__)
+/*
+ * vhost-net backend.
+ *
+ * The guest sets up virtio rings in its memory, which are then handed to the
+ * host kernel's vhost-net together with the tap device. Guest kicks are
+ * routed to vhost through KVM ioeventfds, and vhost signals used receive
+ * buffers through an eventfd in the poll wait set, so packets never pass
+ * through the tender.
+ */
+struct vhost_dev {
+    int vhostfd;
+    int kickfd[2];
+    int callfd;
+    bool protocol_features;             /* vhost-user only */
+    bool active;
+};
+
+static struct vhost_dev vhost_devs[MFT_MAX_ENTRIES];
+
+/*
+ * vhost-user backend (--net:NAME=vhost-user:PATH).
+ *
+ * The rings are served by a user-space switch, such as DPDK or Snabb,
+ * listening on the vhost-user socket at PATH, rather than by vhost-net. The
+ * switch is given guest memory, which must therefore be shared
+ * (--mem-shared), and the kick and call eventfds, so that packets pass
+ * through neither the tender nor the host kernel. (vhostfd) is the socket.
+ * Only the legacy virtio header is negotiated, matching the guest's rings.
+ */
+#define VHOST_USER_GET_FEATURES          1
+#define VHOST_USER_SET_FEATURES          2
+#define VHOST_USER_SET_OWNER             3
+#define VHOST_USER_SET_MEM_TABLE         5
+#define VHOST_USER_SET_VRING_NUM         8
+#define VHOST_USER_SET_VRING_ADDR        9
+#define VHOST_USER_SET_VRING_BASE        10
+#define VHOST_USER_SET_VRING_KICK        12
+#define VHOST_USER_SET_VRING_CALL        13
+#define VHOST_USER_GET_PROTOCOL_FEATURES 15
+#define VHOST_USER_SET_PROTOCOL_FEATURES 16
+#define VHOST_USER_SET_VRING_ENABLE      18
+
+#define VHOST_USER_VERSION               0x1
+#define VHOST_USER_REPLY                 0x4
+#define VHOST_USER_VRING_NOFD            0x100
+#define VHOST_USER_F_PROTOCOL_FEATURES   30
+
+struct vhost_user_region {
+    uint64_t guest_phys_addr;
+    uint64_t memory_size;
+    uint64_t userspace_addr;
+    uint64_t mmap_offset;
+};
+
+struct vhost_user_msg {
+    uint32_t request;
+    uint32_t flags;
+    uint32_t size;
+    union {
+        uint64_t u64;
+        struct vhost_vring_state state;
+        struct vhost_vring_addr addr;
+        struct {
+            uint32_t nregions;
+            uint32_t padding;
+            struct vhost_user_region region;
+        } mem;
+    } payload;
+} __attribute__((packed));
+
+#define VHOST_USER_HDR_SIZE offsetof(struct vhost_user_msg, payload)
+
+/*
+ * Send (request) with (size) bytes of (payload) on (sock), passing (fd) with
+ * it unless it is -1. Returns 0 on success, -1 on error.
+ */
+static int vhost_user_send(int sock, uint32_t request, const void *payload,
+        uint32_t size, int fd)
+{
+    struct vhost_user_msg msg = {
+        .request = request,
+        .flags = VHOST_USER_VERSION,
+        .size = size
+    };
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof (int))];
+    } control;
+    assert(size <= sizeof msg.payload);
+    if (size)
+        memcpy(&msg.payload, payload, size);
+    struct iovec iov = {
+        .iov_base = &msg,
+        .iov_len = VHOST_USER_HDR_SIZE + size
+    };
+    struct msghdr mh = { .msg_iov = &iov, .msg_iovlen = 1 };
+    if (fd != -1) {
+        memset(&control, 0, sizeof control);
+        mh.msg_control = control.buf;
+        mh.msg_controllen = sizeof control.buf;
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&mh);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof (int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof (int));
+    }
+    ssize_t nbytes;
+    do {
+        nbytes = sendmsg(sock, &mh, MSG_NOSIGNAL);
+    } while (nbytes == -1 && errno == EINTR);
+    if (nbytes != (ssize_t)iov.iov_len) {
+        warn("vhost-user: Could not send request %u", request);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Send (request) on (sock) and receive its reply, a u64, into (*val).
+ * Returns 0 on success, -1 on error.
+ */
+static int vhost_user_get_u64(int sock, uint32_t request, uint64_t *val)
+{
+    struct vhost_user_msg msg;
+
+    if (vhost_user_send(sock, request, NULL, 0, -1) == -1)
+        return -1;
+    size_t want = VHOST_USER_HDR_SIZE + sizeof msg.payload.u64;
+    size_t got = 0;
+    while (got < want) {
+        ssize_t nbytes = recv(sock, (char *)&msg + got, want - got, 0);
+        if (nbytes == -1 && errno == EINTR)
+            continue;
+        if (nbytes <= 0) {
+            warnx("vhost-user: No reply to request %u", request);
+            return -1;
+        }
+        got += nbytes;
+    }
+    if (msg.request != request || !(msg.flags & VHOST_USER_REPLY) ||
+            msg.size != sizeof msg.payload.u64) {
+        warnx("vhost-user: Invalid reply to request %u", request);
+        return -1;
+    }
+    *val = msg.payload.u64;
+    return 0;
+}
+
+static int vhost_user_connect(const char *path)
+{
+    struct sockaddr_un sa = { .sun_family = AF_UNIX };
+
+    if (strlen(path) >= sizeof sa.sun_path) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(sa.sun_path, path);
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock == -1)
+        return -1;
+    if (connect(sock, (struct sockaddr *)&sa, sizeof sa) == -1) {
+        int saved_errno = errno;
+        close(sock);
+        errno = saved_errno;
+        return -1;
+    }
+    return sock;
+}
+
+/*
+ * Negotiate features with the vhost-user backend of (d). Returns 0 on
+ * success, -1 on error.
+ */
+static int vhost_user_setup_dev(struct vhost_dev *d)
+{
+    uint64_t features, protocol_features;
+
+    if (vhost_user_send(d->vhostfd, VHOST_USER_SET_OWNER, NULL, 0, -1) == -1 ||
+            vhost_user_get_u64(d->vhostfd, VHOST_USER_GET_FEATURES,
+                &features) == -1)
+        return -1;
+    /*
+     * With protocol features, rings start disabled and must be enabled once
+     * set up. No protocol features are used otherwise.
+     */
+    features &= 1ULL << VHOST_USER_F_PROTOCOL_FEATURES;
+    if (vhost_user_send(d->vhostfd, VHOST_USER_SET_FEATURES, &features,
+                sizeof features, -1) == -1)
+        return -1;
+    if (features) {
+        if (vhost_user_get_u64(d->vhostfd, VHOST_USER_GET_PROTOCOL_FEATURES,
+                    &protocol_features) == -1)
+            return -1;
+        protocol_features = 0;
+        if (vhost_user_send(d->vhostfd, VHOST_USER_SET_PROTOCOL_FEATURES,
+                    &protocol_features, sizeof protocol_features, -1) == -1)
+            return -1;
+    }
+    d->protocol_features = features != 0;
+    return 0;
+}
+
+/*
+ * Hand guest memory and the rings in (vr) to the vhost-user backend of (d).
+ */
+static void vhost_user_vrings(struct hvt *hvt, struct vhost_dev *d,
+        struct hvt_hc_net_vrings *vr)
+{
+    int sock = d->vhostfd;
+    struct vhost_user_region region = {
+        .guest_phys_addr = 0,
+        .memory_size = hvt->mem_size,
+        .userspace_addr = (uint64_t)hvt->mem,
+        .mmap_offset = 0
+    };
+    struct {
+        uint32_t nregions;
+        uint32_t padding;
+        struct vhost_user_region region;
+    } mem = { .nregions = 1, .region = region };
+    if (vhost_user_send(sock, VHOST_USER_SET_MEM_TABLE, &mem, sizeof mem,
+                hvt->mem_fd) == -1)
+        errx(1, "vhost-user: Could not set up guest memory");
+
+    for (unsigned q = 0; q < 2; q++) {
+        struct hvt_net_vring *ring = &vr->queue[q];
+        struct vhost_vring_state state = { .index = q };
+        struct vhost_vring_addr addr = { .index = q };
+        uint64_t file;
+
+        addr.desc_user_addr = (uint64_t)HVT_CHECKED_GPA_P(hvt, ring->desc,
+                16 * HVT_NET_VRING_NUM);
+        addr.avail_user_addr = (uint64_t)HVT_CHECKED_GPA_P(hvt, ring->avail,
+                6 + 2 * HVT_NET_VRING_NUM);
+        addr.used_user_addr = (uint64_t)HVT_CHECKED_GPA_P(hvt, ring->used,
+                6 + 8 * HVT_NET_VRING_NUM);
+
+        state.num = HVT_NET_VRING_NUM;
+        if (vhost_user_send(sock, VHOST_USER_SET_VRING_NUM, &state,
+                    sizeof state, -1) == -1)
+            goto fail;
+        state.num = 0;
+        if (vhost_user_send(sock, VHOST_USER_SET_VRING_BASE, &state,
+                    sizeof state, -1) == -1 ||
+                vhost_user_send(sock, VHOST_USER_SET_VRING_ADDR, &addr,
+                    sizeof addr, -1) == -1)
+            goto fail;
+        file = q;
+        if (vhost_user_send(sock, VHOST_USER_SET_VRING_KICK, &file,
+                    sizeof file, d->kickfd[q]) == -1)
+            goto fail;
+        /*
+         * As with vhost-net, we only ask for notifications on the receive
+         * queue.
+         */
+        if (q == HVT_NET_VRING_RX) {
+            if (vhost_user_send(sock, VHOST_USER_SET_VRING_CALL, &file,
+                        sizeof file, d->callfd) == -1)
+                goto fail;
+        }
+        else {
+            file |= VHOST_USER_VRING_NOFD;
+            if (vhost_user_send(sock, VHOST_USER_SET_VRING_CALL, &file,
+                        sizeof file, -1) == -1)
+                goto fail;
+        }
+        if (d->protocol_features) {
+            state.num = 1;
+            if (vhost_user_send(sock, VHOST_USER_SET_VRING_ENABLE, &state,
+                        sizeof state, -1) == -1)
+                goto fail;
+        }
+        (void)hvt_ioeventfd(hvt, HVT_HYPERCALL_NET_KICK, d->kickfd[q], true,
+                HVT_NET_VRING_QUEUE(vr->handle, q));
+    }
+    return;
+
+fail:
+    errx(1, "vhost-user: Could not set up rings");
+}
+
+static int vhost_setup_eventfds(struct vhost_dev *d)
+{
+    for (int q = 0; q < 2; q++) {
+        d->kickfd[q] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (d->kickfd[q] == -1)
+            err(1, "eventfd() failed");
+    }
+    d->callfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (d->callfd == -1)
+        err(1, "eventfd() failed");
+    return 0;
+}
+
+static int vhost_setup_dev(struct vhost_dev *d, bool user)
+{
+    uint64_t features;
+
+    if (user) {
+        if (vhost_user_setup_dev(d) == -1)
+            return -1;
+        return vhost_setup_eventfds(d);
+    }
+    d->vhostfd = open("/dev/vhost-net", O_RDWR | O_CLOEXEC);
+    if (d->vhostfd == -1) {
+        warn("Could not open /dev/vhost-net");
+        return -1;
+    }
+    if (ioctl(d->vhostfd, VHOST_SET_OWNER, NULL) == -1) {
+        warn("vhost: ioctl(VHOST_SET_OWNER) failed");
+        return -1;
+    }
+    if (ioctl(d->vhostfd, VHOST_GET_FEATURES, &features) == -1) {
+        warn("vhost: ioctl(VHOST_GET_FEATURES) failed");
+        return -1;
+    }
+    /*
+     * We do not enable IFF_VNET_HDR on the tap device, so have vhost add and
+     * strip the virtio_net_hdr on our behalf.
+     */
+    if (!(features & (1ULL << VHOST_NET_F_VIRTIO_NET_HDR))) {
+        warnx("vhost: VHOST_NET_F_VIRTIO_NET_HDR not supported");
+        return -1;
+    }
+    features = 1ULL << VHOST_NET_F_VIRTIO_NET_HDR;
+    if (ioctl(d->vhostfd, VHOST_SET_FEATURES, &features) == -1) {
+        warn("vhost: ioctl(VHOST_SET_FEATURES) failed");
+        return -1;
+    }
+    return vhost_setup_eventfds(d);
+}
+
+static void hypercall_net_vrings(struct hvt *hvt, hvt_gpa_t gpa)
+{
+    struct hvt_hc_net_vrings *vr =
+        HVT_CHECKED_GPA_P(hvt, gpa, sizeof (struct hvt_hc_net_vrings));
+    struct mft_entry *e = mft_get_by_index(host_mft, vr->handle, MFT_NET_BASIC);
+    if (e == NULL || !e->attached || vhost_devs[vr->handle].active) {
+        vr->ret = SOLO5_R_EINVAL;
+        return;
+    }
+    struct vhost_dev *d = &vhost_devs[vr->handle];
+    const unsigned num = HVT_NET_VRING_NUM;
+
+    for (unsigned q = 0; q < 2; q++) {
+        struct hvt_net_vring *ring = &vr->queue[q];
+        if ((ring->desc & 15) || (ring->avail & 1) || (ring->used & 3)) {
+            vr->ret = SOLO5_R_EINVAL;
+            return;
+        }
+    }
+    if (vhost_user[vr->handle]) {
+        vhost_user_vrings(hvt, d, vr);
+        d->active = true;
+        vr->ret = SOLO5_R_OK;
+        return;
+    }
+
+    struct {
+        struct vhost_memory m;
+        struct vhost_memory_region r;
+    } mem = {
+        .m.nregions = 1,
+        .r.guest_phys_addr = 0,
+        .r.memory_size = hvt->mem_size,
+        .r.userspace_addr = (uint64_t)hvt->mem
+    };
+    if (ioctl(d->vhostfd, VHOST_SET_MEM_TABLE, &mem) == -1)
+        err(1, "vhost: ioctl(VHOST_SET_MEM_TABLE) failed");
+
+    for (unsigned q = 0; q < 2; q++) {
+        struct hvt_net_vring *ring = &vr->queue[q];
+        struct vhost_vring_state state = { .index = q };
+        struct vhost_vring_addr addr = { .index = q };
+        struct vhost_vring_file file = { .index = q };
+
+        addr.desc_user_addr = (uint64_t)HVT_CHECKED_GPA_P(hvt, ring->desc,
+                16 * num);
+        addr.avail_user_addr = (uint64_t)HVT_CHECKED_GPA_P(hvt, ring->avail,
+                6 + 2 * num);
+        addr.used_user_addr = (uint64_t)HVT_CHECKED_GPA_P(hvt, ring->used,
+                6 + 8 * num);
+
+        state.num = num;
+        if (ioctl(d->vhostfd, VHOST_SET_VRING_NUM, &state) == -1)
+            err(1, "vhost: ioctl(VHOST_SET_VRING_NUM) failed");
+        state.num = 0;
+        if (ioctl(d->vhostfd, VHOST_SET_VRING_BASE, &state) == -1)
+            err(1, "vhost: ioctl(VHOST_SET_VRING_BASE) failed");
+        if (ioctl(d->vhostfd, VHOST_SET_VRING_ADDR, &addr) == -1)
+            err(1, "vhost: ioctl(VHOST_SET_VRING_ADDR) failed");
+        file.fd = d->kickfd[q];
+        if (ioctl(d->vhostfd, VHOST_SET_VRING_KICK, &file) == -1)
+            err(1, "vhost: ioctl(VHOST_SET_VRING_KICK) failed");
+        /*
+         * Used transmit buffers are reclaimed by the guest as needed, so we
+         * only ask for notifications on the receive queue.
+         */
+        file.fd = (q == HVT_NET_VRING_RX) ? d->callfd : -1;
+        if (ioctl(d->vhostfd, VHOST_SET_VRING_CALL, &file) == -1)
+            err(1, "vhost: ioctl(VHOST_SET_VRING_CALL) failed");
+        file.fd = host_mft->e[vr->handle].hostfd;
+        if (ioctl(d->vhostfd, VHOST_NET_SET_BACKEND, &file) == -1)
+            err(1, "vhost: ioctl(VHOST_NET_SET_BACKEND) failed");
+        /*
+         * If the backend cannot route kicks directly to vhost, they exit to
+         * hypercall_net_kick() below instead.
+         */
+        (void)hvt_ioeventfd(hvt, HVT_HYPERCALL_NET_KICK, d->kickfd[q], true,
+                HVT_NET_VRING_QUEUE(vr->handle, q));
+    }
+
+    d->active = true;
+    vr->ret = SOLO5_R_OK;
+}
+
+static void hypercall_net_kick(struct hvt *hvt, hvt_gpa_t gpa)
+{
+    uint64_t handle = gpa >> 1, q = gpa & 1, one = 1;
+
+    (void)hvt;
+    if (handle >= MFT_MAX_ENTRIES || !vhost_devs[handle].active)
+        return;
+    (void)write(vhost_devs[handle].kickfd[q], &one, sizeof one);
+}
+#endif /* __linux__ */
+
 static int handle_cmdarg(char *cmdarg, struct mft *mft)
 {
     enum {
         opt_net,
-        opt_net_mac
+        opt_net_offload,
+        opt_net_mac,
+        opt_net_mtu,
+        opt_net_filter,
+        opt_net_rate,
+        opt_net_pcap
     } which;
 
-    if (strncmp("--net:", cmdarg, 6) == 0)
+    if (strcmp("--net-rings", cmdarg) == 0) {
+        use_rings = true;
+        return 0;
+    }
+#if defined(__linux__)
+    else if (strcmp("--net-vhost", cmdarg) == 0) {
+        use_vhost = true;
+        return 0;
+    }
+#endif
+    else if (strncmp("--net:", cmdarg, 6) == 0)
         which = opt_net;
+    else if (strncmp("--net-offload:", cmdarg, 14) == 0)
+        which = opt_net_offload;
     else if (strncmp("--net-mac:", cmdarg, 10) == 0)
         which = opt_net_mac;
+    else if (strncmp("--net-mtu:", cmdarg, 10) == 0)
+        which = opt_net_mtu;
+    else if (strncmp("--net-pcap:", cmdarg, 11) == 0)
+        which = opt_net_pcap;
+#if defined(__linux__)
+    else if (strncmp("--net-filter:", cmdarg, 13) == 0)
+        which = opt_net_filter;
+    else if (strncmp("--net-rate:", cmdarg, 11) == 0)
+        which = opt_net_rate;
+#endif
     else
         return -1;
 
     char name[MFT_NAME_SIZE];
-    char iface[20]; /* XXX should be IFNAMSIZ, needs extra header here */
+    char iface[128]; /* Fits "vhost-user:" + sizeof sun_path */
     int rc;
-    if (which == opt_net) {
-        rc = sscanf(cmdarg,
-                "--net:%" XSTR(MFT_NAME_MAX) "[A-Za-z0-9]="
-                "%19s", name, iface);
+    if (which == opt_net || which == opt_net_offload) {
+        if (which == opt_net)
+            rc = sscanf(cmdarg,
+                    "--net:%" XSTR(MFT_NAME_MAX) "[A-Za-z0-9]="
+                    "%127s", name, iface);
+        else
+            rc = sscanf(cmdarg,
+                    "--net-offload:%" XSTR(MFT_NAME_MAX) "[A-Za-z0-9]="
+                    "%127s", name, iface);
         if (rc != 2)
             return -1;
-        struct mft_entry *e = mft_get_by_name(mft, name, MFT_NET_BASIC, NULL);
+        unsigned index;
+        struct mft_entry *e = mft_get_by_name(mft, name, MFT_NET_BASIC,
+                &index);
         if (e == NULL) {
             warnx("Resource not declared in manifest: '%s'", name);
             return -1;
         }
-        int fd = tap_attach(iface);
+        uint32_t offloads = 0;
+        int fd;
+        if (which == opt_net && xdp_is_spec(iface)) {
+            xdp_socks[index] = xdp_attach(iface);
+            if (xdp_socks[index] == NULL) {
+                warn("Could not attach AF_XDP socket: %s", iface);
+                return -1;
+            }
+            fd = xdp_fd(xdp_socks[index]);
+        }
+        else if (which == opt_net && netmap_is_spec(iface)) {
+            netmap_ports[index] = netmap_attach(iface);
+            if (netmap_ports[index] == NULL) {
+                warn("Could not attach netmap port: %s", iface);
+                return -1;
+            }
+            fd = netmap_fd(netmap_ports[index]);
+        }
+        else if (which == opt_net && shm_is_spec(iface)) {
+            shm_links[index] = shm_attach(iface);
+            if (shm_links[index] == NULL) {
+                warn("Could not attach shared-memory link: %s", iface + 4);
+                return -1;
+            }
+            fd = shm_fd(shm_links[index]);
+        }
+        else if (which == opt_net && switch_is_spec(iface)) {
+            switch_ports[index] = switch_attach(iface);
+            if (switch_ports[index] == NULL) {
+                warn("Could not attach switch port: %s", iface + 7);
+                return -1;
+            }
+            fd = switch_fd(switch_ports[index]);
+        }
+        else if (which == opt_net && udp_is_spec(iface)) {
+            udp_links[index] = udp_attach(iface);
+            if (udp_links[index] == NULL) {
+                warn("Could not attach UDP tunnel: %s", iface + 4);
+                return -1;
+            }
+            fd = udp_fd(udp_links[index]);
+        }
+#if defined(__linux__)
+        else if (which == opt_net && strncmp(iface, "vhost-user:", 11) == 0) {
+            fd = vhost_user_connect(iface + 11);
+            if (fd == -1) {
+                warn("Could not connect to vhost-user socket: %s", iface + 11);
+                return -1;
+            }
+            vhost_user[index] = true;
+            use_vhost = true;
+        }
+#endif
+        else if (which == opt_net && e->attrs.net.offloads == 0)
+            fd = tap_attach(iface);
+        else
+            fd = tap_attach_offload(iface, &offloads);
         if (fd < 0) {
             warnx("Could not attach interface: %s", iface);
             return -1;
         }
 
         /* e->u.net_basic.mac[] is set either by option or generated later by
-         * setup().
+         * setup(). Likewise, e->u.net_basic.mtu is either set by option,
+         * required by the manifest or taken from the host interface here.
          */
-        e->u.net_basic.mtu = 1500; /* TODO */
+        if (e->u.net_basic.mtu == 0)
+            e->u.net_basic.mtu = e->attrs.net.mtu;
+        if (e->u.net_basic.mtu == 0) {
+            int mtu = xdp_socks[index] ? XDP_ATTACH_MTU :
+                netmap_ports[index] ? NETMAP_ATTACH_MTU :
+                shm_links[index] ? SHM_ATTACH_MTU :
+                switch_ports[index] ? SWITCH_ATTACH_MTU :
+                udp_links[index] ? UDP_ATTACH_MTU :
+                vhost_user[index] ? 1500 : tap_attach_mtu(fd);
+            if (mtu < MFT_NET_MTU_MIN || mtu > MFT_NET_MTU_MAX)
+                mtu = 1500;
+            e->u.net_basic.mtu = mtu;
+        }
+        e->u.net_basic.offloads = offloads;
         e->hostfd = fd;
         e->attached = true;
         module_in_use = true;
@@ -137,20 +1193,185 @@ static int handle_cmdarg(char *cmdarg, struct mft *mft)
         }
         memcpy(e->u.net_basic.mac, mac, sizeof mac);
     }
+    else if (which == opt_net_mtu) {
+        unsigned mtu;
+        rc = sscanf(cmdarg,
+                "--net-mtu:%" XSTR(MFT_NAME_MAX) "[A-Za-z0-9]=%u",
+                name, &mtu);
+        if (rc != 2)
+            return -1;
+        struct mft_entry *e = mft_get_by_name(mft, name, MFT_NET_BASIC, NULL);
+        if (e == NULL) {
+            warnx("Resource not declared in manifest: '%s'", name);
+            return -1;
+        }
+        if (mtu < MFT_NET_MTU_MIN || mtu > MFT_NET_MTU_MAX) {
+            warnx("Invalid MTU for network '%s': %u", name, mtu);
+            return -1;
+        }
+        e->u.net_basic.mtu = mtu;
+    }
+    else if (which == opt_net_filter) {
+        int n = -1;
+        rc = sscanf(cmdarg,
+                "--net-filter:%" XSTR(MFT_NAME_MAX) "[A-Za-z0-9]=%n",
+                name, &n);
+        if (rc != 1 || n == -1)
+            return -1;
+        const char *spec = cmdarg + n;
+        unsigned index;
+        struct mft_entry *e = mft_get_by_name(mft, name, MFT_NET_BASIC,
+                &index);
+        if (e == NULL) {
+            warnx("Resource not declared in manifest: '%s'", name);
+            return -1;
+        }
+        if (strcmp(spec, "mac") == 0)
+            net_filters[index].mac = true;
+        else if (strncmp(spec, "bpf:", 4) == 0 && spec[4] != '\0')
+            net_filters[index].bpf = spec + 4;
+        else
+            return -1;
+    }
+    else if (which == opt_net_rate) {
+        int n = -1;
+        rc = sscanf(cmdarg,
+                "--net-rate:%" XSTR(MFT_NAME_MAX) "[A-Za-z0-9]=%n",
+                name, &n);
+        if (rc != 1 || n == -1)
+            return -1;
+        unsigned index;
+        struct mft_entry *e = mft_get_by_name(mft, name, MFT_NET_BASIC,
+                &index);
+        if (e == NULL) {
+            warnx("Resource not declared in manifest: '%s'", name);
+            return -1;
+        }
+        if (rate_limit_parse(cmdarg + n, &net_rates[index].rx,
+                    &net_rates[index].tx) == -1)
+            return -1;
+    }
+    else if (which == opt_net_pcap) {
+        int n = -1;
+        rc = sscanf(cmdarg,
+                "--net-pcap:%" XSTR(MFT_NAME_MAX) "[A-Za-z0-9]=%n",
+                name, &n);
+        if (rc != 1 || n == -1)
+            return -1;
+        unsigned index;
+        struct mft_entry *e = mft_get_by_name(mft, name, MFT_NET_BASIC,
+                &index);
+        if (e == NULL) {
+            warnx("Resource not declared in manifest: '%s'", name);
+            return -1;
+        }
+        if (pcap_captured[index]) {
+            warnx("Network '%s' is already being captured", name);
+            return -1;
+        }
+        if (pcap_open(index, name, cmdarg + n) == -1)
+            return -1;
+        pcap_captured[index] = true;
+    }
 
     return 0;
 }
 
+/*
+ * Returns the largest MTU supported by the backend serving network (i).
+ */
+static unsigned mtu_max(unsigned i)
+{
+    if (xdp_socks[i] != NULL)
+        return XDP_ATTACH_MTU;
+    else if (netmap_ports[i] != NULL)
+        return NETMAP_ATTACH_MTU;
+    else if (shm_links[i] != NULL)
+        return SHM_ATTACH_MTU;
+    else if (switch_ports[i] != NULL)
+        return SWITCH_ATTACH_MTU;
+    else if (udp_links[i] != NULL)
+        return UDP_ATTACH_MTU_MAX;
+    else if (use_rings)
+        return sizeof ((struct hvt_net_ring_slot *)0)->data - SOLO5_NET_HLEN;
+    else
+        return MFT_NET_MTU_MAX;
+}
+
 static int setup(struct hvt *hvt, struct mft *mft)
 {
     if (!module_in_use)
         return 0;
 
     host_mft = mft;
-    assert(hvt_core_register_hypercall(HVT_HYPERCALL_NET_WRITE,
+    assert(hvt_core_register_hypercall(hvt, HVT_HYPERCALL_NET_WRITE,
                 hypercall_net_write) == 0);
-    assert(hvt_core_register_hypercall(HVT_HYPERCALL_NET_READ,
+    assert(hvt_core_register_hypercall(hvt, HVT_HYPERCALL_NET_READ,
                 hypercall_net_read) == 0);
+    assert(hvt_core_register_hypercall(hvt, HVT_HYPERCALL_NET_WRITEV,
+                hypercall_net_writev) == 0);
+    assert(hvt_core_register_hypercall(hvt, HVT_HYPERCALL_NET_READV,
+                hypercall_net_readv) == 0);
+    if (use_rings && use_vhost)
+        errx(1, "--net-rings and --net-vhost are mutually exclusive");
+    /*
+     * Rings are served by threads of their own, which cannot be reset.
+     */
+    if (hvt->reuse && (use_rings || use_vhost))
+        errx(1, "--net-rings and --net-vhost cannot be used with --reuse");
+    if (use_rings || use_vhost) {
+        for (unsigned i = 0; i != mft->entries; i++) {
+            if (mft->e[i].type != MFT_NET_BASIC || !mft->e[i].attached)
+                continue;
+            if (mft->e[i].u.net_basic.offloads != 0)
+                errx(1, "Offloads (--net-offload, or required by the "
+                        "manifest) cannot be used with --net-rings or "
+                        "--net-vhost");
+            if (xdp_socks[i] != NULL)
+                errx(1, "AF_XDP networks cannot be used with --net-rings or "
+                        "--net-vhost");
+            if (netmap_ports[i] != NULL)
+                errx(1, "netmap networks cannot be used with --net-rings or "
+                        "--net-vhost");
+            if (shm_links[i] != NULL)
+                errx(1, "Shared-memory networks cannot be used with "
+                        "--net-rings or --net-vhost");
+            if (switch_ports[i] != NULL)
+                errx(1, "Switch networks cannot be used with --net-rings or "
+                        "--net-vhost");
+            if (udp_links[i] != NULL)
+                errx(1, "UDP networks cannot be used with --net-rings or "
+                        "--net-vhost");
+        }
+    }
+#if defined(__linux__)
+    for (unsigned i = 0; i != mft->entries; i++) {
+        if (vhost_user[i] && hvt->mem_fd == -1)
+            errx(1, "vhost-user networks require --mem-shared");
+    }
+    if (use_vhost) {
+        assert(hvt_core_register_hypercall(hvt, HVT_HYPERCALL_NET_VRINGS,
+                    hypercall_net_vrings) == 0);
+        assert(hvt_core_register_hypercall(hvt, HVT_HYPERCALL_NET_KICK,
+                    hypercall_net_kick) == 0);
+        hvt->features |= HVT_FEATURE_NET_VHOST;
+    }
+#endif
+    if (use_rings) {
+        assert(hvt_core_register_hypercall(hvt, HVT_HYPERCALL_NET_RINGS,
+                    hypercall_net_rings) == 0);
+#if defined(__linux__)
+        doorbellfd[0] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (doorbellfd[0] == -1)
+            err(1, "eventfd() failed");
+        doorbellfd[1] = doorbellfd[0];
+#else
+        setup_pipe(doorbellfd);
+#endif
+        assert(hvt_core_register_doorbell(hvt, HVT_HYPERCALL_NET_NOTIFY,
+                    doorbellfd[1]) == 0);
+        hvt->features |= HVT_FEATURE_NET_RINGS;
+    }
 
     for (unsigned i = 0; i != mft->entries; i++) {
         if (mft->e[i].type != MFT_NET_BASIC || !mft->e[i].attached)
@@ -158,8 +1379,79 @@ static int setup(struct hvt *hvt, struct mft *mft)
         char no_mac[6] = { 0 };
         if (memcmp(mft->e[i].u.net_basic.mac, no_mac, sizeof no_mac) == 0)
             tap_attach_genmac(mft->e[i].u.net_basic.mac);
-        assert(hvt_core_register_pollfd(mft->e[i].hostfd, i) == 0);
+        if (mft->e[i].u.net_basic.mtu > mtu_max(i))
+            errx(1, "MTU of network '%s' must not exceed %u",
+                    mft->e[i].name, mtu_max(i));
+        if (mft_check_attrs(&mft->e[i]) == -1)
+            return -1;
+        if (net_filters[i].mac || net_filters[i].bpf) {
+            if (xdp_socks[i] != NULL || netmap_ports[i] != NULL ||
+                    shm_links[i] != NULL || switch_ports[i] != NULL ||
+                    udp_links[i] != NULL || vhost_user[i])
+                errx(1, "--net-filter can only be used with tap networks");
+            if (net_filters[i].mac &&
+                    tap_attach_filter_mac(mft->e[i].hostfd,
+                        mft->e[i].u.net_basic.mac) == -1)
+                err(1, "Could not set MAC filter for network '%s'",
+                        mft->e[i].name);
+            if (net_filters[i].bpf &&
+                    tap_attach_filter_bpf(mft->e[i].hostfd,
+                        net_filters[i].bpf) == -1)
+                err(1, "Could not attach BPF filter %s to network '%s'",
+                        net_filters[i].bpf, mft->e[i].name);
+        }
+        /*
+         * vhost moves packets between guest memory and the host without
+         * passing them through the tender.
+         */
+        if (pcap_captured[i] && (use_vhost || vhost_user[i]))
+            errx(1, "--net-pcap cannot be used with --net-vhost or "
+                    "vhost-user networks");
+        if (use_rings) {
+            /*
+             * With rings, the tap device is served by the I/O thread, and
+             * readiness is signalled to the guest through a separate pipe.
+             */
+            ring_devs[i].hostfd = mft->e[i].hostfd;
+            setup_pipe(ring_devs[i].readyfd);
+            assert(hvt_core_register_pollfd_edge(ring_devs[i].readyfd[0], i)
+                    == 0);
+        }
+#if defined(__linux__)
+        else if (use_vhost) {
+            /*
+             * /dev/vhost-net must be opened here, before privileges are
+             * dropped. vhost-user sockets were connected by handle_cmdarg().
+             */
+            vhost_devs[i].vhostfd = mft->e[i].hostfd;
+            if (vhost_setup_dev(&vhost_devs[i], vhost_user[i]) == -1)
+                errx(1, "Could not set up %s for network '%s'",
+                        vhost_user[i] ? "vhost-user" : "vhost-net",
+                        mft->e[i].name);
+            assert(hvt_core_register_pollfd_edge(vhost_devs[i].callfd, i)
+                    == 0);
+        }
+#endif
+        else
+            assert(hvt_core_register_pollfd(mft->e[i].hostfd, i) == 0);
+#if defined(__linux__)
+        if (rate_limit_enabled(&net_rates[i].rx) ||
+                rate_limit_enabled(&net_rates[i].tx)) {
+            if (use_rings || use_vhost)
+                errx(1, "--net-rate cannot be used with --net-rings or "
+                        "--net-vhost");
+            if (rate_limit_enabled(&net_rates[i].rx)) {
+                net_rates[i].timerfd = timerfd_create(CLOCK_MONOTONIC,
+                        TFD_NONBLOCK | TFD_CLOEXEC);
+                if (net_rates[i].timerfd == -1)
+                    err(1, "Could not create timerfd");
+                assert(hvt_core_register_pollfd_edge(net_rates[i].timerfd, i)
+                        == 0);
+            }
+        }
+#endif
     }
+    pcap_init();
 
     return 0;
 }
@@ -167,7 +1459,37 @@ static int setup(struct hvt *hvt, struct mft *mft)
 static char *usage(void)
 {
     return "--net:NAME=IFACE | @NN (attach tap at IFACE or at fd @NN as network NAME)\n"
-        "  [ --net-mac:NAME=HWADDR ] (set HWADDR for network NAME)";
+        "  | --net:NAME=xdp:IFACE[:QUEUE] (attach AF_XDP socket on IFACE queue QUEUE)\n"
+#if defined(__FreeBSD__)
+        "  | --net:NAME=netmap:IFACE | valeX:PORT (attach netmap port)\n"
+#endif
+#if defined(__linux__)
+        "  | --net:NAME=shm:PATH (link to the tender attached to the same PATH)\n"
+        "  | --net:NAME=switch:SWITCH[,uplink=IFACE] (attach port of switch\n"
+        "    SWITCH shared with other tenders, with tap or xdp: uplink IFACE)\n"
+        "  | --net:NAME=udp:LOCAL=REMOTE[,vni=VNI] (tunnel frames in UDP from\n"
+        "    ADDR:PORT LOCAL to REMOTE, in VXLAN with VNI if given)\n"
+        "  | --net:NAME=vhost-user:PATH (attach vhost-user socket at PATH;\n"
+        "    requires --mem-shared)\n"
+#endif
+        "  | --net-offload:NAME=IFACE | @NN (as above, enabling offloads)\n"
+        "  [ --net-mac:NAME=HWADDR ] (set HWADDR for network NAME)\n"
+        "  [ --net-mtu:NAME=MTU ] (set MTU for network NAME)\n"
+        "  [ --net-pcap:NAME=FILE[,snaplen=BYTES][,paused] ] (capture up to\n"
+        "    BYTES, default 128, of each packet of network NAME to pcapng FILE;\n"
+        "    SIGHUP pauses and resumes capture)\n"
+#if defined(__linux__)
+        "  [ --net-filter:NAME=mac | bpf:FILE ] (drop frames for other MACs,\n"
+        "    or rejected by the BPF program in FILE, on the host)\n"
+        "  [ --net-rate:NAME=rx|tx:BYTES[:PACKETS[:BURST_MS]] ] (limit network\n"
+        "    NAME to BYTES and PACKETS per second, 0 for no limit, with bursts\n"
+        "    of BURST_MS, default 10)\n"
+#endif
+        "  [ --net-rings ] (use shared-memory packet rings for all networks)"
+#if defined(__linux__)
+        "\n  [ --net-vhost ] (use vhost-net for all networks)"
+#endif
+        ;
 }
 
 DECLARE_MODULE(net,
@@ -0,0 +1,344 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * hvt_module_pci.c: PCI device passthrough module, using VFIO.
+ */
+
+#define _GNU_SOURCE
+#include <assert.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#if defined(__linux__)
+#include <libgen.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <linux/vfio.h>
+#endif
+
+#include "hvt.h"
+#include "solo5.h"
+
+static bool module_in_use;
+static struct mft *host_mft;
+
+#if defined(__linux__)
+
+#define PCI_COMMAND             0x04
+#define PCI_COMMAND_MEMORY      0x02
+#define PCI_COMMAND_MASTER      0x04
+
+/*
+ * All devices share one VFIO container, and so one IOMMU domain, into which
+ * guest memory is mapped by setup() at IOVAs equal to guest physical
+ * addresses. Each IOMMU group may only be opened once.
+ */
+static int container = -1;
+static struct {
+    int id;
+    int fd;
+} groups[MFT_MAX_ENTRIES];
+static unsigned ngroups;
+
+/*
+ * Offsets of each device's BARs in its VFIO device file descriptor, which is
+ * the device's (hostfd).
+ */
+static struct {
+    uint64_t bar_offset[MFT_PCI_BARS];
+    bool mapped[MFT_PCI_BARS];
+} pci_devs[MFT_MAX_ENTRIES];
+
+static void container_init(void)
+{
+    if (container != -1)
+        return;
+    container = open("/dev/vfio/vfio", O_RDWR | O_CLOEXEC);
+    if (container == -1)
+        err(1, "Could not open /dev/vfio/vfio");
+    if (ioctl(container, VFIO_GET_API_VERSION) != VFIO_API_VERSION ||
+            ioctl(container, VFIO_CHECK_EXTENSION, VFIO_TYPE1_IOMMU) != 1)
+        errx(1, "VFIO type 1 IOMMU not supported by host");
+}
+
+/*
+ * Returns a file descriptor for the VFIO group of device (bdf), adding the
+ * group to the container if it is not already.
+ */
+static int group_open(const char *bdf)
+{
+    char path[PATH_MAX], link[PATH_MAX];
+
+    snprintf(path, sizeof path, "/sys/bus/pci/devices/%s/iommu_group", bdf);
+    ssize_t n = readlink(path, link, sizeof link - 1);
+    if (n == -1)
+        err(1, "%s: Could not find IOMMU group", bdf);
+    link[n] = '\0';
+    int id = atoi(basename(link));
+
+    for (unsigned i = 0; i != ngroups; i++)
+        if (groups[i].id == id)
+            return groups[i].fd;
+
+    snprintf(path, sizeof path, "/dev/vfio/%d", id);
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd == -1)
+        err(1, "%s: Could not open %s", bdf, path);
+    struct vfio_group_status status = { .argsz = sizeof status };
+    if (ioctl(fd, VFIO_GROUP_GET_STATUS, &status) == -1)
+        err(1, "%s: VFIO_GROUP_GET_STATUS", bdf);
+    if (!(status.flags & VFIO_GROUP_FLAGS_VIABLE))
+        errx(1, "%s: All devices in IOMMU group %d must be bound to vfio-pci",
+                bdf, id);
+    if (ioctl(fd, VFIO_GROUP_SET_CONTAINER, &container) == -1)
+        err(1, "%s: VFIO_GROUP_SET_CONTAINER", bdf);
+    /*
+     * The IOMMU model can only be set once the container has a group.
+     */
+    if (ngroups == 0 &&
+            ioctl(container, VFIO_SET_IOMMU, VFIO_TYPE1_IOMMU) == -1)
+        err(1, "VFIO_SET_IOMMU");
+    groups[ngroups].id = id;
+    groups[ngroups].fd = fd;
+    ngroups++;
+    return fd;
+}
+
+static void region_info(int fd, unsigned index, struct vfio_region_info *r)
+{
+    memset(r, 0, sizeof *r);
+    r->argsz = sizeof *r;
+    r->index = index;
+    if (ioctl(fd, VFIO_DEVICE_GET_REGION_INFO, r) == -1)
+        err(1, "VFIO_DEVICE_GET_REGION_INFO");
+}
+
+/*
+ * Attach PCI device (bdf) to manifest entry (e) at (index). Memory BARs which
+ * can be mapped, i.e. of a power of two size and not containing registers
+ * that VFIO must trap, are offered to the guest. Memory decoding and bus
+ * mastering are enabled here, so that the guest needs no access to the
+ * configuration space.
+ */
+static void pci_attach(const char *bdf, struct mft_entry *e, unsigned index)
+{
+    container_init();
+    int fd = ioctl(group_open(bdf), VFIO_GROUP_GET_DEVICE_FD, bdf);
+    if (fd == -1)
+        err(1, "%s: VFIO_GROUP_GET_DEVICE_FD", bdf);
+    struct vfio_device_info info = { .argsz = sizeof info };
+    if (ioctl(fd, VFIO_DEVICE_GET_INFO, &info) == -1)
+        err(1, "%s: VFIO_DEVICE_GET_INFO", bdf);
+    if (!(info.flags & VFIO_DEVICE_FLAGS_PCI))
+        errx(1, "%s: Not a PCI device", bdf);
+
+    struct vfio_region_info r;
+    region_info(fd, VFIO_PCI_CONFIG_REGION_INDEX, &r);
+    uint16_t id[2], command;
+    if (pread(fd, id, sizeof id, r.offset) != sizeof id ||
+            pread(fd, &command, sizeof command, r.offset + PCI_COMMAND) !=
+            sizeof command)
+        err(1, "%s: Could not read configuration space", bdf);
+    command |= PCI_COMMAND_MEMORY | PCI_COMMAND_MASTER;
+    if (pwrite(fd, &command, sizeof command, r.offset + PCI_COMMAND) !=
+            sizeof command)
+        err(1, "%s: Could not write configuration space", bdf);
+    e->u.pci_basic.vendor_id = id[0];
+    e->u.pci_basic.device_id = id[1];
+
+    long page_size = sysconf(_SC_PAGESIZE);
+    for (unsigned i = 0; i != MFT_PCI_BARS; i++) {
+        region_info(fd, VFIO_PCI_BAR0_REGION_INDEX + i, &r);
+        e->u.pci_basic.bar_shift[i] = 0;
+        if (!(r.flags & VFIO_REGION_INFO_FLAG_MMAP) ||
+                r.size < (uint64_t)page_size || (r.size & (r.size - 1)))
+            continue;
+        void *p = mmap(NULL, r.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+                r.offset);
+        if (p == MAP_FAILED)
+            continue;
+        munmap(p, r.size);
+        e->u.pci_basic.bar_shift[i] = __builtin_ctzll(r.size);
+        pci_devs[index].bar_offset[i] = r.offset;
+    }
+
+    struct vfio_irq_info irq = {
+        .argsz = sizeof irq,
+        .index = VFIO_PCI_MSIX_IRQ_INDEX
+    };
+    if (ioctl(fd, VFIO_DEVICE_GET_IRQ_INFO, &irq) == -1)
+        err(1, "%s: VFIO_DEVICE_GET_IRQ_INFO", bdf);
+    e->u.pci_basic.irqs = (irq.flags & VFIO_IRQ_INFO_EVENTFD) ?
+        (irq.count > UINT16_MAX ? UINT16_MAX : irq.count) : 0;
+    e->hostfd = fd;
+}
+
+/*
+ * Route all MSI-X vectors of device (i) to a single eventfd, which makes the
+ * device's handle ready for the guest.
+ */
+static void setup_irqs(struct mft_entry *e, unsigned i)
+{
+    unsigned count = e->u.pci_basic.irqs;
+    int efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (efd == -1)
+        err(1, "eventfd");
+    size_t size = sizeof (struct vfio_irq_set) + count * sizeof (int);
+    struct vfio_irq_set *set = malloc(size);
+    if (set == NULL)
+        err(1, "malloc");
+    set->argsz = size;
+    set->flags = VFIO_IRQ_SET_DATA_EVENTFD | VFIO_IRQ_SET_ACTION_TRIGGER;
+    set->index = VFIO_PCI_MSIX_IRQ_INDEX;
+    set->start = 0;
+    set->count = count;
+    for (unsigned v = 0; v != count; v++)
+        memcpy(set->data + v * sizeof (int), &efd, sizeof (int));
+    if (ioctl(e->hostfd, VFIO_DEVICE_SET_IRQS, set) == -1)
+        err(1, "PCI device '%s': VFIO_DEVICE_SET_IRQS", e->name);
+    free(set);
+    /*
+     * Nothing reads from (efd), so it is watched edge-triggered.
+     */
+    assert(hvt_core_register_pollfd_edge(efd, i) == 0);
+}
+
+/*
+ * BARs are mapped over guest memory set aside for them by the guest, as with
+ * --block-map. Guest memory remains mapped for DMA beneath them.
+ */
+static void hypercall_pci_map(struct hvt *hvt, hvt_gpa_t gpa)
+{
+    struct hvt_hc_pci_map *mp =
+        HVT_CHECKED_GPA_P(hvt, gpa, sizeof (struct hvt_hc_pci_map));
+    struct mft_entry *e = mft_get_by_index(host_mft, mp->handle,
+            MFT_PCI_BASIC);
+    if (e == NULL || mp->bar >= MFT_PCI_BARS ||
+            e->u.pci_basic.bar_shift[mp->bar] == 0 ||
+            pci_devs[mp->handle].mapped[mp->bar] ||
+            (mp->data & (HVT_PCI_ALIGN - 1)) != 0) {
+        mp->ret = SOLO5_R_EINVAL;
+        return;
+    }
+
+    size_t size = (size_t)1 << e->u.pci_basic.bar_shift[mp->bar];
+    size_t len = (size + HVT_PCI_ALIGN - 1) & ~(size_t)(HVT_PCI_ALIGN - 1);
+    void *data = HVT_CHECKED_GPA_P(hvt, mp->data, len);
+    if (mmap(data, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+                e->hostfd, pci_devs[mp->handle].bar_offset[mp->bar]) ==
+            MAP_FAILED)
+        err(1, "Could not map PCI device BAR into guest memory");
+    pci_devs[mp->handle].mapped[mp->bar] = true;
+    mp->ret = SOLO5_R_OK;
+}
+
+#endif /* __linux__ */
+
+static int handle_cmdarg(char *cmdarg, struct mft *mft)
+{
+    char name[MFT_NAME_SIZE];
+    char bdf[13];
+
+    if (strncmp("--pci:", cmdarg, 6) != 0)
+        return -1;
+    int rc = sscanf(cmdarg,
+            "--pci:%" XSTR(MFT_NAME_MAX) "[A-Za-z0-9]=%12[0-9a-f:.]",
+            name, bdf);
+    if (rc != 2)
+        return -1;
+    unsigned index;
+    struct mft_entry *e = mft_get_by_name(mft, name, MFT_PCI_BASIC, &index);
+    if (e == NULL) {
+        warnx("Resource not declared in manifest: '%s'", name);
+        return -1;
+    }
+#if defined(__linux__)
+    pci_attach(bdf, e, index);
+    e->attached = true;
+    module_in_use = true;
+    return 0;
+#else
+    warnx("PCI passthrough is not supported on this host: '%s'", cmdarg);
+    return -1;
+#endif
+}
+
+static int setup(struct hvt *hvt, struct mft *mft)
+{
+    if (!module_in_use)
+        return 0;
+
+#if defined(__linux__)
+    for (unsigned i = 0; i != mft->entries; i++) {
+        if (mft->e[i].type != MFT_PCI_BASIC || !mft->e[i].attached)
+            continue;
+        if (mft_check_attrs(&mft->e[i]) == -1)
+            return -1;
+        if (mft->e[i].u.pci_basic.irqs != 0)
+            setup_irqs(&mft->e[i], i);
+    }
+
+    /*
+     * Pinning guest memory for DMA populates all of it, and is limited by
+     * RLIMIT_MEMLOCK. Pages released by the guest would stay pinned, so the
+     * guest may no longer release memory.
+     */
+    struct vfio_iommu_type1_dma_map dma = {
+        .argsz = sizeof dma,
+        .flags = VFIO_DMA_MAP_FLAG_READ | VFIO_DMA_MAP_FLAG_WRITE,
+        .vaddr = (uintptr_t)hvt->mem,
+        .iova = 0,
+        .size = hvt->mem_size
+    };
+    if (ioctl(container, VFIO_IOMMU_MAP_DMA, &dma) == -1)
+        err(1, "Could not map guest memory for DMA");
+    hvt->mem_pinned = true;
+
+    host_mft = mft;
+    assert(hvt_core_register_hypercall(hvt, HVT_HYPERCALL_PCI_MAP,
+                hypercall_pci_map) == 0);
+#else
+    (void)hvt;
+    (void)mft;
+#endif
+
+    return 0;
+}
+
+static char *usage(void)
+{
+    return "--pci:NAME=DDDD:BB:DD.F (pass through the PCI device at DDDD:BB:DD.F, bound\n"
+        "    to vfio-pci, as PCI device NAME; Linux only)";
+}
+
+DECLARE_MODULE(pci,
+    .setup = setup,
+    .handle_cmdarg = handle_cmdarg,
+    .usage = usage
+)
@@ -0,0 +1,325 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * hvt_module_profile.c: Sampling CPU profiler (--profile=FILE[,hz=N]).
+ *
+ * When enabled, a thread interrupts the boot VCPU N times a second with
+ * hvt_core_interrupt_poll(), and records the guest program counter and the return
+ * addresses found by following the chain of frame pointers on the guest
+ * stack. When the guest halts, the samples are written to FILE as folded
+ * stacks, one line per distinct stack, with the functions from the outermost
+ * inwards separated by semicolons, followed by the number of samples. This is
+ * the input format of flame graph tools. Functions are named from the symbol
+ * table of the unikernel; full stacks require the unikernel to have been
+ * built with frame pointers.
+ */
+
+#define _GNU_SOURCE
+#include <err.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "hvt.h"
+
+#define PROFILE_HZ_DEFAULT 99
+#define PROFILE_HZ_MAX 1000
+#define PROFILE_DEPTH_MAX 64
+/*
+ * Distinct stacks are counted in an open-addressed hash table, samples of
+ * stacks which do not fit being counted together.
+ */
+#define PROFILE_STACKS_MAX 4096
+
+struct stack {
+    uint64_t count;
+    unsigned depth;
+    uint64_t pc[PROFILE_DEPTH_MAX];     /* [0] is the innermost */
+};
+
+static const char *profile_file;
+static unsigned profile_hz = PROFILE_HZ_DEFAULT;
+static struct stack *stacks;
+static uint64_t dropped;
+static pthread_mutex_t profile_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t stack_hash(const struct stack *s)
+{
+    uint64_t h = 14695981039346656037ULL;
+
+    for (unsigned i = 0; i < s->depth; i++) {
+        h ^= s->pc[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static void stack_count(const struct stack *s)
+{
+    uint64_t h = stack_hash(s);
+
+    pthread_mutex_lock(&profile_lock);
+    for (unsigned i = 0; i < PROFILE_STACKS_MAX; i++) {
+        struct stack *e = &stacks[(h + i) % PROFILE_STACKS_MAX];
+        if (e->count == 0) {
+            *e = *s;
+            e->count = 1;
+            pthread_mutex_unlock(&profile_lock);
+            return;
+        }
+        if (e->depth == s->depth &&
+                memcmp(e->pc, s->pc, s->depth * sizeof s->pc[0]) == 0) {
+            e->count++;
+            pthread_mutex_unlock(&profile_lock);
+            return;
+        }
+    }
+    dropped++;
+    pthread_mutex_unlock(&profile_lock);
+}
+
+/*
+ * Called on the boot VCPU's thread. Both x86_64 and aarch64 guests keep the
+ * caller's frame pointer at (fp) and the return address at (fp + 8), with
+ * frames further up the stack at higher addresses. The walk stops at a frame
+ * pointer which is misaligned, outside guest memory or not further up the
+ * stack, or after PROFILE_DEPTH_MAX frames.
+ */
+static void profile_sample(struct hvt *hvt)
+{
+    struct stack s;
+    uint64_t pc, fp;
+
+    if (hvt_vcpu_get_frame(hvt, &pc, &fp) == -1)
+        return;
+    s.pc[0] = pc;
+    s.depth = 1;
+    while (s.depth < PROFILE_DEPTH_MAX) {
+        if (fp == 0 || (fp & 7) != 0 || fp > hvt->mem_size - 16)
+            break;
+        uint64_t *frame = (uint64_t *)(hvt->mem + fp);
+        if (frame[1] == 0)
+            break;
+        s.pc[s.depth++] = frame[1];
+        if (frame[0] <= fp)
+            break;
+        fp = frame[0];
+    }
+    stack_count(&s);
+}
+
+/*
+ * Samples are taken at fixed intervals, skipping any which have been missed
+ * as hvt_core_interrupt() may take some time to return.
+ */
+static void *profile_thread_fn(void *arg)
+{
+    struct hvt *hvt = arg;
+    long period = 1000000000L / profile_hz;
+    struct timespec next, now;
+
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    for (;;) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        do {
+            next.tv_nsec += period;
+            if (next.tv_nsec >= 1000000000L) {
+                next.tv_nsec -= 1000000000L;
+                next.tv_sec++;
+            }
+        } while (next.tv_sec < now.tv_sec ||
+                (next.tv_sec == now.tv_sec && next.tv_nsec <= now.tv_nsec));
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next,
+                    NULL) != 0)
+            ;
+        if (hvt_core_interrupt_poll(hvt, profile_sample) == -1) {
+            warnx("profile: Cannot interrupt the guest on this host");
+            return NULL;
+        }
+    }
+}
+
+struct symbol {
+    uint64_t addr;
+    uint64_t size;
+    char *name;
+};
+
+struct symbols {
+    struct symbol *sym;
+    size_t count;
+    size_t size;
+};
+
+static void symbol_add(uint64_t addr, uint64_t size, const char *name,
+        void *arg)
+{
+    struct symbols *syms = arg;
+
+    if (syms->count == syms->size) {
+        size_t size = syms->size ? syms->size * 2 : 256;
+        struct symbol *sym = realloc(syms->sym, size * sizeof *sym);
+        if (sym == NULL)
+            err(1, "realloc");
+        syms->sym = sym;
+        syms->size = size;
+    }
+    syms->sym[syms->count].addr = addr;
+    syms->sym[syms->count].size = size;
+    syms->sym[syms->count].name = strdup(name);
+    if (syms->sym[syms->count].name == NULL)
+        err(1, "strdup");
+    syms->count++;
+}
+
+static int symbol_cmp(const void *a, const void *b)
+{
+    const struct symbol *sa = a, *sb = b;
+
+    return (sa->addr > sb->addr) - (sa->addr < sb->addr);
+}
+
+static const char *symbol_find(const struct symbols *syms, uint64_t addr)
+{
+    size_t lo = 0, hi = syms->count;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (syms->sym[mid].addr <= addr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == 0 || addr - syms->sym[lo - 1].addr >= syms->sym[lo - 1].size)
+        return NULL;
+    return syms->sym[lo - 1].name;
+}
+
+static void profile_write(struct hvt *hvt, int status, void *cookie)
+{
+    (void)status;
+    (void)cookie;
+    struct symbols syms = { 0 };
+
+    if (hvt->file != NULL &&
+            elf_load_symbols(hvt->file, 0, symbol_add, &syms) > 0)
+        qsort(syms.sym, syms.count, sizeof *syms.sym, symbol_cmp);
+
+    FILE *out = fopen(profile_file, "w");
+    if (out == NULL) {
+        warn("profile: %s", profile_file);
+        return;
+    }
+    pthread_mutex_lock(&profile_lock);
+    for (unsigned i = 0; i < PROFILE_STACKS_MAX; i++) {
+        struct stack *e = &stacks[i];
+        if (e->count == 0)
+            continue;
+        for (unsigned d = e->depth; d-- > 0;) {
+            /*
+             * Return addresses point after the call, which may be past the
+             * end of the calling function.
+             */
+            uint64_t addr = (d == 0) ? e->pc[d] : e->pc[d] - 1;
+            const char *name = symbol_find(&syms, addr);
+            if (name != NULL)
+                fprintf(out, "%s", name);
+            else
+                fprintf(out, "0x%" PRIx64, e->pc[d]);
+            fputc(d == 0 ? ' ' : ';', out);
+        }
+        fprintf(out, "%" PRIu64 "\n", e->count);
+    }
+    if (dropped != 0)
+        fprintf(out, "[dropped] %" PRIu64 "\n", dropped);
+    pthread_mutex_unlock(&profile_lock);
+    if (fclose(out) != 0)
+        warn("profile: %s", profile_file);
+
+    for (size_t i = 0; i < syms.count; i++)
+        free(syms.sym[i].name);
+    free(syms.sym);
+}
+
+static int handle_cmdarg(char *cmdarg, struct mft *mft)
+{
+    if (strncmp("--profile=", cmdarg, 10) != 0)
+        return -1;
+
+    /*
+     * FILE is followed by an optional ",hz=N".
+     */
+    char *opt = strstr(cmdarg + 10, ",hz=");
+    if (opt != NULL) {
+        char *end;
+        unsigned long hz = strtoul(opt + 4, &end, 10);
+        if (*end != '\0' || hz == 0 || hz > PROFILE_HZ_MAX)
+            errx(1, "Malformed argument to --profile, hz must be 1 to %d",
+                    PROFILE_HZ_MAX);
+        profile_hz = hz;
+        *opt = '\0';
+    }
+    if (cmdarg[10] == '\0')
+        errx(1, "Malformed argument to --profile");
+    profile_file = cmdarg + 10;
+    return 0;
+}
+
+static char *usage(void)
+{
+    return "--profile=FILE[,hz=N] (sample the guest N times a second, "
+        "default 99, and write folded stacks to FILE on exit)";
+}
+
+static int setup(struct hvt *hvt, struct mft *mft)
+{
+    if (profile_file == NULL)
+        return 0;
+
+    stacks = calloc(PROFILE_STACKS_MAX, sizeof *stacks);
+    if (stacks == NULL)
+        err(1, "calloc");
+    if (hvt_core_register_halt_hook(hvt, profile_write) == -1)
+        return -1;
+
+    pthread_t thread;
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    if (pthread_create(&thread, NULL, profile_thread_fn, hvt) != 0)
+        errx(1, "Could not create profile thread");
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    pthread_detach(thread);
+
+    return 0;
+}
+
+DECLARE_MODULE(profile,
+    .setup = setup,
+    .handle_cmdarg = handle_cmdarg,
+    .usage = usage
+)
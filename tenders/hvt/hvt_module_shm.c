@@ -0,0 +1,185 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * hvt_module_shm.c: Shared-memory region module.
+ */
+
+#define _GNU_SOURCE
+#include <assert.h>
+#include <err.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "../common/shm_region.h"
+#include "hvt.h"
+#include "solo5.h"
+
+static bool module_in_use;
+static struct mft *host_mft;
+
+/*
+ * Regions are mapped over guest memory set aside for them by the guest, as
+ * with --block-map, which is only possible with KVM. (kickfd) is signalled
+ * when the guest notifies the service, and the service's (notifyfd) is
+ * watched for the guest.
+ */
+static struct {
+    int notifyfd, kickfd;
+    bool mapped;
+} regions[MFT_MAX_ENTRIES];
+
+static void hypercall_shm_map(struct hvt *hvt, hvt_gpa_t gpa)
+{
+    struct hvt_hc_shm_map *mp =
+        HVT_CHECKED_GPA_P(hvt, gpa, sizeof (struct hvt_hc_shm_map));
+    struct mft_entry *e = mft_get_by_index(host_mft, mp->handle,
+            MFT_SHM_BASIC);
+    if (e == NULL || regions[mp->handle].mapped ||
+            (mp->data & (HVT_SHM_ALIGN - 1)) != 0) {
+        mp->ret = SOLO5_R_EINVAL;
+        return;
+    }
+
+    size_t size = (size_t)e->u.shm_basic.pages * MFT_SHM_PAGE_SIZE;
+    size_t len = (size + HVT_SHM_ALIGN - 1) & ~(size_t)(HVT_SHM_ALIGN - 1);
+    void *data = HVT_CHECKED_GPA_P(hvt, mp->data, len);
+#if defined(__linux__)
+    /*
+     * Only the region itself is mapped; the rest of the aligned range is
+     * left as ordinary guest memory.
+     */
+    if (mmap(data, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+                e->hostfd, 0) == MAP_FAILED)
+        err(1, "Could not map shared memory into guest memory");
+    regions[mp->handle].mapped = true;
+    mp->ret = SOLO5_R_OK;
+#else
+    (void)data;
+    mp->ret = SOLO5_R_EUNSPEC;
+#endif
+}
+
+static void hypercall_shm_notify(struct hvt *hvt, hvt_gpa_t gpa)
+{
+    struct hvt_hc_shm_notify *np =
+        HVT_CHECKED_GPA_P(hvt, gpa, sizeof (struct hvt_hc_shm_notify));
+    struct mft_entry *e = mft_get_by_index(host_mft, np->handle,
+            MFT_SHM_BASIC);
+    if (e == NULL || !(e->u.shm_basic.flags & MFT_SHM_DOORBELL)) {
+        np->ret = SOLO5_R_EINVAL;
+        return;
+    }
+
+    uint64_t n = 1;
+    ssize_t nbytes;
+    do {
+        nbytes = write(regions[np->handle].kickfd, &n, sizeof n);
+    } while (nbytes == -1 && errno == EINTR);
+    np->ret = (nbytes == sizeof n) ? SOLO5_R_OK : SOLO5_R_EUNSPEC;
+}
+
+static int handle_cmdarg(char *cmdarg, struct mft *mft)
+{
+    char name[MFT_NAME_SIZE];
+    char path[PATH_MAX + 1];
+
+    if (strncmp("--shm:", cmdarg, 6) != 0)
+        return -1;
+    int rc = sscanf(cmdarg,
+            "--shm:%" XSTR(MFT_NAME_MAX) "[A-Za-z0-9]="
+            "%" XSTR(PATH_MAX) "s", name, path);
+    if (rc != 2)
+        return -1;
+    unsigned index;
+    struct mft_entry *e = mft_get_by_name(mft, name, MFT_SHM_BASIC, &index);
+    if (e == NULL) {
+        warnx("Resource not declared in manifest: '%s'", name);
+        return -1;
+    }
+
+    struct shm_region r;
+    if (shm_region_attach(path, &r) == -1) {
+        if (errno == ENOTSUP)
+            warnx("Shared memory is not supported on this host: '%s'",
+                    cmdarg);
+        else
+            warn("Could not attach shared memory: '%s'", path);
+        return -1;
+    }
+    if (r.size / MFT_SHM_PAGE_SIZE > UINT32_MAX) {
+        warnx("Shared memory too large: '%s'", path);
+        return -1;
+    }
+    e->u.shm_basic.pages = r.size / MFT_SHM_PAGE_SIZE;
+    e->u.shm_basic.flags = (r.notifyfd != -1) ? MFT_SHM_DOORBELL : 0;
+    e->hostfd = r.memfd;
+    e->attached = true;
+    regions[index].notifyfd = r.notifyfd;
+    regions[index].kickfd = r.kickfd;
+    module_in_use = true;
+
+    return 0;
+}
+
+static int setup(struct hvt *hvt, struct mft *mft)
+{
+    if (!module_in_use)
+        return 0;
+
+    for (unsigned i = 0; i != mft->entries; i++) {
+        if (mft->e[i].type == MFT_SHM_BASIC && mft->e[i].attached &&
+                mft_check_attrs(&mft->e[i]) == -1)
+            return -1;
+        /*
+         * Nothing reads from (notifyfd) after the service signals it, so it
+         * is watched edge-triggered.
+         */
+        if (mft->e[i].type == MFT_SHM_BASIC && mft->e[i].attached &&
+                regions[i].notifyfd != -1)
+            assert(hvt_core_register_pollfd_edge(regions[i].notifyfd, i)
+                    == 0);
+    }
+
+    host_mft = mft;
+    assert(hvt_core_register_hypercall(hvt, HVT_HYPERCALL_SHM_MAP,
+                hypercall_shm_map) == 0);
+    assert(hvt_core_register_hypercall_mt(hvt, HVT_HYPERCALL_SHM_NOTIFY,
+                hypercall_shm_notify) == 0);
+
+    return 0;
+}
+
+static char *usage(void)
+{
+    return "--shm:NAME=PATH (attach the file or service listening on the UNIX socket at\n"
+        "    PATH as shared memory NAME; Linux only)";
+}
+
+DECLARE_MODULE(shm,
+    .setup = setup,
+    .handle_cmdarg = handle_cmdarg,
+    .usage = usage
+)
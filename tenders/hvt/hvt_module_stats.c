@@ -0,0 +1,358 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * hvt_module_stats.c: Hypercall and VCPU exit statistics (--stats).
+ *
+ * When enabled, counts hypercalls by number, with their cumulative latency, a
+ * histogram of latencies in power-of-two buckets of nanoseconds and the bytes
+ * moved by network and block hypercalls, as well as VCPU exits which are not
+ * hypercalls, by backend-specific reason. A summary is printed to stderr when
+ * the guest halts. The same counters are served with --metrics. When neither
+ * is enabled, the only cost is a test in hvt_core_hypercall().
+ */
+
+#include <err.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "hvt.h"
+#include "solo5.h"
+
+static bool use_stats;
+
+#define STATS_BUCKETS 64
+
+struct hypercall_stats {
+    uint64_t calls;
+    uint64_t nsecs;
+    uint64_t bytes;
+    uint64_t buckets[STATS_BUCKETS];    /* [i] counts latencies < 2^i ns */
+};
+
+static struct hypercall_stats stats[HVT_HYPERCALL_MAX];
+
+/*
+ * Exits are counted by reason in a small table, with reasons which do not
+ * fit counted together.
+ */
+#define STATS_EXITS_MAX 16
+
+static struct {
+    unsigned reason;
+    uint64_t count;
+} exits[STATS_EXITS_MAX];
+static unsigned nexits;
+static uint64_t other_exits;
+static pthread_mutex_t exits_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * HVT_HYPERCALL_POLL calls returning with devices ready, and without.
+ */
+static uint64_t poll_events, poll_timeouts;
+
+static uint64_t start_nsecs;
+
+/*
+ * Returns the number of bytes moved by the completed hypercall (nr) with
+ * arguments at (gpa). The arguments have already been validated by the
+ * handler, so only successful calls are looked at.
+ */
+static uint64_t hypercall_bytes(struct hvt *hvt, int nr, hvt_gpa_t gpa)
+{
+    uint64_t bytes = 0;
+
+    switch (nr) {
+    case HVT_HYPERCALL_NET_WRITE: {
+        struct hvt_hc_net_write *wr =
+            HVT_CHECKED_GPA_P(hvt, gpa, sizeof (struct hvt_hc_net_write));
+        if (wr->ret == SOLO5_R_OK)
+            bytes = wr->len;
+        break;
+    }
+    case HVT_HYPERCALL_NET_READ: {
+        struct hvt_hc_net_read *rd =
+            HVT_CHECKED_GPA_P(hvt, gpa, sizeof (struct hvt_hc_net_read));
+        if (rd->ret == SOLO5_R_OK)
+            bytes = rd->len;
+        break;
+    }
+    case HVT_HYPERCALL_NET_WRITEV:
+    case HVT_HYPERCALL_NET_READV: {
+        /*
+         * struct hvt_hc_net_writev and struct hvt_hc_net_readv share a
+         * layout.
+         */
+        struct hvt_hc_net_readv *rd =
+            HVT_CHECKED_GPA_P(hvt, gpa, sizeof (struct hvt_hc_net_readv));
+        if (rd->iovcnt > HVT_NET_IOV_MAX)
+            break;
+        struct hvt_net_iov *iov = HVT_CHECKED_GPA_P(hvt, rd->iov,
+                rd->iovcnt * sizeof (struct hvt_net_iov));
+        for (size_t i = 0; i < rd->iovcnt; i++)
+            if (iov[i].ret == SOLO5_R_OK)
+                bytes += iov[i].len;
+        break;
+    }
+    case HVT_HYPERCALL_BLOCK_WRITE: {
+        struct hvt_hc_block_write *wr =
+            HVT_CHECKED_GPA_P(hvt, gpa, sizeof (struct hvt_hc_block_write));
+        if (wr->ret == SOLO5_R_OK)
+            bytes = wr->len;
+        break;
+    }
+    case HVT_HYPERCALL_BLOCK_READ: {
+        struct hvt_hc_block_read *rd =
+            HVT_CHECKED_GPA_P(hvt, gpa, sizeof (struct hvt_hc_block_read));
+        if (rd->ret == SOLO5_R_OK)
+            bytes = rd->len;
+        break;
+    }
+    case HVT_HYPERCALL_BLOCK_WRITEV:
+    case HVT_HYPERCALL_BLOCK_READV: {
+        /*
+         * struct hvt_hc_block_writev and struct hvt_hc_block_readv share a
+         * layout.
+         */
+        struct hvt_hc_block_readv *rd =
+            HVT_CHECKED_GPA_P(hvt, gpa, sizeof (struct hvt_hc_block_readv));
+        if (rd->ret != SOLO5_R_OK || rd->iovcnt > HVT_BLOCK_IOV_MAX)
+            break;
+        struct hvt_block_iov *iov = HVT_CHECKED_GPA_P(hvt, rd->iov,
+                rd->iovcnt * sizeof (struct hvt_block_iov));
+        for (size_t i = 0; i < rd->iovcnt; i++)
+            bytes += iov[i].len;
+        break;
+    }
+    case HVT_HYPERCALL_BLOCK_SUBMIT: {
+        /*
+         * Counts the bytes to be moved by the requests queued.
+         */
+        struct hvt_hc_block_submit *sb =
+            HVT_CHECKED_GPA_P(hvt, gpa, sizeof (struct hvt_hc_block_submit));
+        if (sb->count > SOLO5_BLOCK_QUEUE_MAX)
+            break;
+        struct hvt_block_req *reqs = HVT_CHECKED_GPA_P(hvt, sb->reqs,
+                sb->count * sizeof (struct hvt_block_req));
+        for (size_t i = 0; i < sb->count; i++)
+            if (reqs[i].op != HVT_BLOCK_OP_FLUSH)
+                bytes += reqs[i].len;
+        break;
+    }
+    default:
+        break;
+    }
+    return bytes;
+}
+
+static void stats_hypercall(struct hvt *hvt, int nr, hvt_gpa_t gpa,
+        uint64_t nsecs)
+{
+    struct hypercall_stats *st = &stats[nr];
+    unsigned bucket = (nsecs == 0) ? 0 : 64 - __builtin_clzll(nsecs);
+
+    if (bucket >= STATS_BUCKETS)
+        bucket = STATS_BUCKETS - 1;
+    __atomic_fetch_add(&st->calls, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&st->nsecs, nsecs, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&st->buckets[bucket], 1, __ATOMIC_RELAXED);
+    uint64_t bytes = hypercall_bytes(hvt, nr, gpa);
+    if (bytes != 0)
+        __atomic_fetch_add(&st->bytes, bytes, __ATOMIC_RELAXED);
+    if (nr == HVT_HYPERCALL_POLL) {
+        struct hvt_hc_poll *p =
+            HVT_CHECKED_GPA_P(hvt, gpa, sizeof (struct hvt_hc_poll));
+        __atomic_fetch_add(p->ready_set ? &poll_events : &poll_timeouts, 1,
+                __ATOMIC_RELAXED);
+    }
+}
+
+static void stats_exit(struct hvt *hvt, unsigned reason)
+{
+    (void)hvt;
+
+    pthread_mutex_lock(&exits_lock);
+    unsigned i;
+    for (i = 0; i != nexits; i++)
+        if (exits[i].reason == reason)
+            break;
+    if (i == nexits && nexits != STATS_EXITS_MAX) {
+        exits[i].reason = reason;
+        nexits++;
+    }
+    if (i == STATS_EXITS_MAX)
+        other_exits++;
+    else
+        exits[i].count++;
+    pthread_mutex_unlock(&exits_lock);
+}
+
+static void stats_dump(struct hvt *hvt, int status, void *cookie)
+{
+    (void)hvt;
+    (void)status;
+    (void)cookie;
+
+    fprintf(stderr, "solo5-hvt: hypercall statistics:\n");
+    fprintf(stderr, "%-20s %12s %14s %10s %16s\n", "HYPERCALL", "CALLS",
+            "TOTAL(us)", "AVG(ns)", "BYTES");
+    for (int nr = 0; nr != HVT_HYPERCALL_MAX; nr++) {
+        struct hypercall_stats *st = &stats[nr];
+        if (st->calls == 0)
+            continue;
+        fprintf(stderr, "%-20s %12" PRIu64 " %14" PRIu64 " %10" PRIu64
+                " %16" PRIu64 "\n",
+                hvt_core_hypercall_name(nr) ? hvt_core_hypercall_name(nr) : "?",
+                st->calls,
+                st->nsecs / 1000, st->nsecs / st->calls, st->bytes);
+    }
+
+    fprintf(stderr, "solo5-hvt: hypercall latency histograms (ns: calls):\n");
+    for (int nr = 0; nr != HVT_HYPERCALL_MAX; nr++) {
+        struct hypercall_stats *st = &stats[nr];
+        if (st->calls == 0)
+            continue;
+        fprintf(stderr, "%-20s", hvt_core_hypercall_name(nr) ?
+                hvt_core_hypercall_name(nr) : "?");
+        for (unsigned i = 0; i != STATS_BUCKETS; i++) {
+            if (st->buckets[i] != 0)
+                fprintf(stderr, " <2^%u: %" PRIu64, i, st->buckets[i]);
+        }
+        fprintf(stderr, "\n");
+    }
+
+    fprintf(stderr, "solo5-hvt: other VCPU exits (reason: count):");
+    for (unsigned i = 0; i != nexits; i++)
+        fprintf(stderr, " 0x%x: %" PRIu64, exits[i].reason, exits[i].count);
+    if (other_exits != 0)
+        fprintf(stderr, " other: %" PRIu64, other_exits);
+    fprintf(stderr, "\n");
+}
+
+static void stats_metrics(struct metrics_buf *b, void *arg)
+{
+    struct hvt *hvt = arg;
+    uint64_t hypercall_nsecs = 0;
+
+    metrics_header(b, "solo5_hvt_hypercalls_total", "counter",
+            "Hypercalls handled.");
+    for (int nr = 0; nr != HVT_HYPERCALL_MAX; nr++) {
+        if (hvt_core_hypercall_name(nr) == NULL)
+            continue;
+        metrics_printf(b, "solo5_hvt_hypercalls_total{hypercall=\"%s\"} %"
+                PRIu64 "\n", hvt_core_hypercall_name(nr),
+                __atomic_load_n(&stats[nr].calls, __ATOMIC_RELAXED));
+    }
+    metrics_header(b, "solo5_hvt_hypercall_seconds_total", "counter",
+            "Time spent handling hypercalls.");
+    for (int nr = 0; nr != HVT_HYPERCALL_MAX; nr++) {
+        uint64_t nsecs = __atomic_load_n(&stats[nr].nsecs, __ATOMIC_RELAXED);
+        if (nr != HVT_HYPERCALL_POLL)
+            hypercall_nsecs += nsecs;
+        if (hvt_core_hypercall_name(nr) == NULL)
+            continue;
+        metrics_printf(b, "solo5_hvt_hypercall_seconds_total{hypercall=\"%s\"}"
+                " %.9f\n", hvt_core_hypercall_name(nr), nsecs / 1e9);
+    }
+    metrics_header(b, "solo5_hvt_hypercall_bytes_total", "counter",
+            "Bytes moved by network and block hypercalls.");
+    for (int nr = 0; nr != HVT_HYPERCALL_MAX; nr++) {
+        uint64_t bytes = __atomic_load_n(&stats[nr].bytes, __ATOMIC_RELAXED);
+        if (hvt_core_hypercall_name(nr) == NULL || bytes == 0)
+            continue;
+        metrics_printf(b, "solo5_hvt_hypercall_bytes_total{hypercall=\"%s\"}"
+                " %" PRIu64 "\n", hvt_core_hypercall_name(nr), bytes);
+    }
+
+    metrics_header(b, "solo5_hvt_exits_total", "counter",
+            "VCPU exits other than hypercalls, by backend-specific reason.");
+    pthread_mutex_lock(&exits_lock);
+    for (unsigned i = 0; i != nexits; i++)
+        metrics_printf(b, "solo5_hvt_exits_total{reason=\"0x%x\"} %" PRIu64
+                "\n", exits[i].reason, exits[i].count);
+    if (other_exits != 0)
+        metrics_printf(b, "solo5_hvt_exits_total{reason=\"other\"} %" PRIu64
+                "\n", other_exits);
+    pthread_mutex_unlock(&exits_lock);
+
+    metrics_header(b, "solo5_hvt_polls_total", "counter",
+            "Calls to solo5_yield() which blocked, by outcome.");
+    metrics_printf(b, "solo5_hvt_polls_total{result=\"event\"} %" PRIu64
+            "\n", __atomic_load_n(&poll_events, __ATOMIC_RELAXED));
+    metrics_printf(b, "solo5_hvt_polls_total{result=\"timeout\"} %" PRIu64
+            "\n", __atomic_load_n(&poll_timeouts, __ATOMIC_RELAXED));
+
+    /*
+     * Time not accounted to hypercalls is taken to have been spent running
+     * the guest, including any time a VCPU was descheduled by the host.
+     */
+    uint64_t poll_nsecs = __atomic_load_n(&stats[HVT_HYPERCALL_POLL].nsecs,
+            __ATOMIC_RELAXED);
+    uint64_t total = (boot_trace_now() - start_nsecs) * hvt->cpus;
+    uint64_t busy = poll_nsecs + hypercall_nsecs;
+    metrics_header(b, "solo5_hvt_vcpu_seconds_total", "counter",
+            "VCPU time since the VCPUs started, by state.");
+    metrics_printf(b, "solo5_hvt_vcpu_seconds_total{state=\"guest\"} %.9f\n",
+            (total > busy ? total - busy : 0) / 1e9);
+    metrics_printf(b, "solo5_hvt_vcpu_seconds_total{state=\"hypercall\"} "
+            "%.9f\n", hypercall_nsecs / 1e9);
+    metrics_printf(b, "solo5_hvt_vcpu_seconds_total{state=\"blocked\"} "
+            "%.9f\n", poll_nsecs / 1e9);
+}
+
+static int handle_cmdarg(char *cmdarg, struct mft *mft)
+{
+    if (strcmp("--stats", cmdarg) != 0)
+        return -1;
+    use_stats = true;
+    return 0;
+}
+
+static char *usage(void)
+{
+    return "--stats (print hypercall and VCPU exit statistics on exit)";
+}
+
+static int setup(struct hvt *hvt, struct mft *mft)
+{
+    if (!use_stats && !metrics_enabled())
+        return 0;
+
+    if (hvt_core_register_hypercall_hook(hvt, stats_hypercall) == -1 ||
+            hvt_core_register_exit_hook(hvt, stats_exit) == -1)
+        return -1;
+    if (use_stats && hvt_core_register_halt_hook(hvt, stats_dump) == -1)
+        return -1;
+    if (metrics_enabled() && metrics_register(stats_metrics, hvt) == -1)
+        return -1;
+    start_nsecs = boot_trace_now();
+
+    return 0;
+}
+
+DECLARE_MODULE(stats,
+    .setup = setup,
+    .handle_cmdarg = handle_cmdarg,
+    .usage = usage
+)
@@ -0,0 +1,410 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * hvt_module_trace.c: Event trace ring (--trace=FILE[,format=chrome]).
+ *
+ * When enabled, the guest records events with solo5_trace() in a ring in its
+ * own memory, which it registers with HVT_HYPERCALL_TRACE_RING. The events in
+ * the ring are written to FILE, oldest first, when the guest halts and
+ * whenever the tender receives SIGPROF, replacing its previous contents. As
+ * the ring is part of guest memory, it is also included in any core file
+ * written by the dumpcore module.
+ *
+ * Each line of FILE holds one event: its sequence number, timestamp in
+ * nanoseconds of guest monotonic time, identifier and two arguments.
+ *
+ * With format=chrome, the tender also records each hypercall it handles, and
+ * FILE is instead written in the Chrome trace event (JSON) format, which
+ * Perfetto and chrome://tracing load, with the guest events and the
+ * hypercalls as two processes on a single timeline. The guest passes its
+ * monotonic time when registering its ring, and its events are placed on the
+ * host's clock by the difference between the two at that point, which is off
+ * by at most the cost of a VCPU exit.
+ */
+
+#define _GNU_SOURCE
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "hvt.h"
+#include "solo5.h"
+
+static const char *trace_file;
+static bool trace_chrome;
+static struct hvt_trace_ring *trace_ring;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static int trigger_pipe[2];
+
+/*
+ * Host time at which tracing started, which is time 0 in the Chrome format,
+ * and the difference between host and guest monotonic time.
+ */
+static uint64_t epoch_nsecs;
+static int64_t guest_offset;
+
+/*
+ * Hypercalls handled by the tender are recorded in a ring of their own, in
+ * the same way as the guest records its events.
+ */
+#define TENDER_TRACE_ENTRIES 16384
+
+struct tender_event {
+    uint64_t seq;
+    uint64_t start;                     /* Host monotonic time, ns */
+    uint64_t nsecs;                     /* Time taken */
+    uint64_t gpa;
+    uint32_t nr;
+    uint32_t thread;
+};
+
+static struct tender_event *tender_ring;
+static uint64_t tender_head;
+static uint32_t nthreads;
+static __thread uint32_t thread_id;
+
+static uint64_t now_nsecs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void hypercall_trace_ring(struct hvt *hvt, hvt_gpa_t gpa)
+{
+    struct hvt_hc_trace_ring *tr =
+        HVT_CHECKED_GPA_P(hvt, gpa, sizeof (struct hvt_hc_trace_ring));
+
+    if (trace_ring != NULL || (tr->ring & 63) != 0) {
+        tr->ret = SOLO5_R_EINVAL;
+        return;
+    }
+    pthread_mutex_lock(&trace_lock);
+    trace_ring = HVT_CHECKED_GPA_P(hvt, tr->ring,
+            sizeof (struct hvt_trace_ring));
+    guest_offset = (int64_t)(now_nsecs() - tr->nsecs);
+    pthread_mutex_unlock(&trace_lock);
+    tr->ret = SOLO5_R_OK;
+}
+
+static void trace_hypercall(struct hvt *hvt, int nr, hvt_gpa_t gpa,
+        uint64_t nsecs)
+{
+    (void)hvt;
+
+    uint64_t end = now_nsecs();
+    if (thread_id == 0)
+        thread_id = __atomic_add_fetch(&nthreads, 1, __ATOMIC_RELAXED);
+
+    uint64_t n = __atomic_fetch_add(&tender_head, 1, __ATOMIC_RELAXED);
+    struct tender_event *ev = &tender_ring[n % TENDER_TRACE_ENTRIES];
+
+    __atomic_store_n(&ev->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&ev->start, end - nsecs, __ATOMIC_RELAXED);
+    __atomic_store_n(&ev->nsecs, nsecs, __ATOMIC_RELAXED);
+    __atomic_store_n(&ev->gpa, gpa, __ATOMIC_RELAXED);
+    __atomic_store_n(&ev->nr, (uint32_t)nr, __ATOMIC_RELAXED);
+    __atomic_store_n(&ev->thread, thread_id, __ATOMIC_RELAXED);
+    __atomic_store_n(&ev->seq, n + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Copy guest event (n) to (e). Returns false if it is being written or has
+ * been overwritten, in which case it is skipped.
+ */
+static bool guest_event(uint64_t n, struct hvt_trace_event *e)
+{
+    struct hvt_trace_event *ev = &trace_ring->ev[n % HVT_TRACE_ENTRIES];
+
+    e->seq = __atomic_load_n(&ev->seq, __ATOMIC_ACQUIRE);
+    e->nsecs = __atomic_load_n(&ev->nsecs, __ATOMIC_RELAXED);
+    e->id = __atomic_load_n(&ev->id, __ATOMIC_RELAXED);
+    e->arg[0] = __atomic_load_n(&ev->arg[0], __ATOMIC_RELAXED);
+    e->arg[1] = __atomic_load_n(&ev->arg[1], __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return e->seq == n + 1 &&
+        __atomic_load_n(&ev->seq, __ATOMIC_RELAXED) == e->seq;
+}
+
+static bool tender_event(uint64_t n, struct tender_event *e)
+{
+    struct tender_event *ev = &tender_ring[n % TENDER_TRACE_ENTRIES];
+
+    e->seq = __atomic_load_n(&ev->seq, __ATOMIC_ACQUIRE);
+    e->start = __atomic_load_n(&ev->start, __ATOMIC_RELAXED);
+    e->nsecs = __atomic_load_n(&ev->nsecs, __ATOMIC_RELAXED);
+    e->gpa = __atomic_load_n(&ev->gpa, __ATOMIC_RELAXED);
+    e->nr = __atomic_load_n(&ev->nr, __ATOMIC_RELAXED);
+    e->thread = __atomic_load_n(&ev->thread, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return e->seq == n + 1 &&
+        __atomic_load_n(&ev->seq, __ATOMIC_RELAXED) == e->seq;
+}
+
+static void text_dump(FILE *f)
+{
+    uint64_t head = __atomic_load_n(&trace_ring->head, __ATOMIC_ACQUIRE);
+    uint64_t n = head > HVT_TRACE_ENTRIES ? head - HVT_TRACE_ENTRIES : 0;
+    for (; n != head; n++) {
+        struct hvt_trace_event e;
+
+        if (!guest_event(n, &e))
+            continue;
+        fprintf(f, "%" PRIu64 " %" PRIu64 " 0x%" PRIx64 " 0x%" PRIx64
+                " 0x%" PRIx64 "\n", e.seq, e.nsecs, e.id, e.arg[0], e.arg[1]);
+    }
+}
+
+/*
+ * Chrome trace timestamps are in microseconds, relative to (epoch_nsecs).
+ */
+static double chrome_ts(uint64_t host_nsecs)
+{
+    return (double)(int64_t)(host_nsecs - epoch_nsecs) / 1e3;
+}
+
+#define GUEST_PID 1
+#define TENDER_PID 2
+
+static void chrome_dump(FILE *f)
+{
+    fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n"
+            "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+            "\"args\":{\"name\":\"guest\"}},\n"
+            "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+            "\"args\":{\"name\":\"solo5-hvt\"}}", GUEST_PID, TENDER_PID);
+
+    /*
+     * Guest events are not attributed to a VCPU, so all are shown on one
+     * track. The entry to and exit from solo5_yield() are shown as a span.
+     */
+    if (trace_ring != NULL) {
+        uint64_t head = __atomic_load_n(&trace_ring->head, __ATOMIC_ACQUIRE);
+        uint64_t n = head > HVT_TRACE_ENTRIES ? head - HVT_TRACE_ENTRIES : 0;
+        for (; n != head; n++) {
+            struct hvt_trace_event e;
+
+            if (!guest_event(n, &e))
+                continue;
+            double ts = chrome_ts(e.nsecs + guest_offset);
+            if (e.id == SOLO5_TRACE_ID_YIELD_ENTER)
+                fprintf(f, ",\n{\"name\":\"solo5_yield\",\"ph\":\"B\","
+                        "\"pid\":%d,\"tid\":1,\"ts\":%.3f,"
+                        "\"args\":{\"deadline\":%" PRIu64 "}}",
+                        GUEST_PID, ts, e.arg[0]);
+            else if (e.id == SOLO5_TRACE_ID_YIELD_EXIT)
+                fprintf(f, ",\n{\"ph\":\"E\",\"pid\":%d,\"tid\":1,"
+                        "\"ts\":%.3f,\"args\":{\"result\":%" PRIu64 ","
+                        "\"ready_set\":\"0x%" PRIx64 "\"}}",
+                        GUEST_PID, ts, e.arg[0], e.arg[1]);
+            else
+                fprintf(f, ",\n{\"name\":\"0x%" PRIx64 "\",\"ph\":\"i\","
+                        "\"s\":\"t\",\"pid\":%d,\"tid\":1,\"ts\":%.3f,"
+                        "\"args\":{\"arg0\":\"0x%" PRIx64 "\","
+                        "\"arg1\":\"0x%" PRIx64 "\"}}",
+                        e.id, GUEST_PID, ts, e.arg[0], e.arg[1]);
+        }
+    }
+
+    /*
+     * Hypercalls are shown as spans on a track per tender thread.
+     */
+    uint64_t head = __atomic_load_n(&tender_head, __ATOMIC_ACQUIRE);
+    uint64_t n = head > TENDER_TRACE_ENTRIES ? head - TENDER_TRACE_ENTRIES : 0;
+    for (; n != head; n++) {
+        struct tender_event e;
+
+        if (!tender_event(n, &e))
+            continue;
+        const char *name = hvt_core_hypercall_name(e.nr);
+        fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,"
+                "\"tid\":%" PRIu32 ",\"ts\":%.3f,\"dur\":%.3f,"
+                "\"args\":{\"nr\":%" PRIu32 ",\"gpa\":\"0x%" PRIx64 "\"}}",
+                name ? name : "?", TENDER_PID, e.thread, chrome_ts(e.start),
+                e.nsecs / 1e3, e.nr, e.gpa);
+    }
+    fprintf(f, "\n]}\n");
+}
+
+/*
+ * Write the events in the ring to (trace_file). The guest may be recording
+ * events meanwhile; those being written, or overwritten while we copy them,
+ * are skipped.
+ */
+static void trace_dump(void)
+{
+    pthread_mutex_lock(&trace_lock);
+    if (trace_ring == NULL && !trace_chrome) {
+        pthread_mutex_unlock(&trace_lock);
+        return;
+    }
+
+    FILE *f = fopen(trace_file, "we");
+    if (f == NULL) {
+        warn("trace: Could not open %s", trace_file);
+        pthread_mutex_unlock(&trace_lock);
+        return;
+    }
+    if (trace_chrome)
+        chrome_dump(f);
+    else
+        text_dump(f);
+    if (fclose(f) != 0)
+        warn("trace: Could not write %s", trace_file);
+    pthread_mutex_unlock(&trace_lock);
+}
+
+static void trace_halt(struct hvt *hvt, int status, void *cookie)
+{
+    (void)hvt;
+    (void)status;
+    (void)cookie;
+
+    trace_dump();
+}
+
+/*
+ * The guest registers its ring again when run again (--reuse).
+ */
+static void trace_reset(struct hvt *hvt)
+{
+    (void)hvt;
+
+    pthread_mutex_lock(&trace_lock);
+    trace_ring = NULL;
+    __atomic_store_n(&tender_head, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&trace_lock);
+}
+
+static void *trace_thread(void *arg)
+{
+    uint8_t c;
+
+    (void)arg;
+    for (;;) {
+        ssize_t nbytes = read(trigger_pipe[0], &c, 1);
+        if (nbytes == -1 && errno == EINTR)
+            continue;
+        if (nbytes != 1)
+            err(1, "trace: read() failed");
+        trace_dump();
+    }
+    return NULL;
+}
+
+static void trigger_handler(int signo)
+{
+    uint8_t c = 0;
+    int saved_errno = errno;
+
+    (void)signo;
+    (void)write(trigger_pipe[1], &c, 1);
+    errno = saved_errno;
+}
+
+static int handle_cmdarg(char *cmdarg, struct mft *mft)
+{
+    if (strncmp("--trace=", cmdarg, 8) != 0)
+        return -1;
+
+    /*
+     * FILE is followed by an optional ",format=chrome".
+     */
+    char *opt = strstr(cmdarg + 8, ",format=");
+    if (opt != NULL) {
+        if (strcmp(opt + 8, "chrome") != 0)
+            errx(1, "Malformed argument to --trace, format must be chrome");
+        trace_chrome = true;
+        *opt = '\0';
+    }
+    if (cmdarg[8] == '\0')
+        errx(1, "Malformed argument to --trace");
+    trace_file = cmdarg + 8;
+    return 0;
+}
+
+static char *usage(void)
+{
+    return "--trace=FILE[,format=chrome] (write solo5_trace() events, and with "
+        "format=chrome hypercalls, to FILE on exit and on SIGPROF)";
+}
+
+static int setup(struct hvt *hvt, struct mft *mft)
+{
+    if (trace_file == NULL)
+        return 0;
+
+    if (hvt_core_register_hypercall(hvt, HVT_HYPERCALL_TRACE_RING,
+                hypercall_trace_ring) == -1 ||
+            hvt_core_register_halt_hook(hvt, trace_halt) == -1 ||
+            hvt_core_register_reset_hook(hvt, trace_reset) == -1)
+        return -1;
+    hvt->features |= HVT_FEATURE_TRACE;
+
+    if (trace_chrome) {
+        tender_ring = calloc(TENDER_TRACE_ENTRIES,
+                sizeof (struct tender_event));
+        if (tender_ring == NULL)
+            err(1, "trace: calloc() failed");
+        if (hvt_core_register_hypercall_hook(hvt, trace_hypercall) == -1)
+            return -1;
+    }
+    epoch_nsecs = now_nsecs();
+
+    if (pipe2(trigger_pipe, O_CLOEXEC) == -1)
+        err(1, "pipe2() failed");
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof (struct sigaction));
+    sa.sa_handler = trigger_handler;
+    sa.sa_flags = SA_RESTART;
+    sigfillset(&sa.sa_mask);
+    if (sigaction(SIGPROF, &sa, NULL) == -1)
+        err(1, "Could not install signal handler");
+
+    pthread_t thread;
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    if (pthread_create(&thread, NULL, trace_thread, NULL) != 0)
+        errx(1, "Could not create trace thread");
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    return 0;
+}
+
+DECLARE_MODULE(trace,
+    .setup = setup,
+    .handle_cmdarg = handle_cmdarg,
+    .usage = usage
+)
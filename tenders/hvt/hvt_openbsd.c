@@ -71,7 +71,8 @@ static void cleanup_vm(void)
     }
 }
 
-struct hvt *hvt_init(size_t mem_size)
+struct hvt *hvt_init(size_t mem_size, unsigned cpus, unsigned mem_flags,
+        unsigned init_flags)
 {
     struct hvt *hvt;
     struct hvt_b *hvb;
@@ -83,16 +84,32 @@ struct hvt *hvt_init(size_t mem_size)
         errno = EPERM;
         err(1, "need root privileges");
     }
+    if (cpus != 1)
+        errx(1, "Only one VCPU is supported on this host");
+    if (init_flags & HVT_INIT_DEDICATED_CORE)
+        errx(1, "--dedicated-core is not supported on this host");
+    if (init_flags & HVT_INIT_IRQCHIP)
+        errx(1, "--irqchip is not supported on this host");
+    if (mem_flags & MEM_HUGEPAGES)
+        errx(1, "--mem-hugepages is not supported on this host");
+    if (mem_flags & MEM_LAZY)
+        errx(1, "--mem-lazy is not supported on this host");
+    if (mem_flags & MEM_MERGEABLE)
+        errx(1, "--mem-mergeable is not supported on this host");
+    if (mem_flags & MEM_SHARED)
+        errx(1, "--mem-shared is not supported on this host");
 
     hvt = calloc(1, sizeof (struct hvt));
     if (hvt == NULL)
         err(1, "calloc hv");
+    hvt->mem_fd = -1;
 
     hvb = calloc(1, sizeof (struct hvt_b));
     if (hvb == NULL)
         err(1, "calloc");
 
     hvt->b = hvb;
+    hvt->cpus = 1;
     hvb->vmd_fd = -1;
 
     hvb->vmd_fd = open(VMM_NODE, O_RDWR);
@@ -121,6 +138,11 @@ struct hvt *hvt_init(size_t mem_size)
     if (p == MAP_FAILED)
         err(1, "mmap");
 
+    if (mem_flags & (MEM_PREFAULT | MEM_LOCK))
+        mem_prefault(p, mem_size);
+    if ((mem_flags & MEM_LOCK) && mem_lock(p, mem_size) == -1)
+        err(1, "Could not lock guest memory (RLIMIT_MEMLOCK may be too low)");
+
     vmr->vmr_va = (vaddr_t)p;
     hvt->mem = p;
     hvt->mem_size = mem_size;
@@ -136,6 +158,27 @@ struct hvt *hvt_init(size_t mem_size)
     return hvt;
 }
 
+int hvt_ioeventfd(struct hvt *hvt, int nr, int fd, bool datamatch,
+        uint32_t data)
+{
+    return -1;
+}
+
+int hvt_vcpu_interrupt(struct hvt *hvt)
+{
+    return -1;
+}
+
+int hvt_dirty_log_enable(struct hvt *hvt)
+{
+    return -1;
+}
+
+int hvt_dirty_log_get(struct hvt *hvt, uint64_t *bitmap)
+{
+    return -1;
+}
+
 #if HVT_DROP_PRIVILEGES
 void hvt_drop_privileges()
 {
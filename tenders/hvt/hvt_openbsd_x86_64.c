@@ -164,7 +164,10 @@ int hvt_vcpu_loop(struct hvt *hvt)
         }
 
         struct vm_exit *vei = vrp->vrp_exit;
-        if (vrp->vrp_exit_reason != VM_EXIT_NONE) {
+        if (vrp->vrp_exit_reason == VM_EXIT_NONE) {
+            hvt_core_exit(hvt, VM_EXIT_NONE);
+        }
+        else {
             switch (vrp->vrp_exit_reason) {
                 case VMX_EXIT_IO:
                 case SVM_VMEXIT_IOIO:
@@ -183,12 +186,8 @@ int hvt_vcpu_loop(struct hvt *hvt)
                         return hvt_core_hypercall_halt(hvt, gpa);
                     }
 
-                    hvt_hypercall_fn_t fn = hvt_core_hypercalls[nr];
-                    if (fn == NULL)
-                        errx(1, "Invalid guest hypercall: num=%d", nr);
-
                     hvt_gpa_t gpa = vei->vei.vei_data;
-                    fn(hvt, gpa);
+                    hvt_core_hypercall(hvt, nr, gpa);
                     break;
                 case VMX_EXIT_TRIPLE_FAULT:
                 case SVM_VMEXIT_SHUTDOWN:
@@ -203,3 +202,18 @@ int hvt_vcpu_loop(struct hvt *hvt)
         }
     }
 }
+
+int hvt_vcpu_get_frame(struct hvt *hvt, uint64_t *pc, uint64_t *fp)
+{
+    return -1;
+}
+
+int hvt_vcpu_save(struct hvt *hvt, int fd)
+{
+    return -1;
+}
+
+int hvt_vcpu_restore(struct hvt *hvt, int fd)
+{
+    return -1;
+}
@@ -0,0 +1,508 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * hvt_replay.c: Recording the inputs of a guest (--record=FILE) and feeding
+ * them back to it (--replay=FILE).
+ *
+ * When recording, the handlers of the hypercalls through which the guest
+ * receives input from the host (packets, block reads, readiness and the wall
+ * clock) are interposed on, and their results, including the data read into
+ * guest memory, are appended to the log together with the time since the
+ * guest started. When replaying, the same hypercalls are answered from the
+ * log instead, without touching the host devices, either as fast as possible
+ * or, with speed=recorded, no earlier than they were answered when recording.
+ * Output (packets sent, block writes) goes to the devices attached as usual.
+ *
+ * For the guest to see the same inputs, it must make the same input
+ * hypercalls in the same order, which is checked. Shared pages and rings,
+ * through which the host would provide input without hypercalls, are not
+ * offered to the guest, and configurations which require them are refused.
+ * The guest's monotonic clock, which it reads from the CPU, is not replayed.
+ */
+
+#define _GNU_SOURCE
+#include <err.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "hvt.h"
+#include "solo5.h"
+
+#define RR_MAGIC "SOLO5RR1"
+
+/*
+ * Each record is a header followed by (size) bytes of payload, in host byte
+ * order. (nsecs) is the time since hvt_replay_init() at which the hypercall
+ * returned.
+ */
+struct rr_hdr {
+    uint32_t nr;
+    uint32_t size;
+    uint64_t nsecs;
+};
+
+struct rr_net_read {
+    int32_t ret;
+    uint32_t pad;
+    uint64_t len;
+};
+
+struct rr_net_readv {
+    int32_t ret;
+    uint32_t iovcnt;
+};
+
+struct rr_net_iov {
+    uint64_t len;
+    int32_t ret;
+    uint32_t pad;
+    uint64_t tstamp;
+};
+
+struct rr_block_read {
+    uint64_t handle;
+    uint64_t offset;
+    uint64_t len;
+    int32_t ret;
+    uint32_t iovcnt;            /* 0 for HVT_HYPERCALL_BLOCK_READ */
+};
+
+struct rr_poll {
+    uint64_t ready_set;
+    uint64_t writable_set;
+    int32_t ret;
+    uint32_t pad;
+};
+
+static FILE *log_file;
+static const char *log_path;
+static bool replaying;
+static bool paced;
+static uint64_t start_nsecs;
+static uint64_t nrecords;
+
+static uint8_t *buf;
+static size_t buf_size, buf_len, buf_pos;
+
+static hvt_hypercall_fn_t orig[HVT_HYPERCALL_MAX];
+
+static uint64_t now_nsecs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void buf_reserve(size_t len)
+{
+    if (buf_len + len <= buf_size)
+        return;
+    while (buf_len + len > buf_size)
+        buf_size = buf_size ? buf_size * 2 : 65536;
+    buf = realloc(buf, buf_size);
+    if (buf == NULL)
+        err(1, "malloc");
+}
+
+/*
+ * Recording: a record is built up in (buf) with rec_put(), and written out
+ * by rec_end().
+ */
+static void rec_put(const void *p, size_t len)
+{
+    buf_reserve(len);
+    memcpy(buf + buf_len, p, len);
+    buf_len += len;
+}
+
+static void rec_end(int nr)
+{
+    struct rr_hdr h = {
+        .nr = nr, .size = buf_len, .nsecs = now_nsecs() - start_nsecs
+    };
+
+    if (fwrite(&h, sizeof h, 1, log_file) != 1 ||
+            (buf_len && fwrite(buf, buf_len, 1, log_file) != 1))
+        err(1, "record: Could not write to %s", log_path);
+    buf_len = 0;
+    nrecords++;
+}
+
+/*
+ * Replaying: rep_begin() reads the next record, which must be for hypercall
+ * (nr), into (buf), and waits until it is due. Its payload is then consumed
+ * with rep_get().
+ */
+static void diverged(const char *why)
+{
+    errx(1, "replay: Guest diverged from %s at record %" PRIu64 ": %s",
+            log_path, nrecords, why);
+}
+
+static void rep_begin(int nr)
+{
+    struct rr_hdr h;
+
+    if (fread(&h, sizeof h, 1, log_file) != 1) {
+        if (feof(log_file))
+            errx(1, "replay: End of %s reached after %" PRIu64 " records",
+                    log_path, nrecords);
+        err(1, "replay: Could not read from %s", log_path);
+    }
+    if (h.nr != (uint32_t)nr)
+        diverged("different hypercall");
+    buf_len = 0;
+    buf_pos = 0;
+    buf_reserve(h.size);
+    if (h.size && fread(buf, h.size, 1, log_file) != 1)
+        errx(1, "replay: Truncated record in %s", log_path);
+    buf_len = h.size;
+    nrecords++;
+
+    if (paced) {
+        uint64_t due = start_nsecs + h.nsecs;
+        uint64_t now = now_nsecs();
+        if (due > now) {
+            struct timespec ts = {
+                .tv_sec = (due - now) / 1000000000ULL,
+                .tv_nsec = (due - now) % 1000000000ULL
+            };
+            while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+                ;
+        }
+    }
+}
+
+static void rep_get(void *p, size_t len)
+{
+    if (buf_len - buf_pos < len)
+        errx(1, "replay: Malformed record in %s", log_path);
+    memcpy(p, buf + buf_pos, len);
+    buf_pos += len;
+}
+
+static void hypercall_walltime(struct hvt *hvt, hvt_gpa_t gpa)
+{
+    struct hvt_hc_walltime *t =
+        HVT_CHECKED_GPA_P(hvt, gpa, sizeof (struct hvt_hc_walltime));
+
+    if (replaying) {
+        rep_begin(HVT_HYPERCALL_WALLTIME);
+        rep_get(&t->nsecs, sizeof t->nsecs);
+        return;
+    }
+    orig[HVT_HYPERCALL_WALLTIME](hvt, gpa);
+    rec_put(&t->nsecs, sizeof t->nsecs);
+    rec_end(HVT_HYPERCALL_WALLTIME);
+}
+
+static void hypercall_poll(struct hvt *hvt, hvt_gpa_t gpa)
+{
+    struct hvt_hc_poll *t =
+        HVT_CHECKED_GPA_P(hvt, gpa, sizeof (struct hvt_hc_poll));
+    struct rr_poll r;
+
+    if (replaying) {
+        rep_begin(HVT_HYPERCALL_POLL);
+        rep_get(&r, sizeof r);
+        t->ready_set = r.ready_set;
+        t->writable_set = r.writable_set;
+        t->ret = r.ret;
+        return;
+    }
+    orig[HVT_HYPERCALL_POLL](hvt, gpa);
+    r = (struct rr_poll){
+        .ready_set = t->ready_set, .writable_set = t->writable_set,
+        .ret = t->ret
+    };
+    rec_put(&r, sizeof r);
+    rec_end(HVT_HYPERCALL_POLL);
+}
+
+static void hypercall_net_read(struct hvt *hvt, hvt_gpa_t gpa)
+{
+    struct hvt_hc_net_read *rd =
+        HVT_CHECKED_GPA_P(hvt, gpa, sizeof (struct hvt_hc_net_read));
+    struct rr_net_read r;
+
+    if (replaying) {
+        rep_begin(HVT_HYPERCALL_NET_READ);
+        rep_get(&r, sizeof r);
+        if (r.ret == SOLO5_R_OK) {
+            if (r.len > rd->len)
+                diverged("smaller packet buffer");
+            rep_get(HVT_CHECKED_GPA_P(hvt, rd->data, r.len), r.len);
+        }
+        rd->len = r.len;
+        rd->ret = r.ret;
+        return;
+    }
+    orig[HVT_HYPERCALL_NET_READ](hvt, gpa);
+    r = (struct rr_net_read){ .ret = rd->ret, .len = rd->len };
+    rec_put(&r, sizeof r);
+    if (rd->ret == SOLO5_R_OK)
+        rec_put(HVT_CHECKED_GPA_P(hvt, rd->data, rd->len), rd->len);
+    rec_end(HVT_HYPERCALL_NET_READ);
+}
+
+static void hypercall_net_readv(struct hvt *hvt, hvt_gpa_t gpa)
+{
+    struct hvt_hc_net_readv *rd =
+        HVT_CHECKED_GPA_P(hvt, gpa, sizeof (struct hvt_hc_net_readv));
+    struct rr_net_readv r;
+    struct rr_net_iov ri;
+
+    if (replaying) {
+        rep_begin(HVT_HYPERCALL_NET_READV);
+        rep_get(&r, sizeof r);
+        if (r.ret == SOLO5_R_OK) {
+            if (r.iovcnt > rd->iovcnt || r.iovcnt > HVT_NET_IOV_MAX)
+                diverged("fewer packet buffers");
+            struct hvt_net_iov *iov = HVT_CHECKED_GPA_P(hvt, rd->iov,
+                    r.iovcnt * sizeof (struct hvt_net_iov));
+            for (uint32_t i = 0; i < r.iovcnt; i++) {
+                rep_get(&ri, sizeof ri);
+                if (ri.len > iov[i].len)
+                    diverged("smaller packet buffer");
+                rep_get(HVT_CHECKED_GPA_P(hvt, iov[i].data, ri.len), ri.len);
+                iov[i].len = ri.len;
+                iov[i].ret = ri.ret;
+                iov[i].tstamp = ri.tstamp;
+            }
+            rd->iovcnt = r.iovcnt;
+        }
+        rd->ret = r.ret;
+        return;
+    }
+    orig[HVT_HYPERCALL_NET_READV](hvt, gpa);
+    r = (struct rr_net_readv){ .ret = rd->ret };
+    if (rd->ret == SOLO5_R_OK)
+        r.iovcnt = rd->iovcnt;
+    rec_put(&r, sizeof r);
+    if (r.iovcnt != 0) {
+        struct hvt_net_iov *iov = HVT_CHECKED_GPA_P(hvt, rd->iov,
+                r.iovcnt * sizeof (struct hvt_net_iov));
+        for (uint32_t i = 0; i < r.iovcnt; i++) {
+            ri = (struct rr_net_iov){
+                .len = iov[i].len, .ret = iov[i].ret, .tstamp = iov[i].tstamp
+            };
+            rec_put(&ri, sizeof ri);
+            rec_put(HVT_CHECKED_GPA_P(hvt, iov[i].data, ri.len), ri.len);
+        }
+    }
+    rec_end(HVT_HYPERCALL_NET_READV);
+}
+
+static void hypercall_block_read(struct hvt *hvt, hvt_gpa_t gpa)
+{
+    struct hvt_hc_block_read *rd =
+        HVT_CHECKED_GPA_P(hvt, gpa, sizeof (struct hvt_hc_block_read));
+    struct rr_block_read r;
+
+    if (replaying) {
+        rep_begin(HVT_HYPERCALL_BLOCK_READ);
+        rep_get(&r, sizeof r);
+        if (r.handle != rd->handle || r.offset != rd->offset ||
+                r.len != rd->len)
+            diverged("different block read");
+        if (r.ret == SOLO5_R_OK)
+            rep_get(HVT_CHECKED_GPA_P(hvt, rd->data, r.len), r.len);
+        rd->ret = r.ret;
+        return;
+    }
+    r = (struct rr_block_read){
+        .handle = rd->handle, .offset = rd->offset, .len = rd->len
+    };
+    orig[HVT_HYPERCALL_BLOCK_READ](hvt, gpa);
+    r.ret = rd->ret;
+    rec_put(&r, sizeof r);
+    if (rd->ret == SOLO5_R_OK)
+        rec_put(HVT_CHECKED_GPA_P(hvt, rd->data, r.len), r.len);
+    rec_end(HVT_HYPERCALL_BLOCK_READ);
+}
+
+static void hypercall_block_readv(struct hvt *hvt, hvt_gpa_t gpa)
+{
+    struct hvt_hc_block_readv *rd =
+        HVT_CHECKED_GPA_P(hvt, gpa, sizeof (struct hvt_hc_block_readv));
+    struct rr_block_read r;
+    struct hvt_block_iov *iov = NULL;
+    uint64_t len = 0;
+
+    /*
+     * Invalid requests are failed by the original handler without reading
+     * the segments, and are recorded as such.
+     */
+    if (rd->iovcnt != 0 && rd->iovcnt <= HVT_BLOCK_IOV_MAX) {
+        iov = HVT_CHECKED_GPA_P(hvt, rd->iov,
+                rd->iovcnt * sizeof (struct hvt_block_iov));
+        for (size_t i = 0; i < rd->iovcnt; i++)
+            len += iov[i].len;
+    }
+
+    if (replaying) {
+        rep_begin(HVT_HYPERCALL_BLOCK_READV);
+        rep_get(&r, sizeof r);
+        if (r.handle != rd->handle || r.offset != rd->offset ||
+                r.iovcnt != rd->iovcnt || r.len != len)
+            diverged("different block read");
+        if (r.ret == SOLO5_R_OK && iov != NULL) {
+            for (size_t i = 0; i < rd->iovcnt; i++)
+                rep_get(HVT_CHECKED_GPA_P(hvt, iov[i].data, iov[i].len),
+                        iov[i].len);
+        }
+        rd->ret = r.ret;
+        return;
+    }
+    r = (struct rr_block_read){
+        .handle = rd->handle, .offset = rd->offset, .len = len,
+        .iovcnt = rd->iovcnt
+    };
+    orig[HVT_HYPERCALL_BLOCK_READV](hvt, gpa);
+    r.ret = rd->ret;
+    rec_put(&r, sizeof r);
+    if (rd->ret == SOLO5_R_OK && iov != NULL) {
+        for (size_t i = 0; i < rd->iovcnt; i++)
+            rec_put(HVT_CHECKED_GPA_P(hvt, iov[i].data, iov[i].len),
+                    iov[i].len);
+    }
+    rec_end(HVT_HYPERCALL_BLOCK_READV);
+}
+
+/*
+ * Completions of asynchronous block requests arrive through
+ * HVT_HYPERCALL_BLOCK_REAP, which is not recorded.
+ */
+static void hypercall_block_submit(struct hvt *hvt __attribute__((unused)),
+        hvt_gpa_t gpa __attribute__((unused)))
+{
+    errx(1, "%s: Asynchronous block I/O is not supported",
+            replaying ? "replay" : "record");
+}
+
+static const struct {
+    int nr;
+    hvt_hypercall_fn_t fn;
+} interposed[] = {
+    { HVT_HYPERCALL_WALLTIME, hypercall_walltime },
+    { HVT_HYPERCALL_POLL, hypercall_poll },
+    { HVT_HYPERCALL_NET_READ, hypercall_net_read },
+    { HVT_HYPERCALL_NET_READV, hypercall_net_readv },
+    { HVT_HYPERCALL_BLOCK_READ, hypercall_block_read },
+    { HVT_HYPERCALL_BLOCK_READV, hypercall_block_readv },
+    { HVT_HYPERCALL_BLOCK_SUBMIT, hypercall_block_submit },
+};
+
+static void flush_log(void)
+{
+    if (fflush(log_file) != 0)
+        err(1, "record: Could not write to %s", log_path);
+}
+
+static void halt(struct hvt *hvt __attribute__((unused)),
+        int status __attribute__((unused)),
+        void *cookie __attribute__((unused)))
+{
+    if (replaying)
+        warnx("replay: Guest halted after %" PRIu64 " records", nrecords);
+    else
+        flush_log();
+}
+
+static void check_supported(struct hvt *hvt, struct mft *mft,
+        const char *what)
+{
+    if (hvt->cpus > 1)
+        errx(1, "%s: Not supported with more than one VCPU", what);
+    if (hvt->features & (HVT_FEATURE_NET_RINGS | HVT_FEATURE_NET_VHOST))
+        errx(1, "%s: Not supported with --net-rings or --net-vhost", what);
+    for (unsigned i = 0; i != mft->entries; i++) {
+        if (!mft->e[i].attached)
+            continue;
+        if (mft->e[i].type == MFT_BLOCK_BASIC &&
+                (mft->e[i].u.block_basic.flags & MFT_BLOCK_MAPPED))
+            errx(1, "%s: Not supported with --block-map", what);
+        if (mft->e[i].type == MFT_SHM_BASIC ||
+                mft->e[i].type == MFT_PCI_BASIC)
+            errx(1, "%s: Not supported with shared memory or PCI devices",
+                    what);
+    }
+}
+
+void hvt_replay_init(struct hvt *hvt, const char *record_file,
+        const char *replay_file, struct mft *mft)
+{
+    char magic[sizeof RR_MAGIC - 1];
+
+    if (record_file == NULL && replay_file == NULL)
+        return;
+
+    if (replay_file != NULL) {
+        replaying = true;
+        char *p = strchr(replay_file, ',');
+        if (p != NULL) {
+            if (strcmp(p, ",speed=recorded") == 0)
+                paced = true;
+            else if (strcmp(p, ",speed=fast") != 0)
+                errx(1, "Malformed argument to --replay");
+            log_path = strndup(replay_file, p - replay_file);
+            if (log_path == NULL)
+                err(1, "strndup");
+        }
+        else
+            log_path = replay_file;
+    }
+    else
+        log_path = record_file;
+    check_supported(hvt, mft, replaying ? "replay" : "record");
+
+    log_file = fopen(log_path, replaying ? "re" : "we");
+    if (log_file == NULL)
+        err(1, "Could not open %s", log_path);
+    if (replaying) {
+        if (fread(magic, sizeof magic, 1, log_file) != 1 ||
+                memcmp(magic, RR_MAGIC, sizeof magic) != 0)
+            errx(1, "replay: %s is not a Solo5 record log", log_path);
+    }
+    else {
+        if (fwrite(RR_MAGIC, sizeof magic, 1, log_file) != 1)
+            err(1, "record: Could not write to %s", log_path);
+        atexit(flush_log);
+    }
+
+    for (size_t i = 0; i < sizeof interposed / sizeof interposed[0]; i++) {
+        int nr = interposed[i].nr;
+        orig[nr] = hvt_core_interpose_hypercall(hvt, nr, interposed[i].fn);
+    }
+    /*
+     * The guest must ask for readiness and the wall clock with hypercalls.
+     */
+    hvt->features &= ~(HVT_FEATURE_POLL_PAGE | HVT_FEATURE_TIME_PAGE);
+    if (hvt_core_register_halt_hook(hvt, halt) == -1)
+        errx(1, "Could not register record/replay halt hook");
+    start_nsecs = now_nsecs();
+}
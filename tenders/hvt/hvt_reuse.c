@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * hvt_reuse.c: Running the guest again once it halts (--reuse=N), without
+ * setting up a new tender.
+ *
+ * Once guest memory has been initialised, the pages up to the end of the
+ * unikernel, which hold everything written so far, are copied aside and
+ * writes to guest memory are logged from then on. When the guest halts, the
+ * core and modules stop using any memory it registered with them and wait
+ * for requests in flight on its behalf, after which the pages written are
+ * copied back from the copy aside, or cleared if beyond it, and the boot VCPU
+ * is initialised again. The VM, guest memory and attached devices are kept.
+ */
+
+#define _GNU_SOURCE
+#include <assert.h>
+#include <err.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "hvt.h"
+
+static size_t page_size;
+static size_t npages;
+static uint8_t *image;
+static size_t image_pages;
+static uint64_t *bitmap;
+
+void hvt_reuse_init(struct hvt *hvt, hvt_gpa_t gpa_kend)
+{
+    long ps = sysconf(_SC_PAGESIZE);
+    assert(ps > 0 && hvt->mem_size % ps == 0);
+    page_size = ps;
+    npages = hvt->mem_size / page_size;
+
+    image_pages = (gpa_kend + page_size - 1) / page_size;
+    assert(image_pages <= npages);
+    image = malloc(image_pages * page_size);
+    bitmap = calloc(HVT_DIRTY_LOG_WORDS(npages), sizeof (uint64_t));
+    if (image == NULL || bitmap == NULL)
+        err(1, "malloc");
+    memcpy(image, hvt->mem, image_pages * page_size);
+
+    if (hvt_dirty_log_enable(hvt) == -1)
+        errx(1, "--reuse is not supported on this host");
+    hvt_dirty_track_enable(hvt);
+}
+
+/*
+ * Clear the pages of guest memory from (first) to (end). Private anonymous
+ * memory is returned to the host instead, which is cheaper and leaves it as
+ * it was before the guest first ran.
+ */
+static void clear_pages(struct hvt *hvt, size_t first, size_t end)
+{
+    uint8_t *p = hvt->mem + first * page_size;
+    size_t len = (end - first) * page_size;
+
+#if defined(__linux__)
+    if (hvt->mem_fd == -1 && madvise(p, len, MADV_DONTNEED) == 0)
+        return;
+#endif
+    memset(p, 0, len);
+}
+
+void hvt_reuse_reset(struct hvt *hvt, hvt_gpa_t gpa_ep)
+{
+    hvt_core_reset(hvt);
+
+    memset(bitmap, 0, HVT_DIRTY_LOG_WORDS(npages) * sizeof (uint64_t));
+    if (hvt_dirty_log_get(hvt, bitmap) == -1)
+        errx(1, "reuse: Could not get pages written by the guest");
+    hvt_dirty_track_get(hvt, bitmap);
+    hvt_dirty_track_clear(hvt);
+
+    size_t first = hvt_dirty_log_next(bitmap, npages, 0, true);
+    while (first < npages) {
+        size_t end = hvt_dirty_log_next(bitmap, npages, first, false);
+        /*
+         * Pages accessed by the tender may only have been read, and may be
+         * mapped read-only, as are the unikernel's text and read-only data.
+         */
+        for (; first < end && first < image_pages; first++) {
+            uint8_t *p = hvt->mem + first * page_size;
+            if (memcmp(p, image + first * page_size, page_size) != 0)
+                memcpy(p, image + first * page_size, page_size);
+        }
+        if (first < end)
+            clear_pages(hvt, first, end);
+        first = hvt_dirty_log_next(bitmap, npages, end, true);
+    }
+
+    /*
+     * The hypercall by which the guest halted is left incomplete, but KVM
+     * does not skip over it once the instruction pointer has been set.
+     */
+    hvt_vcpu_init(hvt, gpa_ep);
+}
@@ -0,0 +1,604 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * hvt_snapshot.c: Saving the guest to a snapshot once it has initialised
+ * (--snapshot=FILE), and restoring new instances from it (--restore=FILE).
+ *
+ * A snapshot file consists of a (struct snapshot_header), followed by the
+ * manifest, the path of the base snapshot if this is an incremental snapshot,
+ * the boot VCPU state as saved by the backend, a bitmap of the pages saved if
+ * this is an incremental snapshot, and guest memory starting at the next page
+ * boundary. Guest memory is written sparsely, and mapped copy-on-write from
+ * the file when restoring, so that restoring does not depend on the size of
+ * guest memory, and any number of instances restored from the same snapshot
+ * share the pages they have not written to.
+ *
+ * An instance restored from a snapshot may itself take an incremental
+ * snapshot, which only contains the pages written since it was restored, as
+ * found by logging the pages written by the guest and tracking those accessed
+ * by the tender. Restoring from it maps guest memory from its base first.
+ *
+ * Snapshots are written to a temporary file which is renamed over FILE once
+ * complete, so that taking a snapshot again does not disturb instances still
+ * running from a previous snapshot at the same path.
+ *
+ * As guest memory is mapped from the file, restoring is lazy: each page is
+ * read from the file when the guest first touches it. With
+ * --restore-prefetch=FILE, the pages touched by an instance restored from
+ * the snapshot, its working set, are recorded to FILE when it exits, and
+ * instances restored later ask the host to read them ahead, so that they do
+ * not wait for each to be read in turn.
+ */
+
+#define _GNU_SOURCE
+#include <assert.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "hvt.h"
+#include "solo5.h"
+
+#define SNAPSHOT_MAGIC "SOLO5SNP"
+#define SNAPSHOT_VERSION 2
+
+/*
+ * Limits on the length of a chain of incremental snapshots, and on the number
+ * of separate runs of pages mapped from each; beyond that, pages are read
+ * instead, so as not to run out of mappings.
+ */
+#define SNAPSHOT_DEPTH_MAX 16
+#define SNAPSHOT_RUNS_MAX 1024
+
+#define PREFETCH_MAGIC "SOLO5PFL"
+
+struct snapshot_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t cpus;
+    uint64_t mem_size;
+    uint64_t cpu_cycle_freq;
+    uint64_t id;                        /* Random, identifies this snapshot */
+    uint64_t base_id;                   /* (id) of the base snapshot */
+    uint64_t mft_size;
+    uint64_t base_len;                  /* 0 if not incremental */
+    uint64_t bitmap_offset;             /* 0 if not incremental */
+    uint64_t mem_offset;
+};
+
+/*
+ * A prefetch file consists of a (struct prefetch_header), followed by a
+ * bitmap of the pages in the working set.
+ */
+struct prefetch_header {
+    char magic[8];
+    uint64_t snapshot_id;               /* (id) of the snapshot restored */
+    uint64_t npages;
+};
+
+static const char *snapshot_file;
+static char *snapshot_tmpfile;
+static int snapshot_fd = -1;
+static struct mft *snapshot_mft;
+static size_t snapshot_mft_size;
+
+/*
+ * Set when taking an incremental snapshot of a restored instance.
+ */
+static char *snapshot_base;
+static uint64_t snapshot_base_id;
+
+static int write_all(int fd, const void *buf, size_t len, off_t offset)
+{
+    const uint8_t *p = buf;
+
+    while (len > 0) {
+        ssize_t nbytes = pwrite(fd, p, len, offset);
+        if (nbytes == -1 && errno == EINTR)
+            continue;
+        if (nbytes <= 0)
+            return -1;
+        p += nbytes;
+        len -= nbytes;
+        offset += nbytes;
+    }
+    return 0;
+}
+
+static int read_all(int fd, void *buf, size_t len, off_t offset)
+{
+    uint8_t *p = buf;
+
+    while (len > 0) {
+        ssize_t nbytes = pread(fd, p, len, offset);
+        if (nbytes == -1 && errno == EINTR)
+            continue;
+        if (nbytes <= 0)
+            return -1;
+        p += nbytes;
+        len -= nbytes;
+        offset += nbytes;
+    }
+    return 0;
+}
+
+/*
+ * Write the guest memory pages set in (bitmap) at (offset). If (bitmap) is
+ * NULL, write the pages which have been touched by the guest, as for
+ * dumpcore. Pages not written are left as holes, which read as zero.
+ */
+static int save_mem(struct hvt *hvt, int fd, off_t offset,
+        const uint64_t *bitmap)
+{
+    long page_size = sysconf(_SC_PAGESIZE);
+    assert(page_size > 0 && hvt->mem_size % page_size == 0);
+    size_t npages = hvt->mem_size / page_size;
+    unsigned char *mvec = NULL;
+    if (bitmap == NULL) {
+        mvec = malloc(npages);
+        if (mvec == NULL)
+            return -1;
+        if (mincore(hvt->mem, hvt->mem_size, (void *)mvec) == -1) {
+            free(mvec);
+            return -1;
+        }
+    }
+    for (size_t pg = 0; pg < npages; pg++) {
+        if (bitmap == NULL ? !(mvec[pg] & 1) :
+                !(bitmap[pg / 64] & (1ULL << (pg % 64))))
+            continue;
+        off_t pgoff = pg * page_size;
+        if (write_all(fd, hvt->mem + pgoff, page_size, offset + pgoff) == -1) {
+            free(mvec);
+            return -1;
+        }
+    }
+    free(mvec);
+    return ftruncate(fd, offset + hvt->mem_size);
+}
+
+static int save(struct hvt *hvt)
+{
+    struct snapshot_header hdr = {
+        .magic = SNAPSHOT_MAGIC,
+        .version = SNAPSHOT_VERSION,
+        .cpus = hvt->cpus,
+        .mem_size = hvt->mem_size,
+        .cpu_cycle_freq = hvt->cpu_cycle_freq,
+        .base_id = snapshot_base_id,
+        .mft_size = snapshot_mft_size,
+        .base_len = snapshot_base ? strlen(snapshot_base) : 0
+    };
+    long page_size = sysconf(_SC_PAGESIZE);
+    size_t npages = hvt->mem_size / page_size;
+    uint64_t *bitmap = NULL;
+    size_t bitmap_size = HVT_DIRTY_LOG_WORDS(npages) * sizeof (uint64_t);
+    off_t off = sizeof hdr;
+    int ret = -1;
+
+    if (getentropy(&hdr.id, sizeof hdr.id) == -1)
+        return -1;
+    if (write_all(snapshot_fd, snapshot_mft, snapshot_mft_size, off) == -1)
+        return -1;
+    off += snapshot_mft_size;
+    if (snapshot_base != NULL) {
+        if (write_all(snapshot_fd, snapshot_base, hdr.base_len, off) == -1)
+            return -1;
+        off += hdr.base_len;
+    }
+    if (lseek(snapshot_fd, off, SEEK_SET) == -1)
+        return -1;
+    if (hvt_vcpu_save(hvt, snapshot_fd) == -1)
+        return -1;
+    off = lseek(snapshot_fd, 0, SEEK_CUR);
+    if (off == -1)
+        return -1;
+    if (snapshot_base != NULL) {
+        bitmap = malloc(bitmap_size);
+        if (bitmap == NULL || hvt_dirty_log_get(hvt, bitmap) == -1)
+            goto out;
+        hvt_dirty_track_get(hvt, bitmap);
+        hdr.bitmap_offset = off;
+        if (write_all(snapshot_fd, bitmap, bitmap_size, off) == -1)
+            goto out;
+        off += bitmap_size;
+    }
+    hdr.mem_offset = (off + page_size - 1) & ~(page_size - 1);
+    if (save_mem(hvt, snapshot_fd, hdr.mem_offset, bitmap) == -1)
+        goto out;
+    if (write_all(snapshot_fd, &hdr, sizeof hdr, 0) == -1)
+        goto out;
+    ret = fsync(snapshot_fd);
+
+out:
+    free(bitmap);
+    return ret;
+}
+
+static void hypercall_snapshot(struct hvt *hvt, hvt_gpa_t gpa)
+{
+    struct hvt_hc_snapshot *s =
+        HVT_CHECKED_GPA_P(hvt, gpa, sizeof (struct hvt_hc_snapshot));
+
+    if (snapshot_fd == -1) {
+        s->ret = SOLO5_R_EUNSPEC;
+        return;
+    }
+    /*
+     * Restored instances see the hypercall return successfully.
+     */
+    s->ret = SOLO5_R_OK;
+    if (save(hvt) == -1 || rename(snapshot_tmpfile, snapshot_file) == -1) {
+        warn("snapshot: Error writing %s", snapshot_file);
+        unlink(snapshot_tmpfile);
+        exit(1);
+    }
+    close(snapshot_fd);
+    free(snapshot_tmpfile);
+    snapshot_tmpfile = NULL;
+    warnx("snapshot: Saved guest to %s", snapshot_file);
+    exit(0);
+}
+
+/*
+ * Removes the temporary file if the guest exits without taking a snapshot.
+ */
+static void cleanup(void)
+{
+    if (snapshot_tmpfile != NULL)
+        unlink(snapshot_tmpfile);
+}
+
+/*
+ * Snapshots cannot capture state held by the tender or host kernel on behalf
+ * of the guest, other than that re-created by attaching devices and the guest
+ * registering its shared pages again.
+ */
+static void check_supported(struct hvt *hvt, struct mft *mft)
+{
+#if !(defined(__linux__) && defined(__x86_64__))
+    errx(1, "snapshot: Not supported on this host");
+#endif
+    if (hvt->cpus > 1)
+        errx(1, "snapshot: Not supported with more than one VCPU");
+    if (hvt->features & (HVT_FEATURE_NET_RINGS | HVT_FEATURE_NET_VHOST))
+        errx(1, "snapshot: Not supported with --net-rings or --net-vhost");
+    for (unsigned i = 0; i != mft->entries; i++) {
+        if (mft->e[i].type == MFT_BLOCK_BASIC && mft->e[i].attached &&
+                (mft->e[i].u.block_basic.flags & MFT_BLOCK_MAPPED))
+            errx(1, "snapshot: Not supported with --block-map");
+        /*
+         * The contents of RAM-backed devices are not saved.
+         */
+        if (mft->e[i].type == MFT_BLOCK_BASIC && mft->e[i].attached &&
+                (mft->e[i].u.block_basic.flags & MFT_BLOCK_RAM))
+            errx(1, "snapshot: Not supported with RAM block devices");
+    }
+}
+
+void hvt_snapshot_init(struct hvt *hvt, const char *file, struct mft *mft,
+        size_t mft_size)
+{
+    assert(hvt_core_register_hypercall(hvt, HVT_HYPERCALL_SNAPSHOT,
+                hypercall_snapshot) == 0);
+    if (file == NULL)
+        return;
+
+    check_supported(hvt, mft);
+    if (asprintf(&snapshot_tmpfile, "%s.XXXXXX", file) == -1)
+        err(1, "asprintf");
+    snapshot_fd = mkostemp(snapshot_tmpfile, O_CLOEXEC);
+    if (snapshot_fd == -1)
+        err(1, "snapshot: Could not create %s", snapshot_tmpfile);
+    atexit(cleanup);
+    snapshot_file = file;
+    snapshot_mft = mft;
+    snapshot_mft_size = mft_size;
+}
+
+bool hvt_snapshot_mft_matches(struct mft *mft, struct mft *saved)
+{
+    if (mft->entries != saved->entries)
+        return false;
+    for (unsigned i = 0; i != mft->entries; i++) {
+        struct mft_entry *e = &mft->e[i], *s = &saved->e[i];
+
+        if (strncmp(e->name, s->name, MFT_NAME_SIZE) != 0 ||
+                e->type != s->type || e->attached != s->attached)
+            return false;
+        if (e->type == MFT_BLOCK_BASIC &&
+                (e->u.block_basic.capacity != s->u.block_basic.capacity ||
+                 e->u.block_basic.block_size != s->u.block_basic.block_size))
+            return false;
+        if (e->type == MFT_NET_BASIC &&
+                e->u.net_basic.mtu != s->u.net_basic.mtu)
+            return false;
+    }
+    return true;
+}
+
+static int open_snapshot(struct hvt *hvt, const char *file,
+        struct snapshot_header *hdr)
+{
+    int fd = open(file, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        err(1, "snapshot: Could not open %s", file);
+    if (read_all(fd, hdr, sizeof *hdr, 0) == -1 ||
+            memcmp(hdr->magic, SNAPSHOT_MAGIC, sizeof hdr->magic) != 0 ||
+            hdr->version != SNAPSHOT_VERSION)
+        errx(1, "snapshot: %s is not a valid snapshot", file);
+    if (hdr->mem_size != hvt->mem_size)
+        errx(1, "snapshot: %s was taken with --mem=%llu", file,
+                (unsigned long long)hdr->mem_size >> 20);
+    if (hdr->cpus != hvt->cpus)
+        errx(1, "snapshot: %s was taken with --cpus=%u", file, hdr->cpus);
+    if (hdr->cpu_cycle_freq != hvt->cpu_cycle_freq)
+        errx(1, "snapshot: %s was taken on a host with a different CPU "
+                "cycle counter frequency", file);
+    return fd;
+}
+
+static void map_mem(struct hvt *hvt, const char *file, int fd, off_t offset,
+        size_t gpa, size_t len)
+{
+    if (mmap(hvt->mem + gpa, len, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_FIXED, fd, offset + gpa) != hvt->mem + gpa)
+        err(1, "snapshot: Could not map guest memory from %s", file);
+}
+
+/*
+ * Map guest memory from the snapshot (file), open as (fd) with header (hdr),
+ * after that of its base snapshot if it is incremental. (depth) is the
+ * number of snapshots in the chain so far.
+ */
+static void restore_mem(struct hvt *hvt, const char *file, int fd,
+        struct snapshot_header *hdr, unsigned depth)
+{
+    if (hdr->base_len == 0) {
+        map_mem(hvt, file, fd, hdr->mem_offset, 0, hvt->mem_size);
+        return;
+    }
+
+    if (depth == SNAPSHOT_DEPTH_MAX)
+        errx(1, "snapshot: %s: Too many incremental snapshots", file);
+    if (hdr->base_len >= PATH_MAX)
+        errx(1, "snapshot: %s is not a valid snapshot", file);
+    char base[PATH_MAX];
+    if (read_all(fd, base, hdr->base_len, sizeof *hdr + hdr->mft_size) == -1)
+        errx(1, "snapshot: %s is not a valid snapshot", file);
+    base[hdr->base_len] = 0;
+    struct snapshot_header base_hdr;
+    int base_fd = open_snapshot(hvt, base, &base_hdr);
+    if (base_hdr.id != hdr->base_id)
+        errx(1, "snapshot: %s has changed since %s was taken", base, file);
+    restore_mem(hvt, base, base_fd, &base_hdr, depth + 1);
+    close(base_fd);
+
+    /*
+     * Then map the pages saved in this snapshot over those of its base.
+     */
+    long page_size = sysconf(_SC_PAGESIZE);
+    size_t npages = hvt->mem_size / page_size;
+    size_t bitmap_size = HVT_DIRTY_LOG_WORDS(npages) * sizeof (uint64_t);
+    uint64_t *bitmap = malloc(bitmap_size);
+    if (bitmap == NULL)
+        err(1, "malloc");
+    if (read_all(fd, bitmap, bitmap_size, hdr->bitmap_offset) == -1)
+        errx(1, "snapshot: %s is not a valid snapshot", file);
+    unsigned runs = 0;
+    size_t start = hvt_dirty_log_next(bitmap, npages, 0, true);
+    while (start < npages) {
+        size_t end = hvt_dirty_log_next(bitmap, npages, start, false);
+        size_t gpa = start * page_size, len = (end - start) * page_size;
+        if (runs++ < SNAPSHOT_RUNS_MAX)
+            map_mem(hvt, file, fd, hdr->mem_offset, gpa, len);
+        else if (read_all(fd, hvt->mem + gpa, len,
+                    hdr->mem_offset + gpa) == -1)
+            errx(1, "snapshot: Could not read guest memory from %s", file);
+        start = hvt_dirty_log_next(bitmap, npages, end, true);
+    }
+    free(bitmap);
+}
+
+/*
+ * Set when recording the working set of a restored instance.
+ */
+static struct hvt *prefetch_hvt;
+static const char *prefetch_path;
+static uint64_t prefetch_snapshot_id;
+
+/*
+ * Reads ahead the pages in the working set recorded in (file) for the
+ * snapshot (id). Returns false if there is no such record.
+ */
+static bool prefetch(struct hvt *hvt, const char *file, uint64_t id)
+{
+    struct prefetch_header hdr;
+    long page_size = sysconf(_SC_PAGESIZE);
+    size_t npages = hvt->mem_size / page_size;
+    size_t bitmap_size = HVT_DIRTY_LOG_WORDS(npages) * sizeof (uint64_t);
+    bool ok = false;
+
+    int fd = open(file, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        if (errno != ENOENT)
+            warn("snapshot: Could not open %s", file);
+        return false;
+    }
+    uint64_t *bitmap = malloc(bitmap_size);
+    if (bitmap == NULL)
+        err(1, "malloc");
+    if (read_all(fd, &hdr, sizeof hdr, 0) == -1 ||
+            memcmp(hdr.magic, PREFETCH_MAGIC, sizeof hdr.magic) != 0 ||
+            hdr.npages != npages ||
+            read_all(fd, bitmap, bitmap_size, sizeof hdr) == -1) {
+        warnx("snapshot: %s is not a valid prefetch file, ignoring", file);
+        goto out;
+    }
+    if (hdr.snapshot_id != id) {
+        warnx("snapshot: %s was recorded for another snapshot, recording "
+                "again", file);
+        goto out;
+    }
+    size_t start = hvt_dirty_log_next(bitmap, npages, 0, true);
+    while (start < npages) {
+        size_t end = hvt_dirty_log_next(bitmap, npages, start, false);
+        (void)madvise(hvt->mem + start * page_size, (end - start) * page_size,
+                MADV_WILLNEED);
+        start = hvt_dirty_log_next(bitmap, npages, end, true);
+    }
+    ok = true;
+
+out:
+    free(bitmap);
+    close(fd);
+    return ok;
+}
+
+/*
+ * Writes the pages of guest memory mapped in the tender, which are those
+ * touched since it was restored, to the prefetch file when the tender exits.
+ */
+static int prefetch_save(struct hvt *hvt, int fd)
+{
+    struct prefetch_header hdr = {
+        .magic = PREFETCH_MAGIC,
+        .snapshot_id = prefetch_snapshot_id
+    };
+    long page_size = sysconf(_SC_PAGESIZE);
+    size_t npages = hvt->mem_size / page_size;
+    size_t bitmap_size = HVT_DIRTY_LOG_WORDS(npages) * sizeof (uint64_t);
+    uint64_t entries[512];
+    int ret = -1;
+
+    hdr.npages = npages;
+    uint64_t *bitmap = calloc(1, bitmap_size);
+    if (bitmap == NULL)
+        return -1;
+    int pfd = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+    if (pfd == -1)
+        goto out;
+    off_t base = (uintptr_t)hvt->mem / page_size * sizeof entries[0];
+    for (size_t pg = 0; pg < npages; pg += 512) {
+        size_t n = npages - pg < 512 ? npages - pg : 512;
+        if (read_all(pfd, entries, n * sizeof entries[0],
+                    base + pg * sizeof entries[0]) == -1)
+            goto out;
+        /*
+         * Bit 63 is set if the page is present, bit 62 if swapped out.
+         */
+        for (size_t i = 0; i < n; i++)
+            if (entries[i] & (3ULL << 62))
+                bitmap[(pg + i) / 64] |= 1ULL << ((pg + i) % 64);
+    }
+    if (write_all(fd, &hdr, sizeof hdr, 0) == -1 ||
+            write_all(fd, bitmap, bitmap_size, sizeof hdr) == -1)
+        goto out;
+    ret = fsync(fd);
+
+out:
+    if (pfd != -1)
+        close(pfd);
+    free(bitmap);
+    return ret;
+}
+
+static void prefetch_record(void)
+{
+    char *tmpfile;
+
+    if (asprintf(&tmpfile, "%s.XXXXXX", prefetch_path) == -1)
+        return;
+    int fd = mkostemp(tmpfile, O_CLOEXEC);
+    if (fd == -1) {
+        warn("snapshot: Could not create %s", tmpfile);
+        free(tmpfile);
+        return;
+    }
+    if (prefetch_save(prefetch_hvt, fd) == -1 ||
+            rename(tmpfile, prefetch_path) == -1) {
+        warn("snapshot: Error writing %s", prefetch_path);
+        unlink(tmpfile);
+    }
+    close(fd);
+    free(tmpfile);
+}
+
+void hvt_snapshot_restore(struct hvt *hvt, const char *file,
+        const char *prefetch_file, struct mft *mft, size_t mft_size)
+{
+    struct snapshot_header hdr;
+
+    check_supported(hvt, mft);
+    int fd = open_snapshot(hvt, file, &hdr);
+
+    struct mft *saved = malloc(hdr.mft_size);
+    if (saved == NULL)
+        err(1, "malloc");
+    if (hdr.mft_size != mft_size ||
+            read_all(fd, saved, mft_size, sizeof hdr) == -1 ||
+            !hvt_snapshot_mft_matches(mft, saved))
+        errx(1, "snapshot: %s was taken of a different unikernel or with "
+                "different devices", file);
+    free(saved);
+
+    if (lseek(fd, sizeof hdr + hdr.mft_size + hdr.base_len, SEEK_SET) == -1 ||
+            hvt_vcpu_restore(hvt, fd) == -1)
+        errx(1, "snapshot: Could not restore VCPU state from %s", file);
+    /*
+     * Replaces the guest memory allocated by hvt_init(), which has only been
+     * touched by hvt_vcpu_init(). The files are opened read-only, so pages
+     * the guest writes to are private to this instance.
+     */
+    restore_mem(hvt, file, fd, &hdr, 0);
+    close(fd);
+    if (prefetch_file != NULL && !prefetch(hvt, prefetch_file, hdr.id)) {
+        prefetch_hvt = hvt;
+        prefetch_path = prefetch_file;
+        prefetch_snapshot_id = hdr.id;
+        atexit(prefetch_record);
+    }
+
+    if (snapshot_fd == -1)
+        return;
+    /*
+     * Taking a snapshot of a restored instance: only the pages written since
+     * it was restored need to be saved. Shared pages are registered again by
+     * the guest, and need not be tracked.
+     */
+    snapshot_base = realpath(file, NULL);
+    if (snapshot_base == NULL)
+        err(1, "snapshot: %s", file);
+    snapshot_base_id = hdr.id;
+    if (hvt_dirty_log_enable(hvt) == -1)
+        errx(1, "snapshot: Incremental snapshots are not supported on this "
+                "host");
+    hvt_dirty_track_enable(hvt);
+}
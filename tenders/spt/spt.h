@@ -29,9 +29,20 @@
 #include <inttypes.h>
 #include <err.h>
 
+#include "../common/affinity.h"
+#include "../common/boot_trace.h"
+#include "../common/cgroup.h"
 #include "../common/cc.h"
 #include "../common/elf.h"
+#include "../common/handoff.h"
+#include "../common/mem.h"
+#include "../common/metrics.h"
 #include "../common/mft.h"
+#include "../common/perf_map.h"
+#include "../common/resctrl.h"
+#include "../common/rt.h"
+#include "../common/rate_limit.h"
+#include "../common/sdt.h"
 #include "spt_abi.h"
 
 struct spt {
@@ -40,16 +51,56 @@ struct spt {
     struct spt_boot_info *bi;
     int epollfd;
     int timerfd;
+    int epoll_pwait2_nr;        /* System call number of epoll_pwait2() if
+                                   usable by the guest, else -1 */
     void *sc_ctx;
+    struct spt_block_uring *block_uring;
+                                /* Set up by the block module, or NULL */
+    struct spt_block_uring *net_uring;
+                                /* Set up by the net module, or NULL */
+    const uint8_t **block_map;  /* Set up by the block module, or NULL */
+    uint8_t **block_ram;        /* Set up by the block module, or NULL */
+    struct spt_net_packet *net_packet;
+                                /* Set up by the net module, or NULL */
+    struct spt_io_thread *io_thread;
+                                /* Set up by the net module, or NULL */
+    size_t io_thread_size;
+    unsigned cpus;              /* Number of CPUs (--cpus), including CPU 0 */
+    struct spt_cpu *cpu;        /* Secondary CPU state in guest memory, or
+                                   NULL */
+    struct spt_zygote *zygote;  /* Set up by spt_zygote_init(), or NULL */
 };
 
-struct spt *spt_init(size_t mem_size);
+/*
+ * (mem_flags) are the MEM_* guest memory options from mem.h.
+ */
+struct spt *spt_init(size_t mem_size, unsigned mem_flags);
 
 void spt_boot_info_init(struct spt *spt, uint64_t p_end, int cmdline_argc,
 	char **cmdline_argv, struct mft *mft, size_t mft_size);
 
 void spt_run(struct spt *spt, uint64_t p_entry);
 
+/*
+ * I/O thread (--io-thread), performing network I/O on behalf of the guest.
+ * spt_io_thread_init() is called by the net module during setup, and
+ * spt_io_thread_start() by spt_run() before the guest's seccomp policy is
+ * applied, as the thread applies its own. The thread enforces the rate limits
+ * (rx) and (tx), indexed by manifest entry.
+ */
+void spt_io_thread_init(struct spt *spt, struct mft *mft,
+        const struct rate_limit *rx, const struct rate_limit *tx);
+void spt_io_thread_start(struct spt *spt);
+
+/*
+ * Fork server (--zygote=PATH), see spt_zygote.c. spt_zygote_enabled() may be
+ * called once the command line has been parsed, and spt_zygote_init() is
+ * called once modules have been set up.
+ */
+int spt_zygote_handle_cmdarg(const char *cmdarg);
+bool spt_zygote_enabled(void);
+void spt_zygote_init(struct spt *spt, struct mft *mft);
+
 /*
  * Operations provided by a module. (setup) is required, all other functions
  * are optional.
@@ -25,7 +25,11 @@
 #define _GNU_SOURCE
 #include <assert.h>
 #include <err.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <libgen.h>
+#include <pthread.h>
+#include <sched.h>
 #include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -34,13 +38,19 @@
 #include <string.h>
 #include <sys/mman.h>
 #include <time.h>
+#include <unistd.h>
 #include <seccomp.h>
+#include <linux/futex.h>
 #include <sys/personality.h>
+#include <sys/syscall.h>
 #include <sys/epoll.h>
 #include <sys/timerfd.h>
 
 #if defined(__x86_64__)
 #include <asm/prctl.h>
+#include <cpuid.h>
+#include <sys/auxv.h>
+#include <x86intrin.h>
 #endif
 
 #include "spt.h"
@@ -58,8 +68,52 @@ extern long __executable_start;
 
 static bool use_exec_heap = false;
 
-struct spt *spt_init(size_t mem_size)
+/*
+ * Busy-poll budget for solo5_yield() (--poll-us=N), 0 if disabled.
+ */
+#define SPT_POLL_US_MAX 100000
+static uint64_t poll_nsecs;
+
+/*
+ * Number of CPUs (--cpus=N), including CPU 0.
+ */
+static unsigned cpus = 1;
+
+/*
+ * Returns the system call number of epoll_pwait2() if both the host kernel
+ * and libseccomp support it, allowing the guest to wait with a nanosecond
+ * timeout without arming the internal timerfd, or -1 otherwise.
+ */
+#if !defined(SYS_epoll_pwait2)
+#define SYS_epoll_pwait2 441
+#endif
+static int epoll_pwait2_nr(int epollfd)
 {
+    struct epoll_event ev;
+    struct timespec ts = { 0 };
+
+    if (syscall(SYS_epoll_pwait2, epollfd, &ev, 1, &ts, NULL, 0) == -1 &&
+            errno == ENOSYS)
+        return -1;
+    int nr = seccomp_syscall_resolve_name("epoll_pwait2");
+    return (nr == __NR_SCMP_ERROR) ? -1 : nr;
+}
+
+struct spt *spt_init(size_t mem_size, unsigned mem_flags)
+{
+    /*
+     * Guest memory is only shared with vhost-user backends, which spt does
+     * not support.
+     */
+    if (mem_flags & MEM_SHARED)
+        errx(1, "--mem-shared is not supported by spt");
+    /*
+     * The guest exits the tender process directly, so there is no point at
+     * which to report.
+     */
+    if (mem_flags & MEM_REPORT)
+        errx(1, "--mem-report is not supported by spt");
+
     struct spt *spt = malloc(sizeof (struct spt));
     if (spt == NULL)
         err(1, "malloc");
@@ -120,11 +174,24 @@ struct spt *spt_init(size_t mem_size)
      * size appropriately.
      */
     int prot = PROT_READ | PROT_WRITE | (use_exec_heap ? PROT_EXEC : 0);
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | mem_mmap_flags(mem_flags);
     spt->mem = mmap((void *)SPT_HOST_MEM_BASE, mem_size - SPT_HOST_MEM_BASE,
-            prot, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+            prot, flags | MAP_FIXED, -1, 0);
     if (spt->mem == MAP_FAILED)
         err(1, "Error allocating guest memory");
     assert(spt->mem == (void *)SPT_HOST_MEM_BASE);
+    if ((mem_flags & MEM_HUGEPAGES) && mem_hugepages(spt->mem,
+                mem_size - SPT_HOST_MEM_BASE, prot, flags) == -1)
+        warnx("Huge pages are not supported by the host, not using them");
+    if ((mem_flags & MEM_MERGEABLE) && mem_mergeable(spt->mem,
+                mem_size - SPT_HOST_MEM_BASE) == -1)
+        warnx("Page merging is not supported by the host, not using it");
+    affinity_bind_mem(spt->mem, mem_size - SPT_HOST_MEM_BASE);
+    if (mem_flags & (MEM_PREFAULT | MEM_LOCK))
+        mem_prefault(spt->mem, mem_size - SPT_HOST_MEM_BASE);
+    if ((mem_flags & MEM_LOCK) &&
+            mem_lock(spt->mem, mem_size - SPT_HOST_MEM_BASE) == -1)
+        err(1, "Could not lock guest memory (RLIMIT_MEMLOCK may be too low)");
     spt->mem -= SPT_HOST_MEM_BASE;
     spt->mem_size = mem_size;
 
@@ -139,9 +206,19 @@ struct spt *spt_init(size_t mem_size)
     ev.data.u64 = SPT_INTERNAL_TIMERFD;
     if (epoll_ctl(spt->epollfd, EPOLL_CTL_ADD, spt->timerfd, &ev) == -1)
         err(1, "epoll_ctl(EPOLL_CTL_ADD) failed");
+    spt->epoll_pwait2_nr = epoll_pwait2_nr(spt->epollfd);
 
     spt->sc_ctx = seccomp_init(SCMP_ACT_KILL);
     assert(spt->sc_ctx != NULL);
+#if SCMP_VER_MAJOR > 2 || (SCMP_VER_MAJOR == 2 && SCMP_VER_MINOR >= 5)
+    /*
+     * Every guest system call runs the filter, so have libseccomp arrange it
+     * as a binary tree on system call number rather than a linear chain,
+     * which grows with the number of devices. Older kernels and libseccomp
+     * versions fall back to a chain ordered by priority (see spt_run()).
+     */
+    (void)seccomp_attr_set(spt->sc_ctx, SCMP_FLTATR_CTL_OPTIMIZE, 2);
+#endif
 
     return spt;
 }
@@ -165,6 +242,103 @@ static void setup_cmdline(uint8_t *cmdline, int argc, char **argv)
     }
 }
 
+#if defined(__x86_64__)
+#define READ_CPU_TICKS __rdtsc
+#elif defined(__aarch64__)
+static inline uint64_t READ_CPU_TICKS(void)
+{
+    uint64_t val;
+
+    __asm__ __volatile__("isb; mrs %0, cntvct_el0" : "=r" (val)::);
+    return val;
+}
+#endif
+
+/*
+ * Read CLOCK_MONOTONIC and the cycle counter as close together as possible,
+ * returning the time in nsecs and the counter in (*ticks).
+ */
+static uint64_t clock_pair(uint64_t *ticks)
+{
+    struct timespec ts;
+
+    uint64_t before = READ_CPU_TICKS();
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t after = READ_CPU_TICKS();
+    *ticks = before + (after - before) / 2;
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Returns the frequency of the cycle counter in Hz if it can be used by the
+ * guest as a monotonic clock, or 0 otherwise. On x86_64, the TSC must be
+ * invariant. Its frequency is taken from CPUID if enumerated, otherwise
+ * measured against CLOCK_MONOTONIC.
+ */
+static uint64_t tsc_frequency(void)
+{
+#if defined(__x86_64__)
+    unsigned eax, ebx, ecx, edx;
+
+    if (__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) == 0 ||
+            eax < 0x80000007)
+        return 0;
+    __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+    if (!(edx & (1U << 8)))
+        return 0;
+    if (__get_cpuid(0x15, &eax, &ebx, &ecx, &edx) != 0 && eax != 0 &&
+            ebx != 0 && ecx != 0)
+        return (uint64_t)ecx * ebx / eax;
+
+    uint64_t t0, t1, c0, c1;
+    struct timespec delay = { .tv_sec = 0, .tv_nsec = 10000000 };
+    t0 = clock_pair(&c0);
+    nanosleep(&delay, NULL);
+    t1 = clock_pair(&c1);
+    return (uint64_t)((c1 - c0) * 1000000000.0 / (t1 - t0));
+#elif defined(__aarch64__)
+    uint64_t freq;
+
+    __asm__ __volatile__("mrs %0, cntfrq_el0" : "=r" (freq)::);
+    return freq;
+#endif
+}
+
+/*
+ * Returns true if the host kernel has enabled the FSGSBASE instructions for
+ * user space (Linux 5.9 and later), in which case the guest can change its
+ * TLS base with WRFSBASE rather than with arch_prctl().
+ */
+static bool fsgsbase_enabled(void)
+{
+#if defined(__x86_64__)
+#ifndef HWCAP2_FSGSBASE
+#define HWCAP2_FSGSBASE (1 << 1)
+#endif
+    return (getauxval(AT_HWCAP2) & HWCAP2_FSGSBASE) != 0;
+#else
+    return false;
+#endif
+}
+
+/*
+ * Opens the scheduler statistics of the calling thread, from which the guest
+ * reads its steal time, and allows the guest to read them. Returns -1 if they
+ * are not available.
+ */
+static int schedstat_open(struct spt *spt)
+{
+    int fd = open("/proc/thread-self/schedstat", O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return -1;
+    int rc = seccomp_rule_add(spt->sc_ctx, SCMP_ACT_ALLOW, SCMP_SYS(pread64),
+            1, SCMP_A0(SCMP_CMP_EQ, fd));
+    if (rc != 0)
+        errx(1, "seccomp_rule_add(pread64, fd=%d) failed: %s", fd,
+                strerror(-rc));
+    return fd;
+}
+
 void spt_boot_info_init(struct spt *spt, uint64_t p_end, int cmdline_argc,
         char **cmdline_argv, struct mft *mft, size_t mft_size)
 {
@@ -177,6 +351,14 @@ void spt_boot_info_init(struct spt *spt, uint64_t p_end, int cmdline_argc,
     bi->kernel_end = p_end;
     bi->epollfd = spt->epollfd;
     bi->timerfd = spt->timerfd;
+    bi->epoll_pwait2 = spt->epoll_pwait2_nr != -1;
+    bi->poll_nsecs = poll_nsecs;
+    bi->boot_trace_start = boot_trace_enabled() ? boot_trace_start() : 0;
+    bi->tsc_freq = tsc_frequency();
+    if (bi->tsc_freq != 0)
+        bi->time_base = clock_pair(&bi->tsc_base);
+    bi->fsgsbase = fsgsbase_enabled();
+    spt->bi = bi;
 
     bi->mft = (void *)lowmem_pos;
     memcpy(spt->mem + lowmem_pos, mft, mft_size);
@@ -185,6 +367,91 @@ void spt_boot_info_init(struct spt *spt, uint64_t p_end, int cmdline_argc,
     bi->cmdline = (void *)lowmem_pos;
     setup_cmdline(spt->mem + lowmem_pos, cmdline_argc, cmdline_argv);
     lowmem_pos += SPT_CMDLINE_SIZE;
+
+    if (spt->block_uring != NULL) {
+        size_t size = mft->entries * sizeof (struct spt_block_uring);
+        bi->block_uring = (void *)lowmem_pos;
+        memcpy(spt->mem + lowmem_pos, spt->block_uring, size);
+        lowmem_pos += size;
+    }
+    else
+        bi->block_uring = NULL;
+
+    if (spt->net_uring != NULL) {
+        size_t size = mft->entries * sizeof (struct spt_block_uring);
+        bi->net_uring = (void *)lowmem_pos;
+        memcpy(spt->mem + lowmem_pos, spt->net_uring, size);
+        lowmem_pos += size;
+    }
+    else
+        bi->net_uring = NULL;
+
+    if (spt->net_packet != NULL) {
+        size_t size = mft->entries * sizeof (struct spt_net_packet);
+        bi->net_packet = (void *)lowmem_pos;
+        memcpy(spt->mem + lowmem_pos, spt->net_packet, size);
+        lowmem_pos += size;
+    }
+    else
+        bi->net_packet = NULL;
+
+    if (spt->io_thread != NULL) {
+        bi->io_thread = (void *)lowmem_pos;
+        memcpy(spt->mem + lowmem_pos, spt->io_thread, spt->io_thread_size);
+        lowmem_pos += spt->io_thread_size;
+    }
+    else
+        bi->io_thread = NULL;
+
+    if (spt->block_map != NULL) {
+        size_t size = mft->entries * sizeof (const uint8_t *);
+        bi->block_map = (void *)lowmem_pos;
+        memcpy(spt->mem + lowmem_pos, spt->block_map, size);
+        lowmem_pos += size;
+    }
+    else
+        bi->block_map = NULL;
+
+    if (spt->block_ram != NULL) {
+        size_t size = mft->entries * sizeof (uint8_t *);
+        bi->block_ram = (void *)lowmem_pos;
+        memcpy(spt->mem + lowmem_pos, spt->block_ram, size);
+        lowmem_pos += size;
+    }
+    else
+        bi->block_ram = NULL;
+
+    bi->cpus = spt->cpus;
+    if (spt->cpus > 1) {
+        lowmem_pos = (lowmem_pos + 63) & ~63ULL;
+        size_t size = spt->cpus * sizeof (struct spt_cpu);
+        bi->cpu = (void *)lowmem_pos;
+        spt->cpu = (struct spt_cpu *)(spt->mem + lowmem_pos);
+        memset(spt->cpu, 0, size);
+        lowmem_pos += size;
+        /*
+         * This thread runs CPU 0, so the descriptors opened here for the
+         * other CPUs are replaced by their own threads, see cpu_thread().
+         */
+        for (unsigned i = 1; i < spt->cpus; i++)
+            spt->cpu[i].schedstat_fd = schedstat_open(spt);
+    }
+    else
+        bi->cpu = NULL;
+    /*
+     * The statistics are those of the thread which opened them, so would not
+     * follow instances forked by --zygote.
+     */
+    bi->schedstat_fd = (spt->zygote == NULL) ? schedstat_open(spt) : -1;
+
+    if (spt->zygote != NULL) {
+        bi->zygote = (void *)lowmem_pos;
+        memcpy(spt->mem + lowmem_pos, spt->zygote,
+                sizeof (struct spt_zygote));
+        lowmem_pos += sizeof (struct spt_zygote);
+    }
+    else
+        bi->zygote = NULL;
 }
 
 /*
@@ -192,6 +459,138 @@ void spt_boot_info_init(struct spt *spt, uint64_t p_end, int cmdline_argc,
  */
 extern void spt_launch(uint64_t stack_start, void (*fn)(void *), void *arg);
 
+static void *cpu_sc_ctx;
+static int cpu_load_rc;         /* Result of seccomp_load(), 1 if pending */
+
+/*
+ * Thread running a secondary CPU. The guest's seccomp policy is applied
+ * before the thread waits to be started by the guest, after which it only
+ * runs guest code (see spt_abi.h).
+ */
+static void *cpu_thread(void *arg)
+{
+    struct spt_cpu *cpu = arg;
+
+    if (cpu->schedstat_fd != -1) {
+        int fd = open("/proc/thread-self/schedstat", O_RDONLY | O_CLOEXEC);
+        if (fd == -1 || dup3(fd, cpu->schedstat_fd, O_CLOEXEC) == -1)
+            err(1, "/proc/thread-self/schedstat");
+        close(fd);
+    }
+
+    rt_apply();
+    int rc = seccomp_load(cpu_sc_ctx);
+    __atomic_store_n(&cpu_load_rc, rc, __ATOMIC_RELEASE);
+    if (rc != 0)
+        return NULL;
+
+    while (__atomic_load_n(&cpu->state, __ATOMIC_ACQUIRE) == SPT_CPU_PARKED)
+        syscall(SYS_futex, &cpu->state, FUTEX_WAIT_PRIVATE, SPT_CPU_PARKED,
+                NULL, NULL, 0);
+
+    void (*entry)(void *) = cpu->entry;
+    void *entry_arg = cpu->arg;
+    uint64_t sp = cpu->stack;
+    /*
+     * Set the TLS base and initial stack alignment as for CPU 0, see
+     * spt_run(). The thread's libc TLS is unusable from here on.
+     */
+#if defined(__x86_64__)
+    syscall(SYS_arch_prctl, ARCH_SET_FS, cpu->tls_base);
+    sp -= 0x8;
+#elif defined(__aarch64__)
+    __asm__ __volatile__("msr tpidr_el0, %0" :: "r" (cpu->tls_base));
+#else
+#error Unsupported architecture
+#endif
+
+    spt_launch(sp, entry, entry_arg);
+
+    abort(); /* spt_launch() does not return */
+}
+
+/*
+ * Start a parked thread for each secondary CPU. Each thread applies the
+ * guest's seccomp policy itself, one at a time, as libseccomp does not
+ * guarantee that a filter context may be loaded concurrently.
+ */
+static void cpus_start(struct spt *spt)
+{
+    int rc;
+
+    for (unsigned i = 1; i < spt->cpus; i++) {
+        uint64_t state = (uint64_t)(uintptr_t)&spt->cpu[i].state;
+        rc = seccomp_rule_add(spt->sc_ctx, SCMP_ACT_ALLOW, SCMP_SYS(futex), 2,
+                SCMP_A0(SCMP_CMP_EQ, state),
+                SCMP_A1(SCMP_CMP_EQ, FUTEX_WAIT_PRIVATE));
+        if (rc != 0)
+            errx(1, "seccomp_rule_add(futex, FUTEX_WAIT_PRIVATE) failed: %s",
+                    strerror(-rc));
+        rc = seccomp_rule_add(spt->sc_ctx, SCMP_ACT_ALLOW, SCMP_SYS(futex), 2,
+                SCMP_A0(SCMP_CMP_EQ, state),
+                SCMP_A1(SCMP_CMP_EQ, FUTEX_WAKE_PRIVATE));
+        if (rc != 0)
+            errx(1, "seccomp_rule_add(futex, FUTEX_WAKE_PRIVATE) failed: %s",
+                    strerror(-rc));
+    }
+
+    cpu_sc_ctx = spt->sc_ctx;
+    for (unsigned i = 1; i < spt->cpus; i++) {
+        pthread_t tid;
+
+        cpu_load_rc = 1;
+        if (pthread_create(&tid, NULL, cpu_thread, &spt->cpu[i]) != 0)
+            errx(1, "pthread_create() failed");
+        while ((rc = __atomic_load_n(&cpu_load_rc, __ATOMIC_ACQUIRE)) == 1)
+            sched_yield();
+        if (rc != 0)
+            errx(1, "seccomp_load() failed: %s", strerror(-rc));
+    }
+}
+
+static int metrics_load_rc = 1;  /* Result of seccomp_load(), 1 if pending */
+
+static void metrics_allow(void *ctx, int syscall, unsigned arg_cnt, int fd)
+{
+    int rc = (arg_cnt == 0) ?
+        seccomp_rule_add(ctx, SCMP_ACT_ALLOW, syscall, 0) :
+        seccomp_rule_add(ctx, SCMP_ACT_ALLOW, syscall, 1,
+                SCMP_A0(SCMP_CMP_EQ, fd));
+    if (rc != 0)
+        errx(1, "seccomp_rule_add(%d) failed: %s", syscall, strerror(-rc));
+}
+
+/*
+ * Applies a seccomp policy of its own to the --metrics thread, which shares
+ * the address space of the guest, before it serves any connection. Data is
+ * only moved with recvfrom() and sendto(), which fail on anything but a
+ * socket. The policy is not released, as free() may need other system calls.
+ */
+static void metrics_thread_init(int listenfd)
+{
+    void *ctx = seccomp_init(SCMP_ACT_KILL);
+    assert(ctx != NULL);
+
+    metrics_allow(ctx, SCMP_SYS(accept4), 1, listenfd);
+#if defined(__x86_64__)
+    metrics_allow(ctx, SCMP_SYS(poll), 0, -1);
+#endif
+    metrics_allow(ctx, SCMP_SYS(ppoll), 0, -1);
+    metrics_allow(ctx, SCMP_SYS(recvfrom), 0, -1);
+    metrics_allow(ctx, SCMP_SYS(sendto), 0, -1);
+    metrics_allow(ctx, SCMP_SYS(close), 0, -1);
+    metrics_allow(ctx, SCMP_SYS(getrusage), 0, -1);
+    metrics_allow(ctx, SCMP_SYS(mincore), 0, -1);
+    metrics_allow(ctx, SCMP_SYS(clock_gettime), 0, -1);
+    metrics_allow(ctx, SCMP_SYS(write), 1, 2);
+    metrics_allow(ctx, SCMP_SYS(exit_group), 0, -1);
+
+    int rc = seccomp_load(ctx);
+    __atomic_store_n(&metrics_load_rc, rc, __ATOMIC_RELEASE);
+    if (rc != 0)
+        pthread_exit(NULL);
+}
+
 void spt_run(struct spt *spt, uint64_t p_entry)
 {
     typedef void (*start_fn_t)(void *arg);
@@ -207,7 +606,38 @@ void spt_run(struct spt *spt, uint64_t p_entry)
 #error Unsupported architecture
 #endif
 
+    /*
+     * System calls made on every I/O operation or call to solo5_yield() are
+     * checked first.
+     */
+    const int hot_syscalls[] = {
+        SCMP_SYS(epoll_pwait), SCMP_SYS(timerfd_settime),
+        SCMP_SYS(clock_gettime), SCMP_SYS(read), SCMP_SYS(write),
+        SCMP_SYS(pread64), SCMP_SYS(pwrite64), SCMP_SYS(preadv),
+        SCMP_SYS(pwritev), SCMP_SYS(io_uring_enter)
+    };
+    for (size_t i = 0; i < sizeof hot_syscalls / sizeof hot_syscalls[0]; i++)
+        (void)seccomp_syscall_priority(spt->sc_ctx, hot_syscalls[i], 255);
+    if (spt->epoll_pwait2_nr != -1)
+        (void)seccomp_syscall_priority(spt->sc_ctx, spt->epoll_pwait2_nr, 255);
+
+    if (spt->io_thread != NULL)
+        spt_io_thread_start(spt);
+    if (spt->cpus > 1)
+        cpus_start(spt);
     int rc = -1;
+    /*
+     * As for secondary CPUs, wait for the --metrics thread to apply its
+     * policy before running any guest code.
+     */
+    if (metrics_enabled()) {
+        metrics_start(metrics_thread_init);
+        while ((rc = __atomic_load_n(&metrics_load_rc, __ATOMIC_ACQUIRE)) == 1)
+            sched_yield();
+        if (rc != 0)
+            errx(1, "seccomp_load() failed: %s", strerror(-rc));
+    }
+
     rc = seccomp_load(spt->sc_ctx);
     if (rc != 0)
         errx(1, "seccomp_load() failed: %s", strerror(-rc));
@@ -225,6 +655,22 @@ static int handle_cmdarg(char *cmdarg, struct mft *mft)
         use_exec_heap = true;
         return 0;
     }
+    if (!strncmp("--poll-us=", cmdarg, 10)) {
+        unsigned us;
+        int rc = sscanf(cmdarg, "--poll-us=%u", &us);
+        if (rc != 1 || us < 1 || us > SPT_POLL_US_MAX)
+            errx(1, "Malformed argument to --poll-us");
+        poll_nsecs = us * 1000ULL;
+        return 0;
+    }
+    if (!strncmp("--cpus=", cmdarg, 7)) {
+        unsigned n;
+        int rc = sscanf(cmdarg, "--cpus=%u", &n);
+        if (rc != 1 || n < 1 || n > SPT_CPUS_MAX)
+            errx(1, "Malformed argument to --cpus");
+        cpus = n;
+        return 0;
+    }
     return -1;
 }
 
@@ -239,10 +685,28 @@ static int setup(struct spt *spt, struct mft *mft)
     rc = seccomp_rule_add(spt->sc_ctx, SCMP_ACT_ALLOW, SCMP_SYS(exit_group), 0);
     if (rc != 0)
         errx(1, "seccomp_rule_add(exit_group) failed: %s", strerror(-rc));
+    /*
+     * Secondary CPUs stop when their entry point returns. The futex() calls
+     * used to start them are allowed by cpus_start(), once their location in
+     * guest memory is known.
+     */
+    spt->cpus = cpus;
+    if (cpus > 1) {
+        rc = seccomp_rule_add(spt->sc_ctx, SCMP_ACT_ALLOW, SCMP_SYS(exit), 0);
+        if (rc != 0)
+            errx(1, "seccomp_rule_add(exit) failed: %s", strerror(-rc));
+    }
     rc = seccomp_rule_add(spt->sc_ctx, SCMP_ACT_ALLOW, SCMP_SYS(epoll_pwait), 1,
             SCMP_A0(SCMP_CMP_EQ, spt->epollfd));
     if (rc != 0)
         errx(1, "seccomp_rule_add(epoll_pwait) failed: %s", strerror(-rc));
+    if (spt->epoll_pwait2_nr != -1) {
+        rc = seccomp_rule_add(spt->sc_ctx, SCMP_ACT_ALLOW,
+                spt->epoll_pwait2_nr, 1, SCMP_A0(SCMP_CMP_EQ, spt->epollfd));
+        if (rc != 0)
+            errx(1, "seccomp_rule_add(epoll_pwait2) failed: %s",
+                    strerror(-rc));
+    }
     rc = seccomp_rule_add(spt->sc_ctx, SCMP_ACT_ALLOW,
             SCMP_SYS(timerfd_settime), 1, SCMP_A0(SCMP_CMP_EQ, spt->timerfd));
     if (rc != 0)
@@ -257,6 +721,15 @@ static int setup(struct spt *spt, struct mft *mft)
     if (rc != 0)
         errx(1, "seccomp_rule_add(clock_gettime, CLOCK_REALTIME) failed: %s",
                 strerror(-rc));
+    /*
+     * solo5_mem_release() discards pages of guest memory.
+     */
+    rc = seccomp_rule_add(spt->sc_ctx, SCMP_ACT_ALLOW, SCMP_SYS(madvise), 2,
+            SCMP_A0(SCMP_CMP_GE, SPT_HOST_MEM_BASE),
+            SCMP_A2(SCMP_CMP_EQ, MADV_DONTNEED));
+    if (rc != 0)
+        errx(1, "seccomp_rule_add(madvise, MADV_DONTNEED) failed: %s",
+                strerror(-rc));
 #if defined(__x86_64__)
     rc = seccomp_rule_add(spt->sc_ctx, SCMP_ACT_ALLOW, SCMP_SYS(arch_prctl),
             1, SCMP_A0(SCMP_CMP_EQ, ARCH_SET_FS));
@@ -272,7 +745,10 @@ static char *usage(void)
 {
     return "--x-exec-heap (make the heap executable)."
            " WARNING: This option is dangerous and not recommended as it"
-           " makes the heap and stack executable.";
+           " makes the heap and stack executable.\n"
+           "    --poll-us=N (busy-poll devices for up to N microseconds"
+           " before blocking in solo5_yield())\n"
+           "    --cpus=N (number of CPUs, up to 64)";
 }
 
 DECLARE_MODULE(core,
@@ -0,0 +1,383 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * spt_io_thread.c: I/O thread (--io-thread).
+ *
+ * The thread reads packets from the attached network devices into the
+ * guest's receive rings, and writes packets queued by the guest on its
+ * transmit rings, so that the guest's I/O consists of memory operations on
+ * the rings (see spt_abi.h). The guest only enters the host to sleep, in
+ * solo5_yield(), and to wake the thread once it has gone to sleep itself.
+ *
+ * The thread is started before the guest's seccomp policy is applied, and
+ * applies its own, allowing only I/O on the network devices and on its
+ * eventfds. All shared state is written by the guest, and is treated as
+ * untrusted.
+ *
+ * Rate limits (--net-rate) are enforced by leaving packets on the transmit
+ * ring, which the guest sees as SOLO5_R_AGAIN once it is full, and on the
+ * device when receiving, until the limit allows them to be moved.
+ */
+
+#define _GNU_SOURCE
+#include <assert.h>
+#include <err.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <seccomp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "spt.h"
+
+static int epollfd;     /* Network devices and (kickfd) */
+static int kickfd;      /* Written by the guest to wake us */
+static int wakefd;      /* Written by us to wake the guest */
+static scmp_filter_ctx sc_ctx;
+static struct spt_io_thread *io;
+static uint64_t mem_size;
+
+/*
+ * Per-device state. Ring buffer locations are copied from the guest once it
+ * is ready, and validated.
+ */
+static struct {
+    int hostfd;
+    uint8_t *rx_buf, *tx_buf;
+    uint32_t rx_slot_size, tx_slot_size;
+    struct rate_limit rx_rate, tx_rate;
+    bool tx_limited;            /* Packets are queued but may not be sent */
+} devs[MFT_MAX_ENTRIES];
+static unsigned ndevs;
+static unsigned dev_index[MFT_MAX_ENTRIES];     /* Manifest entry of devs[] */
+static uint64_t rate_wait_nsecs;   /* Until the first limited device may go */
+
+static void allow(int syscall, int fd)
+{
+    int rc = seccomp_rule_add(sc_ctx, SCMP_ACT_ALLOW, syscall, 1,
+            SCMP_A0(SCMP_CMP_EQ, fd));
+    if (rc != 0)
+        errx(1, "seccomp_rule_add(%d, fd=%d) failed: %s", syscall, fd,
+                strerror(-rc));
+}
+
+void spt_io_thread_init(struct spt *spt, struct mft *mft,
+        const struct rate_limit *rx, const struct rate_limit *tx)
+{
+    epollfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epollfd == -1)
+        err(1, "epoll_create1() failed");
+    kickfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    wakefd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (kickfd == -1 || wakefd == -1)
+        err(1, "eventfd() failed");
+
+    sc_ctx = seccomp_init(SCMP_ACT_KILL);
+    assert(sc_ctx != NULL);
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u64 = MFT_MAX_ENTRIES;
+    if (epoll_ctl(epollfd, EPOLL_CTL_ADD, kickfd, &ev) == -1)
+        err(1, "epoll_ctl(EPOLL_CTL_ADD, kickfd=%d) failed", kickfd);
+    /*
+     * The guest determines readiness from its receive rings, so (wakefd) is
+     * never read and must be edge-triggered.
+     */
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.u64 = SPT_IO_THREAD_WAKE;
+    if (epoll_ctl(spt->epollfd, EPOLL_CTL_ADD, wakefd, &ev) == -1)
+        err(1, "epoll_ctl(EPOLL_CTL_ADD, wakefd=%d) failed", wakefd);
+
+    for (unsigned i = 0; i != mft->entries; i++) {
+        if (mft->e[i].type != MFT_NET_BASIC || !mft->e[i].attached)
+            continue;
+        /*
+         * Devices are edge-triggered, as receiving stops while the guest's
+         * receive ring is full; the guest wakes us once it has made space.
+         */
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.u64 = i;
+        if (epoll_ctl(epollfd, EPOLL_CTL_ADD, mft->e[i].hostfd, &ev) == -1)
+            err(1, "epoll_ctl(EPOLL_CTL_ADD, hostfd=%d) failed",
+                    mft->e[i].hostfd);
+        allow(SCMP_SYS(read), mft->e[i].hostfd);
+        allow(SCMP_SYS(write), mft->e[i].hostfd);
+        devs[ndevs].hostfd = mft->e[i].hostfd;
+        devs[ndevs].rx_rate = rx[i];
+        devs[ndevs].tx_rate = tx[i];
+        dev_index[ndevs] = i;
+        ndevs++;
+    }
+    allow(SCMP_SYS(read), kickfd);
+    allow(SCMP_SYS(write), wakefd);
+#if defined(__x86_64__)
+    allow(SCMP_SYS(epoll_wait), epollfd);
+#endif
+    allow(SCMP_SYS(epoll_pwait), epollfd);
+    allow(SCMP_SYS(write), 2);
+    int rc = seccomp_rule_add(sc_ctx, SCMP_ACT_ALLOW, SCMP_SYS(exit_group), 0);
+    if (rc != 0)
+        errx(1, "seccomp_rule_add(exit_group) failed: %s", strerror(-rc));
+    /*
+     * Should the vDSO not be usable, rate limiting and receive timestamps
+     * need the clock.
+     */
+    rc = seccomp_rule_add(sc_ctx, SCMP_ACT_ALLOW, SCMP_SYS(clock_gettime), 0);
+    if (rc != 0)
+        errx(1, "seccomp_rule_add(clock_gettime) failed: %s", strerror(-rc));
+
+    /*
+     * The guest may wake us with (kickfd).
+     */
+    rc = seccomp_rule_add(spt->sc_ctx, SCMP_ACT_ALLOW, SCMP_SYS(write), 1,
+            SCMP_A0(SCMP_CMP_EQ, kickfd));
+    if (rc != 0)
+        errx(1, "seccomp_rule_add(write, fd=%d) failed: %s", kickfd,
+                strerror(-rc));
+
+    spt->io_thread_size = sizeof (struct spt_io_thread) +
+        mft->entries * sizeof spt->io_thread->net[0];
+    spt->io_thread = calloc(1, spt->io_thread_size);
+    if (spt->io_thread == NULL)
+        err(1, "calloc");
+    spt->io_thread->kickfd = kickfd;
+}
+
+/*
+ * Returns true if (ring)'s buffers, as set up by the guest, lie within guest
+ * memory.
+ */
+static bool ring_valid(struct spt_io_ring *ring, uint8_t **buf,
+        uint32_t *slot_size)
+{
+    uint64_t start = (uint64_t)(uintptr_t)ring->buf;
+    uint64_t size = (uint64_t)ring->slot_size * SPT_IO_RING_SLOTS;
+
+    if (ring->slot_size == 0 || start < SPT_HOST_MEM_BASE ||
+            size > mem_size || start > mem_size - size)
+        return false;
+    *buf = ring->buf;
+    *slot_size = ring->slot_size;
+    return true;
+}
+
+static void wait_ready(void)
+{
+    struct epoll_event revents[MFT_MAX_ENTRIES + 1];
+    uint64_t n;
+
+    while (!__atomic_load_n(&io->ready, __ATOMIC_ACQUIRE)) {
+        if (epoll_wait(epollfd, revents, MFT_MAX_ENTRIES + 1, -1) == -1 &&
+                errno != EINTR)
+            err(1, "epoll_wait() failed");
+        (void)read(kickfd, &n, sizeof n);
+    }
+    for (unsigned d = 0; d < ndevs; d++) {
+        unsigned i = dev_index[d];
+        if (!ring_valid(&io->net[i].rx, &devs[d].rx_buf,
+                    &devs[d].rx_slot_size) ||
+                !ring_valid(&io->net[i].tx, &devs[d].tx_buf,
+                    &devs[d].tx_slot_size))
+            errx(1, "Guest set up invalid I/O rings");
+    }
+}
+
+/*
+ * Returns true if (rl) does not allow a packet now, lowering
+ * (rate_wait_nsecs) to the time until it does.
+ */
+static bool rate_limited(const struct rate_limit *rl)
+{
+    if (!rate_limit_enabled(rl))
+        return false;
+    uint64_t wait = rate_limit_wait(rl, rate_limit_clock());
+    if (wait != 0 && wait < rate_wait_nsecs)
+        rate_wait_nsecs = wait;
+    return wait != 0;
+}
+
+static void rate_charge(struct rate_limit *rl, size_t bytes)
+{
+    if (rate_limit_enabled(rl))
+        rate_limit_charge(rl, rate_limit_clock(), bytes);
+}
+
+/*
+ * Write out all packets queued on the transmit ring of device (d), as far as
+ * its rate limit allows. Packets which cannot be written are dropped, as for
+ * solo5_net_write().
+ */
+static void do_tx(unsigned d)
+{
+    struct spt_io_ring *ring = &io->net[dev_index[d]].tx;
+    uint32_t pos = ring_cons_pos(&ring->idx);
+    uint32_t avail = ring_cons_avail(&ring->idx);
+    uint32_t n;
+
+    devs[d].tx_limited = false;
+    if (avail == 0 || avail > SPT_IO_RING_SLOTS)
+        return;
+    for (n = 0; n < avail; n++) {
+        if (rate_limited(&devs[d].tx_rate)) {
+            devs[d].tx_limited = true;
+            break;
+        }
+        uint32_t slot = ring_slot(pos + n, SPT_IO_RING_SLOTS);
+        uint32_t len = ring->len[slot];
+        if (len > devs[d].tx_slot_size)
+            len = devs[d].tx_slot_size;
+        ssize_t nbytes = write(devs[d].hostfd,
+                devs[d].tx_buf + (size_t)slot * devs[d].tx_slot_size, len);
+        TENDER_PROBE3(net__write, dev_index[d], len, nbytes);
+        (void)nbytes;
+        rate_charge(&devs[d].tx_rate, len);
+    }
+    ring_cons_release(&ring->idx, n);
+}
+
+/*
+ * Read packets from device (d) into its receive ring, until the device has
+ * none, the ring is full or its rate limit is reached. Returns true if any
+ * were read.
+ */
+static bool do_rx(unsigned d)
+{
+    struct spt_io_ring *ring = &io->net[dev_index[d]].rx;
+    bool any = false;
+
+    for (;;) {
+        if (ring_prod_free(&ring->idx, SPT_IO_RING_SLOTS) == 0) {
+            /*
+             * Ring is full (or corrupt). Ask the guest to wake us once it
+             * has made space, re-checking in case it already has.
+             */
+            __atomic_store_n(&ring->waiting, 1, __ATOMIC_SEQ_CST);
+            ring_fence();
+            if (ring_prod_free(&ring->idx, SPT_IO_RING_SLOTS) != 0)
+                continue;
+            break;
+        }
+        if (rate_limited(&devs[d].rx_rate))
+            break;
+        uint32_t slot = ring_slot(ring_prod_pos(&ring->idx),
+                SPT_IO_RING_SLOTS);
+        ssize_t nbytes = read(devs[d].hostfd,
+                devs[d].rx_buf + (size_t)slot * devs[d].rx_slot_size,
+                devs[d].rx_slot_size);
+        TENDER_PROBE3(net__read, dev_index[d], devs[d].rx_slot_size, nbytes);
+        if (nbytes < 0)
+            break;
+        ring->len[slot] = (uint32_t)nbytes;
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ring->tstamp[slot] = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+        rate_charge(&devs[d].rx_rate, nbytes);
+        ring_prod_publish(&ring->idx, 1);
+        any = true;
+    }
+    return any;
+}
+
+/*
+ * Returns true if packets are queued for devices which may send them.
+ */
+static bool tx_pending(void)
+{
+    for (unsigned d = 0; d < ndevs; d++) {
+        struct spt_io_ring *ring = &io->net[dev_index[d]].tx;
+        if (devs[d].tx_limited)
+            continue;
+        if (ring_cons_avail(&ring->idx) != 0)
+            return true;
+    }
+    return false;
+}
+
+static void *io_thread_main(void *arg)
+{
+    (void)arg;
+    struct epoll_event revents[MFT_MAX_ENTRIES + 1];
+    uint64_t one = 1, n;
+
+    int rc = seccomp_load(sc_ctx);
+    if (rc != 0)
+        errx(1, "seccomp_load() failed: %s", strerror(-rc));
+    wait_ready();
+    for (;;) {
+        bool woken = false;
+
+        rate_wait_nsecs = UINT64_MAX;
+        for (unsigned d = 0; d < ndevs; d++) {
+            do_tx(d);
+            if (do_rx(d))
+                woken = true;
+        }
+        if (woken)
+            (void)write(wakefd, &one, sizeof one);
+
+        /*
+         * Having set (idle), check for packets queued by the guest which it
+         * may have seen us as busy for, before going to sleep.
+         */
+        __atomic_store_n(&io->idle, 1, __ATOMIC_SEQ_CST);
+        ring_fence();
+        if (tx_pending()) {
+            __atomic_store_n(&io->idle, 0, __ATOMIC_SEQ_CST);
+            continue;
+        }
+        /*
+         * Devices held back by their rate limit are retried once the first
+         * of them may proceed, regardless of events.
+         */
+        int timeout_ms = -1;
+        if (rate_wait_nsecs != UINT64_MAX)
+            timeout_ms = (rate_wait_nsecs + 999999) / 1000000;
+        if (epoll_wait(epollfd, revents, MFT_MAX_ENTRIES + 1, timeout_ms)
+                == -1 && errno != EINTR)
+            err(1, "epoll_wait() failed");
+        __atomic_store_n(&io->idle, 0, __ATOMIC_SEQ_CST);
+        (void)read(kickfd, &n, sizeof n);
+    }
+    return NULL;
+}
+
+void spt_io_thread_start(struct spt *spt)
+{
+    pthread_t tid;
+
+    io = spt->bi->io_thread;
+    io = (struct spt_io_thread *)(spt->mem + (uintptr_t)io);
+    mem_size = spt->mem_size;
+
+    /*
+     * The thread is created before the guest's seccomp policy is applied, so
+     * does not inherit it, and applies its own before doing anything else.
+     */
+    if (pthread_create(&tid, NULL, io_thread_main, NULL) != 0)
+        errx(1, "pthread_create() failed");
+}
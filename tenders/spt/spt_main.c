@@ -49,6 +49,7 @@ static void setup_modules(struct spt *spt, struct mft *mft)
             }
             exit(1);
         }
+        boot_trace("setup (%s)", m->name);
     }
 
     bool fail = false;
@@ -95,6 +96,39 @@ static void usage(const char *prog)
     fprintf(stderr, "ARGS are optional arguments passed to the unikernel.\n");
     fprintf(stderr, "Core options:\n");
     fprintf(stderr, "  [ --mem=512 ] (guest memory in MB)\n");
+    fprintf(stderr, "  [ --mem-hugepages ] (back guest memory with huge "
+            "pages)\n");
+    fprintf(stderr, "  [ --mem-prefault | --mem-lazy ] (populate guest memory "
+            "up front, or do not reserve it)\n");
+    fprintf(stderr, "  [ --mem-mergeable ] (allow the host to merge identical "
+            "pages of guest memory)\n");
+    fprintf(stderr, "  [ --mem-lock ] (populate guest memory up front and "
+            "lock it into host memory)\n");
+    fprintf(stderr, "  [ --cpu=LIST ] (run only on the host CPUs in LIST, "
+            "e.g. 0-3,8)\n");
+    fprintf(stderr, "  [ --numa-node=N ] (place guest memory and, without "
+            "--cpu, threads on host NUMA node N)\n");
+#if defined(__linux__)
+    fprintf(stderr, "  [ --cgroup=PATH ] (run in cgroup v2 PATH, with memory "
+            "limits derived from --mem)\n");
+    fprintf(stderr, "  [ --cpu-quota=PCT ] (limit the cgroup to PCT%% of one "
+            "host CPU)\n");
+    fprintf(stderr, "  [ --cache-class=NAME ] (run in resctrl group NAME, for "
+            "its share of cache and memory bandwidth)\n");
+    fprintf(stderr, "  [ --rt-priority=N[,rr][,budget=MS] ] (run VCPUs with "
+            "SCHED_FIFO, or SCHED_RR, priority N, killing the tender if one "
+            "runs for MS, default 1000, without blocking)\n");
+#endif
+    fprintf(stderr, "  [ --trace-boot ] (report the time taken by each "
+            "startup phase)\n");
+    fprintf(stderr, "  [ --perf-map[=FILE] ] (write guest symbols for perf "
+            "to FILE, default /tmp/perf-PID.map)\n");
+    fprintf(stderr, "  [ --metrics=PATH ] (serve counters in Prometheus text "
+            "format on the UNIX socket PATH)\n");
+    fprintf(stderr, "  [ --fds-from=PATH ] (attach devices passed by a "
+            "launcher on the UNIX socket PATH)\n");
+    fprintf(stderr, "  [ --zygote=PATH ] (fork an instance at solo5_snapshot() "
+            "for each launcher on the UNIX socket PATH)\n");
     fprintf(stderr, "    --help (display this help)\n");
     fprintf(stderr, "Compiled-in modules: ");
     for (struct spt_module *m = &__start_modules; m < &__stop_modules; m++) {
@@ -118,11 +152,13 @@ static void usage(const char *prog)
 int main(int argc, char **argv)
 {
     size_t mem_size = 0x20000000;
+    unsigned mem_flags = 0;
     uint64_t p_entry, p_end;
     const char *prog;
     const char *elffile;
     int matched;
 
+    boot_trace_init();
     prog = basename(*argv);
     argc--;
     argv++;
@@ -162,10 +198,12 @@ int main(int argc, char **argv)
     struct mft *mft;
     size_t mft_size;
     elf_load_mft(elffile, &mft, &mft_size);
+    boot_trace("elf_load_mft");
     if (mft_validate(mft, mft_size) == -1) {
         free(mft);
         errx(1, "%s: Solo5 manifest is invalid", elffile);
     }
+    boot_trace("mft_validate");
 
     /*
      * Scan command line arguments in a 2nd pass, and pass options through to
@@ -186,6 +224,56 @@ int main(int argc, char **argv)
             argc--;
             argv++;
         }
+        if (mem_handle_cmdarg(*argv, &mem_flags) == 0) {
+            matched = 1;
+            argc--;
+            argv++;
+        }
+        if (affinity_handle_cmdarg(*argv) == 0) {
+            matched = 1;
+            argc--;
+            argv++;
+        }
+        if (cgroup_handle_cmdarg(*argv) == 0) {
+            matched = 1;
+            argc--;
+            argv++;
+        }
+        if (resctrl_handle_cmdarg(*argv) == 0) {
+            matched = 1;
+            argc--;
+            argv++;
+        }
+        if (rt_handle_cmdarg(*argv) == 0) {
+            matched = 1;
+            argc--;
+            argv++;
+        }
+        if (boot_trace_handle_cmdarg(*argv) == 0) {
+            matched = 1;
+            argc--;
+            argv++;
+        }
+        if (perf_map_handle_cmdarg(*argv) == 0) {
+            matched = 1;
+            argc--;
+            argv++;
+        }
+        if (metrics_handle_cmdarg(*argv) == 0) {
+            matched = 1;
+            argc--;
+            argv++;
+        }
+        if (handoff_handle_cmdarg(*argv) == 0) {
+            matched = 1;
+            argc--;
+            argv++;
+        }
+        if (spt_zygote_handle_cmdarg(*argv) == 0) {
+            matched = 1;
+            argc--;
+            argv++;
+        }
         if (handle_cmdarg(*argv, mft) == 0) {
             /* Handled by module, consume and go on to next arg */
             matched = 1;
@@ -201,18 +289,52 @@ int main(int argc, char **argv)
     argc--;
     argv++;
 
+    char **handoff_args;
+    int n_handoff_args = handoff_receive(&handoff_args);
+    for (int i = 0; i < n_handoff_args; i++) {
+        if (handle_cmdarg(handoff_args[i], mft) != 0)
+            errx(1, "Invalid option from launcher: `%s'", handoff_args[i]);
+    }
+
     /*
      * TODO, maybe: No signal handlers, since that would mean adding more to the
      * seccomp policy.
      */
 
-    struct spt *spt = spt_init(mem_size);
+    /*
+     * Instances forked by the zygote inherit neither memory locks nor
+     * real-time scheduling.
+     */
+    if (spt_zygote_enabled() && (rt_enabled() || (mem_flags & MEM_LOCK)))
+        errx(1, "--rt-priority and --mem-lock cannot be used with --zygote");
+    cgroup_apply(mem_size);
+    resctrl_apply();
+    affinity_apply();
+    struct spt *spt = spt_init(mem_size, mem_flags);
+    boot_trace("spt_init");
 
-    elf_load(elffile, spt->mem, spt->mem_size, &p_entry, &p_end);
+    /*
+     * Guest memory is ordinary process memory, so the unikernel can be mapped
+     * from its file, unless guest memory has been populated up front.
+     */
+    elf_load(elffile, spt->mem, spt->mem_size,
+            !(mem_flags & (MEM_HUGEPAGES | MEM_PREFAULT | MEM_LOCK)), &p_entry,
+            &p_end);
+    boot_trace("elf_load");
+    perf_map_write(elffile, (uintptr_t)spt->mem, PERF_MAP_PROCESS);
 
     setup_modules(spt, mft);
+    metrics_init(elffile, mft, spt->mem, spt->mem_size);
+    spt_zygote_init(spt, mft);
 
     spt_boot_info_init(spt, p_end, argc, argv, mft, mft_size);
+    boot_trace("spt_boot_info_init");
 
+    /*
+     * The tender does not regain control once the guest is running, so the
+     * guest reports when it reaches solo5_app_main() itself.
+     */
+    boot_trace_report();
+    rt_apply();
     spt_run(spt, p_entry);
 }
@@ -26,39 +26,174 @@
 #define _FILE_OFFSET_BITS 64
 #include <assert.h>
 #include <err.h>
+#include <fcntl.h>
 #include <limits.h>
+#include <signal.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <seccomp.h>
+#include <linux/blkzoned.h>
 
 #include "../common/block_attach.h"
+#include "../common/block_cow.h"
+#include "../common/block_nbd.h"
+#include "../common/block_stripe.h"
+#include "../common/block_ram.h"
+#include "../common/block_uring.h"
+#include "../common/block_zone.h"
 #include "spt.h"
+#include "solo5.h"
 
 static bool module_in_use;
+static struct block_uring urings[MFT_MAX_ENTRIES];
 
-static int handle_cmdarg(char *cmdarg, struct mft *mft)
+/*
+ * Contents of RAM-backed devices (--block:NAME=ram:SIZE), mapped writable
+ * into the address space shared with the guest, which reads and writes them
+ * directly with memcpy().
+ */
+static uint8_t *block_rams[MFT_MAX_ENTRIES];
+
+/*
+ * The guest performs block I/O itself, from its own threads, so the host I/O
+ * priority given with --block-prio is that of the whole tender, and must be
+ * the same for all devices. It is set by setup(), before any other threads
+ * are created, which inherit it. Requests the guest submits to io_uring
+ * carry no priority of their own, and so take that of the submitting thread.
+ */
+static int block_ioprio = BLOCK_IOPRIO_NONE;
+
+static int handle_prio_cmdarg(char *cmdarg, struct mft *mft)
 {
-    if (strncmp("--block:", cmdarg, 8) != 0)
+    char name[MFT_NAME_SIZE];
+    int n = -1, ioprio;
+
+    int rc = sscanf(cmdarg,
+            "--block-prio:%" XSTR(MFT_NAME_MAX) "[A-Za-z0-9]=%n", name, &n);
+    if (rc != 1 || n == -1)
+        return -1;
+    if (mft_get_by_name(mft, name, MFT_BLOCK_BASIC, NULL) == NULL) {
+        warnx("Resource not declared in manifest: '%s'", name);
         return -1;
+    }
+    if (!block_parse_ioprio(cmdarg + n, &ioprio))
+        return -1;
+    if (block_ioprio != BLOCK_IOPRIO_NONE && ioprio != block_ioprio) {
+        warnx("All block devices must have the same I/O priority on spt");
+        return -1;
+    }
+    block_ioprio = ioprio;
+    return 0;
+}
 
+static int handle_cmdarg(char *cmdarg, struct mft *mft)
+{
     char name[MFT_NAME_SIZE];
     char path[PATH_MAX + 1];
-    int rc = sscanf(cmdarg,
-            "--block:%" XSTR(MFT_NAME_MAX) "[A-Za-z0-9]="
-            "%" XSTR(PATH_MAX) "s", name, path);
+    bool direct = false, map = false;
+    int rc;
+
+    if (strncmp("--block-prio:", cmdarg, 13) == 0)
+        return handle_prio_cmdarg(cmdarg, mft);
+    else if (strncmp("--block:", cmdarg, 8) == 0) {
+        rc = sscanf(cmdarg,
+                "--block:%" XSTR(MFT_NAME_MAX) "[A-Za-z0-9]="
+                "%" XSTR(PATH_MAX) "s", name, path);
+    }
+    else if (strncmp("--block-direct:", cmdarg, 15) == 0) {
+        direct = true;
+        rc = sscanf(cmdarg,
+                "--block-direct:%" XSTR(MFT_NAME_MAX) "[A-Za-z0-9]="
+                "%" XSTR(PATH_MAX) "s", name, path);
+    }
+    else if (strncmp("--block-map:", cmdarg, 12) == 0) {
+        map = true;
+        rc = sscanf(cmdarg,
+                "--block-map:%" XSTR(MFT_NAME_MAX) "[A-Za-z0-9]="
+                "%" XSTR(PATH_MAX) "s", name, path);
+    }
+    else
+        return -1;
     if (rc != 2)
         return -1;
-    struct mft_entry *e = mft_get_by_name(mft, name, MFT_BLOCK_BASIC, NULL);
+    unsigned bs;
+    if (!block_parse_opts(path, &bs)) {
+        warnx("Invalid block device options: '%s'", cmdarg);
+        return -1;
+    }
+    unsigned index;
+    struct mft_entry *e = mft_get_by_name(mft, name, MFT_BLOCK_BASIC, &index);
     if (e == NULL) {
         warnx("Resource not declared in manifest: '%s'", name);
         return -1;
     }
 
+    /*
+     * The guest performs I/O on (hostfd) itself, so overlays, NBD exports and
+     * striped devices, which need the tender to direct each request, are not
+     * supported.
+     */
+    char *overlay;
+    if (block_cow_path(path, &overlay)) {
+        warnx("Overlays are not supported on spt: '%s'", cmdarg);
+        return -1;
+    }
+    if (block_nbd_is_spec(path)) {
+        warnx("NBD exports are not supported on spt: '%s'", cmdarg);
+        return -1;
+    }
+    if (block_stripe_is_spec(path)) {
+        warnx("Striped devices are not supported on spt: '%s'", cmdarg);
+        return -1;
+    }
+
+    /*
+     * The block size required by the manifest is the default, and direct I/O
+     * is used if preferred by the manifest and possible.
+     */
+    if (bs == BLOCK_SIZE_DEFAULT)
+        bs = e->attrs.block.block_size;
+    bool ram = block_ram_is_spec(path);
+    if (!ram && !map && (e->attrs.block.flags & MFT_BLOCK_ATTR_DIRECT))
+        direct = true;
+
     off_t capacity;
-    int fd = block_attach(path, &capacity);
+    uint16_t block_size;
+    int fd;
+    if (ram) {
+        if (direct || map) {
+            warnx("RAM block devices can only be attached with --block: "
+                    "'%s'", cmdarg);
+            return -1;
+        }
+        bool huge;
+        fd = block_ram_attach(path, bs, &capacity, &block_size,
+                &block_rams[index], &huge);
+    }
+    else
+        fd = block_attach(path, (direct ? BLOCK_ATTACH_DIRECT : 0) |
+                (map ? BLOCK_ATTACH_RDONLY : 0), bs, &capacity, &block_size);
+    /*
+     * Writes to a sequential zone must reach the device in order, which
+     * writeback from the host page cache does not guarantee.
+     */
+    uint64_t zone_size = ram ? 0 : block_zone_size(fd);
+    if (zone_size != 0 && !direct) {
+        warnx("Zoned block devices can only be attached with --block-direct:"
+                " '%s'", cmdarg);
+        return -1;
+    }
+    e->u.block_basic.zone_blocks = zone_size / block_size;
     e->u.block_basic.capacity = capacity;
-    e->u.block_basic.block_size = 512;
+    e->u.block_basic.block_size = block_size;
+    e->u.block_basic.flags = (direct ? MFT_BLOCK_DIRECT : 0) |
+        (map ? MFT_BLOCK_MAPPED : 0) | (ram ? MFT_BLOCK_RAM : 0);
     e->hostfd = fd;
     e->attached = true;
     module_in_use = true;
@@ -66,53 +201,263 @@ static int handle_cmdarg(char *cmdarg, struct mft *mft)
     return 0;
 }
 
+/*
+ * Set up an io_uring instance for asynchronous I/O on block device (i), if
+ * supported by the host. The guest queues requests and reaps completions
+ * directly, so the seccomp policy only needs to allow io_uring_enter() on the
+ * ring. Completions are signalled on an eventfd in the epoll() set. If the
+ * host does not support io_uring, the guest falls back to synchronous I/O.
+ */
+static void setup_uring(struct spt *spt, struct mft *mft, unsigned i)
+{
+    struct block_uring *u = &urings[i];
+
+    if (block_uring_init(u, mft->e[i].hostfd, SOLO5_BLOCK_QUEUE_MAX) == -1)
+        return;
+
+    if (spt->block_uring == NULL) {
+        spt->block_uring = calloc(mft->entries,
+                sizeof (struct spt_block_uring));
+        if (spt->block_uring == NULL)
+            err(1, "calloc");
+    }
+    struct spt_block_uring *sb = &spt->block_uring[i];
+    sb->ringfd = u->ringfd;
+    sb->entries = u->entries;
+    sb->sq_head = u->sq_head;
+    sb->sq_tail = u->sq_tail;
+    sb->sq_mask = u->sq_mask;
+    sb->sq_array = u->sq_array;
+    sb->sqes = u->sqes;
+    sb->cq_head = u->cq_head;
+    sb->cq_tail = u->cq_tail;
+    sb->cq_mask = u->cq_mask;
+    sb->cqes = u->cqes;
+
+    /*
+     * The guest determines readiness from the completion queue itself, so the
+     * eventfd is never read and must be edge-triggered.
+     */
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.u64 = i;
+    if (epoll_ctl(spt->epollfd, EPOLL_CTL_ADD, u->eventfd, &ev) == -1)
+        err(1, "epoll_ctl(EPOLL_CTL_ADD, eventfd=%d) failed", u->eventfd);
+
+    int rc = seccomp_rule_add(spt->sc_ctx, SCMP_ACT_ALLOW,
+            SCMP_SYS(io_uring_enter), 2,
+            SCMP_A0(SCMP_CMP_EQ, u->ringfd),
+            SCMP_A3(SCMP_CMP_EQ, 0));
+    if (rc != 0)
+        errx(1, "seccomp_rule_add(io_uring_enter, fd=%d) failed: %s",
+                u->ringfd, strerror(-rc));
+}
+
+/*
+ * Map block device (i), attached with --block-map, read-only into the address
+ * space shared with the guest, which reads it directly. A guest write to the
+ * mapping is fatal. Writes through the file descriptor fail, as the device is
+ * opened read-only.
+ */
+static void setup_map(struct spt *spt, struct mft *mft, unsigned i)
+{
+    void *p = mmap(NULL, mft->e[i].u.block_basic.capacity, PROT_READ,
+            MAP_SHARED, mft->e[i].hostfd, 0);
+    if (p == MAP_FAILED)
+        err(1, "Could not map block device '%s'", mft->e[i].name);
+
+    if (spt->block_map == NULL) {
+        spt->block_map = calloc(mft->entries, sizeof (const uint8_t *));
+        if (spt->block_map == NULL)
+            err(1, "calloc");
+    }
+    spt->block_map[i] = p;
+}
+
+/*
+ * Neither the seccomp rules nor the io_uring restrictions can fully bound the
+ * extent of requests. To prevent the guest from growing regular files beyond
+ * their capacity, limit the size of files written by the tender to (fsize),
+ * the largest capacity of any regular file attached. Such writes then fail
+ * with EFBIG.
+ */
+static void limit_fsize(off_t fsize)
+{
+    struct rlimit rl;
+
+    if (getrlimit(RLIMIT_FSIZE, &rl) == -1)
+        err(1, "getrlimit(RLIMIT_FSIZE) failed");
+    if (rl.rlim_cur != RLIM_INFINITY && rl.rlim_cur <= (rlim_t)fsize)
+        return;
+    rl.rlim_cur = rl.rlim_max = fsize;
+    if (setrlimit(RLIMIT_FSIZE, &rl) == -1)
+        err(1, "setrlimit(RLIMIT_FSIZE) failed");
+    if (signal(SIGXFSZ, SIG_IGN) == SIG_ERR)
+        err(1, "signal(SIGXFSZ) failed");
+}
+
 static int setup(struct spt *spt, struct mft *mft)
 {
     if (!module_in_use)
         return 0;
 
+    off_t fsize = 0;
+
     for (unsigned i = 0; i != mft->entries; i++) {
         if (mft->e[i].type != MFT_BLOCK_BASIC || !mft->e[i].attached)
             continue;
+        if (mft_check_attrs(&mft->e[i]) == -1)
+            return -1;
 
         int rc = -1;
 
         /*
          * When reading or writing to the file descriptor, enforce that the
-         * operation cannot be performed beyond the (detected) capacity,
-         * otherwise, when backed by a regular file, the guest could grow the
-         * file size arbitrarily.
+         * operation cannot start beyond the (detected) capacity, by ensuring
+         * that (A3 <= (capacity - block_size)) holds. The size of requests
+         * is bounded by (A2 <= SOLO5_BLOCK_IO_MAX) for pread64()/pwrite64()
+         * and (A2 <= SOLO5_BLOCK_IOV_MAX) segments for preadv()/pwritev().
+         *
+         * fallocate() is allowed for discarding (punching holes) and
+         * writing zeroes only, with (A2 <= pos_max) bounding the offset.
+         *
+         * fadvise64() is allowed for POSIX_FADV_WILLNEED only, used to read
+         * ahead, which only reads into the host page cache.
          *
-         * The Solo5 API mandates that reads/writes must be equal to
-         * block_size, so we implement the above by ensuring that (A2 ==
-         * block_size) && (A3 <= (capacity - block_size) holds.
+         * ioctl() is allowed on zoned devices for reporting and managing
+         * zones only, which the guest may do to any zone of the device.
+         *
+         * As seccomp cannot relate the size of a request to its offset (or
+         * inspect the segments of vectored requests), when backed by a
+         * regular file, the guest could still grow the file by writing past
+         * its end. This is prevented by limit_fsize() below, which also
+         * applies to FALLOC_FL_ZERO_RANGE. Holes punched past the end of the
+         * file with FALLOC_FL_KEEP_SIZE have no effect.
          */
+        uint64_t pos_max = mft->e[i].u.block_basic.capacity -
+            mft->e[i].u.block_basic.block_size;
         rc = seccomp_rule_add(spt->sc_ctx, SCMP_ACT_ALLOW,
                 SCMP_SYS(pread64), 3,
                 SCMP_A0(SCMP_CMP_EQ, mft->e[i].hostfd),
-                SCMP_A2(SCMP_CMP_EQ, mft->e[i].u.block_basic.block_size),
-                SCMP_A3(SCMP_CMP_LE,
-                    (mft->e[i].u.block_basic.capacity - mft->e[i].u.block_basic.block_size)));
+                SCMP_A2(SCMP_CMP_LE, SOLO5_BLOCK_IO_MAX),
+                SCMP_A3(SCMP_CMP_LE, pos_max));
         if (rc != 0)
             errx(1, "seccomp_rule_add(pread64, fd=%d) failed: %s",
                     mft->e[i].hostfd, strerror(-rc));
         rc = seccomp_rule_add(spt->sc_ctx, SCMP_ACT_ALLOW,
                 SCMP_SYS(pwrite64), 3,
                 SCMP_A0(SCMP_CMP_EQ, mft->e[i].hostfd),
-                SCMP_A2(SCMP_CMP_EQ, mft->e[i].u.block_basic.block_size),
-                SCMP_A3(SCMP_CMP_LE,
-                    (mft->e[i].u.block_basic.capacity - mft->e[i].u.block_basic.block_size)));
+                SCMP_A2(SCMP_CMP_LE, SOLO5_BLOCK_IO_MAX),
+                SCMP_A3(SCMP_CMP_LE, pos_max));
         if (rc != 0)
             errx(1, "seccomp_rule_add(pwrite64, fd=%d) failed: %s",
                     mft->e[i].hostfd, strerror(-rc));
+        rc = seccomp_rule_add(spt->sc_ctx, SCMP_ACT_ALLOW,
+                SCMP_SYS(preadv), 3,
+                SCMP_A0(SCMP_CMP_EQ, mft->e[i].hostfd),
+                SCMP_A2(SCMP_CMP_LE, SOLO5_BLOCK_IOV_MAX),
+                SCMP_A3(SCMP_CMP_LE, pos_max));
+        if (rc != 0)
+            errx(1, "seccomp_rule_add(preadv, fd=%d) failed: %s",
+                    mft->e[i].hostfd, strerror(-rc));
+        rc = seccomp_rule_add(spt->sc_ctx, SCMP_ACT_ALLOW,
+                SCMP_SYS(pwritev), 3,
+                SCMP_A0(SCMP_CMP_EQ, mft->e[i].hostfd),
+                SCMP_A2(SCMP_CMP_LE, SOLO5_BLOCK_IOV_MAX),
+                SCMP_A3(SCMP_CMP_LE, pos_max));
+        if (rc != 0)
+            errx(1, "seccomp_rule_add(pwritev, fd=%d) failed: %s",
+                    mft->e[i].hostfd, strerror(-rc));
+        rc = seccomp_rule_add(spt->sc_ctx, SCMP_ACT_ALLOW,
+                SCMP_SYS(fdatasync), 1,
+                SCMP_A0(SCMP_CMP_EQ, mft->e[i].hostfd));
+        if (rc != 0)
+            errx(1, "seccomp_rule_add(fdatasync, fd=%d) failed: %s",
+                    mft->e[i].hostfd, strerror(-rc));
+        rc = seccomp_rule_add(spt->sc_ctx, SCMP_ACT_ALLOW,
+                SCMP_SYS(fallocate), 3,
+                SCMP_A0(SCMP_CMP_EQ, mft->e[i].hostfd),
+                SCMP_A1(SCMP_CMP_EQ,
+                    FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE),
+                SCMP_A2(SCMP_CMP_LE, pos_max));
+        if (rc != 0)
+            errx(1, "seccomp_rule_add(fallocate, fd=%d) failed: %s",
+                    mft->e[i].hostfd, strerror(-rc));
+        rc = seccomp_rule_add(spt->sc_ctx, SCMP_ACT_ALLOW,
+                SCMP_SYS(fallocate), 3,
+                SCMP_A0(SCMP_CMP_EQ, mft->e[i].hostfd),
+                SCMP_A1(SCMP_CMP_EQ, FALLOC_FL_ZERO_RANGE),
+                SCMP_A2(SCMP_CMP_LE, pos_max));
+        if (rc != 0)
+            errx(1, "seccomp_rule_add(fallocate, fd=%d) failed: %s",
+                    mft->e[i].hostfd, strerror(-rc));
+        rc = seccomp_rule_add(spt->sc_ctx, SCMP_ACT_ALLOW,
+                SCMP_SYS(fadvise64), 2,
+                SCMP_A0(SCMP_CMP_EQ, mft->e[i].hostfd),
+                SCMP_A3(SCMP_CMP_EQ, POSIX_FADV_WILLNEED));
+        if (rc != 0)
+            errx(1, "seccomp_rule_add(fadvise64, fd=%d) failed: %s",
+                    mft->e[i].hostfd, strerror(-rc));
+#if defined(BLKOPENZONE)
+        static const unsigned long zone_ioctls[] = {
+            BLKREPORTZONE, BLKRESETZONE, BLKOPENZONE, BLKCLOSEZONE,
+            BLKFINISHZONE
+        };
+        for (unsigned j = 0; mft->e[i].u.block_basic.zone_blocks != 0 &&
+                j < sizeof zone_ioctls / sizeof zone_ioctls[0]; j++) {
+            rc = seccomp_rule_add(spt->sc_ctx, SCMP_ACT_ALLOW,
+                    SCMP_SYS(ioctl), 2,
+                    SCMP_A0(SCMP_CMP_EQ, mft->e[i].hostfd),
+                    SCMP_A1(SCMP_CMP_EQ, zone_ioctls[j]));
+            if (rc != 0)
+                errx(1, "seccomp_rule_add(ioctl, fd=%d) failed: %s",
+                        mft->e[i].hostfd, strerror(-rc));
+        }
+#endif
+
+        struct stat st;
+        if (fstat(mft->e[i].hostfd, &st) == -1)
+            err(1, "fstat(fd=%d) failed", mft->e[i].hostfd);
+        if (S_ISREG(st.st_mode) && mft->e[i].u.block_basic.capacity > fsize)
+            fsize = mft->e[i].u.block_basic.capacity;
+
+        /*
+         * Requests to RAM-backed devices are served synchronously by the
+         * guest without system calls, so have no use for io_uring. Nor can
+         * devices of --zygote instances use it, as they replace the
+         * descriptor a ring would be bound to.
+         */
+        if (block_rams[i] != NULL) {
+            if (spt->block_ram == NULL) {
+                spt->block_ram = calloc(mft->entries, sizeof (uint8_t *));
+                if (spt->block_ram == NULL)
+                    err(1, "calloc");
+            }
+            spt->block_ram[i] = block_rams[i];
+        }
+        else if (!spt_zygote_enabled())
+            setup_uring(spt, mft, i);
+        if (mft->e[i].u.block_basic.flags & MFT_BLOCK_MAPPED)
+            setup_map(spt, mft, i);
     }
+    if (fsize != 0)
+        limit_fsize(fsize);
+    if (block_ioprio != BLOCK_IOPRIO_NONE &&
+            block_set_ioprio(block_ioprio) == -1)
+        err(1, "Could not set I/O priority");
 
     return 0;
 }
 
 static char *usage(void)
 {
-    return "--block:NAME=PATH (attach block device/file at PATH as block storage NAME)";
+    return "--block:NAME=PATH[,bs=SIZE] (attach block device/file at PATH as block storage NAME)\n"
+        "  | --block-direct:NAME=PATH[,bs=SIZE] (as above, bypassing the host page cache)\n"
+        "  | --block-map:NAME=PATH[,bs=SIZE] (as above, read-only and mapped into guest memory)\n"
+        "  | --block:NAME=ram:SIZE[:huge][,bs=SIZE] (attach scratch storage of SIZE bytes held in\n"
+        "    memory, backed by huge pages with :huge)\n"
+        "  [ --block-prio:NAME=rt|be|idle[:LEVEL] ] (set the host I/O priority class and\n"
+        "    LEVEL, 0 (highest) to 7, of block storage NAME; the same for all devices)";
 }
 
 DECLARE_MODULE(block,
@@ -24,56 +24,119 @@
 
 #include <assert.h>
 #include <err.h>
+#include <errno.h>
 #include <inttypes.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <seccomp.h>
 #include <sys/epoll.h>
+#include <linux/io_uring.h>
 
+#include "../common/block_uring.h"
+#include "../common/packet_attach.h"
 #include "../common/tap_attach.h"
+#include "../common/xdp_attach.h"
 #include "spt.h"
+#include "solo5.h"
 
 static bool module_in_use;
+static bool use_uring;
+static bool use_io_thread;
+static struct block_uring urings[MFT_MAX_ENTRIES];
+static struct packet_ring packet_rings[MFT_MAX_ENTRIES];
+static struct rate_limit rx_rates[MFT_MAX_ENTRIES], tx_rates[MFT_MAX_ENTRIES];
+static bool use_rates;
 
 static int handle_cmdarg(char *cmdarg, struct mft *mft)
 {
     enum {
         opt_net,
-        opt_net_mac
+        opt_net_offload,
+        opt_net_mac,
+        opt_net_mtu,
+        opt_net_rate
     } which;
 
-    if (strncmp("--net:", cmdarg, 6) == 0)
+    if (strcmp("--net-uring", cmdarg) == 0) {
+        use_uring = true;
+        return 0;
+    }
+    else if (strcmp("--io-thread", cmdarg) == 0) {
+        use_io_thread = true;
+        return 0;
+    }
+    else if (strncmp("--net:", cmdarg, 6) == 0)
         which = opt_net;
+    else if (strncmp("--net-offload:", cmdarg, 14) == 0)
+        which = opt_net_offload;
     else if (strncmp("--net-mac:", cmdarg, 10) == 0)
         which = opt_net_mac;
+    else if (strncmp("--net-mtu:", cmdarg, 10) == 0)
+        which = opt_net_mtu;
+    else if (strncmp("--net-rate:", cmdarg, 11) == 0)
+        which = opt_net_rate;
     else
         return -1;
 
     char name[MFT_NAME_SIZE];
-    char iface[20]; /* XXX should be IFNAMSIZ, needs extra header here */
+    char iface[32]; /* XXX should be IFNAMSIZ + "xdp:" + ":queueNN" */
     int rc;
-    if (which == opt_net) {
-        rc = sscanf(cmdarg,
-                "--net:%" XSTR(MFT_NAME_MAX) "[A-Za-z0-9]="
-                "%19s", name, iface);
+    if (which == opt_net || which == opt_net_offload) {
+        if (which == opt_net)
+            rc = sscanf(cmdarg,
+                    "--net:%" XSTR(MFT_NAME_MAX) "[A-Za-z0-9]="
+                    "%31s", name, iface);
+        else
+            rc = sscanf(cmdarg,
+                    "--net-offload:%" XSTR(MFT_NAME_MAX) "[A-Za-z0-9]="
+                    "%31s", name, iface);
         if (rc != 2)
             return -1;
-        struct mft_entry *e = mft_get_by_name(mft, name, MFT_NET_BASIC, NULL);
+        unsigned index;
+        struct mft_entry *e = mft_get_by_name(mft, name, MFT_NET_BASIC,
+                &index);
         if (e == NULL) {
             warnx("Resource not declared in manifest: '%s'", name);
             return -1;
         }
-        int fd = tap_attach(iface);
+        if (xdp_is_spec(iface)) {
+            warnx("AF_XDP networks are not supported by solo5-spt: %s", iface);
+            return -1;
+        }
+        if (which == opt_net_offload && packet_is_spec(iface)) {
+            warnx("Offloads are not supported for AF_PACKET networks: %s",
+                    iface);
+            return -1;
+        }
+        uint32_t offloads = 0;
+        int fd;
+        if (packet_is_spec(iface))
+            fd = packet_attach(iface, &packet_rings[index]);
+        else if (which == opt_net && e->attrs.net.offloads == 0)
+            fd = tap_attach(iface);
+        else
+            fd = tap_attach_offload(iface, &offloads);
         if (fd < 0) {
             warnx("Could not attach interface: %s", iface);
             return -1;
         }
 
         /* e->u.net_basic.mac[] is set either by option or generated later by
-         * setup().
+         * setup(). Likewise, e->u.net_basic.mtu is either set by option,
+         * required by the manifest or taken from the host interface here.
          */
-        e->u.net_basic.mtu = 1500; /* TODO */
+        if (e->u.net_basic.mtu == 0)
+            e->u.net_basic.mtu = e->attrs.net.mtu;
+        if (e->u.net_basic.mtu == 0) {
+            int mtu = packet_rings[index].rx ? packet_rings[index].mtu :
+                tap_attach_mtu(fd);
+            if (mtu < MFT_NET_MTU_MIN || mtu > MFT_NET_MTU_MAX)
+                mtu = 1500;
+            e->u.net_basic.mtu = mtu;
+        }
+        e->u.net_basic.offloads = offloads;
         e->hostfd = fd;
         e->attached = true;
         module_in_use = true;
@@ -95,21 +158,184 @@ static int handle_cmdarg(char *cmdarg, struct mft *mft)
         }
         memcpy(e->u.net_basic.mac, mac, sizeof mac);
     }
+    else if (which == opt_net_mtu) {
+        unsigned mtu;
+        rc = sscanf(cmdarg,
+                "--net-mtu:%" XSTR(MFT_NAME_MAX) "[A-Za-z0-9]=%u",
+                name, &mtu);
+        if (rc != 2)
+            return -1;
+        struct mft_entry *e = mft_get_by_name(mft, name, MFT_NET_BASIC, NULL);
+        if (e == NULL) {
+            warnx("Resource not declared in manifest: '%s'", name);
+            return -1;
+        }
+        if (mtu < MFT_NET_MTU_MIN || mtu > MFT_NET_MTU_MAX) {
+            warnx("Invalid MTU for network '%s': %u", name, mtu);
+            return -1;
+        }
+        e->u.net_basic.mtu = mtu;
+    }
+    else if (which == opt_net_rate) {
+        int n = -1;
+        rc = sscanf(cmdarg,
+                "--net-rate:%" XSTR(MFT_NAME_MAX) "[A-Za-z0-9]=%n",
+                name, &n);
+        if (rc != 1 || n == -1)
+            return -1;
+        unsigned index;
+        struct mft_entry *e = mft_get_by_name(mft, name, MFT_NET_BASIC,
+                &index);
+        if (e == NULL) {
+            warnx("Resource not declared in manifest: '%s'", name);
+            return -1;
+        }
+        if (rate_limit_parse(cmdarg + n, &rx_rates[index],
+                    &tx_rates[index]) == -1)
+            return -1;
+        use_rates = true;
+    }
 
     return 0;
 }
 
+/*
+ * Set up an io_uring instance for packet I/O on network device (i), if
+ * --net-uring was given. The guest queues reads and writes of packets on the
+ * ring directly and passes each batch to the kernel with a single
+ * io_uring_enter(), so the seccomp policy only allows that, on the ring, in
+ * place of read() and write() on the device. Returns false if the host does
+ * not support io_uring, in which case the guest uses read() and write().
+ *
+ * Guest memory is not registered with the ring as fixed buffers, as this
+ * would pin all of it.
+ */
+static bool setup_uring(struct spt *spt, struct mft *mft, unsigned i)
+{
+    struct block_uring *u = &urings[i];
+
+    if (!use_uring)
+        return false;
+    if (net_uring_init(u, mft->e[i].hostfd, SOLO5_NET_FRAMES_MAX) == -1) {
+        warnx("Could not set up io_uring for network '%s': %s",
+                mft->e[i].name, strerror(errno));
+        return false;
+    }
+
+    if (spt->net_uring == NULL) {
+        spt->net_uring = calloc(mft->entries,
+                sizeof (struct spt_block_uring));
+        if (spt->net_uring == NULL)
+            err(1, "calloc");
+    }
+    struct spt_block_uring *sn = &spt->net_uring[i];
+    sn->ringfd = u->ringfd;
+    sn->entries = u->entries;
+    sn->sq_head = u->sq_head;
+    sn->sq_tail = u->sq_tail;
+    sn->sq_mask = u->sq_mask;
+    sn->sq_array = u->sq_array;
+    sn->sqes = u->sqes;
+    sn->cq_head = u->cq_head;
+    sn->cq_tail = u->cq_tail;
+    sn->cq_mask = u->cq_mask;
+    sn->cqes = u->cqes;
+
+    /*
+     * The device is non-blocking, so all requests complete during
+     * io_uring_enter(), and the guest may wait for them to do so.
+     */
+    int rc = seccomp_rule_add(spt->sc_ctx, SCMP_ACT_ALLOW,
+            SCMP_SYS(io_uring_enter), 2,
+            SCMP_A0(SCMP_CMP_EQ, u->ringfd),
+            SCMP_A3(SCMP_CMP_EQ, IORING_ENTER_GETEVENTS));
+    if (rc != 0)
+        errx(1, "seccomp_rule_add(io_uring_enter, fd=%d) failed: %s",
+                u->ringfd, strerror(-rc));
+    return true;
+}
+
+/*
+ * Network device (i) is attached to an AF_PACKET socket. The guest walks its
+ * rings directly, and only needs to enter the host to start transmission
+ * (sendto() with no data) or to wait for a receive block to be ready.
+ */
+static void setup_packet(struct spt *spt, struct mft *mft, unsigned i)
+{
+    struct packet_ring *r = &packet_rings[i];
+
+    if (spt->net_packet == NULL) {
+        spt->net_packet = calloc(mft->entries,
+                sizeof (struct spt_net_packet));
+        if (spt->net_packet == NULL)
+            err(1, "calloc");
+    }
+    struct spt_net_packet *sp = &spt->net_packet[i];
+    sp->fd = mft->e[i].hostfd;
+    sp->block_size = r->block_size;
+    sp->rx_blocks = r->rx_blocks;
+    sp->frame_size = r->frame_size;
+    sp->tx_frames = r->tx_frames;
+    sp->rx = r->rx;
+    sp->tx = r->tx;
+
+    int rc = seccomp_rule_add(spt->sc_ctx, SCMP_ACT_ALLOW, SCMP_SYS(sendto),
+            3, SCMP_A0(SCMP_CMP_EQ, mft->e[i].hostfd),
+            SCMP_A1(SCMP_CMP_EQ, 0), SCMP_A2(SCMP_CMP_EQ, 0));
+    if (rc != 0)
+        errx(1, "seccomp_rule_add(sendto, fd=%d) failed: %s",
+                mft->e[i].hostfd, strerror(-rc));
+}
+
 static int setup(struct spt *spt, struct mft *mft)
 {
     if (!module_in_use)
         return 0;
+    if (use_uring && use_io_thread) {
+        warnx("--net-uring and --io-thread are mutually exclusive");
+        return -1;
+    }
+    /*
+     * Rate limits are enforced by the I/O thread, as the guest performs its
+     * own I/O otherwise.
+     */
+    if (use_rates && !use_io_thread) {
+        warnx("--net-rate requires --io-thread");
+        return -1;
+    }
+
+    /*
+     * AF_PACKET networks are served by their rings only.
+     */
+    for (unsigned i = 0; i != mft->entries; i++) {
+        if (mft->e[i].type != MFT_NET_BASIC || packet_rings[i].rx == NULL)
+            continue;
+        if (use_uring || use_io_thread) {
+            warnx("--net-uring and --io-thread are not supported with "
+                    "AF_PACKET networks");
+            return -1;
+        }
+        if (mft->e[i].u.net_basic.mtu > (unsigned)packet_rings[i].mtu) {
+            warnx("MTU for network '%s' exceeds that of host interface (%d)",
+                    mft->e[i].name, packet_rings[i].mtu);
+            return -1;
+        }
+    }
 
     for (unsigned i = 0; i != mft->entries; i++) {
         if (mft->e[i].type != MFT_NET_BASIC || !mft->e[i].attached)
             continue;
+        if (mft_check_attrs(&mft->e[i]) == -1)
+            return -1;
         char no_mac[6] = { 0 };
         if (memcmp(mft->e[i].u.net_basic.mac, no_mac, sizeof no_mac) == 0)
             tap_attach_genmac(mft->e[i].u.net_basic.mac);
+        /*
+         * With --io-thread, all I/O on the device is performed by the I/O
+         * thread, see spt_io_thread.c.
+         */
+        if (use_io_thread)
+            continue;
 
         int rc;
         struct epoll_event ev;
@@ -124,6 +350,12 @@ static int setup(struct spt *spt, struct mft *mft)
             err(1, "epoll_ctl(EPOLL_CTL_ADD, hostfd=%d) failed",
                     mft->e[i].hostfd);
 
+        if (packet_rings[i].rx != NULL) {
+            setup_packet(spt, mft, i);
+            continue;
+        }
+        if (setup_uring(spt, mft, i))
+            continue;
         rc = seccomp_rule_add(spt->sc_ctx, SCMP_ACT_ALLOW, SCMP_SYS(read), 1,
                 SCMP_A0(SCMP_CMP_EQ, mft->e[i].hostfd));
         if (rc != 0)
@@ -135,6 +367,8 @@ static int setup(struct spt *spt, struct mft *mft)
             errx(1, "seccomp_rule_add(write, fd=%d) failed: %s",
                     mft->e[i].hostfd, strerror(-rc));
     }
+    if (use_io_thread)
+        spt_io_thread_init(spt, mft, rx_rates, tx_rates);
 
     return 0;
 }
@@ -142,7 +376,15 @@ static int setup(struct spt *spt, struct mft *mft)
 static char *usage(void)
 {
     return "--net:NAME=IFACE | @NN (attach tap at IFACE or at fd @NN as network NAME)\n"
-        "  [ --net-mac:NAME=HWADDR ] (set HWADDR for network NAME)";
+        "  | --net:NAME=packet:IFACE (attach AF_PACKET socket on IFACE)\n"
+        "  | --net-offload:NAME=IFACE | @NN (as above, enabling offloads)\n"
+        "  [ --net-mac:NAME=HWADDR ] (set HWADDR for network NAME)\n"
+        "  [ --net-mtu:NAME=MTU ] (set MTU for network NAME)\n"
+        "  [ --net-uring ] (perform network I/O using io_uring)\n"
+        "  [ --io-thread ] (perform network I/O on a separate host thread)\n"
+        "  [ --net-rate:NAME=rx|tx:BYTES[:PACKETS[:BURST_MS]] ] (limit network\n"
+        "    NAME to BYTES and PACKETS per second, 0 for no limit, with bursts\n"
+        "    of BURST_MS, default 10; requires --io-thread)";
 }
 
 DECLARE_MODULE(net,
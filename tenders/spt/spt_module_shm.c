@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * spt_module_shm.c: Shared-memory region module.
+ */
+
+#define _GNU_SOURCE
+#include <err.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <seccomp.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+
+#include "../common/shm_region.h"
+#include "spt.h"
+#include "solo5.h"
+
+static bool module_in_use;
+
+/*
+ * The service's (notifyfd) is watched for the guest, which notifies the
+ * service by writing to (kickfd) itself.
+ */
+static struct {
+    int notifyfd, kickfd;
+} regions[MFT_MAX_ENTRIES];
+
+static int handle_cmdarg(char *cmdarg, struct mft *mft)
+{
+    char name[MFT_NAME_SIZE];
+    char path[PATH_MAX + 1];
+
+    if (strncmp("--shm:", cmdarg, 6) != 0)
+        return -1;
+    int rc = sscanf(cmdarg,
+            "--shm:%" XSTR(MFT_NAME_MAX) "[A-Za-z0-9]="
+            "%" XSTR(PATH_MAX) "s", name, path);
+    if (rc != 2)
+        return -1;
+    unsigned index;
+    struct mft_entry *e = mft_get_by_name(mft, name, MFT_SHM_BASIC, &index);
+    if (e == NULL) {
+        warnx("Resource not declared in manifest: '%s'", name);
+        return -1;
+    }
+
+    struct shm_region r;
+    if (shm_region_attach(path, &r) == -1) {
+        warn("Could not attach shared memory: '%s'", path);
+        return -1;
+    }
+    if (r.size / MFT_SHM_PAGE_SIZE > UINT32_MAX) {
+        warnx("Shared memory too large: '%s'", path);
+        return -1;
+    }
+    e->u.shm_basic.pages = r.size / MFT_SHM_PAGE_SIZE;
+    e->u.shm_basic.flags = (r.notifyfd != -1) ? MFT_SHM_DOORBELL : 0;
+    e->hostfd = r.memfd;
+    e->attached = true;
+    regions[index].notifyfd = r.notifyfd;
+    regions[index].kickfd = r.kickfd;
+    module_in_use = true;
+
+    return 0;
+}
+
+/*
+ * Map region (i) into the address space shared with the guest, which accesses
+ * it directly, and allow the guest to use its doorbell, if any.
+ */
+static void setup_region(struct spt *spt, struct mft *mft, unsigned i)
+{
+    struct mft_entry *e = &mft->e[i];
+    size_t size = (size_t)e->u.shm_basic.pages * MFT_SHM_PAGE_SIZE;
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+            e->hostfd, 0);
+    if (p == MAP_FAILED)
+        err(1, "Could not map shared memory '%s'", e->name);
+    e->u.shm_basic.addr = (uintptr_t)p;
+
+    if (regions[i].notifyfd == -1)
+        return;
+    /*
+     * The guest needs no descriptor for the memory once it is mapped, so
+     * (hostfd) is replaced by the descriptor it notifies the service through.
+     */
+    e->hostfd = regions[i].kickfd;
+    /*
+     * Nothing reads from (notifyfd) after the service signals it, so it is
+     * watched edge-triggered.
+     */
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.u64 = i;
+    if (epoll_ctl(spt->epollfd, EPOLL_CTL_ADD, regions[i].notifyfd, &ev) == -1)
+        err(1, "epoll_ctl(EPOLL_CTL_ADD, notifyfd=%d) failed",
+                regions[i].notifyfd);
+
+    int rc = seccomp_rule_add(spt->sc_ctx, SCMP_ACT_ALLOW, SCMP_SYS(write), 2,
+            SCMP_A0(SCMP_CMP_EQ, regions[i].kickfd),
+            SCMP_A2(SCMP_CMP_EQ, sizeof (uint64_t)));
+    if (rc != 0)
+        errx(1, "seccomp_rule_add(write, fd=%d) failed: %s",
+                regions[i].kickfd, strerror(-rc));
+}
+
+static int setup(struct spt *spt, struct mft *mft)
+{
+    if (!module_in_use)
+        return 0;
+
+    for (unsigned i = 0; i != mft->entries; i++) {
+        if (mft->e[i].type != MFT_SHM_BASIC || !mft->e[i].attached)
+            continue;
+        if (mft_check_attrs(&mft->e[i]) == -1)
+            return -1;
+        setup_region(spt, mft, i);
+    }
+
+    return 0;
+}
+
+static char *usage(void)
+{
+    return "--shm:NAME=PATH (attach the file or service listening on the UNIX socket at\n"
+        "    PATH as shared memory NAME)";
+}
+
+DECLARE_MODULE(shm,
+    .setup = setup,
+    .handle_cmdarg = handle_cmdarg,
+    .usage = usage
+)
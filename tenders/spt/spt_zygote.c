@@ -0,0 +1,229 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * spt_zygote.c: Fork server (--zygote=PATH).
+ *
+ * The guest runs until it calls solo5_snapshot(), then forks an instance for
+ * each launcher connecting to the UNIX socket PATH, which passes the devices
+ * to attach to it. Instances skip loading the unikernel and its
+ * initialisation, and share guest memory with the zygote copy-on-write.
+ *
+ * As on spt the guest shares the tender's address space, the forking is done
+ * by the guest itself (see bindings/spt/zygote.c), bounded by the seccomp
+ * policy: the zygote's policy additionally allows the system calls needed,
+ * restricted to the descriptors concerned where possible, and each instance
+ * applies a second policy denying them before the unikernel continues. An
+ * instance is therefore confined as a guest run without --zygote before it
+ * handles any input of its own.
+ */
+
+#define _GNU_SOURCE
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+#include <seccomp.h>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+
+#include "spt.h"
+
+static const char *socket_path;
+
+int spt_zygote_handle_cmdarg(const char *cmdarg)
+{
+    if (strncmp("--zygote=", cmdarg, 9) != 0)
+        return -1;
+    if (cmdarg[9] == '\0')
+        errx(1, "Malformed argument to --zygote");
+    socket_path = &cmdarg[9];
+    return 0;
+}
+
+bool spt_zygote_enabled(void)
+{
+    return socket_path != NULL;
+}
+
+static void allow(void *ctx, int syscall, unsigned arg_cnt,
+        struct scmp_arg_cmp a, struct scmp_arg_cmp b)
+{
+    int rc = seccomp_rule_add(ctx, SCMP_ACT_ALLOW, syscall, arg_cnt, a, b);
+    if (rc != 0)
+        errx(1, "seccomp_rule_add(%d) failed: %s", syscall, strerror(-rc));
+}
+
+/*
+ * System calls allowed to the zygote only, see spt_abi.h.
+ */
+static const int zygote_syscalls[] = {
+    SCMP_SYS(accept4), SCMP_SYS(recvmsg), SCMP_SYS(dup3), SCMP_SYS(close),
+    SCMP_SYS(clone), SCMP_SYS(epoll_create1), SCMP_SYS(timerfd_create),
+    SCMP_SYS(epoll_ctl), SCMP_SYS(seccomp)
+};
+
+/*
+ * Returns the instance policy, which denies (zygote_syscalls), as classic BPF
+ * of (*len) instructions.
+ */
+static void *instance_filter(uint32_t *len)
+{
+    void *ctx = seccomp_init(SCMP_ACT_ALLOW);
+    if (ctx == NULL)
+        errx(1, "seccomp_init() failed");
+    for (size_t i = 0; i < sizeof zygote_syscalls / sizeof zygote_syscalls[0];
+            i++) {
+        int rc = seccomp_rule_add(ctx, SCMP_ACT_KILL, zygote_syscalls[i], 0);
+        if (rc != 0)
+            errx(1, "seccomp_rule_add(%d) failed: %s", zygote_syscalls[i],
+                    strerror(-rc));
+    }
+
+    int fd = memfd_create("solo5-zygote", MFD_CLOEXEC);
+    if (fd == -1)
+        err(1, "memfd_create() failed");
+    int rc = seccomp_export_bpf(ctx, fd);
+    if (rc != 0)
+        errx(1, "seccomp_export_bpf() failed: %s", strerror(-rc));
+    seccomp_release(ctx);
+    off_t size = lseek(fd, 0, SEEK_END);
+    if (size <= 0 || size % sizeof (struct sock_filter) != 0)
+        errx(1, "seccomp_export_bpf() returned a malformed filter");
+    void *filter = malloc(size);
+    if (filter == NULL)
+        err(1, "malloc");
+    if (pread(fd, filter, size, 0) != size)
+        err(1, "pread() failed");
+    close(fd);
+
+    *len = size / sizeof (struct sock_filter);
+    return filter;
+}
+
+void spt_zygote_init(struct spt *spt, struct mft *mft)
+{
+    struct sockaddr_un sa = { .sun_family = AF_UNIX };
+    struct stat st;
+
+    if (socket_path == NULL)
+        return;
+
+    /*
+     * Only the calling thread is forked, and instances must not share device
+     * state with the zygote or with each other, so only devices whose state
+     * is entirely held by the descriptors an instance replaces are supported.
+     */
+    if (spt->cpus > 1)
+        errx(1, "--zygote cannot be used with --cpus");
+    if (metrics_enabled())
+        errx(1, "--zygote cannot be used with --metrics");
+    if (spt->io_thread != NULL || spt->net_uring != NULL ||
+            spt->net_packet != NULL)
+        errx(1, "--zygote cannot be used with --io-thread, --net-uring or "
+                "AF_PACKET networks");
+    for (unsigned i = 0; i != mft->entries; i++) {
+        struct mft_entry *e = &mft->e[i];
+        if (!e->attached)
+            continue;
+        if (e->type != MFT_NET_BASIC && e->type != MFT_BLOCK_BASIC)
+            errx(1, "--zygote only supports network and block devices");
+        if (e->type == MFT_BLOCK_BASIC && (e->u.block_basic.flags &
+                    (MFT_BLOCK_MAPPED | MFT_BLOCK_RAM)))
+            errx(1, "--zygote cannot be used with --block-map or RAM-backed "
+                    "block devices");
+    }
+
+    if (strlen(socket_path) >= sizeof sa.sun_path)
+        errx(1, "--zygote: %s: Path too long", socket_path);
+    strcpy(sa.sun_path, socket_path);
+    /*
+     * A socket left behind by a previous zygote is replaced.
+     */
+    if (stat(socket_path, &st) == 0 && S_ISSOCK(st.st_mode))
+        (void)unlink(socket_path);
+    int listenfd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (listenfd == -1)
+        err(1, "--zygote: socket() failed");
+    if (bind(listenfd, (struct sockaddr *)&sa, sizeof sa) == -1)
+        err(1, "--zygote: Could not bind to %s", socket_path);
+    if (listen(listenfd, SOMAXCONN) == -1)
+        err(1, "--zygote: listen() failed");
+    /*
+     * Reserve the descriptor each connection is moved to, so that the policy
+     * can refer to it.
+     */
+    int connfd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if (connfd == -1)
+        err(1, "--zygote: /dev/null");
+    /*
+     * The zygote does not wait for its instances.
+     */
+    if (signal(SIGCHLD, SIG_IGN) == SIG_ERR)
+        err(1, "signal(SIGCHLD) failed");
+
+    struct spt_zygote *z = malloc(sizeof (struct spt_zygote));
+    if (z == NULL)
+        err(1, "malloc");
+    z->listenfd = listenfd;
+    z->connfd = connfd;
+    z->filter = instance_filter(&z->filter_len);
+    spt->zygote = z;
+
+    void *ctx = spt->sc_ctx;
+    struct scmp_arg_cmp none = { 0 };
+    allow(ctx, SCMP_SYS(accept4), 1, SCMP_A0(SCMP_CMP_EQ, listenfd), none);
+    allow(ctx, SCMP_SYS(recvmsg), 1, SCMP_A0(SCMP_CMP_EQ, connfd), none);
+    allow(ctx, SCMP_SYS(write), 1, SCMP_A0(SCMP_CMP_EQ, connfd), none);
+    allow(ctx, SCMP_SYS(dup3), 1, SCMP_A1(SCMP_CMP_EQ, connfd), none);
+    allow(ctx, SCMP_SYS(dup3), 1, SCMP_A1(SCMP_CMP_EQ, spt->epollfd), none);
+    allow(ctx, SCMP_SYS(dup3), 1, SCMP_A1(SCMP_CMP_EQ, spt->timerfd), none);
+    for (unsigned i = 0; i != mft->entries; i++) {
+        if (mft->e[i].attached)
+            allow(ctx, SCMP_SYS(dup3), 1,
+                    SCMP_A1(SCMP_CMP_EQ, mft->e[i].hostfd), none);
+    }
+    /*
+     * Descriptors received are closed once moved or replied to, at whatever
+     * number they were received.
+     */
+    allow(ctx, SCMP_SYS(close), 0, none, none);
+    allow(ctx, SCMP_SYS(clone), 2, SCMP_A0(SCMP_CMP_EQ, SIGCHLD),
+            SCMP_A1(SCMP_CMP_EQ, 0));
+    allow(ctx, SCMP_SYS(epoll_create1), 1, SCMP_A0(SCMP_CMP_EQ, 0), none);
+    allow(ctx, SCMP_SYS(timerfd_create), 2,
+            SCMP_A0(SCMP_CMP_EQ, CLOCK_MONOTONIC),
+            SCMP_A1(SCMP_CMP_EQ, TFD_NONBLOCK));
+    allow(ctx, SCMP_SYS(epoll_ctl), 2, SCMP_A0(SCMP_CMP_EQ, spt->epollfd),
+            SCMP_A1(SCMP_CMP_EQ, EPOLL_CTL_ADD));
+    allow(ctx, SCMP_SYS(seccomp), 2,
+            SCMP_A0(SCMP_CMP_EQ, SECCOMP_SET_MODE_FILTER),
+            SCMP_A1(SCMP_CMP_EQ, 0));
+}
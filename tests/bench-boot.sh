@@ -0,0 +1,158 @@
+#!/bin/sh
+# Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+#
+# This file is part of Solo5, a sandboxed execution environment.
+#
+# Permission to use, copy, modify, and/or distribute this software
+# for any purpose with or without fee is hereby granted, provided
+# that the above copyright notice and this permission notice appear
+# in all copies.
+#
+# THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+# WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+# WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+# AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+# CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+# OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+# NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+# CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#
+# bench-boot.sh: Boot time and density benchmark for the hvt and spt tenders.
+#
+# Launches 1, 2, 4, ... instances of each unikernel in parallel, with
+# --trace-boot, and reports for each level the time taken to reach
+# solo5_app_main() as traced by the tender, the wall time from exec to exit
+# and the peak RSS of each instance. The ramp stops once the median time to
+# solo5_app_main() exceeds FACTOR times that of a single instance, or at MAX
+# instances, giving the number of instances which fit before boot latency
+# degrades.
+#
+# Unikernels are given without their target suffix, and default to
+# test_hello. They are run with "Hello_Solo5" as command line and no devices.
+#
+# Linux only: uses date +%s%N and GNU time, if installed, for the peak RSS.
+#
+
+usage()
+{
+    cat <<USAGE 1>&2
+usage: $0 [ -t TARGETS ] [ -n MAX ] [ -f FACTOR ] [ -m MEM ] [ UNIKERNEL ... ]
+    -t TARGETS  tenders to run, default "hvt spt"
+    -n MAX      maximum number of instances, default 256
+    -f FACTOR   boot latency degradation factor, default 2
+    -m MEM      guest memory in MB, default 32
+USAGE
+    exit 1
+}
+
+TESTS=$(cd $(dirname $0) && pwd)
+TARGETS="hvt spt"
+MAX=256
+FACTOR=2
+MEM=32
+
+while getopts "t:n:f:m:" opt; do
+    case ${opt} in
+    t) TARGETS="${OPTARG}" ;;
+    n) MAX="${OPTARG}" ;;
+    f) FACTOR="${OPTARG}" ;;
+    m) MEM="${OPTARG}" ;;
+    *) usage ;;
+    esac
+done
+shift $((OPTIND - 1))
+UNIKERNELS="$*"
+[ -z "${UNIKERNELS}" ] && UNIKERNELS=${TESTS}/test_hello/test_hello
+
+if [ -x /usr/bin/time ] && /usr/bin/time -f %M true >/dev/null 2>&1; then
+    GNU_TIME=/usr/bin/time
+fi
+
+WORKDIR=$(mktemp -d)
+trap "rm -rf ${WORKDIR}" EXIT
+
+# Prints the median and 90th percentile of the numbers in file $1.
+percentiles()
+{
+    sort -n $1 | awk '{ v[NR] = $1 }
+        END {
+            if (NR == 0) { print "n/a n/a"; exit }
+            print v[int((NR + 1) / 2)], v[int((NR * 9 + 9) / 10)]
+        }'
+}
+
+# Runs $3 instances of unikernel $2 on tender $1, leaving per-instance
+# results in ${WORKDIR}.
+run_level()
+{
+    rm -f ${WORKDIR}/*
+    i=0
+    while [ ${i} -lt $3 ]; do
+        (
+            start=$(date +%s%N)
+            if [ -n "${GNU_TIME}" ]; then
+                ${GNU_TIME} -f %M -o ${WORKDIR}/${i}.rss \
+                    $1 --mem=${MEM} --trace-boot -- $2 Hello_Solo5 \
+                    >${WORKDIR}/${i}.log 2>&1
+            else
+                $1 --mem=${MEM} --trace-boot -- $2 Hello_Solo5 \
+                    >${WORKDIR}/${i}.log 2>&1
+            fi
+            end=$(date +%s%N)
+            echo $(( (end - start) / 1000 )) >${WORKDIR}/${i}.wall
+        ) &
+        i=$((i + 1))
+    done
+    wait
+}
+
+for target in ${TARGETS}; do
+    tender=${TESTS}/../tenders/${target}/solo5-${target}
+    if [ ! -x ${tender} ]; then
+        echo "${target}: ${tender} not built, skipping" 1>&2
+        continue
+    fi
+
+    for uk in ${UNIKERNELS}; do
+        uk=${uk}.${target}
+        if [ ! -f ${uk} ]; then
+            echo "${target}: ${uk} not built, skipping" 1>&2
+            continue
+        fi
+
+        baseline=
+        fit=0
+        n=1
+        while [ ${n} -le ${MAX} ]; do
+            run_level ${tender} ${uk} ${n}
+            cat ${WORKDIR}/*.log | awk '/solo5_app_main \(guest\)/ {
+                for (i = 2; i <= NF; i++) if ($i == "us") print $(i - 1) }' \
+                >${WORKDIR}/app_main
+            cat ${WORKDIR}/*.wall >${WORKDIR}/exit
+            cat ${WORKDIR}/*.rss >${WORKDIR}/rss 2>/dev/null || true
+            failed=$(( n - $(grep -l SUCCESS ${WORKDIR}/*.log | wc -l) ))
+
+            set -- $(percentiles ${WORKDIR}/app_main)
+            app_p50=$1 app_p90=$2
+            set -- $(percentiles ${WORKDIR}/exit)
+            exit_p50=$1 exit_p90=$2
+            set -- $(percentiles ${WORKDIR}/rss)
+            rss_p50=$1
+
+            echo "${target} $(basename ${uk}) x${n}:" \
+                "app_main us p50 ${app_p50} p90 ${app_p90}," \
+                "exit us p50 ${exit_p50} p90 ${exit_p90}," \
+                "peak RSS KiB p50 ${rss_p50}, ${failed} failed"
+
+            [ "${app_p50}" = "n/a" ] && break
+            [ -z "${baseline}" ] && baseline=${app_p50}
+            [ ${failed} -ne 0 ] && break
+            [ ${app_p50} -gt $(( baseline * FACTOR )) ] && break
+            fit=${n}
+            n=$(( n * 2 ))
+        done
+        echo "${target} $(basename ${uk}): ${fit} instances before boot" \
+            "latency exceeded ${FACTOR}x that of one instance"
+    done
+done
@@ -0,0 +1,200 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "solo5.h"
+#include "solo5_alloc.h"
+#include "../../bindings/lib.c"
+#include "../../bindings/alloc.c"
+
+static void puts(const char *s)
+{
+    solo5_console_write(s, strlen(s));
+}
+
+#define STACK_SIZE (1UL << 20)
+#define NOBJS 4096
+
+static void *objs[NOBJS];
+static size_t sizes[NOBJS];
+
+static uint8_t pattern(size_t i, size_t j)
+{
+    return (uint8_t)(i * 13 + j * 7 + 1);
+}
+
+static void fill(uint8_t *p, size_t size, size_t i)
+{
+    for (size_t j = 0; j < size; j++)
+        p[j] = pattern(i, j);
+}
+
+static bool check(const uint8_t *p, size_t size, size_t i)
+{
+    for (size_t j = 0; j < size; j++)
+        if (p[j] != pattern(i, j))
+            return false;
+    return true;
+}
+
+static bool aligned(const void *p, size_t align)
+{
+    return ((uintptr_t)p & (align - 1)) == 0;
+}
+
+/*
+ * Allocates objects of sizes across all size classes, checks that they do
+ * not overlap, and frees them in an order other than that of allocation.
+ */
+static bool test_small(void)
+{
+    for (size_t i = 0; i < NOBJS; i++) {
+        sizes[i] = 1 + (i * 2654435761UL) % SOLO5_ALLOC_SMALL_MAX;
+        if (i % 4 == 0)
+            sizes[i] %= 256;
+        sizes[i] += (sizes[i] == 0);
+        objs[i] = solo5_alloc(0, sizes[i]);
+        if (objs[i] == NULL || !aligned(objs[i], 16) ||
+                solo5_alloc_usable_size(objs[i]) < sizes[i])
+            return false;
+        fill(objs[i], sizes[i], i);
+    }
+    for (size_t i = 0; i < NOBJS; i++)
+        if (!check(objs[i], sizes[i], i))
+            return false;
+    for (size_t i = 0; i < NOBJS; i += 2)
+        solo5_free(0, objs[i]);
+    for (size_t i = 1; i < NOBJS; i += 2)
+        solo5_free(0, objs[NOBJS - i]);
+    return solo5_alloc(0, 0) == NULL;
+}
+
+static bool test_aligned(void)
+{
+    static const size_t aligns[] = { 32, 64, 512, 4096, 65536,
+        SOLO5_ALLOC_HUGE_SIZE };
+
+    for (size_t i = 0; i < sizeof aligns / sizeof aligns[0]; i++) {
+        void *p = solo5_alloc_aligned(0, aligns[i], 100);
+        if (p == NULL || !aligned(p, aligns[i]))
+            return false;
+        fill(p, 100, i);
+        solo5_free(0, p);
+    }
+    return solo5_alloc_aligned(0, 48, 100) == NULL;
+}
+
+static bool test_large(size_t heap_size)
+{
+    uint8_t *p = solo5_alloc(0, 100000);
+    uint8_t *h = solo5_alloc(0, SOLO5_ALLOC_HUGE_SIZE + 1);
+    if (p == NULL || h == NULL || !aligned(p, SOLO5_PAGE_SIZE) ||
+            !aligned(h, SOLO5_ALLOC_HUGE_SIZE) ||
+            solo5_alloc_usable_size(h) != 2 * SOLO5_ALLOC_HUGE_SIZE)
+        return false;
+    fill(p, 100000, 1);
+    fill(h, SOLO5_ALLOC_HUGE_SIZE + 1, 2);
+
+    /*
+     * Growing moves the allocation, keeping its contents.
+     */
+    uint8_t *q = solo5_realloc(0, p, 300000);
+    if (q == NULL || !check(q, 100000, 1))
+        return false;
+    solo5_free(0, q);
+    solo5_free(0, h);
+
+    return solo5_alloc(0, heap_size) == NULL;
+}
+
+static bool test_arena(void)
+{
+    struct solo5_arena arena;
+
+    solo5_arena_init(&arena, 0);
+    for (int round = 0; round < 3; round++) {
+        uint8_t *first = NULL;
+        for (size_t i = 0; i < 1000; i++) {
+            size_t size = 1 + i % 200;
+            uint8_t *p = solo5_arena_alloc(&arena, size, 8);
+            if (p == NULL || !aligned(p, 8))
+                return false;
+            fill(p, size, i);
+            if (first == NULL)
+                first = p;
+        }
+        uint8_t *big = solo5_arena_alloc(&arena, 200000, 64);
+        if (big == NULL || !aligned(big, 64) || !check(first, 1, 0))
+            return false;
+        solo5_arena_reset(&arena);
+    }
+    solo5_arena_destroy(&arena);
+    return solo5_arena_alloc(&arena, 16, 3) == NULL;
+}
+
+int solo5_app_main(const struct solo5_start_info *si)
+{
+    puts("\n**** Solo5 standalone test_alloc ****\n\n");
+
+    if (si->heap_huge_size != 0 &&
+            (!aligned((void *)si->heap_huge_start, SOLO5_HUGE_PAGE_SIZE) ||
+             si->heap_huge_start < si->heap_start ||
+             si->heap_huge_start + si->heap_huge_size >
+                si->heap_start + si->heap_size)) {
+        puts("ERROR: huge page heap region is not in the heap\n");
+        return SOLO5_EXIT_FAILURE;
+    }
+
+    size_t heap_size = si->heap_size - STACK_SIZE;
+    if (solo5_alloc_init(si->heap_start, heap_size) != SOLO5_R_OK) {
+        puts("ERROR: solo5_alloc_init() failed\n");
+        return SOLO5_EXIT_FAILURE;
+    }
+    if (!test_small()) {
+        puts("ERROR: small allocations failed\n");
+        return SOLO5_EXIT_FAILURE;
+    }
+    if (!test_aligned()) {
+        puts("ERROR: aligned allocations failed\n");
+        return SOLO5_EXIT_FAILURE;
+    }
+    if (!test_large(heap_size)) {
+        puts("ERROR: large allocations failed\n");
+        return SOLO5_EXIT_FAILURE;
+    }
+    if (!test_arena()) {
+        puts("ERROR: arena allocations failed\n");
+        return SOLO5_EXIT_FAILURE;
+    }
+
+    /*
+     * Everything has been freed, so the heap must be back to a single span.
+     */
+    solo5_alloc_flush(0);
+    solo5_alloc_trim();
+    void *p = solo5_alloc(0, (size_t)heap_pages * SOLO5_PAGE_SIZE);
+    if (p == NULL) {
+        puts("ERROR: memory leaked\n");
+        return SOLO5_EXIT_FAILURE;
+    }
+    solo5_free(0, p);
+
+    puts("SUCCESS\n");
+    return SOLO5_EXIT_SUCCESS;
+}
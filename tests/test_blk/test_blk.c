@@ -51,6 +51,435 @@ bool check_one_block(solo5_handle_t h, solo5_off_t offset, size_t block_size)
     return true;
 }
 
+/*
+ * Submit a full queue of asynchronous writes followed by reads of the same
+ * blocks, and check that each completes exactly once with the right data.
+ */
+#define ASYNC_BLOCK_SIZE_MAX 4096
+static uint8_t abuf[SOLO5_BLOCK_QUEUE_MAX][ASYNC_BLOCK_SIZE_MAX];
+
+static bool await_completions(solo5_handle_t h, uint64_t *done)
+{
+    struct solo5_block_completion c[SOLO5_BLOCK_QUEUE_MAX];
+    size_t n, total = 0;
+
+    while (total < SOLO5_BLOCK_QUEUE_MAX) {
+        solo5_handle_set_t ready_set = 0;
+        solo5_yield(solo5_clock_monotonic() + 1000000000ULL, &ready_set);
+        if (!(ready_set & (1ULL << h)))
+            return false;
+        if (solo5_block_reap(h, c, SOLO5_BLOCK_QUEUE_MAX, &n) != SOLO5_R_OK)
+            return false;
+        for (size_t i = 0; i < n; i++) {
+            if (c[i].tag >= SOLO5_BLOCK_QUEUE_MAX ||
+                    (*done & (1ULL << c[i].tag)) ||
+                    c[i].result != SOLO5_R_OK)
+                return false;
+            *done |= 1ULL << c[i].tag;
+        }
+        total += n;
+    }
+    return true;
+}
+
+static int check_async(solo5_handle_t h, size_t block_size)
+{
+    uint64_t done;
+    uint64_t i;
+    size_t j;
+
+    if (block_size > ASYNC_BLOCK_SIZE_MAX)
+        return 0;
+
+    for (i = 0; i < SOLO5_BLOCK_QUEUE_MAX; i++) {
+        for (j = 0; j < block_size; j++)
+            abuf[i][j] = i + j;
+        if (solo5_block_submit_write(h, i * block_size, abuf[i], block_size,
+                    i) != SOLO5_R_OK)
+            return 12;
+    }
+    if (solo5_block_submit_write(h, 0, abuf[0], block_size, 0) !=
+            SOLO5_R_AGAIN)
+        return 13;
+    done = 0;
+    if (!await_completions(h, &done))
+        return 14;
+
+    for (i = 0; i < SOLO5_BLOCK_QUEUE_MAX; i++) {
+        for (j = 0; j < block_size; j++)
+            abuf[i][j] = 0;
+        if (solo5_block_submit_read(h, i * block_size, abuf[i], block_size,
+                    i) != SOLO5_R_OK)
+            return 15;
+    }
+    done = 0;
+    if (!await_completions(h, &done))
+        return 16;
+    for (i = 0; i < SOLO5_BLOCK_QUEUE_MAX; i++) {
+        for (j = 0; j < block_size; j++)
+            if (abuf[i][j] != (uint8_t)(i + j))
+                return 17;
+    }
+
+    /*
+     * Invalid requests are rejected on submission.
+     */
+    if (solo5_block_submit_read(h, block_size - 1, abuf[0], block_size, 0)
+            == SOLO5_R_OK)
+        return 18;
+    if (solo5_block_submit_write(h, 0, abuf[0], block_size - 1, 0)
+            == SOLO5_R_OK)
+        return 19;
+
+    return 0;
+}
+
+/*
+ * Register (abuf) and read back the blocks written by check_async() through
+ * it, write them again from it, and check that requests outside of it are
+ * rejected.
+ */
+static int check_fixed(solo5_handle_t h, size_t block_size)
+{
+    uint64_t done;
+    unsigned index;
+    uint64_t i;
+    size_t j;
+
+    if (block_size > ASYNC_BLOCK_SIZE_MAX)
+        return 0;
+    solo5_result_t rc = solo5_block_register_buffer(h, &abuf[0][0],
+            sizeof abuf, &index);
+    if (rc == SOLO5_R_EUNSPEC)
+        return 0;
+    if (rc != SOLO5_R_OK)
+        return 59;
+
+    for (i = 0; i < SOLO5_BLOCK_QUEUE_MAX; i++) {
+        for (j = 0; j < block_size; j++)
+            abuf[i][j] = 0;
+        if (solo5_block_submit_read_fixed(h, i * block_size, index,
+                    i * sizeof abuf[0], block_size, i) != SOLO5_R_OK)
+            return 60;
+    }
+    done = 0;
+    if (!await_completions(h, &done))
+        return 61;
+    for (i = 0; i < SOLO5_BLOCK_QUEUE_MAX; i++) {
+        for (j = 0; j < block_size; j++)
+            if (abuf[i][j] != (uint8_t)(i + j))
+                return 62;
+    }
+
+    for (i = 0; i < SOLO5_BLOCK_QUEUE_MAX; i++) {
+        if (solo5_block_submit_write_fixed(h, i * block_size, index,
+                    i * sizeof abuf[0], block_size, i) != SOLO5_R_OK)
+            return 63;
+    }
+    done = 0;
+    if (!await_completions(h, &done))
+        return 64;
+
+    /*
+     * Requests outside of the buffer, or of registered buffers, are rejected
+     * on submission.
+     */
+    if (solo5_block_submit_read_fixed(h, 0, index,
+                sizeof abuf - block_size + 1, block_size, 0) == SOLO5_R_OK)
+        return 65;
+    if (solo5_block_submit_read_fixed(h, 0, index + 1, 0, block_size, 0)
+            == SOLO5_R_OK)
+        return 66;
+
+    return 0;
+}
+
+/*
+ * Write multiple blocks with a single request and read them back in segments,
+ * and vice versa. Uses (abuf) as scratch space.
+ */
+#define MULTI_BLOCKS 8
+
+static int check_multi(solo5_handle_t h, size_t block_size,
+        solo5_off_t capacity)
+{
+    size_t size = MULTI_BLOCKS * block_size;
+    uint8_t *wbuf = &abuf[0][0], *rbuf = wbuf + size;
+    size_t i;
+
+    if ((2 * size + block_size) > sizeof abuf ||
+            capacity < (2 * size))
+        return 0;
+
+    for (i = 0; i < size; i++) {
+        wbuf[i] = i * 7;
+        rbuf[i] = 0;
+    }
+    if (solo5_block_write(h, block_size, wbuf, size) != SOLO5_R_OK)
+        return 20;
+
+    /*
+     * Read back as 1, 3 and 4 blocks into non-contiguous buffers.
+     */
+    struct solo5_block_iov iov[3] = {
+        { .buf = rbuf + (4 * block_size), .size = block_size },
+        { .buf = rbuf, .size = 3 * block_size },
+        { .buf = rbuf + (5 * block_size), .size = 4 * block_size }
+    };
+    if (solo5_block_readv(h, block_size, iov, 3) != SOLO5_R_OK)
+        return 21;
+    for (i = 0; i < 3; i++) {
+        uint8_t *expected = wbuf;
+        for (size_t j = 0; j < i; j++)
+            expected += iov[j].size;
+        if (memcmp(iov[i].buf, expected, iov[i].size) != 0)
+            return 22;
+    }
+
+    /*
+     * Write the same segments elsewhere, and read back as a single request.
+     */
+    if (solo5_block_writev(h, size, iov, 3) != SOLO5_R_OK)
+        return 23;
+    memset(rbuf, 0, size);
+    if (solo5_block_read(h, size, rbuf, size) != SOLO5_R_OK)
+        return 24;
+    if (memcmp(rbuf, wbuf, size) != 0)
+        return 25;
+
+    /*
+     * Invalid requests: extending beyond the end of the device, segments not
+     * a multiple of the block size, no segments or too many segments, and
+     * too large.
+     */
+    if (solo5_block_read(h, capacity - block_size, rbuf, 2 * block_size)
+            == SOLO5_R_OK)
+        return 26;
+    iov[1].size = block_size + 1;
+    if (solo5_block_readv(h, 0, iov, 3) == SOLO5_R_OK)
+        return 27;
+    if (solo5_block_writev(h, 0, iov, 0) == SOLO5_R_OK ||
+            solo5_block_writev(h, 0, iov, SOLO5_BLOCK_IOV_MAX + 1)
+            == SOLO5_R_OK)
+        return 28;
+    if (solo5_block_read(h, 0, rbuf, SOLO5_BLOCK_IO_MAX + block_size)
+            == SOLO5_R_OK)
+        return 29;
+
+    /*
+     * Asynchronous requests may also span multiple blocks.
+     */
+    struct solo5_block_completion c;
+    size_t n = 0;
+    memset(rbuf, 0, size);
+    if (solo5_block_submit_read(h, block_size, rbuf, size, 0) != SOLO5_R_OK)
+        return 30;
+    while (n == 0) {
+        solo5_handle_set_t ready_set = 0;
+        solo5_yield(solo5_clock_monotonic() + 1000000000ULL, &ready_set);
+        if (!(ready_set & (1ULL << h)) ||
+                solo5_block_reap(h, &c, 1, &n) != SOLO5_R_OK)
+            return 31;
+    }
+    if (c.result != SOLO5_R_OK || memcmp(rbuf, wbuf, size) != 0)
+        return 32;
+
+    return 0;
+}
+
+/*
+ * Flush synchronously, then submit several flushes together; each must
+ * complete, even where they are served by a single flush of the host.
+ * Completions are awaited with solo5_yield_events() here.
+ */
+#define FLUSHES 4
+
+static int check_flush(solo5_handle_t h)
+{
+    struct solo5_block_completion c[FLUSHES];
+    uint64_t done = 0;
+    size_t n;
+
+    if (solo5_block_flush(h) != SOLO5_R_OK)
+        return 33;
+    for (uint64_t i = 0; i < FLUSHES; i++) {
+        if (solo5_block_submit_flush(h, i) != SOLO5_R_OK)
+            return 34;
+    }
+    while (done != (1ULL << FLUSHES) - 1) {
+        struct solo5_event ev;
+        size_t nready = 0;
+        solo5_yield_events(solo5_clock_monotonic() + 1000000000ULL, &ev, 1,
+                &nready);
+        if (nready != 1 || ev.handle != h ||
+                ev.events != SOLO5_EVENT_COMPLETION ||
+                solo5_block_reap(h, c, FLUSHES, &n) != SOLO5_R_OK)
+            return 35;
+        for (size_t i = 0; i < n; i++) {
+            if (c[i].tag >= FLUSHES || (done & (1ULL << c[i].tag)) ||
+                    c[i].result != SOLO5_R_OK)
+                return 36;
+            done |= 1ULL << c[i].tag;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Write zeroes to the middle of a range of blocks, leaving the blocks on
+ * either side intact, then discard the range and zero the whole device. Uses
+ * (abuf) as scratch space.
+ */
+static int check_zeroes(solo5_handle_t h, size_t block_size,
+        solo5_off_t capacity)
+{
+    size_t size = MULTI_BLOCKS * block_size;
+    uint8_t *buf = &abuf[0][0];
+    size_t i;
+
+    if (size > sizeof abuf || capacity < size)
+        return 0;
+
+    memset(buf, 0xff, size);
+    if (solo5_block_write(h, 0, buf, size) != SOLO5_R_OK)
+        return 37;
+    if (solo5_block_write_zeroes(h, block_size, size - (2 * block_size))
+            != SOLO5_R_OK)
+        return 38;
+    if (solo5_block_read(h, 0, buf, size) != SOLO5_R_OK)
+        return 39;
+    for (i = 0; i < size; i++) {
+        bool edge = (i < block_size || i >= size - block_size);
+        if (buf[i] != (edge ? 0xff : 0))
+            return 40;
+    }
+
+    if (solo5_block_discard(h, 0, size) != SOLO5_R_OK)
+        return 41;
+    if (solo5_block_write_zeroes(h, 0, capacity) != SOLO5_R_OK)
+        return 42;
+    memset(buf, 0xff, block_size);
+    if (solo5_block_read(h, capacity - block_size, buf, block_size)
+            != SOLO5_R_OK)
+        return 43;
+    for (i = 0; i < block_size; i++) {
+        if (buf[i] != 0)
+            return 44;
+    }
+
+    /*
+     * Invalid requests: empty, not aligned to the block size, and extending
+     * beyond the end of the device.
+     */
+    if (solo5_block_discard(h, 0, 0) == SOLO5_R_OK ||
+            solo5_block_write_zeroes(h, 0, 0) == SOLO5_R_OK)
+        return 45;
+    if (solo5_block_discard(h, 1, block_size) == SOLO5_R_OK ||
+            solo5_block_write_zeroes(h, 0, block_size - 1) == SOLO5_R_OK)
+        return 46;
+    if (solo5_block_discard(h, block_size, capacity) == SOLO5_R_OK ||
+            solo5_block_write_zeroes(h, capacity, block_size) == SOLO5_R_OK)
+        return 47;
+
+    return 0;
+}
+
+/*
+ * Prefetch the whole device, zeroed by check_zeroes(), and read it back
+ * sequentially, which the host may detect and read ahead. Uses (abuf) as
+ * scratch space.
+ */
+static int check_prefetch(solo5_handle_t h, size_t block_size,
+        solo5_off_t capacity)
+{
+    size_t size = MULTI_BLOCKS * block_size;
+    uint8_t *buf = &abuf[0][0];
+
+    if (size > sizeof abuf)
+        return 0;
+    if (solo5_block_prefetch(h, 0, capacity) != SOLO5_R_OK)
+        return 53;
+    for (solo5_off_t offset = 0; offset < capacity; offset += size) {
+        size_t n = (capacity - offset < size) ? capacity - offset : size;
+        memset(buf, 0xff, n);
+        if (solo5_block_read(h, offset, buf, n) != SOLO5_R_OK)
+            return 54;
+        for (size_t i = 0; i < n; i++) {
+            if (buf[i] != 0)
+                return 55;
+        }
+    }
+
+    if (solo5_block_prefetch(h, 0, 0) == SOLO5_R_OK ||
+            solo5_block_prefetch(h, 1, block_size) == SOLO5_R_OK ||
+            solo5_block_prefetch(h, block_size, capacity) == SOLO5_R_OK)
+        return 56;
+
+    return 0;
+}
+
+/*
+ * The device is a disk image, so it is not zoned, and zone operations fail.
+ */
+static int check_zones(solo5_handle_t h, const struct solo5_block_info *bi)
+{
+    struct solo5_block_zone z;
+    solo5_off_t offset;
+    size_t nzones;
+
+    if (bi->zone_size != 0)
+        return 57;
+    if (solo5_block_zone_report(h, 0, &z, 1, &nzones) == SOLO5_R_OK ||
+            solo5_block_zone_append(h, 0, &abuf[0][0], bi->block_size,
+                &offset) == SOLO5_R_OK ||
+            solo5_block_zone_manage(h, SOLO5_BLOCK_ZONE_RESET, 0) ==
+                SOLO5_R_OK)
+        return 58;
+
+    return 0;
+}
+
+/*
+ * Check that one read, one write and one failed request are counted, if the
+ * bindings keep statistics at all.
+ */
+static int check_stats(solo5_handle_t h, size_t block_size)
+{
+    struct solo5_block_stats s0, s1;
+    struct solo5_call_stats c0, c1;
+    uint8_t *buf = &abuf[0][0];
+
+    solo5_result_t rc = solo5_block_stats(h, &s0);
+    if (rc == SOLO5_R_EUNSPEC)
+        return 0;
+    if (rc != SOLO5_R_OK ||
+            solo5_call_stats(h, SOLO5_CALL_BLOCK_READ, &c0) != SOLO5_R_OK)
+        return 48;
+    if (solo5_block_write(h, 0, buf, block_size) != SOLO5_R_OK ||
+            solo5_block_read(h, 0, buf, block_size) != SOLO5_R_OK ||
+            solo5_block_read(h, 1, buf, block_size) == SOLO5_R_OK)
+        return 49;
+    if (solo5_block_stats(h, &s1) != SOLO5_R_OK ||
+            solo5_call_stats(h, SOLO5_CALL_BLOCK_READ, &c1) != SOLO5_R_OK)
+        return 50;
+    if (c1.calls != c0.calls + 2 || c1.bytes != c0.bytes + block_size ||
+            c1.again != c0.again)
+        return 67;
+    if (s1.write_ops != s0.write_ops + 1 ||
+            s1.write_bytes != s0.write_bytes + block_size ||
+            s1.read_ops != s0.read_ops + 1 ||
+            s1.read_bytes != s0.read_bytes + block_size ||
+            s1.errors != s0.errors + 1)
+        return 51;
+    if (solo5_block_stats(h + 1, &s1) != SOLO5_R_EINVAL)
+        return 52;
+    if (solo5_call_stats(h, SOLO5_CALL_MAX, &c1) != SOLO5_R_EINVAL)
+        return 68;
+
+    return 0;
+}
+
 int solo5_app_main(const struct solo5_start_info *si __attribute__((unused)))
 {
     puts("\n**** Solo5 standalone test_blk ****\n\n");
@@ -125,6 +554,31 @@ int solo5_app_main(const struct solo5_start_info *si __attribute__((unused)))
             == SOLO5_R_OK)
         return 11;
 
+    int rc = check_async(h, bi.block_size);
+    if (rc != 0)
+        return rc;
+    rc = check_fixed(h, bi.block_size);
+    if (rc != 0)
+        return rc;
+    rc = check_multi(h, bi.block_size, bi.capacity);
+    if (rc != 0)
+        return rc;
+    rc = check_flush(h);
+    if (rc != 0)
+        return rc;
+    rc = check_zeroes(h, bi.block_size, bi.capacity);
+    if (rc != 0)
+        return rc;
+    rc = check_prefetch(h, bi.block_size, bi.capacity);
+    if (rc != 0)
+        return rc;
+    rc = check_zones(h, &bi);
+    if (rc != 0)
+        return rc;
+    rc = check_stats(h, bi.block_size);
+    if (rc != 0)
+        return rc;
+
     puts("SUCCESS\n");
 
     return SOLO5_EXIT_SUCCESS;
@@ -0,0 +1,258 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Block I/O benchmark: measures sequential and random read and write IOPS,
+ * throughput and latency on the "storage" device, for each request size and
+ * queue depth. A queue depth of 1 uses the synchronous interfaces, larger
+ * ones the asynchronous interfaces. The contents of the device are
+ * overwritten.
+ *
+ * Each combination runs for one second, or for 20 ms if given "quick" on the
+ * command line.
+ */
+
+#include "solo5.h"
+#include "../../bindings/lib.c"
+
+static void puts(const char *s)
+{
+    solo5_console_write(s, strlen(s));
+}
+
+static void put_ulong(unsigned long n)
+{
+    char buf[24];
+    size_t i = sizeof buf;
+
+    buf[--i] = '\0';
+    do {
+        buf[--i] = '0' + (n % 10);
+        n /= 10;
+    } while (n != 0);
+    puts(&buf[i]);
+}
+
+#define QD_MAX 32
+#define HIST_BUCKETS 32         /* Latency buckets, powers of 2 in us */
+
+static const size_t sizes[] = { 512, 4096, 65536, SOLO5_BLOCK_IO_MAX };
+static const unsigned depths[] = { 1, 8, QD_MAX };
+
+static uint8_t bufs[QD_MAX][SOLO5_BLOCK_IO_MAX] __attribute__((aligned(4096)));
+
+static solo5_handle_t h;
+static struct solo5_block_info info;
+static solo5_time_t duration = 1000000000ULL;
+
+struct run {
+    bool write;
+    bool random;
+    size_t size;
+    unsigned depth;
+    solo5_off_t next;           /* Next sequential offset */
+    uint64_t rand;              /* xorshift64 state */
+    unsigned long ops;
+    unsigned long hist[HIST_BUCKETS];
+};
+
+static solo5_off_t next_offset(struct run *r)
+{
+    uint64_t nblocks = info.capacity / r->size;
+    solo5_off_t offset;
+
+    if (r->random) {
+        r->rand ^= r->rand << 13;
+        r->rand ^= r->rand >> 7;
+        r->rand ^= r->rand << 17;
+        return (r->rand % nblocks) * r->size;
+    }
+    offset = r->next;
+    r->next += r->size;
+    if (r->next + r->size > info.capacity)
+        r->next = 0;
+    return offset;
+}
+
+static void record(struct run *r, solo5_time_t ns)
+{
+    unsigned b = 0;
+
+    for (solo5_time_t us = ns / 1000; us != 0 && b < HIST_BUCKETS - 1; us >>= 1)
+        b++;
+    r->hist[b]++;
+    r->ops++;
+}
+
+/*
+ * Returns the upper bound, in us, of the latency bucket holding the (pct)th
+ * percentile.
+ */
+static unsigned long percentile(const struct run *r, unsigned pct)
+{
+    unsigned long want = (r->ops * pct + 99) / 100, seen = 0;
+
+    for (unsigned b = 0; b < HIST_BUCKETS; b++) {
+        seen += r->hist[b];
+        if (seen >= want)
+            return 1UL << b;
+    }
+    return 1UL << (HIST_BUCKETS - 1);
+}
+
+static bool run_sync(struct run *r)
+{
+    solo5_time_t start = solo5_clock_monotonic(), now = start;
+
+    while (now - start < duration) {
+        solo5_off_t offset = next_offset(r);
+        solo5_result_t rc = r->write ?
+            solo5_block_write(h, offset, bufs[0], r->size) :
+            solo5_block_read(h, offset, bufs[0], r->size);
+        solo5_time_t t = solo5_clock_monotonic();
+
+        if (rc != SOLO5_R_OK)
+            return false;
+        record(r, t - now);
+        now = t;
+    }
+    return true;
+}
+
+static bool run_async(struct run *r)
+{
+    struct solo5_block_completion c[QD_MAX];
+    solo5_time_t submitted[QD_MAX];
+    unsigned free_slots[QD_MAX], nfree = r->depth;
+    solo5_time_t start = solo5_clock_monotonic(), now = start;
+    size_t n;
+
+    for (unsigned i = 0; i < r->depth; i++)
+        free_slots[i] = i;
+
+    while (now - start < duration || nfree < r->depth) {
+        while (nfree > 0 && now - start < duration) {
+            unsigned slot = free_slots[nfree - 1];
+            solo5_off_t offset = next_offset(r);
+            solo5_result_t rc = r->write ?
+                solo5_block_submit_write(h, offset, bufs[slot], r->size, slot) :
+                solo5_block_submit_read(h, offset, bufs[slot], r->size, slot);
+
+            if (rc == SOLO5_R_AGAIN)
+                break;
+            if (rc != SOLO5_R_OK)
+                return false;
+            submitted[slot] = solo5_clock_monotonic();
+            nfree--;
+        }
+
+        solo5_result_t rc = solo5_block_reap(h, c, QD_MAX, &n);
+        if (rc == SOLO5_R_AGAIN) {
+            solo5_yield(solo5_clock_monotonic() + duration, NULL);
+            now = solo5_clock_monotonic();
+            continue;
+        }
+        if (rc != SOLO5_R_OK)
+            return false;
+        now = solo5_clock_monotonic();
+        for (size_t i = 0; i < n; i++) {
+            if (c[i].result != SOLO5_R_OK)
+                return false;
+            record(r, now - submitted[c[i].tag]);
+            free_slots[nfree++] = c[i].tag;
+        }
+    }
+    return true;
+}
+
+static void report(const struct run *r)
+{
+    unsigned long ops_s = r->ops * 1000000000ULL / duration;
+
+    puts(r->random ? "rand " : "seq  ");
+    puts(r->write ? "write " : "read  ");
+    put_ulong(r->size);
+    puts(" qd");
+    put_ulong(r->depth);
+    puts(": ");
+    put_ulong(ops_s);
+    puts(" IOPS ");
+    put_ulong(ops_s * r->size / 1024);
+    puts(" KiB/s, latency us p50 <");
+    put_ulong(percentile(r, 50));
+    puts(" p99 <");
+    put_ulong(percentile(r, 99));
+    puts(" max <");
+    put_ulong(percentile(r, 100));
+    puts("\n  histogram (us):");
+    for (unsigned b = 0; b < HIST_BUCKETS; b++) {
+        if (r->hist[b] == 0)
+            continue;
+        puts(" <");
+        put_ulong(1UL << b);
+        puts(":");
+        put_ulong(r->hist[b]);
+    }
+    puts("\n");
+}
+
+int solo5_app_main(const struct solo5_start_info *si)
+{
+    puts("\n**** Solo5 standalone test_blk_bench ****\n\n");
+
+    if (strcmp(si->cmdline, "quick") == 0)
+        duration = 20000000ULL;
+    else if (si->cmdline[0] != '\0') {
+        puts("Usage: test_blk_bench [ quick ]\n");
+        return SOLO5_EXIT_FAILURE;
+    }
+
+    if (solo5_block_acquire("storage", &h, &info) != SOLO5_R_OK) {
+        puts("Could not acquire 'storage' block device\n");
+        return SOLO5_EXIT_FAILURE;
+    }
+    for (unsigned i = 0; i < QD_MAX; i++)
+        memset(bufs[i], 'A' + i, SOLO5_BLOCK_IO_MAX);
+
+    for (unsigned pattern = 0; pattern < 4; pattern++) {
+        for (size_t s = 0; s < sizeof sizes / sizeof sizes[0]; s++) {
+            for (size_t d = 0; d < sizeof depths / sizeof depths[0]; d++) {
+                struct run r = {
+                    .write = pattern & 1, .random = pattern & 2,
+                    .size = sizes[s], .depth = depths[d],
+                    .rand = 0x9e3779b97f4a7c15ULL
+                };
+
+                if (r.size < info.block_size || r.size % info.block_size ||
+                        r.size > info.capacity)
+                    continue;
+                if (!(r.depth == 1 ? run_sync(&r) : run_async(&r))) {
+                    puts("I/O error\n");
+                    puts("FAILURE\n");
+                    return SOLO5_EXIT_FAILURE;
+                }
+                report(&r);
+            }
+        }
+    }
+
+    puts("SUCCESS\n");
+    return SOLO5_EXIT_SUCCESS;
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "solo5.h"
+#include "../../bindings/lib.c"
+
+static void puts(const char *s)
+{
+    solo5_console_write(s, strlen(s));
+}
+
+/*
+ * Written to the device at MAGIC_OFFSET by tests.bats.
+ */
+#define MAGIC "Solo5 mapped block device"
+#define MAGIC_OFFSET 4096
+
+int solo5_app_main(const struct solo5_start_info *si __attribute__((unused)))
+{
+    puts("\n**** Solo5 standalone test_blk_map ****\n\n");
+
+    solo5_handle_t h;
+    struct solo5_block_info bi;
+    if (solo5_block_acquire("storage", &h, &bi) != SOLO5_R_OK) {
+        puts("Could not acquire 'storage' block device\n");
+        return 99;
+    }
+
+    const uint8_t *data;
+    if (solo5_block_map(h, &data) != SOLO5_R_OK) {
+        puts("Could not map 'storage' block device\n");
+        return 1;
+    }
+    if (memcmp(data + MAGIC_OFFSET, MAGIC, sizeof MAGIC - 1) != 0)
+        return 2;
+
+    /*
+     * Contents read through memory and with solo5_block_read() must match,
+     * up to the end of the device.
+     */
+    uint8_t buf[bi.block_size];
+    for (solo5_off_t offset = 0; offset < bi.capacity;
+            offset += (10 * bi.block_size)) {
+        if (solo5_block_read(h, offset, buf, bi.block_size) != SOLO5_R_OK)
+            return 3;
+        if (memcmp(data + offset, buf, bi.block_size) != 0)
+            return 4;
+    }
+    solo5_off_t last_block = bi.capacity - bi.block_size;
+    if (solo5_block_read(h, last_block, buf, bi.block_size) != SOLO5_R_OK)
+        return 5;
+    if (memcmp(data + last_block, buf, bi.block_size) != 0)
+        return 6;
+
+    /*
+     * The device is read-only.
+     */
+    if (solo5_block_write(h, 0, buf, bi.block_size) == SOLO5_R_OK)
+        return 7;
+
+    puts("SUCCESS\n");
+
+    return SOLO5_EXIT_SUCCESS;
+}
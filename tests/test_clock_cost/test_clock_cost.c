@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Measures the cost of reading the monotonic clock, on one CPU and then on
+ * all CPUs at once, checking that it never goes backwards on any CPU.
+ */
+
+#include "solo5.h"
+#include "../../bindings/lib.c"
+
+#define CPUS_MAX 64
+#define STACK_SIZE 16384
+#define CALLS 1000000UL
+
+static uint8_t stacks[CPUS_MAX][STACK_SIZE] __attribute__((aligned(16)));
+static unsigned started;
+static unsigned done;
+static unsigned backwards;
+static uint64_t cpu_nsecs;
+
+static void puts(const char *s)
+{
+    solo5_console_write(s, strlen(s));
+}
+
+static void put_ulong(unsigned long n)
+{
+    char buf[24];
+    size_t i = sizeof buf;
+
+    buf[--i] = '\0';
+    do {
+        buf[--i] = '0' + (n % 10);
+        n /= 10;
+    } while (n != 0);
+    puts(&buf[i]);
+}
+
+/*
+ * Reads the clock CALLS times, returning the time taken.
+ */
+static solo5_time_t read_clock(void)
+{
+    solo5_time_t start = solo5_clock_monotonic();
+    solo5_time_t prev = start;
+
+    for (unsigned long i = 0; i < CALLS; i++) {
+        solo5_time_t now = solo5_clock_monotonic();
+        if (now < prev)
+            __atomic_add_fetch(&backwards, 1, __ATOMIC_RELAXED);
+        prev = now;
+    }
+    return prev - start;
+}
+
+static void cpu_main(void *arg)
+{
+    unsigned cpus = (uintptr_t)arg;
+
+    __atomic_add_fetch(&started, 1, __ATOMIC_RELAXED);
+    while (__atomic_load_n(&started, __ATOMIC_RELAXED) != cpus)
+        ;
+    __atomic_add_fetch(&cpu_nsecs, read_clock(), __ATOMIC_RELAXED);
+    __atomic_add_fetch(&done, 1, __ATOMIC_RELEASE);
+}
+
+int solo5_app_main(const struct solo5_start_info *si __attribute__((unused)))
+{
+    puts("\n**** Solo5 standalone test_clock_cost ****\n\n");
+
+    puts("solo5_clock_monotonic: ");
+    put_ulong(read_clock() / (CALLS / 1000));
+    puts(" ps/call\n");
+
+    unsigned cpus = solo5_cpu_count();
+    if (cpus > CPUS_MAX)
+        cpus = CPUS_MAX;
+    if (cpus > 1) {
+        started = 1;
+        for (uintptr_t cpu = 1; cpu < cpus; cpu++) {
+            if (solo5_cpu_start(cpu, cpu_main, (void *)(uintptr_t)cpus,
+                        (uintptr_t)&stacks[cpu][STACK_SIZE], 0) != SOLO5_R_OK)
+                return 1;
+        }
+        while (__atomic_load_n(&started, __ATOMIC_RELAXED) != cpus)
+            ;
+        solo5_time_t nsecs = read_clock();
+        while (__atomic_load_n(&done, __ATOMIC_ACQUIRE) != cpus - 1)
+            ;
+        nsecs += __atomic_load_n(&cpu_nsecs, __ATOMIC_RELAXED);
+        put_ulong(cpus);
+        puts(" CPUs: solo5_clock_monotonic: ");
+        put_ulong(nsecs / (cpus * (CALLS / 1000)));
+        puts(" ps/call\n");
+    }
+
+    if (backwards != 0) {
+        puts("Clock went backwards\n");
+        return 2;
+    }
+    puts("SUCCESS\n");
+    return SOLO5_EXIT_SUCCESS;
+}
@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "solo5.h"
+#include "../../bindings/lib.c"
+
+#if defined(__x86_64__)
+/* Variant II */
+struct tcb {
+    volatile uint64_t _data;
+    void *tp;
+};
+#elif defined(__aarch64__)
+/* Variant I */
+struct tcb {
+    void *tp;
+    void *pad;
+    volatile uint64_t _data;
+};
+#else
+#error Unsupported architecture
+#endif
+
+#define CPUS_MAX 64
+#define STACK_SIZE 16384
+#define ITERATIONS 100000
+
+static uint8_t stacks[CPUS_MAX][STACK_SIZE] __attribute__((aligned(16)));
+static struct tcb tcbs[CPUS_MAX];
+static uint64_t counter;
+static unsigned done;
+
+static void puts(const char *s)
+{
+    solo5_console_write(s, strlen(s));
+}
+
+__thread volatile uint64_t _data;
+
+static void cpu_main(void *arg)
+{
+    uint64_t cpu = (uintptr_t)arg;
+
+    /*
+     * Each CPU must see its own TLS.
+     */
+    _data = cpu;
+    for (unsigned i = 0; i < ITERATIONS; i++)
+        __atomic_add_fetch(&counter, 1, __ATOMIC_RELAXED);
+    if (_data == cpu && tcbs[cpu]._data == cpu)
+        __atomic_add_fetch(&done, 1, __ATOMIC_RELEASE);
+}
+
+int solo5_app_main(const struct solo5_start_info *si __attribute__((unused)))
+{
+    puts("\n**** Solo5 standalone test_cpus ****\n\n");
+
+    unsigned cpus = solo5_cpu_count();
+    if (cpus < 2 || cpus > CPUS_MAX)
+        return 1;
+
+    if (solo5_cpu_start(0, cpu_main, NULL, (uintptr_t)stacks[1], 0) !=
+            SOLO5_R_EINVAL)
+        return 2;
+    if (solo5_cpu_start(cpus, cpu_main, NULL, (uintptr_t)stacks[1], 0) !=
+            SOLO5_R_EINVAL)
+        return 3;
+
+    for (unsigned cpu = 1; cpu < cpus; cpu++) {
+        tcbs[cpu].tp = &tcbs[cpu].tp;
+        if (solo5_cpu_start(cpu, cpu_main, (void *)(uintptr_t)cpu,
+                    (uintptr_t)&stacks[cpu][STACK_SIZE],
+                    (uintptr_t)tcbs[cpu].tp) != SOLO5_R_OK)
+            return 4;
+    }
+    if (solo5_cpu_start(1, cpu_main, NULL, (uintptr_t)&stacks[1][STACK_SIZE],
+                0) != SOLO5_R_EINVAL)
+        return 5;
+
+    solo5_time_t deadline = solo5_clock_monotonic() + 10000000000ULL;
+    while (__atomic_load_n(&done, __ATOMIC_ACQUIRE) != cpus - 1) {
+        if (solo5_clock_monotonic() > deadline)
+            return 6;
+    }
+    if (__atomic_load_n(&counter, __ATOMIC_RELAXED) !=
+            (uint64_t)ITERATIONS * (cpus - 1))
+        return 7;
+
+    puts("SUCCESS\n");
+    return SOLO5_EXIT_SUCCESS;
+}
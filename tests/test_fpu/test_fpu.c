@@ -26,6 +26,170 @@ static void puts(const char *s)
     solo5_console_write(s, strlen(s));
 }
 
+#if defined(__x86_64__)
+static void cpuid(uint32_t leaf, uint32_t *eax, uint32_t *ebx, uint32_t *ecx,
+        uint32_t *edx)
+{
+    __asm__ __volatile__("cpuid"
+        : "=a" (*eax), "=b" (*ebx), "=c" (*ecx), "=d" (*edx)
+        : "0" (leaf), "2" (0)
+    );
+}
+
+static uint64_t xgetbv(void)
+{
+    uint32_t eax, edx;
+
+    __asm__ __volatile__("xgetbv" : "=a" (eax), "=d" (edx) : "c" (0));
+    return ((uint64_t)edx << 32) | eax;
+}
+
+__attribute__((target("avx")))
+static void square_avx(float y[8])
+{
+    __asm__ (
+        "vmovups %0, %%ymm1;"
+        "vmulps %%ymm1, %%ymm1, %%ymm1;"
+        "vmovups %%ymm1, %0;"
+        "vzeroupper"
+        : "+m" (*(float (*)[8])y)
+        :
+        : "xmm1"
+    );
+}
+
+/*
+ * Uses an opmask and one of the upper 16 registers so that all three AVX-512
+ * state components are touched.
+ */
+__attribute__((target("avx512f")))
+static void square_avx512(float z[16])
+{
+    __asm__ (
+        "kxnorw %%k1, %%k1, %%k1;"
+        "vmovups %0, %%zmm17%{%%k1%};"
+        "vmulps %%zmm17, %%zmm17, %%zmm17;"
+        "vmovups %%zmm17, %0"
+        : "+m" (*(float (*)[16])z)
+        :
+        : "xmm17", "k1"
+    );
+}
+
+/*
+ * Exercise AVX and AVX-512 state if CPUID advertises them. Advertising either
+ * without the matching XCR0 state enabled is a failure, as the guest would
+ * take #UD on its first such instruction.
+ */
+static bool test_avx(void)
+{
+    uint32_t eax, ebx, ecx, edx;
+    uint32_t max;
+    struct solo5_cpu_info info;
+
+    /*
+     * solo5_cpu_info() must report exactly what is usable.
+     */
+    solo5_cpu_info(&info);
+    cpuid(0, &max, &ebx, &ecx, &edx);
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    if (!(ecx & (1U << 27)) || !(ecx & (1U << 28))) {
+        puts("AVX: not available\n");
+        return !(info.features & SOLO5_CPU_AVX);
+    }
+    uint64_t xcr0 = xgetbv();
+    if ((xcr0 & 0x6) != 0x6) {
+        puts("AVX: advertised but not enabled in XCR0\n");
+        return false;
+    }
+
+    float y[8] = { 1.0, 2.0, 3.0, 4.0, 5.0, 6.0, 7.0, 8.0 };
+    square_avx(y);
+    for (int i = 0; i < 8; i++)
+        if (y[i] != (float)((i + 1) * (i + 1)))
+            return false;
+    if (!(info.features & SOLO5_CPU_AVX))
+        return false;
+    puts("AVX: OK\n");
+
+    if (max < 7)
+        return true;
+    cpuid(7, &eax, &ebx, &ecx, &edx);
+    if (!(ebx & (1U << 16))) {
+        puts("AVX-512: not available\n");
+        return !(info.features & SOLO5_CPU_AVX512F);
+    }
+    if ((xcr0 & 0xe6) != 0xe6) {
+        puts("AVX-512: advertised but not enabled in XCR0\n");
+        return false;
+    }
+
+    float z[16];
+    for (int i = 0; i < 16; i++)
+        z[i] = (float)(i + 1);
+    square_avx512(z);
+    for (int i = 0; i < 16; i++)
+        if (z[i] != (float)((i + 1) * (i + 1)))
+            return false;
+    if (!(info.features & SOLO5_CPU_AVX512F))
+        return false;
+    puts("AVX-512: OK\n");
+    return true;
+}
+#endif
+
+#if defined(__aarch64__)
+/*
+ * Squares as many elements of (v) as fit in one SVE vector, which holds up to
+ * 64 floats.
+ */
+static void square_sve(float v[64])
+{
+    __asm__ __volatile__(
+        ".arch_extension sve\n"
+        "ptrue p0.s\n"
+        "ld1w {z0.s}, p0/z, [%0]\n"
+        "fmul z0.s, z0.s, z0.s\n"
+        "st1w {z0.s}, p0, [%0]\n"
+        :
+        : "r" (v)
+        : "v0", "memory"
+    );
+}
+
+/*
+ * Exercise SVE if it is reported as usable, with whatever vector length the
+ * host gave us.
+ */
+static bool test_sve(void)
+{
+    struct solo5_cpu_info info;
+    static float v[64];
+    uint64_t n;
+
+    solo5_cpu_info(&info);
+    if (!(info.features & SOLO5_CPU_SVE)) {
+        puts("SVE: not available\n");
+        return true;
+    }
+    __asm__ __volatile__(
+        ".arch_extension sve\n"
+        "cntw %0"
+        : "=r" (n)
+    );
+    if (n < 4 || n > 64 || (n & 3) != 0)
+        return false;
+    for (uint64_t i = 0; i < 64; i++)
+        v[i] = (float)(i + 1);
+    square_sve(v);
+    for (uint64_t i = 0; i < 64; i++)
+        if (v[i] != (i < n ? (float)((i + 1) * (i + 1)) : (float)(i + 1)))
+            return false;
+    puts("SVE: OK\n");
+    return true;
+}
+#endif
+
 int solo5_app_main(const struct solo5_start_info *si __attribute__((unused)))
 {
     puts("\n**** Solo5 standalone test_fpu ****\n\n");
@@ -60,6 +224,14 @@ int solo5_app_main(const struct solo5_start_info *si __attribute__((unused)))
 #error Unsupported architecture
 #endif
 
+#if defined(__x86_64__)
+    if (!test_avx())
+        return SOLO5_EXIT_FAILURE;
+#elif defined(__aarch64__)
+    if (!test_sve())
+        return SOLO5_EXIT_FAILURE;
+#endif
+
     a = 1.5;
     b = 5.0;
     a *= b;
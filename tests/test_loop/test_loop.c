@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include "solo5.h"
+#include "solo5_loop.h"
+#include "../../bindings/lib.c"
+#include "../../bindings/loop.c"
+
+static void puts(const char *s)
+{
+    solo5_console_write(s, strlen(s));
+}
+
+#define NTIMERS 64
+#define INTERVAL 1000000ULL             /* 1ms */
+
+static struct solo5_timer timers[NTIMERS];
+static solo5_time_t deadlines[NTIMERS];
+static solo5_time_t last;
+static int nfired;
+static bool failed;
+
+/*
+ * Timers run in order of deadline, not before it. The odd timers stop the
+ * next one, which therefore never runs.
+ */
+static void timer_fn(struct solo5_loop *loop, struct solo5_timer *timer,
+        void *arg)
+{
+    size_t i = (size_t)arg;
+
+    if (solo5_timer_active(timer) || timer->deadline < last ||
+            solo5_loop_now(loop) < deadlines[i])
+        failed = true;
+    last = timer->deadline;
+    nfired++;
+    if (i % 2 == 1 && i + 1 < NTIMERS)
+        solo5_timer_stop(loop, &timers[i + 1]);
+}
+
+static struct solo5_timer periodic;
+static int nticks;
+
+/*
+ * Restarting a timer with a deadline which has already passed must not run
+ * it again until the next iteration of the loop, which yields in between.
+ */
+static void periodic_fn(struct solo5_loop *loop, struct solo5_timer *timer,
+        void *arg __attribute__((unused)))
+{
+    if (++nticks == 10) {
+        solo5_loop_stop(loop);
+        return;
+    }
+    solo5_timer_start(loop, timer, solo5_loop_now(loop));
+}
+
+int solo5_app_main(const struct solo5_start_info *si __attribute__((unused)))
+{
+    struct solo5_loop loop;
+
+    puts("\n**** Solo5 standalone test_loop ****\n\n");
+
+    solo5_loop_init(&loop);
+    solo5_time_t start = solo5_loop_now(&loop);
+    /*
+     * Start the timers in an order other than that of their deadlines, and
+     * restart some of them.
+     */
+    for (size_t i = 0; i < NTIMERS; i++) {
+        size_t j = (i * 37) % NTIMERS;
+        deadlines[j] = start + (j + 1) * INTERVAL;
+        solo5_timer_init(&timers[j], timer_fn, (void *)j);
+        solo5_timer_start(&loop, &timers[j], start);
+    }
+    for (size_t i = 0; i < NTIMERS; i++)
+        solo5_timer_start(&loop, &timers[i], deadlines[i]);
+
+    solo5_loop_run(&loop);
+    if (failed || nfired != NTIMERS / 2 + 1) {
+        puts("ERROR: timers ran out of order or too early\n");
+        return SOLO5_EXIT_FAILURE;
+    }
+    if (solo5_clock_monotonic() < start + NTIMERS * INTERVAL) {
+        puts("ERROR: loop returned early\n");
+        return SOLO5_EXIT_FAILURE;
+    }
+
+    solo5_timer_init(&periodic, periodic_fn, NULL);
+    solo5_timer_start(&loop, &periodic, 0);
+    for (int i = 0; i < 10; i++) {
+        if (!solo5_loop_run_once(&loop, false) || nticks != i + 1) {
+            puts("ERROR: restarted timer ran twice in one iteration\n");
+            return SOLO5_EXIT_FAILURE;
+        }
+    }
+    if (solo5_timer_active(&periodic) || solo5_loop_run_once(&loop, true)) {
+        puts("ERROR: loop did not stop\n");
+        return SOLO5_EXIT_FAILURE;
+    }
+
+    puts("SUCCESS\n");
+    return SOLO5_EXIT_SUCCESS;
+}
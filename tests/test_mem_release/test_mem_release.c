@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include "solo5.h"
+#include "../../bindings/lib.c"
+
+static void puts(const char *s)
+{
+    solo5_console_write(s, strlen(s));
+}
+
+#define NSEC_PER_SEC 1000000000ULL
+#define NPAGES 64
+
+static uint8_t pattern(size_t i)
+{
+    return (uint8_t)(i * 7 + 3);
+}
+
+static void fill(uint8_t *p, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+        p[i] = pattern(i);
+}
+
+static bool check(const uint8_t *p, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+        if (p[i] != pattern(i))
+            return false;
+    return true;
+}
+
+int solo5_app_main(const struct solo5_start_info *si)
+{
+    puts("\n**** Solo5 standalone test_mem_release ****\n\n");
+
+    uintptr_t base = (si->heap_start + SOLO5_PAGE_SIZE - 1) &
+        ~(uintptr_t)(SOLO5_PAGE_SIZE - 1);
+    uint8_t *mem = (uint8_t *)base;
+    size_t size = NPAGES * SOLO5_PAGE_SIZE;
+    fill(mem, size);
+
+    if (solo5_mem_release(base + 1, SOLO5_PAGE_SIZE) != SOLO5_R_EINVAL ||
+            solo5_mem_release(base, 1) != SOLO5_R_EINVAL ||
+            solo5_mem_release(si->heap_start + si->heap_size,
+                SOLO5_PAGE_SIZE) != SOLO5_R_EINVAL) {
+        puts("ERROR: invalid release not rejected\n");
+        return SOLO5_EXIT_FAILURE;
+    }
+
+    /*
+     * Releasing the middle of the range leaves the rest of it alone.
+     */
+    size_t off = (NPAGES / 4) * SOLO5_PAGE_SIZE;
+    solo5_result_t rc = solo5_mem_release(base + off, size / 2);
+    if (rc == SOLO5_R_EUNSPEC) {
+        puts("Memory reclaim not supported\n");
+        puts("SUCCESS\n");
+        return SOLO5_EXIT_SUCCESS;
+    }
+    else if (rc != SOLO5_R_OK) {
+        puts("ERROR: solo5_mem_release() failed\n");
+        return SOLO5_EXIT_FAILURE;
+    }
+    if (!check(mem, off) ||
+            !check(mem + off + size / 2, size - off - size / 2)) {
+        puts("ERROR: memory outside the released range changed\n");
+        return SOLO5_EXIT_FAILURE;
+    }
+
+    /*
+     * Released memory can be used again.
+     */
+    fill(mem, size);
+    if (!check(mem, size)) {
+        puts("ERROR: released memory not usable\n");
+        return SOLO5_EXIT_FAILURE;
+    }
+
+    /*
+     * If asked to, wait for the host to request memory to be released.
+     */
+    if (strcmp(si->cmdline, "request") == 0) {
+        solo5_time_t deadline = solo5_clock_monotonic() + 30 * NSEC_PER_SEC;
+        while (!solo5_mem_reclaim_requested()) {
+            solo5_time_t now = solo5_clock_monotonic();
+            if (now >= deadline) {
+                puts("ERROR: no request to release memory\n");
+                return SOLO5_EXIT_FAILURE;
+            }
+            solo5_yield(now + NSEC_PER_SEC / 100, NULL);
+        }
+        if (solo5_mem_release(base, size) != SOLO5_R_OK) {
+            puts("ERROR: solo5_mem_release() failed\n");
+            return SOLO5_EXIT_FAILURE;
+        }
+        puts("Released memory on request\n");
+    }
+
+    puts("SUCCESS\n");
+    return SOLO5_EXIT_SUCCESS;
+}
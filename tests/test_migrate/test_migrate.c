@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "solo5.h"
+#include "../../bindings/lib.c"
+
+static void puts(const char *s)
+{
+    solo5_console_write(s, strlen(s));
+}
+
+#define NSEC_PER_SEC 1000000000ULL
+
+/*
+ * Rewritten continually, so that the guest is migrated while doing so.
+ */
+static uint8_t state[1 << 20];
+
+static uint8_t pattern(size_t i, unsigned gen)
+{
+    return (uint8_t)(i * 7 + gen);
+}
+
+int solo5_app_main(const struct solo5_start_info *si __attribute__((unused)))
+{
+    puts("\n**** Solo5 standalone test_migrate ****\n\n");
+
+    /*
+     * Runs for 3 seconds of guest time, which does not include the time for
+     * which the guest is stopped.
+     */
+    solo5_time_t start = solo5_clock_monotonic();
+    unsigned gen = 0;
+    for (size_t i = 0; i < sizeof state; i++)
+        state[i] = pattern(i, gen);
+    while (solo5_clock_monotonic() - start < 3 * NSEC_PER_SEC) {
+        for (size_t i = 0; i < sizeof state; i++) {
+            if (state[i] != pattern(i, gen)) {
+                puts("ERROR: state not preserved\n");
+                return SOLO5_EXIT_FAILURE;
+            }
+        }
+        gen++;
+        for (size_t i = 0; i < sizeof state; i++)
+            state[i] = pattern(i, gen);
+        solo5_yield(solo5_clock_monotonic() + NSEC_PER_SEC / 100, NULL);
+    }
+
+    if (solo5_clock_wall() < 1483228800ULL * NSEC_PER_SEC) {
+        puts("ERROR: wall time is before 2017\n");
+        return SOLO5_EXIT_FAILURE;
+    }
+
+    puts("SUCCESS\n");
+    return SOLO5_EXIT_SUCCESS;
+}
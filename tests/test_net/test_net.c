@@ -91,28 +91,9 @@ struct pingpkt {
     struct ping ping;
 };
 
-/* Copied from https://tools.ietf.org/html/rfc1071 */
-static uint16_t checksum(uint16_t *addr, size_t count)
+static uint16_t checksum(const void *buf, size_t size)
 {
-    /* Compute Internet Checksum for "count" bytes
-     * beginning at location "addr".*/
-    register long sum = 0;
-
-    while (count > 1)  {
-        /*  This is the inner loop */
-        sum += * (unsigned short *) addr++;
-        count -= 2;
-    }
-
-    /* Add left-over byte, if any */
-    if (count > 0)
-        sum += * (unsigned char *) addr;
-
-    /* Fold 32-bit sum to 16 bits */
-    while (sum >> 16)
-        sum = (sum & 0xffff) + (sum >> 16);
-
-    return ~sum;
+    return solo5_net_csum_fold(solo5_net_csum_partial(buf, size, 0));
 }
 
 static uint16_t htons(uint16_t x)
@@ -158,6 +139,27 @@ uint8_t macaddr_brd[HLEN_ETHER] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
 static unsigned long n_pings_received = 0;
 static bool opt_verbose = false;
 static bool opt_limit = false;
+static bool opt_batch = false;
+static bool opt_loan = false;
+
+/*
+ * With SOLO5_NET_OFFLOAD_HDR, all packets are prefixed by a solo5_net_hdr. We
+ * do not make use of any offloads, so only need to account for its length.
+ */
+static size_t frame_hdr_len(int ifindex)
+{
+    return (ni[ifindex].info.offloads & SOLO5_NET_OFFLOAD_HDR) ?
+        SOLO5_NET_HDR_LEN : 0;
+}
+
+static size_t frame_buf_size(int ifindex)
+{
+    if (ni[ifindex].info.offloads &
+            (SOLO5_NET_OFFLOAD_TSO4 | SOLO5_NET_OFFLOAD_TSO6))
+        return SOLO5_NET_HDR_LEN + SOLO5_NET_GSO_FRAME_MAX;
+    else
+        return frame_hdr_len(ifindex) + ni[ifindex].info.mtu + SOLO5_NET_HLEN;
+}
 
 static bool handle_arp(int ifindex, uint8_t *buf)
 {
@@ -233,13 +235,13 @@ static bool handle_ip(int ifindex, uint8_t *buf)
 
     /* recalculate ip checksum for return pkt */
     p->ip.checksum = 0;
-    p->ip.checksum = checksum((uint16_t *) &p->ip, sizeof(struct ip));
+    p->ip.checksum = checksum(&p->ip, sizeof(struct ip));
 
     p->ping.type = 0x0; /* change into reply */
 
     /* recalculate ICMP checksum */
     p->ping.checksum = 0;
-    p->ping.checksum = checksum((uint16_t *) &p->ping,
+    p->ping.checksum = checksum(&p->ping,
             htons(p->ip.length) - sizeof(struct ip));
 
     n_pings_received++;
@@ -267,29 +269,36 @@ static void send_garp(int ifindex)
     memcpy(p.arp.spa, ni[ifindex].ipaddr, PLEN_IPV4);
     memcpy(p.arp.tpa, ni[ifindex].ipaddr, PLEN_IPV4);
 
-    if (solo5_net_write(ni[ifindex].h, (uint8_t *)&p, sizeof p) != SOLO5_R_OK)
+    size_t hlen = frame_hdr_len(ifindex);
+    uint8_t buf[SOLO5_NET_HDR_LEN + sizeof p];
+    memset(buf, 0, hlen);
+    memcpy(buf + hlen, &p, sizeof p);
+    if (solo5_net_write(ni[ifindex].h, buf, hlen + sizeof p) != SOLO5_R_OK)
         xputs(ifindex, "Could not send GARP packet\n");
 }
 
 static const solo5_time_t NSEC_PER_SEC = 1000000000ULL;
 
-static bool handle_packet(int ifindex)
+/*
+ * Processes the packet in (buf), rewriting it in place into a reply if one
+ * should be sent. Returns true if the reply should be sent.
+ */
+static bool process_packet(int ifindex, uint8_t *buf)
 {
-    uint8_t buf[ni[ifindex].info.mtu + SOLO5_NET_HLEN];
-    solo5_result_t result;
-    size_t len;
-    struct ether *p = (struct ether *)&buf;
+    size_t hlen = frame_hdr_len(ifindex);
     bool handled = false;
 
-    result = solo5_net_read(ni[ifindex].h, buf, sizeof buf, &len);
-    if (result != SOLO5_R_OK) {
-        xputs(ifindex, "Read error\n");
-        return false;
-    }
+    /*
+     * Replies are sent with complete checksums and no segmentation.
+     */
+    memset(buf, 0, hlen);
+    buf += hlen;
+
+    struct ether *p = (struct ether *)buf;
 
     if (memcmp(p->target, ni[ifindex].info.mac_address, HLEN_ETHER) &&
         memcmp(p->target, macaddr_brd, HLEN_ETHER))
-        return true; /* not ether addressed to us */
+        return false; /* not ether addressed to us */
 
     switch (htons(p->type)) {
         case ETHERTYPE_ARP:
@@ -310,19 +319,162 @@ static bool handle_packet(int ifindex)
             break;
     }
 
-    if (handled) {
+    if (!handled)
+        xputs(ifindex, "Unknown or unsupported packet, dropped\n");
+
+    return handled;
+}
+
+static bool handle_packet(int ifindex)
+{
+    uint8_t buf[frame_buf_size(ifindex)];
+    solo5_result_t result;
+    size_t len;
+
+    result = solo5_net_read(ni[ifindex].h, buf, sizeof buf, &len);
+    if (result != SOLO5_R_OK) {
+        xputs(ifindex, "Read error\n");
+        return false;
+    }
+
+    if (process_packet(ifindex, buf)) {
         if (solo5_net_write(ni[ifindex].h, buf, len) != SOLO5_R_OK) {
             xputs(ifindex, "Write error\n");
             return false;
         }
     }
-    else {
-        xputs(ifindex, "Unknown or unsupported packet, dropped\n");
+
+    return true;
+}
+
+#define BATCH_FRAMES 16
+
+/*
+ * As handle_packet(), but receives and replies to up to BATCH_FRAMES packets
+ * at a time using the batched network I/O interfaces.
+ */
+static bool handle_packets_batch(int ifindex)
+{
+    size_t bufsize = frame_buf_size(ifindex);
+    uint8_t bufs[BATCH_FRAMES][bufsize];
+    struct solo5_net_frame rx[BATCH_FRAMES], tx[BATCH_FRAMES];
+    solo5_result_t result;
+    size_t nrx, ntx = 0;
+
+    for (size_t i = 0; i < BATCH_FRAMES; i++) {
+        rx[i].buf = bufs[i];
+        rx[i].size = bufsize;
+    }
+    result = solo5_net_readv(ni[ifindex].h, rx, BATCH_FRAMES, &nrx);
+    if (result != SOLO5_R_OK) {
+        xputs(ifindex, "Read error\n");
+        return false;
+    }
+
+    for (size_t i = 0; i < nrx; i++) {
+        if (process_packet(ifindex, rx[i].buf))
+            tx[ntx++] = rx[i];
+    }
+    if (ntx > 0 && solo5_net_writev(ni[ifindex].h, tx, ntx) != SOLO5_R_OK) {
+        xputs(ifindex, "Write error\n");
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Transmit buffers for handle_packet_loan(), loaned to Solo5 while in flight.
+ * Loans are reclaimed in the order they were made, so the buffers are used
+ * round-robin.
+ */
+#define TX_LOAN_BUFS 4
+#define TX_LOAN_BUF_SIZE (SOLO5_NET_HDR_LEN + SOLO5_NET_GSO_FRAME_MAX)
+
+static struct {
+    uint8_t buf[TX_LOAN_BUFS][TX_LOAN_BUF_SIZE];
+    unsigned head;              /* Number of buffers loaned */
+    unsigned tail;              /* Number of buffers reclaimed */
+} tx_loans[sizeof ni / sizeof ni[0]];
+
+/*
+ * Returns the next transmit buffer, waiting for in-flight ones to complete if
+ * needed.
+ */
+static uint8_t *tx_loans_get(int ifindex)
+{
+    const uint8_t *done[TX_LOAN_BUFS];
+    size_t n;
+
+    while (tx_loans[ifindex].head - tx_loans[ifindex].tail == TX_LOAN_BUFS) {
+        solo5_result_t result = solo5_net_write_reclaim(ni[ifindex].h, done,
+                TX_LOAN_BUFS, &n);
+        if (result == SOLO5_R_OK)
+            tx_loans[ifindex].tail += n;
+        else if (result != SOLO5_R_AGAIN)
+            return NULL;
+    }
+    return tx_loans[ifindex].buf[tx_loans[ifindex].head % TX_LOAN_BUFS];
+}
+
+/*
+ * As handle_packet(), but using the buffer loan interfaces. As the loaned
+ * receive buffer is read-only, the reply is built in a transmit buffer which
+ * is then loaned back for sending.
+ */
+static bool handle_packet_loan(int ifindex)
+{
+    uint8_t *buf;
+    const uint8_t *pkt;
+    solo5_result_t result;
+    size_t len;
+
+    buf = tx_loans_get(ifindex);
+    if (buf == NULL) {
+        xputs(ifindex, "Reclaim error\n");
+        return false;
+    }
+
+    result = solo5_net_read_loan(ni[ifindex].h, &pkt, &len);
+    if (result != SOLO5_R_OK) {
+        xputs(ifindex, "Read error\n");
+        return false;
+    }
+    if (len > frame_buf_size(ifindex)) {
+        xputs(ifindex, "Loaned packet too large\n");
+        return false;
+    }
+    memcpy(buf, pkt, len);
+    if (solo5_net_read_release(ni[ifindex].h) != SOLO5_R_OK) {
+        xputs(ifindex, "Release error\n");
+        return false;
+    }
+    if (solo5_net_read_release(ni[ifindex].h) != SOLO5_R_EINVAL) {
+        xputs(ifindex, "Double release not detected\n");
+        return false;
+    }
+
+    if (process_packet(ifindex, buf)) {
+        if (solo5_net_write_loan(ni[ifindex].h, buf, len) != SOLO5_R_OK) {
+            xputs(ifindex, "Write error\n");
+            return false;
+        }
+        tx_loans[ifindex].head++;
     }
 
     return true;
 }
 
+static bool handle_ready(int ifindex)
+{
+    if (opt_batch)
+        return handle_packets_batch(ifindex);
+    else if (opt_loan)
+        return handle_packet_loan(ifindex);
+    else
+        return handle_packet(ifindex);
+}
+
 static bool ping_serve(void)
 {
     if (solo5_net_acquire("service0", &ni[0].h, &ni[0].info) != SOLO5_R_OK) {
@@ -360,11 +512,11 @@ static bool ping_serve(void)
         io_ready = solo5_yield(solo5_clock_monotonic() + NSEC_PER_SEC,
                 &ready_set);
         if (io_ready && (ready_set & 1U << ni[0].h))
-            if (!handle_packet(0))
+            if (!handle_ready(0))
                 return false;
 #ifdef TWO_INTERFACES
         if (io_ready && (ready_set & 1U << ni[1].h))
-            if (!handle_packet(1))
+            if (!handle_ready(1))
                 return false;
 #endif
         if (!io_ready && ready_set != 0) {
@@ -392,9 +544,17 @@ int solo5_app_main(const struct solo5_start_info *si)
         case 'l':
             opt_limit = true;
             break;
+        case 'b':
+            opt_batch = true;
+            opt_limit = true;
+            break;
+        case 'z':
+            opt_loan = true;
+            opt_limit = true;
+            break;
         default:
             puts("Error in command line.\n");
-            puts("Usage: test_net [ verbose | limit ]\n");
+            puts("Usage: test_net [ verbose | limit | batch | zerocopy ]\n");
             return SOLO5_EXIT_FAILURE;
         }
     }
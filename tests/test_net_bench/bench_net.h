@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * bench_net.h: Messages exchanged by the test_net_bench unikernel and the
+ * bench-net-host harness, in the payload of UDP packets to and from
+ * BENCH_PORT. Both ends run on the same machine, so fields are in host byte
+ * order.
+ */
+
+#ifndef BENCH_NET_H
+#define BENCH_NET_H
+
+#define BENCH_PORT 7777
+
+#define BENCH_ECHO 1            /* Reflected with t_guest filled in */
+#define BENCH_GEN  2            /* Send (seq) packets of (t_host) bytes */
+#define BENCH_DATA 3            /* Generated packet */
+#define BENCH_END  4            /* Last generated packet */
+#define BENCH_QUIT 5            /* Print statistics and exit */
+
+/*
+ * Fits in the payload of a minimum size (64 byte) frame.
+ */
+struct bench_msg {
+    uint16_t type;
+    uint32_t seq;
+    uint64_t t_host;            /* Host CLOCK_REALTIME at send, in ns */
+    uint64_t t_guest;           /* Guest solo5_clock_wall() at send, in ns */
+} __attribute__((packed));
+
+#endif /* BENCH_NET_H */
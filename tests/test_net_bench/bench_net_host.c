@@ -0,0 +1,256 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * bench-net-host: Host side of the test_net_bench benchmark.
+ *
+ * For each frame size given (by default 64, 512 and 1500 bytes, including
+ * the Ethernet header), measures against the unikernel at GUEST_IP:
+ *
+ *   - round-trip latency percentiles, echoing one packet at a time,
+ *   - one-way latency medians in either direction, from the host and guest
+ *     wall clocks (only meaningful if both are in sync, as they usually are
+ *     for a guest running on the same host),
+ *   - packets per second reflected by the guest, with up to WINDOW packets
+ *     outstanding,
+ *   - packets per second generated by the guest and received by the host.
+ *
+ * Finally, tells the guest to print its CPU cost per packet and exit.
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench_net.h"
+
+#define HDR_LEN    42           /* Ethernet, IPv4 and UDP headers */
+#define FRAME_MAX  1514
+#define RR_COUNT   10000
+#define FLOOD_COUNT 200000
+#define GEN_COUNT  200000
+#define WINDOW     64
+
+static int sock;
+static struct sockaddr_in guest;
+
+static uint64_t now_ns(clockid_t clock)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void die(const char *s)
+{
+    perror(s);
+    exit(1);
+}
+
+static void send_msg(uint8_t *buf, size_t size, uint16_t type, uint32_t seq,
+        uint64_t t_host)
+{
+    struct bench_msg *m = (struct bench_msg *)buf;
+
+    m->type = type;
+    m->seq = seq;
+    m->t_host = t_host;
+    m->t_guest = 0;
+    if (sendto(sock, buf, size - HDR_LEN, 0, (struct sockaddr *)&guest,
+                sizeof guest) == -1)
+        die("sendto");
+}
+
+/*
+ * Receives a message into (buf), returning false on timeout.
+ */
+static bool recv_msg(uint8_t *buf)
+{
+    ssize_t n;
+
+    do {
+        n = recv(sock, buf, FRAME_MAX, 0);
+    } while (n != -1 && (size_t)n < sizeof (struct bench_msg));
+    if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return false;
+    if (n == -1)
+        die("recv");
+    return true;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static uint64_t percentile(uint64_t *v, size_t n, double p)
+{
+    size_t i = (size_t)(p * (n - 1) / 100.0 + 0.5);
+
+    return v[i];
+}
+
+static void bench_rr(size_t size)
+{
+    static uint64_t rtt[RR_COUNT], out[RR_COUNT], back[RR_COUNT];
+    uint8_t buf[FRAME_MAX];
+    size_t n = 0, lost = 0;
+
+    for (uint32_t seq = 0; seq < RR_COUNT; seq++) {
+        const struct bench_msg *m = (const struct bench_msg *)buf;
+        uint64_t t0 = now_ns(CLOCK_MONOTONIC);
+
+        send_msg(buf, size, BENCH_ECHO, seq, now_ns(CLOCK_REALTIME));
+        do {
+            if (!recv_msg(buf))
+                break;
+        } while (m->type != BENCH_ECHO || m->seq != seq);
+        if (m->type != BENCH_ECHO || m->seq != seq) {
+            lost++;
+            continue;
+        }
+        rtt[n] = now_ns(CLOCK_MONOTONIC) - t0;
+        out[n] = m->t_guest - m->t_host;
+        back[n] = now_ns(CLOCK_REALTIME) - m->t_guest;
+        n++;
+    }
+    if (n == 0) {
+        printf("%4zu bytes: no replies\n", size);
+        return;
+    }
+
+    qsort(rtt, n, sizeof rtt[0], cmp_u64);
+    qsort(out, n, sizeof out[0], cmp_u64);
+    qsort(back, n, sizeof back[0], cmp_u64);
+    printf("%4zu bytes: rtt us p50 %.1f p90 %.1f p99 %.1f p99.9 %.1f "
+            "max %.1f (%zu lost)\n", size,
+            percentile(rtt, n, 50) / 1e3, percentile(rtt, n, 90) / 1e3,
+            percentile(rtt, n, 99) / 1e3, percentile(rtt, n, 99.9) / 1e3,
+            rtt[n - 1] / 1e3, lost);
+    printf("%4zu bytes: one-way us p50 host->guest %.1f guest->host %.1f\n",
+            size, (int64_t)percentile(out, n, 50) / 1e3,
+            (int64_t)percentile(back, n, 50) / 1e3);
+}
+
+static void bench_flood(size_t size)
+{
+    uint8_t buf[FRAME_MAX];
+    size_t sent = 0, received = 0, outstanding = 0;
+    uint64_t t0 = now_ns(CLOCK_MONOTONIC);
+
+    while (sent < FLOOD_COUNT || outstanding > 0) {
+        while (outstanding < WINDOW && sent < FLOOD_COUNT) {
+            send_msg(buf, size, BENCH_ECHO, sent++, 0);
+            outstanding++;
+        }
+        if (!recv_msg(buf)) {
+            /* Whatever is still outstanding was lost. */
+            outstanding = 0;
+            continue;
+        }
+        if (((struct bench_msg *)buf)->type == BENCH_ECHO) {
+            received++;
+            outstanding--;
+        }
+    }
+
+    uint64_t ns = now_ns(CLOCK_MONOTONIC) - t0;
+    printf("%4zu bytes: reflected %.0f pps (%zu of %d)\n", size,
+            received * 1e9 / ns, received, FLOOD_COUNT);
+}
+
+static void bench_gen(size_t size)
+{
+    uint8_t buf[FRAME_MAX];
+    const struct bench_msg *m = (const struct bench_msg *)buf;
+    size_t received = 0;
+    uint64_t t0 = 0, t1 = 0;
+
+    send_msg(buf, HDR_LEN + sizeof (struct bench_msg), BENCH_GEN, GEN_COUNT,
+            size);
+    while (recv_msg(buf)) {
+        if (m->type != BENCH_DATA && m->type != BENCH_END)
+            continue;
+        t1 = now_ns(CLOCK_MONOTONIC);
+        if (received++ == 0)
+            t0 = t1;
+        if (m->type == BENCH_END)
+            break;
+    }
+
+    printf("%4zu bytes: generated %.0f pps (%zu of %d)\n", size,
+            received > 1 ? (received - 1) * 1e9 / (t1 - t0) : 0.0,
+            received, GEN_COUNT);
+}
+
+int main(int argc, char *argv[])
+{
+    static const size_t default_sizes[] = { 64, 512, 1500 };
+    struct timeval tv = { .tv_sec = 1 };
+    int rcvbuf = 4 * 1024 * 1024;
+    uint8_t buf[FRAME_MAX];
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s GUEST_IP [ SIZE ... ]\n", argv[0]);
+        return 1;
+    }
+    memset(&guest, 0, sizeof guest);
+    guest.sin_family = AF_INET;
+    guest.sin_port = htons(BENCH_PORT);
+    if (inet_pton(AF_INET, argv[1], &guest.sin_addr) != 1) {
+        fprintf(stderr, "%s: invalid address: %s\n", argv[0], argv[1]);
+        return 1;
+    }
+
+    if ((sock = socket(AF_INET, SOCK_DGRAM, 0)) == -1)
+        die("socket");
+    if (setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv) == -1)
+        die("setsockopt");
+    /* Best effort, the generator can easily outrun a default buffer. */
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof rcvbuf);
+
+    for (int i = 0; i < (argc > 2 ? argc - 2 : 3); i++) {
+        size_t size = argc > 2 ? strtoul(argv[i + 2], NULL, 0) :
+            default_sizes[i];
+
+        if (size < HDR_LEN + sizeof (struct bench_msg) || size > FRAME_MAX) {
+            fprintf(stderr, "%s: invalid size: %zu\n", argv[0], size);
+            return 1;
+        }
+        bench_rr(size);
+        bench_flood(size);
+        bench_gen(size);
+    }
+
+    send_msg(buf, HDR_LEN + sizeof (struct bench_msg), BENCH_QUIT, 0, 0);
+    return 0;
+}
@@ -0,0 +1,427 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Network benchmark: reflects and generates UDP packets on port BENCH_PORT
+ * of 10.0.0.2, driven by bench-net-host on the host. On receipt of a
+ * BENCH_QUIT message, prints the number of packets handled and the guest CPU
+ * time spent per packet, i.e. the time not spent in solo5_yield().
+ */
+
+#include "solo5.h"
+#include "../../bindings/lib.c"
+#include "bench_net.h"
+
+static void puts(const char *s)
+{
+    solo5_console_write(s, strlen(s));
+}
+
+static void put_ulong(unsigned long n)
+{
+    char buf[24];
+    size_t i = sizeof buf;
+
+    buf[--i] = '\0';
+    do {
+        buf[--i] = '0' + (n % 10);
+        n /= 10;
+    } while (n != 0);
+    puts(&buf[i]);
+}
+
+#define ETHERTYPE_IP  0x0800
+#define ETHERTYPE_ARP 0x0806
+#define HLEN_ETHER  6
+#define PLEN_IPV4  4
+
+struct ether {
+    uint8_t target[HLEN_ETHER];
+    uint8_t source[HLEN_ETHER];
+    uint16_t type;
+};
+
+struct arp {
+    uint16_t htype;
+    uint16_t ptype;
+    uint8_t hlen;
+    uint8_t plen;
+    uint16_t op;
+    uint8_t sha[HLEN_ETHER];
+    uint8_t spa[PLEN_IPV4];
+    uint8_t tha[HLEN_ETHER];
+    uint8_t tpa[PLEN_IPV4];
+};
+
+struct ip {
+    uint8_t version_ihl;
+    uint8_t type;
+    uint16_t length;
+    uint16_t id;
+    uint16_t flags_offset;
+    uint8_t ttl;
+    uint8_t proto;
+    uint16_t checksum;
+    uint8_t src_ip[PLEN_IPV4];
+    uint8_t dst_ip[PLEN_IPV4];
+};
+
+struct udp {
+    uint16_t src_port;
+    uint16_t dst_port;
+    uint16_t length;
+    uint16_t checksum;
+};
+
+struct arppkt {
+    struct ether ether;
+    struct arp arp;
+};
+
+struct udppkt {
+    struct ether ether;
+    struct ip ip;
+    struct udp udp;
+    struct bench_msg msg;
+};
+
+/* Copied from https://tools.ietf.org/html/rfc1071 */
+static uint16_t checksum(uint16_t *addr, size_t count)
+{
+    register long sum = 0;
+
+    while (count > 1)  {
+        sum += * (unsigned short *) addr++;
+        count -= 2;
+    }
+    if (count > 0)
+        sum += * (unsigned char *) addr;
+    while (sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
+
+    return ~sum;
+}
+
+static uint16_t htons(uint16_t x)
+{
+    return (x << 8) + (x >> 8);
+}
+
+static const uint8_t ipaddr[PLEN_IPV4] = { 0x0a, 0x00, 0x00, 0x02 };
+static solo5_handle_t h;
+static struct solo5_net_info info;
+
+#define BATCH_FRAMES 32
+#define FRAME_MAX (SOLO5_NET_HDR_LEN + 9216)
+
+static uint8_t rx_bufs[BATCH_FRAMES][FRAME_MAX];
+static uint8_t tx_bufs[BATCH_FRAMES][FRAME_MAX];
+
+static unsigned long rx_packets, tx_packets;
+static solo5_time_t yield_ns;
+static bool quit;
+
+/*
+ * With SOLO5_NET_OFFLOAD_HDR, all packets are prefixed by a solo5_net_hdr. We
+ * do not make use of any offloads, so only need to account for its length.
+ */
+static size_t frame_hdr_len(void)
+{
+    return (info.offloads & SOLO5_NET_OFFLOAD_HDR) ? SOLO5_NET_HDR_LEN : 0;
+}
+
+static size_t frame_buf_size(void)
+{
+    size_t size = frame_hdr_len() + info.mtu + SOLO5_NET_HLEN;
+
+    return size < FRAME_MAX ? size : FRAME_MAX;
+}
+
+/*
+ * Writes (count) frames, retrying those the device has no room for yet.
+ */
+static bool write_frames(struct solo5_net_frame *frames, size_t count)
+{
+    while (count > 0) {
+        size_t left = 0;
+
+        if (solo5_net_writev(h, frames, count) == SOLO5_R_OK) {
+            tx_packets += count;
+            return true;
+        }
+        for (size_t i = 0; i < count; i++) {
+            if (frames[i].result == SOLO5_R_OK)
+                tx_packets++;
+            else if (frames[i].result == SOLO5_R_AGAIN)
+                frames[left++] = frames[i];
+            else {
+                puts("Write error\n");
+                return false;
+            }
+        }
+        count = left;
+    }
+    return true;
+}
+
+static bool handle_arp(uint8_t *buf)
+{
+    struct arppkt *p = (struct arppkt *)buf;
+
+    if (p->arp.htype != htons(1) || p->arp.ptype != htons(ETHERTYPE_IP) ||
+            p->arp.hlen != HLEN_ETHER || p->arp.plen != PLEN_IPV4 ||
+            p->arp.op != htons(1) || memcmp(p->arp.tpa, ipaddr, PLEN_IPV4))
+        return false;
+
+    memcpy(p->ether.target, p->ether.source, HLEN_ETHER);
+    memcpy(p->ether.source, info.mac_address, HLEN_ETHER);
+    memcpy(p->arp.tha, p->arp.sha, HLEN_ETHER);
+    memcpy(p->arp.sha, info.mac_address, HLEN_ETHER);
+    p->arp.op = htons(2);
+    memcpy(p->arp.tpa, p->arp.spa, PLEN_IPV4);
+    memcpy(p->arp.spa, ipaddr, PLEN_IPV4);
+    return true;
+}
+
+/*
+ * Rewrites the UDP packet in (buf) into a packet of (size) bytes back to its
+ * sender, carrying (type) and (seq).
+ */
+static void udp_reply(uint8_t *buf, size_t size, uint16_t type,
+        uint32_t seq)
+{
+    struct udppkt *p = (struct udppkt *)buf;
+    uint8_t ip_tmp[PLEN_IPV4];
+    uint16_t port_tmp;
+
+    memcpy(p->ether.target, p->ether.source, HLEN_ETHER);
+    memcpy(p->ether.source, info.mac_address, HLEN_ETHER);
+    memcpy(ip_tmp, p->ip.src_ip, PLEN_IPV4);
+    memcpy(p->ip.src_ip, p->ip.dst_ip, PLEN_IPV4);
+    memcpy(p->ip.dst_ip, ip_tmp, PLEN_IPV4);
+    p->ip.length = htons(size - sizeof p->ether);
+    p->ip.id = 0;
+    p->ip.flags_offset = 0;
+    p->ip.ttl = 64;
+    p->ip.checksum = 0;
+    p->ip.checksum = checksum((uint16_t *)&p->ip, sizeof p->ip);
+    port_tmp = p->udp.src_port;
+    p->udp.src_port = p->udp.dst_port;
+    p->udp.dst_port = port_tmp;
+    p->udp.length = htons(size - sizeof p->ether - sizeof p->ip);
+    p->udp.checksum = 0;
+    p->msg.type = type;
+    p->msg.seq = seq;
+}
+
+/*
+ * Sends (count) packets of (size) bytes back to the sender of the BENCH_GEN
+ * request in (req), the last one being a BENCH_END.
+ */
+static bool generate(const uint8_t *req, size_t count, size_t size)
+{
+    struct solo5_net_frame frames[BATCH_FRAMES];
+    size_t hlen = frame_hdr_len();
+    solo5_time_t start = solo5_clock_monotonic();
+
+    for (size_t i = 0; i < BATCH_FRAMES; i++) {
+        memset(tx_bufs[i], 0, hlen + size);
+        memcpy(tx_bufs[i] + hlen, req, sizeof (struct udppkt));
+        udp_reply(tx_bufs[i] + hlen, size, BENCH_DATA, 0);
+        frames[i].buf = tx_bufs[i];
+        frames[i].size = hlen + size;
+    }
+
+    for (size_t sent = 0; sent < count; ) {
+        size_t n = count - sent < BATCH_FRAMES ? count - sent : BATCH_FRAMES;
+
+        for (size_t i = 0; i < n; i++) {
+            struct udppkt *p = (struct udppkt *)(tx_bufs[i] + hlen);
+
+            p->msg.seq = sent + i;
+            p->msg.type = (sent + i == count - 1) ? BENCH_END : BENCH_DATA;
+            p->msg.t_guest = solo5_clock_wall();
+            /* write_frames() may have reordered frames[] */
+            frames[i].buf = tx_bufs[i];
+            frames[i].size = hlen + size;
+        }
+        if (!write_frames(frames, n))
+            return false;
+        sent += n;
+    }
+
+    solo5_time_t ns = solo5_clock_monotonic() - start;
+    puts("Generated ");
+    put_ulong(count);
+    puts(" packets of ");
+    put_ulong(size);
+    puts(" bytes: ");
+    put_ulong(count * 1000000000ULL / (ns ? ns : 1));
+    puts(" pps\n");
+    return true;
+}
+
+/*
+ * Processes the packet in (buf), rewriting it in place into a reply if one
+ * should be sent. Returns true if the reply should be sent. A BENCH_GEN
+ * request is stored in (gen_req) to be served once the batch is complete.
+ */
+static bool process_packet(uint8_t *buf, size_t *len, uint8_t *gen_req)
+{
+    size_t hlen = frame_hdr_len();
+    struct udppkt *p = (struct udppkt *)(buf + hlen);
+
+    memset(buf, 0, hlen);
+    if (*len < hlen + sizeof p->ether)
+        return false;
+    if (p->ether.type == htons(ETHERTYPE_ARP))
+        return handle_arp(buf + hlen);
+    if (p->ether.type != htons(ETHERTYPE_IP) ||
+            *len < hlen + sizeof *p ||
+            p->ip.version_ihl != 0x45 || p->ip.proto != 17 ||
+            memcmp(p->ip.dst_ip, ipaddr, PLEN_IPV4) ||
+            p->udp.dst_port != htons(BENCH_PORT))
+        return false;
+
+    switch (p->msg.type) {
+    case BENCH_ECHO:
+        p->msg.t_guest = solo5_clock_wall();
+        udp_reply(buf + hlen, *len - hlen, BENCH_ECHO, p->msg.seq);
+        return true;
+    case BENCH_GEN:
+        memcpy(gen_req, p, sizeof *p);
+        return false;
+    case BENCH_QUIT:
+        quit = true;
+        return false;
+    default:
+        return false;
+    }
+}
+
+static bool handle_packets(void)
+{
+    struct solo5_net_frame rx[BATCH_FRAMES], tx[BATCH_FRAMES];
+    struct udppkt gen_req = { .msg.type = 0 };
+    size_t nrx, ntx = 0;
+    solo5_result_t rc;
+
+    for (size_t i = 0; i < BATCH_FRAMES; i++) {
+        rx[i].buf = rx_bufs[i];
+        rx[i].size = frame_buf_size();
+    }
+    rc = solo5_net_readv(h, rx, BATCH_FRAMES, &nrx);
+    if (rc == SOLO5_R_AGAIN)
+        return true;
+    else if (rc != SOLO5_R_OK) {
+        puts("Read error\n");
+        return false;
+    }
+    rx_packets += nrx;
+
+    for (size_t i = 0; i < nrx; i++) {
+        if (process_packet(rx[i].buf, &rx[i].size, (uint8_t *)&gen_req))
+            tx[ntx++] = rx[i];
+    }
+    if (ntx > 0 && !write_frames(tx, ntx))
+        return false;
+
+    if (gen_req.msg.type == BENCH_GEN) {
+        size_t size = gen_req.msg.t_host;
+        size_t max = info.mtu + SOLO5_NET_HLEN;
+
+        if (size < sizeof gen_req)
+            size = sizeof gen_req;
+        if (size > max)
+            size = max;
+        return generate((uint8_t *)&gen_req, gen_req.msg.seq, size);
+    }
+    return true;
+}
+
+static void send_garp(void)
+{
+    struct arppkt p;
+    uint8_t buf[SOLO5_NET_HDR_LEN + sizeof p];
+    size_t hlen = frame_hdr_len();
+
+    memset(p.ether.target, 0xff, HLEN_ETHER);
+    memcpy(p.ether.source, info.mac_address, HLEN_ETHER);
+    p.ether.type = htons(ETHERTYPE_ARP);
+    p.arp.htype = htons(1);
+    p.arp.ptype = htons(ETHERTYPE_IP);
+    p.arp.hlen = HLEN_ETHER;
+    p.arp.plen = PLEN_IPV4;
+    p.arp.op = htons(1);
+    memcpy(p.arp.sha, info.mac_address, HLEN_ETHER);
+    memset(p.arp.tha, 0, HLEN_ETHER);
+    memcpy(p.arp.spa, ipaddr, PLEN_IPV4);
+    memcpy(p.arp.tpa, ipaddr, PLEN_IPV4);
+
+    memset(buf, 0, hlen);
+    memcpy(buf + hlen, &p, sizeof p);
+    solo5_net_write(h, buf, hlen + sizeof p);
+}
+
+int solo5_app_main(const struct solo5_start_info *si __attribute__((unused)))
+{
+    solo5_time_t start = 0;
+
+    puts("\n**** Solo5 standalone test_net_bench ****\n\n");
+
+    if (solo5_net_acquire("service0", &h, &info) != SOLO5_R_OK) {
+        puts("Could not acquire 'service0' network\n");
+        return SOLO5_EXIT_FAILURE;
+    }
+    puts("Serving benchmark on 10.0.0.2 port ");
+    put_ulong(BENCH_PORT);
+    puts("\n");
+    send_garp();
+
+    while (!quit) {
+        solo5_handle_set_t ready_set = 0;
+        solo5_time_t t = solo5_clock_monotonic();
+
+        solo5_yield(t + 1000000000ULL, &ready_set);
+        if (start != 0)
+            yield_ns += solo5_clock_monotonic() - t;
+        if (!(ready_set & 1ULL << h))
+            continue;
+        /* Time is accounted from the first packet received. */
+        if (start == 0)
+            start = solo5_clock_monotonic();
+        if (!handle_packets()) {
+            puts("FAILURE\n");
+            return SOLO5_EXIT_FAILURE;
+        }
+    }
+
+    solo5_time_t busy_ns = solo5_clock_monotonic() - start - yield_ns;
+    unsigned long packets = rx_packets + tx_packets;
+    puts("Received ");
+    put_ulong(rx_packets);
+    puts(" packets, sent ");
+    put_ulong(tx_packets);
+    puts(" packets\nCPU cost: ");
+    put_ulong(packets ? busy_ns / packets : 0);
+    puts(" ns/packet\n");
+    puts("SUCCESS\n");
+    return SOLO5_EXIT_SUCCESS;
+}
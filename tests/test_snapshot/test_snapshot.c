@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "solo5.h"
+#include "../../bindings/lib.c"
+
+static void puts(const char *s)
+{
+    solo5_console_write(s, strlen(s));
+}
+
+#define NSEC_PER_SEC 1000000000ULL
+
+/*
+ * State set up before the snapshot, which must be intact after restoring.
+ */
+static uint8_t state[65536];
+
+static uint8_t pattern(size_t i)
+{
+    return (uint8_t)(i * 7 + 3);
+}
+
+/*
+ * Every other page of the state is changed before the incremental snapshot.
+ */
+static bool changed(size_t i)
+{
+    return (i / 4096) % 2 == 0;
+}
+
+int solo5_app_main(const struct solo5_start_info *si __attribute__((unused)))
+{
+    puts("\n**** Solo5 standalone test_snapshot ****\n\n");
+
+    for (size_t i = 0; i < sizeof state; i++)
+        state[i] = pattern(i);
+    solo5_time_t before = solo5_clock_monotonic();
+
+    solo5_result_t rc = solo5_snapshot();
+    if (rc == SOLO5_R_EUNSPEC) {
+        puts("No snapshot requested\n");
+        puts("SUCCESS\n");
+        return SOLO5_EXIT_SUCCESS;
+    }
+    else if (rc != SOLO5_R_OK) {
+        puts("ERROR: solo5_snapshot() failed\n");
+        return SOLO5_EXIT_FAILURE;
+    }
+    puts("Restored from snapshot\n");
+
+    for (size_t i = 0; i < sizeof state; i++) {
+        if (state[i] != pattern(i)) {
+            puts("ERROR: state not restored\n");
+            return SOLO5_EXIT_FAILURE;
+        }
+    }
+
+    /*
+     * Monotonic time carries on from the snapshot, and wall time is that of
+     * the host.
+     */
+    if (solo5_clock_monotonic() < before) {
+        puts("ERROR: monotonic time went backwards\n");
+        return SOLO5_EXIT_FAILURE;
+    }
+    solo5_time_t ta = solo5_clock_monotonic();
+    solo5_yield(ta + NSEC_PER_SEC / 10, NULL);
+    if (solo5_clock_monotonic() - ta < NSEC_PER_SEC / 10) {
+        puts("ERROR: slept too little\n");
+        return SOLO5_EXIT_FAILURE;
+    }
+    if (solo5_clock_wall() < 1483228800ULL * NSEC_PER_SEC) {
+        puts("ERROR: wall time is before 2017\n");
+        return SOLO5_EXIT_FAILURE;
+    }
+
+    /*
+     * Take an incremental snapshot of the restored instance, if requested.
+     */
+    for (size_t i = 0; i < sizeof state; i++) {
+        if (changed(i))
+            state[i] = ~pattern(i);
+    }
+    rc = solo5_snapshot();
+    if (rc == SOLO5_R_OK) {
+        puts("Restored from incremental snapshot\n");
+        for (size_t i = 0; i < sizeof state; i++) {
+            if (state[i] != (changed(i) ? (uint8_t)~pattern(i) : pattern(i))) {
+                puts("ERROR: state not restored\n");
+                return SOLO5_EXIT_FAILURE;
+            }
+        }
+    }
+    else if (rc != SOLO5_R_EUNSPEC) {
+        puts("ERROR: solo5_snapshot() failed\n");
+        return SOLO5_EXIT_FAILURE;
+    }
+
+    puts("SUCCESS\n");
+    return SOLO5_EXIT_SUCCESS;
+}
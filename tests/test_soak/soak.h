@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * soak.h: Messages exchanged by the test_soak unikernel and the soak-host
+ * harness, in the payload of UDP packets to and from SOAK_PORT. Both ends
+ * run on the same machine, so fields are in host byte order.
+ */
+
+#ifndef SOAK_H
+#define SOAK_H
+
+#define SOAK_PORT 7778
+
+#define SOAK_ECHO  1            /* Reflected with t_guest filled in */
+#define SOAK_STATS 2            /* Reflected with a soak_stats appended */
+#define SOAK_QUIT  3            /* Print totals and exit */
+
+/*
+ * Fits in the payload of a minimum size (64 byte) frame.
+ */
+struct soak_msg {
+    uint16_t type;
+    uint32_t seq;
+    uint64_t t_host;            /* Host CLOCK_REALTIME at send, in ns */
+    uint64_t t_guest;           /* Guest solo5_clock_wall() at send, in ns */
+} __attribute__((packed));
+
+/*
+ * Block I/O performed by the unikernel since it started. Latencies are
+ * counted in buckets of powers of 2 in us, the last one holding everything
+ * above; the harness computes each interval's percentiles from the
+ * difference between two replies.
+ */
+#define SOAK_HIST_BUCKETS 24
+
+struct soak_stats {
+    uint64_t blk_ops;
+    uint64_t blk_bytes;
+    uint64_t blk_errors;
+    uint64_t net_packets;       /* Received by the unikernel */
+    uint64_t hist[SOAK_HIST_BUCKETS];
+} __attribute__((packed));
+
+#endif /* SOAK_H */
@@ -0,0 +1,385 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * soak-host: Host side of the test_soak soak test.
+ *
+ * Keeps WINDOW packets outstanding to the unikernel at GUEST_IP for
+ * DURATION, and every INTERVAL prints one line of key=value pairs with:
+ *
+ *   - the packets per second reflected, their round-trip latency
+ *     percentiles and the number of packets lost,
+ *   - the block requests per second completed by the unikernel, its
+ *     throughput, latency percentiles (as upper bounds of powers of 2) and
+ *     errors,
+ *   - the resident set size of process PID if given, normally the tender,
+ *   - the offset of the guest's wall clock from the host's, taken from the
+ *     reply with the lowest round-trip time, and its drift in parts per
+ *     million since the first interval.
+ *
+ * Durations are in seconds, or in minutes, hours or days with an "m", "h"
+ * or "d" suffix. Finally, tells the unikernel to print its totals and exit.
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "soak.h"
+
+#define MSG_MAX    (sizeof (struct soak_msg) + sizeof (struct soak_stats))
+#define WINDOW     8
+#define RTT_MAX_US 65536        /* Round-trip latency buckets, 1 us each */
+#define STARTUP_S  30           /* Time allowed for the unikernel to start */
+
+static int sock;
+static struct sockaddr_in guest;
+
+static uint64_t now_ns(clockid_t clock)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void die(const char *s)
+{
+    perror(s);
+    exit(1);
+}
+
+static void send_msg(uint16_t type, uint32_t seq, uint64_t t_host)
+{
+    uint8_t buf[MSG_MAX] = { 0 };
+    struct soak_msg *m = (struct soak_msg *)buf;
+
+    m->type = type;
+    m->seq = seq;
+    m->t_host = t_host;
+    if (sendto(sock, buf, type == SOAK_STATS ? MSG_MAX : sizeof *m, 0,
+                (struct sockaddr *)&guest, sizeof guest) == -1)
+        die("sendto");
+}
+
+/*
+ * Receives a message into (buf), returning false on timeout.
+ */
+static bool recv_msg(uint8_t *buf)
+{
+    ssize_t n;
+
+    do {
+        n = recv(sock, buf, MSG_MAX, 0);
+    } while (n != -1 && (size_t)n < sizeof (struct soak_msg));
+    if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return false;
+    if (n == -1)
+        die("recv");
+    if (((struct soak_msg *)buf)->type == SOAK_STATS && (size_t)n < MSG_MAX)
+        return recv_msg(buf);
+    return true;
+}
+
+static bool parse_duration(const char *s, uint64_t *seconds)
+{
+    char *end;
+    unsigned long n = strtoul(s, &end, 10);
+
+    if (end == s)
+        return false;
+    switch (*end) {
+    case '\0':
+    case 's':
+        break;
+    case 'm':
+        n *= 60;
+        break;
+    case 'h':
+        n *= 3600;
+        break;
+    case 'd':
+        n *= 86400;
+        break;
+    default:
+        return false;
+    }
+    if (*end != '\0' && end[1] != '\0')
+        return false;
+    *seconds = n;
+    return n > 0;
+}
+
+/*
+ * Returns the resident set size of (pid) in KiB, or -1 if it is unknown.
+ */
+static long rss_kib(long pid)
+{
+    char path[64], line[256];
+    long kib = -1;
+    FILE *f;
+
+    if (pid <= 0)
+        return -1;
+    snprintf(path, sizeof path, "/proc/%ld/status", pid);
+    if ((f = fopen(path, "r")) == NULL)
+        return -1;
+    while (fgets(line, sizeof line, f) != NULL) {
+        if (sscanf(line, "VmRSS: %ld kB", &kib) == 1)
+            break;
+    }
+    fclose(f);
+    return kib;
+}
+
+/*
+ * Measurements of the current interval.
+ */
+static uint32_t rtt_hist[RTT_MAX_US + 1];
+static uint64_t rtt_count, rtt_max, lost;
+static uint64_t best_rtt;
+static int64_t best_offset;
+
+static double rtt_percentile(double p)
+{
+    uint64_t want = (uint64_t)(rtt_count * p / 100.0 + 0.5), seen = 0;
+
+    for (size_t us = 0; us < RTT_MAX_US; us++) {
+        seen += rtt_hist[us];
+        if (seen >= want && seen > 0)
+            return us;
+    }
+    return rtt_max / 1e3;
+}
+
+static uint64_t blk_percentile(const struct soak_stats *s,
+        const struct soak_stats *s0, uint64_t ops, unsigned pct)
+{
+    uint64_t want = (ops * pct + 99) / 100, seen = 0;
+
+    if (ops == 0)
+        return 0;
+    for (unsigned b = 0; b < SOAK_HIST_BUCKETS; b++) {
+        seen += s->hist[b] - s0->hist[b];
+        if (seen >= want && seen > 0)
+            return 1ULL << b;
+    }
+    return 1ULL << (SOAK_HIST_BUCKETS - 1);
+}
+
+static void report(uint64_t elapsed_ns, uint64_t interval_ns,
+        const struct soak_stats *s, const struct soak_stats *s0, long pid,
+        int64_t offset0, uint64_t offset0_ns)
+{
+    uint64_t ops = s->blk_ops - s0->blk_ops;
+    long rss = rss_kib(pid);
+
+    printf("t=%llu pps=%.0f rtt_p50_us=%.0f rtt_p99_us=%.0f "
+            "rtt_max_us=%.0f lost=%llu ",
+            (unsigned long long)(elapsed_ns / 1000000000ULL),
+            rtt_count * 1e9 / interval_ns, rtt_percentile(50),
+            rtt_percentile(99), rtt_max / 1e3, (unsigned long long)lost);
+    printf("iops=%.0f kib_s=%.0f blk_p50_us=%llu blk_p99_us=%llu "
+            "blk_max_us=%llu blk_errors=%llu ",
+            ops * 1e9 / interval_ns,
+            (s->blk_bytes - s0->blk_bytes) * 1e9 / 1024 / interval_ns,
+            (unsigned long long)blk_percentile(s, s0, ops, 50),
+            (unsigned long long)blk_percentile(s, s0, ops, 99),
+            (unsigned long long)blk_percentile(s, s0, ops, 100),
+            (unsigned long long)(s->blk_errors - s0->blk_errors));
+    if (rss >= 0)
+        printf("rss_kib=%ld ", rss);
+    else
+        printf("rss_kib=- ");
+    if (rtt_count == 0)
+        printf("clock_offset_us=- drift_ppm=-\n");
+    else
+        printf("clock_offset_us=%.1f drift_ppm=%.3f\n", best_offset / 1e3,
+                elapsed_ns > offset0_ns ?
+                (best_offset - offset0) * 1e6 / (elapsed_ns - offset0_ns) :
+                0.0);
+    fflush(stdout);
+
+    memset(rtt_hist, 0, sizeof rtt_hist);
+    rtt_count = rtt_max = lost = 0;
+    best_rtt = UINT64_MAX;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [ -i INTERVAL ] [ -p PID ] GUEST_IP DURATION\n",
+            prog);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    struct {
+        uint32_t seq;
+        bool pending;
+        uint64_t t_mono;
+        uint64_t t_wall;
+    } slots[WINDOW] = { { 0 } };
+    struct timeval tv = { .tv_sec = 1 };
+    uint8_t buf[MSG_MAX];
+    const struct soak_msg *m = (const struct soak_msg *)buf;
+    struct soak_stats s0;
+    uint64_t duration, interval = 60;
+    long pid = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "i:p:")) != -1) {
+        switch (opt) {
+        case 'i':
+            if (!parse_duration(optarg, &interval))
+                usage(argv[0]);
+            break;
+        case 'p':
+            pid = strtol(optarg, NULL, 10);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (argc - optind != 2 || !parse_duration(argv[optind + 1], &duration))
+        usage(argv[0]);
+    memset(&guest, 0, sizeof guest);
+    guest.sin_family = AF_INET;
+    guest.sin_port = htons(SOAK_PORT);
+    if (inet_pton(AF_INET, argv[optind], &guest.sin_addr) != 1) {
+        fprintf(stderr, "%s: invalid address: %s\n", argv[0], argv[optind]);
+        return 1;
+    }
+
+    if ((sock = socket(AF_INET, SOCK_DGRAM, 0)) == -1)
+        die("socket");
+    if (setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv) == -1)
+        die("setsockopt");
+
+    /*
+     * The first statistics serve as a baseline, and tell us that the
+     * unikernel is up.
+     */
+    for (unsigned i = 0; ; i++) {
+        if (i == STARTUP_S) {
+            fprintf(stderr, "%s: no reply from %s\n", argv[0], argv[optind]);
+            return 1;
+        }
+        send_msg(SOAK_STATS, 0, 0);
+        if (recv_msg(buf) && m->type == SOAK_STATS)
+            break;
+    }
+    memcpy(&s0, buf + sizeof *m, sizeof s0);
+
+    uint64_t start = now_ns(CLOCK_MONOTONIC), last = start;
+    uint64_t end = start + duration * 1000000000ULL;
+    uint64_t stats_sent = 0, offset0_ns = 0;
+    int64_t offset0 = 0;
+    bool have_offset0 = false;
+    uint32_t seq = 0;
+    unsigned outstanding = 0;
+
+    best_rtt = UINT64_MAX;
+    for (;;) {
+        uint64_t now = now_ns(CLOCK_MONOTONIC);
+
+        /* Ends once the last interval has been reported. */
+        if (last >= end && stats_sent == 0)
+            break;
+        while (outstanding < WINDOW && now < end) {
+            unsigned i = seq % WINDOW;
+
+            /* Sent WINDOW packets ago and never reflected. */
+            if (slots[i].pending) {
+                lost++;
+                outstanding--;
+            }
+            slots[i].seq = seq;
+            slots[i].pending = true;
+            slots[i].t_wall = now_ns(CLOCK_REALTIME);
+            slots[i].t_mono = now_ns(CLOCK_MONOTONIC);
+            send_msg(SOAK_ECHO, seq++, slots[i].t_wall);
+            outstanding++;
+        }
+        /* Resent if the reply has not arrived within a second. */
+        if ((stats_sent == 0 && (now - last >= interval * 1000000000ULL ||
+                        now >= end)) ||
+                (stats_sent != 0 && now - stats_sent >= 1000000000ULL)) {
+            send_msg(SOAK_STATS, 0, 0);
+            stats_sent = now;
+        }
+
+        if (!recv_msg(buf)) {
+            for (unsigned i = 0; i < WINDOW; i++)
+                slots[i].pending = false;
+            lost += outstanding;
+            outstanding = 0;
+            continue;
+        }
+        now = now_ns(CLOCK_MONOTONIC);
+
+        if (m->type == SOAK_ECHO) {
+            unsigned i = m->seq % WINDOW;
+
+            if (!slots[i].pending || slots[i].seq != m->seq)
+                continue;
+            slots[i].pending = false;
+            outstanding--;
+
+            uint64_t rtt = now - slots[i].t_mono;
+            rtt_hist[rtt / 1000 < RTT_MAX_US ? rtt / 1000 : RTT_MAX_US]++;
+            rtt_count++;
+            if (rtt > rtt_max)
+                rtt_max = rtt;
+            if (rtt < best_rtt) {
+                best_rtt = rtt;
+                best_offset = (int64_t)(m->t_guest - slots[i].t_wall) -
+                    (int64_t)(rtt / 2);
+            }
+        }
+        else if (m->type == SOAK_STATS && stats_sent != 0) {
+            struct soak_stats s;
+
+            memcpy(&s, buf + sizeof *m, sizeof s);
+            if (!have_offset0 && rtt_count > 0) {
+                offset0 = best_offset;
+                offset0_ns = now - start;
+                have_offset0 = true;
+            }
+            report(now - start, now - last, &s, &s0, pid, offset0,
+                    offset0_ns);
+            s0 = s;
+            last = now;
+            stats_sent = 0;
+        }
+    }
+
+    send_msg(SOAK_QUIT, 0, 0);
+    return 0;
+}
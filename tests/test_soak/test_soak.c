@@ -0,0 +1,469 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Soak test: runs a network and a block workload for as long as the
+ * soak-host harness on the host keeps it running, hours or days, so that
+ * performance which decays slowly can be seen. Reflects UDP packets on port
+ * SOAK_PORT of 10.0.0.2, and meanwhile keeps BLK_QD random reads and writes
+ * in flight on the "storage" device, whose contents are overwritten. The
+ * harness periodically asks for the block I/O statistics, which it reports
+ * together with its own measurements.
+ */
+
+#include "solo5.h"
+#include "../../bindings/lib.c"
+#include "soak.h"
+
+static void puts(const char *s)
+{
+    solo5_console_write(s, strlen(s));
+}
+
+static void put_ulong(unsigned long n)
+{
+    char buf[24];
+    size_t i = sizeof buf;
+
+    buf[--i] = '\0';
+    do {
+        buf[--i] = '0' + (n % 10);
+        n /= 10;
+    } while (n != 0);
+    puts(&buf[i]);
+}
+
+#define ETHERTYPE_IP  0x0800
+#define ETHERTYPE_ARP 0x0806
+#define HLEN_ETHER  6
+#define PLEN_IPV4  4
+
+struct ether {
+    uint8_t target[HLEN_ETHER];
+    uint8_t source[HLEN_ETHER];
+    uint16_t type;
+};
+
+struct arp {
+    uint16_t htype;
+    uint16_t ptype;
+    uint8_t hlen;
+    uint8_t plen;
+    uint16_t op;
+    uint8_t sha[HLEN_ETHER];
+    uint8_t spa[PLEN_IPV4];
+    uint8_t tha[HLEN_ETHER];
+    uint8_t tpa[PLEN_IPV4];
+};
+
+struct ip {
+    uint8_t version_ihl;
+    uint8_t type;
+    uint16_t length;
+    uint16_t id;
+    uint16_t flags_offset;
+    uint8_t ttl;
+    uint8_t proto;
+    uint16_t checksum;
+    uint8_t src_ip[PLEN_IPV4];
+    uint8_t dst_ip[PLEN_IPV4];
+};
+
+struct udp {
+    uint16_t src_port;
+    uint16_t dst_port;
+    uint16_t length;
+    uint16_t checksum;
+};
+
+struct arppkt {
+    struct ether ether;
+    struct arp arp;
+};
+
+struct udppkt {
+    struct ether ether;
+    struct ip ip;
+    struct udp udp;
+    struct soak_msg msg;
+};
+
+/* Copied from https://tools.ietf.org/html/rfc1071 */
+static uint16_t checksum(uint16_t *addr, size_t count)
+{
+    register long sum = 0;
+
+    while (count > 1)  {
+        sum += * (unsigned short *) addr++;
+        count -= 2;
+    }
+    if (count > 0)
+        sum += * (unsigned char *) addr;
+    while (sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
+
+    return ~sum;
+}
+
+static uint16_t htons(uint16_t x)
+{
+    return (x << 8) + (x >> 8);
+}
+
+static const uint8_t ipaddr[PLEN_IPV4] = { 0x0a, 0x00, 0x00, 0x02 };
+static solo5_handle_t h, bh;
+static struct solo5_net_info info;
+static struct solo5_block_info binfo;
+
+#define BATCH_FRAMES 32
+#define FRAME_MAX (SOLO5_NET_HDR_LEN + 9216)
+
+static uint8_t rx_bufs[BATCH_FRAMES][FRAME_MAX];
+
+static unsigned long rx_packets, tx_packets;
+static struct soak_stats stats;
+static bool quit;
+
+/*
+ * With SOLO5_NET_OFFLOAD_HDR, all packets are prefixed by a solo5_net_hdr. We
+ * do not make use of any offloads, so only need to account for its length.
+ */
+static size_t frame_hdr_len(void)
+{
+    return (info.offloads & SOLO5_NET_OFFLOAD_HDR) ? SOLO5_NET_HDR_LEN : 0;
+}
+
+static size_t frame_buf_size(void)
+{
+    size_t size = frame_hdr_len() + info.mtu + SOLO5_NET_HLEN;
+
+    return size < FRAME_MAX ? size : FRAME_MAX;
+}
+
+/*
+ * Writes (count) frames, retrying those the device has no room for yet.
+ */
+static bool write_frames(struct solo5_net_frame *frames, size_t count)
+{
+    while (count > 0) {
+        size_t left = 0;
+
+        if (solo5_net_writev(h, frames, count) == SOLO5_R_OK) {
+            tx_packets += count;
+            return true;
+        }
+        for (size_t i = 0; i < count; i++) {
+            if (frames[i].result == SOLO5_R_OK)
+                tx_packets++;
+            else if (frames[i].result == SOLO5_R_AGAIN)
+                frames[left++] = frames[i];
+            else {
+                puts("Write error\n");
+                return false;
+            }
+        }
+        count = left;
+    }
+    return true;
+}
+
+static bool handle_arp(uint8_t *buf)
+{
+    struct arppkt *p = (struct arppkt *)buf;
+
+    if (p->arp.htype != htons(1) || p->arp.ptype != htons(ETHERTYPE_IP) ||
+            p->arp.hlen != HLEN_ETHER || p->arp.plen != PLEN_IPV4 ||
+            p->arp.op != htons(1) || memcmp(p->arp.tpa, ipaddr, PLEN_IPV4))
+        return false;
+
+    memcpy(p->ether.target, p->ether.source, HLEN_ETHER);
+    memcpy(p->ether.source, info.mac_address, HLEN_ETHER);
+    memcpy(p->arp.tha, p->arp.sha, HLEN_ETHER);
+    memcpy(p->arp.sha, info.mac_address, HLEN_ETHER);
+    p->arp.op = htons(2);
+    memcpy(p->arp.tpa, p->arp.spa, PLEN_IPV4);
+    memcpy(p->arp.spa, ipaddr, PLEN_IPV4);
+    return true;
+}
+
+/*
+ * Rewrites the UDP packet in (buf) into a packet of (size) bytes back to its
+ * sender.
+ */
+static void udp_reply(uint8_t *buf, size_t size)
+{
+    struct udppkt *p = (struct udppkt *)buf;
+    uint8_t ip_tmp[PLEN_IPV4];
+    uint16_t port_tmp;
+
+    memcpy(p->ether.target, p->ether.source, HLEN_ETHER);
+    memcpy(p->ether.source, info.mac_address, HLEN_ETHER);
+    memcpy(ip_tmp, p->ip.src_ip, PLEN_IPV4);
+    memcpy(p->ip.src_ip, p->ip.dst_ip, PLEN_IPV4);
+    memcpy(p->ip.dst_ip, ip_tmp, PLEN_IPV4);
+    p->ip.length = htons(size - sizeof p->ether);
+    p->ip.id = 0;
+    p->ip.flags_offset = 0;
+    p->ip.ttl = 64;
+    p->ip.checksum = 0;
+    p->ip.checksum = checksum((uint16_t *)&p->ip, sizeof p->ip);
+    port_tmp = p->udp.src_port;
+    p->udp.src_port = p->udp.dst_port;
+    p->udp.dst_port = port_tmp;
+    p->udp.length = htons(size - sizeof p->ether - sizeof p->ip);
+    p->udp.checksum = 0;
+}
+
+#define BLK_QD 8
+#define BLK_SIZE_MAX 65536
+
+static uint8_t blk_bufs[BLK_QD][BLK_SIZE_MAX] __attribute__((aligned(4096)));
+static solo5_time_t blk_submitted[BLK_QD];
+static unsigned blk_free[BLK_QD], blk_nfree;
+static size_t blk_size;
+static uint64_t blk_rand = 0x9e3779b97f4a7c15ULL;    /* xorshift64 state */
+
+/*
+ * Fills the block queue with requests for random blocks of the device, one
+ * in four of which are writes.
+ */
+static bool blk_submit(void)
+{
+    uint64_t nblocks = binfo.capacity / blk_size;
+
+    while (blk_nfree > 0) {
+        unsigned slot = blk_free[blk_nfree - 1];
+        solo5_off_t offset;
+        solo5_result_t rc;
+
+        blk_rand ^= blk_rand << 13;
+        blk_rand ^= blk_rand >> 7;
+        blk_rand ^= blk_rand << 17;
+        offset = (blk_rand % nblocks) * blk_size;
+        rc = (blk_rand >> 32) % 4 == 0 ?
+            solo5_block_submit_write(bh, offset, blk_bufs[slot], blk_size,
+                    slot) :
+            solo5_block_submit_read(bh, offset, blk_bufs[slot], blk_size,
+                    slot);
+        if (rc == SOLO5_R_AGAIN)
+            break;
+        if (rc != SOLO5_R_OK) {
+            puts("Block submit error\n");
+            return false;
+        }
+        blk_submitted[slot] = solo5_clock_monotonic();
+        blk_nfree--;
+    }
+    return true;
+}
+
+static void blk_record(solo5_time_t ns)
+{
+    unsigned b = 0;
+
+    for (solo5_time_t us = ns / 1000; us != 0 && b < SOAK_HIST_BUCKETS - 1;
+            us >>= 1)
+        b++;
+    stats.hist[b]++;
+    stats.blk_ops++;
+    stats.blk_bytes += blk_size;
+}
+
+/*
+ * Reaps completed block requests and, unless the test is ending, submits as
+ * many new ones. Failed requests are counted, and the test goes on.
+ */
+static bool blk_reap(void)
+{
+    struct solo5_block_completion c[BLK_QD];
+    solo5_result_t rc;
+    size_t n;
+
+    while ((rc = solo5_block_reap(bh, c, BLK_QD, &n)) == SOLO5_R_OK) {
+        solo5_time_t now = solo5_clock_monotonic();
+
+        for (size_t i = 0; i < n; i++) {
+            if (c[i].result == SOLO5_R_OK)
+                blk_record(now - blk_submitted[c[i].tag]);
+            else
+                stats.blk_errors++;
+            blk_free[blk_nfree++] = c[i].tag;
+        }
+    }
+    if (rc != SOLO5_R_AGAIN) {
+        puts("Block reap error\n");
+        return false;
+    }
+    return quit || blk_submit();
+}
+
+/*
+ * Processes the packet in (buf), rewriting it in place into a reply if one
+ * should be sent. Returns true if the reply should be sent.
+ */
+static bool process_packet(uint8_t *buf, size_t len)
+{
+    size_t hlen = frame_hdr_len();
+    struct udppkt *p = (struct udppkt *)(buf + hlen);
+
+    memset(buf, 0, hlen);
+    if (len < hlen + sizeof p->ether)
+        return false;
+    if (p->ether.type == htons(ETHERTYPE_ARP))
+        return handle_arp(buf + hlen);
+    if (p->ether.type != htons(ETHERTYPE_IP) ||
+            len < hlen + sizeof *p ||
+            p->ip.version_ihl != 0x45 || p->ip.proto != 17 ||
+            memcmp(p->ip.dst_ip, ipaddr, PLEN_IPV4) ||
+            p->udp.dst_port != htons(SOAK_PORT))
+        return false;
+
+    switch (p->msg.type) {
+    case SOAK_STATS:
+        /* The harness sends requests large enough for the reply. */
+        if (len < hlen + sizeof *p + sizeof stats)
+            return false;
+        stats.net_packets = rx_packets;
+        memcpy(p + 1, &stats, sizeof stats);
+        /* Fall through */
+    case SOAK_ECHO:
+        p->msg.t_guest = solo5_clock_wall();
+        udp_reply(buf + hlen, len - hlen);
+        return true;
+    case SOAK_QUIT:
+        quit = true;
+        return false;
+    default:
+        return false;
+    }
+}
+
+static bool handle_packets(void)
+{
+    struct solo5_net_frame rx[BATCH_FRAMES], tx[BATCH_FRAMES];
+    size_t nrx, ntx = 0;
+    solo5_result_t rc;
+
+    for (size_t i = 0; i < BATCH_FRAMES; i++) {
+        rx[i].buf = rx_bufs[i];
+        rx[i].size = frame_buf_size();
+    }
+    rc = solo5_net_readv(h, rx, BATCH_FRAMES, &nrx);
+    if (rc == SOLO5_R_AGAIN)
+        return true;
+    else if (rc != SOLO5_R_OK) {
+        puts("Read error\n");
+        return false;
+    }
+    rx_packets += nrx;
+
+    for (size_t i = 0; i < nrx; i++) {
+        if (process_packet(rx[i].buf, rx[i].size))
+            tx[ntx++] = rx[i];
+    }
+    return ntx == 0 || write_frames(tx, ntx);
+}
+
+static void send_garp(void)
+{
+    struct arppkt p;
+    uint8_t buf[SOLO5_NET_HDR_LEN + sizeof p];
+    size_t hlen = frame_hdr_len();
+
+    memset(p.ether.target, 0xff, HLEN_ETHER);
+    memcpy(p.ether.source, info.mac_address, HLEN_ETHER);
+    p.ether.type = htons(ETHERTYPE_ARP);
+    p.arp.htype = htons(1);
+    p.arp.ptype = htons(ETHERTYPE_IP);
+    p.arp.hlen = HLEN_ETHER;
+    p.arp.plen = PLEN_IPV4;
+    p.arp.op = htons(1);
+    memcpy(p.arp.sha, info.mac_address, HLEN_ETHER);
+    memset(p.arp.tha, 0, HLEN_ETHER);
+    memcpy(p.arp.spa, ipaddr, PLEN_IPV4);
+    memcpy(p.arp.tpa, ipaddr, PLEN_IPV4);
+
+    memset(buf, 0, hlen);
+    memcpy(buf + hlen, &p, sizeof p);
+    solo5_net_write(h, buf, hlen + sizeof p);
+}
+
+int solo5_app_main(const struct solo5_start_info *si __attribute__((unused)))
+{
+    puts("\n**** Solo5 standalone test_soak ****\n\n");
+
+    if (solo5_net_acquire("service0", &h, &info) != SOLO5_R_OK) {
+        puts("Could not acquire 'service0' network\n");
+        return SOLO5_EXIT_FAILURE;
+    }
+    if (solo5_block_acquire("storage", &bh, &binfo) != SOLO5_R_OK) {
+        puts("Could not acquire 'storage' block device\n");
+        return SOLO5_EXIT_FAILURE;
+    }
+    blk_size = binfo.block_size > 4096 ? binfo.block_size : 4096;
+    if (blk_size > BLK_SIZE_MAX || blk_size % binfo.block_size ||
+            binfo.capacity < blk_size) {
+        puts("Unsupported 'storage' block device\n");
+        return SOLO5_EXIT_FAILURE;
+    }
+    for (unsigned i = 0; i < BLK_QD; i++) {
+        memset(blk_bufs[i], 'A' + i, blk_size);
+        blk_free[blk_nfree++] = i;
+    }
+
+    puts("Serving soak test on 10.0.0.2 port ");
+    put_ulong(SOAK_PORT);
+    puts("\n");
+    send_garp();
+    if (!blk_submit()) {
+        puts("FAILURE\n");
+        return SOLO5_EXIT_FAILURE;
+    }
+
+    /*
+     * Once told to quit, waits for the block requests in flight.
+     */
+    while (!quit || blk_nfree < BLK_QD) {
+        solo5_handle_set_t ready_set = 0;
+
+        solo5_yield(solo5_clock_monotonic() + 1000000000ULL, &ready_set);
+        if (((ready_set & 1ULL << h) && !handle_packets()) ||
+                ((ready_set & 1ULL << bh) && !blk_reap())) {
+            puts("FAILURE\n");
+            return SOLO5_EXIT_FAILURE;
+        }
+    }
+
+    puts("Received ");
+    put_ulong(rx_packets);
+    puts(" packets, sent ");
+    put_ulong(tx_packets);
+    puts(" packets\nBlock requests: ");
+    put_ulong(stats.blk_ops);
+    puts(", errors: ");
+    put_ulong(stats.blk_errors);
+    puts("\n");
+    if (stats.blk_errors != 0) {
+        puts("FAILURE\n");
+        return SOLO5_EXIT_FAILURE;
+    }
+    puts("SUCCESS\n");
+    return SOLO5_EXIT_SUCCESS;
+}
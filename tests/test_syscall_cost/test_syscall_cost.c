@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2015-2019 Contributors as noted in the AUTHORS file
+ *
+ * This file is part of Solo5, a sandboxed execution environment.
+ *
+ * Permission to use, copy, modify, and/or distribute this software
+ * for any purpose with or without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/*
+ * Measures the cost of Solo5 calls which go to the host on every call: on spt,
+ * each of these makes system calls checked by the seccomp filter; on hvt,
+ * most of them are hypercalls. Built as test_syscall_cost_net, also measures
+ * solo5_net_read() on an empty receive queue.
+ */
+
+#include "solo5.h"
+#include "../../bindings/lib.c"
+
+static void puts(const char *s)
+{
+    solo5_console_write(s, strlen(s));
+}
+
+static void put_ulong(unsigned long n)
+{
+    char buf[24];
+    size_t i = sizeof buf;
+
+    buf[--i] = '\0';
+    do {
+        buf[--i] = '0' + (n % 10);
+        n /= 10;
+    } while (n != 0);
+    puts(&buf[i]);
+}
+
+static void report(const char *name, solo5_time_t nsecs, unsigned long calls)
+{
+    puts(name);
+    puts(": ");
+    put_ulong(nsecs / calls);
+    puts(" ns/call\n");
+}
+
+#define CALLS 100000UL
+#define CONSOLE_CALLS 200UL
+
+static const size_t console_sizes[] = { 1, 64, 1024 };
+static char console_buf[1024];
+
+static uintptr_t tls_block[2];
+
+int solo5_app_main(const struct solo5_start_info *si __attribute__((unused)))
+{
+    puts("\n**** Solo5 standalone test_syscall_cost ****\n\n");
+
+    /*
+     * The clock is read once more than CALLS, which is noise.
+     */
+    solo5_time_t start = solo5_clock_monotonic();
+    for (unsigned long i = 0; i < CALLS; i++)
+        (void)solo5_clock_monotonic();
+    report("solo5_clock_monotonic", solo5_clock_monotonic() - start, CALLS);
+
+    start = solo5_clock_monotonic();
+    for (unsigned long i = 0; i < CALLS; i++)
+        (void)solo5_clock_wall();
+    report("solo5_clock_wall", solo5_clock_monotonic() - start, CALLS);
+
+    /*
+     * A deadline in the past never blocks.
+     */
+    start = solo5_clock_monotonic();
+    for (unsigned long i = 0; i < CALLS; i++)
+        (void)solo5_yield(0, NULL);
+    report("solo5_yield", solo5_clock_monotonic() - start, CALLS);
+
+    /*
+     * Console output is kept to a few hundred lines of dots per size.
+     */
+    memset(console_buf, '.', sizeof console_buf);
+    for (size_t i = 0; i < sizeof console_sizes / sizeof console_sizes[0]; i++) {
+        size_t size = console_sizes[i];
+
+        console_buf[size - 1] = '\n';
+        start = solo5_clock_monotonic();
+        for (unsigned long j = 0; j < CONSOLE_CALLS; j++)
+            solo5_console_write(console_buf, size);
+        solo5_time_t nsecs = solo5_clock_monotonic() - start;
+        console_buf[size - 1] = '.';
+        puts("solo5_console_write(");
+        put_ulong(size);
+        report(")", nsecs, CONSOLE_CALLS);
+    }
+
+    /*
+     * The stack protector guard is global, so the TLS base may point
+     * anywhere while nothing uses TLS.
+     */
+    start = solo5_clock_monotonic();
+    for (unsigned long i = 0; i < CALLS; i++) {
+        if (solo5_set_tls_base((uintptr_t)&tls_block[i & 1]) != SOLO5_R_OK) {
+            puts("solo5_set_tls_base failed\n");
+            return SOLO5_EXIT_FAILURE;
+        }
+    }
+    report("solo5_set_tls_base", solo5_clock_monotonic() - start, CALLS);
+
+#ifdef NET_READ_COST
+    solo5_handle_t h;
+    struct solo5_net_info ni;
+    static uint8_t buf[SOLO5_NET_HDR_LEN + SOLO5_NET_GSO_FRAME_MAX];
+    size_t size;
+
+    if (solo5_net_acquire("service0", &h, &ni) != SOLO5_R_OK) {
+        puts("Could not acquire 'service0' network\n");
+        return SOLO5_EXIT_FAILURE;
+    }
+    /*
+     * Nothing is sent to the unikernel, so the queue is normally empty;
+     * the odd packet received from the host is counted all the same.
+     */
+    start = solo5_clock_monotonic();
+    for (unsigned long i = 0; i < CALLS; i++)
+        (void)solo5_net_read(h, buf, sizeof buf, &size);
+    report("solo5_net_read", solo5_clock_monotonic() - start, CALLS);
+#endif
+
+    puts("SUCCESS\n");
+    return SOLO5_EXIT_SUCCESS;
+}
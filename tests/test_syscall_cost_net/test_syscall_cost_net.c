@@ -0,0 +1,2 @@
+#define NET_READ_COST
+#include "../test_syscall_cost/test_syscall_cost.c"
@@ -54,9 +54,12 @@ int solo5_app_main(const struct solo5_start_info *si __attribute__((unused)))
      * The tender is configured with no I/O modules for this test so
      * solo5_yield() is equivalent to a sleep here.
      */
+    struct solo5_cpu_time ca, cb;
+    (void)solo5_cpu_time(&ca);
     ta = solo5_clock_monotonic();
     solo5_yield(ta + NSEC_PER_SEC, NULL);
     tb = solo5_clock_monotonic();
+    (void)solo5_cpu_time(&cb);
     /*
      * Verify that we did not sleep less than requested (see above).
      */
@@ -73,6 +76,15 @@ int solo5_app_main(const struct solo5_start_info *si __attribute__((unused)))
         return SOLO5_EXIT_FAILURE;
     }
 
+    /*
+     * Verify that the sleep was accounted as idle time, and that steal time,
+     * if the host reports it, did not go backwards.
+     */
+    if ((cb.idle - ca.idle) < NSEC_PER_SEC / 2 || cb.steal < ca.steal) {
+        puts("ERROR: CPU time not accounted\n");
+        return SOLO5_EXIT_FAILURE;
+    }
+
     /*
      * Verify that wall time is 2017 or later
      */
@@ -68,12 +68,13 @@ setup() {
   NET1=tap101
   NET1_IP=10.1.0.2
   DISK=${BATS_TMPDIR}/disk.img
+  OVERLAY=${BATS_TMPDIR}/disk.cow
   dd if=/dev/zero of=${DISK} bs=4k count=1024
 }
 
 teardown() {
   echo "${output}"
-  rm -f ${DISK}
+  rm -f ${DISK} ${OVERLAY}
 }
 
 hvt_run() {
@@ -129,6 +130,196 @@ virtio_expect_abort() {
   expect_success
 }
 
+@test "stats hvt" {
+  hvt_run --stats -- test_hello/test_hello.hvt Hello_Solo5
+  expect_success
+  [[ "$output" == *"hypercall statistics"* ]]
+  [[ "$output" == *"CONSOLE_RING"* ]]
+}
+
+@test "metrics hvt" {
+  [ "${CONFIG_HOST}" = "Linux" ] || skip "not implemented for ${CONFIG_HOST}"
+  command -v socat >/dev/null || skip "socat not installed"
+  SOCKET=${BATS_TMPDIR}/metrics.$$
+
+  ( sleep 1; socat - UNIX-CONNECT:${SOCKET} > ${SOCKET}.out ) &
+  hvt_run --metrics=${SOCKET} -- test_migrate/test_migrate.hvt
+  METRICS="$(cat ${SOCKET}.out)"
+  rm -f ${SOCKET}.out
+  expect_success
+  [ ! -e ${SOCKET} ]
+  [[ "$METRICS" == *"solo5_hvt_polls_total{result=\"timeout\"}"* ]]
+  [[ "$METRICS" == *"solo5_guest_resident_bytes"* ]]
+}
+
+@test "metrics spt" {
+  command -v socat >/dev/null || skip "socat not installed"
+  SOCKET=${BATS_TMPDIR}/metrics.$$
+
+  ( sleep 1; socat - UNIX-CONNECT:${SOCKET} > ${SOCKET}.out ) &
+  spt_run --metrics=${SOCKET} -- test_migrate/test_migrate.spt
+  METRICS="$(cat ${SOCKET}.out)"
+  rm -f ${SOCKET} ${SOCKET}.out
+  expect_success
+  [[ "$METRICS" == *"solo5_cpu_seconds_total"* ]]
+}
+
+@test "trace hvt" {
+  TRACE=${BATS_TMPDIR}/trace.$$
+
+  hvt_run --trace=${TRACE} -- test_time/test_time.hvt
+  EVENTS=$(cat ${TRACE})
+  rm -f ${TRACE}
+  expect_success
+  [[ "${EVENTS}" == *" 0xffff0000 "* ]]
+  [[ "${EVENTS}" == *" 0xffff0001 "* ]]
+}
+
+@test "profile hvt" {
+  PROFILE=${BATS_TMPDIR}/profile.$$
+
+  hvt_run --profile=${PROFILE},hz=1000 -- test_time/test_time.hvt
+  SAMPLES=$(cat ${PROFILE})
+  rm -f ${PROFILE}
+  expect_success
+  [[ "${SAMPLES}" =~ [^\ ]+\ [0-9]+ ]]
+}
+
+@test "hello prefault hvt" {
+  hvt_run --mem-prefault -- test_hello/test_hello.hvt Hello_Solo5
+  expect_success
+}
+
+@test "hello lazy spt" {
+  spt_run --mem-lazy -- test_hello/test_hello.spt Hello_Solo5
+  expect_success
+}
+
+@test "hello mergeable hvt" {
+  [ "${CONFIG_HOST}" = "Linux" ] || skip "not supported on ${CONFIG_HOST}"
+  hvt_run --mem-mergeable -- test_hello/test_hello.hvt Hello_Solo5
+  expect_success
+  [[ "$output" == *[Mm]"erged"* ]]
+}
+
+@test "hello mergeable spt" {
+  spt_run --mem-mergeable -- test_hello/test_hello.spt Hello_Solo5
+  expect_success
+}
+
+@test "hello zstd hvt" {
+  [ -n "${CONFIG_ZSTD}" ] || skip "zstd support not configured"
+  command -v zstd >/dev/null || skip "zstd not installed"
+  zstd -q -f -o ${BATS_TMPDIR}/test_hello.hvt.zst test_hello/test_hello.hvt
+  hvt_run ${BATS_TMPDIR}/test_hello.hvt.zst Hello_Solo5
+  expect_success
+}
+
+@test "hello zstd spt" {
+  [ -n "${CONFIG_ZSTD}" ] || skip "zstd support not configured"
+  command -v zstd >/dev/null || skip "zstd not installed"
+  zstd -q -f -o ${BATS_TMPDIR}/test_hello.spt.zst test_hello/test_hello.spt
+  spt_run ${BATS_TMPDIR}/test_hello.spt.zst Hello_Solo5
+  expect_success
+}
+
+@test "hello mem_report hvt" {
+  hvt_run --mem-report -- test_hello/test_hello.hvt Hello_Solo5
+  expect_success
+  [[ "$output" == *"guest memory touched"* ]]
+  [[ "$output" == *"untouched between heap and stack"* ]]
+}
+
+@test "hello cpu affinity hvt" {
+  [ "${CONFIG_HOST}" = "Linux" ] || skip "not supported on ${CONFIG_HOST}"
+  hvt_run --cpu=0 --numa-node=0 -- test_hello/test_hello.hvt Hello_Solo5
+  expect_success
+}
+
+@test "hello cpu affinity spt" {
+  spt_run --cpu=0 --numa-node=0 -- test_hello/test_hello.spt Hello_Solo5
+  expect_success
+}
+
+@test "trace-boot hvt" {
+  hvt_run --trace-boot -- test_hello/test_hello.hvt Hello_Solo5
+  expect_success
+  [[ "$output" == *"boot:"*"hvt_vcpu_init"* ]]
+  [[ "$output" == *"boot:"*"solo5_app_main (guest)"* ]]
+}
+
+@test "trace-boot spt" {
+  spt_run --trace-boot -- test_hello/test_hello.spt Hello_Solo5
+  expect_success
+  [[ "$output" == *"boot:"*"spt_boot_info_init"* ]]
+  [[ "$output" == *"boot:"*"solo5_app_main (guest)"* ]]
+}
+
+@test "syscall_cost hvt" {
+  hvt_run test_syscall_cost/test_syscall_cost.hvt
+  expect_success
+  [[ "$output" == *"solo5_yield: "*" ns/call"* ]]
+}
+
+@test "syscall_cost spt" {
+  spt_run test_syscall_cost/test_syscall_cost.spt
+  expect_success
+  [[ "$output" == *"solo5_yield: "*" ns/call"* ]]
+}
+
+@test "syscall_cost virtio" {
+  virtio_run test_syscall_cost/test_syscall_cost.virtio
+  virtio_expect_success
+  [[ "$output" == *"solo5_set_tls_base: "*" ns/call"* ]]
+}
+
+@test "syscall_cost_net hvt" {
+  [ $(id -u) -ne 0 ] && skip "Need root to run this test, for tap access"
+
+  hvt_run --net:service0=${NET0} -- \
+      test_syscall_cost_net/test_syscall_cost_net.hvt
+  expect_success
+  [[ "$output" == *"solo5_net_read: "*" ns/call"* ]]
+}
+
+@test "syscall_cost_net spt" {
+  [ $(id -u) -ne 0 ] && skip "Need root to run this test, for tap access"
+
+  spt_run --net:service0=${NET0} -- \
+      test_syscall_cost_net/test_syscall_cost_net.spt
+  expect_success
+  [[ "$output" == *"solo5_net_read: "*" ns/call"* ]]
+}
+
+@test "syscall_cost_net virtio" {
+  [ $(id -u) -ne 0 ] && skip "Need root to run this test, for tap access"
+
+  virtio_run -n ${NET0} -- test_syscall_cost_net/test_syscall_cost_net.virtio
+  virtio_expect_success
+  [[ "$output" == *"solo5_net_read: "*" ns/call"* ]]
+}
+
+@test "clock_cost hvt" {
+  hvt_run test_clock_cost/test_clock_cost.hvt
+  expect_success
+  [[ "$output" == *"solo5_clock_monotonic: "*" ps/call"* ]]
+}
+
+@test "clock_cost cpus hvt" {
+  [ "${CONFIG_ARCH}" = "x86_64" ] || skip "not implemented for ${CONFIG_ARCH}"
+  [ "${CONFIG_HOST}" = "Linux" ] || skip "not implemented for ${CONFIG_HOST}"
+
+  hvt_run --cpus=4 -- test_clock_cost/test_clock_cost.hvt
+  expect_success
+  [[ "$output" == *"4 CPUs: solo5_clock_monotonic: "*" ps/call"* ]]
+}
+
+@test "clock_cost spt" {
+  spt_run --cpus=4 -- test_clock_cost/test_clock_cost.spt
+  expect_success
+  [[ "$output" == *"4 CPUs: solo5_clock_monotonic: "*" ps/call"* ]]
+}
+
 @test "quiet hvt" {
   hvt_run -- test_quiet/test_quiet.hvt --solo5:quiet
   expect_success
@@ -259,6 +450,19 @@ virtio_expect_abort() {
   expect_success
 }
 
+@test "cpus hvt" {
+  [ "${CONFIG_ARCH}" = "x86_64" ] || skip "not implemented for ${CONFIG_ARCH}"
+  [ "${CONFIG_HOST}" = "Linux" ] || skip "not implemented for ${CONFIG_HOST}"
+
+  hvt_run --cpus=4 -- test_cpus/test_cpus.hvt
+  expect_success
+}
+
+@test "cpus spt" {
+  spt_run --cpus=4 -- test_cpus/test_cpus.spt
+  expect_success
+}
+
 @test "ssp hvt" {
   hvt_run test_ssp/test_ssp.hvt
   expect_abort
@@ -279,6 +483,16 @@ virtio_expect_abort() {
   expect_success
 }
 
+@test "fpu sve hvt" {
+  [ "${CONFIG_ARCH}" = "aarch64" ] || skip "not implemented for ${CONFIG_ARCH}"
+  [ "${CONFIG_HOST}" = "Linux" ] || skip "not implemented for ${CONFIG_HOST}"
+  grep -qw sve /proc/cpuinfo || skip "host does not support SVE"
+
+  hvt_run --sve -- test_fpu/test_fpu.hvt
+  expect_success
+  [[ "$output" == *"SVE: OK"* ]]
+}
+
 @test "fpu virtio" {
   virtio_run test_fpu/test_fpu.virtio
   virtio_expect_success
@@ -304,6 +518,16 @@ virtio_expect_abort() {
   expect_success
 }
 
+@test "time poll hvt" {
+  hvt_run --poll-us=50 -- test_time/test_time.hvt
+  expect_success
+}
+
+@test "time poll spt" {
+  spt_run --poll-us=50 -- test_time/test_time.spt
+  expect_success
+}
+
 @test "seccomp spt" {
   spt_run test_seccomp/test_seccomp.spt
   [ "$status" -eq 159 ] # SIGSYS
@@ -314,6 +538,58 @@ virtio_expect_abort() {
   expect_success
 }
 
+@test "blk bs=4096 hvt" {
+  hvt_run --block:storage=${DISK},bs=4096 -- test_blk/test_blk.hvt
+  expect_success
+}
+
+@test "blk overlay hvt" {
+  hvt_run --block:storage=${DISK}+${OVERLAY} -- test_blk/test_blk.hvt
+  expect_success
+  # BASE must not have been modified
+  cmp -n $(stat -c %s ${DISK}) ${DISK} /dev/zero
+}
+
+@test "blk nbd hvt" {
+  command -v qemu-nbd >/dev/null || skip "qemu-nbd not installed"
+  SOCKET=${BATS_TMPDIR}/nbd.$$
+  CACHE=${BATS_TMPDIR}/nbd.$$.cache
+
+  qemu-nbd -f raw -t -e 2 -k ${SOCKET} ${DISK} &
+  NBD_PID=$!
+  for i in $(seq 50); do [ -S ${SOCKET} ] && break; sleep 0.1; done
+  hvt_run --block:storage=nbd+unix:///?socket=${SOCKET},conns=2,cache=${CACHE} \
+      -- test_blk/test_blk.hvt
+  kill ${NBD_PID}
+  wait ${NBD_PID} || true
+  rm -f ${SOCKET} ${CACHE}
+  expect_success
+}
+
+@test "blk ram hvt" {
+  if [ "${CONFIG_HOST}" != "Linux" ]; then
+    skip "not supported on ${CONFIG_HOST}"
+  fi
+  hvt_run --block:storage=ram:4M -- test_blk/test_blk.hvt
+  expect_success
+}
+
+@test "blk coalesce hvt" {
+  hvt_run --block-coalesce:storage --block:storage=${DISK} \
+      -- test_blk/test_blk.hvt
+  expect_success
+}
+
+@test "blk map hvt" {
+  if [ "${CONFIG_HOST}" != "Linux" ]; then
+    skip "not supported on ${CONFIG_HOST}"
+  fi
+  printf "Solo5 mapped block device" | \
+    dd of=${DISK} bs=1 seek=4096 conv=notrunc
+  hvt_run --block-map:storage=${DISK} -- test_blk_map/test_blk_map.hvt
+  expect_success
+}
+
 @test "blk virtio" {
   virtio_run -d ${DISK} -- test_blk/test_blk.virtio
   virtio_expect_success
@@ -324,6 +600,52 @@ virtio_expect_abort() {
   expect_success
 }
 
+@test "blk bs=4096 spt" {
+  spt_run --block:storage=${DISK},bs=4096 -- test_blk/test_blk.spt
+  expect_success
+}
+
+@test "blk ram spt" {
+  spt_run --block:storage=ram:4M -- test_blk/test_blk.spt
+  expect_success
+}
+
+@test "blk map spt" {
+  printf "Solo5 mapped block device" | \
+    dd of=${DISK} bs=1 seek=4096 conv=notrunc
+  spt_run --block-map:storage=${DISK} -- test_blk_map/test_blk_map.spt
+  expect_success
+}
+
+@test "blk_bench hvt" {
+  hvt_run --block:storage=${DISK} -- test_blk_bench/test_blk_bench.hvt quick
+  expect_success
+  [[ "$output" == *"rand write 4096 qd32: "*" IOPS"* ]]
+}
+
+@test "blk_bench qos hvt" {
+  [ "${CONFIG_HOST}" != "Linux" ] && skip "not supported on ${CONFIG_HOST}"
+  hvt_run --block-rate:storage=0:1000 --block-prio:storage=idle \
+      --block:storage=${DISK} -- test_blk_bench/test_blk_bench.hvt quick
+  expect_success
+  # Limited to 1000 IOPS, with bursts of 10 ms worth of requests
+  iops=$(echo "$output" | \
+      sed -n 's/.*rand write 4096 qd32: \([0-9]*\) IOPS.*/\1/p')
+  [ -n "${iops}" ] && [ "${iops}" -lt 5000 ]
+}
+
+@test "blk_bench virtio" {
+  virtio_run -d ${DISK} -- test_blk_bench/test_blk_bench.virtio quick
+  virtio_expect_success
+  [[ "$output" == *"rand write 4096 qd32: "*" IOPS"* ]]
+}
+
+@test "blk_bench spt" {
+  spt_run --block:storage=${DISK} -- test_blk_bench/test_blk_bench.spt quick
+  expect_success
+  [[ "$output" == *"rand write 4096 qd32: "*" IOPS"* ]]
+}
+
 @test "net hvt" {
   [ $(id -u) -ne 0 ] && skip "Need root to run this test, for ping -f"
 
@@ -348,6 +670,151 @@ virtio_expect_abort() {
   expect_success
 }
 
+@test "net_batch hvt" {
+  [ $(id -u) -ne 0 ] && skip "Need root to run this test, for ping -f"
+
+  ( sleep 1; ${TIMEOUT} 60s ping -fq -c 100000 ${NET0_IP} ) &
+  hvt_run --net:service0=${NET0} -- test_net/test_net.hvt batch
+  expect_success
+}
+
+@test "net_batch spt" {
+  [ $(id -u) -ne 0 ] && skip "Need root to run this test, for ping -f"
+
+  ( sleep 1; ${TIMEOUT} 60s ping -fq -c 100000 ${NET0_IP} ) &
+  spt_run --net:service0=${NET0} -- test_net/test_net.spt batch
+  expect_success
+}
+
+@test "net_batch uring spt" {
+  [ $(id -u) -ne 0 ] && skip "Need root to run this test, for ping -f"
+
+  ( sleep 1; ${TIMEOUT} 60s ping -fq -c 100000 ${NET0_IP} ) &
+  spt_run --net-uring --net:service0=${NET0} -- test_net/test_net.spt batch
+  expect_success
+}
+
+@test "net_batch io_thread spt" {
+  [ $(id -u) -ne 0 ] && skip "Need root to run this test, for ping -f"
+
+  ( sleep 1; ${TIMEOUT} 60s ping -fq -c 100000 ${NET0_IP} ) &
+  spt_run --io-thread --net:service0=${NET0} -- test_net/test_net.spt batch
+  expect_success
+}
+
+@test "net_offload spt" {
+  [ $(id -u) -ne 0 ] && skip "Need root to run this test, for ping -f"
+
+  ( sleep 1; ${TIMEOUT} 60s ping -fq -c 100000 ${NET0_IP} ) &
+  spt_run --net-offload:service0=${NET0} -- test_net/test_net.spt limit
+  expect_success
+}
+
+@test "net_mtu hvt" {
+  [ $(id -u) -ne 0 ] && skip "Need root to run this test, for ping -f"
+
+  ( sleep 1; ${TIMEOUT} 60s ping -fq -c 100000 ${NET0_IP} ) &
+  hvt_run --net-mtu:service0=9000 --net:service0=${NET0} -- test_net/test_net.hvt limit
+  expect_success
+}
+
+@test "net_mtu spt" {
+  [ $(id -u) -ne 0 ] && skip "Need root to run this test, for ping -f"
+
+  ( sleep 1; ${TIMEOUT} 60s ping -fq -c 100000 ${NET0_IP} ) &
+  spt_run --net-mtu:service0=9000 --net:service0=${NET0} -- test_net/test_net.spt limit
+  expect_success
+}
+
+@test "net_loan hvt" {
+  [ $(id -u) -ne 0 ] && skip "Need root to run this test, for ping -f"
+
+  ( sleep 1; ${TIMEOUT} 60s ping -fq -c 100000 ${NET0_IP} ) &
+  hvt_run --net:service0=${NET0} -- test_net/test_net.hvt zerocopy
+  expect_success
+}
+
+@test "net_loan spt" {
+  [ $(id -u) -ne 0 ] && skip "Need root to run this test, for ping -f"
+
+  ( sleep 1; ${TIMEOUT} 60s ping -fq -c 100000 ${NET0_IP} ) &
+  spt_run --net:service0=${NET0} -- test_net/test_net.spt zerocopy
+  expect_success
+}
+
+@test "net_loan virtio" {
+  [ $(id -u) -ne 0 ] && skip "Need root to run this test, for ping -f"
+
+  ( sleep 3; ${TIMEOUT} 60s ping -fq -c 100000 ${NET0_IP} ) &
+  virtio_run -n ${NET0} -- test_net/test_net.virtio zerocopy
+  virtio_expect_success
+}
+
+@test "net_rings_loan hvt" {
+  [ $(id -u) -ne 0 ] && skip "Need root to run this test, for ping -f"
+
+  ( sleep 1; ${TIMEOUT} 60s ping -fq -c 100000 ${NET0_IP} ) &
+  hvt_run --net-rings --net:service0=${NET0} -- test_net/test_net.hvt zerocopy
+  expect_success
+}
+
+@test "net_rings hvt" {
+  [ $(id -u) -ne 0 ] && skip "Need root to run this test, for ping -f"
+
+  ( sleep 1; ${TIMEOUT} 60s ping -fq -c 100000 ${NET0_IP} ) &
+  hvt_run --net-rings --net:service0=${NET0} -- test_net/test_net.hvt batch
+  expect_success
+}
+
+@test "net_offload hvt" {
+  [ $(id -u) -ne 0 ] && skip "Need root to run this test, for ping -f"
+  [ "${CONFIG_HOST}" != "Linux" ] && skip "not supported on ${CONFIG_HOST}"
+
+  ( sleep 1; ${TIMEOUT} 60s ping -fq -c 100000 ${NET0_IP} ) &
+  hvt_run --net-offload:service0=${NET0} -- test_net/test_net.hvt limit
+  expect_success
+}
+
+@test "net_vhost hvt" {
+  [ $(id -u) -ne 0 ] && skip "Need root to run this test, for ping -f"
+  [ "${CONFIG_HOST}" != "Linux" ] && skip "not supported on ${CONFIG_HOST}"
+  [ -c /dev/vhost-net ] || skip "/dev/vhost-net not present"
+
+  ( sleep 1; ${TIMEOUT} 60s ping -fq -c 100000 ${NET0_IP} ) &
+  hvt_run --net-vhost --net:service0=${NET0} -- test_net/test_net.hvt batch
+  expect_success
+}
+
+@test "net_filter hvt" {
+  [ $(id -u) -ne 0 ] && skip "Need root to run this test, for ping -f"
+  [ "${CONFIG_HOST}" != "Linux" ] && skip "not supported on ${CONFIG_HOST}"
+
+  ( sleep 1; ${TIMEOUT} 60s ping -fq -c 100000 ${NET0_IP} ) &
+  hvt_run --net-filter:service0=mac --net:service0=${NET0} -- \
+      test_net/test_net.hvt limit
+  expect_success
+}
+
+@test "net_rate hvt" {
+  [ $(id -u) -ne 0 ] && skip "Need root to run this test, for ping -f"
+  [ "${CONFIG_HOST}" != "Linux" ] && skip "not supported on ${CONFIG_HOST}"
+
+  ( sleep 1; ${TIMEOUT} 60s ping -fq -c 100000 ${NET0_IP} ) &
+  hvt_run --net-rate:service0=rx:0:20K --net-rate:service0=tx:0:20K \
+      --net:service0=${NET0} -- test_net/test_net.hvt limit
+  expect_success
+}
+
+@test "net_rate io_thread spt" {
+  [ $(id -u) -ne 0 ] && skip "Need root to run this test, for ping -f"
+
+  ( sleep 1; ${TIMEOUT} 60s ping -fq -c 100000 ${NET0_IP} ) &
+  spt_run --io-thread --net-rate:service0=rx:0:20K \
+      --net-rate:service0=tx:0:20K --net:service0=${NET0} -- \
+      test_net/test_net.spt limit
+  expect_success
+}
+
 @test "net_2if hvt" {
   [ $(id -u) -ne 0 ] && skip "Need root to run this test, for ping -f"
   [ "${CONFIG_HOST}" = "OpenBSD" ] && skip "breaks on OpenBSD due to #374"
@@ -369,6 +836,189 @@ virtio_expect_abort() {
   expect_success
 }
 
+@test "net_bench hvt" {
+  [ $(id -u) -ne 0 ] && skip "Need root to run this test, for tap access"
+
+  ( sleep 1; ${TIMEOUT} 50s test_net_bench/bench-net-host ${NET0_IP} 64 ) &
+  hvt_run --net:service0=${NET0} -- test_net_bench/test_net_bench.hvt
+  expect_success
+  [[ "$output" == *"CPU cost: "*" ns/packet"* ]]
+}
+
+@test "net_bench virtio" {
+  [ $(id -u) -ne 0 ] && skip "Need root to run this test, for tap access"
+
+  ( sleep 3; ${TIMEOUT} 50s test_net_bench/bench-net-host ${NET0_IP} 64 ) &
+  virtio_run -n ${NET0} -- test_net_bench/test_net_bench.virtio
+  virtio_expect_success
+  [[ "$output" == *"CPU cost: "*" ns/packet"* ]]
+}
+
+@test "net_bench spt" {
+  [ $(id -u) -ne 0 ] && skip "Need root to run this test, for tap access"
+
+  ( sleep 1; ${TIMEOUT} 50s test_net_bench/bench-net-host ${NET0_IP} 64 ) &
+  spt_run --net:service0=${NET0} -- test_net_bench/test_net_bench.spt
+  expect_success
+  [[ "$output" == *"CPU cost: "*" ns/packet"* ]]
+}
+
+@test "soak hvt" {
+  [ $(id -u) -ne 0 ] && skip "Need root to run this test, for tap access"
+
+  ( ${TIMEOUT} 60s test_soak/soak-host -i 1 ${NET0_IP} 3 ) &
+  hvt_run --net:service0=${NET0} --block:storage=${DISK} -- \
+      test_soak/test_soak.hvt
+  expect_success
+  [[ "$output" == *"Block requests: "*", errors: 0"* ]]
+}
+
+@test "soak spt" {
+  [ $(id -u) -ne 0 ] && skip "Need root to run this test, for tap access"
+
+  ( ${TIMEOUT} 60s test_soak/soak-host -i 1 ${NET0_IP} 3 ) &
+  spt_run --net:service0=${NET0} --block:storage=${DISK} -- \
+      test_soak/test_soak.spt
+  expect_success
+  [[ "$output" == *"Block requests: "*", errors: 0"* ]]
+}
+
+@test "snapshot hvt" {
+  [ "${CONFIG_ARCH}" = "x86_64" ] || skip "not implemented for ${CONFIG_ARCH}"
+  [ "${CONFIG_HOST}" = "Linux" ] || skip "not implemented for ${CONFIG_HOST}"
+  SNAPSHOT=${BATS_TMPDIR}/snapshot.$$
+
+  hvt_run --snapshot=${SNAPSHOT} -- test_snapshot/test_snapshot.hvt
+  [ "$status" -eq 0 ]
+  [ -f ${SNAPSHOT} ]
+
+  hvt_run --restore=${SNAPSHOT} -- test_snapshot/test_snapshot.hvt
+  rm -f ${SNAPSHOT}
+  expect_success
+  [[ "$output" == *"Restored from snapshot"* ]]
+}
+
+@test "snapshot clone hvt" {
+  [ "${CONFIG_ARCH}" = "x86_64" ] || skip "not implemented for ${CONFIG_ARCH}"
+  [ "${CONFIG_HOST}" = "Linux" ] || skip "not implemented for ${CONFIG_HOST}"
+  SNAPSHOT=${BATS_TMPDIR}/snapshot-clone.$$
+
+  hvt_run --snapshot=${SNAPSHOT} -- test_snapshot/test_snapshot.hvt
+  [ "$status" -eq 0 ]
+  # No temporary files are left behind
+  [ -z "$(ls ${SNAPSHOT}.* 2>/dev/null)" ]
+  SUM=$(cksum < ${SNAPSHOT})
+
+  # Restored instances do not modify the snapshot
+  for i in 1 2; do
+    hvt_run --restore=${SNAPSHOT} -- test_snapshot/test_snapshot.hvt
+    expect_success
+  done
+  [ "$(cksum < ${SNAPSHOT})" = "${SUM}" ]
+  rm -f ${SNAPSHOT}
+}
+
+@test "snapshot incremental hvt" {
+  [ "${CONFIG_ARCH}" = "x86_64" ] || skip "not implemented for ${CONFIG_ARCH}"
+  [ "${CONFIG_HOST}" = "Linux" ] || skip "not implemented for ${CONFIG_HOST}"
+  SNAPSHOT=${BATS_TMPDIR}/snapshot-base.$$
+  INCREMENTAL=${BATS_TMPDIR}/snapshot-incremental.$$
+
+  hvt_run --snapshot=${SNAPSHOT} -- test_snapshot/test_snapshot.hvt
+  [ "$status" -eq 0 ]
+  hvt_run --restore=${SNAPSHOT} --snapshot=${INCREMENTAL} -- \
+      test_snapshot/test_snapshot.hvt
+  [ "$status" -eq 0 ]
+  [ -f ${INCREMENTAL} ]
+
+  hvt_run --restore=${INCREMENTAL} -- test_snapshot/test_snapshot.hvt
+  rm -f ${SNAPSHOT} ${INCREMENTAL}
+  expect_success
+  [[ "$output" == *"Restored from incremental snapshot"* ]]
+}
+
+@test "snapshot not requested hvt" {
+  hvt_run test_snapshot/test_snapshot.hvt
+  expect_success
+}
+
+@test "migrate hvt" {
+  [ "${CONFIG_ARCH}" = "x86_64" ] || skip "not implemented for ${CONFIG_ARCH}"
+  [ "${CONFIG_HOST}" = "Linux" ] || skip "not implemented for ${CONFIG_HOST}"
+  SOCKET=${BATS_TMPDIR}/migrate.$$
+
+  ${TIMEOUT} --foreground 60s ${HVT_TENDER} --incoming=unix:${SOCKET} -- \
+      test_migrate/test_migrate.hvt > ${SOCKET}.out 2>&1 &
+  INCOMING=$!
+  ${HVT_TENDER} --migrate-to=unix:${SOCKET} -- \
+      test_migrate/test_migrate.hvt > ${SOCKET}.src 2>&1 &
+  SOURCE=$!
+  sleep 1
+  kill -USR1 ${SOURCE}
+  wait ${SOURCE}
+  SOURCE_STATUS=$?
+  wait ${INCOMING}
+  status=$?
+  output="$(cat ${SOCKET}.src ${SOCKET}.out)"
+  rm -f ${SOCKET}.src ${SOCKET}.out
+  [ "${SOURCE_STATUS}" -eq 0 ]
+  [[ "$output" == *"Migrated guest"* ]]
+  expect_success
+}
+
+@test "mem_release hvt" {
+  hvt_run test_mem_release/test_mem_release.hvt
+  expect_success
+}
+
+@test "mem_release virtio" {
+  virtio_run test_mem_release/test_mem_release.virtio
+  virtio_expect_success
+}
+
+@test "mem_release spt" {
+  spt_run test_mem_release/test_mem_release.spt
+  expect_success
+}
+
+@test "alloc hvt" {
+  hvt_run test_alloc/test_alloc.hvt
+  expect_success
+}
+
+@test "alloc virtio" {
+  virtio_run test_alloc/test_alloc.virtio
+  virtio_expect_success
+}
+
+@test "alloc spt" {
+  spt_run test_alloc/test_alloc.spt
+  expect_success
+}
+
+@test "loop hvt" {
+  hvt_run test_loop/test_loop.hvt
+  expect_success
+}
+
+@test "loop virtio" {
+  virtio_run test_loop/test_loop.virtio
+  virtio_expect_success
+}
+
+@test "loop spt" {
+  spt_run test_loop/test_loop.spt
+  expect_success
+}
+
+@test "mem_release request hvt" {
+  [ "${CONFIG_HOST}" = "Linux" ] || skip "not implemented for ${CONFIG_HOST}"
+  ( sleep 1; pkill -USR2 -x solo5-hvt ) &
+  hvt_run test_mem_release/test_mem_release.hvt request
+  expect_success
+  [[ "$output" == *"Released memory on request"* ]]
+}
+
 @test "dumpcore hvt" {
   [ "${CONFIG_ARCH}" = "x86_64" ] || skip "not implemented for ${CONFIG_ARCH}"
   case "${CONFIG_HOST}" in
@@ -384,4 +1034,18 @@ virtio_expect_abort() {
   [ "$status" -eq 255 ]
   CORE=`echo "$output" | grep -o "core\.solo5-hvt\.[0-9]*$"`
   [ -f "$BATS_TMPDIR"/"$CORE" ]
+  [[ "$output" == *"zero pages skipped"* ]]
+}
+
+@test "dumpcore live hvt" {
+  [ "${CONFIG_ARCH}" = "x86_64" ] || skip "not implemented for ${CONFIG_ARCH}"
+  [ "${CONFIG_HOST}" = "Linux" ] || skip "not implemented for ${CONFIG_HOST}"
+
+  ( sleep 1; pkill -QUIT -x solo5-hvt-debug ) &
+  run ${TIMEOUT} --foreground 60s ${HVT_TENDER_DEBUG} \
+     --dumpcore="$BATS_TMPDIR" test_migrate/test_migrate.hvt
+  expect_success
+  CORE=`echo "$output" | grep -o "core\.solo5-hvt\.[0-9]*\.0"`
+  [ -f "$BATS_TMPDIR"/"$CORE" ]
+  rm -f "$BATS_TMPDIR"/"$CORE"
 }